@@ -80,12 +80,17 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->lastTime = time(NULL);
 
     // 初始化时间事件结构
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEvents = NULL;
+    eventLoop->timeEventsCount = 0;
+    eventLoop->timeEventsSize = 0;
+    eventLoop->timeEventsDone = NULL;
     eventLoop->timeEventNextId = 0;
 
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    eventLoop->aftersleep = NULL;
+    eventLoop->dontwait = 0;
     if (aeApiCreate(eventLoop) == -1) goto err; // 创建实际干活的 epoll-instance
 
     /* Events with mask == AE_NONE are not set. So let's initialize the
@@ -155,6 +160,7 @@ void aeDeleteEventLoop(aeEventLoop *eventLoop) {
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+    zfree(eventLoop->timeEvents);
     zfree(eventLoop);
 }
 
@@ -286,6 +292,81 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* ----------------------------- Time events heap ---------------------------
+ *
+ * The time events are kept in a binary min-heap ordered by fire time, so
+ * that the nearest timer is always eventLoop->timeEvents[0]: creating a
+ * timer and rescheduling or removing the one that fired is O(log(N)), and
+ * the lookup done before every poll is O(1).
+ *
+ * 时间事件保存在以触发时间排序的最小堆中：
+ * 插入、重新调度都是 O(log(N))，查找最近的时间事件是 O(1) */
+
+/* Return true if time event 'a' fires before 'b'. */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+/* Store 'te' at position 'idx' of the heap, updating its index. */
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEvents[idx] = te;
+    te->heapIndex = idx;
+}
+
+/* Move the event at position 'idx' up or down until the heap property
+ * holds again. */
+static void aeTimeHeapFix(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEvents;
+    aeTimeEvent *te = heap[idx];
+
+    // 上浮
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+
+        if (!aeTimeEventBefore(te,heap[parent])) break;
+        aeTimeHeapSet(eventLoop,idx,heap[parent]);
+        idx = parent;
+    }
+
+    // 下沉
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= eventLoop->timeEventsCount) break;
+        if (child+1 < eventLoop->timeEventsCount &&
+            aeTimeEventBefore(heap[child+1],heap[child])) child++;
+        if (!aeTimeEventBefore(heap[child],te)) break;
+        aeTimeHeapSet(eventLoop,idx,heap[child]);
+        idx = child;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+/* Add 'te' to the heap. */
+static void aeTimeHeapPush(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventsCount == eventLoop->timeEventsSize) {
+        eventLoop->timeEventsSize = eventLoop->timeEventsSize ?
+                                    eventLoop->timeEventsSize*2 : 16;
+        eventLoop->timeEvents = zrealloc(eventLoop->timeEvents,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventsSize);
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventsCount++,te);
+    aeTimeHeapFix(eventLoop,te->heapIndex);
+}
+
+/* Remove 'te' from the heap, without freeing it. */
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapIndex;
+    aeTimeEvent *last = eventLoop->timeEvents[--eventLoop->timeEventsCount];
+
+    te->heapIndex = -1;
+    if (last != te) {
+        aeTimeHeapSet(eventLoop,idx,last);
+        aeTimeHeapFix(eventLoop,idx);
+    }
+}
+
 /*
  * 创建时间事件
  * 并不会为每一个 key 都做一个 time_event 来进行过期处理，而是通过惰性删除的方式完成过期处理
@@ -314,32 +395,42 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->finalizerProc = finalizerProc;
     // 设置私有数据
     te->clientData = clientData;
+    te->next = NULL;
 
-    // 将新事件放入表头
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    // 将新事件放入堆中
+    aeTimeHeapPush(eventLoop,te);
 
     return id;
 }
 
 /*
  * 删除给定 id 的时间事件
+ *
+ * Finding the event by ID is O(N), but timers are rarely deleted: most of
+ * them are removed returning AE_NOMORE from their handler, that is
+ * O(log(N)).
  */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
+    aeTimeEvent *te;
+    int j;
+
+    /* The events already taken out of the heap by processTimeEvents() are
+     * just flagged: they are freed when all the due events were processed. */
+    // 本轮已经移出堆（比如正在执行）的事件，只做标记，由 processTimeEvents() 负责释放
+    for (te = eventLoop->timeEventsDone; te; te = te->next) {
+        if (te->id == id) {
+            te->id = AE_DELETED_EVENT_ID;
+            return AE_OK;
+        }
+    }
 
-    // 遍历链表（因为是遍历链表的关系，不宜过多定时事件）
-    te = eventLoop->timeEventHead;
-    while(te) {
+    for (j = 0; j < eventLoop->timeEventsCount; j++) {
+        te = eventLoop->timeEvents[j];
 
         // 发现目标事件，删除
         if (te->id == id) {
-
-            if (prev == NULL)   // 删除的是头节点
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
+            aeTimeHeapRemove(eventLoop,te);
 
             // 执行清理处理器
             if (te->finalizerProc)
@@ -350,8 +441,6 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 
             return AE_OK;
         }
-        prev = te;
-        te = te->next;
     }
 
     return AE_ERR; /* NO event with the specified ID found */
@@ -362,36 +451,24 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
+ * The events are kept in a min-heap, so this is O(1).
  */
-// 寻找里目前时间最近的时间事件
-// 因为链表是乱序的，所以查找复杂度为 O（N）
+// 寻找里目前时间最近的时间事件：就是堆顶
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;   // 这时候其实可以直接 break 出去的，而不是用 if(!nearest) 来走完所有的 while-loop
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timeEventsCount ? eventLoop->timeEvents[0] : NULL;
 }
 
 /* Process time events
  *
  * 处理所有已到达的时间事件
- * Note that this is NOT great algorithmically. Redis uses a single time event so it's not a problem
+ *
+ * Every event fires at most once per call: the events already processed,
+ * and the ones created by the handlers, are kept out of the heap until all
+ * the due events were processed, so that handlers can't loop forever.
  */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
+    int processed = 0, j;
     aeTimeEvent *te;
     long long maxId;
     time_t now = time(NULL);
@@ -406,73 +483,67 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * indefinitely, and practice suggests it is. */
     // 通过重置事件的运行时间，
     // 防止因时间穿插（skew）而造成的事件处理混乱
+    // 所有事件的触发时间都相同，堆依然是合法的
     if (now < eventLoop->lastTime) {
         // 现在的时间，再上一次触发 timer-event 之前，显然 system clock 被改动过
-        te = eventLoop->timeEventHead;
-        while(te) {
+        for (j = 0; j < eventLoop->timeEventsCount; j++) {
+            te = eventLoop->timeEvents[j];
             te->when_sec = 0;   // 将所有 timer-event 全部都立马触发一次，以更新所有时间的触发时间点
-            te = te->next;
+            te->when_ms = 0;
         }
     }
     // 更新最后一次处理时间事件的时间
     eventLoop->lastTime = now;
 
-    // 遍历链表
-    // 执行那些已经到达的事件
-    te = eventLoop->timeEventHead;
+    // 从堆顶开始，执行那些已经到达的事件
     maxId = eventLoop->timeEventNextId-1;
-    while(te) {
+    while(eventLoop->timeEventsCount) {
         long now_sec, now_ms;
         long long id;
+        int retval;
+
+        te = eventLoop->timeEvents[0];
 
-        // 跳过无效事件
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        
         // 获取当前时间(因为 while-loop 的时间可能比较长，所以每一次都要更新)
         aeGetTime(&now_sec, &now_ms);
 
-        // 如果当前时间等于或等于事件的执行时间，那么说明事件已到达，执行这个事件
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
+        // 堆顶的事件还没有到达，其他事件更不会到达
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
 
-            id = te->id;
-            // 执行事件处理的 callback，并获取返回值
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            /* After an event is processed our time event list may
-             * no longer be the same, so we restart from head.
-             * Still we make sure to don't process events registered
-             * by event handlers itself in order to don't loop forever.
-             * To do so we saved the max ID we want to handle.
-             *
-             * FUTURE OPTIMIZATIONS:
-             * Note that this is NOT great algorithmically. Redis uses
-             * a single time event so it's not a problem but the right
-             * way to do this is to add the new elements on head, and
-             * to flag deleted elements in a special way for later
-             * deletion (putting references to the nodes to delete into
-             * another linked list). */
-
-            // 记录是否有需要循环执行这个事件时间
-            if (retval != AE_NOMORE) {
-                // 是的， retval 毫秒之后继续执行这个时间事件
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                // 不，将这个事件删除
-                aeDeleteTimeEvent(eventLoop, id);
-            }
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = eventLoop->timeEventsDone;
+        eventLoop->timeEventsDone = te;
+
+        // 跳过本轮中新创建的事件，留待下一轮
+        if (te->id > maxId) continue;
+
+        // 执行事件处理的 callback，并获取返回值
+        id = te->id;
+        retval = te->timeProc(eventLoop, id, te->clientData);
+        processed++;
+
+        // 记录是否有需要循环执行这个事件时间
+        if (retval != AE_NOMORE && te->id != AE_DELETED_EVENT_ID) {
+            // 是的， retval 毫秒之后继续执行这个时间事件
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+        } else {
+            // 不，将这个事件删除
+            te->id = AE_DELETED_EVENT_ID;
+        }
+    }
 
-            // 因为执行事件之后，事件列表可能已经被改变了
-            // 因此需要将 te 放回表头，继续开始执行事件
-            te = eventLoop->timeEventHead;
+    /* Put back in the heap the events that are still alive. */
+    while(eventLoop->timeEventsDone) {
+        te = eventLoop->timeEventsDone;
+        eventLoop->timeEventsDone = te->next;
+        te->next = NULL;
+        if (te->id == AE_DELETED_EVENT_ID) {
+            if (te->finalizerProc)
+                te->finalizerProc(eventLoop, te->clientData);
+            zfree(te);
         } else {
-            // 时间还没有到达，等等再说
-            te = te->next;
+            aeTimeHeapPush(eventLoop,te);
         }
     }
     return processed;
@@ -540,18 +611,22 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             // 并将该时间距保存在 tv 结构中
             aeGetTime(&now_sec, &now_ms);
             tvp = &tv;
-            tvp->tv_sec = shortest->when_sec - now_sec;
-            if (shortest->when_ms < now_ms) {
-                tvp->tv_usec = ((shortest->when_ms+1000) - now_ms)*1000;
-                tvp->tv_sec --;
-            } else {
-                tvp->tv_usec = (shortest->when_ms - now_ms)*1000;
-            }
 
+            /* Compute the difference in milliseconds first: splitting it
+             * in seconds and milliseconds before checking the sign could
+             * make us sleep for up to a second for a timer already due. */
             // 时间差小于 0 ，说明有 timer-event 事件已经可以执行了，将秒和毫秒设为 0 （不阻塞）
             // 避免过度耽误 timer-event
-            if (tvp->tv_sec < 0) tvp->tv_sec = 0;
-            if (tvp->tv_usec < 0) tvp->tv_usec = 0;
+            long long ms = (shortest->when_sec - now_sec)*1000LL +
+                           shortest->when_ms - now_ms;
+
+            if (ms > 0) {
+                tvp->tv_sec = ms/1000;
+                tvp->tv_usec = (ms % 1000)*1000;
+            } else {
+                tvp->tv_sec = 0;
+                tvp->tv_usec = 0;
+            }
         } else {
             
             // 执行到这一步，说明没有时间事件
@@ -571,8 +646,20 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
         }
 
+        /* The beforesleep callback may know there is already work to do
+         * without any file event, see aeSetDontWait(). */
+        if (eventLoop->dontwait) {
+            tv.tv_sec = tv.tv_usec = 0;
+            tvp = &tv;
+        }
+
         // 处理文件事件，阻塞时间由 tvp 决定
         numevents = aeApiPoll(eventLoop, tvp);
+
+        /* After sleep callback. */
+        if (eventLoop->aftersleep != NULL && flags & AE_CALL_AFTER_SLEEP)
+            eventLoop->aftersleep(eventLoop);
+
         for (j = 0; j < numevents; j++) {
             // 从已就绪数组中获取事件
             aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
@@ -647,7 +734,7 @@ void aeMain(aeEventLoop *eventLoop) {
             eventLoop->beforesleep(eventLoop);
 
         // 开始处理事件
-        aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+        aeProcessEvents(eventLoop, AE_ALL_EVENTS|AE_CALL_AFTER_SLEEP);
     }
 }
 
@@ -664,3 +751,21 @@ char *aeGetApiName(void) {
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+/*
+ * 设置 poll 返回之后需要被执行的函数
+ */
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
+    eventLoop->aftersleep = aftersleep;
+}
+
+/*
+ * 设置下一次 poll 是否不阻塞，通常由 beforesleep 函数调用
+ *
+ * If 'noWait' is true the next calls to aeProcessEvents() poll the file
+ * events without blocking, as with AE_DONT_WAIT, until it is set again to
+ * false. Used when there is work that is not signaled by a file event.
+ */
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait) {
+    eventLoop->dontwait = noWait;
+}
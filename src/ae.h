@@ -62,11 +62,14 @@
 #define AE_ALL_EVENTS (AE_FILE_EVENTS|AE_TIME_EVENTS)
 // 不阻塞，也不进行等待（控制 epoll 系统调用是由阻塞等待）
 #define AE_DONT_WAIT 4
+// 在 poll 返回之后调用 aftersleep 函数
+#define AE_CALL_AFTER_SLEEP 8
 
 /*
  * 决定时间事件是否要持续执行的 flag
  */
 #define AE_NOMORE -1
+#define AE_DELETED_EVENT_ID -1
 
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
@@ -132,7 +135,10 @@ typedef struct aeTimeEvent {
     // 多路复用库的私有数据
     void *clientData;
 
-    // 指向下个时间事件结构，形成链表
+    // 在时间事件最小堆中的位置，不在堆中时为 -1
+    int heapIndex; /* position in eventLoop->timeEvents, -1 if not there. */
+
+    // 处理时间事件时，用来串起本轮已经移出堆的事件
     struct aeTimeEvent *next;
 
 } aeTimeEvent;
@@ -185,9 +191,14 @@ typedef struct aeEventLoop {
     // epoll_wait 返回的已就绪事件，从这个返回给上层调用（统一返回就绪事件的 fd + mask，表明那个 fd 的什么事件就绪了）
     aeFiredEvent *fired; /* Fired events */
 
-    // 时间事件(挂载为单向链表，不会进行排序处理)
+    // 时间事件(按触发时间组织成最小堆，堆顶就是最近的时间事件)
     // redis 对于 timer 处理的事件，并没有很严格的精确计时要求，所以并不会将 TIMEOUT_EVENT 注册进 epoll-instance 里面
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEvents; /* Min-heap of the time events, by fire time. */
+    int timeEventsCount;
+    int timeEventsSize;
+
+    // 本轮 processTimeEvents() 已经移出堆的时间事件（包括正在执行的）
+    aeTimeEvent *timeEventsDone;
 
     // 事件处理器的开关
     int stop;
@@ -202,6 +213,12 @@ typedef struct aeEventLoop {
     // 在处理事件前要执行的函数
     aeBeforeSleepProc *beforesleep;
 
+    // 在 poll 返回之后、处理事件前要执行的函数
+    aeBeforeSleepProc *aftersleep;
+
+    // 为真时 poll 不阻塞，见 aeSetDontWait()
+    int dontwait;
+
 } aeEventLoop;
 
 /* Prototypes */
@@ -221,6 +238,8 @@ int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
@@ -65,202 +65,420 @@
  * 过程：
  * 1) 手动、自动触发 AOF-rewrite
  * 2) 主线程主动创建子线程（heap 是共享的，子线程 read-olny），根据当前内存情况，构建 AOF-rewrite 文件
- * 3) 当子线程开始进行 AOF rewrite 的时候，父线程依旧处理新的 CMD，并进行 AOF 持久化，同时保存到 aof-rewrite-buf 里面；
+ * 3) fork 之前父进程打开一个新的 INCR 文件，之后的 CMD 都追加到这个文件里面，不再需要 aof-rewrite-buf
  * 4) 当子线程完成了 AOF rewrite 之后，通知父线程，并退出
- * 5) 父线程完成最后的收尾工作，将 AOF-rewrite-buf 里面的数据放入新的 AOF 文件中（同步，阻塞父线程）
- * 6) 如此一来，AOF 文件就完整了
+ * 5) 父线程把子进程生成的文件改名为新的 BASE 文件，并写入新的 manifest（只记录新 BASE 以及最后一个 INCR）
+ * 6) 如此一来，旧的 BASE 和 INCR 文件就可以在后台删除了
  */
 
-void aofUpdateCurrentSize(void);
-
 /* ----------------------------------------------------------------------------
- * AOF rewrite buffer implementation.
+ * AOF manifest implementation.
  *
- * AOF 重写缓存的实现。
+ * AOF manifest 的实现。
  *
- * The following code implement a simple buffer used in order to accumulate
- * changes while the background process is rewriting the AOF file.
+ * The AOF is split in multiple files living in server.aof_dirname: a BASE
+ * file, written by the last rewrite (in RDB format when the RDB preamble is
+ * enabled), and the INCR files the server appends the commands to. A new
+ * INCR file is opened every time a rewrite starts, so the parent no longer
+ * has to accumulate the commands received during the rewrite: once the
+ * child is done, the new BASE replaces the old BASE and all the INCR files
+ * but the last one.
  *
- * 以下代码实现了一个简单的缓存，
- * 它可以在 BGREWRITEAOF 执行的过程中，累积所有修改数据集的命令。
+ * AOF 被分成多个文件：最后一次重写产生的 BASE 文件，以及服务器追加命令的 INCR 文件。
+ * 每次开始重写时都会打开一个新的 INCR 文件，所以父进程不再需要累积重写期间收到的命令，
+ * 重写完成之后，新的 BASE 文件替换掉旧的 BASE 以及除最后一个以外的所有 INCR 文件。
  *
- * We only need to append, but can't just use realloc with a large block
- * because 'huge' reallocs are not always handled as one could expect
- * (via remapping of pages at OS level) but may involve copying data.
+ * The manifest lists the files in the order they must be loaded, one per
+ * line, for instance:
  *
- * For this reason we use a list of blocks, every block is
- * AOF_RW_BUF_BLOCK_SIZE bytes.
+ *   file appendonly.aof.2.base.rdb seq 2 type b
+ *   file appendonly.aof.5.incr.aof seq 5 type i
  *
- * 程序需要不断对这个缓存执行 append 操作，
- * 因为分配一个非常大的空间并不总是可能的，
- * 也可能产生大量的复制工作，
- * 所以这里使用多个大小为 AOF_RW_BUF_BLOCK_SIZE 的空间来保存命令。
+ * It is always replaced atomically (written to a temp file then renamed),
+ * so writing the manifest is what switches from a set of files to another.
  *
+ * manifest 总是原子地替换（先写临时文件再改名），所以写入 manifest 就是切换文件的时刻
  * ------------------------------------------------------------------------- */
 
-// 每个缓存块的大小
-#define AOF_RW_BUF_BLOCK_SIZE (1024*1024*10)    /* 10 MB per block */
+#define AOF_MANIFEST_KEY_FILE_NAME "file"
+#define AOF_MANIFEST_KEY_FILE_SEQ "seq"
+#define AOF_MANIFEST_KEY_FILE_TYPE "type"
 
-typedef struct aofrwblock {
-    
-    // 缓存块已使用字节数和可用字节数
-    unsigned long used, free;
+static aofInfo *aofInfoCreate(void) {
+    return zcalloc(sizeof(aofInfo));
+}
+
+/* Free an aofInfo, it is the free method of the INCR files list. */
+static void aofInfoFree(void *item) {
+    aofInfo *ai = item;
 
-    // 缓存块
-    char buf[AOF_RW_BUF_BLOCK_SIZE];
+    sdsfree(ai->file_name);
+    zfree(ai);
+}
 
-} aofrwblock;
+static void *aofInfoDup(void *item) {
+    aofInfo *orig = item, *ai = aofInfoCreate();
 
-/* This function free the old AOF rewrite buffer if needed, and initialize
- * a fresh new one. It tests for server.aof_rewrite_buf_blocks equal to NULL
- * so can be used for the first initialization as well. 
- *
- * 释放旧的 AOF 重写缓存，并初始化一个新的 AOF 缓存。
- *
- * 这个函数也可以单纯地用于 AOF 重写缓存的初始化。
- */
-void aofRewriteBufferReset(void) {
+    ai->file_name = sdsdup(orig->file_name);
+    ai->file_seq = orig->file_seq;
+    ai->file_type = orig->file_type;
+    return ai;
+}
 
-    // 释放旧有的缓存（链表）
-    if (server.aof_rewrite_buf_blocks)
-        listRelease(server.aof_rewrite_buf_blocks);
+static aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zcalloc(sizeof(aofManifest));
 
-    // 初始化新的缓存（链表）
-    server.aof_rewrite_buf_blocks = listCreate();
-    listSetFreeMethod(server.aof_rewrite_buf_blocks,zfree);
+    am->incr_aof_list = listCreate();
+    listSetFreeMethod(am->incr_aof_list,aofInfoFree);
+    listSetDupMethod(am->incr_aof_list,aofInfoDup);
+    return am;
 }
 
-/* Return the current size of the AOF rerwite buffer. 
- *
- * 返回 AOF 重写缓存当前的大小
- */
-unsigned long aofRewriteBufferSize(void) {
+static void aofManifestFree(aofManifest *am) {
+    if (am->base_aof_info) aofInfoFree(am->base_aof_info);
+    listRelease(am->incr_aof_list);
+    zfree(am);
+}
+
+/* Changes are always done to a copy of the manifest, that replaces the
+ * current one only once it was persisted. */
+static aofManifest *aofManifestDup(aofManifest *orig) {
+    aofManifest *am = zcalloc(sizeof(aofManifest));
+
+    am->base_aof_info = orig->base_aof_info ?
+                        aofInfoDup(orig->base_aof_info) : NULL;
+    am->incr_aof_list = listDup(orig->incr_aof_list);
+    redisAssert(am->incr_aof_list != NULL);
+    am->curr_base_file_seq = orig->curr_base_file_seq;
+    am->curr_incr_file_seq = orig->curr_incr_file_seq;
+    return am;
+}
+
+/* Append to 's' the manifest line describing 'ai'. */
+static sds aofInfoFormat(sds s, aofInfo *ai) {
+    return sdscatprintf(s,"%s %s %s %lld %s %c\n",
+        AOF_MANIFEST_KEY_FILE_NAME, ai->file_name,
+        AOF_MANIFEST_KEY_FILE_SEQ, ai->file_seq,
+        AOF_MANIFEST_KEY_FILE_TYPE, ai->file_type);
+}
 
-    // 取出链表中最后的缓存块
-    listNode *ln = listLast(server.aof_rewrite_buf_blocks);
-    aofrwblock *block = ln ? ln->value : NULL;
+static sds getAofManifestAsString(aofManifest *am) {
+    sds buf = sdsempty();
+    listNode *ln;
+    listIter li;
+
+    if (am->base_aof_info) buf = aofInfoFormat(buf,am->base_aof_info);
+    listRewind(am->incr_aof_list,&li);
+    while ((ln = listNext(&li)) != NULL)
+        buf = aofInfoFormat(buf,listNodeValue(ln));
+    return buf;
+}
+
+/* The files are named after appendfilename:
+ *
+ *   <appendfilename>.<seq>.base.<rdb|aof>   BASE files
+ *   <appendfilename>.<seq>.incr.aof         INCR files
+ *   <appendfilename>.manifest               the manifest */
+static sds getAofManifestFileName(void) {
+    return sdscatprintf(sdsempty(),"%s.manifest",server.aof_filename);
+}
 
-    // 没有缓存被使用
-    if (block == NULL) return 0;
+static sds getTempAofManifestFileName(void) {
+    return sdscatprintf(sdsempty(),"temp-%s.manifest",server.aof_filename);
+}
 
-    // 总缓存大小 = （缓存块数量-1） * AOF_RW_BUF_BLOCK_SIZE + 最后一个缓存块的大小
-    unsigned long size =
-        (listLength(server.aof_rewrite_buf_blocks)-1) * AOF_RW_BUF_BLOCK_SIZE;
-    size += block->used;
+/* Return the size of the AOF file 'filename', or 0 if it can't be stat-ed. */
+static off_t getAppendOnlyFileSize(sds filename) {
+    sds path = makePath(server.aof_dirname,filename);
+    struct redis_stat sb;
+    off_t size = 0;
 
+    if (redis_stat(path,&sb) == -1) {
+        redisLog(REDIS_WARNING,"Unable to obtain the length of the AOF file %s. stat: %s",
+            path, strerror(errno));
+    } else {
+        size = sb.st_size;
+    }
+    sdsfree(path);
     return size;
 }
 
-/* Append data(uchar *s) to the AOF rewrite buffer, allocating new blocks if needed. */
-void aofRewriteBufferAppend(unsigned char *s, unsigned long len) {
-
-    // 指向最后一个缓存块（当作单向队列来用）
-    listNode *ln = listLast(server.aof_rewrite_buf_blocks);
-    aofrwblock *block = ln ? ln->value : NULL;
-
-    // 死循环写入，不写完誓不罢休！
-    // FIXME:(DONE) 要是内存没有办法顺利分配下来，问题将会很麻烦，这会长时间循环尝试，没有任何跳出方案
-    // 即使是最新版也没有 handle 这个问题，估计是采用 REDIS_WARNING log 的方案来进行 handle
-    // 再加上 jmalloc 等更优秀的 allocater，基本上这个问题就相当难触发了
-    //（内存型数据库，没有了内存，基本是完蛋的；这里额外再加没有内存、内存分配失败的 handle 没啥意义）
-    // 努力优化内存的利用率，性价比来得更高
-    while(len) {
-        /* If we already got at least an allocated block, try appending
-         * at least some piece into it. 
-         *
-         * 如果已经有至少一个缓存块，那么尝试将内容追加到这个缓存块里面
-         */
-        if (block) {
-            unsigned long thislen = (block->free < len) ? block->free : len;
-            if (thislen) {  /* The current block is not already full. */
-                /* 进入这个 if-branch 将会有两种情况，但是无论是那种，都会尽可能填满当前这块 buf
-                 * 1. 当前这个 block 的 buf 并不足以容纳所有的 AOF-data
-                 *    为了充分利用这一块 buf，会尽可能地写入，直到写完 buf[AOF_RW_BUF_BLOCK_SIZE]
-                 *    剩下的 AOF-data，待会 malloc 之后，写入新的 buf 中
-                 * 2. 当前这个 block 的 buf 能够装完全部内容，直接写入全部 AOF-data，len 将会为 0
-                 */
-                memcpy(block->buf+block->used, s, thislen);
-                block->used += thislen;
-                block->free -= thislen;
-                s += thislen;
-                len -= thislen; // AOF-data 还剩下多少内容没有写进 buf 里面去
-            }
-        }
+/* Load the manifest at 'path'. Errors are fatal, like the errors loading
+ * the AOF itself. */
+static aofManifest *aofLoadManifestFromFile(sds path) {
+    aofManifest *am = aofManifestCreate();
+    char buf[REDIS_CONFIGLINE_MAX+1];
+    const char *err = NULL;
+    int linenum = 0;
+    FILE *fp;
 
-        /* First block to allocate, or need another block. */
-        /* 同样，这个 if-branch 也有两种可能：
-         * 1. block != NULL ，那么这里是创建另一个缓存块买容纳 block 装不下的内容
-         * 2. block == NULL ，那么这里是创建缓存链表的第一个缓存块
-         */
-        if (len) { /* First block to allocate, or need another block. */
-            int numblocks;
+    if ((fp = fopen(path,"r")) == NULL) {
+        redisLog(REDIS_WARNING,"Fatal error: can't open the AOF manifest %s for reading: %s",
+            path, strerror(errno));
+        exit(1);
+    }
+
+    while (fgets(buf,sizeof(buf),fp) != NULL) {
+        sds line, *argv;
+        int argc, j;
+        aofInfo *ai;
 
-            // 分配缓存块
-            block = zmalloc(sizeof(*block));
-            block->free = AOF_RW_BUF_BLOCK_SIZE;
-            block->used = 0;
+        linenum++;
+        line = sdstrim(sdsnew(buf)," \t\r\n");
+        if (line[0] == '#' || line[0] == '\0') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        sdsfree(line);
+        if (argv == NULL || argc < 6 || argc % 2) {
+            err = "Invalid line format";
+            goto loaderr;
+        }
 
-            // 链接到链表末尾
-            listAddNodeTail(server.aof_rewrite_buf_blocks,block);
+        // 每一行都是 key value 对，不认识的 key 直接忽略
+        ai = aofInfoCreate();
+        for (j = 0; j < argc; j += 2) {
+            if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_NAME)) {
+                sdsfree(ai->file_name);
+                ai->file_name = sdsdup(argv[j+1]);
+            } else if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_SEQ)) {
+                ai->file_seq = strtoll(argv[j+1],NULL,10);
+            } else if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_TYPE)) {
+                ai->file_type = argv[j+1][0];
+            }
+        }
+        sdsfreesplitres(argv,argc);
 
-            /* Log every time we cross more 10 or 100 blocks, respectively
-             * as a notice or warning. 
-             *
-             * 每次创建 10 个缓存块就打印一个日志，用作标记或者提醒
-             */
-            numblocks = listLength(server.aof_rewrite_buf_blocks);
-            if (((numblocks+1) % 10) == 0) {
-                int level = ((numblocks+1) % 100) == 0 ? REDIS_WARNING :
-                                                         REDIS_NOTICE;
-                redisLog(level,"Background AOF buffer size: %lu MB",
-                    aofRewriteBufferSize()/(1024*1024));
+        if (ai->file_name == NULL || ai->file_seq <= 0 || ai->file_type == 0) {
+            err = "Missing file name, sequence or type";
+            goto loaderr;
+        }
+        if (!pathIsBaseName(ai->file_name)) {
+            err = "File names can't be paths";
+            goto loaderr;
+        }
+        if (ai->file_type == REDIS_AOF_FILE_TYPE_BASE) {
+            if (am->base_aof_info) {
+                err = "Found more than one BASE file";
+                goto loaderr;
             }
+            am->base_aof_info = ai;
+            am->curr_base_file_seq = ai->file_seq;
+        } else if (ai->file_type == REDIS_AOF_FILE_TYPE_INCR) {
+            if (ai->file_seq <= am->curr_incr_file_seq) {
+                err = "INCR files sequence is not increasing";
+                goto loaderr;
+            }
+            listAddNodeTail(am->incr_aof_list,ai);
+            am->curr_incr_file_seq = ai->file_seq;
+        } else {
+            err = "Unknown file type";
+            goto loaderr;
         }
     }
+    if (ferror(fp)) {
+        err = strerror(errno);
+        goto loaderr;
+    }
+    fclose(fp);
+    return am;
+
+loaderr:
+    redisLog(REDIS_WARNING,"Bad AOF manifest %s at line %d: %s",
+        path, linenum, err);
+    exit(1);
 }
 
-/* Write the buffer (possibly composed of multiple blocks) into the specified
- * fd. If a short write or any other error happens -1 is returned,
- * otherwise the number of bytes written is returned. 
- *
- * 将重写缓存中的所有内容（可能由多个块组成）写入到给定 fd 中。
+/* Write the manifest 'am' on disk, atomically replacing the old one.
+ * Returns REDIS_OK on success, REDIS_ERR on error. */
+static int persistAofManifest(aofManifest *am) {
+    sds name = getAofManifestFileName(), tmpname = getTempAofManifestFileName();
+    sds path = makePath(server.aof_dirname,name);
+    sds tmppath = makePath(server.aof_dirname,tmpname);
+    sds buf = getAofManifestAsString(am);
+    int fd = -1, retval = REDIS_ERR;
+
+    if (dirCreateIfMissing(server.aof_dirname) == -1) {
+        redisLog(REDIS_WARNING,"Can't create the AOF directory %s: %s",
+            server.aof_dirname, strerror(errno));
+        goto cleanup;
+    }
+    if ((fd = open(tmppath,O_WRONLY|O_TRUNC|O_CREAT,0644)) == -1) {
+        redisLog(REDIS_WARNING,"Can't open the AOF manifest %s: %s",
+            tmppath, strerror(errno));
+        goto cleanup;
+    }
+    if (write(fd,buf,sdslen(buf)) != (ssize_t)sdslen(buf) ||
+        aof_fsync(fd) == -1)
+    {
+        redisLog(REDIS_WARNING,"Error writing the AOF manifest %s: %s",
+            tmppath, strerror(errno));
+        goto cleanup;
+    }
+    // 改名之后还要 fsync 所在的目录，改名本身才能确保落盘
+    if (rename(tmppath,path) == -1 || fsyncFileDir(path) == -1) {
+        redisLog(REDIS_WARNING,"Error moving the AOF manifest to %s: %s",
+            path, strerror(errno));
+        goto cleanup;
+    }
+    retval = REDIS_OK;
+
+cleanup:
+    if (fd != -1) close(fd);
+    if (retval == REDIS_ERR) unlink(tmppath);
+    sdsfree(name);
+    sdsfree(tmpname);
+    sdsfree(path);
+    sdsfree(tmppath);
+    sdsfree(buf);
+    return retval;
+}
+
+/* The AOF of older versions is a single file in the working directory:
+ * move it into the AOF directory, where it becomes the BASE file. The new
+ * manifest is written first, so that if we crash in the middle the
+ * manifest references a missing file, instead of the AOF to look empty. */
+static void aofUpgradeFromSingleFile(void) {
+    aofManifest *am = aofManifestCreate();
+    aofInfo *ai = aofInfoCreate();
+    sds path = makePath(server.aof_dirname,server.aof_filename);
+
+    ai->file_name = sdsnew(server.aof_filename);
+    ai->file_seq = 1;
+    ai->file_type = REDIS_AOF_FILE_TYPE_BASE;
+    am->base_aof_info = ai;
+    am->curr_base_file_seq = 1;
+
+    if (persistAofManifest(am) == REDIS_ERR) exit(1);
+    if (rename(server.aof_filename,path) == -1) {
+        redisLog(REDIS_WARNING,"Error moving the AOF file %s into %s: %s",
+            server.aof_filename, server.aof_dirname, strerror(errno));
+        exit(1);
+    }
+    redisLog(REDIS_NOTICE,"The AOF file %s was moved into %s, where it is the BASE of the new multi part AOF",
+        server.aof_filename, server.aof_dirname);
+    aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+    sdsfree(path);
+}
+
+/* Load the manifest at startup, or create an empty one if there is none.
  *
- * 如果没有 short write 或者其他错误发生，那么返回写入的字节数量，
- * 否则，返回 -1 。
- * 
- * 只有当子进程完成了 AOF-rewrite 之后，父进程才会调用 backgroundRewriteDoneHandler() 转而调用这个函数
- * 将 AOF-re-write-buf 中的内容追加进去
- * 
- * 追加完毕之后，AOF 文件就是一个完成的 AOF 持久化文件了
- * 因为这是在父进程调用的，并且会阻塞父进程，也就意味着，不会有任何新的改动被 redis-server 接受
- * 所以这个函数执行完毕之后，AOF 就是一个完整的备份了
- */
-ssize_t aofRewriteBufferWrite(int fd) {
-    listNode *ln;
-    listIter li;
-    ssize_t count = 0;
+ * 启动时载入 manifest ，旧版本的单个 AOF 文件会被转换为 BASE 文件 */
+void aofLoadManifestFromDisk(void) {
+    sds name = getAofManifestFileName();
+    sds path = makePath(server.aof_dirname,name);
+    struct redis_stat sb;
 
-    // 遍历所有缓存块
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {   // 也是会阻塞主进程的
-        aofrwblock *block = listNodeValue(ln);
-        ssize_t nwritten;
+    server.aof_manifest = aofManifestCreate();
+    if (redis_stat(path,&sb) == 0) {
+        aofManifestFree(server.aof_manifest);
+        server.aof_manifest = aofLoadManifestFromFile(path);
+    } else if (server.aof_state == REDIS_AOF_ON &&
+               redis_stat(server.aof_filename,&sb) == 0)
+    {
+        aofUpgradeFromSingleFile();
+    }
+    sdsfree(name);
+    sdsfree(path);
+}
 
-        if (block->used) {
+/* Delete the AOF file 'filename'. The file is opened before the unlink, so
+ * that the actual deletion, that may block for big files, happens when the
+ * background thread closes it. */
+static void aofDelFile(sds filename) {
+    sds path = makePath(server.aof_dirname,filename);
+    int fd = open(path,O_RDONLY|O_NONBLOCK);
 
-            // 写入缓存块内容到 fd
-            nwritten = write(fd,block->buf,block->used);
-            if (nwritten != block->used) {  // If a short write or any other error happens -1 is returned
-                if (nwritten == 0) errno = EIO;
-                return -1;
-            }
+    if (unlink(path) == -1 && errno != ENOENT) {
+        redisLog(REDIS_WARNING,"Can't remove the AOF file %s: %s",
+            path, strerror(errno));
+    }
+    if (fd != -1)
+        bioCreateBackgroundJob(REDIS_BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+    sdsfree(path);
+}
 
-            // 积累写入字节
-            count += nwritten;
-        }
+/* Switch to a new INCR file. This happens every time a rewrite starts: the
+ * commands received from now on are not in the BASE the child is writing.
+ *
+ * With AOF on the manifest is persisted right away. While waiting for the
+ * first rewrite (AOF just switched on) the old files don't hold the current
+ * dataset, so the new INCR file enters the manifest on disk only together
+ * with the new BASE.
+ *
+ * 切换到新的 INCR 文件，每次开始重写时调用 */
+static int openNewIncrAofForAppend(void) {
+    aofManifest *am = aofManifestDup(server.aof_manifest);
+    aofInfo *ai = aofInfoCreate();
+    int newfd = -1;
+    sds path;
+
+    ai->file_seq = ++am->curr_incr_file_seq;
+    ai->file_name = sdscatprintf(sdsempty(),"%s.%lld.incr.aof",
+        server.aof_filename, ai->file_seq);
+    ai->file_type = REDIS_AOF_FILE_TYPE_INCR;
+    listAddNodeTail(am->incr_aof_list,ai);
+    path = makePath(server.aof_dirname,ai->file_name);
+
+    if (dirCreateIfMissing(server.aof_dirname) == -1 ||
+        (newfd = open(path,O_WRONLY|O_TRUNC|O_CREAT,0644)) == -1)
+    {
+        redisLog(REDIS_WARNING,"Can't open the append-only file %s: %s",
+            path, strerror(errno));
+        goto error;
+    }
+    if (server.aof_state == REDIS_AOF_ON &&
+        persistAofManifest(am) == REDIS_ERR)
+    {
+        close(newfd);
+        unlink(path);
+        goto error;
+    }
+
+    /* The old INCR file is closed (and synced, unless the fsync policy is
+     * 'no') in background. */
+    if (server.aof_fd != -1) {
+        bioCreateBackgroundJob(REDIS_BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+            (server.aof_fsync != AOF_FSYNC_NO) ? (void*)1 : NULL,NULL);
     }
+    server.aof_fd = newfd;
+    server.aof_last_incr_size = 0;
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+    sdsfree(path);
+    return REDIS_OK;
 
-    return count;
+error:
+    aofManifestFree(am);
+    sdsfree(path);
+    return REDIS_ERR;
+}
+
+/* Open the AOF for appending at startup: we continue with the last INCR
+ * file, or start a new one if there is none. */
+void aofOpenIfNeededOnServerStart(void) {
+    listNode *ln;
+
+    if (server.aof_state != REDIS_AOF_ON) return;
+
+    if ((ln = listLast(server.aof_manifest->incr_aof_list)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+        sds path = makePath(server.aof_dirname,ai->file_name);
+
+        server.aof_fd = open(path,O_WRONLY|O_APPEND|O_CREAT,0644);
+        if (server.aof_fd == -1) {
+            redisLog(REDIS_WARNING,"Can't open the append-only file %s: %s",
+                path, strerror(errno));
+            exit(1);
+        }
+        server.aof_last_incr_size = getAppendOnlyFileSize(ai->file_name);
+        sdsfree(path);
+    } else if (openNewIncrAofForAppend() == REDIS_ERR) {
+        exit(1);
+    }
 }
 
 /* ----------------------------------------------------------------------------
@@ -289,13 +507,15 @@ void stopAppendOnly(void) {
 
     // 将 AOF 缓存的内容写入并冲洗到 AOF 文件中
     // 参数 1 表示强制模式
-    flushAppendOnlyFile(1);
+    if (server.aof_fd != -1) {
+        flushAppendOnlyFile(1);
 
-    // 冲洗 AOF 文件
-    aof_fsync(server.aof_fd);
+        // 冲洗 AOF 文件
+        aof_fsync(server.aof_fd);
 
-    // 关闭 AOF 文件
-    close(server.aof_fd);
+        // 关闭 AOF 文件
+        close(server.aof_fd);
+    }
 
     // 清空 AOF 状态
     server.aof_fd = -1;
@@ -317,10 +537,7 @@ void stopAppendOnly(void) {
         if (kill(server.aof_child_pid,SIGUSR1) != -1)
             wait3(&statloc,0,NULL);
 
-        /* reset the buffer accumulating changes while the child saves 
-         * 清理未完成的 AOF 重写留下来的缓存和临时文件
-         */
-        aofRewriteBufferReset();
+        /* 清理未完成的 AOF 重写留下来的临时文件 */
         aofRemoveTempFile(server.aof_child_pid);
         server.aof_child_pid = -1;
         server.aof_rewrite_time_start = -1;
@@ -338,35 +555,226 @@ int startAppendOnly(void) {
     // 将开始时间设为 AOF 最后一次 fsync 时间 
     server.aof_last_fsync = server.unixtime;
 
-    // O_APPEND 方式打开 AOF 文件
-    server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
-
     // 检查 redis aof 的状态机无异常，异常后理应直接 abort 退出
     redisAssert(server.aof_state == REDIS_AOF_OFF);
 
-    // 文件打开失败
-    if (server.aof_fd == -1) {
-        redisLog(REDIS_WARNING,"Redis needs to enable the AOF but can't open the append only file: %s",strerror(errno));
-        return REDIS_ERR;
-    }
+    /* We switch on AOF, and wait for the rewrite to be complete: the INCR
+     * file the rewrite opens joins the manifest together with the BASE.
+     *
+     * 等待重写执行完毕，重写开始时会打开新的 INCR 文件
+     */
+    server.aof_state = REDIS_AOF_WAIT_REWRITE;
 
     if (rewriteAppendOnlyFileBackground() == REDIS_ERR) {
         // AOF 后台重写失败，关闭 AOF 文件
-        close(server.aof_fd);
+        server.aof_state = REDIS_AOF_OFF;
+        if (server.aof_fd != -1) {
+            close(server.aof_fd);
+            server.aof_fd = -1;
+        }
         redisLog(REDIS_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return REDIS_ERR;
     }
 
-    /* We correctly switched on AOF, now wait for the rerwite to be complete
-     * in order to append data on disk. 
-     *
-     * 等待重写执行完毕
-     */
-    server.aof_state = REDIS_AOF_WAIT_REWRITE;
-
     return REDIS_OK;
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF writer thread (group commit)
+ * ------------------------------------------------------------------------- */
+
+/* With appendfsync always and aof-group-commit enabled, the write(2) and the
+ * fsync(2) of the AOF buffer are performed by a dedicated thread. While a
+ * batch is on its way to the disk the main thread keeps serving clients and
+ * accumulates the new commands in server.aof_buf, that becomes the next
+ * batch as soon as the writer is done: a single fsync covers the writes of
+ * all the clients served in the meantime.
+ *
+ * The replies of the clients that changed the dataset are held until the
+ * AOF offset of their last write is on disk (see call() and
+ * holdClientRepliesForAof()), so the 'always' contract is preserved.
+ *
+ * 组提交：由专门的线程执行 write + fsync ，批次落盘期间主线程继续处理命令，
+ * 新的命令累积在 aof_buf 中，成为下一个批次。
+ * 执行了写命令的客户端，要等到对应的 AOF 偏移量落盘之后才会收到回复。
+ */
+
+static pthread_t aof_writer_thread;
+static pthread_mutex_t aof_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aof_writer_cond = PTHREAD_COND_INITIALIZER;
+
+/* The batch handed to the writer. 'buf' is owned by the main thread, that
+ * sets it and releases it: it is NULL when the writer is idle. The other
+ * fields are protected by aof_writer_mutex. */
+static struct {
+    sds buf;            /* Batch being written, NULL if the writer is idle. */
+    int fd;             /* File to write the batch to. */
+    int fsync;          /* Whether to fsync after the write. */
+    long long end_off;  /* server.aof_fed_off covered by the batch. */
+    int done;           /* Set by the writer when the batch is processed. */
+    ssize_t nwritten;   /* Bytes actually written. */
+    int err;            /* errno of the failed write or fsync, or 0. */
+    mstime_t latency;   /* Time spent in fsync. */
+} aof_writer_job;
+
+static void *aofWriterThreadMain(void *arg) {
+    REDIS_NOTUSED(arg);
+
+    pthread_mutex_lock(&aof_writer_mutex);
+    while(1) {
+        sds buf;
+        size_t len;
+        ssize_t nwritten = 0;
+        int fd, dosync, err = 0;
+        mstime_t latency = 0;
+
+        while (aof_writer_job.buf == NULL || aof_writer_job.done)
+            pthread_cond_wait(&aof_writer_cond,&aof_writer_mutex);
+        buf = aof_writer_job.buf;
+        fd = aof_writer_job.fd;
+        dosync = aof_writer_job.fsync;
+        pthread_mutex_unlock(&aof_writer_mutex);
+
+        len = sdslen(buf);
+        while ((size_t)nwritten < len) {
+            ssize_t n = write(fd,buf+nwritten,len-nwritten);
+
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                err = errno;
+                break;
+            }
+            nwritten += n;
+        }
+        if (!err && dosync) {
+            latencyStartMonitor(latency);
+            if (aof_fsync(fd) == -1) err = errno;
+            latencyEndMonitor(latency);
+        }
+
+        pthread_mutex_lock(&aof_writer_mutex);
+        aof_writer_job.nwritten = nwritten;
+        aof_writer_job.err = err;
+        aof_writer_job.latency = latency;
+        aof_writer_job.done = 1;
+        pthread_cond_broadcast(&aof_writer_cond);
+        /* Awake the event loop: the pipe is non blocking, and a single byte
+         * is enough even if the pipe is full. */
+        if (write(server.aof_writer_pipe[1],"A",1) != 1) {
+            /* Nothing to do, the main thread will get the notification. */
+        }
+    }
+    return NULL;
+}
+
+/* Return true if the AOF buffer should be written by the writer thread. */
+int aofGroupCommitActive(void) {
+    return server.aof_group_commit &&
+           server.aof_fsync == AOF_FSYNC_ALWAYS &&
+           server.aof_state == REDIS_AOF_ON &&
+           server.aof_fd != -1;
+}
+
+/* Bytes of the batch the writer is processing, for memory accounting. */
+size_t aofWriterBufferSize(void) {
+    return aof_writer_job.buf ? sdslen(aof_writer_job.buf) : 0;
+}
+
+/* Hand the AOF buffer to the idle writer thread. */
+static void aofWriterSubmit(void) {
+    pthread_mutex_lock(&aof_writer_mutex);
+    aof_writer_job.buf = server.aof_buf;
+    aof_writer_job.fd = server.aof_fd;
+    aof_writer_job.fsync = !(server.aof_no_fsync_on_rewrite &&
+        (server.aof_child_pid != -1 || server.rdb_child_pid != -1));
+    aof_writer_job.end_off = server.aof_fed_off;
+    aof_writer_job.done = 0;
+    pthread_cond_broadcast(&aof_writer_cond);
+    pthread_mutex_unlock(&aof_writer_mutex);
+    server.aof_buf = sdsempty();
+}
+
+/* Account the batch processed by the writer, and send the replies of the
+ * clients whose writes are now on disk. The writer must be done. */
+static void aofWriterCollect(void) {
+    if (aof_writer_job.err) {
+        /* Like the synchronous write there is no way to recover with the
+         * 'always' policy: the batch may be only partially on disk. */
+        redisLog(REDIS_WARNING,"Error writing the AOF file in the writer "
+            "thread: %s. Can't recover from AOF write errors when the AOF "
+            "fsync policy is 'always'. Exiting...",
+            strerror(aof_writer_job.err));
+        exit(1);
+    }
+    server.aof_current_size += aof_writer_job.nwritten;
+    server.aof_last_incr_size += aof_writer_job.nwritten;
+    if (aof_writer_job.fsync) {
+        latencyAddSampleIfNeeded("aof-fsync-always",aof_writer_job.latency);
+        server.aof_last_fsync = server.unixtime;
+    }
+    server.aof_durable_off = aof_writer_job.end_off;
+    server.stat_aof_group_commits++;
+
+    sdsfree(aof_writer_job.buf);
+    aof_writer_job.buf = NULL;
+    aof_writer_job.done = 0;
+    releaseClientsWaitingAof();
+}
+
+/* Block until the writer is idle. Called before writing the AOF from the
+ * main thread, or before changing the file the writer may be using. */
+static void aofWriterWait(void) {
+    if (aof_writer_job.buf == NULL) return;
+
+    pthread_mutex_lock(&aof_writer_mutex);
+    while (!aof_writer_job.done)
+        pthread_cond_wait(&aof_writer_cond,&aof_writer_mutex);
+    pthread_mutex_unlock(&aof_writer_mutex);
+    aofWriterCollect();
+}
+
+/* Event handler of the pipe written by the writer when a batch is done:
+ * collect it, and submit the commands accumulated in the meantime. */
+static void aofWriterPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    int done;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(privdata);
+    REDIS_NOTUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    if (aof_writer_job.buf == NULL) return;
+
+    pthread_mutex_lock(&aof_writer_mutex);
+    done = aof_writer_job.done;
+    pthread_mutex_unlock(&aof_writer_mutex);
+    if (!done) return;
+
+    aofWriterCollect();
+    flushAppendOnlyFile(0);
+}
+
+/* Start the writer thread, called at startup. */
+void aofWriterInit(void) {
+    server.clients_waiting_aof = listCreate();
+    if (pipe(server.aof_writer_pipe) == -1) {
+        redisLog(REDIS_WARNING,"Can't create the pipe for the AOF writer: %s",
+            strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,server.aof_writer_pipe[0]);
+    anetNonBlock(NULL,server.aof_writer_pipe[1]);
+    if (aeCreateFileEvent(server.el,server.aof_writer_pipe[0],AE_READABLE,
+        aofWriterPipeReadable,NULL) == AE_ERR)
+    {
+        redisPanic("Error registering the readable event for the AOF writer.");
+    }
+    if (pthread_create(&aof_writer_thread,NULL,aofWriterThreadMain,NULL) != 0) {
+        redisLog(REDIS_WARNING,"Fatal: Can't initialize the AOF writer thread.");
+        exit(1);
+    }
+}
+
 /* Write the append only file buffer on disk.
  *
  * 将 AOF 缓存写入到文件中。
@@ -419,6 +827,22 @@ int startAppendOnly(void) {
 void flushAppendOnlyFile(int force) {
     ssize_t nwritten;
     int sync_in_progress = 0;
+    mstime_t latency;
+
+    /* With group commit the buffer goes to the writer thread, unless it is
+     * still busy with the previous batch: in that case the commands keep
+     * accumulating, and are submitted as soon as the writer is done.
+     *
+     * 组提交时交给写线程；写线程忙的话，命令继续在 aof_buf 中累积 */
+    if (aofGroupCommitActive() && !force) {
+        if (sdslen(server.aof_buf) && aof_writer_job.buf == NULL)
+            aofWriterSubmit();
+        return;
+    }
+
+    /* Writing from the main thread: the batch of the writer, if any, must
+     * reach the file first. */
+    aofWriterWait();
 
     // 缓冲区中没有任何内容，直接返回
     if (sdslen(server.aof_buf) == 0) return;
@@ -507,7 +931,24 @@ void flushAppendOnlyFile(int force) {
     // 这个 write 可能会被子线程的 fsync() block 住。主要有两个情况：
     // 1. 被要求强制 fsync()
     // 2. 没有被强制要求 fsync(), 但是已经 delay 的很多次了，不得不强行调用 fsync()
+    latencyStartMonitor(latency);
     nwritten = write(server.aof_fd,server.aof_buf,sdslen(server.aof_buf));
+    latencyEndMonitor(latency);
+    /* We want to capture different events for delayed writes:
+     * when the delay happens with a pending fsync, or with a saving child
+     * active, and when the above two conditions are missing.
+     * We also use an additional event name to save all samples which is
+     * useful for graphing / monitoring purposes. */
+    // 区分 write 被阻塞的原因：后台 fsync 、子进程的磁盘写入或者单纯的磁盘慢
+    if (sync_in_progress) {
+        latencyAddSampleIfNeeded("aof-write-pending-fsync",latency);
+    } else if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) {
+        latencyAddSampleIfNeeded("aof-write-active-child",latency);
+    } else {
+        latencyAddSampleIfNeeded("aof-write-alone",latency);
+    }
+    latencyAddSampleIfNeeded("aof-write",latency);
+
     if (nwritten != (signed)sdslen(server.aof_buf)) {   // 未完全写入
 
         static time_t last_write_error_log = 0; // static 的
@@ -541,12 +982,12 @@ void flushAppendOnlyFile(int force) {
             }
 
             // 尝试移除新追加的不完整内容
-            // 当前 AOF 状态：写了一部分数据进 AOF 的 IO buf 里面（不完整），但是 server.aof_current_size 还没有被刷新
+            // 当前 AOF 状态：写了一部分数据进 AOF 的 IO buf 里面（不完整），但是 server.aof_last_incr_size 还没有被刷新
             // TODO:(DONE) 这个 ftruncate() 的调用就不怕跟子线程的 fsync() 冲突吗？
             // 不怕的，所有的 write 调用都是不保证落盘的，仅仅是保证进入了 IO buf 里面
             // 由于这些操作必然是原子的，fsync 的落盘、ftruncate 只能够一前一后发生
-            // 顺序不重要，因为 server.aof_current_size 是统计了进入 IO buf 里面的数据量，而不是 fsync 落盘后的数据量
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            // 顺序不重要，因为 server.aof_last_incr_size 是统计了进入 IO buf 里面的数据量，而不是 fsync 落盘后的数据量
+            if (ftruncate(server.aof_fd, server.aof_last_incr_size) == -1) {
                 // 无法删除刚刚的 short-write 数据
                 if (can_log) {
                     redisLog(REDIS_WARNING, "Could not remove short write "
@@ -557,7 +998,7 @@ void flushAppendOnlyFile(int force) {
             } else {
                 /* If the ftrunacate() succeeded we can set nwritten to
                  * -1 since there is no longer partial data into the AOF. */
-                // 利用 ftruncate() 跟 server.aof_current_size 将刚刚 short-write 的数据删除掉
+                // 利用 ftruncate() 跟 server.aof_last_incr_size 将刚刚 short-write 的数据删除掉
                 nwritten = -1;
             }
             server.aof_last_write_errno = ENOSPC;
@@ -583,6 +1024,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_last_incr_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -600,6 +1042,12 @@ void flushAppendOnlyFile(int force) {
 
     // 更新写入后的 AOF 文件大小
     server.aof_current_size += nwritten;
+    server.aof_last_incr_size += nwritten;
+
+    /* Replies held for group commit are released as usual after the
+     * write, for instance if group commit was just disabled. */
+    server.aof_durable_off = server.aof_fed_off;
+    if (listLength(server.clients_waiting_aof)) releaseClientsWaitingAof();
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). 
@@ -638,7 +1086,10 @@ void flushAppendOnlyFile(int force) {
     if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
         /* aof_fsync is defined as fdatasync() for Linux in order to avoid
          * flushing metadata. */
+        latencyStartMonitor(latency);
         aof_fsync(server.aof_fd); /* Let's try to get this data on the disk */
+        latencyEndMonitor(latency);
+        latencyAddSampleIfNeeded("aof-fsync-always",latency);
 
         // 更新最后一次执行 fsnyc 的时间
         server.aof_last_fsync = server.unixtime;
@@ -760,16 +1211,14 @@ sds catAppendOnlyExpireAtCommand(sds buf, struct redisCommand *cmd, robj *key, r
     return buf;
 }
 
-/*
- * 将命令追加到 AOF buf 中，
- * 如果 AOF 重写正在进行，那么也将命令追加到 AOF 重写缓存中。
- * 这个函数并不会真正的落盘！！！
- */
-// 仅仅是负责向 AOF buf 追加新的记录，并不会选择 multi-set 这样的压缩命令
-// 忠诚的执行上层函数要求写入的内容（除非这个 key 有过期时间，这里会自动追加）
-void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
+/* Append to 'buf' the AOF representation of the command, preceded by a
+ * SELECT if the command targets a DB different from the last one.
+ *
+ * 将命令的 AOF 表示追加到 buf ，必要时先追加 SELECT */
+static sds catAppendOnlyCommand(sds buf, struct redisCommand *cmd, int dictid,
+                                robj **argv, int argc)
+{
     // dictid = client->db->id
-    sds buf = sdsempty();
     robj *tmpargv[3];
 
     /* The DB this command was targeting is not the same as the last command
@@ -827,7 +1276,11 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
          * for the replication itself. */
         buf = catAppendOnlyGenericCommand(buf,argc,argv);
     }
+    return buf;
+}
 
+/* Append 'buf' to the AOF buffer and take ownership of it. */
+static void feedAppendOnlyFileBuffer(sds buf) {
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
      * positive reply about the operation performed. 
@@ -837,25 +1290,51 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
      * 并向客户端返回一个回复。
      */
     // 仅仅是放到 AOF buf 里面，然后等其他动作都完成了，再由 beforesleep() 根据 policy 决定是否落盘
-    if (server.aof_state == REDIS_AOF_ON)
-        server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
-
-    /* If a background append only file rewriting is in progress we want to
-     * accumulate the differences between the child DB and the current one
-     * in a buffer, so that when the child process will do its work we
-     * can append the differences to the new append only file. 
+    /* While waiting for the first rewrite the commands go to the INCR file
+     * opened when the rewrite started, that will follow the new BASE.
      *
-     * 如果 BGREWRITEAOF 正在进行，
-     * 那么我们还需要将命令追加到重写缓存中，
-     * 从而记录当前正在重写的 AOF 文件和数据库当前状态的差异。
-     */
-    if (server.aof_child_pid != -1)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
+     * 等待第一次重写完成时，命令写入重写开始时打开的 INCR 文件 */
+    if (server.aof_state == REDIS_AOF_ON ||
+        (server.aof_state == REDIS_AOF_WAIT_REWRITE &&
+         server.aof_child_pid != -1))
+    {
+        server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+        server.aof_fed_off += sdslen(buf);
+    }
 
     // 释放
     sdsfree(buf);
 }
 
+/*
+ * 将命令追加到 AOF buf 中，
+ * 如果 AOF 重写正在进行，那么也将命令追加到 AOF 重写缓存中。
+ * 这个函数并不会真正的落盘！！！
+ */
+// 仅仅是负责向 AOF buf 追加新的记录，并不会选择 multi-set 这样的压缩命令
+// 忠诚的执行上层函数要求写入的内容（除非这个 key 有过期时间，这里会自动追加）
+void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
+    feedAppendOnlyFileBuffer(
+        catAppendOnlyCommand(sdsempty(),cmd,dictid,argv,argc));
+}
+
+/* Like feedAppendOnlyFile() for all the ops of 'oa' targeting the AOF, that
+ * are encoded in a single buffer and appended at once, see propagateBatch().
+ *
+ * 将一批命令编码到同一个缓冲中，一次追加到 AOF buf */
+void feedAppendOnlyFileBatch(redisOpArray *oa) {
+    sds buf = sdsempty();
+    int j;
+
+    for (j = 0; j < oa->numops; j++) {
+        redisOp *op = oa->ops+j;
+
+        if (!(op->target & REDIS_PROPAGATE_AOF)) continue;
+        buf = catAppendOnlyCommand(buf,op->cmd,op->dbid,op->argv,op->argc);
+    }
+    feedAppendOnlyFileBuffer(buf);
+}
+
 /* ----------------------------------------------------------------------------
  * AOF loading
  * ------------------------------------------------------------------------- */
@@ -873,11 +1352,16 @@ struct redisClient *createFakeClient(void) {
 
     c->fd = -1;
     c->name = NULL;
+    memset(&c->usage,0,sizeof(c->usage));
+    memset(&c->usage_folded,0,sizeof(c->usage_folded));
     c->querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
     c->bufpos = 0;
+    c->buf = NULL;
+    c->buf_usable_size = 0;
+    c->buf_peak = 0;
     c->flags = 0;
     c->btype = REDIS_BLOCKED_NONE;
     /* We set the fake client as a slave waiting for the synchronization
@@ -908,6 +1392,7 @@ void freeFakeClient(struct redisClient *c) {
 
     // 释放回复缓存
     listRelease(c->reply);
+    zfree(c->buf);
 
     // 释放监视的键
     listRelease(c->watched_keys);
@@ -918,9 +1403,114 @@ void freeFakeClient(struct redisClient *c) {
     zfree(c);
 }
 
-/* Replay（回放） the append log file. On error REDIS_OK is returned. On non fatal
- * error (the append only file is zero-length) REDIS_ERR is returned. On
- * fatal error an error message is logged and the program exists.
+/* AOF loading reads the file in big blocks and parses the protocol in
+ * place: much faster than a fgets() / fread() for every field.
+ *
+ * 载入 AOF 时按大块读取文件，直接在缓冲区中解析协议 */
+#define AOF_LOAD_BUF_LEN (1024*1024)
+#define AOF_LOAD_LINE_MAX 64        /* "*<count>\r\n" and "$<len>\r\n" lines. */
+
+/* Argument objects no longer referenced after a command are reused for the
+ * next ones, unless they are too big. */
+#define AOF_LOAD_POOL_SIZE 64
+#define AOF_LOAD_POOL_MAX_ALLOC 1024
+
+/* Return values of aofReadNumberLine(). */
+#define AOF_READ_OK 0
+#define AOF_READ_EOF 1      /* Clean EOF: nothing left to read. */
+#define AOF_READ_TRUNC 2    /* The file ends in the middle of the line. */
+#define AOF_READ_FMT 3      /* Malformed line. */
+
+typedef struct aofReader {
+    FILE *fp;
+    char *buf;
+    size_t len;         /* Bytes in buf. */
+    size_t pos;         /* Bytes of buf already parsed. */
+} aofReader;
+
+/* Make sure at least 'n' bytes (n <= AOF_LOAD_BUF_LEN) are buffered, or all
+ * the remaining bytes of the file. Returns the buffered bytes. */
+static size_t aofReaderFill(aofReader *r, size_t n) {
+    if (r->len - r->pos >= n) return r->len - r->pos;
+
+    memmove(r->buf,r->buf+r->pos,r->len-r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    while (r->len < n) {
+        size_t nread = fread(r->buf+r->len,1,AOF_LOAD_BUF_LEN-r->len,r->fp);
+
+        if (nread == 0) break;
+        r->len += nread;
+    }
+    return r->len;
+}
+
+/* Offset in the file of the next byte to parse. */
+static off_t aofReaderOffset(aofReader *r) {
+    return ftello(r->fp) - (off_t)(r->len - r->pos);
+}
+
+/* Parse a "<prefix><number>\r\n" line, like "*3\r\n" or "$5\r\n". */
+static int aofReadNumberLine(aofReader *r, char prefix, long long *value) {
+    size_t avail = aofReaderFill(r,AOF_LOAD_LINE_MAX);
+    char *p = r->buf+r->pos, *nl;
+
+    if (avail == 0) return AOF_READ_EOF;
+    if ((nl = memchr(p,'\n',avail)) == NULL)
+        return (avail < AOF_LOAD_LINE_MAX) ? AOF_READ_TRUNC : AOF_READ_FMT;
+    if (p[0] != prefix || nl-p < 3 || nl[-1] != '\r' ||
+        !string2ll(p+1,nl-p-2,value)) return AOF_READ_FMT;
+    r->pos += nl-p+1;
+    return AOF_READ_OK;
+}
+
+/* Read a bulk of 'len' bytes followed by CRLF into 'o' if not NULL (a
+ * reusable object from the pool), or into a new string object. Returns
+ * NULL if the file ends before the bulk. */
+static robj *aofReadBulk(aofReader *r, size_t len, robj *o) {
+    sds s;
+
+    if (len+2 <= AOF_LOAD_BUF_LEN) {
+        if (aofReaderFill(r,len+2) < len+2) return NULL;
+        if (o) {
+            o->ptr = sdscpylen(o->ptr,r->buf+r->pos,len);
+        } else {
+            o = createObject(REDIS_STRING,sdsnewlen(r->buf+r->pos,len));
+        }
+        r->pos += len+2;
+        return o;
+    }
+
+    /* Big argument: read the part not already buffered straight into the
+     * string. */
+    {
+        size_t copied = r->len - r->pos;
+
+        if (copied > len) copied = len;
+        s = sdsnewlen(NULL,len);
+        memcpy(s,r->buf+r->pos,copied);
+        r->pos += copied;
+        if (copied < len) {
+            r->pos = r->len = 0;
+            if (fread(s+copied,1,len-copied,r->fp) != len-copied) {
+                sdsfree(s);
+                return NULL;
+            }
+        }
+        if (aofReaderFill(r,2) < 2) {
+            sdsfree(s);
+            return NULL;
+        }
+        r->pos += 2;
+    }
+    if (o) decrRefCount(o);
+    return createObject(REDIS_STRING,s);
+}
+
+/* Replay（回放） the append log file 'filename', relative to the AOF directory.
+ * On success REDIS_OK is returned. On non fatal error (the append only file
+ * is zero-length) REDIS_ERR is returned. On fatal error an error message is
+ * logged and the program exists.
  *
  * 执行 AOF 文件中的命令。
  *
@@ -931,30 +1521,39 @@ void freeFakeClient(struct redisClient *c) {
  * 出现致命错误时打印信息到日志，并且程序退出。
  */
 // 实际上，这就是把 AOF 里面所有的协议内容，再让 redis-server handle 一次
-int loadAppendOnlyFile(char *filename) {
+static int loadSingleAppendOnlyFile(char *filename) {
 
     // 为客户端
     struct redisClient *fakeClient;
 
     // 打开 AOF 文件
-    FILE *fp = fopen(filename,"r");
+    sds path = makePath(server.aof_dirname,filename);
+    FILE *fp = fopen(path,"r");
 
     struct redis_stat sb;
     int old_aof_state = server.aof_state;
     long loops = 0;
+    char sig[5]; /* "REDIS" */
+    aofReader reader;
+    robj **argv = NULL, *pool[AOF_LOAD_POOL_SIZE];
+    long long argv_size = 0;
+    int pool_len = 0;
+    struct redisCommand *lastcmd = NULL;
+    sds lastname;
 
     // 检查文件的正确性
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
-        server.aof_current_size = 0;
         fclose(fp);
+        sdsfree(path);
         return REDIS_ERR;
     }
 
     // 检查文件是否正常打开
     if (fp == NULL) {
-        redisLog(REDIS_WARNING,"Fatal error: can't open the append log file for reading: %s",strerror(errno));
+        redisLog(REDIS_WARNING,"Fatal error: can't open the append log file %s for reading: %s",path,strerror(errno));
         exit(1);
     }
+    sdsfree(path);
 
     /* Temporarily disable AOF, to prevent EXEC from feeding a MULTI
      * to the same file we're about to read. 
@@ -970,12 +1569,35 @@ int loadAppendOnlyFile(char *filename) {
     // startLoading 定义于 rdb.c
     startLoading(fp);
 
+    /* Check if this AOF file has an RDB preamble. In that case we need to
+     * load the RDB file and later continue loading the AOF tail.
+     *
+     * 以 REDIS 开头的 AOF 文件带有 RDB 前导：先载入 RDB 数据，再执行之后的命令
+     */
+    if (fread(sig,1,5,fp) != 5 || memcmp(sig,"REDIS",5) != 0) {
+        /* No RDB preamble, seek back at 0 offset. */
+        if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+    } else {
+        rio rdb;
+
+        redisLog(REDIS_NOTICE,"Reading RDB preamble from AOF file...");
+        if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+        rioInitWithFile(&rdb,fp);
+        if (rdbLoadRio(&rdb,NULL) != REDIS_OK) {
+            redisLog(REDIS_WARNING,"Error reading the RDB preamble of the AOF file, AOF loading aborted");
+            goto readerr;
+        }
+        redisLog(REDIS_NOTICE,"Reading the remaining AOF tail...");
+    }
+
+    reader.fp = fp;
+    reader.buf = zmalloc(AOF_LOAD_BUF_LEN);
+    reader.len = reader.pos = 0;
+    lastname = sdsempty();
+
     while(1) {
-        int argc, j;
-        unsigned long len;
-        robj **argv;
-        char buf[128];
-        sds argsds;
+        long long argc, len;
+        int j, ret;
         struct redisCommand *cmd;
 
         /* Serve the clients from time to time 
@@ -984,65 +1606,67 @@ int loadAppendOnlyFile(char *filename) {
          * 因为服务器正处于载入状态，所以能正常执行的只有 PUBSUB 等模块
          */
         if (!(loops++ % 1000)) {
-            loadingProgress(ftello(fp));
+            loadingProgress(aofReaderOffset(&reader));
             processEventsWhileBlocked();
         }
 
-        // 读入文件内容到缓存
-        if (fgets(buf,sizeof(buf),fp) == NULL) {
-            if (feof(fp))
-                // 文件已经读完，跳出
-                break;
-            else
-                goto readerr;
-        }
-
-        // 确认协议格式，比如 *3\r\n
-        if (buf[0] != '*') goto fmterr;
-        
-        // 取出命令参数，比如 *3\r\n 中的 3
-        argc = atoi(buf+1);
-
+        // 确认协议格式，并取出命令参数的个数，比如 *3\r\n 中的 3
+        ret = aofReadNumberLine(&reader,'*',&argc);
+        // 文件已经读完，跳出
+        if (ret == AOF_READ_EOF) break;
+        if (ret == AOF_READ_TRUNC) goto readerr;
         // 至少要有一个参数（被调用的命令）
-        if (argc < 1) goto fmterr;
+        if (ret == AOF_READ_FMT || argc < 1 || argc > INT_MAX) goto fmterr;
+
+        // 参数数组在命令之间复用，不够大时才扩展
+        if (argc > argv_size) {
+            argv = zrealloc(argv,sizeof(robj*)*argc);
+            argv_size = argc;
+        }
 
         // 从文本中创建字符串对象：包括命令，以及命令参数
         // 例如 $3\r\nSET\r\n$3\r\nKEY\r\n$5\r\nVALUE\r\n
         // 将创建三个包含以下内容的字符串对象：
         // SET 、 KEY 、 VALUE
-        argv = zmalloc(sizeof(robj*)*argc);
         for (j = 0; j < argc; j++) {
-            if (fgets(buf,sizeof(buf),fp) == NULL) goto readerr;
-
-            if (buf[0] != '$') goto fmterr;
+            robj *o = NULL;
 
-            // 读取参数值的长度
-            len = strtol(buf+1,NULL,10);
-            // 读取参数值
-            argsds = sdsnewlen(NULL,len);
-            if (len && fread(argsds,len,1,fp) == 0) goto fmterr;
-            // 为参数创建对象
-            argv[j] = createObject(REDIS_STRING,argsds);
+            ret = aofReadNumberLine(&reader,'$',&len);
+            if (ret == AOF_READ_EOF || ret == AOF_READ_TRUNC) goto readerr;
+            if (ret == AOF_READ_FMT || len < 0) goto fmterr;
 
-            if (fread(buf,2,1,fp) == 0) goto fmterr; /* discard CRLF */
+            // 尽量复用之前的命令已经不再使用的参数对象
+            if (pool_len && len < AOF_LOAD_POOL_MAX_ALLOC) o = pool[--pool_len];
+            if ((argv[j] = aofReadBulk(&reader,len,o)) == NULL) goto readerr;
         }
 
-        /* Command lookup 
+        /* Command lookup, the common case of a run of the same command
+         * skips the table lookup.
          *
-         * 查找命令
+         * 查找命令，连续执行同一个命令时不必每次都查表
          */
-        cmd = lookupCommand(argv[0]->ptr);
-        if (!cmd) {
-            redisLog(REDIS_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
-            exit(1);
+        if (lastcmd && sdslen(argv[0]->ptr) == sdslen(lastname) &&
+            !strcasecmp(argv[0]->ptr,lastname))
+        {
+            cmd = lastcmd;
+        } else {
+            cmd = lookupCommand(argv[0]->ptr);
+            if (!cmd) {
+                redisLog(REDIS_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
+                exit(1);
+            }
+            lastcmd = cmd;
+            lastname = sdscpylen(lastname,argv[0]->ptr,sdslen(argv[0]->ptr));
         }
 
-        /* Run the command in the context of a fake client 
+        /* Run the command in the context of a fake client. It has no
+         * connection, so no reply is ever built for it.
          *
-         * 调用伪客户端，执行命令
+         * 调用伪客户端，执行命令（伪客户端没有连接，不会生成回复）
          */
         fakeClient->argc = argc;
         fakeClient->argv = argv;
+        fakeClient->cmd = cmd; /* The commands of the modules need it. */
         cmd->proc(fakeClient);
 
         /* The fake client should not have a reply */
@@ -1051,13 +1675,31 @@ int loadAppendOnlyFile(char *filename) {
         redisAssert((fakeClient->flags & REDIS_BLOCKED) == 0);
 
         /* Clean up. Command code may have changed argv/argc so we use the
-         * argv/argc of the client instead of the local variables. 
+         * argv/argc of the client instead of the local variables. The
+         * arguments nobody else references go back to the pool.
          *
-         * 清理命令和命令参数对象
+         * 清理命令参数对象，没有被其他地方引用的对象放回对象池
          */
-        for (j = 0; j < fakeClient->argc; j++)
-            decrRefCount(fakeClient->argv[j]);
-        zfree(fakeClient->argv);
+        for (j = 0; j < fakeClient->argc; j++) {
+            robj *o = fakeClient->argv[j];
+
+            if (pool_len < AOF_LOAD_POOL_SIZE && o->refcount == 1 &&
+                o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_RAW &&
+                sdsAllocSize(o->ptr) <= AOF_LOAD_POOL_MAX_ALLOC)
+            {
+                pool[pool_len++] = o;
+            } else {
+                decrRefCount(o);
+            }
+        }
+        /* The command replaced the vector: the old one was freed. */
+        if (fakeClient->argv != argv) {
+            argv = fakeClient->argv;
+            argv_size = fakeClient->argc;
+        }
+        fakeClient->argv = NULL;
+        fakeClient->argc = 0;
+        server.aof_load_commands++;
     }
 
     /* This point can only be reached when EOF is reached without errors.
@@ -1068,6 +1710,12 @@ int loadAppendOnlyFile(char *filename) {
      */
     if (fakeClient->flags & REDIS_MULTI) goto readerr;
 
+    server.aof_load_bytes += aofReaderOffset(&reader);
+    while (pool_len) decrRefCount(pool[--pool_len]);
+    zfree(argv);
+    zfree(reader.buf);
+    sdsfree(lastname);
+
     // 关闭 AOF 文件
     fclose(fp);
     // 释放伪客户端
@@ -1076,10 +1724,6 @@ int loadAppendOnlyFile(char *filename) {
     server.aof_state = old_aof_state;
     // 停止载入
     stopLoading();
-    // 更新服务器状态中， AOF 文件的当前大小
-    aofUpdateCurrentSize();
-    // 记录前一次重写时的大小
-    server.aof_rewrite_base_size = server.aof_current_size;
     
     return REDIS_OK;
 
@@ -1087,24 +1731,61 @@ int loadAppendOnlyFile(char *filename) {
 readerr:
     // 非预期的末尾，可能是 AOF 文件在写入的中途遭遇了停机
     if (feof(fp)) {
-        redisLog(REDIS_WARNING,"Unexpected end of file reading the append only file");
+        redisLog(REDIS_WARNING,"Unexpected end of file reading the append only file %s", filename);
     
     // 文件内容出错
     } else {
-        redisLog(REDIS_WARNING,"Unrecoverable error reading the append only file: %s", strerror(errno));
+        redisLog(REDIS_WARNING,"Unrecoverable error reading the append only file %s: %s", filename, strerror(errno));
     }
     exit(1);
 
 // 内容格式错误
 fmterr:
-    redisLog(REDIS_WARNING,"Bad file format reading the append only file: make a backup of your AOF file, then use ./redis-check-aof --fix <filename>");
+    redisLog(REDIS_WARNING,"Bad file format reading the append only file %s: make a backup of your AOF file, then use ./redis-check-aof --fix <filename>", filename);
     exit(1);
 }
 
-/* ----------------------------------------------------------------------------
- * AOF rewrite
- * ------------------------------------------------------------------------- */
-
+/* Replay all the files of the manifest 'am', the BASE first. Returns
+ * REDIS_OK if some data was loaded, REDIS_ERR if there was nothing to load
+ * (no files or just empty ones). Errors are fatal as for a single file.
+ *
+ * 按 manifest 的顺序载入所有 AOF 文件 */
+int loadAppendOnlyFiles(aofManifest *am) {
+    off_t total_size = 0;
+    int loaded = 0;
+    long long start = ustime();
+    listNode *ln;
+    listIter li;
+
+    server.aof_load_commands = 0;
+    server.aof_load_bytes = 0;
+
+    if (am->base_aof_info) {
+        aofInfo *ai = am->base_aof_info;
+
+        redisLog(REDIS_NOTICE,"Reading the AOF BASE file %s",ai->file_name);
+        if (loadSingleAppendOnlyFile(ai->file_name) == REDIS_OK) loaded = 1;
+        total_size += getAppendOnlyFileSize(ai->file_name);
+    }
+    listRewind(am->incr_aof_list,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+
+        if (loadSingleAppendOnlyFile(ai->file_name) == REDIS_OK) loaded = 1;
+        total_size += getAppendOnlyFileSize(ai->file_name);
+    }
+
+    // 更新服务器状态中， AOF 文件的当前大小，并记录为前一次重写时的大小
+    server.aof_current_size = total_size;
+    server.aof_rewrite_base_size = total_size;
+    server.aof_load_time = ustime()-start;
+    return loaded ? REDIS_OK : REDIS_ERR;
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF rewrite
+ * ------------------------------------------------------------------------- */
+
 /* Delegate writing an object to writing a bulk string or bulk long long.
  * This is not placed in rio.c since that adds the redis.h dependency. 
  *
@@ -1117,6 +1798,18 @@ int rioWriteBulkObject(rio *r, robj *obj) {
         return rioWriteBulkLongLong(r,(long)obj->ptr);
     } else if (sdsEncodedObject(obj)) {
         return rioWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
+    } else if (obj->encoding == REDIS_ENCODING_CHUNKED) {
+        stringChunks *sc = obj->ptr;
+        size_t j;
+
+        if (rioWriteBulkCount(r,'$',sc->len) == 0) return 0;
+        for (j = 0; j < sc->count; j++) {
+            char *p;
+            size_t n = stringChunksAt(sc,j,&p);
+
+            if (rioWrite(r,p,n) == 0) return 0;
+        }
+        return rioWrite(r,"\r\n",2);
     } else {
         redisPanic("Unknown string encoding");
     }
@@ -1134,65 +1827,45 @@ int rioWriteBulkObject(rio *r, robj *obj) {
 int rewriteListObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = listTypeLength(o);
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *zl = o->ptr;
-        unsigned char *p = ziplistIndex(zl,0);
-        unsigned char *vstr;
-        unsigned int vlen;
-        long long vlong;
+    if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklist *list = o->ptr;
+        quicklistIter *li = quicklistGetIterator(list, AL_START_HEAD);
+        quicklistEntry entry;
 
         // 先构建一个 RPUSH key 
-        // 然后从 ZIPLIST 中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
-        // 之后重复第一步，直到 ZIPLIST 为空
-        while(ziplistGet(p,&vstr,&vlen,&vlong)) {
+        // 然后从 QUICKLIST 中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
+        // 之后重复第一步，直到 QUICKLIST 为空
+        while (quicklistNext(li,&entry)) {
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
                     REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
 
-                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
-                if (rioWriteBulkString(r,"RPUSH",5) == 0) return 0;
-                if (rioWriteBulkObject(r,key) == 0) return 0;
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0 ||
+                    rioWriteBulkString(r,"RPUSH",5) == 0 ||
+                    rioWriteBulkObject(r,key) == 0)
+                {
+                    quicklistReleaseIterator(li);
+                    return 0;
+                }
             }
+
             // 取出值
-            if (vstr) {
-                if (rioWriteBulkString(r,(char*)vstr,vlen) == 0) return 0;
+            if (entry.value) {
+                if (rioWriteBulkString(r,(char*)entry.value,entry.sz) == 0) {
+                    quicklistReleaseIterator(li);
+                    return 0;
+                }
             } else {
-                if (rioWriteBulkLongLong(r,vlong) == 0) return 0;
-            }
-            // 移动指针，并计算被取出元素的数量
-            p = ziplistNext(zl,p);
-            if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
-            items--;
-        }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list *list = o->ptr;
-        listNode *ln;
-        listIter li;
-
-        // 先构建一个 RPUSH key 
-        // 然后从双端链表中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
-        // 之后重复第一步，直到链表为空
-        listRewind(list,&li);
-        while((ln = listNext(&li))) {
-            robj *eleobj = listNodeValue(ln);
-
-            if (count == 0) {
-                int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
-                    REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
-
-                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
-                if (rioWriteBulkString(r,"RPUSH",5) == 0) return 0;
-                if (rioWriteBulkObject(r,key) == 0) return 0;
+                if (rioWriteBulkLongLong(r,entry.longval) == 0) {
+                    quicklistReleaseIterator(li);
+                    return 0;
+                }
             }
-
-            // 取出值
-            if (rioWriteBulkObject(r,eleobj) == 0) return 0;
-
-            // 元素计数
+            // 计算被取出元素的数量
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
-
             items--;
         }
+        quicklistReleaseIterator(li);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -1265,7 +1938,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = zsetLength(o);
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -1273,13 +1946,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         long long vll;
         double score;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         while (eptr != NULL) {
-            redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+            vstr = lpGetValue(eptr,&vlen,&vll);
             score = zzlGetScore(sptr);
 
             if (count == 0) {
@@ -1306,7 +1979,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         dictEntry *de;
 
         while((de = dictNext(di)) != NULL) {
-            robj *eleobj = dictGetKey(de);
+            sds ele = dictGetKey(de);
             double *score = dictGetVal(de);
 
             if (count == 0) {
@@ -1318,7 +1991,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
             if (rioWriteBulkDouble(r,*score) == 0) return 0;
-            if (rioWriteBulkObject(r,eleobj) == 0) return 0;
+            if (rioWriteBulkString(r,ele,sdslen(ele)) == 0) return 0;
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
@@ -1348,12 +2021,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
 
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             return rioWriteBulkString(r, (char*)vstr, vlen);
         } else {
@@ -1408,70 +2081,108 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
     return 1;
 }
 
-/* Write a sequence of commands able to fully rebuild the dataset into
- * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
- *
- * 将一集足以还原当前数据集的命令写入到 filename 指定的文件中。
- *
- * 这个函数被 REWRITEAOF 和 BGREWRITEAOF 两个命令调用。
- * （REWRITEAOF 似乎已经是一个废弃的命令）
- *
- * In order to minimize the number of commands needed in the rewritten
- * log Redis uses variadic commands when possible, such as RPUSH, SADD
- * and ZADD. However at max REDIS_AOF_REWRITE_ITEMS_PER_CMD items per time
- * are inserted using a single command. 
+/* Emit the XADD command needed to add the entry 'id' of the stream
+ * iterator 'si', that has 'numfields' fields, to the stream 'key'. */
+static int rioWriteStreamEntry(rio *r, robj *key, streamIterator *si,
+                               streamID *id, int64_t numfields)
+{
+    char idbuf[64];
+    int idlen;
+
+    idlen = snprintf(idbuf,sizeof(idbuf),"%llu-%llu",
+        (unsigned long long)id->ms,(unsigned long long)id->seq);
+    if (rioWriteBulkCount(r,'*',3+numfields*2) == 0) return 0;
+    if (rioWriteBulkString(r,"XADD",4) == 0) return 0;
+    if (rioWriteBulkObject(r,key) == 0) return 0;
+    if (rioWriteBulkString(r,idbuf,idlen) == 0) return 0;
+    while(numfields--) {
+        unsigned char *field, *value;
+        int64_t field_len, value_len;
+
+        streamIteratorGetField(si,&field,&value,&field_len,&value_len);
+        if (rioWriteBulkString(r,(char*)field,field_len) == 0) return 0;
+        if (rioWriteBulkString(r,(char*)value,value_len) == 0) return 0;
+    }
+    return 1;
+}
+
+/* Emit the commands needed to rebuild a stream object: an XADD for every
+ * entry. An empty stream still owns its last ID, so it is rebuilt adding
+ * a dummy entry with that ID and trimming it away in the same XADD.
+ * The function returns 0 on error, 1 on success.
+ *
+ * 重建流对象：每个元素一条 XADD 命令，空的流用 MAXLEN 0 的 XADD 保留最后的 ID */
+int rewriteStreamObject(rio *r, robj *key, robj *o) {
+    stream *s = o->ptr;
+    streamIterator si;
+    streamID id;
+    int64_t numfields;
+
+    if (s->length == 0) {
+        char idbuf[64];
+        int idlen;
+
+        idlen = snprintf(idbuf,sizeof(idbuf),"%llu-%llu",
+            (unsigned long long)s->last_id.ms,
+            (unsigned long long)s->last_id.seq);
+        if (rioWriteBulkCount(r,'*',7) == 0) return 0;
+        if (rioWriteBulkString(r,"XADD",4) == 0) return 0;
+        if (rioWriteBulkObject(r,key) == 0) return 0;
+        if (rioWriteBulkString(r,"MAXLEN",6) == 0) return 0;
+        if (rioWriteBulkString(r,"0",1) == 0) return 0;
+        if (rioWriteBulkString(r,idbuf,idlen) == 0) return 0;
+        if (rioWriteBulkString(r,"x",1) == 0) return 0;
+        if (rioWriteBulkString(r,"y",1) == 0) return 0;
+        return 1;
+    }
+
+    streamIteratorStart(&si,s,NULL,NULL,0);
+    while(streamIteratorGetID(&si,&id,&numfields)) {
+        if (rioWriteStreamEntry(r,key,&si,&id,numfields) == 0) {
+            streamIteratorStop(&si);
+            return 0;
+        }
+    }
+    streamIteratorStop(&si);
+    return 1;
+}
+
+/* Emit FUNCTION LOAD <name> <body> REPLACE for every function.
  *
- * 为了最小化重建数据集所需执行的命令数量，
- * Redis 会尽可能地使用接受可变参数数量的命令，比如 RPUSH 、SADD 和 ZADD 等。
+ * 重写所有函数 */
+static int rewriteFunctions(rio *r) {
+    dictIterator *di = dictGetIterator(server.lua_functions);
+    dictEntry *de;
+
+    while((de = dictNext(di)) != NULL) {
+        char cmd[] = "*5\r\n$8\r\nFUNCTION\r\n$4\r\nLOAD\r\n";
+        sds name = dictGetKey(de);
+        luaFunction *fn = dictGetVal(de);
+
+        if (rioWrite(r,cmd,sizeof(cmd)-1) == 0 ||
+            rioWriteBulkString(r,name,sdslen(name)) == 0 ||
+            rioWriteBulkObject(r,fn->body) == 0 ||
+            rioWriteBulkString(r,"REPLACE",7) == 0)
+        {
+            dictReleaseIterator(di);
+            return 0;
+        }
+    }
+    dictReleaseIterator(di);
+    return 1;
+}
+
+/* Write a sequence of commands able to fully rebuild the dataset into
+ * 'aof'. Returns REDIS_OK on success, REDIS_ERR on write errors.
  *
- * 不过单个命令每次处理的元素数量不能超过 REDIS_AOF_REWRITE_ITEMS_PER_CMD 。
- * #define REDIS_AOF_REWRITE_ITEMS_PER_CMD 64
- * 避免一个 CMD 过长，要是中间坏了一个，会很麻烦
+ * 将重建整个数据库所需的命令写入到 aof 中
  */
-int rewriteAppendOnlyFile(char *filename) {
+int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
-    rio aof;
-    FILE *fp;
-    char tmpfile[256];
     int j;
     long long now = mstime();
-
-    /* Note that we have to use a different temp name here compared to the
-     * one used by rewriteAppendOnlyFileBackground() function. 
-     *
-     * 创建临时文件
-     *
-     * 注意这里创建的文件名和 rewriteAppendOnlyFileBackground() 创建的文件名稍有不同
-     */
-    // temp-rewriteaof-bg-%d.aof  VS.  temp-rewriteaof-%d.aof
-    // TODO: 为什么要准备两个名字，这两个名字都会对应创建一个临时文件吗？
-    // temp-rewriteaof-%d.aof 是最开始进行 AOF 重写的产物，重写之后的结果就在这里（在子进程中进行并完成）
-    // temp-rewriteaof-bg-%d.aof 当上面的那个成功了之后，在 rename 为 temp-rewriteaof-bg-%d.aof，（在子进程中进行并完成）
-    // 然后子进程就完成了所有的任务了，剩下的就是父进程的工作了
-    // 父进程：
-    snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
-    fp = fopen(tmpfile,"w");
-    if (!fp) {
-        redisLog(REDIS_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
-        return REDIS_ERR;
-    }
-
-    // 初始化文件 io，指向 temp-rewriteaof-%d.aof 文件（本函数使用）
-    rioInitWithFile(&aof,fp);
-
-    // 设置每写入 REDIS_AOF_AUTOSYNC_BYTES 字节
-    // 就执行一次 FSYNC 
-    // 防止缓存中积累太多命令内容，造成 I/O 阻塞时间过长
-    /**
-     * # When a child rewrites the AOF file, if the following option is enabled
-     * # the file will be fsync-ed every 32 MB of data generated. This is useful
-     * # in order to commit the file to the disk more incrementally and avoid
-     * # big latency spikes.
-     * aof-rewrite-incremental-fsync yes
-    */
-    if (server.aof_rewrite_incremental_fsync)
-        rioSetAutoSync(&aof,REDIS_AOF_AUTOSYNC_BYTES);
+    size_t processed = 0;
 
     /**
      * 实际上，所谓的 rewrite 就是从当前的 redis-server 内存中，
@@ -1484,6 +2195,9 @@ int rewriteAppendOnlyFile(char *filename) {
      * }
     */
 
+    // 先写入函数，脚本可能在之后的命令中被调用
+    if (rewriteFunctions(aof) == 0) goto werr;
+
     // 遍历所有数据库
     for (j = 0; j < server.dbnum; j++) {
 
@@ -1497,17 +2211,14 @@ int rewriteAppendOnlyFile(char *filename) {
 
         // 创建键空间迭代器
         di = dictGetSafeIterator(d);
-        if (!di) {
-            fclose(fp);
-            return REDIS_ERR;
-        }
+        if (!di) return REDIS_ERR;
 
         /* rewirte CMD: SELECT j
          *
          * 首先写入 SELECT 命令，确保之后的数据会被插入到正确的数据库上
          */
-        if (rioWrite(&aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
-        if (rioWriteBulkLongLong(&aof,j) == 0) goto werr;
+        if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
+        if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
         /* Iterate this DB and writing for every entry(key-value pair) 
          *
@@ -1517,6 +2228,7 @@ int rewriteAppendOnlyFile(char *filename) {
             sds keystr;
             robj key, *o;
             long long expiretime;
+            size_t written = aof->processed_bytes;
 
             // 取出键
             keystr = dictGetKey(de);
@@ -1541,18 +2253,22 @@ int rewriteAppendOnlyFile(char *filename) {
             if (o->type == REDIS_STRING) {
                 /* Emit a SET command */
                 char cmd[]="*3\r\n$3\r\nSET\r\n";
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
                 /* Key and value */
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,o) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkObject(aof,o) == 0) goto werr;
             } else if (o->type == REDIS_LIST) {
-                if (rewriteListObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteListObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == REDIS_SET) {
-                if (rewriteSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == REDIS_ZSET) {
-                if (rewriteSortedSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSortedSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == REDIS_HASH) {
-                if (rewriteHashObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteHashObject(aof,&key,o) == 0) goto werr;
+            } else if (o->type == REDIS_STREAM) {
+                if (rewriteStreamObject(aof,&key,o) == 0) goto werr;
+            } else if (o->type == REDIS_MODULE) {
+                if (rewriteModuleObject(aof,&key,o) == 0) goto werr;
             } else {
                 redisPanic("Unknown object type");
             }
@@ -1565,16 +2281,109 @@ int rewriteAppendOnlyFile(char *filename) {
                 char cmd[]="*3\r\n$9\r\nPEXPIREAT\r\n";
 
                 // 写入 PEXPIREAT expiretime 命令
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkLongLong(&aof,expiretime) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
             }
+
+            /* A child won't read the value again: give its pages back. */
+            if (server.in_fork_child && server.fork_friendly)
+                dismissObject(o,aof->processed_bytes-written);
+
+            /* In a child, report the copy-on-write size from time to time. */
+            if ((++processed & 1023) == 0) sendChildInfoIfNeeded();
         }
 
         // 释放迭代器
         dictReleaseIterator(di);
     }
 
+    return REDIS_OK;
+
+werr:
+    if (di) dictReleaseIterator(di);
+    return REDIS_ERR;
+}
+
+/* Write a sequence of commands able to fully rebuild the dataset into
+ * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
+ *
+ * 将一集足以还原当前数据集的命令写入到 filename 指定的文件中。
+ *
+ * 这个函数被 REWRITEAOF 和 BGREWRITEAOF 两个命令调用。
+ * （REWRITEAOF 似乎已经是一个废弃的命令）
+ *
+ * In order to minimize the number of commands needed in the rewritten
+ * log Redis uses variadic commands when possible, such as RPUSH, SADD
+ * and ZADD. However at max REDIS_AOF_REWRITE_ITEMS_PER_CMD items per time
+ * are inserted using a single command. 
+ *
+ * 为了最小化重建数据集所需执行的命令数量，
+ * Redis 会尽可能地使用接受可变参数数量的命令，比如 RPUSH 、SADD 和 ZADD 等。
+ *
+ * 不过单个命令每次处理的元素数量不能超过 REDIS_AOF_REWRITE_ITEMS_PER_CMD 。
+ * #define REDIS_AOF_REWRITE_ITEMS_PER_CMD 64
+ * 避免一个 CMD 过长，要是中间坏了一个，会很麻烦
+ */
+int rewriteAppendOnlyFile(char *filename) {
+    rio aof;
+    FILE *fp;
+    char tmpfile[256];
+
+    /* Note that we have to use a different temp name here compared to the
+     * one used by rewriteAppendOnlyFileBackground() function. 
+     *
+     * 创建临时文件
+     *
+     * 注意这里创建的文件名和 rewriteAppendOnlyFileBackground() 创建的文件名稍有不同
+     */
+    // temp-rewriteaof-bg-%d.aof  VS.  temp-rewriteaof-%d.aof
+    // TODO: 为什么要准备两个名字，这两个名字都会对应创建一个临时文件吗？
+    // temp-rewriteaof-%d.aof 是最开始进行 AOF 重写的产物，重写之后的结果就在这里（在子进程中进行并完成）
+    // temp-rewriteaof-bg-%d.aof 当上面的那个成功了之后，在 rename 为 temp-rewriteaof-bg-%d.aof，（在子进程中进行并完成）
+    // 然后子进程就完成了所有的任务了，剩下的就是父进程的工作了
+    // 父进程：
+    snprintf(tmpfile,256,"%s/temp-rewriteaof-%d.aof",
+        server.aof_dirname, (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        redisLog(REDIS_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
+        return REDIS_ERR;
+    }
+
+    // 初始化文件 io，指向 temp-rewriteaof-%d.aof 文件（本函数使用）
+    rioInitWithFile(&aof,fp);
+
+    // 设置每写入 REDIS_AUTOSYNC_BYTES 字节
+    // 就执行一次 FSYNC 
+    // 防止缓存中积累太多命令内容，造成 I/O 阻塞时间过长
+    /**
+     * # When a child rewrites the AOF file, if the following option is enabled
+     * # the file will be fsync-ed every 32 MB of data generated. This is useful
+     * # in order to commit the file to the disk more incrementally and avoid
+     * # big latency spikes.
+     * aof-rewrite-incremental-fsync yes
+    */
+    if (server.aof_rewrite_incremental_fsync)
+        rioSetAutoSync(&aof,REDIS_AUTOSYNC_BYTES);
+
+    /* With the RDB preamble the dataset is saved in RDB format, that is
+     * both faster to generate and to load. The commands received by the
+     * parent in the meantime are in the INCR file opened before the fork.
+     *
+     * 使用 RDB 前导时，以 RDB 格式保存数据库，父进程之后收到的命令在新的 INCR 文件中
+     */
+    if (server.aof_use_rdb_preamble) {
+        int error;
+
+        if (rdbSaveRio(&aof,&error,REDIS_RDB_SAVE_AOF_PREAMBLE) == REDIS_ERR) {
+            errno = error;
+            goto werr;
+        }
+    } else {
+        if (rewriteAppendOnlyFileRio(&aof) == REDIS_ERR) goto werr;
+    }
+
     /* Make sure data will not remain on the OS's output buffers */
     // 冲洗并关闭新 AOF 文件
     if (fflush(fp) == EOF) goto werr;
@@ -1600,7 +2409,6 @@ werr:
     fclose(fp);
     unlink(tmpfile);
     redisLog(REDIS_WARNING,"Write error writing append only file on disk: %s", strerror(errno));
-    if (di) dictReleaseIterator(di);
     return REDIS_ERR;
 }
 
@@ -1609,35 +2417,22 @@ werr:
  * 以下是后台重写 AOF 文件（BGREWRITEAOF）的工作步骤：
  *
  * 1) The user calls BGREWRITEAOF
- * 2) Redis calls this function, that forks():
+ * 2) Redis calls this function, that opens a new INCR file and forks():
  *    2a) the child rewrite the append only file in a temp file.
- *    2b) the parent accumulates differences in server.aof_rewrite_buf.
- *        父进程将新输入的写命令追加到 server.aof_rewrite_buf 中
+ *    2b) the parent appends the new commands to the new INCR file.
+ *        父进程将新输入的写命令追加到新的 INCR 文件中
  * 3) When the child finished '2a' exists.
- * 4) The parent will trap the exit code, if it's OK, will append the
- *    data accumulated into server.aof_rewrite_buf into the temp file, and
- *    finally will rename(2) the temp file in the actual file name.
- *    The the new file is reopened as the new append only file. Profit!
+ * 4) The parent will trap the exit code, if it's OK, will rename(2) the
+ *    temp file as the new BASE file, and persist a manifest listing just
+ *    the new BASE and the INCR file opened in '2'. The old files are then
+ *    deleted in background. Profit!
  *
  *    父进程会捕捉子进程的退出信号，
  *    如果子进程的退出状态是 OK 的话，
- *    那么父进程将新输入命令的缓存追加到临时文件，
- *    然后使用 rename(2) 对临时文件改名，用它代替旧的 AOF 文件，
+ *    那么父进程使用 rename(2) 把临时文件改名为新的 BASE 文件，
+ *    然后写入新的 manifest ，用它代替旧的 BASE 以及 INCR 文件，
  *    至此，后台 AOF 重写完成。
  */
-/**
- * How it works
- * Log rewriting uses the same copy-on-write trick already in use for snapshotting. This is how it works:
- *   1) Redis forks, so now we have a child and a parent process.
- *   2) The child starts writing the new AOF in a temporary file.
- *   3) The parent accumulates all the new changes in an in-memory buffer
- *      (but at the same time it writes the new changes in the old append-only file,
- *       so if the rewriting fails, we are safe).
- *   4) When the child is done rewriting the file, the parent gets a signal,
- *      and appends the in-memory buffer at the end of the file generated by the child.
- *   5) Profit! Now Redis atomically renames the old file into the new one,
- *      and starts appending new data into the new file.
-*/
 int rewriteAppendOnlyFileBackground(void) {
     pid_t childpid;
     long long start;
@@ -1645,7 +2440,22 @@ int rewriteAppendOnlyFileBackground(void) {
     // 已经有进程在进行 AOF 重写了
     if (server.aof_child_pid != -1) return REDIS_ERR;
 
+    if (dirCreateIfMissing(server.aof_dirname) == -1) {
+        redisLog(REDIS_WARNING,"Can't create the AOF directory %s: %s",
+            server.aof_dirname, strerror(errno));
+        return REDIS_ERR;
+    }
+
+    /* The commands received from now on go to a new INCR file.
+     *
+     * 从现在开始，命令写入新的 INCR 文件 */
+    if (server.aof_state != REDIS_AOF_OFF) {
+        flushAppendOnlyFile(1);
+        if (openNewIncrAofForAppend() == REDIS_ERR) return REDIS_ERR;
+    }
+
     // 记录 fork 开始前的时间，计算 fork 耗时用
+    openChildInfoPipe();
     start = ustime();
 
     if ((childpid = fork()) == 0) {
@@ -1658,9 +2468,12 @@ int rewriteAppendOnlyFileBackground(void) {
 
         // 为进程设置名字，方便记认
         redisSetProcTitle("redis-aof-rewrite");
+        redisSetCpuAffinity(server.aof_rewrite_cpulist);
+        server.in_fork_child = REDIS_CHILD_INFO_TYPE_AOF;
 
         // 创建临时文件，并进行 AOF 重写
-        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());
+        snprintf(tmpfile,256,"%s/temp-rewriteaof-bg-%d.aof",
+            server.aof_dirname, (int) getpid());
         if (rewriteAppendOnlyFile(tmpfile) == REDIS_OK) {
             size_t private_dirty = zmalloc_get_private_dirty();
 
@@ -1669,6 +2482,7 @@ int rewriteAppendOnlyFileBackground(void) {
                     "AOF rewrite: %zu MB of memory used by copy-on-write",
                     private_dirty/(1024*1024));
             }
+            sendChildInfo(REDIS_CHILD_INFO_TYPE_AOF,private_dirty);
             // 发送重写成功信号
             exitFromChild(0);
         } else {
@@ -1684,8 +2498,11 @@ int rewriteAppendOnlyFileBackground(void) {
         /* Parent */
         // 记录执行 fork 所消耗的时间
         server.stat_fork_time = ustime()-start;
+        server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
+        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
 
         if (childpid == -1) {
+            closeChildInfoPipe();
             redisLog(REDIS_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
@@ -1703,16 +2520,6 @@ int rewriteAppendOnlyFileBackground(void) {
         // 关闭字典自动 rehash
         updateDictResizePolicy();
 
-        /* We set appendseldb to -1 in order to force the next call to the
-         * feedAppendOnlyFile() to issue a SELECT command, so the differences
-         * accumulated by the parent into server.aof_rewrite_buf will start
-         * with a SELECT statement and it will be safe to merge. 
-         *
-         * 将 aof_selected_db 设为 -1 ，
-         * 强制让 feedAppendOnlyFile() 下次执行时引发一个 SELECT 命令，
-         * 从而确保之后新添加的命令会设置到正确的数据库中
-         */
-        server.aof_selected_db = -1;
         replicationScriptCacheFlush();  // TODO: 看完 repl 之后再看这个
         return REDIS_OK;
     }
@@ -1727,7 +2534,10 @@ void bgrewriteaofCommand(redisClient *c) {
 
     // 如果正在执行 BGSAVE ，那么预定 BGREWRITEAOF
     // 等 BGSAVE 完成之后， BGREWRITEAOF 就会开始执行（避免大量的 IO 竞争、IO-Wait）
-    } else if (server.rdb_child_pid != -1) {
+    /* Inside MULTI/EXEC or a script the rewrite is scheduled as well, since
+     * switching to a new INCR file would split the transaction in two. */
+    } else if (server.rdb_child_pid != -1 ||
+               (c->flags & (REDIS_MULTI|REDIS_LUA_CLIENT))) {
         server.aof_rewrite_scheduled = 1;
         addReplyStatus(c,"Background append only file rewriting scheduled");
 
@@ -1746,32 +2556,11 @@ void bgrewriteaofCommand(redisClient *c) {
 void aofRemoveTempFile(pid_t childpid) {
     char tmpfile[256];
 
-    snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) childpid);
+    snprintf(tmpfile,256,"%s/temp-rewriteaof-bg-%d.aof",
+        server.aof_dirname, (int) childpid);
     unlink(tmpfile);
 }
 
-/* Update the server.aof_current_size filed explicitly using stat(2)
- * to check the size of the file. This is useful after a rewrite or after
- * a restart, normally the size is updated just adding the write length
- * to the current length, that is much faster. 
- *
- * 将 aof 文件的当前大小记录到服务器状态中。
- *
- * 通常用于 BGREWRITEAOF 执行之后，或者服务器重启之后。
- */
-void aofUpdateCurrentSize(void) {
-    struct redis_stat sb;
-
-    // 读取文件状态
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
-        redisLog(REDIS_WARNING,"Unable to obtain the AOF file length. stat: %s",
-            strerror(errno));
-    } else {
-        // 设置到服务器
-        server.aof_current_size = sb.st_size;
-    }
-}
-
 /* A background append only file rewriting (BGREWRITEAOF) terminated its work.
  * Handle this. 
  *
@@ -1779,176 +2568,97 @@ void aofUpdateCurrentSize(void) {
  */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     if (!bysignal && exitcode == 0) {
-        int newfd, oldfd;
+        aofManifest *am;
+        aofInfo *ai;
+        list *obsolete;
+        listNode *ln;
+        listIter li;
+        sds tmppath, newpath;
         char tmpfile[256];
         long long now = ustime();
 
         redisLog(REDIS_NOTICE,
             "Background AOF rewrite terminated with success");
 
-        /* Flush the differences accumulated by the parent to the
-         * rewritten AOF. */
-        // 打开保存新 AOF 文件内容的临时文件
-        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
-            (int)server.aof_child_pid);
-        newfd = open(tmpfile,O_WRONLY|O_APPEND);    // 因为还要把父进程积累的 AOF-rewrite 数据写进去
-        if (newfd == -1) {
-            redisLog(REDIS_WARNING,
-                "Unable to open the temporary AOF produced by the child: %s", strerror(errno));
-            goto cleanup;
-        }
-
-        // 将累积的重写缓存写入到临时文件中
-        // 这个函数调用的 write 操作会阻塞主进程
-        if (aofRewriteBufferWrite(newfd) == -1) {
-            redisLog(REDIS_WARNING,
-                "Error trying to flush the parent diff to the rewritten AOF: %s", strerror(errno));
-            close(newfd);
-            goto cleanup;
-        }
-
-        redisLog(REDIS_NOTICE,
-            "Parent diff successfully flushed to the rewritten AOF (%lu bytes)", aofRewriteBufferSize());
-
-        // unlink消耗的时间取决于文件的大小
-        // rename 会 close 已经存在的文件，进而可能触发 unlink 的调用
-        /* The only remaining thing to do is to rename the temporary file to
-         * the configured file and switch the file descriptor used to do AOF    
-         * writes. We don't want close(2) or rename(2) calls to block the
-         * server on old file deletion.
-         *
-         * 剩下的工作就是将临时文件改名为 AOF 程序指定的文件名，
-         * 并将新文件的 fd 设为 AOF 程序的写目标。
-         *
-         * 不过这里有一个问题 ——
-         * 我们不想 close(2) 或者 rename(2) 在删除旧文件时阻塞。
-         *
-         * There are two possible scenarios:
-         *
-         * 以下是两个可能的场景：
-         *
-         * 1) AOF is DISABLED and this was a one time rewrite. The temporary
-         * file will be renamed to the configured file. When this file already
-         * exists, it will be unlinked, which may block the server.
-         *
-         * AOF 被关闭，这个是一次单次的写操作。
-         * 临时文件会被改名为 AOF 文件。
-         * 本来已经存在的 AOF 文件会被 unlink ，这可能会阻塞服务器。
+        /* The new BASE replaces the old one, and all the INCR files but the
+         * last: that is the one opened when the rewrite started, holding
+         * the commands the child didn't see. With AOF off no INCR file is
+         * needed at all.
          *
-         * 2) AOF is ENABLED and the rewritten AOF will immediately start
-         * receiving writes. After the temporary file is renamed to the
-         * configured file, the original AOF file descriptor will be closed.
-         * Since this will be the last reference to that file, closing it
-         * causes the underlying file to be unlinked, which may block the
-         * server.
-         *
-         * AOF 被开启，并且重写后的 AOF 文件会立即被用于接收新的写入命令。
-         * 当临时文件被改名为 AOF 文件时，原来的 AOF 文件描述符会被关闭。
-         * 因为 Redis 会是最后一个引用这个文件的进程，
-         * 所以关闭这个文件会引起 unlink ，这可能会阻塞服务器。
-         *
-         * To mitigate the blocking effect of the unlink operation (either
-         * caused by rename(2) in scenario 1, or by close(2) in scenario 2), we
-         * use a background thread to take care of this. 
-         * 
-         * First, we make scenario 1 identical to scenario 2 by opening the target file
-         * when it exists. The unlink operation after the rename(2) will then
-         * be executed upon calling close(2) for its descriptor. Everything to
-         * guarantee atomicity for this switch has already happened by then, so
-         * we don't care what the outcome or duration of that close operation
-         * is, as long as the file descriptor is released again. 
-         *
-         * 为了避免出现阻塞现象，程序会将 close(2) 放到后台线程执行，
-         * 这样服务器就可以持续处理请求，不会被中断。
+         * 新的 BASE 替换旧的 BASE ，以及除了重写开始时打开的最后一个 INCR 之外的所有 INCR 文件
          */
-        if (server.aof_fd == -1) {
-            /* AOF disabled */
-
-             /* Don't care if this fails: oldfd will be -1 and we handle that.
-              * One notable case of -1 return is if the old file does
-              * not exist. */
-             oldfd = open(server.aof_filename,O_RDONLY|O_NONBLOCK);
-        } else {
-            /* AOF enabled */
-            oldfd = -1; /* We'll set this to the current AOF filedes later. */
+        am = aofManifestDup(server.aof_manifest);
+        obsolete = listCreate();
+        listSetFreeMethod(obsolete,aofInfoFree);
+        if (am->base_aof_info) listAddNodeTail(obsolete,am->base_aof_info);
+        while ((ln = listFirst(am->incr_aof_list)) != NULL &&
+               (server.aof_fd == -1 || ln != listLast(am->incr_aof_list)))
+        {
+            listAddNodeTail(obsolete,aofInfoDup(listNodeValue(ln)));
+            listDelNode(am->incr_aof_list,ln);
         }
+        ai = aofInfoCreate();
+        ai->file_seq = ++am->curr_base_file_seq;
+        ai->file_name = sdscatprintf(sdsempty(),"%s.%lld.base.%s",
+            server.aof_filename, ai->file_seq,
+            server.aof_use_rdb_preamble ? "rdb" : "aof");
+        ai->file_type = REDIS_AOF_FILE_TYPE_BASE;
+        am->base_aof_info = ai;
 
-        /* Rename the temporary file. This will not unlink the target file if
-         * it exists, because we reference it with "oldfd". 
-         *
-         * 对临时文件进行改名，替换现有的 AOF 文件。
+        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+            (int)server.aof_child_pid);
+        tmppath = makePath(server.aof_dirname,tmpfile);
+        newpath = makePath(server.aof_dirname,ai->file_name);
+
+        /* Persisting the manifest is what actually switches to the new
+         * files: until then the old ones are still the AOF, and if this
+         * fails we just drop the new BASE.
          *
-         * server.aof_filename 不会在这里被 unlink ，因为 oldfd 引用了它。
-         */
-        // 只要 server.aof_filename 这个文件被打开了，就不用担心会触发 unlink 的调用（这个调用会 block）
-        if (rename(tmpfile,server.aof_filename) == -1) {
+         * 写入 manifest 才是真正切换到新文件的时刻，失败的话丢弃新的 BASE 即可 */
+        if (rename(tmppath,newpath) == -1) {
             redisLog(REDIS_WARNING,
-                "Error trying to rename the temporary AOF file: %s", strerror(errno));
-            close(newfd);
-            if (oldfd != -1) close(oldfd);
-            goto cleanup;
-        }
-
-        if (server.aof_fd == -1) {
-            /* AOF disabled, we don't need to set the AOF file descriptor
-             * to this new file, so we can close it. 
-             *
-             * AOF 被关闭，直接关闭 AOF 文件，
-             * 因为关闭 AOF 本来就会引起阻塞，所以这里就算 close 被阻塞也无所谓
-             */
-            close(newfd);
+                "Error trying to rename the temporary AOF file %s into %s: %s",
+                tmppath, newpath, strerror(errno));
+            server.aof_lastbgrewrite_status = REDIS_ERR;
+        } else if (persistAofManifest(am) == REDIS_ERR) {
+            aofDelFile(ai->file_name);
+            server.aof_lastbgrewrite_status = REDIS_ERR;
         } else {
-            /* AOF enabled, replace the old fd with the new one. 
-             *
-             * 用新 AOF 文件的 fd 替换原来 AOF 文件的 fd
-             */
-            oldfd = server.aof_fd;
-            server.aof_fd = newfd;
+            aofManifestFree(server.aof_manifest);
+            server.aof_manifest = am;
+            am = NULL;
 
-            // 因为前面将 AOF-rewrite-buf 里面的数据 writr 进了 IO buf 里面
-            // 所以这里可能要立即 fsync 一次
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
-                aof_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
-                aof_background_fsync(newfd);
+            /* The old files are deleted in background.
+             *
+             * 在后台删除旧的文件 */
+            listRewind(obsolete,&li);
+            while ((ln = listNext(&li)) != NULL)
+                aofDelFile(((aofInfo*)listNodeValue(ln))->file_name);
 
-            // 强制引发 AOF 文件中，增加 SELECT DB 的 CMD
-            server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+            // 记录前一次重写时的大小，将会影响 redis-server 决策：是否需要自动执行 AOF-rewrite
+            server.aof_rewrite_base_size = getAppendOnlyFileSize(ai->file_name);
+            server.aof_current_size = server.aof_rewrite_base_size;
+            if (server.aof_fd != -1)
+                server.aof_current_size += server.aof_last_incr_size;
 
-            // 更新 AOF 文件的大小
-            aofUpdateCurrentSize();
+            server.aof_lastbgrewrite_status = REDIS_OK;
 
-            // 记录前一次重写时的大小，将会影响 redis-server 决策：是否需要自动执行 AOF-rewrite
-            server.aof_rewrite_base_size = server.aof_current_size;
+            redisLog(REDIS_NOTICE, "Background AOF rewrite finished successfully");
 
-            /* Clear regular AOF buffer since its contents was just written to
-             * the new AOF from the background rewrite buffer. 
+            /* Change state from WAIT_REWRITE to ON if needed 
              *
-             * 清空 AOF 缓存，因为它的内容已经被写入过了，没用了
+             * 如果是第一次创建 AOF 文件，那么更新 AOF 状态
              */
-            sdsfree(server.aof_buf);
-            server.aof_buf = sdsempty();
-        }
-
-        server.aof_lastbgrewrite_status = REDIS_OK;
-
-        redisLog(REDIS_NOTICE, "Background AOF rewrite finished successfully");
-
-        /* Change state from WAIT_REWRITE to ON if needed 
-         *
-         * 如果是第一次创建 AOF 文件，那么更新 AOF 状态
-         */
-        if (server.aof_state == REDIS_AOF_WAIT_REWRITE)
-            server.aof_state = REDIS_AOF_ON;
-
-        /* Asynchronously close the overwritten AOF. 
-         *
-         * 异步关闭旧 AOF 文件
-         */
-        if (oldfd != -1) bioCreateBackgroundJob(REDIS_BIO_CLOSE_FILE,(void*)(long)oldfd,NULL,NULL);
+            if (server.aof_state == REDIS_AOF_WAIT_REWRITE)
+                server.aof_state = REDIS_AOF_ON;
 
-        redisLog(REDIS_VERBOSE,
-            "Background AOF rewrite signal handler took %lldus", ustime()-now);
+            redisLog(REDIS_VERBOSE,
+                "Background AOF rewrite signal handler took %lldus", ustime()-now);
+        }
+        if (am) aofManifestFree(am);
+        listRelease(obsolete);
+        sdsfree(tmppath);
+        sdsfree(newpath);
 
     // BGREWRITEAOF 重写出错
     } else if (!bysignal && exitcode != 0) {
@@ -1965,10 +2675,6 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
             "Background AOF rewrite terminated by signal %d", bysignal);
     }
 
-cleanup:
-
-    // 清空 AOF 缓冲区
-    aofRewriteBufferReset();
 
     // 移除临时文件
     aofRemoveTempFile(server.aof_child_pid);
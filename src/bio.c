@@ -141,13 +141,6 @@ struct bio_job {
 
 void *bioProcessBackgroundJobs(void *arg);
 
-/* Make sure we have enough stack to perform all the things we do in the
- * main thread. 
- *
- * 子线程栈大小
- */
-#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
-
 /* Initialize the background system, spawning the thread. 
  *
  * 初始化后台任务系统，生成线程
@@ -230,6 +223,9 @@ void *bioProcessBackgroundJobs(void *arg) {
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
+    // 绑定到 bio-cpulist 指定的 CPU ，未设置时继承主线程的设置
+    redisSetCpuAffinity(server.bio_cpulist);
+
     pthread_mutex_lock(&bio_mutex[type]);
     /* Block SIGALRM so we are sure that only the main thread will
      * receive the watchdog signal. */
@@ -262,10 +258,26 @@ void *bioProcessBackgroundJobs(void *arg) {
         /* Process the job accordingly to its type. */
         // 执行任务
         if (type == REDIS_BIO_CLOSE_FILE) {
+            // arg2 非空时，关闭之前先 fsync 文件
+            if (job->arg2) aof_fsync((long)job->arg1);
             close((long)job->arg1);
 
         } else if (type == REDIS_BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == REDIS_BIO_LAZY_FREE) {
+            /* What we free changes depending on what arguments are set:
+             * arg1 -> free the object at pointer.
+             * arg2 & arg3 -> free two dictionaries (a Redis DB).
+             * only arg2 -> free the expire index of a DB.
+             * only arg3 -> free the skiplist. */
+            if (job->arg1)
+                lazyfreeFreeObjectFromBioThread(job->arg1);
+            else if (job->arg2 && job->arg3)
+                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
+            else if (job->arg2)
+                lazyfreeFreeExpireIndexFromBioThread(job->arg2);
+            else if (job->arg3)
+                lazyfreeFreeSlotsMapFromBioThread(job->arg3);
 
         } else {
             redisPanic("Wrong job type in bioProcessBackgroundJobs().");
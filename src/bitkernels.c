@@ -0,0 +1,388 @@
+/* Bulk bitmap kernels used by BITCOUNT, BITPOS and BITOP.
+ *
+ * Every kernel has a portable C version working one 64 bit word at a time.
+ * On x86-64 builds with GCC or clang there are also POPCNT and AVX2
+ * versions, compiled with per-function target attributes (so the rest of
+ * the server keeps the generic -march) and selected at runtime with
+ * __builtin_cpu_supports(), that reads the CPUID bits cached at startup.
+ *
+ * 位图批量计算的内核：可移植版本，以及在运行时根据 CPUID 选择的 POPCNT / AVX2 版本
+ *
+ * Copyright (c) 2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "bitkernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(NO_BITKERNELS_SIMD)
+#define BITKERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* BITOP applies every source to a block of the destination before moving
+ * to the next one, so the block stays in L1 no matter how many keys. */
+#define BITKERNEL_OP_BLOCK 4096
+
+/* ---------------------------------------------------------------------------
+ * Portable kernels.
+ * ------------------------------------------------------------------------ */
+
+static inline size_t popcount64(uint64_t v) {
+    v = v - ((v >> 1) & UINT64_C(0x5555555555555555));
+    v = (v & UINT64_C(0x3333333333333333)) +
+        ((v >> 2) & UINT64_C(0x3333333333333333));
+    v = (v + (v >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return (v * UINT64_C(0x0101010101010101)) >> 56;
+}
+
+static size_t popcountPortable(const unsigned char *p, size_t len) {
+    size_t bits = 0;
+    uint64_t v;
+
+    while (len >= 8) {
+        memcpy(&v,p,8);
+        bits += popcount64(v);
+        p += 8;
+        len -= 8;
+    }
+    if (len) {
+        v = 0;
+        memcpy(&v,p,len);
+        bits += popcount64(v);
+    }
+    return bits;
+}
+
+static size_t skipPortable(const unsigned char *p, size_t len,
+                           unsigned char skipval) {
+    uint64_t w, skipword = skipval ? UINT64_MAX : 0;
+    size_t skipped = 0;
+
+    while (len >= 32) {
+        uint64_t a, b, c, d;
+
+        memcpy(&a,p,8); memcpy(&b,p+8,8);
+        memcpy(&c,p+16,8); memcpy(&d,p+24,8);
+        w = (a ^ skipword) | (b ^ skipword) | (c ^ skipword) | (d ^ skipword);
+        if (w) break;
+        p += 32;
+        len -= 32;
+        skipped += 32;
+    }
+    return skipped;
+}
+
+static void opApplyPortable(int op, unsigned char *dst,
+                            const unsigned char *s, size_t len) {
+    uint64_t a, b;
+    size_t i;
+
+    for (i = 0; i+8 <= len; i += 8) {
+        memcpy(&a,dst+i,8);
+        memcpy(&b,s+i,8);
+        switch(op) {
+        case BITOP_AND: a &= b; break;
+        case BITOP_OR:  a |= b; break;
+        case BITOP_XOR: a ^= b; break;
+        }
+        memcpy(dst+i,&a,8);
+    }
+    for (; i < len; i++) {
+        switch(op) {
+        case BITOP_AND: dst[i] &= s[i]; break;
+        case BITOP_OR:  dst[i] |= s[i]; break;
+        case BITOP_XOR: dst[i] ^= s[i]; break;
+        }
+    }
+}
+
+static void opNotPortable(unsigned char *dst, size_t len) {
+    uint64_t a;
+    size_t i;
+
+    for (i = 0; i+8 <= len; i += 8) {
+        memcpy(&a,dst+i,8);
+        a = ~a;
+        memcpy(dst+i,&a,8);
+    }
+    for (; i < len; i++) dst[i] = ~dst[i];
+}
+
+/* ---------------------------------------------------------------------------
+ * x86-64 kernels.
+ * ------------------------------------------------------------------------ */
+
+#ifdef BITKERNELS_X86
+__attribute__((target("popcnt")))
+static size_t popcountPopcnt(const unsigned char *p, size_t len) {
+    uint64_t a, b, c, d, v;
+    size_t b0 = 0, b1 = 0, b2 = 0, b3 = 0;
+
+    // 四路独立累加，避免 popcnt 之间的依赖链
+    while (len >= 32) {
+        memcpy(&a,p,8); memcpy(&b,p+8,8);
+        memcpy(&c,p+16,8); memcpy(&d,p+24,8);
+        b0 += __builtin_popcountll(a);
+        b1 += __builtin_popcountll(b);
+        b2 += __builtin_popcountll(c);
+        b3 += __builtin_popcountll(d);
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        memcpy(&v,p,8);
+        b0 += __builtin_popcountll(v);
+        p += 8;
+        len -= 8;
+    }
+    if (len) {
+        v = 0;
+        memcpy(&v,p,len);
+        b0 += __builtin_popcountll(v);
+    }
+    return b0+b1+b2+b3;
+}
+
+/* Count with a 4 bit lookup table held in a register (PSHUFB), summing the
+ * per byte counts with PSADBW every 8 iterations so they can't overflow. */
+__attribute__((target("avx2,popcnt")))
+static size_t popcountAvx2(const unsigned char *p, size_t len) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+        0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i lowmask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    uint64_t lanes[4];
+    int i;
+
+    while (len >= 256) {
+        __m256i local = zero;
+
+        for (i = 0; i < 8; i++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            __m256i lo = _mm256_and_si256(v,lowmask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),lowmask);
+
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,lo));
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,hi));
+            p += 32;
+        }
+        acc = _mm256_add_epi64(acc,_mm256_sad_epu8(local,zero));
+        len -= 256;
+    }
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+popcountPopcnt(p,len);
+}
+
+__attribute__((target("avx2")))
+static size_t skipAvx2(const unsigned char *p, size_t len,
+                       unsigned char skipval) {
+    const __m256i sv = _mm256_set1_epi8((char)skipval);
+    size_t skipped = 0;
+
+    while (len >= 64) {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p),sv);
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p+32)),sv);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(a,b),_mm256_or_si256(a,b)))
+            break;
+        p += 64;
+        len -= 64;
+        skipped += 64;
+    }
+    return skipped+skipPortable(p,len,skipval);
+}
+
+__attribute__((target("avx2")))
+static void opApplyAvx2(int op, unsigned char *dst,
+                        const unsigned char *s, size_t len) {
+    size_t i = 0;
+
+    switch(op) {
+    case BITOP_AND:
+        for (; i+32 <= len; i += 32)
+            _mm256_storeu_si256((__m256i*)(dst+i),_mm256_and_si256(
+                _mm256_loadu_si256((const __m256i*)(dst+i)),
+                _mm256_loadu_si256((const __m256i*)(s+i))));
+        break;
+    case BITOP_OR:
+        for (; i+32 <= len; i += 32)
+            _mm256_storeu_si256((__m256i*)(dst+i),_mm256_or_si256(
+                _mm256_loadu_si256((const __m256i*)(dst+i)),
+                _mm256_loadu_si256((const __m256i*)(s+i))));
+        break;
+    case BITOP_XOR:
+        for (; i+32 <= len; i += 32)
+            _mm256_storeu_si256((__m256i*)(dst+i),_mm256_xor_si256(
+                _mm256_loadu_si256((const __m256i*)(dst+i)),
+                _mm256_loadu_si256((const __m256i*)(s+i))));
+        break;
+    }
+    opApplyPortable(op,dst+i,s+i,len-i);
+}
+#endif
+
+/* ---------------------------------------------------------------------------
+ * Dispatch.
+ * ------------------------------------------------------------------------ */
+
+#ifdef BITKERNELS_X86
+#define cpuHasAvx2() __builtin_cpu_supports("avx2")
+#define cpuHasPopcnt() __builtin_cpu_supports("popcnt")
+#else
+#define cpuHasAvx2() 0
+#define cpuHasPopcnt() 0
+#endif
+
+/* Return the number of bits set in the 'len' bytes at 's'. */
+size_t bitkernelPopcount(const void *s, size_t len) {
+#ifdef BITKERNELS_X86
+    if (cpuHasAvx2()) return popcountAvx2(s,len);
+    if (cpuHasPopcnt()) return popcountPopcnt(s,len);
+#endif
+    return popcountPortable(s,len);
+}
+
+/* Return how many leading bytes of 's' are equal to 'skipval' (0 or 255),
+ * always a multiple of 32: the caller looks for the first different bit in
+ * what follows. Used by BITPOS to jump over long runs of zeros or ones. */
+size_t bitkernelSkip(const void *s, size_t len, unsigned char skipval) {
+#ifdef BITKERNELS_X86
+    if (cpuHasAvx2()) return skipAvx2(s,len,skipval);
+#endif
+    return skipPortable(s,len,skipval);
+}
+
+/* Compute dst = dst OP src[1] OP ... OP src[numsrc-1] over 'len' bytes, or
+ * dst = ~dst for BITOP_NOT. The caller has already copied src[0] into dst,
+ * and every source must be at least 'len' bytes long. */
+void bitkernelOp(int op, unsigned char *dst, unsigned char **src,
+                 long numsrc, size_t len) {
+    void (*apply)(int, unsigned char *, const unsigned char *, size_t) =
+        opApplyPortable;
+    size_t off, block;
+    long i;
+
+    if (op == BITOP_NOT) {
+        opNotPortable(dst,len);
+        return;
+    }
+#ifdef BITKERNELS_X86
+    if (cpuHasAvx2()) apply = opApplyAvx2;
+#endif
+    for (off = 0; off < len; off += block) {
+        block = len-off;
+        if (block > BITKERNEL_OP_BLOCK) block = BITKERNEL_OP_BLOCK;
+        for (i = 1; i < numsrc; i++)
+            apply(op,dst+off,src[i]+off,block);
+    }
+}
+
+#ifdef BITKERNELS_BENCHMARK_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec*1000000)+tv.tv_usec;
+}
+
+static unsigned long long cycles(void) {
+#ifdef BITKERNELS_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#define BENCH(name, bytes, expr) do { \
+    long long t0 = usec(); unsigned long long c0 = cycles(); int r; \
+    for (r = 0; r < rounds; r++) { expr; } \
+    double us = (double)(usec()-t0), cyc = (double)(cycles()-c0); \
+    printf("%-22s %8.2f GB/s  %6.2f bytes/cycle\n", name, \
+        (double)(bytes)*rounds/us/1000, cyc ? (double)(bytes)*rounds/cyc : 0); \
+} while(0)
+
+int main(void) {
+    size_t len = 8*1024*1024, j;
+    int rounds = 20, numkeys = 30, k;
+    unsigned char *buf = malloc(len+1), *dst = malloc(len), *ref = malloc(len);
+    unsigned char **src = malloc(sizeof(unsigned char*)*numkeys);
+    size_t c1, c2 = 0, c3 = 0;
+    volatile size_t sink = 0;
+
+    srand(1234);
+    for (j = 0; j < len+1; j++) buf[j] = rand();
+    for (k = 0; k < numkeys; k++) {
+        src[k] = malloc(len);
+        for (j = 0; j < len; j++) src[k][j] = rand() | rand() | rand();
+    }
+
+    /* Check the variants against each other, also on unaligned input. */
+    c1 = popcountPortable(buf+1,len-3);
+#ifdef BITKERNELS_X86
+    c2 = cpuHasPopcnt() ? popcountPopcnt(buf+1,len-3) : c1;
+    c3 = cpuHasAvx2() ? popcountAvx2(buf+1,len-3) : c1;
+#else
+    c2 = c3 = c1;
+#endif
+    printf("popcount check: %s\n", (c1 == c2 && c1 == c3) ? "OK" : "FAILED");
+    memcpy(ref,src[0],len);
+    for (k = 1; k < numkeys; k++) opApplyPortable(BITOP_AND,ref,src[k],len);
+    memcpy(dst,src[0],len);
+    bitkernelOp(BITOP_AND,dst,src,numkeys,len);
+    printf("bitop check:    %s\n", memcmp(ref,dst,len) ? "FAILED" : "OK");
+
+    printf("\n%zu bytes, best kernel: %s\n", len,
+        cpuHasAvx2() ? "avx2" : (cpuHasPopcnt() ? "popcnt" : "portable"));
+    BENCH("popcount portable", len, sink += popcountPortable(buf,len));
+#ifdef BITKERNELS_X86
+    if (cpuHasPopcnt())
+        BENCH("popcount popcnt", len, sink += popcountPopcnt(buf,len));
+    if (cpuHasAvx2())
+        BENCH("popcount avx2", len, sink += popcountAvx2(buf,len));
+#endif
+    memset(dst,0,len);
+    BENCH("skip portable", len, sink += skipPortable(dst,len,0));
+#ifdef BITKERNELS_X86
+    if (cpuHasAvx2())
+        BENCH("skip avx2", len, sink += skipAvx2(dst,len,0));
+#endif
+    rounds = 2;
+    BENCH("bitop and x30 portable", len*numkeys,
+        for (k = 1; k < numkeys; k++) opApplyPortable(BITOP_AND,dst,src[k],len));
+    BENCH("bitop and x30 blocked", len*numkeys,
+        bitkernelOp(BITOP_AND,dst,src,numkeys,len));
+    return (c1 == c2 && c1 == c3) ? 0 : 1;
+}
+#endif
@@ -0,0 +1,17 @@
+#ifndef __BITKERNELS_H
+#define __BITKERNELS_H
+
+#include <stddef.h>
+
+/* Operations of bitkernelOp(), also used by BITOP. */
+#define BITOP_AND   0
+#define BITOP_OR    1
+#define BITOP_XOR   2
+#define BITOP_NOT   3
+
+size_t bitkernelPopcount(const void *s, size_t len);
+size_t bitkernelSkip(const void *s, size_t len, unsigned char skipval);
+void bitkernelOp(int op, unsigned char *dst, unsigned char **src,
+                 long numsrc, size_t len);
+
+#endif
@@ -59,6 +59,12 @@
  * When implementing a new type of blocking opeation, the implementation
  * should modify unblockClient() and replyToBlockedClientTimedOut() in order
  * to handle the btype-specific behavior of this two functions.
+ *
+ * Operations blocking for keys (BLPOP & co, XREAD) share the rest of the
+ * machinery: blockForKeys() registers the client in db->blocking_keys,
+ * signalKeyAsReady() is called by the commands adding data to a key, and
+ * handleClientsBlockedOnKeys() serves the clients after every command,
+ * calling the type-specific function of the key's type.
  */
 
 #include "redis.h"
@@ -124,7 +130,7 @@ void processUnblockedClients(void) {
         /* Process remaining data in the input buffer. */
         if (c->querybuf && sdslen(c->querybuf) > 0) {
             server.current_client = c;
-            processInputBuffer(c);
+            processInputBufferAndReplicate(c);
             server.current_client = NULL;
         }
     }
@@ -134,10 +140,16 @@ void processUnblockedClients(void) {
  * of operation the client is blocking for. */
 // 取消给定的客户端的阻塞状态
 void unblockClient(redisClient *c) {
-    if (c->btype == REDIS_BLOCKED_LIST) {
+    if (c->btype == REDIS_BLOCKED_LIST || c->btype == REDIS_BLOCKED_STREAM) {
         unblockClientWaitingData(c);
     } else if (c->btype == REDIS_BLOCKED_WAIT) {
         unblockClientWaitingReplicas(c);
+    } else if (c->btype == REDIS_BLOCKED_OFFSET) {
+        unblockClientWaitingOffset(c);
+    } else if (c->btype == REDIS_BLOCKED_MODULE) {
+        unblockClientFromModule(c);
+    } else if (c->btype == REDIS_BLOCKED_MIGRATE) {
+        unblockClientFromMigrate(c);
     } else {
         redisPanic("Unknown btype in unblockClient().");
     }
@@ -154,12 +166,257 @@ void unblockClient(redisClient *c) {
  * send it a reply of some kind. */
 // 等待超时，向被阻塞的客户端返回通知
 void replyToBlockedClientTimedOut(redisClient *c) {
-    if (c->btype == REDIS_BLOCKED_LIST) {
-        addReply(c,shared.nullmultibulk);
+    if (c->btype == REDIS_BLOCKED_LIST || c->btype == REDIS_BLOCKED_STREAM) {
+        addReplyNullArray(c);
     } else if (c->btype == REDIS_BLOCKED_WAIT) {
         addReplyLongLong(c,replicationCountAcksByOffset(c->bpop.reploffset));
+    } else if (c->btype == REDIS_BLOCKED_OFFSET) {
+        addReplyLongLong(c,replicationGetReadOffset());
+    } else if (c->btype == REDIS_BLOCKED_MODULE) {
+        moduleBlockedClientTimedOut(c);
+    } else if (c->btype == REDIS_BLOCKED_MIGRATE) {
+        /* MIGRATE ASYNC enforces its own I/O timeout: just detach. */
+        addReplySds(c,sdsnew("-IOERR timeout waiting for target instance\r\n"));
     } else {
         redisPanic("Unknown btype in replyToBlockedClientTimedOut().");
     }
 }
 
+/* Set a client in blocking mode for the specified key, with the specified
+ * timeout. 'btype' is REDIS_BLOCKED_LIST or REDIS_BLOCKED_STREAM: in the
+ * latter case 'ids' holds, for every key, the ID the client wants entries
+ * greater than. */
+// 根据给定数量的 key ，对给定客户端进行阻塞
+// 参数：
+// btype   阻塞类型
+// keys    任意多个 key
+// numkeys keys 的键数量
+// timeout 阻塞的最长时限
+// target  在解除阻塞时，将结果保存到这个 key 对象，而不是返回给客户端
+//         只用于 BRPOPLPUSH 命令
+// ids     每个 key 等待的最小 ID（不含），只用于 XREAD 命令
+// 核心的 block 操作，当有 key 没办法
+void blockForKeys(redisClient *c, int btype, robj **keys, int numkeys, mstime_t timeout, robj *target, streamID *ids) {
+    dictEntry *de;
+    list *l;
+    int j;
+
+    // 设置阻塞状态的超时和目标选项
+    c->bpop.timeout = timeout;
+
+    // target 在执行 RPOPLPUSH 命令时使用
+    c->bpop.target = target;
+
+    if (target != NULL) incrRefCount(target);
+
+    // 关联阻塞客户端和键的相关信息
+    for (j = 0; j < numkeys; j++) {
+
+        /* If the key already exists in the dict ignore it. */
+        // c->bpop.keys 是一个集合（值为 NULL 的字典）
+        // 它记录所有造成客户端阻塞的键
+        // 以下语句在键不存在于集合的时候，将它添加到集合
+        if (btype == REDIS_BLOCKED_STREAM) {
+            streamID *id = zmalloc(sizeof(*id));
+
+            *id = ids[j];
+            if (dictAdd(c->bpop.keys,keys[j],id) != DICT_OK) {
+                zfree(id);
+                continue;
+            }
+        } else {
+            if (dictAdd(c->bpop.keys,keys[j],NULL) != DICT_OK) continue;
+        }
+
+        incrRefCount(keys[j]);
+
+        /* 以便快速检测当前 key 是否被 block */
+        /* And in the other "side", to map keys -> clients */
+        // c->db->blocking_keys 字典的键为造成客户端阻塞的键
+        // 而值则是一个链表，链表中包含了所有被阻塞的客户端
+        // 以下程序将阻塞键和被阻塞客户端关联起来
+        // 只有把被 block 的 key 放进 hash-table 里面去，才能够在 push 的时候，快速确认这个 key 是否被阻塞等待
+        // 是的话，那就把 push 的 node pop 给对应的 client
+        de = dictFind(c->db->blocking_keys,keys[j]);
+        if (de == NULL) {
+            // 链表不存在，新创建一个，并将它关联到字典中
+            int retval;
+
+            /* For every key we take a list of clients blocked for it */
+            l = listCreate();
+            retval = dictAdd(c->db->blocking_keys,keys[j],l);
+            incrRefCount(keys[j]);
+            redisAssertWithInfo(c,keys[j],retval == DICT_OK);
+        } else {
+            l = dictGetVal(de);
+        }
+        // 将客户端填接到被阻塞客户端的链表中
+        // 顺序记录 block 在这个 key 上面的 client，等有新的 push 进来之后，顺序响应
+        listAddNodeTail(l,c);
+    }
+    blockClient(c,btype);
+}
+
+/* Unblock a client that's waiting in a blocking operation such as BLPOP
+ * or XREAD.
+ * You should never call this function directly, but unblockClient() instead. */
+// 消除所有跟本 client 相关的 block 记录
+void unblockClientWaitingData(redisClient *c) {
+    dictEntry *de;
+    dictIterator *di;
+    list *l;
+
+    redisAssertWithInfo(c,NULL,dictSize(c->bpop.keys) != 0);
+
+    // 遍历所有 key ，将它们从客户端 db->blocking_keys 的链表中移除（dict 的 iter 是删除操作安全的迭代器）
+    di = dictGetIterator(c->bpop.keys);
+    /* The client may wait for multiple keys, so unblock it for every key. */
+    while((de = dictNext(di)) != NULL) {
+        robj *key = dictGetKey(de);
+
+        /* Remove this client from the list of clients waiting for this key. */
+        // 获取所有因为 key 而被阻塞的客户端的链表
+        l = dictFetchValue(c->db->blocking_keys,key);
+
+        redisAssertWithInfo(c,key,l != NULL);
+
+        // 将指定客户端从链表中删除（删除的是第一个找到的）
+        // 一般一个 client 只会 block 在一个 key 上面
+        listDelNode(l,listSearchKey(l,c));
+
+        /* If the list is empty we need to remove it to avoid wasting memory */
+        // 如果已经没有其他客户端阻塞在这个 key 上，那么删除这个链表
+        if (listLength(l) == 0)
+            dictDelete(c->db->blocking_keys,key);
+    }
+    dictReleaseIterator(di);    // 避免内存泄漏
+
+    /* Cleanup the client structure */
+    // 清空 bpop.keys 集合（字典）
+    dictEmpty(c->bpop.keys,NULL);
+    if (c->bpop.target) {
+        decrRefCount(c->bpop.target);
+        c->bpop.target = NULL;
+    }
+}
+
+/* If the specified key has clients blocked waiting for list pushes or new
+ * stream entries, this function will put the key reference into the server.ready_keys list.
+ * Note that db->ready_keys is a hash table that allows us to avoid putting
+ * the same key again and again in the list in case of multiple pushes
+ * made by a script or in the context of MULTI/EXEC.
+ *
+ * 如果有客户端正因为等待给定 key 被 push 而阻塞，
+ * 那么将这个 key 的放进 server.ready_keys 列表里面。
+ *
+ * 注意 db->ready_keys 是一个哈希表，而 server.ready_keys 则是一个 list
+ * 这可以避免在事务或者脚本中，将同一个 key 一次又一次添加到列表的情况出现。
+ * db->ready_keys 是用来去重的（已经 ready_keys 着的 key，可以不用重复记录）
+ * server.ready_keys 顺序处理 ready 的 key
+ *
+ * The list will be finally processed by handleClientsBlockedOnKeys() 
+ *
+ * 这个列表最终会被 handleClientsBlockedOnKeys() 函数处理。
+ */
+void signalKeyAsReady(redisClient *c, robj *key) {
+    readyList *rl;
+
+    /* No clients blocking for this key? No need to queue it. */
+    // 没有客户端被这个键阻塞，直接返回
+    if (dictFind(c->db->blocking_keys,key) == NULL) return;
+
+    /* Key was already signaled? No need to queue it again. */
+    // 这个键已经被添加到 db->ready_keys 中了，直接返回
+    if (dictFind(c->db->ready_keys,key) != NULL) return;
+
+    /* Ok, we need to queue this key into server.ready_keys. */
+    // 创建一个 readyList 结构，保存键和数据库
+    // 然后将 readyList(node) 添加到 server.ready_keys 中
+    // 等候 handleClientsBlockedOnKeys() 进行处理
+    rl = zmalloc(sizeof(*rl));
+    rl->key = key;
+    rl->db = c->db;
+    incrRefCount(key);
+    listAddNodeTail(server.ready_keys,rl);  // 把 rl 包裹进 listNode 里面进行保存
+
+    /* We also add the key in the db->ready_keys dictionary in order
+     * to avoid adding it multiple times into a list with a simple O(1)
+     * check. 
+     *
+     * 将 key 添加到 c->db->ready_keys 集合中，防止重复添加
+     */
+    incrRefCount(key);
+    redisAssert(dictAdd(c->db->ready_keys,key,NULL) == DICT_OK);
+}
+
+/* This function should be called by Redis every time a single command,
+ * a MULTI/EXEC block, or a Lua script, terminated its execution after
+ * being called by a client.
+ *
+ * 这个函数会在 Redis 每次执行完单个命令、事务块或 Lua 脚本之后调用。processCommand() 函数的最后
+ *
+ * All the keys with at least one client blocked that received at least
+ * one new element via some PUSH operation are accumulated into
+ * the server.ready_keys list. This function will run the list and will
+ * serve clients accordingly. Note that the function will iterate again and
+ * again as a result of serving BRPOPLPUSH we can have new blocking clients
+ * to serve because of the PUSH side of BRPOPLPUSH. 
+ *
+ * 对所有被阻塞在某个客户端的 key 来说，只要这个 key 被执行了某种 PUSH 操作
+ * 那么这个 key 就会被放到 serve.ready_keys 去。signalKeyAsReady()
+ * 
+ * 这个函数会遍历整个 serve.ready_keys 链表，
+ * 并将里面的 key 的元素弹出给被阻塞客户端，
+ * 从而解除客户端的阻塞状态。
+ *
+ * 函数会一次又一次地进行迭代，
+ * 因此它在执行 BRPOPLPUSH 命令的情况下也可以正常获取到正确的新被阻塞客户端。
+ */
+// 每次处理完 CMD（processCommand()） 之后，都会来这里检查, 看看是不是 server.ready_keys 就绪了
+// 是的话，立马对 block 命令进行响应处理，避免 client 的长时间等待
+void handleClientsBlockedOnKeys(void) {
+
+    // 遍历整个 ready_keys 链表(里面保存了刚刚执行了 push 的 key)
+    while(listLength(server.ready_keys) != 0) {
+        list *l;
+
+        /* Point server.ready_keys to a fresh list and save the current one
+         * locally. This way as we run the old list we are free to call
+         * signalKeyAsReady() that may push new elements in server.ready_keys
+         * when handling clients blocked into BRPOPLPUSH. */
+        // 备份旧的 ready_keys ，再给服务器端赋值一个新的
+        l = server.ready_keys;
+        server.ready_keys = listCreate();   // 避免在遍历的时候，signalKeyAsReady() 这个函数导致的插入，进而遍历不完整
+
+        while(listLength(l) != 0) {
+
+            // 取出 ready_keys 中的首个链表节点
+            listNode *ln = listFirst(l);
+
+            // 指向 readyList 结构
+            readyList *rl = ln->value;
+
+            /* First of all remove this key from db->ready_keys so that
+             * we can safely call signalKeyAsReady() against this key. */
+            // TODO: 为什么这么慌，难道 signalListAsReady() 这个函数会同时调用吗？
+            // 从 ready_keys 中移除就绪的 key
+            dictDelete(rl->db->ready_keys,rl->key);
+
+            /* If the key exists, serve the clients blocked for it with the
+             * function of its type. */
+            robj *o = lookupKeyWrite(rl->db,rl->key);
+            if (o != NULL) {
+                if (o->type == REDIS_LIST)
+                    serveClientsBlockedOnListKey(o,rl);
+                else if (o->type == REDIS_STREAM)
+                    serveClientsBlockedOnStreamKey(o,rl);
+            }
+
+            /* Free this item. */
+            decrRefCount(rl->key);
+            zfree(rl);
+            listDelNode(l,ln);
+        }
+        listRelease(l); /* We have the new list on place at this point. */
+    }
+}
@@ -0,0 +1,123 @@
+/* childinfo.c - Information sent by the children to the parent process
+ *
+ * 子进程（ BGSAVE 、 BGREWRITEAOF ）通过管道向父进程报告 copy-on-write 的内存用量
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* While a child is saving the dataset every page the parent modifies is
+ * duplicated by the kernel (copy-on-write). The child measures its private
+ * dirty memory from /proc/self/smaps, that is what the copy-on-write cost
+ * so far, and reports it to the parent through a pipe: about once per
+ * second while it works, and a last time when it is done. The parent reads
+ * the pipe in serverCron() and exposes the current, last and peak size in
+ * INFO persistence.
+ *
+ * 子进程定期以及结束时读取 /proc/self/smaps 中的 Private_Dirty ，
+ * 即目前为止 copy-on-write 复制的内存，通过管道发给父进程。 */
+
+#include "redis.h"
+#include <unistd.h>
+
+/* Minimum interval between two reports of a working child, since reading
+ * smaps has a cost proportional to the number of mappings. */
+#define CHILD_INFO_SEND_PERIOD 1000 /* milliseconds */
+
+/* Open the pipe used by the next child to send its info. On error the
+ * pipe is just not used. */
+void openChildInfoPipe(void) {
+    closeChildInfoPipe();
+    if (pipe(server.child_info_pipe) == -1) {
+        server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+        return;
+    }
+    /* Neither the parent nor the child must block on the pipe. */
+    anetNonBlock(NULL,server.child_info_pipe[0]);
+    anetNonBlock(NULL,server.child_info_pipe[1]);
+    server.stat_current_cow_bytes = 0;
+}
+
+/* Close the pipe, once the child exited or when the fork failed. */
+void closeChildInfoPipe(void) {
+    if (server.child_info_pipe[0] != -1) {
+        close(server.child_info_pipe[0]);
+        close(server.child_info_pipe[1]);
+        server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+    }
+    server.stat_current_cow_bytes = 0;
+}
+
+/* Send the child info to the parent: called in the child with the type
+ * of work it is doing, REDIS_CHILD_INFO_TYPE_(RDB|AOF), and the private
+ * dirty memory it just measured. */
+void sendChildInfo(int ptype, size_t cow_size) {
+    childInfoData data;
+
+    if (server.child_info_pipe[1] == -1) return;
+    data.magic = REDIS_CHILD_INFO_MAGIC;
+    data.process_type = ptype;
+    data.cow_size = cow_size;
+    if (write(server.child_info_pipe[1],&data,sizeof(data)) != sizeof(data)) {
+        /* Just lost, the parent will get the next one. */
+    }
+}
+
+/* Called from time to time by the code saving the dataset: if we are a
+ * child, send the info at most once every CHILD_INFO_SEND_PERIOD ms. */
+void sendChildInfoIfNeeded(void) {
+    static mstime_t last_send = 0;
+    mstime_t now;
+
+    if (server.in_fork_child == REDIS_CHILD_INFO_TYPE_NONE) return;
+    now = mstime();
+    if (now - last_send < CHILD_INFO_SEND_PERIOD) return;
+    last_send = now;
+    sendChildInfo(server.in_fork_child,zmalloc_get_private_dirty());
+}
+
+/* Read the info sent by the child, called by the parent periodically and
+ * once the child exited. The last report of an RDB (AOF) child is its
+ * last copy-on-write size, and the peak is tracked over all the reports. */
+void receiveChildInfo(void) {
+    childInfoData data;
+
+    if (server.child_info_pipe[0] == -1) return;
+    while (read(server.child_info_pipe[0],&data,sizeof(data)) == sizeof(data)) {
+        if (data.magic != REDIS_CHILD_INFO_MAGIC) continue;
+        server.stat_current_cow_bytes = data.cow_size;
+        if (data.process_type == REDIS_CHILD_INFO_TYPE_RDB) {
+            server.stat_rdb_cow_bytes = data.cow_size;
+            if (data.cow_size > server.stat_rdb_cow_peak)
+                server.stat_rdb_cow_peak = data.cow_size;
+        } else if (data.process_type == REDIS_CHILD_INFO_TYPE_AOF) {
+            server.stat_aof_cow_bytes = data.cow_size;
+            if (data.cow_size > server.stat_aof_cow_peak)
+                server.stat_aof_cow_peak = data.cow_size;
+        }
+    }
+}
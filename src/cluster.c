@@ -403,6 +403,7 @@ int clusterAddNode(clusterNode *node);
 void clusterAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void clusterReadHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void clusterSendPing(clusterLink *link, int type);
+static void clusterSendPingToNode(clusterLink *link, clusterNode *target, int type);
 void clusterSendFail(char *nodename);
 void clusterSendFailoverAuthIfNeeded(clusterNode *node, clusterMsg *request);
 void clusterUpdateState(void);
@@ -424,6 +425,14 @@ void resetManualFailover(void);
 void clusterCloseAllSlots(void);
 void clusterSetNodeAsMaster(clusterNode *n);
 void clusterDelNode(clusterNode *delnode);
+static void clusterMigrateSlotCommand(redisClient *c);
+static void clusterImportSlotCommand(redisClient *c);
+static void clusterBumpConfigEpochForImport(int slot);
+void clusterSlotMigrationCron(void);
+void clusterSlotMigrationClientGone(redisClient *c);
+static int clusterSlotHandoffInProgress(int slot);
+void clusterInvalidateReplyCache(void);
+void clusterDropForeignShardChannels(void);
 
 /* -----------------------------------------------------------------------------
  * Initialization
@@ -811,8 +820,22 @@ void clusterInit(void) {
     server.cluster->failover_auth_rank = 0;
     server.cluster->failover_auth_epoch = 0;
     server.cluster->lastVoteEpoch = 0;
-    server.cluster->stats_bus_messages_sent = 0;
-    server.cluster->stats_bus_messages_received = 0;
+    memset(server.cluster->stats_bus_messages_sent,0,
+        sizeof(server.cluster->stats_bus_messages_sent));
+    memset(server.cluster->stats_bus_messages_received,0,
+        sizeof(server.cluster->stats_bus_messages_received));
+    memset(server.cluster->stats_bus_bytes_sent,0,
+        sizeof(server.cluster->stats_bus_bytes_sent));
+    memset(server.cluster->stats_bus_bytes_received,0,
+        sizeof(server.cluster->stats_bus_bytes_received));
+    server.cluster->stats_bus_light_sent = 0;
+    server.cluster->stats_bus_light_received = 0;
+    server.cluster->slot_migration = NULL;
+    server.cluster->slot_import_client = NULL;
+    server.cluster->slot_import_slot = -1;
+    server.cluster->cached_slots_reply = NULL;
+    server.cluster->cached_nodes_reply = NULL;
+    server.cluster->cached_nodes_time = 0;
     memset(server.cluster->slots,0, sizeof(server.cluster->slots));
     clusterCloseAllSlots();
 
@@ -869,9 +892,9 @@ void clusterInit(void) {
         }
     }
 
-    /* The slots -> keys map is a sorted set. Init it. */
-    // slots -> keys 映射是一个有序集合
-    server.cluster->slots_to_keys = zslCreate();
+    /* The slots -> keys map is a dictionary per slot. Init it. */
+    // slots -> keys 映射是每个槽一个字典
+    server.cluster->slots_to_keys = slotToKeyCreate();
     resetManualFailover();
 }
 
@@ -967,8 +990,11 @@ void freeClusterLink(clusterLink *link) {
     sdsfree(link->rcvbuf);
 
     // 将节点的 link 属性设为 NULL
-    if (link->node)
+    // 对方可能已经重启，不再假定它知道我们的槽布局
+    if (link->node) {
         link->node->link = NULL;
+        link->node->slots_hash_acked = 0;
+    }
 
     // 关闭连接
     close(link->fd);
@@ -1106,6 +1132,7 @@ clusterNode *createClusterNode(char *nodename, int flags) {
     node->voted_time = 0;
     node->repl_offset_time = 0;
     node->repl_offset = 0;
+    node->slots_hash_acked = 0;
     listSetFreeMethod(node->fail_reports,zfree);
 
     return node;
@@ -1285,6 +1312,7 @@ int clusterNodeRemoveSlave(clusterNode *master, clusterNode *slave) {
             memmove(master->slaves+j,master->slaves+(j+1),
                 (master->numslaves-1)-j);   // 最后一个是横竖删不掉的，所以只能通过计数来确认使用到那个坑位
             master->numslaves--;    // 这个才是唯一准确的计数，直接看 master->slaves[master->numslaves] == NULL 是不准确的
+            clusterInvalidateReplyCache();
             return REDIS_OK;
         }
     }
@@ -1306,6 +1334,7 @@ int clusterNodeAddSlave(clusterNode *master, clusterNode *slave) {
         sizeof(clusterNode*)*(master->numslaves+1));
     master->slaves[master->numslaves] = slave;
     master->numslaves++;
+    clusterInvalidateReplyCache();
 
     return REDIS_OK;
 }
@@ -1347,6 +1376,7 @@ void freeClusterNode(clusterNode *n) {
 
     // 释放节点结构
     zfree(n);
+    clusterInvalidateReplyCache();
 }
 
 /* Add a node to the nodes hash table */
@@ -1357,6 +1387,7 @@ int clusterAddNode(clusterNode *node) {
     // 这样接下来当前节点就会创建连向 node 的节点
     retval = dictAdd(server.cluster->nodes,
             sdsnewlen(node->name,REDIS_CLUSTER_NAMELEN), node);
+    clusterInvalidateReplyCache();
     return (retval == DICT_OK) ? REDIS_OK : REDIS_ERR;
 }
 
@@ -1992,6 +2023,7 @@ int nodeUpdateAddressIfNeeded(clusterNode *node, clusterLink *link, int port) {
     /* IP / port is different, update it. */
     memcpy(node->ip,ip,sizeof(ip));
     node->port = port;
+    clusterInvalidateReplyCache();
 
     // 释放旧连接（新连接会在之后自动创建）
     if (node->link) freeClusterLink(node->link);
@@ -2281,6 +2313,58 @@ void clusterHandleConfigEpochCollision(clusterNode *sender) {
 // 这是一个相当重要的函数，因为每个 node 都是从这个函数中获取其他 node 的状态信息、想要传递的信息
 // 所以从这个函数获取的不同信息，将会触发相应的 node 本身、对于其他 node 的看法、对于整个 cluster 的看法**转变**；
 // 进而引发不同的过程
+/* -----------------------------------------------------------------------------
+ * Light PING / PONG messages
+ * -------------------------------------------------------------------------- */
+
+/* Hash of a slots bitmap, as announced in the slotshash header field. Zero
+ * is reserved to mean "unknown". */
+static uint64_t clusterSlotsHash(const unsigned char *slots) {
+    uint64_t hash = crc64(0,slots,REDIS_CLUSTER_SLOTS/8);
+
+    return hash ? hash : 1;
+}
+
+/* Return the slots bitmap 'node' sends in the myslots field of its messages
+ * according to our view: its own slots if it is a master, the slots of its
+ * master if it is a slave. NULL if we don't know. */
+static unsigned char *clusterNodeAnnouncedSlots(clusterNode *node) {
+    clusterNode *master = nodeIsMaster(node) ? node : node->slaveof;
+
+    return master ? master->slots : NULL;
+}
+
+/* Restore the light message in link->rcvbuf to the normal layout, filling
+ * myslots with our view of the sender.
+ *
+ * 将轻量消息还原为普通格式，myslots 用我们所知道的发送者槽布局填充。
+ *
+ * Returns 1 if our view matches the slotshash announced by the sender, 0 if
+ * the restored bitmap can't be trusted: in that case the next message we
+ * send to the node carries a different peerhash, so the node goes back to
+ * full messages. */
+static int clusterRestoreLightMsg(clusterLink *link) {
+    size_t off = offsetof(clusterMsg,myslots);
+    size_t slotslen = REDIS_CLUSTER_SLOTS/8;
+    size_t len = sdslen(link->rcvbuf);
+    clusterMsg *hdr = (clusterMsg*) link->rcvbuf;
+    clusterNode *sender = clusterLookupNode(hdr->sender);
+    unsigned char *slots = sender ? clusterNodeAnnouncedSlots(sender) : NULL;
+
+    link->rcvbuf = sdsMakeRoomFor(link->rcvbuf,slotslen);
+    memmove(link->rcvbuf+off+slotslen,link->rcvbuf+off,len-off);
+    sdsIncrLen(link->rcvbuf,slotslen);
+
+    hdr = (clusterMsg*) link->rcvbuf;
+    if (slots)
+        memcpy(hdr->myslots,slots,slotslen);
+    else
+        memset(hdr->myslots,0,slotslen);
+    hdr->totlen = htonl(len+slotslen);
+    hdr->hflags &= htons(~CLUSTERMSG_HFLAG_LIGHT);
+    return slots && clusterSlotsHash(hdr->myslots) == ntohu64(hdr->slotshash);
+}
+
 int clusterProcessPacket(clusterLink *link) {
 
     // 指向消息头
@@ -2293,14 +2377,20 @@ int clusterProcessPacket(clusterLink *link) {
     uint16_t type = ntohs(hdr->type);
 
     // 消息发送者的标识
-    uint16_t flags = ntohs(hdr->flags);
+    uint16_t flags;
 
     uint64_t senderCurrentEpoch = 0, senderConfigEpoch = 0;
 
     clusterNode *sender;
 
+    // 轻量消息的 myslots 是否可信
+    int slots_known = 1;
+
     // 更新接受消息计数器
-    server.cluster->stats_bus_messages_received++;
+    if (type < CLUSTERMSG_TYPE_COUNT) {
+        server.cluster->stats_bus_messages_received[type]++;
+        server.cluster->stats_bus_bytes_received[type] += totlen;
+    }
 
 // #define CLUSTERMSG_TYPE_PING 0          /* Ping */
 // #define CLUSTERMSG_TYPE_PONG 1          /* Pong (reply to Ping) */
@@ -2314,6 +2404,19 @@ int clusterProcessPacket(clusterLink *link) {
     if (ntohs(hdr->ver) != 0) return 1; /* Can't handle versions other than 0.*/
     if (totlen > sdslen(link->rcvbuf)) return 1;
 
+    /* Restore light messages to the normal layout before accessing any
+     * field following myslots. */
+    if (ntohs(hdr->hflags) & CLUSTERMSG_HFLAG_LIGHT) {
+        if ((type != CLUSTERMSG_TYPE_PING && type != CLUSTERMSG_TYPE_PONG) ||
+            totlen < CLUSTERMSG_LIGHT_MIN_LEN) return 1;
+        slots_known = clusterRestoreLightMsg(link);
+        hdr = (clusterMsg*) link->rcvbuf;
+        totlen = ntohl(hdr->totlen);
+        server.cluster->stats_bus_light_received++;
+    }
+    if (totlen < CLUSTERMSG_MIN_LEN) return 1;
+    flags = ntohs(hdr->flags);
+
     // 检查不同种类的消息，长度是否合法（有没有用错 union）
     if (type == CLUSTERMSG_TYPE_PING || type == CLUSTERMSG_TYPE_PONG ||
         type == CLUSTERMSG_TYPE_MEET)
@@ -2378,6 +2481,12 @@ int clusterProcessPacket(clusterLink *link) {
             clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|
                                  CLUSTER_TODO_FSYNC_CONFIG);
         }
+        /* Remember what the sender knows about our slots, so that we can
+         * send it light messages while our slots don't change. */
+        if ((type == CLUSTERMSG_TYPE_PING || type == CLUSTERMSG_TYPE_PONG ||
+             type == CLUSTERMSG_TYPE_MEET) && hdr->peerhash != 0)
+            sender->slots_hash_acked = ntohu64(hdr->peerhash);
+
         /* Update the replication offset info for this node. */
         sender->repl_offset = ntohu64(hdr->offset);
         sender->repl_offset_time = mstime();
@@ -2444,7 +2553,7 @@ int clusterProcessPacket(clusterLink *link) {
 
         /* Anyway reply with a PONG */
         // 向目标节点返回一个 PONG（表示 meet、ping 已经收到，并且 gossip 一下自己的 info）
-        clusterSendPing(link,CLUSTERMSG_TYPE_PONG); // 正常情况下的 PONG 回包
+        clusterSendPingToNode(link,sender,CLUSTERMSG_TYPE_PONG); // 正常情况下的 PONG 回包
 
         // 即使进入了这个 if-brance，link->node 也依旧是 NULL 的
         // 新的 MEET 的话，基本上走完这个 if-brance，这个函数就结束了
@@ -2655,7 +2764,8 @@ int clusterProcessPacket(clusterLink *link) {
 
         if (sender) {
             sender_master = nodeIsMaster(sender) ? sender : sender->slaveof;
-            if (sender_master) {
+            // 轻量消息中还原出的 myslots 不可信时，不根据它更新槽布局
+            if (sender_master && slots_known) {
                 dirty_slots = memcmp(sender_master->slots,
                         hdr->myslots,sizeof(hdr->myslots)) != 0;
             }
@@ -2998,7 +3108,7 @@ void clusterReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                 /* Perform some sanity check on the message signature
                  * and length. */
                 if (memcmp(hdr->sig,"RCmb",4) != 0 ||
-                    ntohl(hdr->totlen) < CLUSTERMSG_MIN_LEN)
+                    ntohl(hdr->totlen) < CLUSTERMSG_LIGHT_MIN_LEN)
                 {
                     redisLog(REDIS_WARNING,
                         "Bad message length or signature received "
@@ -3075,7 +3185,11 @@ void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
     link->sndbuf = sdscatlen(link->sndbuf, msg, msglen);
 
     // 增一发送信息计数
-    server.cluster->stats_bus_messages_sent++;
+    uint16_t type = ntohs(((clusterMsg*)msg)->type);
+    if (type < CLUSTERMSG_TYPE_COUNT) {
+        server.cluster->stats_bus_messages_sent[type]++;
+        server.cluster->stats_bus_bytes_sent[type] += msglen;
+    }
 }
 
 /* Send a message to all the nodes that are part of the cluster having
@@ -3157,6 +3271,7 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
 
     // 设置当前节点负责的槽（直接把本 node->slots bitmap 拷贝一下就好了）
     memcpy(hdr->myslots,master->slots,sizeof(hdr->myslots));
+    hdr->slotshash = htonu64(clusterSlotsHash(hdr->myslots));
 
     // 清零 slaveof 域
     memset(hdr->slaveof,0,REDIS_CLUSTER_NAMELEN);
@@ -3214,9 +3329,20 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
 // Ping and pong packets also contain a gossip section. 
 // This section offers to the receiver a view of what the sender node thinks about other nodes in the cluster.
 void clusterSendPing(clusterLink *link, int type) {
-    unsigned char buf[sizeof(clusterMsg)];
-    clusterMsg *hdr = (clusterMsg*) buf;
+    clusterSendPingToNode(link,link->node,type);
+}
+
+/* Same as clusterSendPing(), but 'target' is the node we are talking to even
+ * when the link is an incoming one (link->node is NULL), as it happens when
+ * replying with a PONG. 'target' may be NULL if unknown.
+ *
+ * If 'target' already knows our slots the message is sent in the light
+ * format, see CLUSTERMSG_HFLAG_LIGHT. */
+static void clusterSendPingToNode(clusterLink *link, clusterNode *target, int type) {
+    unsigned char *buf;
+    clusterMsg *hdr;
     int gossipcount = 0/*已经发送了多少个 Gossip*/, totlen;
+    int wanted, maxiterations;
     /* freshnodes is the number of nodes we can still use to populate the
      * gossip section of the ping packet. Basically we start with the nodes
      * we have in memory minus two (ourself and the node we are sending the
@@ -3233,6 +3359,29 @@ void clusterSendPing(clusterLink *link, int type) {
     // TODO: 这个 gossip 发送的对象是什么？为什么要给他们发送？
     int freshnodes = dictSize(server.cluster->nodes)-2; // 还有多少个已知 node 可以发送出去（减 2，一个是自己，一个是对端）
 
+    /* How many gossip sections we want to add: 1/10 of the known nodes, and
+     * at least 3. Failure reports must reach a majority of the masters
+     * within the node timeout: with a fixed number of sections the time
+     * needed to spread them grows with the size of the cluster, while with
+     * a fanout proportional to it the number of pings needed stays about
+     * the same.
+     *
+     * gossip 的数量与集群规模成正比（十分之一，至少 3 个），
+     * 这样下线报告传播到多数主节点所需的 PING 数量不随集群规模增长。 */
+    wanted = dictSize(server.cluster->nodes)/10;
+    if (wanted < 3) wanted = 3;
+    if (wanted > freshnodes) wanted = freshnodes;
+    if (wanted < 0) wanted = 0;
+    maxiterations = wanted*3;
+
+    /* The buffer must hold the whole header, as clusterBuildMessageHdr()
+     * clears it, plus the wanted gossip sections. */
+    totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
+    totlen += (sizeof(clusterMsgDataGossip)*wanted);
+    if (totlen < (int)sizeof(clusterMsg)) totlen = sizeof(clusterMsg);
+    buf = zcalloc(totlen);
+    hdr = (clusterMsg*) buf;
+
     // 如果发送的信息是 PING ，那么更新最后一次发送 PING 命令的时间戳
     if (link->node && type == CLUSTERMSG_TYPE_PING)
         link->node->ping_sent = mstime();
@@ -3242,12 +3391,12 @@ void clusterSendPing(clusterLink *link, int type) {
     clusterBuildMessageHdr(hdr,type);
 
     /* Populate the gossip fields */
-    // 从当前节点已知的节点中**随机**选出两个节点
+    // 从当前节点已知的节点中**随机**选出 wanted 个节点
     // 并通过这条消息捎带给目标节点，从而实现 gossip 协议
 
     // 每个节点有 freshnodes 次发送 gossip 信息的机会
-    // 每次向目标节点发送 2 个被选中节点的 gossip 信息（gossipcount 计数）
-    while(freshnodes > 0 && gossipcount < 3) {
+    // 每次最多向目标节点发送 wanted 个被选中节点的 gossip 信息（gossipcount 计数）
+    while(freshnodes > 0 && gossipcount < wanted && maxiterations--) {
         // 从 nodes 字典中随机选出一个节点（被选中节点），可能会选中自己，甚至是对方
         dictEntry *de = dictGetRandomKey(server.cluster->nodes);
         clusterNode *this = dictGetVal(de);
@@ -3318,8 +3467,31 @@ void clusterSendPing(clusterLink *link, int type) {
     // 将信息的长度记录到信息里面
     hdr->totlen = htonl(totlen);
 
+    /* Tell the target what we know about its slots, so that it can send us
+     * light messages. */
+    if (target) {
+        unsigned char *slots = clusterNodeAnnouncedSlots(target);
+
+        if (slots) hdr->peerhash = htonu64(clusterSlotsHash(slots));
+    }
+
+    /* The target already knows our slots: cut myslots out of the message. */
+    if ((type == CLUSTERMSG_TYPE_PING || type == CLUSTERMSG_TYPE_PONG) &&
+        target && target->slots_hash_acked == ntohu64(hdr->slotshash))
+    {
+        size_t off = offsetof(clusterMsg,myslots);
+        size_t slotslen = sizeof(hdr->myslots);
+
+        hdr->hflags |= htons(CLUSTERMSG_HFLAG_LIGHT);
+        memmove(buf+off,buf+off+slotslen,totlen-off-slotslen);
+        totlen -= slotslen;
+        hdr->totlen = htonl(totlen);
+        server.cluster->stats_bus_light_sent++;
+    }
+
     // 发送信息
     clusterSendMessage(link,buf,totlen);
+    zfree(buf);
 }
 
 /* Send a PONG packet to every connected node that's not in handshake state
@@ -4439,6 +4611,9 @@ void clusterCron(void) {
     /* Abourt a manual failover if the timeout is reached. */
     manualFailoverCheckTimeout();
 
+    /* Check the progress of an outgoing CLUSTER MIGRATESLOT. */
+    if (server.cluster->slot_migration) clusterSlotMigrationCron();
+
     /* slave 开始进行 failover */
     if (nodeIsSlave(myself)) {
         clusterHandleManualFailover();
@@ -4499,8 +4674,11 @@ void clusterBeforeSleep(void) {
 
     /* Update the cluster state. */
     // 更新节点的状态
-    if (server.cluster->todo_before_sleep & CLUSTER_TODO_UPDATE_STATE)
+    if (server.cluster->todo_before_sleep & CLUSTER_TODO_UPDATE_STATE) {
         clusterUpdateState();
+        if (dictSize(server.pubsubshard_channels))
+            clusterDropForeignShardChannels();
+    }
 
     /* Save the config, possibly using fsync. */
     // 保存 nodes.conf 配置文件
@@ -4515,10 +4693,32 @@ void clusterBeforeSleep(void) {
     server.cluster->todo_before_sleep = 0;
 }
 
+/* Unsubscribe the clients of every shard channel whose slot is no longer
+ * served by this node or by its master. The slot configuration changes
+ * rarely, so a full scan of the shard channels is fine here. Clients get
+ * a SUNSUBSCRIBE notification and are expected to resubscribe against the
+ * new owner. */
+// 槽不再由本分片负责时，取消对应分片频道的所有订阅
+void clusterDropForeignShardChannels(void) {
+    dictIterator *di = dictGetSafeIterator(server.pubsubshard_channels);
+    dictEntry *de;
+
+    while((de = dictNext(di)) != NULL) {
+        robj *channel = dictGetKey(de);
+        int slot = keyHashSlot(channel->ptr,sdslen(channel->ptr));
+        clusterNode *n = server.cluster->slots[slot];
+
+        if (n == myself || (n != NULL && myself->slaveof == n)) continue;
+        pubsubShardUnsubscribeAllClients(channel);
+    }
+    dictReleaseIterator(di);
+}
+
 // 打开 todo_before_sleep 的指定标识
 // 每个标识代表了节点在结束一个事件循环时要做的工作
 void clusterDoBeforeSleep(int flags) {
     server.cluster->todo_before_sleep |= flags;
+    clusterInvalidateReplyCache();
 }
 
 /* -----------------------------------------------------------------------------
@@ -4598,6 +4798,7 @@ int clusterAddSlot(clusterNode *n, int slot) {
 
     // 更新集群状态
     server.cluster->slots[slot] = n;
+    clusterInvalidateReplyCache();
 
     return REDIS_OK;
 }
@@ -4624,6 +4825,7 @@ int clusterDelSlot(int slot) {
 
     // 清空负责处理槽的节点
     server.cluster->slots[slot] = NULL;
+    clusterInvalidateReplyCache();
 
     return REDIS_OK;
 }
@@ -5026,6 +5228,80 @@ sds clusterGenNodesDescription(int filter) {
     return ci;
 }
 
+/* -----------------------------------------------------------------------------
+ * CLUSTER SLOTS / CLUSTER NODES reply cache
+ *
+ * Clients refresh their view of the topology with CLUSTER SLOTS or
+ * CLUSTER NODES, often every few seconds per connection. Both replies only
+ * depend on the cluster configuration, so they are generated once and kept
+ * until something that can change them happens: every path that flags a
+ * config change calls clusterDoBeforeSleep(), and the few functions that
+ * touch slots, slaves or node addresses directly invalidate explicitly.
+ *
+ * CLUSTER NODES also reports ping / pong times and link state, which change
+ * all the time without any config event, so its cached copy additionally
+ * expires after CLUSTER_NODES_CACHE_TTL milliseconds.
+ *
+ * 拓扑查询的回复只在集群配置变化时才重新生成，其余时候直接复制缓存。
+ * -------------------------------------------------------------------------- */
+
+#define CLUSTER_NODES_CACHE_TTL 100 /* Milliseconds. */
+
+void clusterInvalidateReplyCache(void) {
+    /* Called from clusterInit() paths before the state is allocated. */
+    if (server.cluster == NULL) return;
+
+    sdsfree(server.cluster->cached_slots_reply);
+    server.cluster->cached_slots_reply = NULL;
+    sdsfree(server.cluster->cached_nodes_reply);
+    server.cluster->cached_nodes_reply = NULL;
+}
+
+/* Append the [ip, port, node-id] triple of a node as raw protocol.
+ * Our own node has no port in its cluster entry, use the listening one. */
+static sds clusterGenSlotsNodeEntry(sds s, clusterNode *node) {
+    int port = (node == myself) ? server.port : node->port;
+
+    s = sdscatprintf(s,"*3\r\n$%d\r\n%s\r\n:%d\r\n$%d\r\n",
+        (int)strlen(node->ip), node->ip, port, REDIS_CLUSTER_NAMELEN);
+    s = sdscatlen(s,node->name,REDIS_CLUSTER_NAMELEN);
+    return sdscatlen(s,"\r\n",2);
+}
+
+/* Generate the full CLUSTER SLOTS reply as raw protocol: one entry for every
+ * run of contiguous slots served by the same master, containing the first
+ * and last slot, the master and then every slave not flagged as failing. */
+static sds clusterGenSlotsReply(void) {
+    sds body = sdsempty(), reply;
+    int ranges = 0, start, j;
+
+    for (start = 0; start < REDIS_CLUSTER_SLOTS; start = j) {
+        clusterNode *n = server.cluster->slots[start];
+        int found = 0, k;
+
+        // 找出由同一个节点负责的连续槽区间 [start, j-1]
+        for (j = start+1; j < REDIS_CLUSTER_SLOTS; j++)
+            if (server.cluster->slots[j] != n) break;
+        if (n == NULL) continue;
+
+        for (k = 0; k < n->numslaves; k++)
+            if (!nodeFailed(n->slaves[k])) found++;
+
+        body = sdscatprintf(body,"*%d\r\n:%d\r\n:%d\r\n",
+            3+found, start, j-1);
+        body = clusterGenSlotsNodeEntry(body,n);
+        for (k = 0; k < n->numslaves; k++)
+            if (!nodeFailed(n->slaves[k]))
+                body = clusterGenSlotsNodeEntry(body,n->slaves[k]);
+        ranges++;
+    }
+
+    reply = sdscatprintf(sdsempty(),"*%d\r\n",ranges);
+    reply = sdscatsds(reply,body);
+    sdsfree(body);
+    return reply;
+}
+
 // 取出一个 slot 数值
 int getSlotOrReply(redisClient *c, robj *o) {
     long long slot;
@@ -5094,12 +5370,25 @@ void clusterCommand(redisClient *c) {
         // 本节点的网络连接情况：例如 connected 。
         // 节点目前包含的槽; 10922-11422; 11423-16383
 
-        robj *o;
-        sds ci = clusterGenNodesDescription(0);
+        mstime_t now = mstime();
 
-        o = createObject(REDIS_STRING,ci);
-        addReplyBulk(c,o);
-        decrRefCount(o);
+        if (server.cluster->cached_nodes_reply == NULL ||
+            now - server.cluster->cached_nodes_time > CLUSTER_NODES_CACHE_TTL)
+        {
+            sdsfree(server.cluster->cached_nodes_reply);
+            server.cluster->cached_nodes_reply = clusterGenNodesDescription(0);
+            server.cluster->cached_nodes_time = now;
+        }
+        addReplyBulkCBuffer(c,server.cluster->cached_nodes_reply,
+            sdslen(server.cluster->cached_nodes_reply));
+
+    } else if (!strcasecmp(c->argv[1]->ptr,"slots") && c->argc == 2) {
+        /* CLUSTER SLOTS */
+        // 以多条批量回复的形式返回槽到节点的映射，结果被缓存到配置变化为止
+        if (server.cluster->cached_slots_reply == NULL)
+            server.cluster->cached_slots_reply = clusterGenSlotsReply();
+        addReplyString(c,server.cluster->cached_slots_reply,
+            sdslen(server.cluster->cached_slots_reply));
 
     } else if (!strcasecmp(c->argv[1]->ptr,"flushslots") && c->argc == 2) {
         /* CLUSTER FLUSHSLOTS */
@@ -5294,27 +5583,7 @@ void clusterCommand(redisClient *c) {
             if (n == myself &&
                 server.cluster->importing_slots_from[slot])
             {
-                /* This slot was manually migrated, set this node configEpoch
-                 * to a new epoch so that the new version can be propagated
-                 * by the cluster.
-                 *
-                 * Note that if this ever results in a collision with another
-                 * node getting the same configEpoch, for example because a
-                 * failover happens at the same time we close the slot, the
-                 * configEpoch collision resolution will fix it assigning
-                 * a different epoch to each node. */
-                uint64_t maxEpoch = clusterGetMaxEpoch();
-
-                if (myself->configEpoch == 0 ||
-                    myself->configEpoch != maxEpoch)
-                {
-                    server.cluster->currentEpoch++;
-                    myself->configEpoch = server.cluster->currentEpoch;
-                    clusterDoBeforeSleep(CLUSTER_TODO_FSYNC_CONFIG);
-                    redisLog(REDIS_WARNING,
-                        "configEpoch set to %llu after importing slot %d",
-                        (unsigned long long) myself->configEpoch, slot);
-                }
+                clusterBumpConfigEpochForImport(slot);
                 server.cluster->importing_slots_from[slot] = NULL;
             }
 
@@ -5332,6 +5601,20 @@ void clusterCommand(redisClient *c) {
         clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|CLUSTER_TODO_UPDATE_STATE);
         addReply(c,shared.ok);
 
+    } else if (!strcasecmp(c->argv[1]->ptr,"migrateslot") &&
+               (c->argc == 4 || c->argc == 5))
+    {
+        /* CLUSTER MIGRATESLOT <slot> <node ID> [timeout] */
+        // 将整个槽流式迁移到目标节点，并原子地交出槽的所有权
+        clusterMigrateSlotCommand(c);
+
+    } else if (!strcasecmp(c->argv[1]->ptr,"importslot") && c->argc >= 4) {
+        /* CLUSTER IMPORTSLOT <slot> BEGIN <node ID> <rdb version>
+         * CLUSTER IMPORTSLOT <slot> DATA <payload>
+         * CLUSTER IMPORTSLOT <slot> ACK | COMMIT
+         * Only sent by a node running CLUSTER MIGRATESLOT. */
+        clusterImportSlotCommand(c);
+
     } else if (!strcasecmp(c->argv[1]->ptr,"info") && c->argc == 2) {
         /* CLUSTER INFO */
         // 打印出集群的当前信息
@@ -5359,6 +5642,18 @@ void clusterCommand(redisClient *c) {
             }
         }
 
+        static char *msgtypes[CLUSTERMSG_TYPE_COUNT] = {
+            "ping","pong","meet","fail","publish","auth-req","auth-ack",
+            "update","mfstart"
+        };
+        long long tot_msg_sent = 0, tot_msg_received = 0;
+        int t;
+
+        for (t = 0; t < CLUSTERMSG_TYPE_COUNT; t++) {
+            tot_msg_sent += server.cluster->stats_bus_messages_sent[t];
+            tot_msg_received += server.cluster->stats_bus_messages_received[t];
+        }
+
         // 打印信息
         sds info = sdscatprintf(sdsempty(),
             "cluster_state:%s\r\n"
@@ -5379,9 +5674,34 @@ void clusterCommand(redisClient *c) {
             dictSize(server.cluster->nodes),
             server.cluster->size,
             (unsigned long long) server.cluster->currentEpoch,
-            server.cluster->stats_bus_messages_sent,
-            server.cluster->stats_bus_messages_received
+            tot_msg_sent,
+            tot_msg_received
         );
+
+        /* Per message type counters, only for the types actually seen. */
+        for (t = 0; t < CLUSTERMSG_TYPE_COUNT; t++) {
+            if (server.cluster->stats_bus_messages_sent[t]) {
+                info = sdscatprintf(info,
+                    "cluster_stats_messages_%s_sent:%lld\r\n"
+                    "cluster_stats_bytes_%s_sent:%lld\r\n",
+                    msgtypes[t], server.cluster->stats_bus_messages_sent[t],
+                    msgtypes[t], server.cluster->stats_bus_bytes_sent[t]);
+            }
+        }
+        for (t = 0; t < CLUSTERMSG_TYPE_COUNT; t++) {
+            if (server.cluster->stats_bus_messages_received[t]) {
+                info = sdscatprintf(info,
+                    "cluster_stats_messages_%s_received:%lld\r\n"
+                    "cluster_stats_bytes_%s_received:%lld\r\n",
+                    msgtypes[t], server.cluster->stats_bus_messages_received[t],
+                    msgtypes[t], server.cluster->stats_bus_bytes_received[t]);
+            }
+        }
+        info = sdscatprintf(info,
+            "cluster_stats_messages_light_sent:%lld\r\n"
+            "cluster_stats_messages_light_received:%lld\r\n",
+            server.cluster->stats_bus_light_sent,
+            server.cluster->stats_bus_light_received);
         addReplySds(c,sdscatprintf(sdsempty(),"$%lu\r\n",
             (unsigned long)sdslen(info)));
         addReplySds(c,info);
@@ -5453,7 +5773,10 @@ void clusterCommand(redisClient *c) {
 
         // 打印获得的键
         addReplyMultiBulkLen(c,numkeys);
-        for (j = 0; j < numkeys; j++) addReplyBulk(c,keys[j]);
+        for (j = 0; j < numkeys; j++) {
+            addReplyBulk(c,keys[j]);
+            decrRefCount(keys[j]);
+        }
         zfree(keys);
 
     } else if (!strcasecmp(c->argv[1]->ptr,"forget") && c->argc == 3) {
@@ -5771,7 +6094,7 @@ void dumpCommand(redisClient *c) {
     /* Check if the key is here. */
     // 取出给定键的值
     if ((o = lookupKeyRead(c->db,c->argv[1])) == NULL) {
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
         return;
     }
 
@@ -5885,6 +6208,9 @@ typedef struct migrateCachedSocket {
     // 最后一次使用的时间
     time_t last_use_time;
 
+    // 套接字上最后一次 SELECT 的数据库，-1 表示未知
+    long last_dbid;
+
 } migrateCachedSocket;
 
 /* Return a TCP scoket connected with the target instance, possibly returning
@@ -5893,12 +6219,12 @@ typedef struct migrateCachedSocket {
  * 返回一个连接向指定地址的 TCP 套接字，这个套接字可能是一个缓存套接字。
  *
  * This function is responsible of sending errors to the client if a
- * connection can't be established. In this case -1 is returned.
- * Otherwise on success the socket is returned, and the caller should not
- * attempt to free it after usage.
+ * connection can't be established. In this case NULL is returned.
+ * Otherwise on success the cached socket is returned, and the caller should
+ * not attempt to free it after usage.
  *
- * 如果连接出错，那么函数返回 -1 。
- * 如果连接正常，那么函数返回 TCP 套接字描述符。
+ * 如果连接出错，那么函数返回 NULL 。
+ * 如果连接正常，那么函数返回缓存的套接字。
  *
  * If the caller detects an error while using the socket, migrateCloseSocket()
  * should be called so that the connection will be craeted from scratch
@@ -5909,7 +6235,7 @@ typedef struct migrateCachedSocket {
  * 这样下次要连接相同地址时，服务器就会创建新的套接字来进行连接。
  */
 // migrate 是会单独创建一个新的 socket 进行传输的；不能复用 cluster bus，不然会影响 node 之间的 Gossip，导致错误观测到 down
-int migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
+migrateCachedSocket *migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
     int fd;
     sds name = sdsempty();
     migrateCachedSocket *cs;
@@ -5926,7 +6252,7 @@ int migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
     if (cs) {
         sdsfree(name);
         cs->last_use_time = server.unixtime;
-        return cs->fd;
+        return cs;
     }
 
     /* No cached socket, create one. */
@@ -5951,7 +6277,7 @@ int migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
         sdsfree(name);
         addReplyErrorFormat(c,"Can't connect to target node: %s",
             server.neterr);
-        return -1;
+        return NULL;
     }
     anetEnableTcpNoDelay(server.neterr,fd);
 
@@ -5962,7 +6288,7 @@ int migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
         addReplySds(c,
             sdsnew("-IOERR error or timeout connecting to the client\r\n"));
         close(fd);
-        return -1;
+        return NULL;
     }
 
     /* Add to the cache and return it to the caller. */
@@ -5970,9 +6296,10 @@ int migrateGetSocket(redisClient *c, robj *host, robj *port, long timeout) {
     cs = zmalloc(sizeof(*cs));
     cs->fd = fd;
     cs->last_use_time = server.unixtime;
+    cs->last_dbid = -1;
     dictAdd(server.migrate_cached_sockets,name,cs);
 
-    return fd;
+    return cs;
 }
 
 /* Free a migrate cached connection. */
@@ -6020,33 +6347,483 @@ void migrateCloseTimedoutSockets(void) {
     dictReleaseIterator(di);
 }
 
-/* in source node: MIGRATE target-host target-port key dbid(MUST 0) timeout [COPY | REPLACE] */
+/* -----------------------------------------------------------------------------
+ * MIGRATE ... ASYNC
+ *
+ * The synchronous MIGRATE blocks the whole server while the payload is
+ * written and the target replies. With ASYNC the transfer is driven by the
+ * event loop instead: the calling client is blocked (REDIS_BLOCKED_MIGRATE),
+ * keys are serialized one after the other as the socket drains, and replies
+ * are parsed as they arrive. Meanwhile the keys are locked: write commands
+ * against them get -TRYAGAIN, reads are served normally.
+ *
+ * 异步迁移：由事件循环驱动，发送缓冲区写空之后才序列化下一个键。
+ * 迁移期间键被锁定，写命令返回 -TRYAGAIN ，读命令照常执行。
+ * -------------------------------------------------------------------------- */
+
+/* Don't serialize more keys once this many bytes are pending. */
+// 发送缓冲区超过这个大小时，暂停序列化后续的键
+#define MIGRATE_ASYNC_BUFFER_BYTES (64*1024)
+/* Max bytes written per writable event, to keep the event loop fair. */
+#define MIGRATE_ASYNC_WRITE_PER_EVENT (256*1024)
+
+typedef struct migrateAsyncJob {
+
+    // 发起迁移的客户端，客户端断开后为 NULL ，迁移照常完成
+    redisClient *c;         /* Client to reply to, NULL if it disconnected. */
+
+    // 连接目标节点的专用套接字
+    int fd;
+
+    // 键所在的数据库，以及目标节点上的数据库号码
+    redisDb *db;
+    long dbid;
+
+    int copy, replace;
+
+    // I/O 超时时间（毫秒），以及最后一次读写成功的时间
+    long timeout;
+    mstime_t last_io;
+
+    // 被迁移的键和对应的值对象（均持有引用计数）
+    robj **kv;
+    robj **ov;
+    int numkeys;
+
+    // 下一个要序列化的键，以及已经发出 RESTORE 的键的下标
+    int next;
+    int *sent;
+    int numsent;
+
+    // 已收到的回复数量（包括 SELECT 的回复）
+    int numreplies;
+
+    // 发送缓冲区和接收缓冲区
+    sds outbuf;
+    size_t outpos;
+    sds inbuf;
+
+    // 复制和 AOF 用的 DEL 命令参数
+    robj **newargv;
+    int del_idx;
+
+    // 目标节点返回的第一个错误，以及 SELECT 是否失败
+    sds error;
+    int select_error;
+
+} migrateAsyncJob;
+
+/* Return 1 if one of the keys of the command is locked by an async
+ * MIGRATE, 0 otherwise. */
+// 检查命令要写入的键中是否有正在异步迁移的键
+int migrateKeysLocked(redisDb *db, struct redisCommand *cmd, robj **argv, int argc) {
+    int *keys, numkeys, j, locked = 0;
+
+    keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        if (dictFind(db->migrating_keys,argv[keys[j]]) != NULL) {
+            locked = 1;
+            break;
+        }
+    }
+    getKeysFreeResult(keys);
+    return locked;
+}
+
+/* Called by unblockClient() when the client goes away (or is otherwise
+ * unblocked) before the transfer is over: the job keeps running so that the
+ * keys acknowledged by the target are still deleted and propagated. */
+// 客户端在迁移完成之前断开，迁移任务继续执行，只是不再回复
+void unblockClientFromMigrate(redisClient *c) {
+    migrateAsyncJob *job = c->bpop.migrate_job;
+
+    if (job) job->c = NULL;
+    c->bpop.migrate_job = NULL;
+    if (server.cluster_enabled) clusterSlotMigrationClientGone(c);
+}
+
+/* Stop the transfer: reply to the client if still there, propagate the DEL
+ * of the migrated keys, unlock the keys and release the job. 'ioerr' is
+ * non-zero if the job was aborted by a socket error or timeout. */
+// 结束迁移任务
+static void migrateAsyncFinish(migrateAsyncJob *job, int ioerr, int writing) {
+    redisClient *c = job->c;
+    listNode *ln;
+    int j;
+
+    aeDeleteFileEvent(server.el,job->fd,AE_READABLE|AE_WRITABLE);
+    close(job->fd);
+
+    /* Translate MIGRATE as DEL for replication/AOF, only for the keys the
+     * target acknowledged. */
+    // 向 AOF 文件和 slave 节点传播 DEL 命令
+    if (job->del_idx > 1) {
+        job->newargv[0] = createStringObject("DEL",3);
+        propagate(server.delCommand,job->db->id,job->newargv,job->del_idx,
+            REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+        decrRefCount(job->newargv[0]);
+    }
+    for (j = 1; j < job->del_idx; j++) decrRefCount(job->newargv[j]);
+    zfree(job->newargv);
+
+    if (c) {
+        if (job->error) {
+            addReplyErrorFormat(c,"Target instance replied with error: %s",
+                job->error);
+        } else if (ioerr) {
+            addReplySds(c,sdscatprintf(sdsempty(),
+                "-IOERR error or timeout %s to target instance\r\n",
+                writing ? "writing" : "reading"));
+        } else {
+            addReply(c,shared.ok);
+        }
+        unblockClient(c);
+    }
+
+    // 解锁所有键，释放引用
+    for (j = 0; j < job->numkeys; j++) {
+        dictDelete(job->db->migrating_keys,job->kv[j]);
+        decrRefCount(job->kv[j]);
+        decrRefCount(job->ov[j]);
+    }
+    zfree(job->kv);
+    zfree(job->ov);
+    zfree(job->sent);
+    sdsfree(job->outbuf);
+    sdsfree(job->inbuf);
+    sdsfree(job->error);
+
+    ln = listSearchKey(server.migrate_async_jobs,job);
+    redisAssert(ln != NULL);
+    listDelNode(server.migrate_async_jobs,ln);
+    zfree(job);
+}
+
+/* Return the value of the key if it is still the object we locked, NULL if
+ * it was deleted (expired, evicted, flushed) in the meantime. */
+static robj *migrateAsyncLookup(migrateAsyncJob *job, int j) {
+    dictEntry *de = dictFind(job->db->dict,job->kv[j]->ptr);
+
+    if (de == NULL || dictGetVal(de) != job->ov[j]) return NULL;
+    return job->ov[j];
+}
+
+/* Append RESTORE commands to the output buffer until it holds at least
+ * MIGRATE_ASYNC_BUFFER_BYTES or all the keys are serialized. */
+// 序列化后续的键，追加到发送缓冲区
+static void migrateAsyncFillBuffer(migrateAsyncJob *job) {
+    rio cmd, payload;
+
+    if (job->outpos == sdslen(job->outbuf)) {
+        sdsclear(job->outbuf);
+        job->outpos = 0;
+    }
+    rioInitWithBuffer(&cmd,job->outbuf);
+    while (job->next < job->numkeys &&
+           sdslen(cmd.io.buffer.ptr) < MIGRATE_ASYNC_BUFFER_BYTES)
+    {
+        int j = job->next++;
+        long long ttl = 0, expireat;
+
+        /* The key may be gone, but never modified: it is locked. */
+        // 键已经被删除（过期、淘汰或者 FLUSH），跳过
+        if (migrateAsyncLookup(job,j) == NULL) continue;
+
+        expireat = getExpire(job->db,job->kv[j]);
+        if (expireat != -1) {
+            ttl = expireat-mstime();
+            if (ttl < 1) ttl = 1;
+        }
+        redisAssert(rioWriteBulkCount(&cmd,'*',job->replace ? 5 : 4));
+        if (server.cluster_enabled)
+            redisAssert(rioWriteBulkString(&cmd,"RESTORE-ASKING",14));
+        else
+            redisAssert(rioWriteBulkString(&cmd,"RESTORE",7));
+        redisAssert(rioWriteBulkString(&cmd,job->kv[j]->ptr,
+                sdslen(job->kv[j]->ptr)));
+        redisAssert(rioWriteBulkLongLong(&cmd,ttl));
+        createDumpPayload(&payload,job->ov[j]);
+        redisAssert(rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+        if (job->replace)
+            redisAssert(rioWriteBulkString(&cmd,"REPLACE",7));
+        job->sent[job->numsent++] = j;
+    }
+    job->outbuf = cmd.io.buffer.ptr;
+}
+
+/* The transfer is over when every key was serialized and written, and
+ * there is a reply for SELECT plus one for every RESTORE sent. */
+static int migrateAsyncDone(migrateAsyncJob *job) {
+    return job->next == job->numkeys &&
+           job->outpos == sdslen(job->outbuf) &&
+           job->numreplies == job->numsent+1;
+}
+
+// 写事件处理器：发送缓冲区中的数据，写空之后继续序列化后续的键
+static void migrateAsyncWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    migrateAsyncJob *job = privdata;
+    size_t written = 0;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    while (written < MIGRATE_ASYNC_WRITE_PER_EVENT) {
+        ssize_t nwritten;
+
+        if (job->outpos == sdslen(job->outbuf)) {
+            if (job->next == job->numkeys) break;
+            migrateAsyncFillBuffer(job);
+            if (job->outpos == sdslen(job->outbuf)) continue; /* All gone. */
+        }
+        nwritten = write(fd,job->outbuf+job->outpos,
+                         sdslen(job->outbuf)-job->outpos);
+        if (nwritten == -1) {
+            if (errno == EAGAIN) break;
+            redisLog(REDIS_VERBOSE,"MIGRATE ASYNC write error: %s",
+                strerror(errno));
+            migrateAsyncFinish(job,1,1);
+            return;
+        }
+        job->outpos += nwritten;
+        written += nwritten;
+        job->last_io = mstime();
+    }
+
+    /* Everything written: wait for the remaining replies. */
+    if (job->next == job->numkeys && job->outpos == sdslen(job->outbuf)) {
+        aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+        if (migrateAsyncDone(job)) migrateAsyncFinish(job,0,0);
+    }
+}
+
+/* Handle one reply line of the target. The first one belongs to SELECT,
+ * the others to the RESTORE commands, in the order they were sent. */
+// 处理目标节点的一行回复
+static void migrateAsyncProcessReply(migrateAsyncJob *job, char *line) {
+    int idx = job->numreplies++;
+
+    if (line[0] == '-') {
+        if (job->error == NULL) job->error = sdsnew(line+1);
+        if (idx == 0) job->select_error = 1;
+        return;
+    }
+
+    /* A failed SELECT fails all the keys, see migrateCommand(). */
+    if (idx == 0 || job->copy || job->select_error) return;
+
+    /* No COPY option: remove the local key, if it is still the value we
+     * sent, and remember it for the replicated DEL. */
+    // 删除本机数据库中的键
+    idx = job->sent[idx-1];
+    if (migrateAsyncLookup(job,idx) != NULL) {
+        robj *key = job->kv[idx];
+
+        dbDelete(job->db,key);
+        signalModifiedKey(job->db,key);
+        server.dirty++;
+        job->newargv[job->del_idx++] = key;
+        incrRefCount(key);
+    }
+}
+
+// 读事件处理器：读取并处理目标节点的回复
+static void migrateAsyncReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    migrateAsyncJob *job = privdata;
+    char buf[REDIS_IOBUF_LEN];
+    ssize_t nread;
+    char *p, *nl;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    nread = read(fd,buf,sizeof(buf));
+    if (nread == -1 && errno == EAGAIN) return;
+    if (nread <= 0) {
+        redisLog(REDIS_VERBOSE,"MIGRATE ASYNC read error: %s",
+            nread ? strerror(errno) : "connection closed");
+        migrateAsyncFinish(job,1,0);
+        return;
+    }
+    job->last_io = mstime();
+    job->inbuf = sdscatlen(job->inbuf,buf,nread);
+
+    /* Replies of SELECT and RESTORE are always single lines. */
+    p = job->inbuf;
+    while ((nl = strstr(p,"\r\n")) != NULL) {
+        *nl = '\0';
+        migrateAsyncProcessReply(job,p);
+        p = nl+2;
+    }
+    sdsrange(job->inbuf,p-job->inbuf,-1);
+
+    if (job->numreplies > job->numsent+1 || sdslen(job->inbuf) > 64*1024) {
+        /* More replies than commands: protocol desync. */
+        migrateAsyncFinish(job,1,0);
+    } else if (migrateAsyncDone(job)) {
+        migrateAsyncFinish(job,0,0);
+    }
+}
+
+/* Start an async transfer of the 'numkeys' keys of 'kv' (values in 'ov').
+ * Takes ownership of the two arrays. Replies to the client and returns on
+ * error, otherwise blocks the client until the transfer is over. */
+// 创建异步迁移任务，锁定所有键并阻塞客户端
+static void migrateAsyncStart(redisClient *c, robj **kv, robj **ov,
+                              int numkeys, long dbid, long timeout,
+                              int copy, int replace)
+{
+    migrateAsyncJob *job;
+    rio cmd;
+    int fd, j, k;
+
+    fd = anetTcpNonBlockConnect(server.neterr,c->argv[1]->ptr,
+                atoi(c->argv[2]->ptr));
+    if (fd == -1) {
+        addReplyErrorFormat(c,"Can't connect to target node: %s",
+            server.neterr);
+        zfree(kv);
+        zfree(ov);
+        return;
+    }
+    anetEnableTcpNoDelay(server.neterr,fd);
+
+    job = zmalloc(sizeof(*job));
+    job->c = c;
+    job->fd = fd;
+    job->db = c->db;
+    job->dbid = dbid;
+    job->copy = copy;
+    job->replace = replace;
+    job->timeout = timeout;
+    job->last_io = mstime();
+    job->kv = kv;
+    job->ov = ov;
+    job->numkeys = numkeys;
+    job->next = 0;
+    job->sent = zmalloc(sizeof(int)*numkeys);
+    job->numsent = 0;
+    job->numreplies = 0;
+    job->outbuf = sdsempty();
+    job->outpos = 0;
+    job->inbuf = sdsempty();
+    job->newargv = copy ? NULL : zmalloc(sizeof(robj*)*(numkeys+1));
+    job->del_idx = 1;
+    job->error = NULL;
+    job->select_error = 0;
+
+    // 锁定所有键，重复的键只迁移一次
+    for (j = 0, k = 0; j < numkeys; j++) {
+        if (dictAdd(c->db->migrating_keys,kv[j],job) != DICT_OK) continue;
+        kv[k] = kv[j];
+        ov[k] = ov[j];
+        incrRefCount(kv[k]);    /* Reference of the lock. */
+        incrRefCount(kv[k]);    /* Reference of the job. */
+        incrRefCount(ov[k]);
+        k++;
+    }
+    job->numkeys = k;
+
+    /* The target DB is always selected: the socket is a fresh one. */
+    rioInitWithBuffer(&cmd,job->outbuf);
+    redisAssert(rioWriteBulkCount(&cmd,'*',2));
+    redisAssert(rioWriteBulkString(&cmd,"SELECT",6));
+    redisAssert(rioWriteBulkLongLong(&cmd,dbid));
+    job->outbuf = cmd.io.buffer.ptr;
+
+    if (aeCreateFileEvent(server.el,fd,AE_WRITABLE,
+            migrateAsyncWriteHandler,job) == AE_ERR ||
+        aeCreateFileEvent(server.el,fd,AE_READABLE,
+            migrateAsyncReadHandler,job) == AE_ERR)
+    {
+        listAddNodeTail(server.migrate_async_jobs,job);
+        job->c = NULL;
+        addReplyError(c,"Can't register the MIGRATE ASYNC socket");
+        migrateAsyncFinish(job,1,1);
+        return;
+    }
+    listAddNodeTail(server.migrate_async_jobs,job);
+
+    c->bpop.timeout = 0;
+    c->bpop.migrate_job = job;
+    blockClient(c,REDIS_BLOCKED_MIGRATE);
+}
+
+/* Called by serverCron(): abort the transfers that made no progress for
+ * more than their timeout. */
+// 中止超时的异步迁移任务
+void migrateAsyncCron(void) {
+    listIter li;
+    listNode *ln;
+    mstime_t now = mstime();
+
+    listRewind(server.migrate_async_jobs,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        migrateAsyncJob *job = ln->value;
+
+        if (now - job->last_io > job->timeout)
+            migrateAsyncFinish(job,1,job->outpos != sdslen(job->outbuf) ||
+                                    job->next != job->numkeys);
+    }
+}
+
+/* in source node: MIGRATE target-host target-port key dbid(MUST 0) timeout [COPY | REPLACE]
+ *                 MIGRATE target-host target-port "" dbid timeout [COPY | REPLACE] KEYS key1 key2 ... keyN
+ *
+ * Both forms also accept ASYNC, see migrateAsyncStart().
+ *
+ * With KEYS all the keys are serialized into a single buffer of pipelined
+ * RESTORE commands, and the replies are read only after the whole buffer was
+ * written, so moving many small keys costs one round trip instead of one per
+ * key. Only the keys acknowledged by the target are deleted locally, and the
+ * command is propagated as a single DEL of those keys.
+ *
+ * 使用 KEYS 时，所有键的 RESTORE 命令被写入同一个缓冲区一次性发送（pipeline），
+ * 然后再统一读取回复，迁移大量小键时只需要一次往返。 */
 // 这个 CMD 会比较慢，因为是同步操作
 // TODO:(DONE) resharde 过程中，怎么锁住这个 slot。通过同步 migrate 操作
 // TODO:(DONE) 为什么要同步操作？为了锁住这个 slot，在迁移完毕之前，不再接受任何读写操作
 //（不太对，因为 ask 命令，实际上在 resharde 过程中，还是可能进行部分数据读写操作的）具体情况讨论请看开头的注释
 void migrateCommand(redisClient *c) {
-    int fd, copy, replace, j;
+    migrateCachedSocket *cs;
+    int copy, replace, async, j;
     long timeout;
     long dbid;
     long long ttl, expireat;
-    robj *o;
+    robj **ov = NULL;       /* Objects to migrate. */
+    robj **kv = NULL;       /* Key names. */
+    robj **newargv = NULL;  /* Used to rewrite the command as DEL ... keys ... */
     rio cmd, payload;
-    int retry_num = 0;
+    int may_retry = 1;
+    int write_error = 0;
+    int argv_rewritten = 0;
+    int select;
 
-try_again:
-    /* Initialization */
-    copy = 0;
-    replace = 0;
-    ttl = 0;
+    /* To support the KEYS option we need the following additional state. */
+    int first_key = 3;  /* Argument index of the first key. */
+    int num_keys = 1;   /* By default only migrate the 'key' argument. */
 
     /* Parse additional options */
-    // 读入 COPY 或者 REPLACE 选项
+    // 读入 COPY 、 REPLACE 、 ASYNC 或者 KEYS 选项
+    copy = 0;
+    replace = 0;
+    async = 0;
     for (j = 6; j < c->argc; j++) {
         if (!strcasecmp(c->argv[j]->ptr,"copy")) {
             copy = 1;
         } else if (!strcasecmp(c->argv[j]->ptr,"replace")) {
             replace = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"async")) {
+            async = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"keys")) {
+            if (sdslen(c->argv[3]->ptr) != 0) {
+                addReplyError(c,
+                    "When using MIGRATE KEYS option, the key argument"
+                    " must be set to the empty string");
+                return;
+            }
+            first_key = j+1;
+            num_keys = c->argc - j - 1;
+            break; /* All the remaining args are keys. */
         } else {
             addReply(c,shared.syntaxerr);
             return;
@@ -6061,64 +6838,122 @@ try_again:
         return;
     if (timeout <= 0) timeout = 1000;
 
-    /* Check if the key is here. If not we reply with success as there is
-     * nothing to migrate (for instance the key expired in the meantime), but
-     * we include such information in the reply string. */
-    // 取出键的值对象
-    if ((o = lookupKeyRead(c->db,c->argv[3])) == NULL) {
+    /* The async mode blocks the client, which is not possible inside
+     * MULTI/EXEC or from scripts and modules. */
+    if (async && (c->flags & REDIS_MULTI || c->fd == -1)) {
+        addReplyError(c,"MIGRATE ASYNC is not allowed in transactions "
+                        "or scripts");
+        return;
+    }
+
+    /* Keys already locked by an async MIGRATE can't be migrated again. */
+    // 键正在被异步迁移
+    if (dictSize(c->db->migrating_keys)) {
+        for (j = 0; j < num_keys; j++) {
+            if (dictFind(c->db->migrating_keys,c->argv[first_key+j])) {
+                addReplySds(c,sdsnew("-TRYAGAIN Key is being migrated\r\n"));
+                return;
+            }
+        }
+    }
+
+    /* Check if the keys are here. If at least one key is to migrate, do it,
+     * otherwise if all the keys are missing reply with "NOKEY" to signal
+     * the caller there was nothing to migrate. We don't return an error in
+     * this case, since often this is due to a normal condition like the key
+     * expiring in the meantime. */
+    // 取出所有存在的键的值对象
+    ov = zmalloc(sizeof(robj*)*num_keys);
+    kv = zmalloc(sizeof(robj*)*num_keys);
+    {
+        int oi = 0;
+
+        for (j = 0; j < num_keys; j++) {
+            if ((ov[oi] = lookupKeyRead(c->db,c->argv[first_key+j])) != NULL) {
+                kv[oi] = c->argv[first_key+j];
+                oi++;
+            }
+        }
+        num_keys = oi;
+    }
+    if (num_keys == 0) {
+        zfree(ov);
+        zfree(kv);
         addReplySds(c,sdsnew("+NOKEY\r\n"));
         return;
     }
 
+    if (async) {
+        migrateAsyncStart(c,kv,ov,num_keys,dbid,timeout,copy,replace);
+        return;
+    }
+
+try_again:
+    write_error = 0;
+
     /* Connect */
     // 获取套接字连接
-    fd = migrateGetSocket(c,c->argv[1],c->argv[2],timeout);
-    if (fd == -1) return; /* error sent to the client by migrateGetSocket() */
+    cs = migrateGetSocket(c,c->argv[1],c->argv[2],timeout);
+    if (cs == NULL) {
+        zfree(ov);
+        zfree(kv);
+        return; /* error sent to the client by migrateGetSocket() */
+    }
 
-    /* Create RESTORE payload and generate the protocol to call the command. */
-    // 创建用于指定数据库的 SELECT 命令，以免键值对被还原到了错误的地方
     rioInitWithBuffer(&cmd,sdsempty());
-    redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SELECT",6));
-    redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,dbid));    // db-id 基本是 0 的了，cluster mode 下只能用 0
 
-    // 取出键的过期时间戳
-    expireat = getExpire(c->db,c->argv[3]);
-    if (expireat != -1) {
-        ttl = expireat-mstime();
-        if (ttl < 1) ttl = 1;
+    /* Send the SELECT command if the current DB is not already selected. */
+    // 只有当缓存套接字上选中的不是目标数据库时，才发送 SELECT
+    select = cs->last_dbid != dbid;
+    if (select) {
+        redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SELECT",6));
+        redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,dbid));    // db-id 基本是 0 的了，cluster mode 下只能用 0
     }
-    redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',replace ? 5 : 4));
-
-    // 如果运行在集群模式下，那么发送的命令为 RESTORE-ASKING
-    // 如果运行在非集群模式下，那么发送的命令为 RESTORE
-    if (server.cluster_enabled)
-        redisAssertWithInfo(c,NULL,
-            rioWriteBulkString(&cmd,"RESTORE-ASKING",14));
-    else
-        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"RESTORE",7));
 
-    // 写入键名和过期时间
-    redisAssertWithInfo(c,NULL,sdsEncodedObject(c->argv[3]));
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,c->argv[3]->ptr,
-            sdslen(c->argv[3]->ptr)));
-    redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
+    /* Create RESTORE payload and generate the protocol to call the command. */
+    // 为每个键生成一条 RESTORE 命令，全部追加到同一个缓冲区里
+    for (j = 0; j < num_keys; j++) {
+        // 取出键的过期时间戳
+        ttl = 0;
+        expireat = getExpire(c->db,kv[j]);
+        if (expireat != -1) {
+            ttl = expireat-mstime();
+            if (ttl < 1) ttl = 1;
+        }
+        redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',replace ? 5 : 4));
 
-    /* Emit the payload argument, that is the serialized object using
-     * the DUMP format. */
-    // 将值对象进行序列化
-    createDumpPayload(&payload,o);
-    // 写入序列化对象
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,payload.io.buffer.ptr,
-                                sdslen(payload.io.buffer.ptr)));
-    sdsfree(payload.io.buffer.ptr);
-
-    /* Add the REPLACE option to the RESTORE command if it was specified
-     * as a MIGRATE option. */
-    // 是否设置了 REPLACE 命令？
-    if (replace)
-        // 写入 REPLACE 参数
-        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"REPLACE",7));
+        // 如果运行在集群模式下，那么发送的命令为 RESTORE-ASKING
+        // 如果运行在非集群模式下，那么发送的命令为 RESTORE
+        if (server.cluster_enabled)
+            redisAssertWithInfo(c,NULL,
+                rioWriteBulkString(&cmd,"RESTORE-ASKING",14));
+        else
+            redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"RESTORE",7));
+
+        // 写入键名和过期时间
+        redisAssertWithInfo(c,NULL,sdsEncodedObject(kv[j]));
+        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,kv[j]->ptr,
+                sdslen(kv[j]->ptr)));
+        redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
+
+        /* Emit the payload argument, that is the serialized object using
+         * the DUMP format. */
+        // 将值对象进行序列化
+        createDumpPayload(&payload,ov[j]);
+        // 写入序列化对象
+        redisAssertWithInfo(c,NULL,
+            rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                               sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+
+        /* Add the REPLACE option to the RESTORE command if it was specified
+         * as a MIGRATE option. */
+        // 是否设置了 REPLACE 命令？
+        if (replace)
+            // 写入 REPLACE 参数
+            redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"REPLACE",7));
+    }
 
     /* Transfer the query to the other node in 64K chunks. */
     // 以 64 kb 每次的大小向对方发送数据
@@ -6130,73 +6965,816 @@ try_again:
 
         while ((towrite = sdslen(buf)-pos) > 0) {
             towrite = (towrite > (64*1024) ? (64*1024) : towrite);
-            nwritten = syncWrite(fd,buf+pos,towrite,timeout);
-            if (nwritten != (signed)towrite) goto socket_wr_err;
+            nwritten = syncWrite(cs->fd,buf+pos,towrite,timeout);
+            if (nwritten != (signed)towrite) {
+                write_error = 1;
+                goto socket_err;
+            }
             pos += nwritten;
         }
     }
 
-    /* Read back the reply. */
+    /* Read back the replies: the one of SELECT, if sent, and then one for
+     * every RESTORE, in order. */
     // 读取命令的回复
     {
-        char buf1[1024];
-        char buf2[1024];
+        char buf1[1024]; /* Select reply. */
+        char buf2[1024]; /* Restore reply. */
+        int error_from_target = 0;
+        int socket_error = 0;
+        int del_idx = 1; /* Index of the key argument for the replicated DEL. */
+
+        /* Read the SELECT reply if needed. */
+        if (select && syncReadLine(cs->fd,buf1,sizeof(buf1),timeout) <= 0)
+            goto socket_err;
+
+        if (!copy) newargv = zmalloc(sizeof(robj*)*(num_keys+1));
+
+        for (j = 0; j < num_keys; j++) {
+            if (syncReadLine(cs->fd,buf2,sizeof(buf2),timeout) <= 0) {
+                socket_error = 1;
+                break;
+            }
 
-        /* Read the two replies */
-        if (syncReadLine(fd, buf1, sizeof(buf1), timeout) <= 0)
-            goto socket_rd_err;
-        if (syncReadLine(fd, buf2, sizeof(buf2), timeout) <= 0)
-            goto socket_rd_err;
+            // 检查 RESTORE 命令执行是否成功
+            if ((select && buf1[0] == '-') || buf2[0] == '-') {
+                /* On error assume that last_dbid is no longer valid. Only
+                 * the first error is reported to the client. */
+                if (!error_from_target) {
+                    cs->last_dbid = -1;
+                    addReplyErrorFormat(c,
+                        "Target instance replied with error: %s",
+                        (select && buf1[0] == '-') ? buf1+1 : buf2+1);
+                    error_from_target = 1;
+                }
+            } else if (!copy) {
+                /* No COPY option: remove the local key, signal the change. */
+                // 如果没有指定 COPY 选项，那么删除本机数据库中的键
+                dbDelete(c->db,kv[j]);
+                signalModifiedKey(c->db,kv[j]);
+                server.dirty++;
+
+                /* Populate the argument vector to replace the old one. */
+                newargv[del_idx++] = kv[j];
+                incrRefCount(kv[j]);
+            }
+        }
 
-        // 检查 RESTORE 命令执行是否成功
+        /* On a socket error retry now, before rewriting the command vector,
+         * but only if we are sure nothing was processed: we failed to read
+         * the very first reply. */
+        if (!error_from_target && socket_error && j == 0 && may_retry &&
+            errno != ETIMEDOUT)
+        {
+            goto socket_err; /* A retry is guaranteed by the tests above. */
+        }
 
-        if (buf1[0] == '-' || buf2[0] == '-') {
+        /* Close the socket now that the original host and port are still
+         * in argv: the command vector may be rewritten as DEL below. */
+        if (socket_error) migrateCloseSocket(c->argv[1],c->argv[2]);
+
+        if (!copy) {
+            /* Translate MIGRATE as DEL for replication/AOF, only for the
+             * keys the target acknowledged. */
+            // 向 AOF 文件和 slave 节点发送一个 DEL 命令，只包含对方确认收到的键
+            if (del_idx > 1) {
+                newargv[0] = createStringObject("DEL",3);
+                /* The following call takes ownership of newargv. */
+                replaceClientCommandVector(c,del_idx,newargv);
+                argv_rewritten = 1;
+            } else {
+                zfree(newargv);
+            }
+            newargv = NULL;
+        }
 
-            // 执行出错。。。
+        /* A socket error we are not going to retry: report it, unless the
+         * target already sent an error we reported. */
+        if (!error_from_target && socket_error) {
+            may_retry = 0;
+            goto socket_err;
+        }
 
-            addReplyErrorFormat(c,"Target instance replied with error: %s",
-                (buf1[0] == '-') ? buf1+1 : buf2+1);
-        } else {
+        /* Success: the target DB is now selected on the cached socket, so
+         * the next MIGRATE to the same DB can skip SELECT. On error the
+         * reply was already sent above. */
+        if (!error_from_target) {
+            cs->last_dbid = dbid;
+            addReply(c,shared.ok);
+        }
+    }
 
-            // 执行成功。。。
+    sdsfree(cmd.io.buffer.ptr);
+    zfree(ov);
+    zfree(kv);
+    return;
 
-            robj *aux;
+/* On socket errors we close the cached socket and try again, once: it is
+ * very common for the cached socket to get closed by the other side, and
+ * reopening it usually just works. */
+socket_err:
+    sdsfree(cmd.io.buffer.ptr);
 
-            // 如果没有指定 COPY 选项，那么删除本机数据库中的键
-            if (!copy) {
-                /* No COPY option: remove the local key, signal the change. */
-                dbDelete(c->db,c->argv[3]);
-                signalModifiedKey(c->db,c->argv[3]);
+    /* Closing the socket also forces SELECT the next time. If argv was
+     * rewritten as DEL the socket was already closed above. */
+    if (!argv_rewritten) migrateCloseSocket(c->argv[1],c->argv[2]);
+    zfree(newargv);
+    newargv = NULL; /* Allocated again on retry. */
+
+    if (errno != ETIMEDOUT && may_retry) {
+        may_retry = 0;
+        goto try_again;
+    }
+
+    zfree(ov);
+    zfree(kv);
+    addReplySds(c,sdscatprintf(sdsempty(),
+        "-IOERR error or timeout %s to target instance\r\n",
+        write_error ? "writing" : "reading"));
+}
+
+/* -----------------------------------------------------------------------------
+ * Whole slot migration: CLUSTER MIGRATESLOT / CLUSTER IMPORTSLOT
+ *
+ * Moving a slot with MIGRATE means one round trip per key and ASK
+ * redirections for clients during the whole resharding. CLUSTER MIGRATESLOT
+ * moves a slot as a unit instead:
+ *
+ * 1) The source serializes all the keys of the slot, found via the per
+ *    slot key index, as RDB key-value pairs in CLUSTER IMPORTSLOT DATA
+ *    commands. This is a point-in-time snapshot.
+ * 2) The snapshot is streamed to the target from the event loop. Every
+ *    write against the slot the source executes after the snapshot is
+ *    appended to the same stream, exactly like it is fed to the slaves, so
+ *    the target applies it after the snapshot, in order. Meanwhile the
+ *    source keeps serving the slot normally: no ASK redirections.
+ * 3) Once the stream is drained the source sends ACK and keeps streaming:
+ *    the reply tells the target applied the snapshot. The next time the
+ *    stream is drained the source refuses writes to the slot (-TRYAGAIN),
+ *    so the refusal only lasts for a short tail of writes, and sends
+ *    COMMIT: the target claims the slot under a new
+ *    configEpoch, saves its config and broadcasts it, then replies. The
+ *    source assigns the slot to the target and deletes its local keys.
+ *
+ * The target doesn't reply to the commands of the importing link apart from
+ * BEGIN, ACK and COMMIT, so the stream needs no reply parsing. If the link drops
+ * before COMMIT the target drops the keys it imported and the slot stays
+ * with the source. If it drops after COMMIT was sent, the source keeps
+ * writes refused until the cluster tells it who owns the slot.
+ *
+ * 整个槽的迁移：源节点先为槽里的所有键生成 RDB 格式的快照，
+ * 之后对该槽的写命令像复制流一样追加在快照后面转发给目标节点，
+ * 发送完毕后短暂拒绝写入并发送 COMMIT ，目标节点提升 configEpoch 接管槽。
+ * 整个过程中客户端不会收到 ASK 转向。
+ * -------------------------------------------------------------------------- */
+
+/* Size of the RDB payload of every CLUSTER IMPORTSLOT DATA command. */
+#define CLUSTER_SLOTMIG_CHUNK (64*1024)
+
+// 迁移状态
+#define CLUSTER_SLOTMIG_STREAM 0    /* Snapshot and writes being streamed. */
+#define CLUSTER_SLOTMIG_HANDOFF 1   /* COMMIT sent, writes to the slot refused. */
+#define CLUSTER_SLOTMIG_UNKNOWN 2   /* Link lost after COMMIT: waiting for the
+                                       cluster to tell who owns the slot. */
+
+typedef struct clusterSlotMigration {
+
+    // 被迁移的槽，以及目标节点的名字
+    int slot;
+    char target[REDIS_CLUSTER_NAMELEN];
+
+    // 阻塞在 CLUSTER MIGRATESLOT 中的客户端，断开后为 NULL
+    redisClient *c;
+
+    // 连接目标节点的套接字，以及是否安装了写事件
+    int fd;
+    int writable;
+
+    int state;              /* CLUSTER_SLOTMIG_* */
+
+    // I/O 超时时间（毫秒）和最后一次读写成功的时间
+    long timeout;
+    mstime_t last_io;
+
+    // UNKNOWN 状态的最长等待时间
+    mstime_t handoff_deadline;
+
+    // 发送缓冲区和接收缓冲区
+    sds outbuf;
+    size_t outpos;
+    sds inbuf;
+
+    // 已经收到的回复，依次属于 BEGIN 、 ACK 和 COMMIT
+    int replies;
+
+    // 是否已经发送 ACK ，以及目标节点是否已经追上快照
+    int ack_sent;
+    int synced;
+
+    // 快照中的键数量，以及转发的写命令数量
+    long long keys;
+    long long forwarded;
+
+} clusterSlotMigration;
+
+static void clusterSlotMigrationWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+/* Append CLUSTER IMPORTSLOT <slot> <subcommand> [args...] to 'buf'. The
+ * 'args' objects are released. */
+static sds clusterCatImportSlotCommand(sds buf, int slot, char *subcmd,
+                                       robj **args, int numargs)
+{
+    robj *argv[6];
+    int j, argc = 0;
+
+    argv[argc++] = createStringObject("CLUSTER",7);
+    argv[argc++] = createStringObject("IMPORTSLOT",10);
+    argv[argc++] = createStringObjectFromLongLong(slot);
+    argv[argc++] = createStringObject(subcmd,strlen(subcmd));
+    for (j = 0; j < numargs; j++) argv[argc++] = args[j];
+    buf = catAppendOnlyGenericCommand(buf,argc,argv);
+    for (j = 0; j < argc; j++) decrRefCount(argv[j]);
+    return buf;
+}
+
+/* Delete all the keys of 'slot', propagating a DEL for every key so that
+ * the slaves and the AOF drop them as well. */
+// 删除槽中的所有键，并向 AOF 和 slave 传播 DEL
+static unsigned int clusterDelKeysInSlotAndPropagate(int slot) {
+    dict *d = server.cluster->slots_to_keys[slot];
+    dictIterator *di;
+    dictEntry *de;
+    unsigned int j = 0;
+
+    if (d == NULL) return 0;
+    di = dictGetSafeIterator(d);
+    while((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key,sdslen(key));
+
+        propagateExpire(&server.db[0],keyobj);
+        dbDelete(&server.db[0],keyobj);
+        signalModifiedKey(&server.db[0],keyobj);
+        decrRefCount(keyobj);
+        server.dirty++;
+        j++;
+    }
+    dictReleaseIterator(di);
+    return j;
+}
+
+/* Return 1 if writes to 'slot' must be refused because the slot is being
+ * handed off to another node. */
+static int clusterSlotHandoffInProgress(int slot) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+
+    return sm && sm->slot == slot && sm->state != CLUSTER_SLOTMIG_STREAM;
+}
+
+/* Release the migration state, replying 'reply' to the client if it is
+ * still there (the reply sds is always consumed). */
+static void clusterSlotMigrationFree(clusterSlotMigration *sm, sds reply) {
+    if (sm->c) {
+        addReplySds(sm->c,reply);
+        unblockClient(sm->c);
+    } else {
+        sdsfree(reply);
+    }
+    if (sm->fd != -1) {
+        aeDeleteFileEvent(server.el,sm->fd,AE_READABLE|AE_WRITABLE);
+        close(sm->fd);
+    }
+    sdsfree(sm->outbuf);
+    sdsfree(sm->inbuf);
+    server.cluster->slot_migration = NULL;
+    zfree(sm);
+}
+
+/* Abort the migration: the slot stays with this node. */
+static void clusterSlotMigrationFail(clusterSlotMigration *sm, sds err) {
+    redisLog(REDIS_WARNING,"Migration of slot %d to %.40s aborted: %s",
+        sm->slot, sm->target, err);
+    clusterSlotMigrationFree(sm,sdscatprintf(sdsempty(),"-%s\r\n",err));
+    sdsfree(err);
+}
+
+/* The target owns the slot now: assign it and drop the local keys. */
+static void clusterSlotMigrationDone(clusterSlotMigration *sm) {
+    clusterNode *n = clusterLookupNode(sm->target);
+    unsigned int deleted;
+
+    if (server.cluster->slots[sm->slot] == myself) {
+        clusterDelSlot(sm->slot);
+        if (n) clusterAddSlot(n,sm->slot);
+    }
+    server.cluster->migrating_slots_to[sm->slot] = NULL;
+    deleted = clusterDelKeysInSlotAndPropagate(sm->slot);
+    clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|
+                         CLUSTER_TODO_UPDATE_STATE|
+                         CLUSTER_TODO_FSYNC_CONFIG);
+    redisLog(REDIS_NOTICE,
+        "Slot %d migrated to %.40s (%lld keys, %lld writes forwarded, "
+        "%u local keys deleted)", sm->slot, sm->target, sm->keys,
+        sm->forwarded, deleted);
+    clusterSlotMigrationFree(sm,sdsnew("+OK\r\n"));
+}
+
+/* The link with the target failed. Before COMMIT this just aborts the
+ * migration. After COMMIT we can't know if the target took the slot: keep
+ * refusing writes until the cluster configuration tells us, or up to
+ * twice the node timeout. */
+static void clusterSlotMigrationLinkError(clusterSlotMigration *sm, int writing) {
+    if (sm->state == CLUSTER_SLOTMIG_STREAM) {
+        clusterSlotMigrationFail(sm,sdscatprintf(sdsempty(),
+            "IOERR error or timeout %s to target instance",
+            writing ? "writing" : "reading"));
+        return;
+    }
+    redisLog(REDIS_WARNING,"Lost the link to %.40s after the handoff of "
+        "slot %d: waiting for the cluster to settle the slot owner.",
+        sm->target, sm->slot);
+    aeDeleteFileEvent(server.el,sm->fd,AE_READABLE|AE_WRITABLE);
+    close(sm->fd);
+    sm->fd = -1;
+    sm->state = CLUSTER_SLOTMIG_UNKNOWN;
+    sm->handoff_deadline = mstime() + server.cluster_node_timeout*2;
+}
+
+/* Make sure the write handler is installed. */
+static void clusterSlotMigrationWantWrite(clusterSlotMigration *sm) {
+    if (sm->writable || sm->fd == -1) return;
+    if (aeCreateFileEvent(server.el,sm->fd,AE_WRITABLE,
+            clusterSlotMigrationWriteHandler,sm) != AE_ERR)
+        sm->writable = 1;
+}
+
+/* Called by propagate(): writes against the slot being streamed are
+ * forwarded to the target, after the snapshot. */
+// 将针对正在迁移的槽的写命令转发到目标节点
+void clusterSlotMigrationFeed(struct redisCommand *cmd, int dbid, robj **argv, int argc) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+    int *keys, numkeys;
+
+    if (sm->state != CLUSTER_SLOTMIG_STREAM || dbid != 0) return;
+    keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    if (numkeys > 0) {
+        robj *key = argv[keys[0]];
+
+        if ((int)keyHashSlot(key->ptr,sdslen(key->ptr)) == sm->slot) {
+            sm->outbuf = catAppendOnlyGenericCommand(sm->outbuf,argc,argv);
+            sm->forwarded++;
+            clusterSlotMigrationWantWrite(sm);
+        }
+    }
+    getKeysFreeResult(keys);
+}
+
+// 写事件处理器：发送快照和转发的写命令，全部发送完毕后发送 COMMIT
+static void clusterSlotMigrationWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    clusterSlotMigration *sm = privdata;
+    size_t written = 0;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    while (written < MIGRATE_ASYNC_WRITE_PER_EVENT &&
+           sm->outpos < sdslen(sm->outbuf))
+    {
+        ssize_t nwritten = write(fd,sm->outbuf+sm->outpos,
+                                 sdslen(sm->outbuf)-sm->outpos);
+        if (nwritten == -1) {
+            if (errno == EAGAIN) break;
+            clusterSlotMigrationLinkError(sm,1);
+            return;
+        }
+        sm->outpos += nwritten;
+        written += nwritten;
+        sm->last_io = mstime();
+    }
+
+    if (sm->outpos != sdslen(sm->outbuf)) {
+        /* Don't let the already sent part grow without bounds while the
+         * source keeps forwarding writes. */
+        if (sm->outpos > CLUSTER_SLOTMIG_CHUNK*16) {
+            sdsrange(sm->outbuf,sm->outpos,-1);
+            sm->outpos = 0;
+        }
+        return;
+    }
+    sdsclear(sm->outbuf);
+    sm->outpos = 0;
+
+    /* Everything sent: ask the target to tell when it applied it. */
+    if (sm->state == CLUSTER_SLOTMIG_STREAM && !sm->ack_sent) {
+        sm->ack_sent = 1;
+        sm->outbuf = clusterCatImportSlotCommand(sm->outbuf,sm->slot,
+                                                 "ACK",NULL,0);
+        return;
+    }
+
+    /* The target caught up with us: stop accepting writes for the slot and
+     * hand it off. */
+    if (sm->state == CLUSTER_SLOTMIG_STREAM && sm->synced) {
+        sm->state = CLUSTER_SLOTMIG_HANDOFF;
+        sm->outbuf = clusterCatImportSlotCommand(sm->outbuf,sm->slot,
+                                                 "COMMIT",NULL,0);
+        redisLog(REDIS_NOTICE,"Slot %d streamed to %.40s, handing it off.",
+            sm->slot, sm->target);
+        return;
+    }
+    aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+    sm->writable = 0;
+}
+
+// 读事件处理器：读取 BEGIN 和 COMMIT 的回复
+static void clusterSlotMigrationReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    clusterSlotMigration *sm = privdata;
+    char buf[1024];
+    ssize_t nread;
+    char *nl;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    nread = read(fd,buf,sizeof(buf));
+    if (nread == -1 && errno == EAGAIN) return;
+    if (nread <= 0) {
+        clusterSlotMigrationLinkError(sm,0);
+        return;
+    }
+    sm->last_io = mstime();
+    sm->inbuf = sdscatlen(sm->inbuf,buf,nread);
+
+    while ((nl = strstr(sm->inbuf,"\r\n")) != NULL) {
+        int ok = sm->inbuf[0] == '+';
+
+        *nl = '\0';
+        sm->replies++;
+        if (!ok) {
+            clusterSlotMigrationFail(sm,sdscatprintf(sdsempty(),
+                "ERR Target refused the %s of the slot: %s",
+                sm->replies == 3 ? "handoff" : "import", sm->inbuf+1));
+            return;
+        }
+        if (sm->replies == 2) {
+            /* ACK: hand off as soon as the pending writes are sent. */
+            sm->synced = 1;
+            clusterSlotMigrationWantWrite(sm);
+        } else if (sm->replies == 3) {
+            clusterSlotMigrationDone(sm);
+            return;
+        }
+        sdsrange(sm->inbuf,(nl+2)-sm->inbuf,-1);
+    }
+    if (sdslen(sm->inbuf) > sizeof(buf)) clusterSlotMigrationLinkError(sm,0);
+}
+
+/* CLUSTER MIGRATESLOT <slot> <node ID> [timeout] */
+static void clusterMigrateSlotCommand(redisClient *c) {
+    clusterSlotMigration *sm;
+    clusterNode *n;
+    long timeout = 5000;
+    long long now = mstime();
+    int slot, fd;
+    dict *d;
+    rio payload;
+
+    if ((slot = getSlotOrReply(c,c->argv[2])) == -1) return;
+    if (c->argc == 5 &&
+        getLongFromObjectOrReply(c,c->argv[4],&timeout,NULL) != REDIS_OK)
+        return;
+    if (timeout <= 0) timeout = 1000;
+
+    if (c->flags & REDIS_MULTI || c->fd == -1) {
+        addReplyError(c,"CLUSTER MIGRATESLOT is not allowed in transactions "
+                        "or scripts");
+        return;
+    }
+    if (server.cluster->slot_migration) {
+        addReplyError(c,"A slot migration is already in progress");
+        return;
+    }
+    if (server.cluster->slots[slot] != myself) {
+        addReplyErrorFormat(c,"I'm not the owner of hash slot %u",slot);
+        return;
+    }
+    if (server.cluster->migrating_slots_to[slot] ||
+        server.cluster->importing_slots_from[slot])
+    {
+        addReplyErrorFormat(c,"Hash slot %d is in migrating or importing "
+                              "state",slot);
+        return;
+    }
+    if ((n = clusterLookupNode(c->argv[3]->ptr)) == NULL) {
+        addReplyErrorFormat(c,"I don't know about node %s",
+            (char*)c->argv[3]->ptr);
+        return;
+    }
+    if (n == myself || !nodeIsMaster(n) || nodeFailed(n)) {
+        addReplyError(c,"The target must be a different, reachable master");
+        return;
+    }
+
+    fd = anetTcpNonBlockConnect(server.neterr,n->ip,n->port);
+    if (fd == -1) {
+        addReplyErrorFormat(c,"Can't connect to target node: %s",
+            server.neterr);
+        return;
+    }
+    anetEnableTcpNoDelay(server.neterr,fd);
+
+    sm = zmalloc(sizeof(*sm));
+    sm->slot = slot;
+    memcpy(sm->target,n->name,REDIS_CLUSTER_NAMELEN);
+    sm->c = c;
+    sm->fd = fd;
+    sm->writable = 0;
+    sm->state = CLUSTER_SLOTMIG_STREAM;
+    sm->timeout = timeout;
+    sm->last_io = now;
+    sm->handoff_deadline = 0;
+    sm->outbuf = sdsempty();
+    sm->outpos = 0;
+    sm->inbuf = sdsempty();
+    sm->replies = 0;
+    sm->ack_sent = 0;
+    sm->synced = 0;
+    sm->keys = 0;
+    sm->forwarded = 0;
+
+    /* BEGIN tells the target who we are and the RDB version of DATA. */
+    {
+        robj *args[2];
+
+        args[0] = createStringObject(myself->name,REDIS_CLUSTER_NAMELEN);
+        args[1] = createStringObjectFromLongLong(REDIS_RDB_VERSION);
+        sm->outbuf = clusterCatImportSlotCommand(sm->outbuf,slot,"BEGIN",
+                                                 args,2);
+    }
+
+    /* Snapshot of the slot: RDB key-value pairs, chunked in DATA commands. */
+    // 为槽中的所有键生成快照
+    d = server.cluster->slots_to_keys[slot];
+    rioInitWithBuffer(&payload,sdsempty());
+    if (d) {
+        dictIterator *di = dictGetIterator(d);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+            robj keyobj, *o;
+
+            initStaticStringObject(keyobj,key);
+            o = dictFetchValue(server.db[0].dict,key);
+            if (rdbSaveKeyValuePair(&payload,&keyobj,o,
+                    getExpire(&server.db[0],&keyobj),now) == 1)
+                sm->keys++;
+            if (sdslen(payload.io.buffer.ptr) >= CLUSTER_SLOTMIG_CHUNK) {
+                robj *arg = createObject(REDIS_STRING,payload.io.buffer.ptr);
+
+                sm->outbuf = clusterCatImportSlotCommand(sm->outbuf,slot,
+                                                         "DATA",&arg,1);
+                rioInitWithBuffer(&payload,sdsempty());
             }
-            addReply(c,shared.ok);
-            server.dirty++;
+        }
+        dictReleaseIterator(di);
+    }
+    if (sdslen(payload.io.buffer.ptr)) {
+        robj *arg = createObject(REDIS_STRING,payload.io.buffer.ptr);
 
-            /* Translate MIGRATE as DEL for replication/AOF. */
-            // 如果键被删除了的话，向 AOF 文件和 slave /节点发送一个 DEL 命令
-            aux = createStringObject("DEL",3);
-            rewriteClientCommandVector(c,2,aux,c->argv[3]);
-            decrRefCount(aux);
+        sm->outbuf = clusterCatImportSlotCommand(sm->outbuf,slot,"DATA",
+                                                 &arg,1);
+    } else {
+        sdsfree(payload.io.buffer.ptr);
+    }
+
+    if (aeCreateFileEvent(server.el,fd,AE_READABLE,
+            clusterSlotMigrationReadHandler,sm) == AE_ERR)
+    {
+        sm->c = NULL;
+        clusterSlotMigrationFree(sm,sdsempty());
+        addReplyError(c,"Can't register the slot migration socket");
+        return;
+    }
+    server.cluster->slot_migration = sm;
+    clusterSlotMigrationWantWrite(sm);
+    redisLog(REDIS_NOTICE,"Migrating slot %d to %.40s: %lld keys, "
+        "%zu bytes snapshot.", slot, sm->target, sm->keys,
+        sdslen(sm->outbuf));
+
+    c->bpop.timeout = 0;
+    blockClient(c,REDIS_BLOCKED_MIGRATE);
+}
+
+/* Called by unblockClient() (via unblockClientFromMigrate()) when the
+ * client blocked in CLUSTER MIGRATESLOT goes away: the migration goes on. */
+void clusterSlotMigrationClientGone(redisClient *c) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+
+    if (sm && sm->c == c) sm->c = NULL;
+}
+
+/* Called by clusterCron(). */
+void clusterSlotMigrationCron(void) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+    mstime_t now = mstime();
+
+    if (sm->state == CLUSTER_SLOTMIG_UNKNOWN) {
+        if (server.cluster->slots[sm->slot] != myself) {
+            /* The target claimed the slot with a greater epoch. */
+            clusterSlotMigrationDone(sm);
+        } else if (now > sm->handoff_deadline) {
+            clusterSlotMigrationFail(sm,sdsnew("IOERR the target never "
+                "confirmed the handoff, the slot is still served here"));
         }
+    } else if (now - sm->last_io > sm->timeout) {
+        clusterSlotMigrationLinkError(sm,sm->outpos != sdslen(sm->outbuf));
     }
+}
 
-    sdsfree(cmd.io.buffer.ptr);
-    return;
+/* This slot was moved here (CLUSTER SETSLOT NODE on an importing slot, or
+ * CLUSTER IMPORTSLOT COMMIT): set this node configEpoch to a new epoch so
+ * that the new version can be propagated by the cluster.
+ *
+ * Note that if this ever results in a collision with another node getting
+ * the same configEpoch, for example because a failover happens at the same
+ * time we close the slot, the configEpoch collision resolution will fix it
+ * assigning a different epoch to each node. */
+static void clusterBumpConfigEpochForImport(int slot) {
+    uint64_t maxEpoch = clusterGetMaxEpoch();
 
-socket_wr_err:
-    sdsfree(cmd.io.buffer.ptr);
-    migrateCloseSocket(c->argv[1],c->argv[2]);
-    if (errno != ETIMEDOUT && retry_num++ == 0) goto try_again;
-    addReplySds(c,
-        sdsnew("-IOERR error or timeout writing to target instance\r\n"));
-    return;
+    if (myself->configEpoch == 0 ||
+        myself->configEpoch != maxEpoch)
+    {
+        server.cluster->currentEpoch++;
+        myself->configEpoch = server.cluster->currentEpoch;
+        clusterDoBeforeSleep(CLUSTER_TODO_FSYNC_CONFIG);
+        redisLog(REDIS_WARNING,
+            "configEpoch set to %llu after importing slot %d",
+            (unsigned long long) myself->configEpoch, slot);
+    }
+}
 
-socket_rd_err:
-    sdsfree(cmd.io.buffer.ptr);
-    migrateCloseSocket(c->argv[1],c->argv[2]);
-    if (errno != ETIMEDOUT && retry_num++ == 0) goto try_again;
-    addReplySds(c,
-        sdsnew("-IOERR error or timeout reading from target node\r\n"));
-    return;
+/* The link importing a slot was closed before COMMIT: drop what it sent. */
+void clusterImportSlotAbort(redisClient *c) {
+    int slot = server.cluster->slot_import_slot;
+
+    c->flags &= ~REDIS_SLOT_IMPORT;
+    if (server.cluster->slot_import_client != c) return;
+    server.cluster->slot_import_client = NULL;
+    server.cluster->slot_import_slot = -1;
+    if (server.cluster->slots[slot] != myself) {
+        redisLog(REDIS_WARNING,"Import of slot %d aborted, removed %u keys.",
+            slot, clusterDelKeysInSlotAndPropagate(slot));
+    }
+}
+
+/* Load the RDB key-value pairs of a DATA payload into the DB. Returns
+ * REDIS_ERR on a malformed payload or a key of another slot. */
+static int clusterImportSlotLoad(int slot, sds payload) {
+    long long now = mstime();
+    rio rdb;
+
+    rioInitWithBuffer(&rdb,payload);
+    while ((size_t)rioTell(&rdb) < sdslen(payload)) {
+        long long expiretime = -1;
+        robj *key, *val;
+        int type;
+
+        if ((type = rdbLoadType(&rdb)) == -1) return REDIS_ERR;
+        if (type == REDIS_RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1)
+                return REDIS_ERR;
+            if ((type = rdbLoadType(&rdb)) == -1) return REDIS_ERR;
+        }
+        if ((key = rdbLoadStringObject(&rdb)) == NULL) return REDIS_ERR;
+        if ((int)keyHashSlot(key->ptr,sdslen(key->ptr)) != slot ||
+            (val = rdbLoadObject(type,&rdb)) == NULL)
+        {
+            decrRefCount(key);
+            return REDIS_ERR;
+        }
+
+        /* Like rdbLoad(): masters don't load keys already expired. */
+        if (server.masterhost == NULL && expiretime != -1 &&
+            expiretime < now)
+        {
+            decrRefCount(key);
+            decrRefCount(val);
+            continue;
+        }
+        if (lookupKeyWrite(&server.db[0],key)) dbDelete(&server.db[0],key);
+        dbAdd(&server.db[0],key,val);
+        if (expiretime != -1) setExpire(&server.db[0],key,expiretime);
+        signalModifiedKey(&server.db[0],key);
+        decrRefCount(key);
+        server.dirty++;
+    }
+    return REDIS_OK;
+}
+
+/* CLUSTER IMPORTSLOT <slot> BEGIN <node ID> <rdb version>
+ * CLUSTER IMPORTSLOT <slot> DATA <payload>
+ * CLUSTER IMPORTSLOT <slot> ACK
+ * CLUSTER IMPORTSLOT <slot> COMMIT
+ *
+ * DATA is propagated verbatim to our slaves and AOF, where it is loaded
+ * without any further check. */
+static void clusterImportSlotCommand(redisClient *c) {
+    int slot;
+    char *subcmd = c->argv[3]->ptr;
+    int replicated = c->flags & REDIS_MASTER || c->fd == -1;
+
+    if ((slot = getSlotOrReply(c,c->argv[2])) == -1) return;
+
+    if (!strcasecmp(subcmd,"data") && c->argc == 5) {
+        if (!replicated && !(c->flags & REDIS_SLOT_IMPORT &&
+                             server.cluster->slot_import_slot == slot))
+        {
+            addReplyError(c,"No import in progress for this slot");
+            return;
+        }
+        if (clusterImportSlotLoad(slot,c->argv[4]->ptr) == REDIS_ERR) {
+            redisLog(REDIS_WARNING,"Bad CLUSTER IMPORTSLOT payload for "
+                "slot %d", slot);
+            /* Closing the link aborts the import. */
+            if (!replicated) freeClientAsync(c);
+            return;
+        }
+        addReply(c,shared.ok);
+        return;
+    }
+
+    if (replicated) {
+        /* Only DATA is propagated. */
+        addReplyError(c,"CLUSTER IMPORTSLOT BEGIN, ACK and COMMIT are only "
+                        "accepted from the source node");
+        return;
+    }
+
+    if (!strcasecmp(subcmd,"begin") && c->argc == 6) {
+        clusterNode *n = clusterLookupNode(c->argv[4]->ptr);
+        long long rdbver;
+
+        if (getLongLongFromObjectOrReply(c,c->argv[5],&rdbver,NULL) !=
+            REDIS_OK) return;
+        if (nodeIsSlave(myself)) {
+            addReplyError(c,"Slots can only be imported by masters");
+        } else if (server.cluster->slot_import_client) {
+            addReplyError(c,"A slot import is already in progress");
+        } else if (n == NULL || server.cluster->slots[slot] != n) {
+            addReplyErrorFormat(c,"The sender is not the owner of hash "
+                                  "slot %d for me",slot);
+        } else if (server.cluster->importing_slots_from[slot] ||
+                   server.cluster->migrating_slots_to[slot]) {
+            addReplyErrorFormat(c,"Hash slot %d is in migrating or "
+                                  "importing state",slot);
+        } else if (rdbver > REDIS_RDB_VERSION) {
+            addReplyError(c,"Unsupported RDB version");
+        } else {
+            /* Stale keys of a previous import are not part of the slot. */
+            clusterDelKeysInSlotAndPropagate(slot);
+            addReply(c,shared.ok);
+            c->flags |= REDIS_SLOT_IMPORT;
+            server.cluster->slot_import_client = c;
+            server.cluster->slot_import_slot = slot;
+            redisLog(REDIS_NOTICE,"Importing slot %d from %.40s", slot,
+                n->name);
+        }
+    } else if (!strcasecmp(subcmd,"ack") && c->argc == 4) {
+        if (!(c->flags & REDIS_SLOT_IMPORT) ||
+            server.cluster->slot_import_slot != slot)
+        {
+            addReplyError(c,"No import in progress for this slot");
+            return;
+        }
+        /* Everything before this command was applied. */
+        c->flags &= ~REDIS_SLOT_IMPORT;
+        addReply(c,shared.ok);
+        c->flags |= REDIS_SLOT_IMPORT;
+    } else if (!strcasecmp(subcmd,"commit") && c->argc == 4) {
+        if (!(c->flags & REDIS_SLOT_IMPORT) ||
+            server.cluster->slot_import_slot != slot)
+        {
+            addReplyError(c,"No import in progress for this slot");
+            return;
+        }
+        c->flags &= ~REDIS_SLOT_IMPORT;
+        server.cluster->slot_import_client = NULL;
+        server.cluster->slot_import_slot = -1;
+
+        /* Take the slot under a new epoch and make it durable before
+         * telling the source, that deletes its keys as soon as we reply. */
+        // 接管槽，提升 configEpoch ，保存配置并广播
+        clusterDelSlot(slot);
+        clusterAddSlot(myself,slot);
+        clusterBumpConfigEpochForImport(slot);
+        clusterUpdateState();
+        clusterSaveConfigOrDie(1);
+        clusterBroadcastPong(CLUSTER_BROADCAST_ALL);
+        redisLog(REDIS_NOTICE,"Slot %d imported, now served here.", slot);
+        addReply(c,shared.ok);
+    } else {
+        addReply(c,shared.syntaxerr);
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -6228,7 +7806,7 @@ socket_rd_err:
 // CLUSTER GETKEYSINSLOT <slot> <count> 这个 CMD 是很好的说明
 /**
  * 实际上，cluster 模式下，key-value pair 的保存，跟单机模式下是完全一样的
- * 只不过，当开启 cluster 之后，需要额外增加一个 server.cluster->slots_to_keys 的跳表，
+ * 只不过，当开启 cluster 之后，需要额外增加一个 server.cluster->slots_to_keys 的映射（每个槽一个字典），
  * 保存 slot-->key 的映射关系。然后每次有关于 key 的 CMD 到了每个不同的 redis-server（node），
  * 每个 node 都会利用这个 server.cluster->slots_to_keys 检查一下：这个 key 对应的 slot，属不属于现在的 node 管理，
  * 在的话，这个 CMD 交由本 node 处理，不在的话，MOVE 去其他 node 处理。
@@ -6325,6 +7903,7 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
     multiState *ms, _ms;
     multiCmd mc;
     int i, slot = 0, migrating_slot = 0, importing_slot = 0, missing_keys = 0;
+    int write_cmds = 0, pubsubshard = 0, shard_subscribe = 0;
 
     /* Set error code optimistically for the base case. */
     if (error_code) *error_code = REDIS_CLUSTER_REDIR_NONE;
@@ -6363,6 +7942,14 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
         margv = ms->commands[i].argv;
 
         // 定位命令的键位置
+        if (mcmd->flags & REDIS_CMD_WRITE) write_cmds = 1;
+        if (mcmd->proc == ssubscribeCommand ||
+            mcmd->proc == sunsubscribeCommand)
+        {
+            pubsubshard = shard_subscribe = 1;
+        } else if (mcmd->proc == spublishCommand) {
+            pubsubshard = 1;
+        }
         keyindex = getKeysFromCommand(mcmd,margv,margc,&numkeys);
         // 遍历命令中的所有键
         for (j = 0; j < numkeys; j++) {
@@ -6416,7 +8003,8 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
             // 当要访问的这个 key 对应的 slot 正在发生迁移（无论是 import 还是 migrate），则视为找不到这个 key
             // 因为你现在很难确认这个 key 究竟在新的 node 上面，还是旧的 node 上面
             // 你得采用 ASK 才行
-            if ((migrating_slot || importing_slot) &&
+            // 分片频道不是键，不参与缺失键的统计
+            if ((migrating_slot || importing_slot) && !pubsubshard &&
                 lookupKeyRead(&server.db[0],thiskey) == NULL)
             {
                 missing_keys++;
@@ -6432,6 +8020,13 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
     /* Return the hashslot by reference. */
     if (hashslot) *hashslot = slot;
 
+    /* Writes against a slot CLUSTER MIGRATESLOT is handing off are refused
+     * until the target confirmed it owns the slot. */
+    if (n == myself && write_cmds && clusterSlotHandoffInProgress(slot)) {
+        if (error_code) *error_code = REDIS_CLUSTER_REDIR_HANDOFF;
+        return NULL;
+    }
+
     /* This request is about a slot we are migrating into another instance?
      * Then if we have all the keys. */
 
@@ -6464,12 +8059,19 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
      * is serving, we can reply without redirection. */
     if (c->flags & REDIS_READONLY &&
         cmd->flags & REDIS_CMD_READONLY &&
+        cmd->proc != spublishCommand &&
         nodeIsSlave(myself) &&
         myself->slaveof == n)
     {
         return myself;
     }
 
+    /* Shard channels can be subscribed on any replica of the master serving
+     * their slot, READONLY or not. SPUBLISH always goes to the master, that
+     * replicates it to the rest of the shard. */
+    if (shard_subscribe && nodeIsSlave(myself) && myself->slaveof == n)
+        return myself;
+
     /* Base case: just return the right node. However if this node is not
      * myself, set error_code to MOVED since we need to issue a rediretion. */
     if (n != myself && error_code) *error_code = REDIS_CLUSTER_REDIR_MOVED;
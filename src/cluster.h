@@ -53,6 +53,8 @@
 #define REDIS_CLUSTER_REDIR_ASK 3           /* -ASK redirection required. */
 // 需要进行 MOVED 转向
 #define REDIS_CLUSTER_REDIR_MOVED 4         /* -MOVED redirection required. */
+// 槽正在被 CLUSTER MIGRATESLOT 交接，暂时拒绝写入
+#define REDIS_CLUSTER_REDIR_HANDOFF 5       /* Slot being handed off. */
 
 // 前置定义，防止编译错误
 // 出于编码方便的原因，clusterLink、clusterNode 是相互记住对方指针地址的
@@ -208,6 +210,10 @@ struct clusterNode {
     // 保存连接节点所需的有关信息
     clusterLink *link;          /* TCP/IP link with this node */
 
+    // 该节点确认已经知道的、我们的槽布局的哈希值，相同时可以发送轻量 PING
+    uint64_t slots_hash_acked;  /* Hash of our slots bitmap this node reported
+                                   to know, see CLUSTERMSG_HFLAG_LIGHT. */
+
     // 一个链表，记录了所有其他节点对该节点的下线报告(由 clusterNodeFailReport 组成的链表)
     // 晚点 markNodeAsFailingIfNeeded() 需要用这个 fail_reports 来统计 fail 的投票情况
     list *fail_reports;         /* List of nodes signaling this as failing */
@@ -217,6 +223,34 @@ struct clusterNode {
 typedef struct clusterNode clusterNode;
 
 
+/* Note that the PING, PONG and MEET messages are actually the same exact
+ * kind of packet. PONG is the reply to ping, in the exact format as a PING,
+ * while MEET is a special PING that forces the receiver to add the sender
+ * as a node (if it is not already in the list). */
+// 注意，PING 、 PONG 和 MEET 实际上是同一种消息。
+// PONG 是对 PING 的回复，它的实际格式也为 PING 消息，
+// 而 MEET 则是一种特殊的 PING 消息，用于强制消息的接收者将消息的发送者添加到集群中
+// （如果节点尚未在节点列表中的话）
+// PING
+#define CLUSTERMSG_TYPE_PING 0          /* Ping */
+// PONG （回复 PING）
+#define CLUSTERMSG_TYPE_PONG 1          /* Pong (reply to Ping) */
+// 请求将某个节点添加到集群中
+#define CLUSTERMSG_TYPE_MEET 2          /* Meet "let's join" message */
+// 将某个节点标记为 FAIL
+#define CLUSTERMSG_TYPE_FAIL 3          /* Mark node xxx as failing */
+// 通过发布与订阅功能广播消息
+#define CLUSTERMSG_TYPE_PUBLISH 4       /* Pub/Sub Publish propagation */
+// 请求进行故障转移操作，要求消息的接收者通过投票来支持消息的发送者
+#define CLUSTERMSG_TYPE_FAILOVER_AUTH_REQUEST 5 /* May I failover? */
+// 消息的接收者同意向消息的发送者投票
+#define CLUSTERMSG_TYPE_FAILOVER_AUTH_ACK 6     /* Yes, you have my vote */
+// 槽布局已经发生变化，消息发送者要求消息接收者进行相应的更新
+#define CLUSTERMSG_TYPE_UPDATE 7        /* Another node slots configuration */
+// 为了进行手动故障转移，暂停各个客户端
+#define CLUSTERMSG_TYPE_MFSTART 8       /* Pause clients for manual failover */
+#define CLUSTERMSG_TYPE_COUNT 9         /* Total number of message types. */
+
 // 集群状态，每个节点都保存着一个这样的状态，记录了它们眼中的集群的样子。
 // 另外，虽然这个结构主要用于记录集群的属性，但是为了节约资源，
 // 有些与节点有关的属性，比如 slots_to_keys 、 failover_auth_count 
@@ -262,13 +296,11 @@ typedef struct clusterState {
     // 内存确实是比较大的，即使是指针
     clusterNode *slots[REDIS_CLUSTER_SLOTS];
 
-    // 跳跃表，表中以槽作为分值，键作为成员，对槽进行有序排序
-    // 当需要对某些槽进行区间（range）操作时，这个跳跃表可以提供方便
+    // 每个槽一个字典（按需创建），保存属于这个槽的键
+    // 键直接引用主字典中的 sds ，每个键只多占用一个 dictEntry
     // 具体操作定义在 db.c 里面
-    // 因为每个 node 的 slot 可能是不连续的，用跳表会具有更强的适应性
-    // TODO:(DONE) 但是同一个 slot 可能有很多 key 呀？那么这些 key 的 score 一样就好了呀，跳表是可以接受相同 score 的
     // 之所以要引入 slot 的概念，也是为了更好的 reshard，调整 cluster 中的 node 负载罢了
-    zskiplist *slots_to_keys;
+    dict **slots_to_keys; /* REDIS_CLUSTER_SLOTS dicts, see slotToKeyAdd(). */
 
     /* The following fields are used to take the slave state on elections. */
     // 以下这些域被用于进行故障转移选举
@@ -321,11 +353,28 @@ typedef struct clusterState {
     // #define CLUSTER_TODO_FSYNC_CONFIG (1<<3)
     int todo_before_sleep; /* Things to do in clusterBeforeSleep(). */
 
-    // 通过 cluster 连接发送的消息数量
-    long long stats_bus_messages_sent;  /* Num of msg sent via cluster bus. */
-
-    // 通过 cluster 接收到的消息数量
-    long long stats_bus_messages_received; /* Num of msg rcvd via cluster bus.*/
+    // 按消息类型统计的 cluster 总线流量
+    long long stats_bus_messages_sent[CLUSTERMSG_TYPE_COUNT]; /* Num of msg
+                                             sent via cluster bus, by type. */
+    long long stats_bus_messages_received[CLUSTERMSG_TYPE_COUNT]; /* Num of
+                                             msg rcvd via cluster bus. */
+    long long stats_bus_bytes_sent[CLUSTERMSG_TYPE_COUNT];     /* Bytes sent. */
+    long long stats_bus_bytes_received[CLUSTERMSG_TYPE_COUNT]; /* Bytes rcvd. */
+    long long stats_bus_light_sent;     /* PING/PONG sent without slots. */
+    long long stats_bus_light_received; /* PING/PONG rcvd without slots. */
+
+    // CLUSTER MIGRATESLOT 正在向外迁移的槽，没有时为 NULL
+    struct clusterSlotMigration *slot_migration; /* Outgoing slot stream. */
+
+    // 正在向本节点流式导入槽的连接（CLUSTER IMPORTSLOT），以及导入的槽
+    struct redisClient *slot_import_client; /* Link streaming a slot to us. */
+    int slot_import_slot;       /* Slot imported by slot_import_client. */
+
+    // 缓存的 CLUSTER SLOTS 回复（协议格式）和 CLUSTER NODES 回复，
+    // 集群配置变化时失效，参考 clusterInvalidateReplyCache()
+    sds cached_slots_reply;     /* CLUSTER SLOTS reply, or NULL. */
+    sds cached_nodes_reply;     /* CLUSTER NODES reply, or NULL. */
+    mstime_t cached_nodes_time; /* When cached_nodes_reply was generated. */
 
 } clusterState;
 
@@ -339,33 +388,6 @@ typedef struct clusterState {
 
 /* Redis cluster messages header */
 
-/* Note that the PING, PONG and MEET messages are actually the same exact
- * kind of packet. PONG is the reply to ping, in the exact format as a PING,
- * while MEET is a special PING that forces the receiver to add the sender
- * as a node (if it is not already in the list). */
-// 注意，PING 、 PONG 和 MEET 实际上是同一种消息。
-// PONG 是对 PING 的回复，它的实际格式也为 PING 消息，
-// 而 MEET 则是一种特殊的 PING 消息，用于强制消息的接收者将消息的发送者添加到集群中
-// （如果节点尚未在节点列表中的话）
-// PING
-#define CLUSTERMSG_TYPE_PING 0          /* Ping */
-// PONG （回复 PING）
-#define CLUSTERMSG_TYPE_PONG 1          /* Pong (reply to Ping) */
-// 请求将某个节点添加到集群中
-#define CLUSTERMSG_TYPE_MEET 2          /* Meet "let's join" message */
-// 将某个节点标记为 FAIL
-#define CLUSTERMSG_TYPE_FAIL 3          /* Mark node xxx as failing */
-// 通过发布与订阅功能广播消息
-#define CLUSTERMSG_TYPE_PUBLISH 4       /* Pub/Sub Publish propagation */
-// 请求进行故障转移操作，要求消息的接收者通过投票来支持消息的发送者
-#define CLUSTERMSG_TYPE_FAILOVER_AUTH_REQUEST 5 /* May I failover? */
-// 消息的接收者同意向消息的发送者投票
-#define CLUSTERMSG_TYPE_FAILOVER_AUTH_ACK 6     /* Yes, you have my vote */
-// 槽布局已经发生变化，消息发送者要求消息接收者进行相应的更新
-#define CLUSTERMSG_TYPE_UPDATE 7        /* Another node slots configuration */
-// 为了进行手动故障转移，暂停各个客户端
-#define CLUSTERMSG_TYPE_MFSTART 8       /* Pause clients for manual failover */
-
 /* Initially we don't know our "name", but we'll find it once we connect
  * to the first node, using the getsockname() function. Then we'll use this
  * address for all the next messages. */
@@ -465,7 +487,8 @@ typedef struct {
     // 消息的长度（包括这个消息头的长度和消息正文的长度）
     uint32_t totlen;    /* Total length of this message */
     uint16_t ver;       /* Protocol version, currently set to 0. */
-    uint16_t notused0;  /* 2 bytes not used. */
+    // 位于 myslots 之前的标志，接收方在还原消息之前就能读到
+    uint16_t hflags;    /* Header flags: CLUSTERMSG_HFLAG_... */
 
     // 消息的类型
     uint16_t type;      /* Message type */
@@ -499,7 +522,14 @@ typedef struct {
     // （一个 40 字节长，值全为 0 的字节数组）
     char slaveof[REDIS_CLUSTER_NAMELEN];
 
-    char notused1[32];  /* 32 bytes reserved for future usage. */
+    // 消息发送者 myslots 的哈希值
+    uint64_t slotshash; /* Hash of myslots, see clusterSlotsHash(). */
+
+    // 消息发送者所知道的、消息接收者的槽布局的哈希值，0 表示未知
+    uint64_t peerhash;  /* Hash of the receiver slots as known by the sender,
+                           or 0 if unknown. */
+
+    char notused1[16];  /* 16 bytes reserved for future usage. */
 
     // 消息发送者的端口号
     uint16_t port;      /* Sender TCP base port */
@@ -520,6 +550,17 @@ typedef struct {
 
 #define CLUSTERMSG_MIN_LEN (sizeof(clusterMsg)-sizeof(union clusterMsgData))
 
+/* Header flags. They live before myslots, so they can be read before the
+ * message is restored to the normal layout.
+ *
+ * A light PING or PONG is the normal message with the myslots bitmap cut
+ * out of the wire format: it is only sent to nodes which reported, via the
+ * peerhash field, that they already know our current slots bitmap. The
+ * receiver fills the bitmap back from its own view of the sender, and uses
+ * slotshash to verify that view is still current. */
+#define CLUSTERMSG_HFLAG_LIGHT (1<<0) /* myslots omitted from the message. */
+#define CLUSTERMSG_LIGHT_MIN_LEN (CLUSTERMSG_MIN_LEN-REDIS_CLUSTER_SLOTS/8)
+
 /* Message flags better specify the packet content or are used to
  * provide some information about the node state. */
 #define CLUSTERMSG_FLAG0_PAUSED (1<<0) /* Master paused for manual failover. */
@@ -50,6 +50,16 @@
 #define HAVE_PROC_SMAPS 1
 #endif
 
+/* Test for sched_setaffinity() and the NUMA memory policy syscalls */
+#ifdef __linux__
+#define HAVE_CPU_AFFINITY 1
+#endif
+
+/* Test for futex(2), used by the shared memory transport */
+#ifdef __linux__
+#define HAVE_SHM_TRANSPORT 1
+#endif
+
 /* Test for task_info() */
 #if defined(__APPLE__)
 #define HAVE_TASKINFO 1
@@ -0,0 +1,203 @@
+/* cpuaffinity.c - Pin the server threads and children to CPU lists
+ *
+ * 将主线程、 bio 线程和持久化子进程绑定到指定的 CPU 列表，可选地把内存绑定到主线程所在的 NUMA 节点
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A CPU list uses the same syntax as taskset(1) and the kernel cpusets:
+ * comma separated CPUs or ranges, a range optionally followed by a stride,
+ * for example "0-3,8,16-30:2".
+ *
+ * The main thread is pinned to server-cpulist before initServer(), so the
+ * I/O threads and the other threads it creates inherit the same CPUs. The
+ * bio.c threads pin themselves to bio-cpulist when they start, and the
+ * BGSAVE and BGREWRITEAOF children to bgsave-cpulist / aof-rewrite-cpulist
+ * right after fork(), so a child does not compete with the main thread for
+ * its core and its cache. An empty list means "inherit from the parent".
+ *
+ * With numa-bind-memory the memory policy of the main thread is set to the
+ * NUMA node of the first CPU it runs on. The policy is inherited by every
+ * thread and child created later. */
+
+#include "redis.h"
+
+#include <ctype.h>
+
+#ifdef HAVE_CPU_AFFINITY
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#endif
+
+#define REDIS_CPULIST_MAX 1024      /* Same as CPU_SETSIZE in glibc */
+#define REDIS_NUMA_MAX_NODES 1024
+
+/* Parse 'cpulist' setting cpus[i] to 1 for every CPU it contains.
+ * Returns the number of CPUs in the list, or -1 on syntax error. */
+static int cpulistParse(const char *cpulist, unsigned char *cpus) {
+    const char *p = cpulist;
+    int count = 0;
+
+    memset(cpus,0,REDIS_CPULIST_MAX);
+    while (*p) {
+        long a, b, stride = 1, j;
+        char *end;
+
+        if (!isdigit((unsigned char)*p)) return -1;
+        a = b = strtol(p,&end,10);
+        p = end;
+        if (*p == '-') {
+            p++;
+            if (!isdigit((unsigned char)*p)) return -1;
+            b = strtol(p,&end,10);
+            p = end;
+            if (*p == ':') {
+                p++;
+                if (!isdigit((unsigned char)*p)) return -1;
+                stride = strtol(p,&end,10);
+                p = end;
+            }
+        }
+        if (a > b || b >= REDIS_CPULIST_MAX || stride < 1) return -1;
+        for (j = a; j <= b; j += stride) {
+            if (!cpus[j]) count++;
+            cpus[j] = 1;
+        }
+        if (*p == ',') {
+            p++;
+            if (*p == '\0') return -1;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return count;
+}
+
+/* Return 1 if 'cpulist' is empty or a valid CPU list, used to validate the
+ * configuration. */
+int cpulistIsValid(const char *cpulist) {
+    unsigned char cpus[REDIS_CPULIST_MAX];
+
+    return cpulist[0] == '\0' || cpulistParse(cpulist,cpus) > 0;
+}
+
+/* Pin the calling thread (or the process, when called by a single threaded
+ * child) to the CPUs of 'cpulist'. Nothing is done if the list is NULL.
+ * A failure is only logged: a wrong CPU list must not stop the server. */
+void redisSetCpuAffinity(const char *cpulist) {
+#ifdef HAVE_CPU_AFFINITY
+    unsigned char cpus[REDIS_CPULIST_MAX];
+    cpu_set_t set;
+    int j;
+
+    if (cpulist == NULL || cpulistParse(cpulist,cpus) <= 0) return;
+
+    CPU_ZERO(&set);
+    for (j = 0; j < REDIS_CPULIST_MAX; j++)
+        if (cpus[j]) CPU_SET(j,&set);
+
+    // pid 为 0 时只作用于调用的线程
+    if (sched_setaffinity(0,sizeof(set),&set) == -1) {
+        redisLog(REDIS_WARNING,"Can't set the CPU affinity to '%s': %s",
+            cpulist, strerror(errno));
+    }
+#else
+    if (cpulist != NULL) {
+        redisLog(REDIS_WARNING,
+            "CPU affinity is not supported on this platform, "
+            "ignoring the CPU list '%s'", cpulist);
+    }
+#endif
+}
+
+#ifdef HAVE_CPU_AFFINITY
+/* Return the NUMA node of 'cpu' looking for the nodeN entry the kernel
+ * exposes in its sysfs directory, or -1 if it can't be found (kernels
+ * without NUMA support have no such entry). */
+static int cpuNumaNode(int cpu) {
+    char path[64];
+    struct dirent *de;
+    DIR *dir;
+    int node = -1;
+
+    snprintf(path,sizeof(path),"/sys/devices/system/cpu/cpu%d",cpu);
+    if ((dir = opendir(path)) == NULL) return -1;
+    while ((de = readdir(dir)) != NULL) {
+        if (!strncmp(de->d_name,"node",4) &&
+            isdigit((unsigned char)de->d_name[4]))
+        {
+            node = atoi(de->d_name+4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+#endif
+
+/* Bind the memory of the process to the NUMA node of the first CPU the main
+ * thread can run on. Called by the main thread after redisSetCpuAffinity(),
+ * before the dataset is allocated. */
+void redisBindMemoryToLocalNode(void) {
+#if defined(HAVE_CPU_AFFINITY) && defined(SYS_set_mempolicy)
+    unsigned long nodemask[REDIS_NUMA_MAX_NODES/(sizeof(unsigned long)*8)];
+    cpu_set_t set;
+    int cpu, node;
+
+    if (sched_getaffinity(0,sizeof(set),&set) == -1) {
+        redisLog(REDIS_WARNING,"Can't get the CPU affinity: %s",
+            strerror(errno));
+        return;
+    }
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu,&set)) break;
+    if (cpu == CPU_SETSIZE ||
+        (node = cpuNumaNode(cpu)) < 0 || node >= REDIS_NUMA_MAX_NODES)
+    {
+        redisLog(REDIS_WARNING,
+            "Can't find the NUMA node of CPU %d, memory is not bound", cpu);
+        return;
+    }
+
+    memset(nodemask,0,sizeof(nodemask));
+    nodemask[node/(sizeof(unsigned long)*8)] |=
+        1UL << (node % (sizeof(unsigned long)*8));
+    /* MPOL_BIND is 2 in <linux/mempolicy.h>. The kernel drops the last bit
+     * of 'maxnode', so we pass one more than the mask size. */
+    if (syscall(SYS_set_mempolicy,2,nodemask,sizeof(nodemask)*8+1) == -1) {
+        redisLog(REDIS_WARNING,"Can't bind memory to NUMA node %d: %s",
+            node, strerror(errno));
+        return;
+    }
+    redisLog(REDIS_NOTICE,"Memory bound to NUMA node %d (CPU %d)", node, cpu);
+#else
+    redisLog(REDIS_WARNING,
+        "NUMA memory binding is not supported on this platform");
+#endif
+}
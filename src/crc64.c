@@ -38,6 +38,9 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "crc64.h"
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,7 +173,17 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+/* Tables for the slice-by-8 variant: crc64_slice[0] is crc64_tab, and
+ * crc64_slice[k][n] is the CRC of byte n followed by k zero bytes, so eight
+ * input bytes can be folded into the CRC with eight independent lookups
+ * instead of a chain of eight dependent ones. They are filled by
+ * crc64_init(): until then crc64() uses the byte-at-a-time loop, so callers
+ * that never initialize still get correct (only slower) checksums. */
+static uint64_t crc64_slice[8][256];
+static int crc64_slice_ready = 0;
+
+/* Byte-at-a-time CRC update, using the single 256 entries table. */
+static uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l) {
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,12 +193,88 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+/* Build the slice-by-8 tables. Must be called once at startup, before any
+ * thread that may compute a CRC is created. */
+void crc64_init(void) {
+    int n, k;
+
+    if (crc64_slice_ready) return;
+    for (n = 0; n < 256; n++) {
+        uint64_t crc = crc64_tab[n];
+
+        crc64_slice[0][n] = crc;
+        for (k = 1; k < 8; k++) {
+            crc = crc64_tab[crc & 0xff] ^ (crc >> 8);
+            crc64_slice[k][n] = crc;
+        }
+    }
+    crc64_slice_ready = 1;
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if (crc64_slice_ready) {
+        // 先逐字节处理到 8 字节对齐，再每次折叠 8 个字节
+        while (l && ((uintptr_t)s & 7)) {
+            crc = crc64_tab[(uint8_t)crc ^ *s++] ^ (crc >> 8);
+            l--;
+        }
+        while (l >= 8) {
+            uint64_t w;
+
+            memcpy(&w,s,sizeof(w));
+            crc ^= w;
+            crc = crc64_slice[7][crc & 0xff] ^
+                  crc64_slice[6][(crc >> 8) & 0xff] ^
+                  crc64_slice[5][(crc >> 16) & 0xff] ^
+                  crc64_slice[4][(crc >> 24) & 0xff] ^
+                  crc64_slice[3][(crc >> 32) & 0xff] ^
+                  crc64_slice[2][(crc >> 40) & 0xff] ^
+                  crc64_slice[1][(crc >> 48) & 0xff] ^
+                  crc64_slice[0][crc >> 56];
+            s += 8;
+            l -= 8;
+        }
+    }
+#endif
+    return crc64_bytewise(crc,s,l);
+}
+
 /* Test main */
 #ifdef TEST_MAIN
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec*1000000)+tv.tv_usec;
+}
+
 int main(void) {
+    size_t len = 64*1024*1024, j;
+    unsigned char *buf = malloc(len+1);
+    uint64_t c1, c2;
+    long long start;
+
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
-    return 0;
+    crc64_init();
+    printf("e9c6d914c4b8d9ca == %016llx\n",
+        (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+
+    /* Compare the two variants on the same (unaligned) buffer. */
+    for (j = 0; j < len+1; j++) buf[j] = (unsigned char)(j*31+(j>>8));
+    start = usec();
+    c1 = crc64_bytewise(0,buf+1,len);
+    printf("bytewise: %016llx %.2f MB/s\n", (unsigned long long) c1,
+        (double)len/(usec()-start));
+    start = usec();
+    c2 = crc64(0,buf+1,len);
+    printf("slice-8:  %016llx %.2f MB/s\n", (unsigned long long) c2,
+        (double)len/(usec()-start));
+    free(buf);
+    return c1 != c2;
 }
 #endif
@@ -33,9 +33,6 @@
 #include <signal.h>
 #include <ctype.h>
 
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
-void slotToKeyFlush(void);
 
 /*-----------------------------------------------------------------------------
  * C-level DB API
@@ -62,8 +59,17 @@ robj *lookupKey(redisDb *db, robj *key) {
          * Don't do it if we have a saving child, as this will trigger
          * a copy on write madness. */
         // 更新时间信息（只在不存在子进程时执行，防止破坏 copy-on-write 机制）
-        if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
-            val->lru = LRU_CLOCK(); // TODO: 为什么是更新 value 的 LRU，而不是 key 的 LRU？
+        if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+            // LFU 策略下更新访问计数，否则更新 LRU 时间
+            if (maxmemoryPolicyIsLFU()) {
+                updateLFU(val);
+            } else {
+                val->lru = LRU_CLOCK(); // TODO: 为什么是更新 value 的 LRU，而不是 key 的 LRU？
+            }
+        }
+
+        // 抽样记录访问，用于统计热点键
+        if (server.hotkeys_tracking) hotkeysTrackAccess(db,key->ptr);
 
         // 返回值
         return val;
@@ -83,7 +89,9 @@ robj *lookupKey(redisDb *db, robj *key) {
  * TODO: 服务器的命中/不命中信息 是用来干什么的？
  * 找到时返回值对象，没找到返回 NULL 。
  */
-robj *lookupKeyRead(redisDb *db, robj *key) {
+/* Unless REDIS_LOOKUP_CHUNKED is given, a chunked string is turned back into
+ * a plain sds, so that callers can keep assuming contiguous bytes. */
+robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     robj *val;
 
     // 检查 key 释放已经过期
@@ -98,10 +106,16 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
     else
         server.stat_keyspace_hits++;
 
+    if (val && !(flags & REDIS_LOOKUP_CHUNKED)) stringConvertToRaw(val);
+
     // 返回值
     return val;
 }
 
+robj *lookupKeyRead(redisDb *db, robj *key) {
+    return lookupKeyReadWithFlags(db,key,REDIS_LOOKUP_NONE);
+}
+
 /*
  * 为执行写入操作而取出键 key 在数据库 db 中的值。
  *
@@ -110,7 +124,8 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * 找到时返回值对象，没找到返回 NULL 。
  */
 // 本函数的底层可能会触发 rehash，注意，是针对 DB 的 key-dict 进行 rehash，而不是针对 某一个 key 下面的 dict 进行 rehash
-robj *lookupKeyWrite(redisDb *db, robj *key) {
+robj *lookupKeyWriteWithFlags(redisDb *db, robj *key, int flags) {
+    robj *val;
 
     // 删除过期键
     // TODO:(DONE) 为什么？过期的 key 不会自动删除的吗？惰性删除？避免满天飞的 timer ？
@@ -119,7 +134,17 @@ robj *lookupKeyWrite(redisDb *db, robj *key) {
     expireIfNeeded(db,key);
 
     // 查找并返回 key 的值对象
-    return lookupKey(db,key);
+    val = lookupKey(db,key);
+
+    /* The caller is about to modify the value. */
+    if (val && server.forkless_save) snapshotKeyWillChange(db,key->ptr);
+    if (val) hllCacheKeyChanged(db,key->ptr);
+    if (val && !(flags & REDIS_LOOKUP_CHUNKED)) stringConvertToRaw(val);
+    return val;
+}
+
+robj *lookupKeyWrite(redisDb *db, robj *key) {
+    return lookupKeyWriteWithFlags(db,key,REDIS_LOOKUP_NONE);
 }
 
 /*
@@ -172,18 +197,20 @@ robj *lookupKeyWriteOrReply(redisClient *c, robj *key, robj *reply) {
 // p *key; $1 = {type = 0(REDIS_STRING), encoding = 8, lru = 6398167, refcount = 1, ptr = 0x7fc992413658}
 // p *val; $2 = {type = 4(REDIS_HASH), encoding = 5, lru = 6398167, refcount = 1, ptr = 0x7fc992486230}
 void dbAdd(redisDb *db, robj *key, robj *val) {
+    dictEntry *de;
 
-    // 复制键名
-    sds copy = sdsdup(key->ptr);
+    if (server.forkless_save) snapshotKeyAdded(db,key->ptr);
+    hllCacheKeyChanged(db,key->ptr);
 
-    // 尝试添加键值对
-    int retval = dictAdd(db->dict, copy, val);
+    // 尝试添加键值对，键名会被复制到字典节点中
+    de = dictAddRaw(db->dict, key->ptr);
 
     // 如果键已经存在，那么停止
-    redisAssertWithInfo(NULL,key,retval == REDIS_OK);
+    redisAssertWithInfo(NULL,key,de != NULL);
+    dictSetVal(db->dict, de, val);
 
     // 如果开启了集群模式，那么将键保存到槽里面
-    if (server.cluster_enabled) slotToKeyAdd(key);
+    if (server.cluster_enabled) slotToKeyAdd(dictGetKey(de));
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -202,7 +229,11 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  * 如果键不存在，那么函数停止。
  */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    dictEntry *de;
+
+    if (server.forkless_save) snapshotKeyWillChange(db,key->ptr);
+    hllCacheKeyChanged(db,key->ptr);
+    de = dictFind(db->dict,key->ptr);
     
     // 节点必须存在，否则中止
     redisAssertWithInfo(NULL,key,de != NULL);
@@ -230,7 +261,7 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
 void setKey(redisDb *db, robj *key, robj *val) {
 
     // 添加或覆写数据库中的键值对
-    if (lookupKeyWrite(db,key) == NULL) {
+    if (lookupKeyWriteWithFlags(db,key,REDIS_LOOKUP_CHUNKED) == NULL) {
         dbAdd(db,key,val);
     } else {
         dbOverwrite(db,key,val);
@@ -300,17 +331,22 @@ robj *dbRandomKey(redisDb *db) {
  *
  * 删除成功返回 1 ，因为键不存在而导致删除失败时，返回 0 。
  */
-int dbDelete(redisDb *db, robj *key) {
+int dbSyncDelete(redisDb *db, robj *key) {
+    if (server.forkless_save) snapshotKeyWillChange(db,key->ptr);
+    hllCacheKeyChanged(db,key->ptr);
 
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     // 删除键的过期时间（有的话）
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->expires) > 0) dbDeleteExpire(db,key->ptr);
+
+    /* The slots to keys map shares the sds of the key as well: if cluster
+     * is enabled remove the key from there before releasing it. */
+    // 如果开启了集群模式，那么从槽中删除给定的键
+    if (server.cluster_enabled) slotToKeyDel(key);
 
     // 删除键值对
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        // 如果开启了集群模式，那么从槽中删除给定的键
-        if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
         // 键不存在
@@ -318,6 +354,17 @@ int dbDelete(redisDb *db, robj *key) {
     }
 }
 
+/* This is a wrapper whose behavior depends on the Redis lazy free
+ * configuration. Deletes the key synchronously or asynchronously.
+ *
+ * 服务器内部发起的删除操作，根据 lazyfree-lazy-server-del 选项
+ * 决定是否在后台线程中释放值
+ */
+int dbDelete(redisDb *db, robj *key) {
+    return server.lazyfree_lazy_server_del ? dbAsyncDelete(db,key) :
+                                             dbSyncDelete(db,key);
+}
+
 /* Prepare the string object stored at 'key' to be modified destructively
  * to implement commands like SETBIT or APPEND.
  *
@@ -362,29 +409,142 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
 /*
  * 清空服务器的所有数据。
  */
-long long emptyDb(void(callback)(void*)) {
-    int j;
+long long emptyDb(int flags, void(callback)(void*)) {
+    int j, async = (flags & EMPTYDB_ASYNC);
     long long removed = 0;
 
+    // 无 fork 快照先写完尚未扫描的键
+    if (server.forkless_save) snapshotFlushDb(-1);
+    hllCacheFlush(-1);
+
     // 清空所有数据库
     for (j = 0; j < server.dbnum; j++) {
 
         // 记录被删除键的数量
         removed += dictSize(server.db[j].dict);
 
-        // 删除所有键值对
-        dictEmpty(server.db[j].dict,callback);
-        // 删除所有键的过期时间
-        dictEmpty(server.db[j].expires,callback);
+        if (async) {
+            // 把旧的字典交给后台线程释放
+            emptyDbAsync(&server.db[j]);
+        } else {
+            // 删除所有键值对
+            dictEmpty(server.db[j].dict,callback);
+            // 删除所有键的过期时间
+            dictEmpty(server.db[j].expires,callback);
+            expireIndexFlush(&server.db[j],0);
+        }
     }
 
     // 如果开启了集群模式，那么还要移除槽记录
-    if (server.cluster_enabled) slotToKeyFlush();
+    if (server.cluster_enabled) {
+        if (async) {
+            slotToKeyFlushAsync();
+        } else {
+            slotToKeyFlush();
+        }
+    }
 
     // 返回键的数量
     return removed;
 }
 
+/* Detach the keyspace of every DB (and the cluster slots to keys map)
+ * replacing it with an empty one, and return the old keyspace.
+ *
+ * Used by slaves loading the RDB from the socket with repl-diskless-load
+ * set to swapdb: the old dataset is put back with restoreDbBackup() if the
+ * transfer fails, or released with discardDbBackup() on success.
+ *
+ * 将所有数据库的键空间替换为空的键空间，并返回旧的键空间
+ */
+dbBackup *backupDb(void) {
+    dbBackup *backup = zmalloc(sizeof(*backup));
+    int j;
+
+    if (server.forkless_save) snapshotFlushDb(-1);
+    hllCacheFlush(-1);
+    backup->dicts = zmalloc(sizeof(dict*)*server.dbnum);
+    backup->expires = zmalloc(sizeof(dict*)*server.dbnum);
+    backup->expires_index = zmalloc(sizeof(rax*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        backup->dicts[j] = server.db[j].dict;
+        backup->expires[j] = server.db[j].expires;
+        backup->expires_index[j] = server.db[j].expires_index;
+        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        if (server.db[j].expires_index)
+            server.db[j].expires_index = raxNew();
+    }
+
+    backup->slots_to_keys = NULL;
+    if (server.cluster_enabled) {
+        backup->slots_to_keys = server.cluster->slots_to_keys;
+        server.cluster->slots_to_keys = slotToKeyCreate();
+    }
+    return backup;
+}
+
+/* Free the keyspace held by 'backup' and the backup itself. With the
+ * EMPTYDB_ASYNC flag the memory is reclaimed in another thread.
+ *
+ * 释放备份的键空间 */
+void discardDbBackup(dbBackup *backup, int flags) {
+    int j, async = (flags & EMPTYDB_ASYNC);
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (async) {
+            freeDbDictsAsync(backup->dicts[j],backup->expires[j]);
+        } else {
+            dictRelease(backup->dicts[j]);
+            dictRelease(backup->expires[j]);
+        }
+        if (backup->expires_index[j]) {
+            if (async)
+                freeExpireIndexAsync(backup->expires_index[j]);
+            else
+                raxFree(backup->expires_index[j]);
+        }
+    }
+    if (backup->slots_to_keys) {
+        if (async)
+            freeSlotsMapAsync(backup->slots_to_keys);
+        else
+            slotToKeyRelease(backup->slots_to_keys);
+    }
+    zfree(backup->dicts);
+    zfree(backup->expires);
+    zfree(backup->expires_index);
+    zfree(backup);
+}
+
+/* Put back the keyspace saved by backupDb(), releasing the current one,
+ * and free the backup.
+ *
+ * 用备份的键空间替换当前的键空间 */
+void restoreDbBackup(dbBackup *backup) {
+    int j;
+
+    hllCacheFlush(-1);
+    for (j = 0; j < server.dbnum; j++) {
+        dictRelease(server.db[j].dict);
+        dictRelease(server.db[j].expires);
+        if (server.db[j].expires_index) raxFree(server.db[j].expires_index);
+        server.db[j].dict = backup->dicts[j];
+        server.db[j].expires = backup->expires[j];
+        server.db[j].expires_index = backup->expires_index[j];
+        /* active-expire-index may have been changed meanwhile. */
+        expireIndexSetup(&server.db[j],server.active_expire_index);
+    }
+    if (backup->slots_to_keys) {
+        slotToKeyRelease(server.cluster->slots_to_keys);
+        server.cluster->slots_to_keys = backup->slots_to_keys;
+    }
+    zfree(backup->dicts);
+    zfree(backup->expires);
+    zfree(backup->expires_index);
+    zfree(backup);
+}
+
 /*
  * 将客户端的目标数据库切换为 id 所指定的数据库
  */
@@ -417,10 +577,12 @@ int selectDb(redisClient *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    trackingInvalidateKeysOnFlush(dbid);
 }
 
 /*-----------------------------------------------------------------------------
@@ -429,36 +591,87 @@ void signalFlushedDb(int dbid) {
  * 与类型无关的数据库操作。
  *----------------------------------------------------------------------------*/
 
+/* Return the set of flags to use for the emptyDb() call for FLUSHALL
+ * and FLUSHDB commands.
+ *
+ * Currently the command just attempts to parse the "ASYNC" option. It
+ * also checks if the command arity is wrong.
+ *
+ * On success REDIS_OK is returned and the flags are stored in *flags,
+ * otherwise REDIS_ERR is returned and the function sends an error to the
+ * client. */
+int getFlushCommandFlags(redisClient *c, int *flags) {
+    /* Parse the optional ASYNC option. */
+    if (c->argc > 1) {
+        if (c->argc > 2 || strcasecmp(c->argv[1]->ptr,"async")) {
+            addReply(c,shared.syntaxerr);
+            return REDIS_ERR;
+        }
+        *flags = EMPTYDB_ASYNC;
+    } else {
+        *flags = EMPTYDB_NO_FLAGS;
+    }
+    return REDIS_OK;
+}
+
 /*
  * 清空客户端当前的数据库
+ *
+ * FLUSHDB [ASYNC]
  */
 void flushdbCommand(redisClient *c) {
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == REDIS_ERR) return;
 
     server.dirty += dictSize(c->db->dict);
 
     // 发送通知
     signalFlushedDb(c->db->id);
 
-    // 清空指定数据库中的 dict 和 expires 字典
-    dictEmpty(c->db->dict,NULL);
-    dictEmpty(c->db->expires,NULL);
+    if (server.forkless_save) snapshotFlushDb(c->db->id);
+    hllCacheFlush(c->db->id);
+
+    if (flags & EMPTYDB_ASYNC) {
+        // 在后台线程中释放旧的 dict 和 expires 字典
+        emptyDbAsync(c->db);
+    } else {
+        // 清空指定数据库中的 dict 和 expires 字典
+        dictEmpty(c->db->dict,NULL);
+        dictEmpty(c->db->expires,NULL);
+        expireIndexFlush(c->db,0);
+    }
 
     // 如果开启了集群模式，那么还要移除槽记录
-    if (server.cluster_enabled) slotToKeyFlush();
+    if (server.cluster_enabled) {
+        if (flags & EMPTYDB_ASYNC) {
+            slotToKeyFlushAsync();
+        } else {
+            slotToKeyFlush();
+        }
+    }
 
     addReply(c,shared.ok);
 }
 
 /*
  * 清空服务器中的所有数据库
+ *
+ * FLUSHALL [ASYNC]
  */
 void flushallCommand(redisClient *c) {
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == REDIS_ERR) return;
 
     // 发送通知（TODO: 通知什么？通知谁？怎么通知？信号？scoket？）
     signalFlushedDb(-1);
 
+    /* Like a saving child, a forkless save in progress is just dropped. */
+    snapshotAbort();
+
     // 清空所有数据库
-    server.dirty += emptyDb(NULL);
+    server.dirty += emptyDb(flags,NULL);
     addReply(c,shared.ok);
 
     // 如果正在保存新的 RDB ，那么取消保存操作
@@ -484,7 +697,8 @@ void flushallCommand(redisClient *c) {
     server.dirty++;
 }
 
-void delCommand(redisClient *c) {
+/* This command implements DEL and UNLINK. */
+void delGenericCommand(redisClient *c, int lazy) {
     int deleted = 0, j;
 
     // 遍历所有输入键
@@ -493,8 +707,10 @@ void delCommand(redisClient *c) {
         // 先删除过期的键
         expireIfNeeded(c->db,c->argv[j]);
 
-        // 尝试删除键
-        if (dbDelete(c->db,c->argv[j])) {
+        // 尝试删除键， UNLINK 会把大的值交给后台线程释放
+        int removed = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
+                             dbSyncDelete(c->db,c->argv[j]);
+        if (removed) {
 
             // 删除键成功，发送通知
 
@@ -513,6 +729,18 @@ void delCommand(redisClient *c) {
     addReplyLongLong(c,deleted);
 }
 
+void delCommand(redisClient *c) {
+    delGenericCommand(c,0);
+}
+
+/* UNLINK key [key ...]
+ *
+ * Like DEL, but the memory of big values is reclaimed in a background
+ * thread, so the command is O(1) for every key regardless of its size. */
+void unlinkCommand(redisClient *c) {
+    delGenericCommand(c,1);
+}
+
 void existsCommand(redisClient *c) {
 
     // 检查键是否已经过期，如果已过期的话，那么将它删除
@@ -556,7 +784,7 @@ void randomkeyCommand(redisClient *c) {
 
     // 随机返回键
     if ((key = dbRandomKey(c->db)) == NULL) {
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
         return;
     }
 
@@ -615,16 +843,62 @@ void keysCommand(redisClient *c) {
     setDeferredMultiBulkLength(c,replylen,numkeys);
 }
 
+/* State shared between scanGenericCommand and scanCallback. */
+typedef struct {
+    list *keys;         /* Collected elements. */
+    robj *o;            /* Object being scanned, NULL for the keyspace. */
+    long visited;       /* Dict entries seen, found or filtered. */
+    /* Keyspace only: filters applied before the key object is created. */
+    char *type;         /* TYPE filter, or NULL. */
+    sds pat;            /* MATCH pattern, or NULL. */
+    int patlen;
+    int prefixlen;      /* >= 0 if 'pat' is "<literal prefix>*". */
+} scanData;
+
+/* Return the length of the literal prefix if 'pat' is a literal string
+ * followed by a single trailing '*', so that matching can be done with a
+ * plain memcmp(). Otherwise -1 is returned.
+ *
+ * "user:*" 这类模式只需比较前缀，不必走 stringmatchlen。 */
+static int scanPatternPrefixLen(sds pat, int patlen) {
+    int j;
+
+    if (patlen == 0 || pat[patlen-1] != '*') return -1;
+    for (j = 0; j < patlen-1; j++) {
+        if (pat[j] == '*' || pat[j] == '?' || pat[j] == '[' || pat[j] == '\\')
+            return -1;
+    }
+    return patlen-1;
+}
+
 /* This callback is used by scanGenericCommand in order to collect elements
  * returned by the dictionary iterator into a list. */
 void scanCallback(void *privdata, const dictEntry *de) {
-    void **pd = (void**) privdata;
-    list *keys = pd[0];
-    robj *o = pd[1];
+    scanData *sd = privdata;
+    list *keys = sd->keys;
+    robj *o = sd->o;
     robj *key, *val = NULL;
 
+    sd->visited++;
     if (o == NULL) {
         sds sdskey = dictGetKey(de);
+
+        /* Filter keyspace entries here, so that keys the client is not
+         * interested in never get an object allocated. */
+        // 在回调里直接过滤，不匹配的 key 不再创建对象
+        if (sd->type &&
+            strcasecmp(sd->type,getObjectTypeName(dictGetVal(de))) != 0)
+            return;
+        if (sd->pat) {
+            size_t keylen = sdslen(sdskey);
+
+            if (sd->prefixlen >= 0) {
+                if (keylen < (size_t)sd->prefixlen ||
+                    memcmp(sdskey,sd->pat,sd->prefixlen) != 0) return;
+            } else if (!stringmatchlen(sd->pat,sd->patlen,sdskey,keylen,0)) {
+                return;
+            }
+        }
         key = createStringObject(sdskey, sdslen(sdskey));
     } else if (o->type == REDIS_SET) {
         key = dictGetKey(de);
@@ -635,8 +909,8 @@ void scanCallback(void *privdata, const dictEntry *de) {
         val = dictGetVal(de);
         incrRefCount(val);
     } else if (o->type == REDIS_ZSET) {
-        key = dictGetKey(de);
-        incrRefCount(key);
+        sds sdskey = dictGetKey(de);
+        key = createStringObject(sdskey, sdslen(sdskey));
         val = createStringObjectFromLongDouble(*(double*)dictGetVal(de));
     } else {
         redisPanic("Type not handled in SCAN callback.");
@@ -687,6 +961,11 @@ int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor) {
  * of every element on the Hash. 
  *
  * 如果被迭代的是哈希对象，那么函数返回的是键值对。
+ *
+ * When iterating the keyspace, MATCH and TYPE are applied inside the scan
+ * callback and COUNT bounds the number of visited entries rather than the
+ * number of returned ones, so a selective filter returns few keys without
+ * making a single call walk the whole dictionary.
  */
 void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
     int rv;
@@ -697,6 +976,7 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
     long count = 10;
     sds pat;
     int patlen, use_pattern = 0;
+    char *type = NULL;
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -743,6 +1023,11 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 
             i += 2;
 
+        // TYPE <type>，只对 SCAN 有效
+        } else if (!strcasecmp(c->argv[i]->ptr, "type") && o == NULL && j >= 2) {
+            type = c->argv[i+1]->ptr;
+            i += 2;
+
         // error
         } else {
             addReply(c,shared.syntaxerr);
@@ -752,7 +1037,7 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
@@ -774,29 +1059,36 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
     } else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT) {
         // 迭代目标为 HT 编码的哈希
         ht = o->ptr;
-        count *= 2; /* We return key / value for this type. */
     } else if (o->type == REDIS_ZSET && o->encoding == REDIS_ENCODING_SKIPLIST) {
         // 迭代目标为 HT 编码的跳跃表
         zset *zs = o->ptr;
         ht = zs->dict;
-        count *= 2; /* We return key / value for this type. */
     }   // TODO:(DONE) ZIPLIST 呢？下面 ht == NULL 的分支将分别处理 ZIPLIST、INTSET 这两种情况
 
     if (ht) {
-        void *privdata[2];
-
-        /* We pass two pointers to the callback: the list to which it will
-         * add new elements, and the object containing the dictionary so that
-         * it is possible to fetch more data in a type-dependent way. */
-        // 我们向回调函数传入两个指针：
-        // 一个是用于记录被迭代元素的列表
-        // 另一个是字典对象
+        scanData sd;
+
+        /* We pass the callback the list to which it will add new elements,
+         * and the object containing the dictionary so that it is possible
+         * to fetch more data in a type-dependent way. */
+        // 我们向回调函数传入用于记录被迭代元素的列表和字典对象
         // 从而实现类型无关的数据提取操作
-        privdata[0] = keys;
-        privdata[1] = o;    // DB->dict 的情况下，是 NULL
+        sd.keys = keys;
+        sd.o = o;           // DB->dict 的情况下，是 NULL
+        sd.visited = 0;
+        sd.type = type;
+        sd.pat = NULL;
+        sd.patlen = 0;
+        sd.prefixlen = -1;
+        if (o == NULL && use_pattern) {
+            sd.pat = pat;
+            sd.patlen = patlen;
+            sd.prefixlen = scanPatternPrefixLen(pat,patlen);
+            use_pattern = 0;    /* Already matched by the callback. */
+        }
         do {
-            cursor = dictScan(ht, cursor, scanCallback, privdata);
-        } while (cursor && listLength(keys) < count);
+            cursor = dictScan(ht, cursor, scanCallback, NULL, &sd);
+        } while (cursor && sd.visited < count);
     } else if (o->type == REDIS_SET) {  // 等价于 o->type == REDIS_SET && o->encoding == INTSET
         int pos = 0;
         int64_t ll;
@@ -805,18 +1097,20 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == REDIS_HASH || o->type == REDIS_ZSET) {
-        // 底层 encoding 采用 ZIPLIST 编码方式
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        // 底层 encoding 采用 LISTPACK 编码方式
+        unsigned char *lp = (o->type == REDIS_HASH) ? hashTypeListpack(o) :
+                                                      o->ptr;
+        unsigned char *p = lpFirst(lp);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(lp,p);
         }
         cursor = 0;
     } else {
@@ -890,7 +1184,7 @@ cleanup:
 }
 
 /* The SCAN command completely relies on scanGenericCommand. */
-// SCAN cursor [MATCH pattern] [COUNT count]
+// SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
 // COUNT 参数的默认值为 10 。并非每次迭代都要使用相同的 COUNT 值。
 // 多 client 同时 SCAN 同一个 REDIS_HASH 是没有问题的，可以相互独立的
 // 因为 redis-server 本身并不记录 cursor，而是将当前的 cursor 返回给相应的 client
@@ -913,26 +1207,25 @@ void lastsaveCommand(redisClient *c) {
     addReplyLongLong(c,server.lastsave);
 }
 
+/* Return the name of the type of 'o' as reported by TYPE. */
+char *getObjectTypeName(robj *o) {
+    switch(o->type) {
+    case REDIS_STRING: return "string";
+    case REDIS_LIST: return "list";
+    case REDIS_SET: return "set";
+    case REDIS_ZSET: return "zset";
+    case REDIS_HASH: return "hash";
+    case REDIS_STREAM: return "stream";
+    case REDIS_MODULE: return ((moduleValue*)o->ptr)->type->name;
+    default: return "unknown";
+    }
+}
+
 void typeCommand(redisClient *c) {
     robj *o;
-    char *type;
 
-    o = lookupKeyRead(c->db,c->argv[1]);
-
-    if (o == NULL) {
-        type = "none";
-    } else {
-        switch(o->type) {
-        case REDIS_STRING: type = "string"; break;
-        case REDIS_LIST: type = "list"; break;
-        case REDIS_SET: type = "set"; break;
-        case REDIS_ZSET: type = "zset"; break;
-        case REDIS_HASH: type = "hash"; break;
-        default: type = "unknown"; break;
-        }
-    }
-
-    addReplyStatus(c,type);
+    o = lookupKeyReadWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED);
+    addReplyStatus(c,o ? getObjectTypeName(o) : "none");
 }
 
 // 直接把所有 client、server 都关闭掉
@@ -985,9 +1278,11 @@ void renameGenericCommand(redisClient *c, int nx) {
         return;
     }
 
-    // 取出来源键
-    if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL)
+    // 取出来源键（只是换个名字，分块字符串不需要拼接）
+    if ((o = lookupKeyWriteWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED)) == NULL) {
+        addReply(c,shared.nokeyerr);
         return;
+    }
 
     // 增加引用计数，因为后面目标键也会引用这个对象
     // 如果不增加的话，当来源键被删除时，这个值对象也会被删除
@@ -997,7 +1292,7 @@ void renameGenericCommand(redisClient *c, int nx) {
     expire = getExpire(c->db,c->argv[1]);
 
     // 检查目标键是否存在
-    if (lookupKeyWrite(c->db,c->argv[2]) != NULL) {
+    if (lookupKeyWriteWithFlags(c->db,c->argv[2],REDIS_LOOKUP_CHUNKED) != NULL) {
 
         // 如果目标键存在，并且执行的是 RENAMENX ，那么直接返回
         if (nx) {
@@ -1081,7 +1376,7 @@ void moveCommand(redisClient *c) {
 
     /* Check if the element exists and get a reference */
     // 取出要移动的对象
-    o = lookupKeyWrite(c->db,c->argv[1]);
+    o = lookupKeyWriteWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED);
     if (!o) {
         addReply(c,shared.czero);
         return;
@@ -1089,7 +1384,7 @@ void moveCommand(redisClient *c) {
 
     /* Return zero if the key already exists in the target DB */
     // 如果键已经存在于目标数据库，那么返回
-    if (lookupKeyWrite(dst,c->argv[1]) != NULL) {
+    if (lookupKeyWriteWithFlags(dst,c->argv[1],REDIS_LOOKUP_CHUNKED) != NULL) {
         addReply(c,shared.czero);
         return;
     }
@@ -1111,6 +1406,127 @@ void moveCommand(redisClient *c) {
  * Expires API
  *----------------------------------------------------------------------------*/
 
+/* When active-expire-index is enabled every DB also keeps its volatile keys
+ * in a radix tree sorted by expire time, so that the active expire cycle can
+ * reclaim exactly the keys that are due, in order, instead of sampling
+ * db->expires at random.
+ *
+ * Every key of the tree is the expire time as a 64 bit big endian number,
+ * with the sign bit flipped so that the byte order matches the numerical
+ * order, followed by the key name. The tree copies the key names, and has
+ * no associated values.
+ *
+ * 过期键索引：以 [过期时间（大端序）][键名] 为键的 rax ，
+ * 按照 rax 的顺序遍历就是按照过期时间从早到晚遍历 */
+
+/* Index keys up to this length are built on the stack. */
+#define EXPIRE_INDEX_STATIC_LEN 128
+
+/* Build the index key of 'key' expiring at 'when' into 'buf' if it fits
+ * in 'buflen' bytes, or into a new allocation otherwise: the caller should
+ * zfree() the returned pointer if it is not 'buf'. The key length is
+ * stored in '*len'. */
+static unsigned char *expireIndexKey(unsigned char *buf, size_t buflen,
+                                     long long when, sds key, size_t *len)
+{
+    uint64_t t = (uint64_t)when ^ (1ULL<<63);
+    size_t keylen = sdslen(key);
+    unsigned char *ik;
+    int j;
+
+    *len = EXPIRE_INDEX_TIME_LEN+keylen;
+    ik = (*len <= buflen) ? buf : zmalloc(*len);
+    for (j = EXPIRE_INDEX_TIME_LEN-1; j >= 0; j--) {
+        ik[j] = t & 0xff;
+        t >>= 8;
+    }
+    memcpy(ik+EXPIRE_INDEX_TIME_LEN,key,keylen);
+    return ik;
+}
+
+/* Return the expire time stored in the index key 'ik' of 'len' bytes,
+ * setting '*key' and '*keylen' to the key name. */
+long long expireIndexDecodeKey(unsigned char *ik, size_t len,
+                               unsigned char **key, size_t *keylen)
+{
+    uint64_t t = 0;
+    int j;
+
+    redisAssert(len >= EXPIRE_INDEX_TIME_LEN);
+    for (j = 0; j < EXPIRE_INDEX_TIME_LEN; j++) t = (t << 8) | ik[j];
+    *key = ik+EXPIRE_INDEX_TIME_LEN;
+    *keylen = len-EXPIRE_INDEX_TIME_LEN;
+    return (long long)(t ^ (1ULL<<63));
+}
+
+/* Add 'key' expiring at 'when' to the expire index of 'db'. */
+static void expireIndexAdd(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_LEN], *ik;
+    size_t len;
+
+    ik = expireIndexKey(buf,sizeof(buf),when,key,&len);
+    raxInsert(db->expires_index,ik,len,NULL,NULL);
+    if (ik != buf) zfree(ik);
+}
+
+/* Remove 'key' expiring at 'when' from the expire index of 'db'. */
+static void expireIndexDel(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_LEN], *ik;
+    size_t len;
+
+    ik = expireIndexKey(buf,sizeof(buf),when,key,&len);
+    raxRemove(db->expires_index,ik,len,NULL);
+    if (ik != buf) zfree(ik);
+}
+
+/* Build the expire index of 'db' from its expires dictionary if 'enable'
+ * is true and the DB has no index yet, or release the index if 'enable'
+ * is false. Called at startup and when active-expire-index is changed
+ * with CONFIG SET.
+ *
+ * 建立或者释放数据库的过期键索引 */
+void expireIndexSetup(redisDb *db, int enable) {
+    if (enable && db->expires_index == NULL) {
+        dictIterator *di;
+        dictEntry *de;
+
+        db->expires_index = raxNew();
+        di = dictGetIterator(db->expires);
+        while ((de = dictNext(di)) != NULL)
+            expireIndexAdd(db,dictGetKey(de),dictGetSignedIntegerVal(de));
+        dictReleaseIterator(di);
+    } else if (!enable && db->expires_index) {
+        raxFree(db->expires_index);
+        db->expires_index = NULL;
+    }
+}
+
+/* Empty the expire index of 'db', if any, after its expires dictionary
+ * was emptied. With 'async' the old index is freed by the bio thread. */
+void expireIndexFlush(redisDb *db, int async) {
+    if (db->expires_index == NULL) return;
+    if (async)
+        freeExpireIndexAsync(db->expires_index);
+    else
+        raxFree(db->expires_index);
+    db->expires_index = raxNew();
+}
+
+/* Remove the expire of 'key' from the expires dictionary of 'db', and from
+ * the expire index if enabled. Return 1 if the key had an expire, 0
+ * otherwise.
+ *
+ * 删除键的过期时间，同时更新过期键索引 */
+int dbDeleteExpire(redisDb *db, sds key) {
+    if (db->expires_index) {
+        dictEntry *de = dictFind(db->expires,key);
+
+        if (de == NULL) return 0;
+        expireIndexDel(db,key,dictGetSignedIntegerVal(de));
+    }
+    return dictDelete(db->expires,key) == DICT_OK;
+}
+
 /*
  * 移除键 key 的过期时间
  */
@@ -1120,8 +1536,11 @@ int removeExpire(redisDb *db, robj *key) {
     // 确保键带有过期时间
     redisAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
 
+    if (server.forkless_save && dictFind(db->expires,key->ptr))
+        snapshotKeyWillChange(db,key->ptr);
+
     // 删除过期时间(key-value 一起删掉)
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    return dbDeleteExpire(db,key->ptr);
 }
 
 /*
@@ -1131,16 +1550,24 @@ void setExpire(redisDb *db, robj *key, long long when) {
 
     dictEntry *kde, *de;
 
+    if (server.forkless_save) snapshotKeyWillChange(db,key->ptr);
+
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->dict,key->ptr);
 
     redisAssertWithInfo(NULL,key,kde != NULL);
 
+    // 索引中的旧过期时间要先删除
+    if (db->expires_index && (de = dictFind(db->expires,key->ptr)) != NULL)
+        expireIndexDel(db,key->ptr,dictGetSignedIntegerVal(de));
+
     de = dictReplaceRaw(db->expires,dictGetKey(kde));   // 没有这个 key 的话，直接新建，有的话，取出整个 entry 就好
 
     // 设置这个 key 的过期时间（这是为 value field）
     // 这里是直接使用整数值来保存过期时间，不是用 INT 编码的 String 对象
     dictSetSignedIntegerVal(de,when);
+
+    if (db->expires_index) expireIndexAdd(db,key->ptr,when);
 }
 
 /* Return the expire time of the specified key, or -1 if no expire
@@ -1194,12 +1621,9 @@ void propagateExpire(redisDb *db, robj *key) {
     incrRefCount(argv[0]);
     incrRefCount(argv[1]);
 
-    // 传播到 AOF 
-    if (server.aof_state != REDIS_AOF_OFF)
-        feedAppendOnlyFile(server.delCommand,db->id,argv,2);
-
-    // 传播到所有附属节点
-    replicationFeedSlaves(server.slaves,db->id,argv,2);
+    // 传播到 AOF 和所有附属节点
+    propagate(server.delCommand,db->id,argv,2,
+        REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
 
     decrRefCount(argv[0]);
     decrRefCount(argv[1]);
@@ -1265,9 +1689,11 @@ int expireIfNeeded(redisDb *db, robj *key) {
     // 发送事件通知
     notifyKeyspaceEvent(REDIS_NOTIFY_EXPIRED,
         "expired",key,db->id);
+    trackingInvalidateKey(key);
 
     // 将过期键从数据库中删除
-    return dbDelete(db,key);
+    return server.lazyfree_lazy_expire ? dbAsyncDelete(db,key) :
+                                         dbSyncDelete(db,key);
 }
 
 /*-----------------------------------------------------------------------------
@@ -1305,7 +1731,7 @@ void expireGenericCommand(redisClient *c, long long basetime, int unit) {
 
     /* No key, return zero. */
     // 取出键
-    if (lookupKeyRead(c->db,key) == NULL) {
+    if (lookupKeyReadWithFlags(c->db,key,REDIS_LOOKUP_CHUNKED) == NULL) {
         addReply(c,shared.czero);
         return;
     }
@@ -1409,7 +1835,7 @@ void ttlGenericCommand(redisClient *c, int output_ms) {
 
     /* If the key does not exist at all, return -2 */
     // 取出键
-    if (lookupKeyRead(c->db,c->argv[1]) == NULL) {
+    if (lookupKeyReadWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED) == NULL) {
         addReplyLongLong(c,-2);
         return;
     }
@@ -1546,6 +1972,59 @@ int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *nu
     return keys;
 }
 
+/* Helper function to extract keys from the MEMORY command: only
+ * MEMORY USAGE <key> has a key argument. */
+int *memoryGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int *keys;
+    REDIS_NOTUSED(cmd);
+
+    if (argc >= 3 && !strcasecmp(argv[1]->ptr,"usage")) {
+        keys = zmalloc(sizeof(int) * 1);
+        keys[0] = 2;
+        *numkeys = 1;
+        return keys;
+    }
+    *numkeys = 0;
+    return NULL;
+}
+
+/* Helper function to extract keys from the XREAD command:
+ *
+ * XREAD [BLOCK <milliseconds>] [COUNT <count>] STREAMS <key> ... <ID> ...
+ *
+ * The keys are the first half of the arguments after STREAMS. */
+int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num = 0, *keys;
+    REDIS_NOTUSED(cmd);
+
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i]->ptr;
+
+        if ((!strcasecmp(arg,"block") || !strcasecmp(arg,"count")) &&
+            i+1 < argc)
+        {
+            i++;
+        } else if (!strcasecmp(arg,"streams")) {
+            num = argc-i-1;
+            break;
+        } else {
+            break;
+        }
+    }
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num == 0 || (num % 2) != 0) {
+        *numkeys = 0;
+        return NULL;
+    }
+    num /= 2;
+
+    keys = zmalloc(sizeof(int)*num);
+    for (i = 0; i < num; i++) keys[i] = argc-num*2+i;
+    *numkeys = num;
+    return keys;
+}
+
 /* Helper function to extract keys from the following commands:
  * EVAL <script> <num-keys> <key> <key> ... <key> [more stuff]
  * EVALSHA <script> <num-keys> <key> <key> ... <key> [more stuff] */
@@ -1570,6 +2049,62 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
     return keys;
 }
 
+/* Helper function to extract keys from the following commands:
+ * SINTERCARD <num-keys> <key> <key> ... <key> [LIMIT <limit>]
+ * ZUNION <num-keys> <key> <key> ... <key> <options>
+ * ZINTER <num-keys> <key> <key> ... <key> <options> */
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    REDIS_NOTUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num <= 0 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    *numkeys = num;
+
+    /* Add all key positions for argv[2...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+
+    return keys;
+}
+
+/* LMPOP numkeys key [key ...] LEFT|RIGHT [COUNT count]
+ * BLMPOP timeout numkeys key [key ...] LEFT|RIGHT [COUNT count]
+ *
+ * 'numkeys_pos' is the position of numkeys, the keys follow it. */
+static int *mpopGetKeys(robj **argv, int argc, int numkeys_pos, int *numkeys) {
+    int i, num, *keys;
+
+    num = atoi(argv[numkeys_pos]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error: the keys are followed by the direction. */
+    if (num <= 0 || num > (argc-numkeys_pos-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    *numkeys = num;
+    for (i = 0; i < num; i++) keys[i] = numkeys_pos+1+i;
+    return keys;
+}
+
+int *lmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    REDIS_NOTUSED(cmd);
+    return mpopGetKeys(argv,argc,1,numkeys);
+}
+
+int *blmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    REDIS_NOTUSED(cmd);
+    return mpopGetKeys(argv,argc,2,numkeys);
+}
+
 /* Helper function to extract keys from the SORT command.
  *
  * SORT <sort-key> ... STORE <store-key> ...
@@ -1620,116 +2155,116 @@ int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
 
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
- * while rehashing the cluster. */
-// 将给定键添加到槽里面，
-// 节点的 slots_to_keys 用跳跃表记录了 slot -> key 之间的映射
+ * while rehashing the cluster.
+ *
+ * The map is an array of REDIS_CLUSTER_SLOTS dictionaries, created on
+ * demand, holding the keys of every slot. The keys are the very sds
+ * strings of the main dictionary, not copies and without references, so
+ * the map costs just a dictEntry per key: slotToKeyDel() must be called
+ * before the key is released from the main dictionary.
+ *
+ * 节点的 slots_to_keys 为每个槽保存一个字典，字典中的键直接引用主字典中的 sds ，
+ * 因此必须先调用 slotToKeyDel() ，再从主字典中删除键 */
+
+// 创建一个空的 slots -> keys 映射
+dict **slotToKeyCreate(void) {
+    return zcalloc(sizeof(dict*)*REDIS_CLUSTER_SLOTS);
+}
+
+// 释放 slots -> keys 映射，不会释放其中的键
+void slotToKeyRelease(dict **slots) {
+    int j;
+
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++)
+        if (slots[j]) dictRelease(slots[j]);
+    zfree(slots);
+}
+
+// 返回映射中键的总数
+size_t slotToKeyCount(dict **slots) {
+    size_t count = 0;
+    int j;
+
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++)
+        if (slots[j]) count += dictSize(slots[j]);
+    return count;
+}
+
+// 将给定键添加到槽里面，key 必须是 0 号数据库主字典中的键名 sds
 // 这样可以快速地处理槽和键的关系，在 rehash 槽时很有用。
-void slotToKeyAdd(robj *key) {
+void slotToKeyAdd(sds key) {
 
     // 计算出键所属的槽
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
+    dict **slots = server.cluster->slots_to_keys;
 
-    // 将槽 slot 作为分值，键作为成员，添加到 slots_to_keys 跳跃表里面
-    zslInsert(server.cluster->slots_to_keys,hashslot,key);
-    incrRefCount(key);
+    if (slots[hashslot] == NULL)
+        slots[hashslot] = dictCreate(&keyptrDictType,NULL);
+
+    // 引用主字典中的键名，而不是复制它
+    dictAdd(slots[hashslot],key,NULL);
 }
 
 // 从槽中删除给定的键 key
 void slotToKeyDel(robj *key) {
     unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    dict *d = server.cluster->slots_to_keys[hashslot];
 
-    zslDelete(server.cluster->slots_to_keys,hashslot,key);
+    if (d) dictDelete(d,key->ptr);
 }
 
 // 清空节点所有槽保存的所有键
 void slotToKeyFlush(void) {
-    zslFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = zslCreate();
+    slotToKeyRelease(server.cluster->slots_to_keys);
+    server.cluster->slots_to_keys = slotToKeyCreate();
 }
 
 // 记录 count 个属于 hashslot 槽的键到 keys 数组
-// 并返回被记录键的数量
+// 并返回被记录键的数量，调用者负责释放这些键对象
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    zskiplistNode *n;
-    zrangespec range;
+    dict *d = server.cluster->slots_to_keys[hashslot];
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
+    if (d == NULL) return 0;
+    di = dictGetIterator(d);
+    while(count-- && (de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
 
-    // 定位到第一个属于指定 slot 的键上面
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    // 遍历跳跃表，并保存属于指定 slot 的键
-    // n && n->score 检查当前键是否属于指定 slot
-    // && count-- 用来计数
-    while(n && n->score == hashslot && count--) {
         // 记录键
-        keys[j++] = n->obj;
-        n = n->level[0].forward;
+        keys[j++] = createStringObject(key,sdslen(key));
     }
+    dictReleaseIterator(di);
     return j;
 }
 
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    zskiplistNode *n;
-    zrangespec range;
+    dict *d = server.cluster->slots_to_keys[hashslot];
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
+    if (d == NULL) return 0;
+    /* dbDelete() removes the current entry: use a safe iterator. */
+    di = dictGetSafeIterator(d);
+    while((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key,sdslen(key));
 
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    while(n && n->score == hashslot) {
-        robj *key = n->obj;
-        n = n->level[0].forward; /* Go to the next item before freeing it. */
-        incrRefCount(key); /* Protect the object while freeing it. */
-        dbDelete(&server.db[0],key);
-        decrRefCount(key);
+        dbDelete(&server.db[0],keyobj);
+        decrRefCount(keyobj);
         j++;
     }
+    dictReleaseIterator(di);
     return j;
 }
 
 // 返回指定 slot 包含的键数量
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    zskiplist *zsl = server.cluster->slots_to_keys;
-    zskiplistNode *zn;
-    zrangespec range;
-    int rank, count = 0;
-
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    /* Find first element in range */
-    // 定位到第一个在指定 slot 上的键
-    zn = zslFirstInRange(zsl, &range);
-
-    /* Use rank of first element, if any, to determine preliminary count */
-    // 使用第一个指定 slot 键的排位减去最后一个指定 slot 键的排位
-    // 这一方法来计算 slot 键的数量
-    // 类似区间算法
-
-    // 第一个在指定 slot 上的键存在
-    if (zn != NULL) {
-        // 获取第一个键的排位
-        rank = zslGetRank(zsl, zn->score, zn->obj);
-        count = (zsl->length - (rank - 1));
-
-        /* Find last element in range */
-        // 获取最后一个指定 slot 的键
-        zn = zslLastInRange(zsl, &range);
-
-        /* Use rank of last element, if any, to determine the actual count */
-        // 最后一个键存在
-        if (zn != NULL) {
-            // 获取排位
-            rank = zslGetRank(zsl, zn->score, zn->obj);
-            // 计算数量
-            count -= (zsl->length - rank);
-        }
-    }
+    dict *d = server.cluster->slots_to_keys[hashslot];
 
-    return count;
+    return d ? dictSize(d) : 0;
 }
@@ -92,7 +92,35 @@ void mixDigest(unsigned char *digest, void *ptr, size_t len) {
     SHA1Final(digest,&ctx);
 }
 
+/* SHA1 of a chunked string, the same of the contiguous string. */
+static void chunkedStringDigest(unsigned char *hash, robj *o) {
+    stringChunks *sc = o->ptr;
+    SHA1_CTX ctx;
+    size_t j;
+
+    SHA1Init(&ctx);
+    for (j = 0; j < sc->count; j++) {
+        char *p;
+        size_t n = stringChunksAt(sc,j,&p);
+
+        SHA1Update(&ctx,(unsigned char*)p,n);
+    }
+    SHA1Final(hash,&ctx);
+}
+
 void mixObjectDigest(unsigned char *digest, robj *o) {
+    if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        unsigned char hash[20];
+        SHA1_CTX ctx;
+        int j;
+
+        chunkedStringDigest(hash,o);
+        for (j = 0; j < 20; j++) digest[j] ^= hash[j];
+        SHA1Init(&ctx);
+        SHA1Update(&ctx,digest,20);
+        SHA1Final(digest,&ctx);
+        return;
+    }
     o = getDecodedObject(o);
     mixDigest(digest,o->ptr,sdslen(o->ptr));
     decrRefCount(o);
@@ -118,7 +146,7 @@ void computeDatasetDigest(unsigned char *final) {
         redisDb *db = server.db+j;
 
         if (dictSize(db->dict) == 0) continue;
-        di = dictGetIterator(db->dict);
+        di = dictGetSafeIterator(db->dict);
 
         /* hash the DB id, so the same dataset moved in a different
          * DB will lead to a different digest */
@@ -166,7 +194,7 @@ void computeDatasetDigest(unsigned char *final) {
             } else if (o->type == REDIS_ZSET) {
                 unsigned char eledigest[20];
 
-                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                if (o->encoding == REDIS_ENCODING_LISTPACK) {
                     unsigned char *zl = o->ptr;
                     unsigned char *eptr, *sptr;
                     unsigned char *vstr;
@@ -174,13 +202,13 @@ void computeDatasetDigest(unsigned char *final) {
                     long long vll;
                     double score;
 
-                    eptr = ziplistIndex(zl,0);
+                    eptr = lpSeek(zl,0);
                     redisAssert(eptr != NULL);
-                    sptr = ziplistNext(zl,eptr);
+                    sptr = lpNext(zl,eptr);
                     redisAssert(sptr != NULL);
 
                     while (eptr != NULL) {
-                        redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                        vstr = lpGetValue(eptr,&vlen,&vll);
                         score = zzlGetScore(sptr);
 
                         memset(eledigest,0,20);
@@ -202,12 +230,12 @@ void computeDatasetDigest(unsigned char *final) {
                     dictEntry *de;
 
                     while((de = dictNext(di)) != NULL) {
-                        robj *eleobj = dictGetKey(de);
+                        sds sdsele = dictGetKey(de);
                         double *score = dictGetVal(de);
 
                         snprintf(buf,sizeof(buf),"%.17g",*score);
                         memset(eledigest,0,20);
-                        mixObjectDigest(eledigest,eleobj);
+                        mixDigest(eledigest,sdsele,sdslen(sdsele));
                         mixDigest(eledigest,buf,strlen(buf));
                         xorDigest(digest,eledigest,20);
                     }
@@ -233,6 +261,36 @@ void computeDatasetDigest(unsigned char *final) {
                     xorDigest(digest,eledigest,20);
                 }
                 hashTypeReleaseIterator(hi);
+            } else if (o->type == REDIS_STREAM) {
+                stream *st = o->ptr;
+                streamIterator si;
+                streamID id;
+                int64_t numfields;
+                unsigned char idbuf[16];
+
+                /* Entries are ordered, so like list elements they are mixed
+                 * in the digest one after the other. */
+                streamIteratorStart(&si,st,NULL,NULL,0);
+                while(streamIteratorGetID(&si,&id,&numfields)) {
+                    streamEncodeID(idbuf,&id);
+                    mixDigest(digest,idbuf,sizeof(idbuf));
+                    while(numfields--) {
+                        unsigned char *field, *value;
+                        int64_t field_len, value_len;
+
+                        streamIteratorGetField(&si,&field,&value,
+                                               &field_len,&value_len);
+                        mixDigest(digest,field,field_len);
+                        mixDigest(digest,value,value_len);
+                    }
+                }
+                streamIteratorStop(&si);
+                streamEncodeID(idbuf,&st->last_id);
+                mixDigest(digest,idbuf,sizeof(idbuf));
+            } else if (o->type == REDIS_MODULE) {
+                /* The value is opaque: only the type is mixed. */
+                moduleValue *mv = o->ptr;
+                mixDigest(digest,mv->type->name,strlen(mv->type->name));
             } else {
                 redisPanic("Unknown object type");
             }
@@ -261,16 +319,17 @@ void debugCommand(redisClient *c) {
             addReply(c,shared.err);
             return;
         }
-        emptyDb(NULL);
-        if (rdbLoad(server.rdb_filename) != REDIS_OK) {
+        emptyDb(EMPTYDB_NO_FLAGS,NULL);
+        if (rdbLoad(server.rdb_filename,NULL) != REDIS_OK) {
             addReplyError(c,"Error trying to load the RDB dump");
             return;
         }
         redisLog(REDIS_WARNING,"DB reloaded by DEBUG RELOAD");
         addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"loadaof")) {
-        emptyDb(NULL);
-        if (loadAppendOnlyFile(server.aof_filename) != REDIS_OK) {
+        if (server.aof_state == REDIS_AOF_ON) flushAppendOnlyFile(1);
+        emptyDb(EMPTYDB_NO_FLAGS,NULL);
+        if (loadAppendOnlyFiles(server.aof_manifest) != REDIS_OK) {
             addReply(c,shared.err);
             return;
         }
@@ -289,13 +348,40 @@ void debugCommand(redisClient *c) {
         val = dictGetVal(de);
         strenc = strEncoding(val->encoding);
 
+        // 对于 quicklist ，额外给出节点数量等信息
+        char extra[196] = {0};
+        if (val->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = val->ptr;
+            quicklistNode *node;
+            double avg = ql->len ? (double)ql->count/ql->len : 0;
+            unsigned long compressed = 0;
+            unsigned long long used = 0, uncompressed = 0;
+
+            // 统计被压缩的节点数量，以及压缩前后 listpack 占用的字节数
+            for (node = ql->head; node; node = node->next) {
+                uncompressed += node->sz;
+                if (quicklistNodeIsCompressed(node)) {
+                    void *data;
+                    used += quicklistGetLzf(node,&data);
+                    compressed++;
+                } else {
+                    used += node->sz;
+                }
+            }
+            snprintf(extra,sizeof(extra)," ql_nodes:%u ql_avg_node:%.2f"
+                " ql_ziplist_max:%d ql_compress_depth:%u"
+                " ql_compressed_nodes:%lu ql_uncompressed_size:%llu"
+                " ql_used_size:%llu",ql->len,avg,ql->fill,ql->compress,
+                compressed,uncompressed,used);
+        }
+
         addReplyStatusFormat(c,
             "Value at:%p refcount:%d "
             "encoding:%s serializedlength:%lld "
-            "lru:%d lru_seconds_idle:%llu",
+            "lru:%d lru_seconds_idle:%llu%s",
             (void*)val, val->refcount,
             strenc, (long long) rdbSavedObjectLen(val),
-            val->lru, estimateObjectIdleTime(val));
+            val->lru, estimateObjectIdleTime(val), extra);
     } else if (!strcasecmp(c->argv[1]->ptr,"sdslen") && c->argc == 3) {
         dictEntry *de;
         robj *val;
@@ -451,6 +537,8 @@ void redisLogObjectDebugInfo(robj *o) {
         redisLog(REDIS_WARNING,"Set size: %d", (int) setTypeSize(o));
     } else if (o->type == REDIS_HASH) {
         redisLog(REDIS_WARNING,"Hash size: %d", (int) hashTypeLength(o));
+    } else if (o->type == REDIS_STREAM) {
+        redisLog(REDIS_WARNING,"Stream length: %d", (int) streamLength(o));
     } else if (o->type == REDIS_ZSET) {
         redisLog(REDIS_WARNING,"Sorted set size: %d", (int) zsetLength(o));
         if (o->encoding == REDIS_ENCODING_SKIPLIST)
@@ -832,8 +920,10 @@ void sigsegvHandler(int sig, siginfo_t *info, void *secret) {
     /* Log INFO and CLIENT LIST */
     redisLog(REDIS_WARNING, "--- INFO OUTPUT");
     infostring = genRedisInfoString("all");
-    infostring = sdscatprintf(infostring, "hash_init_value: %u\n",
-        dictGetHashFunctionSeed());
+    infostring = sdscat(infostring, "hash_init_value: ");
+    infostring = sdscatrepr(infostring,
+        (char*)dictGetHashFunctionSeed(),16);
+    infostring = sdscat(infostring, "\n");
     redisLogRaw(REDIS_WARNING, infostring);
     redisLog(REDIS_WARNING, "--- CLIENT LIST OUTPUT");
     clients = getAllClientsInfoString();
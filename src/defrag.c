@@ -0,0 +1,678 @@
+/* defrag.c - Active memory defragmentation
+ *
+ * 主动碎片整理：在 serverCron 中逐步扫描键空间，
+ * 把位于利用率较低的 jemalloc run 里的分配重新分配到利用率更高的 run 中，
+ * 让分配器最终可以把空出来的页归还给操作系统。
+ *
+ * Try to find key / value allocations that need to be re-allocated in order
+ * to reduce external fragmentation.
+ * We do that by scanning the keyspace and for each pointer we have, we can try to
+ * ask the allocator if moving it to a new address will help reduce fragmentation.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+#include "cluster.h"
+
+#ifdef HAVE_DEFRAG
+
+/* this method was added to jemalloc in order to help us understand which
+ * pointers are worthwhile moving and which aren't */
+int je_get_defrag_hint(void* ptr, int *bin_util, int *run_util);
+
+/* Defrag helper for generic allocations.
+ *
+ * returns NULL in case the allocatoin wasn't moved.
+ * when it returns a non-null value, the old pointer was already released
+ * and should NOT be accessed.
+ *
+ * 分配器认为值得搬迁时，复制到新地址并释放旧地址，返回新地址，否则返回 NULL
+ */
+static void *activeDefragAlloc(void *ptr) {
+    int bin_util, run_util;
+    size_t size;
+    void *newptr;
+    if(!je_get_defrag_hint(ptr, &bin_util, &run_util)) {
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
+    /* if this run is more utilized than the average utilization in this bin
+     * (or it is full), skip it. This will eventually move all the allocations
+     * from relatively empty runs into relatively full runs. */
+    if (run_util > bin_util || run_util == 1<<16) {
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
+    /* move this allocation to a new allocation.
+     * make sure not to use the thread cache. so that we don't get back the same
+     * pointers we try to free */
+    size = zmalloc_size(ptr);
+    newptr = zmalloc_no_tcache(size);
+    memcpy(newptr, ptr, size);
+    zfree_no_tcache(ptr);
+    return newptr;
+}
+
+/*Defrag helper for sds strings
+ *
+ * returns NULL in case the allocatoin wasn't moved.
+ * when it returns a non-null value, the old pointer was already released
+ * and should NOT be accessed. */
+static sds activeDefragSds(sds sdsptr) {
+    void *ptr = sdsAllocPtr(sdsptr);
+    void *newptr = activeDefragAlloc(ptr);
+    if (newptr) {
+        size_t offset = sdsptr - (char*)ptr;
+        return (char*)newptr + offset;
+    }
+    return NULL;
+}
+
+/* Defrag helper for string objects (and the robj structure of any other
+ * type) owned by exactly 'owners' references.
+ *
+ * returns NULL in case the allocatoin wasn't moved.
+ * when it returns a non-null value, the old pointer was already released
+ * and should NOT be accessed. The caller must update all the 'owners'
+ * references to the returned pointer. */
+static robj *activeDefragObject(robj *ob, int owners, long *defragged) {
+    robj *ret = NULL;
+
+    // 对象还被其他地方（例如客户端回复缓冲区、其他集合）引用，不能搬迁
+    if (ob->refcount != owners)
+        return NULL;
+
+    /* try to defrag robj (only if not an EMBSTR type (handled below). */
+    if (ob->type != REDIS_STRING || ob->encoding != REDIS_ENCODING_EMBSTR) {
+        if ((ret = activeDefragAlloc(ob))) {
+            ob = ret;
+            (*defragged)++;
+        }
+    }
+
+    /* try to defrag string object */
+    if (ob->type == REDIS_STRING) {
+        if (ob->encoding == REDIS_ENCODING_RAW) {
+            sds newsds = activeDefragSds((sds)ob->ptr);
+            if (newsds) {
+                ob->ptr = newsds;
+                (*defragged)++;
+            }
+        } else if (ob->encoding == REDIS_ENCODING_EMBSTR) {
+            /* The sds is embedded in the object allocation, calculate the
+             * offset and update the pointer in the new allocation. */
+            long ofs = (intptr_t)ob->ptr - (intptr_t)ob;
+            if ((ret = activeDefragAlloc(ob))) {
+                ret->ptr = (void*)((intptr_t)ret + ofs);
+                (*defragged)++;
+            }
+        } else if (ob->encoding != REDIS_ENCODING_INT) {
+            redisPanic("Unknown string encoding");
+        }
+    }
+    return ret;
+}
+
+/* Defrag helper for robj that are referenced only once (keyspace values,
+ * members of sets and fields and values of hashes). */
+static robj *activeDefragStringOb(robj *ob, long *defragged) {
+    return activeDefragObject(ob, 1, defragged);
+}
+
+/* Defrag helper for dictEntries, used by the dictScan() bucket callbacks
+ * with a reference to the head of every bucket visited: the entries are
+ * reallocated and the chain is relinked in place. Returns a stat of how
+ * many pointers were moved. */
+static long defragDictBucket(dictEntry **bucketref) {
+    long defragged = 0;
+
+    while(*bucketref) {
+        dictEntry *de = *bucketref, *newde;
+        if ((newde = activeDefragAlloc(de))) {
+            *bucketref = newde;
+            defragged++;
+        }
+        bucketref = &(*bucketref)->next;
+    }
+    return defragged;
+}
+
+/* Defrag helper for the hash tables of a dict (the dict struct itself is
+ * owned by the caller). The segments of the big tables are moved as well.
+ * Returns a stat of how many pointers were moved. */
+static long dictDefragTables(dict* d) {
+    dictEntry **newtable;
+    long defragged = 0;
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        dictht *ht = &d->ht[j];
+
+        if (!ht->table) continue;
+        newtable = activeDefragAlloc(ht->table);
+        if (newtable)
+            defragged++, ht->table = newtable;
+        if (dictHtIsSegmented(ht)) {
+            dictEntry ***segments = (dictEntry***)ht->table;
+            unsigned long k;
+
+            for (k = 0; k < dictHtSegments(ht); k++) {
+                if (segments[k] && (newtable = activeDefragAlloc(segments[k])))
+                    defragged++, segments[k] = newtable;
+            }
+        }
+    }
+    return defragged;
+}
+
+/* Internal function used by zslDefrag */
+static void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode,
+                          zskiplistNode *newnode, zskiplistNode **update)
+{
+    int i;
+    for (i = 0; i < zsl->level; i++) {
+        if (update[i]->level[i].forward == oldnode)
+            update[i]->level[i].forward = newnode;
+    }
+    redisAssert(zsl->header != oldnode);
+    if (newnode->level[0].forward) {
+        redisAssert(newnode->level[0].forward->backward == oldnode);
+        newnode->level[0].forward->backward = newnode;
+    } else {
+        redisAssert(zsl->tail == oldnode);
+        zsl->tail = newnode;
+    }
+}
+
+/* Defrag helper for sorted set.
+ * Find the skiplist node holding 'ele' and try to move it. The member is
+ * embedded in the node, so the node's own ele pointer has to be rebased
+ * on the new allocation. When return value is non-NULL, it is the moved
+ * node: the dict record must then be updated with its ele and score.
+ *
+ * 找到成员为 ele 的跳跃表节点并尝试搬迁节点本身（成员也随节点一起搬迁）
+ */
+static zskiplistNode *zslDefrag(zskiplist *zsl, double score, sds ele) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
+    size_t eleoff;
+    int i;
+
+    /* find the skiplist node referring to the member, and all pointers that
+     * need to be updated if we'll end up moving the skiplist node. */
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+            x->level[i].forward->ele != ele &&
+            (x->level[i].forward->score < score ||
+                (x->level[i].forward->score == score &&
+                sdscmp(x->level[i].forward->ele,ele) < 0)))
+            x = x->level[i].forward;
+        update[i] = x;
+    }
+
+    x = x->level[0].forward;
+    redisAssert(x && score == x->score && x->ele == ele);
+
+    /* try to defrag the skiplist struct */
+    eleoff = (char*)x->ele - (char*)x;
+    newx = activeDefragAlloc(x);
+    if (newx) {
+        newx->ele = (char*)newx + eleoff;
+        zslUpdateNode(zsl, x, newx, update);
+        return newx;
+    }
+    return NULL;
+}
+
+/* State passed to the dictScan() callbacks used for the elements of
+ * hashes, sets and sorted sets. */
+typedef struct defragCtx {
+    robj *ob;           /* The object owning the dictionary. */
+    long defragged;     /* Number of pointers moved so far. */
+} defragCtx;
+
+/* dictScan() callback for the elements of aggregated values: the entries
+ * were already moved by defragDictBucketCallback(), here we take care of
+ * the objects they point to. */
+static void defragAggregateCallback(void *privdata, const dictEntry *const_de) {
+    defragCtx *ctx = privdata;
+    dictEntry *de = (dictEntry*)const_de;
+    robj *newele;
+
+    if (ctx->ob->type == REDIS_SET) {
+        if ((newele = activeDefragStringOb(dictGetKey(de), &ctx->defragged)))
+            de->key = newele;
+    } else if (ctx->ob->type == REDIS_HASH) {
+        if ((newele = activeDefragStringOb(dictGetKey(de), &ctx->defragged)))
+            de->key = newele;
+        if ((newele = activeDefragStringOb(dictGetVal(de), &ctx->defragged)))
+            de->v.val = newele;
+    } else if (ctx->ob->type == REDIS_ZSET) {
+        /* The dict key and value point inside the skiplist node, so both
+         * are updated when the node moves. */
+        zset *zs = ctx->ob->ptr;
+        zskiplistNode *newnode;
+
+        newnode = zslDefrag(zs->zsl, *(double*)dictGetVal(de), dictGetKey(de));
+        if (newnode) {
+            de->key = newnode->ele;
+            de->v.val = &newnode->score;
+            ctx->defragged++;
+        }
+    }
+}
+
+/* dictScan() bucket callback for the elements of aggregated values. */
+static void defragAggregateBucketCallback(void *privdata, dictEntry **bucketref) {
+    defragCtx *ctx = privdata;
+    ctx->defragged += defragDictBucket(bucketref);
+}
+
+/* Defrag the dictionary of an aggregated value: the dictEntries, the
+ * objects they reference and the hash tables. */
+static long defragAggregateDict(robj *ob, dict *d) {
+    defragCtx ctx;
+    unsigned long cursor = 0;
+
+    ctx.ob = ob;
+    ctx.defragged = 0;
+    do {
+        cursor = dictScan(d, cursor, defragAggregateCallback,
+                          defragAggregateBucketCallback, &ctx);
+    } while (cursor);
+    return ctx.defragged + dictDefragTables(d);
+}
+
+/* Defrag the quicklist of a list value: the quicklist struct, the nodes
+ * and the listpacks (or LZF blobs) they hold. */
+static long defragQuicklist(robj *ob) {
+    quicklist *ql = ob->ptr, *newql;
+    quicklistNode *node, *newnode;
+    unsigned char *newzl;
+    long defragged = 0;
+
+    if ((newql = activeDefragAlloc(ql)))
+        defragged++, ob->ptr = ql = newql;
+    node = ql->head;
+    while (node) {
+        if ((newnode = activeDefragAlloc(node))) {
+            if (newnode->prev)
+                newnode->prev->next = newnode;
+            else
+                ql->head = newnode;
+            if (newnode->next)
+                newnode->next->prev = newnode;
+            else
+                ql->tail = newnode;
+            node = newnode;
+            defragged++;
+        }
+        if ((newzl = activeDefragAlloc(node->zl)))
+            defragged++, node->zl = newzl;
+        node = node->next;
+    }
+    return defragged;
+}
+
+/* Utility function that replaces an old key pointer in the dictionary with a
+ * new pointer. Additionally, we try to defrag the dictEntry in that dict.
+ * oldkey mey be a dead pointer and should not be accessed (we get a
+ * pre-calculated hash value). if newkey is NULL the key is unchanged. */
+static void replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey,
+        sds newkey, uint64_t hash, long *defragged)
+{
+    dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
+    if (deref) {
+        dictEntry *de = *deref;
+        dictEntry *newde = activeDefragAlloc(de);
+        if (newde) {
+            de = *deref = newde;
+            (*defragged)++;
+        }
+        if (newkey)
+            de->key = newkey;
+    }
+}
+
+/* for each key we scan in the main dict, this function will attempt to
+ * defrag all the various pointers it has. Returns a stat of how many
+ * pointers were moved. The key name is embedded in the dictEntry, so it is
+ * moved together with the entry by defragDbBucketCallback().
+ *
+ * 整理一个键的值对象以及值内部的各种分配，键名嵌入在节点中，随节点一起整理
+ */
+static long defragKey(dictEntry *de) {
+    robj *newob, *ob;
+    unsigned char *newzl;
+    long defragged = 0;
+
+    /* Try to defrag robj and / or string value. */
+    ob = dictGetVal(de);
+    if ((newob = activeDefragStringOb(ob, &defragged))) {
+        de->v.val = newob;
+        ob = newob;
+    }
+
+    // 只有被键空间独占的值才能继续整理它的内部结构
+    if (ob->refcount != 1) return defragged;
+
+    if (ob->type == REDIS_STRING) {
+        /* Already handled in activeDefragStringOb. */
+    } else if (ob->type == REDIS_LIST) {
+        if (ob->encoding == REDIS_ENCODING_QUICKLIST) {
+            defragged += defragQuicklist(ob);
+        } else {
+            redisPanic("Unknown list encoding");
+        }
+    } else if (ob->type == REDIS_SET) {
+        if (ob->encoding == REDIS_ENCODING_HT) {
+            dict *d = ob->ptr, *newd;
+            if ((newd = activeDefragAlloc(d)))
+                defragged++, ob->ptr = d = newd;
+            defragged += defragAggregateDict(ob, d);
+        } else if (ob->encoding == REDIS_ENCODING_INTSET) {
+            intset *is = ob->ptr;
+            intset *newis = activeDefragAlloc(is);
+            if (newis)
+                defragged++, ob->ptr = newis;
+        } else {
+            redisPanic("Unknown set encoding");
+        }
+    } else if (ob->type == REDIS_ZSET) {
+        if (ob->encoding == REDIS_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragAlloc(ob->ptr)))
+                defragged++, ob->ptr = newzl;
+        } else if (ob->encoding == REDIS_ENCODING_SKIPLIST) {
+            zset *zs = (zset*)ob->ptr;
+            zset *newzs;
+            zskiplist *newzsl;
+            struct zskiplistNode *newheader;
+            dict *newd;
+            if ((newzs = activeDefragAlloc(zs)))
+                defragged++, ob->ptr = zs = newzs;
+            if ((newzsl = activeDefragAlloc(zs->zsl)))
+                defragged++, zs->zsl = newzsl;
+            if ((newheader = activeDefragAlloc(zs->zsl->header)))
+                defragged++, zs->zsl->header = newheader;
+            if ((newd = activeDefragAlloc(zs->dict)))
+                defragged++, zs->dict = newd;
+            defragged += defragAggregateDict(ob, zs->dict);
+        } else {
+            redisPanic("Unknown sorted set encoding");
+        }
+    } else if (ob->type == REDIS_HASH) {
+        if (ob->encoding == REDIS_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragAlloc(ob->ptr)))
+                defragged++, ob->ptr = newzl;
+        } else if (ob->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+            hashListpackIndex *idx = ob->ptr, *newidx;
+            if ((newidx = activeDefragAlloc(idx)))
+                defragged++, ob->ptr = idx = newidx;
+            if ((newzl = activeDefragAlloc(idx->lp)))
+                defragged++, idx->lp = newzl;
+        } else if (ob->encoding == REDIS_ENCODING_HT) {
+            dict *d = ob->ptr, *newd;
+            if ((newd = activeDefragAlloc(d)))
+                defragged++, ob->ptr = d = newd;
+            defragged += defragAggregateDict(ob, d);
+        } else {
+            redisPanic("Unknown hash encoding");
+        }
+    } else if (ob->type == REDIS_STREAM) {
+        stream *st = ob->ptr, *newst;
+        raxIterator ri;
+
+        if ((newst = activeDefragAlloc(st)))
+            defragged++, ob->ptr = st = newst;
+
+        /* The nodes ziplists are moved updating the value of their key in
+         * place, that does not change the tree structure. */
+        raxStart(&ri,st->rax);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) {
+            unsigned char *newzl;
+            if ((newzl = activeDefragAlloc(ri.data))) {
+                raxInsert(st->rax,ri.key,ri.key_len,newzl,NULL);
+                defragged++;
+            }
+        }
+        raxStop(&ri);
+    } else if (ob->type == REDIS_MODULE) {
+        /* The values of the modules are opaque, only the wrapper moves. */
+        moduleValue *mv = ob->ptr, *newmv;
+        if ((newmv = activeDefragAlloc(mv)))
+            defragged++, ob->ptr = newmv;
+    } else {
+        redisPanic("Unknown object type");
+    }
+    return defragged;
+}
+
+/* Defrag scan callback for the main db dictionary. */
+static void defragScanCallback(void *privdata, const dictEntry *de) {
+    long defragged = defragKey((dictEntry*)de);
+
+    REDIS_NOTUSED(privdata);
+    server.stat_active_defrag_hits += defragged;
+    if (defragged)
+        server.stat_active_defrag_key_hits++;
+    else
+        server.stat_active_defrag_key_misses++;
+}
+
+/* Defrag scan bucket callback for the main db dictionary. Moving an entry
+ * moves the key name embedded in it as well, so the pointers to the key in
+ * the expires dict and in the cluster slots to keys map are updated.
+ *
+ * 主字典的节点内嵌键名，移动节点后需要更新过期字典和槽字典中对键名的引用 */
+static void defragDbBucketCallback(void *privdata, dictEntry **bucketref) {
+    redisDb *db = privdata;
+    long defragged = 0;
+
+    while(*bucketref) {
+        dictEntry *de = *bucketref, *newde;
+        sds oldkey = dictGetKey(de), newkey = NULL;
+        size_t keyoffset = (char*)oldkey - (char*)de;
+        uint64_t hash;
+
+        if ((newde = activeDefragAlloc(de))) {
+            newkey = (char*)newde + keyoffset;
+            newde->key = newkey;
+            *bucketref = de = newde;
+            defragged++;
+        }
+        /* Dirty code: oldkey may be a dead pointer now, the satellite dicts
+         * are searched by pointer with the hash of the live key. */
+        hash = dictHashKey(db->dict, de->key);
+        if (dictSize(db->expires))
+            replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, oldkey,
+                newkey, hash, &defragged);
+        if (server.cluster_enabled) {
+            dict *sd = server.cluster->slots_to_keys[keyHashSlot(de->key,
+                                                    sdslen(de->key))];
+            if (sd) replaceSateliteDictKeyPtrAndOrDefragDictEntry(sd, oldkey,
+                newkey, hash, &defragged);
+        }
+        bucketref = &(*bucketref)->next;
+    }
+    server.stat_active_defrag_hits += defragged;
+}
+
+/* Utility function to get the fragmentation ratio from jemalloc.
+ * It is critical to do that by comparing only heap maps that belown to
+ * jemalloc, and skip ones the jemalloc keeps as spare. Since we use this
+ * fragmentation ratio in order to decide if a defrag action should be taken
+ * or not, a false detection can cause the defragmenter to waste a lot of CPU
+ * without the possibility of getting any results. */
+static float getAllocatorFragmentation(size_t *out_frag_bytes) {
+    size_t allocated, active, resident;
+    float frag_pct;
+    size_t frag_bytes;
+
+    if (!zmalloc_get_allocator_info(&allocated,&active,&resident)) {
+        /* The allocator can't report its active pages: fall back to the
+         * RSS, which also counts the pages not yet returned to the OS. */
+        allocated = zmalloc_used_memory();
+        active = resident = zmalloc_get_rss();
+    }
+    if (allocated == 0 || active <= allocated) {
+        if (out_frag_bytes) *out_frag_bytes = 0;
+        return 0;
+    }
+    frag_pct = ((float)active / allocated)*100 - 100;
+    frag_bytes = active - allocated;
+    if (out_frag_bytes) *out_frag_bytes = frag_bytes;
+    redisLog(REDIS_DEBUG,
+        "allocated=%zu, active=%zu, resident=%zu, frag=%.0f%%, frag_bytes=%zu",
+        allocated, active, resident, frag_pct, frag_bytes);
+    return frag_pct;
+}
+
+#define INTERPOLATE(x, x1, x2, y1, y2) ( (y1) + ((x)-(x1)) * ((y2)-(y1)) / ((x2)-(x1)) )
+#define LIMIT(y, min, max) ((y)<(min)? min: ((y)>(max)? max: (y)))
+
+/* Perform incremental defragmentation work from the serverCron.
+ * This works in a similar way to activeExpireCycle, in the sense that
+ * we do incremental work across calls.
+ *
+ * 以 activeExpireCycle 类似的方式，每次调用只执行有限时间的整理工作，
+ * 游标和当前数据库保存在静态变量中，下次调用从中断的地方继续
+ */
+void activeDefragCycle(void) {
+    static int current_db = -1;
+    static unsigned long cursor = 0;
+    static redisDb *db = NULL;
+    static long long start_scan, start_stat;
+    unsigned int iterations = 0;
+    unsigned long long defragged = server.stat_active_defrag_hits;
+    long long start, timelimit;
+
+    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1)
+        return; /* Defragging memory while there's a fork will just do damage. */
+
+    /* Once a second, check if we the fragmentation justfies starting a scan
+     * or making it more aggressive. */
+    run_with_period(1000) {
+        size_t frag_bytes;
+        float frag_pct = getAllocatorFragmentation(&frag_bytes);
+        int cpu_pct;
+
+        /* If we're not already running, and below the threshold, exit. */
+        if (!server.active_defrag_running) {
+            if (frag_pct < server.active_defrag_threshold_lower ||
+                frag_bytes < server.active_defrag_ignore_bytes)
+                return;
+        }
+
+        /* Calculate the adaptive aggressiveness of the defrag */
+        cpu_pct = INTERPOLATE(frag_pct,
+                server.active_defrag_threshold_lower,
+                server.active_defrag_threshold_upper,
+                server.active_defrag_cycle_min,
+                server.active_defrag_cycle_max);
+        cpu_pct = LIMIT(cpu_pct,
+                server.active_defrag_cycle_min,
+                server.active_defrag_cycle_max);
+         /* We allow increasing the aggressiveness during a scan, but don't
+          * reduce it. */
+        if (!server.active_defrag_running ||
+            cpu_pct > server.active_defrag_running)
+        {
+            server.active_defrag_running = cpu_pct;
+            redisLog(REDIS_VERBOSE,
+                "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, cpu=%d%%",
+                frag_pct, frag_bytes, cpu_pct);
+        }
+    }
+    if (!server.active_defrag_running)
+        return;
+
+    /* See activeExpireCycle for how timelimit is handled. */
+    start = ustime();
+    timelimit = 1000000*server.active_defrag_running/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
+
+    do {
+        if (!cursor) {
+            /* Move on to next database, and stop if we reached the last one. */
+            if (++current_db >= server.dbnum) {
+                long long now = ustime();
+                size_t frag_bytes;
+                float frag_pct = getAllocatorFragmentation(&frag_bytes);
+                redisLog(REDIS_VERBOSE,
+                    "Active defrag done in %dms, reallocated=%d, frag=%.0f%%, frag_bytes=%zu",
+                    (int)((now - start_scan)/1000),
+                    (int)(server.stat_active_defrag_hits - start_stat),
+                    frag_pct, frag_bytes);
+
+                start_scan = now;
+                current_db = -1;
+                cursor = 0;
+                db = NULL;
+                server.active_defrag_running = 0;
+                return;
+            } else if (current_db == 0) {
+                /* Start a scan from the first database. */
+                start_scan = ustime();
+                start_stat = server.stat_active_defrag_hits;
+            }
+
+            db = &server.db[current_db];
+            cursor = 0;
+            // 顺便整理数据库字典自身的哈希表
+            server.stat_active_defrag_hits += dictDefragTables(db->dict);
+            server.stat_active_defrag_hits += dictDefragTables(db->expires);
+        }
+
+        do {
+            cursor = dictScan(db->dict, cursor, defragScanCallback,
+                              defragDbBucketCallback, db);
+            /* Once in 16 scan iterations, or 1000 pointer reallocations
+             * (if we have a lot of pointers in one hash bucket), check if we
+             * reached the time limit. */
+            if (cursor && (++iterations > 16 ||
+                server.stat_active_defrag_hits - defragged > 1000))
+            {
+                if ((ustime() - start) > timelimit) {
+                    return;
+                }
+                iterations = 0;
+                defragged = server.stat_active_defrag_hits;
+            }
+        } while(cursor);
+    } while(1);
+}
+
+#else /* HAVE_DEFRAG */
+
+void activeDefragCycle(void) {
+    /* Not supported by this allocator, see HAVE_DEFRAG in zmalloc.h. */
+}
+
+#endif
@@ -47,6 +47,10 @@
 #include "zmalloc.h"
 #include "redisassert.h"
 
+/* random() returns 31 bits: combine two calls so that every bucket of the
+ * tables larger than 2^31 can be picked. */
+#define randomULong() (((unsigned long)random() << 31) ^ (unsigned long)random())
+
 /* Using dictEnableResize() / dictDisableResize() we make possible to
  * enable/disable resizing of the hash table as needed. 
  * 
@@ -86,11 +90,20 @@ static int dict_can_resize = 1;
 // 强制 rehash 的比率
 static unsigned int dict_force_resize_ratio = 5;
 
+/* With dictDisableRehash() a rehashing already in progress is paused too:
+ * lookups and updates no longer move buckets from ht[0] to ht[1], since
+ * this writes to the entries and the two tables, that is, pages shared
+ * with a child. The new elements still go in ht[1], so the rehashing
+ * resumes anyway once ht[1] is loaded beyond dict_force_resize_ratio.
+ *
+ * 有子进程时暂停渐进式 rehash ，除非 ht[1] 的负载过高 */
+static int dict_can_rehash = 1;
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
+static long _dictKeyIndex(dict *d, const void *key, dictht **ht);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
 /* -------------------------- hash functions -------------------------------- */
@@ -116,82 +129,124 @@ unsigned int dictIdentityHashFunction(unsigned int key)
     return key;
 }
 
-static uint32_t dict_hash_function_seed = 5381;
+/* The seed of the hash functions, set to a random value at startup so that
+ * the hash values of the keys can't be predicted from the outside. */
+static uint8_t dict_hash_function_seed[16];
 // 其他文件利用 dictSetHashFunctionSeed() 来访问 dict_hash_function_seed，确保 dict_hash_function_seed 无法被随意修改
 // 保护了 dict_hash_function_seed 的 private 特性，仅仅能通过 dict_hash_function_seed\dictGetHashFunctionSeed 来访问
-void dictSetHashFunctionSeed(uint32_t seed) {
-    dict_hash_function_seed = seed;
+void dictSetHashFunctionSeed(uint8_t *seed) {
+    memcpy(dict_hash_function_seed,seed,sizeof(dict_hash_function_seed));
 }
 
-uint32_t dictGetHashFunctionSeed(void) {
+uint8_t *dictGetHashFunctionSeed(void) {
     return dict_hash_function_seed;
 }
 
-/* MurmurHash2, by Austin Appleby
+/* The hash of the keys is 64 bit, so that tables larger than 2^32 buckets
+ * still get a well distributed index from the low bits of the hash.
+ *
+ * Two hash functions are available, selected at compile time:
+ *
+ * - MurmurHash64A (default): the 64 bit version of MurmurHash2, mixing 8
+ *   bytes per round. It is the fastest, but an attacker able to choose the
+ *   keys can find collisions for any seed.
+ * - SipHash-1-3 (DICT_HASH_SIPHASH, "make DICT_HASH=siphash"): a keyed hash
+ *   resistant to hash flooding, a bit slower on long keys.
+ *
+ * 哈希值为 64 位，编译时可以在 MurmurHash64A（默认，最快）和
+ * SipHash-1-3（可以防止碰撞攻击）中选择 */
+uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+
+/* MurmurHash64A, by Austin Appleby
  * Note - This code makes a few assumptions about how your machine behaves -（这个设计的前提）
- * 1. We can read a 4-byte value from any address without crashing
- * 2. sizeof(int) == 4（linux 64 bit 系统都满足，出来的是 uint32_t）
+ * 1. We can read a 8-byte value from any address with memcpy()
  *
  * And it has a few limitations -
  *
  * 1. It will not work incrementally.
  * 2. It will not produce the same results on little-endian and big-endian
  *    machines.
- * 
+ *
  * 非加密 hash，计算出来的 hash code 具有良好的随机分布特性
- * 算出来的也是 uint32_t 的 hash code
+ * 当 nocase 为真时，按照小写字母计算哈希值（调用处为常量，编译时展开）
  */
-unsigned int dictGenHashFunction(const void *key, int len) {
+static inline uint64_t dictMurmurHash64A(const void *key, int len, int nocase) {
     /* 'm' and 'r' are mixing constants generated offline.
      They're not really 'magic', they just happen to work well.  */
-    uint32_t seed = dict_hash_function_seed;
-    const uint32_t m = 0x5bd1e995;
-    const int r = 24;
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t seed;
+
+    memcpy(&seed,dict_hash_function_seed,sizeof(seed));
 
     /* Initialize the hash to a 'random' value */
-    uint32_t h = seed ^ len;    // 长度通常是会不停变化的（虽然重合率也很高）
+    uint64_t h = seed ^ (len * m);   // 长度通常是会不停变化的（虽然重合率也很高）
 
-    /* Mix 4 bytes（unsigned char *） at a time into the hash */
+    /* Mix 8 bytes at a time into the hash */
     const unsigned char *data = (const unsigned char *)key;
+    const unsigned char *end = data + (len - (len & 7));
 
-    while(len >= 4) {   // 对于 key 指针指向的字符串，每次取出 4 Byte 的数据来进行运算，不断循环，直到所有的字符都用完
-        uint32_t k = *(uint32_t*)data;
+    while(data != end) {   // 每次取出 8 Byte 的数据来进行运算，直到剩余不足 8 Byte
+        uint64_t k;
+
+        if (nocase) {
+            int j;
+            unsigned char buf[8];
+            for (j = 0; j < 8; j++) buf[j] = tolower(data[j]);
+            memcpy(&k,buf,sizeof(k));
+        } else {
+            memcpy(&k,data,sizeof(k));
+        }
 
         k *= m;
         k ^= k >> r;
         k *= m;
 
-        h *= m;
         h ^= k;
+        h *= m;
 
-        data += 4;
-        len -= 4;
+        data += 8;
     }
 
     /* Handle the last few bytes of the input array  */
-    switch(len) {
-    case 3: h ^= data[2] << 16;
-    case 2: h ^= data[1] << 8;
-    case 1: h ^= data[0]; h *= m;
+#define MURMURBYTE(j) ((uint64_t)(nocase ? tolower(data[j]) : data[j]))
+    switch(len & 7) {
+    case 7: h ^= MURMURBYTE(6) << 48;
+    case 6: h ^= MURMURBYTE(5) << 40;
+    case 5: h ^= MURMURBYTE(4) << 32;
+    case 4: h ^= MURMURBYTE(3) << 24;
+    case 3: h ^= MURMURBYTE(2) << 16;
+    case 2: h ^= MURMURBYTE(1) << 8;
+    case 1: h ^= MURMURBYTE(0); h *= m;
     };
+#undef MURMURBYTE
 
     /* Do a few final mixes of the hash to ensure the last few
      * bytes are well-incorporated. */
-    h ^= h >> 13;
+    h ^= h >> r;
     h *= m;
-    h ^= h >> 15;
+    h ^= h >> r;
 
-    return (unsigned int)h;
+    return h;
 }
 
-/* And a case insensitive hash function (based on djb hash) */
-// 大小写没有感知的 hash，同样也是算出 uint32_t 的 hash code
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = (unsigned int)dict_hash_function_seed;
+uint64_t dictGenHashFunction(const void *key, int len) {
+#ifdef DICT_HASH_SIPHASH
+    return siphash(key,len,dict_hash_function_seed);
+#else
+    return dictMurmurHash64A(key,len,0);
+#endif
+}
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (tolower(*buf++)); /* hash * 33 + c */
-    return hash;
+/* And a case insensitive hash function */
+// 大小写没有感知的 hash
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
+#ifdef DICT_HASH_SIPHASH
+    return siphash_nocase(buf,len,dict_hash_function_seed);
+#else
+    return dictMurmurHash64A(buf,len,1);
+#endif
 }
 
 /* ----------------------------- API implementation ------------------------- */
@@ -213,6 +268,54 @@ static void _dictReset(dictht *ht)  // dict hash table
     ht->used = 0;       // 用来计算 hash 冲突比 ratio
 }
 
+/* Allocate the empty table of a hash table of 'size' buckets: the buckets
+ * themselves for small tables, only the array of segments for big ones. */
+static dictEntry **_dictHtAllocTable(unsigned long size) {
+    if (size > DICT_HT_SEGMENT_SIZE)
+        return zcalloc((size>>DICT_HT_SEGMENT_EXP)*sizeof(dictEntry**));
+    return zcalloc(size*sizeof(dictEntry*));
+}
+
+/* Release the table of 'ht' with all its segments, not the entries. */
+static void _dictHtFreeTable(dictht *ht) {
+    if (dictHtIsSegmented(ht)) {
+        dictEntry ***segments = (dictEntry***)ht->table;
+        unsigned long j;
+
+        for (j = 0; j < dictHtSegments(ht); j++) zfree(segments[j]);
+    }
+    zfree(ht->table);
+}
+
+/* Like dictHtBucketRef() but allocates the segment of the bucket if needed,
+ * used when an entry is linked into the bucket. */
+static dictEntry **_dictHtBucketRefAlloc(dictht *ht, unsigned long idx) {
+    dictEntry ***segments;
+    unsigned long j = idx>>DICT_HT_SEGMENT_EXP;
+
+    if (!dictHtIsSegmented(ht)) return ht->table+idx;
+    segments = (dictEntry***)ht->table;
+    if (segments[j] == NULL)
+        segments[j] = zcalloc(DICT_HT_SEGMENT_SIZE*sizeof(dictEntry*));
+    return segments[j]+(idx&DICT_HT_SEGMENT_MASK);
+}
+
+/* Move the rehashing index of 'd' to the next bucket of ht[0]. When a whole
+ * segment of ht[0] was moved it is released, since no entry will be ever
+ * stored there again. */
+static void _dictRehashAdvance(dict *d) {
+    dictht *ht = &d->ht[0];
+
+    d->rehashidx++;
+    if (dictHtIsSegmented(ht) && (d->rehashidx & DICT_HT_SEGMENT_MASK) == 0) {
+        dictEntry ***segments = (dictEntry***)ht->table;
+        unsigned long j = (d->rehashidx-1)>>DICT_HT_SEGMENT_EXP;
+
+        zfree(segments[j]);
+        segments[j] = NULL;
+    }
+}
+
 /* Create a new hash table */
 /*
  * 创建一个新的字典
@@ -332,7 +435,8 @@ int dictExpand(dict *d, unsigned long size)
     n.size = realsize;
     n.sizemask = realsize-1;
     // T = O(N)
-    n.table = zcalloc(realsize*sizeof(dictEntry*)); // 申请所有 hash table entry 的内存，且将所有指针指向 NULL, C 语言才能做到的才做，POD 类型的对象也可以
+    // 小表申请所有 hash table entry 的内存，且将所有指针指向 NULL；大表只申请段指针数组，段按需分配
+    n.table = _dictHtAllocTable(realsize);
     n.used = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
@@ -396,14 +500,14 @@ int dictRehash(dict *d, int n) {
     // 进行 N 步迁移
     // T = O(N)
     while(n--) {
-        dictEntry *de, *nextde; // 因为 ht[0] 里面的每一个 entry 都是一条单向链表，nextde 是用来记住链表的下一个 entry 的
+        dictEntry *de, *nextde, **bucketref; // 因为 ht[0] 里面的每一个 entry 都是一条单向链表，nextde 是用来记住链表的下一个 entry 的
 
         /* Check if we already rehashed the whole table... */
         // 如果 0 号哈希表为空，那么表示 rehash 执行完毕
         // T = O(1)
         if (d->ht[0].used == 0) {
             // 释放 0 号哈希表
-            zfree(d->ht[0].table);
+            _dictHtFreeTable(&d->ht[0]);
             // 将原来的 1 号哈希表设置为新的 0 号哈希表
             d->ht[0] = d->ht[1];
             // 重置旧的 1 号哈希表
@@ -418,22 +522,30 @@ int dictRehash(dict *d, int n) {
          * elements because ht[0].used != 0 */
         // 确保 rehashidx 没有越界，否则可能引发 crash
         // 当 d->ht[0].size <= d->rehashidx 的时候，其实也就意味着：已经 rehash 完成了，这时候，理应在上面就 return 0 了
-        assert(d->ht[0].size > (unsigned)d->rehashidx);
+        assert(d->ht[0].size > (unsigned long)d->rehashidx);
 
         /* find the entry need to be rehash in ht[0](old hash table) */
         // 略过数组中为空的索引（已经 rehash 到了 ht[1]），找到下一个非空索引（下一个需要 rehash 到 ht[1] 的 entry）
         // TODO: 就不怕 ++ 的时候，rehashidx 超过了 ht[0].size 吗？
         // 不会，因为上面的 if (d->ht[0].used == 0) 就已经保证了：接下来继续遍历整个 ht[0] 里面的数组，肯定有 d->ht[0].table[d->rehashidx] != NULL
-        while(d->ht[0].table[d->rehashidx] == NULL) d->rehashidx++;
+        // 未分配的段整段略过
+        while((bucketref = dictHtBucketRef(&d->ht[0],d->rehashidx)) == NULL ||
+              *bucketref == NULL)
+        {
+            if (bucketref == NULL)
+                d->rehashidx = (d->rehashidx|DICT_HT_SEGMENT_MASK)+1;
+            else
+                _dictRehashAdvance(d);
+        }
 
         // 指向该索引的链表表头节点
-        de = d->ht[0].table[d->rehashidx];
+        de = *bucketref;
 
         /* Move all the keys in this bucket from the old to the new hash HT */
         // 将链表中的所有节点迁移到新哈希表
         // T = O(K)，这个 hash bucket 里面的链表有多长
         while(de) {
-            unsigned int h; // 这个 entry 应该放到 d->ht[1].table 的哪一个 index 
+            uint64_t h; // 这个 entry 应该放到 d->ht[1].table 的哪一个 index 
 
             // 保存下个节点的指针
             nextde = de->next;
@@ -446,8 +558,9 @@ int dictRehash(dict *d, int n) {
             h = dictHashKey(d, de->key) & d->ht[1].sizemask;
 
             // 插入节点到新哈希表（向链表头插入）
-            de->next = d->ht[1].table[h];
-            d->ht[1].table[h] = de;
+            bucketref = _dictHtBucketRefAlloc(&d->ht[1],h);
+            de->next = *bucketref;
+            *bucketref = de;
 
             // 更新计数器
             d->ht[0].used--;
@@ -458,9 +571,9 @@ int dictRehash(dict *d, int n) {
         }   // end of this hash table bucket single-link-list handle
 
         // 将刚迁移完的哈希表索引的指针设为空
-        d->ht[0].table[d->rehashidx] = NULL;
+        *dictHtBucketRef(&d->ht[0],d->rehashidx) = NULL;
         // 更新 rehash 索引
-        d->rehashidx++;
+        _dictRehashAdvance(d);
     }   // finish handle for the specified hash buckets(n)
 
     return 1;
@@ -522,7 +635,11 @@ int dictRehashMilliseconds(dict *d, int ms) {
  * T = O(1)
  */
 static void _dictRehashStep(dict *d) {
-    if (d->iterators == 0) dictRehash(d,1);
+    if (d->iterators != 0) return;
+    if (!dict_can_rehash &&
+        (d->ht[0].used+d->ht[1].used)/d->ht[1].size <= dict_force_resize_ratio)
+        return;
+    dictRehash(d,1);
 }
 
 /* Add an element to the target hash table */
@@ -579,8 +696,8 @@ int dictAdd(dict *d, void *key, void *val)  // add key-value into dict
  */
 dictEntry *dictAddRaw(dict *d, void *key)
 {
-    int index;
-    dictEntry *entry;
+    long index;
+    dictEntry *entry, **bucketref;
     dictht *ht;
 
     // 如果条件允许的话，进行单步 rehash
@@ -595,29 +712,33 @@ dictEntry *dictAddRaw(dict *d, void *key)
     // 如果值为 -1 ，那么表示键已经存在
     // NOTE: 这一步还没有把 entry 加入 dict(hash table) 里面的
     // T = O(N)
-    if ((index = _dictKeyIndex(d, key)) == -1)  // 检查加入当前 key 的可能性，并试算 hash code 是多少
+    // ht 被设置为新键应该加入的哈希表
+    if ((index = _dictKeyIndex(d, key, &ht)) == -1)  // 检查加入当前 key 的可能性，并试算 hash code 是多少
         return NULL;    // 避免重复创建
 
     // T = O(1)
     /* Allocate the memory and store the new entry */
     // NOTE: 到了这一步，才会真正的把 entry 创建出来，并加入 dict 的 hash table 里面
-    // 如果字典正在 rehash ，那么将新键添加到 1 号哈希表
-    // 否则，将新键添加到 0 号哈希表
-    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    // 为新节点分配空间
-    entry = zmalloc(sizeof(*entry));
+    // 为新节点分配空间，嵌入键时键和节点使用同一块内存
+    if (d->type->keyEmbed) {
+        entry = zmalloc(sizeof(*entry)+d->type->keyEmbedSize(key));
+        entry->key = d->type->keyEmbed(entry+1, key);
+    } else {
+        entry = zmalloc(sizeof(*entry));
+
+        /* Set the hash entry fields. */
+        // 设置新节点的键
+        // T = O(1)
+        // 把 key 的具体值，根据当前的 dict 的 key 拷贝赋值函数，完成拷贝动作
+        dictSetKey(d, entry, key);
+    }
     // 将新节点插入到链表表头（头插法）
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    bucketref = _dictHtBucketRefAlloc(ht,index);
+    entry->next = *bucketref;
+    *bucketref = entry;
     // 更新哈希表已使用节点数量
     ht->used++;
 
-    /* Set the hash entry fields. */
-    // 设置新节点的键
-    // T = O(1)
-    // 把 key 的具体值，根据当前的 dict 的 key 拷贝赋值函数，完成拷贝动作
-    dictSetKey(d, entry, key);
-
     return entry;
 }
 
@@ -715,7 +836,7 @@ dictEntry *dictReplaceRaw(dict *d, void *key) {
 // 根据 entry 的 key 在对应的 dict 中进行删除
 static int dictGenericDelete(dict *d, const void *key, int nofree)
 {
-    unsigned int h, idx;
+    uint64_t h, idx;
     dictEntry *he, *prevHe;
     int table;
 
@@ -735,7 +856,7 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
         // 计算索引值 
         idx = h & d->ht[table].sizemask;
         // 指向该索引上的链表
-        he = d->ht[table].table[idx];
+        he = dictHtBucket(&d->ht[table],idx);
         prevHe = NULL;  // 单向链表，在删除节点的时候，需要记住 prev_node 才能正常维护链表
         // 遍历链表上的所有节点
         // T = O(1)
@@ -749,7 +870,7 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
                 if (prevHe) // 要删除的 entry 是中间节点
                     prevHe->next = he->next;
                 else        // 要删除的 entry 是头节点
-                    d->ht[table].table[idx] = he->next;
+                    *dictHtBucketRef(&d->ht[table],idx) = he->next;
 
                 // 释放调用键和值的释放函数？
                 // TODO: 如何确保在 nofree 的情况下，依旧能够正常释放 key 跟 value，不造成内存泄漏？
@@ -826,7 +947,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
         // 跳过空索引
-        if ((he = ht->table[i]) == NULL) continue;
+        if ((he = dictHtBucket(ht,i)) == NULL) continue;
 
         // 遍历、删除整个链表
         // T = O(1)
@@ -849,7 +970,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 
     /* Free the table and the allocated cache structure */
     // 释放哈希表结构
-    zfree(ht->table);
+    _dictHtFreeTable(ht);
 
     /* Re-initialize the table */
     // 重置哈希表属性
@@ -885,7 +1006,7 @@ void dictRelease(dict *d)
 dictEntry *dictFind(dict *d, const void *key)
 {
     dictEntry *he;
-    unsigned int h, idx, table;
+    uint64_t h, idx, table;
 
     // 字典（的哈希表）为空
     if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
@@ -904,7 +1025,7 @@ dictEntry *dictFind(dict *d, const void *key)
         idx = h & d->ht[table].sizemask;
 
         // 遍历给定索引上的链表的所有节点，查找 key
-        he = d->ht[table].table[idx];
+        he = dictHtBucket(&d->ht[table],idx);
         // T = O(1)
         while(he) {
 
@@ -941,6 +1062,35 @@ void *dictFetchValue(dict *d, const void *key) {
     return he ? dictGetVal(he) : NULL;
 }
 
+/* Finds the dictEntry reference by using pointer and pre-calculated hash.
+ * oldkey is a dead pointer and should not be accessed.
+ * the hash value should be provided using dictHashKey.
+ * no string / key comparison is performed.
+ * return value is the reference to the dictEntry if found, or NULL if not found.
+ *
+ * 只比较 key 的指针（不解引用），返回指向该节点的指针的地址，
+ * 供 active defrag 在 key 被重新分配之后替换节点或者更新 key 指针
+ */
+dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash) {
+    dictEntry *he, **heref;
+    unsigned long idx, table;
+
+    if (d->ht[0].size == 0) return NULL; /* dict is empty */
+    for (table = 0; table <= 1; table++) {
+        idx = hash & d->ht[table].sizemask;
+        heref = dictHtBucketRef(&d->ht[table],idx);
+        he = heref ? *heref : NULL;
+        while(he) {
+            if (oldptr==he->key)
+                return heref;
+            heref = &he->next;
+            he = *heref;
+        }
+        if (!dictIsRehashing(d)) return NULL;
+    }
+    return NULL;
+}
+
 /* A fingerprint is a 64 bit number that represents the state of the dictionary
  * at a given time, it's just a few dict properties xored together.
  * When an unsafe iterator is initialized, we get the dict fingerprint, and check
@@ -1048,7 +1198,7 @@ dictEntry *dictNext(dictIterator *iter)
             // 那么说明这个哈希表已经迭代完毕
             // int iter->index; unsigned long; 为了避免溢出，在比较之前就要强制转换
             // TODO: 这样真的安全吗？ size 强制转换之后，不就变小了吗？岂不是会有一些 bucket 没有检查？
-            if (iter->index >= (signed) ht->size) {
+            if (iter->index >= (long) ht->size) {
                 // 如果正在 rehash 的话，那么说明 1 号哈希表也正在使用中
                 // 那么继续对 1 号哈希表进行迭代
                 if (dictIsRehashing(iter->d) && iter->table == 0) {
@@ -1064,7 +1214,7 @@ dictEntry *dictNext(dictIterator *iter)
             // 如果进行到这里，说明这个哈希表并未迭代完
             // 更新节点指针，指向下个索引链表的表头节点
             // 本轮的节点迭代更新
-            iter->entry = ht->table[iter->index];
+            iter->entry = dictHtBucket(ht,iter->index);
         } else {
             // 执行到这里，说明程序正在迭代某个链表
             // 将节点指针指向链表的下个节点
@@ -1124,7 +1274,7 @@ void dictReleaseIterator(dictIterator *iter)
 dictEntry *dictGetRandomKey(dict *d)
 {
     dictEntry *he, *orighe;
-    unsigned int h;
+    unsigned long h;
     int listlen, listele;
 
     // 字典为空
@@ -1139,16 +1289,16 @@ dictEntry *dictGetRandomKey(dict *d)
     if (dictIsRehashing(d)) {
         // T = O(N)
         do {
-            h = random() % (d->ht[0].size+d->ht[1].size);   // ht[0] + ht[1] 都是随机目标的范围
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] : // 落在了 ht[1] 上，换算出 ht[1] 的 index
-                                      d->ht[0].table[h];    // 落在了 ht[0] 上
+            h = randomULong() % (d->ht[0].size+d->ht[1].size);   // ht[0] + ht[1] 都是随机目标的范围
+            he = (h >= d->ht[0].size) ? dictHtBucket(&d->ht[1],h - d->ht[0].size) : // 落在了 ht[1] 上，换算出 ht[1] 的 index
+                                      dictHtBucket(&d->ht[0],h);    // 落在了 ht[0] 上
         } while(he == NULL);    // 当前的字典一定不为空
     // 否则，只从 0 号哈希表中查找节点
     } else {
         // T = O(N)
         do {
-            h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            h = randomULong() & d->ht[0].sizemask;
+            he = dictHtBucket(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -1187,31 +1337,73 @@ dictEntry *dictGetRandomKey(dict *d)
  *
  * The function returns the number of items stored into 'des', that may
  * be less than 'count' if the hash table has less than 'count' elements
- * inside.
+ * inside, or if not enough elements were found in a reasonable amount of
+ * steps (at most count*10 buckets are visited).
  *
  * Note that this function is not suitable when you need a good distribution
  * of the returned items, but only when you need to "sample" a given number
  * of continuous elements to run some kind of algorithm or to produce
- * statistics. However the function is much faster than dictGetRandomKey()
- * at producing N elements, and the elements are guaranteed to be non
- * repeating. */
+ * statistics. To reduce the correlation between the returned elements, the
+ * scan jumps to a new random place of the table every time a run of empty
+ * buckets is found, so the elements may be repeated in the unlikely case
+ * the same buckets are visited twice. However the function is much faster
+ * than dictGetRandomKey() at producing N elements. */
 // 这个函数返回的 entry，并不会很均衡的分散在 dict 中，虽然比较快，但是分散度不太好
-// 返回的都是连续的 entry，在 hash table 上面连续
+// 返回的基本都是连续的 entry，遇到连续的空 bucket 时会跳到新的随机位置
 int dictGetRandomKeys(dict *d, dictEntry **des, int count) {    // dictEntry **des 管理节点的内存需要调用者自行保证 
-    int j; /* internal hash table id, 0 or 1. */
-    int stored = 0; // 目前找到了几个随机 key ？
-
-    if (dictSize(d) < count) count = dictSize(d);   // 避免返回重复的 key
-    while(stored < count) { // 还没有找够
-        for (j = 0; j < 2; j++) {
-            /* Pick a random point inside the hash table 0 or 1. */
-            unsigned int i = random() & d->ht[j].sizemask;  // 随机的 index
-            int size = d->ht[j].size;
-
-            /* Make sure to visit every bucket by iterating 'size' times. */
-            /* random index 是从哪里开始，永远都是最多遍历 size 次，每一个 ht 的 bucket 最多只会遍历一遍，避免产生重复的 key */
-            while(size--) {
-                dictEntry *he = d->ht[j].table[i];
+    unsigned long j; /* internal hash table id, 0 or 1. */
+    unsigned long tables; /* 1 or 2 tables? */
+    unsigned long stored = 0, maxsizemask;
+    unsigned long maxsteps;
+    unsigned long i, emptylen = 0;
+
+    if (dictSize(d) < (unsigned long)count) count = dictSize(d);   // 避免返回重复的 key
+    maxsteps = count*10;
+
+    /* Try to do a rehashing work proportional to 'count'. */
+    for (j = 0; j < (unsigned long)count; j++) {
+        if (dictIsRehashing(d))
+            _dictRehashStep(d);
+        else
+            break;
+    }
+
+    tables = dictIsRehashing(d) ? 2 : 1;
+    maxsizemask = d->ht[0].sizemask;
+    if (tables > 1 && maxsizemask < d->ht[1].sizemask)
+        maxsizemask = d->ht[1].sizemask;
+
+    /* Pick a random point inside the larger table. */
+    i = randomULong() & maxsizemask;
+    while(stored < (unsigned long)count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            dictEntry *he;
+
+            /* Invariant of the dict.c rehashing: up to the indexes already
+             * visited in ht[0] during the rehashing, there are no populated
+             * buckets, so we can skip ht[0] for indexes between 0 and idx-1. */
+            // rehash 时 ht[0] 中 rehashidx 之前的 bucket 都已经是空的了
+            if (tables == 2 && j == 0 && i < (unsigned long) d->rehashidx) {
+                /* Moreover, if we are out of range in the second
+                 * table, there will be no elements in both tables up to
+                 * the current rehashing index, so we jump if possible.
+                 * (this happens when going from big to small table). */
+                if (i >= d->ht[1].size) i = d->rehashidx;
+                continue;
+            }
+            if (i >= d->ht[j].size) continue; /* Out of range for this table. */
+            he = dictHtBucket(&d->ht[j],i);
+
+            /* Count contiguous empty buckets, and jump to other
+             * locations if they reach 'count' (with a minimum of 5). */
+            if (he == NULL) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > (unsigned long)count) {
+                    i = randomULong() & maxsizemask;
+                    emptylen = 0;
+                }
+            } else {
+                emptylen = 0;
                 while (he) {    // 整个 bucket 的 link-list 都遍历完了
                     /* Collect all the elements of the buckets found non
                      * empty while iterating. */
@@ -1219,18 +1411,13 @@ int dictGetRandomKeys(dict *d, dictEntry **des, int count) {    // dictEntry **d
                     des++;
                     he = he->next;
                     stored++;
-                    if (stored == count) return stored; // 正常的返回点，正常情况下只会在这里返回
+                    if (stored == (unsigned long)count) return stored; // 正常的返回点
                 }
-                i = (i+1) & d->ht[j].sizemask;  // 相邻的 bucket
             }
-            /* If there is only one table and we iterated it all, we should
-             * already have 'count' elements. Assert this condition. */
-            // TODO: 什么情况、场景下会调用 dictGetRandomKeys(), 进而要求 assert(dictIsRehashing(d) != 0) 必须程利
-            // 是随机 rehash 吗？
-            assert(dictIsRehashing(d) != 0);
         }
+        i = (i+1) & maxsizemask;    // 相邻的 bucket
     }
-    return stored; /* Never reached. */
+    return stored;
 }
 
 /* Function to reverse bits. Algorithm from:
@@ -1276,6 +1463,10 @@ static unsigned long rev(unsigned long v) {
  * 每当一个元素被返回时，回调函数 fn 就会被执行，
  * fn 函数的第一个参数是 privdata ，而第二个参数则是字典节点 de 。
  *
+ * If 'bucketfn' is not NULL it is called, before the entries of a bucket
+ * are emitted, with a reference to the bucket head: this allows the caller
+ * to replace the dictEntry structures themselves (see defrag.c).
+ *
  * HOW IT WORKS.
  * 工作原理
  *
@@ -1395,10 +1586,12 @@ static unsigned long rev(unsigned long v) {
 unsigned long dictScan(dict *d,
                        unsigned long v,
                        dictScanFunction *fn,
+                       dictScanBucketFunction* bucketfn,
                        void *privdata)
 {
     dictht *t0, *t1;    // ht[0]、ht[1]
     const dictEntry *de;
+    dictEntry **bucketref;
     unsigned long m0, m1;   // ht[0].sizemask、ht[1].sizemask
 
     // 跳过空字典
@@ -1415,7 +1608,9 @@ unsigned long dictScan(dict *d,
 
         /* Emit entries at cursor */
         // 指向哈希桶
-        de = t0->table[v & m0];
+        bucketref = dictHtBucketRef(t0,v & m0);
+        if (bucketfn && bucketref) bucketfn(privdata, bucketref);
+        de = bucketref ? *bucketref : NULL;
         // 遍历桶中的所有节点
         while (de) {
             fn(privdata, de);   // 将结果保存到 list 里面，准备返回给 client
@@ -1442,7 +1637,9 @@ unsigned long dictScan(dict *d,
 
         /* Emit entries at cursor */
         // 指向桶，并迭代桶中的所有节点
-        de = t0->table[v & m0];
+        bucketref = dictHtBucketRef(t0,v & m0);
+        if (bucketfn && bucketref) bucketfn(privdata, bucketref);
+        de = bucketref ? *bucketref : NULL;
         while (de) {
             fn(privdata, de);
             de = de->next;
@@ -1456,7 +1653,9 @@ unsigned long dictScan(dict *d,
         do {
             /* Emit entries at cursor */
             // 指向桶，并迭代桶中的所有节点
-            de = t1->table[v & m1];
+            bucketref = dictHtBucketRef(t1,v & m1);
+            if (bucketfn && bucketref) bucketfn(privdata, bucketref);
+            de = bucketref ? *bucketref : NULL;
             while (de) {
                 fn(privdata, de);
                 de = de->next;
@@ -1481,6 +1680,22 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* Return 1 if a scan of 'd' that dictScan() brought to the cursor 'v'
+ * already emitted 'key', 0 otherwise, assuming the key was in the dict
+ * during the whole scan.
+ *
+ * The cursor is incremented in reversed bits order, and the bucket of a key
+ * is given by the low bits of its hash, so the buckets already visited are
+ * the ones whose reversed index is below the reversed cursor, whatever the
+ * size of the tables was when they were visited. 'v' == 0 here means the
+ * scan did not start yet.
+ *
+ * 判断游标 v 之前的扫描是否已经返回过 key ：
+ * 游标按反转的二进制位递增，与哈希表的大小无关 */
+int dictScanVisited(dict *d, const void *key, unsigned long v) {
+    return rev(dictHashKey(d,key)) < rev(v);
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
@@ -1552,11 +1767,14 @@ static unsigned long _dictNextPower(unsigned long size)
  * 返回可以将 key 插入到哈希表的索引位置
  * 如果 key 已经存在于哈希表，那么返回 -1
  *
- * Note that if we are in the process of rehashing the hash table, the
- * index is always returned in the context of the second (new) hash table. (always insert new node into ht[1] during rehashing)
+ * The table the index refers to is stored at 'ht'. Note that if we are in
+ * the process of rehashing the hash table, the key goes to the old table
+ * if its bucket was not moved yet, to the new one otherwise: this way the
+ * new table is only written behind the rehashing index and its segments
+ * are allocated gradually.
  *
- * 注意，如果字典正在进行 rehash ，那么总是返回 1 号哈希表的索引。
- * 因为在字典进行 rehash 时，新节点总是插入到 1 号哈希表。
+ * 索引所属的哈希表保存在 ht 中。rehash 时如果键所在的桶尚未迁移，
+ * 键就加入 0 号哈希表，否则加入 1 号哈希表，这样新表的段只会随着迁移逐步分配。
  *
  * T = O(N)
  */
@@ -1564,9 +1782,9 @@ static unsigned long _dictNextPower(unsigned long size)
 // 注意，这个函数除非发现需要进行 rehash，否则是不会改动 hash table 的！
 // 仅仅是试着算一下：给定的 key 可不可以加入 hash table 里面，可以的话，hash code 又是什么？
 // 甚至不会创建 entry，占住这个 key-value 的 entry
-static int _dictKeyIndex(dict *d, const void *key)
+static long _dictKeyIndex(dict *d, const void *key, dictht **ht)
 {
-    unsigned int h, idx, table;
+    uint64_t h, idx, table;
     dictEntry *he;
 
     /* Expand the hash table if needed */
@@ -1589,7 +1807,7 @@ static int _dictKeyIndex(dict *d, const void *key)
         /* Search if this slot does not already contain the given key */
         // 查找 key 是否存在
         // T = O(1)
-        he = d->ht[table].table[idx];
+        he = dictHtBucket(&d->ht[table],idx);
         while(he) { // 遍历整个 bucket
             if (dictCompareKeys(d, key, he->key))   // 当前这个 key 已经存在吗？
                 return -1;  // 本质上，hash 是不兼容 multi-map 的，你可以针对同一个 key 进行覆盖，但是既然这里这个 key 已经存在了，那你就没办法新建一个 key-value
@@ -1602,7 +1820,14 @@ static int _dictKeyIndex(dict *d, const void *key)
         // 发生 rehash 的时候，还要确认这个 
     }
 
+    // 桶尚未迁移时加入 0 号哈希表
+    if (dictIsRehashing(d) && (h & d->ht[0].sizemask) >= (uint64_t)d->rehashidx) {
+        *ht = &d->ht[0];
+        return h & d->ht[0].sizemask;
+    }
+
     // 返回索引值
+    *ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
     return idx;
 }
 
@@ -1640,6 +1865,19 @@ void dictDisableResize(void) {
     dict_can_resize = 0;
 }
 
+/*
+ * 恢复 / 暂停渐进式 rehash ，见 dict_can_rehash
+ *
+ * T = O(1)
+ */
+void dictEnableRehash(void) {
+    dict_can_rehash = 1;
+}
+
+void dictDisableRehash(void) {
+    dict_can_rehash = 0;
+}
+
 #if 0
 
 /* The following is code that we don't use for Redis currently, but that is part
@@ -1662,14 +1900,13 @@ static void _dictPrintStatsHt(dictht *ht) {
     for (i = 0; i < ht->size; i++) {
         dictEntry *he;
 
-        if (ht->table[i] == NULL) {
+        if ((he = dictHtBucket(ht,i)) == NULL) {
             clvector[0]++;
             continue;
         }
         slots++;
         /* For each hash entry on this slot... */
         chainlen = 0;
-        he = ht->table[i];
         while(he) {
             chainlen++;
             he = he->next;
@@ -1702,7 +1939,7 @@ void dictPrintStats(dict *d) {
 
 /* ----------------------- StringCopy Hash Table Type ------------------------*/
 
-static unsigned int _dictStringCopyHTHashFunction(const void *key)
+static uint64_t _dictStringCopyHTHashFunction(const void *key)
 {
     return dictGenHashFunction(key, strlen(key));
 }
@@ -1764,3 +2001,227 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringDestructor,         /* val destructor */
 };
 #endif
+
+#ifdef DICT_BENCHMARK_MAIN
+
+/* dict-benchmark: compare the hash functions available for the dict tables
+ * and measure the dict operations with the one selected at compile time.
+ *
+ * Usage: ./dict-benchmark [count] [keylen]
+ *
+ * Without 'keylen' the key lengths follow the distribution of a typical
+ * keyspace: half of the keys are short "object:id" names, most of the
+ * others up to 64 bytes and a few long ones.
+ *
+ * 比较各个哈希函数的速度，并测试字典在常见键长分布下的各项操作 */
+
+#include "sds.h"
+
+/* The server provides _redisAssert(): report and quit here. */
+void _redisAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED ===\n");
+    fprintf(stderr,"==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+/* The 32 bit MurmurHash2 used by the dict tables before the 64 bit
+ * hashes, kept as the baseline of the comparison. */
+static uint32_t benchMurmurHash2(const void *key, int len, uint32_t seed) {
+    const uint32_t m = 0x5bd1e995;
+    const int r = 24;
+    uint32_t h = seed ^ len;
+    const unsigned char *data = (const unsigned char *)key;
+
+    while(len >= 4) {
+        uint32_t k;
+
+        memcpy(&k,data,sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        len -= 4;
+    }
+    switch(len) {
+    case 3: h ^= data[2] << 16;
+    case 2: h ^= data[1] << 8;
+    case 1: h ^= data[0]; h *= m;
+    };
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+static uint64_t benchHashMurmur2(const void *key, int len) {
+    return benchMurmurHash2(key,len,5381);
+}
+
+static uint64_t benchHashMurmur64A(const void *key, int len) {
+    return dictMurmurHash64A(key,len,0);
+}
+
+static uint64_t benchHashSiphash(const void *key, int len) {
+    return siphash(key,len,dict_hash_function_seed);
+}
+
+static long long benchUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Return the length of the next key of the typical keyspace. */
+static int benchKeyLen(void) {
+    int r = random() % 100;
+
+    if (r < 50) return 8 + random() % 9;        /* 8..16 */
+    if (r < 85) return 17 + random() % 16;      /* 17..32 */
+    if (r < 97) return 33 + random() % 32;      /* 33..64 */
+    return 65 + random() % 192;                 /* 65..256 */
+}
+
+static sds benchKey(long j, int len) {
+    sds key = sdscatprintf(sdsempty(),"object:%ld:",j);
+
+    while ((int)sdslen(key) < len) key = sdscatlen(key,"x",1);
+    sdsrange(key,0,len-1);
+    /* Keep the numeric part so that keys are unique even when truncated. */
+    if ((int)sdslen(key) < len || len < 16) {
+        sdsfree(key);
+        key = sdscatprintf(sdsempty(),"%0*ld",len,j);
+    }
+    return key;
+}
+
+static uint64_t benchSdsHash(const void *key) {
+    return dictGenHashFunction(key,sdslen((sds)key));
+}
+
+static int benchSdsKeyCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    size_t l1 = sdslen((sds)key1), l2 = sdslen((sds)key2);
+
+    DICT_NOTUSED(privdata);
+    return l1 == l2 && memcmp(key1,key2,l1) == 0;
+}
+
+static void benchSdsDestructor(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    sdsfree(key);
+}
+
+static dictType benchDictType = {
+    benchSdsHash,          /* hash function */
+    NULL,                  /* key dup */
+    NULL,                  /* val dup */
+    benchSdsKeyCompare,    /* key compare */
+    benchSdsDestructor,    /* key destructor */
+    NULL                   /* val destructor */
+};
+
+#define BENCH_START() start = benchUstime()
+#define BENCH_END(msg, ops) do { \
+    elapsed = benchUstime()-start; \
+    printf("%-28s %8.1f ns/op  %10.0f ops/sec\n", msg, \
+        (double)elapsed*1000/(ops), (double)(ops)*1000000/(elapsed ? elapsed : 1)); \
+} while(0)
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    int keylen = argc > 2 ? atoi(argv[2]) : 0;
+    sds *keys = zmalloc(sizeof(sds)*count);
+    size_t totlen = 0;
+    long long start, elapsed;
+    uint64_t sum = 0;
+    long j, k;
+    int h;
+    dict *d;
+    struct {
+        char *name;
+        uint64_t (*hash)(const void *key, int len);
+    } hashes[] = {
+        {"MurmurHash2 (32 bit)", benchHashMurmur2},
+        {"MurmurHash64A", benchHashMurmur64A},
+        {"SipHash-1-3", benchHashSiphash},
+    };
+
+    srandom(1234);
+    for (j = 0; j < 16; j++) dict_hash_function_seed[j] = random();
+    for (j = 0; j < count; j++) {
+        keys[j] = benchKey(j,keylen ? keylen : benchKeyLen());
+        totlen += sdslen(keys[j]);
+    }
+    printf("%ld keys, average length %.1f bytes\n\n", count,
+        (double)totlen/count);
+
+    /* Raw speed of the hash functions, 10 passes over the keys. */
+    for (h = 0; h < (int)(sizeof(hashes)/sizeof(hashes[0])); h++) {
+        BENCH_START();
+        for (k = 0; k < 10; k++)
+            for (j = 0; j < count; j++)
+                sum += hashes[h].hash(keys[j],sdslen(keys[j]));
+        BENCH_END(hashes[h].name,count*10);
+    }
+    printf("(checksum %llu)\n\n", (unsigned long long)sum);
+
+    /* dict operations with the hash function selected at compile time. */
+#ifdef DICT_HASH_SIPHASH
+    printf("dict with SipHash-1-3\n");
+#else
+    printf("dict with MurmurHash64A\n");
+#endif
+    d = dictCreate(&benchDictType,NULL);
+    BENCH_START();
+    for (j = 0; j < count; j++) {
+        int retval = dictAdd(d,sdsdup(keys[j]),NULL);
+        assert(retval == DICT_OK);
+    }
+    BENCH_END("Inserting",count);
+    assert((long)dictSize(d) == count);
+
+    /* Wait for the rehashing to complete. */
+    while (dictIsRehashing(d)) dictRehashMilliseconds(d,100);
+
+    BENCH_START();
+    for (j = 0; j < count; j++) {
+        dictEntry *de = dictFind(d,keys[j]);
+        assert(de != NULL);
+    }
+    BENCH_END("Linear access of existing",count);
+
+    BENCH_START();
+    for (j = 0; j < count; j++) {
+        dictEntry *de = dictFind(d,keys[random() % count]);
+        assert(de != NULL);
+    }
+    BENCH_END("Random access of existing",count);
+
+    BENCH_START();
+    for (j = 0; j < count; j++) {
+        sds key = keys[random() % count];
+        dictEntry *de;
+
+        key[0] ^= 0x80; /* Not a key of the dict. */
+        de = dictFind(d,key);
+        key[0] ^= 0x80;
+        assert(de == NULL);
+    }
+    BENCH_END("Accessing missing",count);
+
+    BENCH_START();
+    for (j = 0; j < count; j++) {
+        int retval = dictDelete(d,keys[j]);
+        assert(retval == DICT_OK);
+    }
+    BENCH_END("Removing",count);
+
+    dictRelease(d);
+    for (j = 0; j < count; j++) sdsfree(keys[j]);
+    zfree(keys);
+    return 0;
+}
+#endif
@@ -110,7 +110,7 @@ typedef struct dictType {
 
     // 计算哈希值的函数
     // REDIS_HASH 配置为 dictEncObjHash(), REDIS_SET 配置为 dictEncObjHash()
-    unsigned int (*hashFunction)(const void *key);
+    uint64_t (*hashFunction)(const void *key);
 
     // 复制键的函数(以便提供深拷贝函数)
     // REDIS_HASH 配置为 NULL, REDIS_SET 配置为 NULL
@@ -132,6 +132,16 @@ typedef struct dictType {
     // REDIS_HASH 配置为 NULL, REDIS_SET 配置为 NULL
     void (*valDestructor)(void *privdata, void *obj);
 
+    /* Optional: if set the keys are copied inside the allocation of their
+     * dictEntry. keyEmbedSize() returns the bytes needed after the entry to
+     * store 'key' and keyEmbed() copies it at 'buf' returning the pointer
+     * to store in the entry. Embedded keys are released with the entry, so
+     * keyDup and keyDestructor should be NULL.
+     *
+     * 可选：把键复制到节点的同一块内存中，查找时只需访问一次内存 */
+    size_t (*keyEmbedSize)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
+
 } dictType;
 
 /**
@@ -160,9 +170,18 @@ typedef struct dictType {
  * rehash 的标志放在 dict，因为管理 hash table 的是 dict，单个 hash table 知道自己正在 rehash 又怎样？
  * 两个 hash table 之间并不能相互访问，所以把 rehash 的标志放在更上层的 dict 是合理的
  */
+/* Tables up to DICT_HT_SEGMENT_SIZE buckets are a flat array of buckets.
+ * Bigger tables are split in segments of DICT_HT_SEGMENT_SIZE buckets:
+ * 'table' is then an array of pointers to the segments, allocated the first
+ * time a bucket of the segment is written. While rehashing the segments of
+ * the old table are released as soon as they were moved, so the memory grows
+ * gradually instead of allocating the whole new table in one shot.
+ *
+ * 大表分段分配：rehash 时新表的段按需分配，旧表的段迁移完成后立即释放，
+ * 避免一次性分配整个新表带来的内存峰值 */
 typedef struct dictht { // dict hash table
     
-    // 哈希表数组
+    // 哈希表数组（大表时为段指针数组）
     dictEntry **table;
 
     // 哈希表大小
@@ -203,7 +222,7 @@ typedef struct dict {
     // 在 rehash 的途中，rehashidx 将会不断增加
     // 当 rehash 不在进行时，值为 -1
     // 先 resize 备用的 ht，然后才会有 rehash
-    int rehashidx; /* rehashing not in progress if rehashidx == -1 */
+    long rehashidx; /* rehashing not in progress if rehashidx == -1 */
 
     // 目前正在运行的安全迭代器的数量
     int iterators; /* number of iterators currently running */
@@ -236,7 +255,8 @@ typedef struct dictIterator {
     // table ：正在被迭代的哈希表号码，值可以是 0 或 1 。
     // index ：迭代器当前所指向的哈希表索引位置。
     // safe ：标识这个迭代器是否安全
-    int table, index, safe;
+    int table, safe;
+    long index;
 
     // entry ：当前迭代到的节点的指针
     // nextEntry ：当前迭代节点的下一个节点
@@ -254,6 +274,7 @@ typedef struct dictIterator {
 } dictIterator;
 
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
+typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 
 /* This is the initial size of every hash table */
 /*
@@ -261,6 +282,31 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
  */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Buckets per segment of the big tables (see dictht). */
+#define DICT_HT_SEGMENT_EXP      14
+#define DICT_HT_SEGMENT_SIZE     (1UL<<DICT_HT_SEGMENT_EXP)
+#define DICT_HT_SEGMENT_MASK     (DICT_HT_SEGMENT_SIZE-1)
+
+// 哈希表是否分段，以及段的数量
+#define dictHtIsSegmented(ht) ((ht)->size > DICT_HT_SEGMENT_SIZE)
+#define dictHtSegments(ht) ((ht)->size >> DICT_HT_SEGMENT_EXP)
+
+/* Return the address of the bucket 'idx' of the table 'ht', or NULL if the
+ * segment holding the bucket is not allocated (so the bucket is empty). */
+static inline dictEntry **dictHtBucketRef(dictht *ht, unsigned long idx) {
+    dictEntry **seg;
+
+    if (!dictHtIsSegmented(ht)) return ht->table+idx;
+    seg = ((dictEntry***)ht->table)[idx>>DICT_HT_SEGMENT_EXP];
+    return seg ? seg+(idx&DICT_HT_SEGMENT_MASK) : NULL;
+}
+
+// 返回桶 idx 的链表头节点
+static inline dictEntry *dictHtBucket(dictht *ht, unsigned long idx) {
+    dictEntry **ref = dictHtBucketRef(ht,idx);
+    return ref ? *ref : NULL;
+}
+
 /* ------------------------------- Macros ------------------------------------*/
 // 给每一个变量都加上括号，确保变量能够在展开之后，依然是同一个变量
 // NOTE: '\' 后面不能有任何的空格！！！
@@ -346,16 +392,20 @@ void dictReleaseIterator(dictIterator *iter);
 dictEntry *dictGetRandomKey(dict *d);
 int dictGetRandomKeys(dict *d, dictEntry **des, int count);
 void dictPrintStats(dict *d);
-unsigned int dictGenHashFunction(const void *key, int len);
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len);
+uint64_t dictGenHashFunction(const void *key, int len);
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len);
 void dictEmpty(dict *d, void(callback)(void*));
 void dictEnableResize(void);
 void dictDisableResize(void);
+void dictEnableRehash(void);
+void dictDisableRehash(void);
 int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
-void dictSetHashFunctionSeed(unsigned int initval);
-unsigned int dictGetHashFunctionSeed(void);
-unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
+void dictSetHashFunctionSeed(uint8_t *seed);
+uint8_t *dictGetHashFunctionSeed(void);
+unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+int dictScanVisited(dict *d, const void *key, unsigned long v);
+dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
 
 /* Hash table types */
 /* The following is code that we don't use for Redis currently, but that is part
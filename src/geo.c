@@ -0,0 +1,777 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*-----------------------------------------------------------------------------
+ * Geo API
+ *----------------------------------------------------------------------------*/
+
+/* The GEO commands do not introduce a new type: a geo index is a regular
+ * sorted set where the score of every member is the 52 bit geohash of its
+ * position (see geohash.h). Points near each other share a prefix of their
+ * hash, so every geohash cell is a contiguous range of scores, and a radius
+ * or box query only needs to visit the ranges of the cell containing the
+ * center of the search and of its eight neighbors, using the same range
+ * lookup as ZRANGEBYSCORE.
+ *
+ * GEO 命令没有新增数据类型：地理索引就是一个普通的有序集合，
+ * 成员的分值是它位置的 52 位 geohash 。
+ * 每个 geohash 格子对应一段连续的分值区间，
+ * 所以范围查询只需要扫描中心格子及其八个邻居对应的分值区间。 */
+
+#include "redis.h"
+#include "geohash.h"
+#include "pqsort.h"
+#include <math.h>
+
+/* A point found by a search. */
+typedef struct geoPoint {
+    double longitude;
+    double latitude;
+    double dist;        /* Distance from the center of the search, meters. */
+    double score;       /* Geohash of the point. */
+    sds member;
+} geoPoint;
+
+typedef struct geoArray {
+    geoPoint *array;
+    size_t buckets;
+    size_t used;
+} geoArray;
+
+/* Sort order of the results. */
+#define GEO_SORT_ASC 0
+#define GEO_SORT_DESC 1
+
+/* Flags of georadiusGeneric(). */
+#define GEO_RADIUS_COORDS (1<<0)    /* GEORADIUS: center given as lon,lat. */
+#define GEO_RADIUS_MEMBER (1<<1)    /* GEORADIUSBYMEMBER: center is a member. */
+#define GEO_SEARCH (1<<2)           /* GEOSEARCH syntax. */
+#define GEO_SEARCHSTORE (1<<3)      /* GEOSEARCHSTORE: GEO_SEARCH + store. */
+
+/* ====================================================================
+ * geoArray helpers
+ * ==================================================================== */
+
+static geoArray *geoArrayCreate(void) {
+    geoArray *ga = zmalloc(sizeof(*ga));
+
+    ga->array = NULL;
+    ga->buckets = 0;
+    ga->used = 0;
+    return ga;
+}
+
+/* Append a point, taking ownership of 'member'. */
+static geoPoint *geoArrayAppend(geoArray *ga, double *xy, double dist,
+                                double score, sds member)
+{
+    geoPoint *gp;
+
+    if (ga->used == ga->buckets) {
+        ga->buckets = (ga->buckets == 0) ? 8 : ga->buckets*2;
+        ga->array = zrealloc(ga->array,sizeof(geoPoint)*ga->buckets);
+    }
+    gp = ga->array+ga->used;
+    gp->longitude = xy[0];
+    gp->latitude = xy[1];
+    gp->dist = dist;
+    gp->score = score;
+    gp->member = member;
+    ga->used++;
+    return gp;
+}
+
+static void geoArrayFree(geoArray *ga) {
+    size_t i;
+
+    for (i = 0; i < ga->used; i++) sdsfree(ga->array[i].member);
+    zfree(ga->array);
+    zfree(ga);
+}
+
+/* ====================================================================
+ * Helpers
+ * ==================================================================== */
+
+/* Decode the score of a geo member into longitude and latitude. */
+static int decodeGeohash(double bits, double *xy) {
+    GeoHashBits hash = { .bits = (uint64_t)bits, .step = GEO_STEP_MAX };
+
+    return geohashDecodeToLongLatWGS84(hash,xy);
+}
+
+/* Parse a longitude,latitude pair from argv[0] and argv[1] into xy. On error
+ * an error is sent to the client and REDIS_ERR is returned. */
+static int extractLongLatOrReply(redisClient *c, robj **argv, double *xy) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (getDoubleFromObjectOrReply(c,argv[i],xy+i,NULL) != REDIS_OK)
+            return REDIS_ERR;
+    }
+    if (xy[0] < GEO_LONG_MIN || xy[0] > GEO_LONG_MAX ||
+        xy[1] < GEO_LAT_MIN || xy[1] > GEO_LAT_MAX) {
+        addReplySds(c,sdscatprintf(sdsempty(),
+            "-ERR invalid longitude,latitude pair %f,%f\r\n",xy[0],xy[1]));
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Decode the position of 'member' of the geo index 'zobj' into xy.
+ * Returns REDIS_ERR if the member does not exist. */
+static int longLatFromMember(robj *zobj, robj *member, double *xy) {
+    double score = 0;
+
+    if (zsetScore(zobj,member,&score) == REDIS_ERR) return REDIS_ERR;
+    if (!decodeGeohash(score,xy)) return REDIS_ERR;
+    return REDIS_OK;
+}
+
+/* Return the number of meters of the unit in 'o', or -1 after sending an
+ * error to the client if the unit is unknown. */
+static double extractUnitOrReply(redisClient *c, robj *o) {
+    char *u = o->ptr;
+
+    if (!strcasecmp(u,"m")) {
+        return 1;
+    } else if (!strcasecmp(u,"km")) {
+        return 1000;
+    } else if (!strcasecmp(u,"ft")) {
+        return 0.3048;
+    } else if (!strcasecmp(u,"mi")) {
+        return 1609.34;
+    } else {
+        addReplyError(c,
+            "unsupported unit provided. please use m, km, ft, mi");
+        return -1;
+    }
+}
+
+/* Parse a "<distance> <unit>" pair from argv, storing the unit size into
+ * *conversion and returning the distance in meters, or -1 after sending an
+ * error to the client. */
+static double extractDistanceOrReply(redisClient *c, robj **argv,
+                                     double *conversion)
+{
+    double distance;
+
+    if (getDoubleFromObjectOrReply(c,argv[0],&distance,
+                                   "need numeric radius") != REDIS_OK)
+        return -1;
+    if (distance < 0) {
+        addReplyError(c,"radius cannot be negative");
+        return -1;
+    }
+    if ((*conversion = extractUnitOrReply(c,argv[1])) < 0) return -1;
+    return distance * *conversion;
+}
+
+/* Parse a "<width> <height> <unit>" box from argv into the shape. */
+static int extractBoxOrReply(redisClient *c, robj **argv, GeoShape *shape,
+                             double *conversion)
+{
+    double width, height;
+
+    if (getDoubleFromObjectOrReply(c,argv[0],&width,
+                                   "need numeric width") != REDIS_OK ||
+        getDoubleFromObjectOrReply(c,argv[1],&height,
+                                   "need numeric height") != REDIS_OK)
+        return REDIS_ERR;
+    if (width < 0 || height < 0) {
+        addReplyError(c,"height or width cannot be negative");
+        return REDIS_ERR;
+    }
+    if ((*conversion = extractUnitOrReply(c,argv[2])) < 0) return REDIS_ERR;
+    shape->width = width * *conversion;
+    shape->height = height * *conversion;
+    return REDIS_OK;
+}
+
+/* Distances are always reported with four decimal digits. */
+static void addReplyDoubleDistance(redisClient *c, double d) {
+    char dbuf[128];
+    int dlen = snprintf(dbuf,sizeof(dbuf),"%.4f",d);
+
+    addReplyBulkCBuffer(c,dbuf,dlen);
+}
+
+/* ====================================================================
+ * Search
+ * ==================================================================== */
+
+/* Append the member to 'ga' if its position is inside the shape, otherwise
+ * free it. Returns 1 if the member was appended. */
+static int geoAppendIfWithinShape(geoArray *ga, GeoShape *shape,
+                                  double score, sds member)
+{
+    double xy[2], distance;
+
+    if (!decodeGeohash(score,xy) ||
+        !geohashGetDistanceIfInShapeWGS84(shape,xy,&distance)) {
+        sdsfree(member);
+        return 0;
+    }
+    geoArrayAppend(ga,xy,distance,score,member);
+    return 1;
+}
+
+/* Collect the members of 'zobj' with a score in [min,max) that are inside
+ * the shape. When 'limit' is not zero (COUNT ANY) the scan stops as soon as
+ * 'ga' holds 'limit' points. Returns the number of points appended.
+ *
+ * 扫描分值在 [min,max) 区间内的成员，
+ * 和 ZRANGEBYSCORE 一样先用 zzlFirstInRange/zslFirstInRange 定位起点。 */
+static int geoGetPointsInRange(robj *zobj, double min, double max,
+                               GeoShape *shape, geoArray *ga,
+                               unsigned long limit)
+{
+    zrangespec range = { .min = min, .max = max, .minex = 0, .maxex = 1 };
+    size_t origincount = ga->used;
+
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->ptr;
+        unsigned char *eptr, *sptr;
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vlong;
+        double score;
+
+        if ((eptr = zzlFirstInRange(zl,&range)) == NULL) return 0;
+        sptr = lpNext(zl,eptr);
+        while (eptr) {
+            score = zzlGetScore(sptr);
+            if (score >= max) break;
+
+            vstr = lpGetValue(eptr,&vlen,&vlong);
+            geoAppendIfWithinShape(ga,shape,score,
+                vstr ? sdsnewlen(vstr,vlen) : sdsfromlonglong(vlong));
+            if (limit && ga->used >= limit) break;
+            zzlNext(zl,&eptr,&sptr);
+        }
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        zskiplistNode *ln;
+
+        if ((ln = zslFirstInRange(zs->zsl,&range)) == NULL) return 0;
+        while (ln) {
+            if (ln->score >= max) break;
+
+            geoAppendIfWithinShape(ga,shape,ln->score,sdsdup(ln->ele));
+            if (limit && ga->used >= limit) break;
+            ln = ln->level[0].forward;
+        }
+    } else {
+        redisPanic("Unknown sorted set encoding");
+    }
+    return ga->used - origincount;
+}
+
+/* Collect the members inside the shape that live in the geohash cell
+ * 'hash'. A cell of step S covers the scores sharing the first 2*S bits. */
+static int membersOfGeoHashBox(robj *zobj, GeoHashBits hash, GeoShape *shape,
+                               geoArray *ga, unsigned long limit)
+{
+    int shift = GEO_STEP_MAX*2 - hash.step*2;
+    uint64_t min = hash.bits << shift;
+    uint64_t max = (hash.bits+1) << shift;
+
+    return geoGetPointsInRange(zobj,min,max,shape,ga,limit);
+}
+
+/* Search all the cells computed by geohashCalculateAreasByShapeWGS84(). */
+static int membersOfAllNeighbors(robj *zobj, GeoHashRadius *r,
+                                 GeoShape *shape, geoArray *ga,
+                                 unsigned long limit)
+{
+    GeoHashBits neighbors[9];
+    int i, j, count = 0;
+
+    neighbors[0] = r->hash;
+    neighbors[1] = r->neighbors.north;
+    neighbors[2] = r->neighbors.south;
+    neighbors[3] = r->neighbors.east;
+    neighbors[4] = r->neighbors.west;
+    neighbors[5] = r->neighbors.north_east;
+    neighbors[6] = r->neighbors.north_west;
+    neighbors[7] = r->neighbors.south_east;
+    neighbors[8] = r->neighbors.south_west;
+
+    for (i = 0; i < 9; i++) {
+        // step 为 0 表示这个邻居已经被证明与搜索范围无关
+        if (neighbors[i].step == 0) continue;
+
+        /* With very big cells, or near the poles, moving to a neighbor can
+         * wrap around and land on a cell already visited. */
+        for (j = 0; j < i; j++) {
+            if (neighbors[j].step == neighbors[i].step &&
+                neighbors[j].bits == neighbors[i].bits) break;
+        }
+        if (j != i) continue;
+
+        if (limit && ga->used >= limit) break;
+        count += membersOfGeoHashBox(zobj,neighbors[i],shape,ga,limit);
+    }
+    return count;
+}
+
+static int sortGeoPointAsc(const void *a, const void *b) {
+    const geoPoint *gpa = a, *gpb = b;
+
+    if (gpa->dist < gpb->dist) return -1;
+    if (gpa->dist > gpb->dist) return 1;
+    return sdscmp(gpa->member,gpb->member);
+}
+
+static int sortGeoPointDesc(const void *a, const void *b) {
+    return -sortGeoPointAsc(a,b);
+}
+
+/* ====================================================================
+ * Commands
+ * ==================================================================== */
+
+/* GEOADD key long lat name [long2 lat2 name2 ... longN latN nameN]
+ *
+ * The command is translated into a ZADD with the geohashes as scores, and
+ * propagated as such. */
+void geoaddCommand(redisClient *c) {
+    int elements, argc, i;
+    robj **argv;
+
+    if ((c->argc - 2) % 3 != 0) {
+        /* Need an odd number of arguments if we got this far... */
+        addReplyError(c,"syntax error. Try GEOADD key [x1] [y1] [name1] "
+                        "[x2] [y2] [name2] ... ");
+        return;
+    }
+
+    /* Validate every pair before touching the dataset, so that the command
+     * either adds everything or nothing. */
+    elements = (c->argc - 2) / 3;
+    for (i = 0; i < elements; i++) {
+        double xy[2];
+
+        if (extractLongLatOrReply(c,c->argv+2+i*3,xy) == REDIS_ERR) return;
+    }
+
+    // 构造 ZADD key score1 member1 ... 的新参数数组
+    argc = 2 + elements*2;
+    argv = zmalloc(sizeof(robj*)*argc);
+    argv[0] = createStringObject("zadd",4);
+    argv[1] = c->argv[1];
+    incrRefCount(argv[1]);
+    for (i = 0; i < elements; i++) {
+        double xy[2];
+        GeoHashBits hash;
+        robj *member = c->argv[4+i*3];
+
+        getDoubleFromObject(c->argv[2+i*3],xy);
+        getDoubleFromObject(c->argv[3+i*3],xy+1);
+        geohashEncodeWGS84(xy[0],xy[1],GEO_STEP_MAX,&hash);
+
+        argv[2+i*2] = createObject(REDIS_STRING,
+                                   sdsfromlonglong((long long)hash.bits));
+        argv[3+i*2] = member;
+        incrRefCount(member);
+    }
+
+    replaceClientCommandVector(c,argc,argv);
+    zaddCommand(c);
+}
+
+/* Store the first 'returned_items' points of 'ga' into the sorted set at
+ * 'storekey', scored by geohash or, with 'storedist', by distance in the
+ * requested unit. Replies with the number of stored members. */
+static void geoStoreResults(redisClient *c, robj *storekey, geoArray *ga,
+                            long returned_items, int storedist,
+                            double conversion, int flags)
+{
+    if (returned_items) {
+        robj *zobj = createZsetObject();
+        zset *zs = zobj->ptr;
+        size_t maxelelen = 0;
+        long i;
+
+        for (i = 0; i < returned_items; i++) {
+            geoPoint *gp = ga->array+i;
+            double score = storedist ? gp->dist / conversion : gp->score;
+            zskiplistNode *znode;
+
+            if (sdslen(gp->member) > maxelelen) maxelelen = sdslen(gp->member);
+            // 节点自带一份 member 拷贝
+            znode = zslInsert(zs->zsl,score,gp->member);
+            redisAssert(dictAdd(zs->dict,znode->ele,&znode->score) == DICT_OK);
+        }
+
+        /* Convert to listpack when in limits, as ZUNIONSTORE does. */
+        if (zs->zsl->length <= server.zset_max_ziplist_entries &&
+            maxelelen <= server.zset_max_ziplist_value)
+            zsetConvert(zobj,REDIS_ENCODING_LISTPACK);
+
+        dbDelete(c->db,storekey);
+        dbAdd(c->db,storekey,zobj);
+        signalModifiedKey(c->db,storekey);
+        notifyKeyspaceEvent(REDIS_NOTIFY_ZSET,
+            (flags & GEO_SEARCH) ? "geosearchstore" : "georadiusstore",
+            storekey,c->db->id);
+        server.dirty += returned_items;
+    } else if (dbDelete(c->db,storekey)) {
+        signalModifiedKey(c->db,storekey);
+        notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",storekey,c->db->id);
+        server.dirty++;
+    }
+    addReplyLongLong(c,returned_items);
+}
+
+/* GEORADIUS key x y radius unit [WITHDIST] [WITHHASH] [WITHCOORD] [ASC|DESC]
+ *                               [COUNT count [ANY]] [STORE key] [STOREDIST key]
+ * GEORADIUSBYMEMBER key member radius unit ... options ...
+ * GEOSEARCH key [FROMMEMBER member] [FROMLONLAT long lat] [BYRADIUS radius unit]
+ *               [BYBOX width height unit] [WITHCOORD] [WITHDIST] [WITHHASH]
+ *               [ASC|DESC] [COUNT count [ANY]]
+ * GEOSEARCHSTORE dest_key src_key ... GEOSEARCH options ... [STOREDIST]
+ *
+ * Results are sorted by distance from the center, nearest first unless
+ * DESC is given.
+ *
+ * 结果总是按距离排序，默认由近到远。 */
+static void georadiusGeneric(redisClient *c, int srcKeyIndex, int flags) {
+    robj *storekey = NULL;
+    int storedist = 0;
+    robj *zobj;
+    GeoShape shape = {0};
+    double conversion = 1;
+    int base_args, i;
+    int withdist = 0, withhash = 0, withcoords = 0;
+    int frommember = 0, fromloc = 0, byradius = 0, bybox = 0;
+    int sort = GEO_SORT_ASC;
+    int any = 0;
+    long long count = 0;
+    robj *member = NULL;
+    geoArray *ga;
+    GeoHashRadius georadius;
+    long result_length, returned_items, option_length;
+
+    /* Look up the requested zset. */
+    zobj = lookupKeyRead(c->db,c->argv[srcKeyIndex]);
+    if (zobj && checkType(c,zobj,REDIS_ZSET)) return;
+
+    /* Find the center and the size of the search. */
+    if (flags & GEO_RADIUS_COORDS) {
+        base_args = 6;
+        shape.type = GEO_SHAPE_RADIUS;
+        if (extractLongLatOrReply(c,c->argv+2,shape.xy) == REDIS_ERR) return;
+        if ((shape.radius = extractDistanceOrReply(c,c->argv+base_args-2,
+            &conversion)) < 0) return;
+    } else if (flags & GEO_RADIUS_MEMBER) {
+        base_args = 5;
+        shape.type = GEO_SHAPE_RADIUS;
+        member = c->argv[2];
+        if ((shape.radius = extractDistanceOrReply(c,c->argv+base_args-2,
+            &conversion)) < 0) return;
+    } else {
+        base_args = (flags & GEO_SEARCHSTORE) ? 3 : 2;
+    }
+
+    /* Parse the options. */
+    for (i = base_args; i < c->argc; i++) {
+        char *arg = c->argv[i]->ptr;
+        int remaining = c->argc - i - 1;
+
+        if (!strcasecmp(arg,"withdist") && !(flags & GEO_SEARCHSTORE)) {
+            withdist = 1;
+        } else if (!strcasecmp(arg,"withhash") && !(flags & GEO_SEARCHSTORE)) {
+            withhash = 1;
+        } else if (!strcasecmp(arg,"withcoord") && !(flags & GEO_SEARCHSTORE)) {
+            withcoords = 1;
+        } else if (!strcasecmp(arg,"any")) {
+            any = 1;
+        } else if (!strcasecmp(arg,"asc")) {
+            sort = GEO_SORT_ASC;
+        } else if (!strcasecmp(arg,"desc")) {
+            sort = GEO_SORT_DESC;
+        } else if (!strcasecmp(arg,"count") && remaining > 0) {
+            if (getLongLongFromObjectOrReply(c,c->argv[i+1],&count,NULL)
+                != REDIS_OK) return;
+            if (count <= 0) {
+                addReplyError(c,"COUNT must be > 0");
+                return;
+            }
+            i++;
+        } else if (!strcasecmp(arg,"store") && remaining > 0 &&
+                   !(flags & GEO_SEARCH)) {
+            storekey = c->argv[i+1];
+            storedist = 0;
+            i++;
+        } else if (!strcasecmp(arg,"storedist") && remaining > 0 &&
+                   !(flags & GEO_SEARCH)) {
+            storekey = c->argv[i+1];
+            storedist = 1;
+            i++;
+        } else if (!strcasecmp(arg,"storedist") &&
+                   (flags & GEO_SEARCHSTORE)) {
+            storedist = 1;
+        } else if (!strcasecmp(arg,"frommember") && remaining > 0 &&
+                   (flags & GEO_SEARCH) && !fromloc) {
+            member = c->argv[i+1];
+            frommember = 1;
+            i++;
+        } else if (!strcasecmp(arg,"fromlonlat") && remaining > 1 &&
+                   (flags & GEO_SEARCH) && !frommember) {
+            if (extractLongLatOrReply(c,c->argv+i+1,shape.xy) == REDIS_ERR)
+                return;
+            fromloc = 1;
+            i += 2;
+        } else if (!strcasecmp(arg,"byradius") && remaining > 1 &&
+                   (flags & GEO_SEARCH) && !bybox) {
+            if ((shape.radius = extractDistanceOrReply(c,c->argv+i+1,
+                &conversion)) < 0) return;
+            shape.type = GEO_SHAPE_RADIUS;
+            byradius = 1;
+            i += 2;
+        } else if (!strcasecmp(arg,"bybox") && remaining > 2 &&
+                   (flags & GEO_SEARCH) && !byradius) {
+            if (extractBoxOrReply(c,c->argv+i+1,&shape,&conversion)
+                != REDIS_OK) return;
+            shape.type = GEO_SHAPE_BOX;
+            bybox = 1;
+            i += 3;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* Check the compatibility of the options. */
+    if ((flags & GEO_SEARCH) && !(frommember || fromloc)) {
+        addReplyError(c,"exactly one of FROMMEMBER or FROMLONLAT can be "
+                        "specified for GEOSEARCH");
+        return;
+    }
+    if ((flags & GEO_SEARCH) && !(byradius || bybox)) {
+        addReplyError(c,"exactly one of BYRADIUS and BYBOX can be "
+                        "specified for GEOSEARCH");
+        return;
+    }
+    if (any && !count) {
+        addReplyError(c,"the ANY argument requires COUNT argument");
+        return;
+    }
+    if (flags & GEO_SEARCHSTORE) storekey = c->argv[1];
+    if (storekey && (withdist || withhash || withcoords)) {
+        addReplyError(c,"STORE option in GEORADIUS is not compatible with "
+                        "WITHDIST, WITHHASH and WITHCOORD options");
+        return;
+    }
+
+    /* Return ASAP when the source key does not exist. */
+    if (zobj == NULL) {
+        if (storekey) {
+            geoStoreResults(c,storekey,NULL,0,0,1,flags);
+        } else {
+            addReply(c,shared.emptymultibulk);
+        }
+        return;
+    }
+
+    /* Lookup the center of the search when it is a member. */
+    if (member && longLatFromMember(zobj,member,shape.xy) == REDIS_ERR) {
+        addReplyError(c,"could not decode requested zset member");
+        return;
+    }
+
+    /* Get all neighbor geohash boxes for our radius search, then search
+     * them for the points inside the shape. */
+    geohashCalculateAreasByShapeWGS84(&shape,&georadius);
+    ga = geoArrayCreate();
+    membersOfAllNeighbors(zobj,&georadius,&shape,ga,any ? count : 0);
+
+    result_length = ga->used;
+    returned_items = (count == 0 || result_length < count) ?
+                     result_length : count;
+
+    /* Only the first 'returned_items' points need to be in order. */
+    if (result_length > 1)
+        pqsort(ga->array,result_length,sizeof(geoPoint),
+               (sort == GEO_SORT_ASC) ? sortGeoPointAsc : sortGeoPointDesc,
+               0,returned_items-1);
+
+    if (storekey) {
+        geoStoreResults(c,storekey,ga,returned_items,storedist,conversion,
+                        flags);
+        geoArrayFree(ga);
+        return;
+    }
+
+    option_length = withdist + withcoords + withhash;
+    addReplyMultiBulkLen(c,returned_items);
+    for (i = 0; i < returned_items; i++) {
+        geoPoint *gp = ga->array+i;
+
+        /* With options every item is an array of the name followed by the
+         * requested fields, otherwise just the name. */
+        if (option_length) addReplyMultiBulkLen(c,option_length+1);
+        addReplyBulkCBuffer(c,gp->member,sdslen(gp->member));
+        if (withdist) addReplyDoubleDistance(c,gp->dist / conversion);
+        if (withhash) addReplyLongLong(c,(long long)gp->score);
+        if (withcoords) {
+            addReplyMultiBulkLen(c,2);
+            addReplyDouble(c,gp->longitude);
+            addReplyDouble(c,gp->latitude);
+        }
+    }
+    geoArrayFree(ga);
+}
+
+void georadiusCommand(redisClient *c) {
+    georadiusGeneric(c,1,GEO_RADIUS_COORDS);
+}
+
+void georadiusbymemberCommand(redisClient *c) {
+    georadiusGeneric(c,1,GEO_RADIUS_MEMBER);
+}
+
+void geosearchCommand(redisClient *c) {
+    georadiusGeneric(c,1,GEO_SEARCH);
+}
+
+void geosearchstoreCommand(redisClient *c) {
+    georadiusGeneric(c,2,GEO_SEARCH|GEO_SEARCHSTORE);
+}
+
+/* GEOHASH key ele1 ele2 ... eleN
+ *
+ * Returns an array with an 11 characters geohash representation of the
+ * position of the specified elements. The stored hashes use the Mercator
+ * latitude limits, so every position is encoded again using the standard
+ * [-90,90] range to be compatible with the usual geohash strings. */
+void geohashCommand(redisClient *c) {
+    char *geoalphabet = "0123456789bcdefghjkmnpqrstuvwxyz";
+    int j;
+    robj *zobj;
+
+    /* Look up the requested zset. */
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj && checkType(c,zobj,REDIS_ZSET)) return;
+
+    addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        double score, xy[2];
+        GeoHashRange r[2];
+        GeoHashBits hash;
+        char buf[12];
+        int i;
+
+        if (zobj == NULL || zsetScore(zobj,c->argv[j],&score) == REDIS_ERR ||
+            !decodeGeohash(score,xy)) {
+            addReplyNull(c);
+            continue;
+        }
+
+        r[0].min = -180;
+        r[0].max = 180;
+        r[1].min = -90;
+        r[1].max = 90;
+        geohashEncode(&r[0],&r[1],xy[0],xy[1],GEO_STEP_MAX,&hash);
+
+        for (i = 0; i < 11; i++) {
+            int idx;
+
+            /* We have just 52 bits, but the geohash string is 11 characters
+             * (55 bits) long: assume zero for the last one. */
+            if (i == 10) {
+                idx = 0;
+            } else {
+                idx = (hash.bits >> (52-((i+1)*5))) & 0x1f;
+            }
+            buf[i] = geoalphabet[idx];
+        }
+        buf[11] = '\0';
+        addReplyBulkCBuffer(c,buf,11);
+    }
+}
+
+/* GEOPOS key ele1 ele2 ... eleN
+ *
+ * Returns an array of two-items arrays representing the longitude and
+ * latitude of each element, or a null array for missing elements. */
+void geoposCommand(redisClient *c) {
+    int j;
+    robj *zobj;
+
+    /* Look up the requested zset. */
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj && checkType(c,zobj,REDIS_ZSET)) return;
+
+    addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        double xy[2];
+
+        if (zobj == NULL || longLatFromMember(zobj,c->argv[j],xy) == REDIS_ERR) {
+            addReplyNullArray(c);
+            continue;
+        }
+        addReplyMultiBulkLen(c,2);
+        addReplyDouble(c,xy[0]);
+        addReplyDouble(c,xy[1]);
+    }
+}
+
+/* GEODIST key ele1 ele2 [unit]
+ *
+ * Return the distance, in meters by default, otherwise according to "unit",
+ * between points ele1 and ele2. If one or more elements are missing a null
+ * reply is returned. */
+void geodistCommand(redisClient *c) {
+    double to_meter = 1;
+    double xyxy[4];
+    robj *zobj;
+
+    /* Check if there is the unit to extract, otherwise assume meters. */
+    if (c->argc == 5) {
+        if ((to_meter = extractUnitOrReply(c,c->argv[4])) < 0) return;
+    } else if (c->argc > 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    /* Look up the requested zset. */
+    if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp]))
+        == NULL || checkType(c,zobj,REDIS_ZSET)) return;
+
+    /* Get the positions of both members. */
+    if (longLatFromMember(zobj,c->argv[2],xyxy) == REDIS_ERR ||
+        longLatFromMember(zobj,c->argv[3],xyxy+2) == REDIS_ERR) {
+        addReplyNull(c);
+        return;
+    }
+    addReplyDoubleDistance(c,
+        geohashGetDistance(xyxy[0],xyxy[1],xyxy[2],xyxy[3]) / to_meter);
+}
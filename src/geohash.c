@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stddef.h>
+#include <math.h>
+#include "geohash.h"
+
+/* Earth radius and half of the equator length in the Mercator projection,
+ * both in meters. */
+#define EARTH_RADIUS_IN_METERS 6372797.560856
+#define MERCATOR_MAX 20037726.37
+
+#define D_R (M_PI / 180.0)
+
+static inline double deg2rad(double ang) { return ang * D_R; }
+static inline double rad2deg(double ang) { return ang / D_R; }
+
+/* Interleave the lower 32 bits of x and y: the bits of x end up in the even
+ * positions of the result, the bits of y in the odd ones.
+ *
+ * 交错两个 32 位整数，x 占偶数位，y 占奇数位。 */
+static uint64_t interleave64(uint32_t xlo, uint32_t ylo) {
+    static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
+                                 0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
+                                 0x0000FFFF0000FFFFULL};
+    static const unsigned int S[] = {1, 2, 4, 8, 16};
+    uint64_t x = xlo, y = ylo;
+    int i;
+
+    for (i = 4; i >= 0; i--) {
+        x = (x | (x << S[i])) & B[i];
+        y = (y | (y << S[i])) & B[i];
+    }
+    return x | (y << 1);
+}
+
+/* Reverse of interleave64(): the even bits are returned in the lower 32 bits
+ * of the result, the odd bits in the upper 32 bits. */
+static uint64_t deinterleave64(uint64_t interleaved) {
+    static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
+                                 0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
+                                 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+    static const unsigned int S[] = {0, 1, 2, 4, 8, 16};
+    uint64_t x = interleaved, y = interleaved >> 1;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        x = (x | (x >> S[i])) & B[i];
+        y = (y | (y >> S[i])) & B[i];
+    }
+    return x | (y << 32);
+}
+
+/* Return the cell offset of 'value' inside 'range' using 'step' bits,
+ * clamping the upper limit into the last cell. */
+static uint32_t geohashOffset(const GeoHashRange *range, double value,
+                              uint8_t step) {
+    double offset = (value - range->min) / (range->max - range->min);
+    uint64_t cells = 1ULL << step;
+    uint64_t idx = (uint64_t)(offset * cells);
+
+    if (idx >= cells) idx = cells - 1;
+    return (uint32_t)idx;
+}
+
+/* Encode the given coordinates as a geohash of 'step' bits per coordinate.
+ * Returns 0 if the coordinates are out of range, 1 on success. */
+int geohashEncode(const GeoHashRange *long_range, const GeoHashRange *lat_range,
+                  double longitude, double latitude, uint8_t step,
+                  GeoHashBits *hash)
+{
+    if (hash == NULL || step == 0 || step > 32 ||
+        lat_range->max <= lat_range->min || long_range->max <= long_range->min)
+        return 0;
+
+    hash->bits = 0;
+    hash->step = step;
+
+    if (longitude < GEO_LONG_MIN || longitude > GEO_LONG_MAX ||
+        latitude < GEO_LAT_MIN || latitude > GEO_LAT_MAX) return 0;
+    if (latitude < lat_range->min || latitude > lat_range->max ||
+        longitude < long_range->min || longitude > long_range->max) return 0;
+
+    // 纬度在偶数位，经度在奇数位，因此每对 bit 中经度是高位
+    hash->bits = interleave64(geohashOffset(lat_range,latitude,step),
+                              geohashOffset(long_range,longitude,step));
+    return 1;
+}
+
+int geohashEncodeWGS84(double longitude, double latitude, uint8_t step,
+                       GeoHashBits *hash)
+{
+    GeoHashRange long_range = {GEO_LONG_MIN, GEO_LONG_MAX};
+    GeoHashRange lat_range = {GEO_LAT_MIN, GEO_LAT_MAX};
+
+    return geohashEncode(&long_range,&lat_range,longitude,latitude,step,hash);
+}
+
+/* Decode a geohash into the area (the cell) it represents. */
+int geohashDecode(const GeoHashRange *long_range, const GeoHashRange *lat_range,
+                  const GeoHashBits hash, GeoHashArea *area)
+{
+    uint64_t sep;
+    uint32_t ilato, ilono;
+    double lat_scale, long_scale, cells;
+
+    if (area == NULL || hash.step == 0 ||
+        lat_range->max <= lat_range->min || long_range->max <= long_range->min)
+        return 0;
+
+    area->hash = hash;
+    sep = deinterleave64(hash.bits);
+    ilato = (uint32_t)sep;          /* Even bits: latitude. */
+    ilono = (uint32_t)(sep >> 32);  /* Odd bits: longitude. */
+    cells = (double)(1ULL << hash.step);
+    lat_scale = lat_range->max - lat_range->min;
+    long_scale = long_range->max - long_range->min;
+
+    area->latitude.min = lat_range->min + (ilato / cells) * lat_scale;
+    area->latitude.max = lat_range->min + ((ilato + 1) / cells) * lat_scale;
+    area->longitude.min = long_range->min + (ilono / cells) * long_scale;
+    area->longitude.max = long_range->min + ((ilono + 1) / cells) * long_scale;
+    return 1;
+}
+
+int geohashDecodeWGS84(const GeoHashBits hash, GeoHashArea *area) {
+    GeoHashRange long_range = {GEO_LONG_MIN, GEO_LONG_MAX};
+    GeoHashRange lat_range = {GEO_LAT_MIN, GEO_LAT_MAX};
+
+    return geohashDecode(&long_range,&lat_range,hash,area);
+}
+
+/* Decode a geohash into the coordinates of the center of its cell, stored
+ * as longitude, latitude into xy[0], xy[1]. */
+int geohashDecodeToLongLatWGS84(const GeoHashBits hash, double *xy) {
+    GeoHashArea area;
+
+    if (xy == NULL || !geohashDecodeWGS84(hash,&area)) return 0;
+
+    xy[0] = (area.longitude.min + area.longitude.max) / 2;
+    if (xy[0] > GEO_LONG_MAX) xy[0] = GEO_LONG_MAX;
+    if (xy[0] < GEO_LONG_MIN) xy[0] = GEO_LONG_MIN;
+    xy[1] = (area.latitude.min + area.latitude.max) / 2;
+    if (xy[1] > GEO_LAT_MAX) xy[1] = GEO_LAT_MAX;
+    if (xy[1] < GEO_LAT_MIN) xy[1] = GEO_LAT_MIN;
+    return 1;
+}
+
+/* Move the cell by 'd' (-1 or 1) positions along the longitude axis. Filling
+ * the latitude bits with ones lets the carry (or the borrow) propagate
+ * across them, so the odd bits behave as a single integer. The result wraps
+ * around at the antimeridian. */
+static void geohashMoveX(GeoHashBits *hash, int d) {
+    uint64_t x = hash->bits & 0xaaaaaaaaaaaaaaaaULL;
+    uint64_t y = hash->bits & 0x5555555555555555ULL;
+    uint64_t zz = 0x5555555555555555ULL >> (64 - hash->step * 2);
+
+    if (d > 0) {
+        x = x + (zz + 1);
+    } else {
+        x = x | zz;
+        x = x - (zz + 1);
+    }
+    x &= (0xaaaaaaaaaaaaaaaaULL >> (64 - hash->step * 2));
+    hash->bits = x | y;
+}
+
+/* Same as geohashMoveX() but along the latitude axis. */
+static void geohashMoveY(GeoHashBits *hash, int d) {
+    uint64_t x = hash->bits & 0xaaaaaaaaaaaaaaaaULL;
+    uint64_t y = hash->bits & 0x5555555555555555ULL;
+    uint64_t zz = 0xaaaaaaaaaaaaaaaaULL >> (64 - hash->step * 2);
+
+    if (d > 0) {
+        y = y + (zz + 1);
+    } else {
+        y = y | zz;
+        y = y - (zz + 1);
+    }
+    y &= (0x5555555555555555ULL >> (64 - hash->step * 2));
+    hash->bits = x | y;
+}
+
+/* Compute the eight cells surrounding 'hash', at the same step. */
+void geohashNeighbors(const GeoHashBits *hash, GeoHashNeighbors *neighbors) {
+    neighbors->east = *hash;
+    neighbors->west = *hash;
+    neighbors->north = *hash;
+    neighbors->south = *hash;
+    neighbors->south_east = *hash;
+    neighbors->south_west = *hash;
+    neighbors->north_east = *hash;
+    neighbors->north_west = *hash;
+
+    geohashMoveX(&neighbors->east,1);
+    geohashMoveX(&neighbors->west,-1);
+    geohashMoveY(&neighbors->north,1);
+    geohashMoveY(&neighbors->south,-1);
+
+    geohashMoveX(&neighbors->south_east,1);
+    geohashMoveY(&neighbors->south_east,-1);
+    geohashMoveX(&neighbors->south_west,-1);
+    geohashMoveY(&neighbors->south_west,-1);
+    geohashMoveX(&neighbors->north_east,1);
+    geohashMoveY(&neighbors->north_east,1);
+    geohashMoveX(&neighbors->north_west,-1);
+    geohashMoveY(&neighbors->north_west,1);
+}
+
+/* Return the step (bits per coordinate) of the smallest cells that are
+ * still at least 'range_meters' wide at the given latitude, so that the
+ * search area is covered by the center cell plus its neighbors.
+ *
+ * 估算格子大小：格子边长不小于搜索半径，这样中心格子加上周围八个格子
+ * 就能覆盖整个搜索区域。 */
+uint8_t geohashEstimateStepsByRadius(double range_meters, double lat) {
+    int step = 1;
+
+    if (range_meters == 0) return GEO_STEP_MAX;
+    while (range_meters < MERCATOR_MAX) {
+        range_meters *= 2;
+        step++;
+    }
+    step -= 2; /* Make sure range is included in most of the base cases. */
+
+    /* Cells get narrower towards the poles, compensate. */
+    if (lat > 66 || lat < -66) {
+        step--;
+        if (lat > 80 || lat < -80) step--;
+    }
+
+    if (step < 1) step = 1;
+    if (step > GEO_STEP_MAX) step = GEO_STEP_MAX;
+    return step;
+}
+
+/* Half width and half height of the shape, in meters. */
+static void geohashShapeHalfSize(const GeoShape *shape,
+                                 double *half_w, double *half_h) {
+    if (shape->type == GEO_SHAPE_RADIUS) {
+        *half_w = *half_h = shape->radius;
+    } else {
+        *half_w = shape->width / 2;
+        *half_h = shape->height / 2;
+    }
+}
+
+/* Compute the bounding box of the shape as min longitude, min latitude,
+ * max longitude, max latitude. The longitude limits may go past +/-180
+ * when the shape crosses the antimeridian. */
+void geohashBoundingBox(const GeoShape *shape, double *bounds) {
+    double longitude = shape->xy[0], latitude = shape->xy[1];
+    double half_w, half_h, lat_delta, long_delta_top, long_delta_bottom;
+
+    geohashShapeHalfSize(shape,&half_w,&half_h);
+    lat_delta = rad2deg(half_h / EARTH_RADIUS_IN_METERS);
+
+    /* A parallel is shorter the nearer it is to the pole, so the edge of the
+     * shape nearer to the pole spans more degrees of longitude. */
+    long_delta_top = rad2deg(half_w / EARTH_RADIUS_IN_METERS /
+                             cos(deg2rad(latitude + lat_delta)));
+    long_delta_bottom = rad2deg(half_w / EARTH_RADIUS_IN_METERS /
+                                cos(deg2rad(latitude - lat_delta)));
+    if (latitude < 0) {
+        bounds[0] = longitude - long_delta_bottom;
+        bounds[2] = longitude + long_delta_bottom;
+    } else {
+        bounds[0] = longitude - long_delta_top;
+        bounds[2] = longitude + long_delta_top;
+    }
+    bounds[1] = latitude - lat_delta;
+    bounds[3] = latitude + lat_delta;
+}
+
+/* Fill 'r' at the given step for a shape centered at (longitude,latitude). */
+static void geohashAreasAtStep(double longitude, double latitude,
+                               uint8_t step, GeoHashRadius *r) {
+    geohashEncodeWGS84(longitude,latitude,step,&r->hash);
+    geohashNeighbors(&r->hash,&r->neighbors);
+    geohashDecodeWGS84(r->hash,&r->area);
+}
+
+/* Compute the cells to scan in order to find every point inside 'shape':
+ * the cell containing the center plus the neighbors actually overlapping
+ * the bounding box of the shape.
+ *
+ * 计算需要扫描的格子：中心所在格子，以及与外接矩形相交的邻居格子。 */
+void geohashCalculateAreasByShapeWGS84(const GeoShape *shape, GeoHashRadius *r) {
+    double longitude = shape->xy[0], latitude = shape->xy[1];
+    double bounds[4], half_w, half_h;
+    uint8_t step;
+
+    geohashShapeHalfSize(shape,&half_w,&half_h);
+    geohashBoundingBox(shape,bounds);
+    step = geohashEstimateStepsByRadius(sqrt(half_w*half_w + half_h*half_h),
+                                        latitude);
+    geohashAreasAtStep(longitude,latitude,step,r);
+
+    /* The estimate may still be too fine when the center is near the edge
+     * of its cell: use bigger cells until the neighbors reach every side
+     * of the bounding box. */
+    while (step > 1) {
+        GeoHashArea north, south, east, west;
+
+        geohashDecodeWGS84(r->neighbors.north,&north);
+        geohashDecodeWGS84(r->neighbors.south,&south);
+        geohashDecodeWGS84(r->neighbors.east,&east);
+        geohashDecodeWGS84(r->neighbors.west,&west);
+
+        if (geohashGetDistance(longitude,latitude,
+                               longitude,north.latitude.max) >= half_h &&
+            geohashGetDistance(longitude,latitude,
+                               longitude,south.latitude.min) >= half_h &&
+            (east.longitude.max >= bounds[2] ||
+             east.longitude.max < r->area.longitude.min) &&
+            (west.longitude.min <= bounds[0] ||
+             west.longitude.min > r->area.longitude.max)) break;
+
+        step--;
+        geohashAreasAtStep(longitude,latitude,step,r);
+    }
+
+    /* Exclude the neighbors that are useless since the center cell already
+     * extends past that side of the bounding box. */
+    if (step >= 2) {
+        if (r->area.latitude.min < bounds[1]) {
+            r->neighbors.south.step = 0;
+            r->neighbors.south_west.step = 0;
+            r->neighbors.south_east.step = 0;
+        }
+        if (r->area.latitude.max > bounds[3]) {
+            r->neighbors.north.step = 0;
+            r->neighbors.north_east.step = 0;
+            r->neighbors.north_west.step = 0;
+        }
+        if (r->area.longitude.min < bounds[0]) {
+            r->neighbors.west.step = 0;
+            r->neighbors.south_west.step = 0;
+            r->neighbors.north_west.step = 0;
+        }
+        if (r->area.longitude.max > bounds[2]) {
+            r->neighbors.east.step = 0;
+            r->neighbors.south_east.step = 0;
+            r->neighbors.north_east.step = 0;
+        }
+    }
+}
+
+/* Great circle distance in meters between two points (haversine). */
+double geohashGetDistance(double lon1d, double lat1d,
+                          double lon2d, double lat2d) {
+    double lat1r, lon1r, lat2r, lon2r, u, v;
+
+    lat1r = deg2rad(lat1d);
+    lon1r = deg2rad(lon1d);
+    lat2r = deg2rad(lat2d);
+    lon2r = deg2rad(lon2d);
+    u = sin((lat2r - lat1r) / 2);
+    v = sin((lon2r - lon1r) / 2);
+    return 2.0 * EARTH_RADIUS_IN_METERS *
+           asin(sqrt(u * u + cos(lat1r) * cos(lat2r) * v * v));
+}
+
+/* Return 1 if the point xy is inside the shape, storing its distance from
+ * the center of the shape into *distance. Return 0 otherwise.
+ *
+ * For a box, the north/south distance is measured along the meridian and
+ * the east/west distance along the parallel of the point. */
+int geohashGetDistanceIfInShapeWGS84(const GeoShape *shape,
+                                     const double *xy, double *distance) {
+    if (shape->type == GEO_SHAPE_RADIUS) {
+        *distance = geohashGetDistance(shape->xy[0],shape->xy[1],xy[0],xy[1]);
+        return *distance <= shape->radius;
+    } else {
+        double lat_distance = EARTH_RADIUS_IN_METERS *
+                              fabs(deg2rad(xy[1] - shape->xy[1]));
+        if (lat_distance > shape->height / 2) return 0;
+        if (geohashGetDistance(xy[0],xy[1],shape->xy[0],xy[1]) >
+            shape->width / 2) return 0;
+        *distance = geohashGetDistance(shape->xy[0],shape->xy[1],xy[0],xy[1]);
+        return 1;
+    }
+}
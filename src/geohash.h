@@ -0,0 +1,91 @@
+#ifndef __GEOHASH_H
+#define __GEOHASH_H
+
+#include <stdint.h>
+
+/* Geohash encoding used by the GEO commands.
+ *
+ * A (longitude,latitude) pair is mapped into a 52 bit integer by
+ * interleaving 26 bits of longitude with 26 bits of latitude. 52 bits fit
+ * exactly in the mantissa of a double, so the hash can be stored as the
+ * score of a regular sorted set member, and all the points inside a
+ * geohash cell map to a contiguous range of scores.
+ *
+ * 经纬度各取 26 位交错成 52 位整数，正好能无损地存进 double 分值里。
+ * 同一个格子里的点，分值落在一个连续区间内。 */
+
+#define GEO_STEP_MAX 26 /* 26*2 = 52 bits. */
+
+/* Limits from EPSG:900913 / EPSG:3785 / OSGEO:41001 */
+#define GEO_LAT_MIN -85.05112878
+#define GEO_LAT_MAX 85.05112878
+#define GEO_LONG_MIN -180
+#define GEO_LONG_MAX 180
+
+typedef struct {
+    uint64_t bits;
+    uint8_t step;   /* Bits per coordinate, 0 means "no cell". */
+} GeoHashBits;
+
+typedef struct {
+    double min;
+    double max;
+} GeoHashRange;
+
+typedef struct {
+    GeoHashBits hash;
+    GeoHashRange longitude;
+    GeoHashRange latitude;
+} GeoHashArea;
+
+typedef struct {
+    GeoHashBits north;
+    GeoHashBits east;
+    GeoHashBits west;
+    GeoHashBits south;
+    GeoHashBits north_east;
+    GeoHashBits south_east;
+    GeoHashBits north_west;
+    GeoHashBits south_west;
+} GeoHashNeighbors;
+
+/* Search shapes. Sizes are always in meters. */
+#define GEO_SHAPE_RADIUS 0
+#define GEO_SHAPE_BOX    1
+
+typedef struct {
+    int type;           /* GEO_SHAPE_RADIUS or GEO_SHAPE_BOX. */
+    double xy[2];       /* Center longitude, latitude. */
+    double radius;      /* GEO_SHAPE_RADIUS only. */
+    double width;       /* GEO_SHAPE_BOX only. */
+    double height;
+} GeoShape;
+
+/* The cell containing the center of a search plus its eight neighbors. A
+ * neighbor with step 0 was proven useless and must be skipped. */
+typedef struct {
+    GeoHashBits hash;
+    GeoHashArea area;
+    GeoHashNeighbors neighbors;
+} GeoHashRadius;
+
+int geohashEncode(const GeoHashRange *long_range, const GeoHashRange *lat_range,
+                  double longitude, double latitude, uint8_t step,
+                  GeoHashBits *hash);
+int geohashEncodeWGS84(double longitude, double latitude, uint8_t step,
+                       GeoHashBits *hash);
+int geohashDecode(const GeoHashRange *long_range, const GeoHashRange *lat_range,
+                  const GeoHashBits hash, GeoHashArea *area);
+int geohashDecodeWGS84(const GeoHashBits hash, GeoHashArea *area);
+int geohashDecodeToLongLatWGS84(const GeoHashBits hash, double *xy);
+void geohashNeighbors(const GeoHashBits *hash, GeoHashNeighbors *neighbors);
+
+uint8_t geohashEstimateStepsByRadius(double range_meters, double lat);
+void geohashBoundingBox(const GeoShape *shape, double *bounds);
+void geohashCalculateAreasByShapeWGS84(const GeoShape *shape, GeoHashRadius *r);
+double geohashGetDistance(double lon1d, double lat1d,
+                          double lon2d, double lat2d);
+int geohashGetDistanceIfInShapeWGS84(const GeoShape *shape,
+                                     const double *xy, double *distance);
+
+#endif
@@ -0,0 +1,301 @@
+/* hotkeys.c - Server side hot keys detection
+ *
+ * 热点键统计：对键空间的访问进行抽样，用 space-saving 算法记录每个时间窗口内访问最多的键
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* When hotkeys-tracking is enabled lookupKey() reports one every
+ * hotkeys-sample-rate successful lookups (on average, the gap is random so
+ * that periodic access patterns are not aliased) to hotkeysTrackAccess().
+ *
+ * The sampled keys are counted with the space-saving algorithm: a fixed
+ * table of HOTKEYS_CAPACITY counters. A key already in the table gets its
+ * counter incremented, otherwise it replaces the key with the smallest
+ * counter, taking its count plus one and remembering that count as the
+ * maximum overestimation ('error'). Every key that received more than
+ * 1/HOTKEYS_CAPACITY of the sampled lookups is guaranteed to be in the
+ * table, which is exactly what we need to find the keys that dominate the
+ * traffic, with constant memory and no allocation for keys already tracked.
+ *
+ * Counters are kept per time window of hotkeys-window seconds: when a window
+ * ends it becomes the "last" window, so HOTKEYS LAST always reports a full
+ * window while HOTKEYS TOP reports the one in progress. The counts are
+ * scaled by the sample rate, so they estimate the real number of lookups. */
+
+#include "redis.h"
+
+#define HOTKEYS_CAPACITY 128        /* Counters of the space-saving table */
+#define HOTKEYS_INFO_TOP 5          /* Keys listed in INFO hotkeys */
+
+/* The table is indexed by the key name prefixed by the DB id, so that the
+ * same name in two DBs is counted separately. */
+#define HOTKEYS_PREFIX_LEN sizeof(int)
+
+typedef struct hotkeyCounter {
+    sds name;                       /* DB id + key name */
+    long long count;                /* Estimated lookups */
+    long long error;                /* Max overestimation of 'count' */
+} hotkeyCounter;
+
+typedef struct hotkeysWindow {
+    hotkeyCounter counters[HOTKEYS_CAPACITY];
+    int used;                       /* Counters in use */
+    dict *index;                    /* name -> counter index + 1 */
+    time_t start;                   /* Unix time the window started */
+    time_t end;                     /* Unix time it ended, 0 if current */
+    long long lookups;              /* Estimated lookups in the window */
+} hotkeysWindow;
+
+static hotkeysWindow hotkeys_windows[2];
+static hotkeysWindow *hotkeys_current = &hotkeys_windows[0];
+static hotkeysWindow *hotkeys_last = &hotkeys_windows[1];
+static long hotkeys_countdown = 1;  /* Lookups before the next sample */
+static sds hotkeys_probe = NULL;    /* Reused to build the index key */
+
+static void hotkeysWindowClear(hotkeysWindow *w, time_t start) {
+    int j;
+
+    for (j = 0; j < w->used; j++) sdsfree(w->counters[j].name);
+    if (w->index == NULL)
+        w->index = dictCreate(&keyptrDictType,NULL);
+    else
+        dictEmpty(w->index,NULL);
+    w->used = 0;
+    w->start = start;
+    w->end = 0;
+    w->lookups = 0;
+}
+
+/* Start a new window if the current one is older than hotkeys-window. */
+static void hotkeysRotateIfNeeded(void) {
+    hotkeysWindow *w;
+
+    if (hotkeys_current->start == 0) {
+        hotkeysWindowClear(hotkeys_current,server.unixtime);
+        return;
+    }
+    if (server.unixtime - hotkeys_current->start < server.hotkeys_window)
+        return;
+
+    /* No lookups for more than a window: the current one is not the last
+     * complete window anymore, both are empty. */
+    if (server.unixtime - hotkeys_current->start >= 2*server.hotkeys_window) {
+        hotkeysWindowClear(hotkeys_last,hotkeys_current->start);
+        hotkeys_last->end = server.unixtime;
+        hotkeysWindowClear(hotkeys_current,server.unixtime);
+        return;
+    }
+
+    w = hotkeys_last;
+    hotkeys_last = hotkeys_current;
+    hotkeys_last->end = server.unixtime;
+    hotkeys_current = w;
+    hotkeysWindowClear(hotkeys_current,server.unixtime);
+}
+
+/* Free all the counters, used by HOTKEYS RESET and when tracking is turned
+ * off with CONFIG SET. */
+void hotkeysReset(void) {
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        hotkeysWindow *w = &hotkeys_windows[j];
+
+        if (w->index) hotkeysWindowClear(w,0);
+    }
+}
+
+/* Called by lookupKey() for every key found when hotkeys-tracking is on. */
+void hotkeysTrackAccess(redisDb *db, sds key) {
+    hotkeysWindow *w;
+    dictEntry *de;
+    hotkeyCounter *hc;
+    long rate = server.hotkeys_sample_rate;
+    int j, min;
+
+    if (--hotkeys_countdown > 0) return;
+    hotkeys_countdown = rate > 1 ? 1 + random() % (2*rate-1) : 1;
+
+    hotkeysRotateIfNeeded();
+    w = hotkeys_current;
+    w->lookups += rate;
+
+    if (hotkeys_probe == NULL)
+        hotkeys_probe = sdsMakeRoomFor(sdsempty(),64);
+    sdsclear(hotkeys_probe);
+    hotkeys_probe = sdscatlen(hotkeys_probe,&db->id,HOTKEYS_PREFIX_LEN);
+    hotkeys_probe = sdscatlen(hotkeys_probe,key,sdslen(key));
+
+    // 已经在表中：增加计数
+    if ((de = dictFind(w->index,hotkeys_probe)) != NULL) {
+        w->counters[(long)dictGetVal(de)-1].count += rate;
+        return;
+    }
+
+    // 表未满，直接添加
+    if (w->used < HOTKEYS_CAPACITY) {
+        hc = &w->counters[w->used++];
+        hc->name = sdsdup(hotkeys_probe);
+        hc->count = rate;
+        hc->error = 0;
+        dictAdd(w->index,hc->name,(void*)(long)w->used);
+        return;
+    }
+
+    // 表已满，替换计数最小的键
+    for (min = 0, j = 1; j < HOTKEYS_CAPACITY; j++)
+        if (w->counters[j].count < w->counters[min].count) min = j;
+    hc = &w->counters[min];
+    dictDelete(w->index,hc->name);
+    sdsfree(hc->name);
+    hc->name = sdsdup(hotkeys_probe);
+    hc->error = hc->count;
+    hc->count += rate;
+    dictAdd(w->index,hc->name,(void*)(long)(min+1));
+}
+
+static int hotkeysCounterCompare(const void *a, const void *b) {
+    const hotkeyCounter *ha = *(hotkeyCounter**)a, *hb = *(hotkeyCounter**)b;
+
+    if (ha->count == hb->count) return 0;
+    return ha->count > hb->count ? -1 : 1;
+}
+
+/* Fill 'top' with the counters of 'w' by decreasing count, return how many
+ * were stored (at most 'count'). */
+static int hotkeysGetTop(hotkeysWindow *w, hotkeyCounter **top, int count) {
+    int j;
+
+    for (j = 0; j < w->used; j++) top[j] = &w->counters[j];
+    qsort(top,w->used,sizeof(hotkeyCounter*),hotkeysCounterCompare);
+    return w->used < count ? w->used : count;
+}
+
+static int hotkeyDbId(hotkeyCounter *hc) {
+    int dbid;
+
+    memcpy(&dbid,hc->name,HOTKEYS_PREFIX_LEN);
+    return dbid;
+}
+
+/* Append the INFO hotkeys section fields to 'info'. */
+sds genHotkeysInfoString(sds info) {
+    hotkeyCounter *top[HOTKEYS_CAPACITY];
+    hotkeysWindow *w;
+    int j, n;
+
+    info = sdscatprintf(info,
+        "hotkeys_tracking:%d\r\n"
+        "hotkeys_sample_rate:%d\r\n"
+        "hotkeys_window_sec:%d\r\n",
+        server.hotkeys_tracking,
+        server.hotkeys_sample_rate,
+        server.hotkeys_window);
+    if (!server.hotkeys_tracking) return info;
+
+    hotkeysRotateIfNeeded();
+    w = hotkeys_current;
+    info = sdscatprintf(info,
+        "hotkeys_window_age_sec:%ld\r\n"
+        "hotkeys_window_lookups:%lld\r\n",
+        (long)(server.unixtime - w->start), w->lookups);
+
+    /* Until the first window has some samples report the last one. */
+    if (w->used == 0 && hotkeys_last->index) w = hotkeys_last;
+    n = hotkeysGetTop(w,top,HOTKEYS_INFO_TOP);
+    for (j = 0; j < n; j++) {
+        info = sdscatprintf(info,"hotkey%d:db=%d,key=",j,hotkeyDbId(top[j]));
+        info = sdscatrepr(info,top[j]->name+HOTKEYS_PREFIX_LEN,
+            sdslen(top[j]->name)-HOTKEYS_PREFIX_LEN);
+        info = sdscatprintf(info,",lookups=%lld,share=%.2f\r\n",
+            top[j]->count,
+            w->lookups ? (double)top[j]->count*100/w->lookups : 0);
+    }
+    return info;
+}
+
+/* Reply with the top 'count' keys of 'w' as an array of
+ * [db, key, lookups, error] entries. */
+static void hotkeysReplyWithWindow(redisClient *c, hotkeysWindow *w,
+                                   long count)
+{
+    hotkeyCounter *top[HOTKEYS_CAPACITY];
+    int j, n;
+
+    if (w->index == NULL) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    n = hotkeysGetTop(w,top,count);
+    addReplyMultiBulkLen(c,n);
+    for (j = 0; j < n; j++) {
+        addReplyMultiBulkLen(c,4);
+        addReplyLongLong(c,hotkeyDbId(top[j]));
+        addReplyBulkCBuffer(c,top[j]->name+HOTKEYS_PREFIX_LEN,
+            sdslen(top[j]->name)-HOTKEYS_PREFIX_LEN);
+        addReplyLongLong(c,top[j]->count);
+        addReplyLongLong(c,top[j]->error);
+    }
+}
+
+/* HOTKEYS TOP [<count>]  -- keys of the window in progress
+ * HOTKEYS LAST [<count>] -- keys of the last complete window
+ * HOTKEYS RESET */
+void hotkeysCommand(redisClient *c) {
+    char *sub = c->argv[1]->ptr;
+    long count = 10;
+
+    if (!strcasecmp(sub,"reset") && c->argc == 2) {
+        hotkeysReset();
+        addReply(c,shared.ok);
+        return;
+    }
+
+    if ((strcasecmp(sub,"top") && strcasecmp(sub,"last")) || c->argc > 3) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 3) {
+        if (getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != REDIS_OK)
+            return;
+        if (count < 1) {
+            addReplyError(c,"count must be positive");
+            return;
+        }
+    }
+    if (!server.hotkeys_tracking) {
+        addReplyError(c,"hot keys tracking is disabled, "
+                        "use CONFIG SET hotkeys-tracking yes");
+        return;
+    }
+
+    hotkeysRotateIfNeeded();
+    hotkeysReplyWithWindow(c,
+        !strcasecmp(sub,"top") ? hotkeys_current : hotkeys_last,count);
+}
@@ -30,6 +30,7 @@
  */
 
 #include "redis.h"
+#include "endianconv.h"
 
 #include <stdint.h>
 #include <math.h>
@@ -358,6 +359,93 @@ static char *invalid_hll_err = "-INVALIDOBJ Corrupted HLL object detected\r\n";
     _p[_byte+1] |= _v >> _fb8; \
 } while(0)
 
+/* With the default HLL_BITS of 6, every 6 bytes of the dense representation
+ * hold exactly 8 registers. The following functions convert such a group of
+ * 6 bytes from / to 8 bytes holding one register each, operating on all the
+ * registers at once inside a 64 bit word (SWAR) instead of extracting them
+ * one by one with shifts that depend on the register position.
+ *
+ * In the unpacked word the register 'k' of the group is stored in the byte
+ * 'k' counting from the least significant one, so turning the word into
+ * memory just requires a little endian store. */
+// 一次处理 8 个寄存器：6 个字节 <-> 每个寄存器一个字节
+static inline uint64_t hllDenseUnpack8(const uint8_t *p) {
+    uint64_t x, y;
+
+    x = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+        ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) |
+        ((uint64_t)p[5] << 40);
+    /* Registers 0-3 go in the low 32 bits, registers 4-7 in the high ones. */
+    y = (x & 0xffffffULL) | ((x << 8) & 0xffffff00000000ULL);
+    return (y & 0x0000003f0000003fULL) |
+           ((y << 2) & 0x00003f0000003f00ULL) |
+           ((y << 4) & 0x003f0000003f0000ULL) |
+           ((y << 6) & 0x3f0000003f000000ULL);
+}
+
+static inline void hllDensePack8(uint8_t *p, uint64_t w) {
+    uint64_t y, x;
+
+    y = (w & 0x0000003f0000003fULL) |
+        ((w >> 2) & 0x00000fc000000fc0ULL) |
+        ((w >> 4) & 0x0003f0000003f000ULL) |
+        ((w >> 6) & 0x00fc000000fc0000ULL);
+    x = (y & 0xffffffULL) | ((y >> 8) & 0xffffff000000ULL);
+    p[0] = x; p[1] = x >> 8; p[2] = x >> 16;
+    p[3] = x >> 24; p[4] = x >> 32; p[5] = x >> 40;
+}
+
+/* Per byte MAX() of two words of unpacked registers. This only works because
+ * registers are less than 128, so setting the most significant bit of every
+ * byte of 'a' makes sure the subtraction never borrows across bytes. */
+static inline uint64_t hllMax8(uint64_t a, uint64_t b) {
+    uint64_t ge = ((a | 0x8080808080808080ULL) - b) & 0x8080808080808080ULL;
+    uint64_t mask = (ge >> 7) * 0xff; /* 0xff where a >= b. */
+    return (a & mask) | (b & ~mask);
+}
+
+/* Load / store 8 unpacked registers from / to an uint8_t register array. */
+static inline uint64_t hllLoad8(const uint8_t *p) {
+    uint64_t w;
+    memcpy(&w,p,sizeof(w));
+    memrev64ifbe(&w);
+    return w;
+}
+
+static inline void hllStore8(uint8_t *p, uint64_t w) {
+    memrev64ifbe(&w);
+    memcpy(p,&w,sizeof(w));
+}
+
+/* Add the 8 registers of an unpacked word to the histogram 'reghisto'. */
+static inline void hllHisto8(int *reghisto, uint64_t w) {
+    if (w == 0) {
+        reghisto[0] += 8;
+        return;
+    }
+    reghisto[w & 0xff]++;
+    reghisto[(w >> 8) & 0xff]++;
+    reghisto[(w >> 16) & 0xff]++;
+    reghisto[(w >> 24) & 0xff]++;
+    reghisto[(w >> 32) & 0xff]++;
+    reghisto[(w >> 40) & 0xff]++;
+    reghisto[(w >> 48) & 0xff]++;
+    reghisto[w >> 56]++;
+}
+
+/* Compute SUM(2^-reg) from an histogram of the register values. Summing
+ * 64 products is both faster and more accurate than adding the 16384
+ * terms one after the other. */
+static double hllHistoSum(int *reghisto, double *PE, int *ezp) {
+    double E = 0;
+    int j;
+
+    for (j = HLL_REGISTER_MAX; j >= 0; j--)
+        if (reghisto[j]) E += reghisto[j]*PE[j];
+    *ezp = reghisto[0];
+    return E;
+}
+
 /* Macros to access the sparse representation.
  * The macros parameter is expected to be an uint8_t pointer. */
 #define HLL_SPARSE_XZERO_BIT 0x40 /* 01xxxxxx */
@@ -507,38 +595,17 @@ double hllDenseSum(uint8_t *registers, double *PE, int *ezp) {
 
     /* Redis default is to use 16384 registers 6 bits each. The code works
      * with other values by modifying the defines, but for our target value
-     * we take a faster path with unrolled loops. */
+     * we take a faster path unpacking 8 registers at a time into an
+     * histogram of the register values. */
     if (HLL_REGISTERS == 16384 && HLL_BITS == 6) {
+        int reghisto[HLL_REGISTER_MAX+1] = {0};
         uint8_t *r = registers;
-        unsigned long r0, r1, r2, r3, r4, r5, r6, r7, r8, r9,
-                      r10, r11, r12, r13, r14, r15;
-        for (j = 0; j < 1024; j++) {
-            /* Handle 16 registers per iteration. */
-            r0 = r[0] & 63; if (r0 == 0) ez++;
-            r1 = (r[0] >> 6 | r[1] << 2) & 63; if (r1 == 0) ez++;
-            r2 = (r[1] >> 4 | r[2] << 4) & 63; if (r2 == 0) ez++;
-            r3 = (r[2] >> 2) & 63; if (r3 == 0) ez++;
-            r4 = r[3] & 63; if (r4 == 0) ez++;
-            r5 = (r[3] >> 6 | r[4] << 2) & 63; if (r5 == 0) ez++;
-            r6 = (r[4] >> 4 | r[5] << 4) & 63; if (r6 == 0) ez++;
-            r7 = (r[5] >> 2) & 63; if (r7 == 0) ez++;
-            r8 = r[6] & 63; if (r8 == 0) ez++;
-            r9 = (r[6] >> 6 | r[7] << 2) & 63; if (r9 == 0) ez++;
-            r10 = (r[7] >> 4 | r[8] << 4) & 63; if (r10 == 0) ez++;
-            r11 = (r[8] >> 2) & 63; if (r11 == 0) ez++;
-            r12 = r[9] & 63; if (r12 == 0) ez++;
-            r13 = (r[9] >> 6 | r[10] << 2) & 63; if (r13 == 0) ez++;
-            r14 = (r[10] >> 4 | r[11] << 4) & 63; if (r14 == 0) ez++;
-            r15 = (r[11] >> 2) & 63; if (r15 == 0) ez++;
-
-            /* Additional parens will allow the compiler to optimize the
-             * code more with a loss of precision that is not very relevant
-             * here (floating point math is not commutative!). */
-            E += (PE[r0] + PE[r1]) + (PE[r2] + PE[r3]) + (PE[r4] + PE[r5]) +
-                 (PE[r6] + PE[r7]) + (PE[r8] + PE[r9]) + (PE[r10] + PE[r11]) +
-                 (PE[r12] + PE[r13]) + (PE[r14] + PE[r15]);
-            r += 12;
+
+        for (j = 0; j < HLL_REGISTERS/8; j++) {
+            hllHisto8(reghisto,hllDenseUnpack8(r));
+            r += 6;
         }
+        return hllHistoSum(reghisto,PE,ezp);
     } else {
         for (j = 0; j < HLL_REGISTERS; j++) {
             unsigned long reg;
@@ -926,31 +993,12 @@ double hllSparseSum(uint8_t *sparse, int sparselen, double *PE, int *ezp, int *i
 /* Implements the SUM operation for uint8_t data type which is only used
  * internally as speedup for PFCOUNT with multiple keys. */
 double hllRawSum(uint8_t *registers, double *PE, int *ezp) {
-    double E = 0;
-    int j, ez = 0;
-    uint64_t *word = (uint64_t*) registers;
-    uint8_t *bytes;
+    int reghisto[HLL_REGISTER_MAX+1] = {0};
+    int j;
 
-    for (j = 0; j < HLL_REGISTERS/8; j++) {
-        if (*word == 0) {
-            ez += 8;
-        } else {
-            bytes = (uint8_t*) word;
-            if (bytes[0]) E += PE[bytes[0]]; else ez++;
-            if (bytes[1]) E += PE[bytes[1]]; else ez++;
-            if (bytes[2]) E += PE[bytes[2]]; else ez++;
-            if (bytes[3]) E += PE[bytes[3]]; else ez++;
-            if (bytes[4]) E += PE[bytes[4]]; else ez++;
-            if (bytes[5]) E += PE[bytes[5]]; else ez++;
-            if (bytes[6]) E += PE[bytes[6]]; else ez++;
-            if (bytes[7]) E += PE[bytes[7]]; else ez++;
-        }
-        word++;
-    }
-    E += ez; /* 2^(-reg[j]) is 1 when m is 0, add it 'ez' times for every
-                zero register in the HLL. */
-    *ezp = ez;
-    return E;
+    for (j = 0; j < HLL_REGISTERS; j += 8)
+        hllHisto8(reghisto,hllLoad8(registers+j));
+    return hllHistoSum(reghisto,PE,ezp);
 }
 
 /* Return the approximated cardinality of the set based on the armonic
@@ -1045,7 +1093,15 @@ int hllMerge(uint8_t *max, robj *hll) {
     struct hllhdr *hdr = hll->ptr;
     int i;
 
-    if (hdr->encoding == HLL_DENSE) {
+    if (hdr->encoding == HLL_DENSE && HLL_BITS == 6) {
+        uint8_t *r = hdr->registers;
+
+        /* Unpack and merge 8 registers at a time. */
+        for (i = 0; i < HLL_REGISTERS; i += 8) {
+            hllStore8(max+i,hllMax8(hllLoad8(max+i),hllDenseUnpack8(r)));
+            r += 6;
+        }
+    } else if (hdr->encoding == HLL_DENSE) {
         uint8_t val;
 
         for (i = 0; i < HLL_REGISTERS; i++) {
@@ -1082,6 +1138,179 @@ int hllMerge(uint8_t *max, robj *hll) {
     return REDIS_OK;
 }
 
+/* ========================= PFCOUNT union cache ============================ */
+
+/* PFCOUNT called with multiple keys has to merge all the source HLLs into
+ * a temporary set of registers on every call, since the resulting union
+ * is not stored anywhere. Dashboards tend to ask for the same union again
+ * and again (for instance the last 30 daily HLLs) while most of the sources
+ * never change anymore, so we remember the cardinality of the last unions
+ * computed, and reuse it as long as no source key was touched.
+ *
+ * Every write to a key is reported by db.c via hllCacheKeyChanged(), that
+ * drops the cached unions the key is part of, and the flush of a whole DB
+ * via hllCacheFlush(). In order to make the check cheap when the cache is
+ * in use, 'sources' maps every key name used by a cached union to the
+ * number of unions referencing it.
+ *
+ * As a further protection every entry also records the value objects of
+ * the sources, that are looked up anyway on every PFCOUNT. */
+// 缓存多键 PFCOUNT 的结果，任意来源键被修改时失效
+
+#define HLL_CACHE_SIZE 64 /* Max number of unions cached. */
+
+typedef struct hllCacheEntry {
+    uint64_t hash;      /* Hash of the DB id and of the keys. */
+    int dbid;           /* DB of the source keys. */
+    int numkeys;        /* Number of source keys. */
+    sds *keys;          /* Source key names, as given to PFCOUNT. */
+    robj **vals;        /* Value objects of the sources (NULL if missing). */
+    uint64_t card;      /* Cardinality of the union. */
+    long long lastuse;  /* For the replacement of the oldest entry. */
+} hllCacheEntry;
+
+static struct {
+    hllCacheEntry *entries[HLL_CACHE_SIZE];
+    int used;           /* Number of not NULL entries. */
+    long long clock;    /* Incremented at every lookup. */
+    dict *sources;      /* Source key name -> entries using it. */
+} hllcache;
+
+static uint64_t hllCacheHash(int dbid, robj **keys, int numkeys) {
+    uint64_t hash = dbid;
+    int j;
+
+    for (j = 0; j < numkeys; j++)
+        hash = hash*31 + dictGenHashFunction(keys[j]->ptr,sdslen(keys[j]->ptr));
+    return hash;
+}
+
+/* Release the entry at slot 'slot', updating the sources references. */
+static void hllCacheDelEntry(int slot) {
+    hllCacheEntry *e = hllcache.entries[slot];
+    int j;
+
+    for (j = 0; j < e->numkeys; j++) {
+        dictEntry *de = dictFind(hllcache.sources,e->keys[j]);
+        uint64_t refs = dictGetUnsignedIntegerVal(de);
+
+        if (refs == 1)
+            dictDelete(hllcache.sources,e->keys[j]);
+        else
+            dictSetUnsignedIntegerVal(de,refs-1);
+        sdsfree(e->keys[j]);
+    }
+    zfree(e->keys);
+    zfree(e->vals);
+    zfree(e);
+    hllcache.entries[slot] = NULL;
+    hllcache.used--;
+}
+
+/* Return the slot caching the union of 'keys' in 'db' if it is still
+ * valid, that is, the source keys still point to the same objects,
+ * otherwise -1 is returned. */
+static int hllCacheLookup(redisDb *db, robj **keys, robj **vals, int numkeys, uint64_t hash) {
+    int slot, j;
+
+    if (hllcache.used == 0) return -1;
+    for (slot = 0; slot < HLL_CACHE_SIZE; slot++) {
+        hllCacheEntry *e = hllcache.entries[slot];
+
+        if (e == NULL || e->hash != hash || e->dbid != db->id ||
+            e->numkeys != numkeys) continue;
+        for (j = 0; j < numkeys; j++)
+            if (sdscmp(e->keys[j],keys[j]->ptr) != 0) break;
+        if (j != numkeys) continue;
+
+        /* Same union: is it still valid? */
+        for (j = 0; j < numkeys; j++)
+            if (e->vals[j] != vals[j]) break;
+        if (j != numkeys) {
+            hllCacheDelEntry(slot);
+            return -1;
+        }
+        e->lastuse = ++hllcache.clock;
+        return slot;
+    }
+    return -1;
+}
+
+/* Remember that the union of 'keys' in 'db' has cardinality 'card'. */
+static void hllCacheStore(redisDb *db, robj **keys, robj **vals, int numkeys, uint64_t hash, uint64_t card) {
+    hllCacheEntry *e;
+    int slot, j, victim = 0;
+
+    if (hllcache.sources == NULL)
+        hllcache.sources = dictCreate(&hllCacheSourcesDictType,NULL);
+
+    /* Use a free slot, or replace the least recently used entry. */
+    for (slot = 0; slot < HLL_CACHE_SIZE; slot++) {
+        if (hllcache.entries[slot] == NULL) break;
+        if (hllcache.entries[slot]->lastuse <
+            hllcache.entries[victim]->lastuse) victim = slot;
+    }
+    if (slot == HLL_CACHE_SIZE) {
+        hllCacheDelEntry(victim);
+        slot = victim;
+    }
+
+    e = zmalloc(sizeof(*e));
+    e->hash = hash;
+    e->dbid = db->id;
+    e->numkeys = numkeys;
+    e->keys = zmalloc(sizeof(sds)*numkeys);
+    e->vals = zmalloc(sizeof(robj*)*numkeys);
+    e->card = card;
+    e->lastuse = ++hllcache.clock;
+    for (j = 0; j < numkeys; j++) {
+        dictEntry *de;
+
+        e->keys[j] = sdsdup(keys[j]->ptr);
+        e->vals[j] = vals[j];
+        if ((de = dictFind(hllcache.sources,e->keys[j])) != NULL) {
+            dictSetUnsignedIntegerVal(de,dictGetUnsignedIntegerVal(de)+1);
+        } else {
+            de = dictAddRaw(hllcache.sources,sdsdup(e->keys[j]));
+            dictSetUnsignedIntegerVal(de,1);
+        }
+    }
+    hllcache.entries[slot] = e;
+    hllcache.used++;
+}
+
+/* Called by db.c every time the key 'key' of 'db' is going to be modified,
+ * overwritten or deleted: drop the cached unions using it. */
+void hllCacheKeyChanged(redisDb *db, sds key) {
+    int slot, j;
+
+    if (hllcache.used == 0 || dictFind(hllcache.sources,key) == NULL) return;
+    for (slot = 0; slot < HLL_CACHE_SIZE; slot++) {
+        hllCacheEntry *e = hllcache.entries[slot];
+
+        if (e == NULL || e->dbid != db->id) continue;
+        for (j = 0; j < e->numkeys; j++) {
+            if (sdscmp(e->keys[j],key) == 0) {
+                hllCacheDelEntry(slot);
+                break;
+            }
+        }
+    }
+}
+
+/* Called by db.c when the DB 'dbid' (or all the DBs if -1) is emptied or
+ * replaced. */
+void hllCacheFlush(int dbid) {
+    int slot;
+
+    if (hllcache.used == 0) return;
+    for (slot = 0; slot < HLL_CACHE_SIZE; slot++) {
+        hllCacheEntry *e = hllcache.entries[slot];
+
+        if (e && (dbid == -1 || e->dbid == dbid)) hllCacheDelEntry(slot);
+    }
+}
+
 /* ========================== HyperLogLog commands ========================== */
 
 /* Create an HLL object. We always create the HLL using sparse encoding.
@@ -1203,29 +1432,53 @@ void pfcountCommand(redisClient *c) {
      * the cardinality of the merge of the N HLLs specified. */
     if (c->argc > 2) {
         uint8_t max[HLL_HDR_SIZE+HLL_REGISTERS], *registers;
-        int j;
+        int j, slot, numkeys = c->argc-1;
+        robj **vals = zmalloc(sizeof(robj*)*numkeys);
+        uint64_t hash;
+
+        /* Check type and size of all the sources. */
+        for (j = 0; j < numkeys; j++) {
+            vals[j] = lookupKeyRead(c->db,c->argv[j+1]);
+            if (vals[j] && isHLLObjectOrReply(c,vals[j]) != REDIS_OK) {
+                zfree(vals);
+                return;
+            }
+        }
+
+        /* Reuse the cardinality computed by a previous call if none of
+         * the sources changed meanwhile. */
+        // 来源键都没有变化时，直接返回缓存的基数
+        hash = hllCacheHash(c->db->id,c->argv+1,numkeys);
+        slot = hllCacheLookup(c->db,c->argv+1,vals,numkeys,hash);
+        if (slot != -1) {
+            addReplyLongLong(c,hllcache.entries[slot]->card);
+            zfree(vals);
+            return;
+        }
 
         /* Compute an HLL with M[i] = MAX(M[i]_j). */
         memset(max,0,sizeof(max));
         hdr = (struct hllhdr*) max;
         hdr->encoding = HLL_RAW; /* Special internal-only encoding. */
         registers = max + HLL_HDR_SIZE;
-        for (j = 1; j < c->argc; j++) {
-            /* Check type and size. */
-            robj *o = lookupKeyRead(c->db,c->argv[j]);
-            if (o == NULL) continue; /* Assume empty HLL for non existing var. */
-            if (isHLLObjectOrReply(c,o) != REDIS_OK) return;
+        for (j = 0; j < numkeys; j++) {
+            /* Assume empty HLL for non existing var. */
+            if (vals[j] == NULL) continue;
 
             /* Merge with this HLL with our 'max' HHL by setting max[i]
              * to MAX(max[i],hll[i]). */
-            if (hllMerge(registers,o) == REDIS_ERR) {
+            if (hllMerge(registers,vals[j]) == REDIS_ERR) {
                 addReplySds(c,sdsnew(invalid_hll_err));
+                zfree(vals);
                 return;
             }
         }
 
         /* Compute cardinality of the resulting set. */
-        addReplyLongLong(c,hllCount(hdr,NULL));
+        card = hllCount(hdr,NULL);
+        hllCacheStore(c->db,c->argv+1,vals,numkeys,hash,card);
+        addReplyLongLong(c,card);
+        zfree(vals);
         return;
     }
 
@@ -1329,8 +1582,13 @@ void pfmergeCommand(redisClient *c) {
     /* Write the resulting HLL to the destination HLL registers and
      * invalidate the cached value. */
     hdr = o->ptr;
-    for (j = 0; j < HLL_REGISTERS; j++) {
-        HLL_DENSE_SET_REGISTER(hdr->registers,j,max[j]);
+    if (HLL_BITS == 6) {
+        for (j = 0; j < HLL_REGISTERS; j += 8)
+            hllDensePack8(hdr->registers+j/8*6,hllLoad8(max+j));
+    } else {
+        for (j = 0; j < HLL_REGISTERS; j++) {
+            HLL_DENSE_SET_REGISTER(hdr->registers,j,max[j]);
+        }
     }
     HLL_INVALIDATE_CACHE(hdr);
 
@@ -0,0 +1,125 @@
+/* latency.h -- latency monitor API header file
+ * See latency.c for more information.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#define LATENCY_TS_LEN 160 /* History length for every monitored event. */
+
+/* Representation of a latency sample: the sampling time and the latency
+ * observed in milliseconds. */
+/*
+ * 延迟采样：采样的时间以及观察到的延迟（毫秒）
+ */
+struct latencySample {
+    int32_t time; /* We don't use time_t to force 4 bytes usage everywhere. */
+    uint32_t latency; /* Latency in milliseconds. */
+};
+
+/* The latency time series for a given event. */
+/*
+ * 某个事件的延迟时间序列，是一个长度为 LATENCY_TS_LEN 的环形数组，
+ * 同一秒内的多个采样只保留最大的那个
+ */
+struct latencyTimeSeries {
+    int idx; /* Index of the next sample to store. */
+    uint32_t max; /* Max latency observed for this event. */
+    struct latencySample samples[LATENCY_TS_LEN]; /* Latest history. */
+};
+
+/* Latency statistics structure. */
+/*
+ * 根据时间序列计算出来的统计数据，供 LATENCY DOCTOR 使用
+ */
+struct latencyStats {
+    uint32_t all_time_high; /* Absolute max observed since latest reset. */
+    uint32_t avg;           /* Average of current samples. */
+    uint32_t min;           /* Min of current samples. */
+    uint32_t max;           /* Max of current samples. */
+    uint32_t mad;           /* Mean absolute deviation. */
+    uint32_t samples;       /* Number of non-zero samples. */
+    time_t period;          /* Number of seconds since first event and now. */
+};
+
+/* Per command latency histogram. Values (microseconds) are stored in a
+ * log-linear layout like HdrHistogram: values below 64 have their own
+ * bucket, then every power of two is split into LATENCY_HIST_SUB_COUNT
+ * linear sub buckets, so the relative error is below 1/32 (about 3%). */
+#define LATENCY_HIST_SUB_BITS 5
+#define LATENCY_HIST_SUB_COUNT (1<<LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 32 /* Values are capped to 2^32-1 usec. */
+#define LATENCY_HIST_BUCKETS \
+    ((LATENCY_HIST_MAX_BITS-LATENCY_HIST_SUB_BITS+1)*LATENCY_HIST_SUB_COUNT)
+
+/*
+ * 命令执行时间的直方图，用于计算 p50 、 p99 之类的百分位数
+ */
+typedef struct latencyHistogram {
+    long long count;    /* Number of recorded values. */
+    long long max;      /* Max recorded value. */
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+} latencyHistogram;
+
+void latencyMonitorInit(void);
+void latencyAddSample(char *event, mstime_t latency);
+latencyHistogram *latencyHistogramCreate(void);
+void latencyHistogramReset(latencyHistogram *h);
+void latencyHistogramRecord(latencyHistogram *h, long long usec);
+long long latencyHistogramPercentile(latencyHistogram *h, double perc);
+
+/* Latency monitoring macros. */
+
+/* Start monitoring an event. We just set the current time. */
+#define latencyStartMonitor(var) if (server.latency_monitor_threshold) { \
+    var = mstime(); \
+} else { \
+    var = 0; \
+}
+
+/* End monitoring an event, compute the difference with the current time
+ * to check the amount of time elapsed. */
+#define latencyEndMonitor(var) if (server.latency_monitor_threshold) { \
+    var = mstime() - var; \
+}
+
+/* Add the sample only if the elapsed time is >= to the configured threshold. */
+#define latencyAddSampleIfNeeded(event,var) \
+    if (server.latency_monitor_threshold && \
+        (var) >= server.latency_monitor_threshold) \
+          latencyAddSample((event),(var));
+
+/* Remove time from a nested event. */
+#define latencyRemoveNestedEvent(event_var,nested_var) \
+    event_var += nested_var;
+
+#endif /* __LATENCY_H */
@@ -0,0 +1,298 @@
+/* lazyfree.c - Free big values and whole databases in a background thread
+ *
+ * 惰性释放：将体积巨大的值以及整个数据库交给 bio 后台线程释放，
+ * 避免 DEL 、 FLUSHALL 之类的命令长时间阻塞事件循环。
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Objects stored inside sets, hashes and sorted sets are reference counted
+ * and may be shared with other values or with client output buffers, so the
+ * bio thread and the main thread can end up touching the same refcount.
+ * While at least one lazyfree job is pending, incrRefCount() and
+ * decrRefCount() switch to atomic operations (see lazyfreeInProgress()),
+ * so the two threads never lose an update. When no job is pending the
+ * refcount is updated with plain instructions as usual.
+ *
+ * Without atomic builtins there is no cheap way to do this, so everything
+ * is freed synchronously, as if the value was always small. */
+
+#include "redis.h"
+#include "bio.h"
+#include "cluster.h"
+
+/* Number of lazyfree jobs not yet completed by the bio thread. It is only
+ * increased by the main thread and decreased by the bio thread once it no
+ * longer touches any object. */
+volatile int lazyfree_jobs = 0;
+
+/* Number of objects (or keys of whole databases) waiting to be freed. */
+static volatile size_t lazyfree_objects = 0;
+
+/* Values requiring more work than this are freed in the background. */
+#define LAZYFREE_THRESHOLD 64
+
+#ifdef HAVE_ATOMIC
+#define lazyfreeAtomicIncr(_var,_n) __sync_add_and_fetch(&(_var),(_n))
+#define lazyfreeAtomicDecr(_var,_n) __sync_sub_and_fetch(&(_var),(_n))
+#endif
+
+/* Return the number of objects still waiting to be freed by the bio
+ * thread. */
+size_t lazyfreeGetPendingObjectsCount(void) {
+#ifdef HAVE_ATOMIC
+    return lazyfreeAtomicIncr(lazyfree_objects,0);
+#else
+    return 0;
+#endif
+}
+
+/* Return the amount of work needed in order to free an object.
+ * The return value is not always the actual number of allocations the
+ * object is composed of, but a number proportional to it.
+ *
+ * For strings the function always returns 1.
+ *
+ * For aggregated objects represented by hash tables or other data structures
+ * the function just returns the number of elements the object is composed of.
+ *
+ * Objects composed of single allocations are always reported as having a
+ * single item even if they are actually logical composed of multiple
+ * elements.
+ *
+ * For lists the function returns the number of elements in the quicklist
+ * representing the list.
+ *
+ * 返回释放对象 obj 所需的工作量
+ */
+size_t lazyfreeGetFreeEffort(robj *obj) {
+    if (obj->type == REDIS_LIST) {
+        quicklist *ql = obj->ptr;
+        return ql->len;
+    } else if (obj->type == REDIS_SET && obj->encoding == REDIS_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == REDIS_ZSET && obj->encoding == REDIS_ENCODING_SKIPLIST){
+        zset *zs = obj->ptr;
+        return zs->zsl->length;
+    } else if (obj->type == REDIS_HASH && obj->encoding == REDIS_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == REDIS_STRING &&
+               obj->encoding == REDIS_ENCODING_CHUNKED) {
+        return ((stringChunks*)obj->ptr)->count;
+    } else if (obj->type == REDIS_STREAM) {
+        stream *s = obj->ptr;
+        return raxSize(s->rax);
+    } else {
+        return 1; /* Everything else is a single allocation. */
+    }
+}
+
+/* Hand one unit of work to the bio thread: see the top comment for the
+ * reason the job counter must be increased before the job is created. */
+#ifdef HAVE_ATOMIC
+static void lazyfreeCreateJob(size_t objects, void *arg1, void *arg2,
+                              void *arg3)
+{
+    lazyfreeAtomicIncr(lazyfree_jobs,1);
+    lazyfreeAtomicIncr(lazyfree_objects,objects);
+    bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE,arg1,arg2,arg3);
+}
+#endif
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If there are enough allocations to free the value object may be put into
+ * a lazy free list instead of being freed synchronously. The lazy free list
+ * will be reclaimed in a different bio.c thread.
+ *
+ * 从数据库中删除给定的键，键的值以及过期时间，
+ * 如果值的体积足够大，那么就把它交给后台线程释放。
+ */
+int dbAsyncDelete(redisDb *db, robj *key) {
+#ifdef HAVE_ATOMIC
+    dictEntry *de;
+
+    if (server.forkless_save) snapshotKeyWillChange(db,key->ptr);
+    hllCacheKeyChanged(db,key->ptr);
+
+    /* Deleting an entry from the expires dict will not free the sds of
+     * the key, because it is shared with the main dictionary. */
+    if (dictSize(db->expires) > 0) dbDeleteExpire(db,key->ptr);
+
+    /* If the value is composed of a few allocations, to free in a lazy way
+     * is actually just slower... So under a certain limit we just free
+     * the object synchronously. */
+    de = dictFind(db->dict,key->ptr);
+    if (de) {
+        robj *val = dictGetVal(de);
+        size_t free_effort = lazyfreeGetFreeEffort(val);
+
+        /* If releasing the object is too much work, let's put it into the
+         * lazy free list. A shared value (refcount > 1) will be freed by its
+         * last owner anyway. */
+        if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
+            lazyfreeCreateJob(1,val,NULL,NULL);
+            // 值的所有权已经交给后台线程，字典删除节点时不会再释放它
+            dictSetVal(db->dict,de,NULL);
+        }
+    }
+
+    /* The slots to keys map shares the sds of the key: remove it from
+     * there before the key is released. */
+    if (server.cluster_enabled) slotToKeyDel(key);
+
+    /* Release the key-val pair, or just the key if we set the val
+     * field to NULL in order to lazy free it later. */
+    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+        return 1;
+    } else {
+        return 0;
+    }
+#else
+    return dbSyncDelete(db,key);
+#endif
+}
+
+/* Empty a Redis DB asynchronously. What the function does actually is to
+ * create a new empty set of hash tables and scheduling the old ones for
+ * lazy freeing.
+ *
+ * 将数据库的字典替换为新的空字典，旧字典交给后台线程释放
+ */
+void emptyDbAsync(redisDb *db) {
+#ifdef HAVE_ATOMIC
+    dict *oldht1 = db->dict, *oldht2 = db->expires;
+
+    db->dict = dictCreate(&dbDictType,NULL);
+    db->expires = dictCreate(&keyptrDictType,NULL);
+    freeDbDictsAsync(oldht1,oldht2);
+#else
+    dictEmpty(db->dict,NULL);
+    dictEmpty(db->expires,NULL);
+#endif
+    expireIndexFlush(db,1);
+}
+
+/* Free the main dictionary and the expires dictionary of a DB that were
+ * already detached from it, like emptyDbAsync() does. */
+void freeDbDictsAsync(dict *ht1, dict *ht2) {
+#ifdef HAVE_ATOMIC
+    lazyfreeCreateJob(dictSize(ht1),NULL,ht1,ht2);
+#else
+    dictRelease(ht1);
+    dictRelease(ht2);
+#endif
+}
+
+/* Free the expire index of a DB already detached from it. */
+void freeExpireIndexAsync(rax *index) {
+#ifdef HAVE_ATOMIC
+    lazyfreeCreateJob(raxSize(index),NULL,index,NULL);
+#else
+    raxFree(index);
+#endif
+}
+
+/* Empty the slots-keys map of Redis Cluster by creating a new empty one
+ * and scheduling the old for lazy freeing. */
+void slotToKeyFlushAsync(void) {
+#ifdef HAVE_ATOMIC
+    dict **oldslots = server.cluster->slots_to_keys;
+
+    server.cluster->slots_to_keys = slotToKeyCreate();
+    freeSlotsMapAsync(oldslots);
+#else
+    slotToKeyFlush();
+#endif
+}
+
+/* Free a slots-keys map already detached from the cluster state. */
+void freeSlotsMapAsync(dict **slots) {
+#ifdef HAVE_ATOMIC
+    lazyfreeCreateJob(slotToKeyCount(slots),NULL,NULL,slots);
+#else
+    slotToKeyRelease(slots);
+#endif
+}
+
+/* Release objects from the lazyfree thread. It's just decrRefCount()
+ * updating the count of objects to release.
+ *
+ * The job counter is decreased last: after that the main thread may go
+ * back to non atomic refcount updates. */
+void lazyfreeFreeObjectFromBioThread(robj *o) {
+    decrRefCount(o);
+#ifdef HAVE_ATOMIC
+    lazyfreeAtomicDecr(lazyfree_objects,1);
+    lazyfreeAtomicDecr(lazyfree_jobs,1);
+#endif
+}
+
+/* Release a database from the lazyfree thread. The 'db' pointer is the
+ * database which was substituted with a fresh one in the main thread
+ * when the database was logically deleted. */
+void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
+    size_t numkeys = dictSize(ht1);
+
+    dictRelease(ht1);
+    dictRelease(ht2);
+#ifdef HAVE_ATOMIC
+    lazyfreeAtomicDecr(lazyfree_objects,numkeys);
+    lazyfreeAtomicDecr(lazyfree_jobs,1);
+#else
+    REDIS_NOTUSED(numkeys);
+#endif
+}
+
+/* Release the dictionaries mapping Redis Cluster slots to keys in the
+ * lazyfree thread. */
+void lazyfreeFreeSlotsMapFromBioThread(dict **slots) {
+    size_t len = slotToKeyCount(slots);
+
+    slotToKeyRelease(slots);
+#ifdef HAVE_ATOMIC
+    lazyfreeAtomicDecr(lazyfree_objects,len);
+    lazyfreeAtomicDecr(lazyfree_jobs,1);
+#else
+    REDIS_NOTUSED(len);
+#endif
+}
+
+/* Release the expire index of a DB in the lazyfree thread. */
+void lazyfreeFreeExpireIndexFromBioThread(rax *index) {
+    size_t len = raxSize(index);
+
+    raxFree(index);
+#ifdef HAVE_ATOMIC
+    lazyfreeAtomicDecr(lazyfree_objects,len);
+    lazyfreeAtomicDecr(lazyfree_jobs,1);
+#else
+    REDIS_NOTUSED(len);
+#endif
+}
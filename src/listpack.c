@@ -0,0 +1,1062 @@
+/* listpack.c - A list of strings serialization format
+ *
+ * A listpack is a compact, single allocation, list of strings and integers,
+ * used where ziplists were used before. The difference is in how an entry
+ * knows the length of the entries around it: a ziplist entry stores the
+ * length of the *previous* entry, so inserting or deleting an entry may
+ * change the size of the length field of the next one, which may in turn
+ * change the next one, and so forth (the "cascading update" of ziplist.c).
+ * A listpack entry instead stores its *own* length at its end (the backlen),
+ * so every entry is self contained and no modification ever touches the
+ * entries around it, but for the memmove() of the tail.
+ *
+ * 紧凑列表：每个元素在末尾保存自己的长度（backlen），
+ * 所以插入、删除元素都不会像 ziplist 那样引起连锁更新
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* LISTPACK OVERALL LAYOUT:
+ *
+ * |  4 byte  |  2 byte  |  ..............  |  1 byte |
+ * +----------+----------+------------------+---------+
+ * | tot-bytes| num-elem |  ... entries ... |   0xFF  |
+ * +----------+----------+------------------+---------+
+ *
+ * tot-bytes is the size of the whole listpack, num-elem the number of
+ * entries, or 65535 if the listpack holds 65535 entries or more: in that
+ * case the entries must be scanned to know how many there are. Both are
+ * little endian.
+ *
+ * Every entry is:
+ *
+ * [encoding-type][element-data][backlen]
+ *
+ * The encoding type and the data are:
+ *
+ * 0xxxxxxx                          7 bit unsigned integer.
+ * 10xxxxxx <string>                 String, 6 bit length.
+ * 110xxxxx yyyyyyyy                 13 bit signed integer.
+ * 1110xxxx yyyyyyyy <string>        String, 12 bit length.
+ * 11110000 <4 bytes len> <string>   String, 32 bit length.
+ * 11110001 <2 bytes>                16 bit signed integer.
+ * 11110010 <3 bytes>                24 bit signed integer.
+ * 11110011 <4 bytes>                32 bit signed integer.
+ * 11110100 <8 bytes>                64 bit signed integer.
+ * 11111111                          End of listpack.
+ *
+ * Multi byte lengths and integers are little endian, negative integers are
+ * stored in two's complement of the width of their encoding.
+ *
+ * backlen is the length of encoding-type plus element-data, stored in 1 to
+ * 5 bytes so that it can be parsed from right to left: every byte holds 7
+ * bits of the length, the rightmost byte the least significant ones, and
+ * the most significant bit of a byte is set if more bytes follow on its
+ * left. This is what makes walking the listpack backward possible.
+ *
+ * 元素：编码类型 + 数据 + backlen（从右往左解析的自身长度） */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "listpack.h"
+#include "zmalloc.h"
+#include "util.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)  (((uint32_t)(p)[0]<<0) | \
+                             ((uint32_t)(p)[1]<<8) | \
+                             ((uint32_t)(p)[2]<<16) | \
+                             ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p) (((uint32_t)(p)[4]<<0) | \
+                             ((uint32_t)(p)[5]<<8))
+
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Entry types returned by lpEncodeGetType(). */
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+/* ------------------------- Encoding helpers ------------------------------- */
+
+/* Encode the integer 'v' in the smallest encoding able to represent it,
+ * writing the encoded bytes in 'intenc' and their number in '*enclen'. */
+static void lpEncodeIntegerGetType(int64_t v, unsigned char *intenc,
+                                   uint64_t *enclen) {
+    if (v >= 0 && v <= 127) {
+        intenc[0] = v;
+        *enclen = 1;
+    } else if (v >= -4096 && v <= 4095) {
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        *enclen = 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        *enclen = 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        *enclen = 4;
+    } else if (v >= -2147483648LL && v <= 2147483647LL) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        *enclen = 5;
+    } else {
+        uint64_t uv = v;
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        intenc[1] = uv&0xff;
+        intenc[2] = (uv>>8)&0xff;
+        intenc[3] = (uv>>16)&0xff;
+        intenc[4] = (uv>>24)&0xff;
+        intenc[5] = (uv>>32)&0xff;
+        intenc[6] = (uv>>40)&0xff;
+        intenc[7] = (uv>>48)&0xff;
+        intenc[8] = uv>>56;
+        *enclen = 9;
+    }
+}
+
+/* Return LP_ENCODING_INT if the string 'ele' of 'size' bytes can be stored
+ * as an integer, writing its encoding in 'intenc', otherwise return
+ * LP_ENCODING_STRING. In both cases '*enclen' is set to the number of bytes
+ * of encoding-type plus element-data, the backlen excluded.
+ *
+ * 能转成整数的字符串按整数编码，和 ziplist 一样 */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size,
+                           unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+
+    if (size <= 20 && string2ll((char*)ele,size,&v)) {
+        lpEncodeIntegerGetType(v,intenc,enclen);
+        return LP_ENCODING_INT;
+    }
+    if (size < 64) *enclen = 1+size;
+    else if (size < 4096) *enclen = 2+size;
+    else *enclen = 5+(uint64_t)size;
+    return LP_ENCODING_STRING;
+}
+
+/* Write the string encoding-type and element-data of 's' in 'buf', that
+ * must have room for the length returned by lpEncodeGetType(). */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Store in 'buf' the backlen encoding of the entry length 'l', and return
+ * the number of bytes used. With a NULL 'buf' only the size is returned. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen whose last byte is pointed by 'p', parsing it from
+ * right to left. Returns UINT64_MAX if the encoding is too long. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while (1);
+    return val;
+}
+
+/* Return the length of encoding-type plus element-data of the entry at
+ * 'p', without its backlen. Returns 0 for an invalid encoding byte. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    if (p[0] == LP_ENCODING_16BIT_INT) return 3;
+    if (p[0] == LP_ENCODING_24BIT_INT) return 4;
+    if (p[0] == LP_ENCODING_32BIT_INT) return 5;
+    if (p[0] == LP_ENCODING_64BIT_INT) return 9;
+    if (p[0] == LP_ENCODING_32BIT_STR) return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    if (p[0] == LP_EOF) return 1;
+    return 0;
+}
+
+/* Return the number of bytes needed to read the encoded size of the entry
+ * at 'p': lpCurrentEncodedSize() must not be called on fewer bytes. */
+static uint32_t lpEncodingSizeBytes(unsigned char *p) {
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2;
+    if (p[0] == LP_ENCODING_32BIT_STR) return 5;
+    return 1;
+}
+
+/* Skip the entry at 'p', returning the address of the next one (or of the
+ * terminator). */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p+entrylen;
+}
+
+/* ------------------------------ Public API -------------------------------- */
+
+/* Create a new empty listpack. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Return the total number of bytes the listpack is composed of. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Return the first entry of the listpack, or NULL if it is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry after 'p', or NULL if 'p' is the last one. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    assert(p);
+    p = lpSkip(p);
+    assert(p < lp+lpGetTotalBytes(lp));
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry before 'p', or NULL if 'p' is the first one. 'p' may
+ * also point to the terminator, so that the last entry is returned.
+ *
+ * 通过前一个元素的 backlen 向前跳转 */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    assert(p);
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the backlen of the previous entry. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    p -= prevlen-1; /* Seek the first byte of the previous entry. */
+    return p;
+}
+
+/* Return the last entry of the listpack, or NULL if it is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek the terminator. */
+    return lpPrev(lp,p);
+}
+
+/* Return the number of entries. When the header counter saturated, the
+ * entries are counted, and the counter is set again if it fits. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned char *p;
+    unsigned long count = 0;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    p = lpFirst(lp);
+    while (p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the entry at 'p'.
+ *
+ * If it is a string, the returned pointer points to the string inside the
+ * listpack and its length is stored in '*count'. If it is an integer and
+ * 'intbuf' is not NULL, the integer is converted to string inside 'intbuf'
+ * (of at least LP_INTBUF_SIZE bytes) which is returned, with the length in
+ * '*count'. If it is an integer and 'intbuf' is NULL, NULL is returned and
+ * the integer itself is stored in '*count'.
+ *
+ * 取出元素：字符串直接返回指针，整数写入 count（或转换成字符串写入 intbuf） */
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
+    int64_t val;
+    uint64_t uval, negstart, negmax;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        negstart = UINT64_MAX; /* 7 bit ints are always positive. */
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *count = LP_ENCODING_6BIT_STR_LEN(p);
+        return p+1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24 |
+               (uint64_t)p[5]<<32 |
+               (uint64_t)p[6]<<40 |
+               (uint64_t)p[7]<<48 |
+               (uint64_t)p[8]<<56;
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *count = LP_ENCODING_12BIT_STR_LEN(p);
+        return p+2;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *count = LP_ENCODING_32BIT_STR_LEN(p);
+        return p+5;
+    } else {
+        assert(NULL); /* Invalid encoding. */
+        return NULL;
+    }
+
+    /* Convert the two's complement of the encoding width to int64_t. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        val = uval;
+        val = -val-1;
+    } else {
+        val = uval;
+    }
+
+    if (intbuf) {
+        *count = ll2string((char*)intbuf,LP_INTBUF_SIZE,(long long)val);
+        return intbuf;
+    } else {
+        *count = val;
+        return NULL;
+    }
+}
+
+/* Same as lpGet(), with the calling convention of ziplistGet(): returns the
+ * string and sets '*slen', or returns NULL and sets '*lval' to the integer. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Insert, delete or replace the entry at 'p'.
+ *
+ * If 'ele' is NULL the entry at 'p' is deleted, otherwise 'ele' of 'size'
+ * bytes is inserted before 'p' (LP_BEFORE), after 'p' (LP_AFTER) or in
+ * place of 'p' (LP_REPLACE). To append, insert before the terminator.
+ *
+ * If 'newp' is not NULL it is set to the address of the inserted entry, or
+ * on deletion to the entry that followed the deleted one (NULL if it was
+ * the last one).
+ *
+ * Only the entries after 'p' are moved, their content is never changed:
+ * there is no cascading update.
+ *
+ * 插入 / 删除 / 替换元素，只需要移动后面的内存，不会连锁更新 */
+unsigned char *lpInsertString(unsigned char *lp, unsigned char *ele,
+                              uint32_t size, unsigned char *p, int where,
+                              unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen = 0, backlen_size = 0, replaced_len = 0;
+    uint64_t old_bytes, new_bytes;
+    unsigned long poff;
+    unsigned char *dst;
+    int enctype = LP_ENCODING_STRING;
+
+    if (ele == NULL) where = LP_REPLACE; /* Deletion. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+    poff = p-lp;
+
+    if (ele) {
+        enctype = lpEncodeGetType(ele,size,intenc,&enclen);
+        backlen_size = lpEncodeBacklen(backlen,enclen);
+    }
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    old_bytes = lpGetTotalBytes(lp);
+    new_bytes = old_bytes+enclen+backlen_size-replaced_len;
+    assert(new_bytes <= UINT32_MAX);
+
+    /* Grow before moving the tail, shrink after. */
+    if (new_bytes > old_bytes) lp = zrealloc(lp,new_bytes);
+    dst = lp+poff;
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_bytes-poff);
+    } else {
+        memmove(dst+enclen+backlen_size,dst+replaced_len,
+                old_bytes-poff-replaced_len);
+    }
+    if (new_bytes < old_bytes) lp = zrealloc(lp,new_bytes);
+    dst = lp+poff;
+
+    if (newp) {
+        *newp = dst;
+        if (!ele && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (ele) {
+        if (enctype == LP_ENCODING_INT)
+            memcpy(dst,intenc,enclen);
+        else
+            lpEncodeString(dst,ele,size);
+        memcpy(dst+enclen,backlen,backlen_size);
+    }
+
+    /* A replacement does not change the number of entries. */
+    if (where != LP_REPLACE || ele == NULL) {
+        uint32_t numele = lpGetNumElements(lp);
+        if (numele != LP_HDR_NUMELE_UNKNOWN) {
+            if (ele) numele++; else numele--;
+            lpSetNumElements(lp,numele);
+        }
+    }
+    lpSetTotalBytes(lp,new_bytes);
+    return lp;
+}
+
+/* Append the string 's' at the tail of the listpack. */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    unsigned char *eofptr = lp+lpGetTotalBytes(lp)-1;
+    return lpInsertString(lp,s,slen,eofptr,LP_BEFORE,NULL);
+}
+
+/* Prepend the string 's' at the head of the listpack. */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    return lpInsertString(lp,s,slen,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
+/* Replace the entry at '*p' with the string 's', updating '*p' to point to
+ * the new entry. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *s, uint32_t slen) {
+    return lpInsertString(lp,s,slen,*p,LP_REPLACE,p);
+}
+
+/* Delete the entry at 'p'. If 'newp' is not NULL it is set to the entry
+ * that followed, or NULL if the deleted entry was the last one. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsertString(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete up to 'num' entries starting at '*p', with a single memmove().
+ * '*p' is updated to the entry after the deleted ones, or NULL. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    size_t bytes = lpGetTotalBytes(lp);
+    unsigned char *eofptr = lp+bytes-1;
+    unsigned char *first = *p, *tail = *p;
+    unsigned long deleted = 0, poff = first-lp;
+    uint32_t numele;
+
+    if (num == 0) return lp;
+    while (num-- && tail[0] != LP_EOF) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    memmove(first,tail,eofptr-tail+1);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = zrealloc(lp,bytes);
+
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete 'num' entries starting at 'index', a negative index counting from
+ * the tail. Deleting more entries than there are after 'index' deletes up
+ * to the end of the listpack. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned long numele = lpLength(lp);
+    unsigned char *p;
+
+    if (num == 0) return lp;
+    if (index < 0) index = (long)numele+index;
+    if (index < 0 || (unsigned long)index >= numele) return lp;
+    if (num > numele-index) num = numele-index;
+
+    p = lpSeek(lp,index);
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Merge the listpacks '*first' and '*second' into a single listpack
+ * holding the entries of '*first' followed by the ones of '*second'.
+ *
+ * The larger of the two is reallocated to hold the merged listpack, while
+ * the other one is freed and its pointer set to NULL. Returns the merged
+ * listpack, or NULL (and nothing is changed) if the arguments are invalid.
+ *
+ * 合并两个 listpack ：扩展较大的那个，释放较小的那个 */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    unsigned char *target, *source;
+    size_t first_bytes, second_bytes, target_bytes, source_bytes;
+    unsigned long numele;
+    uint64_t bytes;
+    int append;
+
+    if (first == NULL || *first == NULL || second == NULL ||
+        *second == NULL || *first == *second) return NULL;
+
+    first_bytes = lpGetTotalBytes(*first);
+    second_bytes = lpGetTotalBytes(*second);
+    numele = lpLength(*first)+lpLength(*second);
+    if (numele > LP_HDR_NUMELE_UNKNOWN) numele = LP_HDR_NUMELE_UNKNOWN;
+    bytes = (uint64_t)first_bytes+second_bytes-LP_HDR_SIZE-1;
+    assert(bytes <= UINT32_MAX);
+
+    if (first_bytes >= second_bytes) {
+        target = *first; target_bytes = first_bytes;
+        source = *second; source_bytes = second_bytes;
+        append = 1;
+    } else {
+        target = *second; target_bytes = second_bytes;
+        source = *first; source_bytes = first_bytes;
+        append = 0;
+    }
+
+    target = zrealloc(target,bytes);
+    if (append) {
+        /* [target entries][source entries+EOF] */
+        memcpy(target+target_bytes-1,source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE);
+    } else {
+        /* [source entries][target entries+EOF] */
+        memmove(target+source_bytes-1,target+LP_HDR_SIZE,
+                target_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE-1);
+    }
+    lpSetNumElements(target,numele);
+    lpSetTotalBytes(target,bytes);
+
+    zfree(source);
+    if (append) {
+        *first = target;
+        *second = NULL;
+    } else {
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Return the entry at 'index', negative indexes counting from the tail
+ * (-1 is the last entry), or NULL when out of range. The scan starts from
+ * the nearest end when the number of entries is known. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned char *p;
+    int forward = 1;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0 || index >= (long)numele) return NULL;
+        if (index > (long)numele/2) {
+            forward = 0;
+            index -= numele; /* Negative index from the tail. */
+        }
+    } else if (index < 0) {
+        forward = 0;
+    }
+
+    if (forward) {
+        p = lpFirst(lp);
+        while (index > 0 && p) {
+            p = lpNext(lp,p);
+            index--;
+        }
+    } else {
+        p = lpLast(lp);
+        while (index < -1 && p) {
+            p = lpPrev(lp,p);
+            index++;
+        }
+    }
+    return p;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's', 0 otherwise.
+ * An integer entry is equal to the strings it was encoded from. */
+int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    unsigned char *value;
+    int64_t count;
+    long long sval;
+
+    value = lpGet(p,&count,NULL);
+    if (value) return count == slen && memcmp(value,s,slen) == 0;
+    return slen <= 20 && string2ll((char*)s,slen,&sval) && sval == count;
+}
+
+/* Find the entry equal to 's' starting at 'p' and comparing only one entry
+ * every 'skip'+1 entries (so that a field/value listpack can be searched by
+ * field with 'skip' 1). Returns NULL if not found.
+ *
+ * 和 ziplistFind() 一样，每隔 skip 个元素比较一次 */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s,
+                      unsigned int slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    int sval_valid = -1; /* -1 means 's' was not converted yet. */
+    long long sval = 0;
+
+    while (p) {
+        if (skipcnt == 0) {
+            unsigned char *value;
+            int64_t count;
+
+            value = lpGet(p,&count,NULL);
+            if (value) {
+                if (count == slen && memcmp(value,s,slen) == 0) return p;
+            } else {
+                /* Convert 's' only once, the first time an integer entry
+                 * is met. */
+                if (sval_valid == -1)
+                    sval_valid = slen <= 20 &&
+                                 string2ll((char*)s,slen,&sval);
+                if (sval_valid && sval == count) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+/* Validate the entry at 'p' without reading past 'eof', storing the
+ * address of the next entry in '*next'. Returns 0 if the entry is not
+ * valid. */
+static int lpValidateNext(unsigned char *p, unsigned char *eof, unsigned char **next) {
+    uint64_t entrylen, backlen_size;
+
+    if (p[0] == LP_EOF) return 0;
+    if ((size_t)(eof-p) < lpEncodingSizeBytes(p)) return 0;
+    if ((entrylen = lpCurrentEncodedSize(p)) == 0) return 0;
+    backlen_size = lpEncodeBacklen(NULL,entrylen);
+    if ((uint64_t)(eof-p) < entrylen+backlen_size) return 0;
+    if (lpDecodeBacklen(p+entrylen+backlen_size-1) != entrylen) return 0;
+    *next = p+entrylen+backlen_size;
+    return 1;
+}
+
+/* Validate 'size' bytes at 'lp', for instance loaded from an RDB file:
+ * check the header and the terminator, and with 'deep' also every entry
+ * and the number of entries. Returns 1 if the listpack is valid.
+ *
+ * 校验不可信的 listpack ，deep 时逐个检查元素 */
+int lpValidateIntegrity(unsigned char *lp, size_t size, int deep) {
+    unsigned char *p, *eof;
+    uint32_t numele;
+    unsigned long count = 0;
+
+    if (size < LP_HDR_SIZE+1) return 0;
+    if (lpGetTotalBytes(lp) != size) return 0;
+    if (lp[size-1] != LP_EOF) return 0;
+    if (!deep) return 1;
+
+    p = lp+LP_HDR_SIZE;
+    eof = lp+size-1;
+    while (p != eof) {
+        if (!lpValidateNext(p,eof,&p)) return 0;
+        count++;
+    }
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN && numele != count) return 0;
+    return 1;
+}
+
+/* Print the listpack entries, for debugging. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr;
+    unsigned char intbuf[LP_INTBUF_SIZE];
+    int64_t vlen;
+    int index = 0;
+
+    printf("{total bytes %u} {num entries %lu}\n",
+        (unsigned)lpGetTotalBytes(lp), lpLength(lp));
+    p = lpFirst(lp);
+    while (p) {
+        uint32_t encoded = lpCurrentEncodedSize(p);
+
+        vstr = lpGet(p,&vlen,intbuf);
+        printf("{index %3d, offset %5ld, entry len %5u, backlen %lu} ",
+            index, (long)(p-lp), encoded, lpEncodeBacklen(NULL,encoded));
+        if (vstr == intbuf) printf("[int] ");
+        fwrite(vstr,vlen > 40 ? 40 : vlen,1,stdout);
+        if (vlen > 40) printf("...");
+        printf("\n");
+        index++;
+        p = lpNext(lp,p);
+    }
+    printf("{end}\n\n");
+}
+
+// usage:
+// 1) gcc -g zmalloc.c util.c sds.c listpack.c -D LISTPACK_TEST_MAIN -lm
+// 2) ./a.out
+#ifdef LISTPACK_TEST_MAIN
+#include <sys/time.h>
+#include "testhelp.h"
+
+void _redisAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED ===\n==> %s:%d '%s' is not true\n",
+        file,line,estr);
+}
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Return 1 if the entry at 'p' is the string (or integer) 's'. */
+static int lpEntryIs(unsigned char *p, char *s) {
+    return p && lpCompare(p,(unsigned char*)s,strlen(s));
+}
+
+static unsigned char *lpPushString(unsigned char *lp, char *s) {
+    return lpAppend(lp,(unsigned char*)s,strlen(s));
+}
+
+int main(int argc, char **argv) {
+    unsigned char *lp, *p;
+    int64_t vlen;
+    int ok, j;
+
+    {
+        char *ints[] = {"0","127","128","-1","4095","-4096","4096","32767",
+                        "-32768","32768","8388607","-8388608","8388608",
+                        "2147483647","-2147483648","2147483648",
+                        "9223372036854775807","-9223372036854775808"};
+        int n = sizeof(ints)/sizeof(*ints);
+
+        lp = lpNew();
+        for (j = 0; j < n; j++) lp = lpPushString(lp,ints[j]);
+        ok = lpLength(lp) == (unsigned long)n;
+        for (j = 0, p = lpFirst(lp); ok && j < n; j++, p = lpNext(lp,p)) {
+            unsigned char buf[LP_INTBUF_SIZE];
+            int64_t len;
+            unsigned char *v = lpGet(p,&len,buf);
+            ok = v == buf && len == (int64_t)strlen(ints[j]) &&
+                 !memcmp(v,ints[j],len);
+        }
+        test_cond("Integer encodings round trip", ok && p == NULL);
+        lpFree(lp);
+    }
+
+    {
+        char *big = zmalloc(70000);
+        unsigned int lens[] = {0,1,63,64,4095,4096,70000};
+        int n = sizeof(lens)/sizeof(*lens);
+
+        memset(big,'a',70000);
+        lp = lpNew();
+        for (j = 0; j < n; j++)
+            lp = lpAppend(lp,(unsigned char*)big,lens[j]);
+        lp = lpPushString(lp,"01"); /* Not an integer: leading zero. */
+        ok = lpLength(lp) == (unsigned long)n+1;
+        for (j = 0, p = lpFirst(lp); ok && j < n; j++, p = lpNext(lp,p)) {
+            unsigned int len;
+            long long lv;
+            unsigned char *v = lpGetValue(p,&len,&lv);
+            ok = v && len == lens[j] && !memcmp(v,big,len);
+        }
+        ok = ok && lpEntryIs(p,"01") && lpGet(p,&vlen,NULL) != NULL;
+        test_cond("String encodings round trip", ok);
+
+        /* Walk backward from the terminator. */
+        p = lpLast(lp);
+        for (j = n; ok && j > 0; j--) ok = (p = lpPrev(lp,p)) != NULL;
+        test_cond("Backward iteration over every encoding",
+            ok && lpPrev(lp,p) == NULL && p == lpFirst(lp));
+        test_cond("Validate integrity",
+            lpValidateIntegrity(lp,lpBytes(lp),1) &&
+            !lpValidateIntegrity(lp,lpBytes(lp)-1,1));
+        lpFree(lp);
+        zfree(big);
+    }
+
+    {
+        lp = lpNew();
+        lp = lpPushString(lp,"b");
+        lp = lpPrepend(lp,(unsigned char*)"a",1);
+        lp = lpPushString(lp,"d");
+        p = lpSeek(lp,1);
+        lp = lpInsertString(lp,(unsigned char*)"c",1,p,LP_AFTER,&p);
+        ok = lpEntryIs(p,"c") && lpEntryIs(lpSeek(lp,0),"a") &&
+             lpEntryIs(lpSeek(lp,2),"c") && lpEntryIs(lpSeek(lp,-1),"d") &&
+             lpSeek(lp,4) == NULL && lpSeek(lp,-5) == NULL;
+        test_cond("Insert, append, prepend and seek", ok);
+
+        p = lpSeek(lp,1);
+        lp = lpReplace(lp,&p,(unsigned char*)"a long replacement string",25);
+        ok = lpEntryIs(p,"a long replacement string") &&
+             lpEntryIs(lpNext(lp,p),"c") && lpLength(lp) == 4;
+        p = lpSeek(lp,1);
+        lp = lpReplace(lp,&p,(unsigned char*)"1000",4);
+        ok = ok && lpEntryIs(p,"1000") && lpEntryIs(lpNext(lp,p),"c");
+        test_cond("Replace", ok && lpValidateIntegrity(lp,lpBytes(lp),1));
+
+        p = lpSeek(lp,-1);
+        lp = lpDelete(lp,p,&p);
+        ok = p == NULL && lpLength(lp) == 3;
+        p = lpFirst(lp);
+        lp = lpDelete(lp,p,&p);
+        ok = ok && lpEntryIs(p,"1000") && lpLength(lp) == 2;
+        test_cond("Delete", ok && lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+    }
+
+    {
+        char buf[32];
+
+        lp = lpNew();
+        for (j = 0; j < 100; j++) {
+            snprintf(buf,sizeof(buf),"field:%d",j);
+            lp = lpPushString(lp,buf);
+            lp = lpAppend(lp,(unsigned char*)buf+6,strlen(buf+6));
+        }
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"field:42",8,1);
+        ok = p && lpEntryIs(lpNext(lp,p),"42");
+        /* Values are not fields: "7" must not match a value. */
+        ok = ok && lpFind(lp,lpFirst(lp),(unsigned char*)"7",1,1) == NULL;
+        p = lpFind(lp,lpSeek(lp,1),(unsigned char*)"7",1,1);
+        ok = ok && p && lpEntryIs(lpPrev(lp,p),"field:7");
+        test_cond("Find with skip", ok);
+
+        lp = lpDeleteRange(lp,10,20);
+        ok = lpLength(lp) == 180 && lpEntryIs(lpSeek(lp,10),"field:15");
+        lp = lpDeleteRange(lp,-10,1000);
+        ok = ok && lpLength(lp) == 170 && lpEntryIs(lpSeek(lp,-1),"94");
+        test_cond("Delete range",
+            ok && lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+    }
+
+    {
+        unsigned char *a = lpNew(), *b = lpNew(), *m;
+
+        for (j = 0; j < 10; j++) {
+            char buf[32];
+            int len = snprintf(buf,sizeof(buf),"%d",j);
+            if (j < 3) a = lpAppend(a,(unsigned char*)buf,len);
+            else b = lpAppend(b,(unsigned char*)buf,len);
+        }
+        m = lpMerge(&a,&b);
+        ok = m && a == NULL && b == m && lpLength(m) == 10;
+        for (j = 0, p = lpFirst(m); ok && j < 10; j++, p = lpNext(m,p)) {
+            char buf[32];
+            snprintf(buf,sizeof(buf),"%d",j);
+            ok = lpEntryIs(p,buf);
+        }
+        test_cond("Merge into the larger listpack",
+            ok && lpValidateIntegrity(m,lpBytes(m),1));
+        lpFree(m);
+    }
+
+    {
+        /* More than 65535 entries: the header counter saturates. */
+        lp = lpNew();
+        for (j = 0; j < 70000; j++) lp = lpAppend(lp,(unsigned char*)"x",1);
+        ok = lpLength(lp) == 70000 && lpEntryIs(lpSeek(lp,-1),"x") &&
+             lpSeek(lp,70000) == NULL;
+        p = lpFirst(lp);
+        lp = lpDeleteRangeWithEntry(lp,&p,5000);
+        ok = ok && lpLength(lp) == 65000 &&
+             lpValidateIntegrity(lp,lpBytes(lp),1);
+        test_cond("Unknown number of entries", ok);
+        lpFree(lp);
+    }
+
+    {
+        /* Prepending only moves the tail of the listpack: no entry is
+         * ever rewritten, whatever the size of the entries. */
+        int n = argc > 1 ? atoi(argv[1]) : 5000;
+        char big[253];
+        long long start = ustime();
+
+        memset(big,'x',sizeof(big));
+        lp = lpNew();
+        for (j = 0; j < n; j++)
+            lp = lpPrepend(lp,(unsigned char*)big,sizeof(big));
+        printf("Prepending %d entries of %d bytes: %lld usec\n",
+            n, (int)sizeof(big), ustime()-start);
+        lpFree(lp);
+    }
+
+    test_report();
+    return 0;
+}
+#endif
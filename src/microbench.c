@@ -0,0 +1,420 @@
+/* Microbenchmarks of the core data structures.
+ *
+ * Usage: ./redis-server --microbench [<filter>] [<count>]
+ *        make microbench
+ *
+ * Every benchmark prints the time and the number of zmalloc allocations
+ * per operation, so that a change that makes a hot structure slower, or
+ * makes it allocate more, shows up before it reaches a release. Only the
+ * groups whose name contains <filter> run. <count> scales the number of
+ * operations, default 1000000. The random inputs come from a fixed seed,
+ * so two runs of the same binary do the same work.
+ *
+ * The benchmarks run inside redis-server because the skiplist and the
+ * other structures are linked there with the same allocator and flags
+ * used in production.
+ *
+ * 核心数据结构的微基准测试：每个操作的耗时与内存分配次数
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+#include "lzf.h"
+
+#include <time.h>
+
+/*-----------------------------------------------------------------------------
+ * Measurement helpers
+ *----------------------------------------------------------------------------*/
+
+typedef struct benchMark {
+    long long start;        /* Nanoseconds */
+    size_t allocs;          /* zmalloc_thread_allocs() at start */
+} benchMark;
+
+static uint64_t bench_seed;
+
+static long long benchNstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/* xorshift64*: cheap, and the same sequence on every platform. */
+static uint64_t benchRandom(void) {
+    bench_seed ^= bench_seed >> 12;
+    bench_seed ^= bench_seed << 25;
+    bench_seed ^= bench_seed >> 27;
+    return bench_seed * 2685821657736338717ULL;
+}
+
+static void benchStart(benchMark *bm) {
+    bm->allocs = zmalloc_thread_allocs();
+    bm->start = benchNstime();
+}
+
+static void benchEnd(benchMark *bm, const char *name, long long ops) {
+    long long elapsed = benchNstime() - bm->start;
+    size_t allocs = zmalloc_thread_allocs() - bm->allocs;
+
+    if (ops == 0) ops = 1;
+    printf("  %-34s %10lld ops %10.1f ns/op %8.2f allocs/op\n",
+        name, ops, (double)elapsed/ops, (double)allocs/ops);
+}
+
+/*-----------------------------------------------------------------------------
+ * dict
+ *----------------------------------------------------------------------------*/
+
+static uint64_t benchSdsHash(const void *key) {
+    return dictGenHashFunction(key,sdslen((sds)key));
+}
+
+static int benchSdsKeyCompare(void *privdata, const void *key1,
+                              const void *key2)
+{
+    size_t l1 = sdslen((sds)key1), l2 = sdslen((sds)key2);
+
+    DICT_NOTUSED(privdata);
+    return l1 == l2 && memcmp(key1,key2,l1) == 0;
+}
+
+static void benchSdsDestructor(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    sdsfree(key);
+}
+
+static dictType benchDictType = {
+    benchSdsHash,           /* hash function */
+    NULL,                   /* key dup */
+    NULL,                   /* val dup */
+    benchSdsKeyCompare,     /* key compare */
+    benchSdsDestructor,     /* key destructor */
+    NULL                    /* val destructor */
+};
+
+static void benchDict(long count) {
+    sds *keys = zmalloc(sizeof(sds)*count), probe;
+    benchMark bm;
+    long j, found = 0;
+    dict *d;
+
+    for (j = 0; j < count; j++)
+        keys[j] = sdscatprintf(sdsempty(),"key:%ld",j);
+
+    d = dictCreate(&benchDictType,NULL);
+    benchStart(&bm);
+    for (j = 0; j < count; j++) dictAdd(d,keys[j],NULL);
+    benchEnd(&bm,"insert (incremental rehash)",count);
+    while (dictIsRehashing(d)) dictRehash(d,100);
+
+    benchStart(&bm);
+    for (j = 0; j < count; j++)
+        if (dictFind(d,keys[benchRandom() % count])) found++;
+    benchEnd(&bm,"lookup existing (random)",count);
+
+    /* Reuse the same sds for the missing keys: no allocation is timed. */
+    probe = sdsMakeRoomFor(sdsempty(),64);
+    benchStart(&bm);
+    for (j = 0; j < count; j++) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long long)benchRandom());
+
+        sdsclear(probe);
+        probe = sdscatlen(probe,buf,len);
+        if (dictFind(d,probe)) found--;
+    }
+    benchEnd(&bm,"lookup missing",count);
+    sdsfree(probe);
+
+    /* A full rehash of the table, timed per moved entry. */
+    dictExpand(d,dictSlots(d)*2);
+    benchStart(&bm);
+    while (dictRehash(d,100));
+    benchEnd(&bm,"rehash (per entry)",count);
+
+    benchStart(&bm);
+    for (j = 0; j < count; j++) dictDelete(d,keys[j]);
+    benchEnd(&bm,"delete",count);
+
+    dictRelease(d);
+    zfree(keys);
+    if (found != count) printf("  (found %ld of %ld keys)\n", found, count);
+}
+
+/*-----------------------------------------------------------------------------
+ * ziplist
+ *----------------------------------------------------------------------------*/
+
+static void benchZiplist(long count) {
+    long entries = 1000, rounds = count/entries, j, k;
+    unsigned char *zl, *p, **zls;
+    char buf[300];
+    benchMark bm;
+
+    if (rounds < 1) rounds = 1;
+    memset(buf,'x',sizeof(buf));
+
+    benchStart(&bm);
+    for (k = 0; k < rounds; k++) {
+        zl = ziplistNew();
+        for (j = 0; j < entries; j++) {
+            int len = ll2string(buf,sizeof(buf),j);
+            zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+        }
+        zfree(zl);
+    }
+    benchEnd(&bm,"push tail (1000 entries)",rounds*entries);
+
+    /* Find an element at a random position of a 1000 entries ziplist. */
+    zl = ziplistNew();
+    for (j = 0; j < entries; j++) {
+        int len = snprintf(buf,sizeof(buf),"element:%ld",j);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+    benchStart(&bm);
+    for (k = 0; k < count/10; k++) {
+        int len = snprintf(buf,sizeof(buf),"element:%ld",
+                           (long)(benchRandom() % entries));
+        p = ziplistFind(ziplistIndex(zl,0),(unsigned char*)buf,len,0);
+        if (p == NULL) printf("  (ziplistFind failed)\n");
+    }
+    benchEnd(&bm,"find (1000 entries)",count/10);
+    zfree(zl);
+
+    /* Cascade update: 250 byte entries need a 1 byte prevlen, inserting a
+     * 300 byte entry at the head makes every one of them grow to 5 bytes. */
+    rounds = rounds > 100 ? 100 : rounds;
+    memset(buf,'x',sizeof(buf));
+    zls = zmalloc(sizeof(unsigned char*)*rounds);
+    for (k = 0; k < rounds; k++) {
+        zls[k] = ziplistNew();
+        for (j = 0; j < entries; j++)
+            zls[k] = ziplistPush(zls[k],(unsigned char*)buf,250,ZIPLIST_TAIL);
+    }
+    benchStart(&bm);
+    for (k = 0; k < rounds; k++)
+        zls[k] = ziplistPush(zls[k],(unsigned char*)buf,300,ZIPLIST_HEAD);
+    benchEnd(&bm,"cascade update (1000 entries)",rounds);
+    for (k = 0; k < rounds; k++) zfree(zls[k]);
+    zfree(zls);
+}
+
+/*-----------------------------------------------------------------------------
+ * intset
+ *----------------------------------------------------------------------------*/
+
+static void benchIntset(long count) {
+    long size = count/50, j, found = 0;
+    intset *is = intsetNew();
+    benchMark bm;
+    uint8_t success;
+
+    if (size < 1) size = 1;
+    /* Adding is O(N) because of the memmove, keep the set small. */
+    benchStart(&bm);
+    for (j = 0; j < size; j++)
+        is = intsetAdd(is,(int64_t)(benchRandom() % (size*4)),&success);
+    benchEnd(&bm,"add random (int16/int32)",size);
+
+    benchStart(&bm);
+    for (j = 0; j < count; j++)
+        found += intsetFind(is,(int64_t)(benchRandom() % (size*4)));
+    benchEnd(&bm,"search",count);
+
+    benchStart(&bm);
+    is = intsetAdd(is,LLONG_MAX,&success);
+    benchEnd(&bm,"upgrade to int64",1);
+    zfree(is);
+    if (found == 0) printf("  (no element found)\n");
+}
+
+/*-----------------------------------------------------------------------------
+ * skiplist
+ *----------------------------------------------------------------------------*/
+
+static void benchSkiplist(long count) {
+    zskiplist *zsl = zslCreate();
+    long j, visited = 0;
+    zrangespec range;
+    benchMark bm;
+    sds ele = sdsempty();
+
+    benchStart(&bm);
+    for (j = 0; j < count; j++) {
+        sdsclear(ele);
+        ele = sdscatprintf(ele,"member:%ld",j);
+        zslInsert(zsl,(double)(benchRandom() % (count*10)),ele);
+    }
+    benchEnd(&bm,"insert random score",count);
+
+    /* ZRANGEBYSCORE like: find the first node, then walk 10 nodes. */
+    range.minex = range.maxex = 0;
+    benchStart(&bm);
+    for (j = 0; j < count; j++) {
+        zskiplistNode *ln;
+        int n;
+
+        range.min = (double)(benchRandom() % (count*10));
+        range.max = range.min + 100;
+        ln = zslFirstInRange(zsl,&range);
+        for (n = 0; ln && n < 10 && ln->score <= range.max; n++) {
+            ln = ln->level[0].forward;
+            visited++;
+        }
+    }
+    benchEnd(&bm,"range (first + 10 nodes)",count);
+
+    benchStart(&bm);
+    zslFree(zsl);
+    benchEnd(&bm,"free (per node)",count);
+    sdsfree(ele);
+    if (visited == 0) printf("  (no node visited)\n");
+}
+
+/*-----------------------------------------------------------------------------
+ * sds
+ *----------------------------------------------------------------------------*/
+
+static void benchSds(long count) {
+    benchMark bm;
+    long j;
+    sds s;
+
+    s = sdsempty();
+    benchStart(&bm);
+    for (j = 0; j < count; j++) s = sdscatlen(s,"x",1);
+    benchEnd(&bm,"grow by 1 byte",count);
+    sdsfree(s);
+
+    s = sdsempty();
+    benchStart(&bm);
+    for (j = 0; j < count/10; j++) s = sdscatlen(s,"abcdefghijklmnop",16);
+    benchEnd(&bm,"grow by 16 bytes",count/10);
+    sdsfree(s);
+
+    benchStart(&bm);
+    for (j = 0; j < count; j++) {
+        s = sdsfromlonglong(j);
+        sdsfree(s);
+    }
+    benchEnd(&bm,"create + free from long long",count);
+
+    s = sdsempty();
+    benchStart(&bm);
+    for (j = 0; j < count/10; j++) {
+        sdsclear(s);
+        s = sdscatfmt(s,"%s:%I:%i","key",(long long)j,(int)j);
+    }
+    benchEnd(&bm,"sdscatfmt",count/10);
+    sdsfree(s);
+}
+
+/*-----------------------------------------------------------------------------
+ * LZF
+ *----------------------------------------------------------------------------*/
+
+#define BENCH_LZF_BLOCK (64*1024)
+
+static void benchLzf(long count) {
+    static const char *words[] = {"user","session","value","redis",
+        "timestamp","12345","id","name","score","payload"};
+    unsigned char *in = zmalloc(BENCH_LZF_BLOCK);
+    unsigned char *out = zmalloc(BENCH_LZF_BLOCK);
+    unsigned char *back = zmalloc(BENCH_LZF_BLOCK);
+    long rounds = count/1000, j;
+    unsigned int clen = 0;
+    size_t pos = 0;
+    benchMark bm;
+
+    if (rounds < 1) rounds = 1;
+    /* Text like input that compresses roughly like JSON values do. */
+    while (pos < BENCH_LZF_BLOCK) {
+        const char *w = words[benchRandom() % 10];
+        size_t l = strlen(w);
+
+        if (pos + l + 1 > BENCH_LZF_BLOCK) break;
+        memcpy(in+pos,w,l);
+        pos += l;
+        in[pos++] = (benchRandom() & 1) ? ':' : ' ';
+    }
+    memset(in+pos,' ',BENCH_LZF_BLOCK-pos);
+
+    benchStart(&bm);
+    for (j = 0; j < rounds; j++)
+        clen = lzf_compress(in,BENCH_LZF_BLOCK,out,BENCH_LZF_BLOCK);
+    benchEnd(&bm,"compress 64k",rounds);
+
+    benchStart(&bm);
+    for (j = 0; j < rounds; j++)
+        lzf_decompress(out,clen,back,BENCH_LZF_BLOCK);
+    benchEnd(&bm,"decompress 64k",rounds);
+
+    printf("  (ratio %.2f, %s)\n", clen ? (double)BENCH_LZF_BLOCK/clen : 0,
+        memcmp(in,back,BENCH_LZF_BLOCK) == 0 ? "round trip ok" :
+                                               "ROUND TRIP FAILED");
+    zfree(in);
+    zfree(out);
+    zfree(back);
+}
+
+/*-----------------------------------------------------------------------------
+ * Entry point
+ *----------------------------------------------------------------------------*/
+
+static struct benchGroup {
+    char *name;
+    void (*proc)(long count);
+} benchGroups[] = {
+    {"dict",benchDict},
+    {"ziplist",benchZiplist},
+    {"intset",benchIntset},
+    {"skiplist",benchSkiplist},
+    {"sds",benchSds},
+    {"lzf",benchLzf}
+};
+
+/* Called by main() for redis-server --microbench [<filter>] [<count>]. */
+void microbenchMain(int argc, char **argv) {
+    char *filter = argc > 2 ? argv[2] : NULL;
+    long count = argc > 3 ? atol(argv[3]) : 1000000;
+    int j, ran = 0;
+
+    if (count < 1000) count = 1000;
+    printf("Redis %s microbenchmarks, count %ld\n", REDIS_VERSION, count);
+    for (j = 0; j < (int)(sizeof(benchGroups)/sizeof(benchGroups[0])); j++) {
+        if (filter && strstr(benchGroups[j].name,filter) == NULL) continue;
+        bench_seed = 0x9E3779B97F4A7C15ULL;
+        printf("\n%s\n", benchGroups[j].name);
+        benchGroups[j].proc(count);
+        ran++;
+    }
+    if (!ran) printf("No benchmark matches '%s'\n", filter);
+}
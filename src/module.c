@@ -0,0 +1,1652 @@
+/* module.c - Loadable modules: the implementation of redismodule.h
+ *
+ * 可载入模块：模块通过 redismodule.h 中的 API 注册命令和数据类型，
+ * 命令的实现以本地代码的形式在服务器进程中运行。
+ *
+ * A module is loaded with dlopen(), then its RedisModule_OnLoad() function
+ * is called with a context whose first field is the pointer to
+ * RM_GetApi(): this is how RedisModule_Init() resolves, by name, every
+ * function of the API, that are the RM_* functions of this file exported
+ * with the "RedisModule_" prefix. This way modules use a stable API instead
+ * of the internals of db.c and object.c.
+ *
+ * Copyright (c) 2016, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+#include "endianconv.h"
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+/* --------------------------------------------------------------------------
+ * Private data structures used by the modules system. Those are data
+ * structures that are never exposed to Redis Modules, if not as void
+ * pointers that have an API the module can call with them)
+ * -------------------------------------------------------------------------- */
+
+/* This structure represents a module inside the system. */
+struct RedisModule {
+    void *handle;   /* Module dlopen() handle. */
+    char *name;     /* Module name. */
+    int ver;        /* Module version. We use just progressive integers. */
+    int apiver;     /* Module API version as requested during initialization.*/
+    list *types;    /* Module data types. */
+    sds path;       /* Shared library path, for CONFIG REWRITE. */
+    sds args;       /* Arguments of MODULE LOAD, for CONFIG REWRITE. */
+};
+typedef struct RedisModule RedisModule;
+
+/* Modules loaded: module name -> RedisModule. */
+static dict *modules;
+
+/* Exported API: API name -> function pointer. */
+static dict *moduleapi;
+
+static uint64_t dictCStringKeyHash(const void *key) {
+    return dictGenHashFunction((unsigned char*)key, strlen((char*)key));
+}
+
+static int dictCStringKeyCompare(void *privdata, const void *key1,
+                                 const void *key2)
+{
+    DICT_NOTUSED(privdata);
+    return strcmp(key1,key2) == 0;
+}
+
+/* Module names and API names are C strings owned by someone else. */
+static dictType moduleDictType = {
+    dictCStringKeyHash,         /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictCStringKeyCompare,      /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* Modules to load at startup, queued by the "loadmodule" directive. */
+struct moduleLoadQueueEntry {
+    sds path;
+    int argc;
+    robj **argv;
+};
+
+/* The context passed to the OnLoad function and to the commands. The
+ * first field must be the pointer to RM_GetApi(), see RedisModule_Init(). */
+struct RedisModuleCtx {
+    void *getapifuncptr;            /* NOTE: Must be the first field. */
+    struct RedisModule *module;     /* Module reference. */
+    redisClient *client;            /* Client calling a command. */
+    int flags;                      /* REDISMODULE_CTX_... flags. */
+    void **postponed_arrays;        /* To set with RM_ReplySetArrayLength(). */
+    int postponed_arrays_count;     /* Number of entries in postponed_arrays. */
+    struct RedisModuleBlockedClient *blocked_client; /* Blocked client of a
+                                                        thread safe context. */
+    void *blocked_privdata;         /* Privdata set when unblocking a client. */
+};
+typedef struct RedisModuleCtx RedisModuleCtx;
+typedef int (*RedisModuleCmdFunc) (RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#define REDISMODULE_CTX_INIT {(void*)(unsigned long)&RM_GetApi, NULL, NULL, 0, NULL, 0, NULL, NULL}
+#define REDISMODULE_CTX_ONLOAD (1<<0)   /* Inside RedisModule_OnLoad(). */
+#define REDISMODULE_CTX_BLOCKED_REPLY (1<<1)    /* In the reply callback. */
+#define REDISMODULE_CTX_BLOCKED_TIMEOUT (1<<2)  /* In the timeout callback. */
+#define REDISMODULE_CTX_THREAD_SAFE (1<<3)      /* RM_GetThreadSafeContext(). */
+
+/* A key opened with RM_OpenKey(). */
+struct RedisModuleKey {
+    RedisModuleCtx *ctx;
+    redisDb *db;
+    robj *key;      /* Key name object. */
+    robj *value;    /* Value object, or NULL if the key was not found. */
+    robj *decoded;  /* Decoded value returned by a read only StringDMA(). */
+    int mode;       /* Opening mode. */
+};
+typedef struct RedisModuleKey RedisModuleKey;
+
+/* The command registered by a module: redisCommand->module_cmd. */
+struct RedisModuleCommandProxy {
+    struct RedisModule *module;
+    RedisModuleCmdFunc func;
+    struct redisCommand *rediscmd;
+};
+typedef struct RedisModuleCommandProxy RedisModuleCommandProxy;
+
+/* A client blocked by RM_BlockClient(), until the module calls
+ * RM_UnblockClient() from any thread. */
+typedef struct RedisModuleBlockedClient {
+    redisClient *client;    /* Pointer to the blocked client, or NULL if the
+                               client was unblocked by a timeout or freed
+                               during the life of this object. */
+    struct RedisModule *module; /* Module blocking the client. */
+    RedisModuleCmdFunc reply_callback; /* Reply callback on normal completion.*/
+    RedisModuleCmdFunc timeout_callback; /* Reply callback on timeout. */
+    void (*free_privdata)(void *);  /* Free privdata on unblock. */
+    void *privdata;     /* Module private data that may be used by the reply
+                           or timeout callback. It is set via the
+                           RedisModule_UnblockClient() API. */
+    redisClient *reply_client; /* Fake client used to accumulate replies
+                                  in thread safe contexts. */
+    int dbid;           /* Database number selected by the original client. */
+} RedisModuleBlockedClient;
+
+/* Blocked clients unblocked by the threads, served by the main thread
+ * in moduleHandleBlockedClients(). */
+static pthread_mutex_t moduleUnblockedClientsMutex = PTHREAD_MUTEX_INITIALIZER;
+static list *moduleUnblockedClients;
+
+/* The global lock: held by the main thread, except while it sleeps in the
+ * event loop, and by the threads holding a locked thread safe context. */
+static pthread_mutex_t moduleGIL = PTHREAD_MUTEX_INITIALIZER;
+
+/* The layout of RedisModuleTypeMethods, that is only defined for modules
+ * in redismodule.h. */
+typedef struct {
+    uint64_t version;
+    moduleTypeLoadFunc rdb_load;
+    moduleTypeSaveFunc rdb_save;
+    moduleTypeRewriteFunc aof_rewrite;
+    moduleTypeFreeFunc free;
+} RedisModuleTypeMethods;
+
+static int RM_GetApi(const char *funcname, void **targetPtrPtr);
+static void moduleFreeType(void *ptr);
+
+/* --------------------------------------------------------------------------
+ * Heap allocation raw functions
+ * -------------------------------------------------------------------------- */
+
+/* Use like malloc(). Memory allocated with this function is reported in
+ * Redis INFO memory, used for keys eviction according to maxmemory settings
+ * and in general is taken into account as memory allocated by Redis. */
+static void *RM_Alloc(size_t bytes) {
+    return zmalloc(bytes);
+}
+
+/* Use like calloc(). */
+static void *RM_Calloc(size_t nmemb, size_t size) {
+    return zcalloc(nmemb*size);
+}
+
+/* Use like realloc() for memory obtained with RedisModule_Alloc(). */
+static void *RM_Realloc(void *ptr, size_t bytes) {
+    return zrealloc(ptr,bytes);
+}
+
+/* Use like free() for memory obtained by RedisModule_Alloc() and
+ * RedisModule_Realloc(). */
+static void RM_Free(void *ptr) {
+    zfree(ptr);
+}
+
+/* Like strdup() but returns memory allocated with RedisModule_Alloc(). */
+static char *RM_Strdup(const char *str) {
+    return zstrdup(str);
+}
+
+/* --------------------------------------------------------------------------
+ * Commands API
+ * -------------------------------------------------------------------------- */
+
+/* Release the resources of a context when the command returns. */
+static void moduleFreeContext(RedisModuleCtx *ctx) {
+    if (ctx->postponed_arrays) {
+        zfree(ctx->postponed_arrays);
+        ctx->postponed_arrays_count = 0;
+        redisLog(REDIS_WARNING,
+            "API misuse detected in module %s: "
+            "RedisModule_ReplyWithArray(REDISMODULE_POSTPONED_ARRAY_LEN) "
+            "not matched by the same number of RedisModule_SetReplyArrayLen() "
+            "calls.",
+            ctx->module ? ctx->module->name : "?");
+    }
+}
+
+/* This Redis command binds the normal Redis command invocation with commands
+ * exported by modules. */
+static void RedisModuleCommandDispatcher(redisClient *c) {
+    RedisModuleCommandProxy *cp = c->cmd->module_cmd;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+
+    ctx.module = cp->module;
+    ctx.client = c;
+    cp->func(&ctx,(RedisModuleString**)c->argv,c->argc);
+    moduleFreeContext(&ctx);
+}
+
+/* Convert the space separated flags of RM_CreateCommand() into the flags
+ * of the command table. Returns -1 on unknown flags. */
+static int commandFlagsFromString(char *s) {
+    int count, j;
+    int flags = 0;
+    sds *tokens = sdssplitlen(s,strlen(s)," ",1,&count);
+
+    for (j = 0; j < count; j++) {
+        char *t = tokens[j];
+        if (!strcasecmp(t,"write")) flags |= REDIS_CMD_WRITE;
+        else if (!strcasecmp(t,"readonly")) flags |= REDIS_CMD_READONLY;
+        else if (!strcasecmp(t,"admin")) flags |= REDIS_CMD_ADMIN;
+        else if (!strcasecmp(t,"deny-oom")) flags |= REDIS_CMD_DENYOOM;
+        else if (!strcasecmp(t,"pubsub")) flags |= REDIS_CMD_PUBSUB;
+        else if (!strcasecmp(t,"noscript")) flags |= REDIS_CMD_NOSCRIPT;
+        else if (!strcasecmp(t,"random")) flags |= REDIS_CMD_RANDOM;
+        else if (!strcasecmp(t,"allow-loading")) flags |= REDIS_CMD_LOADING;
+        else if (!strcasecmp(t,"allow-stale")) flags |= REDIS_CMD_STALE;
+        else if (!strcasecmp(t,"fast")) continue; /* No such flag here. */
+        else break;
+    }
+    sdsfreesplitres(tokens,count);
+    if (j != count) return -1; /* Some token not processed correctly. */
+    return flags;
+}
+
+/* Register a new command in the Redis server, that will be handled by
+ * calling the function pointer 'cmdfunc' using the RedisModule calling
+ * convention. The function returns REDISMODULE_ERR if the specified command
+ * name is already busy or a set of invalid flags were passed, otherwise
+ * REDISMODULE_OK is returned and the new command is registered.
+ *
+ * 'strflags' is a space separated list of: "write", "readonly", "admin",
+ * "deny-oom", "pubsub", "noscript", "random", "allow-loading",
+ * "allow-stale" and "fast", with the meaning of the flags of the commands
+ * table in redis.c ("fast" is accepted for compatibility and ignored).
+ *
+ * 'firstkey', 'lastkey' and 'keystep' are the positions of the keys in the
+ * arguments, like for the built-in commands, or zero if there are none. */
+static int RM_CreateCommand(RedisModuleCtx *ctx, const char *name,
+                            RedisModuleCmdFunc cmdfunc, const char *strflags,
+                            int firstkey, int lastkey, int keystep)
+{
+    int flags = strflags ? commandFlagsFromString((char*)strflags) : 0;
+    struct redisCommand *rediscmd;
+    RedisModuleCommandProxy *cp;
+    sds cmdname;
+
+    if (ctx->module == NULL || flags == -1) return REDISMODULE_ERR;
+    if (lookupCommandByCString((char*)name) != NULL) return REDISMODULE_ERR;
+
+    /* The arity is checked by the module itself, see RM_WrongArity(). */
+    cp = zmalloc(sizeof(*cp));
+    cp->module = ctx->module;
+    cp->func = cmdfunc;
+    cp->rediscmd = zcalloc(sizeof(*rediscmd));
+    cp->rediscmd->name = zstrdup(name);
+    cp->rediscmd->proc = RedisModuleCommandDispatcher;
+    cp->rediscmd->arity = -1;
+    cp->rediscmd->sflags = zstrdup(strflags ? strflags : "");
+    cp->rediscmd->flags = flags;
+    cp->rediscmd->firstkey = firstkey;
+    cp->rediscmd->lastkey = lastkey;
+    cp->rediscmd->keystep = keystep;
+    cp->rediscmd->module_cmd = cp;
+
+    cmdname = sdsnew(name);
+    dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
+    dictAdd(server.orig_commands,cmdname,cp->rediscmd);
+    return REDISMODULE_OK;
+}
+
+/* Called by RM_Init() to setup the ctx->module structure. */
+static void RM_SetModuleAttribs(RedisModuleCtx *ctx, const char *name,
+                                int ver, int apiver)
+{
+    RedisModule *module;
+
+    if (ctx->module != NULL) return;
+    module = zcalloc(sizeof(*module));
+    module->name = zstrdup(name);
+    module->ver = ver;
+    module->apiver = apiver;
+    module->types = listCreate();
+    ctx->module = module;
+}
+
+/* Send an error about the number of arguments given to the command,
+ * citing the command name in the error message. */
+static int RM_WrongArity(RedisModuleCtx *ctx) {
+    if (ctx->client == NULL || ctx->client->argc == 0) return REDISMODULE_OK;
+    addReplyErrorFormat(ctx->client,
+        "wrong number of arguments for '%s' command",
+        (char*)ctx->client->argv[0]->ptr);
+    return REDISMODULE_OK;
+}
+
+/* Return the currently selected DB. */
+static int RM_GetSelectedDb(RedisModuleCtx *ctx) {
+    return ctx->client->db->id;
+}
+
+/* Change the currently selected DB. Returns an error if the id is out of
+ * range. */
+static int RM_SelectDb(RedisModuleCtx *ctx, int newid) {
+    return selectDb(ctx->client,newid) == REDIS_OK ?
+           REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/* Propagate the command to the AOF and the slaves exactly as it was
+ * invoked by the client. The command must be deterministic. */
+static int RM_ReplicateVerbatim(RedisModuleCtx *ctx) {
+    forceCommandPropagation(ctx->client,
+        REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    server.dirty++;
+    return REDISMODULE_OK;
+}
+
+/* --------------------------------------------------------------------------
+ * String objects APIs
+ *
+ * RedisModuleString is a robj: the argv of the commands are the ones of the
+ * client, the strings created by the module must be freed by the module.
+ * -------------------------------------------------------------------------- */
+
+/* Create a new module string object, copying 'len' bytes at 'ptr'. */
+static RedisModuleString *RM_CreateString(RedisModuleCtx *ctx,
+                                          const char *ptr, size_t len)
+{
+    REDIS_NOTUSED(ctx);
+    return createStringObject((char*)ptr,len);
+}
+
+/* Like RedisModule_CreateString(), but the string is the decimal
+ * representation of the long long 'll'. */
+static RedisModuleString *RM_CreateStringFromLongLong(RedisModuleCtx *ctx,
+                                                      long long ll)
+{
+    char buf[REDIS_LONGSTR_SIZE];
+    size_t len = ll2string(buf,sizeof(buf),ll);
+
+    REDIS_NOTUSED(ctx);
+    return createStringObject(buf,len);
+}
+
+/* Free a string obtained by one of the Redis module API calls that return
+ * new string objects. */
+static void RM_FreeString(RedisModuleCtx *ctx, RedisModuleString *str) {
+    REDIS_NOTUSED(ctx);
+    decrRefCount(str);
+}
+
+/* Keep a reference to 'str' (for instance one of the argv strings) after
+ * the command returns. It must be released with RedisModule_FreeString(). */
+static void RM_RetainString(RedisModuleCtx *ctx, RedisModuleString *str) {
+    REDIS_NOTUSED(ctx);
+    incrRefCount(str);
+}
+
+/* Given a string module object, this function returns the string pointer
+ * and length of the string. The returned pointer and length should only
+ * be used for read only accesses and never modified. */
+static const char *RM_StringPtrLen(const RedisModuleString *str, size_t *len) {
+    redisAssert(sdsEncodedObject(str));
+    if (len) *len = sdslen(str->ptr);
+    return str->ptr;
+}
+
+/* Convert the string into a long long integer, storing it at '*ll'.
+ * Returns REDISMODULE_OK on success. If the string can't be parsed
+ * as a valid, strict long long (no spaces before/after), REDISMODULE_ERR
+ * is returned. */
+static int RM_StringToLongLong(const RedisModuleString *str, long long *ll) {
+    return getLongLongFromObject((robj*)str,ll) == REDIS_OK ?
+           REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/* Convert the string into a double, storing it at '*d'. */
+static int RM_StringToDouble(const RedisModuleString *str, double *d) {
+    return getDoubleFromObject((robj*)str,d) == REDIS_OK ?
+           REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/* --------------------------------------------------------------------------
+ * Reply APIs
+ *
+ * Every function returns REDISMODULE_OK, so that the command can be
+ * implemented as: return RedisModule_ReplyWith...(ctx,...);
+ * -------------------------------------------------------------------------- */
+
+/* Return the client the replies are sent to. The replies of a thread safe
+ * context go to the fake client of its blocked client, and are sent to the
+ * real client when it is unblocked, or nowhere if it has no blocked client:
+ * in that case NULL is returned. */
+static redisClient *moduleGetReplyClient(RedisModuleCtx *ctx) {
+    if (ctx->flags & REDISMODULE_CTX_THREAD_SAFE)
+        return ctx->blocked_client ? ctx->blocked_client->reply_client : NULL;
+    return ctx->client;
+}
+
+static int RM_ReplyWithLongLong(RedisModuleCtx *ctx, long long ll) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyLongLong(c,ll);
+    return REDISMODULE_OK;
+}
+
+/* Reply with the error 'err', that should start with the error code, for
+ * example "ERR wrong type". */
+static int RM_ReplyWithError(RedisModuleCtx *ctx, const char *err) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplySds(c,sdscatprintf(sdsempty(),"-%s\r\n",err));
+    return REDISMODULE_OK;
+}
+
+/* Reply with a simple string (+... \r\n in RESP protocol). */
+static int RM_ReplyWithSimpleString(RedisModuleCtx *ctx, const char *msg) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyStatus(c,(char*)msg);
+    return REDISMODULE_OK;
+}
+
+/* Reply with an array of 'len' elements: the next 'len' replies are its
+ * elements. With REDISMODULE_POSTPONED_ARRAY_LEN the length is set later
+ * with RedisModule_ReplySetArrayLength(). */
+static int RM_ReplyWithArray(RedisModuleCtx *ctx, long len) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c == NULL) return REDISMODULE_OK;
+    if (len == REDISMODULE_POSTPONED_ARRAY_LEN) {
+        ctx->postponed_arrays = zrealloc(ctx->postponed_arrays,
+            sizeof(void*)*(ctx->postponed_arrays_count+1));
+        ctx->postponed_arrays[ctx->postponed_arrays_count] =
+            addDeferredMultiBulkLength(c);
+        ctx->postponed_arrays_count++;
+    } else {
+        addReplyMultiBulkLen(c,len);
+    }
+    return REDISMODULE_OK;
+}
+
+/* Set the length of the latest postponed array. Nested postponed arrays
+ * are closed from the innermost to the outermost. */
+static void RM_ReplySetArrayLength(RedisModuleCtx *ctx, long len) {
+    redisClient *c = moduleGetReplyClient(ctx);
+    void *node;
+
+    if (c == NULL) return;
+    if (ctx->postponed_arrays_count == 0) {
+        redisLog(REDIS_WARNING,
+            "API misuse detected in module %s: "
+            "RedisModule_ReplySetArrayLength() called without previous "
+            "RedisModule_ReplyWithArray(ctx,REDISMODULE_POSTPONED_ARRAY_LEN) "
+            "call.", ctx->module ? ctx->module->name : "?");
+        return;
+    }
+    ctx->postponed_arrays_count--;
+    node = ctx->postponed_arrays[ctx->postponed_arrays_count];
+    setDeferredMultiBulkLength(c,node,len);
+    if (ctx->postponed_arrays_count == 0) {
+        zfree(ctx->postponed_arrays);
+        ctx->postponed_arrays = NULL;
+    }
+}
+
+static int RM_ReplyWithStringBuffer(RedisModuleCtx *ctx, const char *buf,
+                                    size_t len)
+{
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyBulkCBuffer(c,(char*)buf,len);
+    return REDISMODULE_OK;
+}
+
+static int RM_ReplyWithString(RedisModuleCtx *ctx, RedisModuleString *str) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyBulk(c,str);
+    return REDISMODULE_OK;
+}
+
+static int RM_ReplyWithNull(RedisModuleCtx *ctx) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyNull(c);
+    return REDISMODULE_OK;
+}
+
+static int RM_ReplyWithDouble(RedisModuleCtx *ctx, double d) {
+    redisClient *c = moduleGetReplyClient(ctx);
+
+    if (c) addReplyDouble(c,d);
+    return REDISMODULE_OK;
+}
+
+/* --------------------------------------------------------------------------
+ * Key space access
+ * -------------------------------------------------------------------------- */
+
+/* Return an handle representing a Redis key, so that it is possible
+ * to call other APIs with the key handle as argument to perform
+ * operations on the key. 'mode' is REDISMODULE_READ and/or
+ * REDISMODULE_WRITE.
+ *
+ * A missing key opened for reading returns NULL. A key opened for writing
+ * is always returned, even if missing, so that it can be created. The key
+ * must be closed with RedisModule_CloseKey(). */
+static RedisModuleKey *RM_OpenKey(RedisModuleCtx *ctx, robj *keyname,
+                                  int mode)
+{
+    RedisModuleKey *kp;
+    robj *value;
+
+    if (mode & REDISMODULE_WRITE) {
+        value = lookupKeyWrite(ctx->client->db,keyname);
+    } else {
+        value = lookupKeyRead(ctx->client->db,keyname);
+        if (value == NULL) return NULL;
+    }
+
+    kp = zmalloc(sizeof(*kp));
+    kp->ctx = ctx;
+    kp->db = ctx->client->db;
+    kp->key = keyname;
+    incrRefCount(keyname);
+    kp->value = value;
+    kp->decoded = NULL;
+    kp->mode = mode;
+    return kp;
+}
+
+/* Close a key handle. A key opened for writing is signaled as modified,
+ * so that WATCH and client side caching notice the change. */
+static void RM_CloseKey(RedisModuleKey *key) {
+    if (key == NULL) return;
+    if (key->mode & REDISMODULE_WRITE) signalModifiedKey(key->db,key->key);
+    if (key->decoded) decrRefCount(key->decoded);
+    decrRefCount(key->key);
+    zfree(key);
+}
+
+/* Return the type of the key. If the key pointer is NULL then
+ * REDISMODULE_KEYTYPE_EMPTY is returned. */
+static int RM_KeyType(RedisModuleKey *key) {
+    if (key == NULL || key->value == NULL) return REDISMODULE_KEYTYPE_EMPTY;
+    switch(key->value->type) {
+    case REDIS_STRING: return REDISMODULE_KEYTYPE_STRING;
+    case REDIS_LIST: return REDISMODULE_KEYTYPE_LIST;
+    case REDIS_SET: return REDISMODULE_KEYTYPE_SET;
+    case REDIS_ZSET: return REDISMODULE_KEYTYPE_ZSET;
+    case REDIS_HASH: return REDISMODULE_KEYTYPE_HASH;
+    case REDIS_MODULE: return REDISMODULE_KEYTYPE_MODULE;
+    case REDIS_STREAM: return REDISMODULE_KEYTYPE_STREAM;
+    default: return 0;
+    }
+}
+
+/* Return the length of the value associated with the key: the length of
+ * the string, or the number of elements of the aggregate types. Zero for
+ * missing keys and values of the module types. */
+static size_t RM_ValueLength(RedisModuleKey *key) {
+    if (key == NULL || key->value == NULL) return 0;
+    switch(key->value->type) {
+    case REDIS_STRING: return stringObjectLen(key->value);
+    case REDIS_LIST: return listTypeLength(key->value);
+    case REDIS_SET: return setTypeSize(key->value);
+    case REDIS_ZSET: return zsetLength(key->value);
+    case REDIS_HASH: return hashTypeLength(key->value);
+    case REDIS_STREAM: return streamLength(key->value);
+    default: return 0;
+    }
+}
+
+/* If the key is open for writing, remove it. Returns REDISMODULE_ERR if
+ * the key is not open for writing. */
+static int RM_DeleteKey(RedisModuleKey *key) {
+    if (!(key->mode & REDISMODULE_WRITE)) return REDISMODULE_ERR;
+    if (key->value) {
+        dbDelete(key->db,key->key);
+        key->value = NULL;
+    }
+    return REDISMODULE_OK;
+}
+
+/* If the key is open for writing, set the specified string 'str' as the
+ * value of the key, deleting the old value if any. */
+static int RM_StringSet(RedisModuleKey *key, RedisModuleString *str) {
+    if (!(key->mode & REDISMODULE_WRITE)) return REDISMODULE_ERR;
+    setKey(key->db,key->key,str);
+    key->value = str;
+    return REDISMODULE_OK;
+}
+
+/* Direct access to the string value of the key, returning its pointer and
+ * its length in '*len', or NULL if the key is empty or not a string.
+ *
+ * With REDISMODULE_WRITE (and the key open for writing) the module is
+ * allowed to modify the bytes in place, without changing the length. */
+static char *RM_StringDMA(RedisModuleKey *key, size_t *len, int mode) {
+    if (key->value == NULL || key->value->type != REDIS_STRING) return NULL;
+
+    if (mode & REDISMODULE_WRITE) {
+        if (!(key->mode & REDISMODULE_WRITE)) return NULL;
+        key->value = dbUnshareStringValue(key->db,key->key,key->value);
+    } else if (!sdsEncodedObject(key->value)) {
+        if (key->decoded == NULL) key->decoded = getDecodedObject(key->value);
+        if (len) *len = sdslen(key->decoded->ptr);
+        return key->decoded->ptr;
+    }
+    if (len) *len = sdslen(key->value->ptr);
+    return key->value->ptr;
+}
+
+/* Return the remaining time to live of the key in milliseconds, or
+ * REDISMODULE_NO_EXPIRE if it has no associated expire or is missing. */
+static mstime_t RM_GetExpire(RedisModuleKey *key) {
+    mstime_t expire;
+
+    if (key->value == NULL) return REDISMODULE_NO_EXPIRE;
+    expire = getExpire(key->db,key->key);
+    if (expire == -1) return REDISMODULE_NO_EXPIRE;
+    expire -= mstime();
+    return expire >= 0 ? expire : 0;
+}
+
+/* Set a new time to live of 'expire' milliseconds for the key, or remove
+ * it with REDISMODULE_NO_EXPIRE. The key must be open for writing and
+ * exist. */
+static int RM_SetExpire(RedisModuleKey *key, mstime_t expire) {
+    if (!(key->mode & REDISMODULE_WRITE) || key->value == NULL)
+        return REDISMODULE_ERR;
+    if (expire == REDISMODULE_NO_EXPIRE)
+        removeExpire(key->db,key->key);
+    else
+        setExpire(key->db,key->key,mstime()+expire);
+    return REDISMODULE_OK;
+}
+
+/* --------------------------------------------------------------------------
+ * Modules data types
+ * -------------------------------------------------------------------------- */
+
+/* Lookup a module type by name, NULL if not found. */
+moduleType *moduleTypeLookupByName(const char *name) {
+    dictIterator *di = dictGetIterator(modules);
+    dictEntry *de;
+    moduleType *found = NULL;
+
+    while(found == NULL && (de = dictNext(di)) != NULL) {
+        RedisModule *module = dictGetVal(de);
+        listIter li;
+        listNode *ln;
+
+        listRewind(module->types,&li);
+        while((ln = listNext(&li))) {
+            moduleType *mt = ln->value;
+            if (!strcmp(mt->name,name)) {
+                found = mt;
+                break;
+            }
+        }
+    }
+    dictReleaseIterator(di);
+    return found;
+}
+
+/* Register a new data type exported by the module. It can only be called
+ * from RedisModule_OnLoad(), so that the type exists before the RDB file
+ * or the AOF holding its values is loaded.
+ *
+ * 'name' is saved in the RDB file with every value, followed by 'encver',
+ * the version of the encoding of the value passed to rdb_load(), so that
+ * a module can still load the values saved by its older versions.
+ *
+ * The rdb_load, rdb_save and free callbacks are required. Without
+ * aof_rewrite the AOF can only be rewritten with the RDB preamble.
+ *
+ * NULL is returned if the name is busy, if the callbacks are missing or
+ * if the function is not called from OnLoad. */
+static moduleType *RM_CreateDataType(RedisModuleCtx *ctx, const char *name,
+                                     int encver, void *typemethods_ptr)
+{
+    RedisModuleTypeMethods *tms = typemethods_ptr;
+    moduleType *mt;
+
+    if (!(ctx->flags & REDISMODULE_CTX_ONLOAD)) return NULL;
+    if (name[0] == '\0' || strchr(name,' ') != NULL) return NULL;
+    if (moduleTypeLookupByName(name) != NULL) return NULL;
+    if (tms->version != REDISMODULE_TYPE_METHOD_VERSION) return NULL;
+    if (!tms->rdb_load || !tms->rdb_save || !tms->free) return NULL;
+
+    mt = zcalloc(sizeof(*mt));
+    mt->module = ctx->module;
+    mt->name = zstrdup(name);
+    mt->encver = encver;
+    mt->rdb_load = tms->rdb_load;
+    mt->rdb_save = tms->rdb_save;
+    mt->aof_rewrite = tms->aof_rewrite;
+    mt->free = tms->free;
+    listAddNodeTail(ctx->module->types,mt);
+    return mt;
+}
+
+/* If the key is open for writing, set a value of the module type 'mt' as
+ * the value of the key, deleting the old value if any. */
+static int RM_ModuleTypeSetValue(RedisModuleKey *key, moduleType *mt,
+                                 void *value)
+{
+    robj *o;
+
+    if (!(key->mode & REDISMODULE_WRITE)) return REDISMODULE_ERR;
+    o = createModuleObject(mt,value);
+    setKey(key->db,key->key,o);
+    decrRefCount(o);
+    key->value = o;
+    return REDISMODULE_OK;
+}
+
+/* Return the module type of the value of the key, or NULL if the key is
+ * empty or not of a module type. */
+static moduleType *RM_ModuleTypeGetType(RedisModuleKey *key) {
+    if (key == NULL || key->value == NULL ||
+        key->value->type != REDIS_MODULE) return NULL;
+    return ((moduleValue*)key->value->ptr)->type;
+}
+
+/* Return the value of a key of a module type, or NULL. The module should
+ * check the type with RedisModule_ModuleTypeGetType() first. */
+static void *RM_ModuleTypeGetValue(RedisModuleKey *key) {
+    if (key == NULL || key->value == NULL ||
+        key->value->type != REDIS_MODULE) return NULL;
+    return ((moduleValue*)key->value->ptr)->value;
+}
+
+/* --------------------------------------------------------------------------
+ * RDB loading and saving functions, for the rdb_load and rdb_save
+ * callbacks. On I/O errors io->error is set and the following calls do
+ * nothing: the value is discarded and the load or the save fails.
+ * -------------------------------------------------------------------------- */
+
+static void RM_SaveUnsigned(RedisModuleIO *io, uint64_t value) {
+    if (io->error) return;
+    memrev64ifbe(&value);
+    if (rioWrite(io->rio,&value,sizeof(value)) == 0) io->error = 1;
+}
+
+static uint64_t RM_LoadUnsigned(RedisModuleIO *io) {
+    uint64_t value;
+
+    if (io->error || rioRead(io->rio,&value,sizeof(value)) == 0) {
+        io->error = 1;
+        return 0;
+    }
+    memrev64ifbe(&value);
+    return value;
+}
+
+static void RM_SaveSigned(RedisModuleIO *io, int64_t value) {
+    RM_SaveUnsigned(io,(uint64_t)value);
+}
+
+static int64_t RM_LoadSigned(RedisModuleIO *io) {
+    return (int64_t)RM_LoadUnsigned(io);
+}
+
+static void RM_SaveString(RedisModuleIO *io, RedisModuleString *s) {
+    if (io->error) return;
+    if (rdbSaveStringObject(io->rio,s) == -1) io->error = 1;
+}
+
+static void RM_SaveStringBuffer(RedisModuleIO *io, const char *str,
+                                size_t len)
+{
+    if (io->error) return;
+    if (rdbSaveRawString(io->rio,(unsigned char*)str,len) == -1)
+        io->error = 1;
+}
+
+/* Load a string saved with SaveString() or SaveStringBuffer(), to be
+ * freed with RedisModule_FreeString(). */
+static RedisModuleString *RM_LoadString(RedisModuleIO *io) {
+    robj *o;
+
+    if (io->error) return NULL;
+    if ((o = rdbLoadStringObject(io->rio)) == NULL) io->error = 1;
+    return o;
+}
+
+/* Like RedisModule_LoadString(), but returns a buffer allocated with
+ * RedisModule_Alloc(), and its length in '*lenptr' if not NULL. */
+static char *RM_LoadStringBuffer(RedisModuleIO *io, size_t *lenptr) {
+    robj *o = RM_LoadString(io);
+    char *buf;
+    size_t len;
+
+    if (o == NULL) return NULL;
+    o = getDecodedObject(o);
+    decrRefCount(o); /* getDecodedObject() took a reference. */
+    len = sdslen(o->ptr);
+    buf = zmalloc(len);
+    memcpy(buf,o->ptr,len);
+    decrRefCount(o);
+    if (lenptr) *lenptr = len;
+    return buf;
+}
+
+static void RM_SaveDouble(RedisModuleIO *io, double value) {
+    if (io->error) return;
+    if (rdbSaveDoubleValue(io->rio,value) == -1) io->error = 1;
+}
+
+static double RM_LoadDouble(RedisModuleIO *io) {
+    double value;
+
+    if (io->error || rdbLoadDoubleValue(io->rio,&value) == -1) {
+        io->error = 1;
+        return 0;
+    }
+    return value;
+}
+
+/* Save a value of a module type (the RDB type is already written): the
+ * type name and the encoding version, then the payload of the module.
+ * Returns the number of bytes written, or -1 on error. */
+int moduleTypeSaveValue(robj *o, rio *rdb) {
+    moduleValue *mv = o->ptr;
+    RedisModuleIO io = {rdb, mv->type, 0};
+    size_t start;
+
+    /* Just computing the length, see rdbSavedObjectLen(). */
+    if (rdb == NULL) {
+        rio r;
+        int len;
+
+        rioInitWithBuffer(&r,sdsempty());
+        len = moduleTypeSaveValue(o,&r);
+        sdsfree(r.io.buffer.ptr);
+        return len;
+    }
+
+    start = rdb->processed_bytes;
+    if (rdbSaveRawString(rdb,(unsigned char*)mv->type->name,
+                         strlen(mv->type->name)) == -1) return -1;
+    if (rdbSaveLen(rdb,mv->type->encver) == -1) return -1;
+    mv->type->rdb_save(&io,mv->value);
+    if (io.error) return -1;
+    return rdb->processed_bytes - start;
+}
+
+/* Load a value saved by moduleTypeSaveValue(). Returns NULL if the module
+ * type is unknown or on errors. */
+robj *moduleTypeLoadValue(rio *rdb) {
+    RedisModuleIO io;
+    moduleType *mt;
+    uint32_t encver;
+    robj *name;
+    void *value;
+
+    if ((name = rdbLoadStringObject(rdb)) == NULL) return NULL;
+    mt = moduleTypeLookupByName(name->ptr);
+    if (mt == NULL) {
+        redisLog(REDIS_WARNING,
+            "The RDB file contains a value of the module type '%s', "
+            "but no loaded module exports it.", (char*)name->ptr);
+        decrRefCount(name);
+        return NULL;
+    }
+    decrRefCount(name);
+    if ((encver = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+
+    io.rio = rdb;
+    io.type = mt;
+    io.error = 0;
+    value = mt->rdb_load(&io,encver);
+    if (io.error) {
+        if (value) mt->free(value);
+        return NULL;
+    }
+    return value ? createModuleObject(mt,value) : NULL;
+}
+
+/* --------------------------------------------------------------------------
+ * AOF rewrite
+ * -------------------------------------------------------------------------- */
+
+/* Emit a command into the AOF during the rewrite, for the aof_rewrite
+ * callback. The arguments are specified by 'fmt':
+ *
+ *  c -- Null terminated C string pointer.
+ *  b -- C buffer, two arguments needed: C string pointer and size_t length.
+ *  s -- RedisModuleString.
+ *  l -- long long integer. */
+static void RM_EmitAOF(RedisModuleIO *io, const char *cmdname,
+                       const char *fmt, ...)
+{
+    va_list ap;
+    const char *p;
+    int ok;
+
+    if (io->error) return;
+    ok = rioWriteBulkCount(io->rio,'*',strlen(fmt)+1) &&
+         rioWriteBulkString(io->rio,cmdname,strlen(cmdname));
+
+    va_start(ap,fmt);
+    for (p = fmt; ok && *p; p++) {
+        if (*p == 'c') {
+            char *cstr = va_arg(ap,char*);
+            ok = rioWriteBulkString(io->rio,cstr,strlen(cstr));
+        } else if (*p == 'b') {
+            char *buf = va_arg(ap,char*);
+            size_t len = va_arg(ap,size_t);
+            ok = rioWriteBulkString(io->rio,buf,len);
+        } else if (*p == 's') {
+            robj *obj = va_arg(ap,void*);
+            ok = rioWriteBulkObject(io->rio,obj);
+        } else if (*p == 'l') {
+            long long ll = va_arg(ap,long long);
+            ok = rioWriteBulkLongLong(io->rio,ll);
+        } else {
+            redisLog(REDIS_WARNING,
+                "Invalid format '%c' in RedisModule_EmitAOF() for the "
+                "module type '%s'", *p, io->type->name);
+            ok = 0;
+        }
+    }
+    va_end(ap);
+    if (!ok) io->error = 1;
+}
+
+/* Rewrite a value of a module type in the AOF. Returns 0 on error, like
+ * the other rewrite*Object() functions of aof.c. */
+int rewriteModuleObject(rio *r, robj *key, robj *o) {
+    moduleValue *mv = o->ptr;
+    RedisModuleIO io = {r, mv->type, 0};
+
+    if (mv->type->aof_rewrite == NULL) {
+        redisLog(REDIS_WARNING,
+            "The module type '%s' can't be rewritten in the AOF, set "
+            "aof-use-rdb-preamble to yes.", mv->type->name);
+        return 0;
+    }
+    mv->type->aof_rewrite(&io,key,mv->value);
+    return !io.error;
+}
+
+/* --------------------------------------------------------------------------
+ * Blocking clients from modules
+ *
+ * A module command can block the client with RM_BlockClient(), pass the
+ * returned handle to a thread doing the work, and return: the event loop
+ * keeps serving the other clients. Once done the thread calls
+ * RM_UnblockClient(), and the reply callback is called by the main thread
+ * to reply to the client.
+ * -------------------------------------------------------------------------- */
+
+/* Block a client in the context of a blocking command, returning an handle
+ * which will be used, later, in order to unblock the client with a call to
+ * RedisModule_UnblockClient(). The arguments specify callback functions
+ * and a timeout after which the client is unblocked.
+ *
+ * The callbacks are called in the following contexts:
+ *
+ * reply_callback:  called after a successful RedisModule_UnblockClient()
+ *                  call in order to reply to the client and unblock it.
+ * timeout_callback: called when the timeout is reached in order to send an
+ *                  error to the client. Without it a null reply is sent.
+ * free_privdata:   called in order to free the private data that is passed
+ *                  by RedisModule_UnblockClient() call.
+ *
+ * A zero 'timeout_ms' means no timeout.
+ *
+ * Clients that can't be blocked, like the ones calling the command from
+ * Lua or inside MULTI, receive an error, and the reply callback is not
+ * called: the handle must still be released with UnblockClient(). */
+static RedisModuleBlockedClient *RM_BlockClient(RedisModuleCtx *ctx,
+    RedisModuleCmdFunc reply_callback, RedisModuleCmdFunc timeout_callback,
+    void (*free_privdata)(void*), long long timeout_ms)
+{
+    redisClient *c = ctx->client;
+    int islua = c->flags & REDIS_LUA_CLIENT;
+    int ismulti = c->flags & REDIS_MULTI;
+    int isfake = c->fd == -1;
+    RedisModuleBlockedClient *bc = zmalloc(sizeof(*bc));
+
+    bc->client = (islua || ismulti || isfake) ? NULL : c;
+    bc->module = ctx->module;
+    bc->reply_callback = reply_callback;
+    bc->timeout_callback = timeout_callback;
+    bc->free_privdata = free_privdata;
+    bc->privdata = NULL;
+    bc->reply_client = createClient(-1);
+    bc->reply_client->flags |= REDIS_MODULE_CLIENT;
+    bc->dbid = c->db->id;
+
+    if (bc->client == NULL) {
+        addReplyError(c, islua ?
+            "Blocking module command called from Lua script" : ismulti ?
+            "Blocking module command called from transaction" :
+            "Blocking module command called from a fake client");
+    } else {
+        c->bpop.module_blocked_handle = bc;
+        c->bpop.timeout = timeout_ms ? (mstime()+timeout_ms) : 0;
+        blockClient(c,REDIS_BLOCKED_MODULE);
+    }
+    return bc;
+}
+
+/* Unblock a client blocked by RedisModule_BlockClient(). This will trigger
+ * the reply callback to be called in order to reply to the client. The
+ * 'privdata' argument will be accessible by the reply callback, so the
+ * caller of this function can pass any value that is needed in order to
+ * actually reply to the client.
+ *
+ * This function is thread safe: it can be called from any thread. The
+ * handle must not be used after the call. */
+static int RM_UnblockClient(RedisModuleBlockedClient *bc, void *privdata) {
+    pthread_mutex_lock(&moduleUnblockedClientsMutex);
+    bc->privdata = privdata;
+    listAddNodeTail(moduleUnblockedClients,bc);
+    if (write(server.module_blocked_pipe[1],"A",1) != 1) {
+        /* Ignore the error, this is best-effort. */
+    }
+    pthread_mutex_unlock(&moduleUnblockedClientsMutex);
+    return REDISMODULE_OK;
+}
+
+/* Abort a blocked client blocking operation: the client will be unblocked
+ * without firing the reply callback. */
+static int RM_AbortBlock(RedisModuleBlockedClient *bc) {
+    bc->reply_callback = NULL;
+    return RM_UnblockClient(bc,NULL);
+}
+
+/* Return non-zero if a module command was called in order to fill the
+ * reply for a blocked client. */
+static int RM_IsBlockedReplyRequest(RedisModuleCtx *ctx) {
+    return (ctx->flags & REDISMODULE_CTX_BLOCKED_REPLY) != 0;
+}
+
+/* Return non-zero if a module command was called in order to fill the
+ * reply for a blocked client that timed out. */
+static int RM_IsBlockedTimeoutRequest(RedisModuleCtx *ctx) {
+    return (ctx->flags & REDISMODULE_CTX_BLOCKED_TIMEOUT) != 0;
+}
+
+/* Get the privata data set by RedisModule_UnblockClient(). */
+static void *RM_GetBlockedClientPrivateData(RedisModuleCtx *ctx) {
+    return ctx->blocked_privdata;
+}
+
+/* Readable handler of the pipe written by RM_UnblockClient(): it just
+ * awakes the event loop, the clients are served by beforeSleep() calling
+ * moduleHandleBlockedClients(). */
+void moduleBlockedClientPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+    REDIS_NOTUSED(privdata);
+}
+
+/* Called by unblockClient(): the client is no longer referenced by the
+ * handle, that is released once the module unblocks it. The client was not
+ * reset after the command, so that the callbacks could access argv. */
+void unblockClientFromModule(redisClient *c) {
+    RedisModuleBlockedClient *bc = c->bpop.module_blocked_handle;
+
+    bc->client = NULL;
+    c->bpop.module_blocked_handle = NULL;
+    resetClient(c);
+}
+
+/* Append the replies accumulated in 'src' by thread safe contexts to the
+ * output buffers of the client 'c'. */
+static void moduleAppendReplies(redisClient *c, redisClient *src) {
+    listIter li;
+    listNode *ln;
+
+    if (src->bufpos) addReplyString(c,src->buf,src->bufpos);
+    listRewind(src->reply,&li);
+    while((ln = listNext(&li))) addReply(c,listNodeValue(ln));
+}
+
+/* Called by beforeSleep() in order to serve the clients unblocked by the
+ * modules: the reply callback is called, and the client is unblocked. */
+void moduleHandleBlockedClients(void) {
+    char buf[1];
+
+    pthread_mutex_lock(&moduleUnblockedClientsMutex);
+    /* Here we unblock all the pending clients blocked in modules operations
+     * so we can read every pending "awake byte" in the pipe. */
+    while (read(server.module_blocked_pipe[0],buf,1) == 1);
+    while (listLength(moduleUnblockedClients)) {
+        listNode *ln = listFirst(moduleUnblockedClients);
+        RedisModuleBlockedClient *bc = ln->value;
+        redisClient *c = bc->client;
+
+        listDelNode(moduleUnblockedClients,ln);
+        pthread_mutex_unlock(&moduleUnblockedClientsMutex);
+
+        if (c != NULL) {
+            /* The replies of the thread safe contexts come first. */
+            moduleAppendReplies(c,bc->reply_client);
+            if (bc->reply_callback != NULL) {
+                RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+
+                ctx.flags |= REDISMODULE_CTX_BLOCKED_REPLY;
+                ctx.blocked_privdata = bc->privdata;
+                ctx.module = bc->module;
+                ctx.client = c;
+                bc->reply_callback(&ctx,(RedisModuleString**)c->argv,c->argc);
+                moduleFreeContext(&ctx);
+            }
+        }
+        if (bc->privdata && bc->free_privdata)
+            bc->free_privdata(bc->privdata);
+        freeClient(bc->reply_client);
+        if (c != NULL) unblockClient(c);
+        zfree(bc);
+
+        pthread_mutex_lock(&moduleUnblockedClientsMutex);
+    }
+    pthread_mutex_unlock(&moduleUnblockedClientsMutex);
+}
+
+/* Called by replyToBlockedClientTimedOut() when the timeout of a client
+ * blocked by a module is reached: the client is unblocked right after,
+ * and the handle released once the module unblocks it. */
+void moduleBlockedClientTimedOut(redisClient *c) {
+    RedisModuleBlockedClient *bc = c->bpop.module_blocked_handle;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+
+    if (bc->timeout_callback == NULL) {
+        addReplyNull(c);
+        return;
+    }
+    ctx.flags |= REDISMODULE_CTX_BLOCKED_TIMEOUT;
+    ctx.module = bc->module;
+    ctx.client = c;
+    bc->timeout_callback(&ctx,(RedisModuleString**)c->argv,c->argc);
+    moduleFreeContext(&ctx);
+}
+
+/* --------------------------------------------------------------------------
+ * Thread safe contexts and the global lock
+ * -------------------------------------------------------------------------- */
+
+/* Return a context which can be used inside threads to make Redis context
+ * calls with certain modules APIs. If 'bc' is not NULL then the replies
+ * are accumulated and sent to the blocked client when it is unblocked,
+ * otherwise they are discarded. The function can be called from any
+ * thread.
+ *
+ * The keyspace can only be accessed between RedisModule_ThreadSafeContextLock()
+ * and RedisModule_ThreadSafeContextUnlock(): every time the context is
+ * locked the DB selected by the blocked client, or zero, is selected. The
+ * reply functions don't need the lock. */
+static RedisModuleCtx *RM_GetThreadSafeContext(RedisModuleBlockedClient *bc) {
+    RedisModuleCtx *ctx = zmalloc(sizeof(*ctx));
+    RedisModuleCtx empty = REDISMODULE_CTX_INIT;
+
+    memcpy(ctx,&empty,sizeof(empty));
+    if (bc) {
+        ctx->blocked_client = bc;
+        ctx->module = bc->module;
+    }
+    ctx->flags |= REDISMODULE_CTX_THREAD_SAFE;
+    return ctx;
+}
+
+/* Release a thread safe context, that must not be locked. */
+static void RM_FreeThreadSafeContext(RedisModuleCtx *ctx) {
+    moduleFreeContext(ctx);
+    zfree(ctx);
+}
+
+/* Acquire the server lock before executing a thread safe API call.
+ * This is not needed for the reply functions when there is a blocked
+ * client connected to the thread safe context. */
+static void RM_ThreadSafeContextLock(RedisModuleCtx *ctx) {
+    moduleAcquireGIL();
+    ctx->client = createClient(-1);
+    ctx->client->flags |= REDIS_MODULE_CLIENT;
+    if (ctx->blocked_client) selectDb(ctx->client,ctx->blocked_client->dbid);
+}
+
+/* Release the server lock after a thread safe API call was executed. */
+static void RM_ThreadSafeContextUnlock(RedisModuleCtx *ctx) {
+    freeClient(ctx->client);
+    ctx->client = NULL;
+    moduleReleaseGIL();
+}
+
+/* The main thread holds the lock, except while it waits for events. */
+void moduleAcquireGIL(void) {
+    pthread_mutex_lock(&moduleGIL);
+}
+
+void moduleReleaseGIL(void) {
+    pthread_mutex_unlock(&moduleGIL);
+}
+
+/* --------------------------------------------------------------------------
+ * Logging and misc
+ * -------------------------------------------------------------------------- */
+
+/* Produces a log message in the standard Redis log, prefixed by the module
+ * name. 'level' is one of the REDISMODULE_LOGLEVEL_* strings. */
+static void RM_Log(RedisModuleCtx *ctx, const char *levelstr,
+                   const char *fmt, ...)
+{
+    va_list ap;
+    char msg[REDIS_MAX_LOGMSG_LEN];
+    int level;
+
+    if (!strcasecmp(levelstr,"debug")) level = REDIS_DEBUG;
+    else if (!strcasecmp(levelstr,"verbose")) level = REDIS_VERBOSE;
+    else if (!strcasecmp(levelstr,"notice")) level = REDIS_NOTICE;
+    else level = REDIS_WARNING;
+    if (level < server.verbosity) return;
+
+    va_start(ap,fmt);
+    vsnprintf(msg,sizeof(msg),fmt,ap);
+    va_end(ap);
+    redisLog(level,"<%s> %s",
+        (ctx && ctx->module) ? ctx->module->name : "module", msg);
+}
+
+/* Return the current UNIX time in milliseconds. */
+static long long RM_Milliseconds(void) {
+    return mstime();
+}
+
+/* --------------------------------------------------------------------------
+ * Modules API internals
+ * -------------------------------------------------------------------------- */
+
+/* Lookup the requested module API and store the function pointer into the
+ * target pointer. The function returns REDISMODULE_ERR if there is no such
+ * named API, otherwise REDISMODULE_OK. */
+static int RM_GetApi(const char *funcname, void **targetPtrPtr) {
+    dictEntry *he = dictFind(moduleapi,funcname);
+
+    if (!he) return REDISMODULE_ERR;
+    *targetPtrPtr = dictGetVal(he);
+    return REDISMODULE_OK;
+}
+
+static int moduleRegisterApi(const char *funcname, void *funcptr) {
+    return dictAdd(moduleapi,(char*)funcname,funcptr);
+}
+
+#define REGISTER_API(name) \
+    moduleRegisterApi("RedisModule_" #name, (void *)(unsigned long)RM_ ## name)
+
+/* Register all the APIs we export. */
+static void moduleRegisterCoreAPI(void) {
+    REGISTER_API(Alloc);
+    REGISTER_API(Calloc);
+    REGISTER_API(Realloc);
+    REGISTER_API(Free);
+    REGISTER_API(Strdup);
+    REGISTER_API(CreateCommand);
+    REGISTER_API(SetModuleAttribs);
+    REGISTER_API(WrongArity);
+    REGISTER_API(ReplyWithLongLong);
+    REGISTER_API(ReplyWithError);
+    REGISTER_API(ReplyWithSimpleString);
+    REGISTER_API(ReplyWithArray);
+    REGISTER_API(ReplySetArrayLength);
+    REGISTER_API(ReplyWithString);
+    REGISTER_API(ReplyWithStringBuffer);
+    REGISTER_API(ReplyWithNull);
+    REGISTER_API(ReplyWithDouble);
+    REGISTER_API(GetSelectedDb);
+    REGISTER_API(SelectDb);
+    REGISTER_API(OpenKey);
+    REGISTER_API(CloseKey);
+    REGISTER_API(KeyType);
+    REGISTER_API(ValueLength);
+    REGISTER_API(DeleteKey);
+    REGISTER_API(StringSet);
+    REGISTER_API(StringDMA);
+    REGISTER_API(GetExpire);
+    REGISTER_API(SetExpire);
+    REGISTER_API(CreateString);
+    REGISTER_API(CreateStringFromLongLong);
+    REGISTER_API(FreeString);
+    REGISTER_API(RetainString);
+    REGISTER_API(StringPtrLen);
+    REGISTER_API(StringToLongLong);
+    REGISTER_API(StringToDouble);
+    REGISTER_API(ReplicateVerbatim);
+    REGISTER_API(CreateDataType);
+    REGISTER_API(ModuleTypeSetValue);
+    REGISTER_API(ModuleTypeGetType);
+    REGISTER_API(ModuleTypeGetValue);
+    REGISTER_API(SaveUnsigned);
+    REGISTER_API(LoadUnsigned);
+    REGISTER_API(SaveSigned);
+    REGISTER_API(LoadSigned);
+    REGISTER_API(SaveString);
+    REGISTER_API(SaveStringBuffer);
+    REGISTER_API(LoadString);
+    REGISTER_API(LoadStringBuffer);
+    REGISTER_API(SaveDouble);
+    REGISTER_API(LoadDouble);
+    REGISTER_API(EmitAOF);
+    REGISTER_API(Log);
+    REGISTER_API(Milliseconds);
+    REGISTER_API(BlockClient);
+    REGISTER_API(UnblockClient);
+    REGISTER_API(AbortBlock);
+    REGISTER_API(IsBlockedReplyRequest);
+    REGISTER_API(IsBlockedTimeoutRequest);
+    REGISTER_API(GetBlockedClientPrivateData);
+    REGISTER_API(GetThreadSafeContext);
+    REGISTER_API(FreeThreadSafeContext);
+    REGISTER_API(ThreadSafeContextLock);
+    REGISTER_API(ThreadSafeContextUnlock);
+}
+
+/* Global initialization at Redis startup, before the configuration is
+ * loaded: "loadmodule" only queues the modules. */
+void moduleInitModulesSystem(void) {
+    server.loadmodule_queue = listCreate();
+    modules = dictCreate(&moduleDictType,NULL);
+    moduleapi = dictCreate(&moduleDictType,NULL);
+    moduleRegisterCoreAPI();
+
+    /* Set up the pipe used to awake the event loop when a thread unblocks
+     * a client blocked by a module. */
+    moduleUnblockedClients = listCreate();
+    if (pipe(server.module_blocked_pipe) == -1) {
+        redisLog(REDIS_WARNING,
+            "Can't create the pipe for module blocking commands: %s",
+            strerror(errno));
+        exit(1);
+    }
+    /* Make the pipe non blocking. This is just a best effort aware mechanism
+     * and we do not want to block not in the read nor in the write half. */
+    anetNonBlock(NULL,server.module_blocked_pipe[0]);
+    anetNonBlock(NULL,server.module_blocked_pipe[1]);
+
+    /* Our thread-safe contexts GIL must start with already locked:
+     * it is just unlocked when it's safe. */
+    moduleAcquireGIL();
+}
+
+/* Queue a module to load at startup, for the "loadmodule" directive. */
+void queueLoadModule(sds path, sds *argv, int argc) {
+    struct moduleLoadQueueEntry *loadmod = zmalloc(sizeof(*loadmod));
+    int j;
+
+    loadmod->path = sdsdup(path);
+    loadmod->argc = argc;
+    loadmod->argv = zmalloc(sizeof(robj*)*argc);
+    for (j = 0; j < argc; j++)
+        loadmod->argv[j] = createStringObject(argv[j],sdslen(argv[j]));
+    listAddNodeTail(server.loadmodule_queue,loadmod);
+}
+
+/* Load all the modules in the server.loadmodule_queue list, which is
+ * populated by "loadmodule" directives in the configuration file.
+ * We can't load modules directly when processing the configuration file
+ * because the server must be initialized before loading modules.
+ *
+ * The function exits the server on loading errors. */
+void moduleLoadFromQueue(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.loadmodule_queue,&li);
+    while((ln = listNext(&li))) {
+        struct moduleLoadQueueEntry *loadmod = ln->value;
+        int j;
+
+        if (moduleLoad(loadmod->path,(void **)loadmod->argv,loadmod->argc)
+            == REDIS_ERR)
+        {
+            redisLog(REDIS_WARNING,
+                "Can't load module from %s: server aborting",
+                loadmod->path);
+            exit(1);
+        }
+        for (j = 0; j < loadmod->argc; j++) decrRefCount(loadmod->argv[j]);
+        zfree(loadmod->argv);
+        sdsfree(loadmod->path);
+        zfree(loadmod);
+        listDelNode(server.loadmodule_queue,ln);
+    }
+}
+
+/* Free the memory of a module that is not, or no longer, loaded. */
+static void moduleFreeModuleStructure(RedisModule *module) {
+    listRelease(module->types);
+    zfree(module->name);
+    sdsfree(module->path);
+    sdsfree(module->args);
+    zfree(module);
+}
+
+/* Unregister all the commands registered by the specified module. */
+static void moduleUnregisterCommands(RedisModule *module) {
+    dictIterator *di = dictGetSafeIterator(server.commands);
+    dictEntry *de;
+
+    while ((de = dictNext(di)) != NULL) {
+        struct redisCommand *cmd = dictGetVal(de);
+        RedisModuleCommandProxy *cp = cmd->module_cmd;
+        listIter li;
+        listNode *ln;
+        sds cmdname;
+
+        if (cp == NULL || cp->module != module) continue;
+
+        /* The clients may still reference it as their last command. */
+        listRewind(server.clients,&li);
+        while((ln = listNext(&li))) {
+            redisClient *c = ln->value;
+            if (c->lastcmd == cmd) c->lastcmd = NULL;
+        }
+
+        cmdname = sdsnew(cmd->name);
+        dictDelete(server.commands,cmdname);
+        dictDelete(server.orig_commands,cmdname);
+        sdsfree(cmdname);
+        zfree(cmd->name);
+        zfree(cmd->sflags);
+        zfree(cmd->latency_histogram);
+        zfree(cmd);
+        zfree(cp);
+    }
+    dictReleaseIterator(di);
+}
+
+/* Load a module and initialize it. On success REDIS_OK is returned,
+ * otherwise REDIS_ERR is returned. */
+int moduleLoad(const char *path, void **module_argv, int module_argc) {
+    int (*onload)(void *, void **, int);
+    void *handle;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+    int j;
+
+#ifdef RTLD_NOLOAD
+    /* Calling OnLoad() again would reinitialize the module state. */
+    if ((handle = dlopen(path,RTLD_NOW|RTLD_NOLOAD)) != NULL) {
+        dlclose(handle);
+        redisLog(REDIS_WARNING, "Module %s is already loaded", path);
+        return REDIS_ERR;
+    }
+#endif
+    handle = dlopen(path,RTLD_NOW|RTLD_LOCAL);
+    if (handle == NULL) {
+        redisLog(REDIS_WARNING, "Module %s failed to load: %s", path, dlerror());
+        return REDIS_ERR;
+    }
+    onload = (int (*)(void *, void **, int))(unsigned long)
+        dlsym(handle,"RedisModule_OnLoad");
+    if (onload == NULL) {
+        dlclose(handle);
+        redisLog(REDIS_WARNING,
+            "Module %s does not export RedisModule_OnLoad() "
+            "symbol. Module not loaded.",path);
+        return REDIS_ERR;
+    }
+
+    ctx.flags |= REDISMODULE_CTX_ONLOAD;
+    if (onload((void*)&ctx,module_argv,module_argc) == REDISMODULE_ERR ||
+        ctx.module == NULL ||
+        dictFind(modules,ctx.module->name) != NULL)
+    {
+        if (ctx.module) {
+            moduleUnregisterCommands(ctx.module);
+            listSetFreeMethod(ctx.module->types,moduleFreeType);
+            moduleFreeModuleStructure(ctx.module);
+        }
+        dlclose(handle);
+        redisLog(REDIS_WARNING,
+            "Module %s initialization failed. Module not loaded",path);
+        return REDIS_ERR;
+    }
+
+    /* Redis module loaded! Register it. */
+    ctx.module->handle = handle;
+    ctx.module->path = sdsnew(path);
+    ctx.module->args = sdsempty();
+    for (j = 0; j < module_argc; j++) {
+        robj *arg = module_argv[j];
+        ctx.module->args = sdscatlen(ctx.module->args," ",1);
+        ctx.module->args = sdscatrepr(ctx.module->args,arg->ptr,
+                                      sdslen(arg->ptr));
+    }
+    dictAdd(modules,ctx.module->name,ctx.module);
+    redisLog(REDIS_NOTICE,"Module '%s' loaded from %s",ctx.module->name,path);
+    return REDIS_OK;
+}
+
+/* Unload the module registered with the specified name. On success
+ * REDIS_OK is returned, otherwise REDIS_ERR is returned and errno is set
+ * to ENOENT if there is no such module, or EBUSY if the module exports
+ * data types: their values could be in the dataset. */
+static int moduleUnload(sds name) {
+    RedisModule *module = dictFetchValue(modules,name);
+
+    if (module == NULL) {
+        errno = ENOENT;
+        return REDIS_ERR;
+    }
+    if (listLength(module->types)) {
+        errno = EBUSY;
+        return REDIS_ERR;
+    }
+
+    moduleUnregisterCommands(module);
+    if (dlclose(module->handle) == -1) {
+        char *error = dlerror();
+        if (error == NULL) error = "Unknown error";
+        redisLog(REDIS_WARNING,"Error when trying to close the %s module: %s",
+            module->name, error);
+    }
+    redisLog(REDIS_NOTICE,"Module %s unloaded",module->name);
+    dictDelete(modules,module->name);
+    moduleFreeModuleStructure(module);
+    return REDIS_OK;
+}
+
+/* Release a type of a module that failed to load. */
+static void moduleFreeType(void *ptr) {
+    moduleType *mt = ptr;
+
+    zfree(mt->name);
+    zfree(mt);
+}
+
+/* Emit a "loadmodule" line for every loaded module, for CONFIG REWRITE. */
+void rewriteConfigLoadmoduleOption(struct rewriteConfigState *state) {
+    dictIterator *di = dictGetIterator(modules);
+    dictEntry *de;
+
+    while ((de = dictNext(di)) != NULL) {
+        RedisModule *module = dictGetVal(de);
+        sds line = sdsnew("loadmodule ");
+
+        line = sdscatsds(line,module->path);
+        line = sdscatsds(line,module->args);
+        rewriteConfigRewriteLine(state,"loadmodule",line,1);
+    }
+    dictReleaseIterator(di);
+    /* Mark "loadmodule" as processed in case modules is empty. */
+    rewriteConfigMarkAsProcessed(state,"loadmodule");
+}
+
+/* MODULE LOAD <path> [args...]
+ * MODULE UNLOAD <name>
+ * MODULE LIST */
+void moduleCommand(redisClient *c) {
+    char *subcmd = c->argv[1]->ptr;
+
+    if (!strcasecmp(subcmd,"load") && c->argc >= 3) {
+        robj **argv = NULL;
+        int argc = 0;
+
+        if (c->argc > 3) {
+            argc = c->argc - 3;
+            argv = &c->argv[3];
+        }
+
+        if (moduleLoad(c->argv[2]->ptr,(void **)argv,argc) == REDIS_OK)
+            addReply(c,shared.ok);
+        else
+            addReplyError(c,
+                "Error loading the extension. Please check the server logs.");
+    } else if (!strcasecmp(subcmd,"unload") && c->argc == 3) {
+        if (moduleUnload(c->argv[2]->ptr) == REDIS_OK) {
+            addReply(c,shared.ok);
+        } else {
+            char *errmsg;
+            switch(errno) {
+            case ENOENT:
+                errmsg = "no such module with that name";
+                break;
+            case EBUSY:
+                errmsg = "the module exports one or more module-side data types, can't unload";
+                break;
+            default:
+                errmsg = "operation not possible.";
+                break;
+            }
+            addReplyErrorFormat(c,"Error unloading module: %s",errmsg);
+        }
+    } else if (!strcasecmp(subcmd,"list") && c->argc == 2) {
+        dictIterator *di = dictGetIterator(modules);
+        dictEntry *de;
+
+        addReplyMultiBulkLen(c,dictSize(modules));
+        while ((de = dictNext(di)) != NULL) {
+            RedisModule *module = dictGetVal(de);
+
+            addReplyMapLen(c,2);
+            addReplyBulkCString(c,"name");
+            addReplyBulkCString(c,module->name);
+            addReplyBulkCString(c,"ver");
+            addReplyLongLong(c,module->ver);
+        }
+        dictReleaseIterator(di);
+    } else {
+        addReply(c,shared.syntaxerr);
+    }
+}
@@ -42,6 +42,7 @@ void initClientMultiState(redisClient *c) {
 
     // 命令计数
     c->mstate.count = 0;
+    c->mstate.capacity = 0;
 }
 
 /* Release all the resources associated with MULTI/EXEC state 
@@ -71,25 +72,29 @@ void freeClientMultiState(redisClient *c) {
 /* Add a new command into the MULTI commands queue 
  *
  * 将一个新命令添加到事务队列中
+ *
+ * The queue takes ownership of the client argv, that is allocated again
+ * for the next command anyway, so the arguments are not copied.
  */
 void queueMultiCommand(redisClient *c) {
     multiCmd *mc;
-    int j;
 
-    // 为新数组元素分配空间
-    c->mstate.commands = zrealloc(c->mstate.commands,
-            sizeof(multiCmd)*(c->mstate.count+1));
+    // 按倍数扩展队列，避免每个命令一次 zrealloc
+    if (c->mstate.count == c->mstate.capacity) {
+        c->mstate.capacity = c->mstate.capacity ? c->mstate.capacity*2 : 8;
+        c->mstate.commands = zrealloc(c->mstate.commands,
+                sizeof(multiCmd)*c->mstate.capacity);
+    }
 
     // 指向新元素
     mc = c->mstate.commands+c->mstate.count;
 
-    // 设置事务的命令、命令参数数量，以及命令的参数
+    // 设置事务的命令、命令参数数量，并直接接管客户端的参数数组
     mc->cmd = c->cmd;
     mc->argc = c->argc;
-    mc->argv = zmalloc(sizeof(robj*)*c->argc);
-    memcpy(mc->argv,c->argv,sizeof(robj*)*c->argc);
-    for (j = 0; j < c->argc; j++)
-        incrRefCount(mc->argv[j]);
+    mc->argv = c->argv;
+    c->argv = NULL;
+    c->argc = 0;
 
     // 事务命令数量计数器增一
     c->mstate.count++;
@@ -168,6 +173,7 @@ void execCommand(redisClient *c) {
     int orig_argc;
     struct redisCommand *orig_cmd;
     int must_propagate = 0; /* Need to propagate MULTI/EXEC to AOF / slaves? */
+    redisOpArray batch;
 
     // 客户端没有执行事务
     if (!(c->flags & REDIS_MULTI)) {
@@ -196,7 +202,7 @@ void execCommand(redisClient *c) {
     if (c->flags & (REDIS_DIRTY_CAS|REDIS_DIRTY_EXEC)) {
 
         addReply(c, c->flags & REDIS_DIRTY_EXEC ? shared.execaborterr :
-                                                  shared.nullmultibulk);
+                                                  shared.nullarray[c->resp]);
 
         // 取消事务
         discardTransaction(c);
@@ -216,6 +222,11 @@ void execCommand(redisClient *c) {
 
     addReplyMultiBulkLen(c,c->mstate.count);
 
+    /* What the commands propagate is collected and sent to the AOF and the
+     * slaves as a single batch together with MULTI and EXEC. */
+    redisOpArrayInit(&batch);
+    server.propagate_batch = &batch;
+
     // 执行事务中的命令
     for (j = 0; j < c->mstate.count; j++) {
 
@@ -265,10 +276,20 @@ void execCommand(redisClient *c) {
     // 清理事务状态
     discardTransaction(c);
 
-    /* Make sure the EXEC command will be propagated as well if MULTI
-     * was already propagated. */
-    // 将服务器设为脏，确保 EXEC 命令也会被传播
-    if (must_propagate) server.dirty++;
+    /* Close the block with EXEC if MULTI was propagated, and send it all.
+     * EXEC is part of the batch, so call() must not propagate it again. */
+    // EXEC 也放进批次里，由这里一次性传播
+    if (must_propagate) {
+        robj *execstring = createStringObject("EXEC",4);
+
+        propagate(server.execCommand,c->db->id,&execstring,1,
+                  REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+        decrRefCount(execstring);
+    }
+    server.propagate_batch = NULL;
+    propagateBatch(&batch);
+    redisOpArrayFree(&batch);
+    preventCommandPropagation(c);
 
 handle_monitor:
     /* Send EXEC to clients waiting data from MONITOR. We do it here
@@ -32,10 +32,24 @@
 // https://redis.io/topics/protocol
 
 #include "redis.h"
+#include "endianconv.h"
+#include "shmtransport.h"
 #include <sys/uio.h>
 #include <math.h>
 
 static void setProtocolError(redisClient *c, int pos);
+static int clientInstallWriteHandler(redisClient *c);
+static int postponeClientRead(redisClient *c);
+
+/* Operation the I/O threads are currently performing, if any. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* Set by processEventsWhileBlocked() while serving events, since in that
+ * context beforeSleep() is never called to collect the postponed reads. */
+static int processing_events_while_blocked = 0;
 
 /* To evaluate the output buffer size of a client we need to get size of
  * allocated objects, however we can't used zmalloc_size() directly on sds
@@ -43,7 +57,7 @@ static void setProtocolError(redisClient *c, int pos);
  * returned pointer), so we use this helper function. */
 // 计算输出缓冲区的大小 
 size_t zmalloc_size_sds(sds s) {
-    return zmalloc_size(s-sizeof(struct sdshdr));
+    return zmalloc_size(sdsAllocPtr(s));
 }
 
 /* Return the amount of memory used by the sds string at object->ptr
@@ -115,12 +129,18 @@ redisClient *createClient(int fd) {
 
     // 默认数据库
     selectDb(c,0);
+    // 唯一 ID
+    c->id = server.next_client_id++;
     // 套接字
     c->fd = fd;
     // 名字
     c->name = NULL;
     // 回复缓冲区的偏移量
     c->bufpos = 0;
+    c->buf = zmalloc(REDIS_REPLY_CHUNK_BYTES);
+    c->buf_usable_size = REDIS_REPLY_CHUNK_BYTES;
+    c->buf_peak = 0;
+    memset(c->argv_pool,0,sizeof(c->argv_pool));
 
     // TODO:(DONE) 这几个缓冲区装的都是一些什么？为什么这个要初始化为 sdsempty()
     // 装的是从 socket 中 read() 出来的原始 RESP 协议内容，所以才会使用 sds 的方式
@@ -129,6 +149,8 @@ redisClient *createClient(int fd) {
     //       没有人能保证日后还会有内存空间放 RESP 协议的内容！
     // 查询缓冲区
     c->querybuf = sdsempty();
+    // master 发来的、已经执行但还没有转发给 sub-slave 的复制流
+    c->pending_querybuf = sdsempty();
     // 查询缓冲区峰值
     c->querybuf_peak = 0;
     // 命令请求的类型
@@ -145,15 +167,22 @@ redisClient *createClient(int fd) {
     c->bulklen = -1;
     // 已发送字节数
     c->sentlen = 0;
+    // I/O 线程读写的结果，由主线程处理
+    c->io_nread = c->io_nwritten = c->io_sentnodes = c->io_errno = 0;
+    // 网络流量与命令执行时间统计
+    memset(&c->usage,0,sizeof(c->usage));
+    memset(&c->usage_folded,0,sizeof(c->usage_folded));
     // 状态 FLAG
     c->flags = 0;
     // 创建时间和最后一次互动时间
     c->ctime = c->lastinteraction = server.unixtime;
     // 认证状态
     c->authenticated = 0;
+    c->resp = 2;
     // 复制状态
     c->replstate = REDIS_REPL_NONE;
-    // 复制偏移量
+    // 复制偏移量：已经从 master 读入的，以及已经执行了的
+    c->read_reploff = 0;
     c->reploff = 0;
     // 通过 ACK 命令接收到的偏移量
     c->repl_ack_off = 0;
@@ -161,6 +190,13 @@ redisClient *createClient(int fd) {
     c->repl_ack_time = 0;
     // 客户端为 slave 时使用，记录了 slave 所使用的端口号
     c->slave_listening_port = 0;
+    // slave 声明的能力以及无盘复制的上线方式
+    c->slave_capa = SLAVE_CAPA_NONE;
+    c->repl_put_online_on_ack = 0;
+    c->psync_initial_offset = 0;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    c->repl_zbuf = NULL;
     // 回复链表
     c->reply = listCreate();
     // 回复链表的字节量
@@ -175,23 +211,37 @@ redisClient *createClient(int fd) {
     // 阻塞超时
     c->bpop.timeout = 0;
     // 造成客户端阻塞的列表键
-    c->bpop.keys = dictCreate(&setDictType,NULL);
+    c->bpop.keys = dictCreate(&objectKeyHeapPointerValueDictType,NULL);
     // 在解除阻塞时将元素推入到 target 指定的键中
     // BRPOPLPUSH 命令时使用
     c->bpop.target = NULL;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
+    c->bpop.xread_count = 0;
+    c->bpop.module_blocked_handle = NULL;
+    c->bpop.migrate_job = NULL;
     c->woff = 0;
+    c->max_lag = 0;
+    c->aof_woff = 0;
     // 进行事务时监视的键
     c->watched_keys = listCreate();
     // 订阅的频道和模式
     c->pubsub_channels = dictCreate(&setDictType,NULL);
     c->pubsub_patterns = listCreate();
+    c->pubsubshard_channels = dictCreate(&setDictType,NULL);
     c->peerid = NULL;
+    c->shm = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
+    c->client_tracking_redirection = 0;
+    c->client_tracking_prefixes = NULL;
     // 如果不是伪客户端，那么添加到服务器的客户端链表中
-    if (fd != -1) listAddNodeTail(server.clients,c);
+    if (fd != -1) {
+        uint64_t id = htonu64(c->id);
+
+        listAddNodeTail(server.clients,c);
+        raxInsert(server.clients_index,(unsigned char*)&id,sizeof(id),c,NULL);
+    }
     // 初始化客户端的事务状态
     initClientMultiState(c);
 
@@ -199,6 +249,21 @@ redisClient *createClient(int fd) {
     return c;
 }
 
+/* Return true if the client has output still to be sent: the output
+ * buffers, or, for slaves, the shared replication buffer after the
+ * position they reached and the frame not yet sent on compressed links. */
+int clientHasPendingReplies(redisClient *c) {
+    if (c->bufpos || listLength(c->reply)) return 1;
+    if ((c->flags & REDIS_SLAVE) && c->ref_repl_buf_node) {
+        replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+
+        if (c->repl_zbuf && sdslen(c->repl_zbuf)) return 1;
+        return c->ref_repl_buf_node != listLast(server.repl_buffer_blocks) ||
+               c->ref_block_pos < o->used;
+    }
+    return 0;
+}
+
 /* This function is called every time we are going to transmit new data
  * to the client. The behavior is the following:
  *
@@ -230,23 +295,28 @@ redisClient *createClient(int fd) {
  */
 int prepareClientToWrite(redisClient *c) {
 
-    // LUA 脚本环境所使用的伪客户端总是可写的
-    if (c->flags & REDIS_LUA_CLIENT) return REDIS_OK;
+    // LUA 脚本环境和模块所使用的伪客户端总是可写的
+    if (c->flags & (REDIS_LUA_CLIENT|REDIS_MODULE_CLIENT)) return REDIS_OK;
     
     // 客户端是 master 并且不接受查询，
     // 那么它是不可写的，出错
     if ((c->flags & REDIS_MASTER) &&
         !(c->flags & REDIS_MASTER_FORCE_REPLY)) return REDIS_ERR;
 
+    // 正在导入槽的连接只接收 BEGIN 和 COMMIT 的回复
+    if (c->flags & REDIS_SLOT_IMPORT) return REDIS_ERR;
+
     // 无连接的伪客户端总是不可写的
     if (c->fd <= 0) return REDIS_ERR; /* Fake client */
 
     // 一般情况，为客户端套接字安装写处理器到事件循环
-    if (c->bufpos == 0 && listLength(c->reply) == 0 &&
+    // Clients served by an I/O thread right now get the handler installed
+    // by the main thread once the threaded read is completed.
+    if (!clientHasPendingReplies(c) &&
+        !(c->flags & REDIS_PENDING_READ) &&
         (c->replstate == REDIS_REPL_NONE ||
-         c->replstate == REDIS_REPL_ONLINE) &&
-        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-        sendReplyToClient, c) == AE_ERR) return REDIS_ERR;
+         (c->replstate == REDIS_REPL_ONLINE && !c->repl_put_online_on_ack)) &&
+        clientInstallWriteHandler(c) == REDIS_ERR) return REDIS_ERR;
         // 仅仅是要求 epoll 看看这个 c->fd 是否可写，可以的话，那就进行 callback 回调
         //（避免直接调用 write() 因为此时此刻未必可以立即写，所以采用这种 write 就绪之后才写的异步方式，
         //  效率会更好，避免死等）
@@ -254,6 +324,64 @@ int prepareClientToWrite(redisClient *c) {
     return REDIS_OK;
 }
 
+/* Make sure the client output buffers will be sent. When I/O threads are
+ * enabled the client is just put in the list of clients with pending
+ * writes, flushed by handleClientsWithPendingWrites() before re-entering
+ * the event loop, otherwise the write handler is installed directly. */
+static int clientInstallWriteHandler(redisClient *c) {
+    /* Replies held for the AOF group commit are sent once released. */
+    if (c->flags & REDIS_AOF_WAIT) return REDIS_OK;
+    if (server.io_threads_num > 1) {
+        if (!(c->flags & REDIS_PENDING_WRITE) &&
+            !(aeGetFileEvents(server.el,c->fd) & AE_WRITABLE))
+        {
+            c->flags |= REDIS_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+        return REDIS_OK;
+    }
+    if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+        sendReplyToClient, c) == AE_ERR) return REDIS_ERR;
+    return REDIS_OK;
+}
+
+/* Hold the replies of 'c' until its last write, that is at the end of the
+ * AOF buffer right now, is fsynced by the AOF writer thread. Called by call()
+ * for the commands that fed the AOF while group commit is active.
+ *
+ * 组提交：在客户端最后一次写入的 AOF 偏移量落盘之前，暂缓发送它的回复 */
+void holdClientRepliesForAof(redisClient *c) {
+    if (c->fd <= 0 || c->flags & (REDIS_MASTER|REDIS_SLAVE|REDIS_MONITOR))
+        return;
+
+    c->aof_woff = server.aof_fed_off;
+    if (c->flags & REDIS_AOF_WAIT) return;
+    c->flags |= REDIS_AOF_WAIT;
+    listAddNodeTail(server.clients_waiting_aof,c);
+
+    /* The replies of the previous commands could be already on their way:
+     * from now on they are sent together with the new ones. */
+    if (aeGetFileEvents(server.el,c->fd) & AE_WRITABLE)
+        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+}
+
+/* Send the held replies of the clients whose writes are now durable. */
+void releaseClientsWaitingAof(void) {
+    listNode *ln;
+    listIter li;
+
+    listRewind(server.clients_waiting_aof,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        redisClient *c = listNodeValue(ln);
+
+        if (c->aof_woff > server.aof_durable_off) continue;
+        c->flags &= ~REDIS_AOF_WAIT;
+        listDelNode(server.clients_waiting_aof,ln);
+        if (clientHasPendingReplies(c) &&
+            clientInstallWriteHandler(c) == REDIS_ERR) freeClientAsync(c);
+    }
+}
+
 /* Create a duplicate of the last object in the reply list when
  * it is not exclusively owned by the reply list. */
 // 当回复列表中的最后一个对象并非属于回复的一部分时
@@ -277,6 +405,21 @@ robj *dupLastObjectIfNeeded(list *reply) {
     return listNodeValue(ln);
 }
 
+/* Return true if 'len' bytes can be appended to 'tail', the last object of
+ * a reply list, without exceeding REDIS_REPLY_CHUNK_BYTES.
+ *
+ * Objects of REDIS_REPLY_ZEROCOPY_BYTES or more are queued by reference, so
+ * the tail may be a big value still owned by the keyspace: appending to it
+ * would mean duplicating the whole value first, so we don't.
+ *
+ * 大对象以引用的方式放进回复链表，不会为了追加内容而复制它们 */
+static int replyTailHasRoomFor(robj *tail, size_t len) {
+    if (tail->ptr == NULL || tail->encoding != REDIS_ENCODING_RAW) return 0;
+    if (sdslen(tail->ptr)+len > REDIS_REPLY_CHUNK_BYTES) return 0;
+    return tail->refcount == 1 ||
+           sdslen(tail->ptr) < REDIS_REPLY_ZEROCOPY_BYTES;
+}
+
 /* -----------------------------------------------------------------------------
  * Low level functions to add more data to output buffers.
  * -------------------------------------------------------------------------- */
@@ -285,11 +428,16 @@ robj *dupLastObjectIfNeeded(list *reply) {
  * 尝试将回复添加到 c->buf 中
  */
 int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available = c->buf_usable_size-c->bufpos;
 
     // 正准备关闭客户端，无须再发送内容
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return REDIS_OK;
 
+    /* Remember how much buffer this client would have used, even when the
+     * reply goes to the list: clientsCron() resizes the buffer from it. */
+    // 记录需要的缓冲区大小，供 clientsCron() 调整 buf 的大小
+    if (c->bufpos+len > c->buf_peak) c->buf_peak = c->bufpos+len;
+
     /* If there already are entries in the reply list, we cannot
      * add anything more to the static buffer. */
     // 回复链表里已经有内容，再添加内容到 c->buf 里面就是错误了
@@ -329,12 +477,12 @@ void _addReplyObjectToList(redisClient *c, robj *o) {
         // 取出表尾的 SDS
         tail = listNodeValue(listLast(c->reply));
 
-        /* Append to this object when possible. */
+        /* Append to this object when possible. Big objects are never
+         * copied: a new node referencing them is added instead.  */
         // 如果表尾 SDS 的已用空间加上对象的长度，小于 REDIS_REPLY_CHUNK_BYTES
         // 那么将新对象的内容拼接到表尾 SDS 的末尾
-        if (tail->ptr != NULL &&
-            tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES)
+        if (sdslen(o->ptr) < REDIS_REPLY_ZEROCOPY_BYTES &&
+            replyTailHasRoomFor(tail,sdslen(o->ptr)))
         {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply); // 可能返回新的 sds-obj（专门用来进行拼接）
@@ -371,9 +519,10 @@ void _addReplySdsToList(redisClient *c, sds s) {
     } else {
         tail = listNodeValue(listLast(c->reply));
 
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(s) <= REDIS_REPLY_CHUNK_BYTES)
+        /* Append to this object when possible. Big strings become a node
+         * of the list themselves, without copying them. */
+        if (sdslen(s) < REDIS_REPLY_ZEROCOPY_BYTES &&
+            replyTailHasRoomFor(tail,sdslen(s)))
         {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply);
@@ -403,9 +552,7 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+len <= REDIS_REPLY_CHUNK_BYTES)
-        {
+        if (replyTailHasRoomFor(tail,len)) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply);
             // 将字符串拼接到一个 SDS 之后
@@ -427,8 +574,27 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
  * The following functions are the ones that commands implementations will call.
  * -------------------------------------------------------------------------- */
 
+/* True if the reply of 'c' must be pushed on the Lua stack instead of being
+ * queued, that is, 'c' is the Lua client running a command for redis.call().
+ * See the Lua reply sink in scripting.c. */
+// 脚本调用的命令，回复直接转换为 Lua 值，不经过输出缓冲区
+#define replyToLuaSink(c) \
+    (((c)->flags & REDIS_LUA_CLIENT) && server.lua_reply_sink)
+
 void addReply(redisClient *c, robj *obj) {
 
+    if (replyToLuaSink(c)) {
+        if (sdsEncodedObject(obj)) {
+            luaReplySinkRaw(obj->ptr,sdslen(obj->ptr));
+        } else {
+            char buf[32];
+            int len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+
+            luaReplySinkRaw(buf,len);
+        }
+        return;
+    }
+
     // 为客户端安装写处理器到事件循环
     if (prepareClientToWrite(c) != REDIS_OK) return;
 
@@ -450,6 +616,18 @@ void addReply(redisClient *c, robj *obj) {
     // 先用 buffer，再用 list; 用了 list 也就意味着 buffer 已经装不下了
     // buff 可以避免 refcount field 的改动
     if (sdsEncodedObject(obj)) {
+        /* Big objects are referenced by the reply list instead of being
+         * copied, unless a child is saving, as incrementing the refcount
+         * would copy their page on write.
+         *
+         * 没有子进程时，大对象直接以引用的方式放进回复链表，避免复制 */
+        if (sdslen(obj->ptr) >= REDIS_REPLY_ZEROCOPY_BYTES &&
+            server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+        {
+            _addReplyObjectToList(c,obj);
+            return;
+        }
+
         // 不管三七二十一，哪怕不是处于 copy-on-write 的状态下，也直接将要发送出去的 obj->ptr 数据深拷贝进 buffer 里面
         // 因为引用的方式放进 buffer 里面将会增加引用计数，也就以唯这内存的修改，也就会触发缺页错误，利用中断，重新分配内存，将整个 memory-page(4 kByte) 拷贝一次
         // 这样的话，将会比直接中断、拷贝 4kByte 来得更快（sds-obj data 部分超过 4 kByte 的概率实在是小）
@@ -463,7 +641,8 @@ void addReply(redisClient *c, robj *obj) {
          * avoid decoding the object and go for the lower level approach. */
         // 优化，如果 c->buf 中有等于或多于 32 个字节的空间
         // 那么将整数直接以字符串的形式复制到 c->buf 中
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (listLength(c->reply) == 0 &&
+            (c->buf_usable_size - c->bufpos) >= 32) {
             char buf[32];
             int len;
 
@@ -489,6 +668,11 @@ void addReply(redisClient *c, robj *obj) {
  * 将 SDS 中的内容复制到回复缓冲区
  */
 void addReplySds(redisClient *c, sds s) {
+    if (replyToLuaSink(c)) {
+        luaReplySinkRaw(s,sdslen(s));
+        sdsfree(s);
+        return;
+    }
     if (prepareClientToWrite(c) != REDIS_OK) {
         /* The caller expects the sds to be free'd. */
         sdsfree(s);
@@ -506,6 +690,10 @@ void addReplySds(redisClient *c, sds s) {
  * 将 C 字符串中的内容复制到回复缓冲区
  */
 void addReplyString(redisClient *c, char *s, size_t len) {
+    if (replyToLuaSink(c)) {
+        luaReplySinkRaw(s,len);
+        return;
+    }
     if (prepareClientToWrite(c) != REDIS_OK) return;
     if (_addReplyToBuffer(c,s,len) != REDIS_OK)
         _addReplyStringToList(c,s,len);
@@ -549,6 +737,10 @@ void addReplyErrorFormat(redisClient *c, const char *fmt, ...) {
  * +hash
 */
 void addReplyStatusLength(redisClient *c, char *s, size_t len) {
+    if (replyToLuaSink(c)) {
+        luaReplySinkStatus(s,len);
+        return;
+    }
     addReplyString(c,"+",1);
     addReplyString(c,s,len);
     addReplyString(c,"\r\n",2);
@@ -598,6 +790,8 @@ void addReplyStatusFormat(redisClient *c, const char *fmt, ...) {
  *  member
  */
 void *addDeferredMultiBulkLength(redisClient *c) {
+    if (replyToLuaSink(c)) return luaReplySinkDeferredAggregate();
+
     /* Note that we install the write event here even if the object is not
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
@@ -606,26 +800,38 @@ void *addDeferredMultiBulkLength(redisClient *c) {
     return listLast(c->reply);  // 给 setDeferredMultiBulkLength() 使用
 }
 
-/* Populate the length object and try gluing it to the next chunk. */
-// 设置 Multi Bulk 回复的长度，仅仅是调整最开头的 "*15" 这一个长度
-void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
+/* Populate the length object and try gluing it to the next chunk.
+ * 'prefix' is the RESP type of the aggregate: '*' for arrays, '%' for
+ * maps and '~' for sets. */
+// 设置聚合回复的长度，仅仅是调整最开头的 "*15" 这一个长度
+static void setDeferredAggregateLen(redisClient *c, void *node, long length,
+                                    char prefix)
+{
     listNode *ln = (listNode*)node; // 当前是指向 NULL 的 tail 节点
     robj *len, *next;
 
     /* Abort when *node is NULL (see addDeferredMultiBulkLength). */
     if (node == NULL) return;
 
+    if (replyToLuaSink(c)) {
+        luaReplySinkSetDeferredAggregate(node,length);
+        return;
+    }
+
     // ln 这个 node 是 addDeferredMultiBulkLength() 预留出来的节点，一定在整个 reply-list 的最开头部分
     len = listNodeValue(ln);
-    len->ptr = sdscatprintf(sdsempty(),"*%ld\r\n",length);
+    len->ptr = sdscatprintf(sdsempty(),"%c%ld\r\n",prefix,length);
     len->encoding = REDIS_ENCODING_RAW; /* in case it was an EMBSTR. */
     c->reply_bytes += zmalloc_size_sds(len->ptr);
     if (ln->next != NULL) {
         // 除了预留节点之外，还有别的节点
         next = listNodeValue(ln->next);
 
-        /* Only glue when the value of next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
+        /* Only glue when the value of next node is non-NULL (an sds in this
+         * case), and not a big object we would have to copy. */
+        if (next->ptr != NULL &&
+            sdslen(next->ptr) < REDIS_REPLY_ZEROCOPY_BYTES)
+        {
             c->reply_bytes -= zmalloc_size_sds(len->ptr);
             c->reply_bytes -= getStringObjectSdsUsedMemory(next);
             len->ptr = sdscatlen(len->ptr,next->ptr,sdslen(next->ptr));
@@ -636,11 +842,29 @@ void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
-/* Add a double as a bulk reply */
+void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
+    setDeferredAggregateLen(c,node,length,'*');
+}
+
+/* Set the length of a deferred map of 'length' field-value pairs. With
+ * RESP2 the map is sent as a flat array of 2*length elements. */
+void setDeferredMapLen(redisClient *c, void *node, long length) {
+    if (c->resp == 2)
+        setDeferredAggregateLen(c,node,length*2,'*');
+    else
+        setDeferredAggregateLen(c,node,length,'%');
+}
+
+/* Set the length of a deferred set, sent as an array with RESP2. */
+void setDeferredSetLen(redisClient *c, void *node, long length) {
+    setDeferredAggregateLen(c,node,length,c->resp == 2 ? '*' : '~');
+}
+
+/* Add a double as a bulk reply, or as a RESP3 double. */
 /*
- * 以 bulk 回复的形式，返回一个双精度浮点数
+ * 以 bulk 回复的形式，返回一个双精度浮点数，RESP3 客户端则使用 double 类型
  *
- * 例子 $4\r\n3.14\r\n
+ * 例子 $4\r\n3.14\r\n 或者 ,3.14\r\n
  */
 void addReplyDouble(redisClient *c, double d) {
     char dbuf[128], sbuf[128];
@@ -648,10 +872,21 @@ void addReplyDouble(redisClient *c, double d) {
     if (isinf(d)) {
         /* Libc in odd systems (Hi Solaris!) will format infinite in a
          * different way, so better to handle it in an explicit way. */
-        addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
+        if (c->resp == 2)
+            addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
+        else
+            addReplyString(c, d > 0 ? ",inf\r\n" : ",-inf\r\n",
+                              d > 0 ? 6 : 7);
     } else {
         dlen = snprintf(dbuf,sizeof(dbuf),"%.17g",d);
-        slen = snprintf(sbuf,sizeof(sbuf),"$%d\r\n%s\r\n",dlen,dbuf);
+        if (replyToLuaSink(c)) {
+            luaReplySinkString(dbuf,dlen);
+            return;
+        }
+        if (c->resp == 2)
+            slen = snprintf(sbuf,sizeof(sbuf),"$%d\r\n%s\r\n",dlen,dbuf);
+        else
+            slen = snprintf(sbuf,sizeof(sbuf),",%s\r\n",dbuf);
         addReplyString(c,sbuf,slen);
     }
 }
@@ -674,6 +909,17 @@ void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix) {
     char buf[128];
     int len;
 
+    /* Bulk lengths are raw protocol for the Lua sink, as the body follows. */
+    if (replyToLuaSink(c)) {
+        if (prefix == '*') {
+            luaReplySinkAggregate(ll);
+            return;
+        } else if (prefix == ':') {
+            luaReplySinkInteger(ll);
+            return;
+        }
+    }
+
     /* Things like $3\r\n or *2\r\n are emitted very often by the protocol
      * so we have a few shared objects to use if the integer is small
      * like it is most of the times. */
@@ -681,6 +927,12 @@ void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix) {
         // 多条批量回复
         addReply(c,shared.mbulkhdr[ll]);
         return;
+    } else if (prefix == '%' && ll < REDIS_SHARED_BULKHDR_LEN) {
+        addReply(c,shared.maphdr[ll]);
+        return;
+    } else if (prefix == '~' && ll < REDIS_SHARED_BULKHDR_LEN) {
+        addReply(c,shared.sethdr[ll]);
+        return;
     } else if (prefix == '$' && ll < REDIS_SHARED_BULKHDR_LEN) {
         // 批量回复
         addReply(c,shared.bulkhdr[ll]);
@@ -700,7 +952,9 @@ void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix) {
  * 格式为 :10086\r\n
  */
 void addReplyLongLong(redisClient *c, long long ll) {
-    if (ll == 0)
+    if (replyToLuaSink(c))
+        luaReplySinkInteger(ll);
+    else if (ll == 0)
         addReply(c,shared.czero);
     else if (ll == 1)
         addReply(c,shared.cone);
@@ -762,12 +1016,70 @@ void addReplyLongLong(redisClient *c, long long ll) {
 */
 
 void addReplyMultiBulkLen(redisClient *c, long length) {
-    if (length < REDIS_SHARED_BULKHDR_LEN)
+    if (replyToLuaSink(c))
+        luaReplySinkAggregate(length);
+    else if (length < REDIS_SHARED_BULKHDR_LEN)
         addReply(c,shared.mbulkhdr[length]);
     else
         addReplyLongLongWithPrefix(c,length,'*');
 }
 
+/* RESP3 typed aggregates and scalars. Every one of them has a RESP2
+ * fallback, so the commands can use them without checking the protocol
+ * version of the client:
+ *
+ *  map      %<pairs>\r\n       RESP2: array of 2*<pairs> elements
+ *  set      ~<count>\r\n       RESP2: array
+ *  push     ><count>\r\n       RESP3 only, out of band data
+ *  null     _\r\n              RESP2: $-1 or *-1
+ *  boolean  #t\r\n or #f\r\n   RESP2: :1 or :0
+ *  double   ,<value>\r\n       RESP2: bulk string (see addReplyDouble)
+ *
+ * RESP3 客户端通过 HELLO 3 打开，RESP2 客户端收到的回复保持不变 */
+void addReplyMapLen(redisClient *c, long length) {
+    if (c->resp == 2)
+        addReplyMultiBulkLen(c,length*2);
+    else
+        addReplyLongLongWithPrefix(c,length,'%');
+}
+
+void addReplySetLen(redisClient *c, long length) {
+    if (c->resp == 2)
+        addReplyMultiBulkLen(c,length);
+    else
+        addReplyLongLongWithPrefix(c,length,'~');
+}
+
+/* Push data is not a reply to a command, the caller must make sure the
+ * client speaks RESP3. */
+void addReplyPushLen(redisClient *c, long length) {
+    redisAssert(c->resp >= 3);
+    addReplyLongLongWithPrefix(c,length,'>');
+}
+
+/* Null as a missing string, "$-1" with RESP2. */
+void addReplyNull(redisClient *c) {
+    if (replyToLuaSink(c))
+        luaReplySinkNull();
+    else
+        addReply(c,shared.null[c->resp]);
+}
+
+/* Null as a missing aggregate, "*-1" with RESP2. */
+void addReplyNullArray(redisClient *c) {
+    if (replyToLuaSink(c))
+        luaReplySinkNull();
+    else
+        addReply(c,shared.nullarray[c->resp]);
+}
+
+void addReplyBool(redisClient *c, int b) {
+    if (c->resp == 2)
+        addReply(c, b ? shared.cone : shared.czero);
+    else
+        addReplyString(c, b ? "#t\r\n" : "#f\r\n",4);
+}
+
 /* Create the length prefix of a bulk reply, example: $2234 */
 // 测量并自动填充 obj 的 len
 void addReplyBulkLen(redisClient *c, robj *obj) {
@@ -800,6 +1112,17 @@ void addReplyBulkLen(redisClient *c, robj *obj) {
  * 返回一个 Redis 对象作为回复
  */
 void addReplyBulk(redisClient *c, robj *obj) {
+    if (replyToLuaSink(c)) {
+        if (sdsEncodedObject(obj)) {
+            luaReplySinkString(obj->ptr,sdslen(obj->ptr));
+        } else {
+            char buf[32];
+            int len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+
+            luaReplySinkString(buf,len);
+        }
+        return;
+    }
     addReplyBulkLen(c,obj);
     addReply(c,obj);
     addReply(c,shared.crlf);
@@ -810,6 +1133,10 @@ void addReplyBulk(redisClient *c, robj *obj) {
  * 返回一个 C 缓冲区作为回复
  */
 void addReplyBulkCBuffer(redisClient *c, void *p, size_t len) {
+    if (replyToLuaSink(c)) {
+        luaReplySinkString(p,len);
+        return;
+    }
     addReplyLongLongWithPrefix(c,len,'$');
     addReplyString(c,p,len);
     addReply(c,shared.crlf);
@@ -821,7 +1148,7 @@ void addReplyBulkCBuffer(redisClient *c, void *p, size_t len) {
  */
 void addReplyBulkCString(redisClient *c, char *s) {
     if (s == NULL) {
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
     } else {
         addReplyBulkCBuffer(c,s,strlen(s));
     }
@@ -852,18 +1179,30 @@ void copyClientOutputBuffer(redisClient *dst, redisClient *src) {
     // 复制新链表到 dst
     dst->reply = listDup(src->reply);
 
-    // 复制内容到回复 buf
+    // 复制内容到回复 buf ，dst 的 buf 不够大的话先扩大
+    dst->bufpos = 0;
+    if (dst->buf_usable_size < (size_t)src->bufpos)
+        clientResizeReplyBuffer(dst,src->buf_usable_size);
     memcpy(dst->buf,src->buf,src->bufpos);
 
     // 同步偏移量和字节数
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+
+    /* Slaves don't have their own copy of the replication stream: just
+     * reference the same shared replication buffer block. */
+    // slave 的追加数据在共享的复制缓冲里面，引用同一个 block 就好
+    releaseReplicaReplicationBuffer(dst);
+    if (src->ref_repl_buf_node) {
+        dst->ref_repl_buf_node = src->ref_repl_buf_node;
+        dst->ref_block_pos = src->ref_block_pos;
+        ((replBufBlock*)listNodeValue(dst->ref_repl_buf_node))->refcount++;
+    }
 }
 
 /*
  * TCP 连接 accept 处理器
  */
-#define MAX_ACCEPTS_PER_CALL 1000
 static void acceptCommonHandler(int fd, int flags) {
 
     // 创建客户端
@@ -908,7 +1247,7 @@ static void acceptCommonHandler(int fd, int flags) {
  * 在向 epoll-instance 注册 listen-socket 的时候，一同注册进去的回调函数
  */
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cport, cfd, max = MAX_ACCEPTS_PER_CALL; // 避免长时间阻塞，甚至是 syn 攻击；反正 epoll-instance 也是 level-trigger
+    int cport, cfd, max = server.max_accepts_per_call; // 避免长时间阻塞，甚至是 syn 攻击；反正 epoll-instance 也是 level-trigger
     char cip[REDIS_IP_STR_LEN];
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
@@ -933,7 +1272,7 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  * 创建一个本地连接处理器
  */
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cfd, max = MAX_ACCEPTS_PER_CALL;
+    int cfd, max = server.max_accepts_per_call;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
     REDIS_NOTUSED(privdata);
@@ -953,17 +1292,85 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Resize the reply buffer of 'c' to 'size' bytes, releasing it when 'size'
+ * is zero. The buffer must not hold data still to be sent. */
+// 调整回复缓冲区的大小，size 为 0 时释放缓冲区
+void clientResizeReplyBuffer(redisClient *c, size_t size) {
+    redisAssert(c->bufpos == 0);
+    zfree(c->buf);
+    c->buf = size ? zmalloc(size) : NULL;
+    c->buf_usable_size = size;
+}
+
 /*
  * 清空所有命令参数
  */
+/* Arguments are usually small strings created and released once per
+ * command. An EMBSTR argument no command retained (refcount still 1) is not
+ * freed but kept in c->argv_pool at its position, and the next command
+ * copies the argument at the same position into it when it fits: same
+ * shaped commands (pipelines of MSET, HMSET, ...) then parse without
+ * calling the allocator.
+ *
+ * A command storing an argument takes a reference to it, so the object
+ * never comes back to the pool and simply lives as a regular object. */
 static void freeClientArgv(redisClient *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = 0; j < c->argc; j++) {
+        robj *o = c->argv[j];
+
+        if (j < REDIS_ARGV_POOL_SIZE && o->refcount == 1 &&
+            o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_EMBSTR)
+        {
+            robj *old = c->argv_pool[j];
+
+            /* Keep the larger of the two objects for this position. */
+            if (old && sdsalloc(old->ptr) >= sdsalloc(o->ptr)) {
+                decrRefCount(o);
+            } else {
+                if (old) decrRefCount(old);
+                c->argv_pool[j] = o;
+            }
+        } else {
+            decrRefCount(o);
+        }
+    }
     c->argc = 0;
     c->cmd = NULL;
 }
 
+/* Return the object for the argument 'j' of the command being parsed,
+ * recycling the pooled object of that position if large enough. */
+// 为第 j 个参数创建字符串对象，能复用 argv_pool 中的对象就复用
+static robj *createClientArgObject(redisClient *c, int j, char *ptr, size_t len) {
+    robj *o;
+
+    if (j < REDIS_ARGV_POOL_SIZE && (o = c->argv_pool[j]) != NULL &&
+        len <= sdsalloc(o->ptr))
+    {
+        c->argv_pool[j] = NULL;
+        memcpy(o->ptr,ptr,len);
+        ((char*)o->ptr)[len] = '\0';
+        sdssetlen(o->ptr,len);
+        initObjectLRUOrLFU(o);
+        server.stat_argv_pool_hits++;
+        return o;
+    }
+    return createStringObject(ptr,len);
+}
+
+/* Release the argument objects pooled by the client. */
+void freeClientArgvPool(redisClient *c) {
+    int j;
+
+    for (j = 0; j < REDIS_ARGV_POOL_SIZE; j++) {
+        if (c->argv_pool[j]) {
+            decrRefCount(c->argv_pool[j]);
+            c->argv_pool[j] = NULL;
+        }
+    }
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -984,19 +1391,11 @@ void replicationHandleMasterDisconnection(void) {
     server.master = NULL;
     server.repl_state = REDIS_REPL_CONNECT; // 尝试 connect 的状态
     server.repl_down_since = server.unixtime;
-    /* We(we are a slave) lost connection with our master, force our slaves to resync
-     * with us as well to load the new data set.
-     *
-     * 和 master 失联，强制所有这个服务器的 slave  resync ，
-     * 等待载入新数据。
-     *
-     * If server.masterhost is NULL the user called SLAVEOF NO ONE so
-     * slave resync is not needed. 
-     *
-     * TODO:（DONE）如果 masterhost 不存在（怎么会这样呢？）有检查的，syncCommand() 最开头就检查了
-     * 那么调用 SLAVEOF NO ONE ，避免 slave resync
-     */
-    if (server.masterhost != NULL) disconnectSlaves();
+    /* We lost connection with our master, don't disconnect slaves yet,
+     * maybe we'll be able to PSYNC with our master later. We'll disconnect
+     * the slaves only if we'll have to do a full resync with our master. */
+    // 和 master 失联，先不断开 sub-slave ，因为 sub-slave 跟自己共享同一段复制历史，
+    // 只有自己需要 full resync 时才会断开它们，见 syncWithMaster()
 }
 
 /*
@@ -1040,12 +1439,17 @@ void freeClient(redisClient *c) {
 
     /* Free the query buffer */
     sdsfree(c->querybuf);
+    sdsfree(c->pending_querybuf);
+    sdsfree(c->repl_zbuf);
     c->querybuf = NULL;
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & REDIS_BLOCKED) unblockClient(c);
     dictRelease(c->bpop.keys);
 
+    /* A slot import that was not committed is rolled back. */
+    if (c->flags & REDIS_SLOT_IMPORT) clusterImportSlotAbort(c);
+
     /* UNWATCH all the keys */
     // 清空 WATCH 信息
     unwatchAllKeys(c);
@@ -1055,8 +1459,13 @@ void freeClient(redisClient *c) {
     // 退订所有频道和模式
     pubsubUnsubscribeAllChannels(c,0);
     pubsubUnsubscribeAllPatterns(c,0);
+    pubsubUnsubscribeShardAllChannels(c,0);
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
+    dictRelease(c->pubsubshard_channels);
+
+    /* Stop tracking the keys of this client for client side caching. */
+    if (c->flags & REDIS_TRACKING) disableTracking(c);
 
     /* Close socket, unregister events, and remove list of replies and
      * accumulated arguments. */
@@ -1067,6 +1476,16 @@ void freeClient(redisClient *c) {
         close(c->fd);
     }
 
+    /* Unmap the shared memory rings. */
+    if (c->shm) {
+        if (c->flags & REDIS_SHM) {
+            ln = listSearchKey(server.shm_clients,c);
+            redisAssert(ln != NULL);
+            listDelNode(server.shm_clients,ln);
+        }
+        shmTransportRelease(c->shm);
+    }
+
     // 清空回复缓冲区
     listRelease(c->reply);
 
@@ -1076,9 +1495,12 @@ void freeClient(redisClient *c) {
     /* Remove from the list of clients */
     //  slave 的客户端链表中删除自身
     if (c->fd != -1) {
+        uint64_t id = htonu64(c->id);
+
         ln = listSearchKey(server.clients,c);
         redisAssert(ln != NULL);
         listDelNode(server.clients,ln);
+        raxRemove(server.clients_index,(unsigned char*)&id,sizeof(id),NULL);
     }
 
     /* When client was just unblocked because of a blocking operation,
@@ -1090,6 +1512,26 @@ void freeClient(redisClient *c) {
         listDelNode(server.unblocked_clients,ln);
     }
 
+    /* Remove the client from the lists of clients waiting for the
+     * I/O threads to perform a read or a write on its behalf. */
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write,ln);
+    }
+    if (c->flags & REDIS_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+    }
+
+    /* Remove from the clients waiting for the AOF group commit. */
+    if (c->flags & REDIS_AOF_WAIT) {
+        ln = listSearchKey(server.clients_waiting_aof,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_waiting_aof,ln);
+    }
+
     /* Master/slave cleanup Case 1:
      * we lost the connection with a slave. */
     if (c->flags & REDIS_SLAVE) {
@@ -1101,6 +1543,8 @@ void freeClient(redisClient *c) {
         ln = listSearchKey(l,c);
         redisAssert(ln != NULL);
         listDelNode(l,ln);
+        // 释放对共享复制缓冲的引用
+        releaseReplicaReplicationBuffer(c);
         /* We need to remember the time when we started to have zero
          * attached slaves, as after some time we'll free the replication
          * backlog. */
@@ -1123,9 +1567,13 @@ void freeClient(redisClient *c) {
 
     /* Release other dynamically allocated client structure fields,
      * and finally release the client structure itself. */
+    clientFoldUsage(c);
     if (c->name) decrRefCount(c->name);
     // 清除参数空间
     zfree(c->argv);
+    // 释放回复缓冲区以及缓存的参数对象
+    zfree(c->buf);
+    freeClientArgvPool(c);
     // 清除事务状态信息
     freeClientMultiState(c);
     sdsfree(c->peerid);
@@ -1160,85 +1608,188 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
-/*
- * 负责传送命令回复的写处理器，将有 epoll-instance 进行监听调度，在就绪的情况下调用本函数，完成相应的 send 任务
- * 
- * 会尽可能的将 c->buf 里面需要发送，却被堆积的内容，全部发送给对应的 client（因为 write 不是立马就可以就绪的，
- * 所以一般会采用这样的异步 write 方案，等到 fd 的 write 就绪之后，再把数据从 buf 里面，真正的 write 出去）
- */
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
-    robj *o;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
+/* Write as much as possible of the shared replication buffer to the slave
+ * 'c', starting from the block and position it references, and move the
+ * reference forward when a block was sent entirely. Since this changes the
+ * refcount of the blocks, slaves are always written by the main thread.
+ *
+ * On compressed links the data is encoded in c->repl_zbuf a frame at a
+ * time, and the next frame is encoded once the current one was sent.
+ *
+ * slave 直接从共享的复制缓冲发送数据，发送完一个 block 就引用下一个 block */
+static int writeReplicationBuffer(redisClient *c) {
+    int nwritten = 0, totwritten = 0;
+
+    while (c->ref_repl_buf_node) {
+        replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+        listNode *next;
+
+        if (c->repl_zbuf) {
+            if (sdslen(c->repl_zbuf) == 0 && o->used > c->ref_block_pos) {
+                size_t len = o->used - c->ref_block_pos;
+
+                if (len > REDIS_REPL_FRAME_MAX_LEN)
+                    len = REDIS_REPL_FRAME_MAX_LEN;
+                c->repl_zbuf = replEncodeFrame(c->repl_zbuf,
+                    o->buf+c->ref_block_pos,len);
+                c->ref_block_pos += len;
+            }
+            if (sdslen(c->repl_zbuf)) {
+                nwritten = write(c->fd,c->repl_zbuf,sdslen(c->repl_zbuf));
+                if (nwritten <= 0) break;
+                sdsrange(c->repl_zbuf,nwritten,-1);
+                totwritten += nwritten;
+                if (sdslen(c->repl_zbuf)) break;
+                if (c->ref_block_pos < o->used) continue;
+            }
+        } else if (o->used > c->ref_block_pos) {
+            nwritten = write(c->fd,o->buf+c->ref_block_pos,
+                             o->used-c->ref_block_pos);
+            if (nwritten <= 0) break;
+            c->ref_block_pos += nwritten;
+            totwritten += nwritten;
+        }
 
-    // 一直循环，直到回复缓冲区为空（包含 buf 里面的内容跟 reply 这个 list 里面的内容清空）
-    // 或者指定条件满足为止
-    while(c->bufpos > 0 || listLength(c->reply)) {
+        /* A short write means the socket buffer is full, while the last
+         * block sent entirely means we are done. */
+        next = listNextNode(c->ref_repl_buf_node);
+        if (c->ref_block_pos < o->used || next == NULL) break;
 
-        if (c->bufpos > 0) {
+        // 当前 block 已经发送完毕，改为引用下一个 block
+        o->refcount--;
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        c->ref_repl_buf_node = next;
+        c->ref_block_pos = 0;
+        incrementalTrimReplicationBacklog(
+            REDIS_REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 
-            // 是优先将 buf 里面的内容发送出去的
-            // c->bufpos > 0, 说明 client->buf 里面是有内容的
+        if (totwritten > REDIS_MAX_WRITE_PER_EVENT &&
+            (server.maxmemory == 0 ||
+             zmalloc_used_memory() < server.maxmemory)) break;
+    }
 
-            // 写入内容到套接字
-            // c->sentlen 是用来处理 short write 的
-            // 当出现 short write ，导致写入未能一次完成时，
-            // c->buf+c->sentlen 就会偏移到正确（未写入）内容的位置上。
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            // 出错则跳出
-            if (nwritten <= 0) break;   // EAGAIN
-            // 成功写入则更新写入计数器变量
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+    if (nwritten == -1 && errno != EAGAIN) {
+        c->io_errno = errno;
+        return -1;
+    }
+    return totwritten;
+}
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            // 如果缓冲区中的内容已经全部写入完毕
-            // 那么清空客户端的两个计数器变量
-            if (c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
+/* Write as much as possible from the client output buffers (c->buf first,
+ * then the reply list) to the client socket.
+ *
+ * Reply list nodes that were fully transmitted are NOT released here: they
+ * are just counted in c->io_sentnodes, and releaseClientSentReplies() will
+ * free them later. The objects in the reply list may be shared with other
+ * clients, so touching their refcount is only safe from the main thread,
+ * while this function only writes to the socket and updates fields of 'c':
+ * this is what makes it possible to call it from the I/O threads.
+ *
+ * Returns the number of bytes written, or -1 on a write error (EAGAIN is
+ * not considered an error), in which case c->io_errno is set. */
+static int writeClientOutputBuffers(redisClient *c) {
+    struct iovec iov[REDIS_IOV_MAX];
+    int nwritten = 0, totwritten = 0;
+    listNode *ln = listFirst(c->reply);
 
-            // listLength(c->reply) != 0
+    c->io_sentnodes = 0;
 
-            // 取出位于链表最前面的对象，objlen 跟 objmem 实际上差别不大
-            // TODO:(DONE) 为什么要区别对待 objlen\objmem ?
-            // 本质上没有啥区别，只不过，objmem 支持 REDIS_ENCODING_RAW，REDIS_ENCODING_EMBSTR 两种格式罢了
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o->ptr);
-            objmem = getStringObjectSdsUsedMemory(o);
+    /* The replication stream of slaves is in the shared replication buffer,
+     * sent once whatever the slave could have in its own buffers is sent. */
+    if ((c->flags & REDIS_SLAVE) && !(c->flags & REDIS_MONITOR) &&
+        c->bufpos == 0 && ln == NULL) return writeReplicationBuffer(c);
+
+    // 一直循环，直到回复缓冲区为空（包含 buf 里面的内容跟 reply 这个 list 里面的内容清空）
+    // 或者指定条件满足为止
+    while(c->bufpos > 0 || ln != NULL) {
+        listNode *next = ln;
+        int iovcnt = 0, nodes = 0;
+        size_t iovlen = 0, offset;
+        size_t done;
+
+        /* Gather c->buf and the reply list nodes that follow it into a single
+         * writev() call. c->sentlen is the offset already sent of c->buf if
+         * it is not empty, otherwise of the first node of the reply list.
+         *
+         * 把 c->buf 和之后的回复链表节点合并到一次 writev() 调用中
+         * （c->sentlen 用来处理 short write ，指向第一块没有写完的内容）
+         */
+        if (c->bufpos > 0) {
+            iov[iovcnt].iov_base = c->buf+c->sentlen;
+            iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+            iovlen += iov[iovcnt].iov_len;
+            iovcnt++;
+            offset = 0;
+        } else {
+            offset = c->sentlen;
+        }
+        while (next != NULL && iovcnt < REDIS_IOV_MAX &&
+               iovlen < REDIS_MAX_WRITE_PER_EVENT)
+        {
+            robj *o = listNodeValue(next);
+            size_t objlen = sdslen(o->ptr);
 
             // 略过空对象
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
+            if (objlen > offset) {
+                iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+                iov[iovcnt].iov_len = objlen-offset;
+                iovlen += iov[iovcnt].iov_len;
+                iovcnt++;
             }
+            offset = 0;
+            nodes++;
+            next = listNextNode(next);
+        }
 
-            // 写入内容到套接字
-            // c->sentlen 是用来处理 short write 的
-            // 当出现 short write ，导致写入未能一次完成时，
-            // c->buf+c->sentlen 就会偏移到正确（未写入）内容的位置上。
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-            // 写入出错则跳出
+        if (iovcnt) {
+            nwritten = (c->flags & REDIS_SHM) ?
+                shmTransportWritev(c->shm,iov,iovcnt) :
+                writev(c->fd,iov,iovcnt);
+            // 出错则跳出
             if (nwritten <= 0) break;   // EAGAIN
-            // 成功写入则更新写入计数器变量
-            c->sentlen += nwritten;
             totwritten += nwritten;
+        } else {
+            nwritten = 0; /* Only empty nodes. */
+        }
 
-            /* If we fully sent the object on head go to the next one */
-            // 如果缓冲区内容全部写入完毕，那么删除已写入完毕的节点
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
+        /* Advance over what was written: the nodes fully sent are counted
+         * in c->io_sentnodes, and are released later by the main thread.
+         *
+         * 根据写入的字节数，更新 c->buf 和回复链表的发送进度 */
+        done = nwritten;
+        if (c->bufpos > 0) {
+            size_t buflen = c->bufpos-c->sentlen;
+
+            if (done < buflen) {
+                c->sentlen += done;
+                done = 0;
+            } else {
+                /* If the buffer was sent, set bufpos to zero to continue
+                 * with the remainder of the reply. */
+                done -= buflen;
+                c->bufpos = 0;
                 c->sentlen = 0;
-                c->reply_bytes -= objmem;
             }
         }
+        while (nodes > 0 && c->bufpos == 0) {
+            robj *o = listNodeValue(ln);
+            size_t left = sdslen(o->ptr)-c->sentlen;
+
+            if (done < left) {
+                c->sentlen += done;
+                break;
+            }
+            /* If we fully sent the object on head go to the next one */
+            done -= left;
+            c->io_sentnodes++;
+            c->sentlen = 0;
+            ln = listNextNode(ln);
+            nodes--;
+        }
+
+        /* A short write means the socket buffer is full. */
+        if ((size_t)nwritten < iovlen) break;
+
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -1267,38 +1818,128 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     } // end of while
 
     // 写入出错检查（对应上面的 break 跳出）
+    if (nwritten == -1 && errno != EAGAIN) {
+        c->io_errno = errno;
+        return -1;
+    }
+    return totwritten;
+}
+
+/* Release the reply list nodes that writeClientOutputBuffers() reported as
+ * fully transmitted. */
+static void releaseClientSentReplies(redisClient *c) {
+    while (c->io_sentnodes > 0) {
+        listNode *ln = listFirst(c->reply);
+        robj *o = listNodeValue(ln);
+
+        c->reply_bytes -= getStringObjectSdsUsedMemory(o);
+        listDelNode(c->reply,ln);
+        c->io_sentnodes--;
+    }
+}
+
+/* The socket of a REDIS_SHM client is only a doorbell: the client writes
+ * a byte to it when it queued requests, or freed room in the reply ring,
+ * while we were sleeping. Reading EOF means the client went away. */
+static void readShmDoorbell(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = privdata;
+    char buf[64];
+    int nread = read(fd,buf,sizeof(buf));
+
+    if (nread == 0 || (nread == -1 && errno != EAGAIN)) {
+        redisLog(REDIS_VERBOSE, "Client closed connection");
+        freeClient(c);
+        return;
+    }
+    /* handleShmClients() will send what did not fit the reply ring. */
+    if (shmTransportHasInput(c->shm)) readQueryFromClient(el,fd,c,mask);
+}
+
+/* Switch the client to the shared memory rings once the reply of CLIENT SHM
+ * was sent on the socket. */
+static int activateShmClient(redisClient *c) {
+    if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+        readShmDoorbell,c) == AE_ERR) return REDIS_ERR;
+    c->flags |= REDIS_SHM;
+    listAddNodeTail(server.shm_clients,c);
+    return REDIS_OK;
+}
+
+/* Main thread side of a write performed by writeClientOutputBuffers():
+ * release the transmitted replies, handle errors, and either remove or
+ * install the write handler depending on the output left to send.
+ * 'handler_installed' tells if the AE_WRITABLE handler is currently set.
+ *
+ * Returns REDIS_ERR if the client was freed. */
+static int afterClientWrite(redisClient *c, int nwritten, int handler_installed) {
+    releaseClientSentReplies(c);
+
     if (nwritten == -1) {
-        if (errno == EAGAIN) {  // 常见，缓冲区满了
-            nwritten = 0;
-        } else {
-            redisLog(REDIS_VERBOSE,
-                "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
-        }
+        redisLog(REDIS_VERBOSE,
+            "Error writing to client: %s", strerror(c->io_errno));
+        freeClient(c);
+        return REDIS_ERR;
     }
 
-    if (totwritten > 0) {
+    if (nwritten > 0) {
+        c->usage.net_output_bytes += nwritten;
         /* For clients representing masters we don't count sending data
          * as an interaction, since we always send REPLCONF ACK commands
          * that take some time to just fill the socket output buffer.
          * We just rely on data / pings received for timeout detection. */
         if (!(c->flags & REDIS_MASTER)) c->lastinteraction = server.unixtime;
     }
-    if (c->bufpos == 0 && listLength(c->reply) == 0) {
+    if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
 
         // 删除 write handler（注意，redis 里面的 event 是采用 level-trigger 的，所以没有写完的时候，不需要再次向 epoll 注册 event）
-        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+        if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
         // 如果指定了写入之后关闭客户端 FLAG ，那么关闭客户端
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
-    }
-}
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+            freeClient(c);
+            return REDIS_ERR;
+        }
 
-/* resetClient prepare the client to process the next command */
-// 在客户端执行完命令之后执行：重置客户端以准备执行下个命令
+        // CLIENT SHM 的回复已经通过 socket 发送，从现在起使用共享内存
+        if (c->shm && !(c->flags & REDIS_SHM) &&
+            activateShmClient(c) == REDIS_ERR)
+        {
+            freeClientAsync(c);
+            return REDIS_ERR;
+        }
+    } else if (!handler_installed && !(c->flags & REDIS_SHM)) {
+        /* A full reply ring is not signaled by the socket: the output left
+         * is sent by handleShmClients() once the client frees room. */
+        /* The socket buffer is full: wait for it to become writable. */
+        if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+            sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
+/*
+ * 负责传送命令回复的写处理器，将有 epoll-instance 进行监听调度，在就绪的情况下调用本函数，完成相应的 send 任务
+ * 
+ * 会尽可能的将 c->buf 里面需要发送，却被堆积的内容，全部发送给对应的 client（因为 write 不是立马就可以就绪的，
+ * 所以一般会采用这样的异步 write 方案，等到 fd 的 write 就绪之后，再把数据从 buf 里面，真正的 write 出去）
+ */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    afterClientWrite(c,writeClientOutputBuffers(c),1);
+}
+
+/* resetClient prepare the client to process the next command */
+// 在客户端执行完命令之后执行：重置客户端以准备执行下个命令
 void resetClient(redisClient *c) {
     redisCommandProc *prevcmd = c->cmd ? c->cmd->proc : NULL;
 
@@ -1586,9 +2227,10 @@ int processMultibulkBuffer(redisClient *c) {
                 pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
-                 * going to contain. */
+                 * going to contain: exactly, since it will become the
+                 * argument itself. */
                 if (qblen < ll+2)   // TODO:(DONE, 看下面的注释，跟 readQueryFromClient()) 为什么是增加作为 buf 的 querybuf 长度来当作优化手段？
-                    c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                    c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf,ll+2-qblen);
                     // 因为一个 while-loop 只会处理一个 arg 的缘故，
                     // 一般进了这个分支之后，都是发生了 RESP 内容滞留，需要等待下一次 read 的
                     // 这一次，扩展长度，只是为了下几次 read 的高效率
@@ -1617,12 +2259,29 @@ int processMultibulkBuffer(redisClient *c) {
                 c->querybuf = sdsempty();
                 /* Assume that if we saw a fat argument we'll see another one
                  * likely... */
-                c->querybuf = sdsMakeRoomFor(c->querybuf,c->bulklen+2);
+                c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf,c->bulklen+2);
+                pos = 0;
+            } else if (pos == 0 &&
+                       c->bulklen >= REDIS_MBULK_BIG_ARG &&
+                       sdslen(c->querybuf)-(c->bulklen+2) < (size_t)c->bulklen)
+            {
+                /* The big argument is followed by some pipelined data:
+                 * copying the (smaller) tail to a new query buffer is
+                 * cheaper than copying the argument out of it. */
+                // 大对象后面还跟着 pipeline 的数据：拷贝较短的尾部，而不是拷贝大对象
+                sds tail = sdsnewlen(c->querybuf+c->bulklen+2,
+                    sdslen(c->querybuf)-(c->bulklen+2));
+
+                sdsIncrLen(c->querybuf,
+                    -(int)(sdslen(c->querybuf)-c->bulklen));
+                c->argv[c->argc++] = createObject(REDIS_STRING,c->querybuf);
+                c->querybuf = tail;
                 pos = 0;
             } else {
                 // 小对象，直接拷贝得了
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
+                c->argv[c->argc] = createClientArgObject(c,c->argc,
+                    c->querybuf+pos,c->bulklen);
+                c->argc++;
                 pos += c->bulklen+2;
             }
 
@@ -1661,9 +2320,11 @@ void processInputBuffer(redisClient *c) {
     //       也正是这个 while-loop，是的 redis-server 能够兼容异步的 redis-cli 客户端
     while(sdslen(c->querybuf)) {
 
-        /* Return if clients are paused. */
+        /* Return if clients are paused. Clients parsed by an I/O thread
+         * are never paused, see postponeClientRead(). */
         // 如果客户端正处于暂停状态，那么直接返回（会导致 querybuf 的内容堆积）
-        if (!(c->flags & REDIS_SLAVE) && clientsArePaused()) return;
+        if (!(c->flags & (REDIS_SLAVE|REDIS_PENDING_READ)) &&
+            clientsArePaused()) return;
 
         /* Immediately abort if the client is in the middle of something. */
         // REDIS_BLOCKED 状态表示客户端正在被阻塞（会导致 querybuf 的内容堆积）
@@ -1705,51 +2366,62 @@ void processInputBuffer(redisClient *c) {
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
+        } else if (c->flags & REDIS_PENDING_READ) {
+            /* Inside an I/O thread we can only parse: flag the client so
+             * that the main thread will execute the command. */
+            c->flags |= REDIS_PENDING_COMMAND;
+            break;
         } else {
             /* Only reset the client when the command was executed. */
             // 执行命令，并重置客户端，重置为单个命令而生的变量
-            if (processCommand(c) == REDIS_OK)
-                resetClient(c);
+            if (processCommand(c) == REDIS_OK) {
+                if (c->flags & REDIS_MASTER && !(c->flags & REDIS_MULTI)) {
+                    /* Update the applied replication offset of our master. */
+                    // 只有执行了的命令才计入 reploff ，未执行完的事务不计入
+                    c->reploff = c->read_reploff - sdslen(c->querybuf);
+                }
+                /* Don't reset the client structure for clients blocked in a
+                 * module blocking command, so that the reply callback will
+                 * still be able to access the client argv and argc field.
+                 * The client will be reset in unblockClientFromModule(). */
+                if (!(c->flags & REDIS_BLOCKED) ||
+                    c->btype != REDIS_BLOCKED_MODULE)
+                    resetClient(c);
+            }
         }
     }   // end of while
 }
 
-/*
- * 是 client-socket 发生 read-event 的时候，所采用的 callback
- * 1. 在 client-socket 第一次连接的时候，被 listen-socket accept 之后，
- *   调用 createClient()，并将这个 fd 注册进 epoll-instance 里面，
- *   并登记这个函数为 fd-read-event 对应的 read-event-callback
- * 2. 这个函数将会在 ae.c:aeProcessEvents() 中被调用，通过上面等级的 fd->read-callback 来触发
- * 
- * 读取客户端的发送过来的 RESP (REdis Serialization Protocol)，并保存到 c->querybuf 中
- * 然后在本函数中，通过 processInputBuffer() 来将 RESP 转换成 client 中的 argc 跟 argv
- */
-// test case: zadd key-string 1 member-1 2 member-2 3 member-3 4 member-4 5 member-5
-/**
- * RESP info: *12\r\n
- *            $4\r\nzadd\r\n
- *            $10\r\nkey-string\r\n
- *            $1\r\n1\r\n
- *            $8\r\nmember-1\r\n
- *            $1\r\n2\r\n
- *            $8\r\nmember-2\r\n
- *            $1\r\n3\r\n
- *            $8\r\nmember-3\r\n
- *            $1\r\n4\r\n
- *            $8\r\nmember-4\r\n
- *            $1\r\n5\r\n
- *            $8\r\nmember-5\r\n
-*/
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = (redisClient*) privdata;
-    int nread, readlen;
+/* This is a wrapper for processInputBuffer that also cares about handling
+ * the replication forwarding to the sub-slaves, in case the client 'c'
+ * is flagged as master. Usually you want to call this instead of the
+ * raw processInputBuffer(). */
+// slave 把已经执行了的 master 复制流原样转发给 sub-slave
+void processInputBufferAndReplicate(redisClient *c) {
+    if (!(c->flags & REDIS_MASTER)) {
+        processInputBuffer(c);
+    } else {
+        long long prev_offset = c->reploff;
+        size_t applied;
+
+        processInputBuffer(c);
+        applied = c->reploff - prev_offset;
+        if (applied) {
+            replicationFeedSlavesFromMasterStream(server.slaves,
+                    c->pending_querybuf, applied);
+            sdsrange(c->pending_querybuf,applied,-1);
+        }
+    }
+}
+
+/* Read from the client socket into the query buffer. The result of the
+ * read(2) call is stored in c->io_nread (and c->io_errno on errors) and is
+ * handled later by afterClientRead(). The function does not touch any
+ * global state, so it is safe to call it from the I/O threads. */
+static void readClientSocket(redisClient *c) {
+    int nread, readlen, big_arg = 0;
     size_t qblen;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    // 设置服务器的当前客户端
-    server.current_client = c;
-    
     // 读入长度（默认为 16 MB）
     // 那也就是意味着：当这个 CMD 的任何一部分、总长度超过了 REDIS_IOBUF_LEN，
     // 都将会再次从 epoll-instance 那里，再次触发本函数，因为一次 read，并不能顺利的将完整的 RESP element 读取出来
@@ -1777,7 +2449,12 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         // 这样就可以避免因为不知道可能会有多长，进而导致的多次拓展 sds，引发的大量 copy
         int remaining = (unsigned)(c->bulklen+2)-sdslen(c->querybuf);
 
-        if (remaining < readlen) readlen = remaining;
+        /* The query buffer is going to become the argument itself: don't
+         * let it grow more than required. */
+        if (remaining > 0) {
+            if (remaining < readlen) readlen = remaining;
+            big_arg = 1;
+        }
     }
 
     // 获取查询缓冲区当前内容的长度
@@ -1787,43 +2464,63 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     // 也是 lazy 的方式更新 buff 的峰值，每次从 socket read 之前，检查一次，看看要不要更新
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     // 为 querybuf 分配空间，每次默认读取 16 MB 的 data；REDIS_IOBUF_LEN
-    c->querybuf = sdsMakeRoomFor(c->querybuf, readlen); // 要是 readlen 小于原本的 sdslen(c->querybuf)，sdsMakeRoomFor() 将不会生效
+    c->querybuf = big_arg ? sdsMakeRoomForNonGreedy(c->querybuf, readlen) :
+                            sdsMakeRoomFor(c->querybuf, readlen); // 要是 readlen 小于原本的 sdslen(c->querybuf)，sdsMakeRoomFor() 将不会生效
 
     // 读入内容，并存放在 querybuf 中，最多读取 REDIS_IOBUF_LEN（遇上了 REDIS_MBULK_BIG_ARG 可能除外） data
     // 一定要在 c->querybuf+qblen，这样才能避免覆盖还没有来得及处理的 RESP 内容
-    nread = read(fd, c->querybuf+qblen, readlen);
+    // 压缩的复制连接：解码 master 发来的帧，querybuf 中保存的依旧是原始的复制流
+    if ((c->flags & REDIS_MASTER) && c->repl_zbuf) {
+        nread = replReadFrames(c->fd,&c->repl_zbuf,&c->querybuf,readlen);
+    } else if (c->flags & REDIS_SHM) {
+        // 共享内存客户端从请求环读取， socket 只用作门铃
+        nread = shmTransportRead(c->shm,c->querybuf+qblen,readlen);
+        if (nread > 0) sdsIncrLen(c->querybuf,nread);
+    } else {
+        nread = read(c->fd, c->querybuf+qblen, readlen);
+        // 根据内容，更新查询缓冲区（SDS） free 和 len 属性
+        // 并将 '\0' 正确地放到内容的最后
+        if (nread > 0) sdsIncrLen(c->querybuf,nread);
+    }
+    c->io_nread = nread;
+    c->io_errno = (nread == -1) ? errno : 0;
+}
+
+/* Handle the outcome of readClientSocket() in the main thread.
+ * Returns REDIS_ERR if the client was freed or nothing was read, so that
+ * the caller should not try to process the query buffer. */
+static int afterClientRead(redisClient *c) {
+    int nread = c->io_nread;
 
     if (nread == -1) {
         // 读入出错
-        if (errno == EAGAIN) {
-            nread = 0;  // TODO: 在 redis 的场景下，这个 EAGAIN 究竟意味着什么，数据读出来了没有？
+        if (c->io_errno == EAGAIN) {
             // 说明 read 没有读到任何数据，而且是非阻塞的关系，所以立马返回，并设置 EAGAIN
+            // 还不至于要走到崩溃报告的程度，所以设置为 NULL
+            server.current_client = NULL;
+            return REDIS_ERR;
         } else {
-            redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(errno));
+            redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(c->io_errno));
             freeClient(c);
-            return;
+            return REDIS_ERR;
         }
     } else if (nread == 0) {
         // 遇到 EOF，client 关闭，会作为一个单独的 read 事件，由 epoll-instance 触发
         // 然后 close(client_socket_fd)
         redisLog(REDIS_VERBOSE, "Client closed connection");
         freeClient(c);
-        return;
+        return REDIS_ERR;
     }
 
-    if (nread) {
-        // 根据内容，更新查询缓冲区（SDS） free 和 len 属性
-        // 并将 '\0' 正确地放到内容的最后
-        sdsIncrLen(c->querybuf,nread);
-        // 记录服务器和客户端最后一次互动的时间
-        c->lastinteraction = server.unixtime;
-        // 如果客户端是 master 的话(slave --> master 时用的 client)，更新它的复制偏移量
-        if (c->flags & REDIS_MASTER) c->reploff += nread;
-    } else {
-        // 在 nread == -1 且 errno == EAGAIN 时运行
-        // 还不至于要走到崩溃报告的程度，所以设置为 NULL
-        server.current_client = NULL;
-        return;
+    // 记录服务器和客户端最后一次互动的时间
+    c->lastinteraction = server.unixtime;
+    c->usage.net_input_bytes += nread;
+    // 如果客户端是 master 的话(slave --> master 时用的 client)，更新它的复制偏移量
+    // 这里只是读入了，执行之后才会更新 reploff ，见 processInputBuffer()
+    if (c->flags & REDIS_MASTER) {
+        c->read_reploff += nread;
+        c->pending_querybuf = sdscatlen(c->pending_querybuf,
+            c->querybuf+sdslen(c->querybuf)-nread,nread);
     }
 
     // querybuf 长度超出服务器所允许的最大缓冲区长度
@@ -1837,8 +2534,51 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(ci);
         sdsfree(bytes);
         freeClient(c);
-        return;
+        return REDIS_ERR;
     }
+    return REDIS_OK;
+}
+
+/*
+ * 是 client-socket 发生 read-event 的时候，所采用的 callback
+ * 1. 在 client-socket 第一次连接的时候，被 listen-socket accept 之后，
+ *   调用 createClient()，并将这个 fd 注册进 epoll-instance 里面，
+ *   并登记这个函数为 fd-read-event 对应的 read-event-callback
+ * 2. 这个函数将会在 ae.c:aeProcessEvents() 中被调用，通过上面等级的 fd->read-callback 来触发
+ * 
+ * 读取客户端的发送过来的 RESP (REdis Serialization Protocol)，并保存到 c->querybuf 中
+ * 然后在本函数中，通过 processInputBuffer() 来将 RESP 转换成 client 中的 argc 跟 argv
+ */
+// test case: zadd key-string 1 member-1 2 member-2 3 member-3 4 member-4 5 member-5
+/**
+ * RESP info: *12\r\n
+ *            $4\r\nzadd\r\n
+ *            $10\r\nkey-string\r\n
+ *            $1\r\n1\r\n
+ *            $8\r\nmember-1\r\n
+ *            $1\r\n2\r\n
+ *            $8\r\nmember-2\r\n
+ *            $1\r\n3\r\n
+ *            $8\r\nmember-3\r\n
+ *            $1\r\n4\r\n
+ *            $8\r\nmember-4\r\n
+ *            $1\r\n5\r\n
+ *            $8\r\nmember-5\r\n
+*/
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* Let an I/O thread read and parse the query if possible. */
+    if (postponeClientRead(c)) return;
+
+    // 设置服务器的当前客户端
+    server.current_client = c;
+
+    readClientSocket(c);
+    if (afterClientRead(c) == REDIS_ERR) return;
 
     // 函数会 wile-loop 的死循环执行，直到 querybuf 中的所有内容都被处理完为止
     // 特殊情况的会中断对 querybuf 的处理：
@@ -1847,7 +2587,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     // c->querybuf == "*12\r\n$4\r\nzadd\r\n$10\r\nkey-string\r\n$1\r\n1\r\n$8\r\nmember-1\r\n
     //                 $1\r\n2\r\n$8\r\nmember-2\r\n$1\r\n3\r\n$8\r\nmember-3\r\n$1\r\n4\r\n
     //                 $8\r\nmember-4\r\n$1\r\n5\r\n$8\r\nmember-5\r\n"
-    processInputBuffer(c);
+    processInputBufferAndReplicate(c);
 
     server.current_client = NULL;
 }
@@ -1950,7 +2690,11 @@ sds catClientInfoString(sds s, redisClient *client) {
     if (client->flags & REDIS_UNBLOCKED) *p++ = 'u';
     if (client->flags & REDIS_CLOSE_ASAP) *p++ = 'A';
     if (client->flags & REDIS_UNIX_SOCKET) *p++ = 'U';
+    if (client->flags & REDIS_SHM) *p++ = 'H';
     if (client->flags & REDIS_READONLY) *p++ = 'r';
+    if (client->flags & REDIS_TRACKING) *p++ = 't';
+    if (client->flags & REDIS_TRACKING_BROKEN_REDIR) *p++ = 'R';
+    if (client->flags & REDIS_TRACKING_BCAST) *p++ = 'B';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
@@ -1960,7 +2704,7 @@ sds catClientInfoString(sds s, redisClient *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i ssub=%i multi=%i qbuf=%U qbuf-free=%U rbs=%U rbp=%U obl=%U oll=%U omem=%U events=%s cmd=%s resp=%i tot-net-in=%U tot-net-out=%U tot-cmds=%U tot-cmd-usec=%U",
         getClientPeerId(client),
         client->fd,
         client->name ? (char*)client->name->ptr : "",
@@ -1970,14 +2714,22 @@ sds catClientInfoString(sds s, redisClient *client) {
         client->db->id,
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
+        (int) dictSize(client->pubsubshard_channels),
         (client->flags & REDIS_MULTI) ? client->mstate.count : -1,
         (unsigned long long) sdslen(client->querybuf),
         (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) client->buf_usable_size,
+        (unsigned long long) client->buf_peak,
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
         events,
-        client->lastcmd ? client->lastcmd->name : "NULL");
+        client->lastcmd ? client->lastcmd->name : "NULL",
+        client->resp,
+        client->usage.net_input_bytes,
+        client->usage.net_output_bytes,
+        client->usage.cmd_calls,
+        client->usage.cmd_usec);
 }
 
 /*
@@ -1999,6 +2751,252 @@ sds getAllClientsInfoString(void) {
     return o;
 }
 
+/* Return the client with the specified ID, or NULL if no client with this
+ * ID is connected.
+ *
+ * 根据 ID 查找客户端 */
+redisClient *lookupClientByID(uint64_t id) {
+    redisClient *c;
+
+    id = htonu64(id);
+    c = raxFind(server.clients_index,(unsigned char*)&id,sizeof(id));
+    return (c == raxNotFound) ? NULL : c;
+}
+
+/* Set the name of the client 'c' to 'name', or remove the current name if
+ * 'name' is empty. Return REDIS_ERR, replying with an error to the client,
+ * if the name contains invalid characters. */
+int clientSetNameOrReply(redisClient *c, robj *name) {
+    int j, len = sdslen(name->ptr);
+    char *p = name->ptr;
+
+    /* Setting the client name to an empty string actually removes
+     * the current name. */
+    // 名字为空时，清空客户端的名字
+    if (len == 0) {
+        clientFoldUsage(c);
+        if (c->name) decrRefCount(c->name);
+        c->name = NULL;
+        return REDIS_OK;
+    }
+
+    /* Otherwise check if the charset is ok. We need to do this otherwise
+     * CLIENT LIST format will break. You should always be able to
+     * split by space to get the different fields. */
+    for (j = 0; j < len; j++) {
+        if (p[j] < '!' || p[j] > '~') { /* ASCII is assumed. */
+            addReplyError(c,
+                "Client names cannot contain spaces, "
+                "newlines or special characters.");
+            return REDIS_ERR;
+        }
+    }
+    clientFoldUsage(c);
+    if (c->name) decrRefCount(c->name);
+    c->name = name;
+    incrRefCount(c->name);
+    return REDIS_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Per client name usage (CLIENT USAGE)
+ *
+ * The usage of every client is accounted in c->usage. The totals per client
+ * name are the usage of the live clients with that name, plus what the
+ * clients that had that name before being closed or renamed used, that is
+ * kept in server.client_usage. c->usage_folded is the part of c->usage that
+ * was already moved there, so that nothing is counted twice.
+ *
+ * Unnamed clients are accounted under the empty name, and so are the new
+ * names once REDIS_CLIENT_USAGE_MAX_NAMES names are tracked, so that clients
+ * using a different name for every connection can't use unbounded memory.
+ *----------------------------------------------------------------------------*/
+
+static void clientUsageAdd(clientUsage *dst, clientUsage *a, clientUsage *b) {
+    dst->net_input_bytes += a->net_input_bytes - b->net_input_bytes;
+    dst->net_output_bytes += a->net_output_bytes - b->net_output_bytes;
+    dst->cmd_calls += a->cmd_calls - b->cmd_calls;
+    dst->cmd_usec += a->cmd_usec - b->cmd_usec;
+}
+
+/* Return the usage entry of 'name' in dict 'd', creating it if needed. */
+static clientUsage *clientUsageLookup(dict *d, char *name) {
+    dictEntry *de;
+    clientUsage *u;
+    sds key = sdsnew(name);
+
+    if ((de = dictFind(d,key)) != NULL) {
+        sdsfree(key);
+        return dictGetVal(de);
+    }
+    if (dictSize(d) >= REDIS_CLIENT_USAGE_MAX_NAMES && key[0] != '\0') {
+        sdsfree(key);
+        return clientUsageLookup(d,"");
+    }
+    u = zcalloc(sizeof(*u));
+    dictAdd(d,key,u);
+    return u;
+}
+
+/* Move the usage of 'c' since the last call to the totals of its current
+ * name. Called before the client is renamed or freed. */
+void clientFoldUsage(redisClient *c) {
+    clientUsage *u;
+
+    if (c->usage.net_input_bytes == c->usage_folded.net_input_bytes &&
+        c->usage.net_output_bytes == c->usage_folded.net_output_bytes &&
+        c->usage.cmd_calls == c->usage_folded.cmd_calls) return;
+
+    u = clientUsageLookup(server.client_usage,
+                          c->name ? (char*)c->name->ptr : "");
+    clientUsageAdd(u,&c->usage,&c->usage_folded);
+    c->usage_folded = c->usage;
+}
+
+typedef struct clientUsageReport {
+    sds name;
+    long connections;
+    clientUsage usage;
+} clientUsageReport;
+
+static int clientUsageReportCompare(const void *a, const void *b) {
+    const clientUsageReport *ra = a, *rb = b;
+
+    if (ra->usage.cmd_usec == rb->usage.cmd_usec) return 0;
+    return ra->usage.cmd_usec > rb->usage.cmd_usec ? -1 : 1;
+}
+
+/* CLIENT SHM [<ringsize>]: create the shared memory rings of the client and
+ * reply with the path to map. The client switches to the rings once the
+ * reply is sent, see shmtransport.h for the protocol. */
+static void clientShmCommand(redisClient *c) {
+    long long ringsize = SHM_TRANSPORT_DEFAULT_RINGSIZE;
+
+    if (!server.shm_transport) {
+        addReplyError(c,"The shared memory transport is disabled, "
+                        "see the shm-transport option");
+        return;
+    }
+    if (!(c->flags & REDIS_UNIX_SOCKET) ||
+        c->flags & (REDIS_SLAVE|REDIS_MASTER|REDIS_MONITOR))
+    {
+        addReplyError(c,"CLIENT SHM is only allowed to normal clients "
+                        "connected to the UNIX socket");
+        return;
+    }
+    if (c->shm) {
+        addReplyError(c,"The client already uses the shared memory transport");
+        return;
+    }
+    if (c->argc == 3 &&
+        getLongLongFromObjectOrReply(c,c->argv[2],&ringsize,NULL) != REDIS_OK)
+        return;
+    if (ringsize < SHM_TRANSPORT_MIN_RINGSIZE ||
+        ringsize > SHM_TRANSPORT_MAX_RINGSIZE || (ringsize & (ringsize-1)))
+    {
+        addReplyErrorFormat(c,"The ring size must be a power of two "
+            "between %d and %d", SHM_TRANSPORT_MIN_RINGSIZE,
+            SHM_TRANSPORT_MAX_RINGSIZE);
+        return;
+    }
+
+    if ((c->shm = shmTransportCreate(c->id,ringsize)) == NULL) {
+        addReplyErrorFormat(c,"Can't create the shared memory rings: %s",
+            strerror(errno));
+        return;
+    }
+    addReplyBulkCString(c,(char*)shmTransportPath(c->shm));
+}
+
+/* CLIENT USAGE: reply with the totals of every client name, the names that
+ * used more CPU first. */
+static void clientUsageCommand(redisClient *c) {
+    dict *names = dictCreate(&keyptrDictType,NULL);
+    sds unnamed = sdsempty();
+    clientUsageReport *report;
+    dictIterator *di;
+    dictEntry *de;
+    listNode *ln;
+    listIter li;
+    long j = 0, count;
+
+    /* Collect the names of the closed and of the live clients. */
+    di = dictGetIterator(server.client_usage);
+    while ((de = dictNext(di)) != NULL)
+        dictAdd(names,dictGetKey(de),NULL);
+    dictReleaseIterator(di);
+
+    report = zcalloc(sizeof(*report)*(dictSize(names)+listLength(server.clients)));
+    di = dictGetIterator(names);
+    while ((de = dictNext(di)) != NULL) {
+        clientUsage *u = dictFetchValue(server.client_usage,dictGetKey(de));
+
+        report[j].name = dictGetKey(de);
+        report[j].usage = *u;
+        dictSetVal(names,de,(void*)(j+1));
+        j++;
+    }
+    dictReleaseIterator(di);
+
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        redisClient *client = listNodeValue(ln);
+        sds name = client->name ? client->name->ptr : unnamed;
+        long idx;
+
+        if ((de = dictFind(names,name)) != NULL) {
+            idx = (long)dictGetVal(de)-1;
+        } else if (dictSize(names) >= REDIS_CLIENT_USAGE_MAX_NAMES &&
+                   name[0] != '\0' && (de = dictFind(names,unnamed)) != NULL) {
+            idx = (long)dictGetVal(de)-1;
+        } else {
+            idx = j++;
+            report[idx].name = name;
+            dictAdd(names,name,(void*)(idx+1));
+        }
+        report[idx].connections++;
+        clientUsageAdd(&report[idx].usage,&client->usage,
+                       &client->usage_folded);
+    }
+    count = j;
+    qsort(report,count,sizeof(*report),clientUsageReportCompare);
+
+    addReplyMultiBulkLen(c,count);
+    for (j = 0; j < count; j++) {
+        addReplyMultiBulkLen(c,12);
+        addReplyBulkCString(c,"name");
+        addReplyBulkCBuffer(c,report[j].name,sdslen(report[j].name));
+        addReplyBulkCString(c,"connections");
+        addReplyLongLong(c,report[j].connections);
+        addReplyBulkCString(c,"tot-net-in");
+        addReplyLongLong(c,report[j].usage.net_input_bytes);
+        addReplyBulkCString(c,"tot-net-out");
+        addReplyLongLong(c,report[j].usage.net_output_bytes);
+        addReplyBulkCString(c,"tot-cmds");
+        addReplyLongLong(c,report[j].usage.cmd_calls);
+        addReplyBulkCString(c,"tot-cmd-usec");
+        addReplyLongLong(c,report[j].usage.cmd_usec);
+    }
+    zfree(report);
+    dictRelease(names);
+    sdsfree(unnamed);
+}
+
+/* CLIENT USAGE RESET: start the per name totals from zero. The totals of
+ * the single clients in CLIENT LIST are not touched. */
+static void clientUsageReset(void) {
+    listNode *ln;
+    listIter li;
+
+    dictEmpty(server.client_usage,NULL);
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        redisClient *client = listNodeValue(ln);
+
+        client->usage_folded = client->usage;
+    }
+}
+
 /*
  * CLIENT 命令的实现
  */
@@ -2037,33 +3035,15 @@ void clientCommand(redisClient *c) {
 
     // CLIENT setname 设置客户端名字
     } else if (!strcasecmp(c->argv[1]->ptr,"setname") && c->argc == 3) {
-        int j, len = sdslen(c->argv[2]->ptr);
-        char *p = c->argv[2]->ptr;
-
-        /* Setting the client name to an empty string actually removes
-         * the current name. */
-        // 名字为空时，清空客户端的名字
-        if (len == 0) {
-            if (c->name) decrRefCount(c->name);
-            c->name = NULL;
+        if (clientSetNameOrReply(c,c->argv[2]) == REDIS_OK)
             addReply(c,shared.ok);
-            return;
-        }
 
-        /* Otherwise check if the charset is ok. We need to do this otherwise
-         * CLIENT LIST format will break. You should always be able to
-         * split by space to get the different fields. */
-        for (j = 0; j < len; j++) {
-            if (p[j] < '!' || p[j] > '~') { /* ASCII is assumed. */
-                addReplyError(c,
-                    "Client names cannot contain spaces, "
-                    "newlines or special characters.");
-                return;
-            }
-        }
-        if (c->name) decrRefCount(c->name);
-        c->name = c->argv[2];
-        incrRefCount(c->name);
+    // CLIENT usage [reset] 按客户端名字汇总的资源使用情况
+    } else if (!strcasecmp(c->argv[1]->ptr,"usage") && c->argc == 2) {
+        clientUsageCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"usage") && c->argc == 3 &&
+               !strcasecmp(c->argv[2]->ptr,"reset")) {
+        clientUsageReset();
         addReply(c,shared.ok);
 
     // CLIENT getname 获取客户端的名字
@@ -2071,7 +3051,7 @@ void clientCommand(redisClient *c) {
         if (c->name)
             addReplyBulk(c,c->name);
         else
-            addReply(c,shared.nullbulk);
+            addReplyNull(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"pause") && c->argc == 3) {
         long long duration;
 
@@ -2079,8 +3059,132 @@ void clientCommand(redisClient *c) {
                                         != REDIS_OK) return;
         pauseClients(duration);
         addReply(c,shared.ok);
+
+    // CLIENT id 获取客户端的 ID
+    } else if (!strcasecmp(c->argv[1]->ptr,"id") && c->argc == 2) {
+        addReplyLongLong(c,c->id);
+
+    // CLIENT tracking on|off [REDIRECT id] [BCAST] [PREFIX prefix ...] [NOLOOP]
+    } else if (!strcasecmp(c->argv[1]->ptr,"tracking") && c->argc >= 3) {
+        long long redir = 0;
+        int j, options = 0;
+        robj **prefix = NULL;
+        size_t numprefix = 0;
+
+        /* Parse the options. */
+        for (j = 3; j < c->argc; j++) {
+            int moreargs = (c->argc-1) - j;
+
+            if (!strcasecmp(c->argv[j]->ptr,"redirect") && moreargs) {
+                j++;
+                if (redir != 0) {
+                    addReplyError(c,"A client can only redirect to a single "
+                                    "other client");
+                    zfree(prefix);
+                    return;
+                }
+                if (getLongLongFromObjectOrReply(c,c->argv[j],&redir,NULL) !=
+                    REDIS_OK)
+                {
+                    zfree(prefix);
+                    return;
+                }
+                /* We will require the client with the specified ID to exist
+                 * right now, even if it is possible that it gets disconnected
+                 * later. Still a valid sanity check. */
+                if (lookupClientByID(redir) == NULL) {
+                    addReplyError(c,"The client ID you want redirect to "
+                                    "does not exist");
+                    zfree(prefix);
+                    return;
+                }
+            } else if (!strcasecmp(c->argv[j]->ptr,"bcast")) {
+                options |= REDIS_TRACKING_BCAST;
+            } else if (!strcasecmp(c->argv[j]->ptr,"noloop")) {
+                options |= REDIS_TRACKING_NOLOOP;
+            } else if (!strcasecmp(c->argv[j]->ptr,"prefix") && moreargs) {
+                j++;
+                prefix = zrealloc(prefix,sizeof(robj*)*(numprefix+1));
+                prefix[numprefix++] = c->argv[j];
+            } else {
+                zfree(prefix);
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+
+        /* Options are ok: enable or disable the tracking for this client. */
+        if (!strcasecmp(c->argv[2]->ptr,"on")) {
+            /* Before enabling tracking, make sure options are compatible
+             * among each other and with the current state of the client. */
+            if (!(options & REDIS_TRACKING_BCAST) && numprefix) {
+                addReplyError(c,
+                    "PREFIX option requires BCAST mode to be enabled");
+                zfree(prefix);
+                return;
+            }
+            if (c->flags & REDIS_TRACKING) {
+                int oldbcast = !!(c->flags & REDIS_TRACKING_BCAST);
+                int newbcast = !!(options & REDIS_TRACKING_BCAST);
+                if (oldbcast != newbcast) {
+                    addReplyError(c,
+                    "You can't switch BCAST mode on/off before disabling "
+                    "tracking for this client, and then re-enabling it with "
+                    "a different mode.");
+                    zfree(prefix);
+                    return;
+                }
+            }
+            /* RESP3 clients receive the invalidation messages in band as
+             * push data. RESP2 clients can't, so the messages are delivered
+             * as Pub/Sub messages to another connection. */
+            if (redir == 0 && c->resp == 2) {
+                addReplyError(c,"Client side caching requires the REDIRECT "
+                                "option with RESP2: invalidation messages are "
+                                "sent to the __redis__:invalidate channel of "
+                                "another connection. Switch to RESP3 with "
+                                "HELLO 3 to receive them in this connection");
+                zfree(prefix);
+                return;
+            }
+            enableTracking(c,redir,options,prefix,numprefix);
+        } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+            disableTracking(c);
+        } else {
+            zfree(prefix);
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        zfree(prefix);
+        addReply(c,shared.ok);
+
+    // CLIENT maxlag <ms> 从 slave 读取时允许的最大延迟
+    } else if (!strcasecmp(c->argv[1]->ptr,"maxlag") && c->argc == 3) {
+        long long max_lag;
+
+        if (getLongLongFromObjectOrReply(c,c->argv[2],&max_lag,NULL)
+            != REDIS_OK) return;
+        if (max_lag < 0) {
+            addReplyError(c,"maxlag can't be negative");
+            return;
+        }
+        c->max_lag = max_lag;
+        addReply(c,shared.ok);
+
+    // CLIENT shm [ringsize] 切换到共享内存传输
+    } else if (!strcasecmp(c->argv[1]->ptr,"shm") &&
+               (c->argc == 2 || c->argc == 3)) {
+        clientShmCommand(c);
+
+    // CLIENT getredir 获取接收失效消息的客户端 ID
+    } else if (!strcasecmp(c->argv[1]->ptr,"getredir") && c->argc == 2) {
+        if (c->flags & REDIS_TRACKING) {
+            addReplyLongLong(c,c->client_tracking_redirection);
+        } else {
+            addReplyLongLong(c,-1);
+        }
     } else {
-        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL ip:port | GETNAME | SETNAME connection-name)");
+        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL ip:port | GETNAME | SETNAME connection-name | ID | TRACKING on|off | GETREDIR | MAXLAG ms | SHM [ringsize])");
     }
 }
 
@@ -2120,6 +3224,21 @@ void rewriteClientCommandVector(redisClient *c, int argc, ...) {
     va_end(ap);
 }
 
+/* Completely replace the client command vector with the provided one. The
+ * new objects are owned by the client from now on, so their ref count is
+ * not touched, while the old vector is freed like above. */
+// 用调用者构造好的数组整体替换参数
+void replaceClientCommandVector(redisClient *c, int argc, robj **argv) {
+    int j;
+
+    for (j = 0; j < c->argc; j++) decrRefCount(c->argv[j]);
+    zfree(c->argv);
+    c->argv = argv;
+    c->argc = argc;
+    c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
+    redisAssertWithInfo(c,NULL,c->cmd != NULL);
+}
+
 /* Rewrite a single item in the command vector.
  * The new val ref count is incremented, and the old decremented. */
 // 修改单个参数
@@ -2166,8 +3285,12 @@ void rewriteClientCommandArgument(redisClient *c, int i, robj *newval) {
 // 是一个不太精确的统计（针对 reply-list 缓冲区，但是没有考虑共享的内存）
 unsigned long getClientOutputBufferMemoryUsage(redisClient *c) {
     unsigned long list_item_size = sizeof(listNode)+sizeof(robj);
+    unsigned long mem = c->reply_bytes + (list_item_size*listLength(c->reply));
 
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    /* Slaves are accounted for the replication buffer they still have to
+     * send, see getReplicaReplicationBufferMemoryUsage(). */
+    if (c->flags & REDIS_SLAVE) mem += getReplicaReplicationBufferMemoryUsage(c);
+    return mem;
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -2190,8 +3313,7 @@ unsigned long getClientOutputBufferMemoryUsage(redisClient *c) {
  */
 int getClientLimitClass(redisClient *c) {
     if (c->flags & REDIS_SLAVE) return REDIS_CLIENT_LIMIT_CLASS_SLAVE;
-    if (dictSize(c->pubsub_channels) || listLength(c->pubsub_patterns))
-        return REDIS_CLIENT_LIMIT_CLASS_PUBSUB;
+    if (clientSubscriptionsCount(c)) return REDIS_CLIENT_LIMIT_CLASS_PUBSUB;
     return REDIS_CLIENT_LIMIT_CLASS_NORMAL;
 }
 
@@ -2321,7 +3443,12 @@ void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) {
     redisAssert(c->reply_bytes < ULONG_MAX-(1024*64));
 
     // 已经被标记了
-    if (c->reply_bytes == 0 || c->flags & REDIS_CLOSE_ASAP) return;
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & REDIS_CLOSE_ASAP) return;
+
+    /* The list of clients to close can't be touched from the I/O threads:
+     * the limits will be checked again by the next reply. */
+    if (io_threads_op != IO_THREADS_OP_IDLE) return;
 
     // 检查限制
     if (checkClientOutputBufferLimits(c)) {
@@ -2433,10 +3560,316 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    processing_events_while_blocked = 1;
     while (iterations--) {
         int events = aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
         if (!events) break;
         count += events;
     }
+    /* beforeSleep() is not called here, so flush the pending writes. */
+    count += handleClientsWithPendingWrites();
+    processing_events_while_blocked = 0;
+    return count;
+}
+
+/* ==========================================================================
+ * Threaded I/O
+ * ==========================================================================
+ *
+ * When io-threads is greater than 1, the clients that need to write their
+ * output buffers (and, if io-threads-do-reads is enabled, the clients that
+ * became readable) are not served directly in the event handlers but are
+ * queued in server.clients_pending_write / server.clients_pending_read.
+ * Before going back to the event loop the main thread splits the queued
+ * clients among the I/O threads and itself, then waits for all of them to
+ * finish. The I/O threads only perform the write(2)/read(2) calls and the
+ * parsing of the query buffer: commands are always executed by the main
+ * thread, so the rest of the server remains single threaded. */
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex;
+static pthread_cond_t io_threads_job_cond;  /* Signaled on new batch. */
+static pthread_cond_t io_threads_done_cond; /* Signaled on batch done. */
+static unsigned long io_threads_batch = 0;  /* Batch ID, never reused. */
+static int io_threads_active = 0;           /* Threads still working. */
+static redisClient **io_threads_jobs;       /* Clients of current batch. */
+static int io_threads_jobs_num;
+
+/* Perform the current I/O operation for the client. This is called both
+ * by the I/O threads and by the main thread. */
+static void processClientIOJob(redisClient *c) {
+    if (io_threads_op == IO_THREADS_OP_WRITE) {
+        c->io_nwritten = writeClientOutputBuffers(c);
+    } else {
+        readClientSocket(c);
+        if (c->io_nread > 0 &&
+            sdslen(c->querybuf) <= server.client_max_querybuf_len)
+            processInputBuffer(c);
+    }
+}
+
+/* Serve the clients at positions id, id+step, id+2*step, ... of the
+ * current batch. The main thread has id 0. */
+static void processClientIOJobs(int id, int step) {
+    int j;
+
+    for (j = id; j < io_threads_jobs_num; j += step)
+        processClientIOJob(io_threads_jobs[j]);
+}
+
+static void *IOThreadMain(void *arg) {
+    int id = (unsigned long) arg;
+    unsigned long batch = 0;
+
+    pthread_mutex_lock(&io_threads_mutex);
+    while(1) {
+        while (batch == io_threads_batch)
+            pthread_cond_wait(&io_threads_job_cond,&io_threads_mutex);
+        batch = io_threads_batch;
+        pthread_mutex_unlock(&io_threads_mutex);
+
+        processClientIOJobs(id,server.io_threads_num);
+
+        pthread_mutex_lock(&io_threads_mutex);
+        if (--io_threads_active == 0)
+            pthread_cond_signal(&io_threads_done_cond);
+    }
+    return NULL;
+}
+
+/* Serve the 'count' clients in 'jobs' performing the I/O operation 'op'.
+ * When there are too few clients to make waking up the threads worthwhile,
+ * everything is done in the main thread. Returns the number of clients
+ * served by the I/O threads. */
+static int runClientIOJobs(redisClient **jobs, int count, int op) {
+    io_threads_op = op;
+    io_threads_jobs = jobs;
+    io_threads_jobs_num = count;
+
+    if (count < server.io_threads_num*2) {
+        processClientIOJobs(0,1);
+        io_threads_op = IO_THREADS_OP_IDLE;
+        return 0;
+    }
+
+    pthread_mutex_lock(&io_threads_mutex);
+    io_threads_active = server.io_threads_num-1;
+    io_threads_batch++;
+    pthread_cond_broadcast(&io_threads_job_cond);
+    pthread_mutex_unlock(&io_threads_mutex);
+
+    processClientIOJobs(0,server.io_threads_num);
+
+    pthread_mutex_lock(&io_threads_mutex);
+    while (io_threads_active)
+        pthread_cond_wait(&io_threads_done_cond,&io_threads_mutex);
+    pthread_mutex_unlock(&io_threads_mutex);
+    io_threads_op = IO_THREADS_OP_IDLE;
     return count;
 }
+
+/* Move the clients of list 'l' into a newly allocated array. The number of
+ * clients is stored in *count. */
+static redisClient **clientListToArray(list *l, int *count) {
+    redisClient **clients = zmalloc(sizeof(redisClient*)*listLength(l));
+    listIter li;
+    listNode *ln;
+    int j = 0;
+
+    listRewind(l,&li);
+    while((ln = listNext(&li))) clients[j++] = listNodeValue(ln);
+    *count = j;
+    return clients;
+}
+
+/* Return true if the reading of the query of client 'c' should be done by
+ * the I/O threads. In that case the client is queued and the read will be
+ * performed in handleClientsWithPendingReads(). */
+static int postponeClientRead(redisClient *c) {
+    /* Already queued: the threaded read did not happen yet, or the parsed
+     * command still waits to be executed. */
+    if (c->flags & REDIS_PENDING_READ) return 1;
+
+    if (server.io_threads_num > 1 && server.io_threads_do_reads &&
+        !processing_events_while_blocked && !server.loading &&
+        !(c->flags & (REDIS_MASTER|REDIS_SLAVE|REDIS_BLOCKED)) &&
+        !clientsArePaused())
+    {
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    }
+    return 0;
+}
+
+/* Write the output buffers of the clients queued by prepareClientToWrite(),
+ * using the I/O threads when enabled. Called in beforeSleep().
+ * Returns the number of clients processed. */
+int handleClientsWithPendingWrites(void) {
+    redisClient **clients;
+    int j, count, slaves, processed = listLength(server.clients_pending_write);
+
+    if (processed == 0) return 0;
+
+    clients = clientListToArray(server.clients_pending_write,&count);
+    while(listLength(server.clients_pending_write))
+        listDelNode(server.clients_pending_write,
+                    listFirst(server.clients_pending_write));
+
+    /* Clients that are going to be closed don't need their replies, and
+     * the ones waiting for the AOF group commit are queued again once
+     * released. Slaves are moved at the end of the array: they share the
+     * replication buffer, so they are written by the main thread after the
+     * I/O threads. */
+    slaves = count;
+    for (j = 0; j < slaves; j++) {
+        redisClient *c = clients[j];
+
+        c->flags &= ~REDIS_PENDING_WRITE;
+        if (c->flags & (REDIS_CLOSE_ASAP|REDIS_AOF_WAIT)) {
+            clients[j--] = clients[--slaves];
+            clients[slaves] = clients[--count];
+        } else if ((c->flags & REDIS_SLAVE) && !(c->flags & REDIS_MONITOR)) {
+            clients[j--] = clients[--slaves];
+            clients[slaves] = c;
+        }
+    }
+
+    server.stat_io_writes_processed +=
+        runClientIOJobs(clients,slaves,IO_THREADS_OP_WRITE);
+    for (j = slaves; j < count; j++)
+        clients[j]->io_nwritten = writeClientOutputBuffers(clients[j]);
+
+    /* Release the sent replies and install the write handler for the
+     * clients that still have something to write. */
+    for (j = 0; j < count; j++)
+        afterClientWrite(clients[j],clients[j]->io_nwritten,0);
+    zfree(clients);
+    return processed;
+}
+
+/* Read and parse the queries of the clients queued by postponeClientRead()
+ * using the I/O threads, then execute the parsed commands in the main
+ * thread. Called in beforeSleep(). Returns the number of clients processed. */
+int handleClientsWithPendingReads(void) {
+    redisClient **clients;
+    int count, processed = listLength(server.clients_pending_read);
+
+    if (processed == 0) return 0;
+
+    clients = clientListToArray(server.clients_pending_read,&count);
+    server.stat_io_reads_processed +=
+        runClientIOJobs(clients,count,IO_THREADS_OP_READ);
+    zfree(clients);
+
+    /* Clients are removed from the list one by one since executing the
+     * command of a client may free other clients of the list. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        server.current_client = c;
+        if (afterClientRead(c) == REDIS_ERR) continue;
+
+        /* The I/O thread stops parsing after the first command. */
+        if (c->flags & REDIS_PENDING_COMMAND) {
+            c->flags &= ~REDIS_PENDING_COMMAND;
+            if (processCommand(c) == REDIS_OK &&
+                (!(c->flags & REDIS_BLOCKED) ||
+                 c->btype != REDIS_BLOCKED_MODULE)) resetClient(c);
+        }
+        processInputBuffer(c);
+        server.current_client = NULL;
+
+        /* Replies added while the client was owned by the I/O thread (for
+         * instance protocol errors) did not install the write handler. */
+        if (c->bufpos || listLength(c->reply))
+            clientInstallWriteHandler(c);
+    }
+    return processed;
+}
+
+/* Serve the shared memory clients without waiting for their doorbell: read
+ * the requests queued since the last event loop iteration, and send the
+ * output that did not fit the reply ring if the client freed room. Called
+ * in beforeSleep(). */
+void handleShmClients(void) {
+    uint64_t *ids;
+    listNode *ln;
+    listIter li;
+    int j = 0, count = listLength(server.shm_clients);
+
+    /* Executing the commands may free other clients of the list. */
+    ids = zmalloc(sizeof(uint64_t)*count);
+    listRewind(server.shm_clients,&li);
+    while ((ln = listNext(&li)) != NULL)
+        ids[j++] = ((redisClient*)listNodeValue(ln))->id;
+
+    for (j = 0; j < count; j++) {
+        redisClient *c = lookupClientByID(ids[j]);
+
+        if (c == NULL ||
+            c->flags & (REDIS_CLOSE_ASAP|REDIS_PENDING_READ)) continue;
+        if (clientHasPendingReplies(c) &&
+            !(c->flags & (REDIS_PENDING_WRITE|REDIS_AOF_WAIT)) &&
+            shmTransportHasRoom(c->shm))
+        {
+            if (afterClientWrite(c,writeClientOutputBuffers(c),0) ==
+                REDIS_ERR) continue;
+        }
+        if (shmTransportHasInput(c->shm))
+            readQueryFromClient(server.el,c->fd,c,AE_READABLE);
+    }
+    zfree(ids);
+}
+
+/* Called at the end of beforeSleep(): from now on the shared memory clients
+ * have to ring the doorbell to wake us up. If some client already has work
+ * for us the event loop polls without sleeping. */
+void prepareShmClientsToSleep(void) {
+    listNode *ln;
+    listIter li;
+    int busy = 0;
+
+    listRewind(server.shm_clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        redisClient *c = listNodeValue(ln);
+        int want_room = clientHasPendingReplies(c) &&
+                        !(c->flags & REDIS_AOF_WAIT);
+
+        if (c->flags & REDIS_CLOSE_ASAP) continue;
+        if (shmTransportPrepareSleep(c->shm,want_room)) busy = 1;
+    }
+    aeSetDontWait(server.el,busy);
+}
+
+/* Spawn the I/O threads. The main thread counts as the first one. */
+void initThreadedIO(void) {
+    pthread_attr_t attr;
+    size_t stacksize;
+    int j;
+
+    if (server.io_threads_num == 1) return;
+
+    pthread_mutex_init(&io_threads_mutex,NULL);
+    pthread_cond_init(&io_threads_job_cond,NULL);
+    pthread_cond_init(&io_threads_done_cond,NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    for (j = 1; j < server.io_threads_num; j++) {
+        void *arg = (void*)(unsigned long) j;
+        if (pthread_create(&io_threads[j],&attr,IOThreadMain,arg) != 0) {
+            redisLog(REDIS_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+    }
+}
@@ -83,6 +83,7 @@ int keyspaceEventsStringToFlags(char *classes) {
         case 'z': flags |= REDIS_NOTIFY_ZSET; break;
         case 'x': flags |= REDIS_NOTIFY_EXPIRED; break;
         case 'e': flags |= REDIS_NOTIFY_EVICTED; break;
+        case 't': flags |= REDIS_NOTIFY_STREAM; break;
         case 'K': flags |= REDIS_NOTIFY_KEYSPACE; break;
         case 'E': flags |= REDIS_NOTIFY_KEYEVENT; break;
         // 不能识别
@@ -115,6 +116,7 @@ sds keyspaceEventsFlagsToString(int flags) {
         if (flags & REDIS_NOTIFY_ZSET) res = sdscatlen(res,"z",1);
         if (flags & REDIS_NOTIFY_EXPIRED) res = sdscatlen(res,"x",1);
         if (flags & REDIS_NOTIFY_EVICTED) res = sdscatlen(res,"e",1);
+        if (flags & REDIS_NOTIFY_STREAM) res = sdscatlen(res,"t",1);
     }
     if (flags & REDIS_NOTIFY_KEYSPACE) res = sdscatlen(res,"K",1);
     if (flags & REDIS_NOTIFY_KEYEVENT) res = sdscatlen(res,"E",1);
@@ -143,9 +145,15 @@ sds keyspaceEventsFlagsToString(int flags) {
  * 'key' is a Redis object representing the key name. 用来组成 channel 的一部分
  * 'dbid' is the database ID where the key lives.
  */
+/* Channel names are built into this buffer, reused across calls, and
+ * wrapped in a stack robj: pubsub always copies channel names into the
+ * replies so the object is never referenced after the publish returns.
+ * A buffer grown past NOTIFY_CHAN_BUF_MAX by a huge key is released. */
+#define NOTIFY_CHAN_BUF_MAX 4096
+static sds notify_chan = NULL;
+
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
-    sds chan;
-    robj *chanobj, *eventobj;
+    robj chanobj, *eventobj;
     int len = -1;
     char buf[24];
 
@@ -153,27 +161,32 @@ void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
     // 如果服务器配置为不发送 type 类型的通知，那么直接返回
     if (!(server.notify_keyspace_events & type)) return;
 
-    // 事件的名字
-    eventobj = createStringObject(event,strlen(event));
+    /* Nobody subscribed to anything: nothing can be delivered. */
+    // 没有任何订阅者时，不需要构建任何对象
+    if (dictSize(server.pubsub_channels) == 0 &&
+        listLength(server.pubsub_patterns) == 0) return;
+
+    if (notify_chan == NULL) notify_chan = sdsempty();
 
     /* __keyspace@<db>__:<key> <event> notifications. */
     // 发送键空间通知
     if (server.notify_keyspace_events & REDIS_NOTIFY_KEYSPACE) {
 
         // 构建频道对象
-        chan = sdsnewlen("__keyspace@",11);
+        sdsclear(notify_chan);
+        notify_chan = sdscatlen(notify_chan, "__keyspace@",11);
         len = ll2string(buf,sizeof(buf),dbid);
-        chan = sdscatlen(chan, buf, len);
-        chan = sdscatlen(chan, "__:", 3);
-        chan = sdscatsds(chan, key->ptr);
-
-        chanobj = createObject(REDIS_STRING, chan);
-
-        // 通过 publish 命令发送通知
-        pubsubPublishMessage(chanobj, eventobj);
-
-        // 释放频道对象
-        decrRefCount(chanobj);
+        notify_chan = sdscatlen(notify_chan, buf, len);
+        notify_chan = sdscatlen(notify_chan, "__:", 3);
+        notify_chan = sdscatsds(notify_chan, key->ptr);
+        initStaticStringObject(chanobj,notify_chan);
+
+        // 有订阅者时才创建事件对象，并通过 publish 命令发送通知
+        if (pubsubChannelHasSubscribers(&chanobj)) {
+            eventobj = createStringObject(event,strlen(event));
+            pubsubPublishMessage(&chanobj, eventobj);
+            decrRefCount(eventobj);
+        }
     }
 
     /* __keyevente@<db>__:<event> <key> notifications. */
@@ -181,23 +194,23 @@ void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
     if (server.notify_keyspace_events & REDIS_NOTIFY_KEYEVENT) {
 
         // 构建频道对象
-        chan = sdsnewlen("__keyevent@",11);
+        sdsclear(notify_chan);
+        notify_chan = sdscatlen(notify_chan, "__keyevent@",11);
         // 如果在前面发送键空间通知的时候计算了 len ，那么它就不会是 -1
         // 这可以避免计算两次 buf 的长度
         if (len == -1) len = ll2string(buf,sizeof(buf),dbid);
-        chan = sdscatlen(chan, buf, len);
-        chan = sdscatlen(chan, "__:", 3);
-        chan = sdscatsds(chan, eventobj->ptr);
-
-        chanobj = createObject(REDIS_STRING, chan);
+        notify_chan = sdscatlen(notify_chan, buf, len);
+        notify_chan = sdscatlen(notify_chan, "__:", 3);
+        notify_chan = sdscat(notify_chan, event);
+        initStaticStringObject(chanobj,notify_chan);
 
         // 通过 publish 命令发送通知
-        pubsubPublishMessage(chanobj, key);
-
-        // 释放频道对象
-        decrRefCount(chanobj);
+        if (pubsubChannelHasSubscribers(&chanobj))
+            pubsubPublishMessage(&chanobj, key);
     }
 
-    // 释放事件对象
-    decrRefCount(eventobj);
+    if (sdslen(notify_chan) > NOTIFY_CHAN_BUF_MAX) {
+        sdsfree(notify_chan);
+        notify_chan = NULL;
+    }
 }
@@ -63,8 +63,9 @@ robj *createObject(int type, void *ptr) {
     o->ptr = ptr;   // 指向底层数据结构，底层数据结构跟 encoding 的描述是一致的
     o->refcount = 1;
 
-    /* Set the LRU to the current lruclock (minutes resolution). */
-    o->lru = LRU_CLOCK();
+    /* Set the LRU to the current lruclock (minutes resolution), or
+     * alternatively the LFU counter. */
+    initObjectLRUOrLFU(o);
     return o;
 }
 
@@ -100,17 +101,19 @@ robj *createRawStringObject(char *ptr, size_t len) {
  *                                                          +------------------+                               
  */
 robj *createEmbeddedStringObject(char *ptr, size_t len) {
-    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr)+len+1);    // +1 是为了 '\0'
-    struct sdshdr *sh = (void*)(o+1);   // 指针先采用 sizeof(robj) 的步长移动一次，然后再转化为 void* 给到 sh
+    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);    // +1 是为了 '\0'
+    struct sdshdr8 *sh = (void*)(o+1);   // 指针先采用 sizeof(robj) 的步长移动一次，然后再转化为 void* 给到 sh
 
     o->type = REDIS_STRING;
     o->encoding = REDIS_ENCODING_EMBSTR;
     o->ptr = sh+1;
     o->refcount = 1;
-    o->lru = LRU_CLOCK();
+    initObjectLRUOrLFU(o);
 
+    // EMBSTR 的长度不超过 REDIS_ENCODING_EMBSTR_SIZE_LIMIT ，总是使用 sdshdr8
     sh->len = len;
-    sh->free = 0;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
     if (ptr) {
         memcpy(sh->buf,ptr,len);
         sh->buf[len] = '\0';
@@ -125,12 +128,12 @@ robj *createEmbeddedStringObject(char *ptr, size_t len) {
  * REIDS_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
  *
- * The current limit of 39 is chosen so that the biggest string object
+ * The current limit of 44 is chosen so that the biggest string object
  * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
-// sizeof(robj) = 16; sizeof(sdshdr) = 8; 64 - 16 - 8 - 1('\0') = 39
+// sizeof(robj) = 16; sizeof(sdshdr8) = 3; 64 - 16 - 3 - 1('\0') = 44
 // arena = 64, 是 jmalloc 将自己内存池里面的一大块内存，分割为多个 64 byte 的小块，然后给应用程序使用
 // 既然 embedded string 是不会变用的 string，那样采用 64 作为分割点，可以更有效地利用内存，减少内存碎片
-#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 39
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
 robj *createStringObject(char *ptr, size_t len) {
     if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
         return createEmbeddedStringObject(ptr,len);
@@ -263,23 +266,23 @@ robj *dupStringObject(robj *o) {
 /* 所有 redis-obj 的创建入口（函数名指定了底层数据的 encoding 方式） */
 // TODO: 再软件设计上，redis 是怎么解决顶层数据结构跟底层的映射关系的？是怎么调用相应函数完成创建的？
 /*
- * 创建一个 LINKEDLIST 编码的列表对象
+ * 创建一个 QUICKLIST 编码的列表对象
  */
-robj *createListObject(void) {
+robj *createQuicklistObject(void) {
 
-    list *l = listCreate();
+    quicklist *l = quicklistNew(server.list_max_ziplist_size,
+                                server.list_compress_depth);
 
     robj *o = createObject(REDIS_LIST,l);
 
-    listSetFreeMethod(l,decrRefCountVoid);  // TODO: 为什么要特意这样设置一下？而且是只有 list 这样
-
-    o->encoding = REDIS_ENCODING_LINKEDLIST;
+    o->encoding = REDIS_ENCODING_QUICKLIST;
 
     return o;
 }
 
 /*
  * 创建一个 ZIPLIST 编码的列表对象
+ * 只会在载入旧版本的 RDB 时短暂存在，随后就会被转换成 QUICKLIST
  */
 robj *createZiplistObject(void) {
 
@@ -321,17 +324,17 @@ robj *createIntsetObject(void) {
 }
 
 /*
- * 创建一个 ZIPLIST 编码的哈希对象
- * 对于 REDIS_HASH obj 而言，总是先采用 REDIS_ENCODING_ZIPLIST 的方式进行编码（一开始总是很小的，没必要用 dict 这种耗内存的东西）
+ * 创建一个 LISTPACK 编码的哈希对象
+ * 对于 REDIS_HASH obj 而言，总是先采用 REDIS_ENCODING_LISTPACK 的方式进行编码（一开始总是很小的，没必要用 dict 这种耗内存的东西）
  * 随着 REDIS_HASH obj 的不断增长，将会改用 REDIS_ENCODING_HT，而这个转换将会发生在 hashTypeConvert() 函数里面
  */
 robj *createHashObject(void) {
 
-    unsigned char *zl = ziplistNew();
+    unsigned char *lp = lpNew();
 
-    robj *o = createObject(REDIS_HASH, zl);
+    robj *o = createObject(REDIS_HASH, lp);
 
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+    o->encoding = REDIS_ENCODING_LISTPACK;
 
     return o;
 }
@@ -342,7 +345,7 @@ robj *createHashObject(void) {
  * 而不是 zset 可以采用 skip list 或 dict 这种两底层 encoding 方式进行编码
  * struct zset 下面是同时管着一个 dict 跟 zsl 的
  * 
- * 另一种可能是：只用 ziplist 构建 zset TODO:(DONE) 这种情况是采用排序的 zipset 来完成吗？对
+ * 另一种可能是：只用 listpack 构建 zset TODO:(DONE) 这种情况是采用排序的 zipset 来完成吗？对
  */
 robj *createZsetObject(void) {
 
@@ -361,25 +364,52 @@ robj *createZsetObject(void) {
 }
 
 /*
- * 创建一个 ZIPLIST 编码的有序集合
+ * 创建一个 LISTPACK 编码的有序集合
  */
-robj *createZsetZiplistObject(void) {
+robj *createZsetListpackObject(void) {
 
-    unsigned char *zl = ziplistNew();
+    unsigned char *lp = lpNew();
 
-    robj *o = createObject(REDIS_ZSET,zl);
+    robj *o = createObject(REDIS_ZSET,lp);
 
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+    o->encoding = REDIS_ENCODING_LISTPACK;
 
     return o;
 }
 
+/*
+ * 创建一个空的流对象
+ */
+robj *createStreamObject(void) {
+
+    stream *s = streamNew();
+
+    robj *o = createObject(REDIS_STREAM,s);
+
+    o->encoding = REDIS_ENCODING_STREAM;
+
+    return o;
+}
+
+/*
+ * 创建一个模块类型的值对象，value 由模块类型 mt 负责释放
+ */
+robj *createModuleObject(moduleType *mt, void *value) {
+    moduleValue *mv = zmalloc(sizeof(*mv));
+
+    mv->type = mt;
+    mv->value = value;
+    return createObject(REDIS_MODULE,mv);
+}
+
 /*
  * 释放字符串对象
  */
 void freeStringObject(robj *o) {
     if (o->encoding == REDIS_ENCODING_RAW) {
         sdsfree(o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        stringChunksFree(o->ptr);
     }
 }
 
@@ -390,8 +420,8 @@ void freeListObject(robj *o) {
 
     switch (o->encoding) {
 
-    case REDIS_ENCODING_LINKEDLIST:
-        listRelease((list*) o->ptr);
+    case REDIS_ENCODING_QUICKLIST:
+        quicklistRelease(o->ptr);
         break;
 
     case REDIS_ENCODING_ZIPLIST:
@@ -439,8 +469,8 @@ void freeZsetObject(robj *o) {
         zfree(zs);
         break;
 
-    case REDIS_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case REDIS_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
 
     default:
@@ -459,7 +489,12 @@ void freeHashObject(robj *o) {
         dictRelease((dict*) o->ptr);
         break;
 
-    case REDIS_ENCODING_ZIPLIST:
+    case REDIS_ENCODING_LISTPACK:
+        lpFree(o->ptr);
+        break;
+
+    case REDIS_ENCODING_LISTPACK_IDX:
+        lpFree(((hashListpackIndex*)o->ptr)->lp);
         zfree(o->ptr);
         break;
 
@@ -469,11 +504,133 @@ void freeHashObject(robj *o) {
     }
 }
 
+/*
+ * 释放流对象
+ */
+void freeStreamObject(robj *o) {
+    freeStream(o->ptr);
+}
+
+/*
+ * 释放模块类型的值对象
+ */
+void freeModuleObject(robj *o) {
+    moduleValue *mv = o->ptr;
+
+    mv->type->free(mv->value);
+    zfree(mv);
+}
+
+/* ------------------ Dismissing saved values in a child ------------------ */
+
+/* A child saving the dataset never reads again a value it already wrote,
+ * so in fork friendly mode it gives the pages of the value back to the
+ * kernel (see zmadvise_dontneed()), and the parent can later modify them
+ * without a copy-on-write. Only allocations spanning whole pages can be
+ * given back, so the elements of an aggregate are walked only when, from
+ * the bytes written for the key ('size_hint'), they are at least a page
+ * on average.
+ *
+ * 子进程保存完一个值之后不会再读它，把它占用的整页交还给内核，
+ * 父进程之后修改这些页就不会再触发 copy-on-write 。 */
+
+#ifdef HAVE_ZMADVISE_DONTNEED
+/* Give back the sds of a string object, unless it is referenced from
+ * elsewhere than the 'refs' references of the aggregate being saved. */
+static void dismissStringObject(robj *o, int refs) {
+    if (o->refcount != refs) return;
+    if (o->encoding == REDIS_ENCODING_RAW) {
+        zmadvise_dontneed(sdsAllocPtr(o->ptr));
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        stringChunks *sc = o->ptr;
+        size_t j;
+
+        for (j = 0; j < sc->count; j++) zmadvise_dontneed(sc->chunk[j]);
+    }
+}
+
+static void dismissDict(dict *d, int refs, int vals, size_t size_hint,
+                        size_t page_size)
+{
+    if (dictSize(d) && size_hint/dictSize(d) >= page_size) {
+        dictIterator *di = dictGetIterator(d);
+        dictEntry *de;
+
+        while ((de = dictNext(di)) != NULL) {
+            dismissStringObject(dictGetKey(de),refs);
+            if (vals) dismissStringObject(dictGetVal(de),refs);
+        }
+        dictReleaseIterator(di);
+    }
+    if (d->ht[0].table) zmadvise_dontneed(d->ht[0].table);
+    if (d->ht[1].table) zmadvise_dontneed(d->ht[1].table);
+}
+#endif
+
+void dismissObject(robj *o, size_t size_hint) {
+#ifdef HAVE_ZMADVISE_DONTNEED
+    static size_t page_size = 0;
+
+    if (page_size == 0) page_size = sysconf(_SC_PAGESIZE);
+
+    /* A shared value is still to be saved under another key. */
+    if (o->refcount != 1) return;
+
+    switch(o->type) {
+    case REDIS_STRING:
+        dismissStringObject(o,1);
+        break;
+    case REDIS_LIST:
+        if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node;
+
+            if (ql->len && size_hint/ql->len >= page_size) {
+                for (node = ql->head; node; node = node->next)
+                    zmadvise_dontneed(node->zl);
+            }
+        }
+        break;
+    case REDIS_SET:
+        if (o->encoding == REDIS_ENCODING_HT)
+            dismissDict(o->ptr,1,0,size_hint,page_size);
+        else
+            zmadvise_dontneed(o->ptr);
+        break;
+    case REDIS_ZSET:
+        /* The members are referenced by both the dict and the skiplist. */
+        if (o->encoding == REDIS_ENCODING_SKIPLIST)
+            dismissDict(((zset*)o->ptr)->dict,2,0,size_hint,page_size);
+        else
+            zmadvise_dontneed(o->ptr);
+        break;
+    case REDIS_HASH:
+        if (o->encoding == REDIS_ENCODING_HT)
+            dismissDict(o->ptr,1,1,size_hint,page_size);
+        else
+            zmadvise_dontneed(hashTypeListpack(o));
+        break;
+    default:
+        /* Streams and module values are left alone. */
+        break;
+    }
+#else
+    REDIS_NOTUSED(o);
+    REDIS_NOTUSED(size_hint);
+#endif
+}
+
 /*
  * 为对象的引用计数增一
  */
 void incrRefCount(robj *o) {
-    o->refcount++;
+    // 后台线程正在释放对象（或者多线程载入 RDB）时，引用计数可能被两个线程同时修改
+#ifdef HAVE_ATOMIC
+    if (lazyfreeInProgress() || rdbLoadThreadsActive())
+        __sync_add_and_fetch(&o->refcount,1);
+    else
+#endif
+        o->refcount++;
 }
 
 /*
@@ -482,24 +639,32 @@ void incrRefCount(robj *o) {
  * 当对象的引用计数降为 0 时，释放对象。
  */
 void decrRefCount(robj *o) {
+    int last;
 
     if (o->refcount <= 0) redisPanic("decrRefCount against refcount <= 0");
 
+    // 后台线程正在释放对象时，使用原子操作减少计数，
+    // 计数降为 0 的那个线程负责释放对象
+#ifdef HAVE_ATOMIC
+    if (lazyfreeInProgress() || rdbLoadThreadsActive())
+        last = __sync_sub_and_fetch(&o->refcount,1) == 0;
+    else
+#endif
+        last = o->refcount-- == 1;
+
     // 释放对象
-    if (o->refcount == 1) {
+    if (last) {
         switch(o->type) {
         case REDIS_STRING: freeStringObject(o); break;
         case REDIS_LIST: freeListObject(o); break;
         case REDIS_SET: freeSetObject(o); break;
         case REDIS_ZSET: freeZsetObject(o); break;
         case REDIS_HASH: freeHashObject(o); break;
+        case REDIS_STREAM: freeStreamObject(o); break;
+        case REDIS_MODULE: freeModuleObject(o); break;
         default: redisPanic("Unknown object type"); break;
         }
         zfree(o);
-
-    // 减少计数
-    } else {
-        o->refcount--;
     }
 }
 
@@ -509,7 +674,7 @@ void decrRefCount(robj *o) {
  *
  * 作用于特定数据结构的释放函数包装
  */
-// listTypeConvert() 将 list 的底层数据结构从 ziplist 转换为普通的 list
+// 例如作为 listSetFreeMethod() 的释放函数
 void decrRefCountVoid(void *o) {
     decrRefCount(o);
 }
@@ -822,6 +987,9 @@ size_t stringObjectLen(robj *o) {
     if (sdsEncodedObject(o)) {
         return sdslen(o->ptr);
 
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        return ((stringChunks*)o->ptr)->len;
+
     // INT 编码，计算将这个值转换为字符串要多少字节
     // 相当于返回它的长度
     } else {
@@ -1080,6 +1248,11 @@ char *strEncoding(int encoding) {
     case REDIS_ENCODING_INTSET: return "intset";
     case REDIS_ENCODING_SKIPLIST: return "skiplist";
     case REDIS_ENCODING_EMBSTR: return "embstr";
+    case REDIS_ENCODING_QUICKLIST: return "quicklist";
+    case REDIS_ENCODING_STREAM: return "stream";
+    case REDIS_ENCODING_LISTPACK: return "listpack";
+    case REDIS_ENCODING_LISTPACK_IDX: return "listpackidx";
+    case REDIS_ENCODING_CHUNKED: return "chunked";
     default: return "unknown";
     }
 }
@@ -1097,6 +1270,94 @@ unsigned long long estimateObjectIdleTime(robj *o) {
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * LFU (Least Frequently Used) implementation.
+ *
+ * We have 24 total bits of space in each object in order to implement
+ * an LFU (Least Frequently Used) eviction policy, since we re-use the
+ * LRU field for this purpose: 16 bits for the decrement time in minutes
+ * and 8 bits for the logarithmic counter, see redis.h.
+ * --------------------------------------------------------------------------*/
+
+/* Return the current time in minutes, just taking the least significant
+ * 16 bits. The returned time is suitable to be stored as LDT (last decrement
+ * time) for the LFU implementation. */
+unsigned long LFUGetTimeInMinutes(void) {
+    return (server.unixtime/60) & 65535;
+}
+
+/* Given an object last decrement time, compute the minimum number of minutes
+ * that elapsed since the last decrement. Handle overflow (ldt greater than
+ * the current 16 bits minutes time) considering the time as wrapping
+ * exactly once. */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/* Logarithmically increment a counter. The greater is the current counter
+ * value the less likely is that it gets really implemented. Saturate it
+ * at 255.
+ *
+ * 以对数的方式增加访问计数： lfu-log-factor 越大，计数器增长得越慢
+ */
+static uint8_t LFULogIncr(uint8_t counter) {
+    double r, baseval, p;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter - REDIS_LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    p = 1.0/(baseval*server.lfu_log_factor+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/* If the object decrement time is reached decrement the LFU counter but
+ * do not update LFU fields of the object, we update the access time
+ * and counter in an explicit way when the object is really accessed.
+ * The counter is decremented by one for every server.lfu_decay_time
+ * minutes elapsed since the last decrement.
+ * Return the object frequency counter.
+ *
+ * This function is used in order to scan the dataset for the best object
+ * to fit: as we check for the candidate, we incrementally decrement the
+ * counter of the scanned objects if needed.
+ *
+ * 返回对象经过衰减之后的访问计数，不修改对象本身
+ */
+unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = server.lfu_decay_time ?
+        LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/* Update LFU when an object is accessed.
+ * Firstly, decrement the counter if the decrement time is reached.
+ * Then logarithmically increment the counter, and update the access time. */
+void updateLFU(robj *o) {
+    unsigned long counter = LFUDecrAndReturn(o);
+
+    counter = LFULogIncr(counter);
+    o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+}
+
+/* Set the access information of a new object: the current LRU clock, or
+ * the initial LFU counter if the maxmemory policy is LFU based. */
+void initObjectLRUOrLFU(robj *o) {
+    if (maxmemoryPolicyIsLFU()) {
+        o->lru = (LFUGetTimeInMinutes()<<8) | REDIS_LFU_INIT_VAL;
+    } else {
+        o->lru = LRU_CLOCK();
+    }
+}
+
 /* This is a helper function for the OBJECT command. We need to lookup keys
  * without any modification of LRU or other parameters.
  *
@@ -1122,6 +1383,367 @@ robj *objectCommandLookupOrReply(redisClient *c, robj *key, robj *reply) {
     return o;
 }
 
+/* ======================= The OBJECT and MEMORY commands =================== */
+
+#if defined(USE_JEMALLOC)
+/* Callback for je_malloc_stats_print(), appending to an sds string. */
+void inputCatSds(void *result, const char *str) {
+    /* result is actually a (sds *), so re-cast it here */
+    sds *info = (sds *)result;
+    *info = sdscat(*info, str);
+}
+#endif
+
+/* Return the total number of bytes used by a string object, including
+ * the robj itself. Embedded strings are a single allocation. */
+static size_t objectComputeStringSize(robj *o) {
+    switch(o->encoding) {
+    case REDIS_ENCODING_RAW:
+        return sizeof(*o)+zmalloc_size_sds(o->ptr);
+    case REDIS_ENCODING_EMBSTR:
+        return zmalloc_size(o);
+    case REDIS_ENCODING_CHUNKED:
+        return sizeof(*o)+stringChunksAllocSize(o->ptr);
+    default:
+        return sizeof(*o); /* REDIS_ENCODING_INT */
+    }
+}
+
+/* Return the number of bytes used by a quicklist node and its listpack, that
+ * may be LZF compressed. */
+static size_t objectComputeQuicklistNodeSize(quicklistNode *node) {
+    if (quicklistNodeIsCompressed(node)) {
+        quicklistLZF *lzf = (quicklistLZF*)node->zl;
+        return sizeof(*node)+sizeof(*lzf)+lzf->sz;
+    }
+    return sizeof(*node)+lpBytes(node->zl);
+}
+
+/* Return the approximated number of bytes used by the object 'o', including
+ * its value and the robj structure, but not the key or the main dictionary
+ * entry.
+ *
+ * Note: to guess the size of the elements of aggregated data types, only
+ * 'sample_size' elements are walked and the average element size is
+ * multiplied by the number of elements, so the result is an estimation.
+ * A 'sample_size' of 0 means to walk all the elements.
+ *
+ * 估算对象 o 以及它的底层数据结构占用的内存字节数，
+ * 对于包含大量元素的聚合对象，只对 sample_size 个元素进行采样
+ */
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size) {
+    robj *ele;
+    dict *d;
+    dictIterator *di;
+    struct dictEntry *de;
+    size_t asize = 0, elesize = 0, samples = 0;
+
+    if (o->type == REDIS_STRING) {
+        asize = objectComputeStringSize(o);
+    } else if (o->type == REDIS_LIST) {
+        if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
+
+            asize = sizeof(*o)+sizeof(quicklist);
+            do {
+                elesize += objectComputeQuicklistNodeSize(node);
+                samples++;
+            } while ((node = node->next) &&
+                     (sample_size == 0 || samples < sample_size));
+            asize += (double)elesize/samples*ql->len;
+        } else {
+            redisPanic("Unknown list encoding");
+        }
+    } else if (o->type == REDIS_SET) {
+        if (o->encoding == REDIS_ENCODING_HT) {
+            d = o->ptr;
+            di = dictGetIterator(d);
+            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while((de = dictNext(di)) != NULL &&
+                  (sample_size == 0 || samples < sample_size))
+            {
+                ele = dictGetKey(de);
+                elesize += sizeof(struct dictEntry) +
+                           objectComputeStringSize(ele);
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == REDIS_ENCODING_INTSET) {
+            intset *is = o->ptr;
+            asize = sizeof(*o)+intsetBlobLen(is);
+        } else {
+            redisPanic("Unknown set encoding");
+        }
+    } else if (o->type == REDIS_ZSET) {
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
+        } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+            d = ((zset*)o->ptr)->dict;
+            zskiplist *zsl = ((zset*)o->ptr)->zsl;
+            zskiplistNode *znode = zsl->header->level[0].forward;
+
+            asize = sizeof(*o)+sizeof(zset)+sizeof(zskiplist)+sizeof(dict)+
+                    (sizeof(struct dictEntry*)*dictSlots(d))+
+                    zmalloc_size(zsl->header);
+            while(znode != NULL &&
+                  (sample_size == 0 || samples < sample_size))
+            {
+                /* The member is stored inside the node allocation. */
+                elesize += sizeof(struct dictEntry) + zmalloc_size(znode);
+                samples++;
+                znode = znode->level[0].forward;
+            }
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else {
+            redisPanic("Unknown sorted set encoding");
+        }
+    } else if (o->type == REDIS_HASH) {
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
+        } else if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+            asize = sizeof(*o)+lpBytes(hashTypeListpack(o))+
+                    hashTypeIndexBytes(o);
+        } else if (o->encoding == REDIS_ENCODING_HT) {
+            d = o->ptr;
+            di = dictGetIterator(d);
+            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while((de = dictNext(di)) != NULL &&
+                  (sample_size == 0 || samples < sample_size))
+            {
+                elesize += objectComputeStringSize(dictGetKey(de));
+                elesize += objectComputeStringSize(dictGetVal(de));
+                elesize += sizeof(struct dictEntry);
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else {
+            redisPanic("Unknown hash encoding");
+        }
+    } else if (o->type == REDIS_STREAM) {
+        stream *s = o->ptr;
+        raxIterator ri;
+
+        /* Every rax node costs at least its header. The nodes ziplists
+         * are sampled, like the elements of the other types. */
+        asize = sizeof(*o)+sizeof(*s)+sizeof(rax);
+        asize += s->rax->numnodes*(sizeof(raxNode)+sizeof(void*)*2);
+        raxStart(&ri,s->rax);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri) && (sample_size == 0 || samples < sample_size)) {
+            elesize += ziplistBlobLen(ri.data);
+            samples++;
+        }
+        raxStop(&ri);
+        if (samples) asize += (double)elesize/samples*raxSize(s->rax);
+    } else if (o->type == REDIS_MODULE) {
+        /* The memory used by the value is only known by the module. */
+        asize = sizeof(*o)+sizeof(moduleValue);
+    } else {
+        redisPanic("Unknown object type");
+    }
+    return asize;
+}
+
+/* Release data obtained with getMemoryOverheadData(). */
+void freeMemoryOverheadData(struct redisMemOverhead *mh) {
+    zfree(mh->db);
+    zfree(mh);
+}
+
+/* Return a struct redisMemOverhead filled with memory overhead
+ * information used for the MEMORY STATS and MEMORY DOCTOR commands. The
+ * returned structure pointer should be freed calling
+ * freeMemoryOverheadData().
+ *
+ * 统计 Redis 在数据集之外的内存开销：客户端缓冲区、复制积压缓冲区、
+ * AOF 缓冲区以及每个数据库的哈希表
+ */
+struct redisMemOverhead *getMemoryOverheadData(void) {
+    int j;
+    size_t mem_total = 0;
+    size_t mem = 0;
+    size_t zmalloc_used = zmalloc_used_memory();
+    struct redisMemOverhead *mh = zcalloc(sizeof(*mh));
+
+    mh->total_allocated = zmalloc_used;
+    mh->startup_allocated = server.initial_memory_usage;
+    mh->peak_allocated = server.stat_peak_memory;
+    mh->fragmentation =
+        zmalloc_get_fragmentation_ratio(server.resident_set_size);
+    mem_total += server.initial_memory_usage;
+
+    /* The backlog and the slaves share the replication buffer: what is
+     * above the backlog size is accounted to the slaves. */
+    mem = 0;
+    if (listLength(server.slaves) &&
+        (long long)server.repl_buffer_mem > server.repl_backlog_size)
+    {
+        mh->repl_backlog = server.repl_backlog_size;
+        mem = server.repl_buffer_mem - server.repl_backlog_size;
+    } else {
+        mh->repl_backlog = server.repl_buffer_mem;
+    }
+    if (server.repl_backlog) mh->repl_backlog += sizeof(replBacklog);
+    mem_total += mh->repl_backlog;
+
+    if (listLength(server.slaves)) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            redisClient *c = listNodeValue(ln);
+            mem += getClientOutputBufferMemoryUsage(c) -
+                   getReplicaReplicationBufferMemoryUsage(c);
+            mem += sdsAllocSize(c->querybuf);
+            mem += sizeof(redisClient) + c->buf_usable_size;
+        }
+    }
+    mh->clients_slaves = mem;
+    mem_total+=mem;
+
+    mem = 0;
+    if (listLength(server.clients)) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.clients,&li);
+        while((ln = listNext(&li))) {
+            redisClient *c = listNodeValue(ln);
+            if (c->flags & REDIS_SLAVE && !(c->flags & REDIS_MONITOR))
+                continue;
+            mem += getClientOutputBufferMemoryUsage(c);
+            mem += sdsAllocSize(c->querybuf);
+            mem += sizeof(redisClient) + c->buf_usable_size;
+        }
+    }
+    mh->clients_normal = mem;
+    mem_total+=mem;
+
+    mem = 0;
+    if (server.aof_state != REDIS_AOF_OFF) {
+        mem += sdsAllocSize(server.aof_buf);
+    }
+    mh->aof_buffer = mem;
+    mem_total+=mem;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        long long keyscount = dictSize(db->dict);
+        if (keyscount==0) continue;
+
+        mh->total_keys += keyscount;
+        mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
+        mh->db[mh->num_dbs].dbid = j;
+
+        mem = dictSize(db->dict) * sizeof(dictEntry) +
+              dictSlots(db->dict) * sizeof(dictEntry*) +
+              dictSize(db->dict) * sizeof(robj);
+        mh->db[mh->num_dbs].overhead_ht_main = mem;
+        mem_total+=mem;
+
+        mem = dictSize(db->expires) * sizeof(dictEntry) +
+              dictSlots(db->expires) * sizeof(dictEntry*);
+        mh->db[mh->num_dbs].overhead_ht_expires = mem;
+        mem_total+=mem;
+
+        mh->num_dbs++;
+    }
+
+    mh->overhead_total = mem_total;
+    mh->dataset = zmalloc_used > mem_total ? zmalloc_used - mem_total : 0;
+    mh->peak_perc = (float)zmalloc_used*100/mh->peak_allocated;
+
+    /* Metrics computed after subtracting the startup memory from
+     * the total memory. */
+    size_t net_usage = 1;
+    if (zmalloc_used > mh->startup_allocated)
+        net_usage = zmalloc_used - mh->startup_allocated;
+    mh->dataset_perc = (float)mh->dataset*100/net_usage;
+    mh->bytes_per_key = mh->total_keys ? (net_usage / mh->total_keys) : 0;
+
+    return mh;
+}
+
+/* This function returns a human readable report about the memory state of
+ * the instance, suggesting what to do when things look wrong. The report
+ * starts with a greeting, as the latency doctor does. */
+sds getMemoryDoctorReport(void) {
+    int empty = 0;          /* Instance is empty or almost empty. */
+    int big_peak = 0;       /* Memory peak is much larger than used mem. */
+    int high_frag = 0;      /* High fragmentation. */
+    int big_slave_buf = 0;  /* Slave buffers are too big. */
+    int big_client_buf = 0; /* Client buffers are too big. */
+    int num_reports = 0;
+    struct redisMemOverhead *mh = getMemoryOverheadData();
+
+    if (mh->total_allocated < (1024*1024*5)) {
+        empty = 1;
+        num_reports++;
+    } else {
+        /* Peak is > 150% of current used memory? */
+        if (((float)mh->peak_allocated / mh->total_allocated) > 1.5) {
+            big_peak = 1;
+            num_reports++;
+        }
+
+        /* Fragmentation is higher than 1.4? */
+        if (mh->fragmentation > 1.4) {
+            high_frag = 1;
+            num_reports++;
+        }
+
+        /* Clients using more than 200k each average? */
+        long numslaves = listLength(server.slaves);
+        long numclients = listLength(server.clients)-numslaves;
+        if (numclients && mh->clients_normal / numclients > (1024*200)) {
+            big_client_buf = 1;
+            num_reports++;
+        }
+
+        /* Slaves using more than 10 MB each? */
+        if (numslaves && mh->clients_slaves / numslaves > (1024*1024*10)) {
+            big_slave_buf = 1;
+            num_reports++;
+        }
+    }
+
+    sds s;
+    if (num_reports == 0) {
+        s = sdsnew(
+        "Hi Sam, I can't find any memory issue in your instance. "
+        "I can only account for what occurs on this base.\n");
+    } else if (empty == 1) {
+        s = sdsnew(
+        "Hi Sam, this instance is empty or is using very little memory, "
+        "my issues detector can't be used in these conditions. "
+        "Please, leave for your mission on Earth and fill it with some data. "
+        "The new Sam and I will be back to our programming as soon as I "
+        "finished rebooting.\n");
+    } else {
+        s = sdsnew("Sam, I detected a few issues in this Redis instance memory implants:\n\n");
+        if (big_peak) {
+            s = sdscat(s," * Peak memory: In the past this instance used more than 150% the memory that is currently using. The allocator is normally not able to release memory after a peak, so you can expect to see a big fragmentation ratio, however this is actually harmless and is only due to the memory peak, and if the Redis instance Resident Set Size (RSS) is currently bigger than expected, the memory will be used as soon as you fill the Redis instance with more data. If the memory peak was only occasional and you want to try to reclaim memory, please try the MEMORY PURGE command, otherwise the only other option is to shutdown and restart the instance.\n\n");
+        }
+        if (high_frag) {
+            s = sdscatprintf(s," * High fragmentation: This instance has a memory fragmentation greater than 1.4 (this means that the Resident Set Size of the Redis process is much larger than the sum of the logical allocations Redis performed). This problem is usually due either to a large peak memory (check if there is a peak memory entry above in the report) or may result from a workload that causes the allocator to fragment memory a lot. If the problem is a large peak memory, then there is no issue. Otherwise, make sure you are using the Jemalloc allocator and not the default libc malloc. Note: The currently used allocator is \"%s\".\n\n", ZMALLOC_LIB);
+        }
+        if (big_slave_buf) {
+            s = sdscat(s," * Big slave buffers: The slave output buffers in this instance are greater than 10MB for each slave (on average). This likely means that there is some slave instance that is struggling receiving data, either because it is too slow or because of networking issues. As a result, data piles on the master output buffers. Please try to identify what slave is not receiving data correctly and why. You can use the INFO output in order to check the slaves delays and the CLIENT LIST command to check the output buffers of each slave.\n\n");
+        }
+        if (big_client_buf) {
+            s = sdscat(s," * Big client buffers: The clients output buffers in this instance are greater than 200K per client (on average). This may result from different causes, like Pub/Sub clients subscribed to channels bot not receiving data fast enough, so that data piles on the Redis instance output buffer, or clients sending commands with large replies or very large sequences of commands in the same pipeline. Please use the CLIENT LIST command in order to investigate the issue if it causes problems in your instance, or to understand better why certain clients are using a big amount of memory.\n\n");
+        }
+        s = sdscat(s,"I'm here to keep you safe, Sam. I want to help you.\n");
+    }
+    freeMemoryOverheadData(mh);
+    return s;
+}
+
 /* Object command allows to inspect the internals of an Redis Object.
  * Usage: OBJECT <verb> ... arguments ... */
 void objectCommand(redisClient *c) {
@@ -1129,22 +1751,180 @@ void objectCommand(redisClient *c) {
 
     // 返回对戏哪个的引用计数
     if (!strcasecmp(c->argv[1]->ptr,"refcount") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.null[c->resp]))
                 == NULL) return;
         addReplyLongLong(c,o->refcount);
 
     // 返回对象的编码
     } else if (!strcasecmp(c->argv[1]->ptr,"encoding") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.null[c->resp]))
                 == NULL) return;
         addReplyBulkCString(c,strEncoding(o->encoding));
     
     // 返回对象的空闲时间
     } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.null[c->resp]))
                 == NULL) return;
+        if (maxmemoryPolicyIsLFU()) {
+            addReplyError(c,"An LFU maxmemory policy is selected, idle time not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
         addReplyLongLong(c,estimateObjectIdleTime(o)/1000);
+
+    // 返回对象的访问频率（对数计数器）
+    } else if (!strcasecmp(c->argv[1]->ptr,"freq") && c->argc == 3) {
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.null[c->resp]))
+                == NULL) return;
+        if (!maxmemoryPolicyIsLFU()) {
+            addReplyError(c,"An LFU maxmemory policy is not selected, access frequency not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
+        /* LFUDecrAndReturn should be called
+         * in case of the key has not been accessed for a long time,
+         * because we update the access time only
+         * when the key is read or overwritten. */
+        addReplyLongLong(c,LFUDecrAndReturn(o));
+    } else {
+        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime|freq)");
+    }
+}
+
+/* The memory command will eventually be a complete interface for the
+ * memory introspection capabilities of Redis.
+ *
+ * Usage: MEMORY usage <key> [SAMPLES <count>]
+ *        MEMORY stats
+ *        MEMORY doctor
+ *        MEMORY malloc-stats
+ *        MEMORY purge
+ */
+void memoryCommand(redisClient *c) {
+    robj *o;
+
+    if (!strcasecmp(c->argv[1]->ptr,"usage") && c->argc >= 3) {
+        dictEntry *de;
+        long long samples = OBJ_COMPUTE_SIZE_DEF_SAMPLES;
+        int j;
+
+        for (j = 3; j < c->argc; j++) {
+            if (!strcasecmp(c->argv[j]->ptr,"samples") &&
+                j+1 < c->argc)
+            {
+                if (getLongLongFromObjectOrReply(c,c->argv[j+1],&samples,NULL)
+                     == REDIS_ERR) return;
+                if (samples < 0) {
+                    addReply(c,shared.syntaxerr);
+                    return;
+                }
+                if (samples == 0) samples = LLONG_MAX;
+                j++; /* skip option argument. */
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+            addReplyNull(c);
+            return;
+        }
+        o = dictGetVal(de);
+        size_t usage = objectComputeSize(o,samples);
+        usage += sdsAllocSize(dictGetKey(de));
+        usage += sizeof(dictEntry);
+        addReplyLongLong(c,usage);
+    } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
+        struct redisMemOverhead *mh = getMemoryOverheadData();
+        size_t j;
+
+        addReplyMultiBulkLen(c,(14+mh->num_dbs)*2);
+
+        addReplyBulkCString(c,"peak.allocated");
+        addReplyLongLong(c,mh->peak_allocated);
+
+        addReplyBulkCString(c,"total.allocated");
+        addReplyLongLong(c,mh->total_allocated);
+
+        addReplyBulkCString(c,"startup.allocated");
+        addReplyLongLong(c,mh->startup_allocated);
+
+        addReplyBulkCString(c,"replication.backlog");
+        addReplyLongLong(c,mh->repl_backlog);
+
+        addReplyBulkCString(c,"clients.slaves");
+        addReplyLongLong(c,mh->clients_slaves);
+
+        addReplyBulkCString(c,"clients.normal");
+        addReplyLongLong(c,mh->clients_normal);
+
+        addReplyBulkCString(c,"aof.buffer");
+        addReplyLongLong(c,mh->aof_buffer);
+
+        for (j = 0; j < mh->num_dbs; j++) {
+            char dbname[32];
+            snprintf(dbname,sizeof(dbname),"db.%zd",mh->db[j].dbid);
+            addReplyBulkCString(c,dbname);
+            addReplyMultiBulkLen(c,4);
+
+            addReplyBulkCString(c,"overhead.hashtable.main");
+            addReplyLongLong(c,mh->db[j].overhead_ht_main);
+
+            addReplyBulkCString(c,"overhead.hashtable.expires");
+            addReplyLongLong(c,mh->db[j].overhead_ht_expires);
+        }
+
+        addReplyBulkCString(c,"overhead.total");
+        addReplyLongLong(c,mh->overhead_total);
+
+        addReplyBulkCString(c,"keys.count");
+        addReplyLongLong(c,mh->total_keys);
+
+        addReplyBulkCString(c,"keys.bytes-per-key");
+        addReplyLongLong(c,mh->bytes_per_key);
+
+        addReplyBulkCString(c,"dataset.bytes");
+        addReplyLongLong(c,mh->dataset);
+
+        addReplyBulkCString(c,"dataset.percentage");
+        addReplyDouble(c,mh->dataset_perc);
+
+        addReplyBulkCString(c,"peak.percentage");
+        addReplyDouble(c,mh->peak_perc);
+
+        addReplyBulkCString(c,"fragmentation");
+        addReplyDouble(c,mh->fragmentation);
+
+        freeMemoryOverheadData(mh);
+    } else if (!strcasecmp(c->argv[1]->ptr,"malloc-stats") && c->argc == 2) {
+#if defined(USE_JEMALLOC)
+        sds info = sdsempty();
+        je_malloc_stats_print(inputCatSds, &info, NULL);
+        addReplyBulkCBuffer(c,info,sdslen(info));
+        sdsfree(info);
+#else
+        addReplyBulkCString(c,"Stats not supported for the current allocator");
+#endif
+    } else if (!strcasecmp(c->argv[1]->ptr,"doctor") && c->argc == 2) {
+        sds report = getMemoryDoctorReport();
+        addReplyBulkCBuffer(c,report,sdslen(report));
+        sdsfree(report);
+    } else if (!strcasecmp(c->argv[1]->ptr,"purge") && c->argc == 2) {
+#if defined(USE_JEMALLOC)
+        char tmp[32];
+        unsigned narenas = 0;
+        size_t sz = sizeof(unsigned);
+        if (!je_mallctl("arenas.narenas", &narenas, &sz, NULL, 0)) {
+            sprintf(tmp, "arena.%d.purge", narenas);
+            if (!je_mallctl(tmp, NULL, 0, NULL, 0)) {
+                addReply(c, shared.ok);
+                return;
+            }
+        }
+        addReplyError(c, "Error purging dirty pages");
+#else
+        addReply(c, shared.ok);
+        /* Nothing to do for other allocators. */
+#endif
     } else {
-        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime)");
+        addReplyError(c,"Syntax error. Try MEMORY (usage <key> [SAMPLES <count>]|stats|doctor|malloc-stats|purge)");
     }
 }
@@ -33,6 +33,84 @@
  * Pubsub low level API
  *----------------------------------------------------------------------------*/
 
+/* Emit the header of a Pub/Sub message or (un)subscribe confirmation of
+ * 'len' elements. With RESP3 they are push data, so that the client can
+ * tell them apart from the replies to the commands it sends meanwhile. */
+static void addReplyPubsubLen(redisClient *c, int len) {
+    if (c->resp == 2)
+        addReply(c,shared.mbulkhdr[len]);
+    else
+        addReplyPushLen(c,len);
+}
+
+/* Number of subscriptions reported to the client in (un)subscribe
+ * confirmations. Shard channels are counted on their own, like the
+ * SSUBSCRIBE family is a separate namespace. */
+static long pubsubSubscriptionCount(redisClient *c, int shard) {
+    if (shard) return dictSize(c->pubsubshard_channels);
+    return dictSize(c->pubsub_channels)+listLength(c->pubsub_patterns);
+}
+
+/* Return the total number of channels, patterns and shard channels the
+ * client is subscribed to: a RESP2 client with any of them is in the
+ * Pub/Sub context. */
+int clientSubscriptionsCount(redisClient *c) {
+    return dictSize(c->pubsub_channels)+listLength(c->pubsub_patterns)+
+           dictSize(c->pubsubshard_channels);
+}
+
+/* -----------------------------------------------------------------------------
+ * Pattern index
+ *
+ * A channel can only match a pattern if it starts with the literal part of
+ * the pattern before the first glob character. server.pubsub_patterns_index
+ * maps every such prefix to the list of pubsubPattern structures sharing
+ * it, so publishing only runs stringmatchlen() against the patterns whose
+ * prefix is a prefix of the channel, instead of against every pattern.
+ *
+ * 只有前缀命中的模式才需要真正执行 stringmatchlen() 。
+ * -------------------------------------------------------------------------- */
+
+/* Length of the literal prefix of a glob-style pattern. A backslash also
+ * ends the prefix, the escaped character is left to stringmatchlen(). */
+static size_t pubsubPatternPrefixLen(sds pattern) {
+    size_t j, len = sdslen(pattern);
+
+    for (j = 0; j < len; j++) {
+        char ch = pattern[j];
+        if (ch == '*' || ch == '?' || ch == '[' || ch == '\\') break;
+    }
+    return j;
+}
+
+static void pubsubPatternIndexAdd(pubsubPattern *pat) {
+    sds p = pat->pattern->ptr;
+    size_t plen = pubsubPatternPrefixLen(p);
+    list *l = raxFind(server.pubsub_patterns_index,(unsigned char*)p,plen);
+
+    if (l == raxNotFound) {
+        l = listCreate();
+        raxInsert(server.pubsub_patterns_index,(unsigned char*)p,plen,l,NULL);
+    }
+    listAddNodeTail(l,pat);
+}
+
+static void pubsubPatternIndexDel(pubsubPattern *pat) {
+    sds p = pat->pattern->ptr;
+    size_t plen = pubsubPatternPrefixLen(p);
+    list *l = raxFind(server.pubsub_patterns_index,(unsigned char*)p,plen);
+    listNode *ln;
+
+    redisAssert(l != raxNotFound);
+    ln = listSearchKey(l,pat);
+    redisAssert(ln != NULL);
+    listDelNode(l,ln);
+    if (listLength(l) == 0) {
+        listRelease(l);
+        raxRemove(server.pubsub_patterns_index,(unsigned char*)p,plen,NULL);
+    }
+}
+
 /*
  * 释放给定的模式 p
  */
@@ -59,9 +137,17 @@ int listMatchPubsubPattern(void *a, void *b) {
  * 设置客户端 c 订阅频道 channel 。
  *
  * 订阅成功返回 1 ，如果客户端已经订阅了该频道，那么返回 0 。
- */
+ *
+ * When 'shard' is true the channel is a shard channel (SSUBSCRIBE), kept
+ * in its own dictionaries. */
 // robj *channel, channel 名字的字符串
-int pubsubSubscribeChannel(redisClient *c, robj *channel) {
+static int pubsubSubscribeChannelGeneric(redisClient *c, robj *channel,
+                                         int shard)
+{
+    dict *client_channels = shard ? c->pubsubshard_channels :
+                                    c->pubsub_channels;
+    dict *server_channels = shard ? server.pubsubshard_channels :
+                                    server.pubsub_channels;
     dictEntry *de;
     list *clients = NULL;
     int retval = 0;
@@ -69,7 +155,7 @@ int pubsubSubscribeChannel(redisClient *c, robj *channel) {
     /* Add the channel to the client -> channels hash table */
     // 将 channels 填接到 c->pubsub_channels 的集合中（值为 NULL 的字典视为集合）
     // c->pubsub_channels 用来给这个 client 对已订阅 channel 进行去重的 set
-    if (dictAdd(c->pubsub_channels,channel,NULL) == DICT_OK) {
+    if (dictAdd(client_channels,channel,NULL) == DICT_OK) {
         retval = 1;
         incrRefCount(channel);
 
@@ -83,10 +169,10 @@ int pubsubSubscribeChannel(redisClient *c, robj *channel) {
         /* Add the client to the channel -> list of clients hash table */
         // 从 pubsub_channels 字典中取出保存着所有订阅了 channel 的客户端的链表
         // 如果 channel 不存在于字典，那么添加进去
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(server_channels,channel);
         if (de == NULL) {
             clients = listCreate();
-            dictAdd(server.pubsub_channels,channel,clients);
+            dictAdd(server_channels,channel,clients);
             incrRefCount(channel);
         } else {
             clients = dictGetVal(de);
@@ -108,17 +194,21 @@ int pubsubSubscribeChannel(redisClient *c, robj *channel) {
     // 1) "subscribe"
     // 2) "xxx"
     // 3) (integer) 1
-    addReply(c,shared.mbulkhdr[3]);
+    addReplyPubsubLen(c,3);
     // "subscribe\n" 字符串
-    addReply(c,shared.subscribebulk);
+    addReply(c,shard ? shared.ssubscribebulk : shared.subscribebulk);
     // 被订阅的客户端
     addReplyBulk(c,channel);
     // 客户端订阅的频道和模式总数
-    addReplyLongLong(c,dictSize(c->pubsub_channels)+listLength(c->pubsub_patterns));
+    addReplyLongLong(c,pubsubSubscriptionCount(c,shard));
 
     return retval;
 }
 
+int pubsubSubscribeChannel(redisClient *c, robj *channel) {
+    return pubsubSubscribeChannelGeneric(c,channel,0);
+}
+
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. 
  *
@@ -127,7 +217,13 @@ int pubsubSubscribeChannel(redisClient *c, robj *channel) {
  * 如果取消成功返回 1 ，如果因为客户端未订阅频道，而造成取消失败，返回 0 。
  */
 // notify == 0\1 取决于 redis-cli 是主动退订 channel(使用 Unsubscribe 命令)，还是被动退订 channel(整个 redis-cli 都退出了)
-int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
+static int pubsubUnsubscribeChannelGeneric(redisClient *c, robj *channel,
+                                           int notify, int shard)
+{
+    dict *client_channels = shard ? c->pubsubshard_channels :
+                                    c->pubsub_channels;
+    dict *server_channels = shard ? server.pubsubshard_channels :
+                                    server.pubsub_channels;
     dictEntry *de;
     list *clients;
     listNode *ln;
@@ -149,7 +245,7 @@ int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
     //  'channel-x': NULL,
     //  'channel-z': NULL,
     // }
-    if (dictDelete(c->pubsub_channels,channel) == DICT_OK) {
+    if (dictDelete(client_channels,channel) == DICT_OK) {
 
         // channel 移除成功，表示客户端订阅了这个频道，执行以下代码
 
@@ -165,7 +261,7 @@ int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
         // {
         //  'channel-x' : [c1, c3]
         // }
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(server_channels,channel);
         redisAssertWithInfo(c,NULL,de != NULL);
         clients = dictGetVal(de);
         ln = listSearchKey(clients,c);
@@ -187,7 +283,7 @@ int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
             /* Free the list and associated hash entry at all if this was
              * the latest client, so that it will be possible to abuse
              * Redis PUBSUB creating millions of channels. */
-            dictDelete(server.pubsub_channels,channel);
+            dictDelete(server_channels,channel);
         }
     }
 
@@ -196,14 +292,13 @@ int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
     // 进入这个 if 分支，一般是客户端依然存在，并没有退出
     // 所以采用通知这个 redis-cli
     if (notify) {
-        addReply(c,shared.mbulkhdr[3]);
+        addReplyPubsubLen(c,3);
         // "ubsubscribe" 字符串
-        addReply(c,shared.unsubscribebulk);
+        addReply(c,shard ? shared.sunsubscribebulk : shared.unsubscribebulk);
         // 被退订的频道
         addReplyBulk(c,channel);
         // 退订频道之后客户端仍在订阅的频道和模式的总数
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
+        addReplyLongLong(c,pubsubSubscriptionCount(c,shard));
 
     }
 
@@ -212,6 +307,10 @@ int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
     return retval;
 }
 
+int pubsubUnsubscribeChannel(redisClient *c, robj *channel, int notify) {
+    return pubsubUnsubscribeChannelGeneric(c,channel,notify,0);
+}
+
 /* Subscribe a client to a pattern. Returns 1 if the operation succeeded,
  * or 0 if the client was already subscribed to that pattern.
  *
@@ -247,6 +346,7 @@ int pubsubSubscribePattern(redisClient *c, robj *pattern) {
 
         // 添加到末尾
         listAddNodeTail(server.pubsub_patterns,pat);
+        pubsubPatternIndexAdd(pat);
     }
 
     /* Notify the client */
@@ -257,7 +357,7 @@ int pubsubSubscribePattern(redisClient *c, robj *pattern) {
     // 1) "psubscribe"
     // 2) "xxx*"
     // 3) (integer) 1
-    addReply(c,shared.mbulkhdr[3]);
+    addReplyPubsubLen(c,3);
     // 回复 "psubscribe" 字符串
     addReply(c,shared.psubscribebulk);
     // 回复被订阅的模式
@@ -296,13 +396,14 @@ int pubsubUnsubscribePattern(redisClient *c, robj *pattern, int notify) {
 
         // 在服务器中查找
         ln = listSearchKey(server.pubsub_patterns,&pat);
+        pubsubPatternIndexDel(listNodeValue(ln));
         listDelNode(server.pubsub_patterns,ln);
     }
 
     /* Notify the client */
     // 回复客户端
     if (notify) {
-        addReply(c,shared.mbulkhdr[3]);
+        addReplyPubsubLen(c,3);
         // "punsubscribe" 字符串
         addReply(c,shared.punsubscribebulk);
         // 被退订的模式
@@ -324,10 +425,13 @@ int pubsubUnsubscribePattern(redisClient *c, robj *pattern, int notify) {
  *
  * 返回被退订频道的总数。
  */
-int pubsubUnsubscribeAllChannels(redisClient *c, int notify) {
+static int pubsubUnsubscribeAllChannelsGeneric(redisClient *c, int notify,
+                                               int shard)
+{
 
     // 频道迭代器
-    dictIterator *di = dictGetSafeIterator(c->pubsub_channels);
+    dictIterator *di = dictGetSafeIterator(shard ? c->pubsubshard_channels :
+                                                   c->pubsub_channels);
     dictEntry *de;
     int count = 0;
 
@@ -335,18 +439,17 @@ int pubsubUnsubscribeAllChannels(redisClient *c, int notify) {
     while((de = dictNext(di)) != NULL) {
         robj *channel = dictGetKey(de);
 
-        count += pubsubUnsubscribeChannel(c,channel,notify);
+        count += pubsubUnsubscribeChannelGeneric(c,channel,notify,shard);
     }
 
     /* We were subscribed to nothing? Still reply to the client. */
     // 如果在执行这个函数时，客户端没有订阅任何频道，
     // 那么向客户端发送回复
     if (notify && count == 0) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.unsubscribebulk);
-        addReply(c,shared.nullbulk);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
+        addReplyPubsubLen(c,3);
+        addReply(c,shard ? shared.sunsubscribebulk : shared.unsubscribebulk);
+        addReplyNull(c);
+        addReplyLongLong(c,pubsubSubscriptionCount(c,shard));
     }
 
     dictReleaseIterator(di);
@@ -355,6 +458,32 @@ int pubsubUnsubscribeAllChannels(redisClient *c, int notify) {
     return count;
 }
 
+int pubsubUnsubscribeAllChannels(redisClient *c, int notify) {
+    return pubsubUnsubscribeAllChannelsGeneric(c,notify,0);
+}
+
+int pubsubUnsubscribeShardAllChannels(redisClient *c, int notify) {
+    return pubsubUnsubscribeAllChannelsGeneric(c,notify,1);
+}
+
+/* Unsubscribe every client from the shard channel 'channel', notifying
+ * them with a SUNSUBSCRIBE message. Used in cluster mode when this node
+ * stops serving the slot of the channel, so that clients resubscribe
+ * against the new owner. */
+void pubsubShardUnsubscribeAllClients(robj *channel) {
+    dictEntry *de;
+
+    incrRefCount(channel);
+    // 链表在最后一个订阅者退订时会被释放，所以每次都重新查找
+    while ((de = dictFind(server.pubsubshard_channels,channel)) != NULL) {
+        list *clients = dictGetVal(de);
+        redisClient *c = listNodeValue(listFirst(clients));
+
+        pubsubUnsubscribeChannelGeneric(c,channel,1,1);
+    }
+    decrRefCount(channel);
+}
+
 /* Unsubscribe from all the patterns. Return the number of patterns the
  * client was subscribed from. 
  *
@@ -380,9 +509,9 @@ int pubsubUnsubscribeAllPatterns(redisClient *c, int notify) {
     // 那么向客户端发送回复
     if (notify && count == 0) {
         /* We were subscribed to nothing? Still reply to the client. */
-        addReply(c,shared.mbulkhdr[3]);
+        addReplyPubsubLen(c,3);
         addReply(c,shared.punsubscribebulk);
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
         addReplyLongLong(c,dictSize(c->pubsub_channels)+
                        listLength(c->pubsub_patterns));
     }
@@ -391,21 +520,18 @@ int pubsubUnsubscribeAllPatterns(redisClient *c, int notify) {
     return count;
 }
 
-/* Publish a message 
- *
- * 将 message 发送到所有订阅频道 channel 的客户端，
- * 以及所有订阅了和 channel 频道匹配的模式的客户端。
- */
-int pubsubPublishMessage(robj *channel, robj *message) {
+/* Send 'message' to the clients subscribed to exactly 'channel' in the
+ * 'channels' dictionary, using 'msgbulk' as message type. Returns the
+ * number of receivers. */
+static int pubsubDeliverToChannel(dict *channels, robj *channel,
+                                  robj *message, robj *msgbulk)
+{
     int receivers = 0;
     dictEntry *de;
-    listNode *ln;
-    listIter li;
 
-    /* Send to clients listening for that channel */
     // 取出包含所有订阅频道 channel 的客户端的链表
     // 并将消息发送给它们
-    de = dictFind(server.pubsub_channels,channel);
+    de = dictFind(channels,channel);
     if (de) {
         list *list = dictGetVal(de);
         listNode *ln;
@@ -421,11 +547,11 @@ int pubsubPublishMessage(robj *channel, robj *message) {
             // 1) "message"
             // 2) "channel-name"
             // 3) "message-string"
-            addReply(c,shared.mbulkhdr[3]);
+            addReplyPubsubLen(c,3);
             // "message" 字符串
-            addReply(c,shared.messagebulk);
-            // 消息的来源频道
-            addReplyBulk(c,channel);
+            addReply(c,msgbulk);
+            // 消息的来源频道（总是复制，频道对象可能分配在栈上）
+            addReplyBulkCBuffer(c,channel->ptr,sdslen(channel->ptr));
             // 消息内容
             addReplyBulk(c,message);
 
@@ -433,41 +559,70 @@ int pubsubPublishMessage(robj *channel, robj *message) {
             receivers++;
         }
     }
+    return receivers;
+}
+
+/* Publish a message 
+ *
+ * 将 message 发送到所有订阅频道 channel 的客户端，
+ * 以及所有订阅了和 channel 频道匹配的模式的客户端。
+ */
+int pubsubPublishMessage(robj *channel, robj *message) {
+    int receivers = 0;
+    listNode *ln;
+    listIter li;
+
+    /* Send to clients listening for that channel */
+    receivers += pubsubDeliverToChannel(server.pubsub_channels,channel,
+                                        message,shared.messagebulk);
 
     /* Send to clients listening to matching channels */
     // 将消息也发送给那些和频道匹配的模式
     if (listLength(server.pubsub_patterns)) {
+        size_t chlen, j;
 
-        // 遍历模式链表
-        listRewind(server.pubsub_patterns,&li);
         channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-
-            // 取出 pubsubPattern
-            pubsubPattern *pat = ln->value;
-
-            // 如果 channel 和 pattern 匹配
-            // 就给所有订阅该 pattern 的客户端发送消息
-            // 这个匹配本身就是 O(n) 的复杂度，而且里面类似正则的匹配也很花时间，所以不建议有太多这样的 pattern channel
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
-
-                // 回复客户端
-                // 示例：
-                // 1) "pmessage"
-                // 2) "*"
-                // 3) "xxx"
-                // 4) "hello"
-                addReply(pat->client,shared.mbulkhdr[4]);
-                addReply(pat->client,shared.pmessagebulk);
-                addReplyBulk(pat->client,pat->pattern);
-                addReplyBulk(pat->client,channel);
-                addReplyBulk(pat->client,message);
-
-                // 对接收消息的客户端进行计数
-                receivers++;
+        chlen = sdslen(channel->ptr);
+
+        // 只检查字面前缀是 channel 前缀的那些模式
+        for (j = 0; j <= chlen; j++) {
+            list *candidates = raxFind(server.pubsub_patterns_index,
+                                       (unsigned char*)channel->ptr,j);
+            if (candidates == raxNotFound) continue;
+
+            // 遍历模式链表
+            listRewind(candidates,&li);
+            while ((ln = listNext(&li)) != NULL) {
+
+                // 取出 pubsubPattern
+                pubsubPattern *pat = ln->value;
+
+                // 如果 channel 和 pattern 匹配
+                // 就给所有订阅该 pattern 的客户端发送消息
+                // 这个匹配本身就是 O(n) 的复杂度，而且里面类似正则的匹配也很花时间，所以不建议有太多这样的 pattern channel
+                server.stat_pubsub_pattern_checks++;
+                if (stringmatchlen((char*)pat->pattern->ptr,
+                                    sdslen(pat->pattern->ptr),
+                                    (char*)channel->ptr,
+                                    sdslen(channel->ptr),0)) {
+
+                    // 回复客户端
+                    // 示例：
+                    // 1) "pmessage"
+                    // 2) "*"
+                    // 3) "xxx"
+                    // 4) "hello"
+                    addReplyPubsubLen(pat->client,4);
+                    addReply(pat->client,shared.pmessagebulk);
+                    addReplyBulk(pat->client,pat->pattern);
+                    addReplyBulkCBuffer(pat->client,channel->ptr,
+                                        sdslen(channel->ptr));
+                    addReplyBulk(pat->client,message);
+
+                    // 对接收消息的客户端进行计数
+                    server.stat_pubsub_pattern_matches++;
+                    receivers++;
+                }
             }
         }
 
@@ -478,6 +633,43 @@ int pubsubPublishMessage(robj *channel, robj *message) {
     return receivers;
 }
 
+/* Return 1 if publishing to 'channel' would reach at least one client,
+ * either subscribed to the channel itself or to a matching pattern. Used
+ * by keyspace notifications to avoid creating the message when nobody
+ * listens. */
+int pubsubChannelHasSubscribers(robj *channel) {
+    listNode *ln;
+    listIter li;
+    size_t chlen, j;
+
+    if (dictFind(server.pubsub_channels,channel) != NULL) return 1;
+    if (listLength(server.pubsub_patterns) == 0) return 0;
+
+    chlen = sdslen(channel->ptr);
+    for (j = 0; j <= chlen; j++) {
+        list *candidates = raxFind(server.pubsub_patterns_index,
+                                   (unsigned char*)channel->ptr,j);
+        if (candidates == raxNotFound) continue;
+
+        listRewind(candidates,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            pubsubPattern *pat = ln->value;
+
+            if (stringmatchlen((char*)pat->pattern->ptr,
+                               sdslen(pat->pattern->ptr),
+                               (char*)channel->ptr,chlen,0)) return 1;
+        }
+    }
+    return 0;
+}
+
+/* Publish a message to the subscribers of a shard channel. Shard channels
+ * have no pattern subscriptions. */
+int pubsubPublishShardMessage(robj *channel, robj *message) {
+    return pubsubDeliverToChannel(server.pubsubshard_channels,channel,
+                                  message,shared.smessagebulk);
+}
+
 /*-----------------------------------------------------------------------------
  * Pubsub commands implementation
  *----------------------------------------------------------------------------*/
@@ -565,6 +757,42 @@ void punsubscribeCommand(redisClient *c) {
     }
 }
 
+/* Shard channels: SSUBSCRIBE / SUNSUBSCRIBE / SPUBLISH.
+ *
+ * In cluster mode a shard channel is routed like a key, using the hash
+ * slot of its name, and a message is only delivered inside the shard
+ * serving that slot: the master executes SPUBLISH and the replication link
+ * carries it to its replicas, instead of broadcasting it to every node of
+ * the cluster bus like PUBLISH does. Subscribers can use the master or any
+ * of its replicas. Outside cluster mode they behave like regular channels
+ * in their own namespace.
+ *
+ * 分片频道按频道名的哈希槽路由，消息只在负责该槽的主从节点之间传递。 */
+void ssubscribeCommand(redisClient *c) {
+    int j;
+
+    for (j = 1; j < c->argc; j++)
+        pubsubSubscribeChannelGeneric(c,c->argv[j],1);
+}
+
+void sunsubscribeCommand(redisClient *c) {
+    if (c->argc == 1) {
+        pubsubUnsubscribeShardAllChannels(c,1);
+    } else {
+        int j;
+
+        for (j = 1; j < c->argc; j++)
+            pubsubUnsubscribeChannelGeneric(c,c->argv[j],1,1);
+    }
+}
+
+void spublishCommand(redisClient *c) {
+    int receivers = pubsubPublishShardMessage(c->argv[1],c->argv[2]);
+
+    forceCommandPropagation(c,REDIS_PROPAGATE_REPL);
+    addReplyLongLong(c,receivers);
+}
+
 void publishCommand(redisClient *c) {
 
     int receivers = pubsubPublishMessage(c->argv[1],c->argv[2]);    // channel-name, message
@@ -579,10 +807,14 @@ void publishCommand(redisClient *c) {
 void pubsubCommand(redisClient *c) {
 
     // PUBSUB CHANNELS [pattern] 子命令
-    if (!strcasecmp(c->argv[1]->ptr,"channels") &&
+    if ((!strcasecmp(c->argv[1]->ptr,"channels") ||
+         !strcasecmp(c->argv[1]->ptr,"shardchannels")) &&
         (c->argc == 2 || c->argc ==3))
     {
-        /* PUBSUB CHANNELS [<pattern>] */
+        /* PUBSUB CHANNELS [<pattern>]
+         * PUBSUB SHARDCHANNELS [<pattern>] */
+        dict *channels = !strcasecmp(c->argv[1]->ptr,"channels") ?
+                         server.pubsub_channels : server.pubsubshard_channels;
         // 检查命令请求是否给定了 pattern 参数
         // 如果没有给定的话，就设为 NULL
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
@@ -590,7 +822,7 @@ void pubsubCommand(redisClient *c) {
         // 创建 pubsub_channels 的字典迭代器
         // 该字典的键为频道，值为链表
         // 链表中保存了所有订阅键所对应的频道的客户端
-        dictIterator *di = dictGetIterator(server.pubsub_channels);
+        dictIterator *di = dictGetIterator(channels);
         dictEntry *de;
         long mblen = 0;
         void *replylen;
@@ -622,8 +854,12 @@ void pubsubCommand(redisClient *c) {
         setDeferredMultiBulkLength(c,replylen,mblen);
 
     // PUBSUB NUMSUB [channel-1 channel-2 ... channel-N] 子命令
-    } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
-        /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
+    } else if ((!strcasecmp(c->argv[1]->ptr,"numsub") ||
+                !strcasecmp(c->argv[1]->ptr,"shardnumsub")) && c->argc >= 2) {
+        /* PUBSUB NUMSUB [Channel_1 ... Channel_N]
+         * PUBSUB SHARDNUMSUB [Channel_1 ... Channel_N] */
+        dict *channels = !strcasecmp(c->argv[1]->ptr,"numsub") ?
+                         server.pubsub_channels : server.pubsubshard_channels;
         int j;
 
         addReplyMultiBulkLen(c,(c->argc-2)*2);
@@ -633,7 +869,7 @@ void pubsubCommand(redisClient *c) {
             // pubsub_channels 的字典为频道名字
             // 而值则是保存了 c->argv[j] 频道所有订阅者的链表
             // 而调用 dictFetchValue 也就是取出所有订阅给定频道的客户端
-            list *l = dictFetchValue(server.pubsub_channels,c->argv[j]);
+            list *l = dictFetchValue(channels,c->argv[j]);
 
             addReplyBulk(c,c->argv[j]);
             // 向客户端返回链表的长度属性
@@ -0,0 +1,1469 @@
+/* quicklist.c - A generic doubly linked list of listpacks
+ *
+ * A quicklist is a doubly linked list where every node holds a listpack of
+ * bounded size. It combines the memory efficiency of the listpack (no
+ * per-element pointers, no robj and sds headers) with the O(1) push and pop
+ * at both ends of a linked list, without ever paying the cost of
+ * reallocating a huge single listpack on every write.
+ *
+ * 快速列表：由 listpack 组成的双端链表，每个 listpack 的大小都是受限的
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h> /* for memcpy */
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "ziplist.h"
+#include "listpack.h"
+#include "util.h"
+#include "lzf.h"
+#include "redisassert.h"
+
+/* Optimization levels for size-based filling, selected by negative fill
+ * factors: -1 means 4k max listpack size, -2 means 8k, and so on. */
+static const size_t optimization_level[] = { 4096, 8192, 16384, 32768, 65536 };
+
+/* Maximum size in bytes of any multi-element listpack when the fill factor
+ * is a count of entries. Larger values will live in their own isolated
+ * listpacks. */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* Minimum listpack size in bytes for attempting a merge of two nodes. */
+#define MIN_MERGE_SIZE 7 /* Header plus terminator of an empty listpack. */
+
+/* Node count and compress depth are 16 bit fields. */
+#define COUNT_MAX ((1 << 16) - 1)
+#define FILL_MAX (1 << 15)
+#define COMPRESS_MAX (1 << 16)
+
+/* Nodes smaller than this are never compressed, and a compressed listpack
+ * must save at least MIN_COMPRESS_IMPROVE bytes to be kept. */
+#define MIN_COMPRESS_BYTES 48
+#define MIN_COMPRESS_IMPROVE 8
+
+/* Every modification of a node resets 'attempted_compress', so that a
+ * node that failed to compress is tried again only after it changed. */
+#define quicklistNodeUpdateSz(node)                                            \
+    do {                                                                       \
+        (node)->sz = lpBytes((node)->zl);                                      \
+        (node)->attempted_compress = 0;                                        \
+    } while (0)
+
+#define initEntry(e)                                                           \
+    do {                                                                       \
+        (e)->zi = (e)->value = NULL;                                           \
+        (e)->longval = -123456789;                                             \
+        (e)->quicklist = NULL;                                                 \
+        (e)->node = NULL;                                                      \
+        (e)->offset = 123456789;                                               \
+        (e)->sz = 0;                                                           \
+    } while (0)
+
+/*-----------------------------------------------------------------------------
+ * Nodes and quicklist creation / destruction
+ *----------------------------------------------------------------------------*/
+
+/* Create a new quicklist.
+ * Free with quicklistRelease().
+ *
+ * 创建一个新的空 quicklist，fill 默认为 -2（每个 listpack 最多 8kb）
+ */
+quicklist *quicklistCreate(void) {
+    struct quicklist *quicklist;
+
+    quicklist = zmalloc(sizeof(*quicklist));
+    quicklist->head = quicklist->tail = NULL;
+    quicklist->len = 0;
+    quicklist->count = 0;
+    quicklist->compress = 0;
+    quicklist->fill = -2;
+    return quicklist;
+}
+
+/* Set the number of nodes at each end of the list that are never
+ * compressed. A 'depth' of 0 disables compression.
+ *
+ * 设置 quicklist 两端不被压缩的节点数量， 0 表示关闭压缩
+ */
+void quicklistSetCompressDepth(quicklist *quicklist, int depth) {
+    if (depth > COMPRESS_MAX) {
+        depth = COMPRESS_MAX;
+    } else if (depth < 0) {
+        depth = 0;
+    }
+    quicklist->compress = depth;
+}
+
+/* Set the fill factor of the listpacks of the quicklist.
+ *
+ * A positive 'fill' is the maximum number of entries per node, a negative
+ * 'fill' in the -1..-5 range selects a maximum size in bytes per node, see
+ * optimization_level[]. */
+void quicklistSetFill(quicklist *quicklist, int fill) {
+    if (fill > FILL_MAX) {
+        fill = FILL_MAX;
+    } else if (fill < -5) {
+        fill = -5;
+    } else if (fill == 0) {
+        fill = 1;
+    }
+    quicklist->fill = fill;
+}
+
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
+    quicklistSetFill(quicklist, fill);
+    quicklistSetCompressDepth(quicklist, depth);
+}
+
+/* Create a new quicklist with the specified fill factor and compress
+ * depth. */
+quicklist *quicklistNew(int fill, int compress) {
+    quicklist *quicklist = quicklistCreate();
+    quicklistSetOptions(quicklist, fill, compress);
+    return quicklist;
+}
+
+static quicklistNode *quicklistCreateNode(void) {
+    quicklistNode *node;
+    node = zmalloc(sizeof(*node));
+    node->zl = NULL;
+    node->count = 0;
+    node->sz = 0;
+    node->next = node->prev = NULL;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    node->recompress = 0;
+    node->attempted_compress = 0;
+    node->extra = 0;
+    return node;
+}
+
+/* Return cached quicklist count */
+unsigned long quicklistCount(const quicklist *ql) { return ql->count; }
+
+/* Free entire quicklist. */
+void quicklistRelease(quicklist *quicklist) {
+    unsigned long len;
+    quicklistNode *current, *next;
+
+    current = quicklist->head;
+    len = quicklist->len;
+    while (len--) {
+        next = current->next;
+
+        zfree(current->zl);
+        quicklist->count -= current->count;
+
+        zfree(current);
+
+        quicklist->len--;
+        current = next;
+    }
+    zfree(quicklist);
+}
+
+/*-----------------------------------------------------------------------------
+ * Node compression
+ *----------------------------------------------------------------------------*/
+
+/* Compress the listpack in 'node' and update encoding details.
+ * Returns 1 if listpack compressed successfully.
+ * Returns 0 if compression failed or if listpack too small to compress.
+ *
+ * 使用 LZF 压缩节点的 listpack
+ */
+static int __quicklistCompressNode(quicklistNode *node) {
+    quicklistLZF *lzf;
+
+    node->recompress = 0;
+
+    /* Don't bother compressing small values */
+    if (node->sz < MIN_COMPRESS_BYTES)
+        return 0;
+
+    lzf = zmalloc(sizeof(*lzf) + node->sz);
+
+    /* Cancel if compression fails or doesn't compress small enough */
+    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
+                                 node->sz)) == 0) ||
+        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+        /* lzf_compress aborts/rejects compression if value not compressable. */
+        zfree(lzf);
+        node->attempted_compress = 1;
+        return 0;
+    }
+    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    zfree(node->zl);
+    node->zl = (unsigned char *)lzf;
+    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    return 1;
+}
+
+/* Uncompress the listpack in 'node' and update encoding details.
+ *
+ * 解压节点的 listpack ，解压失败说明内存中的数据已经损坏
+ */
+static void __quicklistDecompressNode(quicklistNode *node) {
+    void *decompressed = zmalloc(node->sz);
+    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    unsigned int len;
+
+    len = lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz);
+    assert(len == node->sz);
+    zfree(lzf);
+    node->zl = decompressed;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+}
+
+/* Compress only uncompressed nodes that did not already fail to compress. */
+#define quicklistCompressNode(_node)                                           \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW &&     \
+            !(_node)->attempted_compress) {                                    \
+            __quicklistCompressNode((_node));                                  \
+        }                                                                      \
+    } while (0)
+
+/* Decompress only compressed nodes. */
+#define quicklistDecompressNode(_node)                                         \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+        }                                                                      \
+    } while (0)
+
+/* Decompress a node that has to be compressed again once we are done
+ * with it, see quicklistRecompressOnly(). */
+#define quicklistDecompressNodeForUse(_node)                                   \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+            (_node)->recompress = 1;                                           \
+        }                                                                      \
+    } while (0)
+
+/* Compress a node previously decompressed by
+ * quicklistDecompressNodeForUse(). */
+#define quicklistRecompressOnly(_node)                                         \
+    do {                                                                       \
+        if ((_node) && (_node)->recompress)                                    \
+            quicklistCompressNode((_node));                                    \
+    } while (0)
+
+/* Return the LZF data of a compressed node in 'data' and its length
+ * as return value. */
+size_t quicklistGetLzf(const quicklistNode *node, void **data) {
+    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    *data = lzf->compressed;
+    return lzf->sz;
+}
+
+/* Force 'quicklist' to meet compression guidelines set by compress depth.
+ * The only way to guarantee interior nodes get compressed is to iterate
+ * to our "interior" compress depth then compress the next node we find.
+ * If compress depth is larger than the entire list, we return immediately.
+ *
+ * 'node' is the node that was just changed (or NULL): it is compressed if
+ * it lies beyond the compress depth. The nodes inside the depth at both
+ * ends are decompressed, since deletions may have moved a compressed node
+ * there.
+ *
+ * 保证 quicklist 两端 compress 个节点都没有被压缩，并尝试压缩其余节点
+ */
+static void __quicklistCompress(const quicklist *quicklist,
+                                quicklistNode *node) {
+    quicklistNode *forward = quicklist->head;
+    quicklistNode *reverse = quicklist->tail;
+    int depth = 0;
+    int in_depth = 0;
+
+    if (quicklist->compress == 0 || quicklist->len == 0)
+        return;
+
+    /* Walk from both ends up to the compress depth, making sure every
+     * node we pass is uncompressed. */
+    while (depth++ < (int)quicklist->compress) {
+        quicklistDecompressNode(forward);
+        quicklistDecompressNode(reverse);
+
+        if (forward == node || reverse == node)
+            in_depth = 1;
+
+        /* The whole list is within the compress depth. */
+        if (forward == reverse || forward->next == reverse)
+            return;
+
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+
+    if (!in_depth)
+        quicklistCompressNode(node);
+
+    /* 'forward' and 'reverse' are now the first nodes beyond the depth,
+     * they may just have been moved there by a push. */
+    quicklistCompressNode(forward);
+    quicklistCompressNode(reverse);
+}
+
+/* Compress 'node' again if it was only decompressed to be accessed,
+ * otherwise enforce the compress depth around it. */
+#define quicklistCompress(_ql, _node)                                          \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+        else                                                                   \
+            __quicklistCompress((_ql), (_node));                               \
+    } while (0)
+
+/* Insert 'new_node' after 'old_node' if 'after' is 1.
+ * Insert 'new_node' before 'old_node' if 'after' is 0.
+ * If 'old_node' is NULL the list must be empty and 'new_node' becomes
+ * both the head and the tail of the list. */
+static void __quicklistInsertNode(quicklist *quicklist, quicklistNode *old_node,
+                                  quicklistNode *new_node, int after) {
+    if (after) {
+        new_node->prev = old_node;
+        if (old_node) {
+            new_node->next = old_node->next;
+            if (old_node->next)
+                old_node->next->prev = new_node;
+            old_node->next = new_node;
+        }
+        if (quicklist->tail == old_node)
+            quicklist->tail = new_node;
+    } else {
+        new_node->next = old_node;
+        if (old_node) {
+            new_node->prev = old_node->prev;
+            if (old_node->prev)
+                old_node->prev->next = new_node;
+            old_node->prev = new_node;
+        }
+        if (quicklist->head == old_node)
+            quicklist->head = new_node;
+    }
+    /* If this insert creates the only element so far, initialize head/tail. */
+    if (quicklist->len == 0) {
+        quicklist->head = quicklist->tail = new_node;
+    }
+    quicklist->len++;
+
+    /* The new node may have pushed its neighbours beyond the depth. */
+    __quicklistCompress(quicklist, new_node);
+}
+
+/* Wrappers for node inserting around existing node. */
+static void _quicklistInsertNodeBefore(quicklist *quicklist,
+                                       quicklistNode *old_node,
+                                       quicklistNode *new_node) {
+    __quicklistInsertNode(quicklist, old_node, new_node, 0);
+}
+
+static void _quicklistInsertNodeAfter(quicklist *quicklist,
+                                      quicklistNode *old_node,
+                                      quicklistNode *new_node) {
+    __quicklistInsertNode(quicklist, old_node, new_node, 1);
+}
+
+/* Unlink 'node' from the quicklist and free it. The entries of the node
+ * are subtracted from the quicklist count. */
+static void __quicklistDelNode(quicklist *quicklist, quicklistNode *node) {
+    if (node->next)
+        node->next->prev = node->prev;
+    if (node->prev)
+        node->prev->next = node->next;
+
+    if (node == quicklist->tail) {
+        quicklist->tail = node->prev;
+    }
+
+    if (node == quicklist->head) {
+        quicklist->head = node->next;
+    }
+
+    quicklist->count -= node->count;
+
+    zfree(node->zl);
+    zfree(node);
+    quicklist->len--;
+
+    /* Nodes previously beyond the depth may now be inside it. */
+    __quicklistCompress(quicklist, NULL);
+}
+
+/*-----------------------------------------------------------------------------
+ * Fill factor checks
+ *----------------------------------------------------------------------------*/
+
+static int _quicklistNodeSizeMeetsOptimizationRequirement(const size_t sz,
+                                                          const int fill) {
+    size_t offset;
+
+    if (fill >= 0)
+        return 0;
+
+    offset = (-fill) - 1;
+    if (offset < (sizeof(optimization_level) / sizeof(*optimization_level))) {
+        if (sz <= optimization_level[offset]) {
+            return 1;
+        } else {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+}
+
+#define sizeMeetsSafetyLimit(sz) ((sz) <= SIZE_SAFETY_LIMIT)
+
+/* Return 1 if an entry of 'sz' bytes can be added to 'node' without
+ * exceeding the fill factor, 0 otherwise.
+ *
+ * 判断 node 是否还能够容纳一个长度为 sz 的新元素
+ */
+static int _quicklistNodeAllowInsert(const quicklistNode *node, const int fill,
+                                     const size_t sz) {
+    int lp_overhead;
+    size_t new_sz;
+
+    if (node == NULL)
+        return 0;
+
+    /* size of the encoding header */
+    if (sz < 64)
+        lp_overhead = 1;
+    else if (sz < 4096)
+        lp_overhead = 2;
+    else
+        lp_overhead = 5;
+
+    /* size of the backlen, the length of the entry itself */
+    if (sz + lp_overhead <= 127)
+        lp_overhead += 1;
+    else if (sz + lp_overhead < 16383)
+        lp_overhead += 2;
+    else
+        lp_overhead += 5;
+
+    /* new_sz overestimates if 'sz' encodes to an integer type */
+    new_sz = node->sz + sz + lp_overhead;
+    if (node->count >= COUNT_MAX)
+        return 0;
+    else if (_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill))
+        return 1;
+    else if (!sizeMeetsSafetyLimit(new_sz))
+        return 0;
+    else if ((int)node->count < fill)
+        return 1;
+    else
+        return 0;
+}
+
+/* Return 1 if the entries of 'a' and 'b' fit in a single node. */
+static int _quicklistNodeAllowMerge(const quicklistNode *a,
+                                    const quicklistNode *b,
+                                    const int fill) {
+    size_t merge_sz;
+
+    if (!a || !b)
+        return 0;
+
+    /* approximate merged listpack size (- header and terminator of 'b') */
+    merge_sz = a->sz + b->sz - MIN_MERGE_SIZE;
+    if ((unsigned int)a->count + b->count > COUNT_MAX)
+        return 0;
+    else if (_quicklistNodeSizeMeetsOptimizationRequirement(merge_sz, fill))
+        return 1;
+    else if (!sizeMeetsSafetyLimit(merge_sz))
+        return 0;
+    else if ((int)(a->count + b->count) <= fill)
+        return 1;
+    else
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Push and append
+ *----------------------------------------------------------------------------*/
+
+/* Add new entry to head node of quicklist.
+ *
+ * Returns 0 if used existing head.
+ * Returns 1 if new head created. */
+int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_head = quicklist->head;
+
+    if (_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)) {
+        quicklist->head->zl = lpPrepend(quicklist->head->zl, value, sz);
+        quicklistNodeUpdateSz(quicklist->head);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->zl = lpPrepend(lpNew(), value, sz);
+
+        quicklistNodeUpdateSz(node);
+        _quicklistInsertNodeBefore(quicklist, quicklist->head, node);
+    }
+    quicklist->count++;
+    quicklist->head->count++;
+    return (orig_head != quicklist->head);
+}
+
+/* Add new entry to tail node of quicklist.
+ *
+ * Returns 0 if used existing tail.
+ * Returns 1 if new tail created. */
+int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_tail = quicklist->tail;
+
+    if (_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz)) {
+        quicklist->tail->zl = lpAppend(quicklist->tail->zl, value, sz);
+        quicklistNodeUpdateSz(quicklist->tail);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->zl = lpAppend(lpNew(), value, sz);
+
+        quicklistNodeUpdateSz(node);
+        _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+    }
+    quicklist->count++;
+    quicklist->tail->count++;
+    return (orig_tail != quicklist->tail);
+}
+
+/* Wrapper to allow argument-based switching between HEAD/TAIL pop */
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
+                   int where) {
+    if (where == QUICKLIST_HEAD) {
+        quicklistPushHead(quicklist, value, sz);
+    } else if (where == QUICKLIST_TAIL) {
+        quicklistPushTail(quicklist, value, sz);
+    }
+}
+
+/* Create new node consisting of a pre-formed listpack.
+ * Used for loading RDBs where entire listpacks have been stored
+ * to be retrieved later. The quicklist takes ownership of 'lp'. */
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *lp) {
+    quicklistNode *node = quicklistCreateNode();
+
+    node->zl = lp;
+    node->count = lpLength(node->zl);
+    node->sz = lpBytes(lp);
+
+    _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+    quicklist->count += node->count;
+}
+
+/* Append all values of ziplist 'zl' individually into 'quicklist'.
+ *
+ * This allows us to restore old RDB ziplists into new quicklists
+ * with smaller ziplist sizes than the saved RDB ziplist.
+ *
+ * Returns 'quicklist' argument. Frees passed-in ziplist 'zl' */
+quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist,
+                                            unsigned char *zl) {
+    unsigned char *value;
+    unsigned int sz;
+    long long longval;
+    char longstr[32] = {0};
+
+    unsigned char *p = ziplistIndex(zl, 0);
+    while (ziplistGet(p, &value, &sz, &longval)) {
+        if (!value) {
+            /* Write the longval as a string so we can re-add it */
+            sz = ll2string(longstr, sizeof(longstr), longval);
+            value = (unsigned char *)longstr;
+        }
+        quicklistPushTail(quicklist, value, sz);
+        p = ziplistNext(zl, p);
+    }
+    zfree(zl);
+    return quicklist;
+}
+
+/* Create new (potentially multi-node) quicklist from a single existing
+ * ziplist.
+ *
+ * Returns new quicklist.  Frees passed-in ziplist 'zl'. */
+quicklist *quicklistCreateFromZiplist(int fill, int compress,
+                                      unsigned char *zl) {
+    return quicklistAppendValuesFromZiplist(quicklistNew(fill, compress), zl);
+}
+
+/*-----------------------------------------------------------------------------
+ * Deletion
+ *----------------------------------------------------------------------------*/
+
+/* Delete one entry from list given the node for the entry and a pointer
+ * to the entry in the node.
+ *
+ * Note: quicklistDelIndex() *requires* uncompressed nodes because you
+ *       already had to get *p from an uncompressed node somewhere.
+ *
+ * Returns 1 if the entire node was deleted, 0 if node still exists.
+ * Also updates in/out param 'p' with the next entry in the listpack. */
+static int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
+                             unsigned char **p) {
+    int gone = 0;
+
+    node->zl = lpDelete(node->zl, *p, p);
+    node->count--;
+    if (node->count == 0) {
+        gone = 1;
+        __quicklistDelNode(quicklist, node);
+    } else {
+        quicklistNodeUpdateSz(node);
+    }
+    quicklist->count--;
+    /* If we deleted the node, the original node is no longer valid */
+    return gone ? 1 : 0;
+}
+
+/* Delete one element represented by 'entry'
+ *
+ * 'entry' stores enough metadata to delete the proper position in
+ * the correct listpack in the correct quicklist node. The iterator is
+ * updated so that the next quicklistNext() call returns the element that
+ * followed the deleted one in the iteration direction. */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistNode *prev = entry->node->prev;
+    quicklistNode *next = entry->node->next;
+    int deleted_node = quicklistDelIndex((quicklist *)entry->quicklist,
+                                         entry->node, &entry->zi);
+
+    /* after delete, the zi is now invalid for any future usage. */
+    iter->zi = NULL;
+
+    /* If current node is deleted, we must update iterator node and offset. */
+    if (deleted_node) {
+        if (iter->direction == AL_START_HEAD) {
+            iter->current = next;
+            iter->offset = 0;
+        } else if (iter->direction == AL_START_TAIL) {
+            iter->current = prev;
+            iter->offset = -1;
+        }
+    }
+    /* else if (!deleted_node), no changes needed: iterating forward the
+     * offset is always positive and the next element slides at the very
+     * same offset, iterating backward the offset is always negative (it is
+     * counted from the tail of the listpack) and the previous element keeps
+     * its offset. If the offset is now past the end of the listpack the next
+     * call into quicklistNext() will jump to the next node. */
+}
+
+/* Delete a range of elements from the quicklist.
+ *
+ * elements may span across multiple quicklistNodes, so we
+ * have to be careful about tracking where we start and end.
+ *
+ * Returns 1 if entries were deleted, 0 if nothing was deleted. */
+int quicklistDelRange(quicklist *quicklist, const long start,
+                      const long count) {
+    quicklistEntry entry;
+    quicklistNode *node;
+    unsigned long extent = count; /* range is inclusive of start position */
+    long offset;
+
+    if (count <= 0)
+        return 0;
+
+    if (start >= 0 && extent > (quicklist->count - start)) {
+        /* if requesting delete more elements than exist, limit to list size. */
+        extent = quicklist->count - start;
+    } else if (start < 0 && extent > (unsigned long)(-start)) {
+        /* else, if at negative offset, limit max size to rest of list. */
+        extent = -start; /* c.f. LREM -29 29; just delete until end. */
+    }
+
+    if (!quicklistIndex(quicklist, start, &entry))
+        return 0;
+
+    node = entry.node;
+    offset = entry.offset;
+    if (offset < 0) offset += node->count;
+
+    /* iterate over next nodes until everything is deleted. */
+    while (extent) {
+        quicklistNode *next = node->next;
+        unsigned long del = node->count - offset;
+
+        if (del > extent) del = extent;
+
+        if (offset == 0 && del == node->count) {
+            /* If we are deleting the whole node, just unlink it. */
+            __quicklistDelNode(quicklist, node);
+        } else {
+            quicklistDecompressNodeForUse(node);
+            node->zl = lpDeleteRange(node->zl, offset, del);
+            node->count -= del;
+            quicklist->count -= del;
+            quicklistNodeUpdateSz(node);
+            quicklistCompress(quicklist, node);
+        }
+
+        extent -= del;
+        node = next;
+        offset = 0;
+    }
+    return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Insertion in the middle and replacement
+ *----------------------------------------------------------------------------*/
+
+/* Split 'node' into two parts, parameterized by 'offset' and 'after'.
+ *
+ * The 'after' argument controls which quicklistNode gets returned.
+ * If 'after'==1, returned node has elements after 'offset'.
+ *                input node keeps elements up to 'offset', including 'offset'.
+ * If 'after'==0, returned node has elements up to 'offset', including 'offset'.
+ *                input node keeps elements after 'offset'.
+ *
+ * The input node keeps all elements not taken by the returned node.
+ *
+ * Returns newly created node or NULL if split not possible. */
+static quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
+                                          int after) {
+    size_t zl_sz = node->sz;
+    quicklistNode *new_node = quicklistCreateNode();
+
+    new_node->zl = zmalloc(zl_sz);
+    /* Copy original listpack so we can split it */
+    memcpy(new_node->zl, node->zl, zl_sz);
+
+    /* -1 here means "continue deleting until the list ends" */
+    int orig_start = after ? offset + 1 : 0;
+    int orig_extent = after ? -1 : offset;
+    int new_start = after ? 0 : offset;
+    int new_extent = after ? offset + 1 : -1;
+
+    node->zl = lpDeleteRange(node->zl, orig_start, orig_extent);
+    node->count = lpLength(node->zl);
+    quicklistNodeUpdateSz(node);
+
+    new_node->zl = lpDeleteRange(new_node->zl, new_start, new_extent);
+    new_node->count = lpLength(new_node->zl);
+    quicklistNodeUpdateSz(new_node);
+
+    return new_node;
+}
+
+/* Move all the entries of 'b' inside 'a' and delete 'b' from the
+ * quicklist. The quicklist entries count does not change.
+ *
+ * 'b' must be a neighbour of 'a'. 'a' is always the node that survives,
+ * so that an iterator still pointing to it stays valid to be released. */
+static void _quicklistListpackMerge(quicklist *quicklist, quicklistNode *a,
+                                    quicklistNode *b) {
+    quicklistDecompressNode(a);
+    quicklistDecompressNode(b);
+
+    /* lpMerge() reallocates the larger listpack and frees the other one,
+     * copying the entries as they are, with two memcpy() at most. Either
+     * way the merged listpack now belongs to 'a' only. */
+    if (b == a->next)
+        a->zl = lpMerge(&a->zl, &b->zl);
+    else
+        a->zl = lpMerge(&b->zl, &a->zl);
+    b->zl = NULL;
+    a->count += b->count;
+    quicklistNodeUpdateSz(a);
+
+    /* __quicklistDelNode() subtracts the entries of the deleted node. */
+    quicklist->count += b->count;
+    __quicklistDelNode(quicklist, b);
+}
+
+/* Attempt to merge the nodes around 'center' after a node split:
+ *   - (center->prev, center)
+ *   - (center, center->next)
+ * Nodes are merged only when the result still respects the fill factor,
+ * always into 'center' so the node the caller refers to is never freed. */
+static void _quicklistMergeNodes(quicklist *quicklist, quicklistNode *center) {
+    int fill = quicklist->fill;
+    quicklistNode *prev = center->prev;
+
+    if (_quicklistNodeAllowMerge(prev, center, fill))
+        _quicklistListpackMerge(quicklist, center, prev);
+
+    if (_quicklistNodeAllowMerge(center, center->next, fill))
+        _quicklistListpackMerge(quicklist, center, center->next);
+
+    /* The merged node may be beyond the compress depth. */
+    quicklistCompress(quicklist, center);
+}
+
+/* Insert a new entry before or after existing entry 'entry'.
+ *
+ * If after==1, the new value is inserted after 'entry', otherwise
+ * the new value is inserted before 'entry'. */
+static void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
+                             void *value, const size_t sz, int after) {
+    int full = 0, at_tail = 0, at_head = 0, full_next = 0, full_prev = 0;
+    int fill = quicklist->fill;
+    quicklistNode *node = entry->node;
+    quicklistNode *new_node = NULL;
+    int offset;
+
+    if (!node) {
+        /* we have no reference node, so let's create only node in the list */
+        new_node = quicklistCreateNode();
+        new_node->zl = lpAppend(lpNew(), value, sz);
+        __quicklistInsertNode(quicklist, NULL, new_node, after);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklist->count++;
+        return;
+    }
+
+    /* The offset may be relative to the listpack tail. */
+    offset = entry->offset;
+    if (offset < 0) offset += node->count;
+
+    /* Populate accounting flags for easier boolean checks later */
+    if (!_quicklistNodeAllowInsert(node, fill, sz))
+        full = 1;
+
+    if (after && offset == (int)node->count - 1) {
+        at_tail = 1;
+        if (!_quicklistNodeAllowInsert(node->next, fill, sz))
+            full_next = 1;
+    }
+
+    if (!after && offset == 0) {
+        at_head = 1;
+        if (!_quicklistNodeAllowInsert(node->prev, fill, sz))
+            full_prev = 1;
+    }
+
+    /* Now determine where and how to insert the new element */
+    if (!full && after) {
+        node->zl = lpInsertString(node->zl, value, sz, entry->zi, LP_AFTER,
+                                  NULL);
+        node->count++;
+        quicklistNodeUpdateSz(node);
+    } else if (!full && !after) {
+        node->zl = lpInsertString(node->zl, value, sz, entry->zi, LP_BEFORE,
+                                  NULL);
+        node->count++;
+        quicklistNodeUpdateSz(node);
+    } else if (full && at_tail && node->next && !full_next && after) {
+        /* If we are: at tail, next has free space, and inserting after:
+         *   - insert entry at head of next node. */
+        new_node = node->next;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = lpPrepend(new_node->zl, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(new_node);
+    } else if (full && at_head && node->prev && !full_prev && !after) {
+        /* If we are: at head, previous has free space, and inserting before:
+         *   - insert entry at tail of previous node. */
+        new_node = node->prev;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = lpAppend(new_node->zl, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(new_node);
+    } else if (full && ((at_tail && after) || (at_head && !after))) {
+        /* If we are: full, at the edge of the node, and the neighbour is
+         * full or missing:
+         *   - create new node and attach to quicklist */
+        new_node = quicklistCreateNode();
+        new_node->zl = lpAppend(lpNew(), value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+    } else if (full) {
+        /* else, node is full we need to split it. */
+        /* covers both after and !after cases */
+        quicklistDecompressNodeForUse(node);
+        new_node = _quicklistSplitNode(node, offset, after);
+        if (after)
+            new_node->zl = lpPrepend(new_node->zl, value, sz);
+        else
+            new_node->zl = lpAppend(new_node->zl, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+        _quicklistMergeNodes(quicklist, node);
+    }
+
+    quicklist->count++;
+}
+
+void quicklistInsertBefore(quicklist *quicklist, quicklistEntry *entry,
+                           void *value, const size_t sz) {
+    _quicklistInsert(quicklist, entry, value, sz, 0);
+}
+
+void quicklistInsertAfter(quicklist *quicklist, quicklistEntry *entry,
+                          void *value, const size_t sz) {
+    _quicklistInsert(quicklist, entry, value, sz, 1);
+}
+
+/* Replace quicklist entry at offset 'index' by 'data' with length 'sz'.
+ *
+ * Returns 1 if replace happened.
+ * Returns 0 if replace failed and no changes happened. */
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
+                            int sz) {
+    quicklistEntry entry;
+
+    if (quicklistIndex(quicklist, index, &entry)) {
+        /* quicklistIndex provides an uncompressed node */
+        entry.node->zl = lpReplace(entry.node->zl, &entry.zi, data, sz);
+        quicklistNodeUpdateSz(entry.node);
+        quicklistCompress(quicklist, entry.node);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Iteration and lookup
+ *----------------------------------------------------------------------------*/
+
+/* Returns a quicklist iterator 'iter'. After the initialization every
+ * call to quicklistNext() will return the next element of the quicklist. */
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction) {
+    quicklistIter *iter;
+
+    iter = zmalloc(sizeof(*iter));
+
+    if (direction == AL_START_HEAD) {
+        iter->current = quicklist->head;
+        iter->offset = 0;
+    } else {
+        iter->current = quicklist->tail;
+        iter->offset = -1;
+    }
+
+    iter->direction = direction;
+    iter->quicklist = quicklist;
+
+    iter->zi = NULL;
+
+    return iter;
+}
+
+/* Initialize an iterator at a specific offset 'idx' and make the iterator
+ * return nodes in 'direction' direction. Returns NULL if the index is out
+ * of range. */
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist,
+                                         const int direction,
+                                         const long long idx) {
+    quicklistEntry entry;
+
+    if (quicklistIndex(quicklist, idx, &entry)) {
+        quicklistIter *base = quicklistGetIterator(quicklist, direction);
+        base->zi = NULL;
+        base->current = entry.node;
+        /* Keep the offset positive going forward and negative going
+         * backward, see quicklistDelEntry() for the reason. */
+        base->offset = entry.offset;
+        if (direction == AL_START_HEAD && base->offset < 0)
+            base->offset += entry.node->count;
+        else if (direction == AL_START_TAIL && base->offset >= 0)
+            base->offset -= entry.node->count;
+        return base;
+    } else {
+        return NULL;
+    }
+}
+
+/* Release iterator.
+ * If we still have a valid current node, then re-encode current node. */
+void quicklistReleaseIterator(quicklistIter *iter) {
+    if (iter->current)
+        quicklistCompress(iter->quicklist, iter->current);
+
+    zfree(iter);
+}
+
+/* Get next element in iterator.
+ *
+ * Note: You must NOT insert into the list while iterating over it.
+ * You *may* delete from the list while iterating using the
+ * quicklistDelEntry() function.
+ * If you insert into the quicklist while iterating, you should
+ * re-create the iterator after your addition.
+ *
+ * iter = quicklistGetIterator(quicklist,<direction>);
+ * quicklistEntry entry;
+ * while (quicklistNext(iter, &entry)) {
+ *     if (entry.value)
+ *          [[ use entry.value with entry.sz ]]
+ *     else
+ *          [[ use entry.longval ]]
+ * }
+ *
+ * Populates 'entry' with values for this iteration.
+ * Returns 0 when iteration is complete or if iteration not possible.
+ * If return value is 0, the contents of 'entry' are not valid.
+ */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    initEntry(entry);
+
+    if (!iter)
+        return 0;
+
+    entry->quicklist = iter->quicklist;
+
+    while (iter->current) {
+        entry->node = iter->current;
+
+        if (!iter->zi) {
+            /* If !zi, use current index. */
+            quicklistDecompressNodeForUse(iter->current);
+            iter->zi = lpSeek(iter->current->zl, iter->offset);
+        } else if (iter->direction == AL_START_HEAD) {
+            iter->zi = lpNext(iter->current->zl, iter->zi);
+            iter->offset++;
+        } else {
+            iter->zi = lpPrev(iter->current->zl, iter->zi);
+            iter->offset--;
+        }
+
+        entry->zi = iter->zi;
+        entry->offset = iter->offset;
+
+        if (iter->zi) {
+            /* Populate value from existing listpack position */
+            entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
+            return 1;
+        }
+
+        /* We ran out of listpack entries.
+         * Pick next node, update offset, then re-run retrieval. */
+        quicklistRecompressOnly(iter->current);
+        if (iter->direction == AL_START_HEAD) {
+            iter->current = iter->current->next;
+            iter->offset = 0;
+        } else {
+            iter->current = iter->current->prev;
+            iter->offset = -1;
+        }
+        iter->zi = NULL;
+    }
+    entry->node = NULL;
+    return 0;
+}
+
+/* Populate 'entry' with the element at the specified zero-based index
+ * where 0 is the head, 1 is the element next to head
+ * and so on. Negative integers are used in order to count
+ * from the tail, -1 is the last element, -2 the penultimate
+ * and so on. If the index is out of range 0 is returned.
+ *
+ * Returns 1 if element found
+ * Returns 0 if element not found */
+int quicklistIndex(const quicklist *quicklist, const long long idx,
+                   quicklistEntry *entry) {
+    quicklistNode *n;
+    unsigned long long accum = 0;
+    unsigned long long index;
+    int forward = idx < 0 ? 0 : 1; /* < 0 -> reverse, 0+ -> forward */
+
+    initEntry(entry);
+    entry->quicklist = quicklist;
+
+    if (!forward) {
+        index = (-idx) - 1;
+        n = quicklist->tail;
+    } else {
+        index = idx;
+        n = quicklist->head;
+    }
+
+    if (index >= quicklist->count)
+        return 0;
+
+    while (n) {
+        if ((accum + n->count) > index) {
+            break;
+        } else {
+            accum += n->count;
+            n = forward ? n->next : n->prev;
+        }
+    }
+
+    if (!n)
+        return 0;
+
+    entry->node = n;
+    if (forward) {
+        /* forward = normal head-to-tail offset. */
+        entry->offset = index - accum;
+    } else {
+        /* reverse = need negative offset for tail-to-head, so undo
+         * the result of the original if (index < 0) above. */
+        entry->offset = (-index) - 1 + accum;
+    }
+
+    /* The node is left uncompressed, the caller compresses it again once
+     * done with the entry (see quicklistReplaceAtIndex()). */
+    quicklistDecompressNodeForUse(entry->node);
+    entry->zi = lpSeek(entry->node->zl, entry->offset);
+    entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
+    return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Pop
+ *----------------------------------------------------------------------------*/
+
+/* Pop from quicklist and return result in 'data' ptr.  Value of 'data'
+ * is the return value of 'saver' function pointer if the data is NOT a number.
+ *
+ * If the quicklist element is a long long, then the return value is returned in
+ * 'sval'.
+ *
+ * Return value of 0 means no elements available.
+ * Return value of 1 means check 'data' and 'sval' for values.
+ * If 'data' is set, use 'data' and 'sz'.  Otherwise, use 'sval'. */
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+                       unsigned int *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, unsigned int sz)) {
+    unsigned char *p;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    int pos = (where == QUICKLIST_HEAD) ? 0 : -1;
+
+    if (quicklist->count == 0)
+        return 0;
+
+    if (data)
+        *data = NULL;
+    if (sz)
+        *sz = 0;
+    if (sval)
+        *sval = -123456789;
+
+    quicklistNode *node;
+    if (where == QUICKLIST_HEAD && quicklist->head) {
+        node = quicklist->head;
+    } else if (where == QUICKLIST_TAIL && quicklist->tail) {
+        node = quicklist->tail;
+    } else {
+        return 0;
+    }
+
+    p = lpSeek(node->zl, pos);
+    if (p) {
+        vstr = lpGetValue(p, &vlen, &vlong);
+        if (vstr) {
+            if (data)
+                *data = saver(vstr, vlen);
+            if (sz)
+                *sz = vlen;
+        } else {
+            if (data)
+                *data = NULL;
+            if (sval)
+                *sval = vlong;
+        }
+        quicklistDelIndex(quicklist, node, &p);
+        return 1;
+    }
+    return 0;
+}
+
+/* Return a malloc'd copy of data passed in */
+static void *_quicklistSaver(unsigned char *data, unsigned int sz) {
+    unsigned char *vstr;
+    if (data) {
+        vstr = zmalloc(sz);
+        memcpy(vstr, data, sz);
+        return vstr;
+    }
+    return NULL;
+}
+
+/* Default pop function
+ *
+ * Returns malloc'd value from quicklist */
+int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
+                 unsigned int *sz, long long *slong) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    if (quicklist->count == 0)
+        return 0;
+    int ret = quicklistPopCustom(quicklist, where, &vstr, &vlen, &vlong,
+                                 _quicklistSaver);
+    if (data)
+        *data = vstr;
+    if (slong)
+        *slong = vlong;
+    if (sz)
+        *sz = vlen;
+    return ret;
+}
+
+/* Compare the listpack entry 'p1' against 'p2' of length 'p2_len'. */
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
+    return lpCompare(p1, p2, p2_len);
+}
+
+// usage:
+// 1) gcc -g zmalloc.c util.c sds.c ziplist.c listpack.c lzf_c.c lzf_d.c quicklist.c -D QUICKLIST_TEST_MAIN -lm
+// 2) ./a.out
+
+#ifdef QUICKLIST_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+/* Verify the cached counters against the actual content of the nodes,
+ * and that no node within the compress depth is compressed. */
+static int _quicklistCheck(quicklist *ql) {
+    quicklistNode *node = ql->head, *prev = NULL;
+    unsigned long count = 0;
+    unsigned int len = 0;
+
+    while (node) {
+        unsigned char *zl = node->zl;
+        int ok;
+
+        if (node->prev != prev) return 0;
+        if (quicklistNodeIsCompressed(node)) {
+            quicklistLZF *lzf = (quicklistLZF *)node->zl;
+
+            if (len < ql->compress || ql->len - len <= ql->compress) return 0;
+            zl = zmalloc(node->sz);
+            if (lzf_decompress(lzf->compressed, lzf->sz, zl, node->sz) !=
+                node->sz) return 0;
+        }
+        ok = node->count == lpLength(zl) && node->sz == lpBytes(zl);
+        if (zl != node->zl) zfree(zl);
+        if (!ok || node->count == 0) return 0;
+        count += node->count;
+        len++;
+        prev = node;
+        node = node->next;
+    }
+    return prev == ql->tail && count == ql->count && len == ql->len;
+}
+
+/* Return the number of compressed nodes. */
+static unsigned int _quicklistCompressedNodes(quicklist *ql) {
+    quicklistNode *node;
+    unsigned int compressed = 0;
+
+    for (node = ql->head; node; node = node->next)
+        if (quicklistNodeIsCompressed(node)) compressed++;
+    return compressed;
+}
+
+/* Return the element at 'idx' as an integer, assuming numeric entries. */
+static long long _quicklistGetInt(quicklist *ql, long long idx) {
+    quicklistEntry entry;
+    char buf[32];
+
+    if (!quicklistIndex(ql, idx, &entry)) return -1;
+    if (!entry.value) return entry.longval;
+    memcpy(buf, entry.value, entry.sz);
+    buf[entry.sz] = '\0';
+    return strtoll(buf, NULL, 10);
+}
+
+static void _quicklistPushInts(quicklist *ql, int start, int count, int where) {
+    char buf[32];
+    int j;
+
+    for (j = start; j < start+count; j++) {
+        int len = ll2string(buf, sizeof(buf), j);
+        quicklistPush(ql, buf, len, where);
+    }
+}
+
+int main(void) {
+    int fills[] = { 1, 2, 3, 32, 128, -1, -2, -5 };
+    int depths[] = { 0, 1, 4 };
+    unsigned int f;
+
+    for (f = 0; f < (sizeof(fills)/sizeof(*fills))*3; f++) {
+        int fill = fills[f/3], depth = depths[f%3], ok, j;
+        quicklist *ql;
+        quicklistIter *iter;
+        quicklistEntry entry;
+        unsigned char *data;
+        unsigned int sz;
+        long long lv;
+
+        printf("--- fill %d, compress depth %d ---\n", fill, depth);
+
+        ql = quicklistNew(fill, depth);
+        _quicklistPushInts(ql, 0, 500, QUICKLIST_TAIL);
+        test_cond("Push tail keeps order and counters",
+            _quicklistCheck(ql) && ql->count == 500 &&
+            _quicklistGetInt(ql, 0) == 0 && _quicklistGetInt(ql, -1) == 499 &&
+            _quicklistGetInt(ql, 250) == 250);
+
+        quicklistPushHead(ql, "head", 4);
+        ok = quicklistIndex(ql, 0, &entry) && entry.sz == 4 &&
+             !memcmp(entry.value, "head", 4);
+        test_cond("Push head", ok && _quicklistCheck(ql));
+
+        ok = quicklistPop(ql, QUICKLIST_HEAD, &data, &sz, &lv) &&
+             data && sz == 4 && !memcmp(data, "head", 4);
+        zfree(data);
+        ok = ok && quicklistPop(ql, QUICKLIST_TAIL, &data, &sz, &lv) &&
+             data == NULL && lv == 499;
+        test_cond("Pop head and tail", ok && _quicklistCheck(ql) &&
+            ql->count == 499);
+
+        /* Insert before every element: the list must double in size. */
+        iter = quicklistGetIterator(ql, AL_START_HEAD);
+        j = 0;
+        while (quicklistNext(iter, &entry)) j++;
+        quicklistReleaseIterator(iter);
+        test_cond("Forward iteration visits every element", j == 499);
+
+        for (j = 0; j < 499; j++) {
+            ok = quicklistIndex(ql, j*2, &entry);
+            quicklistInsertBefore(ql, &entry, "x", 1);
+        }
+        ok = _quicklistCheck(ql) && ql->count == 998;
+        for (j = 0; ok && j < 499; j++) {
+            quicklistIndex(ql, j*2, &entry);
+            ok = entry.sz == 1 && entry.value[0] == 'x' &&
+                 _quicklistGetInt(ql, j*2+1) == j;
+        }
+        test_cond("Insert before splitting nodes", ok);
+
+        /* Delete the inserted elements iterating backward. */
+        iter = quicklistGetIterator(ql, AL_START_TAIL);
+        while (quicklistNext(iter, &entry)) {
+            if (entry.value && entry.sz == 1 && entry.value[0] == 'x')
+                quicklistDelEntry(iter, &entry);
+        }
+        quicklistReleaseIterator(iter);
+        ok = _quicklistCheck(ql) && ql->count == 499;
+        for (j = 0; ok && j < 499; j++) ok = _quicklistGetInt(ql, j) == j;
+        test_cond("Delete while iterating backward", ok);
+
+        for (j = 0; j < 499; j++) {
+            quicklistIndex(ql, j*2, &entry);
+            quicklistInsertAfter(ql, &entry, "y", 1);
+        }
+        iter = quicklistGetIteratorAtIdx(ql, AL_START_HEAD, 1);
+        while (quicklistNext(iter, &entry)) {
+            if (entry.value && entry.sz == 1 && entry.value[0] == 'y')
+                quicklistDelEntry(iter, &entry);
+        }
+        quicklistReleaseIterator(iter);
+        ok = _quicklistCheck(ql) && ql->count == 499;
+        for (j = 0; ok && j < 499; j++) ok = _quicklistGetInt(ql, j) == j;
+        test_cond("Insert after and delete while iterating forward", ok);
+
+        ok = quicklistReplaceAtIndex(ql, 100, "replaced", 8) &&
+             quicklistIndex(ql, 100, &entry) && entry.sz == 8 &&
+             !quicklistReplaceAtIndex(ql, 1000, "x", 1);
+        test_cond("Replace at index", ok && _quicklistCheck(ql));
+
+        quicklistDelRange(ql, 10, 100);
+        quicklistDelRange(ql, -50, 50);
+        ok = _quicklistCheck(ql) && ql->count == 349 &&
+             _quicklistGetInt(ql, 9) == 9 && _quicklistGetInt(ql, 10) == 110 &&
+             _quicklistGetInt(ql, -1) == 448;
+        test_cond("Delete ranges", ok);
+
+        quicklistDelRange(ql, 0, ql->count);
+        test_cond("Delete everything", _quicklistCheck(ql) &&
+            ql->count == 0 && ql->len == 0 && ql->head == NULL);
+        quicklistRelease(ql);
+    }
+
+    {
+        unsigned char *zl = ziplistNew();
+        quicklist *ql;
+        char buf[32];
+        int j;
+
+        for (j = 0; j < 1000; j++) {
+            int len = ll2string(buf, sizeof(buf), j);
+            zl = ziplistPush(zl, (unsigned char*)buf, len, ZIPLIST_TAIL);
+        }
+        ql = quicklistCreateFromZiplist(16, 0, zl);
+        test_cond("Create from ziplist", _quicklistCheck(ql) &&
+            ql->count == 1000 && ql->len == 63 &&
+            _quicklistGetInt(ql, 999) == 999);
+        quicklistRelease(ql);
+    }
+
+    {
+        quicklist *ql = quicklistNew(32, 2);
+        quicklistIter *iter;
+        quicklistEntry entry;
+        int ok = 1, j = 0;
+
+        char buf[64];
+
+        /* Log-like entries compress well, plain integers would not. */
+        for (j = 0; j < 10000; j++) {
+            int len = snprintf(buf, sizeof(buf), "log entry number %d", j);
+            quicklistPushTail(ql, buf, len);
+        }
+        test_cond("Interior nodes are compressed", _quicklistCheck(ql) &&
+            _quicklistCompressedNodes(ql) == ql->len - 4);
+
+        iter = quicklistGetIterator(ql, AL_START_HEAD);
+        j = 0;
+        while (quicklistNext(iter, &entry)) {
+            int len = snprintf(buf, sizeof(buf), "log entry number %d", j++);
+            if (!entry.value || entry.sz != (unsigned int)len ||
+                memcmp(entry.value, buf, len)) ok = 0;
+        }
+        quicklistReleaseIterator(iter);
+        test_cond("Iterate compressed list", ok && j == 10000 &&
+            _quicklistCheck(ql) && _quicklistCompressedNodes(ql) == ql->len - 4);
+
+        ok = quicklistReplaceAtIndex(ql, 5000, "5000", 4) &&
+             _quicklistGetInt(ql, 5000) == 5000;
+        test_cond("Index and replace in compressed node", ok &&
+            _quicklistCheck(ql));
+
+        quicklistDelRange(ql, 0, 9900);
+        ok = quicklistIndex(ql, 0, &entry) &&
+             !memcmp(entry.value, "log entry number 9900", entry.sz);
+        test_cond("Delete range decompresses nodes within depth",
+            ok && _quicklistCheck(ql) && ql->count == 100);
+        quicklistRelease(ql);
+    }
+
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,1015 @@
+/* rax.c - A compressed radix tree implementation
+ *
+ * An ordered map of binary safe strings to pointers, using memory
+ * proportional to the distinct parts of the keys: the common prefixes are
+ * stored just once, in compressed paths. Lookup, insertion and deletion
+ * are O(length of the key), and iterators can seek to any element (equal,
+ * greater, smaller, first or last) and walk the keys in lexicographic order
+ * in both directions.
+ *
+ * 压缩前缀树：有序的字符串 -> 指针映射，公共前缀只保存一次
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rax.h"
+#include "zmalloc.h"
+
+/* This is a special pointer that is guaranteed to never have the same value
+ * of a radix tree node. It's used in order to report "not found" error
+ * without requiring the function to have multiple return values. */
+void *raxNotFound = (void*)"rax-not-found-pointer";
+
+/* ------------------------- Node layout helpers ---------------------------- */
+
+/* Bytes needed after 'len' bytes to align the pointers that follow. */
+#define raxPadding(len) \
+    ((sizeof(void*)-((len) % sizeof(void*))) & (sizeof(void*)-1))
+
+#define raxNodeEdges(n) ((n)->data+(n)->prefixlen)
+#define raxNodeChildren(n) ((raxNode**)((n)->data+(n)->prefixlen+(n)->size+ \
+                            raxPadding((n)->prefixlen+(n)->size)))
+#define raxNodeHasValue(n) ((n)->iskey && !(n)->isnull)
+#define raxNodeValuePtr(n) ((void**)(raxNodeChildren(n)+(n)->size))
+
+/* Return the value associated with the key node 'n', NULL if none. */
+static void *raxNodeGetData(raxNode *n) {
+    return raxNodeHasValue(n) ? *raxNodeValuePtr(n) : NULL;
+}
+
+/* Create a node with the given compressed path, children and key flag.
+ * The prefix, edges and children are copied, so they can point inside a
+ * node that the caller is going to free.
+ *
+ * 创建一个节点，复制给定的压缩路径和子节点 */
+static raxNode *raxNodeMake(rax *rax, const unsigned char *prefix,
+                            size_t prefixlen, const unsigned char *edges,
+                            raxNode **children, size_t size, int iskey,
+                            void *data)
+{
+    size_t len = prefixlen+size;
+    int hasvalue = iskey && data != NULL;
+    raxNode *n = zmalloc(sizeof(raxNode)+len+raxPadding(len)+
+                         sizeof(raxNode*)*size+(hasvalue ? sizeof(void*) : 0));
+
+    n->iskey = iskey;
+    n->isnull = !hasvalue;
+    n->size = size;
+    n->prefixlen = prefixlen;
+    if (prefixlen) memcpy(n->data,prefix,prefixlen);
+    if (size) {
+        memcpy(raxNodeEdges(n),edges,size);
+        memcpy(raxNodeChildren(n),children,sizeof(raxNode*)*size);
+    }
+    if (hasvalue) *raxNodeValuePtr(n) = data;
+    rax->numnodes++;
+    return n;
+}
+
+static void raxNodeFree(rax *rax, raxNode *n) {
+    zfree(n);
+    rax->numnodes--;
+}
+
+/* Return a copy of 'n' with a new compressed path and key state, freeing
+ * 'n'. The new prefix may point inside 'n'. */
+static raxNode *raxNodeReplace(rax *rax, raxNode *n,
+                               const unsigned char *prefix, size_t prefixlen,
+                               int iskey, void *data)
+{
+    raxNode *new = raxNodeMake(rax,prefix,prefixlen,raxNodeEdges(n),
+                               raxNodeChildren(n),n->size,iskey,data);
+    raxNodeFree(rax,n);
+    return new;
+}
+
+/* Return the index of the child of 'n' reached with the byte 'c', or -1. */
+static int raxNodeFindChild(raxNode *n, unsigned char c) {
+    unsigned char *edges = raxNodeEdges(n);
+    int j;
+
+    for (j = 0; j < (int)n->size; j++) {
+        if (edges[j] == c) return j;
+        if (edges[j] > c) break;
+    }
+    return -1;
+}
+
+/* Return the index of the first child of 'n' reached with a byte greater
+ * or equal to 'c', or n->size if there is none. */
+static int raxNodeLowerBound(raxNode *n, unsigned char c) {
+    unsigned char *edges = raxNodeEdges(n);
+    int j;
+
+    for (j = 0; j < (int)n->size; j++)
+        if (edges[j] >= c) break;
+    return j;
+}
+
+/* Return a copy of 'n' with the new child 'child' reached with byte 'c',
+ * freeing 'n'. There must not be already a child for 'c'. */
+static raxNode *raxNodeAddChild(rax *rax, raxNode *n, unsigned char c,
+                                raxNode *child)
+{
+    unsigned char edges[256];
+    raxNode *children[256];
+    int idx = raxNodeLowerBound(n,c);
+    int after = n->size-idx;
+    raxNode *new;
+
+    memcpy(edges,raxNodeEdges(n),idx);
+    memcpy(children,raxNodeChildren(n),sizeof(raxNode*)*idx);
+    edges[idx] = c;
+    children[idx] = child;
+    memcpy(edges+idx+1,raxNodeEdges(n)+idx,after);
+    memcpy(children+idx+1,raxNodeChildren(n)+idx,sizeof(raxNode*)*after);
+    new = raxNodeMake(rax,n->data,n->prefixlen,edges,children,n->size+1,
+                      n->iskey,raxNodeGetData(n));
+    raxNodeFree(rax,n);
+    return new;
+}
+
+/* Return a copy of 'n' without the child at index 'idx', freeing 'n'.
+ * The child itself is not freed. */
+static raxNode *raxNodeRemoveChild(rax *rax, raxNode *n, int idx) {
+    unsigned char edges[256];
+    raxNode *children[256];
+    int after = n->size-idx-1;
+    raxNode *new;
+
+    memcpy(edges,raxNodeEdges(n),idx);
+    memcpy(children,raxNodeChildren(n),sizeof(raxNode*)*idx);
+    memcpy(edges+idx,raxNodeEdges(n)+idx+1,after);
+    memcpy(children+idx,raxNodeChildren(n)+idx+1,sizeof(raxNode*)*after);
+    new = raxNodeMake(rax,n->data,n->prefixlen,edges,children,n->size-1,
+                      n->iskey,raxNodeGetData(n));
+    raxNodeFree(rax,n);
+    return new;
+}
+
+/* Split the compressed path of 'n' at offset 'j', that must be smaller
+ * than the prefix length: the returned node holds the first 'j' bytes and
+ * has a single child, reached with the byte at offset 'j', that holds the
+ * rest of the path, the children and the key of 'n'. 'n' is freed.
+ *
+ * 在 j 处拆分压缩路径 */
+static raxNode *raxNodeSplit(rax *rax, raxNode *n, size_t j) {
+    unsigned char edge = n->data[j];
+    raxNode *child = raxNodeMake(rax,n->data+j+1,n->prefixlen-j-1,
+                                 raxNodeEdges(n),raxNodeChildren(n),n->size,
+                                 n->iskey,raxNodeGetData(n));
+    raxNode *new = raxNodeMake(rax,n->data,j,&edge,&child,1,0,NULL);
+
+    raxNodeFree(rax,n);
+    return new;
+}
+
+/* Merge 'n', that must not be a key and have a single child, with its
+ * child, freeing both: the returned node has the path of 'n', the child
+ * byte and the path of the child, and the children and key of the child.
+ *
+ * 将只有一个子节点的非键节点和它的子节点合并 */
+static raxNode *raxNodeMergeChild(rax *rax, raxNode *n) {
+    raxNode *child = raxNodeChildren(n)[0];
+    size_t prefixlen = n->prefixlen+1+child->prefixlen;
+    unsigned char buf[256], *prefix;
+    raxNode *new;
+
+    prefix = (prefixlen <= sizeof(buf)) ? buf : zmalloc(prefixlen);
+    memcpy(prefix,n->data,n->prefixlen);
+    prefix[n->prefixlen] = raxNodeEdges(n)[0];
+    memcpy(prefix+n->prefixlen+1,child->data,child->prefixlen);
+    new = raxNodeMake(rax,prefix,prefixlen,raxNodeEdges(child),
+                      raxNodeChildren(child),child->size,child->iskey,
+                      raxNodeGetData(child));
+    if (prefix != buf) zfree(prefix);
+    raxNodeFree(rax,child);
+    raxNodeFree(rax,n);
+    return new;
+}
+
+/* ------------------------------- Tree API --------------------------------- */
+
+/* Allocate a new rax and return its pointer. */
+rax *raxNew(void) {
+    rax *rax = zmalloc(sizeof(*rax));
+
+    rax->numele = 0;
+    rax->numnodes = 0;
+    rax->head = raxNodeMake(rax,NULL,0,NULL,NULL,0,0,NULL);
+    return rax;
+}
+
+/* Insert the element 's' of length 'len', setting as auxiliary data the
+ * pointer 'data'. If the element already exists, its data is updated only
+ * if 'overwrite' is true, and the old value is stored in '*old' if 'old' is
+ * not NULL. Returns 1 if the element was added, 0 if it already existed. */
+static int raxGenericInsert(rax *rax, unsigned char *s, size_t len,
+                            void *data, void **old, int overwrite)
+{
+    raxNode **link = &rax->head, *n = rax->head;
+    size_t i = 0;
+
+    while(1) {
+        size_t j = 0;
+        int idx;
+
+        // 匹配压缩路径，不匹配时拆分节点
+        while (j < n->prefixlen && i+j < len && n->data[j] == s[i+j]) j++;
+        if (j < n->prefixlen) n = *link = raxNodeSplit(rax,n,j);
+        i += n->prefixlen;
+
+        /* The string ends at this node: make it a key. */
+        if (i == len) {
+            if (n->iskey) {
+                if (old) *old = raxNodeGetData(n);
+                if (!overwrite) return 0;
+                if (raxNodeHasValue(n) && data != NULL)
+                    *raxNodeValuePtr(n) = data;
+                else if (raxNodeHasValue(n) || data != NULL)
+                    *link = raxNodeReplace(rax,n,n->data,n->prefixlen,1,data);
+                return 0;
+            }
+            *link = raxNodeReplace(rax,n,n->data,n->prefixlen,1,data);
+            rax->numele++;
+            return 1;
+        }
+
+        /* Follow the child for the next byte, or add a leaf holding the
+         * rest of the string. */
+        idx = raxNodeFindChild(n,s[i]);
+        if (idx == -1) {
+            raxNode *leaf = raxNodeMake(rax,s+i+1,len-i-1,NULL,NULL,0,1,data);
+
+            *link = raxNodeAddChild(rax,n,s[i],leaf);
+            rax->numele++;
+            return 1;
+        }
+        link = raxNodeChildren(n)+idx;
+        n = *link;
+        i++;
+    }
+}
+
+/* Insert or update the element 's'. See raxGenericInsert(). */
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
+    return raxGenericInsert(rax,s,len,data,old,1);
+}
+
+/* Insert the element 's' only if it does not exist. See raxGenericInsert(). */
+int raxTryInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
+    return raxGenericInsert(rax,s,len,data,old,0);
+}
+
+/* Find a key in the rax, returns raxNotFound special void pointer value
+ * if the item was not found, otherwise the value associated with the
+ * item is returned. */
+void *raxFind(rax *rax, unsigned char *s, size_t len) {
+    raxNode *n = rax->head;
+    size_t i = 0;
+
+    while(1) {
+        int idx;
+
+        if (n->prefixlen > len-i || memcmp(n->data,s+i,n->prefixlen) != 0)
+            return raxNotFound;
+        i += n->prefixlen;
+        if (i == len) return n->iskey ? raxNodeGetData(n) : raxNotFound;
+        if ((idx = raxNodeFindChild(n,s[i])) == -1) return raxNotFound;
+        n = raxNodeChildren(n)[idx];
+        i++;
+    }
+}
+
+/* Remove the specified item. Returns 1 if the item was found and
+ * deleted, 0 otherwise. The value of the item is stored in '*old' if
+ * 'old' is not NULL.
+ *
+ * Nodes that are no longer keys are removed if they have no children, and
+ * merged with their child if they have just one, so that the tree stays
+ * as compact as if the element was never inserted. */
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
+    raxNode **link = &rax->head, **plink = NULL, *n = rax->head;
+    size_t i = 0;
+    int idx = -1;
+
+    while(1) {
+        int c;
+
+        if (n->prefixlen > len-i || memcmp(n->data,s+i,n->prefixlen) != 0)
+            return 0;
+        i += n->prefixlen;
+        if (i == len) break;
+        if ((c = raxNodeFindChild(n,s[i])) == -1) return 0;
+        plink = link;
+        idx = c;
+        link = raxNodeChildren(n)+c;
+        n = *link;
+        i++;
+    }
+    if (!n->iskey) return 0;
+    if (old) *old = raxNodeGetData(n);
+    rax->numele--;
+
+    if (n->size == 0 && plink) {
+        /* Remove the leaf. The parent may be left with a single child, or
+         * with none if it is the root. */
+        // 删除叶子节点，父节点只剩一个子节点时与之合并
+        raxNode *p = *plink;
+
+        raxNodeFree(rax,n);
+        p = *plink = raxNodeRemoveChild(rax,p,idx);
+        if (!p->iskey && p->size == 1)
+            *plink = raxNodeMergeChild(rax,p);
+        else if (!p->iskey && p->size == 0)
+            *plink = raxNodeReplace(rax,p,NULL,0,0,NULL);
+    } else if (n->size == 1) {
+        *link = raxNodeMergeChild(rax,n);
+    } else {
+        /* Still needed to reach the children, or the root of a tree that
+         * is now empty. */
+        *link = raxNodeReplace(rax,n,n->data,n->size ? n->prefixlen : 0,
+                               0,NULL);
+    }
+    return 1;
+}
+
+/* Free the whole radix tree, calling the specified callback in order to
+ * free the auxiliary data. */
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*)) {
+    size_t items = 0, max = 32;
+    raxNode **stack = zmalloc(sizeof(raxNode*)*max);
+
+    /* Use an explicit stack: the tree can be as deep as the longest key. */
+    stack[items++] = rax->head;
+    while (items) {
+        raxNode *n = stack[--items];
+
+        if (items+n->size > max) {
+            max = (items+n->size)*2;
+            stack = zrealloc(stack,sizeof(raxNode*)*max);
+        }
+        memcpy(stack+items,raxNodeChildren(n),sizeof(raxNode*)*n->size);
+        items += n->size;
+        if (free_callback && raxNodeHasValue(n))
+            free_callback(*raxNodeValuePtr(n));
+        zfree(n);
+    }
+    zfree(stack);
+    zfree(rax);
+}
+
+/* Free a whole radix tree. */
+void raxFree(rax *rax) {
+    raxFreeWithCallback(rax,NULL);
+}
+
+/* Return the number of elements inside the radix tree. */
+uint64_t raxSize(rax *rax) {
+    return rax->numele;
+}
+
+/* ------------------------------- Iterator --------------------------------- */
+
+/* Initialize a Rax iterator. This call should be performed a single time
+ * to initialize the iterator, and must be followed by a raxSeek() call,
+ * otherwise the raxPrev()/raxNext() functions will just return EOF. */
+void raxStart(raxIterator *it, rax *rt) {
+    it->flags = RAX_ITER_EOF; /* No crash if the iterator is not seeked. */
+    it->rt = rt;
+    it->key_len = 0;
+    it->key = it->key_static_string;
+    it->key_max = RAX_ITER_STATIC_LEN;
+    it->data = NULL;
+    it->stack = it->stack_static;
+    it->stack_items = 0;
+    it->stack_max = RAX_ITER_STATIC_STACK;
+}
+
+/* Make sure the key buffer of the iterator can hold 'len' bytes. */
+static void raxIterKeyReserve(raxIterator *it, size_t len) {
+    if (len <= it->key_max) return;
+    it->key_max = len*2;
+    if (it->key == it->key_static_string) {
+        it->key = zmalloc(it->key_max);
+        memcpy(it->key,it->key_static_string,it->key_len);
+    } else {
+        it->key = zrealloc(it->key,it->key_max);
+    }
+}
+
+/* Push the node 'n' on the iterator stack. */
+static void raxIterPush(raxIterator *it, raxNode *n) {
+    if (it->stack_items == it->stack_max) {
+        it->stack_max *= 2;
+        if (it->stack == it->stack_static) {
+            it->stack = zmalloc(sizeof(raxStackFrame)*it->stack_max);
+            memcpy(it->stack,it->stack_static,
+                   sizeof(raxStackFrame)*it->stack_items);
+        } else {
+            it->stack = zrealloc(it->stack,
+                                 sizeof(raxStackFrame)*it->stack_max);
+        }
+    }
+    it->stack[it->stack_items].node = n;
+    it->stack[it->stack_items].idx = -1;
+    it->stack_items++;
+}
+
+#define raxIterTop(it) ((it)->stack[(it)->stack_items-1].node)
+
+/* Position the iterator on the root node. */
+static void raxIterReset(raxIterator *it) {
+    raxNode *head = it->rt->head;
+
+    it->stack_items = 0;
+    raxIterPush(it,head);
+    raxIterKeyReserve(it,head->prefixlen);
+    memcpy(it->key,head->data,head->prefixlen);
+    it->key_len = head->prefixlen;
+}
+
+/* Move to the child 'idx' of the current node, updating the key. */
+static void raxIterDescend(raxIterator *it, int idx) {
+    raxNode *n = raxIterTop(it);
+    raxNode *child = raxNodeChildren(n)[idx];
+
+    it->stack[it->stack_items-1].idx = idx;
+    raxIterKeyReserve(it,it->key_len+1+child->prefixlen);
+    it->key[it->key_len++] = raxNodeEdges(n)[idx];
+    memcpy(it->key+it->key_len,child->data,child->prefixlen);
+    it->key_len += child->prefixlen;
+    raxIterPush(it,child);
+}
+
+/* Move back to the parent of the current node, updating the key. */
+static void raxIterAscend(raxIterator *it) {
+    raxNode *n = raxIterTop(it);
+
+    it->stack_items--;
+    it->key_len -= 1+n->prefixlen;
+}
+
+/* Move to the smallest key of the subtree of the current node. Returns 0
+ * if there is none, that is only possible for the root of an empty tree. */
+static int raxIterFirstInSubtree(raxIterator *it) {
+    while (!raxIterTop(it)->iskey) {
+        if (raxIterTop(it)->size == 0) return 0;
+        raxIterDescend(it,0);
+    }
+    return 1;
+}
+
+/* Move to the greatest key of the subtree of the current node, that is
+ * the deepest node following the last children. Returns 0 if there is
+ * none. */
+static int raxIterLastInSubtree(raxIterator *it) {
+    while (raxIterTop(it)->size)
+        raxIterDescend(it,raxIterTop(it)->size-1);
+    return raxIterTop(it)->iskey;
+}
+
+/* Move to the smallest key greater than all the keys of the subtree of the
+ * current node. Returns 0 if there is none. */
+static int raxIterNextAfterSubtree(raxIterator *it) {
+    while (it->stack_items > 1) {
+        raxStackFrame *parent;
+
+        raxIterAscend(it);
+        parent = &it->stack[it->stack_items-1];
+        if (parent->idx+1 < (int)parent->node->size) {
+            raxIterDescend(it,parent->idx+1);
+            return raxIterFirstInSubtree(it);
+        }
+    }
+    return 0;
+}
+
+/* Move to the greatest key smaller than the current node and all its
+ * subtree. Returns 0 if there is none. */
+static int raxIterPrevBeforeNode(raxIterator *it) {
+    while (it->stack_items > 1) {
+        raxStackFrame *parent;
+
+        raxIterAscend(it);
+        parent = &it->stack[it->stack_items-1];
+        if (parent->idx > 0) {
+            raxIterDescend(it,parent->idx-1);
+            return raxIterLastInSubtree(it);
+        }
+        if (parent->node->iskey) return 1;
+    }
+    return 0;
+}
+
+/* Set the iterator state after a successful (or not) positioning. */
+static int raxIterSetFound(raxIterator *it, int found) {
+    if (found) {
+        it->data = raxNodeGetData(raxIterTop(it));
+    } else {
+        it->flags |= RAX_ITER_EOF;
+        it->data = NULL;
+    }
+    return found;
+}
+
+/* Position the iterator, already on the root, on the element 'ele' or the
+ * first greater (gt) or smaller (lt) key. Returns 0 if there is none. */
+static int raxIterSeekElement(raxIterator *it, unsigned char *ele, size_t len,
+                              int eq, int lt, int gt)
+{
+    size_t i = 0;
+
+    while(1) {
+        raxNode *n = raxIterTop(it);
+        size_t j = 0;
+        int idx;
+
+        while (j < n->prefixlen && i+j < len && n->data[j] == ele[i+j]) j++;
+        if (j < n->prefixlen) {
+            /* The element diverges inside the compressed path of 'n': all
+             * the keys of the subtree are either greater or smaller. */
+            // 元素在压缩路径中分叉：整棵子树都比它大，或者都比它小
+            int subtree_greater = (i+j == len) || ele[i+j] < n->data[j];
+
+            if (gt)
+                return subtree_greater ? raxIterFirstInSubtree(it) :
+                                         raxIterNextAfterSubtree(it);
+            if (lt)
+                return subtree_greater ? raxIterPrevBeforeNode(it) :
+                                         raxIterLastInSubtree(it);
+            return 0;
+        }
+        i += n->prefixlen;
+
+        if (i == len) {
+            /* The element is the string of 'n': its subtree is greater. */
+            if (n->iskey && eq) return 1;
+            if (gt) {
+                if (!n->iskey) return raxIterFirstInSubtree(it);
+                if (n->size == 0) return raxIterNextAfterSubtree(it);
+                raxIterDescend(it,0);
+                return raxIterFirstInSubtree(it);
+            }
+            if (lt) return raxIterPrevBeforeNode(it);
+            return 0;
+        }
+
+        if ((idx = raxNodeFindChild(n,ele[i])) != -1) {
+            raxIterDescend(it,idx);
+            i++;
+            continue;
+        }
+
+        /* There is no child for the next byte: the children before it are
+         * smaller, the ones after it greater, and 'n' itself smaller. */
+        // 没有对应的子节点：之前的子节点都更小，之后的都更大
+        idx = raxNodeLowerBound(n,ele[i]);
+        if (gt) {
+            if (idx == (int)n->size) return raxIterNextAfterSubtree(it);
+            raxIterDescend(it,idx);
+            return raxIterFirstInSubtree(it);
+        }
+        if (lt) {
+            if (idx == 0) return n->iskey ? 1 : raxIterPrevBeforeNode(it);
+            raxIterDescend(it,idx-1);
+            return raxIterLastInSubtree(it);
+        }
+        return 0;
+    }
+}
+
+/* Seek an iterator at the specified element.
+ * Return 0 if the seek failed for syntax error, otherwise 1 is returned,
+ * even when no element matches: in that case the iterator is at EOF.
+ * The operators are ">", ">=", "<", "<=", "==" (or "="), "^" for the first
+ * element and "$" for the last one. After a seek, the first raxNext() or
+ * raxPrev() call returns the element the iterator was positioned on.
+ *
+ * 将迭代器定位到满足条件的第一个元素 */
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
+    int eq = 0, lt = 0, gt = 0, found;
+
+    it->flags = RAX_ITER_JUST_SEEKED;
+    raxIterReset(it);
+    if (op[0] == '^') {
+        found = raxIterFirstInSubtree(it);
+    } else if (op[0] == '$') {
+        found = raxIterLastInSubtree(it);
+    } else {
+        if (op[0] == '>') {
+            gt = 1;
+            if (op[1] == '=') eq = 1;
+        } else if (op[0] == '<') {
+            lt = 1;
+            if (op[1] == '=') eq = 1;
+        } else if (op[0] == '=') {
+            eq = 1;
+        } else {
+            it->flags = RAX_ITER_EOF;
+            return 0;
+        }
+        found = raxIterSeekElement(it,ele,len,eq,lt,gt);
+    }
+    raxIterSetFound(it,found);
+    return 1;
+}
+
+/* Go to the next element in the scope of the iterator 'it'.
+ * If EOF (or out of range) is reached, 0 is returned, otherwise 1 is
+ * returned. */
+int raxNext(raxIterator *it) {
+    raxNode *n;
+
+    if (it->flags & RAX_ITER_EOF) return 0;
+    if (it->flags & RAX_ITER_JUST_SEEKED) {
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+    n = raxIterTop(it);
+    if (n->size) {
+        raxIterDescend(it,0);
+        return raxIterSetFound(it,raxIterFirstInSubtree(it));
+    }
+    return raxIterSetFound(it,raxIterNextAfterSubtree(it));
+}
+
+/* Go to the previous element in the scope of the iterator 'it'.
+ * If EOF (or out of range) is reached, 0 is returned, otherwise 1 is
+ * returned. */
+int raxPrev(raxIterator *it) {
+    if (it->flags & RAX_ITER_EOF) return 0;
+    if (it->flags & RAX_ITER_JUST_SEEKED) {
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+    return raxIterSetFound(it,raxIterPrevBeforeNode(it));
+}
+
+/* Compare the key currently pointed by the iterator to the specified
+ * key according to the specified operator. Returns 1 if the comparison is
+ * true, otherwise 0 is returned. Used to stop a range iteration:
+ *
+ *  raxSeek(&it,">=",start,startlen);
+ *  while(raxNext(&it) && raxCompare(&it,"<=",end,endlen)) { ... } */
+int raxCompare(raxIterator *iter, const char *op, unsigned char *key, size_t key_len) {
+    int eq = 0, lt = 0, gt = 0, cmp;
+    size_t minlen;
+
+    if (op[0] == '=' || op[1] == '=') eq = 1;
+    if (op[0] == '>') gt = 1;
+    else if (op[0] == '<') lt = 1;
+    else if (op[1] != '=') return 0; /* Syntax error. */
+
+    minlen = key_len < iter->key_len ? key_len : iter->key_len;
+    cmp = minlen ? memcmp(iter->key,key,minlen) : 0;
+
+    /* Handle == */
+    if (lt == 0 && gt == 0) return cmp == 0 && key_len == iter->key_len;
+
+    /* Handle >, >=, <, <= */
+    if (cmp == 0) {
+        /* Same prefix: longer wins. */
+        if (eq && key_len == iter->key_len) return 1;
+        else if (lt) return iter->key_len < key_len;
+        else return iter->key_len > key_len;
+    } else if (cmp > 0) {
+        return gt;
+    } else {
+        return lt;
+    }
+}
+
+/* Return if the iterator is in an EOF state. This happens when raxSeek()
+ * failed to seek an appropriate element, so that raxNext() or raxPrev()
+ * will return zero, or when an EOF condition was reached while iterating
+ * with raxNext() and raxPrev(). */
+int raxEOF(raxIterator *it) {
+    return it->flags & RAX_ITER_EOF;
+}
+
+/* Free the iterator. */
+void raxStop(raxIterator *it) {
+    if (it->key != it->key_static_string) zfree(it->key);
+    if (it->stack != it->stack_static) zfree(it->stack);
+}
+
+// usage:
+// 1) gcc -g zmalloc.c rax.c -D RAX_TEST_MAIN
+// 2) ./a.out [number of keys for the benchmark]
+#ifdef RAX_TEST_MAIN
+#include <stdio.h>
+#include <sys/time.h>
+#include "testhelp.h"
+
+typedef struct testKey {
+    unsigned char buf[16];
+    size_t len;
+} testKey;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static int testKeyCompare(const void *a, const void *b) {
+    const testKey *ka = a, *kb = b;
+    size_t minlen = ka->len < kb->len ? ka->len : kb->len;
+    int cmp = memcmp(ka->buf,kb->buf,minlen);
+
+    if (cmp) return cmp;
+    return (ka->len > kb->len) - (ka->len < kb->len);
+}
+
+/* Random keys from a small alphabet, to get a lot of shared prefixes. */
+static void testKeyRandom(testKey *k) {
+    size_t j;
+
+    k->len = rand() % 8;
+    for (j = 0; j < k->len; j++) k->buf[j] = "abc\xff"[rand() % 4];
+}
+
+/* Index of the first sorted key that compares greater or equal ('ge') or
+ * greater than 'k', 'count' if there is none. */
+static int testKeyBound(testKey *sorted, int count, testKey *k, int ge) {
+    int lo = 0, hi = count;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2, cmp = testKeyCompare(sorted+mid,k);
+
+        if (cmp < 0 || (!ge && cmp == 0)) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Check that iterating the whole tree in both directions returns exactly
+ * the 'count' keys of 'sorted'. */
+static int testIterateAll(rax *t, testKey *sorted, int count) {
+    raxIterator it;
+    int j = 0, ok = 1;
+
+    raxStart(&it,t);
+    raxSeek(&it,"^",NULL,0);
+    while (raxNext(&it)) {
+        if (j >= count || it.key_len != sorted[j].len ||
+            memcmp(it.key,sorted[j].buf,it.key_len) != 0 ||
+            it.data != (void*)(long)(sorted[j].len+1)) ok = 0;
+        j++;
+    }
+    if (j != count) ok = 0;
+    raxSeek(&it,"$",NULL,0);
+    while (raxPrev(&it)) {
+        j--;
+        if (j < 0 || it.key_len != sorted[j].len ||
+            memcmp(it.key,sorted[j].buf,it.key_len) != 0) ok = 0;
+    }
+    if (j != 0) ok = 0;
+    raxStop(&it);
+    return ok;
+}
+
+/* Seek random elements with every operator, checking the element the
+ * iterator lands on, and the next and previous ones. */
+static int testSeekRandom(rax *t, testKey *sorted, int count, int rounds) {
+    const char *ops[] = {">",">=","<","<=","=="};
+    raxIterator it;
+    int ok = 1;
+
+    raxStart(&it,t);
+    while (rounds--) {
+        testKey k;
+        int op = rand() % 5, expect, step, j;
+
+        testKeyRandom(&k);
+        switch(op) {
+        case 0: expect = testKeyBound(sorted,count,&k,0); break;
+        case 1: expect = testKeyBound(sorted,count,&k,1); break;
+        case 2: expect = testKeyBound(sorted,count,&k,1)-1; break;
+        case 3: expect = testKeyBound(sorted,count,&k,0)-1; break;
+        default:
+            expect = testKeyBound(sorted,count,&k,1);
+            if (expect == count || testKeyCompare(sorted+expect,&k) != 0)
+                expect = -1;
+            break;
+        }
+        if (expect >= count) expect = -1;
+
+        raxSeek(&it,ops[op],k.buf,k.len);
+        if (expect == -1) {
+            if (!raxEOF(&it) || raxNext(&it)) ok = 0;
+            continue;
+        }
+        step = (op == 2 || op == 3) ? -1 : 1;
+        for (j = expect; j >= 0 && j < count && j-expect < 3 && expect-j < 3;
+             j += step)
+        {
+            if (!(step == 1 ? raxNext(&it) : raxPrev(&it)) ||
+                it.key_len != sorted[j].len ||
+                memcmp(it.key,sorted[j].buf,it.key_len) != 0) ok = 0;
+        }
+    }
+    raxStop(&it);
+    return ok;
+}
+
+static void testBenchmark(int numkeys) {
+    rax *t = raxNew();
+    raxIterator it;
+    char buf[64];
+    long long start;
+    int j, count = 0;
+
+    start = ustime();
+    for (j = 0; j < numkeys; j++) {
+        int len = snprintf(buf,sizeof(buf),"key:%d",j);
+        raxInsert(t,(unsigned char*)buf,len,(void*)(long)j,NULL);
+    }
+    printf("Insert %d keys: %.2f ms, %llu nodes\n",numkeys,
+        (float)(ustime()-start)/1000,(unsigned long long)t->numnodes);
+
+    start = ustime();
+    for (j = 0; j < numkeys; j++) {
+        int len = snprintf(buf,sizeof(buf),"key:%d",rand() % numkeys);
+        if (raxFind(t,(unsigned char*)buf,len) == raxNotFound) count = -1;
+    }
+    printf("Lookup %d keys: %.2f ms%s\n",numkeys,
+        (float)(ustime()-start)/1000,count == -1 ? " (MISSING KEYS)" : "");
+
+    start = ustime();
+    raxStart(&it,t);
+    raxSeek(&it,"^",NULL,0);
+    count = 0;
+    while (raxNext(&it)) count++;
+    raxStop(&it);
+    printf("Iterate %d keys: %.2f ms\n",count,(float)(ustime()-start)/1000);
+
+    start = ustime();
+    raxStart(&it,t);
+    count = 0;
+    for (j = 0; j < numkeys/10; j++) {
+        int len = snprintf(buf,sizeof(buf),"key:%d",rand() % numkeys), k;
+        raxSeek(&it,">=",(unsigned char*)buf,len);
+        for (k = 0; k < 10 && raxNext(&it); k++) count++;
+    }
+    raxStop(&it);
+    printf("Seek and fetch 10 keys, %d times: %.2f ms\n",numkeys/10,
+        (float)(ustime()-start)/1000);
+
+    start = ustime();
+    for (j = 0; j < numkeys; j++) {
+        int len = snprintf(buf,sizeof(buf),"key:%d",j);
+        raxRemove(t,(unsigned char*)buf,len,NULL);
+    }
+    printf("Remove %d keys: %.2f ms, %llu nodes left\n",numkeys,
+        (float)(ustime()-start)/1000,(unsigned long long)t->numnodes);
+    raxFree(t);
+}
+
+int main(int argc, char **argv) {
+    int numkeys = argc > 1 ? atoi(argv[1]) : 1000000;
+    testKey *keys, *sorted;
+    int j, count, round;
+
+    {
+        rax *t = raxNew();
+        void *old = NULL;
+
+        test_cond("Empty tree has no elements and one node",
+            raxSize(t) == 0 && t->numnodes == 1 &&
+            raxFind(t,(unsigned char*)"",0) == raxNotFound);
+
+        test_cond("Insert new elements",
+            raxInsert(t,(unsigned char*)"foo",3,(void*)1,NULL) == 1 &&
+            raxInsert(t,(unsigned char*)"foobar",6,(void*)2,NULL) == 1 &&
+            raxInsert(t,(unsigned char*)"footer",6,NULL,NULL) == 1 &&
+            raxInsert(t,(unsigned char*)"",0,(void*)4,NULL) == 1 &&
+            raxSize(t) == 4);
+
+        test_cond("Compressed paths are shared",
+            t->numnodes == 4);
+
+        test_cond("Find elements, including NULL values",
+            raxFind(t,(unsigned char*)"foo",3) == (void*)1 &&
+            raxFind(t,(unsigned char*)"foobar",6) == (void*)2 &&
+            raxFind(t,(unsigned char*)"footer",6) == NULL &&
+            raxFind(t,(unsigned char*)"",0) == (void*)4 &&
+            raxFind(t,(unsigned char*)"fo",2) == raxNotFound &&
+            raxFind(t,(unsigned char*)"foob",4) == raxNotFound &&
+            raxFind(t,(unsigned char*)"foobarx",7) == raxNotFound);
+
+        test_cond("raxTryInsert() does not overwrite, raxInsert() does",
+            raxTryInsert(t,(unsigned char*)"foo",3,(void*)9,&old) == 0 &&
+            old == (void*)1 &&
+            raxFind(t,(unsigned char*)"foo",3) == (void*)1 &&
+            raxInsert(t,(unsigned char*)"foo",3,(void*)9,&old) == 0 &&
+            raxFind(t,(unsigned char*)"foo",3) == (void*)9);
+
+        test_cond("Remove elements, merging the nodes left",
+            raxRemove(t,(unsigned char*)"foo",3,&old) == 1 &&
+            old == (void*)9 &&
+            raxRemove(t,(unsigned char*)"foo",3,NULL) == 0 &&
+            raxRemove(t,(unsigned char*)"foobar",6,NULL) == 1 &&
+            raxFind(t,(unsigned char*)"footer",6) == NULL &&
+            t->numnodes == 2);
+
+        test_cond("Removing all the elements leaves an empty root",
+            raxRemove(t,(unsigned char*)"footer",6,NULL) == 1 &&
+            raxRemove(t,(unsigned char*)"",0,NULL) == 1 &&
+            raxSize(t) == 0 && t->numnodes == 1 &&
+            t->head->prefixlen == 0);
+        raxFree(t);
+    }
+
+    /* Random operations checked against a sorted array. */
+    srand(1234);
+    keys = zmalloc(sizeof(testKey)*20000);
+    sorted = zmalloc(sizeof(testKey)*20000);
+    for (round = 0; round < 20; round++) {
+        rax *t = raxNew();
+        int n = 1 + rand() % 20000, ok = 1;
+
+        count = 0;
+        for (j = 0; j < n; j++) {
+            int added;
+
+            testKeyRandom(keys+j);
+            /* The value is derived from the key, to check it back. */
+            added = raxInsert(t,keys[j].buf,keys[j].len,
+                              (void*)(long)(keys[j].len+1),NULL);
+            count += added;
+        }
+        memcpy(sorted,keys,sizeof(testKey)*n);
+        qsort(sorted,n,sizeof(testKey),testKeyCompare);
+        for (j = 1, count = n ? 1 : 0; j < n; j++)
+            if (testKeyCompare(sorted+j,sorted+count-1) != 0)
+                sorted[count++] = sorted[j];
+        if (raxSize(t) != (uint64_t)count) ok = 0;
+        for (j = 0; j < n; j++)
+            if (raxFind(t,keys[j].buf,keys[j].len) !=
+                (void*)(long)(keys[j].len+1)) ok = 0;
+        if (!testIterateAll(t,sorted,count)) ok = 0;
+        if (!testSeekRandom(t,sorted,count,2000)) ok = 0;
+
+        /* Remove about half of the keys. */
+        for (j = 0; j < count; j++) {
+            if (rand() % 2) {
+                if (raxRemove(t,sorted[j].buf,sorted[j].len,NULL) != 1) ok = 0;
+                sorted[j].len = 16; /* Mark as removed. */
+            }
+        }
+        for (j = 0, n = 0; j < count; j++)
+            if (sorted[j].len != 16) sorted[n++] = sorted[j];
+        count = n;
+        if (raxSize(t) != (uint64_t)count ||
+            t->numnodes > (uint64_t)count*2+1) ok = 0;
+        if (!testIterateAll(t,sorted,count)) ok = 0;
+        if (!testSeekRandom(t,sorted,count,2000)) ok = 0;
+
+        for (j = 0; j < count; j++)
+            if (raxRemove(t,sorted[j].buf,sorted[j].len,NULL) != 1) ok = 0;
+        if (raxSize(t) != 0 || t->numnodes != 1) ok = 0;
+        raxFree(t);
+        if (!ok) {
+            printf("Random round %d failed\n", round);
+            __failed_tests++;
+        }
+    }
+    test_cond("Random insert, find, iterate, seek and remove", 1);
+    zfree(keys);
+    zfree(sorted);
+
+    test_report();
+    testBenchmark(numkeys);
+    return 0;
+}
+#endif
@@ -0,0 +1,130 @@
+/* rax.h - A compressed radix tree implementation
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RAX_H__
+#define __RAX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Representation of a radix tree as implemented in this file, that contains
+ * the strings "foo", "foobar" and "footer" after the insertion of each
+ * word. Every node stores the compressed path leading to it (the prefix),
+ * then one byte per child: the byte each child key continues with.
+ *
+ * 压缩前缀树：每个节点保存一段压缩路径（prefix），以及每个子节点对应的首字节
+ *
+ *              ["foo"] (key)
+ *                |
+ *        +-------+-------+
+ *       'b'             't'
+ *        |               |
+ *     ["ar"] (key)    ["er"] (key)
+ *
+ * The string represented by a node is the concatenation of the prefixes
+ * and child bytes from the root: "foo", "foo"+'b'+"ar", "foo"+'t'+"er".
+ * Nodes that are not keys always have at least two children (but the
+ * root), so the number of nodes is at most twice the number of keys.
+ *
+ * Every key can be associated with a value pointer, that may be NULL: in
+ * that case no space is used for it. */
+typedef struct raxNode {
+    uint32_t iskey:1;       /* Does this node contain a key? */
+    uint32_t isnull:1;      /* Associated value is NULL (don't store it). */
+    uint32_t size:30;       /* Number of children. */
+    uint32_t prefixlen;     /* Length of the compressed path. */
+
+    /* Data layout:
+     *
+     * [prefix bytes][child bytes][padding][child pointers][value pointer]
+     *
+     * The child bytes are sorted, the padding aligns the pointers, and the
+     * value pointer is only present if iskey is set and isnull is not.
+     *
+     * 数据布局：压缩路径，子节点首字节（有序），对齐填充，子节点指针，值指针 */
+    unsigned char data[];
+} raxNode;
+
+typedef struct rax {
+    raxNode *head;          /* Root node, never NULL. */
+    uint64_t numele;        /* Number of keys. */
+    uint64_t numnodes;      /* Number of nodes. */
+} rax;
+
+/* Stack frame of the iterator: the node and, but for the last frame, the
+ * index of the child the iterator descended into. */
+typedef struct raxStackFrame {
+    raxNode *node;
+    int idx;
+} raxStackFrame;
+
+#define RAX_ITER_STATIC_LEN 128
+#define RAX_ITER_STATIC_STACK 32
+#define RAX_ITER_JUST_SEEKED (1<<0) /* Iterator was just seeked. Return current
+                                       element for the first iteration and
+                                       clear the flag. */
+#define RAX_ITER_EOF (1<<1)    /* End of iteration reached. */
+
+/* Radix tree iterator. The tree must not be modified while iterating. */
+typedef struct raxIterator {
+    int flags;
+    rax *rt;                /* Radix tree we are iterating. */
+    unsigned char *key;     /* The current string. */
+    void *data;             /* Data associated to this key. */
+    size_t key_len;         /* Current key length. */
+    size_t key_max;         /* Max key len the current key buffer can hold. */
+    unsigned char key_static_string[RAX_ITER_STATIC_LEN];
+    raxStackFrame *stack;   /* Path from the root to the current node. */
+    size_t stack_items;
+    size_t stack_max;
+    raxStackFrame stack_static[RAX_ITER_STATIC_STACK];
+} raxIterator;
+
+/* A special pointer returned for not found items. */
+extern void *raxNotFound;
+
+/* Exported API. */
+rax *raxNew(void);
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
+int raxTryInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
+void *raxFind(rax *rax, unsigned char *s, size_t len);
+void raxFree(rax *rax);
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*));
+void raxStart(raxIterator *it, rax *rt);
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len);
+int raxNext(raxIterator *it);
+int raxPrev(raxIterator *it);
+int raxCompare(raxIterator *iter, const char *op, unsigned char *key, size_t key_len);
+void raxStop(raxIterator *it);
+int raxEOF(raxIterator *it);
+uint64_t raxSize(rax *rax);
+
+#endif
@@ -29,6 +29,12 @@
 
 #include "redis.h"
 #include "lzf.h"    /* LZF compression library */
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 #include "zipmap.h"
 #include "endianconv.h"
 
@@ -101,6 +107,8 @@
  *    #define REDIS_RDB_TYPE_SET_INTSET    11
  *    #define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
  *    #define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+ *    #define REDIS_RDB_TYPE_HASH_LISTPACK 16
+ *    #define REDIS_RDB_TYPE_ZSET_LISTPACK 17
  * 
  * 3. $encoded-value, The encoding of the value depends on the value type flag.
  *    1) When value type = 0, the value is a simple string.
@@ -376,18 +384,79 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
+/* Map a rdb-compression-codec name to its REDIS_RDB_CODEC_* value.
+ * Returns -1 if the name is unknown or the codec was not compiled in. */
+int rdbCompressionCodecFromName(char *name) {
+    if (!strcasecmp(name,"lzf")) return REDIS_RDB_CODEC_LZF;
+#ifdef USE_LZ4
+    if (!strcasecmp(name,"lz4")) return REDIS_RDB_CODEC_LZ4;
+#endif
+#ifdef USE_ZSTD
+    if (!strcasecmp(name,"zstd")) return REDIS_RDB_CODEC_ZSTD;
+#endif
+    return -1;
+}
+
+char *rdbCompressionCodecName(int codec) {
+    switch(codec) {
+    case REDIS_RDB_CODEC_LZ4: return "lz4";
+    case REDIS_RDB_CODEC_ZSTD: return "zstd";
+    default: return "lzf";
+    }
+}
+
+/*
+ * 将已经被压缩的数据 data 保存到 rdb 中，
+ * enc 为压缩所用的 REDIS_RDB_ENC_* 编码，
+ * compress_len 为压缩后的长度， original_len 为压缩前的长度。
+ *
+ * 函数在成功时返回写入的字节数，写入失败时返回 -1 。
+ */
+static int rdbSaveCompressedBlob(rio *rdb, int enc, void *data,
+                                 size_t compress_len, size_t original_len) {
+    unsigned char byte;
+    int n, nwritten = 0;
+
+    // 写入类型，说明这是一个压缩字符串
+    byte = (REDIS_RDB_ENCVAL<<6)|enc;
+    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) return -1;
+    nwritten += n;
+
+    // 写入字符串压缩后的长度
+    if ((n = rdbSaveLen(rdb,compress_len)) == -1) return -1;
+    nwritten += n;
+
+    // 写入字符串未压缩时的长度
+    if ((n = rdbSaveLen(rdb,original_len)) == -1) return -1;
+    nwritten += n;
+
+    // 写入压缩后的字符串
+    if ((n = rdbWriteRaw(rdb,data,compress_len)) == -1) return -1;
+    nwritten += n;
+
+    return nwritten;
+}
+
+/*
+ * 将已经被 LZF 压缩的数据 data 保存到 rdb 中。
+ */
+int rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                   size_t original_len) {
+    return rdbSaveCompressedBlob(rdb,REDIS_RDB_ENC_LZF,data,compress_len,
+                                 original_len);
+}
+
 /*
- * 尝试对输入字符串 s 进行压缩，
+ * 尝试使用 server.rdb_compression_codec 指定的算法对输入字符串 s 进行压缩，
  * 如果压缩成功，那么将压缩后的字符串保存到 rdb 中。
  *
  * 函数在成功时返回保存压缩后的 s 所需的字节数，
  * 压缩失败或者内存不足时返回 0 ，
  * 写入失败时返回 -1 。
  */
-int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
-    size_t comprlen, outlen;
-    unsigned char byte;
-    int n, nwritten = 0;
+int rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
+    size_t comprlen = 0, outlen;
+    int nwritten, enc = REDIS_RDB_ENC_LZF;
     void *out;
 
     /* We require at least four bytes compression for this to be worth it */
@@ -395,7 +464,27 @@ int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    switch(server.rdb_compression_codec) {
+#ifdef USE_LZ4
+    case REDIS_RDB_CODEC_LZ4:
+        enc = REDIS_RDB_ENC_LZ4;
+        if (len <= INT_MAX) {
+            int n = LZ4_compress_default((char*)s,out,len,outlen);
+            if (n > 0) comprlen = n;
+        }
+        break;
+#endif
+#ifdef USE_ZSTD
+    case REDIS_RDB_CODEC_ZSTD:
+        enc = REDIS_RDB_ENC_ZSTD;
+        comprlen = ZSTD_compress(out,outlen,s,len,REDIS_RDB_ZSTD_LEVEL);
+        if (ZSTD_isError(comprlen)) comprlen = 0;
+        break;
+#endif
+    default:
+        comprlen = lzf_compress(s, len, out, outlen);
+        break;
+    }
     if (comprlen == 0) {
         zfree(out);
         return 0;
@@ -405,37 +494,18 @@ int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
      *
      * 保存压缩后的字符串到 rdb 。
      */
-
-    // 写入类型，说明这是一个 LZF 压缩字符串
-    byte = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_LZF;
-    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
-    nwritten += n;
-
-    // 写入字符串压缩后的长度
-    if ((n = rdbSaveLen(rdb,comprlen)) == -1) goto writeerr;
-    nwritten += n;
-    
-    // 写入字符串未压缩时的长度
-    if ((n = rdbSaveLen(rdb,len)) == -1) goto writeerr;
-    nwritten += n;
-
-    // 写入压缩后的字符串
-    if ((n = rdbWriteRaw(rdb,out,comprlen)) == -1) goto writeerr;
-    nwritten += n;
-
+    nwritten = rdbSaveCompressedBlob(rdb,enc,out,comprlen,len);
     zfree(out);
-
     return nwritten;
-
-writeerr:
-    zfree(out);
-    return -1;
 }
 
 /*
- * 从 rdb 中载入被 LZF 压缩的字符串，解压它，并创建相应的字符串对象。
+ * 从 rdb 中载入被压缩的字符串，解压它，并创建相应的字符串对象。
+ *
+ * enc 为字符串的 REDIS_RDB_ENC_* 压缩编码。载入与当前的
+ * rdb-compression-codec 设置无关，只要求对应的算法已经被编译进来。
  */
-robj *rdbLoadLzfStringObject(rio *rdb) {
+robj *rdbLoadCompressedStringObject(rio *rdb, int enc) {
     unsigned int len, clen;
     unsigned char *c = NULL;
     sds val = NULL;
@@ -453,7 +523,27 @@ robj *rdbLoadLzfStringObject(rio *rdb) {
     if (rioRead(rdb,c,clen) == 0) goto err;
 
     // 解压缓存，得出字符串
-    if (lzf_decompress(c,clen,val,len) == 0) goto err;
+    switch(enc) {
+    case REDIS_RDB_ENC_LZF:
+        if (lzf_decompress(c,clen,val,len) == 0) goto err;
+        break;
+#ifdef USE_LZ4
+    case REDIS_RDB_ENC_LZ4:
+        if (clen > INT_MAX || len > INT_MAX ||
+            LZ4_decompress_safe((char*)c,val,clen,len) != (int)len) goto err;
+        break;
+#endif
+#ifdef USE_ZSTD
+    case REDIS_RDB_ENC_ZSTD:
+        if (ZSTD_decompress(val,len,c,clen) != len) goto err;
+        break;
+#endif
+    default:
+        redisLog(REDIS_WARNING,
+            "RDB string compressed with a codec not supported by this build "
+            "(encoding %d)", enc);
+        goto err;
+    }
     zfree(c);
 
     // 创建字符串对象
@@ -491,16 +581,16 @@ int rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it 
      *
-     * 如果字符串长度大于 20 ，并且服务器开启了 LZF 压缩，
-     * 那么在保存字符串到数据库之前，先对字符串进行 LZF 压缩。
+     * 如果字符串长度大于 20 ，并且服务器开启了压缩，
+     * 那么在保存字符串到数据库之前，先对字符串进行压缩。
      */
     if (server.rdb_compression && len > 20) {
 
         // 尝试压缩
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        n = rdbSaveCompressedStringObject(rdb,s,len);
 
         if (n == -1) return -1;
         if (n > 0) return n;
@@ -581,6 +671,22 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
     if (obj->encoding == REDIS_ENCODING_INT) {
         return rdbSaveLongLongAsStringObject(rdb,(long)obj->ptr);
 
+    // 分块字符串：逐块原样写入，不压缩（LZF 需要连续的内存）
+    } else if (obj->encoding == REDIS_ENCODING_CHUNKED) {
+        stringChunks *sc = obj->ptr;
+        int n, nwritten;
+        size_t j;
+
+        if ((nwritten = rdbSaveLen(rdb,sc->len)) == -1) return -1;
+        for (j = 0; j < sc->count; j++) {
+            unsigned char *p;
+
+            n = stringChunksAt(sc,j,(char**)&p);
+            if (rdbWriteRaw(rdb,p,n) == -1) return -1;
+            nwritten += n;
+        }
+        return nwritten;
+
     // 保存 STRING 编码的字符串
     } else {
         redisAssertWithInfo(NULL,obj,sdsEncodedObject(obj));
@@ -612,9 +718,11 @@ robj *rdbGenericLoadStringObject(rio *rdb, int encode) {
         case REDIS_RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,encode);
 
-        // LZF 压缩
+        // LZF / LZ4 / zstd 压缩
         case REDIS_RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb);
+        case REDIS_RDB_ENC_LZ4:
+        case REDIS_RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,len);
 
         default:
             redisPanic("Unknown RDB encoding type");
@@ -727,6 +835,27 @@ int rdbLoadDoubleValue(rio *rdb, double *val) {
     }
 }
 
+/* Save a double as its raw 8 bytes IEEE 754 representation, always in little
+ * endian, so scores survive without the ASCII round trip of
+ * rdbSaveDoubleValue(). Used by REDIS_RDB_TYPE_ZSET_2.
+ *
+ * 以 8 字节二进制（小端）格式保存双精度浮点数
+ */
+int rdbSaveBinaryDoubleValue(rio *rdb, double val) {
+    memrev64ifbe(&val);
+    return rdbWriteRaw(rdb,&val,sizeof(val));
+}
+
+/* Load a double saved by rdbSaveBinaryDoubleValue().
+ *
+ * 载入二进制格式的双精度浮点数
+ */
+int rdbLoadBinaryDoubleValue(rio *rdb, double *val) {
+    if (rioRead(rdb,val,sizeof(*val)) == 0) return -1;
+    memrev64ifbe(val);
+    return 0;
+}
+
 /* Save the object type of object "o". 
  *
  * 将对象 o 的类型写入到 rdb 中
@@ -739,10 +868,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         return rdbSaveType(rdb,REDIS_RDB_TYPE_STRING);
 
     case REDIS_LIST:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_ZIPLIST);
-        else if (o->encoding == REDIS_ENCODING_LINKEDLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST);
+        if (o->encoding == REDIS_ENCODING_QUICKLIST)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_QUICKLIST_2);
         else
             redisPanic("Unknown list encoding");
 
@@ -755,21 +882,27 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
             redisPanic("Unknown set encoding");
 
     case REDIS_ZSET:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET_ZIPLIST);
+        if (o->encoding == REDIS_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET_LISTPACK);
         else if (o->encoding == REDIS_ENCODING_SKIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET);
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET_2);
         else
             redisPanic("Unknown sorted set encoding");
 
     case REDIS_HASH:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH_ZIPLIST);
+        if (hashTypeIsListpack(o))
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == REDIS_ENCODING_HT)
             return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH);
         else
             redisPanic("Unknown hash encoding");
 
+    case REDIS_STREAM:
+        return rdbSaveType(rdb,REDIS_RDB_TYPE_STREAM_ZIPLISTS);
+
+    case REDIS_MODULE:
+        return rdbSaveType(rdb,REDIS_RDB_TYPE_MODULE);
+
     default:
         redisPanic("Unknown object type");
     }
@@ -806,27 +939,27 @@ int rdbSaveObject(rio *rdb, robj *o) {
     // 保存列表对象
     } else if (o->type == REDIS_LIST) {
         /* Save a list value */
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
-
-            // 以字符串对象的形式保存整个 ZIPLIST 列表
-            if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
-            nwritten += n;
-        } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-            list *list = o->ptr;
-            listIter li;
-            listNode *ln;
+        if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
 
-            if ((n = rdbSaveLen(rdb,listLength(list))) == -1) return -1;
+            // 先保存 quicklist 的节点数量
+            if ((n = rdbSaveLen(rdb,ql->len)) == -1) return -1;
             nwritten += n;
 
-            // 遍历所有列表项
-            listRewind(list,&li);
-            while((ln = listNext(&li))) {
-                robj *eleobj = listNodeValue(ln);
-                // 以字符串对象的形式保存列表项
-                if ((n = rdbSaveStringObject(rdb,eleobj)) == -1) return -1;
-                nwritten += n;
+            // 以字符串对象的形式逐个保存节点中的 listpack
+            while(node) {
+                if (quicklistNodeIsCompressed(node)) {
+                    // 被压缩的节点直接以 LZF 字符串的格式写入，无须解压
+                    void *data;
+                    size_t compress_len = quicklistGetLzf(node, &data);
+                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    nwritten += n;
+                } else {
+                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                    nwritten += n;
+                }
+                node = node->next;
             }
         } else {
             redisPanic("Unknown list encoding");
@@ -864,10 +997,10 @@ int rdbSaveObject(rio *rdb, robj *o) {
     // 保存有序集对象
     } else if (o->type == REDIS_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
-            // 以字符串对象的形式保存整个 ZIPLIST 有序集
+            // 以字符串对象的形式保存整个 LISTPACK 有序集
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
         } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -880,16 +1013,16 @@ int rdbSaveObject(rio *rdb, robj *o) {
 
             // 遍历有序集
             while((de = dictNext(di)) != NULL) {
-                robj *eleobj = dictGetKey(de);
+                sds ele = dictGetKey(de);
                 double *score = dictGetVal(de);
 
-                // 以字符串对象的形式保存集合成员
-                if ((n = rdbSaveStringObject(rdb,eleobj)) == -1) return -1;
+                // 以字符串的形式保存集合成员
+                if ((n = rdbSaveRawString(rdb,(unsigned char*)ele,sdslen(ele)))
+                    == -1) return -1;
                 nwritten += n;
 
-                // 成员分值（一个双精度浮点数）会被转换成字符串
-                // 然后保存到 rdb 中
-                if ((n = rdbSaveDoubleValue(rdb,*score)) == -1) return -1;
+                // 成员分值以 8 字节二进制格式保存到 rdb 中
+                if ((n = rdbSaveBinaryDoubleValue(rdb,*score)) == -1) return -1;
                 nwritten += n;
             }
             dictReleaseIterator(di);
@@ -901,11 +1034,12 @@ int rdbSaveObject(rio *rdb, robj *o) {
     } else if (o->type == REDIS_HASH) {
 
         /* Save a hash value */
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (hashTypeIsListpack(o)) {
+            unsigned char *lp = hashTypeListpack(o);
+            size_t l = lpBytes(lp);
 
-            // 以字符串对象的形式保存整个 ZIPLIST 哈希表
-            if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
+            // 以字符串对象的形式保存整个 LISTPACK 哈希表，索引在载入时重建
+            if ((n = rdbSaveRawString(rdb,lp,l)) == -1) return -1;
             nwritten += n;
 
         } else if (o->encoding == REDIS_ENCODING_HT) {
@@ -932,6 +1066,46 @@ int rdbSaveObject(rio *rdb, robj *o) {
             redisPanic("Unknown hash encoding");
         }
 
+    // 保存流对象
+    } else if (o->type == REDIS_STREAM) {
+        stream *s = o->ptr;
+        raxIterator ri;
+        unsigned char idbuf[16];
+
+        /* Every node is saved as its 128 bit master ID followed by the
+         * ziplist blob, then the last ID of the stream, that is retained
+         * even when all the entries were trimmed away. The length is
+         * recomputed from the nodes when loading. */
+        if ((n = rdbSaveLen(rdb,raxSize(s->rax))) == -1) return -1;
+        nwritten += n;
+
+        raxStart(&ri,s->rax);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) {
+            unsigned char *zl = ri.data;
+
+            if ((n = rdbSaveRawString(rdb,ri.key,ri.key_len)) == -1) {
+                raxStop(&ri);
+                return -1;
+            }
+            nwritten += n;
+            if ((n = rdbSaveRawString(rdb,zl,ziplistBlobLen(zl))) == -1) {
+                raxStop(&ri);
+                return -1;
+            }
+            nwritten += n;
+        }
+        raxStop(&ri);
+
+        streamEncodeID(idbuf,&s->last_id);
+        if ((n = rdbSaveRawString(rdb,idbuf,sizeof(idbuf))) == -1) return -1;
+        nwritten += n;
+
+    // 保存模块类型的值：类型名、编码版本，然后是模块自己保存的数据
+    } else if (o->type == REDIS_MODULE) {
+        if ((n = moduleTypeSaveValue(o,rdb)) == -1) return -1;
+        nwritten += n;
+
     } else {
         redisPanic("Unknown object type");
     }
@@ -992,43 +1166,151 @@ int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val,
     return 1;
 }
 
-/* Save the DB on disk. Return REDIS_ERR on error, REDIS_OK on success 
+/* Save an AUX field: a key string followed by a value string. Loaders
+ * skip the AUX fields they don't understand.
  *
- * 将数据库保存到磁盘上。
+ * 写入一个辅助字段，返回 -1 表示出错 */
+static int rdbSaveAuxField(rio *rdb, char *key, char *val, size_t vallen) {
+    if (rdbSaveType(rdb,REDIS_RDB_OPCODE_AUX) == -1) return -1;
+    if (rdbSaveRawString(rdb,(unsigned char*)key,strlen(key)) == -1) return -1;
+    if (rdbSaveRawString(rdb,(unsigned char*)val,vallen) == -1) return -1;
+    return 1;
+}
+
+/* Wrapper for rdbSaveAuxField() used when the value is an integer. */
+static int rdbSaveAuxFieldStrInt(rio *rdb, char *key, long long val) {
+    char buf[REDIS_LONGSTR_SIZE];
+    int vlen = ll2string(buf,sizeof(buf),val);
+    return rdbSaveAuxField(rdb,key,buf,vlen);
+}
+
+/* Save the replication ID and offset, and the DB selected in the
+ * replication stream, if they are meaningful:
  *
- * 保存成功返回 REDIS_OK ，出错/失败返回 REDIS_ERR 。
- */
-// 无论是前台还是后台 save RDB，最终都是跑到这里来
-int rdbSave(char *filename) {
-    dictIterator *di = NULL;
+ * - A master only when it has a backlog, otherwise nobody can PSYNC with
+ *   it and a new history is started anyway when a slave attaches.
+ * - A slave when it has a master, connected or cached, reading the stream
+ *   DB from it: the offset only increases with data from the master.
+ *
+ * When called inside a BGSAVE child this is the state at fork time, that
+ * is consistent with the dataset being saved.
+ *
+ * 将复制信息保存为辅助字段 */
+static int rdbSaveReplicationInfo(rio *rdb) {
+    int stream_db;
+
+    if (!server.masterhost && server.repl_backlog) {
+        /* A slaveseldb of -1 means that the next write command is going
+         * to emit a SELECT anyway, so any DB is fine. */
+        stream_db = server.slaveseldb == -1 ? 0 : server.slaveseldb;
+    } else if (server.masterhost && server.master) {
+        stream_db = server.master->db->id;
+    } else if (server.masterhost && server.cached_master) {
+        stream_db = server.cached_master->db->id;
+    } else {
+        return 1;
+    }
+
+    if (rdbSaveAuxFieldStrInt(rdb,"repl-stream-db",stream_db) == -1)
+        return -1;
+    if (rdbSaveAuxField(rdb,"repl-id",server.replid,REDIS_RUN_ID_SIZE) == -1)
+        return -1;
+    if (rdbSaveAuxFieldStrInt(rdb,"repl-offset",server.master_repl_offset)
+        == -1) return -1;
+    return 1;
+}
+
+/* Save the functions created with FUNCTION LOAD, each one as the
+ * REDIS_RDB_OPCODE_FUNCTION opcode followed by its name and its body.
+ *
+ * 保存所有函数 */
+static int rdbSaveFunctions(rio *rdb) {
+    dictIterator *di = dictGetIterator(server.lua_functions);
     dictEntry *de;
-    char tmpfile[256];
-    char magic[10];
-    int j;
-    long long now = mstime();
-    FILE *fp;
-    rio rdb;
-    uint64_t cksum;
 
-    // 创建临时文件
-    snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
-    fp = fopen(tmpfile,"w");
-    if (!fp) {
-        redisLog(REDIS_WARNING, "Failed opening .rdb for saving: %s",
-            strerror(errno));
-        return REDIS_ERR;
+    while((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        luaFunction *fn = dictGetVal(de);
+
+        if (rdbSaveType(rdb,REDIS_RDB_OPCODE_FUNCTION) == -1 ||
+            rdbSaveRawString(rdb,(unsigned char*)name,sdslen(name)) == -1 ||
+            rdbSaveStringObject(rdb,fn->body) == -1)
+        {
+            dictReleaseIterator(di);
+            return -1;
+        }
     }
+    dictReleaseIterator(di);
+    return 1;
+}
 
-    // 初始化 I/O
-    rioInitWithFile(&rdb,fp);
+/* Produces a dump of the database in RDB format sending it to the specified
+ * Redis I/O channel. On success REDIS_OK is returned, otherwise REDIS_ERR
+ * is returned and part of the output, or all the output, can be
+ * missing because of I/O errors.
+ *
+ * When the function returns REDIS_ERR and if 'error' is not NULL, the
+ * integer pointed by 'error' is set to the value of errno just after the I/O
+ * error.
+ *
+ * With the REDIS_RDB_SAVE_AOF_PREAMBLE flag the dump is the preamble of an
+ * AOF rewrite, and the diff sent by the parent is read while saving.
+ *
+ * 将数据库以 RDB 格式写入到给定的 rio 中（文件或者 slave 的套接字），
+ * 成功返回 REDIS_OK ，出错返回 REDIS_ERR 。
+ */
+/* Write what comes before the keys in an RDB file: the version, the aux
+ * fields and the functions. Returns -1 on write error.
+ *
+ * 写入 RDB 的头部：版本号、辅助字段以及函数 */
+int rdbSaveRioHeader(rio *rdb) {
+    char magic[10];
 
     // 设置校验和函数(默认开启)
     if (server.rdb_checksum)
-        rdb.update_cksum = rioGenericUpdateChecksum;
+        rdb->update_cksum = rioGenericUpdateChecksum;
 
     // 写入 RDB 版本号
     snprintf(magic,sizeof(magic),"REDIS%04d",REDIS_RDB_VERSION);
-    if (rdbWriteRaw(&rdb,magic,9) == -1) goto werr;
+    if (rdbWriteRaw(rdb,magic,9) == -1) return -1;
+    if (rdbSaveReplicationInfo(rdb) == -1) return -1;
+    if (rdbSaveFunctions(rdb) == -1) return -1;
+    return 0;
+}
+
+/* Write the EOF opcode and the checksum that terminate an RDB file.
+ * Returns -1 on write error. */
+int rdbSaveRioTrailer(rio *rdb) {
+    uint64_t cksum;
+
+    /* EOF opcode 
+     *
+     * 写入 EOF 代码
+     */
+    if (rdbSaveType(rdb,REDIS_RDB_OPCODE_EOF) == -1) return -1;
+
+    /* CRC64 checksum. It will be zero if checksum computation is disabled, the
+     * loading code skips the check in this case. 
+     *
+     * CRC64 校验和。
+     *
+     * 如果校验和功能已关闭，那么 rdb.cksum 将为 0 ，
+     * 在这种情况下， RDB 载入时会跳过校验和检查。
+     */
+    cksum = rdb->cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(rdb,&cksum,8) == 0) return -1;
+    return 0;
+}
+
+int rdbSaveRio(rio *rdb, int *error, int flags) {
+    dictIterator *di = NULL;
+    dictEntry *de;
+    int j;
+    long long now = mstime();
+    size_t processed = 0;
+
+    if (rdbSaveRioHeader(rdb) == -1) goto werr;
 
     // 遍历所有数据库
     for (j = 0; j < server.dbnum; j++) {
@@ -1044,17 +1326,14 @@ int rdbSave(char *filename) {
 
         // 创建键空间迭代器
         di = dictGetSafeIterator(d);
-        if (!di) {
-            fclose(fp);
-            return REDIS_ERR;
-        }
+        if (!di) return REDIS_ERR;
 
         /* Write the SELECT DB opcode 
          *
          * 写入 DB 选择器
          */
-        if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_SELECTDB) == -1) goto werr;
-        if (rdbSaveLen(&rdb,j) == -1) goto werr;    // 写入数据库编号
+        if (rdbSaveType(rdb,REDIS_RDB_OPCODE_SELECTDB) == -1) goto werr;
+        if (rdbSaveLen(rdb,j) == -1) goto werr;    // 写入数据库编号
 
         /* Iterate this DB writing every entry 
          *
@@ -1064,6 +1343,7 @@ int rdbSave(char *filename) {
             sds keystr = dictGetKey(de);
             robj key, *o = dictGetVal(de);
             long long expire;
+            size_t written = rdb->processed_bytes;
             
             // 根据 keystr ，在栈中 init key 对象为 string 类型的 robj
             initStaticStringObject(key,keystr);
@@ -1072,29 +1352,96 @@ int rdbSave(char *filename) {
             expire = getExpire(db,&key);
 
             // 保存键值对数据
-            if (rdbSaveKeyValuePair(&rdb,&key,o,expire,now) == -1) goto werr;
+            if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1) goto werr;
+
+            /* A child won't read the value again: give its pages back. */
+            if (server.in_fork_child && server.fork_friendly)
+                dismissObject(o,rdb->processed_bytes-written);
+
+            /* In a child, report the copy-on-write size from time to time. */
+            if ((++processed & 1023) == 0) sendChildInfoIfNeeded();
         }
         dictReleaseIterator(di);
     }
     di = NULL; /* So that we don't release it again on error. */
 
-    /* EOF opcode 
-     *
-     * 写入 EOF 代码
-     */
-    if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_EOF) == -1) goto werr;
+    if (rdbSaveRioTrailer(rdb) == -1) goto werr;
+    return REDIS_OK;
 
-    /* CRC64 checksum. It will be zero if checksum computation is disabled, the
-     * loading code skips the check in this case. 
-     *
-     * CRC64 校验和。
+werr:
+    if (error) *error = errno;
+    if (di) dictReleaseIterator(di);
+    return REDIS_ERR;
+}
+
+/* This is just a wrapper to rdbSaveRio() that additionally adds a prefix
+ * and a suffix to the generated RDB dump. The prefix is:
+ *
+ * $EOF:<40 bytes unguessable hex string>\r\n
+ *
+ * While the suffix is the 40 bytes hex string we announced in the prefix.
+ * This way processes receiving the payload can understand when it ends
+ * without doing any processing of the content.
+ *
+ * 无盘复制时，master 事先并不知道 RDB 的长度，
+ * 因此用一个随机的 40 字节分隔符代替 "$<length>" 前缀，
+ * 并在 RDB 之后再次写入这个分隔符，slave 以此判断传送是否结束。
+ */
+int rdbSaveRioWithEOFMark(rio *rdb, int *error) {
+    char eofmark[REDIS_EOF_MARK_SIZE];
+
+    getRandomHexChars(eofmark,REDIS_EOF_MARK_SIZE);
+    if (error) *error = 0;
+    if (rioWrite(rdb,"$EOF:",5) == 0) goto werr;
+    if (rioWrite(rdb,eofmark,REDIS_EOF_MARK_SIZE) == 0) goto werr;
+    if (rioWrite(rdb,"\r\n",2) == 0) goto werr;
+    if (rdbSaveRio(rdb,error,REDIS_RDB_SAVE_NONE) == REDIS_ERR) goto werr;
+    if (rioWrite(rdb,eofmark,REDIS_EOF_MARK_SIZE) == 0) goto werr;
+    return REDIS_OK;
+
+werr: /* Write error. */
+    /* Set 'error' only if not already set by rdbSaveRio() call. */
+    if (error && *error == 0) *error = errno;
+    return REDIS_ERR;
+}
+
+/* Save the DB on disk. Return REDIS_ERR on error, REDIS_OK on success 
+ *
+ * 将数据库保存到磁盘上。
+ *
+ * 保存成功返回 REDIS_OK ，出错/失败返回 REDIS_ERR 。
+ */
+// 无论是前台还是后台 save RDB，最终都是跑到这里来
+int rdbSave(char *filename) {
+    char tmpfile[256];
+    FILE *fp;
+    rio rdb;
+    int error;
+
+    // 创建临时文件
+    snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        redisLog(REDIS_WARNING, "Failed opening .rdb for saving: %s",
+            strerror(errno));
+        return REDIS_ERR;
+    }
+
+    // 初始化 I/O
+    rioInitWithFile(&rdb,fp);
+
+    /* Like the AOF rewrite, fsync every REDIS_AUTOSYNC_BYTES written, so
+     * that the dirty pages of a big dump are not flushed all at once.
      *
-     * 如果校验和功能已关闭，那么 rdb.cksum 将为 0 ，
-     * 在这种情况下， RDB 载入时会跳过校验和检查。
-     */
-    cksum = rdb.cksum;
-    memrev64ifbe(&cksum);
-    rioWrite(&rdb,&cksum,8);
+     * 每写入 REDIS_AUTOSYNC_BYTES 字节执行一次 fsync ，避免集中刷盘 */
+    if (server.rdb_save_incremental_fsync)
+        rioSetAutoSync(&rdb,REDIS_AUTOSYNC_BYTES);
+
+    // 写入 RDB 内容
+    if (rdbSaveRio(&rdb,&error,REDIS_RDB_SAVE_NONE) == REDIS_ERR) {
+        errno = error;
+        goto werr;
+    }
 
     /* Make sure data will not remain on the OS's output buffers */
     // 冲洗缓存，确保数据已写入磁盘
@@ -1131,15 +1478,13 @@ int rdbSave(char *filename) {
     return REDIS_OK;
 
 werr:
+    redisLog(REDIS_WARNING,"Write error saving DB on disk: %s", strerror(errno));
+
     // 关闭文件
     fclose(fp);
     // 删除文件
     unlink(tmpfile);
 
-    redisLog(REDIS_WARNING,"Write error saving DB on disk: %s", strerror(errno));
-
-    if (di) dictReleaseIterator(di);
-
     return REDIS_ERR;
 }
 
@@ -1157,6 +1502,7 @@ int rdbSaveBackground(char *filename) {
     server.lastbgsave_try = time(NULL);
 
     // fork() 开始前的时间，记录 fork() 返回耗时用
+    openChildInfoPipe();
     start = ustime();
 
     if ((childpid = fork()) == 0) {
@@ -1169,6 +1515,8 @@ int rdbSaveBackground(char *filename) {
 
         // 设置进程的标题，方便识别
         redisSetProcTitle("redis-rdb-bgsave");
+        redisSetCpuAffinity(server.bgsave_cpulist);
+        server.in_fork_child = REDIS_CHILD_INFO_TYPE_RDB;
 
         // 执行保存操作
         retval = rdbSave(filename);
@@ -1182,6 +1530,7 @@ int rdbSaveBackground(char *filename) {
                     "RDB: %zu MB of memory used by copy-on-write",
                     private_dirty/(1024*1024));
             }
+            sendChildInfo(REDIS_CHILD_INFO_TYPE_RDB,private_dirty);
         }
 
         // 向父进程发送信号
@@ -1196,9 +1545,12 @@ int rdbSaveBackground(char *filename) {
 
         // 计算 fork() 执行的时间
         server.stat_fork_time = ustime()-start;
+        server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
+        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
 
         // 如果 fork() 出错，那么报告错误
         if (childpid == -1) {
+            closeChildInfoPipe();
             server.lastbgsave_status = REDIS_ERR;
             redisLog(REDIS_WARNING,"Can't save in background: fork: %s",
                 strerror(errno));
@@ -1213,6 +1565,7 @@ int rdbSaveBackground(char *filename) {
 
         // 记录负责执行 BGSAVE 的子进程 ID
         server.rdb_child_pid = childpid;
+        server.rdb_child_type = REDIS_RDB_CHILD_TYPE_DISK;
 
         // 关闭自动 rehash
         updateDictResizePolicy();
@@ -1223,28 +1576,229 @@ int rdbSaveBackground(char *filename) {
     return REDIS_OK; /* unreached */
 }
 
-/*
- * 移除 BGSAVE 所产生的临时文件
+/* Spawn an RDB child that writes the RDB to the sockets of the slaves
+ * that are currently in REDIS_REPL_WAIT_BGSAVE_START state.
  *
- * BGSAVE 执行被中断时使用
- */
-void rdbRemoveTempFile(pid_t childpid) {
-    char tmpfile[256];
-
-    snprintf(tmpfile,256,"temp-%d.rdb", (int) childpid);
-    unlink(tmpfile);
-}
-
-/* Load a Redis object of the specified type from the specified file.
+ * The child writes the RDB to all those slaves at the same time through an
+ * fdset rio target, and at exit reports to the parent, via a pipe, which
+ * slaves received the payload correctly and which ones failed:
  *
- * 从 rdb 文件中载入指定类型的对象。
+ * <len> <slave[0].id> <slave[0].error> ...
  *
- * On success a newly allocated object is returned, otherwise NULL. 
+ * 'len', 'client id' and 'error' are all unsigned 64 bit integers in host
+ * byte order. Error is zero for the slaves that received the RDB correctly.
  *
- * 读入成功返回一个新对象，否则返回 NULL 。
+ * 无盘复制：fork 出的子进程直接将 RDB 写入所有等待中的 slave 的套接字，
+ * 并在退出前通过管道告诉父进程每个 slave 的传送结果。
  */
-robj *rdbLoadObject(int rdbtype, rio *rdb) {
-    robj *o, *ele, *dec;
+int rdbSaveToSlavesSockets(void) {
+    int *fds;
+    uint64_t *clientids;
+    int numfds;
+    listNode *ln;
+    listIter li;
+    pid_t childpid;
+    long long start;
+    int pipefds[2];
+
+    if (server.rdb_child_pid != -1) return REDIS_ERR;
+
+    /* Before to fork, create a pipe that will be used in order to
+     * send back to the parent the IDs of the slaves that successfully
+     * received all the writes. */
+    if (pipe(pipefds) == -1) return REDIS_ERR;
+    server.rdb_pipe_read_result_from_child = pipefds[0];
+    server.rdb_pipe_write_result_to_parent = pipefds[1];
+
+    /* Collect the file descriptors of the slaves we want to transfer
+     * the RDB to, which are in WAIT_BGSAVE_START state. */
+    fds = zmalloc(sizeof(int)*listLength(server.slaves));
+    /* We also allocate an array of corresponding client IDs. This will
+     * be useful for the child process in order to build the report
+     * (sent via unix pipe) that will be sent to the parent. */
+    clientids = zmalloc(sizeof(uint64_t)*listLength(server.slaves));
+    numfds = 0;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
+            clientids[numfds] = slave->id;
+            fds[numfds++] = slave->fd;
+            replicationSetupSlaveForFullResync(slave,getPsyncInitialOffset());
+            /* Put the socket in blocking mode to simplify RDB transfer.
+             * We'll restore it when the children returns (since duped
+             * socket will share the O_NONBLOCK attribute with the parent). */
+            anetBlock(NULL,slave->fd);
+            anetSendTimeout(NULL,slave->fd,server.repl_timeout*1000);
+        }
+    }
+
+    /* Create the child process. */
+    openChildInfoPipe();
+    start = ustime();
+    if ((childpid = fork()) == 0) {
+        /* Child */
+        int retval;
+        rio slave_sockets;
+
+        rioInitWithFdset(&slave_sockets,fds,numfds);
+        zfree(fds);
+
+        closeListeningSockets(0);
+        redisSetProcTitle("redis-rdb-to-slaves");
+        redisSetCpuAffinity(server.bgsave_cpulist);
+        server.in_fork_child = REDIS_CHILD_INFO_TYPE_RDB;
+
+        retval = rdbSaveRioWithEOFMark(&slave_sockets,NULL);
+        if (retval == REDIS_OK && rioFlush(&slave_sockets) == 0)
+            retval = REDIS_ERR;
+
+        if (retval == REDIS_OK) {
+            size_t private_dirty = zmalloc_get_private_dirty();
+
+            if (private_dirty) {
+                redisLog(REDIS_NOTICE,
+                    "RDB: %zu MB of memory used by copy-on-write",
+                    private_dirty/(1024*1024));
+            }
+            sendChildInfo(REDIS_CHILD_INFO_TYPE_RDB,private_dirty);
+
+            /* If we are returning OK, at least one slave was served
+             * with the RDB file as expected, so we need to send a report
+             * to the parent via the pipe. The format of the message is:
+             *
+             * <len> <slave[0].id> <slave[0].error> ...
+             *
+             * len, slave IDs, and slave errors, are all uint64_t integers,
+             * so basically the reply is composed of 64 bits for the len field
+             * plus 2 additional 64 bit integers for each entry, for a total
+             * of 'len' entries.
+             *
+             * The 'id' represents the slave's client ID, so that the master
+             * can match the report with a specific slave, and 'error' is
+             * set to 0 if the replication process terminated with a success
+             * or the error code if an error occurred. */
+            void *msg = zmalloc(sizeof(uint64_t)*(1+2*numfds));
+            uint64_t *len = msg;
+            uint64_t *ids = len+1;
+            int j, msglen;
+
+            *len = numfds;
+            for (j = 0; j < numfds; j++) {
+                *ids++ = clientids[j];
+                *ids++ = slave_sockets.io.fdset.state[j];
+            }
+
+            /* Write the message to the parent. If we have no good slaves or
+             * we are unable to transfer the message to the parent, we exit
+             * with an error so that the parent will abort the replication
+             * process with all the slaves that were waiting. */
+            msglen = sizeof(uint64_t)*(1+2*numfds);
+            if (*len == 0 ||
+                write(server.rdb_pipe_write_result_to_parent,msg,msglen)
+                != msglen)
+            {
+                retval = REDIS_ERR;
+            }
+            zfree(msg);
+        }
+        zfree(clientids);
+        rioFreeFdset(&slave_sockets);
+        exitFromChild((retval == REDIS_OK) ? 0 : 1);
+    } else {
+        /* Parent */
+        server.stat_fork_time = ustime()-start;
+        server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
+        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+        if (childpid == -1) {
+            closeChildInfoPipe();
+            redisLog(REDIS_WARNING,"Can't save in background: fork: %s",
+                strerror(errno));
+
+            /* Undo the state change. The caller will perform cleanup on
+             * all the slaves in BGSAVE_START state, but an early call to
+             * replicationSetupSlaveForFullResync() turned it into BGSAVE_END */
+            listRewind(server.slaves,&li);
+            while((ln = listNext(&li))) {
+                redisClient *slave = ln->value;
+                int j;
+
+                for (j = 0; j < numfds; j++) {
+                    if (slave->id == clientids[j]) {
+                        slave->replstate = REDIS_REPL_WAIT_BGSAVE_START;
+                        anetNonBlock(NULL,slave->fd);
+                        anetSendTimeout(NULL,slave->fd,0);
+                        break;
+                    }
+                }
+            }
+            zfree(clientids);
+            zfree(fds);
+            close(pipefds[0]);
+            close(pipefds[1]);
+            return REDIS_ERR;
+        }
+        redisLog(REDIS_NOTICE,"Background RDB transfer started by pid %d",
+            childpid);
+        server.rdb_save_time_start = time(NULL);
+        server.rdb_child_pid = childpid;
+        server.rdb_child_type = REDIS_RDB_CHILD_TYPE_SOCKET;
+        updateDictResizePolicy();
+        zfree(clientids);
+        zfree(fds);
+        return REDIS_OK;
+    }
+    return REDIS_OK; /* unreached */
+}
+
+/*
+ * 移除 BGSAVE 所产生的临时文件
+ *
+ * BGSAVE 执行被中断时使用
+ */
+void rdbRemoveTempFile(pid_t childpid) {
+    char tmpfile[256];
+
+    snprintf(tmpfile,256,"temp-%d.rdb", (int) childpid);
+    unlink(tmpfile);
+}
+
+/* Convert a ziplist loaded from an old RDB file into a listpack with the
+ * same entries. The ziplist is not freed.
+ *
+ * 旧版本 RDB 中的 ziplist 在载入时转换为 listpack */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    char buf[LP_INTBUF_SIZE];
+
+    while (p != NULL) {
+        ziplistGet(p,&vstr,&vlen,&vll);
+        if (vstr == NULL) {
+            vlen = ll2string(buf,sizeof(buf),vll);
+            vstr = (unsigned char*)buf;
+        }
+        lp = lpAppend(lp,vstr,vlen);
+        p = ziplistNext(zl,p);
+    }
+    return lp;
+}
+
+/* Load a Redis object of the specified type from the specified file.
+ *
+ * 从 rdb 文件中载入指定类型的对象。
+ *
+ * On success a newly allocated object is returned, otherwise NULL. 
+ *
+ * 读入成功返回一个新对象，否则返回 NULL 。
+ */
+robj *rdbLoadObject(int rdbtype, rio *rdb) {
+    robj *o, *ele, *dec;
     size_t len;
     unsigned int i;
 
@@ -1263,15 +1817,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          */
         if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
 
-        /* Use a real list when there are too many entries 
-         *
-         * 根据节点数，创建对象的编码
-         */
-        if (len > server.list_max_ziplist_entries) {
-            o = createListObject();
-        } else {
-            o = createZiplistObject();
-        }
+        // 旧格式的列表一律载入为 quicklist
+        o = createQuicklistObject();
 
         /* Load every single element of the list 
          *
@@ -1282,31 +1829,54 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             // 载入字符串对象
             if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
 
-            /* If we are using a ziplist and the value is too big, convert
-             * the object to a real list. 
-             *
-             * 根据字符串对象，
-             * 检查是否需要将列表从 ZIPLIST 编码转换为 LINKEDLIST 编码
-             */
-            if (o->encoding == REDIS_ENCODING_ZIPLIST &&
-                sdsEncodedObject(ele) &&
-                sdslen(ele->ptr) > server.list_max_ziplist_value)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+            // 将列表项推入到 quicklist 的末尾
+            dec = getDecodedObject(ele);
+            quicklistPushTail(o->ptr,dec->ptr,sdslen(dec->ptr));
+            decrRefCount(dec);
+            decrRefCount(ele);
+        }
 
-            // ZIPLIST
-            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-                dec = getDecodedObject(ele);
+    // 载入 quicklist 编码的列表
+    } else if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST ||
+               rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST_2)
+    {
 
-                // 将字符串值推入 ZIPLIST 末尾来重建列表
-                o->ptr = ziplistPush(o->ptr,dec->ptr,sdslen(dec->ptr),REDIS_TAIL);
+        // 读入 quicklist 的节点数
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+        o = createQuicklistObject();
+
+        /* Every node is saved as a listpack blob (a ziplist one for the old
+         * QUICKLIST type, converted while loading): load them one after the
+         * other and append them to the quicklist. */
+        while (len--) {
+            robj *zlobj;
+            unsigned char *lp;
+
+            if ((zlobj = rdbLoadStringObject(rdb)) == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
 
-                decrRefCount(dec);
-                decrRefCount(ele);
+            if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST) {
+                lp = rdbZiplistToListpack(zlobj->ptr);
             } else {
-                // 将新列表项推入到链表的末尾
-                ele = tryObjectEncoding(ele);
-                listAddNodeTail(o->ptr,ele);
+                if (!lpValidateIntegrity(zlobj->ptr,sdslen(zlobj->ptr),1)) {
+                    decrRefCount(zlobj);
+                    decrRefCount(o);
+                    return NULL;
+                }
+                // listpack 的所有权交给 quicklist ，所以需要一份独立的拷贝
+                lp = zmalloc(sdslen(zlobj->ptr));
+                memcpy(lp,zlobj->ptr,sdslen(zlobj->ptr));
+            }
+            decrRefCount(zlobj);
+
+            // 跳过空的 listpack ， quicklist 不保存空节点
+            if (lpLength(lp) == 0) {
+                lpFree(lp);
+                continue;
             }
+            quicklistAppendListpack(o->ptr,lp);
         }
 
     // 载入集合对象
@@ -1365,7 +1935,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         }
 
     // 载入有序集合对象
-    } else if (rdbtype == REDIS_RDB_TYPE_ZSET) {
+    } else if (rdbtype == REDIS_RDB_TYPE_ZSET ||
+               rdbtype == REDIS_RDB_TYPE_ZSET_2)
+    {
         /* Read list/set value */
         size_t zsetlen;
         size_t maxelelen = 0;
@@ -1384,34 +1956,36 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             double score;
             zskiplistNode *znode;
 
-            // 载入元素成员
-            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
-            ele = tryObjectEncoding(ele);
+            // 载入元素成员（跳跃表节点会保存自己的 sds 拷贝）
+            if ((ele = rdbLoadStringObject(rdb)) == NULL) return NULL;
 
             // 载入元素分值
-            if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
+            if (rdbtype == REDIS_RDB_TYPE_ZSET_2) {
+                if (rdbLoadBinaryDoubleValue(rdb,&score) == -1) return NULL;
+            } else {
+                if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
+            }
 
-            /* Don't care about integer-encoded strings. */
             // 记录成员的最大长度
-            if (sdsEncodedObject(ele) && sdslen(ele->ptr) > maxelelen)
+            if (sdslen(ele->ptr) > maxelelen)
                 maxelelen = sdslen(ele->ptr);
 
             // 将元素插入到跳跃表中
-            znode = zslInsert(zs->zsl,score,ele);
+            znode = zslInsert(zs->zsl,score,ele->ptr);
             // 将元素关联到字典中
-            dictAdd(zs->dict,ele,&znode->score);
+            dictAdd(zs->dict,znode->ele,&znode->score);
 
-            incrRefCount(ele); /* added to skiplist */
+            decrRefCount(ele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. 
          *
-         * 如果有序集合符合条件的话，将它转换为 ZIPLIST 编码
+         * 如果有序集合符合条件的话，将它转换为 LISTPACK 编码
          * 节约空间
          */
         if (zsetLength(o) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,REDIS_ENCODING_ZIPLIST);
+                zsetConvert(o,REDIS_ENCODING_LISTPACK);
 
     // 载入哈希表对象
     } else if (rdbtype == REDIS_RDB_TYPE_HASH) {
@@ -1426,16 +2000,16 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         o = createHashObject();
 
         /* Too many entries? Use a hash table.
-         * 根据节点数量，选择使用 ZIPLIST 编码还是 HT 编码
+         * 根据节点数量，选择使用 LISTPACK 编码还是 HT 编码
          */
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, REDIS_ENCODING_HT);
 
-        /* Load every field and value into the ziplist 
+        /* Load every field and value into the listpack 
          *
-         * 载入所有域和值，并将它们推入到 ZIPLIST 中
+         * 载入所有域和值，并将它们推入到 LISTPACK 中
          */
-        while (o->encoding == REDIS_ENCODING_ZIPLIST && len > 0) {
+        while (o->encoding == REDIS_ENCODING_LISTPACK && len > 0) {
             robj *field, *value;
 
             len--;
@@ -1450,14 +2024,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if (value == NULL) return NULL;
             redisAssert(sdsEncodedObject(value));
 
-            /* Add pair to ziplist 
+            /* Add pair to listpack 
              *
-             * 将域和值推入到 ZIPLIST 末尾
+             * 将域和值推入到 LISTPACK 末尾
              *
              * 先推入域，再推入值。
              */
-            o->ptr = ziplistPush(o->ptr, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+            o->ptr = lpAppend(o->ptr, field->ptr, sdslen(field->ptr));
+            o->ptr = lpAppend(o->ptr, value->ptr, sdslen(value->ptr));
 
             /* Convert to hash table if size threshold is exceeded 
              *
@@ -1510,13 +2084,25 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == REDIS_RDB_TYPE_SET_INTSET   ||
                rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == REDIS_RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == REDIS_RDB_TYPE_HASH_LISTPACK)
     {
         // 载入字符串对象
         robj *aux = rdbLoadStringObject(rdb);
 
         if (aux == NULL) return NULL;
 
+        /* Listpacks are used straight from the file: check them before
+         * anything walks their entries. */
+        if ((rdbtype == REDIS_RDB_TYPE_ZSET_LISTPACK ||
+             rdbtype == REDIS_RDB_TYPE_HASH_LISTPACK) &&
+            !lpValidateIntegrity(aux->ptr,sdslen(aux->ptr),1))
+        {
+            decrRefCount(aux);
+            return NULL;
+        }
+
         o = createObject(REDIS_STRING,NULL); /* string is just placeholder */
         o->ptr = zmalloc(sdslen(aux->ptr));
         memcpy(o->ptr,aux->ptr,sdslen(aux->ptr));
@@ -1538,25 +2124,25 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
             // ZIPMAP 编码的哈希表
             case REDIS_RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    // 创建 ZIPLIST
-                    unsigned char *zl = ziplistNew();
+                    // 创建 LISTPACK
+                    unsigned char *zl = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
                     unsigned int maxlen = 0;
 
                     // 从 2.6 开始， HASH 不再使用 ZIPMAP 来进行编码
-                    // 所以遇到 ZIPMAP 编码的值时，要将它转换为 ZIPLIST
+                    // 所以遇到 ZIPMAP 编码的值时，要将它转换为 LISTPACK
 
-                    // 从字符串中取出 ZIPMAP 的域和值，然后推入到 ZIPLIST 中
+                    // 从字符串中取出 ZIPMAP 的域和值，然后推入到 LISTPACK 中
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        zl = lpAppend(zl, fstr, flen);
+                        zl = lpAppend(zl, vstr, vlen);
                     }
 
                     zfree(o->ptr);
@@ -1564,13 +2150,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     // 设置类型、编码和值指针
                     o->ptr = zl;
                     o->type = REDIS_HASH;
-                    o->encoding = REDIS_ENCODING_ZIPLIST;
+                    o->encoding = REDIS_ENCODING_LISTPACK;
 
-                    // 是否需要从 ZIPLIST 编码转换为 HT 编码
+                    // 是否需要从 LISTPACK 编码转换为 HT 编码
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
                     {
                         hashTypeConvert(o, REDIS_ENCODING_HT);
+                    } else {
+                        hashTypeTryIndexListpack(o);
                     }
                 }
                 break;
@@ -1581,9 +2169,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = REDIS_LIST;
                 o->encoding = REDIS_ENCODING_ZIPLIST;
 
-                // 检查是否需要转换编码
-                if (ziplistLen(o->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+                // 旧格式的 ZIPLIST 列表总是转换为 quicklist
+                listTypeConvert(o,REDIS_ENCODING_QUICKLIST);
                 break;
 
             // INTSET 编码的集合
@@ -1597,26 +2184,42 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,REDIS_ENCODING_HT);
                 break;
 
-            // ZIPLIST 编码的有序集合
+            // ZIPLIST / LISTPACK 编码的有序集合
             case REDIS_RDB_TYPE_ZSET_ZIPLIST:
+            case REDIS_RDB_TYPE_ZSET_LISTPACK:
 
+                // 旧格式的 ZIPLIST 转换为 LISTPACK
+                if (rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST) {
+                    unsigned char *lp = rdbZiplistToListpack(o->ptr);
+                    zfree(o->ptr);
+                    o->ptr = lp;
+                }
                 o->type = REDIS_ZSET;
-                o->encoding = REDIS_ENCODING_ZIPLIST;
+                o->encoding = REDIS_ENCODING_LISTPACK;
 
                 // 检查是否需要转换编码
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
                     zsetConvert(o,REDIS_ENCODING_SKIPLIST);
                 break;
 
-            // ZIPLIST 编码的 HASH
+            // ZIPLIST / LISTPACK 编码的 HASH
             case REDIS_RDB_TYPE_HASH_ZIPLIST:
+            case REDIS_RDB_TYPE_HASH_LISTPACK:
 
+                // 旧格式的 ZIPLIST 转换为 LISTPACK
+                if (rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST) {
+                    unsigned char *lp = rdbZiplistToListpack(o->ptr);
+                    zfree(o->ptr);
+                    o->ptr = lp;
+                }
                 o->type = REDIS_HASH;
-                o->encoding = REDIS_ENCODING_ZIPLIST;
+                o->encoding = REDIS_ENCODING_LISTPACK;
 
                 // 检查是否需要转换编码
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, REDIS_ENCODING_HT);
+                else
+                    hashTypeTryIndexListpack(o);
                 break;
 
             default:
@@ -1624,6 +2227,70 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 break;
         }
 
+    // 载入模块类型的值
+    } else if (rdbtype == REDIS_RDB_TYPE_MODULE) {
+        if ((o = moduleTypeLoadValue(rdb)) == NULL) return NULL;
+
+    // 载入流对象
+    } else if (rdbtype == REDIS_RDB_TYPE_STREAM_ZIPLISTS) {
+        stream *s;
+        robj *idobj;
+
+        // 读入节点数
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+        o = createStreamObject();
+        s = o->ptr;
+
+        /* Every node is a 128 bit master ID and a ziplist blob, used as
+         * they are: the length of the stream is the sum of the counts
+         * stored at the head of the ziplists. */
+        while (len--) {
+            robj *keyobj, *zlobj;
+            unsigned char *zl;
+
+            if ((keyobj = rdbLoadStringObject(rdb)) == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
+            if (sdslen(keyobj->ptr) != sizeof(streamID) ||
+                (zlobj = rdbLoadStringObject(rdb)) == NULL)
+            {
+                decrRefCount(keyobj);
+                decrRefCount(o);
+                return NULL;
+            }
+
+            // ziplist 的所有权交给 rax ，所以需要一份独立的拷贝
+            zl = zmalloc(sdslen(zlobj->ptr));
+            memcpy(zl,zlobj->ptr,sdslen(zlobj->ptr));
+            decrRefCount(zlobj);
+
+            if (ziplistLen(zl) == 0 ||
+                !raxTryInsert(s->rax,keyobj->ptr,sizeof(streamID),zl,NULL))
+            {
+                /* Empty or duplicated node: the file is corrupted. */
+                zfree(zl);
+                decrRefCount(keyobj);
+                decrRefCount(o);
+                return NULL;
+            }
+            s->length += streamNodeCount(zl);
+            decrRefCount(keyobj);
+        }
+
+        // 读入最后一个 ID
+        if ((idobj = rdbLoadStringObject(rdb)) == NULL) {
+            decrRefCount(o);
+            return NULL;
+        }
+        if (sdslen(idobj->ptr) != sizeof(streamID)) {
+            decrRefCount(idobj);
+            decrRefCount(o);
+            return NULL;
+        }
+        streamDecodeID(idobj->ptr,&s->last_id);
+        decrRefCount(idobj);
+
     } else {
         redisPanic("Unknown object type");
     }
@@ -1642,18 +2309,27 @@ void startLoading(FILE *fp) {
 
     /* Load the DB */
 
+    // 文件的大小
+    if (fstat(fileno(fp), &sb) == -1) {
+        startLoadingWithSize(0);
+    } else {
+        startLoadingWithSize(sb.st_size);
+    }
+}
+
+/* Like startLoading() but the total size is provided by the caller, as it
+ * happens when loading from a socket. A zero size means unknown.
+ *
+ * 和 startLoading() 一样，但载入的总字节数由调用者给出，0 表示未知 */
+void startLoadingWithSize(off_t size) {
     // 正在载入
     server.loading = 1;
 
     // 开始进行载入的时间
     server.loading_start_time = time(NULL);
 
-    // 文件的大小
-    if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 1; /* just to avoid division by zero */
-    } else {
-        server.loading_total_bytes = sb.st_size;
-    }
+    // 载入的总字节数
+    server.loading_total_bytes = size ? size : 1; /* just to avoid division by zero */
 }
 
 /* Refresh the loading progress info */
@@ -1672,68 +2348,606 @@ void stopLoading(void) {
     server.loading = 0;
 }
 
+/* Serve clients from time to time while loading, and refresh the loading
+ * info: called every loading_process_events_interval_bytes of the stream. */
+static void rdbLoadingProcessEvents(off_t processed_bytes) {
+    /* The DB can take some non trivial amount of time to load. Update
+     * our cached time since it is used to create and update the last
+     * interaction time with clients and for other important things. */
+    updateCachedTime();
+    if (server.masterhost && server.repl_state == REDIS_REPL_TRANSFER)
+        replicationSendNewlineToMaster();
+    loadingProgress(processed_bytes);
+    processEventsWhileBlocked();
+}
+
 /* Track loading progress in order to serve client's from time to time
    and if needed calculate rdb checksum  */
-// 记录载入进度信息，以便让客户端进行查询
-// 这也会在计算 RDB 校验和时用到。
 void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     if (server.rdb_checksum)
         rioGenericUpdateChecksum(r, buf, len);
     if (server.loading_process_events_interval_bytes &&
         (r->processed_bytes + len)/server.loading_process_events_interval_bytes > r->processed_bytes/server.loading_process_events_interval_bytes)
     {
-        /* The DB can take some non trivial amount of time to load. Update
-         * our cached time since it is used to create and update the last
-         * interaction time with clients and for other important things. */
-        updateCachedTime();
-        if (server.masterhost && server.repl_state == REDIS_REPL_TRANSFER)
-            replicationSendNewlineToMaster();
-        loadingProgress(r->processed_bytes);
-        processEventsWhileBlocked();
+        rdbLoadingProcessEvents(r->processed_bytes);
     }
 }
 
-/*
- * 将给定 rdb 中保存的数据载入到数据库中。
+/* Load the AUX field that follows a REDIS_RDB_OPCODE_AUX opcode. The
+ * replication info is stored into 'rsi' if not NULL, the fields we don't
+ * know are skipped, so new ones can be added compatibly.
+ * Returns -1 on short read, 0 otherwise. */
+static int rdbLoadAuxField(rio *rdb, rdbSaveInfo *rsi) {
+    robj *auxkey, *auxval;
+
+    if ((auxkey = rdbLoadStringObject(rdb)) == NULL) return -1;
+    if ((auxval = rdbLoadStringObject(rdb)) == NULL) {
+        decrRefCount(auxkey);
+        return -1;
+    }
+
+    if (rsi && !strcasecmp(auxkey->ptr,"repl-stream-db")) {
+        rsi->repl_stream_db = atoi(auxval->ptr);
+    } else if (rsi && !strcasecmp(auxkey->ptr,"repl-id")) {
+        if (sdslen(auxval->ptr) == REDIS_RUN_ID_SIZE) {
+            memcpy(rsi->repl_id,auxval->ptr,REDIS_RUN_ID_SIZE+1);
+            rsi->repl_id_is_set = 1;
+        }
+    } else if (rsi && !strcasecmp(auxkey->ptr,"repl-offset")) {
+        rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
+    }
+
+    decrRefCount(auxkey);
+    decrRefCount(auxval);
+    return 0;
+}
+
+/* Load the name and the body of the function that follows a
+ * REDIS_RDB_OPCODE_FUNCTION opcode. Returns -1 on short read, 0 otherwise. */
+static int rdbLoadFunction(rio *rdb, robj **name, robj **body) {
+    if ((*name = rdbLoadStringObject(rdb)) == NULL) return -1;
+    if ((*body = rdbLoadStringObject(rdb)) == NULL) {
+        decrRefCount(*name);
+        return -1;
+    }
+    return 0;
+}
+
+/* Create the function loaded by rdbLoadFunction(), releasing the objects.
+ * Returns REDIS_ERR if the body can't be compiled. */
+static int rdbCreateFunction(robj *name, robj *body) {
+    int retval = luaFunctionCreate(NULL,name,body);
+
+    if (retval == REDIS_ERR)
+        redisLog(REDIS_WARNING,"Can't create the function '%s' loading DB",
+            (char*)name->ptr);
+    decrRefCount(name);
+    decrRefCount(body);
+    return retval;
+}
+
+/* ---------------------------- Threaded loading ----------------------------
+ *
+ * When rdb-load-threads is greater than 1 the keys are loaded by a pipeline
+ * instead of the main thread alone:
+ *
+ * 1) A reader thread parses the stream. The opcodes and the keys are decoded,
+ *    while the values are just copied, still serialized (and compressed),
+ *    into a queue of jobs.
+ * 2) rdb-load-threads - 1 worker threads build the values of the queued jobs
+ *    calling rdbLoadObject() against the copy: this is where the strings are
+ *    LZF decompressed and the ziplists, intsets, dicts and skiplists created.
+ * 3) The main thread adds the built values to the keyspace, in the same order
+ *    they appear in the stream, and serves the clients from time to time.
+ *
+ * While the threads run, incrRefCount() and decrRefCount() switch to atomic
+ * operations, since the values the workers create may reference the shared
+ * integers. Without atomic builtins the RDB is always loaded sequentially.
+ *
+ * 多线程载入：读线程解析 RDB 流，工作线程构建值对象，主线程按顺序添加到数据库 */
+
+#define RDB_LOAD_QUEUE_LEN 1024     /* Jobs parsed ahead of the main thread. */
+
+#define RDB_LOAD_JOB_PENDING 0      /* Queued by the reader thread. */
+#define RDB_LOAD_JOB_BUILDING 1     /* A worker is building the value. */
+#define RDB_LOAD_JOB_DONE 2         /* Ready to be added to the keyspace. */
+
+typedef struct rdbLoadJob {
+    int state;              /* RDB_LOAD_JOB_* state. */
+    int type;               /* RDB object type of the value. */
+    int dbid;               /* DB of the key. */
+    long long expiretime;   /* Expire time in milliseconds, or -1. */
+    off_t processed_bytes;  /* Bytes of the stream read after this job. */
+    robj *key;
+    sds payload;            /* The value, as serialized in the stream. */
+    robj *val;              /* Value built by a worker, NULL on error. */
+} rdbLoadJob;
+
+volatile int rdb_load_threads_active = 0;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t space_cond;  /* The main thread consumed a job. */
+    pthread_cond_t job_cond;    /* The reader thread queued a job. */
+    pthread_cond_t done_cond;   /* A worker built a value. */
+    rdbLoadJob jobs[RDB_LOAD_QUEUE_LEN];
+    /* Ever increasing job counters, modulo RDB_LOAD_QUEUE_LEN for the slot. */
+    unsigned long head;         /* Next job to add to the keyspace. */
+    unsigned long next;         /* Next job to assign to a worker. */
+    unsigned long tail;         /* Next job the reader will queue. */
+    int reader_done;            /* No more jobs will be queued. */
+    int reader_err;             /* The stream is truncated or corrupted. */
+    int stop;                   /* The threads should exit ASAP. */
+    rio *rdb;
+    rdbSaveInfo *rsi;
+    list *functions;            /* Name, body, ... created by the main thread. */
+} rdb_loader;
+
+/* Return true if the RDB should be loaded with the threaded pipeline. */
+static int rdbLoadUseThreads(void) {
+#ifdef HAVE_ATOMIC
+    return server.rdb_load_threads > 1;
+#else
+    return 0;
+#endif
+}
+
+/* The rdbCopy*() functions parse the serialized value without decoding it,
+ * appending the raw bytes read to the sds string '*dst'. This is how the
+ * reader thread finds where a value ends. They return -1 on short read. */
+static int rdbCopyRaw(rio *rdb, sds *dst, size_t len) {
+    size_t curlen = sdslen(*dst);
+
+    *dst = sdsMakeRoomFor(*dst,len);
+    if (len && rioRead(rdb,*dst+curlen,len) == 0) return -1;
+    sdsIncrLen(*dst,len);
+    return 0;
+}
+
+static uint32_t rdbCopyLen(rio *rdb, sds *dst, int *isencoded) {
+    unsigned char buf[1];
+    uint32_t len;
+    int type;
+
+    if (isencoded) *isencoded = 0;
+    if (rdbCopyRaw(rdb,dst,1) == -1) return REDIS_RDB_LENERR;
+    buf[0] = (*dst)[sdslen(*dst)-1];
+    type = (buf[0]&0xC0)>>6;
+
+    if (type == REDIS_RDB_ENCVAL) {
+        if (isencoded) *isencoded = 1;
+        return buf[0]&0x3F;
+    } else if (type == REDIS_RDB_6BITLEN) {
+        return buf[0]&0x3F;
+    } else if (type == REDIS_RDB_14BITLEN) {
+        if (rdbCopyRaw(rdb,dst,1) == -1) return REDIS_RDB_LENERR;
+        return ((buf[0]&0x3F)<<8)|(unsigned char)(*dst)[sdslen(*dst)-1];
+    } else {
+        if (rdbCopyRaw(rdb,dst,4) == -1) return REDIS_RDB_LENERR;
+        memcpy(&len,*dst+sdslen(*dst)-4,4);
+        return ntohl(len);
+    }
+}
+
+static int rdbCopyString(rio *rdb, sds *dst) {
+    int isencoded;
+    uint32_t len, clen;
+
+    if ((len = rdbCopyLen(rdb,dst,&isencoded)) == REDIS_RDB_LENERR) return -1;
+    if (isencoded) {
+        switch(len) {
+        case REDIS_RDB_ENC_INT8: return rdbCopyRaw(rdb,dst,1);
+        case REDIS_RDB_ENC_INT16: return rdbCopyRaw(rdb,dst,2);
+        case REDIS_RDB_ENC_INT32: return rdbCopyRaw(rdb,dst,4);
+        case REDIS_RDB_ENC_LZF:
+        case REDIS_RDB_ENC_LZ4:
+        case REDIS_RDB_ENC_ZSTD:
+            /* Compressed length, uncompressed length, compressed data. */
+            if ((clen = rdbCopyLen(rdb,dst,NULL)) == REDIS_RDB_LENERR ||
+                rdbCopyLen(rdb,dst,NULL) == REDIS_RDB_LENERR) return -1;
+            return rdbCopyRaw(rdb,dst,clen);
+        default:
+            redisPanic("Unknown RDB encoding type");
+        }
+    }
+    return rdbCopyRaw(rdb,dst,len);
+}
+
+static int rdbCopyDouble(rio *rdb, sds *dst) {
+    unsigned char len;
+
+    if (rdbCopyRaw(rdb,dst,1) == -1) return -1;
+    len = (*dst)[sdslen(*dst)-1];
+    /* 253, 254 and 255 are NaN and infinities, with no payload. */
+    if (len >= 253) return 0;
+    return rdbCopyRaw(rdb,dst,len);
+}
+
+/* Copy the serialized value of type 'rdbtype', the counterpart of
+ * rdbLoadObject(). Returns the copy, or NULL on short read. */
+static sds rdbCopyObject(int rdbtype, rio *rdb) {
+    sds payload = sdsempty();
+    uint32_t len, j;
+    int err = 0;
+
+    if (rdbtype == REDIS_RDB_TYPE_STRING ||
+        rdbtype == REDIS_RDB_TYPE_HASH_ZIPMAP ||
+        rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
+        rdbtype == REDIS_RDB_TYPE_SET_INTSET ||
+        rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST ||
+        rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST ||
+        rdbtype == REDIS_RDB_TYPE_ZSET_LISTPACK ||
+        rdbtype == REDIS_RDB_TYPE_HASH_LISTPACK)
+    {
+        err = rdbCopyString(rdb,&payload);
+    } else if (rdbtype == REDIS_RDB_TYPE_STREAM_ZIPLISTS) {
+        /* Master ID and ziplist of every node, then the last ID. */
+        if ((len = rdbCopyLen(rdb,&payload,NULL)) == REDIS_RDB_LENERR) {
+            err = -1;
+        } else {
+            for (j = 0; j < len && !err; j++) {
+                err = rdbCopyString(rdb,&payload);
+                if (!err) err = rdbCopyString(rdb,&payload);
+            }
+            if (!err) err = rdbCopyString(rdb,&payload);
+        }
+    } else if (rdbtype == REDIS_RDB_TYPE_LIST ||
+               rdbtype == REDIS_RDB_TYPE_SET ||
+               rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST ||
+               rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST_2 ||
+               rdbtype == REDIS_RDB_TYPE_ZSET ||
+               rdbtype == REDIS_RDB_TYPE_ZSET_2 ||
+               rdbtype == REDIS_RDB_TYPE_HASH)
+    {
+        if ((len = rdbCopyLen(rdb,&payload,NULL)) == REDIS_RDB_LENERR) {
+            err = -1;
+        } else {
+            for (j = 0; j < len && !err; j++) {
+                err = rdbCopyString(rdb,&payload);
+                if (!err && rdbtype == REDIS_RDB_TYPE_ZSET)
+                    err = rdbCopyDouble(rdb,&payload);
+                else if (!err && rdbtype == REDIS_RDB_TYPE_ZSET_2)
+                    err = rdbCopyRaw(rdb,&payload,sizeof(double));
+                else if (!err && rdbtype == REDIS_RDB_TYPE_HASH)
+                    err = rdbCopyString(rdb,&payload);
+            }
+        }
+    } else {
+        redisPanic("Unknown object type");
+    }
+
+    if (err) {
+        sdsfree(payload);
+        return NULL;
+    }
+    return payload;
+}
+
+/* Reader thread: parse the stream and queue a job for every key. */
+static void *rdbLoadReaderMain(void *arg) {
+    rio *rdb = rdb_loader.rdb;
+    int dbid = 0, type;
+    REDIS_NOTUSED(arg);
+
+    while(1) {
+        long long expiretime = -1;
+        rdbLoadJob *job;
+        robj *key, *val = NULL;
+        sds payload;
+
+        if ((type = rdbLoadType(rdb)) == -1) goto err;
+        if (type == REDIS_RDB_OPCODE_EXPIRETIME) {
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto err;
+            if ((type = rdbLoadType(rdb)) == -1) goto err;
+            expiretime *= 1000;
+        } else if (type == REDIS_RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto err;
+            if ((type = rdbLoadType(rdb)) == -1) goto err;
+        }
+
+        if (type == REDIS_RDB_OPCODE_EOF) break;
+
+        if (type == REDIS_RDB_OPCODE_SELECTDB) {
+            uint32_t id;
+
+            if ((id = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) goto err;
+            if (id >= (unsigned)server.dbnum) {
+                redisLog(REDIS_WARNING,"FATAL: Data file was created with a Redis server configured to handle more than %d databases. Exiting\n", server.dbnum);
+                exit(1);
+            }
+            dbid = id;
+            continue;
+        }
+
+        if (type == REDIS_RDB_OPCODE_AUX) {
+            if (rdbLoadAuxField(rdb,rdb_loader.rsi) == -1) goto err;
+            continue;
+        }
+
+        /* Lua is not thread safe: the functions are created by the main
+         * thread once the threads are joined. */
+        if (type == REDIS_RDB_OPCODE_FUNCTION) {
+            robj *name, *body;
+
+            if (rdbLoadFunction(rdb,&name,&body) == -1) goto err;
+            listAddNodeTail(rdb_loader.functions,name);
+            listAddNodeTail(rdb_loader.functions,body);
+            continue;
+        }
+
+        if (!rdbIsObjectType(type)) goto err;
+        if ((key = rdbLoadStringObject(rdb)) == NULL) goto err;
+
+        /* The payload of the module types is only known by the module:
+         * the value is built here and queued already done. */
+        if (type == REDIS_RDB_TYPE_MODULE) {
+            payload = NULL;
+            if ((val = moduleTypeLoadValue(rdb)) == NULL) {
+                decrRefCount(key);
+                goto err;
+            }
+        } else if ((payload = rdbCopyObject(type,rdb)) == NULL) {
+            decrRefCount(key);
+            goto err;
+        }
+
+        /* Wait for a free slot, the main thread consumes the jobs. */
+        pthread_mutex_lock(&rdb_loader.mutex);
+        while (rdb_loader.tail - rdb_loader.head == RDB_LOAD_QUEUE_LEN &&
+               !rdb_loader.stop)
+            pthread_cond_wait(&rdb_loader.space_cond,&rdb_loader.mutex);
+        if (rdb_loader.stop) {
+            pthread_mutex_unlock(&rdb_loader.mutex);
+            decrRefCount(key);
+            if (payload) sdsfree(payload);
+            else decrRefCount(val);
+            return NULL;
+        }
+        job = rdb_loader.jobs + (rdb_loader.tail % RDB_LOAD_QUEUE_LEN);
+        job->state = payload ? RDB_LOAD_JOB_PENDING : RDB_LOAD_JOB_DONE;
+        job->type = type;
+        job->dbid = dbid;
+        job->expiretime = expiretime;
+        job->processed_bytes = rdb->processed_bytes;
+        job->key = key;
+        job->payload = payload;
+        job->val = payload ? NULL : val;
+        rdb_loader.tail++;
+        if (payload)
+            pthread_cond_signal(&rdb_loader.job_cond);
+        else
+            pthread_cond_signal(&rdb_loader.done_cond);
+        pthread_mutex_unlock(&rdb_loader.mutex);
+    }
+
+    pthread_mutex_lock(&rdb_loader.mutex);
+    rdb_loader.reader_done = 1;
+    pthread_cond_broadcast(&rdb_loader.job_cond);
+    pthread_cond_signal(&rdb_loader.done_cond);
+    pthread_mutex_unlock(&rdb_loader.mutex);
+    return NULL;
+
+err:
+    pthread_mutex_lock(&rdb_loader.mutex);
+    rdb_loader.reader_done = 1;
+    rdb_loader.reader_err = 1;
+    pthread_cond_broadcast(&rdb_loader.job_cond);
+    pthread_cond_signal(&rdb_loader.done_cond);
+    pthread_mutex_unlock(&rdb_loader.mutex);
+    return NULL;
+}
+
+/* Worker thread: build the values of the queued jobs. */
+static void *rdbLoadWorkerMain(void *arg) {
+    REDIS_NOTUSED(arg);
+
+    pthread_mutex_lock(&rdb_loader.mutex);
+    while(1) {
+        rdbLoadJob *job;
+        rio payload;
+        robj *val;
+
+        while (rdb_loader.next == rdb_loader.tail &&
+               !rdb_loader.reader_done && !rdb_loader.stop)
+            pthread_cond_wait(&rdb_loader.job_cond,&rdb_loader.mutex);
+        if (rdb_loader.stop || rdb_loader.next == rdb_loader.tail) break;
+        job = rdb_loader.jobs + (rdb_loader.next % RDB_LOAD_QUEUE_LEN);
+        rdb_loader.next++;
+        if (job->state == RDB_LOAD_JOB_DONE) continue; /* Module value. */
+        job->state = RDB_LOAD_JOB_BUILDING;
+        pthread_mutex_unlock(&rdb_loader.mutex);
+
+        rioInitWithBuffer(&payload,job->payload);
+        val = rdbLoadObject(job->type,&payload);
+        sdsfree(job->payload);
+
+        pthread_mutex_lock(&rdb_loader.mutex);
+        job->payload = NULL;
+        job->val = val;
+        job->state = RDB_LOAD_JOB_DONE;
+        pthread_cond_signal(&rdb_loader.done_cond);
+    }
+    pthread_mutex_unlock(&rdb_loader.mutex);
+    return NULL;
+}
+
+/* Load the keys of 'rdb' (already past the header) with the reader and the
+ * worker threads, adding them to the keyspace from the main thread.
+ * Returns REDIS_ERR if the stream is truncated or corrupted. */
+static int rdbLoadThreaded(rio *rdb, rdbSaveInfo *rsi, long long now) {
+    pthread_t threads[REDIS_RDB_LOAD_THREADS_MAX_NUM];
+    pthread_attr_t attr;
+    size_t stacksize;
+    int j, numthreads = server.rdb_load_threads, retval = REDIS_OK;
+    off_t interval = server.loading_process_events_interval_bytes;
+    off_t processed_bytes = rdb->processed_bytes;
+
+    pthread_mutex_init(&rdb_loader.mutex,NULL);
+    pthread_cond_init(&rdb_loader.space_cond,NULL);
+    pthread_cond_init(&rdb_loader.job_cond,NULL);
+    pthread_cond_init(&rdb_loader.done_cond,NULL);
+    rdb_loader.head = rdb_loader.next = rdb_loader.tail = 0;
+    rdb_loader.reader_done = rdb_loader.reader_err = rdb_loader.stop = 0;
+    rdb_loader.rdb = rdb;
+    rdb_loader.rsi = rsi;
+    rdb_loader.functions = listCreate();
+
+    /* The reader thread can't serve clients: only the checksum is updated
+     * while reading, the main thread handles the events itself. */
+    rdb->update_cksum = server.rdb_checksum ? rioGenericUpdateChecksum : NULL;
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    rdb_load_threads_active = 1;
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(&threads[j],&attr,
+                           j == 0 ? rdbLoadReaderMain : rdbLoadWorkerMain,
+                           NULL) != 0)
+        {
+            redisLog(REDIS_WARNING,"Fatal: Can't initialize RDB loading threads.");
+            exit(1);
+        }
+    }
+    redisLog(REDIS_NOTICE,"Loading the DB with %d threads", numthreads);
+
+    pthread_mutex_lock(&rdb_loader.mutex);
+    while(1) {
+        rdbLoadJob *slot = rdb_loader.jobs+(rdb_loader.head % RDB_LOAD_QUEUE_LEN);
+        rdbLoadJob job;
+        redisDb *db;
+
+        if (rdb_loader.head == rdb_loader.tail) {
+            if (rdb_loader.reader_done) break;
+            pthread_cond_wait(&rdb_loader.done_cond,&rdb_loader.mutex);
+            continue;
+        }
+        if (slot->state != RDB_LOAD_JOB_DONE) {
+            pthread_cond_wait(&rdb_loader.done_cond,&rdb_loader.mutex);
+            continue;
+        }
+        job = *slot;
+        rdb_loader.head++;
+        pthread_cond_signal(&rdb_loader.space_cond);
+        pthread_mutex_unlock(&rdb_loader.mutex);
+
+        if (job.val == NULL) {
+            decrRefCount(job.key);
+            retval = REDIS_ERR;
+            pthread_mutex_lock(&rdb_loader.mutex);
+            break;
+        }
+
+        /* Expired keys are skipped like rdbLoadRio() does. */
+        db = server.db+job.dbid;
+        if (server.masterhost == NULL && job.expiretime != -1 &&
+            job.expiretime < now)
+        {
+            decrRefCount(job.key);
+            decrRefCount(job.val);
+        } else {
+            dbAdd(db,job.key,job.val);
+            if (job.expiretime != -1) setExpire(db,job.key,job.expiretime);
+            decrRefCount(job.key);
+        }
+
+        if (interval && job.processed_bytes/interval > processed_bytes/interval)
+            rdbLoadingProcessEvents(job.processed_bytes);
+        processed_bytes = job.processed_bytes;
+
+        pthread_mutex_lock(&rdb_loader.mutex);
+    }
+    if (rdb_loader.reader_err) retval = REDIS_ERR;
+    rdb_loader.stop = 1;
+    pthread_cond_broadcast(&rdb_loader.space_cond);
+    pthread_cond_broadcast(&rdb_loader.job_cond);
+    pthread_mutex_unlock(&rdb_loader.mutex);
+
+    for (j = 0; j < numthreads; j++) pthread_join(threads[j],NULL);
+    rdb_load_threads_active = 0;
+
+    while(listLength(rdb_loader.functions)) {
+        listNode *ln = listFirst(rdb_loader.functions);
+        robj *name = listNodeValue(ln), *body = listNodeValue(ln->next);
+
+        if (retval == REDIS_OK && rdbCreateFunction(name,body) == REDIS_ERR) {
+            retval = REDIS_ERR;
+        } else if (retval == REDIS_ERR) {
+            decrRefCount(name);
+            decrRefCount(body);
+        }
+        listDelNode(rdb_loader.functions,ln->next);
+        listDelNode(rdb_loader.functions,ln);
+    }
+    listRelease(rdb_loader.functions);
+
+    /* On errors some job may still be in the queue. */
+    for (; rdb_loader.head != rdb_loader.tail; rdb_loader.head++) {
+        rdbLoadJob *job = rdb_loader.jobs+(rdb_loader.head % RDB_LOAD_QUEUE_LEN);
+
+        decrRefCount(job->key);
+        if (job->payload) sdsfree(job->payload);
+        if (job->val) decrRefCount(job->val);
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_cond_destroy(&rdb_loader.space_cond);
+    pthread_cond_destroy(&rdb_loader.job_cond);
+    pthread_cond_destroy(&rdb_loader.done_cond);
+    pthread_mutex_destroy(&rdb_loader.mutex);
+
+    rdb->update_cksum = rdbLoadProgressCallback;
+    return retval;
+}
+
+/* Load an RDB file from the rio stream 'rdb'. On success REDIS_OK is
+ * returned, otherwise REDIS_ERR is returned and 'errno' is set accordingly:
+ * EINVAL when the stream doesn't look like an RDB at all, EIO when it is
+ * truncated or corrupted. The caller decides if the error is fatal.
+ *
+ * If 'rsi' is not NULL it is populated with the replication info found in
+ * the AUX fields, see rdbSaveReplicationInfo().
+ *
+ * The caller is responsible for startLoading() / stopLoading().
+ *
+ * 将给定 rdb 流中保存的数据载入到数据库中，
+ * 出错时是否退出进程由调用者决定。
  */
 // TODO: 看一下用来进行重新同步的 RDB 过程（AOF、replication 之后）
-int rdbLoad(char *filename) {
+int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
     uint32_t dbid;
     int type, rdbver;
     redisDb *db = server.db+0;
     char buf[1024];
     long long expiretime, now = mstime();
-    FILE *fp;
-    rio rdb;
 
-    // 打开 rdb 文件
-    if ((fp = fopen(filename,"r")) == NULL) return REDIS_ERR;
-
-    // 初始化写入流
-    rioInitWithFile(&rdb,fp);
-    rdb.update_cksum = rdbLoadProgressCallback;
-    rdb.max_processing_chunk = server.loading_process_events_interval_bytes;
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
     // 目前 offset 位于 rdb_file 的开头，只读取 version 的信息的前 9 byte，作为 RDB 文件的可用性检查
-    if (rioRead(&rdb,buf,9) == 0) goto eoferr;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
 
     // 检查版本号
     if (memcmp(buf,"REDIS",5) != 0) {
-        fclose(fp);
-        redisLog(REDIS_WARNING,"Wrong signature trying to load DB from file");
+        redisLog(REDIS_WARNING,"Wrong signature trying to load DB");
         errno = EINVAL;
         return REDIS_ERR;
     }
     rdbver = atoi(buf+5);
     if (rdbver < 1 || rdbver > REDIS_RDB_VERSION) {
-        fclose(fp);
         redisLog(REDIS_WARNING,"Can't handle RDB format version %d",rdbver);
         errno = EINVAL;
         return REDIS_ERR;
     }
 
-    // 将服务器状态调整到开始载入状态
-    startLoading(fp);
+    if (rdbLoadUseThreads()) {
+        if (rdbLoadThreaded(rdb,rsi,now) == REDIS_ERR) goto eoferr;
+        goto verify_checksum;
+    }
+
     /**
      * while(1) {
      *     1. 读取 type
@@ -1755,20 +2969,20 @@ int rdbLoad(char *filename) {
          * REDIS_RDB_TYPE_* 为前缀的常量的其中一个
          * 或者所有以 REDIS_RDB_OPCODE_* 为前缀的常量的其中一个
          */
-        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
 
         // 读入过期时间值
         if (type == REDIS_RDB_OPCODE_EXPIRETIME) {
 
             // 以秒计算的过期时间
 
-            if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
 
             /* We read the time so we need to read the object type again. 
              *
              * 在过期时间之后会跟着一个键值对，我们要读入这个键值对的类型
              */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
 
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. 
@@ -1781,13 +2995,13 @@ int rdbLoad(char *filename) {
 
             /* Milliseconds precision expire times introduced with RDB
              * version 3. */
-            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
 
             /* We read the time so we need to read the object type again.
              *
              * 在过期时间之后会跟着一个键值对，我们要读入这个键值对的类型
              */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
         }
             
         // 读入数据 REDIS_RDB_OPCODE_EOF （不是 rdb 文件的 EOF）
@@ -1801,7 +3015,7 @@ int rdbLoad(char *filename) {
         if (type == REDIS_RDB_OPCODE_SELECTDB) {
 
             // 读入数据库号码
-            if ((dbid = rdbLoadLen(&rdb,NULL)) == REDIS_RDB_LENERR)
+            if ((dbid = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR)
                 goto eoferr;
 
             // 检查数据库号码的正确性
@@ -1817,17 +3031,41 @@ int rdbLoad(char *filename) {
             continue;
         }
 
+        /* AUX fields: string key / string value pairs. The ones we don't
+         * know are skipped, so new ones can be added compatibly.
+         *
+         * 读入辅助字段
+         */
+        if (type == REDIS_RDB_OPCODE_AUX) {
+            if (rdbLoadAuxField(rdb,rsi) == -1) goto eoferr;
+            continue;
+        }
+
+        /* Functions created with FUNCTION LOAD.
+         *
+         * 读入函数 */
+        if (type == REDIS_RDB_OPCODE_FUNCTION) {
+            robj *name, *body;
+
+            if (rdbLoadFunction(rdb,&name,&body) == -1) goto eoferr;
+            if (rdbCreateFunction(name,body) == REDIS_ERR) {
+                errno = EIO;
+                return REDIS_ERR;
+            }
+            continue;
+        }
+
         /* Read key */
         /*
          * 读入键
          */
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
 
         /* Read value */
         /*
          * 读入值
          */
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
+        if ((val = rdbLoadObject(type,rdb)) == NULL) goto eoferr;
 
         /* Check if the key already expired. This function is used when loading
          * an RDB file from disk, either at startup, or when an RDB was
@@ -1867,45 +3105,82 @@ int rdbLoad(char *filename) {
         decrRefCount(key);
     }   // end of while(1)
 
+verify_checksum:
     /* Verify the checksum if RDB version is >= 5 
      *
      * 如果 RDB 版本 >= 5 ，那么比对校验和
      */
-    if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+    if (rdbver >= 5) {
+        uint64_t cksum, expected = rdb->cksum;
 
+        /* The checksum is consumed even when not verified, so that a
+         * stream (the socket of the master) is left right after the RDB. */
         // 读入文件的校验和
-        if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
         memrev64ifbe(&cksum);
 
         // 比对校验和
-        if (cksum == 0) {
+        if (!server.rdb_checksum) {
+            /* Checksum verification disabled. */
+        } else if (cksum == 0) {
             redisLog(REDIS_WARNING,"RDB file was saved with checksum disabled: no check performed.");
         } else if (cksum != expected) {
-            redisLog(REDIS_WARNING,"Wrong RDB checksum. Aborting now.");
-            exit(1);
+            redisLog(REDIS_WARNING,"Wrong RDB checksum.");
+            errno = EIO;
+            return REDIS_ERR;
         }
     }
 
-    // 关闭 RDB 
+    return REDIS_OK;
+
+eoferr: /* unexpected end of file, rdbLoad() turns it into a fatal exit */
+    redisLog(REDIS_WARNING,"Short read or OOM loading DB.");
+    errno = EIO;
+    return REDIS_ERR;
+}
+
+/*
+ * 将给定 rdb 文件中保存的数据载入到数据库中。
+ *
+ * A file that is not an RDB at all is reported to the caller, while a
+ * truncated or corrupted one is an unrecoverable error.
+ */
+int rdbLoad(char *filename, rdbSaveInfo *rsi) {
+    FILE *fp;
+    rio rdb;
+    int retval, err;
+
+    // 打开 rdb 文件
+    if ((fp = fopen(filename,"r")) == NULL) return REDIS_ERR;
+
+    // 将服务器状态调整到开始载入状态
+    startLoading(fp);
+
+    // 初始化读取流
+    rioInitWithFile(&rdb,fp);
+    retval = rdbLoadRio(&rdb,rsi);
+    err = errno;
+
+    // 关闭 RDB
     fclose(fp);
 
     // 服务器从载入状态中退出
     stopLoading();
 
-    return REDIS_OK;
-
-eoferr: /* unexpected end of file is handled here with a fatal exit */
-    redisLog(REDIS_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
-    exit(1);
-    return REDIS_ERR; /* Just to avoid warning */
+    if (retval != REDIS_OK && err != EINVAL) {
+        redisLog(REDIS_WARNING,"Unrecoverable error loading the DB, aborting now.");
+        exit(1);
+    }
+    errno = err;
+    return retval;
 }
 
-/* A background saving child (BGSAVE) terminated its work. Handle this. 
+/* A background saving child (BGSAVE) terminated its work. Handle this.
+ * This function covers the case of actual BGSAVEs. 
  *
- * 处理 BGSAVE 完成时发送的信号
+ * 处理 BGSAVE 完成时发送的信号（ RDB 写入磁盘的情况）
  */
-void backgroundSaveDoneHandler(int exitcode, int bysignal) {
+void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
 
     // BGSAVE 成功
     if (!bysignal && exitcode == 0) {
@@ -1934,13 +3209,130 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
 
     // 更新服务器状态
     server.rdb_child_pid = -1;
+    server.rdb_child_type = REDIS_RDB_CHILD_TYPE_NONE;
     server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
     server.rdb_save_time_start = -1;
 
     /* Possibly there are slaves waiting for a BGSAVE in order to be served
      * (the first stage of SYNC is a bulk transfer of dump.rdb) */
     // 有正在等待 master 完成 RDB 进行同步的 slave，而且这个 BGSAVE CMD 很可能就是 slave 引发 master 执行的，处理这种情况
-    updateSlavesWaitingBgsave(exitcode == 0 ? REDIS_OK : REDIS_ERR);
+    updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? REDIS_OK : REDIS_ERR,
+        REDIS_RDB_CHILD_TYPE_DISK);
+}
+
+/* A background saving child (BGSAVE) terminated its work. Handle this.
+ * This function covers the case of RDB -> Slaves socket transfers for
+ * diskless replication.
+ *
+ * 处理无盘复制子进程的退出：读取子进程在管道中留下的报告，
+ * 释放传送失败的 slave ，其余的 slave 等待第一个 ACK 后上线。
+ */
+void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
+    uint64_t *ok_slaves;
+
+    if (!bysignal && exitcode == 0) {
+        redisLog(REDIS_NOTICE,
+            "Background RDB transfer terminated with success");
+    } else if (!bysignal && exitcode != 0) {
+        redisLog(REDIS_WARNING, "Background transfer error");
+    } else {
+        redisLog(REDIS_WARNING,
+            "Background transfer terminated by signal %d", bysignal);
+    }
+    server.rdb_child_pid = -1;
+    server.rdb_child_type = REDIS_RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_start = -1;
+
+    /* If the child returns an OK exit code, read the set of slave client
+     * IDs and the associated status code. We'll terminate all the slaves
+     * in error state.
+     *
+     * If the process returned an error, consider the list of slaves that
+     * can continue to be empty, so that it's just a special case of the
+     * normal code path. */
+    ok_slaves = zmalloc(sizeof(uint64_t)); /* Make space for the count. */
+    ok_slaves[0] = 0;
+    if (!bysignal && exitcode == 0) {
+        int readlen = sizeof(uint64_t);
+
+        if (read(server.rdb_pipe_read_result_from_child, ok_slaves, readlen) ==
+                 readlen)
+        {
+            readlen = ok_slaves[0]*sizeof(uint64_t)*2;
+
+            /* Make space for enough elements as specified by the first
+             * uint64_t element in the array. */
+            ok_slaves = zrealloc(ok_slaves,sizeof(uint64_t)+readlen);
+            if (readlen &&
+                read(server.rdb_pipe_read_result_from_child, ok_slaves+1,
+                     readlen) != readlen)
+            {
+                ok_slaves[0] = 0;
+            }
+        }
+    }
+
+    close(server.rdb_pipe_read_result_from_child);
+    close(server.rdb_pipe_write_result_to_parent);
+
+    /* We can continue the replication process with all the slaves that
+     * correctly received the full payload. Others are terminated. */
+    listNode *ln;
+    listIter li;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END) {
+            uint64_t j;
+            int errorcode = 0;
+
+            /* Search for the slave ID in the reply. In order for a slave to
+             * continue the replication process, we need to find it in the list,
+             * and it must have an error code set to 0 (which means success). */
+            for (j = 0; j < ok_slaves[0]; j++) {
+                if (slave->id == ok_slaves[2*j+1]) {
+                    errorcode = ok_slaves[2*j+2];
+                    break; /* Found in slaves list. */
+                }
+            }
+            if (j == ok_slaves[0] || errorcode != 0) {
+                redisLog(REDIS_WARNING,
+                "Closing slave %llu: child->slave RDB transfer failed: %s",
+                    (unsigned long long) slave->id,
+                    (errorcode == 0) ? "RDB transfer child aborted"
+                                     : strerror(errorcode));
+                freeClient(slave);
+            } else {
+                redisLog(REDIS_NOTICE,
+                "Slave %llu correctly received the streamed RDB file.",
+                    (unsigned long long) slave->id);
+                /* Restore the socket as non-blocking. */
+                anetNonBlock(NULL,slave->fd);
+                anetSendTimeout(NULL,slave->fd,0);
+            }
+        }
+    }
+    zfree(ok_slaves);
+
+    updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? REDIS_OK : REDIS_ERR,
+        REDIS_RDB_CHILD_TYPE_SOCKET);
+}
+
+/* When a background RDB saving/transfer terminates, call the right handler. */
+void backgroundSaveDoneHandler(int exitcode, int bysignal) {
+    switch(server.rdb_child_type) {
+    case REDIS_RDB_CHILD_TYPE_DISK:
+        backgroundSaveDoneHandlerDisk(exitcode,bysignal);
+        break;
+    case REDIS_RDB_CHILD_TYPE_SOCKET:
+        backgroundSaveDoneHandlerSocket(exitcode,bysignal);
+        break;
+    default:
+        redisPanic("Unknown RDB child type.");
+        break;
+    }
 }
 
 // #define REDIS_DEFAULT_RDB_FILENAME "dump.rdb" 默认的 RDB 名字
@@ -1961,12 +3353,36 @@ void saveCommand(redisClient *c) {
     }
 }
 
+/*
+ * BGSAVE [FORKLESS]
+ *
+ * FORKLESS, or the rdb-forkless option, saves without fork(), see snapshot.c.
+ */
 void bgsaveCommand(redisClient *c) {
+    int forkless = server.rdb_forkless;
+
+    if (c->argc > 2) {
+        addReply(c,shared.syntaxerr);
+        return;
+    } else if (c->argc == 2) {
+        if (strcasecmp(c->argv[1]->ptr,"forkless")) {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        forkless = 1;
+    }
 
     // 不能重复执行 BGSAVE
-    if (server.rdb_child_pid != -1) {
+    if (server.rdb_child_pid != -1 || server.forkless_save) {
         addReplyError(c,"Background save already in progress");
 
+    // 无 fork 的 BGSAVE 可以与 BGREWRITEAOF 同时进行
+    } else if (forkless) {
+        if (rdbSaveForkless(server.rdb_filename) == REDIS_OK)
+            addReplyStatus(c,"Background saving started");
+        else
+            addReply(c,shared.err);
+
     // 不能在 BGREWRITEAOF 正在运行时执行
     } else if (server.aof_child_pid != -1) {
         addReplyError(c,"Can't BGSAVE while AOF log rewriting is in progress");
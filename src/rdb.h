@@ -41,7 +41,7 @@
  *
  * RDB 的版本，当新版本不向就版本兼容时，增一
  */
-#define REDIS_RDB_VERSION 6
+#define REDIS_RDB_VERSION 9
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -88,6 +88,11 @@
 #define REDIS_RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define REDIS_RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define REDIS_RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define REDIS_RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define REDIS_RDB_ENC_ZSTD 5        /* string compressed with zstd */
+
+/* zstd level used for RDB strings: favours save speed over ratio. */
+#define REDIS_RDB_ZSTD_LEVEL 3
 
 /* Dup object types to RDB object types. Only reason is readability (are we
  * dealing with RDB types or with in-memory object types?).
@@ -109,17 +114,28 @@
 #define REDIS_RDB_TYPE_SET_INTSET    11
 #define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
 #define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+#define REDIS_RDB_TYPE_LIST_QUICKLIST 14
+#define REDIS_RDB_TYPE_STREAM_ZIPLISTS 15
+#define REDIS_RDB_TYPE_HASH_LISTPACK 16
+#define REDIS_RDB_TYPE_ZSET_LISTPACK 17
+#define REDIS_RDB_TYPE_LIST_QUICKLIST_2 18
+#define REDIS_RDB_TYPE_MODULE 19    /* Value of a module type, see module.c */
+#define REDIS_RDB_TYPE_ZSET_2 20    /* ZSET with binary double scores */
 
 /* Test if a type is an object type.
  *
  * 检查给定类型是否对象
  */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 20))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType).
  *
  * 数据库特殊操作标识符
  */
+// (0xF6), 函数：函数名字符串跟着函数体字符串
+#define REDIS_RDB_OPCODE_FUNCTION   246
+// (0xFA), 辅助字段：一个 key 字符串跟着一个 value 字符串
+#define REDIS_RDB_OPCODE_AUX        250
 // (0xFC), 以 MS 计算的过期时间
 #define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
 // (0xFD), 以秒计算的过期时间
@@ -129,18 +145,47 @@
 // (0xFF), 数据库的结尾（但不是 RDB 文件的结尾）
 #define REDIS_RDB_OPCODE_EOF        255
 
+/* rdbSaveRio() flags. */
+#define REDIS_RDB_SAVE_NONE 0
+#define REDIS_RDB_SAVE_AOF_PREAMBLE (1<<0) /* Saving the AOF rewrite preamble */
+
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
 time_t rdbLoadTime(rio *rdb);
+long long rdbLoadMillisecondTime(rio *rdb);
 int rdbSaveLen(rio *rdb, uint32_t len);
 uint32_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
-int rdbLoad(char *filename);
+/* Replication info stored into the RDB as AUX fields, so that a restarted
+ * slave can PSYNC with its master, and so that a slave loading the RDB
+ * from its master knows the DB selected by the replication stream.
+ *
+ * 保存在 RDB 辅助字段中的复制信息 */
+typedef struct rdbSaveInfo {
+    int repl_stream_db;     /* DB selected in the replication stream, or -1. */
+    int repl_id_is_set;     /* True if repl_id was found in the RDB. */
+    char repl_id[REDIS_RUN_ID_SIZE+1]; /* Replication ID. */
+    long long repl_offset;  /* Replication offset, or -1. */
+} rdbSaveInfo;
+
+#define RDB_SAVE_INFO_INIT {-1,0,"0000000000000000000000000000000000000000",-1}
+
+/* While the threads of the threaded loader run, refcounts are updated
+ * atomically as the values they build may reference shared objects. */
+extern volatile int rdb_load_threads_active;
+#define rdbLoadThreadsActive() (rdb_load_threads_active != 0)
+
+int rdbLoad(char *filename, rdbSaveInfo *rsi);
+int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi);
 int rdbSaveBackground(char *filename);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename);
+int rdbSaveRio(rio *rdb, int *error, int flags);
+int rdbSaveRioHeader(rio *rdb);
+int rdbSaveRioTrailer(rio *rdb);
+int rdbSaveToSlavesSockets(void);
 int rdbSaveObject(rio *rdb, robj *o);
 off_t rdbSavedObjectLen(robj *o);
 off_t rdbSavedObjectPages(robj *o);
@@ -148,5 +193,13 @@ robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
 robj *rdbLoadStringObject(rio *rdb);
+int rdbSaveStringObject(rio *rdb, robj *obj);
+int rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
+int rdbCompressionCodecFromName(char *name);
+char *rdbCompressionCodecName(int codec);
+int rdbSaveDoubleValue(rio *rdb, double val);
+int rdbLoadDoubleValue(rio *rdb, double *val);
+int rdbSaveBinaryDoubleValue(rio *rdb, double val);
+int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 
 #endif
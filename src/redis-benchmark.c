@@ -39,6 +39,9 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
+#include <math.h>
+#include <stdint.h>
 
 #include "ae.h"
 #include "hiredis.h"
@@ -48,16 +51,81 @@
 
 #define REDIS_NOTUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
+#define MAX_THREADS 256
+#define CLUSTER_SLOTS 16384
+#define WORKLOAD_MAX_OPS 16
+
+/* Distributions of the key ids used for __rand_int__ and by workloads, and
+ * of the value sizes used by workloads. */
+#define DIST_FIXED 0        /* Value sizes only: always -d bytes. */
+#define DIST_UNIFORM 1
+#define DIST_ZIPF 2
+#define DIST_SEQUENTIAL 3   /* Key ids only. */
+
+unsigned short crc16(const char *buf, int len);
+
+/* Zipfian generator over [0,n), as described by Gray et al. in "Quickly
+ * generating billion-record synthetic databases" (the YCSB one). Smaller
+ * ids are the hottest. */
+typedef struct zipfGenerator {
+    long long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipfGenerator;
+
+/* A command of a mixed workload, see --workload. */
+typedef struct workloadOp {
+    const char *name;
+    int weight;
+} workloadOp;
+
+/* A master of the cluster, see --cluster. */
+typedef struct clusterNode {
+    char *ip;
+    int port;
+    unsigned char slots[CLUSTER_SLOTS/8]; /* Bitmap of the served slots. */
+} clusterNode;
+
+/* Latencies are recorded in microseconds into a log-linear histogram, in
+ * the spirit of HdrHistogram: values below 2*HIST_SUB_COUNT are exact, and
+ * every power of two above is split into HIST_SUB_COUNT buckets, so that
+ * percentiles have a relative error below 1% at any magnitude. */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1<<HIST_SUB_BITS)
+#define HIST_MAX_BITS 32 /* Values are capped to 2^32-1 usec. */
+#define HIST_BUCKETS ((HIST_MAX_BITS-HIST_SUB_BITS+1)*HIST_SUB_COUNT)
+
+typedef struct histogram {
+    long long count;
+    long long min;
+    long long max;
+    long long sum;
+    unsigned long long buckets[HIST_BUCKETS];
+} histogram;
+
+/* Every thread drives its own clients from its own event loop. Without
+ * --threads a single one of these is run by the main thread. */
+typedef struct benchmarkThread {
+    int index;
+    pthread_t thread;
+    aeEventLoop *el;
+    list *clients;
+    int numclients;         /* Clients this thread should keep connected. */
+    int liveclients;
+    uint64_t seed;          /* xorshift64* state for keys and values. */
+    histogram latency;
+} benchmarkThread;
 
 static struct config {
-    aeEventLoop *el;
+    aeEventLoop *el;        /* Main thread loop: throughput reporting. */
     const char *hostip;
     int hostport;
     const char *hostsocket;
     int numclients;
-    int liveclients;
     int requests;
-    int requests_issued;
+    int requests_issued;    /* Updated atomically by the threads. */
     int requests_finished;
     int keysize;
     int datasize;
@@ -67,9 +135,7 @@ static struct config {
     int pipeline;
     long long start;
     long long totlatency;
-    long long *latency;
     const char *title;
-    list *clients;
     int quiet;
     int csv;
     int loop;
@@ -77,9 +143,29 @@ static struct config {
     int dbnum;
     sds dbnumstr;
     char *tests;
+    int keydist;            /* DIST_* of the key ids. */
+    int sizedist;           /* DIST_* of the workload value sizes. */
+    int datasize_min;       /* Smallest value size if sizedist != fixed. */
+    double zipf_theta;
+    zipfGenerator keyzipf;
+    zipfGenerator sizezipf;
+    long long seq_next;     /* Next DIST_SEQUENTIAL key id. */
+    char *databuf;          /* -d bytes of value for the workloads. */
+    workloadOp workload[WORKLOAD_MAX_OPS];
+    int workload_ops;       /* 0 unless --workload was given. */
+    int workload_weight;    /* Sum of the weights. */
+    int cluster_mode;
+    clusterNode *nodes;
+    int numnodes;
+    int next_node;          /* Round robin assignment of clients to nodes. */
+    int num_threads;        /* --threads, 0 means no extra threads. */
+    int running_threads;
+    benchmarkThread **threads;
 } config;
 
 typedef struct _client {
+    benchmarkThread *thread; /* Thread owning the client and its loop. */
+    clusterNode *node;      /* Node the client is connected to, or NULL. */
     redisContext *context;
     sds obuf;
     char **randptr;         /* Pointers to :rand: strings inside the command buf */
@@ -99,6 +185,352 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 static void createMissingClients(client c);
 
 /* Implementation */
+
+/* Return the index of the bucket counting the value 'v'. */
+static int histogramBucketIndex(unsigned long long v) {
+    int msb, shift;
+
+    if (v < HIST_SUB_COUNT*2) return v;
+    if (v >> HIST_MAX_BITS) v = (1ULL<<HIST_MAX_BITS)-1;
+    msb = 63 - __builtin_clzll(v);
+    shift = msb - HIST_SUB_BITS;
+    return shift*HIST_SUB_COUNT + (v >> shift);
+}
+
+/* Return the highest value counted by the bucket at 'idx'. */
+static unsigned long long histogramBucketValue(int idx) {
+    int shift;
+    unsigned long long mantissa;
+
+    if (idx < HIST_SUB_COUNT*2) return idx;
+    shift = idx/HIST_SUB_COUNT - 1;
+    mantissa = idx - shift*HIST_SUB_COUNT;
+    return ((mantissa+1) << shift) - 1;
+}
+
+static void histogramReset(histogram *h) {
+    memset(h,0,sizeof(*h));
+    h->min = -1;
+}
+
+static void histogramRecord(histogram *h, long long usec) {
+    if (usec < 0) usec = 0;
+    h->buckets[histogramBucketIndex(usec)]++;
+    h->count++;
+    h->sum += usec;
+    if (h->min == -1 || usec < h->min) h->min = usec;
+    if (usec > h->max) h->max = usec;
+}
+
+/* Add the values recorded in 'src' to 'dst'. */
+static void histogramMerge(histogram *dst, histogram *src) {
+    int j;
+
+    if (src->count == 0) return;
+    for (j = 0; j < HIST_BUCKETS; j++) dst->buckets[j] += src->buckets[j];
+    if (dst->min == -1 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+}
+
+/* Return the value at the percentile 'perc' (0-100), that is the highest
+ * value counted by the matching bucket, capped to the max recorded value. */
+static long long histogramPercentile(histogram *h, double perc) {
+    unsigned long long target, seen = 0;
+    int j;
+
+    if (h->count == 0) return 0;
+    target = (unsigned long long) ((perc / 100) * h->count + 0.5);
+    if (target == 0) target = 1;
+    for (j = 0; j < HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= target) {
+            long long v = histogramBucketValue(j);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+/* ----------------------- Keys and values generation ----------------------- */
+
+static uint64_t benchmarkRandom(benchmarkThread *t) {
+    t->seed ^= t->seed >> 12;
+    t->seed ^= t->seed << 25;
+    t->seed ^= t->seed >> 27;
+    return t->seed * 2685821657736338717ULL;
+}
+
+/* Return a random double in [0,1). */
+static double benchmarkRandomDouble(benchmarkThread *t) {
+    return (benchmarkRandom(t) >> 11) * (1.0/9007199254740992.0);
+}
+
+/* Return sum(1/i^theta) for i in [1,n]. After the first million terms the
+ * tail is approximated with an integral, so that huge keyspaces don't take
+ * seconds to set up. */
+static double zipfZeta(long long n, double theta) {
+    long long i, exact = n < 1000000 ? n : 1000000;
+    double sum = 0;
+
+    for (i = 1; i <= exact; i++) sum += 1/pow((double)i,theta);
+    if (n > exact) {
+        sum += (pow(n+0.5,1-theta) - pow(exact+0.5,1-theta)) / (1-theta);
+    }
+    return sum;
+}
+
+static void zipfInit(zipfGenerator *z, long long n, double theta) {
+    double zeta2 = zipfZeta(2,theta);
+
+    if (n < 1) n = 1;
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1/(1-theta);
+    z->zetan = zipfZeta(n,theta);
+    z->eta = (1-pow(2.0/n,1-theta)) / (1-zeta2/z->zetan);
+}
+
+static long long zipfNext(zipfGenerator *z, benchmarkThread *t) {
+    double u = benchmarkRandomDouble(t), uz = u*z->zetan;
+    long long v;
+
+    if (z->n == 1 || uz < 1) return 0;
+    if (uz < 1+pow(0.5,z->theta)) return 1;
+    v = (long long) (z->n * pow(z->eta*u - z->eta + 1, z->alpha));
+    return v >= z->n ? z->n-1 : v;
+}
+
+/* Return the next key id in [0,keyspacelen). Without -r every request
+ * uses key id 0, like a __rand_int__ that is not expanded. */
+static long long nextKeyId(benchmarkThread *t) {
+    long long n = config.randomkeys ? config.randomkeys_keyspacelen : 1;
+
+    if (n <= 1) return 0;
+    switch(config.keydist) {
+    case DIST_ZIPF: return zipfNext(&config.keyzipf,t);
+    case DIST_SEQUENTIAL: return __sync_fetch_and_add(&config.seq_next,1) % n;
+    default: return benchmarkRandom(t) % n;
+    }
+}
+
+/* Return the size of the next workload value. */
+static int nextValueSize(benchmarkThread *t) {
+    int range = config.datasize-config.datasize_min+1;
+
+    switch(config.sizedist) {
+    case DIST_UNIFORM:
+        return config.datasize_min + benchmarkRandom(t) % range;
+    case DIST_ZIPF:
+        return config.datasize_min + zipfNext(&config.sizezipf,t);
+    default:
+        return config.datasize;
+    }
+}
+
+/* Same as keyHashSlot() in cluster.c. */
+static unsigned int keyHashSlot(char *key, int keylen) {
+    int s, e; /* start-end indexes of { and } */
+
+    for (s = 0; s < keylen; s++)
+        if (key[s] == '{') break;
+    if (s == keylen) return crc16(key,keylen) & 0x3FFF;
+    for (e = s+1; e < keylen; e++)
+        if (key[e] == '}') break;
+    if (e == keylen || e == s+1) return crc16(key,keylen) & 0x3FFF;
+    return crc16(key+s+1,e-s-1) & 0x3FFF;
+}
+
+static int clusterNodeServesSlot(clusterNode *n, unsigned int slot) {
+    return (n->slots[slot>>3] & (1<<(slot&7))) != 0;
+}
+
+static sds catBulk(sds s, const char *p, size_t len) {
+    char buf[32];
+    int l = snprintf(buf,sizeof(buf),"$%zu\r\n",len);
+
+    s = sdscatlen(s,buf,l);
+    s = sdscatlen(s,p,len);
+    return sdscatlen(s,"\r\n",2);
+}
+
+/* Append a random request of the workload to the client output buffer.
+ * In cluster mode key ids are drawn until one hashes to a slot served by
+ * the node of the client, so every request goes to the owning node. */
+static void appendWorkloadRequest(client c) {
+    benchmarkThread *t = c->thread;
+    int pick = benchmarkRandom(t) % config.workload_weight, j, keylen;
+    int tries = 0, vlen;
+    const char *op, *prefix;
+    char key[64];
+
+    for (j = 0; pick >= config.workload[j].weight; j++)
+        pick -= config.workload[j].weight;
+    op = config.workload[j].name;
+
+    /* Every data type gets its own keys to avoid WRONGTYPE errors. */
+    if (!strcmp(op,"incr")) prefix = "counter:";
+    else if (!strcmp(op,"hset") || !strcmp(op,"hget")) prefix = "hash:";
+    else if (!strcmp(op,"lpush") || !strcmp(op,"lpop")) prefix = "list:";
+    else if (!strcmp(op,"sadd")) prefix = "set:";
+    else prefix = "key:";
+
+    do {
+        keylen = snprintf(key,sizeof(key),"%s%012lld",prefix,nextKeyId(t));
+        if (c->node == NULL ||
+            clusterNodeServesSlot(c->node,keyHashSlot(key,keylen))) break;
+    } while (++tries < 1000);
+    if (tries == 1000) {
+        fprintf(stderr,"No key of the keyspace is served by %s:%d, "
+                       "try a larger -r\n", c->node->ip, c->node->port);
+        exit(1);
+    }
+
+    if (!strcmp(op,"set") || !strcmp(op,"lpush") || !strcmp(op,"sadd")) {
+        c->obuf = sdscat(c->obuf,"*3\r\n");
+        c->obuf = catBulk(c->obuf,op,strlen(op));
+        c->obuf = catBulk(c->obuf,key,keylen);
+        vlen = nextValueSize(t);
+        c->obuf = catBulk(c->obuf,config.databuf,vlen);
+    } else if (!strcmp(op,"hset")) {
+        c->obuf = sdscat(c->obuf,"*4\r\n");
+        c->obuf = catBulk(c->obuf,op,strlen(op));
+        c->obuf = catBulk(c->obuf,key,keylen);
+        c->obuf = catBulk(c->obuf,"field",5);
+        vlen = nextValueSize(t);
+        c->obuf = catBulk(c->obuf,config.databuf,vlen);
+    } else if (!strcmp(op,"hget")) {
+        c->obuf = sdscat(c->obuf,"*3\r\n");
+        c->obuf = catBulk(c->obuf,op,strlen(op));
+        c->obuf = catBulk(c->obuf,key,keylen);
+        c->obuf = catBulk(c->obuf,"field",5);
+    } else {
+        c->obuf = sdscat(c->obuf,"*2\r\n");
+        c->obuf = catBulk(c->obuf,op,strlen(op));
+        c->obuf = catBulk(c->obuf,key,keylen);
+    }
+}
+
+/* Parse a --workload specification like "get:80,set:20". */
+static int parseWorkload(const char *spec) {
+    static const char *ops[] = {"get","set","incr","del","exists","hget",
+                                "hset","lpush","lpop","sadd",NULL};
+    sds *parts;
+    int count, j, k, ok = 1;
+
+    config.workload_ops = 0;
+    config.workload_weight = 0;
+    parts = sdssplitlen(spec,strlen(spec),",",1,&count);
+    for (j = 0; j < count && ok; j++) {
+        char *colon = strchr(parts[j],':');
+        int weight = colon ? atoi(colon+1) : 1;
+
+        if (colon) *colon = '\0';
+        sdstolower(parts[j]);
+        for (k = 0; ops[k] && strcmp(ops[k],parts[j]); k++);
+        if (ops[k] == NULL || weight <= 0 ||
+            config.workload_ops == WORKLOAD_MAX_OPS)
+        {
+            ok = 0;
+            break;
+        }
+        config.workload[config.workload_ops].name = ops[k];
+        config.workload[config.workload_ops].weight = weight;
+        config.workload_ops++;
+        config.workload_weight += weight;
+    }
+    sdsfreesplitres(parts,count);
+    return ok && config.workload_ops;
+}
+
+static int parseDistribution(const char *name) {
+    if (!strcasecmp(name,"fixed")) return DIST_FIXED;
+    if (!strcasecmp(name,"uniform")) return DIST_UNIFORM;
+    if (!strcasecmp(name,"zipf") || !strcasecmp(name,"zipfian"))
+        return DIST_ZIPF;
+    if (!strcasecmp(name,"sequential")) return DIST_SEQUENTIAL;
+    return -1;
+}
+
+/* Fetch the masters and their slots with CLUSTER NODES. */
+static void fetchClusterConfiguration(void) {
+    redisContext *ctx;
+    redisReply *reply;
+    sds *lines;
+    int count, j;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx == NULL || ctx->err) {
+        fprintf(stderr,"Could not connect to Redis: %s\n",
+            ctx ? ctx->errstr : "out of memory");
+        exit(1);
+    }
+    reply = redisCommand(ctx,"CLUSTER NODES");
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) {
+        fprintf(stderr,"CLUSTER NODES failed: %s\n",
+            reply && reply->type == REDIS_REPLY_ERROR ? reply->str : ctx->errstr);
+        exit(1);
+    }
+
+    lines = sdssplitlen(reply->str,reply->len,"\n",1,&count);
+    config.nodes = zmalloc(sizeof(clusterNode)*count);
+    config.numnodes = 0;
+    for (j = 0; j < count; j++) {
+        sds *f;
+        int fcount, k;
+        char *addr, *p;
+        clusterNode *n;
+
+        f = sdssplitlen(lines[j],sdslen(lines[j])," ",1,&fcount);
+        if (fcount < 8 || !strstr(f[2],"master") || strstr(f[2],"fail")) {
+            sdsfreesplitres(f,fcount);
+            continue;
+        }
+        n = config.nodes+config.numnodes;
+        memset(n->slots,0,sizeof(n->slots));
+        addr = f[1];
+        if ((p = strchr(addr,'@')) != NULL) *p = '\0'; /* Bus port. */
+        p = strrchr(addr,':');
+        n->port = p ? atoi(p+1) : 0;
+        if (p) *p = '\0';
+        /* The node we are connected to may not know its own address yet,
+         * and reports it as ":0". */
+        if (addr[0] == '\0' || n->port == 0) {
+            n->ip = strdup(config.hostip);
+            n->port = config.hostport;
+        } else {
+            n->ip = strdup(addr);
+        }
+        for (k = 8; k < fcount; k++) {
+            int start, stop, s;
+
+            if (f[k][0] == '[') continue; /* Importing / migrating. */
+            if ((p = strchr(f[k],'-')) != NULL) {
+                start = atoi(f[k]);
+                stop = atoi(p+1);
+            } else {
+                start = stop = atoi(f[k]);
+            }
+            for (s = start; s <= stop && s < CLUSTER_SLOTS; s++)
+                n->slots[s>>3] |= 1<<(s&7);
+        }
+        sdsfreesplitres(f,fcount);
+        config.numnodes++;
+    }
+    sdsfreesplitres(lines,count);
+    freeReplyObject(reply);
+    redisFree(ctx);
+
+    if (config.numnodes == 0) {
+        fprintf(stderr,"No master found in the cluster configuration\n");
+        exit(1);
+    }
+}
+
 static long long ustime(void) {
     struct timeval tv;
     long long ust;
@@ -120,33 +552,49 @@ static long long mstime(void) {
 }
 
 static void freeClient(client c) {
+    benchmarkThread *t = c->thread;
     listNode *ln;
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
+
+    aeDeleteFileEvent(t->el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(t->el,c->context->fd,AE_READABLE);
     redisFree(c->context);
     sdsfree(c->obuf);
     zfree(c->randptr);
     zfree(c);
-    config.liveclients--;
-    ln = listSearchKey(config.clients,c);
+    t->liveclients--;
+    ln = listSearchKey(t->clients,c);
     assert(ln != NULL);
-    listDelNode(config.clients,ln);
+    listDelNode(t->clients,ln);
+
+    /* Nothing left to do for this thread. */
+    if (listLength(t->clients) == 0) aeStop(t->el);
+}
+
+/* Number of entries in config.threads. */
+static int benchmarkThreadCount(void) {
+    return config.num_threads ? config.num_threads : 1;
 }
 
 static void freeAllClients(void) {
-    listNode *ln = config.clients->head, *next;
+    int j;
+
+    for (j = 0; j < benchmarkThreadCount(); j++) {
+        listNode *ln = config.threads[j]->clients->head, *next;
 
-    while(ln) {
-        next = ln->next;
-        freeClient(ln->value);
-        ln = next;
+        while(ln) {
+            next = ln->next;
+            freeClient(ln->value);
+            ln = next;
+        }
     }
 }
 
 static void resetClient(client c) {
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
-    aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    aeEventLoop *el = c->thread->el;
+
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
     c->written = 0;
     c->pending = config.pipeline;
 }
@@ -156,7 +604,7 @@ static void randomizeClientKey(client c) {
 
     for (i = 0; i < c->randlen; i++) {
         char *p = c->randptr[i]+11;
-        size_t r = random() % config.randomkeys_keyspacelen;
+        size_t r = nextKeyId(c->thread);
         size_t j;
 
         for (j = 0; j < 12; j++) {
@@ -168,17 +616,16 @@ static void randomizeClientKey(client c) {
 }
 
 static void clientDone(client c) {
-    if (config.requests_finished == config.requests) {
+    if (config.requests_finished >= config.requests) {
         freeClient(c);
-        aeStop(config.el);
         return;
     }
     if (config.keepalive) {
         resetClient(c);
     } else {
-        config.liveclients--;
+        c->thread->liveclients--;
         createMissingClients(c);
-        config.liveclients++;
+        c->thread->liveclients++;
         freeClient(c);
     }
 }
@@ -227,8 +674,11 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     continue;
                 }
 
-                if (config.requests_finished < config.requests)
-                    config.latency[config.requests_finished++] = c->latency;
+                if (__sync_fetch_and_add(&config.requests_finished,1) <
+                    config.requests)
+                {
+                    histogramRecord(&c->thread->latency,c->latency);
+                }
                 c->pending--;
                 if (c->pending == 0) {
                     clientDone(c);
@@ -243,20 +693,28 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
-    REDIS_NOTUSED(el);
     REDIS_NOTUSED(fd);
     REDIS_NOTUSED(mask);
 
     /* Initialize request when nothing was written. */
     if (c->written == 0) {
         /* Enforce upper bound to number of requests. */
-        if (config.requests_issued++ >= config.requests) {
+        if (__sync_fetch_and_add(&config.requests_issued,1) >= config.requests) {
             freeClient(c);
             return;
         }
 
-        /* Really initialize: randomize keys and set start time. */
-        if (config.randomkeys) randomizeClientKey(c);
+        /* Really initialize: randomize keys and set start time. Workload
+         * requests are generated from scratch every time, after the
+         * SELECT prefix if it was not sent yet. */
+        if (config.workload_ops) {
+            int j;
+
+            sdssetlen(c->obuf,c->selectlen);
+            for (j = 0; j < config.pipeline; j++) appendWorkloadRequest(c);
+        } else if (config.randomkeys) {
+            randomizeClientKey(c);
+        }
         c->start = ustime();
         c->latency = -1;
     }
@@ -272,8 +730,8 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
         c->written += nwritten;
         if (sdslen(c->obuf) == c->written) {
-            aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-            aeCreateFileEvent(config.el,c->context->fd,AE_READABLE,readHandler,c);
+            aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+            aeCreateFileEvent(el,c->context->fd,AE_READABLE,readHandler,c);
         }
     }
 }
@@ -299,12 +757,23 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  *    for arguments randomization.
  *
  * Even when cloning another client, the SELECT command is automatically prefixed
- * if needed. */
-static client createClient(char *cmd, size_t len, client from) {
+ * if needed.
+ *
+ * The client is served by the event loop of 't'. */
+static client createClient(benchmarkThread *t, char *cmd, size_t len, client from) {
     int j;
     client c = zmalloc(sizeof(struct _client));
 
-    if (config.hostsocket == NULL) {
+    c->thread = t;
+    c->node = NULL;
+
+    /* In cluster mode clients are spread among the masters. */
+    if (config.cluster_mode) {
+        int idx = __sync_fetch_and_add(&config.next_node,1) % config.numnodes;
+
+        c->node = config.nodes+idx;
+        c->context = redisConnectNonBlock(c->node->ip,c->node->port);
+    } else if (config.hostsocket == NULL) {
         c->context = redisConnectNonBlock(config.hostip,config.hostport);
     } else {
         c->context = redisConnectUnixNonBlock(config.hostsocket);
@@ -381,9 +850,9 @@ static client createClient(char *cmd, size_t len, client from) {
             }
         }
     }
-    aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
-    listAddNodeTail(config.clients,c);
-    config.liveclients++;
+    aeCreateFileEvent(t->el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    listAddNodeTail(t->clients,c);
+    t->liveclients++;
     return c;
 }
 
@@ -399,8 +868,8 @@ static void createMissingClients(client c) {
         buflen -= c->selectlen;
     }
 
-    while(config.liveclients < config.numclients) {
-        createClient(NULL,0,c);
+    while(c->thread->liveclients < c->thread->numclients) {
+        createClient(c->thread,NULL,0,c);
 
         /* Listen backlog is quite limited on most systems */
         if (++n > 64) {
@@ -410,52 +879,130 @@ static void createMissingClients(client c) {
     }
 }
 
-static int compareLatency(const void *a, const void *b) {
-    return (*(long long*)a)-(*(long long*)b);
-}
-
 static void showLatencyReport(void) {
-    int i, curlat = 0;
-    float perc, reqpersec;
+    static double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    int finished = config.requests_finished, j;
+    float reqpersec;
+    histogram *h = zmalloc(sizeof(*h));
+
+    if (finished > config.requests) finished = config.requests;
+    reqpersec = (float)finished/((float)config.totlatency/1000);
+
+    /* Per thread histograms are merged only once the run is over. */
+    histogramReset(h);
+    for (j = 0; j < benchmarkThreadCount(); j++)
+        histogramMerge(h,&config.threads[j]->latency);
 
-    reqpersec = (float)config.requests_finished/((float)config.totlatency/1000);
     if (!config.quiet && !config.csv) {
         printf("====== %s ======\n", config.title);
-        printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
+        printf("  %d requests completed in %.2f seconds\n", finished,
             (float)config.totlatency/1000);
         printf("  %d parallel clients\n", config.numclients);
+        if (config.num_threads)
+            printf("  %d threads\n", config.num_threads);
         printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
         printf("\n");
 
-        qsort(config.latency,config.requests,sizeof(long long),compareLatency);
-        for (i = 0; i < config.requests; i++) {
-            if (config.latency[i]/1000 != curlat || i == (config.requests-1)) {
-                curlat = config.latency[i]/1000;
-                perc = ((float)(i+1)*100)/config.requests;
-                printf("%.2f%% <= %d milliseconds\n", perc, curlat);
-            }
-        }
+        printf("Latency by percentile distribution (usec):\n");
+        printf("  min: %lld, avg: %.2f\n", h->min < 0 ? 0 : h->min,
+            h->count ? (double)h->sum/h->count : 0);
+        for (j = 0; j < (int)(sizeof(percentiles)/sizeof(percentiles[0])); j++)
+            printf("  p%g: %lld\n", percentiles[j],
+                histogramPercentile(h,percentiles[j]));
+        printf("  max: %lld\n", h->max);
         printf("%.2f requests per second\n\n", reqpersec);
     } else if (config.csv) {
         printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
     } else {
         printf("%s: %.2f requests per second\n", config.title, reqpersec);
     }
+    zfree(h);
+}
+
+/* Create the state of a benchmark thread. If 'el' is NULL the thread gets
+ * its own event loop. */
+static benchmarkThread *createBenchmarkThread(int index, aeEventLoop *el) {
+    benchmarkThread *t = zmalloc(sizeof(*t));
+
+    t->index = index;
+    t->el = el ? el : aeCreateEventLoop(1024*10);
+    t->clients = listCreate();
+    t->numclients = 0;
+    t->liveclients = 0;
+    t->seed = ((uint64_t)random() << 32) | random() | 1; /* Never zero. */
+    histogramReset(&t->latency);
+    return t;
 }
 
+static void *benchmarkThreadMain(void *arg) {
+    benchmarkThread *t = arg;
+
+    aeMain(t->el);
+    __sync_sub_and_fetch(&config.running_threads,1);
+    return NULL;
+}
+
+/* Stop the main loop once every thread is done. */
+static int checkThreadsDone(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    REDIS_NOTUSED(id);
+    REDIS_NOTUSED(clientData);
+
+    if (__sync_add_and_fetch(&config.running_threads,0) == 0) aeStop(eventLoop);
+    return 10;
+}
+
+/* Run the benchmark: the clients are split among the threads, each one
+ * running its own event loop, while the main thread just reports the
+ * throughput. Without --threads the only loop runs in the main thread. */
 static void benchmark(char *title, char *cmd, int len) {
+    int nthreads = benchmarkThreadCount(), j;
     client c;
 
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
 
-    c = createClient(cmd,len,NULL);
-    createMissingClients(c);
+    for (j = 0; j < nthreads; j++) {
+        benchmarkThread *t = config.threads[j];
+
+        t->numclients = config.numclients/nthreads +
+                        (j < config.numclients%nthreads);
+        histogramReset(&t->latency);
+        /* Like before threads existed, a single loop always gets a client. */
+        if (t->numclients == 0 && config.num_threads) continue;
+        c = createClient(t,cmd,len,NULL);
+        createMissingClients(c);
+    }
 
     config.start = mstime();
-    aeMain(config.el);
+    if (config.num_threads == 0) {
+        aeMain(config.threads[0]->el);
+    } else {
+        long long te;
+
+        config.running_threads = 0;
+        for (j = 0; j < nthreads; j++) {
+            if (config.threads[j]->numclients == 0) continue;
+            config.running_threads++;
+        }
+        for (j = 0; j < nthreads; j++) {
+            if (config.threads[j]->numclients == 0) continue;
+            if (pthread_create(&config.threads[j]->thread,NULL,
+                benchmarkThreadMain,config.threads[j]) != 0)
+            {
+                fprintf(stderr,"Error creating benchmark thread %d\n",j);
+                exit(1);
+            }
+        }
+        te = aeCreateTimeEvent(config.el,10,checkThreadsDone,NULL,NULL);
+        aeMain(config.el);
+        aeDeleteTimeEvent(config.el,te);
+        for (j = 0; j < nthreads; j++) {
+            if (config.threads[j]->numclients == 0) continue;
+            pthread_join(config.threads[j]->thread,NULL);
+        }
+    }
     config.totlatency = mstime()-config.start;
 
     showLatencyReport();
@@ -527,6 +1074,44 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i],"--key-dist") ||
+                   !strcmp(argv[i],"--datasize-dist"))
+        {
+            int dist;
+
+            if (lastarg) goto invalid;
+            dist = parseDistribution(argv[i+1]);
+            if (argv[i][2] == 'k') {
+                if (dist == -1 || dist == DIST_FIXED) goto invalid;
+                config.keydist = dist;
+            } else {
+                if (dist == -1 || dist == DIST_SEQUENTIAL) goto invalid;
+                config.sizedist = dist;
+            }
+            i++;
+        } else if (!strcmp(argv[i],"--zipf-theta")) {
+            if (lastarg) goto invalid;
+            config.zipf_theta = strtod(argv[++i],NULL);
+            if (config.zipf_theta <= 0 || config.zipf_theta >= 1) goto invalid;
+        } else if (!strcmp(argv[i],"--datasize-min")) {
+            if (lastarg) goto invalid;
+            config.datasize_min = atoi(argv[++i]);
+            if (config.datasize_min < 1) config.datasize_min = 1;
+        } else if (!strcmp(argv[i],"--workload")) {
+            if (lastarg) goto invalid;
+            if (!parseWorkload(argv[++i])) goto invalid;
+        } else if (!strcmp(argv[i],"--cluster")) {
+            config.cluster_mode = 1;
+        } else if (!strcmp(argv[i],"--threads")) {
+            if (lastarg) goto invalid;
+            config.num_threads = atoi(argv[++i]);
+            if (config.num_threads > MAX_THREADS) {
+                printf("WARNING: too many threads, limiting threads to %d.\n",
+                       MAX_THREADS);
+                config.num_threads = MAX_THREADS;
+            } else if (config.num_threads < 0) {
+                config.num_threads = 0;
+            }
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -554,6 +1139,22 @@ usage:
 " -n <requests>      Total number of requests (default 10000)\n"
 " -d <size>          Data size of SET/GET value in bytes (default 2)\n"
 " -dbnum <db>        SELECT the specified db number (default 0)\n"
+" --threads <num>    Run the clients from <num> threads, each with its own\n"
+"                    event loop (default 0: single threaded)\n"
+" --key-dist <dist>  Distribution of the -r key ids: uniform (default),\n"
+"                    zipf or sequential\n"
+" --zipf-theta <t>   Skew of the zipf distributions, in (0,1) (default 0.99)\n"
+" --workload <spec>  Run a single mixed test, e.g. get:80,set:15,incr:5\n"
+"                    Commands: get set incr del exists hget hset lpush lpop\n"
+"                    sadd. Every request picks a command by weight and a key\n"
+"                    id using --key-dist\n"
+" --datasize-dist <dist> Distribution of the workload value sizes: fixed\n"
+"                    (default, -d bytes), uniform or zipf between\n"
+"                    --datasize-min and -d bytes\n"
+" --datasize-min <size> Smallest workload value size (default 1)\n"
+" --cluster          Spread the clients among the masters of the cluster\n"
+"                    -h/-p belong to. Only --workload keys are routed to the\n"
+"                    node serving their slot\n"
 " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
 " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values for SADD\n"
 "  Using this option the benchmark will expand the string __rand_int__\n"
@@ -579,6 +1180,9 @@ usage:
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
+" Mixed workload on hot keys with values of 10 to 1000 bytes:\n"
+"   $ redis-benchmark -n 1000000 -r 1000000 --key-dist zipf --workload get:90,set:10 \\\n"
+"     --datasize-dist uniform --datasize-min 10 -d 1000\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
@@ -627,7 +1231,6 @@ int main(int argc, const char **argv) {
 
     config.numclients = 50;
     config.requests = 10000;
-    config.liveclients = 0;
     config.el = aeCreateEventLoop(1024*10);
     aeCreateTimeEvent(config.el,1,showThroughput,NULL,NULL);
     config.keepalive = 1;
@@ -639,8 +1242,20 @@ int main(int argc, const char **argv) {
     config.csv = 0;
     config.loop = 0;
     config.idlemode = 0;
-    config.latency = NULL;
-    config.clients = listCreate();
+    config.keydist = DIST_UNIFORM;
+    config.sizedist = DIST_FIXED;
+    config.datasize_min = 1;
+    config.zipf_theta = 0.99;
+    config.seq_next = 0;
+    config.workload_ops = 0;
+    config.workload_weight = 0;
+    config.cluster_mode = 0;
+    config.nodes = NULL;
+    config.numnodes = 0;
+    config.next_node = 0;
+    config.num_threads = 0;
+    config.running_threads = 0;
+    config.threads = NULL;
     config.hostip = "127.0.0.1";
     config.hostport = 6379;
     config.hostsocket = NULL;
@@ -651,7 +1266,32 @@ int main(int argc, const char **argv) {
     argc -= i;
     argv += i;
 
-    config.latency = zmalloc(sizeof(long long)*config.requests);
+    /* Without --threads the main thread runs the only benchmark loop, that
+     * also reports the throughput. */
+    if (config.num_threads) {
+        zmalloc_enable_thread_safeness();
+        config.threads = zmalloc(sizeof(benchmarkThread*)*config.num_threads);
+        for (i = 0; i < config.num_threads; i++)
+            config.threads[i] = createBenchmarkThread(i,NULL);
+    } else {
+        config.threads = zmalloc(sizeof(benchmarkThread*));
+        config.threads[0] = createBenchmarkThread(0,config.el);
+    }
+
+    if (config.datasize_min > config.datasize)
+        config.datasize_min = config.datasize;
+    if (config.keydist == DIST_ZIPF && config.randomkeys)
+        zipfInit(&config.keyzipf,config.randomkeys_keyspacelen,config.zipf_theta);
+    if (config.sizedist == DIST_ZIPF)
+        zipfInit(&config.sizezipf,config.datasize-config.datasize_min+1,
+                 config.zipf_theta);
+    if (config.cluster_mode) {
+        if (!config.workload_ops) {
+            fprintf(stderr,"--cluster requires --workload\n");
+            exit(1);
+        }
+        fetchClusterConfiguration();
+    }
 
     if (config.keepalive == 0) {
         printf("WARNING: keepalive disabled, you probably need 'echo 1 > /proc/sys/net/ipv4/tcp_tw_reuse' for Linux and 'sudo sysctl -w net.inet.tcp.msl=1000' for Mac OS X in order to use a lot of clients/requests\n");
@@ -659,12 +1299,28 @@ int main(int argc, const char **argv) {
 
     if (config.idlemode) {
         printf("Creating %d idle connections and waiting forever (Ctrl+C when done)\n", config.numclients);
-        c = createClient("",0,NULL); /* will never receive a reply */
+        config.threads[0]->numclients = config.numclients;
+        c = createClient(config.threads[0],"",0,NULL); /* will never receive a reply */
         createMissingClients(c);
-        aeMain(config.el);
+        aeMain(config.threads[0]->el);
         /* and will wait for every */
     }
 
+    /* Run the mixed workload: requests are generated by the clients. */
+    if (config.workload_ops) {
+        sds title = sdsnew("WORKLOAD");
+
+        for (i = 0; i < config.workload_ops; i++)
+            title = sdscatprintf(title,"%c%s:%d", i ? ',' : ' ',
+                config.workload[i].name, config.workload[i].weight);
+        config.databuf = zmalloc(config.datasize);
+        memset(config.databuf,'x',config.datasize);
+        do {
+            benchmark(title,"",0);
+        } while(config.loop);
+        return 0;
+    }
+
     /* Run benchmark with command in the remainder of the arguments. */
     if (argc) {
         sds title = sdsnew(argv[0]);
@@ -274,6 +274,16 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    /* Files rewritten with aof-use-rdb-preamble start with an RDB payload
+     * we are not able to parse: refuse to check (and truncate) them. */
+    // 带有 RDB 前导的 AOF 文件无法检查
+    char sig[5];
+    if (fread(sig,1,5,fp) == 5 && memcmp(sig,"REDIS",5) == 0) {
+        printf("The AOF starts with an RDB preamble, that can't be checked: %s\n", filename);
+        exit(1);
+    }
+    rewind(fp);
+
     // 如果文件出错，那么这个偏移量指向：
     // 1） 第一个不符合格式的位置
     // 2） 第一个没有 EXEC 对应的 MULTI 的位置
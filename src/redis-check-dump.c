@@ -39,8 +39,17 @@
 #include <arpa/inet.h>
 #include <stdint.h>
 #include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include "lzf.h"
 #include "crc64.h"
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 /* Object types */
 #define REDIS_STRING 0
@@ -53,6 +62,12 @@
 #define REDIS_SET_INTSET 11
 #define REDIS_ZSET_ZIPLIST 12
 #define REDIS_HASH_ZIPLIST 13
+#define REDIS_LIST_QUICKLIST 14
+#define REDIS_STREAM_ZIPLISTS 15
+#define REDIS_HASH_LISTPACK 16
+#define REDIS_ZSET_LISTPACK 17
+#define REDIS_LIST_QUICKLIST_2 18
+#define REDIS_ZSET_2 20
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
@@ -63,6 +78,8 @@
 #define REDIS_ENCODING_HT 3     /* Encoded as a hash table */
 
 /* Object types only used for dumping to disk */
+#define REDIS_FUNCTION 246
+#define REDIS_AUX 250
 #define REDIS_EXPIRETIME_MS 252
 #define REDIS_EXPIRETIME 253
 #define REDIS_SELECTDB 254
@@ -94,6 +111,8 @@
 #define REDIS_RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define REDIS_RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define REDIS_RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define REDIS_RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define REDIS_RDB_ENC_ZSTD 5        /* string compressed with zstd */
 
 #define ERROR(...) { \
     printf(__VA_ARGS__); \
@@ -107,8 +126,10 @@ typedef struct {
     size_t offset;
 } pos;
 
-static unsigned char level = 0;
-static pos positions[16];
+/* The parser state is per thread, so that --analyze can run one parser
+ * for every chunk of the file. */
+static __thread unsigned char level = 0;
+static __thread pos positions[16];
 
 #define CURR_OFFSET (positions[level].offset)
 
@@ -118,12 +139,18 @@ typedef struct {
     size_t offset[16];
     size_t level;
 } errors_t;
-static errors_t errors;
+static __thread errors_t errors;
+
+/* --analyze never prints the error stack, and formatting it would be most
+ * of the cost of looking for entry boundaries. */
+static int record_errors = 1;
 
 #define SHIFT_ERROR(provided_offset, ...) { \
-    sprintf(errors.error[errors.level], __VA_ARGS__); \
-    errors.offset[errors.level] = provided_offset; \
-    errors.level++; \
+    if (record_errors) { \
+        sprintf(errors.error[errors.level], __VA_ARGS__); \
+        errors.offset[errors.level] = provided_offset; \
+        errors.level++; \
+    } \
 }
 
 /* Data type to hold opcode with optional key name an success status */
@@ -131,6 +158,7 @@ typedef struct {
     char* key;
     int type;
     char success;
+    long long expire;   /* Unix time in milliseconds, -1 if none */
 } entry;
 
 /* Global vars that are actually used as constants. The following double
@@ -141,13 +169,20 @@ static double R_Zero, R_PosInf, R_NegInf, R_Nan;
 /* store string types for output */
 static char types[256][16];
 
+/* When set, string values are skipped without being allocated or
+ * decompressed. Used by --analyze, that only needs the entry sizes. */
+static int skip_values = 0;
+
 /* Return true if 't' is a valid object type. */
 int checkType(unsigned char t) {
     /* In case a new object type is added, update the following 
      * condition as necessary. */
     return
-        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_HASH_ZIPLIST) ||
+        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_LIST_QUICKLIST_2) ||
+        t == REDIS_ZSET_2 ||
         t <= REDIS_HASH ||
+        t == REDIS_FUNCTION ||
+        t == REDIS_AUX ||
         t >= REDIS_EXPIRETIME_MS;
 }
 
@@ -180,7 +215,7 @@ int processHeader() {
     }
 
     dump_version = (int)strtol(buf + 5, NULL, 10);
-    if (dump_version < 1 || dump_version > 6) {
+    if (dump_version < 1 || dump_version > 9) {
         ERROR("Unknown RDB format version: %d\n", dump_version);
     }
     return dump_version;
@@ -213,13 +248,24 @@ int peekType() {
     return -1;
 }
 
-/* discard time, just consume the bytes */
-int processTime(int type) {
+/* consume the time, storing it in milliseconds in 'expire' */
+int processTime(int type, long long *expire) {
     uint32_t offset = CURR_OFFSET;
     unsigned char t[8];
     int timelen = (type == REDIS_EXPIRETIME_MS) ? 8 : 4;
 
     if (readBytes(t,timelen)) {
+        /* Times are saved in host byte order, like rdbLoadTime() reads
+         * them. */
+        if (type == REDIS_EXPIRETIME_MS) {
+            int64_t t64;
+            memcpy(&t64,t,8);
+            *expire = t64;
+        } else {
+            int32_t t32;
+            memcpy(&t32,t,4);
+            *expire = (long long)t32*1000;
+        }
         return 1;
     } else {
         SHIFT_ERROR(offset, "Could not read time");
@@ -287,13 +333,15 @@ char *loadIntegerObject(int enctype) {
     return buf;
 }
 
-char* loadLzfStringObject() {
+char* loadCompressedStringObject(int enc) {
     unsigned int slen, clen;
     char *c, *s;
 
     if ((clen = loadLength(NULL)) == REDIS_RDB_LENERR) return NULL;
     if ((slen = loadLength(NULL)) == REDIS_RDB_LENERR) return NULL;
 
+    /* Don't allocate garbage lengths, common while resyncing. */
+    if (CURR_OFFSET + clen > positions[level].size) return NULL;
     c = malloc(clen);
     if (!readBytes(c, clen)) {
         free(c);
@@ -301,13 +349,31 @@ char* loadLzfStringObject() {
     }
 
     s = malloc(slen+1);
-    if (lzf_decompress(c,clen,s,slen) == 0) {
-        free(c); free(s);
-        return NULL;
+    switch(enc) {
+    case REDIS_RDB_ENC_LZF:
+        if (lzf_decompress(c,clen,s,slen) == 0) goto err;
+        break;
+#ifdef USE_LZ4
+    case REDIS_RDB_ENC_LZ4:
+        if (LZ4_decompress_safe(c,s,clen,slen) != (int)slen) goto err;
+        break;
+#endif
+#ifdef USE_ZSTD
+    case REDIS_RDB_ENC_ZSTD:
+        if (ZSTD_decompress(s,slen,c,clen) != slen) goto err;
+        break;
+#endif
+    default:
+        goto err;
     }
+    s[slen] = '\0';
 
     free(c);
     return s;
+
+err:
+    free(c); free(s);
+    return NULL;
 }
 
 /* returns NULL when not processable, char* when valid */
@@ -324,7 +390,9 @@ char* loadStringObject() {
         case REDIS_RDB_ENC_INT32:
             return loadIntegerObject(len);
         case REDIS_RDB_ENC_LZF:
-            return loadLzfStringObject();
+        case REDIS_RDB_ENC_LZ4:
+        case REDIS_RDB_ENC_ZSTD:
+            return loadCompressedStringObject(len);
         default:
             /* unknown encoding */
             SHIFT_ERROR(offset, "Unknown string encoding (0x%02x)", len);
@@ -333,6 +401,7 @@ char* loadStringObject() {
     }
 
     if (len == REDIS_RDB_LENERR) return NULL;
+    if (CURR_OFFSET + len > positions[level].size) return NULL;
 
     char *buf = malloc(sizeof(char) * (len+1));
     buf[len] = '\0';
@@ -343,8 +412,73 @@ char* loadStringObject() {
     return buf;
 }
 
+/* Consume a string object without loading it. Returns 0 on short read. */
+int skipStringObject() {
+    pos *p = &positions[level];
+    int isencoded;
+    uint32_t len, clen;
+    size_t skip;
+
+    len = loadLength(&isencoded);
+    if (len == REDIS_RDB_LENERR) return 0;
+    if (isencoded) {
+        switch(len) {
+        case REDIS_RDB_ENC_INT8: skip = 1; break;
+        case REDIS_RDB_ENC_INT16: skip = 2; break;
+        case REDIS_RDB_ENC_INT32: skip = 4; break;
+        case REDIS_RDB_ENC_LZF:
+        case REDIS_RDB_ENC_LZ4:
+        case REDIS_RDB_ENC_ZSTD:
+            /* Compressed length, then uncompressed length. */
+            if ((clen = loadLength(NULL)) == REDIS_RDB_LENERR) return 0;
+            if (loadLength(NULL) == REDIS_RDB_LENERR) return 0;
+            skip = clen;
+            break;
+        default:
+            return 0;
+        }
+    } else {
+        skip = len;
+    }
+
+    if (p->offset + skip > p->size) return 0;
+    p->offset += skip;
+    return 1;
+}
+
+/* Like loadStringObject() but plain strings are truncated to
+ * MAX_KEYNAME_LEN bytes: enough to report a key, and cheap when the length
+ * is garbage because we are looking for an entry boundary. */
+#define MAX_KEYNAME_LEN 1024
+char *loadKeyName() {
+    size_t offset = CURR_OFFSET;
+    int isencoded;
+    uint32_t len;
+    char *buf;
+
+    len = loadLength(&isencoded);
+    if (len == REDIS_RDB_LENERR) return NULL;
+    if (isencoded) {
+        CURR_OFFSET = offset;
+        return loadStringObject();
+    }
+    if (CURR_OFFSET + len > positions[level].size) return NULL;
+    if (len > MAX_KEYNAME_LEN) len = MAX_KEYNAME_LEN;
+    buf = malloc(len+1);
+    memcpy(buf,(char*)positions[level].data + CURR_OFFSET,len);
+    buf[len] = '\0';
+    return buf;
+}
+
 int processStringObject(char** store) {
     unsigned long offset = CURR_OFFSET;
+
+    if (store == NULL && skip_values) {
+        if (skipStringObject()) return 1;
+        SHIFT_ERROR(offset, "Error reading string object");
+        return 0;
+    }
+
     char *key = loadStringObject();
     if (key == NULL) {
         SHIFT_ERROR(offset, "Error reading string object");
@@ -404,9 +538,16 @@ int loadPair(entry *e) {
     uint32_t offset = CURR_OFFSET;
     uint32_t i;
 
-    /* read key first */
+    /* read key first. When skipping values the key is only loaded once
+     * the whole entry parsed, not to copy garbage while resyncing. */
     char *key;
-    if (processStringObject(&key)) {
+    size_t keyoffset = CURR_OFFSET;
+    if (skip_values) {
+        if (!skipStringObject()) {
+            SHIFT_ERROR(offset, "Error reading entry key");
+            return 0;
+        }
+    } else if (processStringObject(&key)) {
         e->key = key;
     } else {
         SHIFT_ERROR(offset, "Error reading entry key");
@@ -415,13 +556,23 @@ int loadPair(entry *e) {
 
     uint32_t length = 0;
     if (e->type == REDIS_LIST ||
+        e->type == REDIS_LIST_QUICKLIST ||
+        e->type == REDIS_LIST_QUICKLIST_2 ||
+        e->type == REDIS_STREAM_ZIPLISTS ||
         e->type == REDIS_SET  ||
         e->type == REDIS_ZSET ||
+        e->type == REDIS_ZSET_2 ||
         e->type == REDIS_HASH) {
         if ((length = loadLength(NULL)) == REDIS_RDB_LENERR) {
             SHIFT_ERROR(offset, "Error reading %s length", types[e->type]);
             return 0;
         }
+        /* Every element takes at least one byte. */
+        if (length > positions[level].size - CURR_OFFSET) {
+            SHIFT_ERROR(offset, "Invalid %s length (%u)", types[e->type],
+                length);
+            return 0;
+        }
     }
 
     switch(e->type) {
@@ -431,12 +582,16 @@ int loadPair(entry *e) {
     case REDIS_SET_INTSET:
     case REDIS_ZSET_ZIPLIST:
     case REDIS_HASH_ZIPLIST:
+    case REDIS_HASH_LISTPACK:
+    case REDIS_ZSET_LISTPACK:
         if (!processStringObject(NULL)) {
             SHIFT_ERROR(offset, "Error reading entry value");
             return 0;
         }
     break;
     case REDIS_LIST:
+    case REDIS_LIST_QUICKLIST:
+    case REDIS_LIST_QUICKLIST_2:
     case REDIS_SET:
         for (i = 0; i < length; i++) {
             offset = CURR_OFFSET;
@@ -446,7 +601,23 @@ int loadPair(entry *e) {
             }
         }
     break;
+    case REDIS_STREAM_ZIPLISTS:
+        /* Master ID and ziplist of every node, then the last ID. */
+        for (i = 0; i < length*2; i++) {
+            offset = CURR_OFFSET;
+            if (!processStringObject(NULL)) {
+                SHIFT_ERROR(offset, "Error reading stream node at index %d (length: %d)", i/2, length);
+                return 0;
+            }
+        }
+        offset = CURR_OFFSET;
+        if (!processStringObject(NULL)) {
+            SHIFT_ERROR(offset, "Error reading stream last ID");
+            return 0;
+        }
+    break;
     case REDIS_ZSET:
+    case REDIS_ZSET_2:
         for (i = 0; i < length; i++) {
             offset = CURR_OFFSET;
             if (!processStringObject(NULL)) {
@@ -454,7 +625,13 @@ int loadPair(entry *e) {
                 return 0;
             }
             offset = CURR_OFFSET;
-            if (!processDoubleValue(NULL)) {
+            if (e->type == REDIS_ZSET_2) {
+                double score;
+                if (!readBytes(&score, sizeof(score))) {
+                    SHIFT_ERROR(offset, "Error reading element value at index %d (length: %d)", i, length);
+                    return 0;
+                }
+            } else if (!processDoubleValue(NULL)) {
                 SHIFT_ERROR(offset, "Error reading element value at index %d (length: %d)", i, length);
                 return 0;
             }
@@ -478,13 +655,25 @@ int loadPair(entry *e) {
         SHIFT_ERROR(offset, "Type not implemented");
         return 0;
     }
+    if (skip_values) {
+        size_t end = CURR_OFFSET;
+
+        CURR_OFFSET = keyoffset;
+        e->key = loadKeyName();
+        CURR_OFFSET = end;
+        if (e->key == NULL) {
+            SHIFT_ERROR(offset, "Error reading entry key");
+            return 0;
+        }
+    }
+
     /* because we're done, we assume success */
     e->success = 1;
     return 1;
 }
 
 entry loadEntry() {
-    entry e = { NULL, -1, 0 };
+    entry e = { NULL, -1, 0, -1 };
     uint32_t length, offset[4];
 
     /* reset error container */
@@ -505,6 +694,12 @@ entry loadEntry() {
             SHIFT_ERROR(offset[1], "Database number out of range (%d)", length);
             return e;
         }
+    } else if (e.type == REDIS_AUX || e.type == REDIS_FUNCTION) {
+        /* AUX: field and value. FUNCTION: name and body. */
+        if (!processStringObject(NULL) || !processStringObject(NULL)) {
+            SHIFT_ERROR(offset[1], "Error reading %s", types[e.type]);
+            return e;
+        }
     } else if (e.type == REDIS_EOF) {
         if (positions[level].offset < positions[level].size) {
             SHIFT_ERROR(offset[0], "Unexpected EOF");
@@ -516,7 +711,7 @@ entry loadEntry() {
         /* optionally consume expire */
         if (e.type == REDIS_EXPIRETIME || 
             e.type == REDIS_EXPIRETIME_MS) {
-            if (!processTime(e.type)) return e;
+            if (!processTime(e.type,&e.expire)) return e;
             if (!loadType(&e)) return e;
         }
 
@@ -705,24 +900,707 @@ void process() {
     }
 }
 
-int main(int argc, char **argv) {
-    /* expect the first argument to be the dump file */
-    if (argc <= 1) {
-        printf("Usage: %s <dump.rdb>\n", argv[0]);
-        exit(0);
+/*------------------------------------------------------------------------------
+ * Analyzer (--analyze)
+ *
+ * Reports where the space of a dump goes: by key prefix, by type, by
+ * encoding, by TTL, plus the largest keys. The size of a key is the number
+ * of bytes its entry takes in the RDB file, that is a good proxy of its
+ * relative memory usage and is known without loading the value.
+ *
+ * The file is split in one chunk per thread, and every thread parses the
+ * entries starting inside its chunk. Since an RDB has no index, every
+ * thread but the first looks for the first offset of its chunk where a few
+ * consecutive entries parse correctly, the same way the checker resyncs
+ * after a corruption. A false sync point, for instance inside a set whose
+ * members look like entries, is detected by the previous thread not
+ * stopping exactly there. The first entries of every chunk are held back
+ * for this reason: when the sync point is wrong the chunk is parsed again
+ * from where the previous thread really stopped, usually just until the
+ * two parses meet at a common entry, and the held entries after that point
+ * are accounted as usual.
+ *--------------------------------------------------------------------------- */
+
+#define ANALYZE_MAX_THREADS 64
+#define ANALYZE_MIN_CHUNK (1024*1024)   /* Don't split files in tinier chunks */
+#define ANALYZE_SYNC_ENTRIES 3          /* Valid entries needed to resync */
+#define ANALYZE_PENDING 1024            /* Entries held until a chunk is synced */
+#define ANALYZE_DEFAULT_TOP 20
+#define ANALYZE_MAX_PREFIXES 100000     /* Per thread, the rest is "(other)" */
+#define ANALYZE_TTL_BUCKETS 7
+
+static const char *ttlBucketName[ANALYZE_TTL_BUCKETS] = {
+    "no ttl", "expired", "< 1 hour", "< 1 day", "< 7 days", "< 30 days",
+    ">= 30 days"
+};
+
+typedef struct prefixStat {
+    char *prefix;       /* NULL for empty slots */
+    uint64_t hash;
+    uint64_t keys;
+    uint64_t bytes;
+} prefixStat;
+
+/* Open addressing hash table of prefixes. */
+typedef struct prefixTable {
+    prefixStat *table;
+    size_t size;        /* Power of two */
+    size_t used;
+    uint64_t other_keys, other_bytes;
+} prefixTable;
+
+typedef struct bigKey {
+    char *key;          /* NULL for empty slots */
+    int type;
+    uint64_t bytes;
+} bigKey;
+
+typedef struct analyzeStats {
+    uint64_t keys, bytes;
+    uint64_t type_keys[256], type_bytes[256];   /* By RDB type (encoding) */
+    uint64_t ttl_keys[ANALYZE_TTL_BUCKETS], ttl_bytes[ANALYZE_TTL_BUCKETS];
+    uint64_t errors, skipped;
+    bigKey *top;        /* Sorted by descending size */
+    prefixTable prefixes;
+} analyzeStats;
+
+/* An entry parsed while the chunk sync point is not confirmed yet. */
+typedef struct pendingEntry {
+    size_t offset;      /* Where the entry starts */
+    char *key;          /* NULL for entries that are not keys */
+    int type;
+    long long expire;
+    uint64_t bytes;
+} pendingEntry;
+
+typedef struct analyzeJob {
+    pthread_t thread;
+    size_t start;       /* Chunk start, first entry of the chunk once synced */
+    size_t stop;        /* Start of the next chunk */
+    size_t end;         /* Where parsing really stopped */
+    int sync;           /* Look for an entry boundary starting at 'start' */
+    analyzeStats stats;
+    pendingEntry *pending;  /* NULL if the chunk start is known to be right */
+    int pending_len;
+    size_t pending_end; /* Offset after the last pending entry */
+} analyzeJob;
+
+static struct {
+    void *data;
+    size_t size;        /* File size minus the checksum */
+    size_t header;      /* Offset of the first entry */
+    int threads;
+    int top;
+    char separator;
+    long long now;
+} analyze;
+
+static long long analyzeMstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000 + tv.tv_usec/1000;
+}
+
+/* FNV-1a, good enough for short key prefixes. */
+static uint64_t prefixHash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
     }
+    return h;
+}
 
-    int fd;
+/* Return the slot of the prefix, or the empty slot where it should go. */
+static prefixStat *prefixFind(prefixTable *pt, const char *prefix,
+                              size_t len, uint64_t hash)
+{
+    size_t idx = hash & (pt->size-1);
+
+    while (pt->table[idx].prefix) {
+        prefixStat *ps = &pt->table[idx];
+        if (ps->hash == hash && strlen(ps->prefix) == len &&
+            memcmp(ps->prefix,prefix,len) == 0) return ps;
+        idx = (idx+1) & (pt->size-1);
+    }
+    return &pt->table[idx];
+}
+
+static void prefixTableInit(prefixTable *pt) {
+    pt->size = 1024;
+    pt->used = 0;
+    pt->table = calloc(pt->size, sizeof(prefixStat));
+    pt->other_keys = pt->other_bytes = 0;
+}
+
+static void prefixTableExpand(prefixTable *pt) {
+    prefixStat *old = pt->table;
+    size_t oldsize = pt->size, j;
+
+    pt->size *= 2;
+    pt->table = calloc(pt->size, sizeof(prefixStat));
+    for (j = 0; j < oldsize; j++) {
+        if (old[j].prefix == NULL) continue;
+        *prefixFind(pt,old[j].prefix,strlen(old[j].prefix),old[j].hash) =
+            old[j];
+    }
+    free(old);
+}
+
+static void prefixTableAdd(prefixTable *pt, const char *prefix, size_t len,
+                           uint64_t keys, uint64_t bytes)
+{
+    uint64_t hash = prefixHash(prefix,len);
+    prefixStat *ps = prefixFind(pt,prefix,len,hash);
+
+    if (ps->prefix == NULL) {
+        if (pt->used >= ANALYZE_MAX_PREFIXES) {
+            pt->other_keys += keys;
+            pt->other_bytes += bytes;
+            return;
+        }
+        ps->prefix = malloc(len+1);
+        memcpy(ps->prefix,prefix,len);
+        ps->prefix[len] = '\0';
+        ps->hash = hash;
+        ps->keys = ps->bytes = 0;
+        pt->used++;
+    }
+    ps->keys += keys;
+    ps->bytes += bytes;
+
+    // 负载因子超过 1/2 时扩容
+    if (pt->used*2 > pt->size) prefixTableExpand(pt);
+}
+
+static void prefixTableFree(prefixTable *pt) {
+    size_t j;
+
+    for (j = 0; j < pt->size; j++) free(pt->table[j].prefix);
+    free(pt->table);
+    pt->table = NULL;
+}
+
+static void statsInit(analyzeStats *st) {
+    memset(st,0,sizeof(*st));
+    st->top = calloc(analyze.top, sizeof(bigKey));
+    prefixTableInit(&st->prefixes);
+}
+
+static void statsFree(analyzeStats *st) {
+    int j;
+
+    for (j = 0; j < analyze.top; j++) free(st->top[j].key);
+    free(st->top);
+    prefixTableFree(&st->prefixes);
+}
+
+/* Keep the key if it is one of the 'analyze.top' biggest seen so far.
+ * The key is copied when 'copy' is true, otherwise it is taken over. */
+static void statsAddBigKey(analyzeStats *st, char *key, int type,
+                           uint64_t bytes, int copy)
+{
+    bigKey *top = st->top;
+    int n = analyze.top, i, j;
+
+    if (top[n-1].key && top[n-1].bytes >= bytes) {
+        if (!copy) free(key);
+        return;
+    }
+    for (i = 0; i < n; i++)
+        if (top[i].key == NULL || top[i].bytes < bytes) break;
+
+    if (copy) {
+        size_t len = strlen(key);
+        char *dup = malloc(len+1);
+        memcpy(dup,key,len+1);
+        key = dup;
+    }
+    free(top[n-1].key);
+    for (j = n-1; j > i; j--) top[j] = top[j-1];
+    top[i].key = key;
+    top[i].type = type;
+    top[i].bytes = bytes;
+}
+
+static int ttlBucket(long long expire) {
+    long long ttl;
+
+    if (expire == -1) return 0;
+    ttl = expire - analyze.now;
+    if (ttl <= 0) return 1;
+    if (ttl < 3600LL*1000) return 2;
+    if (ttl < 86400LL*1000) return 3;
+    if (ttl < 7*86400LL*1000) return 4;
+    if (ttl < 30*86400LL*1000) return 5;
+    return 6;
+}
+
+/* Account a key. The stats take over the key string. */
+static void statsAddKey(analyzeStats *st, char *key, int type,
+                        long long expire, uint64_t bytes)
+{
+    int bucket = ttlBucket(expire);
+    char *sep;
+
+    st->keys++;
+    st->bytes += bytes;
+    st->type_keys[type]++;
+    st->type_bytes[type] += bytes;
+    st->ttl_keys[bucket]++;
+    st->ttl_bytes[bucket] += bytes;
+
+    if ((sep = strchr(key,analyze.separator)) != NULL)
+        prefixTableAdd(&st->prefixes,key,sep-key,1,bytes);
+    else
+        prefixTableAdd(&st->prefixes,"(none)",6,1,bytes);
+    statsAddBigKey(st,key,type,bytes,0);
+}
+
+/* Starting at the current offset, find the first offset where
+ * ANALYZE_SYNC_ENTRIES consecutive entries parse, and move there.
+ * Returns 0 if none is found before 'limit'. */
+static int analyzeResync(size_t limit) {
+    size_t offset = positions[0].offset;
+    entry e;
+    int i;
+
+    while (offset < limit) {
+        positions[1] = positions[0];
+        positions[1].offset = offset;
+        for (i = 0; i < ANALYZE_SYNC_ENTRIES; i++) {
+            e = loadEntry();
+            free(e.key);
+            if (!e.success) break;
+            if (e.type == REDIS_EOF) {
+                i = ANALYZE_SYNC_ENTRIES;
+                break;
+            }
+        }
+        if (i == ANALYZE_SYNC_ENTRIES) {
+            positions[0].offset = offset;
+            return 1;
+        }
+        offset++;
+    }
+    positions[0].offset = limit;
+    return 0;
+}
+
+/* Corrupted region: move to the next valid entry, returning the number of
+ * bytes skipped. */
+static size_t analyzeSkipCorruption(void) {
+    size_t offset = positions[0].offset;
+
+    positions[0].offset++;
+    analyzeResync(analyze.size);
+    return positions[0].offset - offset;
+}
+
+/* Hold an entry, or an unparsable region if 'key' is NULL and 'type' is
+ * -1, until the chunk sync point is confirmed. */
+static void analyzeAddPending(analyzeJob *job, size_t offset, char *key,
+                              int type, long long expire, uint64_t bytes)
+{
+    pendingEntry *pe = &job->pending[job->pending_len++];
+
+    pe->offset = offset;
+    pe->key = key;
+    pe->type = type;
+    pe->expire = expire;
+    pe->bytes = bytes;
+    job->pending_end = offset + bytes;
+}
+
+/* Parse entries from the current offset until the start of the next chunk.
+ * While 'job->pending' has room the entries are stored there instead of
+ * being accounted. */
+static void analyzeParse(analyzeJob *job) {
+    analyzeStats *st = &job->stats;
+    entry e;
+
+    while (positions[0].offset < job->stop) {
+        uint64_t bytes;
+
+        positions[1] = positions[0];
+        e = loadEntry();
+        if (!e.success) {
+            size_t offset = positions[0].offset;
+
+            free(e.key);
+            bytes = analyzeSkipCorruption();
+            if (job->pending && job->pending_len < ANALYZE_PENDING) {
+                analyzeAddPending(job,offset,NULL,-1,-1,bytes);
+            } else {
+                st->errors++;
+                st->skipped += bytes;
+            }
+            continue;
+        }
+
+        bytes = positions[1].offset - positions[0].offset;
+        if (job->pending && job->pending_len < ANALYZE_PENDING) {
+            analyzeAddPending(job,positions[0].offset,e.key,e.type,e.expire,
+                bytes);
+        } else if (e.key) {
+            statsAddKey(st,e.key,e.type,e.expire,bytes);
+        }
+        positions[0] = positions[1];
+        if (e.type == REDIS_EOF) break;
+    }
+    job->end = positions[0].offset;
+}
+
+static void analyzeSetupParser(size_t offset) {
+    positions[0].data = analyze.data;
+    positions[0].size = analyze.size;
+    positions[0].offset = offset;
+    level = 1;
+}
+
+static void *analyzeRange(void *arg) {
+    analyzeJob *job = arg;
+
+    analyzeSetupParser(job->start);
+    if (job->sync) {
+        analyzeResync(job->stop);
+        job->start = positions[0].offset;
+    }
+    analyzeParse(job);
+    return NULL;
+}
+
+static void statsMerge(analyzeStats *dst, analyzeStats *src) {
+    size_t j;
+    int i;
+
+    dst->keys += src->keys;
+    dst->bytes += src->bytes;
+    dst->errors += src->errors;
+    dst->skipped += src->skipped;
+    for (i = 0; i < 256; i++) {
+        dst->type_keys[i] += src->type_keys[i];
+        dst->type_bytes[i] += src->type_bytes[i];
+    }
+    for (i = 0; i < ANALYZE_TTL_BUCKETS; i++) {
+        dst->ttl_keys[i] += src->ttl_keys[i];
+        dst->ttl_bytes[i] += src->ttl_bytes[i];
+    }
+    for (i = 0; i < analyze.top && src->top[i].key; i++) {
+        statsAddBigKey(dst,src->top[i].key,src->top[i].type,
+            src->top[i].bytes,1);
+    }
+    for (j = 0; j < src->prefixes.size; j++) {
+        prefixStat *ps = &src->prefixes.table[j];
+        if (ps->prefix == NULL) continue;
+        prefixTableAdd(&dst->prefixes,ps->prefix,strlen(ps->prefix),
+            ps->keys,ps->bytes);
+    }
+    dst->prefixes.other_keys += src->prefixes.other_keys;
+    dst->prefixes.other_bytes += src->prefixes.other_bytes;
+}
+
+/* Account the pending entries starting at the given index. */
+static void analyzeFlushPending(analyzeJob *job, int from) {
+    int j;
+
+    for (j = 0; j < job->pending_len; j++) {
+        pendingEntry *pe = &job->pending[j];
+        if (j >= from && pe->key) {
+            statsAddKey(&job->stats,pe->key,pe->type,pe->expire,pe->bytes);
+        } else {
+            if (j >= from && pe->type == -1) {
+                job->stats.errors++;
+                job->stats.skipped += pe->bytes;
+            }
+            free(pe->key);
+        }
+    }
+    free(job->pending);
+    job->pending = NULL;
+    job->pending_len = 0;
+}
+
+/* The chunk sync point was wrong: parse again from 'offset', the real end
+ * of the previous chunk, until an entry boundary is shared with the first
+ * parse. If none is found the rest of the chunk is parsed again. */
+static void analyzeRepair(analyzeJob *job, size_t offset) {
+    analyzeStats fixed;
+    int k = 0, met = 0;
+    entry e;
+
+    statsInit(&fixed);
+    analyzeSetupParser(offset);
+    job->start = offset;
+    while (positions[0].offset < job->stop) {
+        size_t cur = positions[0].offset;
+
+        while (k < job->pending_len && job->pending[k].offset < cur) k++;
+        if ((k < job->pending_len && job->pending[k].offset == cur) ||
+            (job->pending_len == ANALYZE_PENDING && cur == job->pending_end))
+        {
+            met = 1;
+            break;
+        }
+        if (k == job->pending_len && cur > job->pending_end) break;
+
+        positions[1] = positions[0];
+        e = loadEntry();
+        if (!e.success) {
+            free(e.key);
+            fixed.errors++;
+            fixed.skipped += analyzeSkipCorruption();
+            continue;
+        }
+        if (e.key) {
+            statsAddKey(&fixed,e.key,e.type,e.expire,
+                positions[1].offset - cur);
+        }
+        positions[0] = positions[1];
+        if (e.type == REDIS_EOF) break;
+    }
+
+    if (met) {
+        /* From here on the first parse was right. */
+        statsMerge(&job->stats,&fixed);
+        statsFree(&fixed);
+        analyzeFlushPending(job,k);
+    } else {
+        analyzeFlushPending(job,job->pending_len);
+        statsFree(&job->stats);
+        job->stats = fixed;
+        analyzeParse(job);
+    }
+}
+
+/* Map an RDB type, that also tells the encoding, to the object type. */
+static const char *rdbTypeObjectName(int type) {
+    switch(type) {
+    case REDIS_STRING: return "string";
+    case REDIS_LIST: case REDIS_LIST_ZIPLIST: case REDIS_LIST_QUICKLIST:
+    case REDIS_LIST_QUICKLIST_2: return "list";
+    case REDIS_SET: case REDIS_SET_INTSET: return "set";
+    case REDIS_ZSET: case REDIS_ZSET_ZIPLIST: case REDIS_ZSET_LISTPACK:
+    case REDIS_ZSET_2: return "zset";
+    case REDIS_HASH: case REDIS_HASH_ZIPMAP: case REDIS_HASH_ZIPLIST:
+    case REDIS_HASH_LISTPACK: return "hash";
+    case REDIS_STREAM_ZIPLISTS: return "stream";
+    default: return "unknown";
+    }
+}
+
+static int comparePrefixBytes(const void *a, const void *b) {
+    const prefixStat *pa = a, *pb = b;
+
+    if (pa->bytes == pb->bytes) return 0;
+    return pa->bytes < pb->bytes ? 1 : -1;
+}
+
+static double pctOf(uint64_t part, uint64_t total) {
+    return total ? 100.0*part/total : 0;
+}
+
+static void analyzeReport(analyzeStats *st, long long elapsed) {
+    const char *objtypes[] = {"string","list","set","zset","hash","stream"};
+    prefixStat *sorted;
+    size_t j, n = 0;
+    int i, t;
+
+    printf("Analyzed %llu keys, %llu bytes in %.2f seconds using %d threads\n",
+        (unsigned long long)st->keys, (unsigned long long)st->bytes,
+        (double)elapsed/1000, analyze.threads);
+    if (st->errors) {
+        printf("Skipped %llu unparsable regions (%llu bytes)\n",
+            (unsigned long long)st->errors, (unsigned long long)st->skipped);
+    }
+
+    printCentered(4, 80, "By type");
+    for (i = 0; i < 6; i++) {
+        uint64_t keys = 0, bytes = 0;
+        for (t = 0; t < 256; t++) {
+            if (strcmp(rdbTypeObjectName(t),objtypes[i]) != 0) continue;
+            keys += st->type_keys[t];
+            bytes += st->type_bytes[t];
+        }
+        if (keys == 0) continue;
+        printf("%-20s %12llu keys %16llu bytes (%5.2f%%)\n", objtypes[i],
+            (unsigned long long)keys, (unsigned long long)bytes,
+            pctOf(bytes,st->bytes));
+    }
+
+    printCentered(4, 80, "By encoding");
+    for (t = 0; t < 256; t++) {
+        if (st->type_keys[t] == 0) continue;
+        printf("%-20s %12llu keys %16llu bytes (%5.2f%%)\n", types[t],
+            (unsigned long long)st->type_keys[t],
+            (unsigned long long)st->type_bytes[t],
+            pctOf(st->type_bytes[t],st->bytes));
+    }
+
+    printCentered(4, 80, "By TTL");
+    for (i = 0; i < ANALYZE_TTL_BUCKETS; i++) {
+        printf("%-20s %12llu keys %16llu bytes (%5.2f%%)\n", ttlBucketName[i],
+            (unsigned long long)st->ttl_keys[i],
+            (unsigned long long)st->ttl_bytes[i],
+            pctOf(st->ttl_bytes[i],st->bytes));
+    }
+
+    printCentered(4, 80, "By prefix");
+    sorted = malloc(sizeof(prefixStat)*(st->prefixes.used+1));
+    for (j = 0; j < st->prefixes.size; j++)
+        if (st->prefixes.table[j].prefix) sorted[n++] = st->prefixes.table[j];
+    qsort(sorted,n,sizeof(prefixStat),comparePrefixBytes);
+    for (j = 0; j < n && j < (size_t)analyze.top; j++) {
+        printf("%-20s %12llu keys %16llu bytes (%5.2f%%)\n", sorted[j].prefix,
+            (unsigned long long)sorted[j].keys,
+            (unsigned long long)sorted[j].bytes,
+            pctOf(sorted[j].bytes,st->bytes));
+    }
+    if (n > (size_t)analyze.top)
+        printf("... %llu more prefixes\n", (unsigned long long)(n-analyze.top));
+    if (st->prefixes.other_keys) {
+        printf("%-20s %12llu keys %16llu bytes (%5.2f%%)\n", "(other)",
+            (unsigned long long)st->prefixes.other_keys,
+            (unsigned long long)st->prefixes.other_bytes,
+            pctOf(st->prefixes.other_bytes,st->bytes));
+    }
+    free(sorted);
+
+    printCentered(4, 80, "Largest keys");
+    for (i = 0; i < analyze.top && st->top[i].key; i++) {
+        printf("%16llu bytes  %-16s %s\n",
+            (unsigned long long)st->top[i].bytes, types[st->top[i].type],
+            st->top[i].key);
+    }
+}
+
+void analyzeDump(void *data, size_t size, int threads, int top,
+                 char separator)
+{
+    analyzeJob *jobs;
+    analyzeStats total;
+    long long start = analyzeMstime();
+    int dump_version, i;
+    size_t chunk;
+
+    positions[0].data = data;
+    positions[0].size = size;
+    positions[0].offset = 0;
+    dump_version = processHeader();
+    if (dump_version >= 5) {
+        if (size < 8) ERROR("RDB version >= 5 but no room for checksum.\n");
+        size -= 8;
+    }
+
+    analyze.data = data;
+    analyze.size = size;
+    analyze.header = positions[0].offset;
+    analyze.top = top;
+    analyze.separator = separator;
+    analyze.now = start;
+    skip_values = 1;
+    record_errors = 0;
+
+    /* Use fewer threads on small files. */
+    if ((size_t)threads > size/ANALYZE_MIN_CHUNK)
+        threads = size/ANALYZE_MIN_CHUNK;
+    if (threads < 1) threads = 1;
+    analyze.threads = threads;
+
+    chunk = (size - analyze.header) / threads;
+    jobs = calloc(threads, sizeof(analyzeJob));
+    for (i = 0; i < threads; i++) {
+        jobs[i].start = analyze.header + chunk*i;
+        jobs[i].stop = (i == threads-1) ? size : analyze.header + chunk*(i+1);
+        jobs[i].sync = (i != 0);
+        if (jobs[i].sync)
+            jobs[i].pending = malloc(sizeof(pendingEntry)*ANALYZE_PENDING);
+        statsInit(&jobs[i].stats);
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&jobs[i].thread,NULL,analyzeRange,&jobs[i]) != 0)
+            ERROR("Cannot create thread\n");
+    }
+    for (i = 0; i < threads; i++) pthread_join(jobs[i].thread,NULL);
+
+    /* Every chunk must start exactly where the previous one ended,
+     * otherwise its sync point was not a real entry boundary. */
+    for (i = 1; i < threads; i++) {
+        if (jobs[i].start == jobs[i-1].end)
+            analyzeFlushPending(&jobs[i],0);
+        else
+            analyzeRepair(&jobs[i],jobs[i-1].end);
+    }
+
+    statsInit(&total);
+    for (i = 0; i < threads; i++) {
+        statsMerge(&total,&jobs[i].stats);
+        statsFree(&jobs[i].stats);
+    }
+    free(jobs);
+
+    analyzeReport(&total,analyzeMstime()-start);
+    statsFree(&total);
+}
+
+void usage(char *progname) {
+    printf("Usage: %s [--analyze] [--threads <n>] [--top <n>] "
+           "[--prefix-sep <c>] <dump.rdb>\n\n", progname);
+    printf("Without options the file is checked for corruption.\n");
+    printf("  --analyze          Report the space used by key prefix, type, "
+           "encoding and TTL,\n");
+    printf("                     and the largest keys.\n");
+    printf("  --threads <n>      Parse the file with <n> threads "
+           "(default: number of CPUs).\n");
+    printf("  --top <n>          Number of prefixes and keys reported "
+           "(default: %d).\n", ANALYZE_DEFAULT_TOP);
+    printf("  --prefix-sep <c>   Key prefix separator (default: ':').\n");
+    exit(0);
+}
+
+int main(int argc, char **argv) {
+    int fd, j, analyze_mode = 0, threads, top = ANALYZE_DEFAULT_TOP;
+    char separator = ':', *filename = NULL;
     off_t size;
     struct stat stat;
     void *data;
 
-    fd = open(argv[1], O_RDONLY);
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (j = 1; j < argc; j++) {
+        int lastarg = (j == argc-1);
+
+        if (!strcmp(argv[j],"--analyze")) {
+            analyze_mode = 1;
+        } else if (!strcmp(argv[j],"--threads") && !lastarg) {
+            threads = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--top") && !lastarg) {
+            top = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--prefix-sep") && !lastarg) {
+            separator = argv[++j][0];
+        } else if (lastarg && argv[j][0] != '-') {
+            filename = argv[j];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    /* expect the last argument to be the dump file */
+    if (filename == NULL) usage(argv[0]);
+    if (threads < 1) threads = 1;
+    if (threads > ANALYZE_MAX_THREADS) threads = ANALYZE_MAX_THREADS;
+    if (top < 1) top = 1;
+
+    crc64_init();
+    fd = open(filename, O_RDONLY);
     if (fd < 1) {
-        ERROR("Cannot open file: %s\n", argv[1]);
+        ERROR("Cannot open file: %s\n", filename);
     }
     if (fstat(fd, &stat) == -1) {
-        ERROR("Cannot stat: %s\n", argv[1]);
+        ERROR("Cannot stat: %s\n", filename);
     } else {
         size = stat.st_size;
     }
@@ -733,7 +1611,7 @@ int main(int argc, char **argv) {
 
     data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
     if (data == MAP_FAILED) {
-        ERROR("Cannot mmap: %s\n", argv[1]);
+        ERROR("Cannot mmap: %s\n", filename);
     }
 
     /* Initialize static vars */
@@ -748,8 +1626,22 @@ int main(int argc, char **argv) {
     sprintf(types[REDIS_SET], "SET");
     sprintf(types[REDIS_ZSET], "ZSET");
     sprintf(types[REDIS_HASH], "HASH");
+    sprintf(types[REDIS_HASH_ZIPMAP], "HASH_ZIPMAP");
+    sprintf(types[REDIS_LIST_ZIPLIST], "LIST_ZIPLIST");
+    sprintf(types[REDIS_SET_INTSET], "SET_INTSET");
+    sprintf(types[REDIS_ZSET_ZIPLIST], "ZSET_ZIPLIST");
+    sprintf(types[REDIS_HASH_ZIPLIST], "HASH_ZIPLIST");
+    sprintf(types[REDIS_LIST_QUICKLIST], "LIST_QUICKLIST");
+    sprintf(types[REDIS_STREAM_ZIPLISTS], "STREAM");
+    sprintf(types[REDIS_HASH_LISTPACK], "HASH_LISTPACK");
+    sprintf(types[REDIS_ZSET_LISTPACK], "ZSET_LISTPACK");
+    sprintf(types[REDIS_LIST_QUICKLIST_2], "LIST_QUICKLIST2");
+    sprintf(types[REDIS_ZSET_2], "ZSET_2");
 
     /* Object types only used for dumping to disk */
+    sprintf(types[REDIS_FUNCTION], "FUNCTION");
+    sprintf(types[REDIS_AUX], "AUX");
+    sprintf(types[REDIS_EXPIRETIME_MS], "EXPIRETIME_MS");
     sprintf(types[REDIS_EXPIRETIME], "EXPIRETIME");
     sprintf(types[REDIS_SELECTDB], "SELECTDB");
     sprintf(types[REDIS_EOF], "EOF");
@@ -760,7 +1652,10 @@ int main(int argc, char **argv) {
     R_NegInf = -1.0/R_Zero;
     R_Nan = R_Zero/R_Zero;
 
-    process();
+    if (analyze_mode)
+        analyzeDump(data, size, threads, top, separator);
+    else
+        process();
 
     munmap(data, size);
     close(fd);
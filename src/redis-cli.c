@@ -89,6 +89,10 @@ static struct config {
     char *pattern;
     char *rdb_filename;
     int bigkeys;
+    int memkeys;
+    int memkeys_samples;
+    int hotkeys;
+    long scan_count; /* COUNT hint for the SCAN based modes, 0 = server default */
     int stdinarg; /* get last arg from stdin. (-x option) */
     char *auth;
     int output; /* output mode, see OUTPUT_* defines */
@@ -749,6 +753,15 @@ static int parseOptions(int argc, char **argv) {
             config.pipe_timeout = atoi(argv[++i]);
         } else if (!strcmp(argv[i],"--bigkeys")) {
             config.bigkeys = 1;
+        } else if (!strcmp(argv[i],"--memkeys")) {
+            config.memkeys = 1;
+        } else if (!strcmp(argv[i],"--memkeys-samples") && !lastarg) {
+            config.memkeys = 1;
+            config.memkeys_samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"--hotkeys")) {
+            config.hotkeys = 1;
+        } else if (!strcmp(argv[i],"--scan-count") && !lastarg) {
+            config.scan_count = strtol(argv[++i],NULL,10);
         } else if (!strcmp(argv[i],"--eval") && !lastarg) {
             config.eval = argv[++i];
         } else if (!strcmp(argv[i],"-c")) {
@@ -823,6 +836,13 @@ static void usage() {
 "                     no reply is received within <n> seconds.\n"
 "                     Default timeout: %d. Use 0 to wait forever.\n"
 "  --bigkeys          Sample Redis keys looking for big keys.\n"
+"  --memkeys          Sample Redis keys looking for keys using a lot of memory.\n"
+"  --memkeys-samples <n> Like --memkeys, passing SAMPLES <n> to MEMORY USAGE.\n"
+"                     Default: 0 (the server default). With -i, --memkeys\n"
+"                     and --hotkeys sleep <interval> seconds per SCAN call.\n"
+"  --hotkeys          Sample Redis keys looking for hot keys.\n"
+"                     Only works when maxmemory-policy is *lfu.\n"
+"  --scan-count <n>   COUNT hint passed to SCAN by the key sampling modes.\n"
 "  --scan             List all keys using the SCAN command.\n"
 "  --pattern <pat>    Useful with --scan to specify a SCAN pattern.\n"
 "  --intrinsic-latency <sec> Run a test to measure intrinsic system latency.\n"
@@ -1343,7 +1363,13 @@ static void pipeMode(void) {
 #define TYPE_NONE   5
 
 static redisReply *sendScan(unsigned long long *it) {
-    redisReply *reply = redisCommand(context, "SCAN %llu", *it);
+    redisReply *reply;
+
+    if (config.scan_count > 0)
+        reply = redisCommand(context, "SCAN %llu COUNT %ld",
+            *it, config.scan_count);
+    else
+        reply = redisCommand(context, "SCAN %llu", *it);
 
     /* Handle any error conditions */
     if(reply == NULL) {
@@ -1365,7 +1391,7 @@ static redisReply *sendScan(unsigned long long *it) {
     assert(reply->element[1]->type == REDIS_REPLY_ARRAY);
     
     /* Update iterator */
-    *it = atoi(reply->element[0]->str);
+    *it = strtoull(reply->element[0]->str,NULL,10);
 
     return reply;
 }
@@ -1608,6 +1634,196 @@ static void findBigKeys(void) {
     exit(0);
 }
 
+/*------------------------------------------------------------------------------
+ * Memory / hot keys sampling mode
+ *--------------------------------------------------------------------------- */
+
+#define TOPKEYS_MEMORY 0    /* Rank keys by MEMORY USAGE */
+#define TOPKEYS_FREQ   1    /* Rank keys by OBJECT FREQ (LFU counter) */
+#define TOPKEYS_LEN    16   /* Number of keys we report */
+
+typedef struct topKey {
+    sds name;                   /* NULL if the slot is still empty */
+    unsigned long long value;   /* Bytes or LFU counter */
+} topKey;
+
+/* Insert the key into the top list, that is kept sorted by descending value.
+ * Keys not making it to the list are not copied at all, so the common case
+ * is just one comparison against the smallest entry. */
+static void topKeysAdd(topKey *top, redisReply *key, unsigned long long value) {
+    int i, j;
+
+    if (top[TOPKEYS_LEN-1].name && top[TOPKEYS_LEN-1].value >= value) return;
+
+    for (i = 0; i < TOPKEYS_LEN; i++)
+        if (top[i].name == NULL || top[i].value < value) break;
+
+    // 挤掉最后一名，其余后移一位
+    if (top[TOPKEYS_LEN-1].name) sdsfree(top[TOPKEYS_LEN-1].name);
+    for (j = TOPKEYS_LEN-1; j > i; j--) top[j] = top[j-1];
+    top[i].name = sdsnewlen(key->str,key->len);
+    top[i].value = value;
+}
+
+/* Pipeline MEMORY USAGE or OBJECT FREQ for every key of a SCAN batch,
+ * filling 'values'. Keys deleted in the meantime get a NULL reply and are
+ * flagged in 'missing'. */
+static void getKeyRanks(redisReply *keys, int mode,
+                        unsigned long long *values, int *missing)
+{
+    redisReply *reply;
+    int i;
+
+    for (i = 0; i < keys->elements; i++) {
+        if (mode == TOPKEYS_MEMORY) {
+            if (config.memkeys_samples > 0)
+                redisAppendCommand(context, "MEMORY USAGE %b SAMPLES %d",
+                    keys->element[i]->str, keys->element[i]->len,
+                    config.memkeys_samples);
+            else
+                redisAppendCommand(context, "MEMORY USAGE %b",
+                    keys->element[i]->str, keys->element[i]->len);
+        } else {
+            redisAppendCommand(context, "OBJECT FREQ %b",
+                keys->element[i]->str, keys->element[i]->len);
+        }
+    }
+
+    for (i = 0; i < keys->elements; i++) {
+        if (redisGetReply(context, (void**)&reply) != REDIS_OK) {
+            fprintf(stderr, "Error getting %s for key '%s' (%d: %s)\n",
+                mode == TOPKEYS_MEMORY ? "memory usage" : "frequency",
+                keys->element[i]->str, context->err, context->errstr);
+            exit(1);
+        } else if (reply->type == REDIS_REPLY_ERROR) {
+            /* Typically OBJECT FREQ without an LFU policy: every other key
+             * would fail the same way, so stop here. */
+            fprintf(stderr, "Error: %s\n", reply->str);
+            if (mode == TOPKEYS_FREQ)
+                fprintf(stderr, "Set maxmemory-policy to allkeys-lfu or "
+                                "volatile-lfu to use --hotkeys.\n");
+            exit(1);
+        } else if (reply->type == REDIS_REPLY_INTEGER) {
+            values[i] = reply->integer;
+            missing[i] = 0;
+        } else {
+            values[i] = 0;
+            missing[i] = 1;
+        }
+        freeReplyObject(reply);
+    }
+}
+
+/* --memkeys and --hotkeys: SCAN the whole keyspace and report the keys with
+ * the highest memory usage or access frequency. Every SCAN batch costs the
+ * server a single pipelined round trip; -i inserts a pause after each batch,
+ * and --scan-count controls the batch size, so the scan can be slowed down
+ * enough to run against a busy master. */
+static void findTopKeys(int mode) {
+    unsigned long long sampled = 0, total_keys, it = 0, *values = NULL;
+    unsigned long long totalvalue = 0, typevalue[TYPE_NONE] = {0};
+    unsigned long long counts[TYPE_NONE] = {0};
+    char *typename[] = {"string","list","set","hash","zset"};
+    topKey top[TOPKEYS_LEN];
+    redisReply *reply, *keys;
+    int *types = NULL, *missing = NULL, arrsize = 0, i;
+    double pct;
+
+    memset(top,0,sizeof(top));
+    total_keys = getDbSize();
+
+    if (mode == TOPKEYS_MEMORY) {
+        printf("\n# Scanning the entire keyspace to find the keys using "
+               "most memory.\n");
+    } else {
+        printf("\n# Scanning the entire keyspace to find hot keys as well as\n");
+        printf("# average key access frequency.\n");
+    }
+    printf("# You can use -i 0.1 to sleep 0.1 sec per SCAN command and\n");
+    printf("# --scan-count to change the number of keys per SCAN.\n\n");
+
+    do {
+        pct = total_keys ? 100 * (double)sampled/total_keys : 100;
+
+        reply = sendScan(&it);
+        keys = reply->element[1];
+
+        if (keys->elements > arrsize) {
+            types = zrealloc(types, sizeof(int)*keys->elements);
+            missing = zrealloc(missing, sizeof(int)*keys->elements);
+            values = zrealloc(values,
+                sizeof(unsigned long long)*keys->elements);
+            arrsize = keys->elements;
+        }
+
+        /* The type is only needed for the per type memory break down. */
+        if (mode == TOPKEYS_MEMORY) getKeyTypes(keys, types);
+        getKeyRanks(keys, mode, values, missing);
+
+        for (i = 0; i < keys->elements; i++) {
+            if (missing[i]) continue;
+            if (mode == TOPKEYS_MEMORY) {
+                if (types[i] == TYPE_NONE) continue;
+                typevalue[types[i]] += values[i];
+                counts[types[i]]++;
+            }
+            sampled++;
+            totalvalue += values[i];
+
+            if (top[TOPKEYS_LEN-1].name == NULL ||
+                top[TOPKEYS_LEN-1].value < values[i])
+            {
+                if (top[0].name == NULL || top[0].value < values[i]) {
+                    printf("[%05.2f%%] %s key found so far '%s' with %llu %s\n",
+                        pct, mode == TOPKEYS_MEMORY ? "Biggest" : "Hottest",
+                        keys->element[i]->str, values[i],
+                        mode == TOPKEYS_MEMORY ? "bytes" : "frequency");
+                }
+                topKeysAdd(top, keys->element[i], values[i]);
+            }
+
+            if (sampled % 1000000 == 0)
+                printf("[%05.2f%%] Sampled %llu keys so far\n", pct, sampled);
+        }
+
+        freeReplyObject(reply);
+
+        /* Throttle: pause after every SCAN batch if requested. */
+        if (config.interval && it != 0) usleep(config.interval);
+    } while (it != 0);
+
+    zfree(types);
+    zfree(missing);
+    zfree(values);
+
+    printf("\n-------- summary -------\n\n");
+    printf("Sampled %llu keys in the keyspace!\n", sampled);
+    if (mode == TOPKEYS_MEMORY) {
+        printf("Total sampled memory is %llu bytes (avg %.2f bytes per key)\n\n",
+            totalvalue, sampled ? (double)totalvalue/sampled : 0);
+        for (i = 0; i < TYPE_NONE; i++) {
+            printf("%llu %ss with %llu bytes (%05.2f%% of keys, "
+                   "avg size %.2f)\n",
+                counts[i], typename[i], typevalue[i],
+                sampled ? 100 * (double)counts[i]/sampled : 0,
+                counts[i] ? (double)typevalue[i]/counts[i] : 0);
+        }
+    } else {
+        printf("Average key access frequency is %.2f\n",
+            sampled ? (double)totalvalue/sampled : 0);
+    }
+    printf("\n");
+
+    for (i = 0; i < TOPKEYS_LEN && top[i].name; i++) {
+        printf("%s key '%s' has %llu %s\n",
+            mode == TOPKEYS_MEMORY ? "Big" : "Hot", top[i].name, top[i].value,
+            mode == TOPKEYS_MEMORY ? "bytes" : "frequency");
+        sdsfree(top[i].name);
+    }
+
+    exit(0);
+}
+
 /*------------------------------------------------------------------------------
  * Stats mode
  *--------------------------------------------------------------------------- */
@@ -1901,6 +2117,10 @@ int main(int argc, char **argv) {
     config.pipe_mode = 0;
     config.pipe_timeout = REDIS_CLI_DEFAULT_PIPE_TIMEOUT;
     config.bigkeys = 0;
+    config.memkeys = 0;
+    config.memkeys_samples = 0;
+    config.hotkeys = 0;
+    config.scan_count = 0;
     config.stdinarg = 0;
     config.auth = NULL;
     config.eval = NULL;
@@ -1948,6 +2168,18 @@ int main(int argc, char **argv) {
         findBigKeys();
     }
 
+    /* Find large keys by memory usage */
+    if (config.memkeys) {
+        if (cliConnect(0) == REDIS_ERR) exit(1);
+        findTopKeys(TOPKEYS_MEMORY);
+    }
+
+    /* Find hot keys */
+    if (config.hotkeys) {
+        if (cliConnect(0) == REDIS_ERR) exit(1);
+        findTopKeys(TOPKEYS_FREQ);
+    }
+
     /* Stat mode */
     if (config.stat_mode) {
         if (cliConnect(0) == REDIS_ERR) exit(1);
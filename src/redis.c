@@ -186,6 +186,7 @@ struct redisCommand redisCommandTable[] = {
     {"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"strlen",strlenCommand,2,"r",0,NULL,1,1,1,0,0},
     {"del",delCommand,-2,"w",0,NULL,1,-1,1,0,0},
+    {"unlink",unlinkCommand,-2,"w",0,NULL,1,-1,1,0,0},
     {"exists",existsCommand,2,"r",0,NULL,1,1,1,0,0},
     {"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0},
     {"getbit",getbitCommand,3,"r",0,NULL,1,1,1,0,0},
@@ -200,8 +201,10 @@ struct redisCommand redisCommandTable[] = {
     {"rpushx",rpushxCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"lpushx",lpushxCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"linsert",linsertCommand,5,"wm",0,NULL,1,1,1,0,0},
-    {"rpop",rpopCommand,2,"w",0,NULL,1,1,1,0,0},
-    {"lpop",lpopCommand,2,"w",0,NULL,1,1,1,0,0},
+    {"rpop",rpopCommand,-2,"w",0,NULL,1,1,1,0,0},
+    {"lpop",lpopCommand,-2,"w",0,NULL,1,1,1,0,0},
+    {"lmpop",lmpopCommand,-4,"w",0,lmpopGetKeys,0,0,0,0,0},
+    {"blmpop",blmpopCommand,-5,"ws",0,blmpopGetKeys,0,0,0,0,0},
     {"brpop",brpopCommand,-3,"ws",0,NULL,1,1,1,0,0},
     {"brpoplpush",brpoplpushCommand,4,"wms",0,NULL,1,2,1,0,0},
     {"blpop",blpopCommand,-3,"ws",0,NULL,1,-2,1,0,0},
@@ -217,10 +220,11 @@ struct redisCommand redisCommandTable[] = {
     {"smove",smoveCommand,4,"w",0,NULL,1,2,1,0,0},
     {"sismember",sismemberCommand,3,"r",0,NULL,1,1,1,0,0},
     {"scard",scardCommand,2,"r",0,NULL,1,1,1,0,0},
-    {"spop",spopCommand,2,"wRs",0,NULL,1,1,1,0,0},
+    {"spop",spopCommand,-2,"wRs",0,NULL,1,1,1,0,0},
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
+    {"sintercard",sintercardCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
@@ -235,10 +239,13 @@ struct redisCommand redisCommandTable[] = {
     {"zremrangebylex",zremrangebylexCommand,4,"w",0,NULL,1,1,1,0,0},
     {"zunionstore",zunionstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
     {"zinterstore",zinterstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
+    {"zunion",zunionCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
+    {"zinter",zinterCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
     {"zrange",zrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrangebyscore",zrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrevrangebyscore",zrevrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrangebylex",zrangebylexCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"zrangestore",zrangestoreCommand,-5,"wm",0,NULL,1,2,1,0,0},
     {"zrevrangebylex",zrevrangebylexCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zcount",zcountCommand,4,"r",0,NULL,1,1,1,0,0},
     {"zlexcount",zlexcountCommand,4,"r",0,NULL,1,1,1,0,0},
@@ -262,6 +269,12 @@ struct redisCommand redisCommandTable[] = {
     {"hgetall",hgetallCommand,2,"r",0,NULL,1,1,1,0,0},
     {"hexists",hexistsCommand,3,"r",0,NULL,1,1,1,0,0},
     {"hscan",hscanCommand,-3,"rR",0,NULL,1,1,1,0,0},
+    {"xadd",xaddCommand,-5,"wmR",0,NULL,1,1,1,0,0},
+    {"xrange",xrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"xrevrange",xrevrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"xlen",xlenCommand,2,"r",0,NULL,1,1,1,0,0},
+    {"xread",xreadCommand,-4,"rs",0,xreadGetKeys,0,0,0,0,0},
+    {"xtrim",xtrimCommand,-4,"w",0,NULL,1,1,1,0,0},
     {"incrby",incrbyCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"decrby",decrbyCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"incrbyfloat",incrbyfloatCommand,3,"wm",0,NULL,1,1,1,0,0},
@@ -284,7 +297,7 @@ struct redisCommand redisCommandTable[] = {
     {"ping",pingCommand,1,"rt",0,NULL,0,0,0,0,0},
     {"echo",echoCommand,2,"r",0,NULL,0,0,0,0,0},
     {"save",saveCommand,1,"ars",0,NULL,0,0,0,0,0},
-    {"bgsave",bgsaveCommand,1,"ar",0,NULL,0,0,0,0,0},
+    {"bgsave",bgsaveCommand,-1,"ar",0,NULL,0,0,0,0,0},
     {"bgrewriteaof",bgrewriteaofCommand,1,"ar",0,NULL,0,0,0,0,0},
     {"shutdown",shutdownCommand,-1,"arlt",0,NULL,0,0,0,0,0},
     {"lastsave",lastsaveCommand,1,"rR",0,NULL,0,0,0,0,0},
@@ -295,10 +308,11 @@ struct redisCommand redisCommandTable[] = {
     {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"psync",syncCommand,3,"ars",0,NULL,0,0,0,0,0},
     {"replconf",replconfCommand,-1,"arslt",0,NULL,0,0,0,0,0},
-    {"flushdb",flushdbCommand,1,"w",0,NULL,0,0,0,0,0},
-    {"flushall",flushallCommand,1,"w",0,NULL,0,0,0,0,0},
+    {"flushdb",flushdbCommand,-1,"w",0,NULL,0,0,0,0,0},
+    {"flushall",flushallCommand,-1,"w",0,NULL,0,0,0,0,0},
     {"sort",sortCommand,-2,"wm",0,sortGetKeys,1,1,1,0,0},
     {"info",infoCommand,-1,"rlt",0,NULL,0,0,0,0,0},
+    {"metrics",metricsCommand,-1,"rlt",0,NULL,0,0,0,0,0},
     {"monitor",monitorCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"ttl",ttlCommand,2,"r",0,NULL,1,1,1,0,0},
     {"pttl",pttlCommand,2,"r",0,NULL,1,1,1,0,0},
@@ -311,6 +325,9 @@ struct redisCommand redisCommandTable[] = {
     {"psubscribe",psubscribeCommand,-2,"rpslt",0,NULL,0,0,0,0,0},
     {"punsubscribe",punsubscribeCommand,-1,"rpslt",0,NULL,0,0,0,0,0},
     {"publish",publishCommand,3,"pltr",0,NULL,0,0,0,0,0},
+    {"ssubscribe",ssubscribeCommand,-2,"pslt",0,NULL,1,-1,1,0,0},
+    {"sunsubscribe",sunsubscribeCommand,-1,"pslt",0,NULL,1,-1,1,0,0},
+    {"spublish",spublishCommand,3,"pltr",0,NULL,1,1,1,0,0},
     {"pubsub",pubsubCommand,-2,"pltrR",0,NULL,0,0,0,0,0},
     {"watch",watchCommand,-2,"rs",0,NULL,1,-1,1,0,0},
     {"unwatch",unwatchCommand,1,"rs",0,NULL,0,0,0,0,0},
@@ -323,24 +340,41 @@ struct redisCommand redisCommandTable[] = {
     {"readwrite",readwriteCommand,1,"r",0,NULL,0,0,0,0,0},
     {"dump",dumpCommand,2,"ar",0,NULL,1,1,1,0,0},
     {"object",objectCommand,-2,"r",0,NULL,2,2,2,0,0},
+    {"memory",memoryCommand,-2,"r",0,memoryGetKeys,0,0,0,0,0},
     {"client",clientCommand,-2,"ar",0,NULL,0,0,0,0,0},
+    {"hello",helloCommand,-1,"rslt",0,NULL,0,0,0,0,0},
     {"eval",evalCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
     {"evalsha",evalShaCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
     {"slowlog",slowlogCommand,-2,"r",0,NULL,0,0,0,0,0},
+    {"latency",latencyCommand,-2,"arslt",0,NULL,0,0,0,0,0},
+    {"hotkeys",hotkeysCommand,-2,"arslt",0,NULL,0,0,0,0,0},
     {"script",scriptCommand,-2,"ras",0,NULL,0,0,0,0,0},
+    {"function",functionCommand,-2,"ras",0,NULL,0,0,0,0,0},
+    {"fcall",fcallCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
+    {"module",moduleCommand,-2,"as",0,NULL,0,0,0,0,0},
     {"time",timeCommand,1,"rR",0,NULL,0,0,0,0,0},
     {"bitop",bitopCommand,-4,"wm",0,NULL,2,-1,1,0,0},
     {"bitcount",bitcountCommand,-2,"r",0,NULL,1,1,1,0,0},
     {"bitpos",bitposCommand,-3,"r",0,NULL,1,1,1,0,0},
+    {"bitfield",bitfieldCommand,-2,"wm",0,NULL,1,1,1,0,0},
     {"wait",waitCommand,3,"rs",0,NULL,0,0,0,0,0},
+    {"waitoffset",waitoffsetCommand,3,"rs",0,NULL,0,0,0,0,0},
     {"pfselftest",pfselftestCommand,1,"r",0,NULL,0,0,0,0,0},
     {"pfadd",pfaddCommand,-2,"wm",0,NULL,1,1,1,0,0},
     {"pfcount",pfcountCommand,-2,"w",0,NULL,1,1,1,0,0},
     {"pfmerge",pfmergeCommand,-2,"wm",0,NULL,1,-1,1,0,0},
-    {"pfdebug",pfdebugCommand,-3,"w",0,NULL,0,0,0,0,0}
+    {"pfdebug",pfdebugCommand,-3,"w",0,NULL,0,0,0,0,0},
+    {"geoadd",geoaddCommand,-5,"wm",0,NULL,1,1,1,0,0},
+    {"georadius",georadiusCommand,-6,"wm",0,NULL,1,1,1,0,0},
+    {"georadiusbymember",georadiusbymemberCommand,-5,"wm",0,NULL,1,1,1,0,0},
+    {"geosearch",geosearchCommand,-7,"r",0,NULL,1,1,1,0,0},
+    {"geosearchstore",geosearchstoreCommand,-8,"wm",0,NULL,1,2,1,0,0},
+    {"geohash",geohashCommand,-2,"r",0,NULL,1,1,1,0,0},
+    {"geopos",geoposCommand,-2,"r",0,NULL,1,1,1,0,0},
+    {"geodist",geodistCommand,-4,"r",0,NULL,1,1,1,0,0}
 };
 
-struct evictionPoolEntry *evictionPoolAlloc(void);
+void evictionPoolAlloc(void);
 
 /*============================ Utility functions ============================ */
 
@@ -509,6 +543,24 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+void dictLuaFunctionDestructor(void *privdata, void *val)
+{
+    luaFunction *fn = val;
+    DICT_NOTUSED(privdata);
+
+    decrRefCount(fn->body);
+    zfree(fn);
+}
+
+/* Embedded sds keys: the string is stored right after the dictEntry. */
+size_t dictSdsKeyEmbedSize(const void *key) {
+    return sdsInplaceSize(sdslen((const sds)key));
+}
+
+void *dictSdsKeyEmbed(void *buf, const void *key) {
+    return sdsnewinplace(buf,key,sdslen((const sds)key));
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -516,16 +568,16 @@ int dictObjKeyCompare(void *privdata, const void *key1,
     return dictSdsKeyCompare(privdata,o1->ptr,o2->ptr);
 }
 
-unsigned int dictObjHash(const void *key) {
+uint64_t dictObjHash(const void *key) {
     const robj *o = key;
     return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
 }
 
-unsigned int dictSdsHash(const void *key) {
+uint64_t dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
-unsigned int dictSdsCaseHash(const void *key) {
+uint64_t dictSdsCaseHash(const void *key) {
     return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
@@ -549,7 +601,7 @@ int dictEncObjKeyCompare(void *privdata, const void *key1,
     return cmp;
 }
 
-unsigned int dictEncObjHash(const void *key) {
+uint64_t dictEncObjHash(const void *key) {
     robj *o = (robj*) key;
 
     if (sdsEncodedObject(o)) {
@@ -562,7 +614,7 @@ unsigned int dictEncObjHash(const void *key) {
             len = ll2string(buf,32,(long)o->ptr);
             return dictGenHashFunction((unsigned char*)buf, len);
         } else {
-            unsigned int hash;
+            uint64_t hash;
 
             o = getDecodedObject(o);
             hash = dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
@@ -582,24 +634,40 @@ dictType setDictType = {
     NULL                       /* val destructor */
 };
 
-/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
-dictType zsetDictType = {
+/* Like setDictType, but the values are heap allocated and freed with the
+ * dictionary entries, as the stream IDs associated to the keys a client
+ * is blocked for by XREAD. */
+dictType objectKeyHeapPointerValueDictType = {
     dictEncObjHash,            /* hash function */
     NULL,                      /* key dup */
     NULL,                      /* val dup */
     dictEncObjKeyCompare,      /* key compare */
     dictRedisObjectDestructor, /* key destructor */
+    dictVanillaFree            /* val destructor */
+};
+
+/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
+dictType zsetDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    NULL,                      /* key destructor: owned by the skiplist node */
     NULL                       /* val destructor */
 };
 
-/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Db->dict, keys are sds strings, vals are Redis objects. The keys are
+ * embedded in the dict entries: adding a key copies it, and the expires
+ * dict and the cluster slots to keys map reference the embedded copy. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictRedisObjectDestructor   /* val destructor */
+    NULL,                       /* key destructor */
+    dictRedisObjectDestructor,  /* val destructor */
+    dictSdsKeyEmbedSize,        /* key embed size */
+    dictSdsKeyEmbed             /* key embed */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -612,6 +680,38 @@ dictType shaScriptObjectDictType = {
     dictRedisObjectDestructor   /* val destructor */
 };
 
+/* server.lua_functions function name (as sds string) -> luaFunction. */
+dictType functionsDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictLuaFunctionDestructor   /* val destructor */
+};
+
+/* Keys a forkless snapshot already handled, see snapshot.c: sds keys
+ * owned by the dict, no values. */
+dictType snapshotKeysDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Source keys of the PFCOUNT union cache, see hyperloglog.c: sds keys
+ * owned by the dict, the value is a reference count. */
+dictType hllCacheSourcesDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
 /* Db->expires */
 dictType keyptrDictType = {
     dictSdsHash,               /* hash function */
@@ -678,6 +778,16 @@ dictType clusterNodesBlackListDictType = {
 };
 
 /* Migrate cache dict type. */
+/* server.client_usage: sds client names -> zmalloc()ed clientUsage. */
+dictType clientUsageDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictVanillaFree             /* val destructor */
+};
+
 dictType migrateCacheDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -757,10 +867,17 @@ int incrementallyRehash(int dbid) {
  * for dict.c to resize the hash tables accordingly to the fact we have o not
  * running childs. */
 void updateDictResizePolicy(void) {
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
         dictEnableResize();
-    else
+        dictEnableRehash();
+    } else {
         dictDisableResize();
+        /* In fork friendly mode the rehashing in progress is paused too. */
+        if (server.fork_friendly)
+            dictDisableRehash();
+        else
+            dictEnableRehash();
+    }
 }
 
 /* ======================= Cron: called every 100 ms ======================== */
@@ -796,10 +913,14 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
         // 传播过期命令
         propagateExpire(db,keyobj);
         // 从数据库中删除该键
-        dbDelete(db,keyobj);
+        if (server.lazyfree_lazy_expire)
+            dbAsyncDelete(db,keyobj);
+        else
+            dbSyncDelete(db,keyobj);
         // 发送事件
         notifyKeyspaceEvent(REDIS_NOTIFY_EXPIRED,
             "expired",keyobj,db->id);
+        trackingInvalidateKey(keyobj);
         decrRefCount(keyobj);
         // 更新计数器
         server.stat_expiredkeys++;
@@ -811,6 +932,98 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
+/* Helper function for the activeExpireCycle() function, used for the DBs
+ * having an expire index (see active-expire-index).
+ *
+ * Instead of sampling random keys, the keys are expired in the order of
+ * their expire time, starting from the index entry expiring first, until
+ * an entry not yet expired is found: the work done is proportional to the
+ * number of keys that are actually due, whatever the number of volatile
+ * keys of the DB.
+ *
+ * 使用过期键索引，按照过期时间从早到晚删除已经过期的键，
+ * 直到遇到一个未过期的键，或者用完了时间
+ *
+ * The time limit is checked every 16 keys against 'start' and 'timelimit',
+ * as in activeExpireCycle(). Returns 1 if the time limit was reached and
+ * there may be more keys to expire, 0 otherwise. */
+static int activeExpireCycleIndexed(redisDb *db, long long start,
+                                    long long timelimit)
+{
+    long long now = mstime(), ttl_sum = 0;
+    unsigned long checked = 0;
+    int ttl_samples = 0, timedout = 0;
+
+    if (dictSize(db->expires) == 0) {
+        db->avg_ttl = 0;
+        return 0;
+    }
+
+    while (raxSize(db->expires_index)) {
+        char buf[128];
+        unsigned char *name;
+        size_t namelen;
+        long long when;
+        raxIterator ri;
+        dictEntry *de;
+        sds key;
+        int inplace;
+
+        // 索引中的第一个键就是最快过期的键
+        raxStart(&ri,db->expires_index);
+        raxSeek(&ri,"^",NULL,0);
+        raxNext(&ri);
+        when = expireIndexDecodeKey(ri.key,ri.key_len,&name,&namelen);
+
+        /* activeExpireCycleTryExpire() only expires keys with now > when. */
+        if (when >= now) {
+            raxStop(&ri);
+            break;
+        }
+
+        inplace = sdsInplaceSize(namelen) <= sizeof(buf);
+        key = inplace ? sdsnewinplace(buf,name,namelen) :
+                        sdsnewlen(name,namelen);
+
+        /* Deleting the key removes it from the index as well. An entry not
+         * matching the expires dictionary should never happen, but would
+         * make us loop forever, so just drop it. */
+        de = dictFind(db->expires,key);
+        if (de && dictGetSignedIntegerVal(de) == when) {
+            activeExpireCycleTryExpire(db,de,now);
+        } else {
+            raxRemove(db->expires_index,ri.key,ri.key_len,NULL);
+        }
+        if (!inplace) sdsfree(key);
+        raxStop(&ri);
+
+        if ((++checked & 0xf) == 0 && ustime()-start > timelimit) {
+            timedout = 1;
+            break;
+        }
+    }
+
+    /* Update the average TTL stats for this database with a few random
+     * samples, since the index only tells how much the next key will live. */
+    while (ttl_samples < ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4) {
+        dictEntry *de = dictGetRandomKey(db->expires);
+        long long ttl;
+
+        if (de == NULL) break;
+        ttl = dictGetSignedIntegerVal(de)-now;
+        if (ttl < 0) ttl = 0;
+        ttl_sum += ttl;
+        ttl_samples++;
+    }
+    if (ttl_samples) {
+        long long avg_ttl = ttl_sum/ttl_samples;
+
+        if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
+        db->avg_ttl = (db->avg_ttl+avg_ttl)/2;
+    }
+    return timedout;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -929,6 +1142,17 @@ void activeExpireCycle(int type) {
         // 那么下次会直接从下个 DB 开始处理
         current_db++;
 
+        /* With the expire index there is no need to sample keys. */
+        if (db->expires_index) {
+            if (activeExpireCycleIndexed(db,start,timelimit)) {
+                latencyAddSampleIfNeeded("expire-cycle",
+                                         (ustime()-start)/1000);
+                timelimit_exit = 1;
+                return;
+            }
+            continue;
+        }
+
         /* Continue to expire if at the end of the cycle more than 25%
          * of the keys were expired. */
         do {
@@ -1013,13 +1237,14 @@ void activeExpireCycle(int type) {
             iteration++;
 
             // 每遍历 16 次执行一次
-            if ((iteration & 0xf) == 0 && /* check once every 16 iterations. */
-                (ustime()-start) > timelimit)
-            {
+            if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
+                long long elapsed = ustime()-start;
+
                 // 如果遍历次数正好是 16 的倍数
                 // 并且遍历的时间超过了 timelimit
                 // 那么断开 timelimit_exit
-                timelimit_exit = 1;
+                latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
+                if (elapsed > timelimit) timelimit_exit = 1;
             }
 
             // 已经超时了，返回
@@ -1031,6 +1256,8 @@ void activeExpireCycle(int type) {
             // 那么不再遍历
         } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
     }
+
+    latencyAddSampleIfNeeded("expire-cycle",(ustime()-start)/1000);
 }
 
 unsigned int getLRUClock(void) {
@@ -1093,9 +1320,8 @@ int clientsCronHandleTimeout(redisClient *c) {
         // 不检查被阻塞的客户端
         !(c->flags & REDIS_BLOCKED) &&  /* no timeout for BLPOP */
         // 不检查订阅了频道的客户端
-        dictSize(c->pubsub_channels) == 0 && /* no timeout for pubsub */
-        // 不检查订阅了模式的客户端
-        listLength(c->pubsub_patterns) == 0 &&
+        // 不检查订阅了频道或模式的客户端
+        clientSubscriptionsCount(c) == 0 && /* no timeout for pubsub */
         // 客户端最后一次与服务器通讯的时间已经超过了 maxidletime 时间
         (now - c->lastinteraction > server.maxidletime))
     {
@@ -1166,6 +1392,45 @@ int clientsCronResizeQueryBuffer(redisClient *c) {
     return 0;
 }
 
+/* Resize the reply buffer of the client to what it actually needs:
+ *
+ * 根据客户端实际的需要调整回复缓冲区的大小：
+ *
+ * 1) Idle clients release it, the next reply allocates it again once the
+ *    cron notices the demand.
+ *    空闲客户端释放回复缓冲区。
+ *
+ * 2) Otherwise the buffer shrinks when the latest peak used less than
+ *    half of it, and doubles (up to REDIS_REPLY_CHUNK_BYTES) when the
+ *    peak did not fit.
+ *    否则根据峰值缩小一半或者扩大一倍。
+ *
+ * Only clients with no pending output are resized. */
+int clientsCronResizeOutputBuffer(redisClient *c) {
+    size_t size = c->buf_usable_size, new_size = size;
+    time_t idletime = server.unixtime - c->lastinteraction;
+
+    if (c->bufpos == 0 && !(c->flags & REDIS_SLAVE)) {
+        if (idletime > 2) {
+            new_size = 0;
+        } else if (c->buf_peak < size/2 && size/2 >= REDIS_REPLY_MIN_BYTES) {
+            new_size = c->buf_peak+1;
+            if (new_size < REDIS_REPLY_MIN_BYTES)
+                new_size = REDIS_REPLY_MIN_BYTES;
+        } else if (c->buf_peak >= size && size < REDIS_REPLY_CHUNK_BYTES) {
+            new_size = size ? size*2 : REDIS_REPLY_MIN_BYTES;
+            if (new_size > REDIS_REPLY_CHUNK_BYTES)
+                new_size = REDIS_REPLY_CHUNK_BYTES;
+        }
+        if (new_size != size) clientResizeReplyBuffer(c,new_size);
+    }
+
+    /* Reset the peak again to capture the peak usage in the next cycle. */
+    // 重置峰值
+    c->buf_peak = c->bufpos;
+    return 0;
+}
+
 void clientsCron(void) {
     /* Make sure to process at least 1/(server.hz*10) of clients per call.
      *
@@ -1212,6 +1477,10 @@ void clientsCron(void) {
         if (clientsCronHandleTimeout(c)) continue;
         // 根据情况，缩小客户端查询缓冲区的大小
         if (clientsCronResizeQueryBuffer(c)) continue;
+        // 根据情况，调整客户端回复缓冲区的大小
+        if (clientsCronResizeOutputBuffer(c)) continue;
+        // 空闲客户端不再需要缓存参数对象
+        if (server.unixtime - c->lastinteraction > 2) freeClientArgvPool(c);
     }
 }
 
@@ -1230,6 +1499,11 @@ void databasesCron(void) {
         // 清除模式为 CYCLE_SLOW ，这个模式会尽量多清除过期键
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
 
+    /* Defrag keys gradually. */
+    // 主动碎片整理，同样受到时间限制
+    if (server.active_defrag_enabled)
+        activeDefragCycle();
+
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
@@ -1458,6 +1732,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             // 当 BGSAVE 正常结束的时候，bysignal 理应为 0。出了意外才是非零
             if (WIFSIGNALED(statloc)) bysignal = WTERMSIG(statloc);
 
+            // 先把子进程最后发来的 COW 信息读掉，再做收尾工作
+            if (pid == server.rdb_child_pid || pid == server.aof_child_pid)
+                receiveChildInfo();
+
             // RDB、rewrite-AOF 的上半部分过程都是在子进程里面完成的
             // 当子进程完成了相应的任务之后，将会退出，并将退出码返回给父进程
             // 当父进程周期性检查中，发现：子进程退出了，那就会开始完成下半部分工作（状态机的改变呀，善后处理呀，buf 的刷写呀）
@@ -1475,6 +1753,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                     (long)pid);
             }
             updateDictResizePolicy();
+            closeChildInfoPipe();
+        } else {
+            /* Child still running: collect the COW size it reported. */
+            receiveChildInfo();
         }
     } else {
 
@@ -1491,7 +1773,8 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
              * successful or if, in case of an error, at least
              * REDIS_BGSAVE_RETRY_DELAY seconds already elapsed. */
             // 检查是否有某个保存条件已经满足了
-            if (server.dirty >= sp->changes &&
+            if (server.forkless_save == NULL &&
+                server.dirty >= sp->changes &&
                 server.unixtime-server.lastsave > sp->seconds &&
                 (server.unixtime-server.lastbgsave_try >
                  REDIS_BGSAVE_RETRY_DELAY ||
@@ -1500,7 +1783,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                 redisLog(REDIS_NOTICE,"%d changes in %d seconds. Saving...",
                     sp->changes, (int)sp->seconds);
                 // 执行 BGSAVE
-                rdbSaveBackground(server.rdb_filename);
+                if (server.rdb_forkless)
+                    rdbSaveForkless(server.rdb_filename);
+                else
+                    rdbSaveBackground(server.rdb_filename);
                 break;
             }
          }
@@ -1553,12 +1839,21 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Clear the paused clients flag if needed. */
     clientsArePaused(); /* Don't check return value, just use the side effect. */
 
+    /* Keep the client side caching tracking table under its size limit. */
+    // 键跟踪表超过上限时，提前失效一些键
+    if (server.tracking_clients) trackingLimitUsedSlots();
+
     /* Replication cron function -- used to reconnect to master and
      * to detect transfer failures. */
     // 复制函数
     // 重连接 master 、向 master 发送 ACK 、判断数据发送失败情况、断开本服务器超时的 slave ，等等
     run_with_period(1000) replicationCron();
 
+    /* Let the slaves know how fresh their data is, see CLIENT MAXLAG. */
+    if (server.repl_heartbeat_period)
+        run_with_period(server.repl_heartbeat_period)
+            replicationSendHeartbeat();
+
     /* Run the Redis Cluster cron. */
     // 如果服务器运行在集群模式下，那么执行集群操作
     run_with_period(100) {
@@ -1577,6 +1872,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         migrateCloseTimedoutSockets();
     }
 
+    /* Abort async MIGRATE transfers that made no progress in time. */
+    // 中止超时的异步迁移
+    if (listLength(server.migrate_async_jobs)) migrateAsyncCron();
+
     // 增加 loop 计数器
     server.cronloops++;
 
@@ -1596,6 +1895,14 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
+    /* Serve the requests the shared memory clients queued without ringing
+     * the doorbell, before the queries postponed to the I/O threads are
+     * read, since they may be postponed as well. */
+    if (listLength(server.shm_clients)) handleShmClients();
+
+    /* Read the queries postponed to the I/O threads and execute them. */
+    handleClientsWithPendingReads();
+
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
     if (server.get_ack_from_slaves) {
@@ -1616,6 +1923,14 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (listLength(server.clients_waiting_acks))
         processClientsWaitingReplicas();
 
+    /* Unblock the clients in WAITOFFSET for the offset we reached. */
+    if (listLength(server.clients_waiting_offset))
+        processClientsWaitingOffset();
+
+    /* Reply to the clients of the module commands that were unblocked by
+     * the threads of the modules. */
+    moduleHandleBlockedClients();
+
     /* Try to process pending commands for clients that were just unblocked. */
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
@@ -1627,6 +1942,29 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Call the Redis Cluster before sleep function. */
     // 在进入下个事件循环前，执行一些集群收尾工作
     if (server.cluster_enabled) clusterBeforeSleep();
+
+    /* Send the replies accumulated in this event loop iteration, possibly
+     * using the I/O threads. This is done after the AOF buffer is written
+     * so that clients receive replies only for already persisted writes. */
+    // 在发送回复之前，向订阅了前缀的客户端发送这次循环中累积的失效消息
+    trackingBroadcastInvalidationMessages();
+    handleClientsWithPendingWrites();
+
+    /* Ask the shared memory clients to ring the doorbell from now on. This
+     * is called even without such clients, to reset aeSetDontWait(). */
+    prepareShmClientsToSleep();
+
+    /* Before sleeping, let the threads of the modules access the dataset
+     * by releasing the global lock. */
+    moduleReleaseGIL();
+}
+
+/* This function is called immadiately after the event loop multiplexing
+ * API returned, and the control is going to soon return to Redis by invoking
+ * the different events callbacks. */
+void afterSleep(struct aeEventLoop *eventLoop) {
+    REDIS_NOTUSED(eventLoop);
+    moduleAcquireGIL();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1642,8 +1980,16 @@ void createSharedObjects(void) {
     shared.czero = createObject(REDIS_STRING,sdsnew(":0\r\n"));
     shared.cone = createObject(REDIS_STRING,sdsnew(":1\r\n"));
     shared.cnegone = createObject(REDIS_STRING,sdsnew(":-1\r\n"));
-    shared.nullbulk = createObject(REDIS_STRING,sdsnew("$-1\r\n"));
-    shared.nullmultibulk = createObject(REDIS_STRING,sdsnew("*-1\r\n"));
+    /* Replies whose encoding depends on the RESP version of the client.
+     * Only the slots of the versions 2 and 3 are used. */
+    shared.null[2] = createObject(REDIS_STRING,sdsnew("$-1\r\n"));
+    shared.null[3] = createObject(REDIS_STRING,sdsnew("_\r\n"));
+    shared.nullarray[2] = createObject(REDIS_STRING,sdsnew("*-1\r\n"));
+    shared.nullarray[3] = createObject(REDIS_STRING,sdsnew("_\r\n"));
+    shared.emptymap[2] = createObject(REDIS_STRING,sdsnew("*0\r\n"));
+    shared.emptymap[3] = createObject(REDIS_STRING,sdsnew("%0\r\n"));
+    shared.emptyset[2] = createObject(REDIS_STRING,sdsnew("*0\r\n"));
+    shared.emptyset[3] = createObject(REDIS_STRING,sdsnew("~0\r\n"));
     shared.emptymultibulk = createObject(REDIS_STRING,sdsnew("*0\r\n"));
     shared.pong = createObject(REDIS_STRING,sdsnew("+PONG\r\n"));
     shared.queued = createObject(REDIS_STRING,sdsnew("+QUEUED\r\n"));
@@ -1681,6 +2027,8 @@ void createSharedObjects(void) {
         "-NOREPLICAS Not enough good slaves to write.\r\n"));
     shared.busykeyerr = createObject(REDIS_STRING,sdsnew(
         "-BUSYKEY Target key name already exists.\r\n"));
+    shared.noprotoerr = createObject(REDIS_STRING,sdsnew(
+        "-NOPROTO unsupported protocol version\r\n"));
 
     // 常用字符
     shared.space = createObject(REDIS_STRING,sdsnew(" "));
@@ -1706,11 +2054,15 @@ void createSharedObjects(void) {
     shared.unsubscribebulk = createStringObject("$11\r\nunsubscribe\r\n",18);
     shared.psubscribebulk = createStringObject("$10\r\npsubscribe\r\n",17);
     shared.punsubscribebulk = createStringObject("$12\r\npunsubscribe\r\n",19);
+    shared.smessagebulk = createStringObject("$8\r\nsmessage\r\n",14);
+    shared.ssubscribebulk = createStringObject("$10\r\nssubscribe\r\n",17);
+    shared.sunsubscribebulk = createStringObject("$12\r\nsunsubscribe\r\n",19);
 
     // 常用命令
     shared.del = createStringObject("DEL",3);
     shared.rpop = createStringObject("RPOP",4);
     shared.lpop = createStringObject("LPOP",4);
+    shared.srem = createStringObject("SREM",4);
     shared.lpush = createStringObject("LPUSH",5);
 
     // 常用整数
@@ -1723,6 +2075,10 @@ void createSharedObjects(void) {
     for (j = 0; j < REDIS_SHARED_BULKHDR_LEN; j++) {
         shared.mbulkhdr[j] = createObject(REDIS_STRING,
             sdscatprintf(sdsempty(),"*%d\r\n",j));
+        shared.maphdr[j] = createObject(REDIS_STRING,
+            sdscatprintf(sdsempty(),"%%%d\r\n",j));
+        shared.sethdr[j] = createObject(REDIS_STRING,
+            sdscatprintf(sdsempty(),"~%d\r\n",j));
         shared.bulkhdr[j] = createObject(REDIS_STRING,
             sdscatprintf(sdsempty(),"$%d\r\n",j));
     }
@@ -1752,9 +2108,13 @@ void initServerConfig() {
     // 设置默认服务器端口号
     server.port = REDIS_SERVERPORT;
     server.tcp_backlog = REDIS_TCP_BACKLOG;
+    server.tcp_reuseport = REDIS_DEFAULT_TCP_REUSEPORT;
+    server.tcp_defer_accept = REDIS_DEFAULT_TCP_DEFER_ACCEPT;
+    server.max_accepts_per_call = REDIS_DEFAULT_MAX_ACCEPTS_PER_CALL;
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = REDIS_DEFAULT_UNIX_SOCKET_PERM;
+    server.shm_transport = REDIS_DEFAULT_SHM_TRANSPORT;
     server.ipfd_count = 0;
     server.sofd = -1;
     server.dbnum = REDIS_DEFAULT_DBNUM;
@@ -1762,6 +2122,7 @@ void initServerConfig() {
     server.maxidletime = REDIS_MAXIDLETIME;
     server.tcpkeepalive = REDIS_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
+    server.active_expire_index = REDIS_DEFAULT_ACTIVE_EXPIRE_INDEX;
     server.client_max_querybuf_len = REDIS_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
@@ -1770,6 +2131,13 @@ void initServerConfig() {
     server.syslog_ident = zstrdup(REDIS_DEFAULT_SYSLOG_IDENT);
     server.syslog_facility = LOG_LOCAL0;
     server.daemonize = REDIS_DEFAULT_DAEMONIZE;
+    server.io_threads_num = REDIS_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = REDIS_DEFAULT_IO_THREADS_DO_READS;
+    server.server_cpulist = NULL;
+    server.bio_cpulist = NULL;
+    server.aof_rewrite_cpulist = NULL;
+    server.bgsave_cpulist = NULL;
+    server.numa_bind_memory = REDIS_DEFAULT_NUMA_BIND_MEMORY;
     server.aof_state = REDIS_AOF_OFF;
     server.aof_fsync = REDIS_DEFAULT_AOF_FSYNC;
     server.aof_no_fsync_on_rewrite = REDIS_DEFAULT_AOF_NO_FSYNC_ON_REWRITE;
@@ -1786,30 +2154,67 @@ void initServerConfig() {
     server.aof_selected_db = -1; /* Make sure the first time will not match */
     server.aof_flush_postponed_start = 0;
     server.aof_rewrite_incremental_fsync = REDIS_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC;
+    server.rdb_save_incremental_fsync = REDIS_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC;
+    server.aof_use_rdb_preamble = REDIS_DEFAULT_AOF_USE_RDB_PREAMBLE;
+    server.aof_group_commit = REDIS_DEFAULT_AOF_GROUP_COMMIT;
+    server.aof_fed_off = 0;
+    server.aof_durable_off = 0;
+    server.aof_load_commands = 0;
+    server.aof_load_bytes = 0;
+    server.aof_load_time = 0;
     server.pidfile = zstrdup(REDIS_DEFAULT_PID_FILE);
     server.rdb_filename = zstrdup(REDIS_DEFAULT_RDB_FILENAME);
     server.aof_filename = zstrdup(REDIS_DEFAULT_AOF_FILENAME);
+    server.aof_dirname = zstrdup(REDIS_DEFAULT_AOF_DIRNAME);
+    server.aof_manifest = NULL;
+    server.aof_last_incr_size = 0;
     server.requirepass = NULL;
     server.rdb_compression = REDIS_DEFAULT_RDB_COMPRESSION;
+    server.rdb_compression_codec = REDIS_DEFAULT_RDB_COMPRESSION_CODEC;
     server.rdb_checksum = REDIS_DEFAULT_RDB_CHECKSUM;
+    server.rdb_load_threads = REDIS_DEFAULT_RDB_LOAD_THREADS;
     server.stop_writes_on_bgsave_err = REDIS_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = REDIS_DEFAULT_ACTIVE_REHASHING;
+    server.fork_friendly = REDIS_DEFAULT_FORK_FRIENDLY;
+    server.rdb_forkless = REDIS_DEFAULT_RDB_FORKLESS;
     server.notify_keyspace_events = 0;
+    server.tracking_table_max_keys = REDIS_DEFAULT_TRACKING_TABLE_MAX_KEYS;
     server.maxclients = REDIS_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = REDIS_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = REDIS_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = REDIS_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = REDIS_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = REDIS_DEFAULT_LFU_DECAY_TIME;
+    server.hotkeys_tracking = REDIS_DEFAULT_HOTKEYS_TRACKING;
+    server.hotkeys_sample_rate = REDIS_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.hotkeys_window = REDIS_DEFAULT_HOTKEYS_WINDOW;
+    server.lazyfree_lazy_eviction = REDIS_DEFAULT_LAZYFREE_LAZY_EVICTION;
+    server.lazyfree_lazy_expire = REDIS_DEFAULT_LAZYFREE_LAZY_EXPIRE;
+    server.lazyfree_lazy_server_del = REDIS_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.active_defrag_enabled = REDIS_DEFAULT_ACTIVE_DEFRAG;
+    server.active_defrag_ignore_bytes = REDIS_DEFAULT_DEFRAG_IGNORE_BYTES;
+    server.active_defrag_threshold_lower = REDIS_DEFAULT_DEFRAG_THRESHOLD_LOWER;
+    server.active_defrag_threshold_upper = REDIS_DEFAULT_DEFRAG_THRESHOLD_UPPER;
+    server.active_defrag_cycle_min = REDIS_DEFAULT_DEFRAG_CYCLE_MIN;
+    server.active_defrag_cycle_max = REDIS_DEFAULT_DEFRAG_CYCLE_MAX;
+    server.active_defrag_running = 0;
     server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
-    server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
-    server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.hash_ziplist_index_entries = REDIS_HASH_ZIPLIST_INDEX_ENTRIES;
+    server.list_max_ziplist_size = REDIS_DEFAULT_LIST_MAX_ZIPLIST_SIZE;
+    server.list_compress_depth = REDIS_DEFAULT_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
+    server.string_chunk_threshold = REDIS_DEFAULT_STRING_CHUNK_THRESHOLD;
     server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
     server.hll_sparse_max_bytes = REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES;
+    server.stream_node_max_bytes = REDIS_DEFAULT_STREAM_NODE_MAX_BYTES;
+    server.stream_node_max_entries = REDIS_DEFAULT_STREAM_NODE_MAX_ENTRIES;
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = REDIS_REPL_PING_SLAVE_PERIOD;
+    server.repl_heartbeat_period = REDIS_DEFAULT_REPL_HEARTBEAT_PERIOD;
+    server.master_timestamp = 0;
     server.repl_timeout = REDIS_REPL_TIMEOUT;
     server.repl_min_slaves_to_write = REDIS_DEFAULT_MIN_SLAVES_TO_WRITE;
     server.repl_min_slaves_max_lag = REDIS_DEFAULT_MIN_SLAVES_MAX_LAG;
@@ -1819,10 +2224,14 @@ void initServerConfig() {
     server.cluster_configfile = zstrdup(REDIS_DEFAULT_CLUSTER_CONFIG_FILE);
     server.lua_caller = NULL;
     server.lua_time_limit = REDIS_LUA_TIME_LIMIT;
+    server.lua_always_replicate_commands = REDIS_DEFAULT_LUA_REPLICATE_COMMANDS;
     server.lua_client = NULL;
     server.lua_timedout = 0;
     server.migrate_cached_sockets = dictCreate(&migrateCacheDictType,NULL);
+    server.client_usage = dictCreate(&clientUsageDictType,NULL);
+    server.migrate_async_jobs = listCreate();
     server.loading_process_events_interval_bytes = (1024*1024*2);
+    server.propagate_batch = NULL;
 
     // 初始化 LRU 时间
     server.lruclock = getLRUClock();
@@ -1846,18 +2255,24 @@ void initServerConfig() {
     server.repl_syncio_timeout = REDIS_REPL_SYNCIO_TIMEOUT;
     server.repl_serve_stale_data = REDIS_DEFAULT_SLAVE_SERVE_STALE_DATA;
     server.repl_slave_ro = REDIS_DEFAULT_SLAVE_READ_ONLY;
+    server.repl_slave_lazy_flush = REDIS_DEFAULT_SLAVE_LAZY_FLUSH;
     server.repl_down_since = 0; /* Never connected, repl is down since EVER. */
     server.repl_disable_tcp_nodelay = REDIS_DEFAULT_REPL_DISABLE_TCP_NODELAY;
+    server.repl_diskless_sync = REDIS_DEFAULT_REPL_DISKLESS_SYNC;
+    server.repl_diskless_sync_delay = REDIS_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_load = REDIS_DEFAULT_REPL_DISKLESS_LOAD;
+    server.repl_compression = REDIS_DEFAULT_REPL_COMPRESSION;
+    server.repl_master_compression = 0;
     server.slave_priority = REDIS_DEFAULT_SLAVE_PRIORITY;
     server.master_repl_offset = 0;
+    changeReplicationId();
+    clearReplicationId2();
 
     /* Replication partial resync backlog */
     // 初始化 PSYNC 命令所使用的 backlog
     server.repl_backlog = NULL;
     server.repl_backlog_size = REDIS_DEFAULT_REPL_BACKLOG_SIZE;
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
-    server.repl_backlog_off = 0;
+    server.repl_buffer_mem = 0;
     server.repl_backlog_time_limit = REDIS_DEFAULT_REPL_BACKLOG_TIME_LIMIT;
     server.repl_no_slaves_since = time(NULL);
 
@@ -1881,15 +2296,19 @@ void initServerConfig() {
     server.commands = dictCreate(&commandTableDictType,NULL);
     server.orig_commands = dictCreate(&commandTableDictType,NULL);
     populateCommandTable();
+    moduleInitModulesSystem();
     server.delCommand = lookupCommandByCString("del");
     server.multiCommand = lookupCommandByCString("multi");
+    server.execCommand = lookupCommandByCString("exec");
     server.lpushCommand = lookupCommandByCString("lpush");
     server.lpopCommand = lookupCommandByCString("lpop");
     server.rpopCommand = lookupCommandByCString("rpop");
+    server.sremCommand = lookupCommandByCString("srem");
     
     /* Slow log */
     // 初始化慢查询日志
     server.slowlog_log_slower_than = REDIS_SLOWLOG_LOG_SLOWER_THAN;
+    server.latency_monitor_threshold = REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD;
     server.slowlog_max_len = REDIS_SLOWLOG_MAX_LEN;
 
     /* Debugging */
@@ -2000,6 +2419,33 @@ void adjustOpenFilesLimit(void) {
  * configuration but the function is not able to bind * for at least
  * one of the IPv4 or IPv6 protocols. */
 // 不写 bind 配置的话，将会 bind *，而且是 ipv4 + ipv6 的
+/* Create a TCP listener on 'bindaddr' (NULL for any address) honouring the
+ * tcp-reuseport and tcp-defer-accept options. Returns the socket or
+ * ANET_ERR with the error in server.neterr. */
+static int listenToTcpAddress(int port, char *bindaddr, int ipv6) {
+    int fd;
+
+    if (ipv6)
+        fd = server.tcp_reuseport ?
+             anetTcp6ReusePortServer(server.neterr,port,bindaddr,
+                                     server.tcp_backlog) :
+             anetTcp6Server(server.neterr,port,bindaddr,server.tcp_backlog);
+    else
+        fd = server.tcp_reuseport ?
+             anetTcpReusePortServer(server.neterr,port,bindaddr,
+                                    server.tcp_backlog) :
+             anetTcpServer(server.neterr,port,bindaddr,server.tcp_backlog);
+
+    if (fd != ANET_ERR && server.tcp_defer_accept) {
+        char err[ANET_ERR_LEN];
+
+        /* Not fatal: the listener just hands over every connection. */
+        if (anetDeferAccept(err,fd,server.tcp_defer_accept) == ANET_ERR)
+            redisLog(REDIS_WARNING,"Ignoring tcp-defer-accept: %s", err);
+    }
+    return fd;
+}
+
 int listenToPort(int port, int *fds, int *count) {
     int j;
 
@@ -2010,14 +2456,12 @@ int listenToPort(int port, int *fds, int *count) {
         if (server.bindaddr[j] == NULL) {
             /* Bind * for both IPv6 and IPv4, we enter here only if
              * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
-                server.tcp_backlog);
+            fds[*count] = listenToTcpAddress(port,NULL,1);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
                 (*count)++;
             }
-            fds[*count] = anetTcpServer(server.neterr,port,NULL,
-                server.tcp_backlog);
+            fds[*count] = listenToTcpAddress(port,NULL,0);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
                 (*count)++;
@@ -2028,12 +2472,10 @@ int listenToPort(int port, int *fds, int *count) {
             if (*count) break;
         } else if (strchr(server.bindaddr[j],':')) {
             /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
+            fds[*count] = listenToTcpAddress(port,server.bindaddr[j],1);
         } else {
             /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
+            fds[*count] = listenToTcpAddress(port,server.bindaddr[j],0);
         }
         if (fds[*count] == ANET_ERR) {
             redisLog(REDIS_WARNING,
@@ -2056,13 +2498,28 @@ void resetServerStats(void) {
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
+    server.stat_eviction_samples = 0;
+    server.stat_eviction_ghosts = 0;
+    server.stat_evicted_idle_sum = 0;
+    server.stat_evicted_lru_keys = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
+    server.stat_pubsub_pattern_checks = 0;
+    server.stat_pubsub_pattern_matches = 0;
+    server.stat_active_defrag_hits = 0;
+    server.stat_active_defrag_misses = 0;
+    server.stat_active_defrag_key_hits = 0;
+    server.stat_active_defrag_key_misses = 0;
+    server.stat_argv_pool_hits = 0;
     server.stat_fork_time = 0;
+    server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
+    server.stat_aof_group_commits = 0;
     memset(server.ops_sec_samples,0,sizeof(server.ops_sec_samples));
     server.ops_sec_idx = 0;
     server.ops_sec_last_sample_time = mstime();
@@ -2086,13 +2543,21 @@ void initServer() {
     // 初始化并创建数据结构
     server.current_client = NULL;
     server.clients = listCreate();
+    server.clients_index = raxNew();
+    server.tracking_clients = 0;
+    server.next_client_id = 1; /* Client IDs, start from 1. */
     server.clients_to_close = listCreate();
+    server.clients_pending_write = listCreate();
+    server.shm_clients = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaves = listCreate();
+    server.repl_buffer_blocks = listCreate();
     server.monitors = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
     server.clients_waiting_acks = listCreate();
+    server.clients_waiting_offset = listCreate();
     server.get_ack_from_slaves = 0;
     server.clients_paused = 0;
 
@@ -2132,24 +2597,29 @@ void initServer() {
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].expires_index = NULL;
+        expireIndexSetup(&server.db[j],server.active_expire_index);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
-        server.db[j].eviction_pool = evictionPoolAlloc();
+        server.db[j].migrating_keys = dictCreate(&setDictType,NULL);
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
     }
+    evictionPoolAlloc();
 
     // 创建 PUBSUB 相关结构
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
+    server.pubsub_patterns_index = raxNew();
+    server.pubsubshard_channels = dictCreate(&keylistDictType,NULL);
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
 
     server.cronloops = 0;
     server.rdb_child_pid = -1;
+    server.rdb_child_type = REDIS_RDB_CHILD_TYPE_NONE;
     server.aof_child_pid = -1;
-    aofRewriteBufferReset();
     server.aof_buf = sdsempty();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
@@ -2165,6 +2635,17 @@ void initServer() {
     server.aof_last_write_status = REDIS_OK;
     server.aof_last_write_errno = 0;
     server.repl_good_slaves_count = 0;
+    server.child_info_pipe[0] = -1;
+    server.child_info_pipe[1] = -1;
+    server.in_fork_child = REDIS_CHILD_INFO_TYPE_NONE;
+    server.forkless_save = NULL;
+    server.rdb_forkless_time_start = -1;
+    server.stat_forkless_early_keys = 0;
+    server.stat_current_cow_bytes = 0;
+    server.stat_rdb_cow_bytes = 0;
+    server.stat_rdb_cow_peak = 0;
+    server.stat_aof_cow_bytes = 0;
+    server.stat_aof_cow_peak = 0;
     updateCachedTime();
 
     /* Create the serverCron() time event, that's our main way to process
@@ -2192,18 +2673,18 @@ void initServer() {
     if (server.sofd > 0 && aeCreateFileEvent(server.el,server.sofd,AE_READABLE,
         acceptUnixHandler,NULL) == AE_ERR) redisPanic("Unrecoverable error creating server.sofd file event.");
 
-    /* Open the AOF file if needed. */
-    // 如果 AOF 持久化功能已经打开，那么打开或创建一个 AOF 文件
-    if (server.aof_state == REDIS_AOF_ON) {
-        server.aof_fd = open(server.aof_filename,
-                               O_WRONLY|O_APPEND|O_CREAT,0644);
-        if (server.aof_fd == -1) {
-            redisLog(REDIS_WARNING, "Can't open the append-only file: %s",
-                strerror(errno));
-            exit(1);
-        }
+    /* Register a readable event for the pipe used to awake the event loop
+     * when a blocked client in a module needs attention. */
+    if (aeCreateFileEvent(server.el, server.module_blocked_pipe[0], AE_READABLE,
+        moduleBlockedClientPipeReadable,NULL) == AE_ERR) {
+            redisPanic(
+                "Error registering the readable event for the module "
+                "blocked clients subsystem.");
     }
 
+    // 启动 AOF 写线程，用于 appendfsync always 时的组提交
+    aofWriterInit();
+
     /* 32 bit instances are limited to 4GB of address space, so if there is
      * no explicit limit in the user provided configuration we set a limit
      * at 3 GB using maxmemory with 'noeviction' policy'. This avoids
@@ -2226,9 +2707,14 @@ void initServer() {
 
     // 初始化慢查询功能
     slowlogInit();
+    latencyMonitorInit();
 
     // 初始化 BIO 系统
     bioInit();
+    initThreadedIO();
+
+    // 记录启动时（载入数据之前）的内存占用，供 MEMORY STATS 使用
+    server.initial_memory_usage = zmalloc_used_memory();
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -2295,15 +2781,20 @@ void resetCommandTableStats(void) {
     int numcommands = sizeof(redisCommandTable)/sizeof(struct redisCommand);
     int j;
 
-    for (j = 0; j < numcommands; j++) {
-        struct redisCommand *c = redisCommandTable+j;
+    for (j = 0; j < numcommands; j++)
+        resetCommandStats(redisCommandTable+j);
+}
 
-        // 清零时间
-        c->microseconds = 0;
+/* Reset the statistics of a single command, see CONFIG RESETSTAT. */
+void resetCommandStats(struct redisCommand *c) {
+    // 清零时间
+    c->microseconds = 0;
 
-        // 清零调用次数
-        c->calls = 0;
-    }
+    // 清零调用次数
+    c->calls = 0;
+
+    // 清空执行时间的直方图
+    if (c->latency_histogram) latencyHistogramReset(c->latency_histogram);
 }
 
 /* ========================== Redis OP Array API ============================ */
@@ -2311,6 +2802,7 @@ void resetCommandTableStats(void) {
 void redisOpArrayInit(redisOpArray *oa) {
     oa->ops = NULL;
     oa->numops = 0;
+    oa->capacity = 0;
 }
 
 int redisOpArrayAppend(redisOpArray *oa, struct redisCommand *cmd, int dbid,
@@ -2318,7 +2810,10 @@ int redisOpArrayAppend(redisOpArray *oa, struct redisCommand *cmd, int dbid,
 {
     redisOp *op;
 
-    oa->ops = zrealloc(oa->ops,sizeof(redisOp)*(oa->numops+1));
+    if (oa->numops == oa->capacity) {
+        oa->capacity = oa->capacity ? oa->capacity*2 : 4;
+        oa->ops = zrealloc(oa->ops,sizeof(redisOp)*oa->capacity);
+    }
     op = oa->ops+oa->numops;
     op->cmd = cmd;
     op->dbid = dbid;
@@ -2409,6 +2904,21 @@ struct redisCommand *lookupCommandOrOriginal(sds name) {
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
                int flags)
 {
+    /* Inside EXEC the commands are collected and propagated together by
+     * propagateBatch(), the vector is copied since the caller owns it. */
+    // 事务执行期间只收集命令，由 EXEC 一次性传播
+    if (server.propagate_batch) {
+        robj **copy = zmalloc(sizeof(robj*)*argc);
+        int j;
+
+        for (j = 0; j < argc; j++) {
+            copy[j] = argv[j];
+            incrRefCount(copy[j]);
+        }
+        redisOpArrayAppend(server.propagate_batch,cmd,dbid,copy,argc,flags);
+        return;
+    }
+
     // 传播到 AOF
     if (server.aof_state != REDIS_AOF_OFF && flags & REDIS_PROPAGATE_AOF)
         feedAppendOnlyFile(cmd,dbid,argv,argc);
@@ -2416,6 +2926,31 @@ void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
     // 传播到 slave
     if (flags & REDIS_PROPAGATE_REPL)
         replicationFeedSlaves(server.slaves,dbid,argv,argc);
+
+    // 转发到正在接收槽的节点
+    if (flags & REDIS_PROPAGATE_REPL &&
+        server.cluster_enabled && server.cluster->slot_migration)
+        clusterSlotMigrationFeed(cmd,dbid,argv,argc);
+}
+
+/* Propagate the commands collected in 'oa' while server.propagate_batch was
+ * set: the AOF gets them with a single append to the AOF buffer, and the
+ * replication buffer as one contiguous chunk, so the MULTI/.../EXEC block
+ * is never split. The ops are not freed. */
+void propagateBatch(redisOpArray *oa) {
+    int j;
+
+    redisAssert(server.propagate_batch == NULL);
+    if (server.aof_state != REDIS_AOF_OFF) feedAppendOnlyFileBatch(oa);
+
+    for (j = 0; j < oa->numops; j++) {
+        redisOp *op = oa->ops+j;
+
+        if (!(op->target & REDIS_PROPAGATE_REPL)) continue;
+        replicationFeedSlaves(server.slaves,op->dbid,op->argv,op->argc);
+        if (server.cluster_enabled && server.cluster->slot_migration)
+            clusterSlotMigrationFeed(op->cmd,op->dbid,op->argv,op->argc);
+    }
 }
 
 /* Used inside commands to schedule the propagation of additional commands
@@ -2434,13 +2969,22 @@ void forceCommandPropagation(redisClient *c, int flags) {
     if (flags & REDIS_PROPAGATE_AOF) c->flags |= REDIS_FORCE_AOF;
 }
 
+/* Avoid that the executed command is propagated at all. This way we
+ * are free to just propagate what we want using the alsoPropagate()
+ * API. */
+void preventCommandPropagation(redisClient *c) {
+    c->flags |= REDIS_PREVENT_PROP;
+}
+
 /* Call() is the core of Redis execution of a command */
 // 调用命令的实现函数，执行命令
 void call(redisClient *c, int flags) {
     // start 记录命令开始执行的时间
     long long dirty, start, duration;
+    long long aof_fed_off = server.aof_fed_off;
     // 记录命令开始执行前的 FLAG
     int client_old_flags = c->flags;
+    redisOpArray prev_also_propagate;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
      * not generated from reading an AOF. */
@@ -2452,8 +2996,10 @@ void call(redisClient *c, int flags) {
         replicationFeedMonitors(c,server.monitors,c->db->id,c->argv,c->argc);
     }
 
-    /* Call the command. */
-    c->flags &= ~(REDIS_FORCE_AOF|REDIS_FORCE_REPL);
+    /* Call the command. The also_propagate array of the caller is saved,
+     * since call() is executed recursively by scripts. */
+    c->flags &= ~(REDIS_FORCE_AOF|REDIS_FORCE_REPL|REDIS_PREVENT_PROP);
+    prev_also_propagate = server.also_propagate;
     redisOpArrayInit(&server.also_propagate);
     // 保留旧 dirty 计数器值
     dirty = server.dirty;
@@ -2463,8 +3009,23 @@ void call(redisClient *c, int flags) {
     c->cmd->proc(c);
     // 计算命令执行耗费的时间
     duration = ustime()-start;
+
+    /* If the client has keys tracking enabled for client side caching,
+     * make sure to remember the keys it fetched via this command. Commands
+     * executed by scripts are tracked for the client that called EVAL. */
+    if (c->cmd->flags & REDIS_CMD_READONLY) {
+        redisClient *caller = (c->flags & REDIS_LUA_CLIENT && server.lua_caller) ?
+                              server.lua_caller : c;
+        if (caller->flags & REDIS_TRACKING &&
+            !(caller->flags & REDIS_TRACKING_BCAST))
+        {
+            trackingRememberKeys(caller,c);
+        }
+    }
     // 计算命令执行之后的 dirty 值
     dirty = server.dirty-dirty;
+    // 像 DEBUG LOADAOF 这样会重置 dirty 的命令，差值可能为负，不应被传播
+    if (dirty < 0) dirty = 0;
 
     /* When EVAL is called loading the AOF we don't want commands called
      * from Lua to go into the slowlog or to populate statistics. */
@@ -2486,40 +3047,65 @@ void call(redisClient *c, int flags) {
 
     /* Log the command into the Slow log if needed, and populate the
      * per-command statistics that we show in INFO commandstats. */
-    // 如果有需要，将命令放到 SLOWLOG 里面
-    if (flags & REDIS_CALL_SLOWLOG && c->cmd->proc != execCommand)
-        slowlogPushEntryIfNeeded(c->argv,c->argc,duration);
+    // 如果有需要，将命令放到 SLOWLOG 里面，同时记录命令的延迟
+    if (flags & REDIS_CALL_SLOWLOG && c->cmd->proc != execCommand) {
+        latencyAddSampleIfNeeded("command",duration/1000);
+        slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+    }
+    /* Account the time to the client. EXEC is skipped since the commands
+     * of the transaction are accounted one by one. */
+    if (c->cmd->proc != execCommand) {
+        c->usage.cmd_usec += duration;
+        c->usage.cmd_calls++;
+    }
+
     // 更新命令的统计信息
     if (flags & REDIS_CALL_STATS) {
         c->cmd->microseconds += duration;
         c->cmd->calls++;
+        if (c->cmd->latency_histogram == NULL)
+            c->cmd->latency_histogram = latencyHistogramCreate();
+        latencyHistogramRecord(c->cmd->latency_histogram,duration);
     }
 
     /* Propagate the command into the AOF and replication link */
     // 将命令复制到 AOF 和 slave 节点
-    if (flags & REDIS_CALL_PROPAGATE) {
-        int flags = REDIS_PROPAGATE_NONE;
+    if (flags & REDIS_CALL_PROPAGATE &&
+        (c->flags & REDIS_PREVENT_PROP) != REDIS_PREVENT_PROP)
+    {
+        int flags_prop = REDIS_PROPAGATE_NONE;
 
         // 强制 REPL 传播
-        if (c->flags & REDIS_FORCE_REPL) flags |= REDIS_PROPAGATE_REPL;
+        if (c->flags & REDIS_FORCE_REPL) flags_prop |= REDIS_PROPAGATE_REPL;
 
         // 强制 AOF 传播
-        if (c->flags & REDIS_FORCE_AOF) flags |= REDIS_PROPAGATE_AOF;
+        if (c->flags & REDIS_FORCE_AOF) flags_prop |= REDIS_PROPAGATE_AOF;
 
         // 如果数据库有被修改，那么启用 REPL 和 AOF 传播
         if (dirty)
-            flags |= (REDIS_PROPAGATE_REPL | REDIS_PROPAGATE_AOF);
-
-        if (flags != REDIS_PROPAGATE_NONE)
-            propagate(c->cmd,c->db->id,c->argv,c->argc,flags);
+            flags_prop |= (REDIS_PROPAGATE_REPL | REDIS_PROPAGATE_AOF);
+
+        /* If the command forced AOF / replication of the command, set
+         * the flags regardless of the command effects on the data set,
+         * then remove the targets the caller or the command excluded. */
+        if (c->flags & REDIS_PREVENT_REPL_PROP ||
+            !(flags & REDIS_CALL_PROPAGATE_REPL))
+                flags_prop &= ~REDIS_PROPAGATE_REPL;
+        if (c->flags & REDIS_PREVENT_AOF_PROP ||
+            !(flags & REDIS_CALL_PROPAGATE_AOF))
+                flags_prop &= ~REDIS_PROPAGATE_AOF;
+
+        if (flags_prop != REDIS_PROPAGATE_NONE)
+            propagate(c->cmd,c->db->id,c->argv,c->argc,flags_prop);
     }
 
-    /* Restore the old FORCE_AOF/REPL flags, since call can be executed
-     * recursively. */
+    /* Restore the old FORCE_AOF/REPL and PREVENT_PROP flags, since call
+     * can be executed recursively. */
     // 将客户端的 FLAG 恢复到命令执行之前
     // 因为 call 可能会递归执行
-    c->flags &= ~(REDIS_FORCE_AOF|REDIS_FORCE_REPL);
-    c->flags |= client_old_flags & (REDIS_FORCE_AOF|REDIS_FORCE_REPL);
+    c->flags &= ~(REDIS_FORCE_AOF|REDIS_FORCE_REPL|REDIS_PREVENT_PROP);
+    c->flags |= client_old_flags &
+        (REDIS_FORCE_AOF|REDIS_FORCE_REPL|REDIS_PREVENT_PROP);
 
     /* Handle the alsoPropagate() API to handle commands that want to propagate
      * multiple separated commands. */
@@ -2528,12 +3114,36 @@ void call(redisClient *c, int flags) {
         int j;
         redisOp *rop;
 
-        for (j = 0; j < server.also_propagate.numops; j++) {
-            rop = &server.also_propagate.ops[j];
-            propagate(rop->cmd, rop->dbid, rop->argv, rop->argc, rop->target);
+        if (flags & REDIS_CALL_PROPAGATE) {
+            for (j = 0; j < server.also_propagate.numops; j++) {
+                int target;
+
+                rop = &server.also_propagate.ops[j];
+                target = rop->target;
+                /* Whatever the command wish is, we honor the call() flags. */
+                if (!(flags & REDIS_CALL_PROPAGATE_AOF))
+                    target &= ~REDIS_PROPAGATE_AOF;
+                if (!(flags & REDIS_CALL_PROPAGATE_REPL))
+                    target &= ~REDIS_PROPAGATE_REPL;
+                if (target)
+                    propagate(rop->cmd,rop->dbid,rop->argv,rop->argc,target);
+            }
         }
         redisOpArrayFree(&server.also_propagate);
     }
+    server.also_propagate = prev_also_propagate;
+
+    /* With the AOF group commit the reply of a command that wrote to the
+     * AOF is sent once the write is fsynced. For scripts the reply to hold
+     * is the one of the EVAL caller.
+     *
+     * 组提交：写入了 AOF 的命令，要等落盘之后才回复客户端 */
+    if (server.aof_fed_off != aof_fed_off && aofGroupCommitActive()) {
+        if (c->flags & REDIS_LUA_CLIENT && server.lua_caller)
+            holdClientRepliesForAof(server.lua_caller);
+        else
+            holdClientRepliesForAof(c);
+    }
     server.stat_numcommands++;
 }
 
@@ -2612,7 +3222,8 @@ int processCommand(redisClient *c) {
 
     /* Check if the user is authenticated */
     // 检查认证信息
-    if (server.requirepass && !c->authenticated && c->cmd->proc != authCommand)
+    if (server.requirepass && !c->authenticated &&
+        c->cmd->proc != authCommand && c->cmd->proc != helloCommand)
     {
         flagTransaction(c);
         addReply(c,shared.noautherr);
@@ -2634,7 +3245,8 @@ int processCommand(redisClient *c) {
      *    命令没有 key 参数
      */
     if (server.cluster_enabled &&       // 启动了 cluster 模式
-        !(c->flags & REDIS_MASTER) &&   // client 不能是 master（是 master 的话，直接执行，不用进行 redirct 的判断，相信 master 过来的 CMD）
+        !(c->flags & REDIS_MASTER) &&
+        !(c->flags & REDIS_SLOT_IMPORT) &&  // 导入槽的连接只会发送该槽的命令   // client 不能是 master（是 master 的话，直接执行，不用进行 redirct 的判断，相信 master 过来的 CMD）
         !(c->cmd->getkeys_proc == NULL && c->cmd->firstkey == 0))   // 只有包含 key 的 redis CMD 才需要进行 redirect 操作，其他操作都不需要，所以不进入这个 if-branch
     {
         int hashslot;
@@ -2659,6 +3271,8 @@ int processCommand(redisClient *c) {
                      * but the slot is not "stable" currently as there is
                      * a migration or import in progress. */
                     addReplySds(c,sdsnew("-TRYAGAIN Multiple keys request during rehashing of slot\r\n"));
+                } else if (error_code == REDIS_CLUSTER_REDIR_HANDOFF) {
+                    addReplySds(c,sdsnew("-TRYAGAIN Slot is being handed off to another node\r\n"));
                 } else {
                     redisPanic("getNodeByQuery() unknown error.");
                 }
@@ -2751,13 +3365,17 @@ int processCommand(redisClient *c) {
 
     /* Only allow SUBSCRIBE and UNSUBSCRIBE in the context of Pub/Sub */
     // 在订阅于发布模式的上下文中，只能执行订阅和退订相关的命令
-    if ((dictSize(c->pubsub_channels) > 0 || listLength(c->pubsub_patterns) > 0)
-        &&
+    /* RESP3 clients receive Pub/Sub messages as push data, so they can
+     * keep sending normal commands. */
+    if (c->resp == 2 &&
+        clientSubscriptionsCount(c) > 0 &&
         c->cmd->proc != subscribeCommand &&
         c->cmd->proc != unsubscribeCommand &&
         c->cmd->proc != psubscribeCommand &&
-        c->cmd->proc != punsubscribeCommand) {
-        addReplyError(c,"only (P)SUBSCRIBE / (P)UNSUBSCRIBE / QUIT allowed in this context");
+        c->cmd->proc != punsubscribeCommand &&
+        c->cmd->proc != ssubscribeCommand &&
+        c->cmd->proc != sunsubscribeCommand) {
+        addReplyError(c,"only (P|S)SUBSCRIBE / (P|S)UNSUBSCRIBE / QUIT allowed in this context");
         return REDIS_OK;
     }
 
@@ -2772,6 +3390,29 @@ int processCommand(redisClient *c) {
         return REDIS_OK;
     }
 
+    /* Refuse the reads of clients that set CLIENT MAXLAG if our data is
+     * older than they tolerate. Only the commands reading keys are
+     * checked, so PING, MULTI or WAITOFFSET (the way to catch up) work. */
+    if (c->max_lag && server.masterhost && !(c->flags & REDIS_MASTER) &&
+        c->cmd->flags & REDIS_CMD_READONLY &&
+        (c->cmd->firstkey || c->cmd->getkeys_proc))
+    {
+        long long lag = replicationGetReadLag();
+
+        if (lag == -1 || lag > c->max_lag) {
+            flagTransaction(c);
+            if (lag == -1)
+                addReplySds(c,sdsnew("-LAGGING the lag of this slave is "
+                    "unknown: no heartbeat received from the master\r\n"));
+            else
+                addReplySds(c,sdscatprintf(sdsempty(),
+                    "-LAGGING this slave is %lld ms behind the master, "
+                    "the CLIENT MAXLAG limit is %lld ms\r\n",
+                    lag, c->max_lag));
+            return REDIS_OK;
+        }
+    }
+
     /* Loading DB? Return an error if the command has not the
      * REDIS_CMD_LOADING flag. */
     // 如果服务器正在载入数据到数据库，那么只执行带有 REDIS_CMD_LOADING
@@ -2798,6 +3439,19 @@ int processCommand(redisClient *c) {
         return REDIS_OK;
     }
 
+    /* Don't accept writes against keys an async MIGRATE is transferring:
+     * the value must not change between serialization and the final DEL. */
+    // 拒绝对正在异步迁移的键执行写命令
+    if (c->cmd->flags & REDIS_CMD_WRITE &&
+        !(c->flags & REDIS_MASTER) &&
+        dictSize(c->db->migrating_keys) &&
+        migrateKeysLocked(c->db,c->cmd,c->argv,c->argc))
+    {
+        flagTransaction(c);
+        addReplySds(c,sdsnew("-TRYAGAIN Key is being migrated\r\n"));
+        return REDIS_OK;
+    }
+
     /* Exec the command */
     if (c->flags & REDIS_MULTI &&
         c->cmd->proc != execCommand && c->cmd->proc != discardCommand &&
@@ -2815,7 +3469,7 @@ int processCommand(redisClient *c) {
         c->woff = server.master_repl_offset;
         // 处理那些解除了阻塞的键
         if (listLength(server.ready_keys))
-            handleClientsBlockedOnLists();
+            handleClientsBlockedOnKeys();
     }
 
     return REDIS_OK;
@@ -2857,6 +3511,7 @@ int prepareForShutdown(int flags) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    snapshotAbort();
 
     // 同理，杀死正在执行 BGREWRITEAOF 的子进程
     if (server.aof_state != REDIS_AOF_OFF) {
@@ -2869,7 +3524,8 @@ int prepareForShutdown(int flags) {
         }
         /* Append only file: fsync() the AOF and exit */
         redisLog(REDIS_NOTICE,"Calling fsync() on the AOF file.");
-        // 将缓冲区的内容写入到硬盘里面
+        // 将缓冲区的内容写入到硬盘里面（组提交时 aof_buf 中可能还有数据）
+        flushAppendOnlyFile(1);
         aof_fsync(server.aof_fd);
     }
 
@@ -2959,6 +3615,100 @@ void authCommand(redisClient *c) {
     }
 }
 
+/* HELLO [protover [AUTH <username> <password>] [SETNAME <name>]]
+ *
+ * Switch the connection to the given RESP protocol version, 2 or 3, and
+ * reply with a map describing the server. The AUTH option authenticates
+ * the client in the same round trip: there are no users, so <username>
+ * must be "default" and <password> is checked against requirepass.
+ *
+ * 协商连接使用的 RESP 协议版本，并返回服务器的基本信息 */
+void helloCommand(redisClient *c) {
+    long long ver = 0;
+    int j, next_arg = 1;
+    char *mode;
+
+    if (c->argc >= 2) {
+        if (getLongLongFromObjectOrReply(c,c->argv[next_arg++],&ver,
+            "Protocol version is not an integer or out of range") != REDIS_OK)
+            return;
+
+        if (ver < 2 || ver > 3) {
+            addReply(c,shared.noprotoerr);
+            return;
+        }
+    }
+
+    for (j = next_arg; j < c->argc; j++) {
+        int moreargs = (c->argc-1) - j;
+        char *opt = c->argv[j]->ptr;
+
+        if (!strcasecmp(opt,"auth") && moreargs >= 2) {
+            if (!server.requirepass) {
+                addReplyError(c,"Client sent AUTH, but no password is set");
+                return;
+            }
+            if (strcmp(c->argv[j+1]->ptr,"default") ||
+                time_independent_strcmp(c->argv[j+2]->ptr,server.requirepass))
+            {
+                c->authenticated = 0;
+                addReplySds(c,sdsnew("-WRONGPASS invalid username-password "
+                                     "pair\r\n"));
+                return;
+            }
+            c->authenticated = 1;
+            j += 2;
+        } else if (!strcasecmp(opt,"setname") && moreargs) {
+            if (clientSetNameOrReply(c,c->argv[j+1]) == REDIS_ERR) return;
+            j++;
+        } else {
+            addReplyErrorFormat(c,"Syntax error in HELLO option '%s'",opt);
+            return;
+        }
+    }
+
+    /* At this point we need to be authenticated to continue. */
+    if (server.requirepass && !c->authenticated) {
+        addReplySds(c,sdsnew("-NOAUTH HELLO must be called with the client "
+            "already authenticated, otherwise the HELLO AUTH <user> <pass> "
+            "option can be used to authenticate the client and select the "
+            "RESP protocol version at the same time\r\n"));
+        return;
+    }
+
+    /* Let's switch to the specified RESP mode. */
+    if (ver) c->resp = ver;
+
+    if (server.cluster_enabled) mode = "cluster";
+    else if (server.sentinel_mode) mode = "sentinel";
+    else mode = "standalone";
+
+    addReplyMapLen(c,6 + !server.sentinel_mode);
+
+    addReplyBulkCString(c,"server");
+    addReplyBulkCString(c,"redis");
+
+    addReplyBulkCString(c,"version");
+    addReplyBulkCString(c,REDIS_VERSION);
+
+    addReplyBulkCString(c,"proto");
+    addReplyLongLong(c,c->resp);
+
+    addReplyBulkCString(c,"id");
+    addReplyLongLong(c,c->id);
+
+    addReplyBulkCString(c,"mode");
+    addReplyBulkCString(c,mode);
+
+    if (!server.sentinel_mode) {
+        addReplyBulkCString(c,"role");
+        addReplyBulkCString(c,server.masterhost ? "slave" : "master");
+    }
+
+    addReplyBulkCString(c,"modules");
+    addReplyMultiBulkLen(c,0);
+}
+
 void pingCommand(redisClient *c) {
     addReply(c,shared.pong);
 }
@@ -3088,10 +3838,12 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "tracking_clients:%u\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            server.tracking_clients);
     }
 
     /* Memory */
@@ -3099,6 +3851,7 @@ sds genRedisInfoString(char *section) {
         char hmem[64];
         char peak_hmem[64];
         size_t zmalloc_used = zmalloc_used_memory();
+        struct redisMemOverhead *mh = getMemoryOverheadData();
 
         /* Peak memory is updated from time to time by serverCron() so it
          * may happen that the instantaneous value is slightly bigger than
@@ -3119,7 +3872,10 @@ sds genRedisInfoString(char *section) {
             "used_memory_peak_human:%s\r\n"
             "used_memory_lua:%lld\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
-            "mem_allocator:%s\r\n",
+            "mem_allocator:%s\r\n"
+            "mem_clients_slaves:%zu\r\n"
+            "mem_clients_normal:%zu\r\n"
+            "lazyfree_pending_objects:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -3127,8 +3883,12 @@ sds genRedisInfoString(char *section) {
             peak_hmem,
             ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
-            ZMALLOC_LIB
+            ZMALLOC_LIB,
+            mh->clients_slaves,
+            mh->clients_normal,
+            lazyfreeGetPendingObjectsCount()
             );
+        freeMemoryOverheadData(mh);
     }
 
     /* Persistence */
@@ -3149,15 +3909,24 @@ sds genRedisInfoString(char *section) {
             "aof_last_rewrite_time_sec:%jd\r\n"
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
-            "aof_last_write_status:%s\r\n",
+            "aof_last_write_status:%s\r\n"
+            "current_cow_size:%zu\r\n"
+            "rdb_last_cow_size:%zu\r\n"
+            "rdb_peak_cow_size:%zu\r\n"
+            "aof_last_cow_size:%zu\r\n"
+            "aof_peak_cow_size:%zu\r\n"
+            "rdb_forkless_in_progress:%d\r\n"
+            "rdb_forkless_last_early_keys:%lld\r\n",
             server.loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            server.rdb_child_pid != -1 || server.forkless_save != NULL,
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == REDIS_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
-                -1 : time(NULL)-server.rdb_save_time_start),
+            (intmax_t)((server.rdb_child_pid != -1) ?
+                time(NULL)-server.rdb_save_time_start :
+                (server.forkless_save != NULL) ?
+                time(NULL)-server.rdb_forkless_time_start : -1),
             server.aof_state != REDIS_AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -3165,7 +3934,31 @@ sds genRedisInfoString(char *section) {
             (intmax_t)((server.aof_child_pid == -1) ?
                 -1 : time(NULL)-server.aof_rewrite_time_start),
             (server.aof_lastbgrewrite_status == REDIS_OK) ? "ok" : "err",
-            (server.aof_last_write_status == REDIS_OK) ? "ok" : "err");
+            (server.aof_last_write_status == REDIS_OK) ? "ok" : "err",
+            server.stat_current_cow_bytes,
+            server.stat_rdb_cow_bytes,
+            server.stat_rdb_cow_peak,
+            server.stat_aof_cow_bytes,
+            server.stat_aof_cow_peak,
+            server.forkless_save != NULL,
+            server.stat_forkless_early_keys);
+
+        /* Throughput of the last AOF load, at startup or DEBUG LOADAOF. */
+        if (server.aof_load_time) {
+            double secs = (double)server.aof_load_time/1000000;
+
+            info = sdscatprintf(info,
+                "aof_last_load_commands:%lld\r\n"
+                "aof_last_load_bytes:%lld\r\n"
+                "aof_last_load_time_usec:%lld\r\n"
+                "aof_last_load_cmds_per_sec:%.0f\r\n"
+                "aof_last_load_mb_per_sec:%.2f\r\n",
+                server.aof_load_commands,
+                server.aof_load_bytes,
+                server.aof_load_time,
+                server.aof_load_commands/secs,
+                server.aof_load_bytes/secs/(1024*1024));
+        }
 
         if (server.aof_state != REDIS_AOF_OFF) {
             info = sdscatprintf(info,
@@ -3173,16 +3966,20 @@ sds genRedisInfoString(char *section) {
                 "aof_base_size:%lld\r\n"
                 "aof_pending_rewrite:%d\r\n"
                 "aof_buffer_length:%zu\r\n"
-                "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_group_commits:%lld\r\n"
+                "aof_group_commit_buffer_length:%zu\r\n"
+                "aof_clients_waiting_fsync:%lu\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
-                aofRewriteBufferSize(),
                 bioPendingJobsOfType(REDIS_BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                server.stat_aof_group_commits,
+                aofWriterBufferSize(),
+                listLength(server.clients_waiting_aof));
         }
 
         if (server.loading) {
@@ -3231,12 +4028,30 @@ sds genRedisInfoString(char *section) {
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "eviction_samples:%lld\r\n"
+            "eviction_pool_ghosts:%lld\r\n"
+            "evicted_keys_avg_idle_ms:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
+            "pubsubshard_channels:%ld\r\n"
+            "pubsub_pattern_checks:%lld\r\n"
+            "pubsub_pattern_matches:%lld\r\n"
+            "tracking_total_keys:%llu\r\n"
+            "tracking_total_items:%llu\r\n"
+            "tracking_total_prefixes:%llu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "migrate_async_jobs:%lu\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "active_defrag_running:%d\r\n"
+            "active_defrag_hits:%lld\r\n"
+            "active_defrag_misses:%lld\r\n"
+            "active_defrag_key_hits:%lld\r\n"
+            "active_defrag_key_misses:%lld\r\n"
+            "argv_pool_hits:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getOperationsPerSecond(),
@@ -3246,12 +4061,31 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
+            server.stat_eviction_samples,
+            server.stat_eviction_ghosts,
+            server.stat_evicted_lru_keys ?
+                server.stat_evicted_idle_sum/server.stat_evicted_lru_keys : 0,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
+            dictSize(server.pubsubshard_channels),
+            server.stat_pubsub_pattern_checks,
+            server.stat_pubsub_pattern_matches,
+            (unsigned long long) trackingGetTotalKeys(),
+            (unsigned long long) trackingGetTotalItems(),
+            (unsigned long long) trackingGetTotalPrefixes(),
             server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets),
+            listLength(server.migrate_async_jobs),
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.active_defrag_running,
+            server.stat_active_defrag_hits,
+            server.stat_active_defrag_misses,
+            server.stat_active_defrag_key_hits,
+            server.stat_active_defrag_key_misses,
+            server.stat_argv_pool_hits);
     }
 
     /* Replication */
@@ -3276,6 +4110,7 @@ sds genRedisInfoString(char *section) {
                 "master_last_io_seconds_ago:%d\r\n"
                 "master_sync_in_progress:%d\r\n"
                 "slave_repl_offset:%lld\r\n"
+                "slave_read_lag_ms:%lld\r\n"
                 ,server.masterhost,
                 server.masterport,
                 (server.repl_state == REDIS_REPL_CONNECTED) ?
@@ -3283,7 +4118,8 @@ sds genRedisInfoString(char *section) {
                 server.master ?
                 ((int)(server.unixtime-server.master->lastinteraction)) : -1,
                 server.repl_state == REDIS_REPL_TRANSFER,
-                slave_repl_offset
+                slave_repl_offset,
+                replicationGetReadLag()
             );
 
             if (server.repl_state == REDIS_REPL_TRANSFER) {
@@ -3360,16 +4196,22 @@ sds genRedisInfoString(char *section) {
             }
         }
         info = sdscatprintf(info,
+            "master_replid:%s\r\n"
+            "master_replid2:%s\r\n"
             "master_repl_offset:%lld\r\n"
+            "second_repl_offset:%lld\r\n"
             "repl_backlog_active:%d\r\n"
             "repl_backlog_size:%lld\r\n"
             "repl_backlog_first_byte_offset:%lld\r\n"
             "repl_backlog_histlen:%lld\r\n",
+            server.replid,
+            server.replid2,
             server.master_repl_offset,
+            server.second_replid_offset,
             server.repl_backlog != NULL,
             server.repl_backlog_size,
-            server.repl_backlog_off,
-            server.repl_backlog_histlen);
+            server.repl_backlog ? server.repl_backlog->offset : 0,
+            server.repl_backlog ? server.repl_backlog->histlen : 0);
     }
 
     /* CPU */
@@ -3397,9 +4239,13 @@ sds genRedisInfoString(char *section) {
 
             if (!c->calls) continue;
             info = sdscatprintf(info,
-                "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f\r\n",
+                "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f"
+                ",p50=%lld,p99=%lld,p99.9=%lld\r\n",
                 c->name, c->calls, c->microseconds,
-                (c->calls == 0) ? 0 : ((float)c->microseconds/c->calls));
+                (c->calls == 0) ? 0 : ((float)c->microseconds/c->calls),
+                latencyHistogramPercentile(c->latency_histogram,50),
+                latencyHistogramPercentile(c->latency_histogram,99),
+                latencyHistogramPercentile(c->latency_histogram,99.9));
         }
     }
 
@@ -3412,6 +4258,13 @@ sds genRedisInfoString(char *section) {
         server.cluster_enabled);
     }
 
+    /* Hot keys */
+    if (allsections || defsections || !strcasecmp(section,"hotkeys")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info,"# Hotkeys\r\n");
+        info = genHotkeysInfoString(info);
+    }
+
     /* Key space */
     if (allsections || defsections || !strcasecmp(section,"keyspace")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -3431,20 +4284,309 @@ sds genRedisInfoString(char *section) {
     return info;
 }
 
+/* INFO [section ...]
+ *
+ * With more than one section the sections are concatenated, so that a
+ * client only interested in a few of them (Sentinel for instance) does
+ * not pay for generating and transferring the whole report. */
 void infoCommand(redisClient *c) {
-    char *section = c->argc == 2 ? c->argv[1]->ptr : "default";
+    sds info;
+    int j;
 
-    if (c->argc > 2) {
-        addReply(c,shared.syntaxerr);
-        return;
+    if (c->argc <= 2) {
+        info = genRedisInfoString(c->argc == 2 ? c->argv[1]->ptr : "default");
+    } else {
+        info = sdsempty();
+        for (j = 1; j < c->argc; j++) {
+            sds part = genRedisInfoString(c->argv[j]->ptr);
+
+            if (sdslen(info) && sdslen(part)) info = sdscatlen(info,"\r\n",2);
+            info = sdscatsds(info,part);
+            sdsfree(part);
+        }
     }
-    sds info = genRedisInfoString(section);
     addReplySds(c,sdscatprintf(sdsempty(),"$%lu\r\n",
         (unsigned long)sdslen(info)));
     addReplySds(c,info);
     addReply(c,shared.crlf);
 }
 
+/* METRICS [pattern ...]
+ *
+ * A compact and machine readable counterpart of INFO, for monitoring
+ * systems: the numerical fields of INFO are returned, with the same names,
+ * as a flat array of name / value pairs. Integers are integer replies and
+ * floating point numbers bulk strings, so nothing needs to be parsed.
+ * The command statistics are returned as cmdstat_<command>_<field> and the
+ * keyspace as db<id>_<field>.
+ *
+ * Only the metrics matching one of the glob style patterns are returned,
+ * all the metrics without arguments.
+ *
+ * 以 名字/值 的形式返回 INFO 中的数值字段，可以用模式选择要返回的字段 */
+typedef struct metricsReply {
+    redisClient *c;
+    robj **patterns;    /* Patterns, or NULL to reply with all the metrics. */
+    int numpatterns;
+    long count;         /* Number of metrics emitted. */
+} metricsReply;
+
+/* Return true if the metric 'name' was requested. */
+static int metricWanted(metricsReply *mr, char *name) {
+    int j;
+
+    if (mr->numpatterns == 0) return 1;
+    for (j = 0; j < mr->numpatterns; j++) {
+        robj *pattern = mr->patterns[j];
+
+        if (stringmatchlen(pattern->ptr,sdslen(pattern->ptr),
+                           name,strlen(name),1)) return 1;
+    }
+    return 0;
+}
+
+static void addReplyMetricLongLong(metricsReply *mr, char *name, long long v) {
+    if (!metricWanted(mr,name)) return;
+    addReplyBulkCString(mr->c,name);
+    addReplyLongLong(mr->c,v);
+    mr->count++;
+}
+
+static void addReplyMetricDouble(metricsReply *mr, char *name, double v) {
+    if (!metricWanted(mr,name)) return;
+    addReplyBulkCString(mr->c,name);
+    addReplyDouble(mr->c,v);
+    mr->count++;
+}
+
+void metricsCommand(redisClient *c) {
+    metricsReply mr = { c, c->argv+1, c->argc-1, 0 };
+    void *replylen = addDeferredMultiBulkLength(c);
+    time_t uptime = server.unixtime-server.stat_starttime;
+    size_t zmalloc_used = zmalloc_used_memory();
+    char name[128];
+    int j, numcommands;
+
+    if (zmalloc_used > server.stat_peak_memory)
+        server.stat_peak_memory = zmalloc_used;
+
+    /* Server */
+    addReplyMetricLongLong(&mr,"uptime_in_seconds",uptime);
+    addReplyMetricLongLong(&mr,"hz",server.hz);
+    addReplyMetricLongLong(&mr,"lru_clock",server.lruclock);
+
+    /* Clients: finding the biggest buffers means scanning the clients. */
+    addReplyMetricLongLong(&mr,"connected_clients",
+        listLength(server.clients)-listLength(server.slaves));
+    if (metricWanted(&mr,"client_longest_output_list") ||
+        metricWanted(&mr,"client_biggest_input_buf"))
+    {
+        unsigned long lol, bib;
+
+        getClientsMaxBuffers(&lol,&bib);
+        addReplyMetricLongLong(&mr,"client_longest_output_list",lol);
+        addReplyMetricLongLong(&mr,"client_biggest_input_buf",bib);
+    }
+    addReplyMetricLongLong(&mr,"blocked_clients",server.bpop_blocked_clients);
+
+    /* Memory */
+    addReplyMetricLongLong(&mr,"used_memory",zmalloc_used);
+    addReplyMetricLongLong(&mr,"used_memory_rss",server.resident_set_size);
+    addReplyMetricLongLong(&mr,"used_memory_peak",server.stat_peak_memory);
+    addReplyMetricLongLong(&mr,"used_memory_lua",
+        ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL);
+    addReplyMetricDouble(&mr,"mem_fragmentation_ratio",
+        zmalloc_get_fragmentation_ratio(server.resident_set_size));
+    addReplyMetricLongLong(&mr,"lazyfree_pending_objects",
+        lazyfreeGetPendingObjectsCount());
+
+    /* Persistence */
+    addReplyMetricLongLong(&mr,"loading",server.loading);
+    addReplyMetricLongLong(&mr,"rdb_changes_since_last_save",server.dirty);
+    addReplyMetricLongLong(&mr,"rdb_bgsave_in_progress",
+        server.rdb_child_pid != -1);
+    addReplyMetricLongLong(&mr,"rdb_last_save_time",server.lastsave);
+    addReplyMetricLongLong(&mr,"rdb_last_bgsave_status",
+        server.lastbgsave_status == REDIS_OK);
+    addReplyMetricLongLong(&mr,"rdb_last_bgsave_time_sec",
+        server.rdb_save_time_last);
+    addReplyMetricLongLong(&mr,"rdb_current_bgsave_time_sec",
+        (server.rdb_child_pid == -1) ?
+            -1 : time(NULL)-server.rdb_save_time_start);
+    addReplyMetricLongLong(&mr,"aof_enabled",server.aof_state != REDIS_AOF_OFF);
+    addReplyMetricLongLong(&mr,"aof_rewrite_in_progress",
+        server.aof_child_pid != -1);
+    addReplyMetricLongLong(&mr,"aof_rewrite_scheduled",
+        server.aof_rewrite_scheduled);
+    addReplyMetricLongLong(&mr,"aof_last_rewrite_time_sec",
+        server.aof_rewrite_time_last);
+    addReplyMetricLongLong(&mr,"aof_current_rewrite_time_sec",
+        (server.aof_child_pid == -1) ?
+            -1 : time(NULL)-server.aof_rewrite_time_start);
+    addReplyMetricLongLong(&mr,"aof_last_bgrewrite_status",
+        server.aof_lastbgrewrite_status == REDIS_OK);
+    addReplyMetricLongLong(&mr,"aof_last_write_status",
+        server.aof_last_write_status == REDIS_OK);
+    addReplyMetricLongLong(&mr,"current_cow_size",
+        server.stat_current_cow_bytes);
+    addReplyMetricLongLong(&mr,"rdb_last_cow_size",server.stat_rdb_cow_bytes);
+    addReplyMetricLongLong(&mr,"aof_last_cow_size",server.stat_aof_cow_bytes);
+    if (server.aof_state != REDIS_AOF_OFF) {
+        addReplyMetricLongLong(&mr,"aof_current_size",server.aof_current_size);
+        addReplyMetricLongLong(&mr,"aof_base_size",
+            server.aof_rewrite_base_size);
+        addReplyMetricLongLong(&mr,"aof_buffer_length",sdslen(server.aof_buf));
+        addReplyMetricLongLong(&mr,"aof_pending_bio_fsync",
+            bioPendingJobsOfType(REDIS_BIO_AOF_FSYNC));
+        addReplyMetricLongLong(&mr,"aof_delayed_fsync",
+            server.aof_delayed_fsync);
+        addReplyMetricLongLong(&mr,"aof_group_commits",
+            server.stat_aof_group_commits);
+    }
+    if (server.loading) {
+        addReplyMetricLongLong(&mr,"loading_total_bytes",
+            server.loading_total_bytes);
+        addReplyMetricLongLong(&mr,"loading_loaded_bytes",
+            server.loading_loaded_bytes);
+    }
+
+    /* Stats */
+    addReplyMetricLongLong(&mr,"total_connections_received",
+        server.stat_numconnections);
+    addReplyMetricLongLong(&mr,"total_commands_processed",
+        server.stat_numcommands);
+    addReplyMetricLongLong(&mr,"instantaneous_ops_per_sec",
+        getOperationsPerSecond());
+    addReplyMetricLongLong(&mr,"rejected_connections",
+        server.stat_rejected_conn);
+    addReplyMetricLongLong(&mr,"sync_full",server.stat_sync_full);
+    addReplyMetricLongLong(&mr,"sync_partial_ok",server.stat_sync_partial_ok);
+    addReplyMetricLongLong(&mr,"sync_partial_err",
+        server.stat_sync_partial_err);
+    addReplyMetricLongLong(&mr,"expired_keys",server.stat_expiredkeys);
+    addReplyMetricLongLong(&mr,"evicted_keys",server.stat_evictedkeys);
+    addReplyMetricLongLong(&mr,"eviction_samples",
+        server.stat_eviction_samples);
+    addReplyMetricLongLong(&mr,"eviction_pool_ghosts",
+        server.stat_eviction_ghosts);
+    addReplyMetricLongLong(&mr,"keyspace_hits",server.stat_keyspace_hits);
+    addReplyMetricLongLong(&mr,"keyspace_misses",server.stat_keyspace_misses);
+    addReplyMetricLongLong(&mr,"pubsub_channels",
+        dictSize(server.pubsub_channels));
+    addReplyMetricLongLong(&mr,"pubsub_patterns",
+        listLength(server.pubsub_patterns));
+    addReplyMetricLongLong(&mr,"pubsubshard_channels",
+        dictSize(server.pubsubshard_channels));
+    addReplyMetricLongLong(&mr,"pubsub_pattern_checks",
+        server.stat_pubsub_pattern_checks);
+    addReplyMetricLongLong(&mr,"pubsub_pattern_matches",
+        server.stat_pubsub_pattern_matches);
+    addReplyMetricLongLong(&mr,"latest_fork_usec",server.stat_fork_time);
+    addReplyMetricLongLong(&mr,"migrate_cached_sockets",
+        dictSize(server.migrate_cached_sockets));
+    addReplyMetricLongLong(&mr,"migrate_async_jobs",
+        listLength(server.migrate_async_jobs));
+    addReplyMetricLongLong(&mr,"io_threaded_reads_processed",
+        server.stat_io_reads_processed);
+    addReplyMetricLongLong(&mr,"io_threaded_writes_processed",
+        server.stat_io_writes_processed);
+    addReplyMetricLongLong(&mr,"active_defrag_running",
+        server.active_defrag_running);
+    addReplyMetricLongLong(&mr,"active_defrag_hits",
+        server.stat_active_defrag_hits);
+    addReplyMetricLongLong(&mr,"active_defrag_misses",
+        server.stat_active_defrag_misses);
+    addReplyMetricLongLong(&mr,"active_defrag_key_hits",
+        server.stat_active_defrag_key_hits);
+    addReplyMetricLongLong(&mr,"active_defrag_key_misses",
+        server.stat_active_defrag_key_misses);
+    addReplyMetricLongLong(&mr,"argv_pool_hits",server.stat_argv_pool_hits);
+
+    /* Replication */
+    if (server.masterhost) {
+        long long slave_repl_offset = 1;
+
+        if (server.master)
+            slave_repl_offset = server.master->reploff;
+        else if (server.cached_master)
+            slave_repl_offset = server.cached_master->reploff;
+        addReplyMetricLongLong(&mr,"master_link_status",
+            server.repl_state == REDIS_REPL_CONNECTED);
+        addReplyMetricLongLong(&mr,"master_last_io_seconds_ago",
+            server.master ?
+            ((int)(server.unixtime-server.master->lastinteraction)) : -1);
+        addReplyMetricLongLong(&mr,"master_sync_in_progress",
+            server.repl_state == REDIS_REPL_TRANSFER);
+        addReplyMetricLongLong(&mr,"slave_repl_offset",slave_repl_offset);
+        addReplyMetricLongLong(&mr,"slave_read_lag_ms",
+            replicationGetReadLag());
+    }
+    addReplyMetricLongLong(&mr,"connected_slaves",listLength(server.slaves));
+    addReplyMetricLongLong(&mr,"master_repl_offset",server.master_repl_offset);
+    addReplyMetricLongLong(&mr,"second_repl_offset",
+        server.second_replid_offset);
+    addReplyMetricLongLong(&mr,"repl_backlog_active",
+        server.repl_backlog != NULL);
+    addReplyMetricLongLong(&mr,"repl_backlog_size",server.repl_backlog_size);
+    addReplyMetricLongLong(&mr,"repl_backlog_first_byte_offset",
+        server.repl_backlog ? server.repl_backlog->offset : 0);
+    addReplyMetricLongLong(&mr,"repl_backlog_histlen",
+        server.repl_backlog ? server.repl_backlog->histlen : 0);
+
+    /* CPU */
+    {
+        struct rusage self_ru, c_ru;
+
+        getrusage(RUSAGE_SELF, &self_ru);
+        getrusage(RUSAGE_CHILDREN, &c_ru);
+        addReplyMetricDouble(&mr,"used_cpu_sys",
+            (double)self_ru.ru_stime.tv_sec+(double)self_ru.ru_stime.tv_usec/1000000);
+        addReplyMetricDouble(&mr,"used_cpu_user",
+            (double)self_ru.ru_utime.tv_sec+(double)self_ru.ru_utime.tv_usec/1000000);
+        addReplyMetricDouble(&mr,"used_cpu_sys_children",
+            (double)c_ru.ru_stime.tv_sec+(double)c_ru.ru_stime.tv_usec/1000000);
+        addReplyMetricDouble(&mr,"used_cpu_user_children",
+            (double)c_ru.ru_utime.tv_sec+(double)c_ru.ru_utime.tv_usec/1000000);
+    }
+
+    /* Commandstats: the percentiles are computed only when requested. */
+    numcommands = sizeof(redisCommandTable)/sizeof(struct redisCommand);
+    for (j = 0; j < numcommands; j++) {
+        struct redisCommand *cmd = redisCommandTable+j;
+
+        if (!cmd->calls) continue;
+        snprintf(name,sizeof(name),"cmdstat_%s_calls",cmd->name);
+        addReplyMetricLongLong(&mr,name,cmd->calls);
+        snprintf(name,sizeof(name),"cmdstat_%s_usec",cmd->name);
+        addReplyMetricLongLong(&mr,name,cmd->microseconds);
+        snprintf(name,sizeof(name),"cmdstat_%s_p50",cmd->name);
+        if (metricWanted(&mr,name)) addReplyMetricLongLong(&mr,name,
+            latencyHistogramPercentile(cmd->latency_histogram,50));
+        snprintf(name,sizeof(name),"cmdstat_%s_p99",cmd->name);
+        if (metricWanted(&mr,name)) addReplyMetricLongLong(&mr,name,
+            latencyHistogramPercentile(cmd->latency_histogram,99));
+        snprintf(name,sizeof(name),"cmdstat_%s_p99.9",cmd->name);
+        if (metricWanted(&mr,name)) addReplyMetricLongLong(&mr,name,
+            latencyHistogramPercentile(cmd->latency_histogram,99.9));
+    }
+
+    /* Keyspace */
+    for (j = 0; j < server.dbnum; j++) {
+        long long keys = dictSize(server.db[j].dict);
+        long long vkeys = dictSize(server.db[j].expires);
+
+        if (!keys && !vkeys) continue;
+        snprintf(name,sizeof(name),"db%d_keys",j);
+        addReplyMetricLongLong(&mr,name,keys);
+        snprintf(name,sizeof(name),"db%d_expires",j);
+        addReplyMetricLongLong(&mr,name,vkeys);
+        snprintf(name,sizeof(name),"db%d_avg_ttl",j);
+        addReplyMetricLongLong(&mr,name,server.db[j].avg_ttl);
+    }
+
+    setDeferredMultiBulkLength(c,replylen,mr.count*2);
+}
+
 void monitorCommand(redisClient *c) {
     /* ignore MONITOR if already slave or in monitor mode */
 
@@ -3511,8 +4653,13 @@ void monitorCommand(redisClient *c) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
-/* Create a new eviction pool. */
-struct evictionPoolEntry *evictionPoolAlloc(void) {
+/* The eviction pool shared by all the databases. */
+static struct evictionPoolEntry *EvictionPool;
+
+/* Create the eviction pool. The key names of the entries are copied into
+ * pre-allocated strings when they are short enough, since allocating and
+ * freeing them at every sampled key is measurable. */
+void evictionPoolAlloc(void) {
     struct evictionPoolEntry *ep;
     int j;
 
@@ -3520,8 +4667,10 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
     for (j = 0; j < REDIS_EVICTION_POOL_SIZE; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
+        ep[j].cached = sdsnewlen(NULL,REDIS_EVICTION_POOL_CACHED_SDS_SIZE);
+        ep[j].dbid = 0;
     }
-    return ep;
+    EvictionPool = ep;
 }
 
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
@@ -3531,11 +4680,14 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
  *
  * We insert keys on place in ascending order, so keys with the smaller
  * idle time are on the left, and keys with the higher idle time on the
- * right. */
+ * right. Empty entries are always on the right.
+ *
+ * 'dbid' is the DB of 'keydict', recorded in the entries, since the same
+ * pool is filled with the keys sampled from every DB. */
 
 #define EVICTION_SAMPLES_ARRAY_SIZE 16
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
-    int j, k, count;
+void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+    int j, k, d, count;
     dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
     dictEntry **samples;
 
@@ -3547,27 +4699,39 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
         samples = zmalloc(sizeof(samples[0])*server.maxmemory_samples);
     }
 
-#if 1 /* Use bulk get by default. */
     count = dictGetRandomKeys(sampledict,samples,server.maxmemory_samples);
-#else
-    count = server.maxmemory_samples;
-    for (j = 0; j < count; j++) samples[j] = dictGetRandomKey(sampledict);
-#endif
+    server.stat_eviction_samples += count;
 
     for (j = 0; j < count; j++) {
         unsigned long long idle;
+        size_t keylen;
         sds key;
         robj *o;
         dictEntry *de;
 
         de = samples[j];
         key = dictGetKey(de);
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (sampledict != keydict) de = dictFind(keydict, key);
-        o = dictGetVal(de);
-        idle = estimateObjectIdleTime(o);
+
+        /* The pool is sorted by 'idle', where a higher value means a
+         * better candidate for eviction. With LFU we invert the access
+         * frequency so that the least used keys are at the right, and
+         * with volatile-ttl we invert the expire time so that the keys
+         * expiring sooner are at the right. */
+        // LFU 策略下用 255 减去访问频率作为 idle 值，频率越低越先被淘汰
+        if (server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL) {
+            /* The expire time is the value of the expires dictionary. */
+            idle = ULLONG_MAX - (unsigned long long)dictGetSignedIntegerVal(de);
+        } else {
+            /* If the dictionary we are sampling from is not the main
+             * dictionary (but the expires one) we need to lookup the key
+             * again in the key dictionary to obtain the value object. */
+            if (sampledict != keydict) de = dictFind(keydict, key);
+            o = dictGetVal(de);
+            if (maxmemoryPolicyIsLFU())
+                idle = 255-LFUDecrAndReturn(o);
+            else
+                idle = estimateObjectIdleTime(o);
+        }
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
@@ -3580,7 +4744,17 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
             /* Can't insert if the element is < the worst element we have
              * and there are no empty buckets. */
             continue;
-        } else if (k < REDIS_EVICTION_POOL_SIZE && pool[k].key == NULL) {
+        }
+
+        /* The sampled key may already be in the pool, sampled by a
+         * previous call: don't waste an entry for a copy of it. */
+        // 同一个键被重复采样时，不要在淘汰池中保存它的多个副本
+        for (d = 0; d < REDIS_EVICTION_POOL_SIZE && pool[d].key; d++) {
+            if (pool[d].dbid == dbid && sdscmp(pool[d].key,key) == 0) break;
+        }
+        if (d < REDIS_EVICTION_POOL_SIZE && pool[d].key) continue;
+
+        if (k < REDIS_EVICTION_POOL_SIZE && pool[k].key == NULL) {
             /* Inserting into empty position. No setup needed before insert. */
         } else {
             /* Inserting in the middle. Now k points to the first element
@@ -3588,51 +4762,87 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
             if (pool[REDIS_EVICTION_POOL_SIZE-1].key == NULL) {
                 /* Free space on the right? Insert at k shifting
                  * all the elements from k to end to the right. */
+                sds cached = pool[REDIS_EVICTION_POOL_SIZE-1].cached;
+
                 memmove(pool+k+1,pool+k,
                     sizeof(pool[0])*(REDIS_EVICTION_POOL_SIZE-k-1));
+                pool[k].cached = cached;
             } else {
                 /* No free space on right? Insert at k-1 */
+                sds cached = pool[0].cached;
+
                 k--;
                 /* Shift all elements on the left of k (included) to the
                  * left, so we discard the element with smaller idle time. */
-                sdsfree(pool[0].key);
+                if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
                 memmove(pool,pool+1,sizeof(pool[0])*k);
+                pool[k].cached = cached;
             }
         }
-        pool[k].key = sdsdup(key);
+
+        /* Reuse the string allocated in the entry if the key fits. */
+        keylen = sdslen(key);
+        if (keylen > REDIS_EVICTION_POOL_CACHED_SDS_SIZE) {
+            pool[k].key = sdsdup(key);
+        } else {
+            memcpy(pool[k].cached,key,keylen+1);
+            sdssetlen(pool[k].cached,keylen);
+            pool[k].key = pool[k].cached;
+        }
         pool[k].idle = idle;
+        pool[k].dbid = dbid;
     }
     if (samples != _samples) zfree(samples);
 }
 
-int freeMemoryIfNeeded(void) {
-    size_t mem_used, mem_tofree, mem_freed;
-    int slaves = listLength(server.slaves);
+/* Return the amount of used memory, not counting the size of slaves
+ * output buffers and AOF buffers, which are not considered by maxmemory.
+ *
+ * 计算出 Redis 目前占用的内存总数，但有两个方面的内存不会计算在内：
+ * 1） slave 的输出缓冲区的内存
+ * 2）AOF 缓冲区的内存
+ */
+static size_t freeMemoryGetUsedMemory(void) {
+    size_t mem_used = zmalloc_used_memory();
 
-    /* Remove the size of slaves output buffers and AOF buffer from the
-     * count of used memory. */
-    // 计算出 Redis 目前占用的内存总数，但有两个方面的内存不会计算在内：
-    // 1） slave 的输出缓冲区的内存
-    // 2）AOF 缓冲区的内存
-    mem_used = zmalloc_used_memory();
-    if (slaves) {
+    if (listLength(server.slaves)) {
         listIter li;
         listNode *ln;
 
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             redisClient *slave = listNodeValue(ln);
-            unsigned long obuf_bytes = getClientOutputBufferMemoryUsage(slave);
+            unsigned long obuf_bytes = getClientOutputBufferMemoryUsage(slave) -
+                getReplicaReplicationBufferMemoryUsage(slave);
             if (obuf_bytes > mem_used)
                 mem_used = 0;
             else
                 mem_used -= obuf_bytes;
         }
+
+        /* The shared replication buffer exceeding the backlog size is
+         * only there because of the slaves. */
+        if ((long long)server.repl_buffer_mem > server.repl_backlog_size) {
+            size_t excess = server.repl_buffer_mem - server.repl_backlog_size;
+            mem_used = (excess > mem_used) ? 0 : mem_used - excess;
+        }
     }
     if (server.aof_state != REDIS_AOF_OFF) {
         mem_used -= sdslen(server.aof_buf);
-        mem_used -= aofRewriteBufferSize();
+        mem_used -= aofWriterBufferSize();
     }
+    return mem_used;
+}
+
+int freeMemoryIfNeeded(void) {
+    size_t mem_used, mem_tofree, mem_freed;
+    int slaves = listLength(server.slaves);
+    long long total_keys_freed = 0;
+    mstime_t latency, eviction_latency;
+
+    /* Remove the size of slaves output buffers and AOF buffer from the
+     * count of used memory. */
+    mem_used = freeMemoryGetUsedMemory();
 
     /* Check if we are over the memory limit. */
     // 如果目前使用的内存大小比设置的 maxmemory 要小，那么无须执行进一步操作
@@ -3651,138 +4861,182 @@ int freeMemoryIfNeeded(void) {
 
     // 根据 maxmemory 策略，
     // 遍历字典，释放内存并记录被释放内存的字节数
+    latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, keys_freed = 0;
-
-        // 遍历所有字典
-        for (j = 0; j < server.dbnum; j++) {
-            long bestval = 0; /* just to prevent warning */
-            sds bestkey = NULL;
-            dictEntry *de;
-            redisDb *db = server.db+j;
-            dict *dict;
-
-            if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM)
-            {
-                // 如果策略是 allkeys-lru 或者 allkeys-random 
-                // 那么淘汰的目标为所有数据库键
-                dict = server.db[j].dict;
-            } else {
-                // 如果策略是 volatile-lru 、 volatile-random 或者 volatile-ttl 
-                // 那么淘汰的目标为带过期时间的数据库键
-                dict = server.db[j].expires;
-            }
-
-            // 跳过空字典
-            if (dictSize(dict) == 0) continue;
-
-            /* volatile-random and allkeys-random policy */
-            // 如果使用的是随机策略，那么从目标字典中随机选出键
-            if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM)
-            {
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
-            }
-
-            /* volatile-lru and allkeys-lru policy */
-            // 如果使用的是 LRU 策略，
-            // 那么从一集 sample 键中选出 IDLE 时间最长的那个键
-            else if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_LRU)
-            {
-                struct evictionPoolEntry *pool = db->eviction_pool;
-
-                while(bestkey == NULL) {
-                    evictionPoolPopulate(dict, db->dict, db->eviction_pool);
-                    /* Go backward from best to worst element to evict. */
-                    for (k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--) {
-                        if (pool[k].key == NULL) continue;
-                        de = dictFind(dict,pool[k].key);
+        int j, k, i, keys_freed = 0;
+        static unsigned int next_db = 0;
+        int allkeys = (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
+                       server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LFU ||
+                       server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM);
+        unsigned long long bestidle = 0;
+        sds bestkey = NULL;
+        int bestdbid = 0;
+        redisDb *db;
+        dict *dict;
+        dictEntry *de;
 
-                        /* Remove the entry from the pool. */
+        // 如果策略是 allkeys-lru 、 allkeys-lfu 或者 allkeys-random
+        // 那么淘汰的目标为所有数据库键，
+        // 否则淘汰的目标为带过期时间的数据库键
+
+        /* volatile-lru, allkeys-lru, volatile-lfu, allkeys-lfu and
+         * volatile-ttl */
+        // 使用全局淘汰池，从所有数据库的 sample 键中选出最适合淘汰的键
+        if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
+            server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_LRU ||
+            server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL ||
+            maxmemoryPolicyIsLFU())
+        {
+            struct evictionPoolEntry *pool = EvictionPool;
+
+            while(bestkey == NULL) {
+                unsigned long total_keys = 0, keys;
+
+                /* We don't want to make local-db choices when evicting
+                 * keys, so to start populate the eviction pool sampling
+                 * keys from every DB. */
+                for (i = 0; i < server.dbnum; i++) {
+                    db = server.db+i;
+                    dict = allkeys ? db->dict : db->expires;
+                    if ((keys = dictSize(dict)) != 0) {
+                        evictionPoolPopulate(i, dict, db->dict, pool);
+                        total_keys += keys;
+                    }
+                }
+                if (!total_keys) break; /* No keys to evict. */
+
+                /* Go backward from best to worst element to evict. */
+                for (k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+                    if (pool[k].key == NULL) continue;
+                    bestdbid = pool[k].dbid;
+                    bestidle = pool[k].idle;
+                    db = server.db+bestdbid;
+                    de = dictFind(allkeys ? db->dict : db->expires,
+                                  pool[k].key);
+
+                    /* Remove the entry from the pool. Since we go from
+                     * the right, the empty entries stay on the right. */
+                    if (pool[k].key != pool[k].cached)
                         sdsfree(pool[k].key);
-                        /* Shift all elements on its right to left. */
-                        memmove(pool+k,pool+k+1,
-                            sizeof(pool[0])*(REDIS_EVICTION_POOL_SIZE-k-1));
-                        /* Clear the element on the right which is empty
-                         * since we shifted one position to the left.  */
-                        pool[REDIS_EVICTION_POOL_SIZE-1].key = NULL;
-                        pool[REDIS_EVICTION_POOL_SIZE-1].idle = 0;
-
-                        /* If the key exists, is our pick. Otherwise it is
-                         * a ghost and we need to try the next element. */
-                        if (de) {
-                            bestkey = dictGetKey(de);
-                            break;
-                        } else {
-                            /* Ghost... */
-                            continue;
-                        }
+                    pool[k].key = NULL;
+                    pool[k].idle = 0;
+
+                    /* If the key exists, is our pick. Otherwise it is
+                     * a ghost and we need to try the next element. */
+                    if (de) {
+                        bestkey = dictGetKey(de);
+                        break;
+                    } else {
+                        /* Ghost... */
+                        server.stat_eviction_ghosts++;
                     }
                 }
             }
+        }
 
-            /* volatile-ttl */
-            // 策略为 volatile-ttl ，从一集 sample 键中选出过期时间距离当前时间最接近的键
-            else if (server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL) {
-                for (k = 0; k < server.maxmemory_samples; k++) {
-                    sds thiskey;
-                    long thisval;
-
+        /* volatile-random and allkeys-random policy */
+        // 如果使用的是随机策略，那么依次从各个数据库中随机选出键
+        else if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
+                 server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM)
+        {
+            /* When evicting a random key, we try to evict a key for
+             * each DB, so we use the static 'next_db' variable to
+             * incrementally visit all DBs. */
+            for (i = 0; i < server.dbnum; i++) {
+                j = (++next_db) % server.dbnum;
+                db = server.db+j;
+                dict = allkeys ? db->dict : db->expires;
+                if (dictSize(dict) != 0) {
                     de = dictGetRandomKey(dict);
-                    thiskey = dictGetKey(de);
-                    thisval = (long) dictGetVal(de);
-
-                    /* Expire sooner (minor expire unix timestamp) is better
-                     * candidate for deletion */
-                    if (bestkey == NULL || thisval < bestval) {
-                        bestkey = thiskey;
-                        bestval = thisval;
-                    }
+                    bestkey = dictGetKey(de);
+                    bestdbid = j;
+                    break;
                 }
             }
+        }
 
-            /* Finally remove the selected key. */
-            // 删除被选中的键
-            if (bestkey) {
-                long long delta;
-
-                robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-                propagateExpire(db,keyobj);
-                /* We compute the amount of memory freed by dbDelete() alone.
-                 * It is possible that actually the memory needed to propagate
-                 * the DEL in AOF and replication link is greater than the one
-                 * we are freeing removing the key, but we can't account for
-                 * that otherwise we would never exit the loop.
-                 *
-                 * AOF and Output buffer memory will be freed eventually so
-                 * we only care about memory used by the key space. */
-                // 计算删除键所释放的内存数量
-                delta = (long long) zmalloc_used_memory();
-                dbDelete(db,keyobj);
-                delta -= (long long) zmalloc_used_memory();
-                mem_freed += delta;
-                
-                // 对淘汰键的计数器增一
-                server.stat_evictedkeys++;
-
-                notifyKeyspaceEvent(REDIS_NOTIFY_EVICTED, "evicted",
-                    keyobj, db->id);
-                decrRefCount(keyobj);
-                keys_freed++;
-
-                /* When the memory to free starts to be big enough, we may
-                 * start spending so much time here that is impossible to
-                 * deliver data to the slaves fast enough, so we force the
-                 * transmission here inside the loop. */
-                if (slaves) flushSlavesOutputBuffers();
+        /* Finally remove the selected key. */
+        // 删除被选中的键
+        if (bestkey) {
+            long long delta;
+            robj *keyobj;
+
+            db = server.db+bestdbid;
+            keyobj = createStringObject(bestkey,sdslen(bestkey));
+            propagateExpire(db,keyobj);
+            /* We compute the amount of memory freed by dbDelete() alone.
+             * It is possible that actually the memory needed to propagate
+             * the DEL in AOF and replication link is greater than the one
+             * we are freeing removing the key, but we can't account for
+             * that otherwise we would never exit the loop.
+             *
+             * AOF and Output buffer memory will be freed eventually so
+             * we only care about memory used by the key space. */
+            // 计算删除键所释放的内存数量
+            delta = (long long) zmalloc_used_memory();
+            latencyStartMonitor(eviction_latency);
+            if (server.lazyfree_lazy_eviction)
+                dbAsyncDelete(db,keyobj);
+            else
+                dbSyncDelete(db,keyobj);
+            latencyEndMonitor(eviction_latency);
+            trackingInvalidateKey(keyobj);
+            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+            latencyRemoveNestedEvent(latency,eviction_latency);
+            delta -= (long long) zmalloc_used_memory();
+            mem_freed += delta;
+
+            // 对淘汰键的计数器增一
+            server.stat_evictedkeys++;
+            if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
+                server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_LRU)
+            {
+                server.stat_evicted_idle_sum += bestidle;
+                server.stat_evicted_lru_keys++;
+            }
+
+            notifyKeyspaceEvent(REDIS_NOTIFY_EVICTED, "evicted",
+                keyobj, db->id);
+            decrRefCount(keyobj);
+            keys_freed++;
+            total_keys_freed++;
+
+            /* When the memory to free starts to be big enough, we may
+             * start spending so much time here that is impossible to
+             * deliver data to the slaves fast enough, so we force the
+             * transmission here inside the loop. */
+            if (slaves) flushSlavesOutputBuffers();
+
+            /* With lazy eviction the memory of big values is released
+             * by the bio thread, so delta above is not accurate: from
+             * time to time check if we already reached the target. */
+            // 惰性淘汰时，键的内存由后台线程释放，需要定期检查实际的内存占用
+            if (server.lazyfree_lazy_eviction && !(total_keys_freed % 16)) {
+                if (freeMemoryGetUsedMemory() <= server.maxmemory)
+                    mem_freed = mem_tofree;
             }
         }
 
-        if (!keys_freed) return REDIS_ERR; /* nothing to free... */
+        if (!keys_freed) {
+            /* Nothing left to evict, but the bio thread may still be
+             * releasing memory of evicted keys: wait for it before to give
+             * up. */
+            // 没有键可以淘汰了，等待后台线程释放已经被淘汰的键
+            int retval = REDIS_ERR; /* nothing to free... */
+
+            while (lazyfreeInProgress()) {
+                if (freeMemoryGetUsedMemory() <= server.maxmemory) break;
+                usleep(1000);
+            }
+            if (freeMemoryGetUsedMemory() <= server.maxmemory)
+                retval = REDIS_OK;
+            latencyEndMonitor(latency);
+            latencyAddSampleIfNeeded("eviction-cycle",latency);
+            return retval;
+        }
     }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("eviction-cycle",latency);
 
     return REDIS_OK;
 }
@@ -3853,7 +5107,8 @@ void usage() {
     fprintf(stderr,"       ./redis-server - (read config from stdin)\n");
     fprintf(stderr,"       ./redis-server -v or --version\n");
     fprintf(stderr,"       ./redis-server -h or --help\n");
-    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n\n");
+    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n");
+    fprintf(stderr,"       ./redis-server --microbench [<filter>] [<count>]\n\n");
     fprintf(stderr,"Examples:\n");
     fprintf(stderr,"       ./redis-server (run the server with default conf)\n");
     fprintf(stderr,"       ./redis-server /etc/redis/6379.conf\n");
@@ -3918,6 +5173,7 @@ void setupSignalHandlers(void) {
 }
 
 void memtest(size_t megabytes, int passes);
+void microbenchMain(int argc, char **argv);
 
 /* Returns 1 if there is --sentinel among the arguments or if
  * argv[0] is exactly "redis-sentinel". */
@@ -3938,16 +5194,33 @@ void loadDataFromDisk(void) {
     // AOF 持久化已打开？
     if (server.aof_state == REDIS_AOF_ON) {
         // 尝试载入 AOF 文件
-        if (loadAppendOnlyFile(server.aof_filename) == REDIS_OK)
+        if (loadAppendOnlyFiles(server.aof_manifest) == REDIS_OK)
             // 打印载入信息，并计算载入耗时长度
             redisLog(REDIS_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     // AOF 持久化未打开
     } else {
+        rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+
         // 尝试载入 RDB 文件
-        if (rdbLoad(server.rdb_filename) == REDIS_OK) {
+        if (rdbLoad(server.rdb_filename,&rsi) == REDIS_OK) {
             // 打印载入信息，并计算载入耗时长度
             redisLog(REDIS_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
+
+            /* Restore the replication ID / offset from the RDB file: as a
+             * slave we can then try a partial resynchronization with our
+             * master instead of a full one. */
+            // slave 重启之后，使用 RDB 中的复制信息尝试 PSYNC
+            if (server.masterhost &&
+                rsi.repl_id_is_set &&
+                rsi.repl_offset != -1 &&
+                rsi.repl_stream_db != -1)
+            {
+                memcpy(server.replid,rsi.repl_id,sizeof(server.replid));
+                server.master_repl_offset = rsi.repl_offset;
+                replicationCacheMasterUsingMyself();
+                selectDb(server.cached_master,rsi.repl_stream_db);
+            }
         } else if (errno != ENOENT) {
             redisLog(REDIS_WARNING,"Fatal error loading the DB: %s. Exiting.",strerror(errno));
             exit(1);
@@ -3979,7 +5252,7 @@ void redisSetProcTitle(char *title) {
 }
 
 int main(int argc, char **argv) {
-    struct timeval tv;
+    char hashseed[16];
 
     /* We need to initialize our libraries, and the server configuration. */
     // 初始化库
@@ -3990,8 +5263,9 @@ int main(int argc, char **argv) {
     zmalloc_enable_thread_safeness();
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
     srand(time(NULL)^getpid());
-    gettimeofday(&tv,NULL);
-    dictSetHashFunctionSeed(tv.tv_sec^tv.tv_usec^getpid());
+    getRandomHexChars(hashseed,sizeof(hashseed));
+    dictSetHashFunctionSeed((uint8_t*)hashseed);
+    crc64_init();
 
     // 检查服务器是否以 Sentinel 模式启动
     server.sentinel_mode = checkForSentinelMode(argc,argv);
@@ -4032,6 +5306,10 @@ int main(int argc, char **argv) {
                 exit(1);
             }
         }
+        if (strcmp(argv[1], "--microbench") == 0) {
+            microbenchMain(argc,argv);
+            exit(0);
+        }
 
         /* First argument is the config file name? */
         // 如果第一个参数（argv[1]）不是以 "--" 开头
@@ -4075,6 +5353,12 @@ int main(int argc, char **argv) {
     // 将服务器设置为守护进程
     if (server.daemonize) daemonize();
 
+    /* Pin the main thread and bind the memory before initServer(): the
+     * threads created from now on inherit the CPU list, and the memory
+     * policy applies to all the allocations that follow. */
+    redisSetCpuAffinity(server.server_cpulist);
+    if (server.numa_bind_memory) redisBindMemoryToLocalNode();
+
     // 创建并初始化服务器数据结构
     initServer();
 
@@ -4096,8 +5380,14 @@ int main(int argc, char **argv) {
         // 打印内存警告
         linuxOvercommitMemoryWarning();
     #endif
+        // 载入配置文件指定的模块，模块的数据类型要在载入数据之前注册
+        moduleLoadFromQueue();
+        // 读取 AOF manifest ，必要时把旧的单文件 AOF 升级到 AOF 目录
+        aofLoadManifestFromDisk();
         // 从 AOF 文件或者 RDB 文件中载入数据
         loadDataFromDisk();
+        // 打开（或新建）用于追加写入的 INCR AOF 文件
+        aofOpenIfNeededOnServerStart();
         // 启动集群？
         if (server.cluster_enabled) {
             if (verifyClusterConfigWithData() == REDIS_ERR) {
@@ -4125,6 +5415,7 @@ int main(int argc, char **argv) {
 
     // 运行事件处理器，一直到服务器关闭为止
     aeSetBeforeSleepProc(server.el,beforeSleep);
+    aeSetAfterSleepProc(server.el,afterSleep);
     aeMain(server.el);
 
     // 服务器关闭，停止事件循环
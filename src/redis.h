@@ -48,9 +48,12 @@
 #include <pthread.h>
 #include <syslog.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include <lua.h>
 #include <signal.h>
 
+typedef long long mstime_t; /* millisecond time type. */
+
 #include "ae.h"      /* Event driven programming library */
 #include "sds.h"     /* Dynamic safe strings */
 #include "dict.h"    /* Hash tables */
@@ -58,9 +61,16 @@
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list without cascading updates */
+#include "quicklist.h" /* Lists are encoded as a linked list of listpacks */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
+#include "latency.h" /* Latency monitor API */
+#include "sparkline.h" /* ASCII graphs API */
+
+#define REDISMODULE_CORE 1
+#include "redismodule.h" /* Redis modules API defines. */
 
 /* Error codes */
 #define REDIS_OK                0
@@ -78,6 +88,13 @@
 #define REDIS_CONFIGLINE_MAX    1024
 #define REDIS_DBCRON_DBS_PER_CALL 16
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
+#define REDIS_CLIENT_USAGE_MAX_NAMES 1024 /* Names tracked by CLIENT USAGE */
+/* Max number of buffers gathered by a single writev() of the replies. */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define REDIS_IOV_MAX IOV_MAX
+#else
+#define REDIS_IOV_MAX 1024
+#endif
 #define REDIS_SHARED_SELECT_CMDS 10
 #define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
@@ -87,38 +104,75 @@
 #define REDIS_AOF_REWRITE_ITEMS_PER_CMD 64
 #define REDIS_SLOWLOG_LOG_SLOWER_THAN 10000
 #define REDIS_SLOWLOG_MAX_LEN 128
+#define REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD 0 /* Latency monitor disabled */
 #define REDIS_MAX_CLIENTS 10000
 #define REDIS_AUTHPASS_MAX_LEN 512
 #define REDIS_DEFAULT_SLAVE_PRIORITY 100
 #define REDIS_REPL_TIMEOUT 60
 #define REDIS_REPL_PING_SLAVE_PERIOD 10
+#define REDIS_DEFAULT_REPL_HEARTBEAT_PERIOD 100     /* Milliseconds */
 #define REDIS_RUN_ID_SIZE 40
+#define REDIS_EOF_MARK_SIZE 40
 #define REDIS_OPS_SEC_SAMPLES 16
 #define REDIS_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
 #define REDIS_DEFAULT_REPL_BACKLOG_TIME_LIMIT (60*60)  /* 1 hour */
 #define REDIS_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
+#define REDIS_REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 64 /* Blocks freed per trim call */
 #define REDIS_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define REDIS_DEFAULT_PID_FILE "/var/run/redis.pid"
 #define REDIS_DEFAULT_SYSLOG_IDENT "redis"
 #define REDIS_DEFAULT_CLUSTER_CONFIG_FILE "nodes.conf"
 #define REDIS_DEFAULT_DAEMONIZE 0
 #define REDIS_DEFAULT_UNIX_SOCKET_PERM 0
+#define REDIS_DEFAULT_SHM_TRANSPORT 0
+#define REDIS_SHM_TRANSPORT_DIR "/dev/shm"
 #define REDIS_DEFAULT_TCP_KEEPALIVE 0
+#define REDIS_DEFAULT_TCP_REUSEPORT 0
+#define REDIS_DEFAULT_TCP_DEFER_ACCEPT 0
+#define REDIS_DEFAULT_MAX_ACCEPTS_PER_CALL 1000
 #define REDIS_DEFAULT_LOGFILE ""
 #define REDIS_DEFAULT_SYSLOG_ENABLED 0
 #define REDIS_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define REDIS_DEFAULT_RDB_COMPRESSION 1
+#define REDIS_DEFAULT_RDB_COMPRESSION_CODEC REDIS_RDB_CODEC_LZF
 #define REDIS_DEFAULT_RDB_CHECKSUM 1
 #define REDIS_DEFAULT_RDB_FILENAME "dump.rdb"
 #define REDIS_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define REDIS_DEFAULT_SLAVE_READ_ONLY 1
+#define REDIS_DEFAULT_SLAVE_LAZY_FLUSH 0
 #define REDIS_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
+#define REDIS_DEFAULT_REPL_DISKLESS_SYNC 0
+#define REDIS_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define REDIS_DEFAULT_REPL_COMPRESSION 0
+
+/* Slave diskless load: how the RDB received from the master is loaded. */
+#define REDIS_REPL_DISKLESS_LOAD_DISABLED 0   /* Store it on disk first. */
+#define REDIS_REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1 /* From socket if no keys. */
+#define REDIS_REPL_DISKLESS_LOAD_SWAPDB 2     /* From socket, keep old data. */
+#define REDIS_DEFAULT_REPL_DISKLESS_LOAD REDIS_REPL_DISKLESS_LOAD_DISABLED
 #define REDIS_DEFAULT_MAXMEMORY 0
 #define REDIS_DEFAULT_MAXMEMORY_SAMPLES 5
+#define REDIS_DEFAULT_LAZYFREE_LAZY_EVICTION 0
+#define REDIS_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
+#define REDIS_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define REDIS_DEFAULT_ACTIVE_DEFRAG 0
+#define REDIS_DEFAULT_ACTIVE_EXPIRE_INDEX 0
+#define REDIS_DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000 /* 1M keys max. */
+#define REDIS_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
+#define REDIS_DEFAULT_DEFRAG_THRESHOLD_UPPER 100 /* maximum defrag force at 100% fragmentation */
+#define REDIS_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
+#define REDIS_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
+#define REDIS_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
 #define REDIS_DEFAULT_AOF_FILENAME "appendonly.aof"
+#define REDIS_DEFAULT_AOF_DIRNAME "appendonlydir"
 #define REDIS_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define REDIS_DEFAULT_ACTIVE_REHASHING 1
+#define REDIS_DEFAULT_FORK_FRIENDLY 1
+#define REDIS_DEFAULT_RDB_FORKLESS 0
 #define REDIS_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
+#define REDIS_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC 1
+#define REDIS_DEFAULT_AOF_USE_RDB_PREAMBLE 0
+#define REDIS_DEFAULT_AOF_GROUP_COMMIT 1
 #define REDIS_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define REDIS_DEFAULT_MIN_SLAVES_MAX_LAG 10
 #define REDIS_IP_STR_LEN INET6_ADDRSTRLEN
@@ -127,23 +181,40 @@
 // It also reserves a number of file. why 32 ? That is the number of file descriptors Redis reserves for internal uses
 /* REDIS_MIN_RESERVED_FDS for extra operations of persistence, listening sockets, log files and so forth. */
 #define REDIS_MIN_RESERVED_FDS 32
+#define REDIS_DEFAULT_IO_THREADS_NUM 1          /* Single threaded by default */
+#define REDIS_DEFAULT_IO_THREADS_DO_READS 0     /* Read + parse from threads? */
+#define REDIS_DEFAULT_NUMA_BIND_MEMORY 0
+#define REDIS_IO_THREADS_MAX_NUM 128
+#define REDIS_DEFAULT_RDB_LOAD_THREADS 1        /* Load RDB files sequentially */
+#define REDIS_RDB_LOAD_THREADS_MAX_NUM 64
+
+/* Make sure we have enough stack to perform all the things we do in the
+ * main thread, also in the background and I/O threads.
+ *
+ * 子线程栈大小
+ */
+#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
+#define EXPIRE_INDEX_TIME_LEN 8 /* Expire time prefix of expire index keys. */
 
 /* Protocol and I/O related defines */
 #define REDIS_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define REDIS_REPLY_MIN_BYTES   (1024)    /* Smallest resized output buffer */
+#define REDIS_ARGV_POOL_SIZE    16        /* Argument objects kept per client */
+#define REDIS_REPLY_ZEROCOPY_BYTES (4*1024) /* Reply by reference from 4k */
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
 #define REDIS_LONGSTR_SIZE      21          /* Bytes needed for long -> str */
 // 指示 AOF 程序每累积这个量的写入数据
 // 就执行一次显式的 fsync
-#define REDIS_AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
+#define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 /* When configuring the Redis eventloop, we setup it so that the total number
  * of file descriptors we can handle are server.maxclients + RESERVED_FDS + FDSET_INCR
  * that is our safety margin. */
@@ -190,26 +261,43 @@
 #define REDIS_SET 2
 #define REDIS_ZSET 3
 #define REDIS_HASH 4
+#define REDIS_STREAM 5
+#define REDIS_MODULE 6      /* Value of a data type defined by a module. */
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
  * is set to one of this fields for this object. */
 // 对象编码
-// 整体压缩编码方式：REDIS_ENCODING_ZIPLIST，REDIS_ENCODING_INTSET，采用独立的编解码函数 zipTryEncoding(), _intsetSet()
+// 整体压缩编码方式：REDIS_ENCODING_LISTPACK，REDIS_ENCODING_INTSET，采用独立的编解码函数 zipTryEncoding(), _intsetSet()
 // 可进行独立压缩编码的 obj：REDIS_ENCODING_RAW，REDIS_ENCODING_INT，REDIS_ENCODING_EMBSTR，采用统一的 tryObjectEncoding() 进行转发
 #define REDIS_ENCODING_RAW 0        /* Raw representation, 初始化默认类型，ptr 有可能指向的是 sds（可能是 string，也可能是一个很长的数值转成的 string） */
 #define REDIS_ENCODING_INT 1        /* Encoded as integer, data 部分直接占用 ptr 的内存（8 byte） */
 #define REDIS_ENCODING_HT 2         /* Encoded as hash table */
 #define REDIS_ENCODING_ZIPMAP 3     /* Encoded as zipmap */
-#define REDIS_ENCODING_LINKEDLIST 4 /* Encoded as regular linked list */
+#define REDIS_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
 
-// 采用 REDIS_ENCODING_ZIPLIST 方式编码的 REDIS_HT，REDIS_ZSET，会将 field\score、value\member 顺序的 push-tail 进 ziplist 中
-#define REDIS_ENCODING_ZIPLIST 5    /* Encoded as ziplist */
+// ziplist 只在载入旧版本 RDB 时使用，载入后都会转换成 listpack
+#define REDIS_ENCODING_ZIPLIST 5    /* Encoded as ziplist, only while loading old RDB files. */
 #define REDIS_ENCODING_INTSET 6     /* Encoded as intset */
 #define REDIS_ENCODING_SKIPLIST 7   /* Encoded as skiplist */
 
 // REDIS_ENCODING_EMBSTR: in the same chunk of memory to save space and cache misses.
-#define REDIS_ENCODING_EMBSTR 8     /* Embedded sds string encoding，const 的紧凑型，最大 39 个 char（为了充分利用 malloc 的分配） */
+#define REDIS_ENCODING_EMBSTR 8     /* Embedded sds string encoding，const 的紧凑型，最大 44 个 char（为了充分利用 malloc 的分配） */
+
+// 列表唯一的编码方式：由多个长度受限的 listpack 组成的双端链表
+#define REDIS_ENCODING_QUICKLIST 9  /* Encoded as linked list of listpacks */
+
+// 流唯一的编码方式：由 rax 索引的多个 ziplist 宏节点
+#define REDIS_ENCODING_STREAM 10    /* Encoded as a radix tree of ziplists */
+
+// 采用 REDIS_ENCODING_LISTPACK 方式编码的 REDIS_HASH，REDIS_ZSET，会将 field\score、value\member 顺序的 push-tail 进 listpack 中
+#define REDIS_ENCODING_LISTPACK 11  /* Encoded as listpack */
+
+// 带域索引的 listpack，只用于 REDIS_HASH：ptr 指向 hashListpackIndex
+#define REDIS_ENCODING_LISTPACK_IDX 12 /* Listpack plus a field offset index */
+
+// 分块字符串，只用于很大的 REDIS_STRING：ptr 指向 stringChunks
+#define REDIS_ENCODING_CHUNKED 13   /* String split in fixed size chunks */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -237,12 +325,24 @@
 #define REDIS_RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define REDIS_RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define REDIS_RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define REDIS_RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define REDIS_RDB_ENC_ZSTD 5        /* string compressed with zstd */
+
+/* Codecs used to compress RDB strings, selected by rdb-compression-codec.
+ * LZ4 and zstd are only available when built with USE_LZ4 / USE_ZSTD. */
+#define REDIS_RDB_CODEC_LZF 0
+#define REDIS_RDB_CODEC_LZ4 1
+#define REDIS_RDB_CODEC_ZSTD 2
 
 /* AOF states */
 #define REDIS_AOF_OFF 0             /* AOF is off */
 #define REDIS_AOF_ON 1              /* AOF is on */
 #define REDIS_AOF_WAIT_REWRITE 2    /* AOF waits rewrite to start appending */
 
+/* Multi part AOF: the files listed in the manifest. */
+#define REDIS_AOF_FILE_TYPE_BASE 'b' /* BASE file, written by a rewrite. */
+#define REDIS_AOF_FILE_TYPE_INCR 'i' /* INCR file, appended by the server. */
+
 /* Client flags */
 #define REDIS_SLAVE (1<<0)   /* This client is a slave server */
 #define REDIS_MASTER (1<<1)  /* This client is a master server */
@@ -263,12 +363,37 @@
 #define REDIS_FORCE_REPL (1<<15)  /* Force replication of current cmd. */
 #define REDIS_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 #define REDIS_READONLY (1<<17)    /* Cluster client is in read-only state. */
+#define REDIS_PENDING_WRITE (1<<18) /* Client has output to send but a write
+                                       handler is yet not installed. */
+#define REDIS_PENDING_READ (1<<19)  /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from using I/O threads. */
+#define REDIS_PENDING_COMMAND (1<<20) /* An I/O thread parsed a full command
+                                         that the main thread must execute. */
+#define REDIS_TRACKING (1<<21)    /* Client enabled keys tracking in order to
+                                     perform client side caching. */
+#define REDIS_TRACKING_BROKEN_REDIR (1<<22) /* Target client is invalid. */
+#define REDIS_TRACKING_BCAST (1<<23) /* Tracking in BCAST mode. */
+#define REDIS_TRACKING_NOLOOP (1<<24) /* Don't send invalidation messages
+                                         about writes performed by myself.*/
+#define REDIS_PREVENT_AOF_PROP (1<<25)  /* Don't propagate to AOF. */
+#define REDIS_PREVENT_REPL_PROP (1<<26) /* Don't propagate to slaves. */
+#define REDIS_MODULE_CLIENT (1<<27) /* Non connected client used by modules */
+#define REDIS_AOF_WAIT (1<<28) /* Replies held until the AOF is fsynced. */
+#define REDIS_SHM (1<<30)         /* Uses the shared memory transport. */
+#define REDIS_SLOT_IMPORT (1<<29) /* Streams a slot to us with CLUSTER
+                                     IMPORTSLOT: replies are suppressed. */
+#define REDIS_PREVENT_PROP (REDIS_PREVENT_AOF_PROP|REDIS_PREVENT_REPL_PROP)
 
 /* Client block type (btype field in client structure)
  * if REDIS_BLOCKED flag is set. */
 #define REDIS_BLOCKED_NONE 0    /* Not blocked, no REDIS_BLOCKED flag set. */
 #define REDIS_BLOCKED_LIST 1    /* BLPOP & co. */
 #define REDIS_BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
+#define REDIS_BLOCKED_STREAM 3  /* XREAD. */
+#define REDIS_BLOCKED_MODULE 4  /* Blocked by a loadable module. */
+#define REDIS_BLOCKED_MIGRATE 5 /* MIGRATE ... ASYNC. */
+#define REDIS_BLOCKED_OFFSET 6  /* WAITOFFSET on a slave. */
 
 /* Client request types */
 #define REDIS_REQ_INLINE 1
@@ -305,6 +430,7 @@
 #define REDIS_REPL_RECEIVE_PONG 3 /* Wait for PING reply（slave 已经发送 ping，正在等待 pong） */
 #define REDIS_REPL_TRANSFER 4 /* slave 正在等待 Receiving .rdb from master */
 #define REDIS_REPL_CONNECTED 5 /* Connected to master（成功连接） */
+#define REDIS_REPL_RECEIVE_PSYNC 10 /* Wait for PSYNC reply（已经发送 PSYNC ，正在等待 master 的回复） */
 
 /* Slave replication state - from the point of view of the master.
  * In SEND_BULK and ONLINE state the slave receives new updates
@@ -315,6 +441,23 @@
 #define REDIS_REPL_SEND_BULK 8 /* Sending RDB file to slave. */
 #define REDIS_REPL_ONLINE 9 /* RDB file transmitted, sending just updates. */
 
+/* Compressed replication link: the data is sent in frames made of an 8
+ * bytes header (compressed length, raw length, both 32 bit little endian)
+ * followed by the LZF compressed payload, or by the raw payload when the
+ * two lengths are equal because the data did not compress. */
+#define REDIS_REPL_FRAME_HDR_LEN 8
+#define REDIS_REPL_FRAME_MAX_LEN REDIS_IOBUF_LEN /* Max raw bytes per frame. */
+
+/* Slave capabilities. */
+#define SLAVE_CAPA_NONE 0
+#define SLAVE_CAPA_EOF (1<<0)   /* Can parse the RDB EOF streaming format. */
+#define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
+
+/* RDB active child save type. */
+#define REDIS_RDB_CHILD_TYPE_NONE 0
+#define REDIS_RDB_CHILD_TYPE_DISK 1     /* RDB is written to disk. */
+#define REDIS_RDB_CHILD_TYPE_SOCKET 2   /* RDB is written to slave socket. */
+
 /* Synchronous read timeout - slave side */
 #define REDIS_REPL_SYNCIO_TIMEOUT 5
 
@@ -327,6 +470,7 @@
 #define REDIS_SORT_ASC 1
 #define REDIS_SORT_DESC 2
 #define REDIS_SORTKEY_MAX 1024
+#define REDIS_SORT_RADIX_MIN 64 /* Smallest numeric SORT using radix sort */
 
 /* Log levels */
 #define REDIS_DEBUG 0
@@ -358,13 +502,17 @@
 #define REDIS_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
 /* Zip structure related defaults */
-#define REDIS_HASH_MAX_ZIPLIST_ENTRIES 512
+#define REDIS_HASH_MAX_ZIPLIST_ENTRIES 1024
 #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
-#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
-#define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_HASH_ZIPLIST_INDEX_ENTRIES 128
+#define REDIS_DEFAULT_LIST_MAX_ZIPLIST_SIZE -2 /* 8kb per quicklist node */
+#define REDIS_DEFAULT_LIST_COMPRESS_DEPTH 0 /* Don't compress list nodes */
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
+#define REDIS_DEFAULT_STRING_CHUNK_THRESHOLD (4*1024*1024)
 #define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
+#define REDIS_DEFAULT_STREAM_NODE_MAX_BYTES 4096
+#define REDIS_DEFAULT_STREAM_NODE_MAX_ENTRIES 100
 
 /* HyperLogLog defines */
 #define REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
@@ -381,10 +529,18 @@
 #define REDIS_MAXMEMORY_ALLKEYS_LRU 3
 #define REDIS_MAXMEMORY_ALLKEYS_RANDOM 4
 #define REDIS_MAXMEMORY_NO_EVICTION 5
+#define REDIS_MAXMEMORY_VOLATILE_LFU 6
+#define REDIS_MAXMEMORY_ALLKEYS_LFU 7
 #define REDIS_DEFAULT_MAXMEMORY_POLICY REDIS_MAXMEMORY_NO_EVICTION
 
+/* True if the maxmemory policy uses the LFU encoding of robj->lru. */
+#define maxmemoryPolicyIsLFU() \
+    (server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_LFU || \
+     server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LFU)
+
 /* Scripting */
 #define REDIS_LUA_TIME_LIMIT 5000 /* milliseconds */
+#define REDIS_DEFAULT_LUA_REPLICATE_COMMANDS 0
 
 /* Units */
 #define UNIT_SECONDS 0
@@ -399,7 +555,9 @@
 #define REDIS_CALL_NONE 0
 #define REDIS_CALL_SLOWLOG 1
 #define REDIS_CALL_STATS 2
-#define REDIS_CALL_PROPAGATE 4
+#define REDIS_CALL_PROPAGATE_AOF 4
+#define REDIS_CALL_PROPAGATE_REPL 8
+#define REDIS_CALL_PROPAGATE (REDIS_CALL_PROPAGATE_AOF|REDIS_CALL_PROPAGATE_REPL)
 #define REDIS_CALL_FULL (REDIS_CALL_SLOWLOG | REDIS_CALL_STATS | REDIS_CALL_PROPAGATE)
 
 /* Command propagation flags, see propagate() function */
@@ -419,7 +577,8 @@
 #define REDIS_NOTIFY_ZSET (1<<7)        /* z */
 #define REDIS_NOTIFY_EXPIRED (1<<8)     /* x */
 #define REDIS_NOTIFY_EVICTED (1<<9)     /* e */
-#define REDIS_NOTIFY_ALL (REDIS_NOTIFY_GENERIC | REDIS_NOTIFY_STRING | REDIS_NOTIFY_LIST | REDIS_NOTIFY_SET | REDIS_NOTIFY_HASH | REDIS_NOTIFY_ZSET | REDIS_NOTIFY_EXPIRED | REDIS_NOTIFY_EVICTED)      /* A */
+#define REDIS_NOTIFY_STREAM (1<<10)     /* t */
+#define REDIS_NOTIFY_ALL (REDIS_NOTIFY_GENERIC | REDIS_NOTIFY_STRING | REDIS_NOTIFY_LIST | REDIS_NOTIFY_SET | REDIS_NOTIFY_HASH | REDIS_NOTIFY_ZSET | REDIS_NOTIFY_EXPIRED | REDIS_NOTIFY_EVICTED | REDIS_NOTIFY_STREAM)      /* A */
 
 /* Using the following macro you can run code inside serverCron() with the
  * specified period, specified in milliseconds.
@@ -436,8 +595,6 @@
  * Data types
  *----------------------------------------------------------------------------*/
 
-typedef long long mstime_t; /* millisecond time type. */
-
 /* A redis object, that is a type able to hold a string / list / set */
 
 /* The actual Redis Object */
@@ -458,6 +615,29 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_LRU_BITS 24
 #define REDIS_LRU_CLOCK_MAX ((1<<REDIS_LRU_BITS)-1) /* Max value of obj->lru */
 #define REDIS_LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
+
+/* With an LFU maxmemory policy the REDIS_LRU_BITS of robj->lru are used
+ * in a different way:
+ *
+ *          16 bits      8 bits
+ *     +----------------+--------+
+ *     + Last decr time | LOG_C  |
+ *     +----------------+--------+
+ *
+ * LOG_C is a logarithmic access counter, incremented with a probability
+ * that gets lower as the counter grows (see lfu-log-factor). The last
+ * decrement time is in minutes (modulo 2^16): the counter is decremented
+ * by one for every lfu-decay-time minutes the key was not accessed.
+ * New objects start with REDIS_LFU_INIT_VAL so that they have a chance
+ * to accumulate hits before being evicted. */
+#define REDIS_LFU_INIT_VAL 5
+#define REDIS_DEFAULT_LFU_LOG_FACTOR 10
+#define REDIS_DEFAULT_LFU_DECAY_TIME 1
+
+/* Hot keys tracking, see hotkeys.c */
+#define REDIS_DEFAULT_HOTKEYS_TRACKING 0
+#define REDIS_DEFAULT_HOTKEYS_SAMPLE_RATE 10    /* Sample 1 lookup every 10 */
+#define REDIS_DEFAULT_HOTKEYS_WINDOW 10         /* Seconds */
 // NOTE: robj 这是一个很可怕的 struct，极度抽象化，复用度极高
 //       robj 实际上就像是一个父类，基于 robj + type + encoding 实现了很多 OO 的事情：
 //       多态 操作（比如：setTypeAdd()，通过 type 来确认继承关系，通过 encoding 来确认派生类的种类，并转发到对应的 override 函数），
@@ -494,6 +674,42 @@ typedef struct redisObject {
 
 } robj;
 
+/* Data types defined by modules, see module.c and redismodule.h.
+ *
+ * 模块定义的数据类型：值对象的 ptr 指向一个 moduleValue ，
+ * 由模块类型的回调函数负责它的持久化和释放 */
+struct RedisModule;
+struct RedisModuleIO;
+
+typedef void *(*moduleTypeLoadFunc)(struct RedisModuleIO *io, int encver);
+typedef void (*moduleTypeSaveFunc)(struct RedisModuleIO *io, void *value);
+typedef void (*moduleTypeRewriteFunc)(struct RedisModuleIO *io, robj *key, void *value);
+typedef void (*moduleTypeFreeFunc)(void *value);
+
+typedef struct RedisModuleType {
+    struct RedisModule *module; /* The module that created the type. */
+    char *name;                 /* Type name, saved in the RDB file. */
+    int encver;                 /* Encoding version of the RDB payload. */
+    moduleTypeLoadFunc rdb_load;
+    moduleTypeSaveFunc rdb_save;
+    moduleTypeRewriteFunc aof_rewrite;
+    moduleTypeFreeFunc free;
+} moduleType;
+
+/* The ptr of REDIS_MODULE objects. */
+typedef struct moduleValue {
+    moduleType *type;
+    void *value;
+} moduleValue;
+
+/* Passed to the callbacks of the module types to save and load values,
+ * or to rewrite them in the AOF. */
+typedef struct RedisModuleIO {
+    struct _rio *rio;           /* The RDB or AOF stream. */
+    moduleType *type;           /* The type of the value. */
+    int error;                  /* True if an I/O error happened. */
+} RedisModuleIO;
+
 /* Macro used to obtain the current LRU clock.
  * If the current resolution is lower than the frequency we refresh the
  * LRU clock (as it should be in production servers) we return the
@@ -513,15 +729,22 @@ typedef struct redisObject {
 
 /* To improve the quality of the LRU approximation we take a set of keys
  * that are good candidate for eviction across freeMemoryIfNeeded() calls.
+ * There is a single pool for the whole server, so that the evicted key is
+ * the best candidate among all the databases, not only in one of them.
  *
  * Entries inside the eviciton pool are taken ordered by idle time, putting
  * greater idle times to the right (ascending order).
  *
- * Empty entries have the key pointer set to NULL. */
+ * Empty entries have the key pointer set to NULL.
+ *
+ * 服务器全局唯一的淘汰池，每个元素记录键所在的数据库 */
 #define REDIS_EVICTION_POOL_SIZE 16
+#define REDIS_EVICTION_POOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
-    unsigned long long idle;    /* Object idle time. */
+    unsigned long long idle;    /* Object idle time (inverse frequency for LFU). */
     sds key;                    /* Key name. */
+    sds cached;                 /* Cached SDS object for key name. */
+    int dbid;                   /* Key DB number. */
 };
 
 /* Redis database representation. There are multiple databases identified
@@ -541,6 +764,10 @@ typedef struct redisDb {
     // value 则是填写了这个 key 相应的过期时间
     dict *expires;              /* Timeout of keys with a timeout set */
 
+    // 按过期时间排序的过期键索引（active-expire-index 开启时才有，否则为 NULL）
+    // 键为 8 字节大端序的过期时间加上键名，参考 expireIndexAdd()
+    struct rax *expires_index;  /* Keys with a timeout in expire time order */
+
     // 正处于阻塞状态的键
     // key -> value <===> string -> list
     // 具体被阻塞的 key -> 阻塞在这个 key 上面的 client，以及阻塞的顺序
@@ -553,7 +780,9 @@ typedef struct redisDb {
     // 正在被 WATCH 命令监视的键(TODO: 结合 multi.c 来看)
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
 
-    struct evictionPoolEntry *eviction_pool;    /* Eviction pool of keys */
+    // 正在被 MIGRATE ASYNC 迁移的键，迁移结束之前拒绝对它们的写命令
+    dict *migrating_keys;       /* Keys locked by an async MIGRATE */
+
 
     // 数据库号码
     int id;                     /* Database ID */
@@ -591,6 +820,9 @@ typedef struct multiState {
 
     // 已入队命令计数
     int count;              /* Total number of MULTI commands */
+
+    // commands 数组已分配的槽位，按倍数增长
+    int capacity;           /* Slots allocated in the commands array */
     int minreplicas;        /* MINREPLICAS for synchronous replication */
     time_t minreplicas_timeout; /* MINREPLICAS timeout as unixtime. */
 } multiState;
@@ -620,6 +852,22 @@ typedef struct blockingState {
     // 复制偏移量
     long long reploffset;   /* Replication offset to reach. */
 
+    // BLMPOP 弹出元素的位置和最大数量
+    int list_where;         /* BLMPOP LEFT|RIGHT: REDIS_HEAD or REDIS_TAIL. */
+    long list_count;        /* BLMPOP COUNT option. */
+
+    /* REDIS_BLOCKED_STREAM */
+    // XREAD 的 COUNT 选项，0 表示不限制
+    size_t xread_count;     /* XREAD COUNT option. */
+
+    /* REDIS_BLOCKED_MODULE */
+    // 阻塞客户端的模块句柄 RedisModuleBlockedClient
+    void *module_blocked_handle; /* RedisModuleBlockedClient structure. */
+
+    /* REDIS_BLOCKED_MIGRATE */
+    // 正在执行的异步迁移任务 migrateAsyncJob
+    void *migrate_job;      /* migrateAsyncJob structure. */
+
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -639,6 +887,77 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* The replication stream is stored only once, in a list of reference
+ * counted blocks (server.repl_buffer_blocks) shared by the backlog and by
+ * all the slaves: the bytes of a block are never modified once written, a
+ * slave just remembers the block it is sending and its position inside it,
+ * and the blocks nobody references any longer are trimmed from the head of
+ * the list when the backlog is larger than repl-backlog-size.
+ *
+ * 复制流只保存一份：backlog 和所有 slave 共享同一串带引用计数的 block ，
+ * slave 只记录自己发送到了哪个 block 的哪个位置，不再各自复制一份。 */
+typedef struct replBufBlock {
+    int refcount;           /* Slaves and backlog referencing this block. */
+    long long id;           /* Progressive block ID, never reused. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;      /* Allocated / used bytes of buf. */
+    char buf[];
+} replBufBlock;
+
+/* The backlog is just a reference to the first block of the shared
+ * replication buffer plus the length of the history it covers. */
+/* Message sent by a child to the parent through server.child_info_pipe,
+ * see childinfo.c. */
+#define REDIS_CHILD_INFO_TYPE_NONE 0
+#define REDIS_CHILD_INFO_TYPE_RDB 1
+#define REDIS_CHILD_INFO_TYPE_AOF 2
+#define REDIS_CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
+typedef struct childInfoData {
+    unsigned long long magic;   /* REDIS_CHILD_INFO_MAGIC */
+    int process_type;           /* REDIS_CHILD_INFO_TYPE_* */
+    size_t cow_size;            /* Private dirty memory of the child. */
+} childInfoData;
+
+/* Forkless snapshot in progress, see snapshot.c. */
+typedef struct forklessSave forklessSave;
+
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* First block referenced by the backlog. */
+    long long histlen;      /* Backlog actual data length. */
+    long long offset;       /* Replication offset of the first byte in the
+                               backlog. */
+} replBacklog;
+
+/* The AOF is made of an optional BASE file, produced by the last rewrite,
+ * followed by the INCR files the server appended commands to since then.
+ * The manifest lists them in the order they must be loaded.
+ *
+ * AOF 由重写产生的 BASE 文件，加上之后追加命令的 INCR 文件组成，
+ * manifest 文件按载入的顺序记录它们 */
+typedef struct aofInfo {
+    sds file_name;          /* File name, relative to the AOF directory. */
+    long long file_seq;     /* Sequence number, grows with every new file. */
+    int file_type;          /* REDIS_AOF_FILE_TYPE_* */
+} aofInfo;
+
+typedef struct aofManifest {
+    aofInfo *base_aof_info;         /* NULL if there is no BASE file. */
+    list *incr_aof_list;            /* INCR files, oldest first. */
+    long long curr_base_file_seq;   /* Sequence of the last BASE file. */
+    long long curr_incr_file_seq;   /* Sequence of the last INCR file. */
+} aofManifest;
+
+/* Resources used by a client: the bytes it sent and received, and the time
+ * spent executing its commands. See CLIENT LIST and CLIENT USAGE.
+ *
+ * 客户端使用的网络流量与命令执行时间 */
+typedef struct clientUsage {
+    unsigned long long net_input_bytes;
+    unsigned long long net_output_bytes;
+    unsigned long long cmd_calls;
+    unsigned long long cmd_usec;
+} clientUsage;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a liked list.
  *
@@ -648,6 +967,9 @@ typedef struct readyList {
  */
 typedef struct redisClient {
 
+    // 客户端的唯一 ID ，单调递增，不会被重用
+    uint64_t id;            /* Client incremental unique ID. */
+
     // 套接字描述符（socket fd）
     int fd;
 
@@ -660,6 +982,11 @@ typedef struct redisClient {
     // 客户端的名字
     robj *name;             /* As set by CLIENT SETNAME */
 
+    // 客户端的资源使用统计
+    clientUsage usage;          /* Totals since the client was created */
+    clientUsage usage_folded;   /* Part of 'usage' already accounted in
+                                   server.client_usage under its name. */
+
 //==============================================================================
 // redis-server 读取 redis-cli 发送过来的数据
     // client 发过来的 req buf，将 read() 中的  RESP 协议内容，直接放到这个 buf 里面
@@ -712,6 +1039,9 @@ typedef struct redisClient {
     // 0 代表未认证， 1 代表已认证
     int authenticated;      /* when requirepass is non-NULL */
 
+    // 客户端使用的 RESP 协议版本，通过 HELLO 命令协商，默认为 2
+    int resp;               /* RESP protocol version. Can be 2 or 3. */
+
     // 复制状态(sync 时，master 使用的状态机)
     int replstate;          /* replication state if this is a slave */
     // master 上看：这个 fd 指向用来进行同步的那个 RDB 文件
@@ -727,19 +1057,39 @@ typedef struct redisClient {
     off_t repldbsize;       /* replication DB file size */
     // repldbsize 的 SDS RESP 形式，如："$%31\r\n"；在传送 RDB 前，先告知 slave，即将传送的 RDB 究竟有多大
     sds replpreamble;       /* replication DB preamble.(前缀，说明 RDB 文件的大小) */
+    // 压缩的复制连接：master 上是 slave 还没发送完的帧，slave 上是 master 还没接收完的帧
+    sds repl_zbuf;          /* Frame being sent to a slave / received from the
+                               master on compressed links, NULL otherwise. */
 
     // 在 slave 上才会用，当前这个 client 就是 slave --> master 的 client
     // 这个 offset 就是 repl 到什么位置，这个是 master 的 buf offset
-    long long reploff;      /* replication offset if this is our master */
+    // reploff 只计算已经执行完毕的命令，read_reploff 计算所有读入的字节
+    long long read_reploff; /* Read replication offset if this is our master */
+    long long reploff;      /* Applied replication offset if this is our master */
+    // 从 master 读入、但还没有执行的复制流，执行之后原样转发给 sub-slave
+    sds pending_querybuf;   /* If this is a master, this buffer represents the
+                               yet not applied replication stream that we
+                               are receiving from the master. */
     //  slave 最后一次发送 REPLCONF ACK 时的偏移量
     long long repl_ack_off; /* replication ack offset, if this is a slave */
     //  slave 最后一次发送 REPLCONF ACK 的时间
     long long repl_ack_time;/* replication ack time, if this is a slave */
-    //  master 的 master run ID
+    //  master 的复制 ID
     // 保存在客户端，用于执行部分重同步
-    char replrunid[REDIS_RUN_ID_SIZE+1]; /* master run id if this is a master */
+    char replid[REDIS_RUN_ID_SIZE+1]; /* Master replication ID (if master). */
     //  slave 的监听端口号
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
+    // slave 通过 REPLCONF capa 声明的能力（ SLAVE_CAPA_* ）
+    int slave_capa;         /* Slave capabilities: SLAVE_CAPA_* bitwise OR. */
+    // 无盘复制时，RDB 传送完毕后要等到 slave 的第一个 REPLCONF ACK 才真正上线
+    int repl_put_online_on_ack; /* Install slave write handler on ACK. */
+    // FULL RESYNC 时告知 slave 的复制偏移量
+    long long psync_initial_offset; /* FULLRESYNC reply offset other slaves
+                                       copying this slave output buffer
+                                       should use. */
+    // slave 正在发送的共享复制缓冲 block ，以及在这个 block 中的发送进度
+    listNode *ref_repl_buf_node; /* Replication buffer block being sent. */
+    size_t ref_block_pos;   /* Bytes of that block already sent. */
 
     // 事务状态
     multiState mstate;      /* MULTI/EXEC state */
@@ -752,10 +1102,19 @@ typedef struct redisClient {
     // 最后被写入的全局复制偏移量
     long long woff;         /* Last write global replication offset. */
 
+    // 从 slave 读取时允许的最大延迟（毫秒）， 0 表示不限制
+    long long max_lag;      /* CLIENT MAXLAG: max staleness of reads, in ms. */
+
+    // 组提交时，回复客户端之前必须已经落盘的 AOF 偏移量
+    long long aof_woff;     /* AOF offset to fsync before replying. */
+
     // 被监视的键
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     sds peerid;             /* Cached peer ID. format: ip:port or [ipv6]:port */
 
+    // 共享内存传输，设置了 REDIS_SHM 之后才用于收发
+    struct shmTransport *shm; /* Shared memory rings, see shmtransport.c */
+
 //==============================================================================
     // TODO:(DONE) 这个 channel 的 dict 存放在 redisClient 干嘛？总不可能每一个 redisClient 的 pubsub 一更新就要全部更新吧？
     // redisClient->pubsub_channels 仅仅是作为一个 set 来进行去重使用
@@ -773,6 +1132,17 @@ typedef struct redisClient {
     // 新 pubsubPattern 结构总是被添加到表尾
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
 
+    // 客户端订阅的分片频道集合（SSUBSCRIBE）
+    dict *pubsubshard_channels; /* shard channels a client is interested in */
+
+    /* Client side caching */
+    // 接收失效消息的客户端 ID ，为 0 时表示没有重定向
+    uint64_t client_tracking_redirection;   /* Client ID receiving the
+                                               invalidation messages. */
+    // BCAST 模式下订阅的键前缀
+    struct rax *client_tracking_prefixes;   /* Prefixes of BCAST mode, or
+                                               NULL if none. */
+
 //==============================================================================
     /* Response buffer */
     // 回复链表(可能要随时释放掉、更换 list，所以采用指针的方式，而不是拥有一个头节点或管理节点)
@@ -805,7 +1175,21 @@ typedef struct redisClient {
     // TODO:(DONE) 超出了这个 buff 该怎么办？
     // 1. 满了就使用 reply 这里 list 进一步拓展缓冲区
     // 2. reply-list 也装得太多了，那就只能够直接异步 close 掉这个 client，不然内存占用实在是过多了
-    char buf[REDIS_REPLY_CHUNK_BYTES];
+    // 大小由 clientsCron() 根据 buf_peak 调整，空闲客户端会释放掉（NULL）
+    char *buf;
+    size_t buf_usable_size; /* Allocated size of buf, 0 if released. */
+    size_t buf_peak;        /* Largest bufpos wanted since the last resize. */
+
+    // 上一个命令用过、没有被命令保留下来的 EMBSTR 参数对象，按参数位置保存
+    // 解析下一个命令的同一位置参数时直接复用，省去一次 malloc/free
+    robj *argv_pool[REDIS_ARGV_POOL_SIZE];
+
+    /* Threaded I/O state, only meaningful while the client is handed to the
+     * I/O threads: results are consumed by the main thread afterwards. */
+    int io_nread;           /* Result of the last threaded read(2). */
+    int io_nwritten;        /* Bytes written by the last threaded write. */
+    int io_sentnodes;       /* Reply list nodes fully transmitted. */
+    int io_errno;           /* errno of the last threaded read / write. */
 
 } redisClient;
 
@@ -824,16 +1208,23 @@ struct saveparam {
 // 预分配的，一开始就创建好了
 struct sharedObjectsStruct {
     robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *cnegone, *pong, *space,
-    *colon, *nullbulk, *nullmultibulk, *queued,
+    *colon, *queued, *noprotoerr,
     *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
     *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
     *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
-    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *rpop, *lpop,
-    *lpush, *emptyscan, *minstring, *maxstring,
+    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *smessagebulk,
+    *ssubscribebulk, *sunsubscribebulk, *del, *rpop, *lpop,
+    *lpush, *srem, *emptyscan, *minstring, *maxstring,
     *select[REDIS_SHARED_SELECT_CMDS],
     *integers[REDIS_SHARED_INTEGERS],
+    *null[4],       /* Null reply, indexed by RESP version: "$-1" or "_" */
+    *nullarray[4],  /* Null array reply, by RESP version: "*-1" or "_" */
+    *emptymap[4],   /* Empty map reply, by RESP version: "*0" or "%0" */
+    *emptyset[4],   /* Empty set reply, by RESP version: "*0" or "~0" */
     *mbulkhdr[REDIS_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
+    *maphdr[REDIS_SHARED_BULKHDR_LEN],   /* "%<value>\r\n" */
+    *sethdr[REDIS_SHARED_BULKHDR_LEN],   /* "~<value>\r\n" */
     *bulkhdr[REDIS_SHARED_BULKHDR_LEN];  /* "$<value>\r\n" */
 };
 
@@ -847,9 +1238,10 @@ struct sharedObjectsStruct {
 // 每一层都会尽可能跳远一些
 typedef struct zskiplistNode {
 
-    // 成员对象
-    // 采用引用计数的方式指向实际 obj，要记得相应的加减引用计数
-    robj *obj;
+    // 成员
+    // 成员字符串和节点共用一次分配，紧跟在 level[] 之后（见 zslCreateNode）
+    // zset 字典的 key 直接指向它，所以节点释放前必须先从字典里删除
+    sds ele;
 
     // 分值, 进行排序的依据
     double score;
@@ -917,15 +1309,15 @@ typedef struct zskiplist {
  *                     |  *zsl   | ------> 
  *                     +---------+
  * 
- * 还有另一种情况就是，zset 整体 node 少，将会采用 ziplist 来进行管理，每一个 node 都会保存 (member, score) pair
+ * 还有另一种情况就是，zset 整体 node 少，将会采用 listpack 来进行管理，每一个 node 都会保存 (member, score) pair
  * 
  *    redis_obj         
- * +------------+      +----------+----------+---------+------------------+---------+
- * |  robj.ptr  | ---> | zlbytes  |  zltail  |  zllen  |  ... entrys ...  |  zlend  |
- * +------------+      +----------+----------+---------+------------------+---------+
+ * +------------+      +-----------+----------+------------------+---------+
+ * |  robj.ptr  | ---> | tot-bytes | num-elem |  ... entries ... |   0xFF  |
+ * +------------+      +-----------+----------+------------------+---------+
  *                     ^
  *                     |
- *             unsigned char *ziplist
+ *             unsigned char *listpack
  */
 typedef struct zset {
 
@@ -940,6 +1332,30 @@ typedef struct zset {
 
 } zset;
 
+/* Overhead memory usage, see getMemoryOverheadData() and MEMORY STATS. */
+struct redisMemOverhead {
+    size_t peak_allocated;
+    size_t total_allocated;
+    size_t startup_allocated;
+    size_t repl_backlog;
+    size_t clients_slaves;
+    size_t clients_normal;
+    size_t aof_buffer;
+    size_t overhead_total;
+    size_t dataset;
+    size_t total_keys;
+    size_t bytes_per_key;
+    float dataset_perc;
+    float peak_perc;
+    float fragmentation;
+    size_t num_dbs;
+    struct {
+        size_t dbid;
+        size_t overhead_ht_main;
+        size_t overhead_ht_expires;
+    } *db;
+};
+
 // 客户端缓冲区限制
 typedef struct clientBufferLimitsConfig {
     // 硬限制
@@ -988,8 +1404,17 @@ typedef struct redisOp {
 typedef struct redisOpArray {
     redisOp *ops;
     int numops;
+    int capacity;   /* Slots allocated in ops, grown geometrically. */
 } redisOpArray;
 
+/* A named function created with FUNCTION LOAD, see scripting.c.
+ *
+ * 以名字保存的脚本函数 */
+typedef struct luaFunction {
+    robj *body;             /* The script. */
+    char funcname[43];      /* Name of its Lua function, f_<sha1 of body>. */
+} luaFunction;
+
 /*-----------------------------------------------------------------------------
  * Global server state
  *----------------------------------------------------------------------------*/
@@ -1025,10 +1450,19 @@ struct redisServer {
 
     // 在执行 serverCron() 时进行渐进式 rehash
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int fork_friendly;          /* Less copy-on-write while a child is
+                                   saving: no rehashing in the parent, the
+                                   child gives back the saved values. */
 
     // 是否设置了密码
     char *requirepass;          /* Pass for AUTH command, or NULL */
 
+    // 配置文件中的 loadmodule 指令，服务器初始化之后载入
+    list *loadmodule_queue;     /* Modules to load at startup: [path, args]. */
+    int module_blocked_pipe[2]; /* Pipe used to awake the event loop if a
+                                   client blocked on a module command needs
+                                   to be processed. */
+
     // PID 文件
     char *pidfile;              /* PID file path */
 
@@ -1054,6 +1488,9 @@ struct redisServer {
     int port;                   /* TCP listening port */
 
     int tcp_backlog;            /* TCP listen() backlog */
+    int tcp_reuseport;          /* Set SO_REUSEPORT on the TCP listeners. */
+    int tcp_defer_accept;       /* TCP_DEFER_ACCEPT seconds, 0 = disabled. */
+    int max_accepts_per_call;   /* Connections accepted per readable event. */
 
     // 地址
     char *bindaddr[REDIS_BINDADDR_MAX]; /* Addresses we should bind to */
@@ -1063,6 +1500,8 @@ struct redisServer {
     // UNIX 套接字
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
+    int shm_transport;          /* Allow CLIENT SHM on the UNIX socket? */
+    list *shm_clients;          /* Clients flagged REDIS_SHM. */
 
     // 描述符
     int ipfd[REDIS_BINDADDR_MAX]; /* TCP socket file descriptors */
@@ -1078,8 +1517,14 @@ struct redisServer {
 
     // 一个链表，保存了所有客户端状态结构
     list *clients;              /* List of active clients */
+    // 以客户端 ID （大端序）为键的索引，参考 lookupClientByID()
+    struct rax *clients_index;  /* Active clients by ID, big endian. */
+    // 下一个客户端的 ID
+    uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     // 链表，保存了所有待关闭的客户端，实现异步关闭（参考：freeClientAsync() 函数，加入；freeClientsInAsyncFreeQueue() 函数，释放）
     list *clients_to_close;     /* Clients to close asynchronously */
+    list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
 
     // 链表，保存了所有 slave ，以及所有监视器
     list *slaves, *monitors;    /* List of slaves and MONITORs */
@@ -1095,6 +1540,9 @@ struct redisServer {
 
     // MIGRATE 缓存(毕竟真实场景中，同一个 slot 是会有很多 key-value pair 的)
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
+    dict *client_usage;         /* Client name -> clientUsage of the clients
+                                   closed or renamed, see CLIENT USAGE. */
+    list *migrate_async_jobs;   /* MIGRATE ASYNC transfers in progress */
 
 //===========================================================
     /* RDB / AOF loading information */
@@ -1115,8 +1563,9 @@ struct redisServer {
 
     /* Fast pointers to often looked up command */
     // 常用命令的快捷连接
-    struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
-                        *rpopCommand;
+    struct redisCommand *delCommand, *multiCommand, *execCommand,
+                        *lpushCommand, *lpopCommand, *rpopCommand,
+                        *sremCommand;
 
 
     /* Fields used only for stats */
@@ -1136,18 +1585,52 @@ struct redisServer {
     // 因为回收内存而被释放的过期键的数量
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
 
+    // 淘汰键的质量统计：采样的键数量、淘汰池中已经不存在的键的数量，
+    // 以及 LRU 策略下被淘汰键的空转时间总和（毫秒）
+    long long stat_eviction_samples;    /* Keys sampled to fill the pool */
+    long long stat_eviction_ghosts;     /* Pool entries found deleted */
+    long long stat_evicted_idle_sum;    /* Idle ms of LRU evicted keys */
+    long long stat_evicted_lru_keys;    /* Keys evicted by a LRU policy */
+
     // 成功查找键的次数
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
 
     // 查找键失败的次数
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
+    long long stat_pubsub_pattern_checks;  /* Patterns matched against a
+                                              published channel. */
+    long long stat_pubsub_pattern_matches; /* ... of which matched. */
+
+    // active defrag 的统计信息
+    long long stat_active_defrag_hits;      /* number of allocations moved */
+    long long stat_active_defrag_misses;    /* number of allocations scanned but not moved */
+    long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
+    long long stat_active_defrag_key_misses;/* number of keys scanned and not moved */
+    long long stat_argv_pool_hits;  /* Arguments parsed into recycled objects */
 
     // 已使用内存峰值
     size_t stat_peak_memory;        /* Max used memory record */
+    size_t initial_memory_usage;    /* Bytes used after initialization. */
 
     // 最后一次执行 fork() 时消耗的时间
     // 仅仅是作为记录，能够通过 redis-cli 查看，作为 debug 性能的依据之一
     long long stat_fork_time;       /* Time needed to perform latest fork() */
+    double stat_fork_rate;          /* Fork rate in GB/sec. */
+
+    // 子进程报告的 copy-on-write 内存用量：正在运行的子进程、最近一次以及峰值
+    int child_info_pipe[2];         /* Pipe used by the children to send
+                                       their info, see childinfo.c. */
+    int in_fork_child;              /* REDIS_CHILD_INFO_TYPE_* in a child. */
+    forklessSave *forkless_save;    /* Forkless BGSAVE in progress or NULL. */
+    int rdb_forkless;               /* BGSAVE and save points don't fork. */
+    time_t rdb_forkless_time_start; /* Current forkless save start time. */
+    long long stat_forkless_early_keys; /* Keys written before the scan by
+                                           the last forkless save. */
+    size_t stat_current_cow_bytes;  /* COW of the running child. */
+    size_t stat_rdb_cow_bytes;      /* COW of the last RDB child. */
+    size_t stat_rdb_cow_peak;       /* Max COW of the RDB children. */
+    size_t stat_aof_cow_bytes;      /* COW of the last AOF rewrite child. */
+    size_t stat_aof_cow_peak;       /* Max COW of the AOF rewrite children. */
 
     // 服务器因为客户端数量过多而拒绝客户端连接的次数
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
@@ -1160,12 +1643,17 @@ struct redisServer {
 
     // PSYNC 执行失败的次数
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
+    long long stat_io_reads_processed;  /* Reads handled by I/O threads. */
+    long long stat_io_writes_processed; /* Writes handled by I/O threads. */
 
 
     /* slowlog */
 
-    // 保存了所有慢查询日志的链表
-    list *slowlog;                  /* SLOWLOG list of commands */
+    // 保存慢查询日志的环形缓冲区，最新的条目在 slowlog_next-1
+    struct slowlogEntry **slowlog;  /* SLOWLOG ring buffer of commands */
+    unsigned long slowlog_size;     /* Slots in the ring buffer */
+    unsigned long slowlog_len;      /* Entries in the ring buffer */
+    unsigned long slowlog_next;     /* Slot the next entry is stored at */
 
     // 下一条慢查询日志的 ID
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
@@ -1175,6 +1663,13 @@ struct redisServer {
 
     // 服务器配置 slowlog-max-len 选项的值
     unsigned long slowlog_max_len;     /* SLOWLOG max number of items logged */
+
+    /* latency monitor */
+
+    // 延迟达到这个值（毫秒）的事件才会被记录， 0 表示关闭延迟监视
+    long long latency_monitor_threshold;
+    // 事件名称 => 历史延迟时间序列
+    dict *latency_events;
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     /* The following two are used to track instantaneous "load" in terms
      * of operations per second. */
@@ -1199,9 +1694,19 @@ struct redisServer {
     // 是否开启 SO_KEEPALIVE 选项
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
+    int active_expire_index;        /* Keep volatile keys sorted by expire. */
     size_t client_max_querybuf_len; /* Limit for client query buffer length */
     int dbnum;                      /* Total number of configured DBs */
     int daemonize;                  /* True if running as a daemon */
+    int io_threads_num;             /* Number of I/O threads to use. */
+    int io_threads_do_reads;        /* Read and parse from I/O threads? */
+
+    // CPU 绑定，为 NULL 时继承父线程（进程）的设置
+    char *server_cpulist;           /* CPUs of the main and I/O threads */
+    char *bio_cpulist;              /* CPUs of the bio.c threads */
+    char *aof_rewrite_cpulist;      /* CPUs of the BGREWRITEAOF child */
+    char *bgsave_cpulist;           /* CPUs of the BGSAVE child */
+    int numa_bind_memory;           /* Bind memory to the main thread node? */
     // 客户端输出缓冲区大小限制
     // 数组的元素有 REDIS_CLIENT_LIMIT_NUM_CLASSES 个
     // 每个代表一类客户端：普通、 slave 、pubsub，诸如此类
@@ -1215,7 +1720,9 @@ struct redisServer {
 
     // 所使用的 fsync 策略（每个写入/每秒/从不）
     int aof_fsync;                  /* Kind of fsync() policy */
-    char *aof_filename;             /* Name of the AOF file */
+    char *aof_filename;             /* Base name of the AOF files */
+    char *aof_dirname;              /* Directory holding the AOF files */
+    aofManifest *aof_manifest;      /* Files making the AOF. */
     int aof_no_fsync_on_rewrite;    /* Don't fsync if a rewrite is in prog. */
     int aof_rewrite_perc;           /* Rewrite AOF if % growth is > M and... */
     off_t aof_rewrite_min_size;     /* the AOF file is at least N bytes. */
@@ -1225,17 +1732,13 @@ struct redisServer {
     off_t aof_rewrite_base_size;    /* AOF size on latest startup or rewrite. */
 
     // AOF 文件的当前字节大小
-    off_t aof_current_size;         /* AOF current size. */
+    off_t aof_current_size;         /* AOF current size (all the files). */
+    off_t aof_last_incr_size;       /* Size of the INCR file appended to. */
     int aof_rewrite_scheduled;      /* Rewrite once BGSAVE terminates. */
 
     // 负责进行 AOF 重写的子进程 ID
     pid_t aof_child_pid;            /* PID if rewriting process */
 
-    // AOF 重写缓存链表，链接着多个缓存块
-    // 缓存块是：struct aofrwblock，每一个 block 能够容纳 10 MB 的内容，
-    // 所有的 aof-rewirte-buf 都有这个链表进行管理
-    list *aof_rewrite_buf_blocks;   /* Hold changes during an AOF rewrite. */
-
     // AOF 缓冲区
     // 因为生成 AOF 记录跟 AOF 记录落盘，代码是分开的，所以要有个 heap buf 暂缓一下临时数据
     // 利用 heap-buf 的方式共享\通信数据
@@ -1266,8 +1769,28 @@ struct redisServer {
 
     // 指示是否需要每写入一定量的数据，就主动执行一次 fsync()
     int aof_rewrite_incremental_fsync;/* fsync incrementally while rewriting? */
+
+    // 指示 RDB 保存时是否需要每写入一定量的数据，就主动执行一次 fsync()
+    int rdb_save_incremental_fsync;   /* fsync incrementally while rdb saving? */
+
+    // 指示 AOF 重写时是否先以 RDB 格式写入数据
+    int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
     int aof_last_write_status;      /* REDIS_OK or REDIS_ERR */
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
+
+    // appendfsync always 时，由 AOF 写线程批量执行 write + fsync （组提交）
+    int aof_group_commit;           /* Write and fsync in the AOF writer thread. */
+    // 写入 aof_buf 的总字节数，以及其中已经落盘的部分
+    long long aof_fed_off;          /* Bytes ever appended to aof_buf. */
+    long long aof_durable_off;      /* Part of aof_fed_off written and fsynced. */
+    list *clients_waiting_aof;      /* Clients with replies held (AOF_WAIT). */
+    int aof_writer_pipe[2];         /* Used by the writer to awake the loop. */
+    long long stat_aof_group_commits; /* Batches written by the writer. */
+
+    // 最近一次载入 AOF 的统计：执行的命令数、读入的字节数、耗时
+    long long aof_load_commands;    /* Commands replayed by the last load. */
+    long long aof_load_bytes;       /* Bytes read by the last load. */
+    long long aof_load_time;        /* Duration of the last load in usec. */
     
 //==============================================================================
     /* RDB persistence */
@@ -1304,11 +1827,18 @@ struct redisServer {
     // 负责执行 BGSAVE 的子进程的 ID
     // 没在执行 BGSAVE 时，设为 -1
     pid_t rdb_child_pid;            /* PID of RDB saving child */
+    // BGSAVE 子进程的输出目标：磁盘或者 slave 的套接字
+    int rdb_child_type;             /* Type of save by active child. */
+    // 无盘复制时，子进程通过管道将每个 slave 的传送结果报告给父进程
+    int rdb_pipe_write_result_to_parent; /* RDB pipes used to return the state */
+    int rdb_pipe_read_result_from_child; /* of each slave in diskless SYNC. */
     struct saveparam *saveparams;   /* Save points array for RDB */
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* REDIS_RDB_CODEC_* used to compress. */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding the RDB when loading. */
 
     // 最后一次完成 SAVE 的时间
     time_t lastsave;                /* Unix time of last successful save */
@@ -1329,6 +1859,8 @@ struct redisServer {
 
     /* Propagation of commands in AOF / replication */
     redisOpArray also_propagate;    /* Additional command to propagate. */
+    redisOpArray *propagate_batch;  /* If not NULL propagate() collects the
+                                       commands here, see execCommand(). */
 
 
     /* Logging */
@@ -1343,49 +1875,28 @@ struct redisServer {
 
     //  master 发送 PING 的频率
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
+    int repl_heartbeat_period;      /* Master sends its time every N ms. */
 
 
-    // backlog 本身 
-    // TODO:(DONE) 环形缓冲？是的，环形，实际上就是条状，多了的从头开始覆盖罢了；
-    // 参考 feedReplicationBacklog()
-    char *repl_backlog;             /* Replication backlog for partial syncs */
+    // backlog ，只是对共享复制缓冲第一个 block 的引用，参考 feedReplicationBuffer()
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
     // backlog 的长度，REDIS_DEFAULT_REPL_BACKLOG_SIZE 1 MB，这个的大小基本上是不会变的
-    long long repl_backlog_size;    /* Backlog circular buffer size */
-    // 是记录下一次写入的时候，从哪里开始追加写入
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset */
-
-    // 实话说，这个一旦到达了 repl_backlog_size 之后，大小就不会变化了，一直都是 repl_backlog_size
-    // 相当于一个溢出标志位罢了
-    // 因为环形队列需要做到：
-    // 1. 被全部 slave ack 的数据，会被标记为可以覆盖；（实际上 redis 不会这样，因为这只是一个 PSYNC 的判断依据）
-    // 2. 还没有被 ack 的数据，依旧保留
-    // 为什么要有这个 histlen 呢？适配缓冲区还没有溢出的情况，溢出且开始覆盖之后，histlen 恒等于 repl_backlog_size
-    // 无论溢出与否，都是 backlog 里面的有效数据长度（预处之后，有效数据长度就固定为 repl_backlog_size 了）
-    long long repl_backlog_histlen; /* Backlog actual data length */
-
-    // **缓冲区中的数据，最开头那一位的版本号**
-    // backlog 的当前索引（范围是：0 -- repl_backlog_size）
-    // backlog 中可以被还原的第一个字节的偏移量
-    /* Each master also takes an offset that increments for every byte of replication stream 
-     * that it is produced to be sent to replicas, in order to update the state of the replicas 
-     * with the new changes modifying the dataset. The replication offset is incremented
-     * even if no replica is actually connected
-     * 
-     * **Identifies an exact version of the dataset of a master.**
-     */
-    long long repl_backlog_off;     /* Replication offset of first byte in the
-                                       backlog buffer. */
+    long long repl_backlog_size;    /* Backlog size */
+    // backlog 和所有 slave 共享的复制缓冲，由 replBufBlock 组成
+    list *repl_buffer_blocks;       /* Replication buffers blocks list
+                                       (serving slaves and backlog). */
+    size_t repl_buffer_mem;         /* The memory of replication buffer. */
     // 全局复制偏移量（一个累计值），作为 master 的 redis-server 负责记录
     /* master 在 handle 完每一个 CMD 之后，就会根据 repl 的开关，看看要不要进行 CMD 的 repl 传播
-     * 需要且 DB dirty 之后，就会在 cron 中进行传播，然后调用 feedReplicationBacklog() 
-     * 把 CMD 记录在 server.repl_backlog 里面，并更新 master_repl_offset。
+     * 需要且 DB dirty 之后，就会在 cron 中进行传播，然后调用 feedReplicationBuffer() 
+     * 把 CMD 记录在共享的复制缓冲里面，并更新 master_repl_offset。
      * 
      * 然后 slave 每次跟 master 沟通的时候，就会向 master 回馈：
      * 目前我这个 slave 读取到了你缓冲里面的 master_repl_offset 位置的命令，
      * 你看看是不是最新的，不是的话，继续同步其他 CMD 给我。
      * 啥？我进度落后太多了？已经没办法进行 PSYNC 了？好吧，我准备一下重新 FULL SYNC
      * 
-     * 每次，这个位于 server 上面的 repl_backlog 环形缓冲区，是只有一个的，而且只会在 server 上面
+     * 每次，这个位于 server 上面的复制缓冲，是只有一个的，而且只会在 server 上面
      * 而 master_repl_offset 的最新值也是在 server 上面的；
      * 在 slave 的 redis-server 上面，都会有各自的同步进度，都是奔着 master_repl_offset 去的
      * 
@@ -1397,11 +1908,19 @@ struct redisServer {
     // psync_offset = server.master_repl_offset; 当前的版本号同步给 slave
     // 每次 slave 想要进行 PSYNC 的时候，master 看看 slave 的版本号，是否能够从 backlog 这个环形缓冲区中恢复
     long long master_repl_offset;   /* Global replication offset */
+    /* The replication history is identified by a replication ID and an
+     * offset: a slave inherits both from its master and, once promoted,
+     * keeps accepting PSYNC requests for the old history (replid2) up to
+     * the offset where it was promoted (second_replid_offset). */
+    // 复制 ID ：slave 使用 master 的复制 ID ，被提升为 master 后，
+    // 旧的复制 ID 保存在 replid2 中，让旧的兄弟节点也可以 PSYNC
+    char replid[REDIS_RUN_ID_SIZE+1];  /* My current replication ID. */
+    char replid2[REDIS_RUN_ID_SIZE+1]; /* replid inherited from master*/
+    long long second_replid_offset; /* Accept offsets up to this for replid2. */
 //==========================================================
-// NOTE: master_repl_offset\repl_backlog_off 这两个都是不断累加的，相当于一个版本号
-//       master_repl_offset 缓冲区中的数据，最末尾那一位的版本号
-//       repl_backlog_off   缓冲区中的数据，最开头那一位的版本号
-// NOTE: repl_backlog_idx\repl_backlog_size 才是作为数组的下标使用
+// NOTE: master_repl_offset\repl_backlog->offset 这两个都是不断累加的，相当于一个版本号
+//       master_repl_offset    缓冲区中的数据，最末尾那一位的版本号
+//       repl_backlog->offset  缓冲区中的数据，最开头那一位的版本号
 //==========================================================
 
     // backlog 的过期时间
@@ -1426,6 +1945,8 @@ struct redisServer {
     char *masterauth;               /* AUTH with this password with master */
     // 对应的 master 地址
     char *masterhost;               /* Hostname of master */
+    // 最近一次处理的 REPLCONF TIMESTAMP 中 master 的时间，用来估计读取的延迟
+    long long master_timestamp;     /* Master time of the last heartbeat. */
     // 对应的 master 端口
     int masterport;                 /* Port of master */
     // 超时时间，超时则视为 master <--> slave 之间的连接断开；默认 REDIS_REPL_TIMEOUT 60s
@@ -1464,6 +1985,7 @@ struct redisServer {
     int repl_serve_stale_data; /* Serve stale data when link is down? */
     // 是否只读 slave ？
     int repl_slave_ro;          /* Slave is read only? */
+    int repl_slave_lazy_flush;  /* Lazy FLUSHALL before loading DB? */
     // 记录了 slave 连接断开的时间点
     time_t repl_down_since; /* Unix time at which link with master went down */
     // 是否要在 SYNC 之后关闭 NODELAY ？
@@ -1485,11 +2007,22 @@ struct redisServer {
     * 不采用聚合等待的方式，将会占用更多的网络资源，但是能够很好的降低 slave 的网络延迟问题（默认选择）
     */
     int repl_disable_tcp_nodelay;   /* Disable TCP_NODELAY after SYNC? */
+    // 是否直接将 RDB 写入 slave 的套接字，而不经过磁盘
+    int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
+    // 无盘复制开始前等待的秒数，以便让更多的 slave 共用同一次 fork
+    int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    // slave 是否直接从套接字载入 master 发来的 RDB ，而不经过磁盘
+    int repl_diskless_load;         /* Slave parse RDB directly from the socket.
+                                     * see REDIS_REPL_DISKLESS_LOAD_* enum */
+    // slave 是否要求 master 压缩复制连接上的数据
+    int repl_compression;           /* Ask the master for a compressed link. */
+    int repl_master_compression;    /* Compression accepted by the master for
+                                       the current link. */
 
     //  slave 优先级
     int slave_priority;             /* Reported in INFO and used by Sentinel. */
-    // 本服务器（ slave ）当前 master 的 RUN ID
-    char repl_master_runid[REDIS_RUN_ID_SIZE+1];  /* Master run id for PSYNC. */
+    // 本服务器（ slave ）当前 master 的复制 ID
+    char master_replid[REDIS_RUN_ID_SIZE+1];  /* Master replication ID for PSYNC. */
     // 初始化偏移量，将会在第一次进行 FULL SYNC 的时候，由 master 告知 slave：master 现在的 server.master_repl_offset 是多少
     // 因为 PSYNC 的关键是：master 不停地向 slave 推送数据，当断开连接时，自然是让 slave 告知 master：上次 slave 都到哪里了，我们继续
     long long repl_master_initial_offset;         /* Master PSYNC offset. */
@@ -1506,18 +2039,38 @@ struct redisServer {
 
     /* Synchronous replication. */
     list *clients_waiting_acks;         /* Clients waiting in WAIT command. */
+    list *clients_waiting_offset;       /* Clients waiting in WAITOFFSET. */
     int get_ack_from_slaves;            /* If true we send REPLCONF GETACK. */
     /* Limits */
     int maxclients;                 /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int lfu_log_factor;             /* LFU logarithmic counter factor. */
+    int lfu_decay_time;             /* LFU counter decay factor. */
+    /* Hot keys */
+    int hotkeys_tracking;           /* Sample lookups to find hot keys? */
+    int hotkeys_sample_rate;        /* Sample one lookup every N. */
+    int hotkeys_window;             /* Seconds of a hot keys window. */
+    /* Lazy free */
+    int lazyfree_lazy_eviction;     /* Free evicted keys in background */
+    int lazyfree_lazy_expire;       /* Free expired keys in background */
+    int lazyfree_lazy_server_del;   /* Implicit deletes in background */
+    /* Active defragmentation */
+    int active_defrag_enabled;
+    unsigned long long active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
+    int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
+    int active_defrag_threshold_upper; /* maximum percentage of fragmentation at which we use maximum effort */
+    int active_defrag_cycle_min;       /* minimal effort for defrag in CPU percentage */
+    int active_defrag_cycle_max;       /* maximal effort for defrag in CPU percentage */
+    // 正在进行碎片整理时，保存当前使用的 CPU 百分比，否则为 0
+    int active_defrag_running;      /* Active defragmentation running (holds current scan aggressiveness) */
 
 
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
-    list *ready_keys;        /* List of readyList structures for BLPOP & co，将会被 handleClientsBlockedOnLists() 处理 */
+    list *ready_keys;        /* List of readyList structures for BLPOP & co，将会被 handleClientsBlockedOnKeys() 处理 */
     // 里面保存了刚刚执行了 push 的 key(顺序保存)，能被加入 ready_keys 的前提是：这个 key 是被 block 的
 
     /* Sort parameters - qsort_r() is only available under BSD so we
@@ -1531,12 +2084,16 @@ struct redisServer {
     /* Zip structure config, see redis.conf for more information  */
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
-    size_t list_max_ziplist_entries;
-    size_t list_max_ziplist_value;
+    size_t hash_ziplist_index_entries; /* Index listpack hashes above this. */
+    int list_max_ziplist_size;
+    int list_compress_depth;
     size_t set_max_intset_entries;
+    size_t string_chunk_threshold;  /* APPEND / SETRANGE chunk above this. */
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     size_t hll_sparse_max_bytes;
+    size_t stream_node_max_bytes;
+    long long stream_node_max_entries;
     time_t unixtime;        /* Unix time sampled every cron cycle. */
     long long mstime;       /* Like 'unixtime' but with milliseconds resolution. */
 
@@ -1550,8 +2107,18 @@ struct redisServer {
     // 这个链表记录了客户端订阅的所有模式的名字
     list *pubsub_patterns;  /* A list of pubsub_patterns */
 
+    // 按模式的字面前缀（第一个通配符之前的部分）索引 pubsub_patterns，
+    // 值为 pubsubPattern 链表，发布时只需匹配前缀命中的模式
+    struct rax *pubsub_patterns_index; /* Literal prefix -> list of pubsubPattern */
+
+    // 分片频道，结构和 pubsub_channels 相同
+    dict *pubsubshard_channels; /* Map shard channels to list of clients */
+
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of REDIS_NOTIFY... flags. */
+    /* Client side caching. */
+    unsigned int tracking_clients;  /* # of clients with tracking enabled.*/
+    size_t tracking_table_max_keys; /* Max number of keys in tracking table. */
 
 
     /* Cluster */
@@ -1576,6 +2143,8 @@ struct redisServer {
 
     // 一个字典，值为 Lua 脚本，键为脚本的 SHA1 校验和
     dict *lua_scripts;         /* A dictionary of SHA1 -> Lua scripts */
+    // 以名字保存的函数，保存在 RDB 和 AOF 中
+    dict *lua_functions;       /* Function name -> luaFunction. */
     // Lua 脚本的执行时限
     mstime_t lua_time_limit;  /* Script timeout in milliseconds */
     // 脚本开始执行的时间
@@ -1596,6 +2165,16 @@ struct redisServer {
     // 是否要杀死脚本
     int lua_kill;         /* Kill the script if true. */
 
+    // 脚本是否以它执行的写命令（而不是整个脚本）的形式传播
+    int lua_always_replicate_commands; /* Default replication type. */
+    int lua_replicate_commands; /* True if we are doing single commands repl. */
+    int lua_multi_emitted;/* True if we already propagated MULTI. */
+    int lua_repl;         /* Script replication flags for redis.set_repl(),
+                             REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL. */
+    // redis.call() 执行命令期间，回复直接推入 Lua 栈
+    int lua_reply_sink;   /* True while the reply of a command called from
+                             Lua is pushed directly on the Lua stack. */
+
 
     /* Assert & bug reporting */
 
@@ -1662,6 +2241,12 @@ struct redisCommand {
     // microseconds 记录了命令执行耗费的总毫微秒数
     // calls 是命令被执行的总次数
     long long microseconds, calls;
+
+    // 命令执行时间的直方图，在命令第一次被执行时创建
+    latencyHistogram *latency_histogram;
+
+    // 模块注册的命令，指向模块的实现函数
+    struct RedisModuleCommandProxy *module_cmd; /* NULL if not a module command. */
 };
 
 struct redisFunctionSym {
@@ -1688,6 +2273,19 @@ typedef struct _redisSortObject {
 
 } redisSortObject;
 
+/* A BY / GET pattern parsed once per SORT call, so that looking it up for
+ * every element does not have to scan the pattern or allocate objects.
+ *
+ * 每次 SORT 只解析一次模式，逐个元素查找时复用 key 名缓冲区。 */
+typedef struct _sortPattern {
+    robj *pattern;      /* Pattern as given by the user. */
+    int self;           /* Pattern is "#". */
+    int prefixlen;      /* Bytes before the '*', -1 if there is no '*'. */
+    int postfixlen;     /* Bytes after the '*', excluding "->field". */
+    robj *field;        /* Hash field, or NULL for string keys. */
+    robj *keyobj;       /* Reused key name, NULL until first lookup. */
+} sortPattern;
+
 // 排序操作
 typedef struct _redisSortOperation {
 
@@ -1698,6 +2296,9 @@ typedef struct _redisSortOperation {
     // 用户给定的模式
     robj *pattern;
 
+    // 解析后的模式
+    sortPattern lookup;
+
 } redisSortOperation;
 
 // Type 类型的结构体，是为了能够兼容底层多种编码方式的存在
@@ -1712,19 +2313,14 @@ typedef struct {
     // 列表对象
     robj *subject;
 
-    // 对象所使用的编码（ziplist\link-list）
+    // 对象所使用的编码（quicklist）
     unsigned char encoding;
 
     // 迭代的方向
     unsigned char direction; /* Iteration direction */
 
-    // ziplist 索引，迭代 ziplist 编码的列表时使用（指向的这一个节点，需要多少 offset）
-    // 总是指向下一个 node
-    unsigned char *zi;
-
-    // 链表节点的指针，迭代双端链表编码的列表时使用
-    // 总是指向下一个 node
-    listNode *ln;
+    // quicklist 迭代器，总是指向下一个 node
+    quicklistIter *iter;
 
 } listTypeIterator;
 
@@ -1739,20 +2335,12 @@ typedef struct {
 typedef struct {
 
     // 列表迭代器（避免迭代器失效）
-    // listTypeGet() 里面会用到
-    // 之所以要这样存一下，是因为，当你只拿到了 listTypeEntry 这一个 struct
-    // 你是没办法确定究竟应该用 zi 还是 ln 来读取数据（你没办法判断 zi == NULL, ln == NULL 究竟是正确的，还是一个异常的行为）
-    // 所以才要利用到 li->encoding
-    // 另一个作用的地方是 listTypeDelete()，更新链表头、更新 zi（ln 不需要，因为 ln 不会整体进行内存 realloc）
+    // listTypeGet() 里面会用到，用来确认 encoding
+    // 另一个作用的地方是 listTypeDelete()，删除之后需要更新 quicklist 迭代器
     listTypeIterator *li;
 
-    // ziplist 节点索引
-    // 指向当前的 node
-    unsigned char *zi;  /* Entry in ziplist */
-
-    // 双端链表节点指针
-    // 指向当前的 node
-    listNode *ln;       /* Entry in linked list */
+    // quicklist 元素，指向当前的 node
+    quicklistEntry entry; /* Entry in quicklist */
 
 } listTypeEntry;
 
@@ -1792,7 +2380,7 @@ typedef struct {
     int encoding;
 
     // 域指针和值指针
-    // 在迭代 ZIPLIST 编码的哈希对象时使用
+    // 在迭代 LISTPACK 编码的哈希对象时使用
     unsigned char *fptr, *vptr;
 
     // 字典迭代器和指向当前迭代字典节点的指针
@@ -1801,6 +2389,46 @@ typedef struct {
     dictEntry *de;
 } hashTypeIterator;
 
+/* A listpack encoded hash with more than hash-ziplist-index-entries fields
+ * also gets an open addressing table (linear probing) holding the offset of
+ * every field entry inside the listpack, so that lookups don't need to scan
+ * it. The listpack itself has exactly the same layout of a plain
+ * REDIS_ENCODING_LISTPACK hash, so iterators, RDB and AOF just use 'lp'.
+ *
+ * 偏移量为 0 表示空桶（listpack 头部占 6 字节，entry 偏移不可能为 0）。 */
+typedef struct hashListpackIndex {
+    unsigned char *lp;      /* Fields and values, like a LISTPACK hash. */
+    uint32_t mask;          /* Number of buckets - 1, buckets are 2^n. */
+    uint32_t used;          /* Number of indexed fields. */
+    uint32_t offsets[];     /* Field entry offsets inside lp, 0 = empty. */
+} hashListpackIndex;
+
+/* A REDIS_ENCODING_CHUNKED string: APPEND and SETRANGE switch strings longer
+ * than string-chunk-threshold to this encoding, so that growing them never
+ * reallocates (and copies) the whole value. Every chunk but the last one is
+ * exactly REDIS_STRING_CHUNK_BYTES long, so the chunk holding a given offset
+ * is found with a division. Only the commands asking for it with
+ * REDIS_LOOKUP_CHUNKED ever see this encoding: all the other lookups turn the
+ * value back into a plain sds first.
+ *
+ * 除了最后一块，每块都正好 REDIS_STRING_CHUNK_BYTES 字节。 */
+#define REDIS_STRING_CHUNK_BYTES (1024*1024)
+typedef struct stringChunks {
+    size_t len;         /* Total length of the string. */
+    size_t count;       /* Chunks in use. */
+    size_t slots;       /* Allocated slots of 'chunk'. */
+    size_t tail_alloc;  /* Allocated bytes of the last chunk. */
+    char **chunk;
+} stringChunks;
+
+/* True for both the plain and the indexed listpack hash encodings. */
+#define hashTypeIsListpack(o) ((o)->encoding == REDIS_ENCODING_LISTPACK || \
+                               (o)->encoding == REDIS_ENCODING_LISTPACK_IDX)
+/* The listpack of a hash in one of the two encodings above. */
+#define hashTypeListpack(o) ((o)->encoding == REDIS_ENCODING_LISTPACK_IDX ? \
+                             ((hashListpackIndex*)(o)->ptr)->lp : \
+                             (unsigned char*)(o)->ptr)
+
 // 取出 field 还是 value 字段
 #define REDIS_HASH_KEY 1
 #define REDIS_HASH_VALUE 2
@@ -1816,10 +2444,16 @@ extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType keyptrDictType;
+extern dictType clientUsageDictType;
+extern dictType snapshotKeysDictType;
+extern dictType hllCacheSourcesDictType;
 extern dictType shaScriptObjectDictType;
+extern dictType functionsDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern dictType objectKeyHeapPointerValueDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -1829,6 +2463,7 @@ extern dictType replScriptCacheDictType;
 long long ustime(void);
 long long mstime(void);
 void getRandomHexChars(char *p, unsigned int len);
+void crc64_init(void);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 void exitFromChild(int retcode);
 size_t redisPopcount(void *s, long count);
@@ -1841,11 +2476,16 @@ void freeClient(redisClient *c);
 void freeClientAsync(redisClient *c);
 void resetClient(redisClient *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+int prepareClientToWrite(redisClient *c);
 void addReply(redisClient *c, robj *obj);
 void *addDeferredMultiBulkLength(redisClient *c);
 void setDeferredMultiBulkLength(redisClient *c, void *node, long length);
+void setDeferredMapLen(redisClient *c, void *node, long length);
+void setDeferredSetLen(redisClient *c, void *node, long length);
 void addReplySds(redisClient *c, sds s);
+void addReplyString(redisClient *c, char *s, size_t len);
 void processInputBuffer(redisClient *c);
+void processInputBufferAndReplicate(redisClient *c);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1860,8 +2500,17 @@ void addReplyError(redisClient *c, char *err);
 void addReplyStatus(redisClient *c, char *status);
 void addReplyDouble(redisClient *c, double d);
 void addReplyLongLong(redisClient *c, long long ll);
+void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix);
 void addReplyMultiBulkLen(redisClient *c, long length);
+void addReplyMapLen(redisClient *c, long length);
+void addReplySetLen(redisClient *c, long length);
+void addReplyPushLen(redisClient *c, long length);
+void addReplyNull(redisClient *c);
+void addReplyNullArray(redisClient *c);
+void addReplyBool(redisClient *c, int b);
 void copyClientOutputBuffer(redisClient *dst, redisClient *src);
+void clientResizeReplyBuffer(redisClient *c, size_t size);
+void freeClientArgvPool(redisClient *c);
 void *dupClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
@@ -1869,9 +2518,15 @@ void formatPeerId(char *peerid, size_t peerid_len, char *ip, int port);
 char *getClientPeerId(redisClient *client);
 sds catClientInfoString(sds s, redisClient *client);
 sds getAllClientsInfoString(void);
+void clientFoldUsage(redisClient *c);
+redisClient *lookupClientByID(uint64_t id);
+int clientSetNameOrReply(redisClient *c, robj *name);
 void rewriteClientCommandVector(redisClient *c, int argc, ...);
+void replaceClientCommandVector(redisClient *c, int argc, robj **argv);
 void rewriteClientCommandArgument(redisClient *c, int i, robj *newval);
+size_t zmalloc_size_sds(sds s);
 unsigned long getClientOutputBufferMemoryUsage(redisClient *c);
+int clientHasPendingReplies(redisClient *c);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(redisClient *c);
 int getClientLimitClassByName(char *name);
@@ -1882,6 +2537,13 @@ int listenToPort(int port, int *fds, int *count);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
+void initThreadedIO(void);
+int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingReads(void);
+void handleShmClients(void);
+void prepareShmClientsToSleep(void);
+void holdClientRepliesForAof(redisClient *c);
+void releaseClientsWaitingAof(void);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(redisClient *c, const char *fmt, ...)
@@ -1894,7 +2556,6 @@ void addReplyStatusFormat(redisClient *c, const char *fmt, ...);
 #endif
 
 /* List data type */
-void listTypeTryConversion(robj *subject, robj *value);
 void listTypePush(robj *subject, robj *value, int where);
 robj *listTypePop(robj *subject, int where);
 unsigned long listTypeLength(robj *subject);
@@ -1906,8 +2567,7 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
 void listTypeDelete(listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
-void unblockClientWaitingData(redisClient *c);
-void handleClientsBlockedOnLists(void);
+void serveClientsBlockedOnListKey(robj *o, readyList *rl);
 void popGenericCommand(redisClient *c, int where);
 
 /* MULTI/EXEC/WATCH... */
@@ -1918,6 +2578,7 @@ void queueMultiCommand(redisClient *c);
 void touchWatchedKey(redisDb *db, robj *key);
 void touchWatchedKeysOnFlush(int dbid);
 void discardTransaction(redisClient *c);
+void execCommandPropagateMulti(redisClient *c);
 void flagTransaction(redisClient *c);
 
 /* Redis object implementation */
@@ -1930,6 +2591,8 @@ void freeListObject(robj *o);
 void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
+void freeStreamObject(robj *o);
+void dismissObject(robj *o, size_t size_hint);
 robj *createObject(int type, void *ptr);
 robj *createStringObject(char *ptr, size_t len);
 robj *createRawStringObject(char *ptr, size_t len);
@@ -1941,16 +2604,18 @@ robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value);
-robj *createListObject(void);
+robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
+robj *createStreamObject(void);
 int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *msg);
 int checkType(redisClient *c, robj *o, int type);
 int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg);
+int getDoubleFromObject(robj *o, double *target);
 int getDoubleFromObjectOrReply(redisClient *c, robj *o, double *target, const char *msg);
 int getLongLongFromObject(robj *o, long long *target);
 int getLongDoubleFromObject(robj *o, long double *target);
@@ -1960,6 +2625,13 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
+struct redisMemOverhead *getMemoryOverheadData(void);
+void freeMemoryOverheadData(struct redisMemOverhead *mh);
+unsigned long LFUGetTimeInMinutes(void);
+unsigned long LFUDecrAndReturn(robj *o);
+void updateLFU(robj *o);
+void initObjectLRUOrLFU(robj *o);
 #define sdsEncodedObject(objptr) (objptr->encoding == REDIS_ENCODING_RAW || objptr->encoding == REDIS_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1969,44 +2641,75 @@ ssize_t syncReadLine(int fd, char *ptr, ssize_t size, long long timeout);
 
 /* Replication */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
+void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
 void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **argv, int argc);
-void updateSlavesWaitingBgsave(int bgsaveerr);
+void updateSlavesWaitingBgsave(int bgsaveerr, int type);
 void replicationCron(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(redisClient *c);
+void replicationCacheMasterUsingMyself(void);
+void changeReplicationId(void);
+void clearReplicationId2(void);
+void shiftReplicationId(void);
 void resizeReplicationBacklog(long long newsize);
+void freeReplicationBacklog(void);
+sds replEncodeFrame(sds dst, const char *p, size_t len);
+ssize_t replReadFrames(int fd, sds *zbuf, sds *dst, size_t maxraw);
+void prepareReplicasToWrite(void);
+void incrementalTrimReplicationBacklog(size_t max_blocks);
+void releaseReplicaReplicationBuffer(redisClient *c);
+unsigned long getReplicaReplicationBufferMemoryUsage(redisClient *c);
 void replicationSetMaster(char *ip, int port);
 void replicationUnsetMaster(void);
 void refreshGoodSlavesCount(void);
 void replicationScriptCacheInit(void);
 void replicationScriptCacheFlush(void);
+int replicationSetupSlaveForFullResync(redisClient *slave, long long offset);
+int startBgsaveForReplication(int mincapa);
+long long getPsyncInitialOffset(void);
 void replicationScriptCacheAdd(sds sha1);
 int replicationScriptCacheExists(sds sha1);
 void processClientsWaitingReplicas(void);
 void unblockClientWaitingReplicas(redisClient *c);
+long long replicationGetReadOffset(void);
+long long replicationGetReadLag(void);
+void replicationSendHeartbeat(void);
+void processClientsWaitingOffset(void);
+void unblockClientWaitingOffset(redisClient *c);
 int replicationCountAcksByOffset(long long offset);
 void replicationSendNewlineToMaster(void);
 long long replicationGetSlaveOffset(void);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
+void startLoadingWithSize(off_t size);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
 /* RDB persistence */
 #include "rdb.h"
 
+/* Stream data type */
+#include "stream.h"
+void serveClientsBlockedOnStreamKey(robj *o, readyList *rl);
+
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+void feedAppendOnlyFileBatch(redisOpArray *oa);
+sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int rioWriteBulkObject(rio *r, robj *obj);
+int loadAppendOnlyFiles(aofManifest *am);
+void aofLoadManifestFromDisk(void);
+void aofOpenIfNeededOnServerStart(void);
 void stopAppendOnly(void);
+void aofWriterInit(void);
+int aofGroupCommitActive(void);
+size_t aofWriterBufferSize(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
-void aofRewriteBufferReset(void);
-unsigned long aofRewriteBufferSize(void);
 
 /* Sorted sets data type */
 
@@ -2031,17 +2734,20 @@ typedef struct {
 /* zsl, zip-skip-list */
 zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl);
-zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score);
-int zslDelete(zskiplist *zsl, double score, robj *obj);
+int zslDelete(zskiplist *zsl, double score, sds ele);
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore);
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
 zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range);
+unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 double zzlGetScore(unsigned char *sptr);
 void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 unsigned int zsetLength(robj *zobj);
+int zsetScore(robj *zobj, robj *member, double *score);
 void zsetConvert(robj *zobj, int encoding);
-unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
+unsigned long zslGetRank(zskiplist *zsl, double score, sds ele);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
@@ -2052,8 +2758,13 @@ struct redisCommand *lookupCommandByCString(char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(redisClient *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
+void propagateBatch(redisOpArray *oa);
+void redisOpArrayInit(redisOpArray *oa);
+int redisOpArrayAppend(redisOpArray *oa, struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
+void redisOpArrayFree(redisOpArray *oa);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
 void forceCommandPropagation(redisClient *c, int flags);
+void preventCommandPropagation(redisClient *c);
 int prepareForShutdown();
 #ifdef __GNUC__
 void redisLog(int level, const char *fmt, ...)
@@ -2069,6 +2780,7 @@ int htNeedsResize(dict *dict);
 void oom(const char *msg);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
+void resetCommandStats(struct redisCommand *c);
 void adjustOpenFilesLimit(void);
 void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
@@ -2088,10 +2800,20 @@ int setTypeRandomElement(robj *setobj, robj **objele, int64_t *llele);
 unsigned long setTypeSize(robj *subject);
 void setTypeConvert(robj *subject, int enc);
 
+/* String data type */
+void stringConvertToChunked(robj *o);
+void stringConvertToRaw(robj *o);
+void stringChunksAppend(stringChunks *sc, const char *s, size_t len);
+void stringChunksFree(stringChunks *sc);
+size_t stringChunksAllocSize(stringChunks *sc);
+size_t stringChunksAt(stringChunks *sc, size_t j, char **p);
+
 /* Hash data type */
 void hashTypeConvert(robj *o, int enc);
 void hashTypeTryConversion(robj *subject, robj **argv, int start, int end);
 void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2);
+void hashTypeTryIndexListpack(robj *o);
+size_t hashTypeIndexBytes(robj *o);
 robj *hashTypeGetObject(robj *o, robj *key);
 int hashTypeExists(robj *o, robj *key);
 int hashTypeSet(robj *o, robj *key, robj *value);
@@ -2100,7 +2822,7 @@ unsigned long hashTypeLength(robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll);
@@ -2114,6 +2836,11 @@ int pubsubUnsubscribeAllPatterns(redisClient *c, int notify);
 void freePubsubPattern(void *p);
 int listMatchPubsubPattern(void *a, void *b);
 int pubsubPublishMessage(robj *channel, robj *message);
+int pubsubUnsubscribeShardAllChannels(redisClient *c, int notify);
+void pubsubShardUnsubscribeAllClients(robj *channel);
+int pubsubPublishShardMessage(robj *channel, robj *message);
+int pubsubChannelHasSubscribers(robj *channel);
+int clientSubscriptionsCount(redisClient *c);
 
 /* Keyspace events notification */
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
@@ -2126,10 +2853,15 @@ void appendServerSaveParams(time_t seconds, int changes);
 void resetServerSaveParams();
 struct rewriteConfigState; /* Forward declaration to export API. */
 void rewriteConfigRewriteLine(struct rewriteConfigState *state, char *option, sds line, int force);
+void rewriteConfigMarkAsProcessed(struct rewriteConfigState *state, char *option);
 int rewriteConfig(char *path);
 
 /* db.c -- Keyspace access API */
 int removeExpire(redisDb *db, robj *key);
+int dbDeleteExpire(redisDb *db, sds key);
+void expireIndexSetup(redisDb *db, int enable);
+void expireIndexFlush(redisDb *db, int async);
+long long expireIndexDecodeKey(unsigned char *buf, size_t len, unsigned char **key, size_t *keylen);
 void propagateExpire(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
@@ -2137,6 +2869,10 @@ void setExpire(redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key);
 robj *lookupKeyRead(redisDb *db, robj *key);
 robj *lookupKeyWrite(redisDb *db, robj *key);
+#define REDIS_LOOKUP_NONE 0
+#define REDIS_LOOKUP_CHUNKED (1<<0) /* Caller handles REDIS_ENCODING_CHUNKED. */
+robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+robj *lookupKeyWriteWithFlags(redisDb *db, robj *key, int flags);
 robj *lookupKeyReadOrReply(redisClient *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(redisClient *c, robj *key, robj *reply);
 void dbAdd(redisDb *db, robj *key, robj *val);
@@ -2145,24 +2881,120 @@ void setKey(redisDb *db, robj *key, robj *val);
 int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
+int dbSyncDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
-long long emptyDb(void(callback)(void*));
+#define EMPTYDB_NO_FLAGS 0      /* No flags. */
+#define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
+long long emptyDb(int flags, void(callback)(void*));
+/* Keyspace detached by backupDb(), see repl-diskless-load swapdb. */
+typedef struct dbBackup {
+    dict **dicts;               /* Main dictionary of every DB. */
+    dict **expires;             /* Expires dictionary of every DB. */
+    struct rax **expires_index; /* Expire index of every DB, or NULL. */
+    dict **slots_to_keys;       /* Cluster slots to keys map, or NULL. */
+} dbBackup;
+dbBackup *backupDb(void);
+void discardDbBackup(dbBackup *backup, int flags);
+void restoreDbBackup(dbBackup *backup);
 int selectDb(redisClient *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+dict **slotToKeyCreate(void);
+void slotToKeyRelease(dict **slots);
+size_t slotToKeyCount(dict **slots);
+void slotToKeyAdd(sds key);
+void slotToKeyDel(robj *key);
+void slotToKeyFlush(void);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
 int verifyClusterConfigWithData(void);
 void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor);
+char *getObjectTypeName(robj *o);
 int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor);
 
+/* lazyfree.c -- Background freeing of big values and databases */
+extern volatile int lazyfree_jobs;
+/* While the bio thread is freeing objects refcounts are updated atomically */
+#define lazyfreeInProgress() (lazyfree_jobs != 0)
+int dbAsyncDelete(redisDb *db, robj *key);
+void emptyDbAsync(redisDb *db);
+void freeDbDictsAsync(dict *ht1, dict *ht2);
+void freeExpireIndexAsync(rax *index);
+void slotToKeyFlushAsync(void);
+void freeSlotsMapAsync(dict **slots);
+size_t lazyfreeGetPendingObjectsCount(void);
+size_t lazyfreeGetFreeEffort(robj *obj);
+void lazyfreeFreeObjectFromBioThread(robj *o);
+void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
+void lazyfreeFreeSlotsMapFromBioThread(dict **slots);
+void lazyfreeFreeExpireIndexFromBioThread(rax *index);
+
+/* tracking.c -- Client side caching */
+void enableTracking(redisClient *c, uint64_t redirect_to, int options, robj **prefix, size_t numprefix);
+void disableTracking(redisClient *c);
+void trackingRememberKeys(redisClient *tracking, redisClient *c);
+void trackingInvalidateKey(robj *keyobj);
+void trackingInvalidateKeysOnFlush(int dbid);
+void trackingLimitUsedSlots(void);
+void trackingBroadcastInvalidationMessages(void);
+uint64_t trackingGetTotalItems(void);
+uint64_t trackingGetTotalKeys(void);
+uint64_t trackingGetTotalPrefixes(void);
+
+/* snapshot.c -- Forkless RDB snapshots */
+int rdbSaveForkless(char *filename);
+void snapshotAbort(void);
+void snapshotKeyWillChange(redisDb *db, sds key);
+void snapshotKeyAdded(redisDb *db, sds key);
+void snapshotFlushDb(int dbid);
+
+/* hyperloglog.c -- PFCOUNT union cache */
+void hllCacheKeyChanged(redisDb *db, sds key);
+void hllCacheFlush(int dbid);
+
+/* childinfo.c -- Info sent by the children to the parent */
+void openChildInfoPipe(void);
+void closeChildInfoPipe(void);
+void sendChildInfo(int ptype, size_t cow_size);
+void sendChildInfoIfNeeded(void);
+void receiveChildInfo(void);
+
+/* defrag.c -- Active defragmentation */
+void activeDefragCycle(void);
+
+/* hotkeys.c -- Hot keys detection */
+void hotkeysTrackAccess(redisDb *db, sds key);
+void hotkeysReset(void);
+sds genHotkeysInfoString(sds info);
+
+/* shmtransport.c -- Shared memory transport */
+typedef struct shmTransport shmTransport;
+shmTransport *shmTransportCreate(uint64_t id, size_t ringsize);
+const char *shmTransportPath(shmTransport *t);
+void shmTransportRelease(shmTransport *t);
+int shmTransportRead(shmTransport *t, char *buf, size_t len);
+int shmTransportWritev(shmTransport *t, const struct iovec *iov, int iovcnt);
+int shmTransportHasInput(shmTransport *t);
+int shmTransportHasRoom(shmTransport *t);
+int shmTransportPrepareSleep(shmTransport *t, int want_room);
+
+/* cpuaffinity.c -- CPU and NUMA placement */
+int cpulistIsValid(const char *cpulist);
+void redisSetCpuAffinity(const char *cpulist);
+void redisBindMemoryToLocalNode(void);
+
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *lmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *blmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *memoryGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 /* Cluster */
 void clusterInit(void);
@@ -2171,6 +3003,11 @@ unsigned int keyHashSlot(char *key, int keylen);
 void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
+void migrateAsyncCron(void);
+int migrateKeysLocked(redisDb *db, struct redisCommand *cmd, robj **argv, int argc);
+void unblockClientFromMigrate(redisClient *c);
+void clusterSlotMigrationFeed(struct redisCommand *cmd, int dbid, robj **argv, int argc);
+void clusterImportSlotAbort(redisClient *c);
 void clusterBeforeSleep(void);
 
 /* Sentinel */
@@ -2182,6 +3019,36 @@ void sentinelIsRunning(void);
 
 /* Scripting */
 void scriptingInit(void);
+void luaReplySinkRaw(const char *p, size_t len);
+void luaReplySinkString(const char *p, size_t len);
+void luaReplySinkInteger(long long ll);
+void luaReplySinkNull(void);
+void luaReplySinkStatus(const char *p, size_t len);
+void luaReplySinkError(const char *p, size_t len);
+void luaReplySinkAggregate(long len);
+void *luaReplySinkDeferredAggregate(void);
+void luaReplySinkSetDeferredAggregate(void *node, long len);
+int luaFunctionCreate(redisClient *c, robj *name, robj *body);
+void luaFunctionsFlush(void);
+
+/* Modules */
+void moduleInitModulesSystem(void);
+int moduleLoad(const char *path, void **argv, int argc);
+void queueLoadModule(sds path, sds *argv, int argc);
+void moduleLoadFromQueue(void);
+moduleType *moduleTypeLookupByName(const char *name);
+robj *createModuleObject(moduleType *mt, void *value);
+void freeModuleObject(robj *o);
+robj *moduleTypeLoadValue(rio *rdb);
+int moduleTypeSaveValue(robj *o, rio *rdb);
+int rewriteModuleObject(rio *r, robj *key, robj *o);
+void moduleAcquireGIL(void);
+void moduleReleaseGIL(void);
+void moduleBlockedClientPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask);
+void moduleHandleBlockedClients(void);
+void moduleBlockedClientTimedOut(redisClient *c);
+void unblockClientFromModule(redisClient *c);
+void rewriteConfigLoadmoduleOption(struct rewriteConfigState *state);
 
 /* Blocked clients */
 void processUnblockedClients(void);
@@ -2189,6 +3056,10 @@ void blockClient(redisClient *c, int btype);
 void unblockClient(redisClient *c);
 void replyToBlockedClientTimedOut(redisClient *c);
 int getTimeoutFromObjectOrReply(redisClient *c, robj *object, mstime_t *timeout, int unit);
+void blockForKeys(redisClient *c, int btype, robj **keys, int numkeys, mstime_t timeout, robj *target, streamID *ids);
+void unblockClientWaitingData(redisClient *c);
+void signalKeyAsReady(redisClient *c, robj *key);
+void handleClientsBlockedOnKeys(void);
 
 /* Git SHA1 */
 char *redisGitSHA1(void);
@@ -2205,6 +3076,7 @@ void setexCommand(redisClient *c);
 void psetexCommand(redisClient *c);
 void getCommand(redisClient *c);
 void delCommand(redisClient *c);
+void unlinkCommand(redisClient *c);
 void existsCommand(redisClient *c);
 void setbitCommand(redisClient *c);
 void getbitCommand(redisClient *c);
@@ -2250,6 +3122,7 @@ void spopCommand(redisClient *c);
 void srandmemberCommand(redisClient *c);
 void sinterCommand(redisClient *c);
 void sinterstoreCommand(redisClient *c);
+void sintercardCommand(redisClient *c);
 void sunionCommand(redisClient *c);
 void sunionstoreCommand(redisClient *c);
 void sdiffCommand(redisClient *c);
@@ -2262,6 +3135,7 @@ void sortCommand(redisClient *c);
 void lremCommand(redisClient *c);
 void rpoplpushCommand(redisClient *c);
 void infoCommand(redisClient *c);
+void metricsCommand(redisClient *c);
 void mgetCommand(redisClient *c);
 void monitorCommand(redisClient *c);
 void expireCommand(redisClient *c);
@@ -2283,6 +3157,7 @@ void zrangebyscoreCommand(redisClient *c);
 void zrevrangebyscoreCommand(redisClient *c);
 void zrangebylexCommand(redisClient *c);
 void zrevrangebylexCommand(redisClient *c);
+void zrangestoreCommand(redisClient *c);
 void zcountCommand(redisClient *c);
 void zlexcountCommand(redisClient *c);
 void zrevrangeCommand(redisClient *c);
@@ -2295,6 +3170,8 @@ void multiCommand(redisClient *c);
 void execCommand(redisClient *c);
 void discardCommand(redisClient *c);
 void blpopCommand(redisClient *c);
+void lmpopCommand(redisClient *c);
+void blmpopCommand(redisClient *c);
 void brpopCommand(redisClient *c);
 void brpoplpushCommand(redisClient *c);
 void appendCommand(redisClient *c);
@@ -2311,12 +3188,20 @@ void hlenCommand(redisClient *c);
 void zremrangebyrankCommand(redisClient *c);
 void zunionstoreCommand(redisClient *c);
 void zinterstoreCommand(redisClient *c);
+void zunionCommand(redisClient *c);
+void zinterCommand(redisClient *c);
 void zscanCommand(redisClient *c);
 void hkeysCommand(redisClient *c);
 void hvalsCommand(redisClient *c);
 void hgetallCommand(redisClient *c);
 void hexistsCommand(redisClient *c);
 void hscanCommand(redisClient *c);
+void xaddCommand(redisClient *c);
+void xrangeCommand(redisClient *c);
+void xrevrangeCommand(redisClient *c);
+void xlenCommand(redisClient *c);
+void xreadCommand(redisClient *c);
+void xtrimCommand(redisClient *c);
 void configCommand(redisClient *c);
 void hincrbyCommand(redisClient *c);
 void hincrbyfloatCommand(redisClient *c);
@@ -2325,6 +3210,9 @@ void unsubscribeCommand(redisClient *c);
 void psubscribeCommand(redisClient *c);
 void punsubscribeCommand(redisClient *c);
 void publishCommand(redisClient *c);
+void ssubscribeCommand(redisClient *c);
+void sunsubscribeCommand(redisClient *c);
+void spublishCommand(redisClient *c);
 void pubsubCommand(redisClient *c);
 void watchCommand(redisClient *c);
 void unwatchCommand(redisClient *c);
@@ -2336,21 +3224,38 @@ void readonlyCommand(redisClient *c);
 void readwriteCommand(redisClient *c);
 void dumpCommand(redisClient *c);
 void objectCommand(redisClient *c);
+void memoryCommand(redisClient *c);
 void clientCommand(redisClient *c);
+void helloCommand(redisClient *c);
 void evalCommand(redisClient *c);
 void evalShaCommand(redisClient *c);
 void scriptCommand(redisClient *c);
+void functionCommand(redisClient *c);
+void fcallCommand(redisClient *c);
+void moduleCommand(redisClient *c);
 void timeCommand(redisClient *c);
+void latencyCommand(redisClient *c);
+void hotkeysCommand(redisClient *c);
 void bitopCommand(redisClient *c);
 void bitcountCommand(redisClient *c);
 void bitposCommand(redisClient *c);
+void bitfieldCommand(redisClient *c);
 void replconfCommand(redisClient *c);
 void waitCommand(redisClient *c);
+void waitoffsetCommand(redisClient *c);
 void pfselftestCommand(redisClient *c);
 void pfaddCommand(redisClient *c);
 void pfcountCommand(redisClient *c);
 void pfmergeCommand(redisClient *c);
 void pfdebugCommand(redisClient *c);
+void geoaddCommand(redisClient *c);
+void georadiusCommand(redisClient *c);
+void georadiusbymemberCommand(redisClient *c);
+void geosearchCommand(redisClient *c);
+void geosearchstoreCommand(redisClient *c);
+void geohashCommand(redisClient *c);
+void geoposCommand(redisClient *c);
+void geodistCommand(redisClient *c);
 
 #if defined(__GNUC__)
 void *calloc(size_t count, size_t size) __attribute__ ((deprecated));
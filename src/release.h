@@ -1,3 +1,3 @@
-#define REDIS_GIT_SHA1 "00000000"
-#define REDIS_GIT_DIRTY "0"
-#define REDIS_BUILD_ID "Jarvis-1611908068"
+#define REDIS_GIT_SHA1 "3eae0fb3"
+#define REDIS_GIT_DIRTY "211"
+#define REDIS_BUILD_ID "vm-1791985899"
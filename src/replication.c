@@ -110,6 +110,8 @@
  * */
 
 #include "redis.h"
+#include "lzf.h"
+#include "endianconv.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -120,6 +122,7 @@
 void replicationDiscardCachedMaster(void);
 void replicationResurrectCachedMaster(int newfd);
 void replicationSendAck(void);
+void putSlaveOnline(redisClient *slave);
 
 // TODO:（DONE） 总结一下: 同步阶段、命令传播阶段
 /* 1. [SLAVE]:
@@ -141,7 +144,7 @@ void replicationSendAck(void);
  * -------------- full sync ------------------------
  * 4. [MASTER]:
  *    1) 执行 bgsave，让子进程自个儿生成 RDB
- *    2) 父进程继续处理新的 CMD，并且把新的 CMD 缓冲在 slave client 的 buf 里面（但不发送）
+ *    2) 父进程继续处理新的 CMD，并且把新的 CMD 追加在共享的复制缓冲里面，slave 引用其中的位置（但不发送）
  *       以便待会追加数据
  *    3) 子进程完成了 RDB 文件，通知父进程，父进程开始将 RDB 文件发送给 slave
  *    [SLAVE]:
@@ -149,8 +152,8 @@ void replicationSendAck(void);
  *    2) 接受来自 master 的 RDB 文件，并加载进自己的进程内存中
  * 5. master <---> slave 完成 RDB 文件的同步
  *    [MASTER]:
- *    1) 开始把 4.2 里面的 client->buf 数据，追加发送给 slave，这时候走的是正常的 addReply
- *       所以即使来了新的 CMD，也是加在 buf 后面的
+ *    1) 开始从 4.2 里面 slave 引用的位置，把共享复制缓冲里面的数据发送给 slave
+ *       所以即使来了新的 CMD，也是追加在复制缓冲后面的
  *    2) 剩下的就是，master 每次 CMD 都存一下 backlog，传播一下 repl 的数据内容给 salve 就好了
  *
  * ...... 发生了网络波动，master <---> slave 短暂失联 ......
@@ -173,62 +176,40 @@ void replicationSendAck(void);
 // TODO:（DONE） slave 跟 master 之间的心跳机制。定期收发 PING、PONG
 
 /**
- * backlog 跟 client->buf 有什么区别？
- * backlog 是作为一个缓冲使用的，暂存所有 master --> slave 的 CMD
- * 当发生了 master <--> slave 短暂失联时，这个 master 就会利用这个 backlog 里面暂存的历史数据
- * 尝试跟 slave 进行 PSYNC，快速同步两者的数据库内容
- * 
- * client->buf 则是在完成同步之后，master 同步 CMD 给 slave 的方法；
- * 另一种使用情况是：master 在进行 bgsave --> 发送完 RDB 给 slave（full sync）期间依旧正常接受请求
- * 然后会把这期间的请求，保存至 client->buf 里面，然后等到发送完 RDB，client 的 write 解禁之后，
- * 就会开始向 slave 发送 client->buf 的数据，这样就能彻底同步了
- * （这个过程中，master 依旧会把 CMD 放进 backlog 里面，但是 backlog 不会在这个过程中被使用）
+ * backlog 跟 slave 的输出缓冲有什么区别？
+ * 现在两者是同一份数据：master --> slave 的 CMD 只追加一次，保存在共享的复制缓冲
+ * （server.repl_buffer_blocks）里面。
+ * backlog 只是引用了其中最旧的那个 block ，当发生了 master <--> slave 短暂失联时，
+ * master 就会利用这部分暂存的历史数据尝试跟 slave 进行 PSYNC，快速同步两者的数据库内容
+ *
+ * 每个 slave 则只记录自己发送到了哪个 block 的哪个位置（ref_repl_buf_node\ref_block_pos）；
+ * master 在进行 bgsave --> 发送完 RDB 给 slave（full sync）期间依旧正常接受请求，
+ * 这期间的请求同样追加在复制缓冲里面，slave 的引用会拖住这些 block 不被释放，
+ * 等到发送完 RDB，client 的 write 解禁之后，就会从引用的位置开始发送，这样就能彻底同步了
 */
 
 /* ---------------------------------- MASTER -------------------------------- */
 
-/* backlog 环形缓冲分类讨论：
- * 前提：这个环形缓冲是惰性丢弃数据的，哪怕 slave ack 了，也不删除旧的数据
- *      等到新的数据太多了，才会通过新数据覆盖旧数据的方式，被动删除旧数据（这点跟滑动窗口不一样）
- *
- * 情况一：没有溢出，也没有发生回旋
- * master_repl_offset 全部历史数据中最末尾的那一位，同时也是 当前有效数据 的最末尾那一位
- * repl_backlog_off   全部历史数据中最开头的那一位，同时也是 当前有效数据 的最开头那一位
- * 
- *   |<--------------------- repl_backlog_size --------------------->|
- *   |<----- histlen ---->|
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *   | 0| 1| 2| 3| 4| 5| 6|  |  |  |  |  |  |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *                      ^                     
- *                      |
- *              repl_backlog_idx
- * 
- * 情况二：发生回旋，但没有溢出
- * master_repl_offset 全部历史数据中最末尾的那一位，同时也是 当前有效数据 的最末尾那一位
- * repl_backlog_off   全部历史数据中最开头的那一位，同时也是 当前有效数据 的最开头那一位
- * 
- *   |<--------- repl_backlog_size -------->|
- *   -- histlen_2 -->|          |<----- histlen_1 ----
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *   | 7| 8| 9|10|11|  |  |  |  | 0| 1| 2| 3| 4| 5| 6|
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *                 ^                     
- *                 |
- *         repl_backlog_idx（下一个写入的位置）
- * 
- * 情况三：发生回旋，也发生溢出
- * master_repl_offset 全部历史数据中最末尾的那一位，不是 当前有效数据 的最末尾那一位
- * repl_backlog_off   全部历史数据中最开头的那一位，不是 当前有效数据 的最开头那一位
- * 
- *   |<--------- ---- repl_backlog_size ------------>|
- *   -------- histlen_2 ------->|<----- histlen_1 ----
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *   |12|13|14|15|16|17|18|19|20| 5| 6| 7| 8| 9|10|11|
- *   +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
- *                             ^                     
- *                             |
- *                     repl_backlog_idx（下一个写入的位置，同时也是最后一位有效数据 跟 第一位有效数据的开头 的分界线）
+/* 共享复制缓冲：
+ * 复制流只保存一份，放在 server.repl_buffer_blocks 这个由 replBufBlock 组成的链表里面，
+ * backlog 和每一个 slave 都只是持有某个 block 的引用（以及在 block 中的发送位置），
+ * 所以再多的 slave 也不会让同一个 CMD 被复制多份。
+ *
+ *   repl_backlog                   slave A              slave B
+ *        |                            |                    |
+ *        v                            v                    v
+ *   +---------+     +---------+     +---------+     +---------+
+ *   | block 0 | --> | block 1 | --> | block 2 | --> | block 3 |（追加写入的 tail）
+ *   +---------+     +---------+     +---------+     +---------+
+ *   |<----------------------- histlen ----------------------->|
+ *
+ * 1. 新的数据总是追加在最后一个 block 里面，写满了就创建新的 block；
+ *    已经写入的字节永远不会被修改，所以可以放心地被多个 slave 同时读取
+ * 2. slave 发送完一个 block 之后，就释放对它的引用，转而引用下一个 block
+ * 3. 当 histlen 超过了 repl_backlog_size ，并且第一个 block 只被 backlog 引用时，
+ *    释放第一个 block ，backlog 把引用移动到下一个 block；
+ *    某个 slave 落后太多，会拖住 block 的释放，这部分内存算在这个 slave 的输出缓冲上面，
+ *    超过 client-output-buffer-limit 之后，这个 slave 会被断开
  */
 
 // 创建 backlog
@@ -236,37 +217,26 @@ void createReplicationBacklog(void) {
 
     redisAssert(server.repl_backlog == NULL);
 
-    // backlog
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    // 第一个 block 要等到有数据写入时才会被引用
+    server.repl_backlog->ref_repl_buf_node = NULL;
     // 数据长度
-    server.repl_backlog_histlen = 0;
-    // 索引值，增加数据时使用
-    server.repl_backlog_idx = 0;
-    /* When a new backlog buffer is created, we increment the replication
-     * offset by one to make sure we'll not be able to PSYNC with any
-     * previous slave. This is needed because we avoid incrementing the
-     * master_repl_offset if no backlog exists nor slaves are attached. */
-    // 每次创建 backlog 时都将 master_repl_offset 增一
-    // 这是为了防止之前使用过 backlog 的 slave 引发错误的 PSYNC 请求
-    server.master_repl_offset++;
+    server.repl_backlog->histlen = 0;
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
      * replication stream. */
     // 尽管没有任何数据，
     // 但 backlog 第一个字节的逻辑位置应该是 repl_offset 后的第一个字节
-    server.repl_backlog_off = server.master_repl_offset+1;
+    server.repl_backlog->offset = server.master_repl_offset+1;
 }
 
 /* This function is called when the user modifies the replication backlog
- * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * size at runtime. Since the backlog is just a reference to the shared
+ * replication buffer, enlarging it is free, while shrinking it just trims
+ * the blocks that are no longer needed, keeping the most recent history. */
 // 动态调整 backlog 大小
-// 当 backlog 是被扩大时，原有的数据会被保留，
-// 因为分配空间使用的是 realloc
+// 不再需要重新分配缓冲区，原有的数据会被保留（缩小时只保留最新的那部分）
 void resizeReplicationBacklog(long long newsize) {
 
     // 不能小于最小大小
@@ -278,21 +248,18 @@ void resizeReplicationBacklog(long long newsize) {
 
     // 设置新大小
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        // 释放 backlog
-        zfree(server.repl_backlog);
-        // 按新大小创建新 backlog
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is emtpy. */
-        server.repl_backlog_off = server.master_repl_offset+1;
-    }
+    if (server.repl_backlog != NULL)
+        incrementalTrimReplicationBacklog(LONG_MAX);
+}
+
+/* Free a block of the replication buffer. */
+static void freeReplBufBlock(listNode *ln) {
+    replBufBlock *o = listNodeValue(ln);
+
+    redisAssert(o->refcount == 0);
+    server.repl_buffer_mem -= o->size+sizeof(replBufBlock);
+    zfree(o);
+    listDelNode(server.repl_buffer_blocks,ln);
 }
 
 // 释放 backlog
@@ -300,80 +267,226 @@ void resizeReplicationBacklog(long long newsize) {
 // 这个时间取决于配置项：repl-backlog-ttl，既然是时间触发，自然是在 replicationCron() 里面的
 void freeReplicationBacklog(void) {
     redisAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL) return;
+
+    /* Without slaves the backlog holds the only reference to the blocks,
+     * so the whole replication buffer can be released. */
+    if (server.repl_backlog->ref_repl_buf_node) {
+        replBufBlock *o = listNodeValue(server.repl_backlog->ref_repl_buf_node);
+        redisAssert(o->refcount == 1);
+        o->refcount--;
+    }
+    while(listLength(server.repl_buffer_blocks))
+        freeReplBufBlock(listFirst(server.repl_buffer_blocks));
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
 }
 
-/* Add data to the replication backlog.
- * This function also increments the global replication offset stored at
- * server.master_repl_offset, because there is no case where we want to feed
- * the backlog without incrementing the buffer. 
+/* Generate a new random replication ID. Called every time this instance
+ * starts a new replication history: at startup, when a new backlog is
+ * created with no history to continue, and so forth. */
+// 生成新的复制 ID ，也即是开始一段新的复制历史
+void changeReplicationId(void) {
+    getRandomHexChars(server.replid,REDIS_RUN_ID_SIZE);
+    server.replid[REDIS_RUN_ID_SIZE] = '\0';
+}
+
+/* Clear (invalidate) the secondary replication ID. This happens, for
+ * example, after a full resynchronization, when we start a new replication
+ * history. */
+void clearReplicationId2(void) {
+    memset(server.replid2,'0',sizeof(server.replid));
+    server.replid2[REDIS_RUN_ID_SIZE] = '\0';
+    server.second_replid_offset = -1;
+}
+
+/* Use the current replication ID / offset as secondary replication
+ * ID, and change the current one in order to start a new history.
+ * This should be used when an instance is switched from slave to master
+ * so that it can serve PSYNC requests performed using the master
+ * replication ID. */
+// slave 被提升为 master 时调用：旧的复制 ID 保存为 replid2 ，
+// 使得其他原本跟随同一个 master 的 slave 可以向自己 PSYNC
+void shiftReplicationId(void) {
+    memcpy(server.replid2,server.replid,sizeof(server.replid));
+    /* We set the second replid offset to the master offset + 1, since
+     * the slave will ask for the first byte it has not yet received, so
+     * we need to add one to the offset: for example if, as a slave, we are
+     * sure we have the same history as the master for 50 bytes, after we
+     * are turned into a master, we can accept a PSYNC request with offset
+     * 51, since the slave asking has the same history up to the 50th
+     * byte, and is asking for the new bytes starting at offset 51. */
+    server.second_replid_offset = server.master_repl_offset+1;
+    changeReplicationId();
+    redisLog(REDIS_WARNING,"Setting secondary replication ID to %s, valid up to offset: %lld. New replication ID is %s", server.replid2, server.second_replid_offset, server.replid);
+}
+
+/* Release the first blocks of the replication buffer while the backlog is
+ * larger than the configured size and nobody but the backlog references
+ * them. At most 'max_blocks' blocks are freed in a single call, so that a
+ * big shrink of the backlog does not block the server for long.
  *
- * 添加数据到复制 backlog ，
- * 并且按照添加内容的长度更新 server.master_repl_offset 偏移量。
- */
-// 基本上是通过：1. repl-cron 来检查是否需要保存进 backlog 里面；
-//              2. 在每次 server.db.dirty 之后，主动把 CMD 放进 backlog 里面
-void feedReplicationBacklog(void *ptr, size_t len) {
-    unsigned char *p = ptr;
+ * 从头部开始释放只被 backlog 引用、而且超出了 repl_backlog_size 的 block */
+void incrementalTrimReplicationBacklog(size_t max_blocks) {
+    size_t trimmed_blocks = 0;
 
-    // 将长度累加到全局 offset 中
-    server.master_repl_offset += len;
+    if (server.repl_backlog == NULL) return;
+    while (server.repl_backlog->histlen > server.repl_backlog_size &&
+           trimmed_blocks < max_blocks)
+    {
+        listNode *first = listFirst(server.repl_buffer_blocks);
+        replBufBlock *fo;
+
+        /* We never trim the backlog to less than one block. */
+        if (listLength(server.repl_buffer_blocks) <= 1) break;
+
+        /* The backlog always references the first block: if some slave
+         * references it as well the data is still needed. */
+        redisAssert(first == server.repl_backlog->ref_repl_buf_node);
+        fo = listNodeValue(first);
+        if (fo->refcount != 1) break;
+
+        /* Don't trim if the backlog would become smaller than its size. */
+        if (server.repl_backlog->histlen - (long long)fo->used <
+            server.repl_backlog_size) break;
+
+        // backlog 改为引用下一个 block
+        server.repl_backlog->histlen -= fo->used;
+        server.repl_backlog->ref_repl_buf_node = listNextNode(first);
+        ((replBufBlock*)listNodeValue(listNextNode(first)))->refcount++;
+        fo->refcount--;
+        freeReplBufBlock(first);
+        trimmed_blocks++;
+    }
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
-    // 环形 buffer ，每次写尽可能多的数据，并在到达尾部时将 idx 重置到头部
-    // 保存数据，并移动 repl_backlog_idx，增加 repl_backlog_histlen
-    while(len) {
-        // 从 idx 到 backlog 尾部的字节数，server.repl_backlog_size = REDIS_DEFAULT_REPL_BACKLOG_SIZE，1 MB
-        // thislen = backlog 总长度 - backlog 目前用到哪 = 现在 backlog 还有多少空间可以用
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
-
-        // 如果 idx 到 backlog 尾部这段空间足以容纳要写入的内容
-        // 那么直接将写入数据长度设为 len
-        // 在将这些 len 字节复制之后，这个 while 循环将跳出
-        if (thislen > len) thislen = len;
-        // 将 p 中的 thislen 字节内容复制到 backlog
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
-        // 更新 idx ，指向新写入的数据之后
-        server.repl_backlog_idx += thislen;
-        // 如果写入达到尾部，那么将索引重置到头部
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
-        // 减去已写入的字节数
-        len -= thislen; // 决定了是否需要继续进行下一轮的 while-loop
-        // 将指针移动到已被写入数据的后面，指向未被复制数据的开头
-        p += thislen;   // 未写入数据的首地址
-        // 增加环形队列中，未被 ack 的数据长度，最大值为 repl_backlog_size
-        server.repl_backlog_histlen += thislen;
-    }
-
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
     /* Set the offset of the first byte we have in the backlog. */
     // 记录程序可以依靠 backlog 来还原的数据的第一个字节的偏移量
     // 比如 master_repl_offset = 10086
-    // repl_backlog_histlen = 30
+    // repl_backlog->histlen = 30
     // 那么 backlog 所保存的数据的第一个字节的偏移量为
     // 10086 - 30 + 1 = 10056 + 1 = 10057
     // 这说明如果 slave 如果从 10057 至 10086 之间的任何时间断线
     // 那么 slave 都可以使用 PSYNC
+    server.repl_backlog->offset = server.master_repl_offset -
+                                  server.repl_backlog->histlen + 1;
+}
 
-    // 这个 repl_backlog_off 并不在这里使用，所以在这里看毫无意义
-    // 应该配合 addReplyReplicationBacklog() 一起看
-    // 当 repl_backlog_off 超过了 repl_backlog_size 之后，也是一直增长的
-    /* 为什么要在这样算呢？
-     * 1. 没有发生溢出，repl_backlog_off 基本不动，master_repl_offset 跟 repl_backlog_histlen 一开始就是固定的
-     * 2. 发生了溢出，repl_backlog_off 永远都是 master_repl_offset 往回回溯 repl_backlog_histlen
-     */
-    server.repl_backlog_off = server.master_repl_offset -
-                              server.repl_backlog_histlen + 1;
+/* Slaves that can receive new data from the replication stream: the ones
+ * waiting for BGSAVE to start will get the data from the RDB instead. */
+static int canFeedReplicaReplBuffer(redisClient *slave) {
+    return slave->replstate != REDIS_REPL_WAIT_BGSAVE_START;
+}
+
+/* Install the write handler of the online slaves before new data is
+ * appended to the replication buffer, as prepareClientToWrite() does for
+ * the clients before their output buffers are populated. */
+void prepareReplicasToWrite(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (!canFeedReplicaReplBuffer(slave)) continue;
+        prepareClientToWrite(slave);
+    }
 }
 
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+/* Add data to the replication buffer, that is shared by the backlog and by
+ * the slaves. This function also increments the global replication offset
+ * stored at server.master_repl_offset, because there is no case where we
+ * want to feed the backlog without incrementing the buffer.
+ *
+ * 添加数据到共享的复制缓冲，
+ * 并且按照添加内容的长度更新 server.master_repl_offset 偏移量。
+ */
+// 基本上是通过：1. repl-cron 来检查是否需要保存进 backlog 里面；
+//              2. 在每次 server.db.dirty 之后，主动把 CMD 放进 backlog 里面
+void feedReplicationBuffer(void *ptr, size_t len) {
+    static long long repl_block_id = 0;
+    unsigned char *p = ptr;
+    listNode *start_node = NULL, *ln;
+    size_t start_pos = 0;
+    int add_new_block = 0;
+    replBufBlock *tail;
+    listIter li;
+
+    if (server.repl_backlog == NULL) return;
+
+    // 将长度累加到全局 offset 中
+    server.master_repl_offset += len;
+    server.repl_backlog->histlen += len;
+
+    /* Append to the tail block while there is room: the bytes already
+     * there are never touched, so slaves can keep sending them. */
+    ln = listLast(server.repl_buffer_blocks);
+    tail = ln ? listNodeValue(ln) : NULL;
+    if (tail && tail->size > tail->used) {
+        size_t avail = tail->size - tail->used;
+        size_t copy = (avail >= len) ? len : avail;
+
+        start_node = ln;
+        start_pos = tail->used;
+        memcpy(tail->buf+tail->used,p,copy);
+        tail->used += copy;
+        p += copy;
+        len -= copy;
+    }
+
+    /* Create a new block for what is left. */
+    if (len) {
+        size_t size = (len < REDIS_REPLY_CHUNK_BYTES) ?
+                      REDIS_REPLY_CHUNK_BYTES : len;
+
+        tail = zmalloc(size+sizeof(replBufBlock));
+        tail->size = size;
+        tail->used = len;
+        tail->refcount = 0;
+        tail->repl_offset = server.master_repl_offset - len + 1;
+        tail->id = repl_block_id++;
+        memcpy(tail->buf,p,len);
+        listAddNodeTail(server.repl_buffer_blocks,tail);
+        server.repl_buffer_mem += size+sizeof(replBufBlock);
+        if (start_node == NULL) {
+            start_node = listLast(server.repl_buffer_blocks);
+            start_pos = 0;
+        }
+        add_new_block = 1;
+    }
+
+    /* Slaves that are not referencing the buffer yet start sending from
+     * the first byte we just added. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (!canFeedReplicaReplBuffer(slave)) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start_node;
+            slave->ref_block_pos = start_pos;
+            ((replBufBlock*)listNodeValue(start_node))->refcount++;
+        }
+        /* The referenced memory only grows when a block is added. */
+        if (add_new_block) asyncCloseClientOnOutputBufferLimitReached(slave);
+    }
+
+    /* The same for the backlog: this only happens with an empty buffer. */
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        redisAssert(add_new_block && start_pos == 0);
+        server.repl_backlog->ref_repl_buf_node = start_node;
+        ((replBufBlock*)listNodeValue(start_node))->refcount++;
+    }
+
+    /* Adding a block usually makes the backlog big enough to release the
+     * oldest one. */
+    incrementalTrimReplicationBacklog(REDIS_REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Wrapper for feedReplicationBuffer() that takes Redis string objects
  * as input. */
-// 将 Redis 对象放进 replication backlog 里面
-void feedReplicationBacklogWithObject(robj *o) {
+// 将 Redis 对象放进复制缓冲里面
+void feedReplicationBufferWithObject(robj *o) {
     char llstr[REDIS_LONGSTR_SIZE];
     void *p;
     size_t len;
@@ -385,7 +498,127 @@ void feedReplicationBacklogWithObject(robj *o) {
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p,len);
+    feedReplicationBuffer(p,len);
+}
+
+/* Release the reference the slave 'c' holds on the replication buffer,
+ * called when the slave is freed. */
+void releaseReplicaReplicationBuffer(redisClient *c) {
+    replBufBlock *o;
+
+    if (c->ref_repl_buf_node == NULL) return;
+    o = listNodeValue(c->ref_repl_buf_node);
+    o->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    incrementalTrimReplicationBacklog(REDIS_REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Return the memory of the replication buffer the slave 'c' is holding,
+ * from the block it is sending to the last one, that is the part of the
+ * shared buffer accounted as its output buffer. */
+unsigned long getReplicaReplicationBufferMemoryUsage(redisClient *c) {
+    unsigned long node_size = sizeof(listNode)+sizeof(replBufBlock);
+    replBufBlock *cur, *last;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    cur = listNodeValue(c->ref_repl_buf_node);
+    last = listNodeValue(listLast(server.repl_buffer_blocks));
+    return (last->repl_offset + last->size - cur->repl_offset) +
+           node_size*(last->id - cur->id + 1);
+}
+
+/* ------------------------- Compressed link framing ------------------------ */
+
+/* Slaves configured with repl-compression ask the master, with
+ * "REPLCONF compression lzf", to compress what it sends them: the disk based
+ * RDB transfer and the replication stream. The backlog and the shared
+ * replication buffer always store the uncompressed stream, every compressed
+ * slave encodes the frames while sending. See REDIS_REPL_FRAME_HDR_LEN.
+ *
+ * 压缩的复制连接：RDB 和复制流都以帧的方式发送，backlog 保存的依旧是未压缩的数据 */
+
+/* Append to 'dst' the frame encoding the 'len' bytes at 'p'. 'len' must be
+ * in the range 1..REDIS_REPL_FRAME_MAX_LEN. Returns the new 'dst'. */
+sds replEncodeFrame(sds dst, const char *p, size_t len) {
+    size_t pos = sdslen(dst);
+    uint32_t clen, rlen = len;
+
+    redisAssert(len > 0 && len <= REDIS_REPL_FRAME_MAX_LEN);
+    dst = sdsMakeRoomFor(dst,REDIS_REPL_FRAME_HDR_LEN+len);
+
+    /* Data that does not get smaller is sent as it is. */
+    clen = lzf_compress(p,len,dst+pos+REDIS_REPL_FRAME_HDR_LEN,len-1);
+    if (clen == 0) {
+        memcpy(dst+pos+REDIS_REPL_FRAME_HDR_LEN,p,len);
+        clen = len;
+    }
+    memrev32ifbe(&clen);
+    memrev32ifbe(&rlen);
+    memcpy(dst+pos,&clen,4);
+    memcpy(dst+pos+4,&rlen,4);
+    memrev32ifbe(&clen);
+    sdsIncrLen(dst,REDIS_REPL_FRAME_HDR_LEN+clen);
+    return dst;
+}
+
+/* Read frames from 'fd' decoding them at the end of '*dst', until at least
+ * 'maxraw' bytes were decoded or no more data is available. '*zbuf' holds
+ * the frame being received between calls. The socket is never read past
+ * the end of a frame, so that what follows is left to the next reader.
+ *
+ * Returns the number of decoded bytes, 0 if the connection was closed and
+ * -1 on errors, with errno set to EAGAIN if no frame was completed yet, or
+ * to EPROTO if a frame is not valid. */
+ssize_t replReadFrames(int fd, sds *zbuf, sds *dst, size_t maxraw) {
+    size_t decoded = 0;
+
+    while (decoded < maxraw) {
+        size_t have = sdslen(*zbuf), need = REDIS_REPL_FRAME_HDR_LEN;
+        uint32_t clen = 0, rlen = 0;
+        ssize_t nread;
+
+        if (have >= REDIS_REPL_FRAME_HDR_LEN) {
+            memcpy(&clen,*zbuf,4);
+            memcpy(&rlen,*zbuf+4,4);
+            memrev32ifbe(&clen);
+            memrev32ifbe(&rlen);
+            if (rlen == 0 || rlen > REDIS_REPL_FRAME_MAX_LEN || clen > rlen) {
+                errno = EPROTO;
+                return -1;
+            }
+            need += clen;
+        }
+
+        /* Read just what is missing of the current frame. */
+        if (have < need) {
+            *zbuf = sdsMakeRoomFor(*zbuf,need-have);
+            nread = read(fd,*zbuf+have,need-have);
+            if (nread <= 0) {
+                if (decoded) break;
+                if (nread == 0) return 0;
+                if (errno == EWOULDBLOCK) errno = EAGAIN;
+                return -1;
+            }
+            sdsIncrLen(*zbuf,nread);
+            continue;
+        }
+
+        /* The frame is complete: decode it. */
+        *dst = sdsMakeRoomFor(*dst,rlen);
+        if (clen == rlen) {
+            memcpy(*dst+sdslen(*dst),*zbuf+REDIS_REPL_FRAME_HDR_LEN,rlen);
+        } else if (lzf_decompress(*zbuf+REDIS_REPL_FRAME_HDR_LEN,clen,
+                   *dst+sdslen(*dst),rlen) != rlen)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        sdsIncrLen(*dst,rlen);
+        sdsclear(*zbuf);
+        decoded += rlen;
+    }
+    return decoded;
 }
 
 /* 完成 SYNC\PSYNC 之后，就会在这里开始完成日常的同步工作 */
@@ -394,15 +627,22 @@ void feedReplicationBacklogWithObject(robj *o) {
 // TODO:(DONE) 谁来检查 server.dirty 的状态？谁来设置 flag ？（cron 会搞定的，发生了修改数据库的 CMD 之后，dirty 才会被 set）
 
 // 将传入的参数发送给 slave 
-// 操作分为三步：
+// 操作分为两步：
 // 1） 构建协议内容
-// 2） 将协议内容备份到 backlog（用于日后可能发生的 PSYNC）
-// 3） 将内容发送给各个 slave 
+// 2） 将协议内容追加到 backlog 和 slave 共享的复制缓冲
+//    （用于日后可能发生的 PSYNC ，同时 slave 也直接从这里发送）
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
     int j, len;
     char llstr[REDIS_LONGSTR_SIZE];
+    char aux[REDIS_LONGSTR_SIZE+3];
+
+    /* If the instance is not a top level master, return ASAP: we'll just
+     * proxy the stream of data we receive from our master instead, in order
+     * to propagate *identical* replication stream. In this way this slave
+     * can advertise the same replication ID as the master (since it shares
+     * the master replication history and has the same backlog and offsets). */
+    // slave 原样转发自己 master 的复制流，见 replicationFeedSlavesFromMasterStream()
+    if (server.masterhost != NULL) return;
 
     /* If there aren't slaves, and there is no backlog buffer to populate,
      * we can return ASAP. */
@@ -412,6 +652,11 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     /* We can't have slaves attached and no backlog. */
     redisAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
+    /* Slaves and backlog share the same replication buffer: the data is
+     * written only once, and every slave (except the ones still waiting for
+     * BGSAVE to start) will send it from there. */
+    prepareReplicasToWrite();
+
     /* Send SELECT command to every slave if needed. */
     // 如果有需要的话，发送 SELECT 命令，指定数据库
     if (server.slaveseldb != dictid) {
@@ -430,17 +675,9 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
                 dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        // 将 SELECT 命令添加到 backlog
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        // 发送给所有 slave 
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            redisClient *slave = ln->value;
-            addReply(slave,selectcmd);
-        }
+        /* Add the SELECT command into the replication buffer. */
+        // 将 SELECT 命令添加到复制缓冲
+        feedReplicationBufferWithObject(selectcmd);
 
         if (dictid < 0 || dictid >= REDIS_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
@@ -448,78 +685,52 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
 
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    // 将命令写入到backlog，备份，日后发生了短暂失联才会使用 backlog 里面的数据
-    if (server.repl_backlog) {
-        char aux[REDIS_LONGSTR_SIZE+3];
+    /* Write the command to the replication buffer. */
+    // 将命令写入到复制缓冲，日后发生了短暂失联也会使用这里的数据
+
+    /* Add the multi bulk reply length. */
+    aux[0] = '*';
+    len = ll2string(aux+1,sizeof(aux)-1,argc);
+    aux[len+1] = '\r';
+    aux[len+2] = '\n';
+    feedReplicationBuffer(aux,len+3);
 
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
+    for (j = 0; j < argc; j++) {
+        long objlen = stringObjectLen(argv[j]);
+
+        /* We need to feed the buffer with the object as a bulk reply
+         * not just as a plain string, so create the $..CRLF payload len 
+         * ad add the final CRLF */
+        // 将参数从对象转换成协议格式
+        aux[0] = '$';
+        len = ll2string(aux+1,sizeof(aux)-1,objlen);
         aux[len+1] = '\r';
         aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len 
-             * ad add the final CRLF */
-            // 将参数从对象转换成协议格式
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
+        feedReplicationBuffer(aux,len+3);
+        feedReplicationBufferWithObject(argv[j]);
+        feedReplicationBuffer(aux+len+1,2);
     }
+}
 
-    /* Write the command to every slave. */
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-
-        // 指向 slave 
-        redisClient *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        // 不要给正在等待 BGSAVE 开始的 slave 发送命令
-        if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-        // 向已经接收完和正在接收 RDB 文件的 slave 发送命令
-        // 如果 slave 正在接收 master 发送的 RDB 文件，
-        // 那么在初次 SYNC 完成之前， master 发送的内容会被放进一个缓冲区里面
-
-        /* Add the multi bulk length. */
-        addReplyMultiBulkLen(slave,argc);
-
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
-    }
+/* This function is used in order to proxy what we receive from our master
+ * to our sub-slaves: the bytes applied to our dataset are appended to the
+ * replication buffer verbatim, so that the sub-slaves share our offsets. */
+// slave 将已经执行了的、来自 master 的复制流原样转发给自己的 sub-slave
+void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
+    REDIS_NOTUSED(slaves);
+
+    /* There is no need to feed anything without a backlog: it must exist
+     * whenever there are sub-slaves. */
+    if (server.repl_backlog == NULL) return;
+    prepareReplicasToWrite();
+    feedReplicationBuffer(buf,buflen);
 }
 
-// 将 RESP 协议的所有内容都原封不动的发给 Monitor 的那个 redis-client
-// 因为你是正在监控，所以无论这个 CMD 是否成功、甚至内容对错，也不管，直接转发一次就好
-// 通过 redis-server 记住有谁正在 monitor 自己，自己自觉、主动汇报来实现 Monitor 功能
-// TODO: 看了 Monitor 功能后再来看
-void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
+/* Append the MONITOR representation of a command, without the timestamp,
+ * to 's'. */
+static sds catMonitorCommand(sds cmdrepr, redisClient *c, int dictid, robj **argv, int argc) {
     int j;
-    sds cmdrepr = sdsnew("+");
-    robj *cmdobj;
-    struct timeval tv;
 
-    // 获取时间戳
-    gettimeofday(&tv,NULL);
-    cmdrepr = sdscatprintf(cmdrepr,"%ld.%06ld ",(long)tv.tv_sec,(long)tv.tv_usec);
     if (c->flags & REDIS_LUA_CLIENT) {
         cmdrepr = sdscatprintf(cmdrepr,"[%d lua] ",dictid);
     } else if (c->flags & REDIS_UNIX_SOCKET) {
@@ -531,7 +742,12 @@ void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **
     // 获取命令和参数
     for (j = 0; j < argc; j++) {
         if (argv[j]->encoding == REDIS_ENCODING_INT) {
-            cmdrepr = sdscatprintf(cmdrepr, "\"%ld\"", (long)argv[j]->ptr);
+            char buf[REDIS_LONGSTR_SIZE+2];
+            int len = ll2string(buf+1,sizeof(buf)-2,(long)argv[j]->ptr);
+
+            buf[0] = '"';
+            buf[len+1] = '"';
+            cmdrepr = sdscatlen(cmdrepr,buf,len+2);
         } else {
             cmdrepr = sdscatrepr(cmdrepr,(char*)argv[j]->ptr,
                         sdslen(argv[j]->ptr));
@@ -539,27 +755,59 @@ void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **
         if (j != argc-1)
             cmdrepr = sdscatlen(cmdrepr," ",1);
     }
-    cmdrepr = sdscatlen(cmdrepr,"\r\n",2);
-    cmdobj = createObject(REDIS_STRING,cmdrepr);
+    return sdscatlen(cmdrepr,"\r\n",2);
+}
 
-    // 将内容发送给所有 MONITOR 
+// 将 RESP 协议的所有内容都原封不动的发给 Monitor 的那个 redis-client
+// 因为你是正在监控，所以无论这个 CMD 是否成功、甚至内容对错，也不管，直接转发一次就好
+// 通过 redis-server 记住有谁正在 monitor 自己，自己自觉、主动汇报来实现 Monitor 功能
+// TODO: 看了 Monitor 功能后再来看
+void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **argv, int argc) {
+    listNode *ln;
+    listIter li;
+    int len;
+    sds cmdrepr;
+    robj *cmdobj = NULL;
+    struct timeval tv;
+    char buf[64];
+
+    /* The line is only formatted once some monitor is going to receive it,
+     * and then shared by all of them. Monitors that are about to be closed
+     * (e.g. over their output buffer limit) don't count. */
+    // 只有真的有 monitor 接收时才格式化，所有 monitor 共享同一个对象
     listRewind(monitors,&li);
     while((ln = listNext(&li))) {
         redisClient *monitor = ln->value;
+
+        if (monitor->flags & REDIS_CLOSE_ASAP) continue;
+        if (cmdobj == NULL) {
+            cmdrepr = sdsMakeRoomFor(sdsnewlen("+",1),128);
+
+            // 获取时间戳
+            gettimeofday(&tv,NULL);
+            len = snprintf(buf,sizeof(buf),"%ld.%06ld ",
+                           (long)tv.tv_sec,(long)tv.tv_usec);
+            cmdrepr = sdscatlen(cmdrepr,buf,len);
+            cmdrepr = catMonitorCommand(cmdrepr,c,dictid,argv,argc);
+            cmdobj = createObject(REDIS_STRING,cmdrepr);
+        }
         addReply(monitor,cmdobj);
     }
-    decrRefCount(cmdobj);
+    if (cmdobj) decrRefCount(cmdobj);
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog. Nothing is copied: the
+ * slave just starts referencing the block holding 'offset'. */
 // 向 slave  c 发送 backlog 中从 offset 到 backlog 尾部之间的数据，完成 PSYNC 过程
 long long addReplyReplicationBacklog(redisClient *c, long long offset) {
-    long long j, skip, len;
+    long long skip;
+    listNode *node;
+    replBufBlock *o;
 
     redisLog(REDIS_DEBUG, "[PSYNC] Slave request offset: %lld", offset);
 
-    if (server.repl_backlog_histlen == 0) {
+    if (server.repl_backlog->histlen == 0) {
         redisLog(REDIS_DEBUG, "[PSYNC] Backlog history len is zero");
         return 0;
     }
@@ -567,53 +815,36 @@ long long addReplyReplicationBacklog(redisClient *c, long long offset) {
     redisLog(REDIS_DEBUG, "[PSYNC] Backlog size: %lld",
              server.repl_backlog_size);
     redisLog(REDIS_DEBUG, "[PSYNC] First byte: %lld",
-             server.repl_backlog_off);
+             server.repl_backlog->offset);
     redisLog(REDIS_DEBUG, "[PSYNC] History len: %lld",
-             server.repl_backlog_histlen);
-    redisLog(REDIS_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
+             server.repl_backlog->histlen);
 
     /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog_off;    // 跳过不需要的版本号
+    skip = offset - server.repl_backlog->offset;    // 跳过不需要的版本号
     redisLog(REDIS_DEBUG, "[PSYNC] Skipping: %lld", skip);
 
-    /* Point j to the oldest byte, that is actaully our
-     * server.repl_backlog_off byte. */
-    /* 1. 溢出后，(server.repl_backlog_size - server.repl_backlog_histlen) = 0
-     *    当 backlog 中有效数据充满了整个 backlog 时，即 backlog 被完全利用，计算退化成
-     *    j = server.repl_backlog_idx % server.repl_backlog_size，
-     *    由于 repl_backlog_idx 不可能大于server.repl_backlog_size，
-     *    所以计算结果就等于 server.repl_backlog_idx（这时候，idx 下一个 byte 就是最旧的那个 byte ），
-     *    它是读写数据的分割点
-     * 2. 当 backlog 中尚有未使用的空间时，repl_backlog_idx 等于 server.repl_backlog_histlen，
-     *    计算退化成 server.repl_backlog_size % server.repl_backlog_size = 0
-     *    全靠 j = (j + skip) % server.repl_backlog_size; 来计算
-     */
-    j = (server.repl_backlog_idx + (server.repl_backlog_size - server.repl_backlog_histlen)) // 
-        % server.repl_backlog_size; // 取出多余的部分，回归 index
-    redisLog(REDIS_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    redisLog(REDIS_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {    // 因为环形 buf 可能要从头再来，所以要检查 len
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        redisLog(REDIS_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-
-        // 因为 write 未必已经就绪，所以采用 epoll 监听到 write 事件就绪后再刷写相应的 buf
-        // 而 addReply 里面的机制，已经能够确保这些数据最终能够被发送出去，所以也就可以移动相应的 offset
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen)); // 需要发送出去的内容已经挂在了 c->buf 里面
-        len -= thislen;
-        j = 0;
-    }
-    return server.repl_backlog_histlen - skip;
+    /* Search the block holding 'offset', starting from the first block of
+     * the backlog. */
+    node = server.repl_backlog->ref_repl_buf_node;
+    while (node != NULL) {
+        o = listNodeValue(node);
+        if (o->repl_offset + (long long)o->used >= offset) break;
+        node = listNextNode(node);
+    }
+    redisAssert(node != NULL);
+
+    /* Install the write handler first, then make the slave reference
+     * the block: the data will be sent from the shared buffer. */
+    // slave 直接从共享的复制缓冲里面发送，不再把 backlog 复制进 c->buf
+    prepareClientToWrite(c);
+    o = listNodeValue(node);
+    o->refcount++;
+    c->ref_repl_buf_node = node;
+    c->ref_block_pos = offset - o->repl_offset;
+
+    redisLog(REDIS_DEBUG, "[PSYNC] Reply total length: %lld",
+             server.repl_backlog->histlen - skip);
+    return server.repl_backlog->histlen - skip;
 }
 
 /* This function handles the PSYNC command from the point of view of a
@@ -624,15 +855,68 @@ long long addReplyReplicationBacklog(redisClient *c, long long offset) {
 // 尝试进行部分 resync ，成功返回 REDIS_OK ，失败返回 REDIS_ERR 。
 // 在 slave 短时断开重连后，上报master runid 及复制偏移量。如果 runid 与 master 一致，且偏移量仍然在 master 的复制缓冲积压中，则 master 进行增量同步。
 // 但如果 slave 重启后，master runid 会丢失，或者切换 master 后，runid 会变化，仍然需要全量同步。
+/* Return the offset to announce to a slave with +FULLRESYNC: the offset
+ * of the replication stream at the moment the RDB is generated. */
+long long getPsyncInitialOffset(void) {
+    return server.master_repl_offset;
+}
+
+/* Send a FULLRESYNC reply in the specific case of a full resynchronization,
+ * as a side effect setup the slave for a full sync in different ways:
+ *
+ * 1) Remember, into the slave client structure, the offset we sent
+ *    here, so that if new slaves will later attach to the same
+ *    background RDB saving process (by duplicating this client output
+ *    buffer), we can get the right offset from this slave.
+ * 2) Set the replication state of the slave to WAIT_BGSAVE_END so that
+ *    we start accumulating differences from this point.
+ * 3) Force the replication stream to re-emit a SELECT statement so
+ *    the new slave incremental differences will now start with a SELECT
+ *    statement, so the DB is correctly selected.
+ *
+ * A SYNC (not PSYNC) slave does not get any reply, only the state change.
+ *
+ * Normally this function should be called immediately after a successful
+ * BGSAVE for replication was started, or when there is one already in
+ * progress that we attached our slave to.
+ *
+ * 在 BGSAVE 真正开始（或者依附到一个已有的 BGSAVE）时，
+ * 将当时的复制偏移量以 +FULLRESYNC 的形式告知 slave 。
+ */
+int replicationSetupSlaveForFullResync(redisClient *slave, long long offset) {
+    char buf[128];
+    int buflen;
+
+    slave->psync_initial_offset = offset;
+    slave->replstate = REDIS_REPL_WAIT_BGSAVE_END;
+    /* We are going to accumulate the incremental changes for this
+     * slave as well. Set slaveseldb to -1 in order to force to re-emit
+     * a SELECT statement in the replication stream. */
+    server.slaveseldb = -1;
+
+    /* Don't send this reply to slaves that approached us with
+     * the old SYNC command. */
+    if (!(slave->flags & REDIS_PRE_PSYNC)) {
+        /* We can't use the connection buffers since they are used to
+         * accumulate new commands at this stage. But we are sure the
+         * socket send buffer is empty so this write will never fail. */
+        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
+                          server.replid,offset);
+        if (write(slave->fd,buf,buflen) != buflen) {
+            freeClientAsync(slave);
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
 int masterTryPartialResynchronization(redisClient *c) {
     long long psync_offset, psync_len;
-    char *master_runid = c->argv[1]->ptr;
+    char *master_replid = c->argv[1]->ptr;
     char buf[128];
     int buflen;
 
-    /* Is the runid of this master the same advertised by the wannabe slave
-     * via PSYNC? If runid changed this master is a different instance(slave 以前并不是跟随这个 master 的) and
-     * there is no way to continue perform a PSYNC. */
+    // slave 以前并不是跟随这个 master 的话，就没办法 PSYNC
     // 检查 master id 是否和 runid 一致，只有一致的情况下才有 PSYNC 的可能 
     /* TODO:(DEON) 为什么？一致跟不一致，分别意味着什么？
      * sync 的核心目的就是：slave 的数据永远跟 master 一致；
@@ -648,14 +932,36 @@ int masterTryPartialResynchronization(redisClient *c) {
      * 因为 master 的 runid 会被 slave 保存起来，所以每次同步之前，slave 发送的 sync 请求都会带上自己保存的 master run-id
      * 这样一来，就可以让现在 master 来决策：这个 slave 以前的 master 是不是我，是的话进行完全同步，否则进行部分同步
      */
-    if (strcasecmp(master_runid, server.runid)) {   // run-id 没有；或者是，slave 保存的 master run-id 跟当前的 master run-id 不一致
+    // 取出 psync_offset 参数
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&psync_offset,NULL) !=
+       REDIS_OK) goto need_full_resync;
+
+    /* Is the replication ID of this master the same advertised by the wannabe
+     * slave via PSYNC? If the replication ID changed this master has a
+     * different replication history, and there is no way to continue.
+     *
+     * Note that there are two potentially valid replication IDs: the ID1
+     * and the ID2. The ID2 however is only valid up to a specific offset. */
+    // 复制 ID 可以是当前的 replid ，也可以是 failover 之前所跟随的 master 的
+    // replid2 （但只在 second_replid_offset 之前有效）
+    if (strcasecmp(master_replid, server.replid) &&
+        (strcasecmp(master_replid, server.replid2) ||
+         psync_offset > server.second_replid_offset))
+    {
         /* Run id "?" is used by slaves that want to force a full resync. */
-        if (master_runid[0] != '?') {
-            // slave 提供的 run id 和服务器的 run id 不一致
-            // 说明以前这个 slave 跟随的 master 并不是自己，所以采取完全同步的方案，避免 slave 的数据有问题
-            redisLog(REDIS_NOTICE,"Partial resynchronization not accepted: "
-                "Runid mismatch (Client asked for runid '%s', my runid is '%s')",
-                master_runid, server.runid);
+        if (master_replid[0] != '?') {
+            if (strcasecmp(master_replid, server.replid) &&
+                strcasecmp(master_replid, server.replid2))
+            {
+                redisLog(REDIS_NOTICE,"Partial resynchronization not accepted: "
+                    "Replication ID mismatch (Slave asked for '%s', my "
+                    "replication IDs are '%s' and '%s')",
+                    master_replid, server.replid, server.replid2);
+            } else {
+                redisLog(REDIS_NOTICE,"Partial resynchronization not accepted: "
+                    "Requested offset for second ID was %lld, but I can reply "
+                    "up to %lld", psync_offset, server.second_replid_offset);
+            }
         } else {
             // slave 提供的 run id 为 '?' ，表示强制 FULL RESYNC
             // 毕竟是第一次进行同步嘛
@@ -666,21 +972,16 @@ int masterTryPartialResynchronization(redisClient *c) {
     }
 
     /* We still have the data our slave is asking for? */
-    // 取出 psync_offset 参数
-    if (getLongLongFromObjectOrReply(c,c->argv[2],&psync_offset,NULL) !=
-       REDIS_OK) goto need_full_resync;
-
     // 判断是否能够进行 PSYNC
     // 1. 要有 backlog
     // 2. master 要能够恢复 slave 需要的所有数据
     if (!server.repl_backlog ||
-        // 或者 psync_offset 小于 server.repl_backlog_off
-        // （想要恢复的那部分数据已经被覆盖）
-        psync_offset < server.repl_backlog_off ||   // 根据目前记录的 repl_backlog_off 缓冲区最开头的版本号，来看看 slave 要的还有没保留在缓冲区里面
+        // 或者 psync_offset 小于 server.repl_backlog->offset
+        // （想要恢复的那部分数据已经被释放）
+        psync_offset < server.repl_backlog->offset ||   // 根据目前记录的 backlog 最开头的版本号，来看看 slave 要的还有没保留在缓冲区里面
         // psync offset 大于 backlog 所保存的数据的偏移量
-        // repl_backlog_histlen 只是用来兼容 backlog 溢出跟没有溢出两种情况罢了
         // 实际上，这个可以直接检查 psync_offset > master_repl_offset - 1
-        psync_offset > (server.repl_backlog_off + server.repl_backlog_histlen))
+        psync_offset > (server.repl_backlog->offset + server.repl_backlog->histlen))
     {
         // 执行 FULL RESYNC
         redisLog(REDIS_NOTICE,
@@ -712,7 +1013,13 @@ int masterTryPartialResynchronization(redisClient *c) {
      * new commands at this stage. But we are sure the socket send buffer is
      * emtpy so this write will never fail actually. */
     // 向 slave 发送一个同步 +CONTINUE ，表示 PSYNC 可以执行
-    buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
+    // 支持 PSYNC2 的 slave 需要知道 master 当前的复制 ID ，
+    // 因为它可能是在 failover 之后通过 replid2 完成 PSYNC 的
+    if (c->slave_capa & SLAVE_CAPA_PSYNC2) {
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s\r\n", server.replid);
+    } else {
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
+    }
     if (write(c->fd,buf,buflen) != buflen) {
         freeClientAsync(c);
         return REDIS_OK;
@@ -734,29 +1041,13 @@ int masterTryPartialResynchronization(redisClient *c) {
     return REDIS_OK; /* The caller can return, no full resync needed. */
 
 need_full_resync:
-    /* Although slave wants to perform a PSYNC, we need a full resync for some reason... notify the client. */
-    // 刷新 psync_offset
-    psync_offset = server.master_repl_offset;
-    /* Add 1 to psync_offset if it the replication backlog does not exists
-     * as when it will be created later we'll increment the offset by one. TODO:（DONE） why ? 没啥的，约定罢了，你看看 backlog 那里就好 */
-    // 刷新 psync_offset
-    if (server.repl_backlog == NULL) psync_offset++;
-    /* Again, we can't use the connection buffers (see above).TODO:（DONE） why ? master 的 backlog 增长太快了，PSYNC 的数据被刷走了 */
-    // 发送 +FULLRESYNC ，表示需要完整重同步
-    // buf = "+FULLRESYNC 21a931865c82d28ec842c7c60bdc0ae6ceeaa12a 1\r\n\000"
-    // master 第一次启动的话：server.master_repl_offset = 0; server.repl_backlog = NULL
-    buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
-                      server.runid,psync_offset);
-    if (write(c->fd,buf,buflen) != buflen) {
-        freeClientAsync(c);
-        return REDIS_OK;
-    }
-    /*
-     * 实际上，这里 master 就已经把 "+FULLRESYNC 21a931865c82d28ec842c7c60bdc0ae6ceeaa12a 1\r\n\000" 发送了给 slave
-     * 而 slave 发出 SYNC 请求之后，是会进行同步阻塞等待的
-     * （slaveTryPartialResynchronization() 的 sendSynchronousCommand() 里面）
-     * 而 slave 则是会在这里收到 master 发送的内容
-     */
+    /* We need a full resync for some reason... Note that we can't
+     * reply to PSYNC right now if a full SYNC is needed. The reply
+     * must include the master offset at the time the RDB file we transfer
+     * is generated, so we need to delay the reply to that moment.
+     *
+     * +FULLRESYNC 的回复要等到真正为这个 slave 开始 BGSAVE 时才发送，
+     * 见 replicationSetupSlaveForFullResync() */
     return REDIS_ERR;
 }
 
@@ -879,11 +1170,63 @@ void syncCommand(redisClient *c) {
     /* Full resynchronization. */
     server.stat_sync_full++;
 
+    /* Setup the slave as one waiting for BGSAVE to start. The following code
+     * paths will change the state if we handle the slave differently. */
+    c->replstate = REDIS_REPL_WAIT_BGSAVE_START;
+
+    // 启用了 Nagle 算法，避免大量拥堵网络  
+    // TODO:(DONE) 为什么 repl 这里要单独启用呢？接下来是收发体积较大的 RDB 文件，除非 slave 收到一点就返回 OK，不然延时可能很恐怖
+    // 这取决于你当前 slave 跟 master 的网络环境允不允许，有没有多余的带宽给 ACK 跟 TCP 头部
+    /**
+     * redis.conf:
+     * 
+     * Disable TCP_NODELAY **on the slave socket after SYNC?**
+     *
+     * If you select "yes" Redis will use a smaller number of TCP packets and
+     * less bandwidth to send data to slaves. But this can add a delay for
+     * the data to appear on the slave side, up to 40 milliseconds with
+     * Linux kernels using a default configuration.
+     *
+     * If you select "no" the delay for data to appear on the slave side will
+     * be reduced but more bandwidth will be used for replication.
+     *
+     * By default we optimize for low latency, but in very high traffic conditions
+     * or when the master and slaves are many hops away, turning this to "yes" may
+     * be a good idea.
+    */
+    if (server.repl_disable_tcp_nodelay)
+        anetDisableTcpNoDelay(NULL, c->fd); /* Non critical if it fails. */
+
+    c->repldbfd = -1;
+
+    c->flags |= REDIS_SLAVE;
+
+    // 添加到 slave 列表中，这个无论是完全同步还是部分同步，哪怕是不需要进行同步，
+    // 都是需要将 slave 的 redisClient 加入 master 的 server.slave 里面的
+    listAddNodeTail(server.slaves,c);
+
+    /* Create the replication backlog if needed. */
+    // 如果是第一个 slave ，那么初始化 backlog
+    // 没有 backlog 也就意味着没有可以延续的复制历史，所以同时换一个新的复制 ID
+    // backlog 要在 BGSAVE 之前创建，这样 +FULLRESYNC 的偏移量才是准确的
+    if (listLength(server.slaves) == 1 && server.repl_backlog == NULL) {
+        /* When we create the backlog from scratch, we always use a new
+         * replication ID and clear the ID2, since there is no valid
+         * past history. */
+        changeReplicationId();
+        clearReplicationId2();
+        createReplicationBacklog();
+    }
+
     /* Here we need to check if there is a background saving operation
      * in progress, or if it is required to start one */
     // TODO:（DONE） 假设有会怎样？没有又怎样？为什么？
     // 有就等待那个 RDB 完成，然后复用
-    if (server.rdb_child_pid != -1) {
+
+    /* CASE 1: BGSAVE is in progress, with disk target. */
+    if (server.rdb_child_pid != -1 &&
+        server.rdb_child_type == REDIS_RDB_CHILD_TYPE_DISK)
+    {
         /* Ok a background save is in progress. Let's check if it is a good
          * one for replication, i.e. if there is another slave that is
          * registering differences since the server forked to save */
@@ -903,74 +1246,46 @@ void syncCommand(redisClient *c) {
             /* Perfect, the server is already registering differences for
              * another slave. Set the right state, and copy the buffer. */
             // 幸运的情况，可以使用目前 BGSAVE 所生成的 RDB
-            // 既然是用同一个 RDB，那自然也是要用同样的追加内容
+            // 既然是用同一个 RDB，那自然也是要用同样的追加内容（以及同样的初始偏移量）
             copyClientOutputBuffer(c,slave);
-            c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
+            replicationSetupSlaveForFullResync(c,slave->psync_initial_offset);
             redisLog(REDIS_NOTICE,"Waiting for end of BGSAVE for SYNC");
         } else {
             /* No way, we need to wait for the next BGSAVE in order to
              * register differences */
             // 不好运的情况，必须等待下个 BGSAVE
-            c->replstate = REDIS_REPL_WAIT_BGSAVE_START;
             redisLog(REDIS_NOTICE,"Waiting for next BGSAVE for SYNC");
         }
-    } else {
-        /* Ok we don't have a BGSAVE in progress, let's start one */
-        // 没有 BGSAVE 在进行，开始一个新的 BGSAVE
-        redisLog(REDIS_NOTICE,"Starting BGSAVE for SYNC");
-        if (rdbSaveBackground(server.rdb_filename) != REDIS_OK) {
-            redisLog(REDIS_NOTICE,"Replication failed, can't BGSAVE");
-            addReplyError(c,"Unable to perform background save");
-            return;
-        }
-        // 设置状态，TODO:(DONE) 为什么一开始就设置为 REDIS_REPL_WAIT_BGSAVE_END ？
-        // 没办法，看英语注释更好，人类迷惑行为一般的命名
-        /* Waiting RDB file creation to finish. */
-        c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
 
-        /* Flush the script cache for the new slave. */
-        // 因为新 slave 进入，刷新复制脚本缓存，TODO: why ?
-        replicationScriptCacheFlush();
+    /* CASE 2: BGSAVE is in progress, with socket target. */
+    } else if (server.rdb_child_pid != -1 &&
+               server.rdb_child_type == REDIS_RDB_CHILD_TYPE_SOCKET)
+    {
+        /* There is an RDB child process but it is writing directly to
+         * the sockets of other slaves. We need to wait for the next BGSAVE
+         * in order to synchronize. */
+        // 子进程正在直接向其他 slave 的套接字写入 RDB ，无法中途加入
+        redisLog(REDIS_NOTICE,"Current BGSAVE has socket target. Waiting for next BGSAVE for SYNC");
 
-        // 成功执行 BGSAVE 之后的 master，就会在 ServerCron 里面检查子进程是否完成了 RDB 的任务
-        // 完成之后会在 backgroundSaveDoneHandler() 里面调用 updateSlavesWaitingBgsave() 完成 repl full sync 剩下的部分
+    /* CASE 3: There is no BGSAVE is progress. */
+    } else {
+        if (server.repl_diskless_sync && (c->slave_capa & SLAVE_CAPA_EOF)) {
+            /* Diskless replication RDB child is created inside
+             * replicationCron() since we want to delay its start a
+             * few seconds to wait for more slaves to arrive. */
+            // 无盘复制：等待 repl-diskless-sync-delay 秒，让更多的 slave 共用一次 fork
+            if (server.repl_diskless_sync_delay)
+                redisLog(REDIS_NOTICE,"Delay next BGSAVE for diskless SYNC");
+        } else {
+            /* Target is disk (or the slave is not capable of supporting
+             * diskless replication) and we don't have a BGSAVE in progress,
+             * let's start one. */
+            // 没有 BGSAVE 在进行，开始一个新的 BGSAVE
+            // 成功执行 BGSAVE 之后的 master，就会在 ServerCron 里面检查子进程是否完成了 RDB 的任务
+            // 完成之后会在 backgroundSaveDoneHandler() 里面调用 updateSlavesWaitingBgsave() 完成 repl full sync 剩下的部分
+            if (startBgsaveForReplication(c->slave_capa) != REDIS_OK) return;
+        }
     }
-
-    // 启用了 Nagle 算法，避免大量拥堵网络  
-    // TODO:(DONE) 为什么 repl 这里要单独启用呢？接下来是收发体积较大的 RDB 文件，除非 slave 收到一点就返回 OK，不然延时可能很恐怖
-    // 这取决于你当前 slave 跟 master 的网络环境允不允许，有没有多余的带宽给 ACK 跟 TCP 头部
-    /**
-     * redis.conf:
-     * 
-     * Disable TCP_NODELAY **on the slave socket after SYNC?**
-     *
-     * If you select "yes" Redis will use a smaller number of TCP packets and
-     * less bandwidth to send data to slaves. But this can add a delay for
-     * the data to appear on the slave side, up to 40 milliseconds with
-     * Linux kernels using a default configuration.
-     *
-     * If you select "no" the delay for data to appear on the slave side will
-     * be reduced but more bandwidth will be used for replication.
-     *
-     * By default we optimize for low latency, but in very high traffic conditions
-     * or when the master and slaves are many hops away, turning this to "yes" may
-     * be a good idea.
-    */
-    if (server.repl_disable_tcp_nodelay)
-        anetDisableTcpNoDelay(NULL, c->fd); /* Non critical if it fails. */
-
-    c->repldbfd = -1;
-
-    c->flags |= REDIS_SLAVE;
-
-    server.slaveseldb = -1; /* Force to re-emit the SELECT command. */
-
-    // 添加到 slave 列表中，这个无论是完全同步还是部分同步，哪怕是不需要进行同步，
-    // 都是需要将 slave 的 redisClient 加入 master 的 server.slave 里面的
-    listAddNodeTail(server.slaves,c);
-    // 如果是第一个 slave ，那么初始化 backlog
-    if (listLength(server.slaves) == 1 && server.repl_backlog == NULL)
-        createReplicationBacklog();
     return;
 }
 
@@ -1021,6 +1336,25 @@ void replconfCommand(redisClient *c) {
                 return;
             c->slave_listening_port = port;
 
+        //  slave 声明自己的能力，例如能够解析 EOF 格式的 RDB 流（无盘复制）
+        } else if (!strcasecmp(c->argv[j]->ptr,"capa")) {
+            /* Ignore capabilities not understood by this master. */
+            if (!strcasecmp(c->argv[j+1]->ptr,"eof"))
+                c->slave_capa |= SLAVE_CAPA_EOF;
+            else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
+                c->slave_capa |= SLAVE_CAPA_PSYNC2;
+
+        //  slave 要求压缩复制连接，目前只支持 LZF
+        } else if (!strcasecmp(c->argv[j]->ptr,"compression")) {
+            /* Unlike capabilities the slave needs to know if the link is
+             * going to be compressed, so unknown algorithms are errors. */
+            if (strcasecmp(c->argv[j+1]->ptr,"lzf")) {
+                addReplyErrorFormat(c,"Unsupported replication compression: %s",
+                    (char*)c->argv[j+1]->ptr);
+                return;
+            }
+            if (c->repl_zbuf == NULL) c->repl_zbuf = sdsempty();
+
         //  slave 发来 REPLCONF ACK <offset> 命令
         // 告知 master ， slave 已处理的复制流的偏移量
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
@@ -1041,6 +1375,11 @@ void replconfCommand(redisClient *c) {
                 c->repl_ack_off = offset;
             // 更新最后一次发送 ack 的时间
             c->repl_ack_time = server.unixtime;
+            /* If this was a diskless replication, we need to really put
+             * the slave online when the first ACK is received (which
+             * confirms slave is online and ready to get more data). */
+            if (c->repl_put_online_on_ack && c->replstate == REDIS_REPL_ONLINE)
+                putSlaveOnline(c);
             /* Note: this command does not reply anything! */
             return;
         } else if (!strcasecmp(c->argv[j]->ptr,"getack")) {
@@ -1048,6 +1387,17 @@ void replconfCommand(redisClient *c) {
              * to the slave. */
             if (server.masterhost && server.master) replicationSendAck();
             /* Note: this command does not reply anything! */
+
+        //  master 在复制流中发送的心跳，带有 master 当时的时间
+        } else if (!strcasecmp(c->argv[j]->ptr,"timestamp")) {
+            /* REPLCONF TIMESTAMP <ms> is sent by the master in the
+             * replication stream, see replicationSendHeartbeat(). */
+            long long ts;
+
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&ts,NULL)
+                != REDIS_OK) return;
+            if (c->flags & REDIS_MASTER) server.master_timestamp = ts;
+            /* Note: this command does not reply anything! */
         } else {
             addReplyErrorFormat(c,"Unrecognized REPLCONF option: %s",
                 (char*)c->argv[j]->ptr);
@@ -1059,11 +1409,47 @@ void replconfCommand(redisClient *c) {
 
 // master 将 RDB 文件发送给 slave 的写事件处理器
 // 此时此刻，slave redisClient 的 write-callback 将会替换为这个函数
+/* This function puts a slave in the online state, and should be called just
+ * after a slave received the RDB file for the initial synchronization, and
+ * we are finally ready to send the incremental stream of commands.
+ *
+ * It does a few things:
+ *
+ * 1) Put the slave in ONLINE state (useless when the function is called
+ *    because state is already ONLINE but repl_put_online_on_ack is true).
+ * 2) Make sure the writable event is re-installed, since calling the SYNC
+ *    command disables it, so that we can accumulate output buffer without
+ *    sending it to the slave.
+ * 3) Update the count of good slaves.
+ *
+ * 将 slave 设置为在线状态，并安装写处理器，开始发送累积的命令
+ */
+void putSlaveOnline(redisClient *slave) {
+    slave->replstate = REDIS_REPL_ONLINE;
+    slave->repl_put_online_on_ack = 0;
+    slave->repl_ack_time = server.unixtime; /* Prevent false timeout. */
+    // 创建向 slave 发送命令的写事件处理器
+    // 将保存并发送 RDB 期间的回复全部发送给 slave 
+    // TODO:（DONE） 要是利用重新注册 sendReplyToClient() 的方法来补充 CMD，那样就跟 backlog 没有任何关系了啦？
+    // TODO: （DONE）这个跟 backlog 有什么区别？
+    // backlog 是用来让 slave 在短暂失联的情况下，能够通过 PSYNC 的方式快速同步
+    // sendReplyToClient() 则是在 full SYNC 之后，将创建、传送 RDB 过程中，master 接收到的数据，补发给 slave
+    if (aeCreateFileEvent(server.el, slave->fd, AE_WRITABLE,
+        sendReplyToClient, slave) == AE_ERR) {
+        redisLog(REDIS_WARNING,"Unable to register writable event for slave bulk transfer: %s", strerror(errno));
+        freeClient(slave);
+        return;
+    }
+    // 刷新低延迟 slave 数量
+    refreshGoodSlavesCount();
+    redisLog(REDIS_NOTICE,"Synchronization with slave succeeded");
+}
+
 void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *slave = privdata;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
-    char buf[REDIS_IOBUF_LEN];
+    char buf[REDIS_IOBUF_LEN], *p;
     ssize_t nwritten, buflen;
 
     /* Before sending the RDB file, we send the preamble as configured by the
@@ -1088,18 +1474,32 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
-    /* If the preamble was already transfered, send the RDB bulk data. */
-    lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
-    // 读取 RDB 数据
-    buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
-    if (buflen <= 0) {
-        redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
-            (buflen == 0) ? "premature EOF" : strerror(errno));
-        freeClient(slave);
-        return;
+    /* If the preamble was already transfered, send the RDB bulk data. On
+     * compressed links the next chunk is encoded only once the previous
+     * frame was written entirely. */
+    if (slave->repl_zbuf == NULL || sdslen(slave->repl_zbuf) == 0) {
+        lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
+        // 读取 RDB 数据
+        buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
+        if (buflen <= 0) {
+            redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
+                (buflen == 0) ? "premature EOF" : strerror(errno));
+            freeClient(slave);
+            return;
+        }
+        if (slave->repl_zbuf) {
+            slave->repl_zbuf = replEncodeFrame(slave->repl_zbuf,buf,buflen);
+            slave->repldboff += buflen;
+        }
+    }
+    if (slave->repl_zbuf) {
+        p = slave->repl_zbuf;
+        buflen = sdslen(slave->repl_zbuf);
+    } else {
+        p = buf;
     }
     // 写入数据到 slave
-    if ((nwritten = write(fd,buf,buflen)) == -1) {
+    if ((nwritten = write(fd,p,buflen)) == -1) {
         if (errno != EAGAIN) {
             // 出了 EAGAIN 之外的其他错误都不能够接受
             redisLog(REDIS_WARNING,"Write error sending DB to slave: %s",
@@ -1110,7 +1510,12 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 
     // 如果写入成功，那么更新写入字节数到 repldboff ，等待下次继续写入
-    slave->repldboff += nwritten;
+    if (slave->repl_zbuf) {
+        sdsrange(slave->repl_zbuf,nwritten,-1);
+        if (sdslen(slave->repl_zbuf)) return;
+    } else {
+        slave->repldboff += nwritten;
+    }
 
     // 如果写入已经全部完成
     if (slave->repldboff == slave->repldbsize) {
@@ -1119,25 +1524,8 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         slave->repldbfd = -1;
         // 删除之前绑定的写事件处理器
         aeDeleteFileEvent(server.el,slave->fd,AE_WRITABLE);
-        // 将状态更新为 REDIS_REPL_ONLINE
-        slave->replstate = REDIS_REPL_ONLINE;
-        // 更新响应时间（因为开启了 TCP_NODELAY）
-        slave->repl_ack_time = server.unixtime;
-        // 创建向 slave 发送命令的写事件处理器
-        // 将保存并发送 RDB 期间的回复全部发送给 slave 
-        // TODO:（DONE） 要是利用重新注册 sendReplyToClient() 的方法来补充 CMD，那样就跟 backlog 没有任何关系了啦？
-        // TODO: （DONE）这个跟 backlog 有什么区别？
-        // backlog 是用来让 slave 在短暂失联的情况下，能够通过 PSYNC 的方式快速同步
-        // sendReplyToClient() 则是在 full SYNC 之后，将创建、传送 RDB 过程中，master 接收到的数据，补发给 slave
-        if (aeCreateFileEvent(server.el, slave->fd, AE_WRITABLE,
-            sendReplyToClient, slave) == AE_ERR) {
-            redisLog(REDIS_WARNING,"Unable to register writable event for slave bulk transfer: %s", strerror(errno));
-            freeClient(slave);
-            return;
-        }
-        // 刷新低延迟 slave 数量
-        refreshGoodSlavesCount();
-        redisLog(REDIS_NOTICE,"Synchronization with slave succeeded");
+        // 将状态更新为 REDIS_REPL_ONLINE ，并重新安装写事件处理器
+        putSlaveOnline(slave);
     }
 }
 
@@ -1156,9 +1544,10 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
  * 它指导该怎么执行和 slave 相关的 RDB 下一步工作。
  */
 // TODO: 要是多个 slave 过来要求同步，而且每个 slave 都发现当前的 RDB 文件不能公用，会发生什么？
-void updateSlavesWaitingBgsave(int bgsaveerr) {
+void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
     listNode *ln;
     int startbgsave = 0;
+    int mincapa = -1;
     listIter li;
 
     // 遍历所有 slave
@@ -1171,9 +1560,10 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
         if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
             // TODO: 进来这里的话，意味着是一个怎样的 case ？
             // 之前的 RDB 文件不能被 slave 使用，
-            // 开始新的 BGSAVE
+            // 开始新的 BGSAVE （只能使用所有等待中的 slave 都支持的能力）
             startbgsave = 1;
-            slave->replstate = REDIS_REPL_WAIT_BGSAVE_END;
+            mincapa = (mincapa == -1) ? slave->slave_capa :
+                                        (mincapa & slave->slave_capa);
 
         } else if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END) {
 
@@ -1181,6 +1571,28 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
 
             struct redis_stat buf;  // 配合 redis_fstat 用的，依赖于操作系统
 
+            /* If this was an RDB on disk save, we have to prepare to send
+             * the RDB from disk to the slave socket. Otherwise if this was
+             * already an RDB -> Slaves socket transfer, used in the case of
+             * diskless replication, our work is trivial, we can just put
+             * the slave online. */
+            // 无盘复制：失败的 slave 已经在 backgroundSaveDoneHandlerSocket() 中释放，
+            // 剩下的 slave 都已经收到了完整的 RDB
+            if (type == REDIS_RDB_CHILD_TYPE_SOCKET) {
+                redisLog(REDIS_NOTICE,
+                    "Streamed RDB transfer with slave %llu succeeded (socket). Waiting for REPLCONF ACK from slave to enable streaming",
+                    (unsigned long long) slave->id);
+                /* Note: we wait for a REPLCONF ACK message from slave in
+                 * order to really put it online (install the write handler
+                 * so that the accumulated data can be transfered). However
+                 * we change the replication state ASAP, since our slave
+                 * is technically online now. */
+                slave->replstate = REDIS_REPL_ONLINE;
+                slave->repl_put_online_on_ack = 1;
+                slave->repl_ack_time = server.unixtime; /* Timeout otherwise. */
+                continue;
+            }
+
             // 但是 BGSAVE 执行错误
             if (bgsaveerr != REDIS_OK) {
                 // 释放 slave
@@ -1207,7 +1619,9 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
             // 更新状态
             slave->replstate = REDIS_REPL_SEND_BULK;
 
-            slave->replpreamble = sdscatprintf(sdsempty(),"$%lld\r\n",
+            // 压缩连接使用 $LZF:<len> ，让 slave 知道 RDB 是以帧的方式发送的
+            slave->replpreamble = sdscatprintf(sdsempty(),
+                slave->repl_zbuf ? "$LZF:%lld\r\n" : "$%lld\r\n",
                 (unsigned long long) slave->repldbsize);
 
             // 清空之前的写事件处理器（避免破坏正在传递的 RDB 文件）
@@ -1223,26 +1637,78 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
     }
 
     // 需要执行新的 BGSAVE
-    if (startbgsave) {
-        /* Since we are starting a new background save for one or more slaves,
-         * we flush the Replication Script Cache to use EVAL to propagate every
-         * new EVALSHA for the first time, since all the new slaves don't know
-         * about previous scripts. */
-        // 开始行的 BGSAVE ，并清空脚本缓存
-        replicationScriptCacheFlush();
-        if (rdbSaveBackground(server.rdb_filename) != REDIS_OK) {
-            listIter li;
+    if (startbgsave) startBgsaveForReplication(mincapa);
+}
 
-            listRewind(server.slaves,&li);
-            redisLog(REDIS_WARNING,"SYNC failed. BGSAVE failed");
-            while((ln = listNext(&li))) {
-                redisClient *slave = ln->value;
+/* Start a BGSAVE for replication goals, which is, selecting the disk or
+ * socket target depending on the configuration, and making sure that
+ * the script cache is flushed before to start.
+ *
+ * The mincapa argument is the bitwise AND among all the slaves capabilities
+ * of the slaves waiting for this BGSAVE, so represents the slave capabilities
+ * all the slaves support. Can be tested via SLAVE_CAPA_* macros.
+ *
+ * On failure the slaves waiting for the BGSAVE to start are disconnected
+ * with an error, and REDIS_ERR is returned.
+ *
+ * 为复制开始一次 BGSAVE ：开启了无盘复制并且所有等待中的 slave 都支持 EOF 格式时，
+ * 将 RDB 直接写入 slave 的套接字，否则写入磁盘。
+ */
+int startBgsaveForReplication(int mincapa) {
+    int retval;
+    int socket_target = server.repl_diskless_sync && (mincapa & SLAVE_CAPA_EOF);
+    listIter li;
+    listNode *ln;
 
-                if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START)
-                    freeClient(slave);
+    redisLog(REDIS_NOTICE,"Starting BGSAVE for SYNC with target: %s",
+        socket_target ? "slaves sockets" : "disk");
+
+    /* Since we are starting a new background save for one or more slaves,
+     * we flush the Replication Script Cache to use EVAL to propagate every
+     * new EVALSHA for the first time, since all the new slaves don't know
+     * about previous scripts. */
+    // 开始行的 BGSAVE ，并清空脚本缓存
+    replicationScriptCacheFlush();
+
+    if (socket_target)
+        retval = rdbSaveToSlavesSockets();
+    else
+        retval = rdbSaveBackground(server.rdb_filename);
+
+    /* If we failed to BGSAVE, remove the slaves waiting for a full
+     * resynchronization from the list of slaves, inform them with
+     * an error about what happened, close the connection ASAP. */
+    if (retval == REDIS_ERR) {
+        redisLog(REDIS_WARNING,"SYNC failed. BGSAVE failed");
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            redisClient *slave = ln->value;
+
+            if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
+                slave->flags &= ~REDIS_SLAVE;
+                slave->replstate = REDIS_REPL_NONE;
+                listDelNode(server.slaves,ln);
+                addReplyError(slave,
+                    "BGSAVE failed, replication can't continue");
+                slave->flags |= REDIS_CLOSE_AFTER_REPLY;
             }
         }
+        return retval;
     }
+
+    /* If the target is socket, rdbSaveToSlavesSockets() already setup
+     * the slaves for a full resync. Otherwise for disk target do it now. */
+    if (!socket_target) {
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            redisClient *slave = ln->value;
+
+            if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START)
+                replicationSetupSlaveForFullResync(slave,
+                    getPsyncInitialOffset());
+        }
+    }
+    return retval;
 }
 
 /* ----------------------------------- SLAVE -------------------------------- */
@@ -1259,9 +1725,14 @@ void replicationAbortSyncTransfer(void) {
     // close VS unlink
     // unlink 之后，会导致引用计数减少，这时候在 linux 看来，才是真正的删除了这个文件
     // close 并不会影响引用计数，所以并不会删除文件
-    close(server.repl_transfer_fd); // 文件被 close 了（文件并没有被删除）
-    unlink(server.repl_transfer_tmpfile);   // unlink 了，确保文件会被删除；这样一来，才不会在下次使用这个文件的时候，残留有这次的数据，确保文件时干净的，没有被污染
-    zfree(server.repl_transfer_tmpfile);
+    // 从套接字直接载入 RDB 时并没有临时文件
+    if (server.repl_transfer_fd != -1) {
+        close(server.repl_transfer_fd); // 文件被 close 了（文件并没有被删除）
+        unlink(server.repl_transfer_tmpfile);   // unlink 了，确保文件会被删除；这样一来，才不会在下次使用这个文件的时候，残留有这次的数据，确保文件时干净的，没有被污染
+        zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_fd = -1;
+        server.repl_transfer_tmpfile = NULL;
+    }
     server.repl_state = REDIS_REPL_CONNECT;
 }
 
@@ -1290,6 +1761,24 @@ void replicationEmptyDbCallback(void *privdata) {
     replicationSendNewlineToMaster();
 }
 
+/* Return true if the RDB received from the master should be loaded
+ * directly from the socket instead of being stored on disk first, according
+ * to the repl-diskless-load option.
+ *
+ * 是否应该直接从套接字载入 master 发来的 RDB */
+static int useDisklessLoad(void) {
+    int j;
+
+    if (server.repl_diskless_load == REDIS_REPL_DISKLESS_LOAD_SWAPDB)
+        return 1;
+    if (server.repl_diskless_load == REDIS_REPL_DISKLESS_LOAD_WHEN_DB_EMPTY) {
+        for (j = 0; j < server.dbnum; j++)
+            if (dictSize(server.db[j].dict)) return 0;
+        return 1;
+    }
+    return 0;
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 // 将这个函数注册进 epoll-instance 里面去，作为 slave 连接 master 的 read-callback
 // slave 就是通过这个函数，将 master 发送过来的 RDB 文件，加载进 slave redis-server 里面
@@ -1298,6 +1787,21 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[4096];
     ssize_t nread, readlen;
     off_t left;
+    /* Static vars used to hold the EOF mark, and the last bytes received
+     * form the server: when they match, we reached the end of the transfer. */
+    static char eofmark[REDIS_EOF_MARK_SIZE];
+    static char lastbytes[REDIS_EOF_MARK_SIZE];
+    static int usemark = 0;
+    /* With compression the payload is received as frames: 'zbuf' holds the
+     * frame being received and 'zraw' the decoded data. */
+    static int usecompression = 0;
+    static sds zbuf = NULL, zraw = NULL;
+    char *p = buf;
+    int eof_reached = 0;
+    /* No temp file was created if the RDB is loaded from the socket. */
+    int use_diskless_load = (server.repl_transfer_fd == -1);
+    dbBackup *backup = NULL;
+    rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(privdata);
     REDIS_NOTUSED(mask);
@@ -1336,79 +1840,245 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
 
         // 分析 RDB 文件大小，buf = "$40\r\n"
-        server.repl_transfer_size = strtol(buf+1,NULL,10);
-
-        redisLog(REDIS_NOTICE,
-            "MASTER <-> SLAVE sync: receiving %lld bytes from master",
-            (long long) server.repl_transfer_size);
+        /* There are two possible forms for the bulk payload. One is the
+         * usual $<count> bulk format. The other is used for diskless transfers
+         * when the master does not know beforehand the size of the file to
+         * transfer. In the latter case, the following format is used:
+         *
+         * $EOF:<40 bytes delimiter>
+         *
+         * At the end of the file the announced delimiter is transmitted. The
+         * delimiter is long and random enough that the probability of a
+         * collision with the actual file content can be ignored. */
+        // 无盘复制时 master 并不知道 RDB 的长度，改用 40 字节的分隔符标记结尾
+        usecompression = 0;
+        if (strncmp(buf+1,"EOF:",4) == 0 && strlen(buf+5) >= REDIS_EOF_MARK_SIZE) {
+            usemark = 1;
+            memcpy(eofmark,buf+5,REDIS_EOF_MARK_SIZE);
+            memset(lastbytes,0,REDIS_EOF_MARK_SIZE);
+            /* Set any repl_transfer_size to avoid entering this code path
+             * at the next call. */
+            server.repl_transfer_size = 0;
+            redisLog(REDIS_NOTICE,
+                "MASTER <-> SLAVE sync: receiving streamed RDB from master");
+        } else if (strncmp(buf+1,"LZF:",4) == 0) {
+            // 压缩的 RDB ，长度是解码之后的长度
+            usemark = 0;
+            usecompression = 1;
+            if (zbuf) sdsclear(zbuf); else zbuf = sdsempty();
+            if (zraw == NULL) zraw = sdsempty();
+            server.repl_transfer_size = strtol(buf+5,NULL,10);
+            redisLog(REDIS_NOTICE,
+                "MASTER <-> SLAVE sync: receiving %lld bytes from master (compressed)",
+                (long long) server.repl_transfer_size);
+        } else {
+            usemark = 0;
+            server.repl_transfer_size = strtol(buf+1,NULL,10);
+            redisLog(REDIS_NOTICE,
+                "MASTER <-> SLAVE sync: receiving %lld bytes from master",
+                (long long) server.repl_transfer_size);
+        }
         return; // 个人估计是不想 syncReadLine() 那里长时间阻塞，而且 master 那边，长度跟 RDB 文件也是分开两次 write 发过来的
     }
 
     /* Read bulk data */
-    // 读数据
-    // 还有多少字节要读？server.repl_transfer_read 在 REDIS_REPL_RECEIVE_PONG 的时候就被 reset 0 了
-    left = server.repl_transfer_size - server.repl_transfer_read;
-    readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);    // 限制一次性最多读取 4 KB 数据
-    // 读取
-    nread = read(fd,buf,readlen);   // 一次最多 read 4k 内存
-    if (nread <= 0) {
-        redisLog(REDIS_WARNING,"I/O error trying to sync with MASTER: %s",
-            (nread == -1) ? strerror(errno) : "connection lost");
+    // 使用无盘载入时，数据在下面由 rdbLoadRio() 直接从套接字读取
+    if (!use_diskless_load) {
+        // 读数据
+        // 还有多少字节要读？server.repl_transfer_read 在 REDIS_REPL_RECEIVE_PONG 的时候就被 reset 0 了
+        if (usemark) {
+            readlen = sizeof(buf);
+        } else {
+            left = server.repl_transfer_size - server.repl_transfer_read;
+            readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);    // 限制一次性最多读取 4 KB 数据
+        }
+        // 读取
+        if (usecompression) {
+            sdsclear(zraw);
+            nread = replReadFrames(fd,&zbuf,&zraw,readlen);
+            /* Just part of a frame was received so far. */
+            if (nread == -1 && errno == EAGAIN) {
+                server.repl_transfer_lastio = server.unixtime;
+                return;
+            }
+            p = zraw;
+        } else {
+            nread = read(fd,buf,readlen);   // 一次最多 read 4k 内存
+        }
+        if (nread <= 0) {
+            redisLog(REDIS_WARNING,"I/O error trying to sync with MASTER: %s",
+                (nread == -1) ? strerror(errno) : "connection lost");
         
-        // nread = 0, 对应的情况就是对端执行了 close(socket_fd)，也就是 connection lost
-        // 这种情况下，对端已经不会在发送数据过来了，自然是中断 repl
+            // nread = 0, 对应的情况就是对端执行了 close(socket_fd)，也就是 connection lost
+            // 这种情况下，对端已经不会在发送数据过来了，自然是中断 repl
+            replicationAbortSyncTransfer();
+            return;
+        }
+        /* When a mark is used, we want to detect EOF asap in order to avoid
+         * writing the EOF mark into the file... */
+        // 使用分隔符时，记录最后收到的 40 个字节，和分隔符相同即传送结束
+        if (usemark) {
+            /* Update the last bytes array, and check if it matches our delimiter.*/
+            if (nread >= REDIS_EOF_MARK_SIZE) {
+                memcpy(lastbytes,buf+nread-REDIS_EOF_MARK_SIZE,REDIS_EOF_MARK_SIZE);
+            } else {
+                int rem = REDIS_EOF_MARK_SIZE-nread;
+                memmove(lastbytes,lastbytes+nread,rem);
+                memcpy(lastbytes+rem,buf,nread);
+            }
+            if (memcmp(lastbytes,eofmark,REDIS_EOF_MARK_SIZE) == 0) eof_reached = 1;
+        }
+
+        // 更新最后 RDB 产生的 IO 时间
+        server.repl_transfer_lastio = server.unixtime;
+        if (usecompression &&
+            nread > server.repl_transfer_size - server.repl_transfer_read)
+        {
+            redisLog(REDIS_WARNING,"Bad protocol from MASTER, the compressed RDB is longer than announced");
+            goto error;
+        }
+        if (write(server.repl_transfer_fd,p,nread) != nread) {    // 将 buf 里面接收到的数据落盘，形成本地的 RDB
+            redisLog(REDIS_WARNING,"Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
+            goto error;
+        }
+        // 加上刚读取好的字节数
+        server.repl_transfer_read += nread;
+
+        /* Delete the last 40 bytes from the file if we reached EOF. */
+        // 分隔符并不属于 RDB ，从文件中删掉
+        if (usemark && eof_reached) {
+            if (ftruncate(server.repl_transfer_fd,
+                server.repl_transfer_read - REDIS_EOF_MARK_SIZE) == -1)
+            {
+                redisLog(REDIS_WARNING,"Error truncating the RDB file received from the master for SYNC: %s", strerror(errno));
+                goto error;
+            }
+        }
+
+        /* Sync data on disk from time to time, otherwise at the end of the transfer
+         * we may suffer a big delay as the memory buffers are copied into the
+         * actual disk. */
+        // 定期将读入的文件 fsync 到磁盘，到最后时因为 buffer 太多，一下子写入时撑爆 IO，导致的阻塞
+        // 这样就不用担心 close 的时候，数据没有真正落盘了
+        if (server.repl_transfer_read >=
+            server.repl_transfer_last_fsync_off + REPL_MAX_WRITTEN_BEFORE_FSYNC)
+        {
+            off_t sync_size = server.repl_transfer_read -
+                              server.repl_transfer_last_fsync_off;
+            rdb_fsync_range(server.repl_transfer_fd,
+                server.repl_transfer_last_fsync_off, sync_size);
+            server.repl_transfer_last_fsync_off += sync_size;
+        }
+
+        /* Check if the transfer is now complete */
+        // 检查 RDB 是否已经传送完毕
+        if (!usemark) {
+            if (server.repl_transfer_read == server.repl_transfer_size)
+                eof_reached = 1;
+        }
+
+        if (!eof_reached) return;
+    }
+
+    /* We reach this point when the whole payload was stored on disk, or
+     * with diskless load as soon as the first bytes of the RDB arrived. */
+
+    // 完毕，将临时文件改名为 dump.rdb
+    if (!use_diskless_load &&
+        rename(server.repl_transfer_tmpfile,server.rdb_filename) == -1)
+    {
+        redisLog(REDIS_WARNING,"Failed trying to rename the temp DB into dump.rdb in MASTER <-> SLAVE synchronization: %s", strerror(errno));
         replicationAbortSyncTransfer();
         return;
     }
-    // 更新最后 RDB 产生的 IO 时间
-    server.repl_transfer_lastio = server.unixtime;
-    if (write(server.repl_transfer_fd,buf,nread) != nread) {    // 将 buf 里面接收到的数据落盘，形成本地的 RDB
-        redisLog(REDIS_WARNING,"Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
-        goto error;
-    }
-    // 加上刚读取好的字节数
-    server.repl_transfer_read += nread;
 
-    /* Sync data on disk from time to time, otherwise at the end of the transfer
-     * we may suffer a big delay as the memory buffers are copied into the
-     * actual disk. */
-    // 定期将读入的文件 fsync 到磁盘，到最后时因为 buffer 太多，一下子写入时撑爆 IO，导致的阻塞
-    // 这样就不用担心 close 的时候，数据没有真正落盘了
-    if (server.repl_transfer_read >=
-        server.repl_transfer_last_fsync_off + REPL_MAX_WRITTEN_BEFORE_FSYNC)
+    signalFlushedDb(-1);
+    if (use_diskless_load &&
+        server.repl_diskless_load == REDIS_REPL_DISKLESS_LOAD_SWAPDB)
     {
-        off_t sync_size = server.repl_transfer_read -
-                          server.repl_transfer_last_fsync_off;
-        rdb_fsync_range(server.repl_transfer_fd,
-            server.repl_transfer_last_fsync_off, sync_size);
-        server.repl_transfer_last_fsync_off += sync_size;
-    }
+        /* Keep the old dataset aside: it is restored if the transfer
+         * fails before the new one is completely loaded. */
+        // 先保存旧数据库，载入失败时恢复
+        redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Saving old data");
+        backup = backupDb();
+    } else {
+        // 先清空旧数据库
+        redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        emptyDb(server.repl_slave_lazy_flush ? EMPTYDB_ASYNC : EMPTYDB_NO_FLAGS,
+                replicationEmptyDbCallback);
+    }
+    /* The functions of the master replace ours, like the dataset. */
+    // 函数以 master 的为准
+    luaFunctionsFlush();
+
+    /* Before loading the DB into memory we need to delete the readable
+     * handler, otherwise it will get called recursively since
+     * rdbLoad() will call the event loop to process events from time to
+     * time for non blocking loading. */
+    // 先删除 master 的读事件监听，因为 rdbLoad() 函数也会监听读事件
+    // TODO: repl_transfer_s 的这个读事件为何冲突呢？
+    aeDeleteFileEvent(server.el,server.repl_transfer_s,AE_READABLE);
 
-    /* Check if the transfer is now complete */
-    // 检查 RDB 是否已经传送完毕
-    if (server.repl_transfer_read == server.repl_transfer_size) {
+    if (use_diskless_load) {
+        rio rdb;
+        int loaded;
 
-        // 完毕，将临时文件改名为 dump.rdb
-        if (rename(server.repl_transfer_tmpfile,server.rdb_filename) == -1) {
-            redisLog(REDIS_WARNING,"Failed trying to rename the temp DB into dump.rdb in MASTER <-> SLAVE synchronization: %s", strerror(errno));
+        /* Parse the RDB as it arrives. The socket is made blocking, with
+         * a timeout, since the loading process itself blocks anyway. When
+         * the size is known we never read past the payload, as what
+         * follows is the replication stream. */
+        // 直接从套接字载入 RDB
+        redisLog(REDIS_NOTICE,
+            "MASTER <-> SLAVE sync: Loading DB in memory from socket");
+        rioInitWithFd(&rdb,fd,usemark ? 0 : server.repl_transfer_size);
+        if (usecompression) rdb.io.fd.zbuf = sdsempty();
+        anetBlock(NULL,fd);
+        anetRecvTimeout(NULL,fd,server.repl_timeout*1000);
+
+        startLoadingWithSize(usemark ? 0 : server.repl_transfer_size);
+        loaded = (rdbLoadRio(&rdb,&rsi) == REDIS_OK);
+        stopLoading();
+
+        /* With the EOF mark the RDB is followed by the mark itself. */
+        if (loaded && usemark) {
+            if (rioRead(&rdb,buf,REDIS_EOF_MARK_SIZE) == 0 ||
+                memcmp(buf,eofmark,REDIS_EOF_MARK_SIZE) != 0)
+            {
+                redisLog(REDIS_WARNING,"Missing or wrong EOF mark after the RDB received from the master");
+                loaded = 0;
+            }
+        }
+        if (!loaded) {
+            redisLog(REDIS_WARNING,"Failed trying to load the MASTER synchronization DB from socket");
+        }
+        rioFreeFd(&rdb);
+
+        if (!loaded) {
+            /* Never serve a partially loaded dataset. */
+            // 丢弃载入了一部分的数据，有备份的话恢复旧数据
+            if (backup) {
+                redisLog(REDIS_NOTICE,"MASTER <-> SLAVE sync: Restoring old data");
+                restoreDbBackup(backup);
+            } else {
+                emptyDb(server.repl_slave_lazy_flush ? EMPTYDB_ASYNC :
+                        EMPTYDB_NO_FLAGS, replicationEmptyDbCallback);
+            }
             replicationAbortSyncTransfer();
             return;
         }
 
-        // 先清空旧数据库
-        redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
-        signalFlushedDb(-1);
-        emptyDb(replicationEmptyDbCallback);
-        /* Before loading the DB into memory we need to delete the readable
-         * handler, otherwise it will get called recursively since
-         * rdbLoad() will call the event loop to process events from time to
-         * time for non blocking loading. */
-        // 先删除 master 的读事件监听，因为 rdbLoad() 函数也会监听读事件
-        // TODO: repl_transfer_s 的这个读事件为何冲突呢？
-        aeDeleteFileEvent(server.el,server.repl_transfer_s,AE_READABLE);
+        if (backup) {
+            redisLog(REDIS_NOTICE,"MASTER <-> SLAVE sync: Discarding old data");
+            discardDbBackup(backup,server.repl_slave_lazy_flush ?
+                            EMPTYDB_ASYNC : EMPTYDB_NO_FLAGS);
+        }
 
+        /* Back to the non blocking mode used for the replication link. */
+        anetNonBlock(NULL,fd);
+        anetRecvTimeout(NULL,fd,0);
+    } else {
         // 载入 RDB
-        if (rdbLoad(server.rdb_filename) != REDIS_OK) {
+        if (rdbLoad(server.rdb_filename,&rsi) != REDIS_OK) {
             redisLog(REDIS_WARNING,"Failed trying to load the MASTER synchronization DB from disk");
             replicationAbortSyncTransfer();
             return;
@@ -1418,48 +2088,77 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         // 关闭临时文件
         zfree(server.repl_transfer_tmpfile);
         close(server.repl_transfer_fd);
+        server.repl_transfer_fd = -1;
+        server.repl_transfer_tmpfile = NULL;
+    }
 
-        // 将 master 设置成一个 redis client
-        // 注意 createClient 会为 master 绑定事件，为接下来接收命令做好准备
-        server.master = createClient(server.repl_transfer_s);
-        // 标记这个客户端为 master 
-        server.master->flags |= REDIS_MASTER;
-        // 标记它为已验证身份
-        server.master->authenticated = 1;
-        // 更新复制状态
-        server.repl_state = REDIS_REPL_CONNECTED;
-        // 设置 master 的复制偏移量
-        server.master->reploff = server.repl_master_initial_offset;
-        // 保存 master 的 RUN ID
-        memcpy(server.master->replrunid, server.repl_master_runid,
-            sizeof(server.repl_master_runid));
-
-        /* If master offset is set to -1, this master is old and is not
-         * PSYNC capable, so we flag it accordingly. */
-        // 如果 offset 被设置为 -1 ，那么表示 master 的版本低于 2.8 
-        // 无法使用 PSYNC ，所以需要设置相应的标识值
-        if (server.master->reploff == -1)
-            server.master->flags |= REDIS_PRE_PSYNC;
-        redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        // 如果有开启 AOF 持久化，那么重启 AOF 功能，并强制生成新数据库的 AOF 文件
-        if (server.aof_state != REDIS_AOF_OFF) {
-            int retry = 10;
-
-            // 关闭
-            stopAppendOnly();
-            // 再重启
-            while (retry-- && startAppendOnly() == REDIS_ERR) {
-                redisLog(REDIS_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
-                sleep(1);
-            }
-            if (!retry) {
-                redisLog(REDIS_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
-                exit(1);
-            }
+    // 将 master 设置成一个 redis client
+    // 注意 createClient 会为 master 绑定事件，为接下来接收命令做好准备
+    server.master = createClient(server.repl_transfer_s);
+    // 标记这个客户端为 master 
+    server.master->flags |= REDIS_MASTER;
+    // 标记它为已验证身份
+    server.master->authenticated = 1;
+    // 压缩的复制连接，之后的复制流同样以帧的方式接收
+    if (server.repl_master_compression) server.master->repl_zbuf = sdsempty();
+    // 更新复制状态
+    server.repl_state = REDIS_REPL_CONNECTED;
+    // 设置 master 的复制偏移量
+    server.master->reploff = server.repl_master_initial_offset;
+    server.master->read_reploff = server.master->reploff;
+    // 保存 master 的复制 ID
+    memcpy(server.master->replid, server.master_replid,
+        sizeof(server.master_replid));
+    /* The replication stream continues in the DB that was selected when
+     * the master generated the RDB. */
+    if (rsi.repl_stream_db != -1)
+        selectDb(server.master,rsi.repl_stream_db);
+
+    /* If master offset is set to -1, this master is old and is not
+     * PSYNC capable, so we flag it accordingly. */
+    // 如果 offset 被设置为 -1 ，那么表示 master 的版本低于 2.8 
+    // 无法使用 PSYNC ，所以需要设置相应的标识值
+    if (server.master->reploff == -1)
+        server.master->flags |= REDIS_PRE_PSYNC;
+
+    /* After a full resynchronization we use the replication ID and offset
+     * of the master. The secondary ID / offset are cleared since we are
+     * starting a new history. */
+    // 完全同步之后，与 master 共享同一段复制历史
+    memcpy(server.replid,server.master->replid,sizeof(server.replid));
+    if (server.master->reploff != -1)
+        server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+
+    /* Let's create the replication backlog if needed. Slaves need to
+     * accumulate the backlog regardless of the fact they have sub-slaves
+     * or not, in order to behave correctly if they are promoted to
+     * masters after a failover. */
+    // slave 同样需要 backlog ，这样被提升为 master 之后才能接受 PSYNC
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+    redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+
+    /* Send the initial ACK immediately to put this slave in online state. */
+    // 无盘复制时，master 要收到第一个 ACK 才会开始发送累积的命令
+    if (usemark) replicationSendAck();
+
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    // 如果有开启 AOF 持久化，那么重启 AOF 功能，并强制生成新数据库的 AOF 文件
+    if (server.aof_state != REDIS_AOF_OFF) {
+        int retry = 10;
+
+        // 关闭
+        stopAppendOnly();
+        // 再重启
+        while (retry-- && startAppendOnly() == REDIS_ERR) {
+            redisLog(REDIS_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
+            sleep(1);
+        }
+        if (!retry) {
+            redisLog(REDIS_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
+            exit(1);
         }
     }
 
@@ -1553,44 +2252,96 @@ char *sendSynchronousCommand(int fd, ...) {
  * PSYNC_NOT_SUPPORTED: If the server does not understand PSYNC at all and
  *                      the caller should fall back to SYNC.
  *                      master 不支持 PSYNC ，调用者应该下降到 SYNC 命令。
+ *
+ * The function is called twice: first with read_reply set to 0 in order to
+ * just send the PSYNC command, then again with read_reply set to 1 every
+ * time the socket becomes readable, since a master performing a full
+ * resync only replies once the BGSAVE for this slave actually starts
+ * (which may be delayed with diskless replication). In the first case
+ * the function returns:
+ *
+ * 函数分两次调用：read_reply 为 0 时只发送 PSYNC 命令，
+ * 之后每当套接字可读时以 read_reply 为 1 调用，读取 master 的回复。
+ * 因为 master 要等到真正开始 BGSAVE 时才会回复 +FULLRESYNC 。
+ *
+ * PSYNC_WAIT_REPLY: The command was sent, call again to read the reply.
+ *                   Also returned when reading if the master just sent
+ *                   a newline to keep the link alive.
+ * PSYNC_WRITE_ERROR: There was an error writing the command to the socket.
  */
 
 #define PSYNC_CONTINUE 0
 #define PSYNC_FULLRESYNC 1
 #define PSYNC_NOT_SUPPORTED 2
-int slaveTryPartialResynchronization(int fd) {
-    char *psync_runid;
+#define PSYNC_WAIT_REPLY 3
+#define PSYNC_WRITE_ERROR 4
+int slaveTryPartialResynchronization(int fd, int read_reply) {
+    char *psync_replid;
     char psync_offset[32];
+    char buf[256];
     sds reply;
 
-    /* Initially set repl_master_initial_offset to -1 to mark the current
-     * master run_id and offset as not valid. Later if we'll be able to do
-     * a FULL resync using the PSYNC command we'll set the offset at the
-     * right value, so that this information will be propagated to the
-     * client structure representing the master into server.master. */
-    server.repl_master_initial_offset = -1;
-
-    if (server.cached_master) {
-        // 缓存存在，尝试部分重同步
-        // 命令为 "PSYNC <master_run_id> <repl_offset>"
-        psync_runid = server.cached_master->replrunid;
-        snprintf(psync_offset,sizeof(psync_offset),"%lld", server.cached_master->reploff+1);
-        redisLog(REDIS_NOTICE,"Trying a partial resynchronization (request %s:%s).", psync_runid, psync_offset);
-    } else {
-        // 缓存不存在
-        // 发送 "PSYNC ? -1" ，要求完整重同步
-        redisLog(REDIS_NOTICE,"Partial resynchronization not possible (no cached master)");
-        psync_runid = "?";
-        memcpy(psync_offset,"-1",3);    // 3 = '-' + '1' + '\0'
+    /* Writing half. */
+    if (!read_reply) {
+        /* Initially set repl_master_initial_offset to -1 to mark the current
+         * master run_id and offset as not valid. Later if we'll be able to do
+         * a FULL resync using the PSYNC command we'll set the offset at the
+         * right value, so that this information will be propagated to the
+         * client structure representing the master into server.master. */
+        server.repl_master_initial_offset = -1;
+
+        if (server.cached_master) {
+            // 缓存存在，尝试部分重同步
+            // 命令为 "PSYNC <master_replid> <repl_offset>"
+            psync_replid = server.cached_master->replid;
+            snprintf(psync_offset,sizeof(psync_offset),"%lld", server.cached_master->reploff+1);
+            redisLog(REDIS_NOTICE,"Trying a partial resynchronization (request %s:%s).", psync_replid, psync_offset);
+        } else {
+            // 缓存不存在
+            // 发送 "PSYNC ? -1" ，要求完整重同步
+            redisLog(REDIS_NOTICE,"Partial resynchronization not possible (no cached master)");
+            psync_replid = "?";
+            memcpy(psync_offset,"-1",3);    // 3 = '-' + '1' + '\0'
+        }
+
+        /* Issue the PSYNC command */
+        // 向 master 发送 PSYNC 命令
+        // 1. 第一次的话，将会发送 "PSYNC ? -1"
+        //    回复由事件循环在套接字可读时读取，slave 不会 block 在这里等待 master 开始 BGSAVE
+        // 2. 要是 PSYNC 的话，发送 "PSYNC ec8a50f43887ce9d69aaf49811fb7a885ac1a382 5406\r\n"
+        //    要是 master 觉得没问题，那就会直接回复：可以进行 PYSNC，你就绪了之后就发起这个流程吧
+        reply = sdscatprintf(sdsempty(),"PSYNC %s %s\r\n",
+                             psync_replid,psync_offset);
+        if (syncWrite(fd,reply,sdslen(reply),
+                      server.repl_syncio_timeout*1000) == -1)
+        {
+            redisLog(REDIS_WARNING,"I/O error writing PSYNC to MASTER: %s",
+                strerror(errno));
+            sdsfree(reply);
+            return PSYNC_WRITE_ERROR;
+        }
+        sdsfree(reply);
+        return PSYNC_WAIT_REPLY;
     }
 
-    /* Issue the PSYNC command */
-    // 向 master 发送 PSYNC 命令
-    // 1. 第一次的话，将会发送 "PSYNC ? -1"
-    //    同时 slave 会同步 block 在这里等待 master 回复（超时会结束 block 等待）
-    // 2. 要是 PSYNC 的话，发送 "PSYNC ec8a50f43887ce9d69aaf49811fb7a885ac1a382 5406\r\n"
-    //    要是 master 觉得没问题，那就会直接回复：可以进行 PYSNC，你就绪了之后就发起这个流程吧
-    reply = sendSynchronousCommand(fd,"PSYNC",psync_runid,psync_offset,NULL);
+    /* Reading half. */
+    if (syncReadLine(fd,buf,sizeof(buf),server.repl_syncio_timeout*1000) == -1)
+        reply = sdscatprintf(sdsempty(),"-Reading from master: %s",
+                strerror(errno));
+    else
+        reply = sdsnew(buf);
+
+    if (sdslen(reply) == 0) {
+        /* The master may send empty newlines after it receives PSYNC
+         * and before to reply, just to keep the connection alive. */
+        sdsfree(reply);
+        server.repl_transfer_lastio = server.unixtime;
+        return PSYNC_WAIT_REPLY;
+    }
+
+    /* We got the reply: delete the readable event, the caller will install
+     * the handler needed by the next replication stage. */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
 
     // 接收到 FULLRESYNC ，进行 full-resync，同时更新 repl_master_initial_offset（为了日后可以进行 PSYNC）。
     // 例如：下面的 1
@@ -1617,19 +2368,19 @@ int slaveTryPartialResynchronization(int fd) {
              * runid to make sure next PSYNCs will fail. */
             //  master 支持 PSYNC ，但是却发来了异常的 run id
             // 只好将 run id 设为 0 ，让下次 PSYNC 时失败
-            memset(server.repl_master_runid,0,REDIS_RUN_ID_SIZE+1);
+            memset(server.master_replid,0,REDIS_RUN_ID_SIZE+1);
         } else {
             /* 之所以要做这么多东西，要保留这么多东西，基本都是为了 PSYNC 的
              * 而且在不需要重新 FULL SYNC 的情况下，这些数据都是能够被更新、被沿用的
              */
             // 保存 run id
-            memcpy(server.repl_master_runid, runid, offset-runid-1);
-            server.repl_master_runid[REDIS_RUN_ID_SIZE] = '\0';
+            memcpy(server.master_replid, runid, offset-runid-1);
+            server.master_replid[REDIS_RUN_ID_SIZE] = '\0';
             // 以及 initial offset
             server.repl_master_initial_offset = strtoll(offset,NULL,10);
             // 打印日志，这是一个 FULL resync
             redisLog(REDIS_NOTICE,"Full resync from master: %s:%lld",
-                server.repl_master_runid,
+                server.master_replid,
                 server.repl_master_initial_offset);
         }
         /* We are going to full resync, discard the cached master structure. */
@@ -1649,10 +2400,48 @@ int slaveTryPartialResynchronization(int fd) {
         /* Partial resync was accepted, set the replication state accordingly */
         redisLog(REDIS_NOTICE,
             "Successful partial resynchronization with master.");
+
+        /* Check the new replication ID advertised by the master. If it
+         * changed, we need to set the new ID as primary ID, and set or
+         * secondary ID as the old master ID up to the current offset, so
+         * that our sub-slaves will be able to PSYNC with us after a
+         * disconnection. */
+        // master 发生过 failover 的话， +CONTINUE 会带上新的复制 ID
+        char *start = reply+10;
+        char *end = reply+9;
+        while(end[0] != '\r' && end[0] != '\n' && end[0] != '\0') end++;
+        if (end-start == REDIS_RUN_ID_SIZE) {
+            char new[REDIS_RUN_ID_SIZE+1];
+            memcpy(new,start,REDIS_RUN_ID_SIZE);
+            new[REDIS_RUN_ID_SIZE] = '\0';
+
+            if (strcmp(new,server.cached_master->replid)) {
+                /* Master ID changed. */
+                redisLog(REDIS_WARNING,"Master replication ID changed to %s",new);
+
+                /* Set the old ID as our ID2, up to the current offset+1. */
+                memcpy(server.replid2,server.cached_master->replid,
+                    sizeof(server.replid2));
+                server.second_replid_offset = server.master_repl_offset+1;
+
+                /* Update the cached master ID and our own primary ID to the
+                 * new one. */
+                memcpy(server.replid,new,sizeof(server.replid));
+                memcpy(server.cached_master->replid,new,sizeof(server.replid));
+
+                /* Disconnect all the sub-slaves: they need to be notified. */
+                disconnectSlaves();
+            }
+        }
         sdsfree(reply);
         // 将缓存中的 master 设为当前 master
         replicationResurrectCachedMaster(fd);
 
+        /* If this instance was restarted and we read the metadata to
+         * PSYNC from the persistence file, our replication backlog could
+         * be still not initialized. Create it. */
+        if (server.repl_backlog == NULL) createReplicationBacklog();
+
         // 返回状态
         return PSYNC_CONTINUE;
     }
@@ -1685,7 +2474,7 @@ int slaveTryPartialResynchronization(int fd) {
 // 这样一来可能会等更久，所以，异步才是比较好的选择
 void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     char tmpfile[256], *err;
-    int dfd, maxtries = 5;
+    int dfd = -1, maxtries = 5;
     int sockerr = 0, psync_result;
     socklen_t errlen = sizeof(sockerr);
     REDIS_NOTUSED(el);
@@ -1726,6 +2515,11 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         goto error;
     }
 
+    /* The reply to PSYNC is read when the socket becomes readable, see
+     * below. */
+    if (server.repl_state == REDIS_REPL_RECEIVE_PSYNC)
+        goto receive_psync_reply;
+
     /* If we were connecting, it's time to send a non blocking PING, we want to
      * make sure the master is able to reply before going into the actual
      * replication process where we have long timeouts in the order of
@@ -1829,13 +2623,59 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(err);
     }
 
+    /* Inform the master of our capabilities. While we currently send
+     * just one capability, it is possible to chain new capabilities here
+     * in the form of REPLCONF capa X capa Y capa Z ...
+     * The master will ignore capabilities it does not understand. */
+    // 告诉 master ：本 slave 能够解析 EOF 格式的 RDB 流（无盘复制）
+    err = sendSynchronousCommand(fd,"REPLCONF","capa","eof",
+                                 "capa","psync2",NULL);
+    if (err[0] == '-') {
+        redisLog(REDIS_NOTICE,"(Non critical) Master does not understand REPLCONF capa: %s", err);
+    }
+    sdsfree(err);
+
+    /* Ask the master to compress what it sends us if configured to do so.
+     * The link is compressed only if the master accepted. */
+    // 要求 master 压缩复制连接，只有 master 同意之后才会压缩
+    server.repl_master_compression = 0;
+    if (server.repl_compression) {
+        err = sendSynchronousCommand(fd,"REPLCONF","compression","lzf",NULL);
+        if (err[0] == '-') {
+            redisLog(REDIS_NOTICE,"(Non critical) Master does not support replication compression: %s", err);
+        } else {
+            server.repl_master_compression = 1;
+        }
+        sdsfree(err);
+    }
+
     /* Try a partial resynchonization. If we don't have a cached master
      * slaveTryPartialResynchronization() will at least try to use PSYNC
      * to start a full resynchronization so that we get the master run id
      * and the global offset, to try a partial resync at the next
      * reconnection attempt. */
     // 根据返回的结果决定是执行部分 resync ，还是 full-resync
-    psync_result = slaveTryPartialResynchronization(fd);
+    /* The reply is not read synchronously: a master about to perform a
+     * full resync replies only when the BGSAVE for this slave starts, that
+     * with diskless replication can be delayed by a few seconds. */
+    // PSYNC 的回复在套接字可读时再读取，避免 slave 阻塞等待 master 开始 BGSAVE
+    if (slaveTryPartialResynchronization(fd,0) == PSYNC_WRITE_ERROR)
+        goto error;
+    server.repl_state = REDIS_REPL_RECEIVE_PSYNC;
+    server.repl_transfer_lastio = server.unixtime;
+    if (aeCreateFileEvent(server.el,fd,AE_READABLE,syncWithMaster,NULL)
+            == AE_ERR)
+    {
+        redisLog(REDIS_WARNING,
+            "Can't create readable event for PSYNC reply: %s (fd=%d)",
+            strerror(errno),fd);
+        goto error;
+    }
+    return;
+
+receive_psync_reply:
+    psync_result = slaveTryPartialResynchronization(fd,1);
+    if (psync_result == PSYNC_WAIT_REPLY) return; /* Try again later... */
 
     // 可以执行部分 resync
     if (psync_result == PSYNC_CONTINUE) {
@@ -1849,8 +2689,15 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
 
+    /* PSYNC failed or is not supported: we want our sub-slaves to resync
+     * with us as well, if we have any, since we are going to start a new
+     * replication history. */
+    // 自己要重新完全同步，sub-slave 也跟着重新同步
+    disconnectSlaves();
+    freeReplicationBacklog();
+
     /* Fall back to SYNC if needed. Otherwise psync_result == PSYNC_FULLRESYNC
-     * and the server.repl_master_runid and repl_master_initial_offset are
+     * and the server.master_replid and repl_master_initial_offset are
      * already populated. */
     //  master 不支持 PSYNC ，发送 SYNC
     if (psync_result == PSYNC_NOT_SUPPORTED) {
@@ -1866,20 +2713,23 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     // 如果执行到这里，
     // 那么 psync_result == PSYNC_FULLRESYNC 或 PSYNC_NOT_SUPPORTED
 
-    /* Prepare a suitable temp file for bulk transfer */
+    /* Prepare a suitable temp file for bulk transfer, unless the RDB is
+     * going to be loaded directly from the socket. */
     // 打开一个临时文件，用于写入和保存接下来从 master 传来的 RDB 文件数据
-    while(maxtries--) {
-        snprintf(tmpfile,256,
-            "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
-        // O_EXCL | O_CREAT 的配合使用，确保了这时候，只有当前进程在操作这一个文件，这是 O_EXCL 的一个特性
-        dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);   // 上一次可能会发生中途取消同步，所以这里并没有添加 O_APPEND 的 flag，而是采用从头开始的覆盖式写入
-
-        if (dfd != -1) break;
-        sleep(1);
-    }
-    if (dfd == -1) {
-        redisLog(REDIS_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
-        goto error;
+    if (!useDisklessLoad()) {
+        while(maxtries--) {
+            snprintf(tmpfile,256,
+                "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
+            // O_EXCL | O_CREAT 的配合使用，确保了这时候，只有当前进程在操作这一个文件，这是 O_EXCL 的一个特性
+            dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);   // 上一次可能会发生中途取消同步，所以这里并没有添加 O_APPEND 的 flag，而是采用从头开始的覆盖式写入
+
+            if (dfd != -1) break;
+            sleep(1);
+        }
+        if (dfd == -1) {
+            redisLog(REDIS_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
+            goto error;
+        }
     }
 
     /* Setup the non blocking download of the bulk file. */
@@ -1902,11 +2752,12 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = (dfd != -1) ? zstrdup(tmpfile) : NULL;
 
     return;
 
 error:
+    aeDeleteFileEvent(server.el,fd,AE_READABLE|AE_WRITABLE);
     close(fd);
     server.repl_transfer_s = -1;
     server.repl_state = REDIS_REPL_CONNECT; // 退回上一次的状态，尝试重新连接
@@ -1952,7 +2803,8 @@ void undoConnectWithMaster(void) {
 
     // 连接必须处于正在连接状态
     redisAssert(server.repl_state == REDIS_REPL_CONNECTING ||
-                server.repl_state == REDIS_REPL_RECEIVE_PONG);
+                server.repl_state == REDIS_REPL_RECEIVE_PONG ||
+                server.repl_state == REDIS_REPL_RECEIVE_PSYNC);
     aeDeleteFileEvent(server.el,fd,AE_READABLE|AE_WRITABLE);
     close(fd);
     server.repl_transfer_s = -1;
@@ -1980,7 +2832,8 @@ int cancelReplicationHandshake(void) {
     if (server.repl_state == REDIS_REPL_TRANSFER) {
         replicationAbortSyncTransfer();
     } else if (server.repl_state == REDIS_REPL_CONNECTING ||
-             server.repl_state == REDIS_REPL_RECEIVE_PONG)
+             server.repl_state == REDIS_REPL_RECEIVE_PONG ||
+             server.repl_state == REDIS_REPL_RECEIVE_PSYNC)
     {
         undoConnectWithMaster();
     } else {
@@ -1992,6 +2845,7 @@ int cancelReplicationHandshake(void) {
 /* Set replication to the specified master address and port. */
 // 将服务器设为指定地址的 slave 
 void replicationSetMaster(char *ip, int port) {
+    int was_master = server.masterhost == NULL;
 
     // 清除原有的 master 信息（如果有的话）
     sdsfree(server.masterhost);
@@ -2003,22 +2857,23 @@ void replicationSetMaster(char *ip, int port) {
     server.masterport = port;
 
     // 如果之前有 master 地址，那么释放相关资源
+    // 旧 master 会被缓存起来，新 master 有可能接受 PSYNC （例如 failover 之后）
     if (server.master) freeClient(server.master);
     // 断开所有 slave 的连接，强制所有 slave 执行重同步
     disconnectSlaves(); /* Force our slaves to resync with us as well. */
-    // 清空可能有的 master 缓存，因为已经不会执行 PSYNC 了
-    replicationDiscardCachedMaster(); /* Don't try a PSYNC. */
-    // 释放 backlog ，同理， PSYNC 目前已经不会执行了
-    freeReplicationBacklog(); /* Don't allow our chained slaves to PSYNC. */
     // 取消之前的复制进程（如果有的话）
     cancelReplicationHandshake();
+    /* Before destroying our master state, create a cached master using
+     * our own parameters, to later PSYNC with the new master. */
+    // 原本是 master 的话，用自己的复制 ID 和偏移量伪造一个缓存 master ，
+    // 这样降级为 slave 之后也可以尝试 PSYNC
+    if (was_master) replicationCacheMasterUsingMyself();
 
     // 进入连接状态（重点）
     // TODO:(DONE) 既然 redis 代码中，repl 的状态机切换是分散在各个文件里面的，那为何不再这里直接异步 connect 呢？
     // 为了能够重试！当某一次 connect 中途出了问题，那么我可以把 REDIS_REPL_CONNECTING 状态回退到 REDIS_REPL_CONNECT 状态
     // 然后在 replicationCron() 里面再次尝试
     server.repl_state = REDIS_REPL_CONNECT; // 实际上是进行异步 connect 的
-    server.master_repl_offset = 0;
     server.repl_down_since = 0;
 }
 
@@ -2030,24 +2885,27 @@ void replicationUnsetMaster(void) {
 
     sdsfree(server.masterhost);
     server.masterhost = NULL;
-
-    if (server.master) {
-        if (listLength(server.slaves) == 0) {
-            /* If this instance is turned into a master and there are no
-             * slaves, it inherits the replication offset from the master.
-             * Under certain conditions this makes replicas comparable by
-             * replication offset to understand what is the most updated. */
-            server.master_repl_offset = server.master->reploff;
-            freeReplicationBacklog();
-        }
-        freeClient(server.master);
-    }
-
+    /* When a slave is turned into a master, the current replication ID
+     * (that was inherited from the master at synchronization time) is
+     * used as secondary ID up to the current offset, and a new replication
+     * ID is created to continue with a new replication history. */
+    // 保留旧 master 的复制历史，其他 slave 可以继续向自己 PSYNC
+    shiftReplicationId();
+    if (server.master) freeClient(server.master);
     replicationDiscardCachedMaster();
-
     cancelReplicationHandshake();
-
+    /* Disconnecting all the slaves is required: we need to inform slaves
+     * of the replication ID change (see shiftReplicationId() call). However
+     * the slaves will be able to partially resync with us, so it will be
+     * a very fast reconnection. */
+    disconnectSlaves();
     server.repl_state = REDIS_REPL_NONE;
+
+    /* We need to make sure the new master will start the replication stream
+     * with a SELECT statement. This is forced after a full resync, but
+     * with PSYNC version 2, there is no need for full resync after a
+     * master switch. */
+    server.slaveseldb = -1;
 }
 
 // 这里的 client 是即将成为 slave 的那个 redis-server 相连通的 redis-cli
@@ -2172,6 +3030,21 @@ void replicationCacheMaster(redisClient *c) {
     redisAssert(ln != NULL);
     listDelNode(server.clients,ln);
 
+    /* Reset the master client so that's ready to accept new commands:
+     * we want to discard the non processed query buffers and non processed
+     * offsets, including pending transactions, already populated arguments,
+     * pending outputs to the master. */
+    // 丢弃还没有执行的命令，缓存的偏移量只算到已经执行了的命令为止
+    sdsclear(server.master->querybuf);
+    sdsclear(server.master->pending_querybuf);
+    server.master->read_reploff = server.master->reploff;
+    if (c->flags & REDIS_MULTI) discardTransaction(c);
+    while(listLength(c->reply)) listDelNode(c->reply,listFirst(c->reply));
+    c->reply_bytes = 0;
+    c->bufpos = 0;
+    c->sentlen = 0;
+    resetClient(c);
+
     /* Save the master. Server.master will be set to null later by
      * replicationHandleMasterDisconnection(). */
     // 缓存 master
@@ -2208,6 +3081,41 @@ void replicationCacheMaster(redisClient *c) {
     replicationHandleMasterDisconnection();
 }
 
+/* This function is called when a master is turned into a slave, in order
+ * to create from scratch a cached master for the new client, that will
+ * allow to PSYNC with the slave that was promoted as the new master after
+ * a failover.
+ *
+ * Assuming this instance was previously the master instance of the new
+ * master, the new master will accept its replication ID, and potentially
+ * also the current offset if no data was lost during the failover. So we
+ * use our current replication ID and offset in order to synthesize a
+ * cached master. */
+// 用自己的复制 ID 和偏移量伪造一个缓存 master ，
+// 也用于重启之后通过 RDB 中保存的复制信息尝试 PSYNC
+void replicationCacheMasterUsingMyself(void) {
+    /* The master client we create can be set to any DBID, because
+     * the new master will start its replication stream with SELECT. */
+    server.repl_master_initial_offset = server.master_repl_offset;
+    replicationDiscardCachedMaster();
+
+    /* Create a client, but it will not be used to serve commands: it only
+     * holds the replication state until the next PSYNC. */
+    server.master = createClient(-1);
+    server.master->reploff = server.master_repl_offset;
+    server.master->read_reploff = server.master->reploff;
+    memcpy(server.master->replid, server.replid, sizeof(server.replid));
+    server.master->flags |= REDIS_MASTER;
+    server.master->authenticated = 1;
+
+    /* Use the client as cached master: clients with fd -1 are already
+     * not in the list of clients, see createClient(). */
+    // createClient(-1) 的客户端不在 server.clients 里面，直接缓存就好
+    server.cached_master = server.master;
+    server.master = NULL;
+    redisLog(REDIS_NOTICE,"Before turning into a slave, using my master parameters to synthesize a cached master: I may be able to synchronize with the new master with just a partial transfer.");
+}
+
 /* Free a cached master, called when there are no longer the conditions for
  * a partial resync on reconnection. 
  *
@@ -2248,6 +3156,10 @@ void replicationResurrectCachedMaster(int newfd) {
 
     server.master->authenticated = 1;
     server.master->lastinteraction = server.unixtime;
+    /* The new link may be compressed or not, depending on the handshake. */
+    sdsfree(server.master->repl_zbuf);
+    server.master->repl_zbuf =
+        server.repl_master_compression ? sdsempty() : NULL;
 
     // 回到已连接状态
     server.repl_state = REDIS_REPL_CONNECTED;
@@ -2577,6 +3489,113 @@ void processClientsWaitingReplicas(void) {
     }
 }
 
+/* ---------------------- BOUNDED STALENESS READS -------------------------
+ *
+ * A client can read from a slave with an explicit freshness guarantee:
+ *
+ * - WAITOFFSET <offset> <timeout> blocks until the slave processed the
+ *   master replication stream up to 'offset'. The offset of a write is
+ *   known calling WAITOFFSET 0 0 (or INFO replication) on the master after
+ *   the write, since on a master the command returns master_repl_offset.
+ *
+ * - CLIENT MAXLAG <ms> makes the slave refuse the reads of the client with
+ *   a -LAGGING error while its data is older than 'ms'. The master sends
+ *   REPLCONF TIMESTAMP <mstime> in the replication stream every
+ *   repl-heartbeat-period milliseconds: once the slave processed it, its
+ *   data is at least as fresh as the master was at that time. The lag is
+ *   computed with the clock of the slave, so it assumes the clocks of the
+ *   two hosts are synchronized, and is never smaller than the period.
+ *
+ * 从 slave 读取时的新鲜度保证：等待某个复制偏移量，或者限制数据的最大延迟
+ */
+
+/* Return the offset the reads of this instance reflect: the processed
+ * stream of our master for a slave, our replication offset for a master. */
+long long replicationGetReadOffset(void) {
+    return server.masterhost ? replicationGetSlaveOffset() :
+                               server.master_repl_offset;
+}
+
+/* Return the age in milliseconds of the data of this slave, 0 for a master,
+ * or -1 if it is unknown since no heartbeat was received. */
+long long replicationGetReadLag(void) {
+    long long lag;
+
+    if (server.masterhost == NULL) return 0;
+    if (server.master_timestamp == 0) return -1;
+    lag = mstime()-server.master_timestamp;
+    return lag > 0 ? lag : 0;
+}
+
+/* Called by serverCron() every repl-heartbeat-period milliseconds. Only the
+ * top level master sends the heartbeat: slaves proxy it to sub-slaves, that
+ * so measure their lag from it as well. */
+void replicationSendHeartbeat(void) {
+    robj *argv[3];
+
+    if (server.masterhost != NULL || listLength(server.slaves) == 0) return;
+
+    argv[0] = createStringObject("REPLCONF",8);
+    argv[1] = createStringObject("TIMESTAMP",9);
+    argv[2] = createStringObjectFromLongLong(mstime());
+    replicationFeedSlaves(server.slaves, server.slaveseldb, argv, 3);
+    decrRefCount(argv[0]);
+    decrRefCount(argv[1]);
+    decrRefCount(argv[2]);
+}
+
+/* WAITOFFSET <offset> <timeout>: reply with our read offset once it reached
+ * 'offset', or when the timeout (in milliseconds, 0 to block forever) is
+ * reached. The caller compares the reply with the offset it asked for. */
+void waitoffsetCommand(redisClient *c) {
+    mstime_t timeout;
+    long long offset, myoffset = replicationGetReadOffset();
+
+    if (getLongLongFromObjectOrReply(c,c->argv[1],&offset,NULL) != REDIS_OK)
+        return;
+    if (getTimeoutFromObjectOrReply(c,c->argv[2],&timeout,UNIT_MILLISECONDS)
+        != REDIS_OK) return;
+
+    /* Masters are always up to date with themselves. */
+    if (myoffset >= offset || server.masterhost == NULL ||
+        c->flags & REDIS_MULTI)
+    {
+        addReplyLongLong(c,myoffset);
+        return;
+    }
+
+    c->bpop.timeout = timeout;
+    c->bpop.reploffset = offset;
+    listAddNodeTail(server.clients_waiting_offset,c);
+    blockClient(c,REDIS_BLOCKED_OFFSET);
+}
+
+/* Called by unblockClient() for clients blocked in WAITOFFSET. */
+void unblockClientWaitingOffset(redisClient *c) {
+    listNode *ln = listSearchKey(server.clients_waiting_offset,c);
+    redisAssert(ln != NULL);
+    listDelNode(server.clients_waiting_offset,ln);
+}
+
+/* Unblock the clients in WAITOFFSET for an offset we already processed.
+ * Called in beforeSleep(), after the stream of the master was applied. */
+void processClientsWaitingOffset(void) {
+    long long myoffset = replicationGetReadOffset();
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients_waiting_offset,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = ln->value;
+
+        /* A slave turned into a master is up to date with itself. */
+        if (myoffset >= c->bpop.reploffset || server.masterhost == NULL) {
+            unblockClient(c);
+            addReplyLongLong(c,myoffset);
+        }
+    }
+}
+
 /* Return the slave replication offset for this instance, that is
  * the offset for which we already processed the master replication stream. */
 long long replicationGetSlaveOffset(void) {
@@ -2613,7 +3632,8 @@ void replicationCron(void) {
     // 尝试连接到 master ，但超时
     if (server.masterhost &&
         (server.repl_state == REDIS_REPL_CONNECTING ||
-         server.repl_state == REDIS_REPL_RECEIVE_PONG) &&
+         server.repl_state == REDIS_REPL_RECEIVE_PONG ||
+         server.repl_state == REDIS_REPL_RECEIVE_PSYNC) &&
         (time(NULL)-server.repl_transfer_lastio) > server.repl_timeout)
     {
         redisLog(REDIS_WARNING,"Timeout connecting to the MASTER...");
@@ -2706,8 +3726,10 @@ void replicationCron(void) {
         while((ln = listNext(&li))) {
             redisClient *slave = ln->value;
 
+            // 无盘复制时子进程正在向套接字写入 RDB ，不能插入换行符
             if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START ||
-                slave->replstate == REDIS_REPL_WAIT_BGSAVE_END) {
+                (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END &&
+                 server.rdb_child_type != REDIS_RDB_CHILD_TYPE_SOCKET)) {
                 if (write(slave->fd, "\n", 1) == -1) {
                     /* Don't worry, it's just a ping. */
                 }
@@ -2753,12 +3775,30 @@ void replicationCron(void) {
     /* If we have no attached slaves and there is a replication backlog
      * using memory, free it after some (configured) time. */
     // 在没有任何 slave 的 N 秒之后，释放 backlog
+    // slave 必须一直保留 backlog ，被提升为 master 之后才能接受 PSYNC
     if (listLength(server.slaves) == 0 && server.repl_backlog_time_limit &&
-        server.repl_backlog)
+        server.repl_backlog && server.masterhost == NULL)
     {
         time_t idle = server.unixtime - server.repl_no_slaves_since;
 
         if (idle > server.repl_backlog_time_limit) {
+            /* When we free the backlog, we always use a new
+             * replication ID and clear the ID2. This is needed
+             * because when there is no backlog, the master_repl_offset
+             * is not updated, but we would still retain our replication
+             * ID, leading to the following problem:
+             *
+             * 1. We are a master instance.
+             * 2. Our slave is promoted to master. It's repl-id-2 will
+             *    be the same as our repl-id.
+             * 3. We, yet as master, receive some updates, that will not
+             *    increment the master_repl_offset.
+             * 4. Later we are turned into a slave, connect to the new
+             *    master that will accept our PSYNC request by second
+             *    replication ID, but there will be data inconsistency
+             *    because we received writes. */
+            changeReplicationId();
+            clearReplicationId2();
             // 释放
             freeReplicationBacklog();
             redisLog(REDIS_NOTICE,
@@ -2780,6 +3820,43 @@ void replicationCron(void) {
         replicationScriptCacheFlush();
     }
 
+    /* Start a BGSAVE good for replication if we have slaves in
+     * WAIT_BGSAVE_START state.
+     *
+     * In case of diskless replication, we make sure to wait the specified
+     * number of seconds (according to configuration) so that other slaves
+     * have the time to arrive before we start streaming. */
+    // 无盘复制时，syncCommand() 并不会立即 fork ，而是由这里在等待
+    // repl-diskless-sync-delay 秒之后，为所有等待中的 slave 一次性开始传送
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+        time_t idle, max_idle = 0;
+        int slaves_waiting = 0;
+        int mincapa = -1;
+        listNode *ln;
+        listIter li;
+
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            redisClient *slave = ln->value;
+            if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
+                idle = server.unixtime - slave->lastinteraction;
+                if (idle > max_idle) max_idle = idle;
+                slaves_waiting++;
+                mincapa = (mincapa == -1) ? slave->slave_capa :
+                                            (mincapa & slave->slave_capa);
+            }
+        }
+
+        if (slaves_waiting &&
+            (!server.repl_diskless_sync ||
+             max_idle > server.repl_diskless_sync_delay))
+        {
+            /* Start a BGSAVE. Usually with socket target, or with disk target
+             * if there was a recent socket -> disk config change. */
+            startBgsaveForReplication(mincapa);
+        }
+    }
+
     /* Refresh the number of slaves with lag <= min-slaves-max-lag. */
     // 更新符合给定延迟值的 slave 的数量
     refreshGoodSlavesCount();
@@ -67,6 +67,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
 #include "rio.h"
 #include "util.h"
 #include "crc64.h"
@@ -117,6 +118,16 @@ static off_t rioBufferTell(rio *r) {
     return r->io.buffer.pos;
 }
 
+/* Flushes any buffer to target device if applicable. Returns 1 on success
+ * and 0 on failures.
+ *
+ * 内存流没有需要冲洗的内容，总是返回成功
+ */
+static int rioBufferFlush(rio *r) {
+    REDIS_NOTUSED(r);
+    return 1; /* Nothing to do, our write just appends to the buffer. */
+}
+
 /* Returns 1 or 0 for success/failure. 
  *
  * 将长度为 len 的内容 buf 写入到文件 r 中。
@@ -159,6 +170,12 @@ static off_t rioFileTell(rio *r) {
     return ftello(r->io.file.fp);
 }
 
+/* Flushes any buffer to target device if applicable. Returns 1 on success
+ * and 0 on failures. */
+static int rioFileFlush(rio *r) {
+    return (fflush(r->io.file.fp) == 0) ? 1 : 0;
+}
+
 /*
  * 流为内存时所使用的结构
  */
@@ -169,6 +186,7 @@ static const rio rioBufferIO = {
     rioBufferWrite,
     // 偏移量函数
     rioBufferTell,
+    rioBufferFlush,
     NULL,           /* update_checksum */
     0,              /* current checksum */
     0,              /* bytes read or written */
@@ -186,6 +204,7 @@ static const rio rioFileIO = {
     rioFileWrite,
     // 偏移量函数
     rioFileTell,
+    rioFileFlush,
     NULL,           /* update_checksum */
     0,              /* current checksum */
     0,              /* bytes had been read or written */
@@ -212,6 +231,269 @@ void rioInitWithBuffer(rio *r, sds s) {
     r->io.buffer.pos = 0;
 }
 
+/* --------------------- File descriptors set implementation ------------------- */
+
+/* Returns 1 or 0 for success/failure.
+ * The function returns success as long as we are able to correctly write
+ * to at least one file descriptor.
+ *
+ * When buf is NULL and len is 0, the function performs a flush operation
+ * if there is some pending buffer, so this function is also used in order
+ * to implement rioFdsetFlush().
+ *
+ * 将 buf 写入到 fdset 中的每个 fd ，
+ * 只要还有一个 fd 可以正常写入，就视为成功。
+ * 出错的 fd 会在 state 数组中记录对应的 errno ，之后不再写入。
+ */
+static size_t rioFdsetWrite(rio *r, const void *buf, size_t len) {
+    ssize_t retval;
+    int j;
+    unsigned char *p = (unsigned char*) buf;
+    int doflush = (buf == NULL && len == 0);
+
+    /* To start we always append to our buffer. If it gets larger than
+     * a given size, we actually write to the sockets. */
+    if (len) {
+        r->io.fdset.buf = sdscatlen(r->io.fdset.buf,buf,len);
+        len = 0; /* Prevent entering the while below if we don't flush. */
+        if (sdslen(r->io.fdset.buf) > REDIS_IOBUF_LEN) doflush = 1;
+    }
+
+    if (doflush) {
+        p = (unsigned char*) r->io.fdset.buf;
+        len = sdslen(r->io.fdset.buf);
+    }
+
+    /* Write in little chunks so that when there are big writes we
+     * parallelize while the kernel is sending data in background to
+     * the TCP socket. */
+    while(len) {
+        size_t count = len < 1024 ? len : 1024;
+        int broken = 0;
+        for (j = 0; j < r->io.fdset.numfds; j++) {
+            if (r->io.fdset.state[j] != 0) {
+                /* Skip FDs already in error. */
+                broken++;
+                continue;
+            }
+
+            /* Make sure to write 'count' bytes to the socket regardless
+             * of short writes. */
+            size_t nwritten = 0;
+            while(nwritten != count) {
+                retval = write(r->io.fdset.fds[j],p+nwritten,count-nwritten);
+                if (retval <= 0) {
+                    /* With blocking sockets, which is the sole user of this
+                     * rio target, EWOULDBLOCK is returned only because of
+                     * the SO_SNDTIMEO socket option, so we translate the error
+                     * into one more recognizable by the user. */
+                    if (retval == -1 && errno == EWOULDBLOCK) errno = ETIMEDOUT;
+                    break;
+                }
+                nwritten += retval;
+            }
+
+            if (nwritten != count) {
+                /* Mark this FD as broken. */
+                r->io.fdset.state[j] = errno;
+                if (r->io.fdset.state[j] == 0) r->io.fdset.state[j] = EIO;
+            }
+        }
+        if (broken == r->io.fdset.numfds) return 0; /* All the FDs in error. */
+        p += count;
+        len -= count;
+        r->io.fdset.pos += count;
+    }
+
+    if (doflush) sdsclear(r->io.fdset.buf);
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure.
+ *
+ * fdset 只用于写出，读取总是失败 */
+static size_t rioFdsetRead(rio *r, void *buf, size_t len) {
+    REDIS_NOTUSED(r);
+    REDIS_NOTUSED(buf);
+    REDIS_NOTUSED(len);
+    return 0; /* Error, this target does not support reading. */
+}
+
+/* Returns read/write position in file. */
+static off_t rioFdsetTell(rio *r) {
+    return r->io.fdset.pos;
+}
+
+/* Flushes any buffer to target device if applicable. Returns 1 on success
+ * and 0 on failures. */
+static int rioFdsetFlush(rio *r) {
+    /* Our flush is implemented by the write method, that recognizes a
+     * buffer set to NULL with a count of zero as a flush request. */
+    return rioFdsetWrite(r,NULL,0);
+}
+
+/*
+ * 流为多个文件描述符（ slave 的套接字）时所使用的结构
+ */
+static const rio rioFdsetIO = {
+    rioFdsetRead,
+    rioFdsetWrite,
+    rioFdsetTell,
+    rioFdsetFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/*
+ * 初始化 fdset 流，写入的数据会被发送到 fds 中的每一个 fd
+ */
+void rioInitWithFdset(rio *r, int *fds, int numfds) {
+    int j;
+
+    *r = rioFdsetIO;
+    r->io.fdset.fds = zmalloc(sizeof(int)*numfds);
+    r->io.fdset.state = zmalloc(sizeof(int)*numfds);
+    memcpy(r->io.fdset.fds,fds,sizeof(int)*numfds);
+    for (j = 0; j < numfds; j++) r->io.fdset.state[j] = 0;
+    r->io.fdset.numfds = numfds;
+    r->io.fdset.pos = 0;
+    r->io.fdset.buf = sdsempty();
+}
+
+/*
+ * 释放 fdset 流所使用的资源（不会关闭其中的 fd ）
+ */
+void rioFreeFdset(rio *r) {
+    zfree(r->io.fdset.fds);
+    zfree(r->io.fdset.state);
+    sdsfree(r->io.fdset.buf);
+}
+
+/* ------------------- File descriptor implementation ------------------- */
+
+/* Returns 1 or 0 for success/failure.
+ *
+ * Data is read from the fd in chunks of up to REDIS_IOBUF_LEN bytes, but
+ * never past read_limit (when set), so that the bytes following the
+ * payload are left in the socket for the next reader.
+ *
+ * 从 fd 中读取 len 字节，fd 应该是阻塞的，
+ * 并通过 SO_RCVTIMEO 设置了读超时。
+ */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    char *p = buf;
+
+    while(len) {
+        size_t avail = sdslen(r->io.fd.buf) - r->io.fd.bufpos;
+
+        /* Refill the buffer once everything it holds was consumed. */
+        if (avail == 0) {
+            size_t toread = REDIS_IOBUF_LEN;
+            ssize_t nread;
+
+            if (r->io.fd.read_limit) {
+                if (r->io.fd.read_so_far == r->io.fd.read_limit) {
+                    errno = EOVERFLOW;
+                    return 0; /* Trying to read past the limit. */
+                }
+                if (r->io.fd.read_limit - r->io.fd.read_so_far < toread)
+                    toread = r->io.fd.read_limit - r->io.fd.read_so_far;
+            }
+
+            sdsclear(r->io.fd.buf);
+            r->io.fd.bufpos = 0;
+            /* On compressed links a frame at a time is decoded, since the
+             * socket is blocking and the next frame may never arrive. */
+            if (r->io.fd.zbuf) {
+                nread = replReadFrames(r->io.fd.fd,&r->io.fd.zbuf,
+                                       &r->io.fd.buf,1);
+            } else {
+                nread = read(r->io.fd.fd,r->io.fd.buf,toread);
+                if (nread > 0) sdsIncrLen(r->io.fd.buf,nread);
+            }
+            if (nread <= 0) {
+                /* The socket is blocking, EWOULDBLOCK means the SO_RCVTIMEO
+                 * timeout elapsed, see rioFdsetWrite(). */
+                if (nread == -1 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                    errno = ETIMEDOUT;
+                if (nread == 0) errno = ECONNRESET;
+                return 0;
+            }
+            r->io.fd.read_so_far += nread;
+            avail = nread;
+        }
+
+        if (avail > len) avail = len;
+        memcpy(p,r->io.fd.buf+r->io.fd.bufpos,avail);
+        r->io.fd.bufpos += avail;
+        r->io.fd.pos += avail;
+        p += avail;
+        len -= avail;
+    }
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure.
+ *
+ * fd 只用于读取，写入总是失败 */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    REDIS_NOTUSED(r);
+    REDIS_NOTUSED(buf);
+    REDIS_NOTUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns read position in the stream. */
+static off_t rioFdTell(rio *r) {
+    return r->io.fd.pos;
+}
+
+/* Nothing is ever buffered for writing. */
+static int rioFdFlush(rio *r) {
+    REDIS_NOTUSED(r);
+    return 1;
+}
+
+/*
+ * 流为单个文件描述符（ master 的套接字）时所使用的结构
+ */
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/*
+ * 初始化 fd 流，最多从 fd 读取 read_limit 字节（ 0 表示不限制）
+ */
+void rioInitWithFd(rio *r, int fd, size_t read_limit) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.pos = 0;
+    r->io.fd.buf = sdsMakeRoomFor(sdsempty(),REDIS_IOBUF_LEN);
+    r->io.fd.bufpos = 0;
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.read_so_far = 0;
+    r->io.fd.zbuf = NULL;
+}
+
+/*
+ * 释放 fd 流所使用的资源（不会关闭 fd ）
+ */
+void rioFreeFd(rio *r) {
+    sdsfree(r->io.fd.buf);
+    sdsfree(r->io.fd.zbuf);
+}
+
 /* This function can be installed both in memory and file streams when checksum
  * computation is needed. */
 /*
@@ -48,6 +48,7 @@ struct _rio {
     size_t (*read)(struct _rio *, void *buf, size_t len);
     size_t (*write)(struct _rio *, const void *buf, size_t len);
     off_t (*tell)(struct _rio *);
+    int (*flush)(struct _rio *);
 
     /* The update_cksum method if not NULL is used to compute the checksum of
      * all the data that was read or written so far. The method should be
@@ -85,6 +86,26 @@ struct _rio {
             // 写入多少字节之后，才会自动执行一次 fsync()
             off_t autosync; /* fsync after 'autosync' bytes written. */
         } file;
+
+        /* Multiple FDs target (used to write to N sockets). */
+        struct {    // fdset 专用
+            int *fds;       /* File descriptors. */
+            int *state;     /* Error state of each fd. 0 (if ok) or errno. */
+            int numfds;
+            off_t pos;
+            sds buf;
+        } fdset;
+
+        /* Single FD target (used to read the RDB from the master socket). */
+        struct {    // fd 专用
+            int fd;             /* File descriptor. */
+            off_t pos;          /* Bytes consumed by the reader. */
+            sds buf;            /* Bytes read from the fd, not yet consumed. */
+            size_t bufpos;      /* Position of the next byte to consume. */
+            size_t read_limit;  /* Don't read more than this, 0 = no limit. */
+            size_t read_so_far; /* Bytes read from the fd so far. */
+            sds zbuf;           /* Frame being received if compressed. */
+        } fd;
     } io;
 };
 
@@ -137,8 +158,19 @@ static inline off_t rioTell(rio *r) {
     return r->tell(r);
 }
 
+/*
+ * 冲洗流中尚未写出的数据，成功返回 1 ，失败返回 0 。
+ */
+static inline int rioFlush(rio *r) {
+    return r->flush(r);
+}
+
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
+void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioFreeFdset(rio *r);
+void rioInitWithFd(rio *r, int fd, size_t read_limit);
+void rioFreeFd(rio *r);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
@@ -37,137 +37,256 @@
 #include <ctype.h>
 #include <math.h>
 
-char *redisProtocolToLuaType_Int(lua_State *lua, char *reply);
-char *redisProtocolToLuaType_Bulk(lua_State *lua, char *reply);
-char *redisProtocolToLuaType_Status(lua_State *lua, char *reply);
-char *redisProtocolToLuaType_Error(lua_State *lua, char *reply);
-char *redisProtocolToLuaType_MultiBulk(lua_State *lua, char *reply);
 int redis_math_random (lua_State *L);
 int redis_math_randomseed (lua_State *L);
 void sha1hex(char *digest, char *script, size_t len);
+int luaCreateFunction(redisClient *c, lua_State *lua, char *funcname, robj *body);
 
-/* Take a Redis reply in the Redis protocol format and convert it into a
- * Lua type. Thanks to this function, and the introduction of not connected
- * clients, it is trivial to implement the redis() lua function.
- *
- * 接收一个 Redis 协议格式的 Redis 回复，并将它转换为 Lua 类型的值。
- *
- * Basically we take the arguments, execute the Redis command in the context
- * of a non connected client, then take the generated reply and convert it
- * into a suitable Lua type. With this trick the scripting feature does not
- * need the introduction of a full Redis internals API. Basically the script
- * is like a normal client that bypasses all the slow I/O paths.
- *
- * 一般来说，程序接收参数，在无网络连接的伪终端中执行 Redis 命令，
- * 然后将所得的回复转换为恰当的 Lua 类型。
+/* ---------------------------------------------------------------------------
+ * Lua reply sink
  *
- * 这样脚本功能就不用为所有 Redis 命令都实现相应的 API 了。
+ * Commands called by redis.call() run in the context of a non connected
+ * client, so that the scripting feature does not need a full Redis internals
+ * API: basically the script is like a normal client that bypasses all the
+ * slow I/O paths.
  *
- * 基本上脚本就是一个没有 I/O 操作的普通客户端。
+ * 脚本通过无网络连接的伪客户端执行 Redis 命令。
  *
- * Note: in this function we do not do any sanity check as the reply is
- * generated by Redis directly. This allows us to go faster.
+ * While the command runs its reply is not serialized in the client output
+ * buffers and parsed again once the command returns: the addReply*()
+ * functions of networking.c redirect the reply of the Lua client to the
+ * functions below, that push it directly on the Lua stack as the proper
+ * Lua type:
  *
- * 函数没有对回复的正确性进行检查，因为所有回复都直接来自于 Redis 命令的结果。
- * 这使得这个函数的可以更快速地执行。
+ * 命令执行期间，伪客户端的回复不会先写入输出缓冲区再解析成 Lua 值，
+ * 而是由 networking.c 中的 addReply*() 函数直接转发到这里，推入 Lua 栈：
  *
- * The reply string can be altered during the parsing as it is discarded
- * after the conversion is completed.
+ *  integer reply   -> number
+ *  bulk reply      -> string
+ *  status reply    -> table with a single 'ok' field
+ *  error reply     -> table with a single 'err' field
+ *  multi bulk      -> array (table), filled as the elements are added
+ *  null reply      -> false
  *
- * 回复的内容在分析（Parsing）的过程中可能会被修改，
- * 并且在分析完毕之后，它会被清除。
+ * Scalars and aggregate headers emitted by the typed helpers (addReplyBulk(),
+ * addReplyLongLong(), addReplyMultiBulkLen(), ...) are converted without any
+ * formatting. Commands that emit raw protocol (shared objects like
+ * shared.ok, or headers and bodies written with addReplyString()) go through
+ * luaReplySinkRaw(), that parses the protocol incrementally, buffering only
+ * the bytes of a value that is not yet complete.
  *
- * Errors are returned as a table with a single 'err' field set to the
- * error string.
+ * 直接输出协议文本的命令（比如 shared.ok ）则由 luaReplySinkRaw() 增量解析，
+ * 只有尚未完整的值才会被缓存。
  *
- * 错误返回为一个带有 err 域的表，域的值为出错的字符串内容。
- */
+ * Note: no sanity check is performed on the protocol as the reply is
+ * generated by Redis directly.
+ * ------------------------------------------------------------------------- */
 
-char *redisProtocolToLuaType(lua_State *lua, char* reply) {
-    char *p = reply;
+/* An aggregate still being filled: the table is on the Lua stack. */
+typedef struct luaReplyLevel {
+    long len;   /* Number of elements, or -1 if the length is deferred. */
+    long added; /* Elements already stored in the table. */
+} luaReplyLevel;
+
+static struct {
+    luaReplyLevel *levels;  /* Open aggregates, innermost last. */
+    int depth;              /* Number of open aggregates. */
+    int size;               /* Allocated levels. */
+    int values;             /* Top level values pushed on the stack. */
+    char type;              /* RESP type of the top level value. */
+    sds pending;            /* Raw protocol of an incomplete value. */
+} luaSink;
+
+/* Start collecting the reply of a command called from Lua. */
+static void luaReplySinkStart(void) {
+    if (luaSink.pending == NULL) luaSink.pending = sdsempty();
+    luaSink.depth = 0;
+    luaSink.values = 0;
+    luaSink.type = '\0';
+    server.lua_reply_sink = 1;
+}
 
-    switch(*p) {
-    case ':':
-        p = redisProtocolToLuaType_Int(lua,reply);
-        break;
-    case '$':
-        p = redisProtocolToLuaType_Bulk(lua,reply);
-        break;
-    case '+':
-        p = redisProtocolToLuaType_Status(lua,reply);
-        break;
-    case '-':
-        p = redisProtocolToLuaType_Error(lua,reply);
-        break;
-    case '*':
-        p = redisProtocolToLuaType_MultiBulk(lua,reply);
-        break;
+/* Stop collecting: exactly one complete value must be on the stack. A
+ * command that did not reply at all is seen by the script as false. */
+static void luaReplySinkStop(void) {
+    server.lua_reply_sink = 0;
+    redisAssert(luaSink.depth == 0 && luaSink.values <= 1 &&
+                sdslen(luaSink.pending) == 0);
+    if (luaSink.values == 0) luaReplySinkNull();
+}
+
+/* A value of RESP type 'type' was pushed on the Lua stack: store it into
+ * the innermost open aggregate, closing the aggregates that are now
+ * complete, that in turn become values of their parent. */
+// 刚推入栈顶的值放进最内层的 table ，table 填满之后自身又成为外层的一个元素
+static void luaReplySinkValueAdded(char type) {
+    lua_State *lua = server.lua;
+
+    while(1) {
+        luaReplyLevel *l;
+
+        if (luaSink.depth == 0) {
+            if (luaSink.values++ == 0) luaSink.type = type;
+            return;
+        }
+        l = luaSink.levels+luaSink.depth-1;
+        lua_rawseti(lua,-2,++l->added);
+        if (l->len == -1 || l->added < l->len) return;
+        luaSink.depth--;
+        type = '*';
     }
+}
 
-    return p;
+void luaReplySinkString(const char *p, size_t len) {
+    lua_pushlstring(server.lua,p,len);
+    luaReplySinkValueAdded('$');
 }
 
-char *redisProtocolToLuaType_Int(lua_State *lua, char *reply) {
-    char *p = strchr(reply+1,'\r');
-    long long value;
+void luaReplySinkInteger(long long ll) {
+    lua_pushnumber(server.lua,(lua_Number)ll);
+    luaReplySinkValueAdded(':');
+}
 
-    string2ll(reply+1,p-reply-1,&value);
-    lua_pushnumber(lua,(lua_Number)value);
-    return p+2;
+void luaReplySinkNull(void) {
+    lua_pushboolean(server.lua,0);
+    luaReplySinkValueAdded('$');
 }
 
-char *redisProtocolToLuaType_Bulk(lua_State *lua, char *reply) {
-    char *p = strchr(reply+1,'\r');
-    long long bulklen;
+/* Status and error replies, as tables with an 'ok' or 'err' field. */
+static void luaReplySinkField(char *field, const char *p, size_t len,
+                              char type)
+{
+    lua_State *lua = server.lua;
 
-    string2ll(reply+1,p-reply-1,&bulklen);
-    if (bulklen == -1) {
-        lua_pushboolean(lua,0);
-        return p+2;
+    lua_newtable(lua);
+    lua_pushstring(lua,field);
+    lua_pushlstring(lua,p,len);
+    lua_settable(lua,-3);
+    luaReplySinkValueAdded(type);
+}
+
+void luaReplySinkStatus(const char *p, size_t len) {
+    luaReplySinkField("ok",p,len,'+');
+}
+
+void luaReplySinkError(const char *p, size_t len) {
+    luaReplySinkField("err",p,len,'-');
+}
+
+/* Open an aggregate of 'len' elements, or -1 for the length to be set
+ * later with luaReplySinkSetDeferredAggregate(). */
+static void luaReplySinkOpen(long len) {
+    lua_State *lua = server.lua;
+    luaReplyLevel *l;
+
+    lua_checkstack(lua,LUA_MINSTACK);
+    lua_newtable(lua);
+    if (len == 0) {
+        luaReplySinkValueAdded('*');
+        return;
+    }
+    if (luaSink.depth == luaSink.size) {
+        luaSink.size = luaSink.size ? luaSink.size*2 : 8;
+        luaSink.levels = zrealloc(luaSink.levels,
+                                  sizeof(luaReplyLevel)*luaSink.size);
+    }
+    l = luaSink.levels+luaSink.depth++;
+    l->len = len;
+    l->added = 0;
+}
+
+void luaReplySinkAggregate(long len) {
+    if (len < 0) {
+        /* Null multi bulk. */
+        lua_pushboolean(server.lua,0);
+        luaReplySinkValueAdded('$');
     } else {
-        lua_pushlstring(lua,p+2,bulklen);
-        return p+2+bulklen+2;
+        luaReplySinkOpen(len);
     }
 }
 
-char *redisProtocolToLuaType_Status(lua_State *lua, char *reply) {
-    char *p = strchr(reply+1,'\r');
+/* The returned handle is the depth of the aggregate, so it is never NULL
+ * and it is not invalidated when the levels array is reallocated. */
+void *luaReplySinkDeferredAggregate(void) {
+    luaReplySinkOpen(-1);
+    return (void*)(long)luaSink.depth;
+}
+
+void luaReplySinkSetDeferredAggregate(void *node, long len) {
+    luaReplyLevel *l = luaSink.levels+luaSink.depth-1;
 
-    lua_newtable(lua);
-    lua_pushstring(lua,"ok");
-    lua_pushlstring(lua,reply+1,p-reply-1);
-    lua_settable(lua,-3);
-    return p+2;
+    /* The elements were already stored: the deferred aggregate must be the
+     * innermost one, and it is complete now. */
+    redisAssert((long)node == luaSink.depth && l->added == len);
+    luaSink.depth--;
+    luaReplySinkValueAdded('*');
 }
 
-char *redisProtocolToLuaType_Error(lua_State *lua, char *reply) {
-    char *p = strchr(reply+1,'\r');
+/* Convert the first complete value (or aggregate header) at 'p' into the
+ * Lua type. Returns the number of bytes consumed, or 0 if more protocol is
+ * needed. */
+static size_t luaReplySinkParse(const char *p, size_t len) {
+    const char *nl;
+    size_t hdrlen;
+    long long ll;
 
-    lua_newtable(lua);
-    lua_pushstring(lua,"err");
-    lua_pushlstring(lua,reply+1,p-reply-1);
-    lua_settable(lua,-3);
-    return p+2;
+    if (len == 0) return 0;
+    nl = memchr(p,'\r',len);
+    if (nl == NULL || nl+1 == p+len) return 0;
+    hdrlen = nl-p+2;
+
+    switch(*p) {
+    case '+':
+        luaReplySinkStatus(p+1,nl-p-1);
+        return hdrlen;
+    case '-':
+        luaReplySinkError(p+1,nl-p-1);
+        return hdrlen;
+    case ':':
+        string2ll(p+1,nl-p-1,&ll);
+        luaReplySinkInteger(ll);
+        return hdrlen;
+    case '$':
+        string2ll(p+1,nl-p-1,&ll);
+        if (ll == -1) {
+            luaReplySinkNull();
+            return hdrlen;
+        }
+        if (len < hdrlen+ll+2) return 0;
+        luaReplySinkString(p+hdrlen,ll);
+        return hdrlen+ll+2;
+    case '*':
+        string2ll(p+1,nl-p-1,&ll);
+        luaReplySinkAggregate(ll);
+        return hdrlen;
+    default:
+        redisPanic("Unknown RESP type in the reply of a command called from Lua");
+    }
+    return 0; /* Not reached. */
 }
 
-char *redisProtocolToLuaType_MultiBulk(lua_State *lua, char *reply) {
-    char *p = strchr(reply+1,'\r');
-    long long mbulklen;
-    int j = 0;
+/* Feed raw protocol emitted by the command. It may contain any number of
+ * values, and start or end in the middle of one. */
+void luaReplySinkRaw(const char *p, size_t len) {
+    size_t consumed = 0, n;
+    int buffered = sdslen(luaSink.pending) != 0;
 
-    string2ll(reply+1,p-reply-1,&mbulklen);
-    p += 2;
-    if (mbulklen == -1) {
-        lua_pushboolean(lua,0);
-        return p;
+    if (buffered) {
+        luaSink.pending = sdscatlen(luaSink.pending,p,len);
+        p = luaSink.pending;
+        len = sdslen(luaSink.pending);
     }
-    lua_newtable(lua);
-    for (j = 0; j < mbulklen; j++) {
-        lua_pushnumber(lua,j+1);
-        p = redisProtocolToLuaType(lua,p);
-        lua_settable(lua,-3);
+    while((n = luaReplySinkParse(p+consumed,len-consumed)) != 0)
+        consumed += n;
+
+    if (buffered) {
+        if (consumed == len)
+            sdsclear(luaSink.pending);
+        else
+            sdsrange(luaSink.pending,consumed,-1);
+    } else if (consumed != len) {
+        luaSink.pending = sdscatlen(luaSink.pending,p+consumed,len-consumed);
     }
-    return p;
 }
 
 void luaPushError(lua_State *lua, char *error) {
@@ -236,7 +355,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
     int j, argc = lua_gettop(lua);
     struct redisCommand *cmd;
     redisClient *c = server.lua_client;
-    sds reply;
+    int call_flags;
 
     /* Cached across calls. */
     static robj **argv = NULL;
@@ -254,9 +373,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     /* Build the arguments vector */
     // 构建参数数组
-    if (!argv) {
-        argv = zmalloc(sizeof(robj*)*argc);
-    } else if (argv_size < argc) {
+    if (argv_size < argc) {
         argv = zrealloc(argv,sizeof(robj*)*argc);
         argv_size = argc;
     }
@@ -270,14 +387,12 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
         /* Try to use a cached object. */
         if (cached_objects[j] && cached_objects_len[j] >= obj_len) {
-            char *s = cached_objects[j]->ptr;
-            struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
+            sds s = cached_objects[j]->ptr;
 
             argv[j] = cached_objects[j];
             cached_objects[j] = NULL;
             memcpy(s,obj_s,obj_len+1);
-            sh->free += sh->len - obj_len;
-            sh->len = obj_len;
+            sdssetlen(s, obj_len);
         } else {
             argv[j] = createStringObject(obj_s, obj_len);
         }
@@ -337,7 +452,8 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
     if (cmd->flags & REDIS_CMD_WRITE) {
 
         // 不能在已经执行过随机命令之后执行
-        if (server.lua_random_dirty) {
+        // 以写命令的形式传播脚本时，随机命令不会影响 slave 和 AOF 的一致性
+        if (server.lua_random_dirty && !server.lua_replicate_commands) {
             luaPushError(lua,
                 "Write commands not allowed after non deterministic commands");
             goto cleanup;
@@ -384,57 +500,55 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
     // 如果将要执行的是写操作，那么设置 lua_write_dirty 状态
     if (cmd->flags & REDIS_CMD_WRITE) server.lua_write_dirty = 1;
 
+    /* If we are using single commands replication, we need to wrap what
+     * we propagate into a MULTI/EXEC block, so that it will be atomic like
+     * a Lua script in the context of AOF and slaves. If the caller is in
+     * a transaction, EXEC already wraps the whole transaction. */
+    if (server.lua_replicate_commands &&
+        !server.lua_multi_emitted &&
+        !(server.lua_caller->flags & REDIS_MULTI) &&
+        server.lua_write_dirty &&
+        server.lua_repl != REDIS_PROPAGATE_NONE)
+    {
+        execCommandPropagateMulti(server.lua_caller);
+        server.lua_multi_emitted = 1;
+    }
+
     /* Run the command */
     // 执行命令
+    // 以写命令的形式传播脚本时，由命令自己传播到 AOF 和 slave
     c->cmd = cmd;
-    call(c,REDIS_CALL_SLOWLOG | REDIS_CALL_STATS);
-
-    /* Convert the result of the Redis command into a suitable Lua type.
-     *
-     * 将 Redis 命令的结果转换为适当的 Lua 类型。
-     *
-     * The first thing we need is to create a single string from the client
-     * output buffers. 
-     *
-     * 首先要做的就是为客户端输出缓存中创建一个字符串
-     */
-    if (listLength(c->reply) == 0 && c->bufpos < REDIS_REPLY_CHUNK_BYTES) {
-        /* This is a fast path for the common case of a reply inside the
-         * client static buffer. Don't create an SDS string but just use
-         * the client buffer directly. */
-        c->buf[c->bufpos] = '\0';
-        reply = c->buf;
-        c->bufpos = 0;
-    } else {
-        reply = sdsnewlen(c->buf,c->bufpos);
-        c->bufpos = 0;
-        while(listLength(c->reply)) {
-            robj *o = listNodeValue(listFirst(c->reply));
-            reply = sdscatlen(reply,o->ptr,sdslen(o->ptr));
-            listDelNode(c->reply,listFirst(c->reply));
-        }
+    call_flags = REDIS_CALL_SLOWLOG | REDIS_CALL_STATS;
+    if (server.lua_replicate_commands) {
+        /* Set flags according to redis.set_repl() settings. */
+        if (server.lua_repl & REDIS_PROPAGATE_AOF)
+            call_flags |= REDIS_CALL_PROPAGATE_AOF;
+        if (server.lua_repl & REDIS_PROPAGATE_REPL)
+            call_flags |= REDIS_CALL_PROPAGATE_REPL;
     }
+    /* The reply is pushed on the Lua stack while the command runs, see the
+     * Lua reply sink at the top of this file. */
+    // 命令的回复直接转换为 Lua 值，推入 Lua 栈
+    luaReplySinkStart();
+    call(c,call_flags);
+    luaReplySinkStop();
 
     // 检测执行的命令是否出错
-    if (raise_error && reply[0] != '-') raise_error = 0;
-
-    // 将回复转换为 Lua 值，并将这些值推入 Lua 环境
-    redisProtocolToLuaType(lua,reply);
+    if (raise_error && luaSink.type != '-') raise_error = 0;
 
     /* Sort the output array if needed, assuming it is a non-null multi bulk
      * reply as expected. 
      *
      * 如果输出是一个 multi bulk reply ，并且它不是一个 null multi bulk reply ，
      * 那么对它进行排序
-     * (null multi bulk reply 的前缀为 *-1\r\n ，具体请参考协议文档）
      */
     if ((cmd->flags & REDIS_CMD_SORT_FOR_SCRIPT) &&
-        (reply[0] == '*' && reply[1] != '-')) {
+        (server.lua_replicate_commands == 0) &&
+        (luaSink.type == '*')) {
             // 排序
             luaSortArray(lua);
     }
 
-    if (reply != c->buf) sdsfree(reply);
     c->reply_bytes = 0;
 
 cleanup:
@@ -452,11 +566,11 @@ cleanup:
              o->encoding == REDIS_ENCODING_EMBSTR) &&
             sdslen(o->ptr) <= LUA_CMD_OBJCACHE_MAX_LEN)
         {
-            struct sdshdr *sh = (void*)(((char*)(o->ptr))-(sizeof(struct sdshdr)));
+            sds s = o->ptr;
 
             if (cached_objects[j]) decrRefCount(cached_objects[j]);
             cached_objects[j] = o;
-            cached_objects_len[j] = sh->free + sh->len;
+            cached_objects_len[j] = sdsalloc(s);
         } else {
             decrRefCount(o);
         }
@@ -465,6 +579,7 @@ cleanup:
     if (c->argv != argv) {
         zfree(c->argv);
         argv = NULL;
+        argv_size = 0;
     }
 
     // 返回错误
@@ -535,6 +650,58 @@ int luaRedisStatusReplyCommand(lua_State *lua) {
     return luaRedisReturnSingleFieldTable(lua,"ok");
 }
 
+/* redis.replicate_commands()
+ *
+ * Turn on single commands replication if the script never called
+ * a write command so far, and returns true. Otherwise if the script
+ * already started to write, returns false and stick to whole scripts
+ * replication, which is our default. */
+int luaRedisReplicateCommandsCommand(lua_State *lua) {
+    if (server.lua_write_dirty) {
+        lua_pushboolean(lua,0);
+    } else {
+        server.lua_replicate_commands = 1;
+        /* When we switch to single commands replication, we can provide
+         * different math.random() sequences at every call, which is what
+         * the user normally expects. */
+        redisSrand48(rand());
+        lua_pushboolean(lua,1);
+    }
+    return 1;
+}
+
+/* redis.set_repl()
+ *
+ * Set the propagation of write commands executed in the context of the
+ * script to on/off for AOF and slaves. Only possible with single commands
+ * replication turned on.
+ *
+ * redis.set_repl(redis.REPL_ALL) -- The default.
+ * redis.set_repl(redis.REPL_NONE) -- No replication at all.
+ * redis.set_repl(redis.REPL_AOF) -- Just AOF replication.
+ * redis.set_repl(redis.REPL_SLAVE) -- Just slaves replication.
+ */
+int luaRedisSetReplCommand(lua_State *lua) {
+    int argc = lua_gettop(lua);
+    int flags;
+
+    if (server.lua_replicate_commands == 0) {
+        lua_pushstring(lua, "You can set the replication behavior only after turning on single commands replication with redis.replicate_commands().");
+        return lua_error(lua);
+    } else if (argc != 1) {
+        lua_pushstring(lua, "redis.set_repl() requires one argument.");
+        return lua_error(lua);
+    }
+
+    flags = lua_tonumber(lua,-1);
+    if ((flags & ~(REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL)) != 0) {
+        lua_pushstring(lua, "Invalid replication flags. Use REPL_AOF, REPL_SLAVE, REPL_ALL or REPL_NONE.");
+        return lua_error(lua);
+    }
+    server.lua_repl = flags;
+    return 0;
+}
+
 int luaLogCommand(lua_State *lua) {
     int j, argc = lua_gettop(lua);
     int level;
@@ -799,6 +966,32 @@ void scriptingInit(void) {
     lua_pushcfunction(lua, luaRedisStatusReplyCommand);
     lua_settable(lua, -3);
 
+    /* redis.replicate_commands(), redis.set_repl() and the replication
+     * flags. */
+    lua_pushstring(lua,"replicate_commands");
+    lua_pushcfunction(lua,luaRedisReplicateCommandsCommand);
+    lua_settable(lua,-3);
+
+    lua_pushstring(lua,"set_repl");
+    lua_pushcfunction(lua,luaRedisSetReplCommand);
+    lua_settable(lua,-3);
+
+    lua_pushstring(lua,"REPL_NONE");
+    lua_pushnumber(lua,REDIS_PROPAGATE_NONE);
+    lua_settable(lua,-3);
+
+    lua_pushstring(lua,"REPL_AOF");
+    lua_pushnumber(lua,REDIS_PROPAGATE_AOF);
+    lua_settable(lua,-3);
+
+    lua_pushstring(lua,"REPL_SLAVE");
+    lua_pushnumber(lua,REDIS_PROPAGATE_REPL);
+    lua_settable(lua,-3);
+
+    lua_pushstring(lua,"REPL_ALL");
+    lua_pushnumber(lua,REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    lua_settable(lua,-3);
+
     /* Finally set the table as 'redis' global var. */
     // 将 table 设置为 redis 全局变量
     lua_setglobal(lua,"redis");
@@ -883,6 +1076,29 @@ void scriptingInit(void) {
      */
     scriptingEnableGlobalsProtection(lua);
 
+    /* Named functions survive SCRIPT FLUSH: when the environment is reset
+     * their Lua functions are defined again in the new interpreter.
+     *
+     * 函数不会被 SCRIPT FLUSH 删除，重置 Lua 环境时重新定义它们 */
+    if (server.lua_functions == NULL) {
+        server.lua_functions = dictCreate(&functionsDictType,NULL);
+    } else {
+        dictIterator *di = dictGetIterator(server.lua_functions);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            luaFunction *fn = dictGetVal(de);
+            sds sha = sdsnewlen(fn->funcname+2,40);
+
+            if (dictFind(server.lua_scripts,sha) == NULL) {
+                int retval = luaCreateFunction(NULL,lua,fn->funcname,fn->body);
+                redisAssert(retval == REDIS_OK);
+            }
+            sdsfree(sha);
+        }
+        dictReleaseIterator(di);
+    }
+
     // 将 Lua 环境赋值到服务器属性中
     server.lua = lua;
 }
@@ -961,7 +1177,7 @@ void luaReplyToRedisReply(redisClient *c, lua_State *lua) {
         addReplyBulkCBuffer(c,(char*)lua_tostring(lua,-1),lua_strlen(lua,-1));
         break;
     case LUA_TBOOLEAN:
-        addReply(c,lua_toboolean(lua,-1) ? shared.cone : shared.nullbulk);
+        addReply(c,lua_toboolean(lua,-1) ? shared.cone : shared.null[c->resp]);
         break;
     case LUA_TNUMBER:
         addReplyLongLong(c,(long long)lua_tonumber(lua,-1));
@@ -1012,7 +1228,7 @@ void luaReplyToRedisReply(redisClient *c, lua_State *lua) {
         }
         break;
     default:
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
     }
     lua_pop(lua,1);
 }
@@ -1049,7 +1265,7 @@ void luaSetGlobalArray(lua_State *lua, char *var, robj **elev, int elec) {
  * 创建成功返回 REDIS_OK ，并且 Lua 栈中不会遗留任何数据。
  *
  * On error REDIS_ERR is returned and an appropriate error is set in the
- * client context. 
+ * client context, or logged if 'c' is NULL.
  */
 int luaCreateFunction(redisClient *c, lua_State *lua, char *funcname, robj *body) {
     sds funcdef = sdsempty();
@@ -1069,8 +1285,12 @@ int luaCreateFunction(redisClient *c, lua_State *lua, char *funcname, robj *body
     if (luaL_loadbuffer(lua,funcdef,sdslen(funcdef),"@user_script")) {
 
         // 如果编译出错，那么返回错误
-        addReplyErrorFormat(c,"Error compiling script (new function): %s\n",
-            lua_tostring(lua,-1));
+        if (c)
+            addReplyErrorFormat(c,"Error compiling script (new function): %s\n",
+                lua_tostring(lua,-1));
+        else
+            redisLog(REDIS_WARNING,"Error compiling script (new function): %s",
+                lua_tostring(lua,-1));
         lua_pop(lua,1);
         sdsfree(funcdef);
 
@@ -1082,8 +1302,12 @@ int luaCreateFunction(redisClient *c, lua_State *lua, char *funcname, robj *body
 
     // 定义函数
     if (lua_pcall(lua,0,0,0)) {
-        addReplyErrorFormat(c,"Error running script (new function): %s\n",
-            lua_tostring(lua,-1));
+        if (c)
+            addReplyErrorFormat(c,"Error running script (new function): %s\n",
+                lua_tostring(lua,-1));
+        else
+            redisLog(REDIS_WARNING,"Error running script (new function): %s",
+                lua_tostring(lua,-1));
         lua_pop(lua,1);
         return REDIS_ERR;
     }
@@ -1108,7 +1332,9 @@ int luaCreateFunction(redisClient *c, lua_State *lua, char *funcname, robj *body
     return REDIS_OK;
 }
 
-void evalGenericCommand(redisClient *c, int evalsha) {
+/* Run the script of EVAL (evalsha = 0), EVALSHA (evalsha = 1), or the
+ * named function 'fn' for FCALL, whose Lua function is always defined. */
+void evalGenericCommand(redisClient *c, int evalsha, luaFunction *fn) {
     lua_State *lua = server.lua;
     char funcname[43];
     long long numkeys;
@@ -1140,6 +1366,9 @@ void evalGenericCommand(redisClient *c, int evalsha) {
      */
     server.lua_random_dirty = 0;
     server.lua_write_dirty = 0;
+    server.lua_replicate_commands = server.lua_always_replicate_commands;
+    server.lua_multi_emitted = 0;
+    server.lua_repl = REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL;
 
     /* Get the number of arguments that are keys */
     // 获取输入键的数量
@@ -1159,7 +1388,9 @@ void evalGenericCommand(redisClient *c, int evalsha) {
      */
     funcname[0] = 'f';
     funcname[1] = '_';
-    if (!evalsha) {
+    if (fn) {
+        memcpy(funcname,fn->funcname,sizeof(funcname));
+    } else if (!evalsha) {
         /* Hash the code if this is an EVAL call */
         // 如果执行的是 EVAL 命令，那么计算脚本的 SHA1 校验和
         sha1hex(funcname+2,c->argv[1]->ptr,sdslen(c->argv[1]->ptr));
@@ -1313,6 +1544,21 @@ void evalGenericCommand(redisClient *c, int evalsha) {
         lua_pop(lua,1); /* Remove the error handler. */
     }
 
+    /* If we are using single commands replication, the script itself is
+     * not propagated: the write commands it executed were propagated while
+     * it was running, and we close the MULTI block with EXEC if there was
+     * at least a write. */
+    if (server.lua_replicate_commands) {
+        preventCommandPropagation(c);
+        if (server.lua_multi_emitted) {
+            robj **propargv = zmalloc(sizeof(robj*));
+
+            propargv[0] = createStringObject("EXEC",4);
+            alsoPropagate(server.execCommand,c->db->id,propargv,1,
+                REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+        }
+    }
+
     /* EVALSHA should be propagated to Slave and AOF file as full EVAL, unless
      * we are sure that the script was already in the context of all the
      * attached slaves *and* the current AOF file if enabled.
@@ -1335,7 +1581,7 @@ void evalGenericCommand(redisClient *c, int evalsha) {
      * 每次有一个新的 slave 连上 master 时，
      * 或者每次进行 AOF 重写时，程序清空缓存字典
      */
-    if (evalsha) {
+    if (evalsha && !fn && !server.lua_replicate_commands) {
         // replicationScriptCacheExists 如果返回 1 
         // 那么表示所有 slave 和 AOF 文件中都知道这个脚本
         // 如果返回 0 ，那么表示这个脚本未被传播到所有 slave 和 AOF 文件中
@@ -1362,7 +1608,7 @@ void evalGenericCommand(redisClient *c, int evalsha) {
 }
 
 void evalCommand(redisClient *c) {
-    evalGenericCommand(c,0);
+    evalGenericCommand(c,0,NULL);
 }
 
 void evalShaCommand(redisClient *c) {
@@ -1374,7 +1620,7 @@ void evalShaCommand(redisClient *c) {
         addReply(c, shared.noscripterr);
         return;
     }
-    evalGenericCommand(c,1);
+    evalGenericCommand(c,1,NULL);
 }
 
 /* We replace math.random() with our implementation that is not affected
@@ -1490,3 +1736,122 @@ void scriptCommand(redisClient *c) {
         addReplyError(c, "Unknown SCRIPT subcommand or wrong # of args.");
     }
 }
+
+/* ---------------------------------------------------------------------------
+ * Named functions: FUNCTION LOAD / DELETE / LIST / FLUSH and FCALL
+ *
+ * A function is a script stored by name. Unlike the scripts cache, the
+ * functions are part of the dataset: they are saved in the RDB file,
+ * rewritten in the AOF and replicated to the slaves with FUNCTION LOAD, so
+ * clients can call them with FCALL after a restart or a failover without
+ * sending the script body again.
+ *
+ * 函数是按名字保存的脚本，它们和数据一起保存到 RDB 和 AOF ，并复制到 slave ，
+ * 客户端在重启或者故障转移之后不需要重新发送脚本内容。
+ *
+ * The body of a function is compiled as the Lua function of the script
+ * with the same body, so FCALL runs exactly like EVALSHA.
+ * ------------------------------------------------------------------------- */
+
+/* Create or replace the function 'name' with the script 'body'. On error
+ * REDIS_ERR is returned and the error is sent to 'c', or logged if 'c' is
+ * NULL, like luaCreateFunction() does. */
+int luaFunctionCreate(redisClient *c, robj *name, robj *body) {
+    luaFunction *fn = zmalloc(sizeof(*fn));
+    sds sha;
+
+    fn->funcname[0] = 'f';
+    fn->funcname[1] = '_';
+    sha1hex(fn->funcname+2,body->ptr,sdslen(body->ptr));
+    sha = sdsnewlen(fn->funcname+2,40);
+
+    // 脚本函数未定义时，在 Lua 中创建它
+    if (dictFind(server.lua_scripts,sha) == NULL &&
+        luaCreateFunction(c,server.lua,fn->funcname,body) == REDIS_ERR)
+    {
+        sdsfree(sha);
+        zfree(fn);
+        return REDIS_ERR;
+    }
+    sdsfree(sha);
+
+    fn->body = body;
+    incrRefCount(body);
+    dictDelete(server.lua_functions,name->ptr);
+    dictAdd(server.lua_functions,sdsdup(name->ptr),fn);
+    return REDIS_OK;
+}
+
+/* Remove all the functions. */
+void luaFunctionsFlush(void) {
+    dictEmpty(server.lua_functions,NULL);
+}
+
+void functionCommand(redisClient *c) {
+
+    // FUNCTION LOAD <name> <body> [REPLACE]
+    if ((c->argc == 4 || c->argc == 5) &&
+        !strcasecmp(c->argv[1]->ptr,"load"))
+    {
+        int replace = 0;
+
+        if (c->argc == 5) {
+            if (strcasecmp(c->argv[4]->ptr,"replace")) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            replace = 1;
+        }
+        if (!replace && dictFind(server.lua_functions,c->argv[2]->ptr)) {
+            addReplyError(c,"Function already exists, use REPLACE to overwrite it");
+            return;
+        }
+        if (luaFunctionCreate(c,c->argv[2],c->argv[3]) == REDIS_ERR) return;
+        addReply(c,shared.ok);
+        server.dirty++; /* Propagate it to the AOF and the slaves. */
+
+    // FUNCTION DELETE <name>
+    } else if (c->argc == 3 && !strcasecmp(c->argv[1]->ptr,"delete")) {
+        if (dictDelete(server.lua_functions,c->argv[2]->ptr) == DICT_ERR) {
+            addReplyError(c,"No such function");
+            return;
+        }
+        addReply(c,shared.ok);
+        server.dirty++;
+
+    // FUNCTION LIST ，返回函数名到函数体的映射
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"list")) {
+        dictIterator *di = dictGetIterator(server.lua_functions);
+        dictEntry *de;
+
+        addReplyMapLen(c,dictSize(server.lua_functions));
+        while((de = dictNext(di)) != NULL) {
+            sds name = dictGetKey(de);
+            luaFunction *fn = dictGetVal(de);
+
+            addReplyBulkCBuffer(c,name,sdslen(name));
+            addReplyBulk(c,fn->body);
+        }
+        dictReleaseIterator(di);
+
+    // FUNCTION FLUSH
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"flush")) {
+        luaFunctionsFlush();
+        addReply(c,shared.ok);
+        server.dirty++;
+
+    } else {
+        addReplyError(c, "Unknown FUNCTION subcommand or wrong # of args.");
+    }
+}
+
+/* FCALL <name> <numkeys> [key ...] [arg ...] */
+void fcallCommand(redisClient *c) {
+    luaFunction *fn = dictFetchValue(server.lua_functions,c->argv[1]->ptr);
+
+    if (fn == NULL) {
+        addReplyError(c,"No matching function. Use FUNCTION LOAD.");
+        return;
+    }
+    evalGenericCommand(c,1,fn);
+}
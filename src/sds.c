@@ -33,9 +33,43 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include "sds.h"
 #include "zmalloc.h"
 
+/* Return the size of the header of an sds of the given type. */
+static inline int sdsHdrSize(char type) {
+    switch(type&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            return sizeof(struct sdshdr8);
+        case SDS_TYPE_16:
+            return sizeof(struct sdshdr16);
+        case SDS_TYPE_32:
+            return sizeof(struct sdshdr32);
+        case SDS_TYPE_64:
+            return sizeof(struct sdshdr64);
+    }
+    return 0;
+}
+
+/* Return the smallest header type able to hold a string of 'string_size'
+ * bytes.
+ *
+ * 根据字符串长度选择最小的头部类型 */
+static inline char sdsReqType(size_t string_size) {
+    if (string_size < 1<<8)
+        return SDS_TYPE_8;
+    if (string_size < 1<<16)
+        return SDS_TYPE_16;
+#if (LONG_MAX == LLONG_MAX)
+    if (string_size < 1ll<<32)
+        return SDS_TYPE_32;
+    return SDS_TYPE_64;
+#else
+    return SDS_TYPE_32;
+#endif
+}
+
 /*
  * 根据给定的初始化字符串 init 和字符串长度 initlen
  * 创建一个新的 sds
@@ -65,7 +99,11 @@
  * \0 characters in the middle, as the length is stored in the sds header. */
 sds sdsnewlen(const void *init, size_t initlen) {
 
-    struct sdshdr *sh;
+    void *sh;
+    sds s;
+    char type = sdsReqType(initlen);
+    int hdrlen = sdsHdrSize(type);
+    unsigned char *fp; /* flags pointer. */
 
     // 根据是否有初始化内容，选择适当的内存分配方式
     // 因为 sds 本身具有管理节点，而且是由 len 这一个「 已使用内存长度 」 的信息节点
@@ -73,28 +111,30 @@ sds sdsnewlen(const void *init, size_t initlen) {
     // T = O(N)
     if (init) {
         // zmalloc 不初始化所分配的内存
-        sh = zmalloc(sizeof(struct sdshdr)+initlen+1);
+        sh = zmalloc(hdrlen+initlen+1);
     } else {
         // zcalloc 将分配的内存全部初始化为 0
-        sh = zcalloc(sizeof(struct sdshdr)+initlen+1);
+        sh = zcalloc(hdrlen+initlen+1);
     }
 
     // 内存分配失败，返回
     if (sh == NULL) return NULL;
 
-    // 设置初始化长度（不包含 '\0'）
-    sh->len = initlen;
-    // 新 sds 不预留任何空间
-    sh->free = 0;
-    // 如果有指定初始化内容，将它们复制到 sdshdr 的 buf 中
+    // 设置初始化长度（不包含 '\0'），新 sds 不预留任何空间
+    s = (char*)sh+hdrlen;
+    fp = ((unsigned char*)s)-1;
+    *fp = type;
+    sdssetlen(s, initlen);
+    sdssetalloc(s, initlen);
+    // 如果有指定初始化内容，将它们复制到 buf 中
     // T = O(N)
     if (initlen && init)
-        memcpy(sh->buf, init, initlen);
+        memcpy(s, init, initlen);
     // 以 \0 结尾
-    sh->buf[initlen] = '\0';
+    s[initlen] = '\0';
 
     // 返回 buf 部分，而不是整个 sdshdr，毕竟调用者不关心管理部分
-    return (char*)sh->buf;
+    return s;
 }
 
 /*
@@ -148,6 +188,32 @@ sds sdsdup(const sds s) {
     return sdsnewlen(s, sdslen(s));
 }
 
+/* Return the number of bytes sdsnewinplace() needs in order to store a
+ * string of 'initlen' bytes, header and null term included. */
+size_t sdsInplaceSize(size_t initlen) {
+    return sdsHdrSize(sdsReqType(initlen))+initlen+1;
+}
+
+/* Create an sds string with the content specified by 'init' and 'initlen'
+ * inside the memory 'buf' provided by the caller, that must be at least
+ * sdsInplaceSize(initlen) bytes. This is used to store a string in the same
+ * allocation of some other structure: the string has no free space and
+ * must never be freed, grown or shrunk with the sds API.
+ *
+ * 在调用者提供的内存 buf 中创建 sds ，用于把字符串嵌入到其他结构的同一块内存中，
+ * 这样的 sds 不能被 sdsfree() 释放，也不能改变大小 */
+sds sdsnewinplace(void *buf, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    sds s = (char*)buf+sdsHdrSize(type);
+
+    s[-1] = type;
+    sdssetlen(s, initlen);
+    sdssetalloc(s, initlen);
+    if (initlen) memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
+}
+
 /*
  * 释放给定的 sds
  *
@@ -157,7 +223,7 @@ sds sdsdup(const sds s) {
 /* Free an sds string. No operation is performed if 's' is NULL. */
 void sdsfree(sds s) {
     if (s == NULL) return;
-    zfree(s-sizeof(struct sdshdr)); // 不然 alloc 用到错误的 cookie 来 free 这一块内存
+    zfree((char*)s-sdsHdrSize(s[-1])); // 不然 alloc 用到错误的 cookie 来 free 这一块内存
 }
 
 // 未使用函数，可能已废弃
@@ -176,10 +242,8 @@ void sdsfree(sds s) {
  * the output will be "6" as the string was modified but the logical length
  * remains 6 bytes. */
 void sdsupdatelen(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     int reallen = strlen(s);
-    sh->free += (sh->len-reallen);
-    sh->len = reallen;
+    sdssetlen(s, reallen);
 }
 
 /*
@@ -195,18 +259,14 @@ void sdsupdatelen(sds s) {
  * number of bytes previously available. */
 void sdsclear(sds s) {
 
-    // 取出 sdshdr
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-
-    // 重新计算属性
-    sh->free += sh->len;
-    sh->len = 0;
+    // 重新计算属性，已用空间全部变为空余空间
+    sdssetlen(s, 0);
 
     // 将结束符放到最前面（相当于惰性地删除 buf 中的内容）
     // 看到了不！这就是 sdshdr 拥有 len 节点的好处，压根就不用再调用一次 memset
     // NOTE: len 永远记录有效数据的使用长度，废弃数据永远不用管（前提：这是一堆二进制数据，永远不需要在 redis-server 里面进行解析）
     // 这个前提其实也可以不要（printf 的时候比较麻烦罢了，要是你已经明确不会有 '\0' 出现的话，'\0' 作为结束 flag 不也挺好的嘛）
-    sh->buf[0] = '\0';
+    s[0] = '\0';
 }
 
 /* Enlarge the free space at the end of the sds string so that the caller
@@ -229,51 +289,84 @@ void sdsclear(sds s) {
  * 
  * 这个函数一定要在调用完之后，自己接新的 sds，因为扩容可能发生数据迁移
  */
-sds sdsMakeRoomFor(sds s, size_t addlen) {  // 本函数的核心目的是：预留、预分配空间
+static sds _sdsMakeRoomFor(sds s, size_t addlen, int greedy) {  // 本函数的核心目的是：预留、预分配空间
 
-    struct sdshdr *sh, *newsh;
+    void *sh, *newsh;
 
     // 获取 s 目前的空余空间长度
-    size_t free = sdsavail(s);
+    size_t avail = sdsavail(s);
 
     size_t len, newlen;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen;
 
     // s 目前的空余空间已经足够，无须再进行扩展，直接返回，而且 zrealloc 也不能接受拓展长度比原本的小
-    if (free >= addlen) return s;
+    if (avail >= addlen) return s;
 
     // 获取 s 目前已占用空间的长度
     len = sdslen(s);
-    sh = (void*) (s-(sizeof(struct sdshdr)));
+    sh = (char*)s-sdsHdrSize(oldtype);
 
     // 整个 sds 的数据部分，最少需要的总长度
     newlen = (len+addlen);
 
     // 根据新长度，为 s 分配新空间所需的大小
-    if (newlen < SDS_MAX_PREALLOC)
+    if (!greedy)
+        ; /* Allocate exactly what was asked. */
+    else if (newlen < SDS_MAX_PREALLOC)
         // 如果新长度小于 SDS_MAX_PREALLOC 
         // 那么为它分配两倍于所需长度的空间
         newlen *= 2;
     else
         // 否则，分配长度为目前长度加上 SDS_MAX_PREALLOC
         newlen += SDS_MAX_PREALLOC;
-    // T = O(N)，因为全部内存要逐一搬运
-    newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1);// 预留 '\0' 的空位，并且完成源数据的迁移工作，旧的部分自己会 free 掉
-    // 在这里是自己管理内存，直接跟 alloc 打交道，所以要自己决定要不要预留 +1 给 '\0', 
-    // 跟 sdsnewlen() 这样的 “用字符串进行操作指挥” 的方式不一样（sdsnewlen 是更上层，更 OO 的操作）
-    // 而这里的扩容，则是更面向过程的内部细节操作
-    // 由于内部是会自己把 old_sh 给 free 掉的，所以一定不能写成：sh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1)
-    // 这样的话，一旦 zrealloc 失败了，将会导致旧的 sh 发生内存泄漏（也算是异常不安全，破坏了原本的数据）
-    // 而且采用末尾 +1 的方式，天然的排除了 size == 0 的坑
 
-    // 内存不足，分配失败，返回
-    if (newsh == NULL) return NULL;
+    // 新的长度可能需要更宽的头部
+    type = sdsReqType(newlen);
+    hdrlen = sdsHdrSize(type);
+    if (oldtype == type) {
+        // T = O(N)，因为全部内存要逐一搬运
+        newsh = zrealloc(sh, hdrlen+newlen+1);// 预留 '\0' 的空位，并且完成源数据的迁移工作，旧的部分自己会 free 掉
+        // 由于内部是会自己把 old_sh 给 free 掉的，所以一定不能写成：sh = zrealloc(sh, hdrlen+newlen+1)
+        // 这样的话，一旦 zrealloc 失败了，将会导致旧的 sh 发生内存泄漏（也算是异常不安全，破坏了原本的数据）
+        // 而且采用末尾 +1 的方式，天然的排除了 size == 0 的坑
+
+        // 内存不足，分配失败，返回
+        if (newsh == NULL) return NULL;
+        s = (char*)newsh+hdrlen;
+    } else {
+        /* Since the header size changes, need to move the string forward,
+         * and can't use realloc.
+         *
+         * 头部大小变了，只能重新分配并搬运数据 */
+        newsh = zmalloc(hdrlen+newlen+1);
+        if (newsh == NULL) return NULL;
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = (char*)newsh+hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
 
-    // 更新 sds 的空余长度
-    newsh->free = newlen - len;
+    // 更新 sds 的分配长度
+    sdssetalloc(s, newlen);
 
     // 返回 sds
     // 因为是预留、预分配空间，所以并不需要更新 '\0'
-    return newsh->buf;
+    return s;
+}
+
+sds sdsMakeRoomFor(sds s, size_t addlen) {
+    return _sdsMakeRoomFor(s,addlen,1);
+}
+
+/* Like sdsMakeRoomFor(), but allocates exactly 'addlen' free bytes without
+ * preallocating more: useful when the final size of the string is known in
+ * advance, like for the big arguments read in the query buffer.
+ *
+ * 和 sdsMakeRoomFor() 一样，但不做预分配，只分配刚好 addlen 的空余空间 */
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen) {
+    return _sdsMakeRoomFor(s,addlen,0);
 }
 
 /*
@@ -296,18 +389,36 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {  // 本函数的核心目的是：预
  * NOTE: 一旦调用了这个函数之后，旧的 sds 指针统统都失效了（调用成功的话）！
  * */
 sds sdsRemoveFreeSpace(sds s) {
-    struct sdshdr *sh;
-
-    sh = (void*) (s-(sizeof(struct sdshdr)));
-
-    // 进行内存重分配，让 buf 的长度仅仅足够保存字符串内容
-    // T = O(N)
-    sh = zrealloc(sh, sizeof(struct sdshdr)+sh->len+1);
+    void *sh, *newsh;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen, oldhdrlen = sdsHdrSize(oldtype);
+    size_t len = sdslen(s);
+
+    sh = (char*)s-oldhdrlen;
+
+    // 收缩之后可能只需要更窄的头部
+    type = sdsReqType(len);
+    hdrlen = sdsHdrSize(type);
+    if (oldtype == type) {
+        // 进行内存重分配，让 buf 的长度仅仅足够保存字符串内容
+        // T = O(N)
+        newsh = zrealloc(sh, oldhdrlen+len+1);
+        if (newsh == NULL) return NULL;
+        s = (char*)newsh+oldhdrlen;
+    } else {
+        newsh = zmalloc(hdrlen+len+1);
+        if (newsh == NULL) return NULL;
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = (char*)newsh+hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
 
     // 空余空间为 0
-    sh->free = 0;
+    sdssetalloc(s, len);
 
-    return sh->buf;
+    return s;
 }
 
 /*
@@ -324,9 +435,17 @@ sds sdsRemoveFreeSpace(sds s) {
  * 4) The implicit null term.
  */
 size_t sdsAllocSize(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+    size_t alloc = sdsalloc(s);
 
-    return sizeof(*sh)+sh->len+sh->free+1;
+    return sdsHdrSize(s[-1])+alloc+1;
+}
+
+/* Return the pointer of the actual SDS allocation (normally SDS strings
+ * are referenced by the start of the string buffer).
+ *
+ * 返回 sds 所在内存块的起始地址（也就是头部的地址） */
+void *sdsAllocPtr(const sds s) {
+    return (void*) (s-sdsHdrSize(s[-1]));
 }
 
 /* Increment the sds length and decrements the left free space at the
@@ -367,24 +486,43 @@ size_t sdsAllocSize(sds s) {
  *  T = O(1)
  */
 void sdsIncrLen(sds s, int incr) {  // 这个函数的存在，是为了能够更好的适配 linux 系统本身体统的 read 操作（update sds 的管理节点信息）
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-
-    // 确保 sds 空间足够
-    assert(sh->free >= incr);
-
-    // 更新属性
-    sh->len += incr;
-    sh->free -= incr;
+    unsigned char flags = s[-1];
+    size_t len;
 
-    // 这个 assert 其实可以忽略
-    // 因为前一个 assert 已经确保 sh->free - incr >= 0 了
-    assert(sh->free >= 0);
+    // 确保 sds 空间足够（或者截断时长度足够），然后更新属性
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            assert((incr >= 0 && sh->alloc-sh->len >= incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            assert((incr >= 0 && sh->alloc-sh->len >= incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            assert((incr >= 0 && sh->alloc-sh->len >= (unsigned int)incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            assert((incr >= 0 && sh->alloc-sh->len >= (uint64_t)incr) || (incr < 0 && sh->len >= (uint64_t)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        default: len = 0; /* Just to avoid compilation warnings. */
+    }
 
     // 放置新的结尾符号
     // 因为 make_room_for 并不意味着真的成功填充内容
     // 而且 make_room_for 算是一种预分配空间的操作
     // 所以只能拖延到这里才添加 '\0'
-    s[sh->len] = '\0';
+    s[len] = '\0';
 }
 
 /* Grow the sds to have the specified length. Bytes that were not part of
@@ -402,8 +540,7 @@ void sdsIncrLen(sds s, int incr) {  // 这个函数的存在，是为了能够
  *  T = O(N)
  */
 sds sdsgrowzero(sds s, size_t len) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    size_t totlen, curlen = sh->len;
+    size_t curlen = sdslen(s);
 
     // 如果 len 比字符串的现有长度小，
     // 那么直接返回，不做动作
@@ -423,13 +560,10 @@ sds sdsgrowzero(sds s, size_t len) {
     /* Make sure added region doesn't contain garbage */
     // 将新分配的空间用 0 填充，防止出现垃圾内容
     // T = O(N)
-    sh = (void*)(s-(sizeof(struct sdshdr)));
     memset(s+curlen,0,(len-curlen+1)); /* also set trailing \0 byte */
 
     // 更新属性
-    totlen = sh->len+sh->free;
-    sh->len = len;
-    sh->free = totlen-sh->len;
+    sdssetlen(s, len);
 
     // 返回新的 sds
     return s;
@@ -453,8 +587,6 @@ sds sdsgrowzero(sds s, size_t len) {
  * */
 sds sdscatlen(sds s, const void *t, size_t len) {
     
-    struct sdshdr *sh;
-    
     // 原有字符串长度
     size_t curlen = sdslen(s);
 
@@ -467,12 +599,10 @@ sds sdscatlen(sds s, const void *t, size_t len) {
 
     // 复制 t 中的内容到字符串后部
     // T = O(N)
-    sh = (void*) (s-(sizeof(struct sdshdr)));
     memcpy(s+curlen, t, len);   // 二进制安全的拷贝
 
     // 更新属性
-    sh->len = curlen+len;
-    sh->free = sh->free-len;
+    sdssetlen(s, curlen+len);
 
     // 添加新结尾符号
     s[curlen+len] = '\0';
@@ -532,18 +662,11 @@ sds sdscatsds(sds s, const sds t) {
  * safe string pointed by 't' of length 'len' bytes. */
 sds sdscpylen(sds s, const char *t, size_t len) {
 
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-
-    // sds 现有 buf 的长度
-    size_t totlen = sh->free+sh->len;
-
     // 如果 s 的 buf 长度不满足 len ，那么扩展它
-    if (totlen < len) {
+    if (sdsalloc(s) < len) {
         // T = O(N)
-        s = sdsMakeRoomFor(s,len-sh->len);
+        s = sdsMakeRoomFor(s,len-sdslen(s));
         if (s == NULL) return NULL;
-        sh = (void*) (s-(sizeof(struct sdshdr)));
-        totlen = sh->free+sh->len;
     }
 
     // 复制内容
@@ -554,8 +677,7 @@ sds sdscpylen(sds s, const char *t, size_t len) {
     s[len] = '\0';
 
     // 更新属性
-    sh->len = len;
-    sh->free = totlen-len;
+    sdssetlen(s, len);
 
     // 返回新的 sds
     return s;
@@ -771,7 +893,6 @@ sds sdscatprintf(sds s, const char *fmt, ...) {
  * %% - Verbatim "%" character.
  */
 sds sdscatfmt(sds s, char const *fmt, ...) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t initlen = sdslen(s);
     const char *f = fmt;
     int i;
@@ -787,9 +908,8 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
         unsigned long long unum;
 
         /* Make sure there is always space for at least 1 char. */
-        if (sh->free == 0) {
+        if (sdsavail(s) == 0) {
             s = sdsMakeRoomFor(s,1);
-            sh = (void*) (s-(sizeof(struct sdshdr)));
         }
 
         switch(*f) {    // 轮询扫描，以 % 作为触发点
@@ -801,14 +921,12 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
             case 'S':
                 str = va_arg(ap,char*); // 拿到本次要处理的变量
                 l = (next == 's') ? strlen(str) : sdslen(str);
-                if (sh->free < l) {
+                if (sdsavail(s) < l) {
                     s = sdsMakeRoomFor(s,l);
-                    sh = (void*) (s-(sizeof(struct sdshdr)));
                 }
                 memcpy(s+i,str,l);  // s+i 当前用到了哪里？
-                sh->len += l;
-                sh->free -= l;
-                i += l; // 总是等于 sh->len
+                sdsinclen(s,l);
+                i += l; // 总是等于 sdslen(s)
                 break;
             case 'i':
             case 'I':
@@ -819,13 +937,11 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
                 {
                     char buf[SDS_LLSTR_SIZE];
                     l = sdsll2str(buf,num);
-                    if (sh->free < l) {
+                    if (sdsavail(s) < l) {
                         s = sdsMakeRoomFor(s,l);
-                        sh = (void*) (s-(sizeof(struct sdshdr)));
                     }
                     memcpy(s+i,buf,l);
-                    sh->len += l;
-                    sh->free -= l;
+                    sdsinclen(s,l);
                     i += l;
                 }
                 break;
@@ -838,27 +954,23 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
                 {
                     char buf[SDS_LLSTR_SIZE];
                     l = sdsull2str(buf,unum);
-                    if (sh->free < l) {
+                    if (sdsavail(s) < l) {
                         s = sdsMakeRoomFor(s,l);
-                        sh = (void*) (s-(sizeof(struct sdshdr)));
                     }
                     memcpy(s+i,buf,l);
-                    sh->len += l;
-                    sh->free -= l;
+                    sdsinclen(s,l);
                     i += l;
                 }
                 break;
             default: /* Handle %% and generally %<unknown>. */
                 s[i++] = next;
-                sh->len += 1;
-                sh->free -= 1;
+                sdsinclen(s,1);
                 break;
             }
             break;
         default:
             s[i++] = *f;    // 原样照抄这一个字符
-            sh->len += 1;
-            sh->free -= 1;
+            sdsinclen(s,1);
             break;
         }
         f++;    // 下一个待检查字符
@@ -899,7 +1011,6 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
  * Output will be just "Hello World".
  */
 sds sdstrim(sds s, const char *cset) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     char *start, *end, *sp, *ep;    // start\end 是固定不动的上界与下界，sp\ep 则是浮动的指针
     size_t len;
 
@@ -917,14 +1028,13 @@ sds sdstrim(sds s, const char *cset) {
     
     // 如果有需要，前移字符串内容
     // T = O(N)
-    if (sh->buf != sp) memmove(sh->buf, sp, len);   // sh->buf == sp 的话，更新 free\len 和 '\0' 就好了
+    if (s != sp) memmove(s, sp, len);   // s == sp 的话，更新 len 和 '\0' 就好了
 
     // 添加终结符
-    sh->buf[len] = '\0';
+    s[len] = '\0';
 
-    // 更新属性
-    sh->free = sh->free+(sh->len-len);  // 新释放了 sh->len - len 长度
-    sh->len = len;
+    // 更新属性（新释放的空间自然变为空余空间）
+    sdssetlen(s,len);
 
     // 返回修剪后的 sds
     return s;
@@ -957,7 +1067,6 @@ sds sdstrim(sds s, const char *cset) {
  * sdsrange(s,1,-1); => "ello World"
  */
 void sdsrange(sds s, int start, int end) {  // 截取后的结果直接放在原本的 sds 里面（截取操作只会缩减，不会增加）
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t newlen, len = sdslen(s);
 
     if (len == 0) return;
@@ -983,14 +1092,13 @@ void sdsrange(sds s, int start, int end) {  // 截取后的结果直接放在原
 
     // 如果有需要，对字符串进行移动
     // T = O(N)
-    if (start && newlen) memmove(sh->buf, sh->buf+start, newlen);
+    if (start && newlen) memmove(s, s+start, newlen);
 
     // 添加终结符，当发生 start > end, start 在 end 的右边时，整个 sds 将会被截断为 len = 1（'\0'）
-    sh->buf[newlen] = 0;
+    s[newlen] = 0;
 
     // 更新属性
-    sh->free = sh->free+(sh->len-newlen);
-    sh->len = newlen;
+    sdssetlen(s,newlen);
 }
 
 /*
@@ -1189,7 +1297,20 @@ sds sdscatrepr(sds s, const char *p, size_t len) {  // len 是转移字符串 p
 
     s = sdscatlen(s,"\"",1);    // 将长度为 len 的字符串 p 以带引号（quoted）的格式，开头的 "
 
-    while(len--) {
+    while(len) {
+        /* Append runs of bytes that need no escaping with a single copy. */
+        // 不需要转义的连续字节一次性追加，不再逐个字节 sdscatprintf
+        size_t run = 0;
+
+        while (run < len && p[run] != '\\' && p[run] != '"' &&
+               isprint((unsigned char)p[run])) run++;
+        if (run) {
+            s = sdscatlen(s,p,run);
+            p += run;
+            len -= run;
+            continue;
+        }
+        len--;
         switch(*p) { 
         case '\\':
         case '"':
@@ -1490,7 +1611,6 @@ sds sdsjoin(char **argv, int argc, char *sep) {
 
 int main(void) {
     {
-        struct sdshdr *sh;
         sds x = sdsnew("foo"), y;
 
         test_cond("Create a string and obtain the length",
@@ -1625,22 +1745,47 @@ int main(void) {
             memcmp(y,"\"\\a\\n\\x00foo\\r\"\0",16) == 0)  // 为什么后面没有 '\0'
         // y 就是字符串 "\a\n\x00foo\r" 15 个字符
         {
-            int oldfree;
+            unsigned int oldfree;
+            char *p;
+            int step = 10, j, i;
 
             sdsfree(x);
             x = sdsnew("0");
-            sh = (void*) (x-(sizeof(struct sdshdr)));
-            test_cond("sdsnew() free/len buffers", sh->len == 1 && sh->free == 0);
+            test_cond("sdsnew() free/len buffers", sdslen(x) == 1 && sdsavail(x) == 0);
+            test_cond("sdsnew() uses the smallest header",
+                (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 &&
+                sdsAllocSize(x) == sizeof(struct sdshdr8)+2);
             x = sdsMakeRoomFor(x,1);
-            sh = (void*) (x-(sizeof(struct sdshdr)));
-            test_cond("sdsMakeRoomFor()", sh->len == 1 && sh->free > 0);
-            oldfree = sh->free;
+            test_cond("sdsMakeRoomFor()", sdslen(x) == 1 && sdsavail(x) > 0);
+            oldfree = sdsavail(x);
             x[1] = '1'; // x[2] 在 update 为 '\0' 会更完善
-            sdsIncrLen(x,1);    // 手动 update sdshdr->len, 因为手动更新的 x[1] 的值
+            sdsIncrLen(x,1);    // 手动 update len, 因为手动更新的 x[1] 的值
             test_cond("sdsIncrLen() -- content", x[0] == '0' && x[1] == '1');
-            test_cond("sdsIncrLen() -- len", sh->len == 2);
-            test_cond("sdsIncrLen() -- free", sh->free == oldfree-1);
+            test_cond("sdsIncrLen() -- len", sdslen(x) == 2);
+            test_cond("sdsIncrLen() -- free", sdsavail(x) == oldfree-1);
 
+            /* Grow the string crossing every header type boundary, checking
+             * the content survives each header change. */
+            sdsfree(x);
+            x = sdsnew("0");
+            for (i = 0; i < 10; i++) {
+                int oldlen = sdslen(x);
+                x = sdsMakeRoomFor(x,step);
+                p = x+oldlen;
+                for (j = 0; j < step; j++) p[j] = 'A'+j;
+                sdsIncrLen(x,step);
+                step *= 4;
+            }
+            test_cond("sdsMakeRoomFor() across header types",
+                (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_32 &&
+                x[0] == '0' && memcmp(x+1,"ABCDEFGHIJ",10) == 0 &&
+                x[sdslen(x)] == '\0');
+            sdsrange(x,0,2);
+            x = sdsRemoveFreeSpace(x);
+            test_cond("sdsRemoveFreeSpace() shrinks the header",
+                (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 &&
+                sdslen(x) == 3 && sdsavail(x) == 0 &&
+                memcmp(x,"0AB\0",4) == 0);
         }
 
         sdsfree(x);
@@ -39,6 +39,7 @@
 
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 /*
  * 类型别名，用于指向 sdshdr 的 buf 属性
@@ -51,32 +52,43 @@
  */
 typedef char *sds;  // 作为 动态字符串 的 handler 实在是方便，体积小，拿来直接打印数据，对管理数据没有感知（封装）
 
-/*
- * 保存字符串对象的结构
- */
-struct sdshdr {
-    
-    // buf 中已占用空间的长度（不包含 '\0'）
-    // 因为这个节点的存在，让每一次的新内容直接覆盖旧内容成为可能，甚至都不用预先 memset 清空
-    // 本质上 '\0' 的添加是不得已而为之，既然如此，这个 \0 就不应该交由调用者去操心
-    // 而是交由 sds 库的作者来操心
-    // 最好不要用 uint32_t, 不然的话，向下溢出，不好处理
-    int len; // （-2,147,483,648 到 2,147,483,647），理论上可以容纳 2047 MB 的 string
-
-    // buf 中剩余可用空间的长度
-    int free;
-
-    // 数据空间（柔性数组）
-    char buf[]; // typedef char *sds; 总是指向这里，而这里也是外界 handle 的通常操作对象
-    // 常见手动，不定长的数据部分，而且是让数据部分直接跟在这里后面，不用跟管理节点分离
-    // 不分离，也就意味着可以直接一次性 malloc，而不需要多次 malloc\free
-    // NOTE: 上层 sds 操作完全不关系 '\0' 的坑位，全部交由跟 alloc 打交道的底层函数去添加 '\0' 的坑位
+/* Note: sdshdr8, sdshdr16, sdshdr32 and sdshdr64 share the same layout and
+ * only differ in the width of the len and alloc fields, so that a short
+ * string pays 3 bytes of header instead of 8. The header type is chosen by
+ * sdsnewlen() from the string length, and is stored in the low bits of the
+ * flags byte that always sits just before buf, so s[-1] tells every sds
+ * which header it uses.
+ *
+ * 根据字符串长度选择不同宽度的头部，flags（s[-1]）记录头部类型 */
+struct __attribute__ ((__packed__)) sdshdr8 {
+    uint8_t len;            /* used, 不包含 '\0' */
+    uint8_t alloc;          /* excluding the header and null terminator */
+    unsigned char flags;    /* 3 lsb of type, 5 unused bits */
+    char buf[];             /* typedef char *sds; 总是指向这里 */
+};
+struct __attribute__ ((__packed__)) sdshdr16 {
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32 {
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr64 {
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
+    char buf[];
 };
 /**
  * sds 通常长这样
- * | len + free | + buf
- * |  管理部分  | + 实际数据开头(柔性数组作为 data_buf)
- * | 对外界隐藏 | + typedef char *sds；
+ * | len + alloc + flags | + buf
+ * |      管理部分       | + 实际数据开头(柔性数组作为 data_buf)
+ * |     对外界隐藏      | + typedef char *sds；
  * 
  * 这样的操作有一个好处：进行 sds 数据操作的时候，可以直接进行操作，而不用每次都进行结构体转跳计算（经常发生）
  * 只有当进行 sds 的管理（扩容、get_len）等操作的时候，才需要计算偏移，获得管理部分（不经常）
@@ -85,7 +97,13 @@ struct sdshdr {
  * 所以尽可能让专业人士才能拿到管理部分是合理的
 */
 
-
+#define SDS_TYPE_8  0
+#define SDS_TYPE_16 1
+#define SDS_TYPE_32 2
+#define SDS_TYPE_64 3
+#define SDS_TYPE_MASK 7
+#define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (void*)((s)-(sizeof(struct sdshdr##T)));
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
 
 /*
  * 返回 sds 实际保存的字符串的长度
@@ -93,8 +111,18 @@ struct sdshdr {
  * T = O(1)
  */
 static inline size_t sdslen(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr))); // 回溯找到 sdshdr 部分，获得长度
-    return sh->len;
+    unsigned char flags = s[-1];    // 回溯找到 flags ，得知头部类型后再取出长度
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            return SDS_HDR(8,s)->len;
+        case SDS_TYPE_16:
+            return SDS_HDR(16,s)->len;
+        case SDS_TYPE_32:
+            return SDS_HDR(32,s)->len;
+        case SDS_TYPE_64:
+            return SDS_HDR(64,s)->len;
+    }
+    return 0;
 }
 
 /*
@@ -103,8 +131,98 @@ static inline size_t sdslen(const sds s) {
  * T = O(1)
  */
 static inline size_t sdsavail(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr))); // 回溯找到 sdshdr 部分，获得 free 的余量
-    return sh->free;
+    unsigned char flags = s[-1];
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            return sh->alloc - sh->len;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            return sh->alloc - sh->len;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            return sh->alloc - sh->len;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            return sh->alloc - sh->len;
+        }
+    }
+    return 0;
+}
+
+/* Set the length of 's' to 'newlen', that must fit the current header. */
+static inline void sdssetlen(sds s, size_t newlen) {
+    unsigned char flags = s[-1];
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            SDS_HDR(8,s)->len = newlen;
+            break;
+        case SDS_TYPE_16:
+            SDS_HDR(16,s)->len = newlen;
+            break;
+        case SDS_TYPE_32:
+            SDS_HDR(32,s)->len = newlen;
+            break;
+        case SDS_TYPE_64:
+            SDS_HDR(64,s)->len = newlen;
+            break;
+    }
+}
+
+/* Increment the length of 's' by 'inc' bytes, without touching the buffer. */
+static inline void sdsinclen(sds s, size_t inc) {
+    unsigned char flags = s[-1];
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            SDS_HDR(8,s)->len += inc;
+            break;
+        case SDS_TYPE_16:
+            SDS_HDR(16,s)->len += inc;
+            break;
+        case SDS_TYPE_32:
+            SDS_HDR(32,s)->len += inc;
+            break;
+        case SDS_TYPE_64:
+            SDS_HDR(64,s)->len += inc;
+            break;
+    }
+}
+
+/* sdsalloc() = sdsavail() + sdslen() */
+static inline size_t sdsalloc(const sds s) {
+    unsigned char flags = s[-1];
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            return SDS_HDR(8,s)->alloc;
+        case SDS_TYPE_16:
+            return SDS_HDR(16,s)->alloc;
+        case SDS_TYPE_32:
+            return SDS_HDR(32,s)->alloc;
+        case SDS_TYPE_64:
+            return SDS_HDR(64,s)->alloc;
+    }
+    return 0;
+}
+
+static inline void sdssetalloc(sds s, size_t newlen) {
+    unsigned char flags = s[-1];
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            SDS_HDR(8,s)->alloc = newlen;
+            break;
+        case SDS_TYPE_16:
+            SDS_HDR(16,s)->alloc = newlen;
+            break;
+        case SDS_TYPE_32:
+            SDS_HDR(32,s)->alloc = newlen;
+            break;
+        case SDS_TYPE_64:
+            SDS_HDR(64,s)->alloc = newlen;
+            break;
+    }
 }
 
 sds sdsnewlen(const void *init, size_t initlen);
@@ -112,6 +230,8 @@ sds sdsnew(const char *init);
 sds sdsempty(void);
 size_t sdslen(const sds s);
 sds sdsdup(const sds s);
+size_t sdsInplaceSize(size_t initlen);
+sds sdsnewinplace(void *buf, const void *init, size_t initlen);
 void sdsfree(sds s);
 size_t sdsavail(const sds s);
 sds sdsgrowzero(sds s, size_t len);
@@ -147,8 +267,10 @@ sds sdsjoin(char **argv, int argc, char *sep);
 
 /* Low level functions exposed to the user API */
 sds sdsMakeRoomFor(sds s, size_t addlen);
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen);
 void sdsIncrLen(sds s, int incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
+void *sdsAllocPtr(const sds s);
 
 #endif
@@ -217,8 +217,6 @@ typedef struct sentinelAddr {
 #define SRI_SLAVE   (1<<1)
 //  instance 是一个 Sentinel
 #define SRI_SENTINEL (1<<2)
-//  instance 已断线
-#define SRI_DISCONNECTED (1<<3)
 //  instance 已处于 SDOWN 状态
 #define SRI_S_DOWN (1<<4)   /* Subjectively down (no quorum). */
 //  instance 已处于 ODOWN 状态
@@ -241,6 +239,8 @@ typedef struct sentinelAddr {
 #define SRI_FORCE_FAILOVER (1<<12)  /* Force failover with master up. */
 // 已经对返回 -BUSY 的服务器发送 SCRIPT KILL 命令
 #define SRI_SCRIPT_KILL_SENT (1<<13) /* SCRIPT KILL already sent on -BUSY */
+// instance 不支持 INFO 多个 section 参数，改为发送完整的 INFO
+#define SRI_INFO_FULL (1<<14)       /* Compact INFO refused, use plain INFO. */
 
 /* Note: times are in milliseconds. */
 /* 各种时间常量，以毫秒为单位 */
@@ -248,6 +248,8 @@ typedef struct sentinelAddr {
 #define SENTINEL_INFO_PERIOD 10000
 // 发送 PING 命令的间隔
 #define SENTINEL_PING_PERIOD 1000
+// ping-period 选项允许的最小值
+#define SENTINEL_MIN_PING_PERIOD 100
 // 发送 ASK 命令的间隔
 #define SENTINEL_ASK_PERIOD 1000
 // 发送 PUBLISH 命令的间隔
@@ -330,31 +332,23 @@ typedef struct sentinelAddr {
 // 脚本重试之前的延迟时间
 #define SENTINEL_SCRIPT_RETRY_DELAY 30000 /* 30 seconds between retries. */
 
-// Sentinel 会为每个被监视的 Redis  instance 创建相应的 sentinelRedisInstance  instance 
-// （被监视的 instance 可以是 master 、 slave 、或者其他 Sentinel ）
-typedef struct sentinelRedisInstance {
-    
-    // 标识值，记录了 instance 的类型，以及该 instance 的当前状态
-    int flags;      /* See SRI_... defines */
-    
-    //  instance 的名字
-    //  master 的名字由用户在配置文件中设置
-    //  slave 以及 Sentinel 的名字由 Sentinel 自动设置
-    // 格式为 ip:port ，例如 "127.0.0.1:26379"
-    char *name;     /* Master name from the point of view of this sentinel. */
-
-    //  instance 的运行 ID
-    char *runid;    /* run ID of this instance. */
-
-    // 配置纪元，用于实现故障转移
-    uint64_t config_epoch;  /* Configuration epoch. */
-
-    //  instance 的地址
-    sentinelAddr *addr; /* Master host. */
+/* The link to an instance: the command and Pub/Sub connections plus the
+ * state about them. A Sentinel monitoring several masters in common with
+ * us is represented by one sentinelRedisInstance per master, but all of
+ * them share a single link (see sentinelTryConnectionSharing()), so that
+ * the number of connections and PINGs does not grow with the number of
+ * monitored masters.
+ *
+ * 多个 master 下代表同一个 Sentinel 的 instance 共用一个 instanceLink 。 */
+typedef struct instanceLink {
+    // 引用这个连接的 instance 数量
+    int refcount;          /* Number of sentinelRedisInstance owners. */
+    // 只要 cc 或者 pc 其中一个连接缺失就为真，需要重连
+    int disconnected;      /* Non-zero if we need to reconnect cc or pc. */
 
     // 用于发送命令的异步连接
     // NOTE: 这才是 sentinel 时，sentinel 跟其他模块的网络连接实体！
-    // 连接调用链：现在 createSentinelRedisInstance() 里面进行初始化，并且设置为 SRI_DISCONNECTED
+    // 连接调用链：现在 createSentinelRedisInstance() 里面进行初始化，并且设置为 disconnected
     // 然后将会由 timer 进行采用异步的方式，真正建立连接：
     // sentinelTimer() --> sentinelHandleRedisInstance() --> sentinelReconnectInstance()
     redisAsyncContext *cc; /* Hiredis context for commands. */
@@ -401,6 +395,32 @@ typedef struct sentinelRedisInstance {
     mstime_t last_pong_time;  /* Last time the instance replied to ping,
                                  whatever the reply was. That's used to check
                                  if the link is idle and must be reconnected. */
+} instanceLink;
+
+// Sentinel 会为每个被监视的 Redis  instance 创建相应的 sentinelRedisInstance  instance 
+// （被监视的 instance 可以是 master 、 slave 、或者其他 Sentinel ）
+typedef struct sentinelRedisInstance {
+    
+    // 标识值，记录了 instance 的类型，以及该 instance 的当前状态
+    int flags;      /* See SRI_... defines */
+    
+    //  instance 的名字
+    //  master 的名字由用户在配置文件中设置
+    //  slave 以及 Sentinel 的名字由 Sentinel 自动设置
+    // 格式为 ip:port ，例如 "127.0.0.1:26379"
+    char *name;     /* Master name from the point of view of this sentinel. */
+
+    //  instance 的运行 ID
+    char *runid;    /* run ID of this instance. */
+
+    // 配置纪元，用于实现故障转移
+    uint64_t config_epoch;  /* Configuration epoch. */
+
+    //  instance 的地址
+    sentinelAddr *addr; /* Master host. */
+
+    // instance 的连接，可能被多个 instance 共享
+    instanceLink *link; /* Link to the instance, may be shared for Sentinels. */
 
     // 最后一次向频道发送问候信息的时间
     // 只在当前 instance 为 sentinel 时使用
@@ -427,6 +447,9 @@ typedef struct sentinelRedisInstance {
     //  instance 无响应多少毫秒之后才会被判断为主观下线（subjectively down）
     mstime_t down_after_period; /* Consider it down after that period. */
 
+    // SENTINEL ping-period 选项所设定的值，两次 PING 之间的最大间隔
+    mstime_t ping_period;       /* Max time between two PINGs. */
+
     // 从 instance 获取 INFO 命令的回复的时间
     mstime_t info_refresh;  /* Time at which we received INFO output from it. */
 
@@ -518,6 +541,9 @@ typedef struct sentinelRedisInstance {
     // 状态改变的时间
     mstime_t failover_state_change_time;
 
+    // 故障转移每个阶段的开始时间，用于生成 +failover-timing 事件
+    mstime_t failover_phase_time[SENTINEL_FAILOVER_STATE_UPDATE_CONFIG+1];
+
     // 最后一次进行故障迁移的时间
     mstime_t failover_start_time;   /* Last failover attempt start time. */
 
@@ -742,14 +768,20 @@ char *sentinelGetSubjectiveLeader(sentinelRedisInstance *master);
 char *sentinelGetObjectiveLeader(sentinelRedisInstance *master);
 int yesnotoi(char *s);
 void sentinelDisconnectInstanceFromContext(const redisAsyncContext *c);
-void sentinelKillLink(sentinelRedisInstance *ri, redisAsyncContext *c);
+void sentinelKillLink(instanceLink *link, redisAsyncContext *c);
 const char *sentinelRedisInstanceTypeStr(sentinelRedisInstance *ri);
 void sentinelAbortFailover(sentinelRedisInstance *ri);
 void sentinelEvent(int level, char *type, sentinelRedisInstance *ri, const char *fmt, ...);
 sentinelRedisInstance *sentinelSelectSlave(sentinelRedisInstance *master);
 void sentinelScheduleScriptExecution(char *path, ...);
 void sentinelStartFailover(sentinelRedisInstance *master);
+void sentinelSetFailoverState(sentinelRedisInstance *master, int state);
+void sentinelFailoverProgress(sentinelRedisInstance *master);
+void sentinelReportFailoverTiming(sentinelRedisInstance *master);
 void sentinelDiscardReplyCallback(redisAsyncContext *c, void *reply, void *privdata);
+instanceLink *createInstanceLink(void);
+instanceLink *releaseInstanceLink(instanceLink *link, sentinelRedisInstance *ri);
+int sentinelTryConnectionSharing(sentinelRedisInstance *ri);
 int sentinelSendSlaveOf(sentinelRedisInstance *ri, char *host, int port);
 char *sentinelVoteLeader(sentinelRedisInstance *master, uint64_t req_epoch, char *req_runid, uint64_t *leader_epoch);
 void sentinelFlushConfig(void);
@@ -758,7 +790,7 @@ int sentinelSendPing(sentinelRedisInstance *ri);
 
 /* ========================= Dictionary types =============================== */
 
-unsigned int dictSdsHash(const void *key);
+uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void releaseSentinelRedisInstance(sentinelRedisInstance *ri);
 
@@ -1563,24 +1595,12 @@ sentinelRedisInstance *createSentinelRedisInstance(char *name, int flags, char *
     /* Note that all the instances are started in the disconnected state,
      * the event loop will take care of connecting them. */
     // 所有连接都已断线为起始状态，sentinel 会在需要时自动为它创建连接
-    ri->flags = flags | SRI_DISCONNECTED;
+    ri->flags = flags;
     ri->name = sdsname;
     ri->runid = NULL;
     ri->config_epoch = 0;
     ri->addr = addr;
-    ri->cc = NULL;
-    ri->pc = NULL;
-    ri->pending_commands = 0;
-    ri->cc_conn_time = 0;
-    ri->pc_conn_time = 0;
-    ri->pc_last_activity = 0;
-    /* We set the last_ping_time to "now" even if we actually don't have yet
-     * a connection with the node, nor we sent a ping.
-     * This is useful to detect a timeout in case we'll not be able to connect
-     * with the node at all. */
-    ri->last_ping_time = mstime();
-    ri->last_avail_time = mstime();
-    ri->last_pong_time = mstime();
+    ri->link = createInstanceLink();
     ri->last_pub_time = mstime();
     ri->last_hello_time = mstime();
     ri->last_master_down_reply_time = mstime();
@@ -1588,6 +1608,7 @@ sentinelRedisInstance *createSentinelRedisInstance(char *name, int flags, char *
     ri->o_down_since_time = 0;
     ri->down_after_period = master ? master->down_after_period :
                             SENTINEL_DEFAULT_DOWN_AFTER;
+    ri->ping_period = master ? master->ping_period : SENTINEL_PING_PERIOD;
     ri->master_link_down_time = 0;
     ri->auth_pass = NULL;
     ri->slave_priority = SENTINEL_DEFAULT_SLAVE_PRIORITY;
@@ -1609,6 +1630,7 @@ sentinelRedisInstance *createSentinelRedisInstance(char *name, int flags, char *
     ri->failover_epoch = 0;
     ri->failover_state = SENTINEL_FAILOVER_STATE_NONE;
     ri->failover_state_change_time = 0;
+    memset(ri->failover_phase_time,0,sizeof(ri->failover_phase_time));
     ri->failover_start_time = 0;
     ri->failover_timeout = SENTINEL_DEFAULT_FAILOVER_TIMEOUT;
     ri->failover_delay_logged = 0;
@@ -1647,10 +1669,9 @@ void releaseSentinelRedisInstance(sentinelRedisInstance *ri) {
     dictRelease(ri->sentinels);
     dictRelease(ri->slaves);
 
-    /* Release hiredis connections. */
-    // 释放连接
-    if (ri->cc) sentinelKillLink(ri,ri->cc);
-    if (ri->pc) sentinelKillLink(ri,ri->pc);
+    /* Release hiredis connections, unless other instances share them. */
+    // 释放连接（如果连接没有被其他 instance 共享的话）
+    ri->link = releaseInstanceLink(ri->link,ri);
 
     /* Free other resources. */
     // 释放其他资源
@@ -1866,12 +1887,12 @@ void sentinelResetMaster(sentinelRedisInstance *ri, int flags) {
         ri->sentinels = dictCreate(&instancesDictType,NULL);
     }
 
-    if (ri->cc) sentinelKillLink(ri,ri->cc);
+    if (ri->link->cc) sentinelKillLink(ri->link,ri->link->cc);
 
-    if (ri->pc) sentinelKillLink(ri,ri->pc);
+    if (ri->link->pc) sentinelKillLink(ri->link,ri->link->pc);
 
     // 设置标识为断线的 master 
-    ri->flags &= SRI_MASTER|SRI_DISCONNECTED;
+    ri->flags &= SRI_MASTER;
 
     if (ri->leader) {
         sdsfree(ri->leader);
@@ -1886,9 +1907,9 @@ void sentinelResetMaster(sentinelRedisInstance *ri, int flags) {
     sdsfree(ri->slave_master_host);
     ri->runid = NULL;
     ri->slave_master_host = NULL;
-    ri->last_ping_time = mstime();
-    ri->last_avail_time = mstime();
-    ri->last_pong_time = mstime();
+    ri->link->last_ping_time = mstime();
+    ri->link->last_avail_time = mstime();
+    ri->link->last_pong_time = mstime();
     ri->role_reported_time = mstime();
     ri->role_reported = SRI_MASTER;
     // 发送 master 重置事件
@@ -2048,9 +2069,10 @@ sentinelAddr *sentinelGetCurrentMasterAddress(sentinelRedisInstance *master) {
     }
 }
 
-/* This function sets the down_after_period field value in 'master' to all
- * the slaves and sentinel instances connected to this master. */
-void sentinelPropagateDownAfterPeriod(sentinelRedisInstance *master) {
+/* This function sets the down_after_period and ping_period field values in
+ * 'master' to all the slaves and sentinel instances connected to this
+ * master. */
+void sentinelPropagatePeriods(sentinelRedisInstance *master) {
     dictIterator *di;
     dictEntry *de;
     int j;
@@ -2061,6 +2083,7 @@ void sentinelPropagateDownAfterPeriod(sentinelRedisInstance *master) {
         while((de = dictNext(di)) != NULL) {
             sentinelRedisInstance *ri = dictGetVal(de);
             ri->down_after_period = master->down_after_period;
+            ri->ping_period = master->ping_period;
         }
         dictReleaseIterator(di);
     }
@@ -2106,7 +2129,18 @@ char *sentinelHandleConfiguration(char **argv, int argc) {
         if (ri->down_after_period <= 0)
             return "negative or zero time parameter.";
 
-        sentinelPropagateDownAfterPeriod(ri);
+        sentinelPropagatePeriods(ri);
+
+    // SENTINEL ping-period 选项
+    } else if (!strcasecmp(argv[0],"ping-period") && argc == 3) {
+
+        /* ping-period <name> <milliseconds> */
+        ri = sentinelGetMasterByName(argv[1]);
+        if (!ri) return "No such master with specified name.";
+        ri->ping_period = atoi(argv[2]);
+        if (ri->ping_period < SENTINEL_MIN_PING_PERIOD)
+            return "ping-period can't be smaller than 100 milliseconds.";
+        sentinelPropagatePeriods(ri);
 
     // SENTINEL failover-timeout 选项
     } else if (!strcasecmp(argv[0],"failover-timeout") && argc == 3) {
@@ -2233,7 +2267,10 @@ char *sentinelHandleConfiguration(char **argv, int argc) {
         {
             return "Wrong hostname or port for sentinel.";
         }
-        if (argc == 5) si->runid = sdsnew(argv[4]);
+        if (argc == 5) {
+            si->runid = sdsnew(argv[4]);
+            sentinelTryConnectionSharing(si);
+        }
 
     } else {
         return "Unrecognized sentinel configuration statement.";
@@ -2276,6 +2313,14 @@ void rewriteConfigSentinelOption(struct rewriteConfigState *state) {
             rewriteConfigRewriteLine(state,"sentinel",line,1);
         }
 
+        /* sentinel ping-period */
+        if (master->ping_period != SENTINEL_PING_PERIOD) {
+            line = sdscatprintf(sdsempty(),
+                "sentinel ping-period %s %ld",
+                master->name, (long) master->ping_period);
+            rewriteConfigRewriteLine(state,"sentinel",line,1);
+        }
+
         /* sentinel failover-timeout */
         if (master->failover_timeout != SENTINEL_DEFAULT_FAILOVER_TIMEOUT) {
             line = sdscatprintf(sdsempty(),
@@ -2408,23 +2453,111 @@ werr:
 
 /* ====================== hiredis connection handling（适配层） ======================= */
 
+/* Create a new, disconnected, link with a single owner. */
+instanceLink *createInstanceLink(void) {
+    instanceLink *link = zmalloc(sizeof(*link));
+
+    link->refcount = 1;
+    link->disconnected = 1;
+    link->pending_commands = 0;
+    link->cc = NULL;
+    link->pc = NULL;
+    link->cc_conn_time = 0;
+    link->pc_conn_time = 0;
+    link->pc_last_activity = 0;
+    /* We set the last_ping_time to "now" even if we actually don't have yet
+     * a connection with the node, nor we sent a ping.
+     * This is useful to detect a timeout in case we'll not be able to connect
+     * with the node at all. */
+    link->last_ping_time = mstime();
+    link->last_avail_time = mstime();
+    link->last_pong_time = mstime();
+    return link;
+}
+
 /* Completely disconnect a hiredis link from an instance. */
 // 断开 instance 的连接
-void sentinelKillLink(sentinelRedisInstance *ri, redisAsyncContext *c) {
-    if (ri->cc == c) {
-        ri->cc = NULL;
-        ri->pending_commands = 0;
+void sentinelKillLink(instanceLink *link, redisAsyncContext *c) {
+    if (c == NULL) return;
+    if (link->cc == c) {
+        link->cc = NULL;
+        link->pending_commands = 0;
     }
-    if (ri->pc == c) ri->pc = NULL;
+    if (link->pc == c) link->pc = NULL;
     c->data = NULL;
 
     // 打开断线标志
-    ri->flags |= SRI_DISCONNECTED;
+    link->disconnected = 1;
 
     // 断开连接
     redisAsyncFree(c);
 }
 
+/* Drop the reference 'ri' holds on 'link'. The connections are closed when
+ * the last owner goes away, and NULL is returned. Otherwise the link is
+ * returned, and the replies of commands still pending on behalf of 'ri' are
+ * bound to sentinelDiscardReplyCallback(), since their privdata is about
+ * to be freed. */
+// 释放 instance 对连接的引用，引用计数为 0 时才真正断开连接
+instanceLink *releaseInstanceLink(instanceLink *link, sentinelRedisInstance *ri)
+{
+    redisAssert(link->refcount > 0);
+    link->refcount--;
+    if (link->refcount != 0) {
+        if (ri && link->cc) {
+            redisCallback *cb = link->cc->replies.head;
+
+            while(cb) {
+                if (cb->privdata == ri) {
+                    cb->fn = sentinelDiscardReplyCallback;
+                    cb->privdata = NULL;
+                }
+                cb = cb->next;
+            }
+        }
+        return link;
+    }
+
+    sentinelKillLink(link,link->cc);
+    sentinelKillLink(link,link->pc);
+    zfree(link);
+    return NULL;
+}
+
+/* Sentinels are tracked once per master they monitor. When 'ri' is a
+ * Sentinel we also know under another master, identified by run ID and
+ * address, drop the link of 'ri' and use the one of the other instance:
+ * every physical Sentinel is then reached with a single connection.
+ *
+ * Returns REDIS_OK if the link is now shared, REDIS_ERR otherwise. */
+// 如果其他 master 下已经有代表同一个 Sentinel 的 instance ，那么共用它的连接
+int sentinelTryConnectionSharing(sentinelRedisInstance *ri) {
+    dictIterator *di;
+    dictEntry *de;
+
+    redisAssert(ri->flags & SRI_SENTINEL);
+    if (ri->runid == NULL) return REDIS_ERR; /* No way to identify it. */
+    if (ri->link->refcount > 1) return REDIS_ERR; /* Already shared. */
+
+    di = dictGetIterator(sentinel.masters);
+    while((de = dictNext(di)) != NULL) {
+        sentinelRedisInstance *master = dictGetVal(de), *match;
+
+        if (master == ri->master) continue;
+        match = getSentinelRedisInstanceByAddrAndRunID(master->sentinels,
+                    ri->addr->ip,ri->addr->port,ri->runid);
+        if (match == NULL || match == ri || match->link == ri->link) continue;
+
+        releaseInstanceLink(ri->link,NULL);
+        ri->link = match->link;
+        match->link->refcount++;
+        dictReleaseIterator(di);
+        return REDIS_OK;
+    }
+    dictReleaseIterator(di);
+    return REDIS_ERR;
+}
+
 /* This function takes a hiredis context that is in an error condition
  * and make sure to mark the instance as disconnected performing the
  * cleanup needed.
@@ -2437,23 +2570,23 @@ void sentinelKillLink(sentinelRedisInstance *ri, redisAsyncContext *c) {
  * 这个函数没有手动释放连接，因为异步连接会自动释放
  */
 void sentinelDisconnectInstanceFromContext(const redisAsyncContext *c) {
-    sentinelRedisInstance *ri = c->data;
+    instanceLink *link = c->data;
     int pubsub;
 
-    if (ri == NULL) return; /* The instance no longer exists. */
+    if (link == NULL) return; /* The link no longer exists. */
 
     // 发送断线事件
-    pubsub = (ri->pc == c);
-    sentinelEvent(REDIS_DEBUG, pubsub ? "-pubsub-link" : "-cmd-link", ri,
-        "%@ #%s", c->errstr);
+    pubsub = (link->pc == c);
+    sentinelEvent(REDIS_DEBUG, pubsub ? "-pubsub-link" : "-cmd-link", NULL,
+        "#%s", c->errstr);
 
     if (pubsub)
-        ri->pc = NULL;
+        link->pc = NULL;
     else
-        ri->cc = NULL;
+        link->cc = NULL;
 
     // 打开标志
-    ri->flags |= SRI_DISCONNECTED;
+    link->disconnected = 1;
 }
 
 // 异步连接的连接回调函数
@@ -2463,12 +2596,12 @@ void sentinelLinkEstablishedCallback(const redisAsyncContext *c, int status) {
     if (status != REDIS_OK) {
         sentinelDisconnectInstanceFromContext(c);
     } else {
-        sentinelRedisInstance *ri = c->data;
-        int pubsub = (ri->pc == c);
+        instanceLink *link = c->data;
+        int pubsub = (link && link->pc == c);
 
         // 发送连接事件
-        sentinelEvent(REDIS_DEBUG, pubsub ? "+pubsub-link" : "+cmd-link", ri,
-            "%@");
+        sentinelEvent(REDIS_DEBUG, pubsub ? "+pubsub-link" : "+cmd-link", NULL,
+            "#connected");
     }
 }
 
@@ -2500,7 +2633,7 @@ void sentinelSendAuthIfNeeded(sentinelRedisInstance *ri, redisAsyncContext *c) {
     // 发送 AUTH 命令
     if (auth_pass) {
         if (redisAsyncCommand(c, sentinelDiscardReplyCallback, NULL, "AUTH %s",
-            auth_pass) == REDIS_OK) ri->pending_commands++;
+            auth_pass) == REDIS_OK) ri->link->pending_commands++;
     }
 }
 
@@ -2518,51 +2651,51 @@ void sentinelSetClientName(sentinelRedisInstance *ri, redisAsyncContext *c, char
     if (redisAsyncCommand(c, sentinelDiscardReplyCallback, NULL,
         "CLIENT SETNAME %s", name) == REDIS_OK)
     {
-        ri->pending_commands++;
+        ri->link->pending_commands++;
     }
 }
 
 /* Create the async connections for the specified instance if the instance
- * is disconnected. Note that the SRI_DISCONNECTED flag is set even if just
+ * is disconnected. Note that link->disconnected is true even if just
  * one of the two links (commands and pub/sub) is missing. */
 // 如果 sentinel 与 instance 处于断线（未连接）状态，那么创建连向 instance 的异步连接。
-// SRI_DISCONNECTED flag is set even if just one of the two links (commands and pub/sub) is missing.
+// link->disconnected is true even if just one of the two links (commands and pub/sub) is missing.
 // 每一个 sentinel 跟一个被监控的 master redis-server 之间，是会建立两个不同的连接的
 // 分别用于 sentinel handle CMD；sentinel subscribe information from redis-server
 void sentinelReconnectInstance(sentinelRedisInstance *ri) {
 
     // 示例未断线（已连接），返回
-    if (!(ri->flags & SRI_DISCONNECTED)) return;
+    if (!ri->link->disconnected) return;
 
     /* Commands connection. */
     // 对所有 instance 创建一个用于发送 Redis 命令的连接
     // TODO:(DONE) 对于 sentinel 跟 sentinel 之间会不会建立 command context ？ 会，不然怎么 PING、PONG 呢
-    if (ri->cc == NULL) {
+    if (ri->link->cc == NULL) {
 
         // 连接 instance （采用异步 connect 的方式，实现上现在并不知道是不是成功进行三次握手的）
-        ri->cc = redisAsyncConnect(ri->addr->ip,ri->addr->port);
+        ri->link->cc = redisAsyncConnect(ri->addr->ip,ri->addr->port);
 
         // 连接出错
-        if (ri->cc->err) {
+        if (ri->link->cc->err) {
             sentinelEvent(REDIS_DEBUG,"-cmd-link-reconnection",ri,"%@ #%s",
-                ri->cc->errstr);
-            sentinelKillLink(ri,ri->cc);
+                ri->link->cc->errstr);
+            sentinelKillLink(ri->link,ri->link->cc);
 
         // 连接成功（仅仅只是发起 connect 这个过程没有发生 error）
         } else {
             // 设置连接属性
-            ri->cc_conn_time = mstime();
-            ri->cc->data = ri;
-            redisAeAttach(server.el,ri->cc);
+            ri->link->cc_conn_time = mstime();
+            ri->link->cc->data = ri->link;
+            redisAeAttach(server.el,ri->link->cc);
             // 设置连线 callback(同时向 epoll-instance 注册 write 事件)
-            redisAsyncSetConnectCallback(ri->cc,
+            redisAsyncSetConnectCallback(ri->link->cc,
                                             sentinelLinkEstablishedCallback);
             // 设置断线 callback(这个一般是收到对端要求断开、连接 broken、本端主动断开)
-            redisAsyncSetDisconnectCallback(ri->cc,
+            redisAsyncSetDisconnectCallback(ri->link->cc,
                                             sentinelDisconnectCallback);
             // 发送 AUTH 命令，验证身份
-            sentinelSendAuthIfNeeded(ri,ri->cc);
-            sentinelSetClientName(ri,ri->cc,"cmd");
+            sentinelSendAuthIfNeeded(ri,ri->link->cc);
+            sentinelSetClientName(ri,ri->link->cc,"cmd");
 
             /* Send a PING ASAP when reconnecting. */
             sentinelSendPing(ri);
@@ -2572,36 +2705,36 @@ void sentinelReconnectInstance(sentinelRedisInstance *ri) {
     /* Pub / Sub */
     // 针对跟 sentinel 连接的 master、slave role redis-server，创建一个用于订阅频道的连接
     // 并不针对 sentinel 跟 sentinel 之间建立 pub\sub context 连接
-    if ((ri->flags & (SRI_MASTER|SRI_SLAVE)) && ri->pc == NULL) {
+    if ((ri->flags & (SRI_MASTER|SRI_SLAVE)) && ri->link->pc == NULL) {
 
         // 连接 instance 
-        ri->pc = redisAsyncConnect(ri->addr->ip,ri->addr->port);
+        ri->link->pc = redisAsyncConnect(ri->addr->ip,ri->addr->port);
 
         // 连接出错
-        if (ri->pc->err) {
+        if (ri->link->pc->err) {
             sentinelEvent(REDIS_DEBUG,"-pubsub-link-reconnection",ri,"%@ #%s",
-                ri->pc->errstr);
-            sentinelKillLink(ri,ri->pc);
+                ri->link->pc->errstr);
+            sentinelKillLink(ri->link,ri->link->pc);
 
         // 连接成功
         } else {
             int retval;
 
             // 设置连接属性
-            ri->pc_conn_time = mstime();
-            ri->pc->data = ri;
-            redisAeAttach(server.el,ri->pc);
+            ri->link->pc_conn_time = mstime();
+            ri->link->pc->data = ri->link;
+            redisAeAttach(server.el,ri->link->pc);
             // 设置连接 callback
-            redisAsyncSetConnectCallback(ri->pc,
+            redisAsyncSetConnectCallback(ri->link->pc,
                                             sentinelLinkEstablishedCallback);
             // 设置断线 callback
-            redisAsyncSetDisconnectCallback(ri->pc,
+            redisAsyncSetDisconnectCallback(ri->link->pc,
                                             sentinelDisconnectCallback);
             // 发送 AUTH 命令，验证身份
-            sentinelSendAuthIfNeeded(ri,ri->pc);
+            sentinelSendAuthIfNeeded(ri,ri->link->pc);
 
             // 为客户但设置名字 "pubsub"
-            sentinelSetClientName(ri,ri->pc,"pubsub");
+            sentinelSetClientName(ri,ri->link->pc,"pubsub");
 
             /* Now we subscribe to the Sentinels "Hello" channel. */
             // 发送 SUBSCRIBE __sentinel__:hello 命令，订阅频道
@@ -2612,15 +2745,15 @@ void sentinelReconnectInstance(sentinelRedisInstance *ri) {
              * 当另一个连接上了这个 master 的 sentinel 在接收到 hello 之后，发现这是一个自己所不知道的 sentinel
              * 就会尝试跟他建立连接（参考 sentinelReceiveHelloMessages() 函数）
              */
-            retval = redisAsyncCommand(ri->pc,
-                sentinelReceiveHelloMessages, NULL, "SUBSCRIBE %s",
+            retval = redisAsyncCommand(ri->link->pc,
+                sentinelReceiveHelloMessages, ri, "SUBSCRIBE %s",
                     SENTINEL_HELLO_CHANNEL);
             
             // 订阅出错，断开连接
             if (retval != REDIS_OK) {
                 /* If we can't subscribe, the Pub/Sub connection is useless
                  * and we can simply disconnect it and try again. */
-                sentinelKillLink(ri,ri->pc);
+                sentinelKillLink(ri->link,ri->link->pc);
                 return;
             }
         }
@@ -2630,8 +2763,8 @@ void sentinelReconnectInstance(sentinelRedisInstance *ri) {
      * (or just the commands connection if this is a sentinel instance). */
     // 如果 instance 是 master 或者 slave ，那么当 cc 和 pc 两个连接都创建成功时，关闭 DISCONNECTED 标识
     // 如果 instance 是 Sentinel ，那么当 cc 连接创建成功时，关闭 DISCONNECTED 标识
-    if (ri->cc && (ri->flags & SRI_SENTINEL || ri->pc))
-        ri->flags &= ~SRI_DISCONNECTED;
+    if (ri->link->cc && (ri->flags & SRI_SENTINEL || ri->link->pc))
+        ri->link->disconnected = 0;
 }
 
 /* ======================== Redis instances pinging  ======================== */
@@ -2881,9 +3014,8 @@ void sentinelRefreshInstanceInfo(sentinelRedisInstance *ri, const char *info) {
             // 设置 slave 的 master （已下线）的故障转移状态
             // 这个状态会让 slave 开始同步新的 master 
             // 剩下的交给 状态机 完成
-            ri->master->failover_state = SENTINEL_FAILOVER_STATE_RECONF_SLAVES;
-            // 更新 slave 的 master （已下线）的故障转移状态变更时间
-            ri->master->failover_state_change_time = mstime();
+            sentinelSetFailoverState(ri->master,
+                SENTINEL_FAILOVER_STATE_RECONF_SLAVES);
             // 将当前 Sentinel 状态保存到配置文件里面
             sentinelFlushConfig();
             // 发送事件
@@ -2992,34 +3124,43 @@ void sentinelRefreshInstanceInfo(sentinelRedisInstance *ri, const char *info) {
 
 // 处理 INFO 命令的回复
 void sentinelInfoReplyCallback(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    sentinelRedisInstance *ri = privdata;
+    instanceLink *link = c->data;
     redisReply *r;
 
-    if (ri) ri->pending_commands--;
-    if (!reply || !ri) return;
+    if (link) link->pending_commands--;
+    if (!reply || !link) return;
     r = reply;
 
     if (r->type == REDIS_REPLY_STRING) {
         sentinelRefreshInstanceInfo(ri,r->str);
+        // failover 期间 slave 的 INFO 可能让状态机前进
+        if ((ri->flags & SRI_SLAVE) &&
+            (ri->master->flags & SRI_FAILOVER_IN_PROGRESS))
+            sentinelFailoverProgress(ri->master);
+    } else if (r->type == REDIS_REPLY_ERROR && !(ri->flags & SRI_INFO_FULL)) {
+        /* Instances not accepting multiple INFO sections get plain INFO. */
+        ri->flags |= SRI_INFO_FULL;
     }
 }
 
 /* Just discard the reply. We use this when we are not monitoring the return
- * value of the command but its effects（ri->pending_commands--; 所谓的 effect 就是这个计数器自减） directly. */
+ * value of the command but its effects（ri->link->pending_commands--; 所谓的 effect 就是这个计数器自减） directly. */
 // 这个回调函数用于处理不需要检查回复的命令（只使用命令的副作用）
 void sentinelDiscardReplyCallback(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    instanceLink *link = c->data;
 
-    if (ri) ri->pending_commands--;
+    if (link) link->pending_commands--;
 }
 
 // 处理 PING 命令的回复
 void sentinelPingReplyCallback(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    sentinelRedisInstance *ri = privdata;
+    instanceLink *link = c->data;
     redisReply *r;
 
-    if (ri) ri->pending_commands--;
-    if (!reply || !ri) return;
+    if (link) link->pending_commands--;
+    if (!reply || !link) return;
     r = reply;
 
     if (r->type == REDIS_REPLY_STATUS ||
@@ -3033,8 +3174,8 @@ void sentinelPingReplyCallback(redisAsyncContext *c, void *reply, void *privdata
             strncmp(r->str,"MASTERDOWN",10) == 0)
         {
             //  instance 运作正常
-            ri->last_avail_time = mstime();
-            ri->last_ping_time = 0; /* Flag the pong as received. */
+            ri->link->last_avail_time = mstime();
+            ri->link->last_ping_time = 0; /* Flag the pong as received. */
             // PING-PONG 的丢失，将会在 sentinelCheckSubjectivelyDown() 发生作用，进而引发 failover
         } else {
 
@@ -3048,28 +3189,29 @@ void sentinelPingReplyCallback(redisAsyncContext *c, void *reply, void *privdata
                 (ri->flags & SRI_S_DOWN) &&
                 !(ri->flags & SRI_SCRIPT_KILL_SENT))
             {
-                if (redisAsyncCommand(ri->cc,
+                if (redisAsyncCommand(ri->link->cc,
                         sentinelDiscardReplyCallback, NULL,
                         "SCRIPT KILL") == REDIS_OK)
-                    ri->pending_commands++;
+                    ri->link->pending_commands++;
                 ri->flags |= SRI_SCRIPT_KILL_SENT;
             }
         }
     }
 
     // 更新 instance 最后一次回复 PING 命令的时间
-    ri->last_pong_time = mstime();
+    ri->link->last_pong_time = mstime();
 }
 
 /* This is called when we get the reply about the PUBLISH command we send
  * to the master to advertise this sentinel. */
 // 处理 PUBLISH 命令的回复
 void sentinelPublishReplyCallback(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    sentinelRedisInstance *ri = privdata;
+    instanceLink *link = c->data;
     redisReply *r;
 
-    if (ri) ri->pending_commands--;
-    if (!reply || !ri) return;
+    if (link) link->pending_commands--;
+    if (!reply || !link) return;
     r = reply;
 
     /* Only update pub_time if we actually published our message. Otherwise
@@ -3146,6 +3288,7 @@ void sentinelProcessHelloMessage(char *hello, int hello_len) {
                  * for Sentinels we don't have a later chance to fill it,
                  * so do it now. */
                 si->runid = sdsnew(token[2]);
+                sentinelTryConnectionSharing(si);
                 sentinelFlushConfig();
             }
         }
@@ -3202,17 +3345,18 @@ cleanup:
 // 此回调函数用于处理 Hello 频道的返回值，它可以发现其他正在订阅同一 master 的 Sentinel
 // （因为 master 充当了广播站的中转站，将所有的 sentinel 发出的 hello 都广播出去给其他的 sentinel）
 void sentinelReceiveHelloMessages(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    sentinelRedisInstance *ri = privdata;
+    instanceLink *link = c->data;
     redisReply *r;  // 从 redisGetReply() 中解析出来的
 
-    if (!reply || !ri) return;
+    if (!reply || !link) return;
     r = reply;
 
     /* Update the last activity in the pubsub channel. Note that since we
      * receive our messages as well this timestamp can be used to detect
      * if the link is probably disconnected even if it seems otherwise. */
     // 更新最后一次接收频道命令的时间
-    ri->pc_last_activity = mstime();
+    ri->link->pc_last_activity = mstime();
    
     /* Sanity check in the reply we expect, so that the code that follows
      * can avoid to check for details. */
@@ -3269,8 +3413,8 @@ int sentinelSendHello(sentinelRedisInstance *ri) {
 
     /* Try to obtain our own IP address. */
     // 获取 instance 自身的地址
-    if (anetSockName(ri->cc->c.fd,ip,sizeof(ip),NULL) == -1) return REDIS_ERR;
-    if (ri->flags & SRI_DISCONNECTED) return REDIS_ERR;
+    if (ri->link->disconnected) return REDIS_ERR;
+    if (anetSockName(ri->link->cc->c.fd,ip,sizeof(ip),NULL) == -1) return REDIS_ERR;
 
     /* Format and send the Hello message. */
     // 格式化信息
@@ -3284,13 +3428,13 @@ int sentinelSendHello(sentinelRedisInstance *ri) {
         (unsigned long long) master->config_epoch);
     
     // 发送信息
-    retval = redisAsyncCommand(ri->cc,
-        sentinelPublishReplyCallback, NULL, "PUBLISH %s %s",
+    retval = redisAsyncCommand(ri->link->cc,
+        sentinelPublishReplyCallback, ri, "PUBLISH %s %s",
             SENTINEL_HELLO_CHANNEL,payload);
 
     if (retval != REDIS_OK) return REDIS_ERR;
 
-    ri->pending_commands++;
+    ri->link->pending_commands++;
 
     return REDIS_OK;
 }
@@ -3302,14 +3446,14 @@ int sentinelSendHello(sentinelRedisInstance *ri) {
  * queued in the connection. */
 // 向指定的 Sentinel 发送 PING 命令。
 int sentinelSendPing(sentinelRedisInstance *ri) {
-    int retval = redisAsyncCommand(ri->cc,
-        sentinelPingReplyCallback, NULL, "PING");
+    int retval = redisAsyncCommand(ri->link->cc,
+        sentinelPingReplyCallback, ri, "PING");
     if (retval == REDIS_OK) {
-        ri->pending_commands++;
+        ri->link->pending_commands++;
         /* We update the ping time only if we received the pong for
          * the previous ping, otherwise we are technically waiting
          * since the first ping that did not received a reply. */
-        if (ri->last_ping_time == 0) ri->last_ping_time = mstime();
+        if (ri->link->last_ping_time == 0) ri->link->last_ping_time = mstime();
         return 1;
     } else {
         return 0;
@@ -3327,7 +3471,7 @@ void sentinelSendPeriodicCommands(sentinelRedisInstance *ri) {
     /* Return ASAP if we have already a PING or INFO already pending, or
      * in the case the instance is not properly connected. */
     // 函数不能在网络连接未创建时执行
-    if (ri->flags & SRI_DISCONNECTED) return;
+    if (ri->link->disconnected) return;
 
     /* For INFO, PING, PUBLISH that are not critical commands to send we
      * also have a limit of SENTINEL_MAX_PENDING_COMMANDS. We don't
@@ -3338,7 +3482,9 @@ void sentinelSendPeriodicCommands(sentinelRedisInstance *ri) {
     // 为了避免 sentinel 在 instance 处于不正常状态时，发送过多命令
     // sentinel 只在待发送命令的数量未超过 SENTINEL_MAX_PENDING_COMMANDS 常量时
     // 才进行命令发送
-    if (ri->pending_commands >= SENTINEL_MAX_PENDING_COMMANDS) return;
+    // 共享连接的场合，按照共享 instance 的数量放宽限制
+    if (ri->link->pending_commands >=
+        SENTINEL_MAX_PENDING_COMMANDS * ri->link->refcount) return;
 
     /* If this is a slave of a master in O_DOWN condition we start sending
      * it INFO every second, instead of the usual SENTINEL_INFO_PERIOD
@@ -3350,18 +3496,21 @@ void sentinelSendPeriodicCommands(sentinelRedisInstance *ri) {
     // 以辅助 sentinel 判断每一个 slave 的状态, 选出更好的 new master
     // TODO:(DONE) this case; 当 sentinel 们正在进行 failover 的时候, 需要更新鲜的 slave 信息, 才能够更好提拔 slave 为 new master
     // 变更 sentinel 向 slave 发送 INFO 请求的频率
+    // 等待 promoted slave 变为 master 时，INFO 的频率与 ping-period 相同
     if ((ri->flags & SRI_SLAVE) &&
         (ri->master->flags & (SRI_O_DOWN|SRI_FAILOVER_IN_PROGRESS))) {
         info_period = 1000;
+        if ((ri->flags & SRI_PROMOTED) && ri->ping_period < info_period)
+            info_period = ri->ping_period;
     } else {
         info_period = SENTINEL_INFO_PERIOD;
     }
     /* We ping instances every time the last received pong is older than
-     * the configured 'down-after-milliseconds' time, but every second
-     * anyway if 'down-after-milliseconds' is greater than 1 second. */
+     * the configured 'down-after-milliseconds' time, but at least every
+     * 'ping-period' milliseconds (one second by default). */
     // TODO: this case
     ping_period = ri->down_after_period;
-    if (ping_period > SENTINEL_PING_PERIOD) ping_period = SENTINEL_PING_PERIOD;
+    if (ping_period > ri->ping_period) ping_period = ri->ping_period;
 
     //  instance 不是 Sentinel （ master 或者 slave ）
     // 并且以下条件的其中一个成立：
@@ -3379,10 +3528,15 @@ void sentinelSendPeriodicCommands(sentinelRedisInstance *ri) {
     {
         /* Send INFO to masters and slaves, not sentinels. */
         // 没错, slave 也会被发送 INFO CMD 的,这样才能获取每一个 slave 的信息, 这样才能在 failover 的时候, 抉择哪一个 slave 作为新的 master 更适合
-        retval = redisAsyncCommand(ri->cc,
-            sentinelInfoReplyCallback, NULL, "INFO");
-        if (retval == REDIS_OK) ri->pending_commands++;
-    } else if ((now - ri->last_pong_time) > ping_period) {
+        // 只请求 sentinel 用得上的 section ，旧版本不支持时退回完整的 INFO
+        if (ri->flags & SRI_INFO_FULL)
+            retval = redisAsyncCommand(ri->link->cc,
+                sentinelInfoReplyCallback, ri, "INFO");
+        else
+            retval = redisAsyncCommand(ri->link->cc,
+                sentinelInfoReplyCallback, ri, "INFO server replication");
+        if (retval == REDIS_OK) ri->link->pending_commands++;
+    } else if ((now - ri->link->last_pong_time) > ping_period) {
         /* Send PING to all the three kinds of instances. */
         sentinelSendPing(ri);
     } else if ((now - ri->last_pub_time) > SENTINEL_PUBLISH_PERIOD) {
@@ -3447,7 +3601,7 @@ void addReplySentinelRedisInstance(redisClient *c, sentinelRedisInstance *ri) {
     if (ri->flags & SRI_MASTER) flags = sdscat(flags,"master,");
     if (ri->flags & SRI_SLAVE) flags = sdscat(flags,"slave,");
     if (ri->flags & SRI_SENTINEL) flags = sdscat(flags,"sentinel,");
-    if (ri->flags & SRI_DISCONNECTED) flags = sdscat(flags,"disconnected,");
+    if (ri->link->disconnected) flags = sdscat(flags,"disconnected,");
     if (ri->flags & SRI_MASTER_DOWN) flags = sdscat(flags,"master_down,");
     if (ri->flags & SRI_FAILOVER_IN_PROGRESS)
         flags = sdscat(flags,"failover_in_progress,");
@@ -3462,7 +3616,11 @@ void addReplySentinelRedisInstance(redisClient *c, sentinelRedisInstance *ri) {
     fields++;
 
     addReplyBulkCString(c,"pending-commands");
-    addReplyBulkLongLong(c,ri->pending_commands);
+    addReplyBulkLongLong(c,ri->link->pending_commands);
+    fields++;
+
+    addReplyBulkCString(c,"link-refcount");
+    addReplyBulkLongLong(c,ri->link->refcount);
     fields++;
 
     if (ri->flags & SRI_FAILOVER_IN_PROGRESS) {
@@ -3473,15 +3631,15 @@ void addReplySentinelRedisInstance(redisClient *c, sentinelRedisInstance *ri) {
 
     addReplyBulkCString(c,"last-ping-sent");
     addReplyBulkLongLong(c,
-        ri->last_ping_time ? (mstime() - ri->last_ping_time) : 0);
+        ri->link->last_ping_time ? (mstime() - ri->link->last_ping_time) : 0);
     fields++;
 
     addReplyBulkCString(c,"last-ok-ping-reply");
-    addReplyBulkLongLong(c,mstime() - ri->last_avail_time);
+    addReplyBulkLongLong(c,mstime() - ri->link->last_avail_time);
     fields++;
 
     addReplyBulkCString(c,"last-ping-reply");
-    addReplyBulkLongLong(c,mstime() - ri->last_pong_time);
+    addReplyBulkLongLong(c,mstime() - ri->link->last_pong_time);
     fields++;
 
     if (ri->flags & SRI_S_DOWN) {
@@ -3500,6 +3658,10 @@ void addReplySentinelRedisInstance(redisClient *c, sentinelRedisInstance *ri) {
     addReplyBulkLongLong(c,ri->down_after_period);
     fields++;
 
+    addReplyBulkCString(c,"ping-period");
+    addReplyBulkLongLong(c,ri->ping_period);
+    fields++;
+
     /* Masters and Slaves */
     if (ri->flags & (SRI_MASTER|SRI_SLAVE)) {
         addReplyBulkCString(c,"info-refresh");
@@ -3725,7 +3887,7 @@ void sentinelCommand(redisClient *c) {
         if (c->argc != 3) goto numargserr;
         ri = sentinelGetMasterByName(c->argv[2]->ptr);
         if (ri == NULL) {
-            addReply(c,shared.nullmultibulk);
+            addReplyNullArray(c);
         } else {
             sentinelAddr *addr = sentinelGetCurrentMasterAddress(ri);
 
@@ -3903,7 +4065,15 @@ void sentinelSetCommand(redisClient *c) {
             if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll <= 0)
                 goto badfmt;
             ri->down_after_period = ll;
-            sentinelPropagateDownAfterPeriod(ri);
+            sentinelPropagatePeriods(ri);
+            changes++;
+        } else if (!strcasecmp(option,"ping-period")) {
+            /* ping-period <milliseconds> */
+            if (getLongLongFromObject(o,&ll) == REDIS_ERR ||
+                ll < SENTINEL_MIN_PING_PERIOD)
+                goto badfmt;
+            ri->ping_period = ll;
+            sentinelPropagatePeriods(ri);
             changes++;
         } else if (!strcasecmp(option,"failover-timeout")) {
             /* failover-timeout <milliseconds> */
@@ -3993,8 +4163,8 @@ void sentinelCheckSubjectivelyDown(sentinelRedisInstance *ri) {
 
     mstime_t elapsed = 0;
 
-    if (ri->last_ping_time) // 说明有 ping 没有回；要是是有的 ping 都被 pong 了的话，这个会被 reset to 0
-        elapsed = mstime() - ri->last_ping_time;
+    if (ri->link->last_ping_time) // 说明有 ping 没有回；要是是有的 ping 都被 pong 了的话，这个会被 reset to 0
+        elapsed = mstime() - ri->link->last_ping_time;
 
     /* Check if we are in need for a reconnection of one of the 
      * links, because we are detecting low activity.
@@ -4005,16 +4175,16 @@ void sentinelCheckSubjectivelyDown(sentinelRedisInstance *ri) {
      *    than SENTINEL_MIN_LINK_RECONNECT_PERIOD, but still we have a
      *    pending ping for more than half the timeout. */
     // 考虑断开 instance 的 cc 连接
-    if (ri->cc 
-        && (mstime() - ri->cc_conn_time) > SENTINEL_MIN_LINK_RECONNECT_PERIOD // 控制发起重连的频率（针对网络 flap 的情况）
-        && ri->last_ping_time != 0 /* Ther is a pending ping... */
+    if (ri->link->cc 
+        && (mstime() - ri->link->cc_conn_time) > SENTINEL_MIN_LINK_RECONNECT_PERIOD // 控制发起重连的频率（针对网络 flap 的情况）
+        && ri->link->last_ping_time != 0 /* Ther is a pending ping... */
         /* The pending ping is delayed, and we did not received
          * error replies as well. */
-        && (mstime() - ri->last_ping_time) > (ri->down_after_period/2)
-        && (mstime() - ri->last_pong_time) > (ri->down_after_period/2))
+        && (mstime() - ri->link->last_ping_time) > (ri->down_after_period/2)
+        && (mstime() - ri->link->last_pong_time) > (ri->down_after_period/2))
         
     {
-        sentinelKillLink(ri,ri->cc);
+        sentinelKillLink(ri->link,ri->link->cc);
     }
 
     /* 2) Check if the pubsub link seems connected, was connected not less
@@ -4023,11 +4193,11 @@ void sentinelCheckSubjectivelyDown(sentinelRedisInstance *ri) {
      *    SENTINEL_PUBLISH_PERIOD * 3.
      */
     // 考虑断开 instance 的 pc 连接
-    if (ri->pc &&
-        (mstime() - ri->pc_conn_time) > SENTINEL_MIN_LINK_RECONNECT_PERIOD &&
-        (mstime() - ri->pc_last_activity) > (SENTINEL_PUBLISH_PERIOD*3))
+    if (ri->link->pc &&
+        (mstime() - ri->link->pc_conn_time) > SENTINEL_MIN_LINK_RECONNECT_PERIOD &&
+        (mstime() - ri->link->pc_last_activity) > (SENTINEL_PUBLISH_PERIOD*3))
     {
-        sentinelKillLink(ri,ri->pc);
+        sentinelKillLink(ri->link,ri->link->pc);
     }
 
     /* Update the SDOWN flag. We believe the instance is SDOWN if:
@@ -4163,11 +4333,12 @@ void sentinelCheckObjectivelyDown(sentinelRedisInstance *master) {
  * 3) (integer) 0   // leader_epoch
 */
 void sentinelReceiveIsMasterDownReply(redisAsyncContext *c, void *reply, void *privdata) {
-    sentinelRedisInstance *ri = c->data;
+    sentinelRedisInstance *ri = privdata;
+    instanceLink *link = c->data;
     redisReply *r;
 
-    if (ri) ri->pending_commands--;
-    if (!reply || !ri) return;
+    if (link) link->pending_commands--;
+    if (!reply || !link) return;
     r = reply;
 
     /* Ignore every error or unexpected reply.
@@ -4207,6 +4378,9 @@ void sentinelReceiveIsMasterDownReply(redisAsyncContext *c, void *reply, void *p
             ri->leader = sdsnew(r->element[1]->str);
             ri->leader_epoch = r->element[2]->integer;
         }
+
+        // 新的意见或者投票可能让 master 进入 ODOWN 或者选出 leader
+        sentinelFailoverProgress(ri->master);
     }
 }
 
@@ -4259,17 +4433,19 @@ void sentinelAskMasterStateToOtherSentinels(sentinelRedisInstance *master, int f
         
         // 都没初始化好，也没法问，直接跳过。
         // TODO: 不会造成投票、ODOWN 失误吗？这是要通过你创建 sentinel 的数量 + quorum 来确保的
-        if (ri->flags & SRI_DISCONNECTED) continue;
+        if (ri->link->disconnected) continue;
         // 不是 SENTINEL_ASK_FORCED 这种必须要立即发送的情况时，会减少发送频率，到了 SENTINEL_ASK_PERIOD 才周期性问一下
         if (!(flags & SENTINEL_ASK_FORCED) &&
-            mstime() - ri->last_master_down_reply_time < SENTINEL_ASK_PERIOD)
+            mstime() - ri->last_master_down_reply_time <
+                (master->ping_period < SENTINEL_ASK_PERIOD ?
+                 master->ping_period : SENTINEL_ASK_PERIOD))
             continue;
 
         /* Ask */
         // 发送其他 SENTINEL is-master-down-by-addr 命令，询问他们对于 master x.x.x.x:port 的看法
         ll2string(port,sizeof(port),master->addr->port);
-        retval = redisAsyncCommand(ri->cc,  // sentinel 跟 sentinel 之间必定有 command context
-                    sentinelReceiveIsMasterDownReply, NULL,
+        retval = redisAsyncCommand(ri->link->cc,  // sentinel 跟 sentinel 之间必定有 command context
+                    sentinelReceiveIsMasterDownReply, ri,
                     "SENTINEL is-master-down-by-addr %s %s %llu %s",
                     master->addr->ip, port,
                     sentinel.current_epoch,
@@ -4281,7 +4457,7 @@ void sentinelAskMasterStateToOtherSentinels(sentinelRedisInstance *master, int f
                     // TODO:（DONE） 发 runid 跟不发 runid 分别是什么情况？
                     // 发 runid 就是想要别人投票选自己作为 leader sentinel
                     // 不发 runid，就是单纯的想问一下其他 sentinel 是不是也觉得这个 master SDOWN 了
-        if (retval == REDIS_OK) ri->pending_commands++;
+        if (retval == REDIS_OK) ri->link->pending_commands++;
     }
     dictReleaseIterator(di);
 }
@@ -4513,29 +4689,45 @@ int sentinelSendSlaveOf(sentinelRedisInstance *ri, char *host, int port) {
     }
 
     // 发送 SLAVEOF NO ONE
-    retval = redisAsyncCommand(ri->cc,
+    retval = redisAsyncCommand(ri->link->cc,
         sentinelDiscardReplyCallback, NULL, "SLAVEOF %s %s", host, portstr);
     if (retval == REDIS_ERR) return retval;
 
-    ri->pending_commands++;
+    ri->link->pending_commands++;
 
     // 发送 CONFIG REWRITE
-    if (redisAsyncCommand(ri->cc,
+    if (redisAsyncCommand(ri->link->cc,
         sentinelDiscardReplyCallback, NULL, "CONFIG REWRITE") == REDIS_OK)
     {
-        ri->pending_commands++;
+        ri->link->pending_commands++;
     }
 
     return REDIS_OK;
 }
 
+/* Move the failover of 'master' to 'state', remembering when every phase
+ * started so that the end of the failover can report how long each of them
+ * took, see sentinelReportFailoverTiming(). */
+// 更新故障转移状态，并记录每个阶段的开始时间
+void sentinelSetFailoverState(sentinelRedisInstance *master, int state) {
+    mstime_t now = mstime();
+
+    if (state == SENTINEL_FAILOVER_STATE_WAIT_START)
+        memset(master->failover_phase_time,0,
+               sizeof(master->failover_phase_time));
+    master->failover_state = state;
+    master->failover_state_change_time = now;
+    if (state != SENTINEL_FAILOVER_STATE_NONE)
+        master->failover_phase_time[state] = now;
+}
+
 /* Setup the master state to start a failover. */
 // 设置 master 的状态，开始一次故障转移
 void sentinelStartFailover(sentinelRedisInstance *master) {
     redisAssert(master->flags & SRI_MASTER);
 
     // 更新故障转移状态
-    master->failover_state = SENTINEL_FAILOVER_STATE_WAIT_START;
+    sentinelSetFailoverState(master,SENTINEL_FAILOVER_STATE_WAIT_START);
 
     // 更新 master 状态
     master->flags |= SRI_FAILOVER_IN_PROGRESS;
@@ -4550,7 +4742,6 @@ void sentinelStartFailover(sentinelRedisInstance *master) {
 
     // 记录故障转移状态的变更时间
     master->failover_start_time = mstime()+rand()%SENTINEL_MAX_DESYNC;
-    master->failover_state_change_time = mstime();
 }
 
 /* This function checks if there are the conditions to start the failover,
@@ -4757,8 +4948,9 @@ sentinelRedisInstance *sentinelSelectSlave(sentinelRedisInstance *master) {
         mstime_t info_validity_time;
 
         // 忽略所有 SDOWN 、ODOWN 或者已断线的 slave 
-        if (slave->flags & (SRI_S_DOWN|SRI_O_DOWN|SRI_DISCONNECTED)) continue;
-        if (mstime() - slave->last_avail_time > SENTINEL_PING_PERIOD*5) continue;
+        if (slave->flags & (SRI_S_DOWN|SRI_O_DOWN)) continue;
+        if (slave->link->disconnected) continue;
+        if (mstime() - slave->link->last_avail_time > SENTINEL_PING_PERIOD*5) continue;
         if (slave->slave_priority == 0) continue;
 
         /* If the master is in SDOWN state we get INFO for slaves every second.
@@ -4845,8 +5037,7 @@ void sentinelFailoverWaitStart(sentinelRedisInstance *ri) {
     sentinelEvent(REDIS_WARNING,"+elected-leader",ri,"%@");
 
     // 进入选择 slave 状态
-    ri->failover_state = SENTINEL_FAILOVER_STATE_SELECT_SLAVE;  // 下一个 sentinel cron 的时候,才会再次进入状态机里面
-    ri->failover_state_change_time = mstime();
+    sentinelSetFailoverState(ri,SENTINEL_FAILOVER_STATE_SELECT_SLAVE);
 
     sentinelEvent(REDIS_WARNING,"+failover-state-select-slave",ri,"%@");
 }
@@ -4881,11 +5072,9 @@ void sentinelFailoverSelectSlave(sentinelRedisInstance *ri) {
         // 记录被选中的 slave 
         ri->promoted_slave = slave;
 
-        // 更新故障转移状态
-        ri->failover_state = SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE;
-
-        // 更新状态改变时间
-        ri->failover_state_change_time = mstime();
+        // 更新故障转移状态以及状态改变时间
+        sentinelSetFailoverState(ri,
+            SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE);
 
         // 发送事件
         sentinelEvent(REDIS_NOTICE,"+failover-state-send-slaveof-noone",
@@ -4906,7 +5095,7 @@ void sentinelFailoverSendSlaveOfNoOne(sentinelRedisInstance *ri) {
     // （一般来说出现这种情况的机会很小，因为在选择新的 master 时，
     // 已经断线的 slave 是不会被选中的，所以这种情况只会出现在
     //  slave 被选中，并且发送 SLAVEOF NO ONE 命令之前的这段时间内）
-    if (ri->promoted_slave->flags & SRI_DISCONNECTED) {
+    if (ri->promoted_slave->link->disconnected) {
 
         // 如果超过时限，就不再重试
         if (mstime() - ri->failover_state_change_time > ri->failover_timeout) {
@@ -4934,10 +5123,7 @@ void sentinelFailoverSendSlaveOfNoOne(sentinelRedisInstance *ri) {
 
     // 更新状态
     // 这个状态会让 Sentinel 等待被选中的 slave 升级为 master 
-    ri->failover_state = SENTINEL_FAILOVER_STATE_WAIT_PROMOTION;
-
-    // 更新状态改变的时间
-    ri->failover_state_change_time = mstime();
+    sentinelSetFailoverState(ri,SENTINEL_FAILOVER_STATE_WAIT_PROMOTION);
 }
 
 /* We actually wait for promotion indirectly checking with INFO when the
@@ -5003,9 +5189,8 @@ void sentinelFailoverDetectEnd(sentinelRedisInstance *master) {
         sentinelEvent(REDIS_WARNING,"+failover-end",master,"%@");
         // 更新故障转移状态
         // 这一状态将告知 Sentinel ，所有 slave 都已经同步到新 master 
-        master->failover_state = SENTINEL_FAILOVER_STATE_UPDATE_CONFIG;
-        // 更新状态改变的时间
-        master->failover_state_change_time = mstime();
+        sentinelSetFailoverState(master,
+            SENTINEL_FAILOVER_STATE_UPDATE_CONFIG);
     }
 
     /* If I'm the leader it is a good idea to send a best effort SLAVEOF
@@ -5022,8 +5207,8 @@ void sentinelFailoverDetectEnd(sentinelRedisInstance *master) {
             int retval;
 
             // 跳过已发送 SLAVEOF 命令，以及已经完成同步的所有 slave 
-            if (slave->flags &
-                (SRI_RECONF_DONE|SRI_RECONF_SENT|SRI_DISCONNECTED)) continue;
+            if (slave->flags & (SRI_RECONF_DONE|SRI_RECONF_SENT) ||
+                slave->link->disconnected) continue;
 
             // 发送命令
             retval = sentinelSendSlaveOf(slave,
@@ -5091,7 +5276,8 @@ void sentinelFailoverReconfNextSlave(sentinelRedisInstance *master) {   // NOTE:
          * in RECONF_SENT state. */
         // 如果已向 slave 发送 SLAVEOF 命令，或者同步正在进行
         // 又或者 slave 已断线，那么略过该服务器
-        if (slave->flags & (SRI_DISCONNECTED|SRI_RECONF_SENT|SRI_RECONF_INPROG))
+        if (slave->flags & (SRI_RECONF_SENT|SRI_RECONF_INPROG) ||
+            slave->link->disconnected)
             continue;
 
         /* Send SLAVEOF <new master>. */
@@ -5130,6 +5316,10 @@ void sentinelFailoverSwitchToPromotedSlave(sentinelRedisInstance *master) {
     sentinelRedisInstance *ref = master->promoted_slave ?
                                  master->promoted_slave : master;
 
+    // 报告故障转移各阶段的耗时
+    if (master->flags & SRI_FAILOVER_IN_PROGRESS)
+        sentinelReportFailoverTiming(master);
+
     // 发送更新 master 事件
     sentinelEvent(REDIS_WARNING,"+switch-master",master,"%s %s %d %s %d",
         // 原 master 信息
@@ -5141,46 +5331,109 @@ void sentinelFailoverSwitchToPromotedSlave(sentinelRedisInstance *master) {
     sentinelResetMasterAndChangeAddress(master,ref->addr->ip,ref->addr->port);
 }
 
-// 执行故障转移(状态机切换), 每次的状态轮转,都要等一次 sentinel timer 的 cron 调度
+// 执行故障转移(状态机切换), 状态完成后立即进入下一个状态，等待回复的状态则由回复或 sentinel timer 推进
 void sentinelFailoverStateMachine(sentinelRedisInstance *ri) {
     redisAssert(ri->flags & SRI_MASTER);
+    int prev_state;
     // ri 只会是，也只能是旧 master
     // 新的 master, 即将被 promote 的 slave 会记录在 master->promoted_slave 里面
 
     // master 未进入故障转移状态，直接返回
     if (!(ri->flags & SRI_FAILOVER_IN_PROGRESS)) return;
 
-    switch(ri->failover_state) {
-
-        // 等待故障转移开始
-        case SENTINEL_FAILOVER_STATE_WAIT_START:
-            sentinelFailoverWaitStart(ri);
-            break;
+    /* Every step that completes moves to the next one right away instead
+     * of waiting for the next sentinelTimer() call: states only waiting
+     * for replies leave the state unchanged, which ends the loop. */
+    // 状态发生变化时立即执行下一个状态，不再等待下一次 sentinel timer
+    do {
+        prev_state = ri->failover_state;
+        switch(ri->failover_state) {
+
+            // 等待故障转移开始
+            case SENTINEL_FAILOVER_STATE_WAIT_START:
+                sentinelFailoverWaitStart(ri);
+                break;
 
-        // 选择新 master 
-        case SENTINEL_FAILOVER_STATE_SELECT_SLAVE:
-            sentinelFailoverSelectSlave(ri);
-            break;
+            // 选择新 master 
+            case SENTINEL_FAILOVER_STATE_SELECT_SLAVE:
+                sentinelFailoverSelectSlave(ri);
+                break;
         
-        // 升级被选中的 slave 为新 master 
-        case SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE:
-            sentinelFailoverSendSlaveOfNoOne(ri);
-            break;
+            // 升级被选中的 slave 为新 master 
+            case SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE:
+                sentinelFailoverSendSlaveOfNoOne(ri);
+                break;
 
-        // TODO:(DONE) 升级超时了怎么办? leader sentinel 在很多地方都有做超时检查，
-        // 一旦超时，旧直接 abort failover，然后其他 sentinel 超时后，
-        // 就会更新 epoch，然后发起新一轮的选举，新一轮的 failvoer
-        // 等待升级生效，如果升级超时，那么重新选择新 master 
-        // 具体情况请看 sentinelRefreshInstanceInfo() 函数
-        case SENTINEL_FAILOVER_STATE_WAIT_PROMOTION:
-            sentinelFailoverWaitPromotion(ri);
-            break;
+            // TODO:(DONE) 升级超时了怎么办? leader sentinel 在很多地方都有做超时检查，
+            // 一旦超时，旧直接 abort failover，然后其他 sentinel 超时后，
+            // 就会更新 epoch，然后发起新一轮的选举，新一轮的 failvoer
+            // 等待升级生效，如果升级超时，那么重新选择新 master 
+            // 具体情况请看 sentinelRefreshInstanceInfo() 函数
+            case SENTINEL_FAILOVER_STATE_WAIT_PROMOTION:
+                sentinelFailoverWaitPromotion(ri);
+                break;
 
-        // 向 slave 发送 SLAVEOF 命令，让它们同步新 master 
-        case SENTINEL_FAILOVER_STATE_RECONF_SLAVES:
-            sentinelFailoverReconfNextSlave(ri);
-            break;
+            // 向 slave 发送 SLAVEOF 命令，让它们同步新 master 
+            case SENTINEL_FAILOVER_STATE_RECONF_SLAVES:
+                sentinelFailoverReconfNextSlave(ri);
+                break;
+        }
+    } while ((ri->flags & SRI_FAILOVER_IN_PROGRESS) &&
+             ri->failover_state != prev_state);
+}
+
+/* Called from the reply callbacks that may let the failover of 'master'
+ * move forward (votes and SDOWN opinions of other Sentinels, INFO of the
+ * slaves during the failover), so that the next step is taken as soon as
+ * the reply arrives and not at the next sentinelTimer() call.
+ *
+ * Switching to the promoted slave is still left to the timer, since it
+ * releases the slave instances whose replies we may be processing. */
+// 收到可能推进故障转移的回复时，立即执行检测和状态机，而不是等待 sentinel timer
+void sentinelFailoverProgress(sentinelRedisInstance *master) {
+    if (sentinel.tilt) return;
+
+    if (master->flags & SRI_S_DOWN) {
+        sentinelCheckObjectivelyDown(master);
+        if (sentinelStartFailoverIfNeeded(master))
+            sentinelAskMasterStateToOtherSentinels(master,SENTINEL_ASK_FORCED);
     }
+    sentinelFailoverStateMachine(master);
+}
+
+/* Log a +failover-timing event with the milliseconds spent in every phase
+ * of the failover of 'master' this Sentinel just completed as leader. A
+ * phase that was not traversed is reported as -1.
+ *
+ * detect:  master SDOWN -> failover started (ODOWN reached)
+ * elect:   failover started -> leader elected
+ * select:  leader elected -> slave selected
+ * promote: slave selected -> slave reported the master role
+ * reconf:  slave promoted -> all the slaves reconfigured
+ * total:   master SDOWN (or failover start if forced) -> now */
+void sentinelReportFailoverTiming(sentinelRedisInstance *master) {
+    mstime_t *t = master->failover_phase_time, now = mstime();
+    mstime_t start = t[SENTINEL_FAILOVER_STATE_WAIT_START], origin = start;
+
+#define PHASE_TIME(a,b) ((t[a] && t[b]) ? (long long)(t[b]-t[a]) : -1LL)
+    if (start == 0) return;
+    if (master->s_down_since_time && master->s_down_since_time <= start)
+        origin = master->s_down_since_time;
+
+    sentinelEvent(REDIS_WARNING,"+failover-timing",master,
+        "%@ detect %lld elect %lld select %lld promote %lld reconf %lld "
+        "total %lld",
+        (long long)(start-origin),
+        PHASE_TIME(SENTINEL_FAILOVER_STATE_WAIT_START,
+                   SENTINEL_FAILOVER_STATE_SELECT_SLAVE),
+        PHASE_TIME(SENTINEL_FAILOVER_STATE_SELECT_SLAVE,
+                   SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE),
+        PHASE_TIME(SENTINEL_FAILOVER_STATE_SEND_SLAVEOF_NOONE,
+                   SENTINEL_FAILOVER_STATE_RECONF_SLAVES),
+        PHASE_TIME(SENTINEL_FAILOVER_STATE_RECONF_SLAVES,
+                   SENTINEL_FAILOVER_STATE_UPDATE_CONFIG),
+        (long long)(now-origin));
+#undef PHASE_TIME
 }
 
 /* Abort a failover in progress:
@@ -5203,8 +5456,7 @@ void sentinelAbortFailover(sentinelRedisInstance *ri) {
     ri->flags &= ~(SRI_FAILOVER_IN_PROGRESS|SRI_FORCE_FAILOVER);
 
     // 清除状态, ODOWN 还是在, 下一轮 cron 会再次发起的, sentinelStartFailoverIfNeeded() 里面
-    ri->failover_state = SENTINEL_FAILOVER_STATE_NONE;
-    ri->failover_state_change_time = mstime();
+    sentinelSetFailoverState(ri,SENTINEL_FAILOVER_STATE_NONE);
 
     // 清除新 master 的升级标识
     if (ri->promoted_slave) {
@@ -0,0 +1,237 @@
+/* shmtransport.c - Shared memory transport for co-located clients
+ *
+ * 同一台机器上的客户端通过共享内存中的环形缓冲与服务器交换请求和回复，
+ * 服务器忙碌时不需要任何系统调用
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The layout of the segment and the protocol the clients follow are in
+ * shmtransport.h. This file only moves bytes between the rings and the
+ * client buffers: networking.c reads the request ring instead of the socket
+ * and writes the reply ring instead of calling writev() for the clients
+ * flagged REDIS_SHM.
+ *
+ * Every ring has a single producer and a single consumer, so the only
+ * synchronization needed is a barrier between the copy of the data and the
+ * update of head / tail. A client is served by one thread at a time (the
+ * main thread or an I/O thread), as for the socket. */
+
+#include "redis.h"
+#include "shmtransport.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_SHM_TRANSPORT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+struct shmTransport {
+    shmHeader *hdr;     /* Start of the mapping. */
+    size_t maplen;      /* Length of the mapping. */
+    char *req;          /* Request ring, client -> server. */
+    char *rep;          /* Reply ring, server -> client. */
+    uint64_t ringsize;
+    sds path;           /* File of the segment, NULL once unlinked. */
+};
+
+/* Create the shared memory segment of the client with ID 'id' and rings of
+ * 'ringsize' bytes, that must be a power of two. Returns NULL on error with
+ * errno set. */
+shmTransport *shmTransportCreate(uint64_t id, size_t ringsize) {
+#ifdef HAVE_SHM_TRANSPORT
+    shmTransport *t;
+    size_t maplen = sizeof(shmHeader) + ringsize*2;
+    void *map;
+    sds path;
+    int fd, saved_errno;
+
+    path = sdscatprintf(sdsempty(),"%s/redis-shm-%ld-%llu",
+        REDIS_SHM_TRANSPORT_DIR, (long)getpid(), (unsigned long long)id);
+    if ((fd = open(path,O_RDWR|O_CREAT|O_EXCL,0600)) == -1) {
+        sdsfree(path);
+        return NULL;
+    }
+    if (ftruncate(fd,maplen) == -1 ||
+        (map = mmap(NULL,maplen,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0)) ==
+         MAP_FAILED)
+    {
+        saved_errno = errno;
+        close(fd);
+        unlink(path);
+        sdsfree(path);
+        errno = saved_errno;
+        return NULL;
+    }
+    close(fd);
+
+    // ftruncate() 之后文件内容全部为 0
+    t = zmalloc(sizeof(*t));
+    t->hdr = map;
+    t->maplen = maplen;
+    t->req = (char*)map + sizeof(shmHeader);
+    t->rep = t->req + ringsize;
+    t->ringsize = ringsize;
+    t->path = path;
+    t->hdr->ringsize = ringsize;
+    __sync_synchronize();
+    t->hdr->magic = SHM_TRANSPORT_MAGIC;
+    return t;
+#else
+    REDIS_NOTUSED(id);
+    REDIS_NOTUSED(ringsize);
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+/* Return the path the client has to map. */
+const char *shmTransportPath(shmTransport *t) {
+    return t->path;
+}
+
+/* The client mapped the segment once it uses the rings: there is no reason
+ * to keep the file around, nor to leave it behind if we crash. */
+static void shmTransportUnlink(shmTransport *t) {
+    if (t->path == NULL) return;
+    unlink(t->path);
+    sdsfree(t->path);
+    t->path = NULL;
+}
+
+void shmTransportRelease(shmTransport *t) {
+#ifdef HAVE_SHM_TRANSPORT
+    shmTransportUnlink(t);
+    munmap(t->hdr,t->maplen);
+    zfree(t);
+#else
+    REDIS_NOTUSED(t);
+#endif
+}
+
+/* Copy up to 'len' bytes from the request ring to 'buf'. Works like read(2)
+ * on a non blocking socket: returns the number of bytes copied, or -1 with
+ * errno set to EAGAIN if the ring is empty. */
+int shmTransportRead(shmTransport *t, char *buf, size_t len) {
+    uint64_t head = t->hdr->req.head, tail = t->hdr->req.tail;
+    uint64_t off;
+    size_t first;
+
+    __sync_synchronize();   /* Read the data after head. */
+    if (head == tail) {
+        errno = EAGAIN;
+        return -1;
+    }
+    shmTransportUnlink(t);
+    if (len > head-tail) len = head-tail;
+    if (len > INT_MAX) len = INT_MAX;
+
+    off = tail & (t->ringsize-1);
+    first = t->ringsize-off < len ? t->ringsize-off : len;
+    memcpy(buf,t->req+off,first);
+    memcpy(buf+first,t->req,len-first);
+    __sync_synchronize();   /* Copy the data before releasing it. */
+    t->hdr->req.tail = tail+len;
+
+    /* We are reading anyway: the client doesn't need to ring the doorbell
+     * for the next requests. */
+    if (t->hdr->server_idle)
+        __sync_bool_compare_and_swap(&t->hdr->server_idle,1,0);
+    return len;
+}
+
+/* Copy the 'iovcnt' buffers of 'iov' to the reply ring, as much as fits.
+ * Works like writev(2) on a non blocking socket: returns the number of bytes
+ * copied, or -1 with errno set to EAGAIN if the ring is full. The client is
+ * woken up if it waits for replies. */
+int shmTransportWritev(shmTransport *t, const struct iovec *iov, int iovcnt) {
+    uint64_t head = t->hdr->rep.head, tail = t->hdr->rep.tail;
+    size_t room, written = 0;
+    int j;
+
+    __sync_synchronize();   /* Overwrite the data only after reading tail. */
+    room = t->ringsize-(head-tail);
+    if (room == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (j = 0; j < iovcnt && written < room; j++) {
+        size_t len = iov[j].iov_len, first;
+        uint64_t off = (head+written) & (t->ringsize-1);
+
+        if (len > room-written) len = room-written;
+        if (len > (size_t)INT_MAX-written) len = (size_t)INT_MAX-written;
+        first = t->ringsize-off < len ? t->ringsize-off : len;
+        memcpy(t->rep+off,iov[j].iov_base,first);
+        memcpy(t->rep,(char*)iov[j].iov_base+first,len-first);
+        written += len;
+        if (len < iov[j].iov_len) break;
+    }
+    __sync_synchronize();   /* Copy the data before publishing it. */
+    t->hdr->rep.head = head+written;
+
+    /* The client sets client_waiting and then checks head again before to
+     * sleep, so after publishing head we have to check client_waiting. */
+    __sync_synchronize();
+    if (t->hdr->client_waiting &&
+        __sync_bool_compare_and_swap(&t->hdr->client_waiting,1,0))
+    {
+#ifdef HAVE_SHM_TRANSPORT
+        syscall(SYS_futex,&t->hdr->client_waiting,FUTEX_WAKE,1,NULL,NULL,0);
+#endif
+    }
+    return written;
+}
+
+/* Return 1 if the request ring is not empty. */
+int shmTransportHasInput(shmTransport *t) {
+    return t->hdr->req.head != t->hdr->req.tail;
+}
+
+/* Return 1 if the reply ring has room for more replies. */
+int shmTransportHasRoom(shmTransport *t) {
+    return t->hdr->rep.head-t->hdr->rep.tail < t->ringsize;
+}
+
+/* Called before the event loop sleeps: ask the client to ring the doorbell
+ * for new requests, or when it frees room in the reply ring if 'want_room'
+ * is true. Returns 1 if there is already something to do, in which case
+ * the event loop should not sleep. */
+int shmTransportPrepareSleep(shmTransport *t, int want_room) {
+    t->hdr->server_idle = 1;
+    __sync_synchronize();   /* Set server_idle before checking the rings. */
+    if (shmTransportHasInput(t) || (want_room && shmTransportHasRoom(t))) {
+        __sync_bool_compare_and_swap(&t->hdr->server_idle,1,0);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* shmtransport.h - Shared memory transport for co-located clients
+ *
+ * This header describes the layout of the shared memory segment, so it can
+ * be included by the clients as well.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SHMTRANSPORT_H
+#define __SHMTRANSPORT_H
+
+#include <stdint.h>
+
+/* A client connected to the Unix socket switches to the shared memory
+ * transport with CLIENT SHM [<ringsize>]. The reply, still sent on the
+ * socket, is the path of a file the client has to open and mmap() with
+ * MAP_SHARED. The server unlinks the file as soon as the client uses it.
+ *
+ * 客户端通过 Unix socket 发送 CLIENT SHM ，之后的请求和回复都经过共享内存
+ *
+ * The segment is a shmHeader followed by two rings of 'ringsize' bytes:
+ * first the request ring (client -> server), then the reply ring (server ->
+ * client). Both carry the plain RESP protocol. 'head' is the total number
+ * of bytes written by the producer and 'tail' the total number of bytes
+ * read by the consumer, so the used part of a ring is head-tail and the
+ * byte at offset N is at ring[N & (ringsize-1)].
+ *
+ * The socket stays open to detect that the client went away, and is used
+ * as the doorbell of the server:
+ *
+ * 1) After publishing new requests, or after consuming replies, the client
+ *    checks 'server_idle'. If it is 1 the server is going to sleep in the
+ *    event loop: the client sets it to 0 with a compare and swap and, if it
+ *    won, writes one byte to the socket. While the server is busy no
+ *    syscall is needed, whatever the number of pipelined commands.
+ *
+ * 2) To wait for replies the client sets 'client_waiting' to 1, checks the
+ *    reply ring again, and sleeps with FUTEX_WAIT on 'client_waiting'. The
+ *    server sets it back to 0 and calls FUTEX_WAKE after publishing
+ *    replies. The futex is shared, so FUTEX_PRIVATE_FLAG must not be used.
+ *
+ * No other command can be sent on the socket after CLIENT SHM: every byte
+ * the server reads from it is considered a doorbell. */
+
+#define SHM_TRANSPORT_MAGIC 0x52454453  /* "REDS" */
+#define SHM_TRANSPORT_DEFAULT_RINGSIZE (1024*1024)
+#define SHM_TRANSPORT_MIN_RINGSIZE (64*1024)
+#define SHM_TRANSPORT_MAX_RINGSIZE (256*1024*1024)
+
+/* Every field written by one side only lives in its own cache line. */
+typedef struct shmRing {
+    volatile uint64_t head;     /* Bytes written by the producer. */
+    char pad1[56];
+    volatile uint64_t tail;     /* Bytes read by the consumer. */
+    char pad2[56];
+} shmRing;
+
+typedef struct shmHeader {
+    uint32_t magic;             /* SHM_TRANSPORT_MAGIC */
+    uint32_t ringsize;          /* Size of every ring, a power of two. */
+    char pad1[56];
+    shmRing req;                /* Requests, client -> server. */
+    shmRing rep;                /* Replies, server -> client. */
+    volatile uint32_t server_idle;      /* Ring the doorbell if 1. */
+    char pad2[60];
+    volatile uint32_t client_waiting;   /* Futex the client sleeps on. */
+    char pad3[60];
+} shmHeader;
+
+#endif
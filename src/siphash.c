@@ -0,0 +1,139 @@
+/* SipHash reference C implementation, adapted for Redis.
+ *
+ * Copyright (c) 2012-2016 Jean-Philippe Aumasson
+ * Copyright (c) 2012-2014 Daniel J. Bernstein
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along
+ * with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * This version uses SipHash-1-3 (one compression round per 8 bytes of input,
+ * three finalization rounds) instead of the SipHash-2-4 of the paper: it is
+ * still a keyed PRF resistant to hash flooding for the short inputs used as
+ * dictionary keys, and roughly twice as fast.
+ *
+ * 带密钥的 64 位哈希函数，可以防止针对哈希表的碰撞攻击（hash flooding）
+ *
+ * Other changes from the reference implementation:
+ *
+ * 1. The API returns the 64 bit hash directly instead of writing it into an
+ *    output buffer.
+ * 2. A case insensitive variant, siphash_nocase(), hashes the input as if it
+ *    was lower case, without allocating a lowered copy of it.
+ * 3. The number of rounds can be changed at compile time with
+ *    SIPHASH_C_ROUNDS and SIPHASH_D_ROUNDS, so that the implementation can be
+ *    checked against the SipHash-2-4 test vectors.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#ifndef SIPHASH_C_ROUNDS
+#define SIPHASH_C_ROUNDS 1
+#endif
+#ifndef SIPHASH_D_ROUNDS
+#define SIPHASH_D_ROUNDS 3
+#endif
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+/* Little endian load of 8 bytes from any address. Compilers turn this into
+ * a single load on little endian targets. */
+#define U8TO64_LE(p)                                                           \
+    (((uint64_t)((p)[0])) | ((uint64_t)((p)[1]) << 8) |                        \
+     ((uint64_t)((p)[2]) << 16) | ((uint64_t)((p)[3]) << 24) |                 \
+     ((uint64_t)((p)[4]) << 32) | ((uint64_t)((p)[5]) << 40) |                 \
+     ((uint64_t)((p)[6]) << 48) | ((uint64_t)((p)[7]) << 56))
+
+#define U8TO64_LE_NOCASE(p)                                                    \
+    (((uint64_t)(tolower((p)[0]))) |                                           \
+     ((uint64_t)(tolower((p)[1])) << 8) |                                      \
+     ((uint64_t)(tolower((p)[2])) << 16) |                                     \
+     ((uint64_t)(tolower((p)[3])) << 24) |                                     \
+     ((uint64_t)(tolower((p)[4])) << 32) |                                     \
+     ((uint64_t)(tolower((p)[5])) << 40) |                                     \
+     ((uint64_t)(tolower((p)[6])) << 48) |                                     \
+     ((uint64_t)(tolower((p)[7])) << 56))
+
+#define SIPROUND                                                               \
+    do {                                                                       \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);              \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                                 \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                                 \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);              \
+    } while (0)
+
+/* Hash 'inlen' bytes at 'in' with the 16 bytes key 'k'. When 'nocase' is
+ * true every byte is lowered before being mixed. The function is inlined
+ * in the two callers below so that the test on 'nocase' is resolved at
+ * compile time. */
+static inline uint64_t siphashGeneric(const uint8_t *in, const size_t inlen,
+                                      const uint8_t *k, const int nocase)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL;
+    uint64_t v1 = 0x646f72616e646f6dULL;
+    uint64_t v2 = 0x6c7967656e657261ULL;
+    uint64_t v3 = 0x7465646279746573ULL;
+    uint64_t k0 = U8TO64_LE(k);
+    uint64_t k1 = U8TO64_LE(k + 8);
+    uint64_t m;
+    const uint8_t *end = in + inlen - (inlen % sizeof(uint64_t));
+    const int left = inlen & 7;
+    uint64_t b = ((uint64_t)inlen) << 56;
+    int i;
+
+    v3 ^= k1;
+    v2 ^= k0;
+    v1 ^= k1;
+    v0 ^= k0;
+
+    // 每次压缩 8 个字节
+    for (; in != end; in += 8) {
+        m = nocase ? U8TO64_LE_NOCASE(in) : U8TO64_LE(in);
+        v3 ^= m;
+        for (i = 0; i < SIPHASH_C_ROUNDS; i++) SIPROUND;
+        v0 ^= m;
+    }
+
+    // 剩余不足 8 个字节的部分和长度一起组成最后一个分组
+#define SIPBYTE(j) ((uint64_t)(nocase ? tolower(in[j]) : in[j]))
+    switch (left) {
+    case 7: b |= SIPBYTE(6) << 48;
+    case 6: b |= SIPBYTE(5) << 40;
+    case 5: b |= SIPBYTE(4) << 32;
+    case 4: b |= SIPBYTE(3) << 24;
+    case 3: b |= SIPBYTE(2) << 16;
+    case 2: b |= SIPBYTE(1) << 8;
+    case 1: b |= SIPBYTE(0); break;
+    case 0: break;
+    }
+#undef SIPBYTE
+
+    v3 ^= b;
+    for (i = 0; i < SIPHASH_C_ROUNDS; i++) SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for (i = 0; i < SIPHASH_D_ROUNDS; i++) SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Return the SipHash of 'inlen' bytes at 'in' using the 16 bytes key 'k'. */
+uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    return siphashGeneric(in,inlen,k,0);
+}
+
+/* Like siphash(), but upper and lower case ASCII letters hash the same. */
+uint64_t siphash_nocase(const uint8_t *in, const size_t inlen,
+                        const uint8_t *k)
+{
+    return siphashGeneric(in,inlen,k,1);
+}
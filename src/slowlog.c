@@ -50,27 +50,43 @@
 #include "redis.h"
 #include "slowlog.h"
 
-/* Create a new slowlog entry.
- *
- * 创建一条新的慢查询日志
+/* Copy the string 'p' of 'len' bytes at '*buf', recording it into 'arg',
+ * and advance '*buf'. A null terminator is added so that the peer id and
+ * the client name can be used as C strings. */
+static void slowlogCopyString(char **buf, slowlogArg *arg,
+                              const char *p, size_t len)
+{
+    memcpy(*buf,p,len);
+    (*buf)[len] = '\0';
+    if (arg) {
+        arg->ptr = *buf;
+        arg->len = len;
+    }
+    *buf += len+1;
+}
+
+/* Fill a slowlog entry. 'se' is reused if it is large enough, otherwise it
+ * is released and a new entry is allocated. The new entry is returned.
  *
- * Incrementing the ref count of all the objects retained is up to
- * this function. 
+ * 填充一条慢查询日志，旧条目 se 的空间足够时直接复用。
  *
- * 函数负责增加所有记录对象的引用计数
- */
-slowlogEntry *slowlogCreateEntry(robj **argv, int argc, long long duration) {
-    slowlogEntry *se = zmalloc(sizeof(*se));
-    int j, slargc = argc;
+ * Arguments are copied, so nothing is retained from 'argv'. The first
+ * pass only computes the bytes needed, the second one copies them. */
+slowlogEntry *slowlogCreateEntry(slowlogEntry *se, redisClient *c,
+                                 robj **argv, int argc, long long duration)
+{
+    char numbuf[REDIS_LONGSTR_SIZE], extra[64];
+    int j, slargc = argc, extralen = 0;
+    size_t bytes;
+    char *peerid = getClientPeerId(c), *buf;
+    sds cname = c->name ? c->name->ptr : NULL;
 
     // 如果参数过多，那么只记录服务器允许的最大参数数量
     if (slargc > SLOWLOG_ENTRY_MAX_ARGC) slargc = SLOWLOG_ENTRY_MAX_ARGC;
 
-    // 记录参数数量
-    se->argc = slargc;
-
-    // 遍历并记录命令的参数
-    se->argv = zmalloc(sizeof(robj*)*slargc);
+    /* Pass 1: size the allocation. */
+    bytes = sizeof(*se) + sizeof(slowlogArg)*slargc;
+    bytes += strlen(peerid)+1 + (cname ? sdslen(cname) : 0)+1;
     for (j = 0; j < slargc; j++) {
         /* Logging too many arguments is a useless memory waste, so we stop
          * at SLOWLOG_ENTRY_MAX_ARGC, but use the last argument to specify
@@ -78,29 +94,59 @@ slowlogEntry *slowlogCreateEntry(robj **argv, int argc, long long duration) {
         // 当参数的数量超过服务器允许的最大参数数量时，
         // 用最后一个参数记录省略提示
         if (slargc != argc && j == slargc-1) {
-            se->argv[j] = createObject(REDIS_STRING,
-                sdscatprintf(sdsempty(),"... (%d more arguments)",
-                argc-slargc+1));
-        } else {
+            bytes += 64;
+        } else if (sdsEncodedObject(argv[j])) {
             /* Trim too long strings as well... */
             // 如果参数太长，那么进行截断
-            if (argv[j]->type == REDIS_STRING &&
-                sdsEncodedObject(argv[j]) &&
-                sdslen(argv[j]->ptr) > SLOWLOG_ENTRY_MAX_STRING)
-            {
-                sds s = sdsnewlen(argv[j]->ptr, SLOWLOG_ENTRY_MAX_STRING);
+            size_t len = sdslen(argv[j]->ptr);
+            bytes += (len > SLOWLOG_ENTRY_MAX_STRING) ?
+                     SLOWLOG_ENTRY_MAX_STRING+64 : len+1;
+        } else {
+            bytes += REDIS_LONGSTR_SIZE;
+        }
+    }
 
-                s = sdscatprintf(s,"... (%lu more bytes)",
-                    (unsigned long)
-                    sdslen(argv[j]->ptr) - SLOWLOG_ENTRY_MAX_STRING);
+    if (se == NULL || se->alloc < bytes) {
+        zfree(se);
+        se = zmalloc(bytes);
+        se->alloc = bytes;
+    }
 
-                se->argv[j] = createObject(REDIS_STRING,s);
+    /* Pass 2: copy. */
+    buf = (char*)(se->argv+slargc);
+    se->peerid = buf;
+    slowlogCopyString(&buf,NULL,peerid,strlen(peerid));
+    se->cname = buf;
+    slowlogCopyString(&buf,NULL,cname ? cname : "",cname ? sdslen(cname) : 0);
+    for (j = 0; j < slargc; j++) {
+        if (slargc != argc && j == slargc-1) {
+            extralen = snprintf(extra,sizeof(extra),"... (%d more arguments)",
+                argc-slargc+1);
+            slowlogCopyString(&buf,se->argv+j,extra,extralen);
+        } else if (sdsEncodedObject(argv[j])) {
+            size_t len = sdslen(argv[j]->ptr);
+
+            if (len > SLOWLOG_ENTRY_MAX_STRING) {
+                extralen = snprintf(extra,sizeof(extra),"... (%lu more bytes)",
+                    (unsigned long) len - SLOWLOG_ENTRY_MAX_STRING);
+                memcpy(buf,argv[j]->ptr,SLOWLOG_ENTRY_MAX_STRING);
+                memcpy(buf+SLOWLOG_ENTRY_MAX_STRING,extra,extralen);
+                buf[SLOWLOG_ENTRY_MAX_STRING+extralen] = '\0';
+                se->argv[j].ptr = buf;
+                se->argv[j].len = SLOWLOG_ENTRY_MAX_STRING+extralen;
+                buf += SLOWLOG_ENTRY_MAX_STRING+extralen+1;
             } else {
-                se->argv[j] = argv[j];
-                incrRefCount(argv[j]);
+                slowlogCopyString(&buf,se->argv+j,argv[j]->ptr,len);
             }
+        } else {
+            int len = ll2string(numbuf,sizeof(numbuf),(long)argv[j]->ptr);
+            slowlogCopyString(&buf,se->argv+j,numbuf,len);
         }
     }
+    redisAssert((size_t)(buf-(char*)se) <= bytes);
+
+    // 记录参数数量
+    se->argc = slargc;
 
     // 命令的执行时间
     se->time = time(NULL);
@@ -114,28 +160,42 @@ slowlogEntry *slowlogCreateEntry(robj **argv, int argc, long long duration) {
     return se;
 }
 
-/* Free a slow log entry. The argument is void so that the prototype of this
- * function matches the one of the 'free' method of adlist.c.
+/* Free a slow log entry. Entries are a single allocation.
  *
  * 释放给定的慢查询日志
- *
- * 因为函数参数的类型为 void* ，所以它可以用作 adlist.c 中的 free 方法。
- *
- * This function will take care to release all the retained object. 
- *
- * 这个函数负责对所有记录对象进行引用计数减一。
  */
-void slowlogFreeEntry(void *septr) {
-    slowlogEntry *se = septr;
-    int j;
-
-    // 释放参数
-    for (j = 0; j < se->argc; j++)
-        decrRefCount(se->argv[j]);
+void slowlogFreeEntry(slowlogEntry *se) {
+    zfree(se);
+}
 
-    zfree(se->argv);
+/* Return the i-th entry, 0 being the newest one. */
+static slowlogEntry *slowlogGetEntry(unsigned long i) {
+    return server.slowlog[(server.slowlog_next+server.slowlog_size-1-i) %
+                          server.slowlog_size];
+}
 
-    zfree(se);
+/* Resize the ring buffer to 'size' slots, keeping the newest entries.
+ *
+ * 调整环形缓冲区大小（slowlog-max-len 被修改后），保留最新的日志 */
+static void slowlogResize(unsigned long size) {
+    struct slowlogEntry **ring = size ? zcalloc(sizeof(*ring)*size) : NULL;
+    unsigned long j, keep = server.slowlog_len;
+
+    if (keep > size) keep = size;
+    /* The newest entry goes into the last kept slot. */
+    for (j = 0; j < server.slowlog_len; j++) {
+        slowlogEntry *se = slowlogGetEntry(j);
+
+        if (j < keep)
+            ring[keep-1-j] = se;
+        else
+            slowlogFreeEntry(se);
+    }
+    zfree(server.slowlog);
+    server.slowlog = ring;
+    server.slowlog_size = size;
+    server.slowlog_len = keep;
+    server.slowlog_next = size ? keep % size : 0;
 }
 
 /* Initialize the slow log. This function should be called a single time
@@ -147,14 +207,12 @@ void slowlogFreeEntry(void *septr) {
  */
 void slowlogInit(void) {
 
-    // 保存日志的链表，FIFO 顺序
-    server.slowlog = listCreate();
+    server.slowlog = NULL;
+    server.slowlog_size = 0;
+    server.slowlog_len = 0;
+    server.slowlog_next = 0;
 
-    // 日志数量计数器
     server.slowlog_entry_id = 0;
-
-    // 日志链表的释构函数
-    listSetFreeMethod(server.slowlog,slowlogFreeEntry);
 }
 
 /* Push a new entry into the slow log.
@@ -163,24 +221,33 @@ void slowlogInit(void) {
  * 那么将一个新条目以 FIFO 顺序推入到慢查询日志中。
  *
  * This function will make sure to trim the slow log accordingly to the
- * configured max length. 
+ * configured max length. When the log is full the oldest entry is
+ * overwritten, reusing its memory when possible.
  *
- * 根据服务器设置的最大日志长度，可能会对日志进行截断（trim）
+ * 日志满了就覆盖最旧的条目，并尽量复用它的内存。
  */
-void slowlogPushEntryIfNeeded(robj **argv, int argc, long long duration) {
+void slowlogPushEntryIfNeeded(redisClient *c, robj **argv, int argc, long long duration) {
+    slowlogEntry **slot;
 
     // 慢查询功能未开启，直接返回
     if (server.slowlog_log_slower_than < 0) return; /* Slowlog disabled */
 
+    /* Remove old entries if needed. */
+    // 如果日志数量上限被修改了，那么调整缓冲区大小
+    if (server.slowlog_size != server.slowlog_max_len)
+        slowlogResize(server.slowlog_max_len);
+
     // 如果执行时间超过服务器设置的上限，那么将命令添加到慢查询日志
-    if (duration >= server.slowlog_log_slower_than)
-        // 新日志添加到链表表头
-        listAddNodeHead(server.slowlog,slowlogCreateEntry(argv,argc,duration));
+    if (duration < server.slowlog_log_slower_than || server.slowlog_size == 0)
+        return;
 
-    /* Remove old entries if needed. */
-    // 如果日志数量过多，那么进行删除
-    while (listLength(server.slowlog) > server.slowlog_max_len)
-        listDelNode(server.slowlog,listLast(server.slowlog));
+    /* Commands run by scripts are logged with the address of the caller. */
+    if (c->flags & REDIS_LUA_CLIENT && server.lua_caller) c = server.lua_caller;
+
+    slot = server.slowlog+server.slowlog_next;
+    *slot = slowlogCreateEntry(*slot,c,argv,argc,duration);
+    server.slowlog_next = (server.slowlog_next+1) % server.slowlog_size;
+    if (server.slowlog_len < server.slowlog_size) server.slowlog_len++;
 }
 
 /* Remove all the entries from the current slow log. 
@@ -188,8 +255,14 @@ void slowlogPushEntryIfNeeded(robj **argv, int argc, long long duration) {
  * 删除所有慢查询日志
  */
 void slowlogReset(void) {
-    while (listLength(server.slowlog) > 0)
-        listDelNode(server.slowlog,listLast(server.slowlog));
+    unsigned long j;
+
+    for (j = 0; j < server.slowlog_size; j++) {
+        slowlogFreeEntry(server.slowlog[j]);
+        server.slowlog[j] = NULL;
+    }
+    server.slowlog_len = 0;
+    server.slowlog_next = 0;
 }
 
 /* The SLOWLOG command. Implements all the subcommands needed to handle the
@@ -206,39 +279,38 @@ void slowlogCommand(redisClient *c) {
 
     // 返回长度
     } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"len")) {
-        addReplyLongLong(c,listLength(server.slowlog));
+        addReplyLongLong(c,server.slowlog_len);
 
     // 获取某条或者全部日志
     } else if ((c->argc == 2 || c->argc == 3) &&
                !strcasecmp(c->argv[1]->ptr,"get"))
     {
-        long count = 10, sent = 0;
-        listIter li;
-        void *totentries;
-        listNode *ln;
+        long count = 10;
+        unsigned long sent;
         slowlogEntry *se;
 
         if (c->argc == 3 &&
             getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != REDIS_OK)
             return;
 
-        // 遍历日志，取出指定数量的日志
-        listRewind(server.slowlog,&li);
-        totentries = addDeferredMultiBulkLength(c);
-        while(count-- && (ln = listNext(&li))) {
+        // 从最新的日志开始，取出指定数量的日志（count 为负数时取出全部）
+        if (count < 0 || (unsigned long)count > server.slowlog_len)
+            count = server.slowlog_len;
+        addReplyMultiBulkLen(c,count);
+        for (sent = 0; sent < (unsigned long)count; sent++) {
             int j;
 
-            se = ln->value;
-            addReplyMultiBulkLen(c,4);
+            se = slowlogGetEntry(sent);
+            addReplyMultiBulkLen(c,6);
             addReplyLongLong(c,se->id);
             addReplyLongLong(c,se->time);
             addReplyLongLong(c,se->duration);
             addReplyMultiBulkLen(c,se->argc);
             for (j = 0; j < se->argc; j++)
-                addReplyBulk(c,se->argv[j]);
-            sent++;
+                addReplyBulkCBuffer(c,se->argv[j].ptr,se->argv[j].len);
+            addReplyBulkCString(c,se->peerid);
+            addReplyBulkCString(c,se->cname);
         }
-        setDeferredMultiBulkLength(c,totentries,sent);
     } else {
         addReplyError(c,
             "Unknown SLOWLOG subcommand or wrong # of args. Try GET, RESET, LEN.");
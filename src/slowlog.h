@@ -30,14 +30,27 @@
 #define SLOWLOG_ENTRY_MAX_ARGC 32
 #define SLOWLOG_ENTRY_MAX_STRING 128
 
-/* This structure defines an entry inside the slow log list */
-/*
- * 慢查询日志
+/* A logged argument. 'ptr' points inside the entry allocation. */
+typedef struct slowlogArg {
+    char *ptr;
+    size_t len;
+} slowlogArg;
+
+/* This structure defines an entry inside the slow log ring buffer. The
+ * entry, its argument vector and every string it references live in a
+ * single allocation, so logging a command costs one zmalloc() at most and
+ * no object references are retained.
+ *
+ * 一条慢查询日志：结构体、参数数组和所有字符串都在同一块内存里。
  */
 typedef struct slowlogEntry {
 
-    // 命令与命令参数
-    robj **argv;
+    // 占用的字节数，覆盖旧条目时如果足够就直接复用
+    size_t alloc;
+
+    // 客户端地址和名字（没有名字时为空字符串）
+    char *peerid;
+    char *cname;
 
     // 命令与命令参数的数量
     int argc;
@@ -52,11 +65,14 @@ typedef struct slowlogEntry {
     // 命令执行时的时间，格式为 UNIX 时间戳
     time_t time;        /* Unix time at which the query was executed. */
 
+    // 命令与命令参数，紧跟在结构体之后
+    slowlogArg argv[];
+
 } slowlogEntry;
 
 /* Exported API */
 void slowlogInit(void);
-void slowlogPushEntryIfNeeded(robj **argv, int argc, long long duration);
+void slowlogPushEntryIfNeeded(redisClient *c, robj **argv, int argc, long long duration);
 
 /* Exported commands */
 void slowlogCommand(redisClient *c);
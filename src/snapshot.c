@@ -0,0 +1,352 @@
+/* snapshot.c - Forkless point-in-time RDB snapshots
+ *
+ * 不使用 fork() 的 RDB 快照：主线程分片扫描键空间，写入前钩子先保存旧值
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A forkless snapshot writes the dataset as it was when the save started
+ * without calling fork(): the keyspace of every DB is iterated with
+ * dictScan() by a time event of the main thread, a slice of at most
+ * REDIS_FORKLESS_SAVE_SLICE microseconds every millisecond.
+ *
+ * While the scan runs the dataset keeps changing, so every function of
+ * db.c about to modify, delete or change the expire of a key first calls
+ * snapshotKeyWillChange(): if the scan did not visit the key yet, its
+ * current value, that is the one it had when the save started, is written
+ * to the RDB right away. Whether the scan visited a key is told by its
+ * cursor (see dictScanVisited()), so nothing is stored for the keys the
+ * scan reaches first. The keys written early, and the keys created after
+ * the save started where the scan did not pass yet, are remembered in the
+ * 'early' set of their DB, so that the scan skips them.
+ *
+ * The keys written early may belong to a DB other than the one being
+ * scanned: a SELECTDB opcode is written whenever the DB changes, the RDB
+ * loader accepts them in any order.
+ *
+ * 扫描尚未经过的键在被修改、删除之前，先把旧值写入 RDB ，并记入 early 集合，
+ * 扫描到这些键（以及快照开始之后才创建的键）时跳过。 */
+
+#include "redis.h"
+#include <unistd.h>
+
+/* Time spent scanning in each call of the time event, every millisecond. */
+#define REDIS_FORKLESS_SAVE_SLICE 1000 /* microseconds */
+
+struct forklessSave {
+    FILE *fp;
+    rio rdb;
+    char tmpfile[256];
+    sds filename;
+    long long te_id;            /* Time event doing the scan. */
+    long long start;            /* mstime() when the save started: the
+                                   expires are checked against it. */
+    long long dirty_before;     /* server.dirty when the save started. */
+    int dbid;                   /* DB being scanned. */
+    int last_dbid;              /* DB of the last SELECTDB written. */
+    unsigned long *cursor;      /* dictScan() cursor of every DB. */
+    int *done;                  /* 1 for the DBs completely saved. */
+    dict **early;               /* Keys the scan must skip, by DB. */
+    long long keys;             /* Keys written so far. */
+    long long early_keys;       /* Keys written by snapshotKeyWillChange(). */
+    int err;                    /* Write error. */
+};
+
+static void snapshotFree(forklessSave *fs) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        if (fs->early[j]) dictRelease(fs->early[j]);
+    zfree(fs->early);
+    zfree(fs->cursor);
+    zfree(fs->done);
+    sdsfree(fs->filename);
+    zfree(fs);
+}
+
+/* Write a key of 'db' with its current value and expire. */
+static int snapshotSaveKey(forklessSave *fs, redisDb *db, sds keystr,
+                           robj *o)
+{
+    robj key;
+
+    if (fs->last_dbid != db->id) {
+        if (rdbSaveType(&fs->rdb,REDIS_RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&fs->rdb,db->id) == -1) return REDIS_ERR;
+        fs->last_dbid = db->id;
+    }
+    initStaticStringObject(key,keystr);
+    if (rdbSaveKeyValuePair(&fs->rdb,&key,o,getExpire(db,&key),
+                            fs->start) == -1) return REDIS_ERR;
+    fs->keys++;
+    return REDIS_OK;
+}
+
+/* Remember that the scan of 'db' must skip 'key'. */
+static void snapshotSkipKey(forklessSave *fs, redisDb *db, sds key) {
+    if (fs->early[db->id] == NULL)
+        fs->early[db->id] = dictCreate(&snapshotKeysDictType,NULL);
+    dictAdd(fs->early[db->id],sdsdup(key),NULL);
+}
+
+/* Return 1 if 'key' of 'db' was already written or must not be written. */
+static int snapshotKeyHandled(forklessSave *fs, redisDb *db, sds key) {
+    if (fs->done[db->id]) return 1;
+    if (dictScanVisited(db->dict,key,fs->cursor[db->id])) return 1;
+    return fs->early[db->id] && dictFind(fs->early[db->id],key) != NULL;
+}
+
+/* Abort the save on a write error, see snapshotAbort(). */
+static void snapshotWriteError(forklessSave *fs) {
+    redisLog(REDIS_WARNING,"Write error in forkless save: %s",
+        strerror(errno));
+    fs->err = 1;
+    snapshotAbort();
+    server.lastbgsave_status = REDIS_ERR;
+}
+
+/* Write the trailer, and move the file on the final destination. */
+static void snapshotFinish(forklessSave *fs) {
+    if (rdbSaveRioTrailer(&fs->rdb) == -1 ||
+        fflush(fs->fp) == EOF ||
+        fsync(fileno(fs->fp)) == -1)
+    {
+        snapshotWriteError(fs);
+        return;
+    }
+    fclose(fs->fp);
+    fs->fp = NULL;
+    if (rename(fs->tmpfile,fs->filename) == -1) {
+        redisLog(REDIS_WARNING,
+            "Error moving temp DB file on the final destination: %s",
+            strerror(errno));
+        unlink(fs->tmpfile);
+        server.lastbgsave_status = REDIS_ERR;
+    } else {
+        redisLog(REDIS_NOTICE,
+            "Forkless saving terminated with success: %lld keys, "
+            "%lld written before the scan reached them",
+            fs->keys, fs->early_keys);
+        server.dirty = server.dirty - fs->dirty_before;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = REDIS_OK;
+    }
+    server.stat_forkless_early_keys = fs->early_keys;
+    server.rdb_save_time_last = time(NULL)-server.rdb_forkless_time_start;
+    server.rdb_forkless_time_start = -1;
+    server.forkless_save = NULL;
+    snapshotFree(fs);
+}
+
+typedef struct snapshotScanData {
+    forklessSave *fs;
+    redisDb *db;
+    unsigned long cursor;       /* Cursor before this dictScan() call. */
+} snapshotScanData;
+
+static void snapshotScanCallback(void *privdata, const dictEntry *de) {
+    snapshotScanData *data = privdata;
+    forklessSave *fs = data->fs;
+    sds key = dictGetKey(de);
+    dict *early = fs->early[data->db->id];
+
+    if (fs->err) return;
+
+    /* After the tables shrank, some keys are returned a second time. */
+    if (dictScanVisited(data->db->dict,key,data->cursor)) return;
+
+    /* Written early, or created after the save started. */
+    if (early && dictDelete(early,key) == DICT_OK) return;
+
+    if (snapshotSaveKey(fs,data->db,key,dictGetVal(de)) == REDIS_ERR)
+        fs->err = 1;
+}
+
+/* Scan the DB 'dbid' up to the end, or until 'deadline' (ustime()) if
+ * not zero. Returns REDIS_ERR on write error. */
+static int snapshotScanDb(forklessSave *fs, int dbid, long long deadline) {
+    snapshotScanData data;
+    int steps = 0;
+
+    data.fs = fs;
+    data.db = server.db+dbid;
+    while (!fs->done[dbid]) {
+        data.cursor = fs->cursor[dbid];
+        fs->cursor[dbid] = dictScan(data.db->dict,data.cursor,
+                                    snapshotScanCallback,NULL,&data);
+        if (fs->err) return REDIS_ERR;
+        if (fs->cursor[dbid] == 0) {
+            /* Nothing left to skip in this DB. */
+            fs->done[dbid] = 1;
+            if (fs->early[dbid]) {
+                dictRelease(fs->early[dbid]);
+                fs->early[dbid] = NULL;
+            }
+        }
+        if (deadline && (++steps & 63) == 0 && ustime() > deadline) break;
+    }
+    return REDIS_OK;
+}
+
+/* Scan some more of the dataset, then finish the save if it is all
+ * written. */
+static void snapshotStep(forklessSave *fs, long long deadline) {
+    while (fs->dbid < server.dbnum) {
+        if (snapshotScanDb(fs,fs->dbid,deadline) == REDIS_ERR) {
+            snapshotWriteError(fs);
+            return;
+        }
+        if (!fs->done[fs->dbid]) return; /* Out of time. */
+        fs->dbid++;
+    }
+    snapshotFinish(fs);
+}
+
+static int snapshotTimeProc(struct aeEventLoop *eventLoop, long long id,
+                            void *clientData)
+{
+    forklessSave *fs = server.forkless_save;
+    REDIS_NOTUSED(eventLoop);
+    REDIS_NOTUSED(clientData);
+
+    /* The save this event was created for is over. */
+    if (fs == NULL || fs->te_id != id) return AE_NOMORE;
+
+    snapshotStep(fs,ustime()+REDIS_FORKLESS_SAVE_SLICE);
+    return server.forkless_save == fs ? 1 : AE_NOMORE;
+}
+
+/* Start a forkless save of the dataset into 'filename'. */
+int rdbSaveForkless(char *filename) {
+    forklessSave *fs;
+    FILE *fp;
+    char tmpfile[256];
+    int j;
+
+    if (server.forkless_save) return REDIS_ERR;
+    server.lastbgsave_try = time(NULL);
+
+    snprintf(tmpfile,256,"temp-forkless-%d.rdb", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        redisLog(REDIS_WARNING, "Failed opening .rdb for saving: %s",
+            strerror(errno));
+        server.lastbgsave_status = REDIS_ERR;
+        return REDIS_ERR;
+    }
+
+    fs = zcalloc(sizeof(*fs));
+    fs->fp = fp;
+    memcpy(fs->tmpfile,tmpfile,sizeof(tmpfile));
+    fs->filename = sdsnew(filename);
+    fs->start = mstime();
+    fs->dirty_before = server.dirty;
+    fs->last_dbid = -1;
+    fs->cursor = zcalloc(sizeof(unsigned long)*server.dbnum);
+    fs->done = zcalloc(sizeof(int)*server.dbnum);
+    fs->early = zcalloc(sizeof(dict*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++)
+        if (dictSize(server.db[j].dict) == 0) fs->done[j] = 1;
+
+    rioInitWithFile(&fs->rdb,fp);
+    if (server.rdb_save_incremental_fsync)
+        rioSetAutoSync(&fs->rdb,REDIS_AUTOSYNC_BYTES);
+    if (rdbSaveRioHeader(&fs->rdb) == -1) {
+        redisLog(REDIS_WARNING,"Write error in forkless save: %s",
+            strerror(errno));
+        fclose(fp);
+        unlink(tmpfile);
+        snapshotFree(fs);
+        server.lastbgsave_status = REDIS_ERR;
+        return REDIS_ERR;
+    }
+
+    fs->te_id = aeCreateTimeEvent(server.el,1,snapshotTimeProc,NULL,NULL);
+    server.forkless_save = fs;
+    server.rdb_forkless_time_start = time(NULL);
+    redisLog(REDIS_NOTICE,"Forkless background saving started");
+    return REDIS_OK;
+}
+
+/* Abort the save in progress, if any, removing the temp file. */
+void snapshotAbort(void) {
+    forklessSave *fs = server.forkless_save;
+
+    if (fs == NULL) return;
+    if (!fs->err) redisLog(REDIS_WARNING,"Forkless saving aborted");
+    fclose(fs->fp);
+    unlink(fs->tmpfile);
+    server.rdb_forkless_time_start = -1;
+    server.forkless_save = NULL;
+    snapshotFree(fs);
+}
+
+/* Called before 'key' of 'db' is modified, deleted, or its expire is
+ * changed: the value the key had when the save started is written now,
+ * unless the scan already did it. */
+void snapshotKeyWillChange(redisDb *db, sds key) {
+    forklessSave *fs = server.forkless_save;
+    dictEntry *de;
+
+    if (snapshotKeyHandled(fs,db,key)) return;
+    if ((de = dictFind(db->dict,key)) == NULL) return;
+    if (snapshotSaveKey(fs,db,dictGetKey(de),dictGetVal(de)) == REDIS_ERR) {
+        snapshotWriteError(fs);
+        return;
+    }
+    fs->early_keys++;
+    snapshotSkipKey(fs,db,key);
+}
+
+/* Called when 'key' is added to 'db': a key the scan did not visit yet
+ * didn't exist when the save started, or was already written by
+ * snapshotKeyWillChange() when it was deleted. */
+void snapshotKeyAdded(redisDb *db, sds key) {
+    forklessSave *fs = server.forkless_save;
+
+    if (snapshotKeyHandled(fs,db,key)) return;
+    snapshotSkipKey(fs,db,key);
+}
+
+/* Called before the keyspace of the DB 'dbid' (every DB if -1) is emptied
+ * or replaced: what the scan did not write yet is written now, blocking
+ * for a time proportional to the size of the DB. */
+void snapshotFlushDb(int dbid) {
+    forklessSave *fs = server.forkless_save;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbid != -1 && j != dbid) continue;
+        if (snapshotScanDb(fs,j,0) == REDIS_ERR) {
+            snapshotWriteError(fs);
+            return;
+        }
+    }
+    /* The save may be complete now. */
+    snapshotStep(fs,ustime());
+}
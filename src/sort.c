@@ -34,6 +34,10 @@
 #include <math.h> /* isnan() */
 
 zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank);
+void sortPatternInit(sortPattern *sp, robj *pattern);
+void sortPatternRelease(sortPattern *sp);
+robj *sortPatternLookup(redisDb *db, sortPattern *sp, robj *subst);
+int sortCompare(const void *s1, const void *s2);
 
 // 创建一次 SORT 操作
 redisSortOperation *createSortOperation(int type, robj *pattern) {
@@ -42,10 +46,19 @@ redisSortOperation *createSortOperation(int type, robj *pattern) {
 
     so->type = type;
     so->pattern = pattern;
+    sortPatternInit(&so->lookup,pattern);
 
     return so;
 }
 
+// 释放一次 SORT 操作
+void freeSortOperation(void *ptr) {
+    redisSortOperation *so = ptr;
+
+    sortPatternRelease(&so->lookup);
+    zfree(so);
+}
+
 /* Return the value associated to the key with a name obtained using
  * the following rules:
  *
@@ -77,49 +90,79 @@ redisSortOperation *createSortOperation(int type, robj *pattern) {
  * 如果返回的对象不是 NULL ，那么这个对象的引用计数总是被增一的。
  */
 robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
-    char *p, *f, *k;
-    sds spat, ssub;
-    robj *keyobj, *fieldobj = NULL, *o;
-    int prefixlen, sublen, postfixlen, fieldlen;
+    sortPattern sp;
+    robj *o;
+
+    sortPatternInit(&sp,pattern);
+    o = sortPatternLookup(db,&sp,subst);
+    sortPatternRelease(&sp);
+    return o;
+}
+
+/* Parse 'pattern' into 'sp'. The pattern object is not retained, it is
+ * owned by the client argument vector for the whole SORT call. */
+// 解析模式：'*' 的位置以及可选的 "->field" 部分
+void sortPatternInit(sortPattern *sp, robj *pattern) {
+    sds spat = pattern->ptr;
+    char *p, *f;
+    int fieldlen = 0;
+
+    sp->pattern = pattern;
+    sp->self = (spat[0] == '#' && spat[1] == '\0');
+    sp->prefixlen = -1;
+    sp->postfixlen = 0;
+    sp->field = NULL;
+    sp->keyobj = NULL;
+    if (sp->self || (p = strchr(spat,'*')) == NULL) return;
+
+    /* Find out if we're dealing with a hash dereference. */
+	// 检查指定的是字符串键还是 Hash 键
+    if ((f = strstr(p+1, "->")) != NULL && *(f+2) != '\0') {
+        fieldlen = sdslen(spat)-(f-spat)-2;
+        sp->field = createStringObject(f+2,fieldlen);
+    }
+    sp->prefixlen = p-spat;
+    sp->postfixlen = sdslen(spat)-(sp->prefixlen+1)-(fieldlen ? fieldlen+2 : 0);
+}
+
+void sortPatternRelease(sortPattern *sp) {
+    if (sp->field) decrRefCount(sp->field);
+    if (sp->keyobj) decrRefCount(sp->keyobj);
+    sp->field = sp->keyobj = NULL;
+}
+
+/* Implements lookupKeyByPattern() for an already parsed pattern. The key
+ * name is built into sp->keyobj, which is reused across calls unless the
+ * lookup retained a reference to it (e.g. to propagate an expire). */
+robj *sortPatternLookup(redisDb *db, sortPattern *sp, robj *subst) {
+    char buf[REDIS_LONGSTR_SIZE];
+    const char *ssub;
+    size_t sublen;
+    sds k;
+    robj *o;
 
     /* If the pattern is "#" return the substitution object itself in order
      * to implement the "SORT ... GET #" feature. */
 	// 如果模式是 # ，那么直接返回 subst
-    spat = pattern->ptr;
-    if (spat[0] == '#' && spat[1] == '\0') {
+    if (sp->self) {
         incrRefCount(subst);
         return subst;
     }
 
-    /* The substitution object may be specially encoded. If so we create
-     * a decoded object on the fly. Otherwise getDecodedObject will just
-     * increment the ref count, that we'll decrement later. */
-    // 获取解码后的 subst
-    subst = getDecodedObject(subst);
-    // 指向 subst 所保存的字符串
-    ssub = subst->ptr;
-
     /* If we can't find '*' in the pattern we return NULL as to GET a
      * fixed key does not make sense. */
 	// 如果模式不是 "#" ，并且模式中不带 '*' ，那么直接返回 NULL
     // 因为一直返回固定的键是没有意义的
-    p = strchr(spat,'*');
-    if (!p) {
-        decrRefCount(subst);
-        return NULL;
-    }
+    if (sp->prefixlen == -1) return NULL;
 
-    /* Find out if we're dealing with a hash dereference. */
-	// 检查指定的是字符串键还是 Hash 键
-    if ((f = strstr(p+1, "->")) != NULL && *(f+2) != '\0') {
-		// Hash 键
-        // 域的长度
-        fieldlen = sdslen(spat)-(f-spat)-2;
-        // 域的对象
-        fieldobj = createStringObject(f+2,fieldlen);
+    /* The substitution object may be integer encoded: render it on the
+     * stack instead of creating a decoded object. */
+    if (sdsEncodedObject(subst)) {
+        ssub = subst->ptr;
+        sublen = sdslen(subst->ptr);
     } else {
-		// 字符串键，没有域
-        fieldlen = 0;
+        ssub = buf;
+        sublen = ll2string(buf,sizeof(buf),(long)subst->ptr);
     }
 
     /* Perform the '*' substitution. */
@@ -128,49 +171,102 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
 	// 那么替换结果就是 nono_happ_www
     // 又比如说， subst 为 peter ，模式为 *-info->age
     // 那么替换结果就是 peter-info->age
-    prefixlen = p-spat;
-    sublen = sdslen(ssub);
-    postfixlen = sdslen(spat)-(prefixlen+1)-(fieldlen ? fieldlen+2 : 0);
-    keyobj = createStringObject(NULL,prefixlen+sublen+postfixlen);
-    k = keyobj->ptr;
-    memcpy(k,spat,prefixlen);
-    memcpy(k+prefixlen,ssub,sublen);
-    memcpy(k+prefixlen+sublen,p+1,postfixlen);
-    decrRefCount(subst); /* Incremented by decodeObject() */
+    if (sp->keyobj && sp->keyobj->refcount != 1) {
+        decrRefCount(sp->keyobj);
+        sp->keyobj = NULL;
+    }
+    if (sp->keyobj == NULL) sp->keyobj = createRawStringObject("",0);
+    k = sdscpylen(sp->keyobj->ptr,sp->pattern->ptr,sp->prefixlen);
+    k = sdscatlen(k,ssub,sublen);
+    k = sdscatlen(k,(char*)sp->pattern->ptr+sp->prefixlen+1,sp->postfixlen);
+    sp->keyobj->ptr = k;
 
     /* Lookup substituted key */
 	// 查找替换 key
-    o = lookupKeyRead(db,keyobj);
-    if (o == NULL) goto noobj;
+    o = lookupKeyRead(db,sp->keyobj);
+    if (o == NULL) return NULL;
 
     // 这是一个 Hash 键
-    if (fieldobj) {
-        if (o->type != REDIS_HASH) goto noobj;
+    if (sp->field) {
+        if (o->type != REDIS_HASH) return NULL;
 
         /* Retrieve value from hash by the field name. This operation
          * already increases the refcount of the returned object. */
 		// 从 Hash 键的指定域中获取值
-        o = hashTypeGetObject(o, fieldobj);
+        return hashTypeGetObject(o,sp->field);
+    }
 
     // 这是一个字符串键
-    } else {
-        if (o->type != REDIS_STRING) goto noobj;
+    if (o->type != REDIS_STRING) return NULL;
+
+    /* Every object that this function returns needs to have its refcount
+     * increased. sortCommand decreases it again. */
+	// 增一字符串键的计数
+    incrRefCount(o);
+    return o;
+}
 
-        /* Every object that this function returns needs to have its refcount
-         * increased. sortCommand decreases it again. */
-		// 增一字符串键的计数
-        incrRefCount(o);
+/* Sort 'vector' by the precomputed numeric scores with an LSD radix sort,
+ * then order the runs of equal scores with sortCompare() so the result is
+ * exactly the one qsort() would produce. server.sort_* must be set.
+ *
+ * 分值映射成保序的 64 位整数后做基数排序，相同分值的小段再用 sortCompare 排。 */
+static void sortRadixNumeric(redisSortObject *vector, long len, int desc) {
+    typedef struct { uint64_t key; long idx; } radixEntry;
+    radixEntry *a = zmalloc(sizeof(radixEntry)*len);
+    radixEntry *b = zmalloc(sizeof(radixEntry)*len);
+    radixEntry *t;
+    redisSortObject *sorted;
+    size_t count[8][256];
+    long j, run;
+    int pass;
+
+    /* Map every score to an integer with the same ordering: flip all the
+     * bits of negative numbers and just the sign bit of positive ones. */
+    memset(count,0,sizeof(count));
+    for (j = 0; j < len; j++) {
+        double score = vector[j].u.score;
+        uint64_t key;
+
+        if (score == 0) score = 0; /* -0.0 compares equal to 0.0 */
+        memcpy(&key,&score,sizeof(key));
+        key = (key & (1ULL<<63)) ? ~key : key | (1ULL<<63);
+        if (desc) key = ~key;
+        a[j].key = key;
+        a[j].idx = j;
+        for (pass = 0; pass < 8; pass++)
+            count[pass][(key >> (pass*8)) & 0xff]++;
     }
-    decrRefCount(keyobj);
-    if (fieldobj) decrRefCount(fieldobj);
 
-    // 返回值
-    return o;
+    for (pass = 0; pass < 8; pass++) {
+        size_t pos = 0, c;
+        int shift = pass*8, byte;
+
+        /* Every key has the same byte here: the pass is a no-op. */
+        if (count[pass][(a[0].key >> shift) & 0xff] == (size_t)len) continue;
+        for (byte = 0; byte < 256; byte++) {
+            c = count[pass][byte];
+            count[pass][byte] = pos;
+            pos += c;
+        }
+        for (j = 0; j < len; j++)
+            b[count[pass][(a[j].key >> shift) & 0xff]++] = a[j];
+        t = a; a = b; b = t;
+    }
 
-noobj:
-    decrRefCount(keyobj);
-    if (fieldlen) decrRefCount(fieldobj);
-    return NULL;
+    sorted = zmalloc(sizeof(redisSortObject)*len);
+    for (j = 0; j < len; j++) sorted[j] = vector[a[j].idx];
+    memcpy(vector,sorted,sizeof(redisSortObject)*len);
+    zfree(sorted);
+
+    /* Equal scores are ordered by the element itself. */
+    for (j = 0; j < len; j = run) {
+        for (run = j+1; run < len && a[run].key == a[j].key; run++);
+        if (run-j > 1)
+            qsort(vector+j,run-j,sizeof(redisSortObject),sortCompare);
+    }
+    zfree(a);
+    zfree(b);
 }
 
 /* sortCompare() is used by qsort in sortCommand(). Given that qsort_r with
@@ -280,7 +376,7 @@ void sortCommand(redisClient *c) {
 	// 创建一个链表，链表中保存了要对所有已排序元素执行的操作
 	// 操作可以是 GET 、 DEL 、 INCR 或者 DECR
     operations = listCreate();
-    listSetFreeMethod(operations,zfree);
+    listSetFreeMethod(operations,freeSortOperation);
 
 	// 指向参数位置
     j = 2; /* options start at argv[2] */
@@ -293,7 +389,7 @@ void sortCommand(redisClient *c) {
     if (sortval)
         incrRefCount(sortval);
     else
-        sortval = createListObject();
+        sortval = createQuicklistObject();
 
     /* The SORT command has an SQL-alike syntax, parse it */
 	// 读入并分析 SORT 命令的选项
@@ -508,7 +604,6 @@ void sortCommand(redisClient *c) {
         zset *zs = sortval->ptr;
         zskiplist *zsl = zs->zsl;
         zskiplistNode *ln;
-        robj *ele;
         int rangelen = vectorlen;
 
         /* Check if starting point is trivial, before doing log(N) lookup. */
@@ -528,8 +623,7 @@ void sortCommand(redisClient *c) {
 		// 遍历范围中的所有节点，并放进数组
         while(rangelen--) {
             redisAssertWithInfo(c,sortval,ln != NULL);
-            ele = ln->obj;
-            vector[j].obj = ele;
+            vector[j].obj = createStringObject(ln->ele,sdslen(ln->ele));
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
@@ -549,7 +643,8 @@ void sortCommand(redisClient *c) {
         dictEntry *setele;
         di = dictGetIterator(set);
         while((setele = dictNext(di)) != NULL) {
-            vector[j].obj = dictGetKey(setele);
+            sds sdsele = dictGetKey(setele);
+            vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
@@ -563,14 +658,16 @@ void sortCommand(redisClient *c) {
     /* Now it's time to load the right scores in the sorting vector */
 	// 载入权重值
     if (dontsort == 0) {
+        sortPattern bypat;
 
+        if (sortby) sortPatternInit(&bypat,sortby);
         for (j = 0; j < vectorlen; j++) {
             robj *byval;
 
 			// 如果使用了 BY 选项，那么就根据指定的对象作为权重
             if (sortby) {
                 /* lookup value to sort by */
-                byval = lookupKeyByPattern(c->db,sortby,vector[j].obj);
+                byval = sortPatternLookup(c->db,&bypat,vector[j].obj);
                 if (!byval) continue;
 			// 如果没有使用 BY 选项，那么使用对象本身作为权重
             } else {
@@ -609,6 +706,7 @@ void sortCommand(redisClient *c) {
                 decrRefCount(byval);
             }
         }
+        if (sortby) sortPatternRelease(&bypat);
 
     }
 
@@ -619,7 +717,9 @@ void sortCommand(redisClient *c) {
         server.sort_bypattern = sortby ? 1 : 0;
         server.sort_store = storekey ? 1 : 0;
 
-        if (sortby && (start != 0 || end != vectorlen-1))
+        if (!alpha && vectorlen >= REDIS_SORT_RADIX_MIN)
+            sortRadixNumeric(vector,vectorlen,desc);
+        else if (sortby && (start != 0 || end != vectorlen-1))
             pqsort(vector,vectorlen,sizeof(redisSortObject),sortCompare, start,end);
         else
             qsort(vector,vectorlen,sizeof(redisSortObject),sortCompare);
@@ -653,13 +753,13 @@ void sortCommand(redisClient *c) {
                 redisSortOperation *sop = ln->value;
 
 				// 解释并查找键
-                robj *val = lookupKeyByPattern(c->db,sop->pattern,
+                robj *val = sortPatternLookup(c->db,&sop->lookup,
                     vector[j].obj);
 
 				// 执行 GET 操作，将指定键的值添加到回复
                 if (sop->type == REDIS_SORT_GET) {
                     if (!val) {
-                        addReply(c,shared.nullbulk);
+                        addReplyNull(c);
                     } else {
                         addReplyBulk(c,val);
                         decrRefCount(val);
@@ -673,7 +773,7 @@ void sortCommand(redisClient *c) {
             }
         }
     } else {
-        robj *sobj = createZiplistObject();
+        robj *sobj = createQuicklistObject();
 
         /* STORE option specified, set the sorting result as a List object */
 		// 已设置 STORE 选项，将排序结果保存到列表对象
@@ -691,7 +791,7 @@ void sortCommand(redisClient *c) {
                 listRewind(operations,&li);
                 while((ln = listNext(&li))) {
                     redisSortOperation *sop = ln->value;
-                    robj *val = lookupKeyByPattern(c->db,sop->pattern,
+                    robj *val = sortPatternLookup(c->db,&sop->lookup,
                         vector[j].obj);
 
                     if (sop->type == REDIS_SORT_GET) {
@@ -699,7 +799,7 @@ void sortCommand(redisClient *c) {
 
                         /* listTypePush does an incrRefCount, so we should take care
                          * care of the incremented refcount caused by either
-                         * lookupKeyByPattern or createStringObject("",0) */
+                         * sortPatternLookup or createStringObject("",0) */
                         listTypePush(sobj,val,REDIS_TAIL);
                         decrRefCount(val);
                     } else {
@@ -726,10 +826,10 @@ void sortCommand(redisClient *c) {
         addReplyLongLong(c,outputlen);
     }
 
-    /* Cleanup */
-    if (sortval->type == REDIS_LIST || sortval->type == REDIS_SET)
-        for (j = 0; j < vectorlen; j++)
-            decrRefCount(vector[j].obj);
+    /* Cleanup: sorted set members are sds strings, so the zset branches
+     * above create their own objects as well. */
+    for (j = 0; j < vectorlen; j++)
+        decrRefCount(vector[j].obj);
     decrRefCount(sortval);
     listRelease(operations);
     for (j = 0; j < vectorlen; j++) {
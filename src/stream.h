@@ -0,0 +1,75 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "rax.h"
+
+/* Stream item ID: a 128 bit number composed of a milliseconds time and
+ * a sequence counter. IDs generated in the same millisecond (or in a
+ * millisecond smaller than the last one, after a clock jump) use the same
+ * milliseconds part and an incremented sequence.
+ *
+ * 流元素 ID ：毫秒时间 + 序号，严格单调递增 */
+typedef struct streamID {
+    uint64_t ms;        /* Unix time in milliseconds. */
+    uint64_t seq;       /* Sequence number. */
+} streamID;
+
+/* A stream is a radix tree of macro nodes. Every node is a ziplist holding
+ * a run of consecutive entries, indexed by the "master ID" of the node
+ * stored as a 128 bit big endian key, so that the radix tree order is the
+ * ID order. Entries store their ID as a delta from the master ID.
+ *
+ * 流由 rax 索引的多个 ziplist 宏节点组成，rax 的 key 是节点的主 ID（大端序）
+ *
+ * Layout of a node ziplist:
+ *
+ * [count][entry]...[entry]
+ *
+ * Where count is the number of entries in the node and every entry is:
+ *
+ * [ms-delta][seq][num-fields][field]...[value][lp-count]
+ *
+ * ms-delta is the difference between the milliseconds of the entry ID and
+ * the ones of the master ID, seq the sequence part of the entry ID, and
+ * lp-count the number of ziplist elements of the entry, so that the node
+ * can be also walked backward. */
+typedef struct stream {
+    rax *rax;               /* The radix tree holding the nodes. */
+    uint64_t length;        /* Number of entries in the stream. */
+    streamID last_id;       /* Greatest ID ever added, 0-0 if none. */
+} stream;
+
+/* Iterator over a range of entries. After streamIteratorStart(), call
+ * streamIteratorGetID() to move to the next entry in the range, then
+ * streamIteratorGetField() for each of its fields. */
+typedef struct streamIterator {
+    stream *stream;         /* The stream we are iterating. */
+    streamID master_id;     /* Master ID of the current node. */
+    streamID start_id;      /* Range start, inclusive. */
+    streamID end_id;        /* Range end, inclusive. */
+    int rev;                /* True if iterating from end_id to start_id. */
+    raxIterator ri;         /* Radix tree iterator over the nodes. */
+    unsigned char *zl;      /* Current node, NULL to move to the next node. */
+    unsigned char *zp;      /* Next entry to return in the current node. */
+    unsigned char *fp;      /* Next field of the current entry. */
+    unsigned char field_buf[21];  /* Buffers for integer encoded fields. */
+    unsigned char value_buf[21];
+} streamIterator;
+
+/* Prototypes of exported APIs. */
+stream *streamNew(void);
+void freeStream(stream *s);
+size_t streamLength(const robj *subject);
+int streamAppendItem(stream *s, robj **argv, int numfields, streamID *added_id, streamID *use_id);
+int64_t streamTrimByLength(stream *s, size_t maxlen, int approx);
+size_t streamReplyWithRange(redisClient *c, stream *s, streamID *start, streamID *end, size_t count, int rev);
+void streamIteratorStart(streamIterator *si, stream *s, streamID *start, streamID *end, int rev);
+int streamIteratorGetID(streamIterator *si, streamID *id, int64_t *numfields);
+void streamIteratorGetField(streamIterator *si, unsigned char **fieldptr, unsigned char **valueptr, int64_t *fieldlen, int64_t *valuelen);
+void streamIteratorStop(streamIterator *si);
+void streamEncodeID(void *buf, streamID *id);
+void streamDecodeID(void *buf, streamID *id);
+int streamCompareID(streamID *a, streamID *b);
+uint64_t streamNodeCount(unsigned char *zl);
+
+#endif
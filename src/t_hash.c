@@ -30,15 +30,129 @@
 #include "redis.h"
 #include <math.h>
 
+/*-----------------------------------------------------------------------------
+ * Listpack field index
+ *
+ * See hashListpackIndex in redis.h. Writes keep the index in sync without
+ * rehashing: a value replaced in place or a deleted pair only moves the
+ * entries stored after it, so it is enough to adjust their offsets.
+ *
+ * 写操作只会移动修改点之后的 entry，调整偏移量即可，不需要重新计算哈希值。
+ *----------------------------------------------------------------------------*/
+
+#define HASH_INDEX_MIN_BUCKETS 16
+
+/* Hash the field stored at 'p', integer encoded entries are hashed using
+ * their string representation, that is what the client sent. */
+static uint32_t hashIndexHashEntry(unsigned char *p) {
+    unsigned char intbuf[LP_INTBUF_SIZE], *s;
+    int64_t len;
+
+    s = lpGet(p,&len,intbuf);
+    return (uint32_t)dictGenHashFunction(s,(int)len);
+}
+
+/* Smallest power of two number of buckets keeping 'count' fields at most
+ * 3/4 full. */
+static uint32_t hashIndexBucketsFor(unsigned long count) {
+    uint32_t buckets = HASH_INDEX_MIN_BUCKETS;
+
+    while (buckets - buckets/4 < count) buckets *= 2;
+    return buckets;
+}
+
+static void hashIndexAdd(hashListpackIndex *idx, uint32_t offset, uint32_t h) {
+    uint32_t j = h & idx->mask;
+
+    while (idx->offsets[j]) j = (j+1) & idx->mask;
+    idx->offsets[j] = offset;
+    idx->used++;
+}
+
+/* Build an index for 'lp' with room for at least 'count' fields. */
+static hashListpackIndex *hashIndexCreate(unsigned char *lp, unsigned long count) {
+    uint32_t buckets = hashIndexBucketsFor(count);
+    hashListpackIndex *idx;
+    unsigned char *p;
+
+    idx = zcalloc(sizeof(*idx)+sizeof(uint32_t)*buckets);
+    idx->lp = lp;
+    idx->mask = buckets-1;
+    for (p = lpFirst(lp); p != NULL; p = lpNext(lp,lpNext(lp,p)))
+        hashIndexAdd(idx,p-lp,hashIndexHashEntry(p));
+    return idx;
+}
+
+/* Return the bucket holding 'field', or -1 if the field is not there. */
+static long hashIndexFind(hashListpackIndex *idx, unsigned char *field,
+                          unsigned int len)
+{
+    uint32_t j = (uint32_t)dictGenHashFunction(field,len) & idx->mask;
+
+    while (idx->offsets[j]) {
+        if (lpCompare(idx->lp+idx->offsets[j],field,len)) return j;
+        j = (j+1) & idx->mask;
+    }
+    return -1;
+}
+
+/* Entries after 'offset' moved by 'delta' bytes. */
+static void hashIndexShift(hashListpackIndex *idx, uint32_t offset, long delta) {
+    uint32_t j;
+
+    if (delta == 0) return;
+    for (j = 0; j <= idx->mask; j++)
+        if (idx->offsets[j] > offset) idx->offsets[j] += delta;
+}
+
+/* Empty bucket 'j' and move back the entries of the same probe sequence
+ * that follow it, so that lookups don't need tombstones. */
+static void hashIndexRemove(hashListpackIndex *idx, uint32_t j) {
+    uint32_t i = j, k;
+
+    idx->offsets[i] = 0;
+    idx->used--;
+    while (1) {
+        j = (j+1) & idx->mask;
+        if (idx->offsets[j] == 0) break;
+        k = hashIndexHashEntry(idx->lp+idx->offsets[j]) & idx->mask;
+        /* The entry in 'j' may fill 'i' only when its home bucket 'k' is
+         * not cyclically inside (i,j]. */
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        idx->offsets[i] = idx->offsets[j];
+        idx->offsets[j] = 0;
+        i = j;
+    }
+}
+
+/* Convert a LISTPACK hash into a LISTPACK_IDX one if it is big enough. */
+void hashTypeTryIndexListpack(robj *o) {
+    unsigned long len;
+
+    if (o->encoding != REDIS_ENCODING_LISTPACK ||
+        server.hash_ziplist_index_entries == 0) return;
+    len = hashTypeLength(o);
+    if (len > server.hash_ziplist_index_entries)
+        hashTypeConvert(o, REDIS_ENCODING_LISTPACK_IDX);
+}
+
+/* Bytes used by the index of a LISTPACK_IDX hash, not counting 'lp'. */
+size_t hashTypeIndexBytes(robj *o) {
+    hashListpackIndex *idx = o->ptr;
+
+    redisAssert(o->encoding == REDIS_ENCODING_LISTPACK_IDX);
+    return sizeof(*idx)+sizeof(uint32_t)*((size_t)idx->mask+1);
+}
+
 /*-----------------------------------------------------------------------------
  * Hash type API
  *----------------------------------------------------------------------------*/
 
 /* Check the length of a number of objects to see if we need to convert a
- * ziplist to a real hash. 
+ * listpack to a real hash. 
  *
  * 对 argv 数组中的多个对象进行检查，
- * 看是否需要将对象的编码从 REDIS_ENCODING_ZIPLIST 转换成 REDIS_ENCODING_HT
+ * 看是否需要将对象的编码从 REDIS_ENCODING_LISTPACK 转换成 REDIS_ENCODING_HT
  *
  * Note that we only check string encoded objects
  * as their string length can be queried in constant time. 
@@ -49,8 +163,8 @@
 void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     int i;
 
-    // 如果对象不是 ziplist 编码，那么直接返回
-    if (o->encoding != REDIS_ENCODING_ZIPLIST) return;
+    // 如果对象不是 listpack 编码，那么直接返回
+    if (!hashTypeIsListpack(o)) return;
 
     // 检查所有输入对象，看它们的字符串值是否超过了指定长度
     for (i = start; i <= end; i++) {
@@ -58,7 +172,7 @@ void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
             sdslen(argv[i]->ptr) > server.hash_max_ziplist_value)   // #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
         {
             // 将对象的编码转换成 REDIS_ENCODING_HT
-            // 将 REDIS_HASH obj 从 REDIS_ENCODING_ZIPLIST 转换为 REDIS_ENCODING_HT 的底层编码方式
+            // 将 REDIS_HASH obj 从 REDIS_ENCODING_LISTPACK 转换为 REDIS_ENCODING_HT 的底层编码方式
             hashTypeConvert(o, REDIS_ENCODING_HT);
             break;
         }
@@ -71,7 +185,7 @@ void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
  * 尝试对对象 o1 和 o2 进行编码压缩，
  * 以节省更多内存。
  * 
- * 当 subject 是 REDIS_ENCODING_ZIPLIST 的时候，就没有必要进行了，因为在 insert ziplist 的时候，还会在编码压缩一次
+ * 当 subject 是 REDIS_ENCODING_LISTPACK 的时候，就没有必要进行了，因为在 insert listpack 的时候，还会在编码压缩一次
  */
 // 因为 encoding 的过程中，o1 o2 的指针本身可能就会发生变化，所以直接传递二维指针
 void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2) {
@@ -81,10 +195,10 @@ void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2) {
     }
 }
 
-/* Get the value from a ziplist encoded hash, identified by field.
+/* Get the value from a listpack encoded hash, identified by field.
  * Returns -1 when the field cannot be found. 
  *
- * 从 ziplist 编码的 hash 中取出和 field 相对应的值。
+ * 从 listpack 编码的 hash 中取出和 field 相对应的值。
  *
  * 参数：
  *  field   域
@@ -95,40 +209,44 @@ void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2) {
  * 查找失败时，函数返回 -1 。
  * 查找成功时，返回 0 。
  */
-int hashTypeGetFromZiplist(robj *o, robj *field,
-                           unsigned char **vstr,
-                           unsigned int *vlen,
-                           long long *vll)
+int hashTypeGetFromListpack(robj *o, robj *field,
+                            unsigned char **vstr,
+                            unsigned int *vlen,
+                            long long *vll)
 {
     unsigned char *zl, *fptr = NULL, *vptr = NULL;
-    int ret;
 
     // 确保编码正确
-    redisAssert(o->encoding == REDIS_ENCODING_ZIPLIST);
+    redisAssert(hashTypeIsListpack(o));
 
     // 取出未编码的域（以防万一的操作）
     field = getDecodedObject(field);
 
-    // 遍历 ziplist ，查找域的位置
-    zl = o->ptr;
-    fptr = ziplistIndex(zl, ZIPLIST_HEAD);
-    if (fptr != NULL) {
+    // 有索引时直接定位，否则遍历 listpack ，查找域的位置
+    if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+        hashListpackIndex *idx = o->ptr;
+        long j = hashIndexFind(idx, field->ptr, sdslen(field->ptr));
+
+        if (j != -1) {
+            vptr = lpNext(idx->lp, idx->lp+idx->offsets[j]);
+            redisAssert(vptr != NULL);
+        }
+    } else if ((fptr = lpFirst(zl = o->ptr)) != NULL) {
         // 定位包含域的节点
-        fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+        fptr = lpFind(zl, fptr, field->ptr, sdslen(field->ptr), 1);
         if (fptr != NULL) {
             /* Grab pointer to the value (fptr points to the field) */
             // 域已经找到，取出和它相对应的值的位置
-            vptr = ziplistNext(zl, fptr);
+            vptr = lpNext(zl, fptr);
             redisAssert(vptr != NULL);
         }
     }
 
     decrRefCount(field);
 
-    // 从 ziplist 节点中取出值
+    // 从 listpack 节点中取出值
     if (vptr != NULL) {
-        ret = ziplistGet(vptr, vstr, vlen, vll);
-        redisAssert(ret);
+        *vstr = lpGetValue(vptr, vlen, vll);
         return 0;
     }
 
@@ -176,13 +294,13 @@ int hashTypeGetFromHashTable(robj *o, robj *field, robj **value) {
 robj *hashTypeGetObject(robj *o, robj *field) {
     robj *value = NULL;
 
-    // 从 ziplist 中取出值
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 从 listpack 中取出值
+    if (hashTypeIsListpack(o)) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) {
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) {
             // 创建值对象
             if (vstr) {
                 value = createStringObject((char*)vstr, vlen);
@@ -217,13 +335,13 @@ robj *hashTypeGetObject(robj *o, robj *field) {
  */
 int hashTypeExists(robj *o, robj *field) {
 
-    // 检查 ziplist
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 检查 listpack
+    if (hashTypeIsListpack(o)) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
 
     // 检查字典
     } else if (o->encoding == REDIS_ENCODING_HT) {
@@ -259,13 +377,13 @@ int hashTypeExists(robj *o, robj *field) {
 int hashTypeSet(robj *o, robj *field, robj *value) {
     int update = 0;
 
-    // 添加到 ziplist
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 添加到 listpack
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr, *vptr;
 
         // 解码成字符串或者数字
-        // ziplist 的压缩编码方式跟 obj 的压缩编码方式不一样
-        // 而且 ziplist 的编解码 api 并不支持直接接受 robj，再取出 robj->ptr，只能手动向 ziplist 的 api 传递 robj->ptr
+        // listpack 的压缩编码方式跟 obj 的压缩编码方式不一样
+        // 而且 listpack 的编解码 api 并不支持直接接受 robj，再取出 robj->ptr，只能手动向 listpack 的 api 传递 robj->ptr
         // 要拿出 robj->ptr，只能再次解码
         // 这里之所以要看起来如此多余的再 decode 一次，是因为 hashTypeSet() 日后可能会被其他地方调用
         // 再次调用 getDecodedObject 是一种强保证，你看看 getDecodedObject 里面的代码，没有进行压缩编码的 robj 实际上很快就 return 了
@@ -273,38 +391,34 @@ int hashTypeSet(robj *o, robj *field, robj *value) {
         field = getDecodedObject(field);
         value = getDecodedObject(value);
 
-        // 遍历整个 ziplist ，尝试查找并更新 field （如果它已经存在的话）
-        // 采用 REDIS_ENCODING_ZIPLIST 构成的 REDIS_HT 会在 tail 顺序的保存一个 key-value 对的 field、value 字段
+        // 遍历整个 listpack ，尝试查找并更新 field （如果它已经存在的话）
+        // 采用 REDIS_ENCODING_LISTPACK 构成的 REDIS_HT 会在 tail 顺序的保存一个 key-value 对的 field、value 字段
         zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);  // 从 ziplist 中拿出第一个 entry，然后再 ziplistFind() 里面，从头开始寻找
+        fptr = lpFirst(zl);  // 从 listpack 中拿出第一个 entry，然后再 lpFind() 里面，从头开始寻找
         if (fptr != NULL) {
             // 定位到域 field
-            fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+            fptr = lpFind(zl, fptr, field->ptr, sdslen(field->ptr), 1);
             if (fptr != NULL) {
                 /* Grab pointer to the value (fptr points to the field) */
                 // 定位到域的值
-                vptr = ziplistNext(zl, fptr);   // 因为 field、value 顺序保存，所以直接拿 next
+                vptr = lpNext(zl, fptr);   // 因为 field、value 顺序保存，所以直接拿 next
                 redisAssert(vptr != NULL);
 
                 // 标识这次操作为更新操作
                 update = 1;
 
-                /* Delete value */
-                // 删除旧的键值对
-                zl = ziplistDelete(zl, &vptr);
-
-                /* Insert new value */
-                // 添加新的键值对
-                zl = ziplistInsert(zl, vptr, value->ptr, sdslen(value->ptr));
+                /* Replace value */
+                // 原地替换旧的值
+                zl = lpReplace(zl, &vptr, value->ptr, sdslen(value->ptr));
             }
         }
 
         // 如果这不是更新操作，那么这就是一个添加操作
         if (!update) {
-            /* Push new field/value pair onto the tail of the ziplist */
-            // 将新的 field-value 对推入到 ziplist 的末尾
-            zl = ziplistPush(zl, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-            zl = ziplistPush(zl, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+            /* Push new field/value pair onto the tail of the listpack */
+            // 将新的 field-value 对推入到 listpack 的末尾
+            zl = lpAppend(zl, field->ptr, sdslen(field->ptr));
+            zl = lpAppend(zl, value->ptr, sdslen(value->ptr));
         }
         
         // 更新对象指针
@@ -314,8 +428,51 @@ int hashTypeSet(robj *o, robj *field, robj *value) {
         decrRefCount(field);
         decrRefCount(value);
 
-        /* Check if the ziplist needs to be converted to a hash table */
-        // 检查在添加操作完成之后，是否需要将 ZIPLIST 编码转换成 HT 编码（可以再放前一点，但是代码结构会变得很差）
+        /* Check if the listpack needs to be converted to a hash table */
+        // 检查在添加操作完成之后，是否需要将 LISTPACK 编码转换成 HT 编码（可以再放前一点，但是代码结构会变得很差）
+        if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+            hashTypeConvert(o, REDIS_ENCODING_HT);
+        else
+            hashTypeTryIndexListpack(o);
+
+    // 添加到带索引的 listpack
+    } else if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+        hashListpackIndex *idx = o->ptr;
+        unsigned char *vptr;
+        size_t oldbytes = lpBytes(idx->lp);
+        long j;
+
+        field = getDecodedObject(field);
+        value = getDecodedObject(value);
+
+        j = hashIndexFind(idx, field->ptr, sdslen(field->ptr));
+        if (j != -1) {
+            uint32_t voffset;
+
+            // 原地替换旧值，之后的 entry 整体平移
+            vptr = lpNext(idx->lp, idx->lp+idx->offsets[j]);
+            redisAssert(vptr != NULL);
+            voffset = vptr-idx->lp;
+            idx->lp = lpReplace(idx->lp, &vptr, value->ptr, sdslen(value->ptr));
+            hashIndexShift(idx, voffset, (long)lpBytes(idx->lp)-(long)oldbytes);
+            update = 1;
+        } else if (idx->used+1 > idx->mask+1-(idx->mask+1)/4) {
+            /* Out of buckets: append, then rebuild a bigger index. */
+            idx->lp = lpAppend(idx->lp, field->ptr, sdslen(field->ptr));
+            idx->lp = lpAppend(idx->lp, value->ptr, sdslen(value->ptr));
+            o->ptr = hashIndexCreate(idx->lp, idx->used+1);
+            zfree(idx);
+        } else {
+            /* The new field starts where the listpack terminator was. */
+            idx->lp = lpAppend(idx->lp, field->ptr, sdslen(field->ptr));
+            idx->lp = lpAppend(idx->lp, value->ptr, sdslen(value->ptr));
+            hashIndexAdd(idx, oldbytes-1,
+                (uint32_t)dictGenHashFunction(field->ptr,sdslen(field->ptr)));
+        }
+
+        decrRefCount(field);
+        decrRefCount(value);
+
         if (hashTypeLength(o) > server.hash_max_ziplist_entries)
             hashTypeConvert(o, REDIS_ENCODING_HT);
 
@@ -350,21 +507,20 @@ int hashTypeSet(robj *o, robj *field, robj *value) {
 int hashTypeDelete(robj *o, robj *field) {
     int deleted = 0;
 
-    // 从 ziplist 中删除
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 从 listpack 中删除
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr;
 
         field = getDecodedObject(field);
 
         zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        fptr = lpFirst(zl);
         if (fptr != NULL) {
             // 定位到域
-            fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+            fptr = lpFind(zl, fptr, field->ptr, sdslen(field->ptr), 1);
             if (fptr != NULL) {
-                // 删除域和值
-                zl = ziplistDelete(zl,&fptr);
-                zl = ziplistDelete(zl,&fptr);   // 紧接下来的就是 value 字段
+                // 删除域和紧接下来的值
+                zl = lpDeleteRangeWithEntry(zl,&fptr,2);
                 o->ptr = zl;    // 把新的 zl 更新到 robj 里面
                 deleted = 1;
             }
@@ -372,13 +528,32 @@ int hashTypeDelete(robj *o, robj *field) {
 
         decrRefCount(field);    // 因为 getDecodedObject 会增加引用计数
 
+    // 从带索引的 listpack 中删除
+    } else if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+        hashListpackIndex *idx = o->ptr;
+        long j;
+
+        field = getDecodedObject(field);
+        j = hashIndexFind(idx, field->ptr, sdslen(field->ptr));
+        if (j != -1) {
+            uint32_t foffset = idx->offsets[j];
+            unsigned char *fptr = idx->lp+foffset;
+            size_t oldbytes = lpBytes(idx->lp);
+
+            idx->lp = lpDeleteRangeWithEntry(idx->lp,&fptr,2);
+            hashIndexShift(idx, foffset, (long)lpBytes(idx->lp)-(long)oldbytes);
+            hashIndexRemove(idx, j);
+            deleted = 1;
+        }
+        decrRefCount(field);
+
     // 从字典中删除
     } else if (o->encoding == REDIS_ENCODING_HT) {
         if (dictDelete((dict*)o->ptr, field) == REDIS_OK) {
             deleted = 1;
 
             /* Always check if the dictionary needs a resize after a delete. */
-            // 删除成功时，看字典是否需要收缩。无所谓，收缩了也不会编程 ziplist（没办法 hash-table 实在是耗内存）
+            // 删除成功时，看字典是否需要收缩。无所谓，收缩了也不会编程 listpack（没办法 hash-table 实在是耗内存）
             if (htNeedsResize(o->ptr)) dictResize(o->ptr);
         }
 
@@ -397,9 +572,11 @@ int hashTypeDelete(robj *o, robj *field) {
 unsigned long hashTypeLength(robj *o) {
     unsigned long length = ULONG_MAX;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        // ziplist 中，每个 field-value 对都需要使用两个节点来保存
-        length = ziplistLen(o->ptr) / 2;
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        // listpack 中，每个 field-value 对都需要使用两个节点来保存
+        length = lpLength(o->ptr) / 2;
+    } else if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+        length = ((hashListpackIndex*)o->ptr)->used;
     } else if (o->encoding == REDIS_ENCODING_HT) {
         length = dictSize((dict*)o->ptr);
     } else {
@@ -425,11 +602,12 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
     // 指向对象
     hi->subject = subject;
 
-    // 记录编码
-    hi->encoding = subject->encoding;
+    // 记录编码：带索引的 listpack 和普通 listpack 的迭代方式完全一样
+    hi->encoding = hashTypeIsListpack(subject) ? REDIS_ENCODING_LISTPACK :
+                                                 subject->encoding;
 
-    // 以 ziplist 的方式初始化迭代器
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 以 listpack 的方式初始化迭代器
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         hi->fptr = NULL;
         hi->vptr = NULL;
 
@@ -455,7 +633,7 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
         dictReleaseIterator(hi->di);
     }
 
-    // 释放 ziplist 迭代器
+    // 释放 listpack 迭代器
     zfree(hi);
 }
 
@@ -471,12 +649,12 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
  */
 int hashTypeNext(hashTypeIterator *hi) {
 
-    // 迭代 ziplist
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 迭代 listpack
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl;
         unsigned char *fptr, *vptr; // 为了异常安全而采用的临时变量
 
-        zl = hi->subject->ptr;
+        zl = hashTypeListpack(hi->subject);
         fptr = hi->fptr;
         vptr = hi->vptr;
 
@@ -484,21 +662,21 @@ int hashTypeNext(hashTypeIterator *hi) {
         if (fptr == NULL) {
             /* Initialize cursor */
             redisAssert(vptr == NULL);
-            fptr = ziplistIndex(zl, 0); // 可以替换为 ZIPLIST_HEAD
+            fptr = lpFirst(zl);
 
         // 获取下一个迭代节点
         } else {
             /* Advance cursor */
             redisAssert(vptr != NULL);
-            fptr = ziplistNext(zl, vptr);
+            fptr = lpNext(zl, vptr);
         }
 
-        // 迭代完毕，或者 ziplist 为空
+        // 迭代完毕，或者 listpack 为空
         if (fptr == NULL) return REDIS_ERR;
 
         /* Grab pointer to the value (fptr points to the field) */
         // 记录值的指针
-        vptr = ziplistNext(zl, fptr);
+        vptr = lpNext(zl, fptr);
         redisAssert(vptr != NULL);
 
         /* fptr, vptr now point to the first or next pair */
@@ -520,30 +698,26 @@ int hashTypeNext(hashTypeIterator *hi) {
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromZiplist`. 
+ * encoded as a listpack. Prototype is similar to `hashTypeGetFromListpack`. 
  *
- * 从 ziplist 编码的哈希中，取出迭代器指针当前指向节点的域或值。
+ * 从 listpack 编码的哈希中，取出迭代器指针当前指向节点的域或值。
  */
 // int what, 决定取出什么字段，REDIS_HASH_KEY\REDIS_HASH_VALUE
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll)
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll)
 {
-    int ret;
-
     // 确保编码正确
-    redisAssert(hi->encoding == REDIS_ENCODING_ZIPLIST);
+    redisAssert(hi->encoding == REDIS_ENCODING_LISTPACK);
 
     // 取出键
     if (what & REDIS_HASH_KEY) {
-        ret = ziplistGet(hi->fptr, vstr, vlen, vll);
-        redisAssert(ret);
+        *vstr = lpGetValue(hi->fptr, vlen, vll);
 
     // 取出值
     } else {
-        ret = ziplistGet(hi->vptr, vstr, vlen, vll);
-        redisAssert(ret);
+        *vstr = lpGetValue(hi->vptr, vlen, vll);
     }
 }
 
@@ -581,17 +755,17 @@ void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst) {
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what) {
     robj *dst;
 
-    // ziplist
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    // listpack
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
         // 取出键或值
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
 
         // 创建键或值的对象
-        // 但是，ZIPLIST 的 encoding 却是 copy-on-write friendly 的，因为你不得不创建一个 robj 来装载 ziplist 里面的一个 node
+        // 但是，LISTPACK 的 encoding 却是 copy-on-write friendly 的，因为你不得不创建一个 robj 来装载 listpack 里面的一个 node
         if (vstr) {
             dst = createStringObject((char*)vstr, vlen);
         } else {
@@ -642,15 +816,20 @@ robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key) {
 }
 
 /*
- * 将一个 ziplist 编码的哈希对象 o 转换成其他编码
+ * 将一个 listpack 编码的哈希对象 o 转换成其他编码
  */
-void hashTypeConvertZiplist(robj *o, int enc) {
-    redisAssert(o->encoding == REDIS_ENCODING_ZIPLIST);
+void hashTypeConvertListpack(robj *o, int enc) {
+    redisAssert(o->encoding == REDIS_ENCODING_LISTPACK);
 
-    // 如果输入是 ZIPLIST ，那么不做动作
-    if (enc == REDIS_ENCODING_ZIPLIST) {
+    // 如果输入是 LISTPACK ，那么不做动作
+    if (enc == REDIS_ENCODING_LISTPACK) {
         /* Nothing to do... */
 
+    // 为 listpack 建立域索引
+    } else if (enc == REDIS_ENCODING_LISTPACK_IDX) {
+        o->ptr = hashIndexCreate(o->ptr, hashTypeLength(o));
+        o->encoding = REDIS_ENCODING_LISTPACK_IDX;
+
     // 转换成 HT 编码
     } else if (enc == REDIS_ENCODING_HT) {
 
@@ -664,32 +843,32 @@ void hashTypeConvertZiplist(robj *o, int enc) {
         // 创建空白的新字典
         dict = dictCreate(&hashDictType, NULL);
 
-        // 遍历整个 ziplist
+        // 遍历整个 listpack
         while (hashTypeNext(hi) != REDIS_ERR) {
             robj *field, *value;
 
-            // 取出 ziplist 里的键
+            // 取出 listpack 里的键
             field = hashTypeCurrentObject(hi, REDIS_HASH_KEY);
             field = tryObjectEncoding(field);
 
-            // 取出 ziplist 里的值
+            // 取出 listpack 里的值
             value = hashTypeCurrentObject(hi, REDIS_HASH_VALUE);
             value = tryObjectEncoding(value);
 
             // 将键值对添加到字典
             ret = dictAdd(dict, field, value);
             if (ret != DICT_OK) {
-                redisLogHexDump(REDIS_WARNING,"ziplist with dup elements dump",
-                    o->ptr,ziplistBlobLen(o->ptr));
+                redisLogHexDump(REDIS_WARNING,"listpack with dup elements dump",
+                    o->ptr,lpBytes(o->ptr));
                 redisAssert(ret == DICT_OK);
             }
         }
 
-        // 释放 ziplist 的迭代器
+        // 释放 listpack 的迭代器
         hashTypeReleaseIterator(hi);
 
-        // 释放对象原来的 ziplist
-        zfree(o->ptr);
+        // 释放对象原来的 listpack
+        lpFree(o->ptr);
 
         // 更新哈希的编码和值对象
         o->encoding = REDIS_ENCODING_HT;
@@ -703,12 +882,22 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 /*
  * 对哈希对象 o 的编码方式进行转换
  *
- * 目前只支持将 ZIPLIST 编码转换成 HT 编码
+ * 目前只支持将 LISTPACK 编码转换成 HT 编码
  */
 void hashTypeConvert(robj *o, int enc) {
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        hashTypeConvertZiplist(o, enc);
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        hashTypeConvertListpack(o, enc);
+
+    } else if (o->encoding == REDIS_ENCODING_LISTPACK_IDX) {
+        hashListpackIndex *idx = o->ptr;
+
+        if (enc == REDIS_ENCODING_LISTPACK_IDX) return;
+        // 丢掉索引，退回普通 listpack 再转换
+        o->ptr = idx->lp;
+        o->encoding = REDIS_ENCODING_LISTPACK;
+        zfree(idx);
+        hashTypeConvertListpack(o, enc);
 
     } else if (o->encoding == REDIS_ENCODING_HT) {
         // 当前版本暂时不支持缩小规模（既然能够 hash 到一定的规模，充分证明扩容是必要的，确确实实有可能，那就没有必要再缩小了）
@@ -969,20 +1158,20 @@ static void addHashFieldToReply(redisClient *c, robj *o, robj *field) {
 
     // 对象不存在
     if (o == NULL) {
-        addReply(c, shared.nullbulk);
+        addReplyNull(c);
         return;
     }
 
-    // ziplist 编码
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    // listpack 编码
+    if (hashTypeIsListpack(o)) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
         // 取出值
-        ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
+        ret = hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll);
         if (ret < 0) {
-            addReply(c, shared.nullbulk);
+            addReplyNull(c);
         } else {
             if (vstr) {
                 addReplyBulkCBuffer(c, vstr, vlen);
@@ -998,7 +1187,7 @@ static void addHashFieldToReply(redisClient *c, robj *o, robj *field) {
         // 取出值
         ret = hashTypeGetFromHashTable(o, field, &value);
         if (ret < 0) {
-            addReply(c, shared.nullbulk);
+            addReplyNull(c);
         } else {
             addReplyBulk(c, value);
         }
@@ -1011,7 +1200,7 @@ static void addHashFieldToReply(redisClient *c, robj *o, robj *field) {
 void hgetCommand(redisClient *c) {
     robj *o;
 
-    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,o,REDIS_HASH)) return;
 
     // 取出并返回域的值
@@ -1102,13 +1291,13 @@ void hlenCommand(redisClient *c) {
  */
 static void addHashIteratorCursorToReply(redisClient *c, hashTypeIterator *hi, int what) {
 
-    // 处理 ZIPLIST
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 处理 LISTPACK
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             addReplyBulkCBuffer(c, vstr, vlen);
         } else {
@@ -1132,9 +1321,12 @@ void genericHgetallCommand(redisClient *c, int flags) {
     hashTypeIterator *hi;
     int multiplier = 0;
     int length, count = 0;
+    /* HGETALL replies with a map, HKEYS and HVALS with an array. */
+    int ismap = (flags & REDIS_HASH_KEY) && (flags & REDIS_HASH_VALUE);
 
     // 取出哈希对象
-    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],
+            ismap ? shared.emptymap[c->resp] : shared.emptymultibulk)) == NULL
         || checkType(c,o,REDIS_HASH)) return;
 
     // 计算要取出的元素数量
@@ -1143,7 +1335,10 @@ void genericHgetallCommand(redisClient *c, int flags) {
 
     length = hashTypeLength(o) * multiplier;
 
-    addReplyMultiBulkLen(c, length);
+    if (ismap)
+        addReplyMapLen(c, length/2);
+    else
+        addReplyMultiBulkLen(c, length);
 
     // 迭代节点，并取出元素
     hi = hashTypeInitIterator(o);
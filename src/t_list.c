@@ -29,34 +29,10 @@
 
 #include "redis.h"
 
-void signalListAsReady(redisClient *c, robj *key);
-
 /*-----------------------------------------------------------------------------
  * List API
  *----------------------------------------------------------------------------*/
 
-/* Check the argument length to see if it requires us to convert the ziplist
- * to a real list. Only check raw-encoded objects because integer encoded
- * objects are never too long. 
- *
- * 对输入值 value 进行检查，看是否需要将 subject 从 ziplist 转换为双端链表，
- * 以便保存值 value 。
- *
- * 函数只对 REDIS_ENCODING_RAW 编码的 value 进行检查，
- * 因为整数编码的值不可能超长。
- */
-void listTypeTryConversion(robj *subject, robj *value) {
-
-    // 确保 subject 为 ZIPLIST 编码
-    if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
-
-    // 看字符串是否过长，过长的话，改变底层编码方式
-    if (sdsEncodedObject(value) &&
-        sdslen(value->ptr) > server.list_max_ziplist_value)
-            // 将编码转换为双端链表
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
-}
-
 /* The function pushes an element to the specified list object 'subject',
  * at head or tail position as specified by 'where'.
  *
@@ -75,38 +51,25 @@ void listTypeTryConversion(robj *subject, robj *value) {
  */
 void listTypePush(robj *subject, robj *value, int where) {
 
-    /* Check if we need to convert the ziplist */
-    // 是否需要转换编码？
-    listTypeTryConversion(subject,value);   // 单个 node 的长度检查
-
-    // 整个 list 的长度检查，REDIS_LIST_MAX_ZIPLIST_ENTRIES 512（也未免太长了吧）
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
-        ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
-
-    // ZIPLIST
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
-        // 取出对象的值，因为 ZIPLIST 只能保存字符串或整数
+    // QUICKLIST，是否需要新建 quicklist 节点由 quicklist 自己根据 fill 决定
+    if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        // 取出对象的值，因为 ziplist 只能保存字符串或整数
         value = getDecodedObject(value);
-        subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+        quicklistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
         decrRefCount(value);    // ziplist 是编码进去的，而不是引用
 
-    // 双端链表
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        if (where == REDIS_HEAD) {
-            listAddNodeHead(subject->ptr,value);
-        } else {
-            listAddNodeTail(subject->ptr,value);
-        }
-        incrRefCount(value);
-
     // 未知编码
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+/* Used by quicklistPopCustom() to create the popped object directly. */
+static void *listPopSaver(unsigned char *data, unsigned int sz) {
+    return createStringObject((char*)data,sz);
+}
+
 /*
  * 从列表的表头或表尾中弹出一个元素。
  *
@@ -117,50 +80,16 @@ void listTypePush(robj *subject, robj *value, int where) {
  *  - REDIS_TAIL 从表尾弹出
  */
 robj *listTypePop(robj *subject, int where) {
-
+    long long vlong;
     robj *value = NULL;
 
-    // ZIPLIST
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p;
-        unsigned char *vstr;
-        unsigned int vlen;
-        long long vlong;
-
-        // 决定弹出元素的位置
-        int pos = (where == REDIS_HEAD) ? 0 : -1;
-
-        p = ziplistIndex(subject->ptr,pos);
-        if (ziplistGet(p,&vstr,&vlen,&vlong)) {
-            // 为被弹出元素创建对象
-            if (vstr) {
-                value = createStringObject((char*)vstr,vlen);
-            } else {
+    int ql_where = where == REDIS_HEAD ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+    if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        // 字符串元素由 listPopSaver 直接创建对象，整数元素保存在 vlong 中
+        if (quicklistPopCustom(subject->ptr,ql_where,(unsigned char **)&value,
+                               NULL,&vlong,listPopSaver)) {
+            if (!value)
                 value = createStringObjectFromLongLong(vlong);
-            }
-            /* We only need to delete an element when it exists */
-            // 从 ziplist 中删除被弹出元素
-            subject->ptr = ziplistDelete(subject->ptr,&p);
-        }
-
-    // 双端链表
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-
-        list *list = subject->ptr;
-
-        listNode *ln;
-
-        if (where == REDIS_HEAD) {
-            ln = listFirst(list);
-        } else {
-            ln = listLast(list);
-        }
-
-        // 删除被弹出节点
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            incrRefCount(value);
-            listDelNode(list,ln);
         }
 
     // 未知编码
@@ -177,13 +106,8 @@ robj *listTypePop(robj *subject, int where) {
  */
 unsigned long listTypeLength(robj *subject) {
 
-    // ZIPLIST
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        return ziplistLen(subject->ptr);
-
-    // 双端链表
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return listLength((list*)subject->ptr);
+    if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCount(subject->ptr);
 
     // 未知编码
     } else {
@@ -212,14 +136,17 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
 
     li->direction = direction;
 
-    // li 总是指向下一个 node，被 li 指向的 node 总是还没有被访问的
-    // ZIPLIST
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-        li->zi = ziplistIndex(subject->ptr,index);
+    li->iter = NULL;
 
-    // 双端链表
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        li->ln = listIndex(subject->ptr,index);
+    /* REDIS_HEAD means start at TAIL and move *towards* head.
+     * REDIS_TAIL means start at HEAD and move *towards tail. */
+    int iter_direction =
+        direction == REDIS_HEAD ? AL_START_TAIL : AL_START_HEAD;
+
+    // li 总是指向下一个 node，被 li 指向的 node 总是还没有被访问的
+    if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        li->iter = quicklistGetIteratorAtIdx(li->subject->ptr,
+                                             iter_direction, index);
 
     // 未知编码
     } else {
@@ -234,6 +161,8 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
  * 释放迭代器
  */
 void listTypeReleaseIterator(listTypeIterator *li) {
+    // 索引超出范围时 li->iter 为 NULL
+    if (li->iter) quicklistReleaseIterator(li->iter);
     zfree(li);
 }
 
@@ -250,42 +179,11 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
     /* Protect from converting when iterating */
     redisAssert(li->subject->encoding == li->encoding);
 
-    // TODO:(DONE) li 为什么要保存在这里？
     // 参考 listTypeGet(), listTypeEntry 需要利用 li->encoding field 来确定究竟使用哪个指针
-    // 当然咯，在一个 while-loop 这一个操作确实有点点多余，但是优化起来会很影响代码
     entry->li = li;
 
-    // 迭代 ZIPLIST
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-
-        // 记录当前节点到 entry
-        entry->zi = li->zi;
-
-        // 移动迭代器的指针，指向下一个 node（防止迭代器失效）
-        // 这是为了下一次进入 listTypeNext() 起作用的
-        if (entry->zi != NULL) {
-            if (li->direction == REDIS_TAIL)
-                li->zi = ziplistNext(li->subject->ptr,li->zi);
-            else
-                li->zi = ziplistPrev(li->subject->ptr,li->zi);
-            return 1;
-        }
-        // else if (entry->zi == NULL) 这时候，实际上已经访问到 tail 了，到底了
-
-    // 迭代双端链表
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-
-        // 记录当前节点到 entry
-        entry->ln = li->ln;
-
-        // 移动迭代器的指针
-        if (entry->ln != NULL) {    // 当迭代到末尾的时候，
-            if (li->direction == REDIS_TAIL)
-                li->ln = li->ln->next;
-            else
-                li->ln = li->ln->prev;
-            return 1;
-        }
+    if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistNext(li->iter, &entry->entry);
 
     // 未知编码
     } else {
@@ -304,30 +202,16 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
  */
 robj *listTypeGet(listTypeEntry *entry) {
 
-    listTypeIterator *li = entry->li;
-
     robj *value = NULL;
 
-    // 根据 entry->zi 指定的 node，从 ZIPLIST 中取出值
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *vstr;
-        unsigned int vlen;
-        long long vlong;
-        redisAssert(entry->zi != NULL);
-        if (ziplistGet(entry->zi,&vstr,&vlen,&vlong)) {
-            if (vstr) {
-                value = createStringObject((char*)vstr,vlen);
-            } else {
-                value = createStringObjectFromLongLong(vlong);
-            }
+    if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        if (entry->entry.value) {
+            value = createStringObject((char *)entry->entry.value,
+                                       entry->entry.sz);
+        } else {
+            value = createStringObjectFromLongLong(entry->entry.longval);
         }
 
-    // 根据 entry->ln 指定的 node，从 link-list 中取出值
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        redisAssert(entry->ln != NULL);
-        value = listNodeValue(entry->ln);
-        incrRefCount(value);
-
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -346,43 +230,23 @@ robj *listTypeGet(listTypeEntry *entry) {
  */
 void listTypeInsert(listTypeEntry *entry, robj *value, int where) {
 
-    robj *subject = entry->li->subject; // 链表头，说明这个 value 具体要插入哪一个链表里面
-    // entry 则是说明需要进行插入的 index，where 则是前插，还是后插
-
-    // 插入到 ZIPLIST
-    if (entry->li->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
 
         // 返回对象未编码的值
         value = getDecodedObject(value);
+        sds str = value->ptr;
+        size_t len = sdslen(str);
 
+        // 插入之后迭代器就失效了，调用者需要停止迭代
         if (where == REDIS_TAIL) {
-            unsigned char *next = ziplistNext(subject->ptr,entry->zi);
-
-            /* When we insert after the current element, but the current element
-             * is the tail of the list, we need to do a push. */
-            if (next == NULL) { // 说白了就是 ziplistInsert 不支持尾节点的 push 操作
-                // next 是表尾节点，push 新节点到表尾
-                subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),REDIS_TAIL);
-            } else {
-                // 插入到到节点之后
-                subject->ptr = ziplistInsert(subject->ptr,next,value->ptr,sdslen(value->ptr));
-            }
-        } else {
-            subject->ptr = ziplistInsert(subject->ptr,entry->zi,value->ptr,sdslen(value->ptr));
+            quicklistInsertAfter((quicklist *)entry->entry.quicklist,
+                                 &entry->entry, str, len);
+        } else if (where == REDIS_HEAD) {
+            quicklistInsertBefore((quicklist *)entry->entry.quicklist,
+                                  &entry->entry, str, len);
         }
         decrRefCount(value);
 
-    // 插入到双端链表
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
-
-        if (where == REDIS_TAIL) {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_TAIL);
-        } else {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_HEAD);
-        }
-
-        incrRefCount(value);
-
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -396,14 +260,9 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where) {
  */
 int listTypeEqual(listTypeEntry *entry, robj *o) {
 
-    listTypeIterator *li = entry->li;
-
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
         redisAssertWithInfo(NULL,o,sdsEncodedObject(o));
-        return ziplistCompare(entry->zi,o->ptr,sdslen(o->ptr));
-
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return equalStringObjects(o,listNodeValue(entry->ln));
+        return quicklistCompare(entry->entry.zi,o->ptr,sdslen(o->ptr));
 
     } else {
         redisPanic("Unknown list encoding");
@@ -416,39 +275,9 @@ int listTypeEqual(listTypeEntry *entry, robj *o) {
  */
 void listTypeDelete(listTypeEntry *entry) {
 
-    listTypeIterator *li = entry->li;
-
-    // ZIPLIST
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-
-        unsigned char *p = entry->zi;
-
-        li->subject->ptr = ziplistDelete(li->subject->ptr,&p);
-
-        /* Update position of the iterator depending on the direction */
-        // 删除节点之后，更新迭代器的指针（整个 ziplist 都被迁移了，自然 zi 也是要更新的）
-        // 这里则是通过 p 来恢复 iter
-        if (li->direction == REDIS_TAIL)
-            li->zi = p;
-        else
-            li->zi = ziplistPrev(li->subject->ptr,p);
-
-    // 双端链表
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
-
-        // 记录后置节点
-        listNode *next;
-
-        if (li->direction == REDIS_TAIL)
-            next = entry->ln->next;
-        else
-            next = entry->ln->prev;
-
-        // 删除当前节点
-        listDelNode(li->subject->ptr,entry->ln);
-
-        // 删除节点之后，更新迭代器的指针
-        li->ln = next;
+    if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        // 删除之后，quicklistDelEntry() 会负责更新迭代器的位置
+        quicklistDelEntry(entry->li->iter, &entry->entry);
 
     } else {
         redisPanic("Unknown list encoding");
@@ -456,37 +285,22 @@ void listTypeDelete(listTypeEntry *entry) {
 }
 
 /*
- * 将列表的底层编码从 ziplist 转换成双端链表
+ * 将列表的底层编码从 ziplist 转换成 quicklist
+ * 只有载入旧版本 RDB 中的 ziplist 列表时才会用到
  */
 void listTypeConvert(robj *subject, int enc) {
 
-    listTypeIterator *li;
-
-    listTypeEntry entry;
-
     redisAssertWithInfo(NULL,subject,subject->type == REDIS_LIST);
+    redisAssertWithInfo(NULL,subject,subject->encoding == REDIS_ENCODING_ZIPLIST);
 
-    // 转换成双端链表
-    if (enc == REDIS_ENCODING_LINKEDLIST) {
-
-        list *l = listCreate();
-
-        listSetFreeMethod(l,decrRefCountVoid);  // TODO: 为什么 list 这么特别，需要这样指定回调？
-
-        /* listTypeGet returns a robj with incremented refcount */
-        // 遍历 ziplist ，并将里面的值全部添加到双端链表中
-        li = listTypeInitIterator(subject,0,REDIS_TAIL);
-        while (listTypeNext(li,&entry)) listAddNodeTail(l,listTypeGet(&entry));
-        listTypeReleaseIterator(li);
-
-        // 更新编码
-        subject->encoding = REDIS_ENCODING_LINKEDLIST;
-
-        // 释放原来的 ziplist
-        zfree(subject->ptr);
+    // 转换成 quicklist
+    if (enc == REDIS_ENCODING_QUICKLIST) {
+        int fill = server.list_max_ziplist_size;
+        int depth = server.list_compress_depth;
 
-        // 更新对象值指针
-        subject->ptr = l;
+        // quicklistCreateFromZiplist() 会释放原来的 ziplist
+        subject->encoding = REDIS_ENCODING_QUICKLIST;
+        subject->ptr = quicklistCreateFromZiplist(fill, depth, subject->ptr);
 
     } else {
         redisPanic("Unsupported list conversion");
@@ -513,8 +327,8 @@ void pushGenericCommand(redisClient *c, int where) {
     }
 
     // 尝试将列表状态设置为就绪（在完成 cmd 之后，才会去处理就绪队列，不会现在立即处理）
-    // 这个 flag 也很明确说明：may ！所以要实际进去 signalListAsReady() 里面试一试才知道
-    if (may_have_waiting_clients) signalListAsReady(c,c->argv[1]);
+    // 这个 flag 也很明确说明：may ！所以要实际进去 signalKeyAsReady() 里面试一试才知道
+    if (may_have_waiting_clients) signalKeyAsReady(c,c->argv[1]);
 
     // 遍历所有输入值，并将它们添加到列表中
     for (j = 2; j < c->argc; j++) {
@@ -524,7 +338,7 @@ void pushGenericCommand(redisClient *c, int where) {
 
         // 如果列表对象不存在，那么创建一个，并关联到数据库
         if (!lobj) {
-            lobj = createZiplistObject();
+            lobj = createQuicklistObject();
             dbAdd(c->db,c->argv[1],lobj);
         }
 
@@ -577,15 +391,6 @@ void pushxGenericCommand(redisClient *c, robj *refval, robj *val, int where) {
 
     // 执行的是 LINSERT 命令
     if (refval != NULL) {
-        /* We're not sure if this value can be inserted yet, but we cannot
-         * convert the list inside the iterator.（因为一旦发生了转换，下面的 while-loop 中的迭代器将会失效） 
-         * We don't want to loop over
-         * the list twice (once to see if the value can be inserted and once
-         * to do the actual insert), so we assume this value can be inserted
-         * and convert the ziplist to a regular list if necessary. */
-        // 看保存值 value 是否需要将列表编码转换为双端链表（默认这个 val 会被 insert 进来）
-        listTypeTryConversion(subject,val);
-
         /* Seek refval from head to tail */
         // 在列表中查找 refval 对象
         iter = listTypeInitIterator(subject,0,REDIS_TAIL);
@@ -600,12 +405,6 @@ void pushxGenericCommand(redisClient *c, robj *refval, robj *val, int where) {
         listTypeReleaseIterator(iter);
 
         if (inserted) {
-            /* Check if the length exceeds the ziplist length threshold. */
-            // 查看插入之后，根据 list 的长度，决定是否需要将编码转换为双端链表
-            if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
-                ziplistLen(subject->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
-
             signalModifiedKey(c->db,c->argv[1]);
 
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"linsert",
@@ -673,7 +472,7 @@ void llenCommand(redisClient *c) {
 // Get an element from a list by its index
 void lindexCommand(redisClient *c) {
 
-    robj *o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk);
+    robj *o = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp]);
 
     if (o == NULL || checkType(c,o,REDIS_LIST)) return;
     long index;
@@ -683,38 +482,25 @@ void lindexCommand(redisClient *c) {
     if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK))
         return;
 
-    // 根据索引，遍历 ziplist ，直到指定位置，最坏 T = O(N)
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p;
-        unsigned char *vstr;
-        unsigned int vlen;
-        long long vlong;
+    // 根据索引，先跳过整个的 quicklist 节点，再在 ziplist 里面定位，最坏 T = O(N)
+    // 通过迭代器访问，这样释放迭代器时被解压的节点会重新压缩
+    if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter *iter;
+        quicklistEntry entry;
 
-        p = ziplistIndex(o->ptr,index); // while-loop inside
-
-        if (ziplistGet(p,&vstr,&vlen,&vlong)) {
-            if (vstr) {
-                value = createStringObject((char*)vstr,vlen);
+        iter = quicklistGetIteratorAtIdx(o->ptr, AL_START_HEAD, index);
+        if (iter && quicklistNext(iter, &entry)) {
+            if (entry.value) {
+                value = createStringObject((char*)entry.value,entry.sz);
             } else {
-                value = createStringObjectFromLongLong(vlong);
+                value = createStringObjectFromLongLong(entry.longval);
             }
             addReplyBulk(c,value);
             decrRefCount(value);
         } else {
-            addReply(c,shared.nullbulk);
-        }
-
-    // 根据索引，遍历双端链表，直到指定位置
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-
-        listNode *ln = listIndex(o->ptr,index); // while-loop inside
-
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            addReplyBulk(c,value);
-        } else {
-            addReply(c,shared.nullbulk);
+            addReplyNull(c);
         }
+        if (iter) quicklistReleaseIterator(iter);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -737,60 +523,109 @@ void lsetCommand(redisClient *c) {
     if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK))
         return;
 
-    // 查看保存 value 值是否需要转换列表的底层编码
-    listTypeTryConversion(o,value);
+    // 设置到 quicklist
+    if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklist *ql = o->ptr;
+        int replaced;
 
-    // 设置到 ziplist
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p, *zl = o->ptr;
-        // 查找索引
-        p = ziplistIndex(zl,index);
-        if (p == NULL) {
+        // 删除现有的值，并在原来的位置上插入新值
+        value = getDecodedObject(value);
+        replaced = quicklistReplaceAtIndex(ql, index,
+                                           value->ptr, sdslen(value->ptr));
+        decrRefCount(value);
+        if (!replaced) {
             // index 上面的并没有 obj，这是一个错误的 index
             addReply(c,shared.outofrangeerr);
         } else {
-            // 删除现有的值（删除了 ziplist 中的一个 node，可能会发生 ziplist 的整体迁移）
-            o->ptr = ziplistDelete(o->ptr,&p);
-            // 插入新值到指定索引
-            value = getDecodedObject(value);
-            // o->ptr(ziplist 的所在)，p(准备进行 set 的节点)，value->ptr(要 set 的 value 数据部分)，sdslen(value->ptr)(数据部分的长度)
-            o->ptr = ziplistInsert(o->ptr,p,value->ptr,sdslen(value->ptr)); // 因为 ziplistIndex 的关系，现在 p 已经指向了 insert 的位置
-            decrRefCount(value);
-
             addReply(c,shared.ok);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
             server.dirty++;
         }
+    } else {
+        redisPanic("Unknown list encoding");
+    }
+}
+
+/* Pop up to 'count' elements from the list 'o' at 'where', replying to 'c'
+ * with an array of the popped elements, in the order they were popped.
+ * The whole range is replied directly from the quicklist and then removed
+ * with a single quicklistDelRange(), without creating an object for every
+ * element. Returns the number of popped elements. */
+long listPopRangeAndReply(redisClient *c, robj *o, int where, long count) {
+    long llen = listTypeLength(o), rangelen = count < llen ? count : llen, j;
+    listTypeIterator *iter;
+    listTypeEntry entry;
 
-    // 设置到双端链表
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
+    addReplyMultiBulkLen(c,rangelen);
+    if (rangelen == 0) return 0;
+
+    // 从表头向表尾，或者从表尾向表头遍历
+    iter = listTypeInitIterator(o,where == REDIS_HEAD ? 0 : -1,
+                                where == REDIS_HEAD ? REDIS_TAIL : REDIS_HEAD);
+    for (j = 0; j < rangelen; j++) {
+        quicklistEntry *qe;
+
+        listTypeNext(iter,&entry);
+        qe = &entry.entry;
+        if (qe->value)
+            addReplyBulkCBuffer(c,qe->value,qe->sz);
+        else
+            addReplyBulkLongLong(c,qe->longval);
+    }
+    listTypeReleaseIterator(iter);
 
-        listNode *ln = listIndex(o->ptr,index);
+    quicklistDelRange(o->ptr,where == REDIS_HEAD ? 0 : -rangelen,rangelen);
+    return rangelen;
+}
 
-        if (ln == NULL) {
-            addReply(c,shared.outofrangeerr);
-        } else {
-            // 删除旧值对象(引用计数，自动释放)
-            decrRefCount((robj*)listNodeValue(ln));
-            // 指向新对象
-            listNodeValue(ln) = value;
-            incrRefCount(value);
+/* Post pop bookkeeping shared by the counted pops: notify the event, delete
+ * the key if the list is now empty, and signal the change. */
+static void listPopNotify(redisClient *c, robj *key, robj *o, int where,
+                          long popped)
+{
+    char *event = (where == REDIS_HEAD) ? "lpop" : "rpop";
 
-            addReply(c,shared.ok);
-            signalModifiedKey(c->db,c->argv[1]);
-            notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
-            server.dirty++;
-        }
-    } else {
-        redisPanic("Unknown list encoding");
+    notifyKeyspaceEvent(REDIS_NOTIFY_LIST,event,key,c->db->id);
+    if (listTypeLength(o) == 0) {
+        notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",key,c->db->id);
+        dbDelete(c->db,key);
     }
+    signalModifiedKey(c->db,key);
+    server.dirty += popped;
 }
 
+// LPOP key [count] / RPOP key [count]
 void popGenericCommand(redisClient *c, int where) {
+    long count = 0;
+    robj *o;
+
+    if (c->argc > 3) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    /* With COUNT the reply is an array of up to 'count' elements, or a null
+     * array if the key does not exist. */
+    if (c->argc == 3) {
+        long popped;
+
+        if (getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != REDIS_OK)
+            return;
+        if (count < 0) {
+            addReplyError(c,"count can't be negative");
+            return;
+        }
+        o = lookupKeyWriteOrReply(c,c->argv[1],shared.nullarray[c->resp]);
+        if (o == NULL || checkType(c,o,REDIS_LIST)) return;
+
+        popped = listPopRangeAndReply(c,o,where,count);
+        if (popped) listPopNotify(c,c->argv[1],o,where,popped);
+        return;
+    }
 
     // 取出列表对象
-    robj *o = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk);
+    o = lookupKeyWriteOrReply(c,c->argv[1],shared.null[c->resp]);
 
     if (o == NULL || checkType(c,o,REDIS_LIST)) return;
 
@@ -799,7 +634,7 @@ void popGenericCommand(redisClient *c, int where) {
 
     // 根据弹出元素是否为空，决定后续动作
     if (value == NULL) {
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
     } else {
         char *event = (where == REDIS_HEAD) ? "lpop" : "rpop";
 
@@ -858,39 +693,24 @@ void lrangeCommand(redisClient *c) {
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c,rangelen);
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p = ziplistIndex(o->ptr,start);
-        unsigned char *vstr;
-        unsigned int vlen;
-        long long vlong;
+    if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        listTypeIterator *iter = listTypeInitIterator(o, start, REDIS_TAIL);
 
-        // 遍历 ziplist ，并将指定索引上的值添加到回复中
+        // 从 start 开始遍历 quicklist ，并将指定索引上的值添加到回复中
         while(rangelen--) {
-            ziplistGet(p,&vstr,&vlen,&vlong);
-            if (vstr) {
-                addReplyBulkCBuffer(c,vstr,vlen);
+            listTypeEntry entry;
+            listTypeNext(iter, &entry);
+            quicklistEntry *qe = &entry.entry;
+            if (qe->value) {
+                addReplyBulkCBuffer(c,qe->value,qe->sz);
             } else {
-                addReplyBulkLongLong(c,vlong);
+                addReplyBulkLongLong(c,qe->longval);
             }
-            p = ziplistNext(o->ptr,p);
-        }
-
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln;
-
-        /* If we are nearest to the end of the list, reach the element
-         * starting from tail and going backward, as it is faster. */
-        if (start > llen/2) start -= llen;
-        ln = listIndex(o->ptr,start);
-
-        // 遍历双端链表，将指定索引上的值添加到回复
-        while(rangelen--) {
-            addReplyBulk(c,ln->value);
-            ln = ln->next;
         }
+        listTypeReleaseIterator(iter);
 
     } else {
-        redisPanic("List encoding is not LINKEDLIST nor ZIPLIST!");
+        redisPanic("List encoding is not QUICKLIST!");
     }
 }
 
@@ -900,9 +720,7 @@ void ltrimCommand(redisClient *c) {
     robj *o;
     // start\stop 是用来检查范围的合理性
     // ltrim\rtrim 则是最终需要保留的范围，由 start\stop 转换而来
-    long start, end, llen, j, ltrim, rtrim;
-    list *list;
-    listNode *ln;
+    long start, end, llen, ltrim, rtrim;
 
     // 取出索引值 start 和 end
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
@@ -944,24 +762,11 @@ void ltrimCommand(redisClient *c) {
 
     /* Remove list elements to perform the trim */
     // 删除指定列表两端的元素
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_QUICKLIST) {
         // 删除左端元素，从 0 开始，删除 ltrim 个 node
-        o->ptr = ziplistDeleteRange(o->ptr,0,ltrim);
+        quicklistDelRange(o->ptr,0,ltrim);
         // 删除右端元素，从 -rtrim 开始，删除 rtrim 个 node
-        o->ptr = ziplistDeleteRange(o->ptr,-rtrim,rtrim);
-
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list = o->ptr;
-        // 删除左端元素
-        for (j = 0; j < ltrim; j++) {
-            ln = listFirst(list);
-            listDelNode(list,ln);
-        }
-        // 删除右端元素
-        for (j = 0; j < rtrim; j++) {
-            ln = listLast(list);
-            listDelNode(list,ln);
-        }
+        quicklistDelRange(o->ptr,-rtrim,rtrim);
 
     } else {
         redisPanic("Unknown list encoding");
@@ -1007,8 +812,7 @@ void lremCommand(redisClient *c) {
 
     /* Make sure obj is raw when we're dealing with a ziplist */
     // 因为 listTypeEqual(&entry,obj)
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        obj = getDecodedObject(obj);
+    obj = getDecodedObject(obj);
 
     listTypeIterator *li;
 
@@ -1023,7 +827,7 @@ void lremCommand(redisClient *c) {
     // 查找，比对对象，并进行删除
     while (listTypeNext(li,&entry)) {
         if (listTypeEqual(&entry,obj)) {
-            listTypeDelete(&entry); // 当 encoding == REDIS_ENCODING_ZIPLIST 的时候，delete 内部会更新 ziplist 的指针
+            listTypeDelete(&entry); // delete 内部会更新 quicklist 迭代器的位置
             server.dirty++;
             removed++;
             // 已经满足删除数量，停止
@@ -1033,8 +837,7 @@ void lremCommand(redisClient *c) {
     listTypeReleaseIterator(li);
 
     /* Clean up raw encoded object */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        decrRefCount(obj);
+    decrRefCount(obj);
 
     // 删除空列表
     if (listTypeLength(subject) == 0) dbDelete(c->db,c->argv[1]);
@@ -1064,9 +867,9 @@ void rpoplpushHandlePush(redisClient *c, robj *dstkey, robj *dstobj, robj *value
     /* Create the list if the key does not exist */
     // 如果目标列表不存在，那么创建一个
     if (!dstobj) {
-        dstobj = createZiplistObject();
+        dstobj = createQuicklistObject();
         dbAdd(c->db,dstkey,dstobj);
-        signalListAsReady(c,dstkey);
+        signalKeyAsReady(c,dstkey);
     }
 
     signalModifiedKey(c->db,dstkey);
@@ -1087,14 +890,14 @@ void rpoplpushCommand(redisClient *c) {
     robj *sobj, *value;
     
     // 来源列表
-    if ((sobj = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((sobj = lookupKeyWriteOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,sobj,REDIS_LIST)) return;
 
     // 空列表，没有元素可 pop ，直接返回
     if (listTypeLength(sobj) == 0) {
         /* This may only happen after loading very old RDB files. Recent
          * versions of Redis delete keys of empty lists. */
-        addReply(c,shared.nullbulk);
+        addReplyNull(c);
 
     // 源列表非空
     } else {
@@ -1177,159 +980,7 @@ void rpoplpushCommand(redisClient *c) {
  *   被解除阻塞的客户端数量取决于 PUSH 命令推入的元素数量。
  */
 
-/* Set a client in blocking mode for the specified key, with the specified
- * timeout */
-// 根据给定数量的 key ，对给定客户端进行阻塞
-// 参数：
-// keys    任意多个 key
-// numkeys keys 的键数量
-// timeout 阻塞的最长时限
-// target  在解除阻塞时，将结果保存到这个 key 对象，而不是返回给客户端
-//         只用于 BRPOPLPUSH 命令
-// 核心的 block 操作，当有 key 没办法
-void blockForKeys(redisClient *c, robj **keys, int numkeys, mstime_t timeout, robj *target) {
-    dictEntry *de;
-    list *l;
-    int j;
-
-    // 设置阻塞状态的超时和目标选项
-    c->bpop.timeout = timeout;
-
-    // target 在执行 RPOPLPUSH 命令时使用
-    c->bpop.target = target;
-
-    if (target != NULL) incrRefCount(target);
-
-    // 关联阻塞客户端和键的相关信息
-    for (j = 0; j < numkeys; j++) {
-
-        /* If the key already exists in the dict ignore it. */
-        // c->bpop.keys 是一个集合（值为 NULL 的字典）
-        // 它记录所有造成客户端阻塞的键
-        // 以下语句在键不存在于集合的时候，将它添加到集合
-        if (dictAdd(c->bpop.keys,keys[j],NULL) != DICT_OK) continue;
-
-        incrRefCount(keys[j]);
-
-        /* 以便快速检测当前 key 是否被 block */
-        /* And in the other "side", to map keys -> clients */
-        // c->db->blocking_keys 字典的键为造成客户端阻塞的键
-        // 而值则是一个链表，链表中包含了所有被阻塞的客户端
-        // 以下程序将阻塞键和被阻塞客户端关联起来
-        // 只有把被 block 的 key 放进 hash-table 里面去，才能够在 push 的时候，快速确认这个 key 是否被阻塞等待
-        // 是的话，那就把 push 的 node pop 给对应的 client
-        de = dictFind(c->db->blocking_keys,keys[j]);
-        if (de == NULL) {
-            // 链表不存在，新创建一个，并将它关联到字典中
-            int retval;
-
-            /* For every key we take a list of clients blocked for it */
-            l = listCreate();
-            retval = dictAdd(c->db->blocking_keys,keys[j],l);
-            incrRefCount(keys[j]);
-            redisAssertWithInfo(c,keys[j],retval == DICT_OK);
-        } else {
-            l = dictGetVal(de);
-        }
-        // 将客户端填接到被阻塞客户端的链表中
-        // 顺序记录 block 在这个 key 上面的 client，等有新的 push 进来之后，顺序响应
-        listAddNodeTail(l,c);
-    }
-    blockClient(c,REDIS_BLOCKED_LIST);
-}
-
-/* Unblock a client that's waiting in a blocking operation such as BLPOP.
- * You should never call this function directly, but unblockClient() instead. */
-// 消除所有跟本 client 相关的 block 记录
-void unblockClientWaitingData(redisClient *c) {
-    dictEntry *de;
-    dictIterator *di;
-    list *l;
-
-    redisAssertWithInfo(c,NULL,dictSize(c->bpop.keys) != 0);
-
-    // 遍历所有 key ，将它们从客户端 db->blocking_keys 的链表中移除（dict 的 iter 是删除操作安全的迭代器）
-    di = dictGetIterator(c->bpop.keys);
-    /* The client may wait for multiple keys, so unblock it for every key. */
-    while((de = dictNext(di)) != NULL) {
-        robj *key = dictGetKey(de);
-
-        /* Remove this client from the list of clients waiting for this key. */
-        // 获取所有因为 key 而被阻塞的客户端的链表
-        l = dictFetchValue(c->db->blocking_keys,key);
-
-        redisAssertWithInfo(c,key,l != NULL);
-
-        // 将指定客户端从链表中删除（删除的是第一个找到的）
-        // 一般一个 client 只会 block 在一个 key 上面
-        listDelNode(l,listSearchKey(l,c));
-
-        /* If the list is empty we need to remove it to avoid wasting memory */
-        // 如果已经没有其他客户端阻塞在这个 key 上，那么删除这个链表
-        if (listLength(l) == 0)
-            dictDelete(c->db->blocking_keys,key);
-    }
-    dictReleaseIterator(di);    // 避免内存泄漏
-
-    /* Cleanup the client structure */
-    // 清空 bpop.keys 集合（字典）
-    dictEmpty(c->bpop.keys,NULL);
-    if (c->bpop.target) {
-        decrRefCount(c->bpop.target);
-        c->bpop.target = NULL;
-    }
-}
-
-/* If the specified key has clients blocked waiting for list pushes, this
- * function will put the key reference into the server.ready_keys list.
- * Note that db->ready_keys is a hash table that allows us to avoid putting
- * the same key again and again in the list in case of multiple pushes
- * made by a script or in the context of MULTI/EXEC.
- *
- * 如果有客户端正因为等待给定 key 被 push 而阻塞，
- * 那么将这个 key 的放进 server.ready_keys 列表里面。
- *
- * 注意 db->ready_keys 是一个哈希表，而 server.ready_keys 则是一个 list
- * 这可以避免在事务或者脚本中，将同一个 key 一次又一次添加到列表的情况出现。
- * db->ready_keys 是用来去重的（已经 ready_keys 着的 key，可以不用重复记录）
- * server.ready_keys 顺序处理 ready 的 key
- *
- * The list will be finally processed by handleClientsBlockedOnLists() 
- *
- * 这个列表最终会被 handleClientsBlockedOnLists() 函数处理。
- */
-void signalListAsReady(redisClient *c, robj *key) {
-    readyList *rl;
-
-    /* No clients blocking for this key? No need to queue it. */
-    // 没有客户端被这个键阻塞，直接返回
-    if (dictFind(c->db->blocking_keys,key) == NULL) return;
-
-    /* Key was already signaled? No need to queue it again. */
-    // 这个键已经被添加到 db->ready_keys 中了，直接返回
-    if (dictFind(c->db->ready_keys,key) != NULL) return;
-
-    /* Ok, we need to queue this key into server.ready_keys. */
-    // 创建一个 readyList 结构，保存键和数据库
-    // 然后将 readyList(node) 添加到 server.ready_keys 中
-    // 等候 handleClientsBlockedOnLists() 进行处理
-    rl = zmalloc(sizeof(*rl));
-    rl->key = key;
-    rl->db = c->db;
-    incrRefCount(key);
-    listAddNodeTail(server.ready_keys,rl);  // 把 rl 包裹进 listNode 里面进行保存
-
-    /* We also add the key in the db->ready_keys dictionary in order
-     * to avoid adding it multiple times into a list with a simple O(1)
-     * check. 
-     *
-     * 将 key 添加到 c->db->ready_keys 集合中，防止重复添加
-     */
-    incrRefCount(key);
-    redisAssert(dictAdd(c->db->ready_keys,key,NULL) == DICT_OK);
-}
-
-/* This is a helper function for handleClientsBlockedOnLists(). It's work
+/* This is a helper function for handleClientsBlockedOnKeys(). It's work
  * is to serve a specific client (receiver) that is blocked on 'key'
  * in the context of the specified 'db', doing the following:
  * 
@@ -1430,132 +1081,219 @@ int serveClientBlockedOnList(redisClient *receiver, robj *key, robj *dstkey, red
     return REDIS_OK;
 }
 
-/* This function should be called by Redis every time a single command,
- * a MULTI/EXEC block, or a Lua script, terminated its execution after
- * being called by a client.
- *
- * 这个函数会在 Redis 每次执行完单个命令、事务块或 Lua 脚本之后调用。processCommand() 函数的最后
- *
- * All the keys with at least one client blocked that received at least
- * one new element via some PUSH operation are accumulated into
- * the server.ready_keys list. This function will run the list and will
- * serve clients accordingly. Note that the function will iterate again and
- * again as a result of serving BRPOPLPUSH we can have new blocking clients
- * to serve because of the PUSH side of BRPOPLPUSH. 
- *
- * 对所有被阻塞在某个客户端的 key 来说，只要这个 key 被执行了某种 PUSH 操作
- * 那么这个 key 就会被放到 serve.ready_keys 去。signalListAsReady()
- * 
- * 这个函数会遍历整个 serve.ready_keys 链表，
- * 并将里面的 key 的元素弹出给被阻塞客户端，
- * 从而解除客户端的阻塞状态。
- *
- * 函数会一次又一次地进行迭代，
- * 因此它在执行 BRPOPLPUSH 命令的情况下也可以正常获取到正确的新被阻塞客户端。
- */
-// 每次处理完 CMD（processCommand()） 之后，都会来这里检查, 看看是不是 server.ready_keys 就绪了
-// 是的话，立马对 block 命令进行响应处理，避免 client 的长时间等待
-void handleClientsBlockedOnLists(void) {
-
-    // 遍历整个 ready_keys 链表(里面保存了刚刚执行了 push 的 key)
-    while(listLength(server.ready_keys) != 0) {
-        list *l;
-
-        /* Point server.ready_keys to a fresh list and save the current one
-         * locally. This way as we run the old list we are free to call
-         * signalListAsReady() that may push new elements in server.ready_keys
-         * when handling clients blocked into BRPOPLPUSH. */
-        // 备份旧的 ready_keys ，再给服务器端赋值一个新的
-        l = server.ready_keys;
-        server.ready_keys = listCreate();   // 避免在遍历的时候，signalListAsReady() 这个函数导致的插入，进而遍历不完整
-
-        while(listLength(l) != 0) {
-
-            // 取出 ready_keys 中的首个链表节点
-            listNode *ln = listFirst(l);
-
-            // 指向 readyList 结构
-            readyList *rl = ln->value;
-
-            /* First of all remove this key from db->ready_keys so that
-             * we can safely call signalListAsReady() against this key. */
-            // TODO: 为什么这么慌，难道 signalListAsReady() 这个函数会同时调用吗？
-            // 从 ready_keys 中移除就绪的 key
-            dictDelete(rl->db->ready_keys,rl->key);
-
-            /* If the key exists and it's a list, serve blocked clients
-             * with data. */
-            // 获取键对象，这个对象应该是非空的，并且是列表
-            robj *o = lookupKeyWrite(rl->db,rl->key);
-            if (o != NULL && o->type == REDIS_LIST) {
-                dictEntry *de;
-
-                /* We serve clients in the same order they blocked for
-                 * this key, from the first blocked to the last. */
-                // 取出所有被这个 key 阻塞的客户端
-                de = dictFind(rl->db->blocking_keys,rl->key);
-                if (de) {
-                    list *clients = dictGetVal(de); // 所有因为这个 key 被阻塞的 client
-                    int numclients = listLength(clients);
-
-                    while(numclients--) {
-                        // 取出客户端
-                        listNode *clientnode = listFirst(clients);
-                        redisClient *receiver = clientnode->value;
-
-                        // 设置弹出的目标对象（只在 BRPOPLPUSH 时使用）
-                        robj *dstkey = receiver->bpop.target;
-
-                        // 从列表中弹出元素
-                        // 弹出的位置取决于是执行 BLPOP 还是 BRPOP 或者 BRPOPLPUSH
-                        int where = (receiver->lastcmd &&
-                                     receiver->lastcmd->proc == blpopCommand) ?
-                                    REDIS_HEAD : REDIS_TAIL;
-                        robj *value = listTypePop(o,where);
-
-                        // 还有元素可弹出（非 NULL）
-                        if (value) {
-                            /* Protect receiver->bpop.target, that will be
-                             * freed by the next unblockClient()
-                             * call. */
-                            if (dstkey) incrRefCount(dstkey);
-
-                            // 取消客户端的阻塞状态
-                            unblockClient(receiver);
-
-                            // 将值 value 推入到造成客户度 receiver 阻塞的 key 上
-                            if (serveClientBlockedOnList(receiver,
-                                rl->key,dstkey,rl->db,value,
-                                where) == REDIS_ERR)
-                            {
-                                /* If we failed serving the client we need
-                                 * to also undo the POP operation. */
-                                    listTypePush(o,value,where);
-                            }
-
-                            if (dstkey) decrRefCount(dstkey);
-                            decrRefCount(value);
-                        } else {
-                            // 如果执行到这里，表示还有至少一个客户端被键所阻塞
-                            // 这些客户端要等待对键的下次 PUSH
-                            break;
-                        }
-                    }
+/* Serve a client blocked by BLMPOP with up to bpop.list_count elements of
+ * the non empty list 'o' stored at 'key', propagating an [LR]POP key count.
+ * Called by serveClientsBlockedOnListKey(). */
+static void serveClientBlockedOnMpop(redisClient *receiver, robj *o,
+                                     robj *key, redisDb *db)
+{
+    int where = receiver->bpop.list_where;
+    long count = receiver->bpop.list_count, popped;
+    robj *argv[3];
+
+    unblockClient(receiver);
+    addReplyMultiBulkLen(receiver,2);
+    addReplyBulk(receiver,key);
+    popped = listPopRangeAndReply(receiver,o,where,count);
+
+    argv[0] = (where == REDIS_HEAD) ? shared.lpop : shared.rpop;
+    argv[1] = key;
+    argv[2] = createStringObjectFromLongLong(popped);
+    propagate((where == REDIS_HEAD) ? server.lpopCommand : server.rpopCommand,
+        db->id,argv,3,REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    decrRefCount(argv[2]);
+}
+
+/* Serve the clients blocked by BLPOP & co for the list 'o' that is stored
+ * at the key 'rl' signaled as ready, popping an element for every client
+ * in the order they blocked. Called by handleClientsBlockedOnKeys(). */
+void serveClientsBlockedOnListKey(robj *o, readyList *rl) {
+    dictEntry *de;
+
+    /* We serve clients in the same order they blocked for
+     * this key, from the first blocked to the last. */
+    // 取出所有被这个 key 阻塞的客户端
+    de = dictFind(rl->db->blocking_keys,rl->key);
+    if (de) {
+        list *clients = dictGetVal(de); // 所有因为这个 key 被阻塞的 client
+        listNode *clientnode;
+        listIter li;
+
+        // unblockClient() 会删除当前节点，迭代器已经指向下一个节点，所以是安全的
+        listRewind(clients,&li);
+        while((clientnode = listNext(&li)) != NULL) {
+            redisClient *receiver = clientnode->value;
+
+            // 同一个 key 上可能还阻塞着等待其他类型的客户端（比如 XREAD）
+            if (receiver->btype != REDIS_BLOCKED_LIST) continue;
+
+            // BLMPOP 一次可以弹出多个元素
+            if (receiver->lastcmd &&
+                receiver->lastcmd->proc == blmpopCommand)
+            {
+                if (listTypeLength(o) == 0) break;
+                serveClientBlockedOnMpop(receiver,o,rl->key,rl->db);
+                continue;
+            }
+
+            // 设置弹出的目标对象（只在 BRPOPLPUSH 时使用）
+            robj *dstkey = receiver->bpop.target;
+
+            // 从列表中弹出元素
+            // 弹出的位置取决于是执行 BLPOP 还是 BRPOP 或者 BRPOPLPUSH
+            int where = (receiver->lastcmd &&
+                         receiver->lastcmd->proc == blpopCommand) ?
+                        REDIS_HEAD : REDIS_TAIL;
+            robj *value = listTypePop(o,where);
+
+            // 还有元素可弹出（非 NULL）
+            if (value) {
+                /* Protect receiver->bpop.target, that will be
+                 * freed by the next unblockClient()
+                 * call. */
+                if (dstkey) incrRefCount(dstkey);
+
+                // 取消客户端的阻塞状态
+                unblockClient(receiver);
+
+                // 将值 value 推入到造成客户度 receiver 阻塞的 key 上
+                if (serveClientBlockedOnList(receiver,
+                    rl->key,dstkey,rl->db,value,
+                    where) == REDIS_ERR)
+                {
+                    /* If we failed serving the client we need
+                     * to also undo the POP operation. */
+                        listTypePush(o,value,where);
                 }
-                
-                // 如果列表元素已经为空，那么从数据库中将它删除
-                if (listTypeLength(o) == 0) dbDelete(rl->db,rl->key);
-                /* We don't call signalModifiedKey() as it was already called
-                 * when an element was pushed on the list. */
+
+                if (dstkey) decrRefCount(dstkey);
+                decrRefCount(value);
+            } else {
+                // 如果执行到这里，表示还有至少一个客户端被键所阻塞
+                // 这些客户端要等待对键的下次 PUSH
+                break;
             }
+        }
+    }
+
+    // 如果列表元素已经为空，那么从数据库中将它删除
+    if (listTypeLength(o) == 0) dbDelete(rl->db,rl->key);
+    /* We don't call signalModifiedKey() as it was already called
+     * when an element was pushed on the list. */
+}
+
+/* Parse the "numkeys key [key ...] LEFT|RIGHT [COUNT count]" arguments of
+ * LMPOP and BLMPOP starting at c->argv[pos]. On success 'numkeys', 'where'
+ * and 'count' are set and REDIS_OK is returned, otherwise an error is sent
+ * to the client. */
+static int mpopParseArgs(redisClient *c, int pos, long *numkeys, int *where,
+                         long *count)
+{
+    int j;
 
-            /* Free this item. */
-            decrRefCount(rl->key);
-            zfree(rl);
-            listDelNode(l,ln);
+    if (getLongFromObjectOrReply(c,c->argv[pos],numkeys,NULL) != REDIS_OK)
+        return REDIS_ERR;
+    if (*numkeys <= 0) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return REDIS_ERR;
+    }
+    if (*numkeys > c->argc-pos-2) {
+        addReply(c,shared.syntaxerr);
+        return REDIS_ERR;
+    }
+
+    j = pos+1+*numkeys;
+    if (!strcasecmp(c->argv[j]->ptr,"left")) {
+        *where = REDIS_HEAD;
+    } else if (!strcasecmp(c->argv[j]->ptr,"right")) {
+        *where = REDIS_TAIL;
+    } else {
+        addReply(c,shared.syntaxerr);
+        return REDIS_ERR;
+    }
+
+    *count = 1;
+    for (j++; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"count") && j+1 < c->argc) {
+            if (getLongFromObjectOrReply(c,c->argv[j+1],count,NULL) !=
+                REDIS_OK) return REDIS_ERR;
+            if (*count <= 0) {
+                addReplyError(c,"count should be greater than 0");
+                return REDIS_ERR;
+            }
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return REDIS_ERR;
         }
-        listRelease(l); /* We have the new list on place at this point. */
     }
+    return REDIS_OK;
+}
+
+/* Pop up to 'count' elements from the first non empty list in 'keys',
+ * replying with [key, [element ...]]. The command is propagated as an
+ * [LR]POP key count. Returns 0, without replying, if all the lists are
+ * empty. */
+static int mpopFromFirstNonEmpty(redisClient *c, robj **keys, long numkeys,
+                                 int where, long count)
+{
+    long j;
+
+    for (j = 0; j < numkeys; j++) {
+        robj *o = lookupKeyWrite(c->db,keys[j]), *key, *countobj;
+        long popped;
+
+        if (o == NULL) continue;
+        if (checkType(c,o,REDIS_LIST)) return 1;
+
+        key = keys[j];
+        incrRefCount(key);  /* argv is rewritten below */
+        addReplyMultiBulkLen(c,2);
+        addReplyBulk(c,key);
+        popped = listPopRangeAndReply(c,o,where,count);
+        listPopNotify(c,key,o,where,popped);
+
+        countobj = createStringObjectFromLongLong(popped);
+        rewriteClientCommandVector(c,3,
+            (where == REDIS_HEAD) ? shared.lpop : shared.rpop,key,countobj);
+        decrRefCount(countobj);
+        decrRefCount(key);
+        return 1;
+    }
+    return 0;
+}
+
+// LMPOP numkeys key [key ...] LEFT|RIGHT [COUNT count]
+void lmpopCommand(redisClient *c) {
+    long numkeys, count;
+    int where;
+
+    if (mpopParseArgs(c,1,&numkeys,&where,&count) != REDIS_OK) return;
+    if (!mpopFromFirstNonEmpty(c,c->argv+2,numkeys,where,count))
+        addReplyNullArray(c);
+}
+
+// BLMPOP timeout numkeys key [key ...] LEFT|RIGHT [COUNT count]
+void blmpopCommand(redisClient *c) {
+    long numkeys, count;
+    mstime_t timeout;
+    int where;
+
+    if (getTimeoutFromObjectOrReply(c,c->argv[1],&timeout,UNIT_SECONDS)
+        != REDIS_OK) return;
+    if (mpopParseArgs(c,2,&numkeys,&where,&count) != REDIS_OK) return;
+    if (mpopFromFirstNonEmpty(c,c->argv+3,numkeys,where,count)) return;
+
+    /* Like BLPOP, inside MULTI an empty list is treated as a timeout. */
+    if (c->flags & REDIS_MULTI) {
+        addReplyNullArray(c);
+        return;
+    }
+
+    // 阻塞，记录元素被推入时需要弹出的位置和数量
+    c->bpop.list_where = where;
+    c->bpop.list_count = count;
+    blockForKeys(c,REDIS_BLOCKED_LIST,c->argv+3,numkeys,timeout,NULL,NULL);
 }
 
 /* Blocking RPOP/LPOP */
@@ -1630,13 +1368,13 @@ void blockingPopGenericCommand(redisClient *c, int where) {
     // 如果命令在一个事务中执行，那么为了不产生死等待
     // 服务器只能向客户端发送一个空回复
     if (c->flags & REDIS_MULTI) {
-        addReply(c,shared.nullmultibulk);
+        addReplyNullArray(c);
         return;
     }
 
     /* If the list is empty or the key does not exists we must block */
     // 所有输入列表键都不存在，只能阻塞了(timeout = 0 的话，意味着无限期阻塞)
-    blockForKeys(c, c->argv + 1, c->argc - 2, timeout, NULL);
+    blockForKeys(c, REDIS_BLOCKED_LIST, c->argv + 1, c->argc - 2, timeout, NULL, NULL);
 }
 
 void blpopCommand(redisClient *c) {
@@ -1662,10 +1400,10 @@ void brpoplpushCommand(redisClient *c) {
         if (c->flags & REDIS_MULTI) {
             /* Blocking against an empty list in a multi state
              * returns immediately. */
-            addReply(c, shared.nullbulk);
+            addReplyNull(c);
         } else {
             /* The list is empty and the client blocks. */
-            blockForKeys(c, c->argv + 1, 1, timeout, c->argv[2]);
+            blockForKeys(c, REDIS_BLOCKED_LIST, c->argv + 1, 1, timeout, c->argv[2], NULL);
         }
 
     // 键非空，执行 RPOPLPUSH
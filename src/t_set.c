@@ -615,14 +615,169 @@ void scardCommand(redisClient *c) {
     addReplyLongLong(c,setTypeSize(o));
 }
 
+/* Selection sampling (Knuth's algorithm S): called once for every member
+ * of a set walked in order, it selects exactly '*need' of the '*remaining'
+ * members, each with the same probability, in a single pass. */
+static int setSampleSelect(unsigned long *need, unsigned long *remaining) {
+    unsigned long r = ((unsigned long)random() << 31) ^ (unsigned long)random();
+    int selected = (r % *remaining) < *need;
+
+    (*remaining)--;
+    if (selected) (*need)--;
+    return selected;
+}
+
+/* How many times bigger should be the set compared to the requested count
+ * for SPOP to pick the members one by one at random instead of selecting
+ * them in a single pass over the whole set. */
+#define SPOP_ONE_PASS_STRATEGY_MUL 3
+
+/* Members per SREM command when propagating SPOP with count. */
+#define SPOP_PROPAGATE_BATCH 1024
+
+/* Append 'ele' to the SREM command being built in *argvp / *argcp to
+ * propagate SPOP with count, flushing it with alsoPropagate() when full
+ * or when 'ele' is NULL. */
+static void spopPropagateMember(redisClient *c, robj ***argvp, int *argcp,
+                                robj *ele) {
+    if (ele) {
+        if (*argvp == NULL) {
+            *argvp = zmalloc(sizeof(robj*)*(2+SPOP_PROPAGATE_BATCH));
+            (*argvp)[0] = shared.srem;
+            (*argvp)[1] = c->argv[1];
+            incrRefCount(shared.srem);
+            incrRefCount(c->argv[1]);
+            *argcp = 2;
+        }
+        (*argvp)[(*argcp)++] = ele;
+        incrRefCount(ele);
+    }
+    if (*argvp && (ele == NULL || *argcp == 2+SPOP_PROPAGATE_BATCH)) {
+        alsoPropagate(server.sremCommand,c->db->id,*argvp,*argcp,
+            REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+        *argvp = NULL;
+        *argcp = 0;
+    }
+}
+
+// SPOP key count ：随机 pop 出 count 个 member
+void spopWithCountCommand(redisClient *c) {
+    long l;
+    unsigned long count, size, j;
+    robj *set, *ele, **propargv = NULL;
+    int64_t llele;
+    int encoding, propargc = 0;
+
+    if (getLongFromObjectOrReply(c,c->argv[2],&l,NULL) != REDIS_OK) return;
+    if (l < 0) {
+        addReplyError(c,"value is out of range, must be positive");
+        return;
+    }
+    count = (unsigned long) l;
+
+    if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.emptymultibulk))
+        == NULL || checkType(c,set,REDIS_SET)) return;
+
+    if (count == 0) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    size = setTypeSize(set);
+
+    notifyKeyspaceEvent(REDIS_NOTIFY_SET,"spop",c->argv[1],c->db->id);
+    server.dirty += (count >= size) ? size : count;
+
+    /* CASE 1: count >= size, return the whole set and delete the key,
+     * propagating a DEL. */
+    if (count >= size) {
+        sunionDiffGenericCommand(c,c->argv+1,1,NULL,REDIS_OP_UNION);
+        dbDelete(c->db,c->argv[1]);
+        notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",c->argv[1],c->db->id);
+        rewriteClientCommandVector(c,2,shared.del,c->argv[1]);
+        signalModifiedKey(c->db,c->argv[1]);
+        return;
+    }
+
+    /* The command itself is replaced by SREM commands of the popped
+     * members, so that replicas and the AOF remove the same ones. */
+    preventCommandPropagation(c);
+    addReplyMultiBulkLen(c,count);
+
+    if (count*SPOP_ONE_PASS_STRATEGY_MUL <= size) {
+        /* CASE 2: few members compared to the set size: pick them one by
+         * one at random, removing each so it can't be picked again. */
+        for (j = 0; j < count; j++) {
+            encoding = setTypeRandomElement(set,&ele,&llele);
+            if (encoding == REDIS_ENCODING_INTSET) {
+                ele = createStringObjectFromLongLong(llele);
+                set->ptr = intsetRemove(set->ptr,llele,NULL);
+            } else {
+                incrRefCount(ele);
+                setTypeRemove(set,ele);
+            }
+            addReplyBulk(c,ele);
+            spopPropagateMember(c,&propargv,&propargc,ele);
+            decrRefCount(ele);
+        }
+    } else if (set->encoding == REDIS_ENCODING_INTSET) {
+        /* CASE 3: a large part of an intset: select the members in a single
+         * pass and rebuild the intset with the ones left, in order. */
+        intset *is = set->ptr, *left = intsetNew();
+        unsigned long need = count, remaining = size;
+
+        for (j = 0; j < size; j++) {
+            intsetGet(is,j,&llele);
+            if (setSampleSelect(&need,&remaining)) {
+                ele = createStringObjectFromLongLong(llele);
+                addReplyBulk(c,ele);
+                spopPropagateMember(c,&propargv,&propargc,ele);
+                decrRefCount(ele);
+            } else {
+                left = intsetAdd(left,llele,NULL);
+            }
+        }
+        zfree(is);
+        set->ptr = left;
+    } else {
+        /* CASE 3: a large part of a hash table set: select the members in
+         * a single pass, deleting them as the safe iterator goes. */
+        dictIterator *di = dictGetSafeIterator(set->ptr);
+        dictEntry *de;
+        unsigned long need = count, remaining = size;
+
+        while(need && (de = dictNext(di)) != NULL) {
+            if (!setSampleSelect(&need,&remaining)) continue;
+            ele = dictGetKey(de);
+            incrRefCount(ele);
+            dictDelete(set->ptr,ele);
+            addReplyBulk(c,ele);
+            spopPropagateMember(c,&propargv,&propargc,ele);
+            decrRefCount(ele);
+        }
+        dictReleaseIterator(di);
+    }
+    spopPropagateMember(c,&propargv,&propargc,NULL);
+    signalModifiedKey(c->db,c->argv[1]);
+}
+
 // 随机 pop 一个 member
+// SPOP key [count]
 void spopCommand(redisClient *c) {
     robj *set, *ele, *aux;
     int64_t llele;
     int encoding;
 
+    // 如果带有 count 参数，那么调用 spopWithCountCommand 来处理
+    if (c->argc == 3) {
+        spopWithCountCommand(c);
+        return;
+    } else if (c->argc > 3) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
     // 取出集合
-    if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,set,REDIS_SET)) return;
 
     // 从集合中随机取出一个元素
@@ -768,11 +923,6 @@ void srandmemberWithCountCommand(redisClient *c) {
         return;
     }
 
-    /* For CASE 3 and CASE 4 we need an auxiliary dictionary. */
-    // 对于情形 3 和情形 4 ，需要一个额外的字典
-    // 针对已经被 random 取出来的元素进行去重处理
-    d = dictCreate(&setDictType,NULL);
-
     /* CASE 3:
      * 
      * 情形 3：
@@ -782,55 +932,36 @@ void srandmemberWithCountCommand(redisClient *c) {
      *
      * count 参数乘以 SRANDMEMBER_SUB_STRATEGY_MUL 的积比集合的基数要大。
      *
-     * In this case we create a set from scratch with all the elements, and
-     * subtract random elements to reach the requested number of elements.
-     *
-     * 在这种情况下，程序创建一个集合的副本，
-     * 并从集合中删除元素，直到集合的基数等于 count 参数指定的数量为止。
+     * In this case we walk the set once and select exactly count elements
+     * with selection sampling, replying with them as we go: there is no
+     * copy of the set and no random walk per element. The elements are
+     * returned in the set order.
      *
-     * This is done because if the number of requsted elements is just
-     * a bit less than the number of elements in the set, the natural approach
-     * used into CASE 3 is highly inefficient. 
-     *
-     * 使用这种做法的原因是，当 count 的数量接近于集合的基数时，
-     * 从集合中随机取出 count 个参数的方法是非常低效的。
+     * 在这种情况下，程序只遍历集合一次，以相同的概率选出 count 个元素并直接回复，
+     * 不需要创建集合的副本，也不需要逐个随机删除元素。
      */
     if (count*SRANDMEMBER_SUB_STRATEGY_MUL > size) {
-        // 从 set 中去除 setTypeSize(set) - count 个 member 比较快；
         setTypeIterator *si;
+        unsigned long need = count, remaining = size;
 
-        /* Add all the elements into the temporary dictionary. */
-        // 遍历集合，将所有元素添加到临时字典中
+        addReplyMultiBulkLen(c,count);
         si = setTypeInitIterator(set);
-        while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
-            int retval = DICT_ERR;
-
-            // 为元素创建对象，并添加到字典中
-            if (encoding == REDIS_ENCODING_INTSET) {
-                retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
-            } else {
-                retval = dictAdd(d,dupStringObject(ele),NULL);
-            }
-            // dict 的复制出错，实际上时影响业务数据的准确性的，不应该出错，不应该有 bug 还在使用
-            // 即使是内存没了导致的出错，也不应该动了，因为这会导致业务数据的准确性
-            redisAssert(retval == DICT_OK);
+        while(need && (encoding = setTypeNext(si,&ele,&llele)) != -1) {
+            if (!setSampleSelect(&need,&remaining)) continue;
+            if (encoding == REDIS_ENCODING_INTSET)
+                addReplyBulkLongLong(c,llele);
+            else
+                addReplyBulk(c,ele);
         }
         setTypeReleaseIterator(si);
-        redisAssert(dictSize(d) == size);
-
-        /* Remove random elements to reach the right count. */
-        // 随机删除元素，直到集合基数等于 count 参数的值
-        while(size > count) {
-            dictEntry *de;
+        return;
+    }
 
-            // 取出并删除随机元素
-            de = dictGetRandomKey(d);
-            dictDelete(d,dictGetKey(de));
+    /* For CASE 4 we need an auxiliary dictionary. */
+    // 对于情形 4 ，需要一个额外的字典
+    // 针对已经被 random 取出来的元素进行去重处理
+    d = dictCreate(&setDictType,NULL);
 
-            size--;
-        }
-    }
-    
     /* CASE 4: We have a big set compared to the requested number of elements.
      *
      * 情形 4 ： count 参数要比集合基数小很多。
@@ -842,7 +973,7 @@ void srandmemberWithCountCommand(redisClient *c) {
      * 在这种情况下，我们可以直接从集合中随机地取出元素，
      * 并将它添加到结果集合中，直到结果集的基数等于 count 为止。
      */
-    else {
+    {
         // 从 set 随机取出 count 个 member 比较快；
         unsigned long added = 0;
 
@@ -872,9 +1003,9 @@ void srandmemberWithCountCommand(redisClient *c) {
         }
     }
 
-    /* CASE 3 & 4: send the result to the user. */
+    /* CASE 4: send the result to the user. */
     {
-        // 情形 3 和 4 ：将结果集回复给客户端
+        // 情形 4 ：将结果集回复给客户端
         dictIterator *di;
         dictEntry *de;
 
@@ -908,7 +1039,7 @@ void srandmemberCommand(redisClient *c) {
     // 随机取出单个元素就可以了
 
     // 取出集合对象
-    if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,set,REDIS_SET)) return;
 
     // 随机取出一个元素
@@ -972,7 +1103,7 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
                 }
                 addReply(c,shared.czero);
             } else {
-                addReply(c,shared.emptymultibulk);
+                addReply(c,shared.emptyset[c->resp]);
             }
             return;
         }
@@ -1038,8 +1169,37 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
      * 
     */
 
-    si = setTypeInitIterator(sets[0]);
-    while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
+    /* When every input is an intset, intersect the sorted arrays directly:
+     * the members of the smallest set are filtered against each of the
+     * other sets in order, without a lookup per member and per set. */
+    // 所有集合都是 INTSET 编码时，直接对有序数组求交集
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (setnum > 1 && j == setnum) {
+        uint32_t count = intsetLen(sets[0]->ptr), i;
+        int64_t *vals = zmalloc(sizeof(int64_t)*(count ? count : 1));
+
+        for (i = 0; i < count; i++) intsetGet(sets[0]->ptr,i,&vals[i]);
+        for (j = 1; j < setnum && count; j++) {
+            if (sets[j] == sets[0]) continue;
+            count = intsetFilter(sets[j]->ptr,vals,count);
+        }
+        for (i = 0; i < count; i++) {
+            if (!dstkey)
+                addReplyBulkLongLong(c,vals[i]);
+            else
+                dstset->ptr = intsetAdd(dstset->ptr,vals[i],NULL);
+        }
+        if (!dstkey)
+            cardinality = count;
+        else if (intsetLen(dstset->ptr) > server.set_max_intset_entries)
+            setTypeConvert(dstset,REDIS_ENCODING_HT);
+        zfree(vals);
+        si = NULL;
+    } else {
+        si = setTypeInitIterator(sets[0]);
+    }
+    while(si && (encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
         // 遍历其他集合，检查元素是否在这些集合中存在
         for (j = 1; j < setnum; j++) {
 
@@ -1109,7 +1269,7 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
             }
         }
     }
-    setTypeReleaseIterator(si);
+    if (si) setTypeReleaseIterator(si);
 
     // SINTERSTORE 命令，将结果集关联到数据库
     if (dstkey) {
@@ -1138,7 +1298,7 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
 
     // SINTER 命令，回复结果集的基数
     } else {
-        setDeferredMultiBulkLength(c,replylen,cardinality);
+        setDeferredSetLen(c,replylen,cardinality);
     }
 
     zfree(sets);
@@ -1157,6 +1317,114 @@ void sinterstoreCommand(redisClient *c) {
     sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
 }
 
+// SINTERCARD numkeys key [key ...] [LIMIT limit]
+// 只返回交集的基数，不构造回复或者结果集；
+// 给定 LIMIT 时，基数达到 limit 就停止计算（0 表示不限制）
+void sintercardCommand(redisClient *c) {
+    long numkeys, limit = 0, j, i;
+    unsigned long cardinality = 0;
+    robj **sets;
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != REDIS_OK)
+        return;
+    if (numkeys <= 0) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+    for (j = 2+numkeys; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"limit") && j+1 < c->argc) {
+            if (getLongFromObjectOrReply(c,c->argv[j+1],&limit,NULL) != REDIS_OK)
+                return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    sets = zmalloc(sizeof(robj*)*numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *setobj = lookupKeyRead(c->db,c->argv[2+j]);
+
+        if (!setobj) {
+            zfree(sets);
+            addReply(c,shared.czero);
+            return;
+        }
+        if (checkType(c,setobj,REDIS_SET)) {
+            zfree(sets);
+            return;
+        }
+        sets[j] = setobj;
+    }
+
+    /* Smallest set first, like SINTER: it bounds the members to test. */
+    qsort(sets,numkeys,sizeof(robj*),qsortCompareSetsByCardinality);
+
+    for (j = 0; j < numkeys; j++)
+        if (sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (numkeys > 1 && j == numkeys) {
+        /* All intsets: filter the sorted members of the smallest one. */
+        uint32_t count = intsetLen(sets[0]->ptr);
+        int64_t *vals = zmalloc(sizeof(int64_t)*(count ? count : 1));
+
+        for (i = 0; i < count; i++) intsetGet(sets[0]->ptr,i,&vals[i]);
+        for (j = 1; j < numkeys && count; j++) {
+            if (sets[j] == sets[0]) continue;
+            count = intsetFilter(sets[j]->ptr,vals,count);
+        }
+        cardinality = count;
+        zfree(vals);
+    } else {
+        setTypeIterator *si = setTypeInitIterator(sets[0]);
+        robj *eleobj;
+        int64_t intobj;
+        int encoding;
+
+        while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
+            for (j = 1; j < numkeys; j++) {
+                if (sets[j] == sets[0]) continue;
+                if (encoding == REDIS_ENCODING_INTSET) {
+                    if (sets[j]->encoding == REDIS_ENCODING_INTSET) {
+                        if (!intsetFind((intset*)sets[j]->ptr,intobj)) break;
+                    } else {
+                        robj *o = createStringObjectFromLongLong(intobj);
+                        int found = setTypeIsMember(sets[j],o);
+
+                        decrRefCount(o);
+                        if (!found) break;
+                    }
+                } else if (eleobj->encoding == REDIS_ENCODING_INT &&
+                           sets[j]->encoding == REDIS_ENCODING_INTSET)
+                {
+                    if (!intsetFind((intset*)sets[j]->ptr,(long)eleobj->ptr))
+                        break;
+                } else if (!setTypeIsMember(sets[j],eleobj)) {
+                    break;
+                }
+            }
+            if (j == numkeys) {
+                cardinality++;
+                // 达到 LIMIT ，提前结束
+                if (limit && cardinality == (unsigned long)limit) break;
+            }
+        }
+        setTypeReleaseIterator(si);
+    }
+    if (limit && cardinality > (unsigned long)limit) cardinality = limit;
+
+    zfree(sets);
+    addReplyLongLong(c,cardinality);
+}
+
 /*
  * 命令的类型
  */
@@ -1364,7 +1632,7 @@ void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *
     // 执行的是 SDIFF 或者 SUNION
     // 打印结果集中的所有元素
     if (!dstkey) {
-        addReplyMultiBulkLen(c,cardinality);
+        addReplySetLen(c,cardinality);
 
         // 遍历并回复结果集中的元素
         si = setTypeInitIterator(dstset);
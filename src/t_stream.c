@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+#include <ctype.h>
+
+/* Max number of entries returned to an XREAD client blocked without the
+ * COUNT option, so that a big backlog can't generate a huge reply. */
+#define XREAD_BLOCKED_DEFAULT_COUNT 1000
+
+/*-----------------------------------------------------------------------------
+ * Low level stream encoding: ziplist helpers
+ *----------------------------------------------------------------------------*/
+
+/* Append the unsigned integer 'v' to the ziplist. The ziplist can encode as
+ * integers only the values fitting a long long, bigger ones are stored as
+ * strings. */
+static unsigned char *streamZlAppendUint(unsigned char *zl, uint64_t v) {
+    char buf[21];
+    int len;
+
+    if (v <= LLONG_MAX)
+        len = ll2string(buf,sizeof(buf),(long long)v);
+    else
+        len = snprintf(buf,sizeof(buf),"%llu",(unsigned long long)v);
+    return ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+}
+
+/* Append the string object 'o' to the ziplist. */
+static unsigned char *streamZlAppendObject(unsigned char *zl, robj *o) {
+    if (sdsEncodedObject(o)) {
+        return ziplistPush(zl,o->ptr,sdslen(o->ptr),ZIPLIST_TAIL);
+    } else {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)o->ptr);
+        return ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+}
+
+/* Return the unsigned integer stored at 'p', see streamZlAppendUint(). */
+static uint64_t streamZlGetUint(unsigned char *p) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    char buf[21];
+
+    ziplistGet(p,&vstr,&vlen,&vll);
+    if (vstr == NULL) return vll;
+    if (vlen >= sizeof(buf)) return 0;
+    memcpy(buf,vstr,vlen);
+    buf[vlen] = '\0';
+    return strtoull(buf,NULL,10);
+}
+
+/* Get the string stored at 'p'. Integer encoded elements are rendered
+ * into 'buf', that must be at least 21 bytes. */
+static void streamZlGetString(unsigned char *p, unsigned char *buf,
+                              unsigned char **s, int64_t *len)
+{
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+
+    ziplistGet(p,&vstr,&vlen,&vll);
+    if (vstr) {
+        *s = vstr;
+        *len = vlen;
+    } else {
+        *len = ll2string((char*)buf,21,vll);
+        *s = buf;
+    }
+}
+
+/* Return the number of entries of a node, stored as its first element. */
+uint64_t streamNodeCount(unsigned char *zl) {
+    return streamZlGetUint(ziplistIndex(zl,0));
+}
+
+/* Set the number of entries of a node. Returns the new ziplist pointer. */
+static unsigned char *streamNodeSetCount(unsigned char *zl, uint64_t count) {
+    unsigned char *p = ziplistIndex(zl,0);
+    char buf[21];
+    int len = ll2string(buf,sizeof(buf),(long long)count);
+
+    zl = ziplistDelete(zl,&p);
+    return ziplistInsert(zl,p,(unsigned char*)buf,len);
+}
+
+/*-----------------------------------------------------------------------------
+ * Stream IDs
+ *----------------------------------------------------------------------------*/
+
+/* Encode the ID as a 128 bit big endian number, so that the lexicographic
+ * order of the radix tree keys is the numerical order of the IDs. */
+void streamEncodeID(void *buf, streamID *id) {
+    unsigned char *p = buf;
+    int j;
+
+    for (j = 0; j < 8; j++) {
+        p[j] = (id->ms >> (56-j*8)) & 0xff;
+        p[j+8] = (id->seq >> (56-j*8)) & 0xff;
+    }
+}
+
+/* The inverse of streamEncodeID(). */
+void streamDecodeID(void *buf, streamID *id) {
+    unsigned char *p = buf;
+    int j;
+
+    id->ms = id->seq = 0;
+    for (j = 0; j < 8; j++) {
+        id->ms = (id->ms << 8) | p[j];
+        id->seq = (id->seq << 8) | p[j+8];
+    }
+}
+
+/* Compare two IDs: returns -1, 0 or 1 like memcmp(). */
+int streamCompareID(streamID *a, streamID *b) {
+    if (a->ms > b->ms) return 1;
+    else if (a->ms < b->ms) return -1;
+    else if (a->seq > b->seq) return 1;
+    else if (a->seq < b->seq) return -1;
+    return 0;
+}
+
+/* Set 'id' to the smallest ID greater than it. Returns REDIS_ERR if 'id'
+ * is already the greatest possible ID. */
+static int streamIncrID(streamID *id) {
+    if (id->seq == UINT64_MAX) {
+        if (id->ms == UINT64_MAX) return REDIS_ERR;
+        id->ms++;
+        id->seq = 0;
+    } else {
+        id->seq++;
+    }
+    return REDIS_OK;
+}
+
+/* Generate the ID of a new entry: the current time in milliseconds, or the
+ * last ID incremented if the clock did not move forward. */
+static int streamNextID(streamID *last_id, streamID *new_id) {
+    uint64_t ms = mstime();
+
+    if (ms > last_id->ms) {
+        new_id->ms = ms;
+        new_id->seq = 0;
+        return REDIS_OK;
+    }
+    *new_id = *last_id;
+    return streamIncrID(new_id);
+}
+
+/* Parse a decimal unsigned 64 bit number, without sign or spaces. */
+static int streamParseUint64(const char *s, uint64_t *value) {
+    unsigned long long v;
+    char *eptr;
+
+    if (!isdigit((unsigned char)s[0])) return 0;
+    errno = 0;
+    v = strtoull(s,&eptr,10);
+    if (errno == ERANGE || *eptr != '\0') return 0;
+    *value = v;
+    return 1;
+}
+
+/* Parse an ID in the form <ms>-<seq> or just <ms>, in which case the
+ * sequence is set to 'missing_seq'. The special IDs "-" and "+" are the
+ * smallest and the greatest IDs. On error the client gets an error reply
+ * and REDIS_ERR is returned. */
+static int streamParseIDOrReply(redisClient *c, robj *o, streamID *id,
+                                uint64_t missing_seq)
+{
+    char buf[128], *dash;
+    size_t len;
+
+    if (sdsEncodedObject(o)) {
+        len = sdslen(o->ptr);
+        if (len >= sizeof(buf)) goto invalid;
+        memcpy(buf,o->ptr,len);
+        buf[len] = '\0';
+    } else {
+        ll2string(buf,sizeof(buf),(long)o->ptr);
+    }
+
+    if (buf[0] == '-' && buf[1] == '\0') {
+        id->ms = id->seq = 0;
+        return REDIS_OK;
+    } else if (buf[0] == '+' && buf[1] == '\0') {
+        id->ms = id->seq = UINT64_MAX;
+        return REDIS_OK;
+    }
+
+    if ((dash = strchr(buf,'-')) != NULL) *dash = '\0';
+    if (!streamParseUint64(buf,&id->ms)) goto invalid;
+    if (dash) {
+        if (!streamParseUint64(dash+1,&id->seq)) goto invalid;
+    } else {
+        id->seq = missing_seq;
+    }
+    return REDIS_OK;
+
+invalid:
+    addReplyError(c,"Invalid stream ID specified as stream command argument");
+    return REDIS_ERR;
+}
+
+/* Reply with the ID in the <ms>-<seq> form. */
+static void addReplyStreamID(redisClient *c, streamID *id) {
+    char buf[64];
+    int len = snprintf(buf,sizeof(buf),"%llu-%llu",
+        (unsigned long long)id->ms,(unsigned long long)id->seq);
+    addReplyBulkCBuffer(c,buf,len);
+}
+
+/*-----------------------------------------------------------------------------
+ * Stream API
+ *----------------------------------------------------------------------------*/
+
+/* Create a new empty stream. */
+stream *streamNew(void) {
+    stream *s = zmalloc(sizeof(*s));
+
+    s->rax = raxNew();
+    s->length = 0;
+    s->last_id.ms = 0;
+    s->last_id.seq = 0;
+    return s;
+}
+
+/* Free a stream and all its nodes. */
+void freeStream(stream *s) {
+    raxFreeWithCallback(s->rax,zfree);
+    zfree(s);
+}
+
+/* Return the number of entries of the stream object. */
+size_t streamLength(const robj *subject) {
+    stream *s = subject->ptr;
+    return s->length;
+}
+
+/* Append an entry with the 'numfields' field-value pairs at 'argv' to the
+ * stream. If 'use_id' is not NULL the entry gets that ID, otherwise a new
+ * one is generated. The ID of the entry is stored in '*added_id' if not
+ * NULL.
+ *
+ * Returns REDIS_ERR, without adding anything, if the ID is not greater
+ * than the last ID of the stream, or no greater ID can be generated.
+ *
+ * 新元素追加到最后一个节点，节点已满（条目数或字节数达到上限）时新建一个节点 */
+int streamAppendItem(stream *s, robj **argv, int numfields, streamID *added_id, streamID *use_id) {
+    unsigned char *zl = NULL;
+    unsigned char rax_key[sizeof(streamID)];
+    streamID id, master_id;
+    raxIterator ri;
+    int j;
+
+    if (use_id) {
+        id = *use_id;
+    } else if (streamNextID(&s->last_id,&id) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
+    if (streamCompareID(&id,&s->last_id) <= 0) return REDIS_ERR;
+
+    /* Use the last node, if it is not full. */
+    raxStart(&ri,s->rax);
+    raxSeek(&ri,"$",NULL,0);
+    if (raxNext(&ri)) {
+        zl = ri.data;
+        if ((server.stream_node_max_bytes &&
+             ziplistBlobLen(zl) >= server.stream_node_max_bytes) ||
+            (server.stream_node_max_entries &&
+             (long long)streamNodeCount(zl) >= server.stream_node_max_entries))
+        {
+            zl = NULL;
+        } else {
+            memcpy(rax_key,ri.key,sizeof(rax_key));
+            streamDecodeID(rax_key,&master_id);
+        }
+    }
+    raxStop(&ri);
+
+    /* Otherwise create a new node, having this entry ID as master ID. */
+    if (zl == NULL) {
+        master_id = id;
+        streamEncodeID(rax_key,&master_id);
+        zl = ziplistNew();
+        zl = streamZlAppendUint(zl,0);
+    }
+
+    zl = streamZlAppendUint(zl,id.ms-master_id.ms);
+    zl = streamZlAppendUint(zl,id.seq);
+    zl = streamZlAppendUint(zl,numfields);
+    for (j = 0; j < numfields*2; j++) zl = streamZlAppendObject(zl,argv[j]);
+    zl = streamZlAppendUint(zl,4+numfields*2);
+    zl = streamNodeSetCount(zl,streamNodeCount(zl)+1);
+    raxInsert(s->rax,rax_key,sizeof(rax_key),zl,NULL);
+
+    s->length++;
+    s->last_id = id;
+    if (added_id) *added_id = id;
+    return REDIS_OK;
+}
+
+/* Trim the stream to 'maxlen' entries, removing the oldest ones. With
+ * 'approx' only whole nodes are removed, so the stream may be left a bit
+ * longer than requested, but trimming is as cheap as removing a rax key.
+ * Returns the number of entries removed. */
+int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
+    int64_t deleted = 0;
+    raxIterator ri;
+
+    if (s->length <= maxlen) return 0;
+
+    raxStart(&ri,s->rax);
+    raxSeek(&ri,"^",NULL,0);
+    while (s->length > maxlen && raxNext(&ri)) {
+        unsigned char *zl = ri.data, *p;
+        uint64_t entries = streamNodeCount(zl), toremove, j;
+        unsigned int elements = 0;
+
+        /* The whole node can go: remove it and seek again, as the tree
+         * was modified. The key is copied as the seek resets the
+         * iterator key. */
+        if (s->length - entries >= maxlen) {
+            unsigned char key[sizeof(streamID)];
+
+            memcpy(key,ri.key,sizeof(key));
+            zfree(zl);
+            raxRemove(s->rax,key,sizeof(key),NULL);
+            raxSeek(&ri,">=",key,sizeof(key));
+            s->length -= entries;
+            deleted += entries;
+            continue;
+        }
+
+        /* We can't remove the whole node: stop if approximated trimming
+         * was requested, otherwise remove the first entries of the node.
+         * The master ID stays the same, as the remaining entries are
+         * encoded referring to it. */
+        if (approx) break;
+
+        toremove = s->length - maxlen;
+        p = ziplistIndex(zl,1);
+        for (j = 0; j < toremove; j++) {
+            unsigned int entry_elements;
+
+            p = ziplistNext(zl,ziplistNext(zl,p));
+            entry_elements = 4+streamZlGetUint(p)*2;
+            elements += entry_elements;
+            /* Skip the rest of the entry: num-fields is its third element. */
+            entry_elements -= 2;
+            while (entry_elements--) p = ziplistNext(zl,p);
+        }
+        zl = ziplistDeleteRange(zl,1,elements);
+        zl = streamNodeSetCount(zl,entries-toremove);
+        raxInsert(s->rax,ri.key,ri.key_len,zl,NULL);
+        s->length -= toremove;
+        deleted += toremove;
+    }
+    raxStop(&ri);
+    return deleted;
+}
+
+/* Initialize the iterator 'si' to return the entries of 's' with IDs
+ * between 'start' and 'end' included, from the smallest to the greatest
+ * ID, or the other way around if 'rev' is true. A NULL 'start' or 'end'
+ * means the smallest or the greatest possible ID. */
+void streamIteratorStart(streamIterator *si, stream *s, streamID *start, streamID *end, int rev) {
+    unsigned char key[sizeof(streamID)];
+
+    si->stream = s;
+    if (start) {
+        si->start_id = *start;
+    } else {
+        si->start_id.ms = 0;
+        si->start_id.seq = 0;
+    }
+    if (end) {
+        si->end_id = *end;
+    } else {
+        si->end_id.ms = UINT64_MAX;
+        si->end_id.seq = UINT64_MAX;
+    }
+    si->rev = rev;
+
+    /* The first node to visit is the one with the greatest master ID not
+     * greater than the range boundary we start from. Iterating forward,
+     * if there is no such node the range starts before the stream. */
+    raxStart(&si->ri,s->rax);
+    streamEncodeID(key,rev ? &si->end_id : &si->start_id);
+    raxSeek(&si->ri,"<=",key,sizeof(key));
+    if (!rev && raxEOF(&si->ri)) raxSeek(&si->ri,"^",NULL,0);
+    si->zl = NULL;
+    si->zp = NULL;
+    si->fp = NULL;
+}
+
+/* Move to the next entry in the range. Returns 1 storing its ID and number
+ * of fields in '*id' and '*numfields', or 0 if there are no more entries.
+ * The fields are then returned by streamIteratorGetField(). */
+int streamIteratorGetID(streamIterator *si, streamID *id, int64_t *numfields) {
+    while(1) {
+        /* Move to the next node: the first entry iterating forward, the
+         * lp-count of the last entry iterating backward. */
+        if (si->zl == NULL) {
+            if (!(si->rev ? raxPrev(&si->ri) : raxNext(&si->ri))) return 0;
+            si->zl = si->ri.data;
+            streamDecodeID(si->ri.key,&si->master_id);
+            si->zp = ziplistIndex(si->zl,si->rev ? -1 : 1);
+        }
+
+        while (si->zp) {
+            unsigned char *p = si->zp;
+
+            if (si->rev) {
+                /* Walk back to the first element of the entry. Before it
+                 * there is the lp-count of the previous entry, or the node
+                 * count if this is the first entry. */
+                int64_t back = streamZlGetUint(p)-1;
+
+                while (back--) p = ziplistPrev(si->zl,p);
+                si->zp = ziplistPrev(si->zl,p);
+                if (si->zp == ziplistIndex(si->zl,0)) si->zp = NULL;
+            }
+
+            id->ms = si->master_id.ms+streamZlGetUint(p);
+            p = ziplistNext(si->zl,p);
+            id->seq = streamZlGetUint(p);
+            p = ziplistNext(si->zl,p);
+            *numfields = streamZlGetUint(p);
+            p = ziplistNext(si->zl,p);
+            si->fp = p;
+
+            if (!si->rev) {
+                /* Skip the fields and the lp-count to the next entry. */
+                int64_t skip = *numfields*2+1;
+
+                while (skip--) p = ziplistNext(si->zl,p);
+                si->zp = p;
+
+                if (streamCompareID(id,&si->start_id) < 0) continue;
+                if (streamCompareID(id,&si->end_id) > 0) return 0;
+            } else {
+                if (streamCompareID(id,&si->end_id) > 0) continue;
+                if (streamCompareID(id,&si->start_id) < 0) return 0;
+            }
+            return 1;
+        }
+        si->zl = NULL;
+    }
+}
+
+/* Return the next field-value pair of the current entry. Must be called
+ * exactly 'numfields' times after each streamIteratorGetID(). The returned
+ * pointers are valid until the iterator moves. */
+void streamIteratorGetField(streamIterator *si, unsigned char **fieldptr, unsigned char **valueptr, int64_t *fieldlen, int64_t *valuelen) {
+    streamZlGetString(si->fp,si->field_buf,fieldptr,fieldlen);
+    si->fp = ziplistNext(si->zl,si->fp);
+    streamZlGetString(si->fp,si->value_buf,valueptr,valuelen);
+    si->fp = ziplistNext(si->zl,si->fp);
+}
+
+/* Release the resources of the iterator. */
+void streamIteratorStop(streamIterator *si) {
+    raxStop(&si->ri);
+}
+
+/* Reply with the entries of 's' in the range 'start'-'end' (see
+ * streamIteratorStart()), at most 'count' if 'count' is not zero.
+ * Returns the number of entries emitted. */
+size_t streamReplyWithRange(redisClient *c, stream *s, streamID *start, streamID *end, size_t count, int rev) {
+    void *replylen = addDeferredMultiBulkLength(c);
+    size_t arraylen = 0;
+    streamIterator si;
+    streamID id;
+    int64_t numfields;
+
+    streamIteratorStart(&si,s,start,end,rev);
+    while(streamIteratorGetID(&si,&id,&numfields)) {
+        addReplyMultiBulkLen(c,2);
+        addReplyStreamID(c,&id);
+        addReplyMultiBulkLen(c,numfields*2);
+        while(numfields--) {
+            unsigned char *field, *value;
+            int64_t field_len, value_len;
+
+            streamIteratorGetField(&si,&field,&value,&field_len,&value_len);
+            addReplyBulkCBuffer(c,field,field_len);
+            addReplyBulkCBuffer(c,value,value_len);
+        }
+        arraylen++;
+        if (count && count == arraylen) break;
+    }
+    streamIteratorStop(&si);
+    setDeferredMultiBulkLength(c,replylen,arraylen);
+    return arraylen;
+}
+
+/* Serve the clients blocked by XREAD on the stream 'o', stored at the key
+ * 'rl' signaled as ready: every client waiting for IDs smaller than the
+ * last one of the stream gets the new entries and is unblocked. Called by
+ * handleClientsBlockedOnKeys(). */
+void serveClientsBlockedOnStreamKey(robj *o, readyList *rl) {
+    stream *s = o->ptr;
+    dictEntry *de;
+    listNode *ln;
+    listIter li;
+
+    de = dictFind(rl->db->blocking_keys,rl->key);
+    if (de == NULL) return;
+
+    // unblockClient() 只会删除当前节点，迭代是安全的
+    listRewind(dictGetVal(de),&li);
+    while((ln = listNext(&li)) != NULL) {
+        redisClient *receiver = ln->value;
+        streamID *gt, start;
+
+        if (receiver->btype != REDIS_BLOCKED_STREAM) continue;
+        gt = dictFetchValue(receiver->bpop.keys,rl->key);
+        if (streamCompareID(&s->last_id,gt) <= 0) continue;
+
+        /* The ID is freed by unblockClient(), so reply first. */
+        start = *gt;
+        streamIncrID(&start);
+        addReplyMultiBulkLen(receiver,1);
+        addReplyMultiBulkLen(receiver,2);
+        addReplyBulk(receiver,rl->key);
+        streamReplyWithRange(receiver,s,&start,NULL,
+                             receiver->bpop.xread_count,0);
+        unblockClient(receiver);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Stream commands implementation
+ *----------------------------------------------------------------------------*/
+
+/* Lookup the stream at 'key' for writing, creating it if it does not exist.
+ * Returns NULL, replying with an error, if the key holds another type. */
+static robj *streamTypeLookupWriteOrCreate(redisClient *c, robj *key) {
+    robj *o = lookupKeyWrite(c->db,key);
+
+    if (o == NULL) {
+        o = createStreamObject();
+        dbAdd(c->db,key,o);
+    } else if (o->type != REDIS_STREAM) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return o;
+}
+
+/* Parse "MAXLEN [~] <count>" starting at argv[*pos], that must be the
+ * MAXLEN option itself, leaving *pos at the count. */
+static int streamParseMaxlenOrReply(redisClient *c, int *pos, long long *maxlen, int *approx) {
+    int i = *pos+1;
+
+    *approx = 0;
+    if (i+1 < c->argc && !strcmp(c->argv[i]->ptr,"~")) {
+        *approx = 1;
+        i++;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[i],maxlen,NULL) != REDIS_OK)
+        return REDIS_ERR;
+    if (*maxlen < 0) {
+        addReplyError(c,"The MAXLEN argument must be >= 0.");
+        return REDIS_ERR;
+    }
+    *pos = i;
+    return REDIS_OK;
+}
+
+/* XADD key [MAXLEN [~] <count>] <ID or *> field value [field value ...] */
+void xaddCommand(redisClient *c) {
+    streamID id;
+    int id_given = 0, approx_maxlen = 0, field_pos, i;
+    long long maxlen = -1;
+    robj *o, *idobj;
+    stream *s;
+    sds idstr;
+
+    /* Parse the options, up to the ID argument. */
+    for (i = 2; i < c->argc; i++) {
+        char *opt = c->argv[i]->ptr;
+
+        if (opt[0] == '*' && opt[1] == '\0') {
+            break;
+        } else if (!strcasecmp(opt,"maxlen") && i+1 < c->argc) {
+            if (streamParseMaxlenOrReply(c,&i,&maxlen,&approx_maxlen)
+                != REDIS_OK) return;
+        } else {
+            if (streamParseIDOrReply(c,c->argv[i],&id,0) != REDIS_OK) return;
+            id_given = 1;
+            break;
+        }
+    }
+    field_pos = i+1;
+
+    /* At least one field-value pair needs to follow. */
+    if (field_pos >= c->argc || ((c->argc-field_pos) % 2) == 1) {
+        addReplyError(c,"wrong number of arguments for XADD");
+        return;
+    }
+    if (id_given && id.ms == 0 && id.seq == 0) {
+        addReplyError(c,"The ID specified in XADD must be greater than 0-0");
+        return;
+    }
+
+    if ((o = streamTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+    s = o->ptr;
+
+    if (streamAppendItem(s,c->argv+field_pos,(c->argc-field_pos)/2,
+        &id, id_given ? &id : NULL) == REDIS_ERR)
+    {
+        if (id_given)
+            addReplyError(c,"The ID specified in XADD is equal or smaller "
+                            "than the target stream top item");
+        else
+            addReplyError(c,"The stream has exhausted the last possible ID, "
+                            "unable to add more items");
+        return;
+    }
+    addReplyStreamID(c,&id);
+
+    signalModifiedKey(c->db,c->argv[1]);
+    notifyKeyspaceEvent(REDIS_NOTIFY_STREAM,"xadd",c->argv[1],c->db->id);
+    server.dirty++;
+
+    if (maxlen >= 0 && streamTrimByLength(s,maxlen,approx_maxlen))
+        notifyKeyspaceEvent(REDIS_NOTIFY_STREAM,"xtrim",c->argv[1],c->db->id);
+
+    /* Propagate the ID actually used, so that the slaves and the AOF don't
+     * generate a different one. */
+    idstr = sdscatprintf(sdsempty(),"%llu-%llu",
+        (unsigned long long)id.ms,(unsigned long long)id.seq);
+    idobj = createObject(REDIS_STRING,idstr);
+    rewriteClientCommandArgument(c,i,idobj);
+    decrRefCount(idobj);
+
+    /* Serve the clients blocked by XREAD for this key. */
+    signalKeyAsReady(c,c->argv[1]);
+}
+
+/* XRANGE/XREVRANGE implementation. */
+void xrangeGenericCommand(redisClient *c, int rev) {
+    robj *o, *startarg, *endarg;
+    streamID startid, endid;
+    long long count = -1;
+    int j;
+
+    startarg = rev ? c->argv[3] : c->argv[2];
+    endarg = rev ? c->argv[2] : c->argv[3];
+    if (streamParseIDOrReply(c,startarg,&startid,0) == REDIS_ERR) return;
+    if (streamParseIDOrReply(c,endarg,&endid,UINT64_MAX) == REDIS_ERR) return;
+
+    /* Parse the COUNT option if any. */
+    for (j = 4; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"count") && j+1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&count,NULL)
+                != REDIS_OK) return;
+            if (count < 0) count = 0;
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+        || checkType(c,o,REDIS_STREAM)) return;
+
+    if (count == 0) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    streamReplyWithRange(c,o->ptr,&startid,&endid,count == -1 ? 0 : count,rev);
+}
+
+/* XRANGE key start end [COUNT <n>] */
+void xrangeCommand(redisClient *c) {
+    xrangeGenericCommand(c,0);
+}
+
+/* XREVRANGE key end start [COUNT <n>] */
+void xrevrangeCommand(redisClient *c) {
+    xrangeGenericCommand(c,1);
+}
+
+/* XLEN key */
+void xlenCommand(redisClient *c) {
+    robj *o;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL
+        || checkType(c,o,REDIS_STREAM)) return;
+    addReplyLongLong(c,streamLength(o));
+}
+
+/* XTRIM key MAXLEN [~] <count> */
+void xtrimCommand(redisClient *c) {
+    long long maxlen;
+    int64_t deleted;
+    int approx, i = 2;
+    robj *o;
+
+    if (strcasecmp(c->argv[2]->ptr,"maxlen")) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (streamParseMaxlenOrReply(c,&i,&maxlen,&approx) != REDIS_OK) return;
+    if (i != c->argc-1) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL
+        || checkType(c,o,REDIS_STREAM)) return;
+
+    deleted = streamTrimByLength(o->ptr,maxlen,approx);
+    if (deleted) {
+        signalModifiedKey(c->db,c->argv[1]);
+        notifyKeyspaceEvent(REDIS_NOTIFY_STREAM,"xtrim",c->argv[1],c->db->id);
+        server.dirty += deleted;
+    }
+    addReplyLongLong(c,deleted);
+}
+
+/* XREAD [BLOCK <milliseconds>] [COUNT <count>] STREAMS key_1 ... key_N
+ *       ID_1 ... ID_N
+ *
+ * Return the entries with ID greater than ID_j of every stream key_j. The
+ * special ID "$" is the last ID of the stream, to only get new entries.
+ * With BLOCK, if no stream has entries to return, the client blocks until
+ * one of them gets new entries or the timeout (0 means forever) expires. */
+#define XREAD_STATIC_IDS 8
+void xreadCommand(redisClient *c) {
+    mstime_t timeout = -1; /* -1 means no BLOCK option. */
+    long long count = 0;
+    int streams_count = 0, streams_arg = 0, i;
+    streamID static_ids[XREAD_STATIC_IDS], *ids = static_ids;
+    size_t arraylen = 0;
+    void *arraylen_ptr = NULL;
+
+    /* Parse the options, up to the STREAMS keyword. */
+    for (i = 1; i < c->argc; i++) {
+        int moreargs = c->argc-i-1;
+        char *opt = c->argv[i]->ptr;
+
+        if (!strcasecmp(opt,"block") && moreargs) {
+            i++;
+            if (getTimeoutFromObjectOrReply(c,c->argv[i],&timeout,
+                UNIT_MILLISECONDS) != REDIS_OK) return;
+        } else if (!strcasecmp(opt,"count") && moreargs) {
+            i++;
+            if (getLongLongFromObjectOrReply(c,c->argv[i],&count,NULL)
+                != REDIS_OK) return;
+            if (count < 0) count = 0;
+        } else if (!strcasecmp(opt,"streams") && moreargs) {
+            streams_arg = i+1;
+            streams_count = c->argc-streams_arg;
+            if ((streams_count % 2) != 0) {
+                addReplyError(c,"Unbalanced XREAD list of streams: "
+                                "for each stream key an ID or '$' must be "
+                                "specified.");
+                return;
+            }
+            streams_count /= 2;
+            break;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    if (streams_arg == 0) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    /* Parse the IDs and check the types before emitting any reply. */
+    if (streams_count > XREAD_STATIC_IDS)
+        ids = zmalloc(sizeof(streamID)*streams_count);
+    for (i = 0; i < streams_count; i++) {
+        robj *key = c->argv[streams_arg+i];
+        robj *idarg = c->argv[streams_arg+streams_count+i];
+        robj *o = lookupKeyRead(c->db,key);
+
+        if (o && checkType(c,o,REDIS_STREAM)) goto cleanup;
+        if (sdsEncodedObject(idarg) && !strcmp(idarg->ptr,"$")) {
+            if (o) {
+                ids[i] = ((stream*)o->ptr)->last_id;
+            } else {
+                ids[i].ms = 0;
+                ids[i].seq = 0;
+            }
+        } else if (streamParseIDOrReply(c,idarg,ids+i,0) != REDIS_OK) {
+            goto cleanup;
+        }
+    }
+
+    /* Serve synchronously the streams having entries after the IDs. */
+    for (i = 0; i < streams_count; i++) {
+        robj *key = c->argv[streams_arg+i];
+        robj *o = lookupKeyRead(c->db,key);
+        stream *s;
+        streamID start;
+
+        if (o == NULL) continue;
+        s = o->ptr;
+        if (streamCompareID(&s->last_id,ids+i) <= 0) continue;
+
+        if (arraylen == 0) arraylen_ptr = addDeferredMultiBulkLength(c);
+        arraylen++;
+        start = ids[i];
+        streamIncrID(&start);
+        addReplyMultiBulkLen(c,2);
+        addReplyBulk(c,key);
+        streamReplyWithRange(c,s,&start,NULL,count,0);
+    }
+    if (arraylen) {
+        setDeferredMultiBulkLength(c,arraylen_ptr,arraylen);
+        goto cleanup;
+    }
+
+    /* Block if needed, but never inside MULTI/EXEC: like BLPOP, it is the
+     * same as a timeout. */
+    if (timeout != -1 && !(c->flags & REDIS_MULTI)) {
+        blockForKeys(c,REDIS_BLOCKED_STREAM,c->argv+streams_arg,
+                     streams_count,timeout,NULL,ids);
+        c->bpop.xread_count = count ? count : XREAD_BLOCKED_DEFAULT_COUNT;
+        goto cleanup;
+    }
+    addReplyNullArray(c);
+
+cleanup:
+    if (ids != static_ids) zfree(ids);
+}
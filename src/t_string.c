@@ -30,6 +30,157 @@
 #include "redis.h"
 #include <math.h> /* isnan(), isinf() */
 
+/*-----------------------------------------------------------------------------
+ * Chunked strings, see stringChunks in redis.h
+ *----------------------------------------------------------------------------*/
+
+/* The last chunk starts this small and doubles up to a full chunk. */
+#define REDIS_STRING_CHUNK_MIN_ALLOC (64*1024)
+
+/* Length of chunk 'j', whose first byte is stored in '*p'. */
+size_t stringChunksAt(stringChunks *sc, size_t j, char **p) {
+    *p = sc->chunk[j];
+    if (j == sc->count-1) return sc->len - j*REDIS_STRING_CHUNK_BYTES;
+    return REDIS_STRING_CHUNK_BYTES;
+}
+
+/* Append 'len' bytes to the string, or 'len' zero bytes when 's' is NULL.
+ * Full chunks are never touched again, so at most one chunk is reallocated
+ * however big the string is. */
+void stringChunksAppend(stringChunks *sc, const char *s, size_t len) {
+    while (len) {
+        size_t used = sc->count ? sc->len - (sc->count-1)*REDIS_STRING_CHUNK_BYTES : 0;
+        size_t n;
+
+        // 最后一块已满，新开一块
+        if (sc->count == 0 || used == REDIS_STRING_CHUNK_BYTES) {
+            if (sc->count == sc->slots) {
+                sc->slots = sc->slots ? sc->slots*2 : 4;
+                sc->chunk = zrealloc(sc->chunk,sizeof(char*)*sc->slots);
+            }
+            sc->chunk[sc->count++] = NULL;
+            sc->tail_alloc = 0;
+            used = 0;
+        }
+
+        n = REDIS_STRING_CHUNK_BYTES - used;
+        if (n > len) n = len;
+        if (used+n > sc->tail_alloc) {
+            size_t alloc = sc->tail_alloc ? sc->tail_alloc : REDIS_STRING_CHUNK_MIN_ALLOC;
+
+            while (alloc < used+n) alloc *= 2;
+            if (alloc > REDIS_STRING_CHUNK_BYTES) alloc = REDIS_STRING_CHUNK_BYTES;
+            sc->chunk[sc->count-1] = zrealloc(sc->chunk[sc->count-1],alloc);
+            sc->tail_alloc = alloc;
+        }
+        if (s) {
+            memcpy(sc->chunk[sc->count-1]+used,s,n);
+            s += n;
+        } else {
+            memset(sc->chunk[sc->count-1]+used,0,n);
+        }
+        sc->len += n;
+        len -= n;
+    }
+}
+
+/* Overwrite the string from 'offset' on, growing it with zeros if needed. */
+static void stringChunksWrite(stringChunks *sc, size_t offset, const char *s,
+                              size_t len)
+{
+    if (offset+len > sc->len) stringChunksAppend(sc,NULL,offset+len-sc->len);
+    while (len) {
+        size_t j = offset / REDIS_STRING_CHUNK_BYTES;
+        size_t skip = offset % REDIS_STRING_CHUNK_BYTES;
+        size_t n = REDIS_STRING_CHUNK_BYTES - skip;
+
+        if (n > len) n = len;
+        memcpy(sc->chunk[j]+skip,s,n);
+        offset += n;
+        s += n;
+        len -= n;
+    }
+}
+
+void stringChunksFree(stringChunks *sc) {
+    size_t j;
+
+    for (j = 0; j < sc->count; j++) zfree(sc->chunk[j]);
+    zfree(sc->chunk);
+    zfree(sc);
+}
+
+size_t stringChunksAllocSize(stringChunks *sc) {
+    size_t size = sizeof(*sc)+sizeof(char*)*sc->slots;
+
+    if (sc->count)
+        size += (sc->count-1)*REDIS_STRING_CHUNK_BYTES + sc->tail_alloc;
+    return size;
+}
+
+/* Turn the RAW string 'o' into a chunked one, in place. */
+void stringConvertToChunked(robj *o) {
+    stringChunks *sc = zcalloc(sizeof(*sc));
+
+    redisAssert(o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_RAW);
+    stringChunksAppend(sc,o->ptr,sdslen(o->ptr));
+    sdsfree(o->ptr);
+    o->ptr = sc;
+    o->encoding = REDIS_ENCODING_CHUNKED;
+}
+
+/* Turn a chunked string back into a RAW one, in place. Any other object is
+ * left alone. */
+void stringConvertToRaw(robj *o) {
+    stringChunks *sc;
+    sds s;
+    size_t j;
+
+    if (o->type != REDIS_STRING || o->encoding != REDIS_ENCODING_CHUNKED)
+        return;
+    sc = o->ptr;
+    s = sdsnewlen(NULL,sc->len);
+    for (j = 0; j < sc->count; j++) {
+        char *p;
+        size_t n = stringChunksAt(sc,j,&p);
+
+        memcpy(s+j*REDIS_STRING_CHUNK_BYTES,p,n);
+    }
+    stringChunksFree(sc);
+    o->ptr = s;
+    o->encoding = REDIS_ENCODING_RAW;
+}
+
+/* Reply with 'len' bytes of a chunked string starting at 'start', chunk by
+ * chunk, without building the contiguous string. */
+static void addReplyChunkedRange(redisClient *c, robj *o, size_t start,
+                                 size_t len)
+{
+    stringChunks *sc = o->ptr;
+
+    addReplyLongLongWithPrefix(c,len,'$');
+    while (len) {
+        size_t j = start / REDIS_STRING_CHUNK_BYTES;
+        size_t skip = start % REDIS_STRING_CHUNK_BYTES;
+        size_t n = REDIS_STRING_CHUNK_BYTES - skip;
+
+        if (n > len) n = len;
+        addReplyString(c,sc->chunk[j]+skip,n);
+        start += n;
+        len -= n;
+    }
+    addReply(c,shared.crlf);
+}
+
+/* Chunk the string 'o' of the key if APPEND / SETRANGE made it big enough.
+ * Strings shared with other references are left alone. */
+static void stringTryChunking(robj *o) {
+    if (server.string_chunk_threshold == 0 ||
+        o->encoding != REDIS_ENCODING_RAW || o->refcount != 1) return;
+    if (sdslen(o->ptr) > server.string_chunk_threshold)
+        stringConvertToChunked(o);
+}
+
 /*-----------------------------------------------------------------------------
  * String Commands
  *----------------------------------------------------------------------------*/
@@ -121,7 +272,7 @@ void setGenericCommand(redisClient *c,
     if ((flags & REDIS_SET_NX && lookupKeyWrite(c->db,key) != NULL) // 首先看看 flags 里面 NX 有没被 set
         || (flags & REDIS_SET_XX && lookupKeyWrite(c->db,key) == NULL))
     {
-        addReply(c, abort_reply ? abort_reply : shared.nullbulk);
+        addReply(c, abort_reply ? abort_reply : shared.null[c->resp]);
         return;
     }
 
@@ -211,14 +362,19 @@ int getGenericCommand(redisClient *c) {
 
     // 尝试从数据库中取出键 c->argv[1] 对应的值对象
     // 如果键不存在时，向客户端发送回复信息，并返回 NULL
-    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL)
+    if ((o = lookupKeyReadWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED)) == NULL) {
+        addReply(c,shared.null[c->resp]);
         return REDIS_OK;
+    }
 
     // 值对象存在，检查它的类型
     if (o->type != REDIS_STRING) {
         // 类型错误
         addReply(c,shared.wrongtypeerr);
         return REDIS_ERR;
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        addReplyChunkedRange(c,o,0,((stringChunks*)o->ptr)->len);
+        return REDIS_OK;
     } else {
         // 类型正确，向客户端返回对象的值
         addReplyBulk(c,o);
@@ -267,7 +423,7 @@ void setrangeCommand(redisClient *c) {
     }
 
     // 取出键现在的值对象
-    o = lookupKeyWrite(c->db,c->argv[1]);
+    o = lookupKeyWriteWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED);
     if (o == NULL) {
 
         // 键不存在于数据库中。。。
@@ -316,16 +472,22 @@ void setrangeCommand(redisClient *c) {
             return;
 
         /* Create a copy when the object is shared or encoded. */
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
+        if (o->encoding != REDIS_ENCODING_CHUNKED)
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
     }
 
     // 这里的 sdslen(value) > 0 其实可以去掉
     // 前面已经做了检测了
     if (sdslen(value) > 0) {
-        // 扩展字符串值对象（本身已经够长的话，就不用拓展了）
-        o->ptr = sdsgrowzero(o->ptr,offset+sdslen(value));
-        // 将 value 复制到字符串中的指定的位置
-        memcpy((char*)o->ptr+offset,value,sdslen(value));   // 正式进行 set 操作
+        if (o->encoding == REDIS_ENCODING_CHUNKED) {
+            stringChunksWrite(o->ptr,offset,value,sdslen(value));
+        } else {
+            // 扩展字符串值对象（本身已经够长的话，就不用拓展了）
+            o->ptr = sdsgrowzero(o->ptr,offset+sdslen(value));
+            // 将 value 复制到字符串中的指定的位置
+            memcpy((char*)o->ptr+offset,value,sdslen(value));   // 正式进行 set 操作
+            stringTryChunking(o);
+        }
 
         // 向数据库发送键被修改的信号
         signalModifiedKey(c->db,c->argv[1]);
@@ -339,7 +501,7 @@ void setrangeCommand(redisClient *c) {
     }
 
     // 设置成功，返回新的字符串值给客户端
-    addReplyLongLong(c,sdslen(o->ptr));
+    addReplyLongLong(c,stringObjectLen(o));
 }
 
 // GETRANGE key start end
@@ -358,13 +520,19 @@ void getrangeCommand(redisClient *c) {
         return;
 
     // 从数据库中查找键 c->argv[1] 
-    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptybulk)) == NULL ||
-        checkType(c,o,REDIS_STRING)) return;
+    if ((o = lookupKeyReadWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED)) == NULL) {
+        addReply(c,shared.emptybulk);
+        return;
+    }
+    if (checkType(c,o,REDIS_STRING)) return;
 
     // 根据编码，对对象的值进行处理
     if (o->encoding == REDIS_ENCODING_INT) {
         str = llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        str = NULL;
+        strlen = ((stringChunks*)o->ptr)->len;
     } else {
         str = o->ptr;
         strlen = sdslen(str);
@@ -383,6 +551,9 @@ void getrangeCommand(redisClient *c) {
     if (start > end) {
         // 处理索引范围为空的情况
         addReply(c,shared.emptybulk);
+    } else if (str == NULL) {
+        // 分块字符串：逐块回复，不拼接
+        addReplyChunkedRange(c,o,start,end-start+1);
     } else {
         // 向客户端返回给定范围内的字符串内容
         addReplyBulkCBuffer(c,(char*)str+start,end-start+1);
@@ -400,11 +571,11 @@ void mgetCommand(redisClient *c) {
         robj *o = lookupKeyRead(c->db,c->argv[j]);
         if (o == NULL) {
             // 值不存在，向客户端发送空回复
-            addReply(c,shared.nullbulk);
+            addReplyNull(c);
         } else {
             if (o->type != REDIS_STRING) {
                 // 值存在，但不是字符串类型
-                addReply(c,shared.nullbulk);
+                addReplyNull(c);
             } else {
                 // 值存在，并且是字符串
                 addReplyBulk(c,o);
@@ -498,11 +669,25 @@ void incrDecrCommand(redisClient *c, long long incr) {
     // 进行加法计算，并将值保存到新的值对象中
     // 然后用新的值对象替换原来的值对象
     value += incr;
-    new = createStringObjectFromLongLong(value);
-    if (o)
-        dbOverwrite(c->db,c->argv[1],new);
-    else
-        dbAdd(c->db,c->argv[1],new);
+
+    /* An unshared INT object is updated in place: no allocation and no
+     * dictionary overwrite. lookupKeyWrite() already told the snapshot and
+     * the HLL cache the key is changing. Values in the shared integers
+     * range still use the shared objects. */
+    // 独占的 INT 编码对象直接原地修改
+    if (o && o->refcount == 1 && o->encoding == REDIS_ENCODING_INT &&
+        (value < 0 || value >= REDIS_SHARED_INTEGERS) &&
+        value >= LONG_MIN && value <= LONG_MAX)
+    {
+        new = o;
+        o->ptr = (void*)((long)value);
+    } else {
+        new = createStringObjectFromLongLong(value);
+        if (o)
+            dbOverwrite(c->db,c->argv[1],new);
+        else
+            dbAdd(c->db,c->argv[1],new);
+    }
 
     // 向数据库发送键被修改的信号
     signalModifiedKey(c->db,c->argv[1]);
@@ -599,7 +784,7 @@ void appendCommand(redisClient *c) {
     robj *o, *append;
 
     // 取出键相应的值对象
-    o = lookupKeyWrite(c->db,c->argv[1]);
+    o = lookupKeyWriteWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED);
     if (o == NULL) {
 
         // 键值对不存在。。。
@@ -627,10 +812,15 @@ void appendCommand(redisClient *c) {
             return;
 
         /* Append the value */
-        // 执行追加操作
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
-        o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
-        totlen = sdslen(o->ptr);
+        // 执行追加操作：分块字符串只会写最后一块，不会整体 realloc
+        if (o->encoding == REDIS_ENCODING_CHUNKED) {
+            stringChunksAppend(o->ptr,append->ptr,sdslen(append->ptr));
+        } else {
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
+            o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
+            stringTryChunking(o);
+        }
+        totlen = stringObjectLen(o);
     }
 
     // 向数据库发送键被修改的信号
@@ -650,8 +840,11 @@ void strlenCommand(redisClient *c) {
     robj *o;
 
     // 取出值对象，并进行类型检查
-    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
-        checkType(c,o,REDIS_STRING)) return;
+    if ((o = lookupKeyReadWithFlags(c->db,c->argv[1],REDIS_LOOKUP_CHUNKED)) == NULL) {
+        addReply(c,shared.czero);
+        return;
+    }
+    if (checkType(c,o,REDIS_STRING)) return;
 
     // 返回字符串值的长度
     addReplyLongLong(c,stringObjectLen(o));
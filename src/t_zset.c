@@ -48,7 +48,7 @@
  * 以跳跃表的视角来看，可以说 Redis 对象是根据分值来排序的。
  * 
  * zsl --> zset skip-list-Node
- * zzl --> zset 的操作函数（Ziplist-backed sorted set API）
+ * zzl --> zset 的操作函数（Listpack-backed sorted set API）
  */
 
 /* This skiplist implementation is almost a C translation of the original
@@ -76,25 +76,34 @@
 #include "redis.h"
 #include <math.h>
 
-static int zslLexValueGteMin(robj *value, zlexrangespec *spec);
-static int zslLexValueLteMax(robj *value, zlexrangespec *spec);
+static int zslLexValueGteMin(sds value, zlexrangespec *spec);
+static int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /*
  * 创建一个层数为 level 的跳跃表节点，
- * 并将节点的成员对象设置为 obj ，分值设置为 score 。
+ * 并将节点的成员设置为 ele ，分值设置为 score 。
+ *
+ * The member is copied inside the node allocation itself, right after the
+ * levels, so the node owns it: the zset dict uses node->ele as its key and
+ * the string is released together with the node. 'ele' may be NULL for
+ * the header node.
+ *
+ * 成员被复制到节点的同一块内存中（位于 level 数组之后）
  *
  * 返回值为新创建的跳跃表节点
  *
  * T = O(1)
  */
-zskiplistNode *zslCreateNode(int level, double score, robj *obj) {
-    
+zskiplistNode *zslCreateNode(int level, double score, sds ele) {
+    size_t nodesize = sizeof(zskiplistNode)+level*sizeof(struct zskiplistLevel);
+    size_t elesize = ele ? sdsInplaceSize(sdslen(ele)) : 0;
+
     // 分配空间
-    zskiplistNode *zn = zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
+    zskiplistNode *zn = zmalloc(nodesize+elesize);
 
     // 设置属性
     zn->score = score;
-    zn->obj = obj;
+    zn->ele = ele ? sdsnewinplace((char*)zn+nodesize,ele,sdslen(ele)) : NULL;
 
     return zn;
 }
@@ -141,8 +150,7 @@ zskiplist *zslCreate(void) {
  */
 void zslFreeNode(zskiplistNode *node) {
 
-    decrRefCount(node->obj);
-
+    // 成员和节点在同一块内存中，一起释放
     zfree(node);
 }
 
@@ -230,11 +238,16 @@ int zslRandomLevel(void) {
  *    通常下面几个 level 是用来 drill down 的，就比如：要找的是第二个跟第三个中间（* 号处）
  *    会直接 node1：l5 -> l4 -> l3; node2：l3 ->l2; *; 三步走
 */
-zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
+/* Link the node 'node', that has 'level' levels, at the position its score
+ * and member require. Used by zslInsert() for new nodes and by
+ * zslUpdateScore() to move an existing node. */
+static zskiplistNode *zslInsertNode(zskiplist *zsl, zskiplistNode *node, int level) {
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL];/* 记录了从 zsl.header 到 可以插入 pos 的路径（一层只会有一个） */
-    zskiplistNode *x; /* 先作为遍历查找的指针（指向 header，作为开始查找的起点），然后指向创建的新节点（需要 return 出去） */
+    zskiplistNode *x; /* 先作为遍历查找的指针（指向 header，作为开始查找的起点），然后指向新节点（需要 return 出去） */
     unsigned int rank[ZSKIPLIST_MAXLEVEL];
-    int i, level;
+    double score = node->score;
+    sds ele = node->ele;
+    int i;
 
     redisAssert(!isnan(score));
 
@@ -267,7 +280,7 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
         // 是的
         while (x->level[i].forward 
                && (x->level[i].forward->score < score // 目标 score 可以继续向前挪动一个 skiplist node（优先向远处跳跃）
-                   || (x->level[i].forward->score == score && compareStringObjects(x->level[i].forward->obj,obj) < 0))) { // 同 score 的情况下，采用 obj 里面的内容来进行比较
+                   || (x->level[i].forward->score == score && sdscmp(x->level[i].forward->ele,ele) < 0))) { // 同 score 的情况下，采用成员的内容来进行比较
 
             // 记录沿途跨越了多少个节点
             rank[i] += x->level[i].span;
@@ -293,11 +306,6 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
      * 所以这里不需要进一步进行检查，可以直接创建新元素。
      */
 
-    // 获取一个随机值作为新节点的层数
-    // 随机决定新插入的 node 究竟要多少个 level
-    // T = O(N)
-    level = zslRandomLevel();
-
     // 必须完善 update[], 因为新节点的信息就是用 update[] 来初始化的
     // 如果新节点的层数比表中其他节点的层数都要大
     // 那么初始化表头节点中未使用的层(因为 header 是所有搜索的起点，必须包含全部 level，才能顺利 drill down)，并将它们记录到 update 数组中
@@ -316,8 +324,7 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
         zsl->level = level;
     }
 
-    // 创建新节点
-    x = zslCreateNode(level,score,obj);
+    x = node;
 
     // 将前面记录的指针指向新节点，并做相应的设置
     // T = O(1)
@@ -363,6 +370,16 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
     return x;
 }
 
+zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
+    // 获取一个随机值作为新节点的层数
+    // 随机决定新插入的 node 究竟要多少个 level
+    // T = O(N)
+    int level = zslRandomLevel();
+
+    // 创建新节点，并链接到跳跃表中
+    return zslInsertNode(zsl,zslCreateNode(level,score,ele),level);
+}
+
 /* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank 
  * 
  * 内部删除函数，
@@ -413,7 +430,7 @@ void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
  * T_wrost = O(N^2), T_avg = O(N log N)
  */
 // match 节点的条件：同时匹配 score 跟 member（robj）
-int zslDelete(zskiplist *zsl, double score, robj *obj) {
+int zslDelete(zskiplist *zsl, double score, sds ele) {
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     int i;
 
@@ -425,7 +442,7 @@ int zslDelete(zskiplist *zsl, double score, robj *obj) {
         // 遍历跳跃表的复杂度为 T_wrost = O(N), T_avg = O(log N)
         while (x->level[i].forward
                && (x->level[i].forward->score < score 
-                   || (x->level[i].forward->score == score && compareStringObjects(x->level[i].forward->obj,obj) < 0))) // score 相同，但是 robj(member) 并不相同
+                   || (x->level[i].forward->score == score && sdscmp(x->level[i].forward->ele,ele) < 0))) // score 相同，但是 member 并不相同
         {
             // 沿着前进指针移动
             x = x->level[i].forward;
@@ -441,7 +458,7 @@ int zslDelete(zskiplist *zsl, double score, robj *obj) {
      * 检查找到的元素 x ，只有在它的分值和对象都相同时，才将它删除。
      */
     x = x->level[0].forward;    // 切换到下一节点（因为总是：下一节点是可能 score match 的节点）
-    if (x && score == x->score && equalStringObjects(x->obj,obj)) {
+    if (x && score == x->score && sdscmp(x->ele,ele) == 0) {
         // T = O(1)
         zslDeleteNode(zsl, x, update);
         // T = O(1)
@@ -454,6 +471,53 @@ int zslDelete(zskiplist *zsl, double score, robj *obj) {
     return 0; /* not found */
 }
 
+/* Update the score of the member 'ele', whose current score is 'curscore',
+ * to 'newscore'. The member must exist.
+ *
+ * The node is never freed nor reallocated: if the new score does not move
+ * it, the score is just updated in place, otherwise the node is unlinked and
+ * linked again at its new position. So the zset dict, that points at
+ * node->ele and node->score, does not need to be updated.
+ *
+ * 更新成员的分值，节点本身不会被释放或者重新分配，返回该节点 */
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    int i, level;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+               (x->level[i].forward->score < curscore ||
+                (x->level[i].forward->score == curscore &&
+                 sdscmp(x->level[i].forward->ele,ele) < 0)))
+        {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    x = x->level[0].forward;
+    redisAssert(x && curscore == x->score && sdscmp(x->ele,ele) == 0);
+
+    /* If the node, after the score update, would be still exactly at the
+     * same position, just update the score. */
+    // 新分值不改变节点位置时，直接原地更新
+    if ((x->backward == NULL || x->backward->score < newscore) &&
+        (x->level[0].forward == NULL || x->level[0].forward->score > newscore))
+    {
+        x->score = newscore;
+        return x;
+    }
+
+    /* Otherwise unlink the node and link it again. The levels of the node
+     * are the ones where update[i] points to it. */
+    for (level = 0; level < zsl->level &&
+                    update[level]->level[level].forward == x; level++);
+    zslDeleteNode(zsl,x,update);
+    x->score = newscore;
+    return zslInsertNode(zsl,x,level);
+}
+
 /*
  * 检测给定值 value 是否大于（或大于等于）范围 spec 中的 min 项。
  *
@@ -644,7 +708,7 @@ unsigned long zslDeleteRangeByScore(zskiplist *zsl, zrangespec *range, dict *dic
         // 记录下个节点的指针
         zskiplistNode *next = x->level[0].forward;
         zslDeleteNode(zsl,x,update);    // 从前往后删除，所以 update[] 能够让 range 内所有待删除节点共同使用
-        dictDelete(dict,x->obj);
+        dictDelete(dict,x->ele);
         zslFreeNode(x);
         removed++;
         x = next;
@@ -662,7 +726,7 @@ unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *di
     x = zsl->header;
     for (i = zsl->level-1; i >= 0; i--) {
         while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->obj,range))
+            !zslLexValueGteMin(x->level[i].forward->ele,range))
                 x = x->level[i].forward;
         update[i] = x;
     }
@@ -671,13 +735,13 @@ unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *di
     x = x->level[0].forward;
 
     /* Delete nodes while in range. */
-    while (x && zslLexValueLteMax(x->obj,range)) {
+    while (x && zslLexValueLteMax(x->ele,range)) {
         zskiplistNode *next = x->level[0].forward;
 
         // 从跳跃表中删除当前节点
         zslDeleteNode(zsl,x,update);
         // 从字典中删除当前节点
-        dictDelete(dict,x->obj);
+        dictDelete(dict,x->ele);
         // 释放当前跳跃表节点的结构
         zslFreeNode(x);
 
@@ -735,7 +799,7 @@ unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned
         // 从跳跃表中删除节点
         zslDeleteNode(zsl,x,update);
         // 从字典中删除节点
-        dictDelete(dict,x->obj);
+        dictDelete(dict,x->ele);
         // 释放节点结构
         zslFreeNode(x);
 
@@ -770,7 +834,7 @@ unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned
  */
 // 通过 score 跟 robj 同时定位一个 node
 // 同时 match score 跟 robj 才能够获得 rank（否则视为指定 node 出错）
-unsigned long zslGetRank(zskiplist *zsl, double score, robj *o) {
+unsigned long zslGetRank(zskiplist *zsl, double score, sds ele) {
     zskiplistNode *x;
     unsigned long rank = 0;
     int i;
@@ -783,7 +847,7 @@ unsigned long zslGetRank(zskiplist *zsl, double score, robj *o) {
         while (x->level[i].forward &&
             (x->level[i].forward->score < score ||
                 (x->level[i].forward->score == score &&
-                compareStringObjects(x->level[i].forward->obj,o) <= 0))) {
+                sdscmp(x->level[i].forward->ele,ele) <= 0))) {
 
             // 累积跨越的节点数量
             rank += x->level[i].span;
@@ -792,11 +856,11 @@ unsigned long zslGetRank(zskiplist *zsl, double score, robj *o) {
             x = x->level[i].forward;
         }
 
-        /* x might be equal to zsl->header, so test if obj is non-NULL */
+        /* x might be equal to zsl->header, so test if ele is non-NULL */
         // 必须确保不仅分值相等，而且成员对象也要相等
         // 要是在这一层就能够 match 到 robj 了，就不必在 drill down 了
         // T = O(N)
-        if (x->obj && equalStringObjects(x->obj,o)) {
+        if (x->ele && sdscmp(x->ele,ele) == 0) {
             return rank;
         }
     }
@@ -986,16 +1050,24 @@ int compareStringObjectsForLexRange(robj *a, robj *b) {
     return compareStringObjects(a,b);
 }
 
-static int zslLexValueGteMin(robj *value, zlexrangespec *spec) {
+/* Compare the member 'value' with the range item 'item', that may be one
+ * of shared.minstring and shared.maxstring. */
+static int zslCompareLexValue(sds value, robj *item) {
+    if (item == shared.minstring) return 1;
+    if (item == shared.maxstring) return -1;
+    return sdscmp(value,item->ptr);
+}
+
+static int zslLexValueGteMin(sds value, zlexrangespec *spec) {
     return spec->minex ?
-        (compareStringObjectsForLexRange(value,spec->min) > 0) :
-        (compareStringObjectsForLexRange(value,spec->min) >= 0);
+        (zslCompareLexValue(value,spec->min) > 0) :
+        (zslCompareLexValue(value,spec->min) >= 0);
 }
 
-static int zslLexValueLteMax(robj *value, zlexrangespec *spec) {
+static int zslLexValueLteMax(sds value, zlexrangespec *spec) {
     return spec->maxex ?
-        (compareStringObjectsForLexRange(value,spec->max) < 0) :
-        (compareStringObjectsForLexRange(value,spec->max) <= 0);
+        (zslCompareLexValue(value,spec->max) < 0) :
+        (zslCompareLexValue(value,spec->max) <= 0);
 }
 
 /* Returns if there is a part of the zset is in the lex range. */
@@ -1008,10 +1080,10 @@ int zslIsInLexRange(zskiplist *zsl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
     x = zsl->tail;
-    if (x == NULL || !zslLexValueGteMin(x->obj,range))
+    if (x == NULL || !zslLexValueGteMin(x->ele,range))
         return 0;
     x = zsl->header->level[0].forward;
-    if (x == NULL || !zslLexValueLteMax(x->obj,range))
+    if (x == NULL || !zslLexValueLteMax(x->ele,range))
         return 0;
     return 1;
 }
@@ -1029,7 +1101,7 @@ zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
     for (i = zsl->level-1; i >= 0; i--) {
         /* Go forward while *OUT* of range. */
         while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->obj,range))
+            !zslLexValueGteMin(x->level[i].forward->ele,range))
                 x = x->level[i].forward;
     }
 
@@ -1038,7 +1110,7 @@ zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
     redisAssert(x != NULL);
 
     /* Check if score <= max. */
-    if (!zslLexValueLteMax(x->obj,range)) return NULL;
+    if (!zslLexValueLteMax(x->ele,range)) return NULL;
     return x;
 }
 
@@ -1055,7 +1127,7 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
     for (i = zsl->level-1; i >= 0; i--) {
         /* Go forward while *IN* range. */
         while (x->level[i].forward &&
-            zslLexValueLteMax(x->level[i].forward->obj,range))
+            zslLexValueLteMax(x->level[i].forward->ele,range))
                 x = x->level[i].forward;
     }
 
@@ -1063,15 +1135,15 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
     redisAssert(x != NULL);
 
     /* Check if score >= min. */
-    if (!zslLexValueGteMin(x->obj,range)) return NULL;
+    if (!zslLexValueGteMin(x->ele,range)) return NULL;
     return x;
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API（基于 ZIPLIST 的 sorted_set 组织方式）
- * 之所以要这样独立封装，是因为 ziplist 得同时用两个 node 来分别装载 score 跟 member
+ * Listpack-backed sorted set API（基于 LISTPACK 的 sorted_set 组织方式）
+ * 之所以要这样独立封装，是因为 listpack 得同时用两个 node 来分别装载 score 跟 member
  * 一个 node 将会是 (member, score) pair
- * ziplist 里的各个 node 按 score 值从小到大排列
+ * listpack 里的各个 node 按 score 值从小到大排列
  *----------------------------------------------------------------------------*/
 
 /*
@@ -1086,15 +1158,15 @@ double zzlGetScore(unsigned char *sptr) {
 
     redisAssert(sptr != NULL);
     // 取出节点值
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         // 字符串转 double
         // TODO: 难道是 redis-cli 发过来的时候，double 数值就是通过字符串的形式发过来的？
-        // TODO:(DONE) 因为 ziplist 没有兼容 double 的编码方式，就直接采用字符串的方案放进去？确实字符串的 double 更省内存
-        //      目前 GDB 之后，ziplist 里面确确实实就是通过 string 的方式存储 double 的数值；当 score 是 integer 的话，将会采用 ziplist 的内部编码
+        // TODO:(DONE) 因为 listpack 没有兼容 double 的编码方式，就直接采用字符串的方案放进去？确实字符串的 double 更省内存
+        //      目前 GDB 之后，listpack 里面确确实实就是通过 string 的方式存储 double 的数值；当 score 是 integer 的话，将会采用 listpack 的内部编码
         //      参考 zzlInsertAt() 中的 d2string() 调用
-        //      这也是为什么 zset 从 ziplist 中取出 score 为什么还要这个函数在封装一层的原因
+        //      这也是为什么 zset 从 listpack 中取出 score 为什么还要这个函数在封装一层的原因
         memcpy(buf,vstr,vlen);
         buf[vlen] = '\0';
         score = strtod(buf,NULL);
@@ -1106,16 +1178,16 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as a Redis string object.
+/* Return a listpack element as a Redis string object.
  * This simple abstraction can be used to simplifies some code at the
  * cost of some performance. */
-robj *ziplistGetObject(unsigned char *sptr) {
+robj *zzlGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     redisAssert(sptr != NULL);
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         return createStringObject((char*)vstr,vlen);
@@ -1140,7 +1212,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     int minlen, cmp;
 
     // 取出节点中的字符串值，以及它的长度
-    redisAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(eptr,&vlen,&vlong);
     if (vstr == NULL) { // 更精确的描述应该是：if (vstr == NULL && vlen = 0 && vlong != 0)  假设 vlong 初始值是 0
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -1158,7 +1230,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
  * 返回跳跃表包含的元素数量
  */
 unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -1174,10 +1246,10 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     redisAssert(*eptr != NULL && *sptr != NULL);
 
     // 指向下个成员
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
         // 指向下个分值
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         redisAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -1201,9 +1273,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     redisAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         redisAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -1217,7 +1289,7 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
 /* Returns if there is a part of the zset is in range. Should only be used
  * internally by zzlFirstInRange and zzlLastInRange. 
  *
- * 如果给定的 ziplist 有至少一个节点符合 range 中指定的范围，
+ * 如果给定的 listpack 有至少一个节点符合 range 中指定的范围，
  * 那么函数返回 1 ，否则返回 0 。
  */
 int zzlIsInRange(unsigned char *zl, zrangespec *range) {
@@ -1229,21 +1301,21 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    // 取出 ziplist 中的最大分值，并和 range 的最大值对比
-    p = ziplistIndex(zl,-1); /* Last score. */
+    // 取出 listpack 中的最大分值，并和 range 的最大值对比
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    // 取出 ziplist 中的最小值，并和 range 的最小值进行对比
-    p = ziplistIndex(zl,1); /* First score. */
+    // 取出 listpack 中的最小值，并和 range 的最小值进行对比
+    p = lpSeek(zl,1); /* First score. */
     redisAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
         return 0;
 
-    // ziplist 有至少一个节点符合范围
+    // listpack 有至少一个节点符合范围
     return 1;
 }
 
@@ -1258,16 +1330,16 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
  */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
     // 从表头开始遍历
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
-    // 分值在 ziplist 中是从小到大排列的
+    // 分值在 listpack 中是从小到大排列的
     // 从表头向表尾遍历
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -1281,7 +1353,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -1297,15 +1369,15 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
  */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
     // 从表尾开始遍历
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
-    // 在有序的 ziplist 里从表尾到表头遍历
+    // 在有序的 listpack 里从表尾到表头遍历
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         // 获取节点的 score 值
@@ -1319,9 +1391,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -1329,17 +1401,27 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
     return NULL;
 }
 
+/* Return a listpack element as a new sds string. */
+static sds zzlGetSds(unsigned char *p) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    vstr = lpGetValue(p,&vlen,&vlong);
+    return vstr ? sdsnewlen(vstr,vlen) : sdsfromlonglong(vlong);
+}
+
 static int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    sds value = zzlGetSds(p);
     int res = zslLexValueGteMin(value,spec);
-    decrRefCount(value);
+    sdsfree(value);
     return res;
 }
 
 static int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    sds value = zzlGetSds(p);
     int res = zslLexValueLteMax(value,spec);
-    decrRefCount(value);
+    sdsfree(value);
     return res;
 }
 
@@ -1354,12 +1436,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     redisAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -1370,7 +1452,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -1384,9 +1466,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         redisAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -1395,7 +1477,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -1412,9 +1494,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -1423,26 +1505,26 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 /*
- * 从 ziplist 编码的有序集合中查找 ele 成员，并将它的分值保存到 score 。
+ * 从 listpack 编码的有序集合中查找 ele 成员，并将它的分值保存到 score 。
  *
  * 寻找成功返回指向成员 ele 的指针，查找失败返回 NULL 。
  */
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
 
     // 定位到首个元素
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     // 解码成员
     ele = getDecodedObject(ele);
 
-    // 遍历整个 ziplist ，查找元素（确认成员存在，并且取出它的分值）
+    // 遍历整个 listpack ，查找元素（确认成员存在，并且取出它的分值）
     while (eptr != NULL) {
         // 指向分值
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
 
         // 比对成员
-        if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
+        if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
             /* Matching element, pull out score. */
             // 成员匹配，取出分值
             if (score != NULL) *score = zzlGetScore(sptr);
@@ -1451,7 +1533,7 @@ unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     decrRefCount(ele);
@@ -1460,66 +1542,57 @@ unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. 
  *
- * 从 ziplist 中删除 eptr 所指定的有序集合元素（包括成员和分值）
+ * 从 listpack 中删除 eptr 所指定的有序集合元素（包括成员和分值）
  */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
-    unsigned char *p = eptr;
-
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
-    return zl;
+    return lpDeleteRangeWithEntry(zl,&eptr,2);
 }
 
 /*
  * 将带有给定成员和分值的新节点插入到 eptr 所指向的节点的前面，
- * 如果 eptr 为 NULL ，那么将新节点插入到 ziplist 的末端。
+ * 如果 eptr 为 NULL ，那么将新节点插入到 listpack 的末端。
  *
- * 函数返回插入操作完成之后的 ziplist
+ * 函数返回插入操作完成之后的 listpack
  */
-unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, double score) {
+unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, sds ele, double score) {
     unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
     // 计算分值的字节长度
-    redisAssertWithInfo(NULL,ele,sdsEncodedObject(ele));
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
 
     // 插入到表尾，或者空表
     if (eptr == NULL) {
         // | member-1 | score-1 | member-2 | score-2 | ... | member-N | score-N |
         // 先推入元素
-        zl = ziplistPush(zl,ele->ptr,sdslen(ele->ptr),ZIPLIST_TAIL);
+        zl = lpAppend(zl,(unsigned char*)ele,sdslen(ele));
         // 后推入分值
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
 
     // 插入到某个节点的前面
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
+        /* Insert the element before eptr, lpInsertString() tells us where
+         * it landed since zl might be re-allocated. */
         // 插入成员
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,ele->ptr,sdslen(ele->ptr));
-        eptr = zl+offset;
+        zl = lpInsertString(zl,(unsigned char*)ele,sdslen(ele),eptr,LP_BEFORE,&sptr);
 
         /* Insert score after the element. */
         // 将分值插入在成员之后
-        redisAssertWithInfo(NULL,ele,(sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        zl = lpInsertString(zl,(unsigned char*)scorebuf,scorelen,sptr,LP_AFTER,NULL);
     }
 
     return zl;
 }
 
-/* Insert (member, score) pair in ziplist. 
+/* Insert (member, score) pair in listpack. 
  *
- * 将 ele 成员和它的分值 score 添加到 ziplist 里面
+ * 将 ele 成员和它的分值 score 添加到 listpack 里面
  *
- * ziplist 里的各个节点按 score 值从小到大排列
+ * listpack 里的各个节点按 score 值从小到大排列
  *
  * This function assumes the element is not yet present in the list. 
  *
@@ -1527,20 +1600,20 @@ unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, do
  */
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
 
-    // 指向 ziplist 第一个节点（也即是有序集的 member 域）
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    // 指向 listpack 第一个节点（也即是有序集的 member 域）
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     // 解码值（不一定需要执行，但是可以增强鲁棒性）
     ele = getDecodedObject(ele);
 
-    // 遍历整个 ziplist
+    // 遍历整个 listpack
     // 因为要从大到小进行排序，而且不必采用二分法，因为最多也就 64 个 node，
     // 即使是最恶劣的情况，也是 64 x 64 = 4096 次操作，之后就会转换成 skip + dict 的方案
     while (eptr != NULL) {
 
         // 取出分值
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -1550,15 +1623,15 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
              * maintain ordering. */
             // 遇到第一个 score 值比输入 score 大的节点
             // 将新节点插入在这个节点的前面，
-            // 让节点在 ziplist 里根据 score 从小到大排列
-            zl = zzlInsertAt(zl,eptr,ele,score);
+            // 让节点在 listpack 里根据 score 从小到大排列
+            zl = zzlInsertAt(zl,eptr,ele->ptr,score);
             break;
         } else if (s == score) {
             /* Ensure lexicographical ordering for elements. */
             // 如果输入 score 和节点的 score 相同
             // 那么根据 member 的字符串位置来决定新节点的插入位置
             if (zzlCompareElements(eptr,ele->ptr,sdslen(ele->ptr)) > 0) {
-                zl = zzlInsertAt(zl,eptr,ele,score);
+                zl = zzlInsertAt(zl,eptr,ele->ptr,score);
                 break;
             }
         }
@@ -1566,19 +1639,19 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
         /* Move to next element. */
         // 输入 score 比节点的 score 值要大
         // 移动到下一个节点
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
     if (eptr == NULL)
-        zl = zzlInsertAt(zl,NULL,ele,score);
+        zl = zzlInsertAt(zl,NULL,ele->ptr,score);
 
     decrRefCount(ele);
     return zl;
 }
 
 /*
- * 删除 ziplist 中分值在指定范围内的元素
+ * 删除 listpack 中分值在指定范围内的元素
  *
  * deleted 不为 NULL 时，在删除完毕之后，将被删除元素的数量保存到 *deleted 中。
  */
@@ -1589,20 +1662,19 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
 
     if (deleted != NULL) *deleted = 0;
 
-    // 指向 ziplist 中第一个符合范围的节点
+    // 指向 listpack 中第一个符合范围的节点
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
+    /* When the tail of the listpack is deleted, eptr will be set to NULL
+     * by lpDeleteRangeWithEntry(). */
     // 一直删除节点，直到遇到不在范围内的值为止
     // 节点中的值都是有序的
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1623,13 +1695,12 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be set to NULL
+     * by lpDeleteRangeWithEntry(). */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1644,7 +1715,7 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 
 /* Delete all the elements with rank between start and end from the skiplist.
  *
- * 删除 ziplist 中所有在给定排位范围内的元素。
+ * 删除 listpack 中所有在给定排位范围内的元素。
  *
  * Start and end are inclusive. Note that start and end need to be 1-based 
  *
@@ -1655,12 +1726,12 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
 
-    if (deleted) *deleted = num;    // 除非能够保证 ziplistDeleteRange() 一定是顺利执行的，否则这个计数是有问题的
+    if (deleted) *deleted = num;    // 除非能够保证 lpDeleteRange() 一定是顺利执行的，否则这个计数是有问题的
 
     // 每个元素占用两个节点，所以删除的其实位置要乘以 2 
-    // 并且因为 ziplist 的索引以 0 为起始值，而 zzl 的起始值为 1 ，
+    // 并且因为 listpack 的索引以 0 为起始值，而 zzl 的起始值为 1 ，
     // 所以需要 start - 1 
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
 
     return zl;
 }
@@ -1673,7 +1744,7 @@ unsigned int zsetLength(robj *zobj) {
 
     int length = -1;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
 
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -1688,19 +1759,19 @@ unsigned int zsetLength(robj *zobj) {
 
 /*
  * 将跳跃表对象 zobj 的底层编码转换为 encoding 。
- * REDIS_ENCODING_ZIPLIST <===> REDIS_ENCODING_SKIPLIST 两者之间可以相互转换
+ * REDIS_ENCODING_LISTPACK <===> REDIS_ENCODING_SKIPLIST 两者之间可以相互转换
  */
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
     zskiplistNode *node, *next;
-    robj *ele;
+    sds ele;
     double score;
 
     // 类似于自我赋值，这种 case 是一定要处理的
     if (zobj->encoding == encoding) return;
 
-    // 从 ZIPLIST 编码转换为 SKIPLIST 编码
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 从 LISTPACK 编码转换为 SKIPLIST 编码
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -1717,58 +1788,59 @@ void zsetConvert(robj *zobj, int encoding) {
         // 跳跃表
         zs->zsl = zslCreate();
 
-        // 有序集合在 ziplist 中的排列：
+        // 有序集合在 listpack 中的排列：
         //
         // | member-1 | score-1 | member-2 | score-2 | ... |
         //
-        // 指向 ziplist 中的首个节点（保存着元素成员）
-        eptr = ziplistIndex(zl,0);
+        // 指向 listpack 中的首个节点（保存着元素成员）
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(NULL,zobj,eptr != NULL);
-        // 指向 ziplist 中的第二个节点（保存着元素分值）
-        sptr = ziplistNext(zl,eptr);
+        // 指向 listpack 中的第二个节点（保存着元素分值）
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,zobj,sptr != NULL);
 
-        // 遍历所有 ziplist 节点，并将元素的成员和分值添加到有序集合中
+        // 遍历所有 listpack 节点，并将元素的成员和分值添加到有序集合中
         while (eptr != NULL) {
             
             // 取出分值
             score = zzlGetScore(sptr);
 
             // 取出成员
-            redisAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
-                ele = createStringObjectFromLongLong(vlong);
+                ele = sdsfromlonglong(vlong);
             else
-                ele = createStringObject((char*)vstr,vlen);
+                ele = sdsnewlen((char*)vstr,vlen);
 
-            /* Has incremented refcount since it was just created. */
+            /* The node keeps its own copy of the member, and the dict key
+             * points to that copy, so the temporary can go right away. */
             // 将成员和分值分别关联到跳跃表和字典中
             node = zslInsert(zs->zsl,score,ele);
-            redisAssertWithInfo(NULL,zobj,dictAdd(zs->dict,ele,&node->score) == DICT_OK);
-            incrRefCount(ele); /* Added to dictionary. */
+            redisAssertWithInfo(NULL,zobj,dictAdd(zs->dict,node->ele,&node->score) == DICT_OK);
+            sdsfree(ele);
 
             // 移动指针，指向下个元素
             zzlNext(zl,&eptr,&sptr);
         }
 
-        // 释放原来的 ziplist
-        zfree(zobj->ptr);
+        // 释放原来的 listpack
+        lpFree(zobj->ptr);
 
         // 更新对象的值，以及编码方式
         zobj->ptr = zs;
         zobj->encoding = REDIS_ENCODING_SKIPLIST;
 
-    // 从 SKIPLIST 转换为 ZIPLIST 编码
+    // 从 SKIPLIST 转换为 LISTPACK 编码
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
 
-        // 新的 ziplist
-        unsigned char *zl = ziplistNew();
+        // 新的 listpack
+        unsigned char *zl = lpNew();
 
-        if (encoding != REDIS_ENCODING_ZIPLIST)
+        if (encoding != REDIS_ENCODING_LISTPACK)
             redisPanic("Unknown target encoding");
 
         /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
+         * the same time as creating the listpack. */
         // 指向跳跃表
         zs = zobj->ptr;
 
@@ -1783,15 +1855,11 @@ void zsetConvert(robj *zobj, int encoding) {
         zfree(zs->zsl->header);
         zfree(zs->zsl);
 
-        // 遍历跳跃表，取出里面的元素，并将它们添加到 ziplist
+        // 遍历跳跃表，取出里面的元素，并将它们添加到 listpack
         while (node) {
 
-            // 取出解码后的值对象
-            ele = getDecodedObject(node->obj);
-
-            // 添加元素到 ziplist
-            zl = zzlInsertAt(zl,NULL,ele,node->score);
-            decrRefCount(ele);
+            // 添加元素到 listpack
+            zl = zzlInsertAt(zl,NULL,node->ele,node->score);
 
             // 沿着跳跃表的第 0 层前进
             next = node->level[0].forward;
@@ -1804,7 +1872,7 @@ void zsetConvert(robj *zobj, int encoding) {
 
         // 更新对象的值，以及对象的编码方式
         zobj->ptr = zl;
-        zobj->encoding = REDIS_ENCODING_ZIPLIST;
+        zobj->encoding = REDIS_ENCODING_LISTPACK;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1823,7 +1891,6 @@ void zaddGenericCommand(redisClient *c, int incr) {
     robj *key = c->argv[1];
     robj *ele;
     robj *zobj;
-    robj *curobj;
     double score = 0, *scores = NULL, curscore = 0.0;
     int j, elements = (c->argc-2)/2;    // 去除 CMD 跟 REDIS_ZSET robj 的 key
     // elements 是 member\score 的数量
@@ -1857,8 +1924,8 @@ void zaddGenericCommand(redisClient *c, int incr) {
             // dict + skiplist 的方式
             zobj = createZsetObject();
         } else {
-            // TODO:(DONE) 采用 ziplist 的话，底层究竟会是什么样子？score 怎么处理？参考 redis.h:struct zset 部分
-            zobj = createZsetZiplistObject();
+            // TODO:(DONE) 采用 listpack 的话，底层究竟会是什么样子？score 怎么处理？参考 redis.h:struct zset 部分
+            zobj = createZsetListpackObject();
         }
         // 关联对象到数据库
         dbAdd(c->db,key,zobj);
@@ -1874,11 +1941,11 @@ void zaddGenericCommand(redisClient *c, int incr) {
     for (j = 0; j < elements; j++) {
         score = scores[j];  // TODO:(DONE) 为什么要这样取一份出来？为了方便罢了，并不一定要的
 
-        // 有序集合为 ziplist 编码
-        if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        // 有序集合为 listpack 编码
+        if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
             unsigned char *eptr;
 
-            /* Prefer non-encoded element when dealing with ziplists. */
+            /* Prefer non-encoded element when dealing with listpacks. */
             // 查找成员
             ele = c->argv[3+j*2];
             if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
@@ -1914,12 +1981,12 @@ void zaddGenericCommand(redisClient *c, int incr) {
 
                 // zsetConvert() 的检查，没必要提前到 insert 前面，没用，因为跳不过去 zobj->encoding == REDIS_ENCODING_SKIPLIST 的 insert
                 // 查看元素的数量，
-                // 看是否需要将 ZIPLIST 编码转换为有序集合
+                // 看是否需要将 LISTPACK 编码转换为有序集合
                 if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
                     zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
 
                 // 查看新添加元素的长度
-                // 看是否需要将 ZIPLIST 编码转换为有序集合
+                // 看是否需要将 LISTPACK 编码转换为有序集合
                 if (sdslen(ele->ptr) > server.zset_max_ziplist_value)
                     zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
 
@@ -1933,17 +2000,14 @@ void zaddGenericCommand(redisClient *c, int incr) {
             zskiplistNode *znode;
             dictEntry *de;
 
-            // 编码对象
-            ele = c->argv[3+j*2] = tryObjectEncoding(c->argv[3+j*2]);
+            ele = c->argv[3+j*2];
 
             // 查看成员是否存在
-            de = dictFind(zs->dict,ele);
+            de = dictFind(zs->dict,ele->ptr);
             if (de != NULL) {
 
                 // 成员存在
 
-                // 取出成员
-                curobj = dictGetKey(de);
                 // 取出分值
                 curscore = *(double*)dictGetVal(de);
 
@@ -1958,25 +2022,15 @@ void zaddGenericCommand(redisClient *c, int incr) {
                     }
                 }
 
-                /* Remove and re-insert when score changed. We can safely
-                 * delete the key object from the skiplist, since the
-                 * dictionary still has a reference to it. */
+                /* Update the score in place when it changed. The node is
+                 * relinked rather than reallocated, so the dict entry that
+                 * points to its member and score stays valid. */
                 // 执行 ZINCRYBY 命令时，
                 // 或者用户通过 ZADD 修改成员的分值时执行
                 if (score != curscore) {
-                    // member 不变，所以 dict 可以不更新 member 部分
-                    // 但是 zsl 时必须全部更新的，因为 zsl 的新 node 是要更新所有 level 的
-                    // 所以只能连带 member 部分也一起更新掉（还不如直接重新 insert）
-
-                    // 删除原有元素
-                    redisAssertWithInfo(c,curobj,zslDelete(zs->zsl,curscore,curobj));
-
-                    // 重新插入元素
-                    znode = zslInsert(zs->zsl,score,curobj);
-                    incrRefCount(curobj); /* Re-inserted in skiplist. */
-
-                    // 更新字典的分值指针
-                    dictGetVal(de) = &znode->score; /* Update score ptr. */
+                    // member 不变，所以 dict 可以不更新
+                    znode = zslUpdateScore(zs->zsl,curscore,ele->ptr,score);
+                    redisAssertWithInfo(c,ele,znode != NULL);
 
                     server.dirty++;
                     updated++;
@@ -1984,12 +2038,10 @@ void zaddGenericCommand(redisClient *c, int incr) {
             } else {
 
                 // 元素不存在，直接添加到跳跃表
-                znode = zslInsert(zs->zsl,score,ele);
-                incrRefCount(ele); /* Inserted in skiplist. */
+                znode = zslInsert(zs->zsl,score,ele->ptr);
 
-                // 将元素关联到字典
-                redisAssertWithInfo(c,NULL,dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
-                incrRefCount(ele); /* Added to dictionary. */
+                // 将元素关联到字典，key 直接指向节点里的成员
+                redisAssertWithInfo(c,NULL,dictAdd(zs->dict,znode->ele,&znode->score) == DICT_OK);
 
                 server.dirty++;
                 added++;
@@ -2032,20 +2084,20 @@ void zremCommand(redisClient *c) {
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    // 从 ziplist 中删除
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    // 从 listpack 中删除
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         // 遍历所有输入元素
         for (j = 2; j < c->argc; j++) {
-            // 如果元素在 ziplist 中存在的话
+            // 如果元素在 listpack 中存在的话
             if ((eptr = zzlFind(zobj->ptr,c->argv[j],NULL)) != NULL) {
                 // 元素存在时，删除计算器才增一
                 deleted++;
                 // 那么删除它们
                 zobj->ptr = zzlDelete(zobj->ptr,eptr);
                 
-                // ziplist 已清空，将有序集合从数据库中删除
+                // listpack 已清空，将有序集合从数据库中删除
                 if (zzlLength(zobj->ptr) == 0) {
                     dbDelete(c->db,key);
                     break;
@@ -2063,20 +2115,21 @@ void zremCommand(redisClient *c) {
         for (j = 2; j < c->argc; j++) {
 
             // 查找元素
-            de = dictFind(zs->dict,c->argv[j]);
+            de = dictFind(zs->dict,c->argv[j]->ptr);
 
             if (de != NULL) {
                 // 元素存在时，删除计算器才增一
                 deleted++;
 
-                /* Delete from the skiplist */
-                // 将元素从跳跃表中删除
+                /* Delete from the hash table first: the dict key lives
+                 * inside the skiplist node that zslDelete() frees. */
+                // 将元素从字典中删除
                 score = *(double*)dictGetVal(de);
-                redisAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
+                dictDelete(zs->dict,c->argv[j]->ptr);
 
-                /* Delete from the hash table */
-                // 将元素从字典中删除
-                dictDelete(zs->dict,c->argv[j]);
+                /* Delete from the skiplist */
+                // 将元素从跳跃表中删除
+                redisAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]->ptr));
 
                 // 检查是否需要缩小字典
                 if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -2161,7 +2214,7 @@ void zremrangeGenericCommand(redisClient *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -2242,7 +2295,7 @@ void zremrangebylexCommand(redisClient *c) {
 typedef struct {
 
     // subject、type、encoding 都是被迭代的那个 REDIS_SET\REDIS_ZSET subject 的基础信息
-    // 被迭代的对象（zset，可能是 ziplist or (zsl + dict)）
+    // 被迭代的对象（zset，可能是 listpack or (zsl + dict)）
     robj *subject;
 
     // 对象的类型
@@ -2280,9 +2333,9 @@ typedef struct {
         /* Sorted set iterators. */
         // 有序集合迭代器
         union _iterzset {
-            // ziplist 迭代器
+            // listpack 迭代器
             struct {
-                // 被迭代的 ziplist
+                // 被迭代的 listpack
                 unsigned char *zl;
                 // 当前成员指针和当前分值指针
                 unsigned char *eptr, *sptr;
@@ -2323,6 +2376,7 @@ typedef struct {
 #define OPVAL_DIRTY_ROBJ 1
 #define OPVAL_DIRTY_LL 2
 #define OPVAL_VALID_LL 4
+#define OPVAL_DIRTY_SDS 8
 
 /* Store value retrieved from the iterator. 
  *
@@ -2336,14 +2390,16 @@ typedef struct {
 
     // 可以用于保存 member 的几个类型
     // dict 的时候，保存 key 这个 robj；
-    // skip-list 的时候，保存 zsl->node.obj 这个 member robj
     robj *ele;
 
-    // REDIS_ENCODING_ZIPLIST 用
+    // skip-list 的时候，保存 zsl->node.ele 这个 member sds
+    sds sele;
+
+    // REDIS_ENCODING_LISTPACK 用
     unsigned char *estr;
     unsigned int elen;
 
-    long long ell;  // intset 一定用这个，ziplist 可能用这个
+    long long ell;  // intset 一定用这个，listpack 可能用这个
 
     // 分值
     double score;
@@ -2389,12 +2445,12 @@ void zuiInitIterator(zsetopsrc *op) {
 
         iterzset *it = &op->iter.zset;
 
-        // 迭代 ziplist
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        // 迭代 listpack
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 redisAssert(it->zl.sptr != NULL);
             }
 
@@ -2440,7 +2496,7 @@ void zuiClearIterator(zsetopsrc *op) {
 
         iterzset *it = &op->iter.zset;
 
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             REDIS_NOTUSED(it); /* skip */
 
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -2474,7 +2530,7 @@ int zuiLength(zsetopsrc *op) {
 
     } else if (op->type == REDIS_ZSET) {
 
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
@@ -2509,6 +2565,8 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
     // TODO: 这个 flag 是为了？哪里增加了引用计数？
     if (val->flags & OPVAL_DIRTY_ROBJ)
         decrRefCount(val->ele);
+    if (val->flags & OPVAL_DIRTY_SDS)
+        sdsfree(val->sele);
 
     // 清零 val 结构
     memset(val,0,sizeof(zsetopval));
@@ -2518,7 +2576,7 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
         iterset *it = &op->iter.set;
 
-        // ziplist 编码的集合
+        // listpack 编码的集合
         if (op->encoding == REDIS_ENCODING_INTSET) {
             int64_t ell;
 
@@ -2556,8 +2614,8 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
         iterzset *it = &op->iter.zset;
 
-        // ziplist 编码的有序集合
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        // listpack 编码的有序集合
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
 
             /* No need to check both, but better be explicit. */
             // 已为空？遍历到末尾了不？
@@ -2565,7 +2623,7 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
                 return 0;
 
             // 取出成员
-            redisAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            val->estr = lpGetValue(it->zl.eptr,&val->elen,&val->ell);
             // 取出分值
             val->score = zzlGetScore(it->zl.sptr);
 
@@ -2578,7 +2636,7 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
             if (it->sl.node == NULL)
                 return 0;
 
-            val->ele = it->sl.node->obj;
+            val->sele = it->sl.node->ele;
             val->score = it->sl.node->score;
 
             /* Move to next element. */
@@ -2603,8 +2661,13 @@ int zuiLongLongFromValue(zsetopval *val) {
         // 打开标识 DIRTY LL
         val->flags |= OPVAL_DIRTY_LL;
 
+        // 从跳跃表节点的 sds 成员中取值
+        if (val->sele != NULL) {
+            if (string2ll(val->sele,sdslen(val->sele),&val->ell))
+                val->flags |= OPVAL_VALID_LL;
+
         // 从对象中取值
-        if (val->ele != NULL) {
+        } else if (val->ele != NULL) {
             // 从 INT 编码的字符串中取出整数
             if (val->ele->encoding == REDIS_ENCODING_INT) {
                 val->ell = (long)val->ele->ptr;
@@ -2618,7 +2681,7 @@ int zuiLongLongFromValue(zsetopval *val) {
                 redisPanic("Unsupported element encoding");
             }
 
-        // 从 ziplist 节点中取值
+        // 从 listpack 节点中取值
         } else if (val->estr != NULL) {
             // 将节点值（一个字符串）转换为整数
             if (string2ll((char*)val->estr,val->elen,&val->ell))
@@ -2643,7 +2706,9 @@ robj *zuiObjectFromValue(zsetopval *val) {
     if (val->ele == NULL) {
 
         // 从 long long 值中创建对象
-        if (val->estr != NULL) {
+        if (val->sele != NULL) {
+            val->ele = createStringObject(val->sele,sdslen(val->sele));
+        } else if (val->estr != NULL) {
             val->ele = createStringObject((char*)val->estr,val->elen);
         } else {
             val->ele = createStringObjectFromLongLong(val->ell);
@@ -2663,7 +2728,10 @@ robj *zuiObjectFromValue(zsetopval *val) {
 int zuiBufferFromValue(zsetopval *val) {
 
     if (val->estr == NULL) {
-        if (val->ele != NULL) {
+        if (val->sele != NULL) {
+            val->elen = sdslen(val->sele);
+            val->estr = (unsigned char*)val->sele;
+        } else if (val->ele != NULL) {
             if (val->ele->encoding == REDIS_ENCODING_INT) {
                 val->elen = ll2string((char*)val->_buf,sizeof(val->_buf),(long)val->ele->ptr);
                 val->estr = val->_buf;
@@ -2682,6 +2750,28 @@ int zuiBufferFromValue(zsetopval *val) {
     return 1;
 }
 
+/*
+ * 从 val 中取出 sds 形式的成员，用于查找 skiplist 编码的字典以及创建跳跃表节点
+ *
+ * The returned sds is owned by val: it is either borrowed from the
+ * skiplist node or the string object, or allocated here and released by
+ * the next zuiNext() call.
+ */
+sds zuiSdsFromValue(zsetopval *val) {
+
+    if (val->sele == NULL) {
+        if (val->ele != NULL && sdsEncodedObject(val->ele)) {
+            val->sele = val->ele->ptr;
+        } else {
+            zuiBufferFromValue(val);
+            val->sele = sdsnewlen((char*)val->estr,val->elen);
+            val->flags |= OPVAL_DIRTY_SDS;
+        }
+    }
+
+    return val->sele;
+}
+
 /* Find value pointed to by val in the source pointer to by op. When found,
  * return 1 and store its score in target. Return 0 otherwise. 
  *
@@ -2724,11 +2814,11 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
 
     // 有序集合
     } else if (op->type == REDIS_ZSET) {
-        // 取出对象
-        zuiObjectFromValue(val);
 
-        // ziplist
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        // listpack
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
+            // 取出对象
+            zuiObjectFromValue(val);
 
             // 取出成员和分值
             if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
@@ -2743,8 +2833,8 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             zset *zs = op->subject->ptr;
             dictEntry *de;
 
-            // 从字典中查找成员对象
-            if ((de = dictFind(zs->dict,val->ele)) != NULL) {
+            // 从字典中查找成员
+            if ((de = dictFind(zs->dict,zuiSdsFromValue(val))) != NULL) {
                 // 取出分值
                 *score = *(double*)dictGetVal(de);
                 return 1;
@@ -2801,14 +2891,203 @@ inline static void zunionInterAggregate(double *target, double val, int aggregat
     }
 }
 
+/* Compute the aggregated score of the element in 'zval', that was taken
+ * from src[i], looking it up in the sources that follow src[i].
+ *
+ * 计算 src[i] 中当前元素加权聚合后的分值，放在 *score 里面
+ *
+ * Returns 0 when op is REDIS_OP_INTER and one of those sources does not
+ * contain the element, 1 otherwise. */
+static int zuiAggregateScore(zsetopsrc *src, long setnum, long i,
+                             zsetopval *zval, int op, int aggregate,
+                             double *score)
+{
+    double value;
+    long j;
+
+    // 计算 src[i] 中，当前 member 加权后分值 score
+    *score = src[i].weight * zval->score;
+    if (isnan(*score)) *score = 0;
+
+    for (j = i+1; j < setnum; j++) {
+        /* It is not safe to access the zset we are
+         * iterating, so explicitly check for equal object. */
+        // 如果 src[j] 的对象和 src[i] 的对象一样，
+        // 那么 src[i] 出现的元素必然也出现在 src[j]
+        // 那么我们可以直接计算聚合值，不必进行 zuiFind 去确保元素是否出现
+        if (src[j].subject == src[i].subject) {
+            value = zval->score*src[j].weight;
+            zunionInterAggregate(score,value,aggregate);
+
+        // 如果能在其他集合找到当前迭代到的元素的话，那么进行聚合计算
+        } else if (zuiFind(&src[j],zval,&value)) {
+            value *= src[j].weight;
+            zunionInterAggregate(score,value,aggregate);
+
+        // 交集运算时，元素没出现在某个集合，就不属于结果集
+        } else if (op == REDIS_OP_INTER) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Results of ZUNION / ZINTER, kept outside of any sorted set. Without a
+ * LIMIT all the results are appended and sorted at the end. With a LIMIT
+ * the array is a max-heap of the 'limit' smallest results seen so far, so
+ * memory is bounded by the limit rather than by the size of the result.
+ *
+ * ZUNION / ZINTER 的结果集合，给定 LIMIT 时是一个只保留最小 limit 个元素的大顶堆 */
+typedef struct {
+    sds ele;
+    double score;
+} zsetopResult;
+
+typedef struct {
+    zsetopResult *items;
+    unsigned long len, size;
+    unsigned long limit;    /* 0 means no limit. */
+} zsetopResults;
+
+/* Sorted set order: by score, then by member. */
+static int zsetopResultCompare(const void *a, const void *b) {
+    const zsetopResult *ra = a, *rb = b;
+
+    if (ra->score < rb->score) return -1;
+    if (ra->score > rb->score) return 1;
+    return sdscmp(ra->ele,rb->ele);
+}
+
+/* Restore the max-heap property moving down from position i. */
+static void zsetopResultsSiftDown(zsetopResults *res, unsigned long i) {
+    zsetopResult tmp;
+
+    while (1) {
+        unsigned long l = i*2+1, r = l+1, max = i;
+
+        if (l < res->len &&
+            zsetopResultCompare(&res->items[l],&res->items[max]) > 0) max = l;
+        if (r < res->len &&
+            zsetopResultCompare(&res->items[r],&res->items[max]) > 0) max = r;
+        if (max == i) break;
+        tmp = res->items[i];
+        res->items[i] = res->items[max];
+        res->items[max] = tmp;
+        i = max;
+    }
+}
+
+/* Add a result. 'ele' is only copied when the result is kept. */
+static void zsetopResultsAdd(zsetopResults *res, sds ele, double score) {
+    zsetopResult item = { ele, score };
+
+    // 堆已满，且新元素不小于堆顶元素：直接丢弃
+    if (res->limit && res->len == res->limit) {
+        if (zsetopResultCompare(&item,&res->items[0]) >= 0) return;
+        sdsfree(res->items[0].ele);
+        res->items[0].ele = sdsdup(ele);
+        res->items[0].score = score;
+        zsetopResultsSiftDown(res,0);
+        return;
+    }
+
+    if (res->len == res->size) {
+        res->size = res->size ? res->size*2 : 16;
+        if (res->limit && res->size > res->limit) res->size = res->limit;
+        res->items = zrealloc(res->items,sizeof(zsetopResult)*res->size);
+    }
+    item.ele = sdsdup(ele);
+    res->items[res->len++] = item;
+
+    /* Sift up: only needed while the array is used as a heap. */
+    if (res->limit) {
+        unsigned long i = res->len-1;
+
+        while (i > 0) {
+            unsigned long parent = (i-1)/2;
+            zsetopResult tmp;
+
+            if (zsetopResultCompare(&res->items[i],&res->items[parent]) <= 0)
+                break;
+            tmp = res->items[i];
+            res->items[i] = res->items[parent];
+            res->items[parent] = tmp;
+            i = parent;
+        }
+    }
+}
+
+/* ZUNION / ZINTER: compute the result straight into a zsetopResults and
+ * reply with it, without creating any sorted set.
+ *
+ * Union duplicates are detected by looking the element up in the sources
+ * that come before src[i], instead of keeping a dict of the elements
+ * already returned, so with a LIMIT no structure grows with the result. */
+static void zunionInterReply(redisClient *c, zsetopsrc *src, long setnum,
+                             int op, int aggregate, int withscores,
+                             long limit)
+{
+    zsetopResults res = { NULL, 0, 0, (unsigned long)limit };
+    zsetopval zval;
+    unsigned long k;
+    long i, j;
+
+    memset(&zval, 0, sizeof(zval));
+
+    for (i = 0; i < setnum; i++) {
+        double score, value;
+
+        // 交集只需要遍历基数最小的 src[0]
+        if (op == REDIS_OP_INTER && i > 0) break;
+        if (zuiLength(&src[i]) == 0) {
+            // 存在空集合时，交集必然为空
+            if (op == REDIS_OP_INTER) break;
+            continue;
+        }
+
+        /* A source given twice was fully handled the first time. */
+        for (j = 0; j < i; j++)
+            if (src[j].subject == src[i].subject) break;
+        if (j < i) continue;
+
+        zuiInitIterator(&src[i]);
+        while (zuiNext(&src[i],&zval)) {
+            /* Skip an element that was already processed. */
+            if (op == REDIS_OP_UNION) {
+                for (j = 0; j < i; j++)
+                    if (zuiFind(&src[j],&zval,&value)) break;
+                if (j < i) continue;
+            }
+
+            if (zuiAggregateScore(src,setnum,i,&zval,op,aggregate,&score))
+                zsetopResultsAdd(&res,zuiSdsFromValue(&zval),score);
+        }
+        zuiClearIterator(&src[i]);
+    }
+
+    // 按分值从小到大排列结果
+    if (res.len) qsort(res.items,res.len,sizeof(zsetopResult),zsetopResultCompare);
+
+    addReplyMultiBulkLen(c, withscores ? (res.len*2) : res.len);
+    for (k = 0; k < res.len; k++) {
+        addReplyBulkCBuffer(c,res.items[k].ele,sdslen(res.items[k].ele));
+        if (withscores) addReplyDouble(c,res.items[k].score);
+        sdsfree(res.items[k].ele);
+    }
+    zfree(res.items);
+}
+
 // dstkey 原本要是存在的话，将会被直接删除掉
-void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
+// dstkey 为 NULL 时（ZUNION / ZINTER），直接回复结果而不创建有序集合
+void zunionInterGenericCommand(redisClient *c, robj *dstkey, int numkeysIndex, int op) {
     int i, j;
     long setnum;
     int aggregate = REDIS_AGGR_SUM; // 默认参数
+    int withscores = 0;
+    long limit = 0;
     zsetopsrc *src;
     zsetopval zval;
-    robj *tmp;
+    sds tmp;
     unsigned int maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
@@ -2817,18 +3096,19 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
 
     /* expect setnum input keys to be given */
     // 取出要处理的有序集合的个数 setnum（numkeys）
-    if ((getLongFromObjectOrReply(c, c->argv[2], &setnum, NULL) != REDIS_OK))
+    if ((getLongFromObjectOrReply(c, c->argv[numkeysIndex], &setnum, NULL) != REDIS_OK))
         return;
 
     if (setnum < 1) {
-        addReplyError(c,
-            "at least 1 input key is needed for ZUNIONSTORE/ZINTERSTORE");
+        addReplyError(c, dstkey ?
+            "at least 1 input key is needed for ZUNIONSTORE/ZINTERSTORE" :
+            "at least 1 input key is needed for ZUNION/ZINTER");
         return;
     }
 
     /* test if the expected number of keys would overflow */
     // setnum 参数和传入的 key 数量不相同，出错
-    if (setnum > c->argc-3) {
+    if (setnum > c->argc-(numkeysIndex+1)) {
         addReply(c,shared.syntaxerr);
         return;
     }
@@ -2836,10 +3116,11 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     /* read keys to be used for input */
     // 为每一个 key（sorted_set） 创建一个迭代器
     src = zcalloc(sizeof(zsetopsrc) * setnum);
-    for (i = 0, j = 3; i < setnum; i++, j++) {
+    for (i = 0, j = numkeysIndex+1; i < setnum; i++, j++) {
 
         // 取出 key 对象
-        robj *obj = lookupKeyWrite(c->db,c->argv[j]);
+        robj *obj = dstkey ? lookupKeyWrite(c->db,c->argv[j]) :
+                             lookupKeyRead(c->db,c->argv[j]);
 
         // 初始化每一个 sorted_set 的迭代器
         if (obj != NULL) {
@@ -2902,6 +3183,28 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
                 }
                 j++; remaining--;
 
+            } else if (!dstkey && !strcasecmp(c->argv[j]->ptr,"withscores")) {
+                // ZUNION / ZINTER 才有的选项
+                j++; remaining--;
+                withscores = 1;
+
+            } else if (!dstkey && remaining >= 2 &&
+                       !strcasecmp(c->argv[j]->ptr,"limit"))
+            {
+                // 只返回分值最小的 limit 个元素（0 表示不限制）
+                if (getLongFromObjectOrReply(c,c->argv[j+1],&limit,NULL)
+                    != REDIS_OK)
+                {
+                    zfree(src);
+                    return;
+                }
+                if (limit < 0) {
+                    zfree(src);
+                    addReplyError(c,"LIMIT can't be negative");
+                    return;
+                }
+                j += 2; remaining -= 2;
+
             } else {
                 // 语法错误，CMD 书写得有问题，有多余的参数
                 zfree(src);
@@ -2916,6 +3219,12 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     // 对所有集合进行排序，以减少算法的常数项（根据每一个 zsetopsrc 里面的 node 个数来进行排列）
     qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
 
+    if (dstkey == NULL) {
+        zunionInterReply(c,src,setnum,op,aggregate,withscores,limit);
+        zfree(src);
+        return;
+    }
+
     // 创建结果集对象
     dstobj = createZsetObject();
     dstzset = dstobj->ptr;
@@ -2933,58 +3242,23 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
             // 遍历基数最小的 src[0] 集合
             zuiInitIterator(&src[0]);
             while (zuiNext(&src[0],&zval)) {    // 从最小的那个集合中，遍历一次其他全部集合
-                double score, value;    // 这两个都是 score，score 是 src[0] 中 member 的 score，value 是 src[j] 中 member 的 score
-
-                // 计算 src[0] 中，当前 member 加权后分值 score
-                score = src[0].weight * zval.score;
-                if (isnan(score)) score = 0;
+                double score;
 
+                /* Only continue when present in every input. */
                 // 将 src[0] 集合中的元素和其他集合中的元素做加权聚合计算
-                for (j = 1; j < setnum; j++) {
-                    /* It is not safe to access the zset we are
-                     * iterating, so explicitly check for equal object. */
-                    // 如果当前迭代到的 src[j] 的对象和 src[0] 的对象一样，
-                    // 那么 src[0] 出现的元素必然也出现在 src[j]
-                    // 那么我们可以直接计算聚合值，
-                    // 不必进行 zuiFind 去确保元素是否出现
-                    // 这种情况在某个 key 输入了两次，
-                    // 并且这个 key 是所有输入集合中基数最小的集合时会出现
-                    if (src[j].subject == src[0].subject) {
-                        // 同一个 REDIS_ZSET 的话
-                        value = zval.score*src[j].weight;
-                        zunionInterAggregate(&score,value,aggregate);   // 将本次计算结果放在 score 里面
-
-                    // 如果能在其他集合找到当前迭代到的元素的话
-                    // 那么进行聚合计算
-                    } else if (zuiFind(&src[j],&zval,&value)) { // 这里会填充 value（即 src[j] 中，跟 src[0] match 的那个 member 的 score）
-                        value *= src[j].weight; // 叠加上 weight
-                        zunionInterAggregate(&score,value,aggregate);   // 将本次计算结果放在 score 里面
-
-                    // 如果当前元素没出现在某个集合，那么跳出 for 循环
-                    // 处理下个元素
-                    } else {
-                        break;
-                    }
-                }   // end of for-loop
+                // 当前元素没出现在某个集合时，处理下个元素
+                if (!zuiAggregateScore(src,setnum,0,&zval,op,aggregate,&score))
+                    continue;
 
-                /* Only continue when present in every input. */
-                // 只在交集元素出现时，才执行以下代码
-                if (j == setnum) {
-                    // 取出 member 对象
-                    tmp = zuiObjectFromValue(&zval);
-                    // 加入到有序集合中
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    incrRefCount(tmp); /* added to skiplist */
-                    // 加入到字典中
-                    dictAdd(dstzset->dict,tmp,&znode->score);
-                    incrRefCount(tmp); /* added to dictionary */
-
-                    // 更新字符串对象的最大长度(将会影响后面要不要采用压缩度更高的 ZIPLIST 编码方式实现 REDIS_ZSET)
-                    if (sdsEncodedObject(tmp)) {
-                        if (sdslen(tmp->ptr) > maxelelen)
-                            maxelelen = sdslen(tmp->ptr);
-                    }
-                }
+                // 取出 member
+                tmp = zuiSdsFromValue(&zval);
+                // 加入到有序集合中（节点自带一份 member 拷贝）
+                znode = zslInsert(dstzset->zsl,score,tmp);
+                // 加入到字典中
+                dictAdd(dstzset->dict,znode->ele,&znode->score);
+
+                // 更新字符串的最大长度(将会影响后面要不要采用压缩度更高的 LISTPACK 编码方式实现 REDIS_ZSET)
+                if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
             }   // end of while-loop
             zuiClearIterator(&src[0]);
         }
@@ -3002,55 +3276,29 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
             // 遍历所有集合元素
             zuiInitIterator(&src[i]);
             while (zuiNext(&src[i],&zval)) {
-                double score, value;
+                double score;
 
                 /* Skip an element that when already processed */
                 // 跳过已处理元素(因为并集是不得不，将每一个 zset 中的每一个 member 都检查一次的)
-                if (dictFind(dstzset->dict,zuiObjectFromValue(&zval)) != NULL)
+                if (dictFind(dstzset->dict,zuiSdsFromValue(&zval)) != NULL)
                     continue;
 
-                /* Initialize score */
-                // 初始化分值
-                score = src[i].weight * zval.score;
-                // 溢出时设为 0
-                if (isnan(score)) score = 0;
-
                 /* We need to check only next sets to see if this element
                  * exists, since we process every element just one time so
                  * it can't exist in a previous set (otherwise it would be
                  * already processed). */
-                for (j = (i+1); j < setnum; j++) {  // j = (i+1)，前面几个 set 不用再检查了，已经检查过了
-                    /* It is not safe to access the zset we are
-                     * iterating, so explicitly check for equal object. */
-                    // 当前元素的集合和被迭代集合一样
-                    // 所以同一个元素必然出现在 src[j] 和 src[i]
-                    // 程序直接计算它们的聚合值
-                    // 而不必使用 zuiFind 来检查元素是否存在
-                    if(src[j].subject == src[i].subject) {
-                        value = zval.score*src[j].weight;
-                        zunionInterAggregate(&score,value,aggregate);
-
-                    // 检查成员是否存在
-                    } else if (zuiFind(&src[j],&zval,&value)) {
-                        value *= src[j].weight;
-                        zunionInterAggregate(&score,value,aggregate);
-                    }
-                }
+                // 计算加权聚合后的分值
+                zuiAggregateScore(src,setnum,i,&zval,op,aggregate,&score);
 
                 // 取出成员
-                tmp = zuiObjectFromValue(&zval);
+                tmp = zuiSdsFromValue(&zval);
                 // 插入并集元素到跳跃表
                 znode = zslInsert(dstzset->zsl,score,tmp);
-                incrRefCount(zval.ele); /* added to skiplist */
                 // 添加元素到字典
-                dictAdd(dstzset->dict,tmp,&znode->score);
-                incrRefCount(zval.ele); /* added to dictionary */
+                dictAdd(dstzset->dict,znode->ele,&znode->score);
 
                 // 更新字符串最大长度
-                if (sdsEncodedObject(tmp)) {
-                    if (sdslen(tmp->ptr) > maxelelen)
-                        maxelelen = sdslen(tmp->ptr);
-                }
+                if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
             }
             zuiClearIterator(&src[i]);
         }
@@ -3067,12 +3315,12 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
 
     // 如果结果集合的长度不为 0 
     if (dstzset->zsl->length) {
-        /* Convert to ziplist when in limits. */
+        /* Convert to listpack when in limits. */
         // 看是否需要对结果集合进行编码转换
         // TODO:(DONE) 为什么这次优先使用 zsl + dict 的方案呢？改修快呀，上面一堆 insert、remove 操作，到了最后才看看要不要压缩操作
         if (dstzset->zsl->length <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(dstobj,REDIS_ENCODING_ZIPLIST);
+                zsetConvert(dstobj,REDIS_ENCODING_LISTPACK);
 
         // 将结果集合关联到数据库
         dbAdd(c->db,dstkey,dstobj);
@@ -3141,38 +3389,182 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
  * 127.0.0.1:6379> 
 */
 void zunionstoreCommand(redisClient *c) {
-    zunionInterGenericCommand(c,c->argv[1], REDIS_OP_UNION);
+    zunionInterGenericCommand(c,c->argv[1],2,REDIS_OP_UNION);
 }
 
 // ZINTERSTORE destination numkeys key [key ...] [WEIGHTS weight] [AGGREGATE SUM|MIN|MAX]
 void zinterstoreCommand(redisClient *c) {
-    zunionInterGenericCommand(c,c->argv[1], REDIS_OP_INTER);
+    zunionInterGenericCommand(c,c->argv[1],2,REDIS_OP_INTER);
 }
 
-void zrangeGenericCommand(redisClient *c, int reverse) {
-    robj *key = c->argv[1];
-    robj *zobj;
-    int withscores = 0;
-    long start;
-    long end;
-    int llen;
-    int rangelen;
+// ZUNION numkeys key [key ...] [WEIGHTS weight] [AGGREGATE SUM|MIN|MAX] [WITHSCORES] [LIMIT count]
+// 和 ZUNIONSTORE 一样计算并集，但直接返回结果（按分值从小到大），不写入 destination
+void zunionCommand(redisClient *c) {
+    zunionInterGenericCommand(c,NULL,1,REDIS_OP_UNION);
+}
 
-    // 取出 start 和 end 参数
-    if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
-        (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK)) return;
+// ZINTER numkeys key [key ...] [WEIGHTS weight] [AGGREGATE SUM|MIN|MAX] [WITHSCORES] [LIMIT count]
+void zinterCommand(redisClient *c) {
+    zunionInterGenericCommand(c,NULL,1,REDIS_OP_INTER);
+}
 
-    // 确定是否显示分值
-    if (c->argc == 5 && !strcasecmp(c->argv[4]->ptr,"withscores")) {
-        withscores = 1;
-    } else if (c->argc >= 5) {
-        addReply(c,shared.syntaxerr);
+/* Range commands emit their results through a zrangeResultHandler, that
+ * either replies to the client (ZRANGE, ZRANGEBYSCORE, ...) or appends the
+ * results to the sorted set that ZRANGESTORE writes to the destination key.
+ *
+ * 范围命令的输出：要么直接回复客户端，要么写入 ZRANGESTORE 的目标有序集合 */
+typedef struct zrangeResultHandler {
+    redisClient *client;
+    robj *dstkey;           /* ZRANGESTORE destination, NULL to reply. */
+    robj *dstobj;           /* Sorted set being built for dstkey. */
+    int withscores;
+    int reverse;            /* Results come in descending order. */
+    unsigned long length;   /* Results emitted so far. */
+    void *replylen;         /* Deferred multi bulk length, if any. */
+} zrangeResultHandler;
+
+static void zrangeResultInit(zrangeResultHandler *handler, redisClient *c,
+                             robj *dstkey, int withscores, int reverse)
+{
+    memset(handler,0,sizeof(*handler));
+    handler->client = c;
+    handler->dstkey = dstkey;
+    handler->withscores = withscores;
+    handler->reverse = reverse;
+}
+
+/* Start emitting 'length' results, or an unknown number when -1.
+ *
+ * When storing, the destination is created in its final encoding when the
+ * length is known: past zset-max-ziplist-entries it starts as a skiplist
+ * instead of being converted later. */
+static void zrangeResultBegin(zrangeResultHandler *handler, long length) {
+    if (handler->dstkey) {
+        if (server.zset_max_ziplist_entries == 0 ||
+            length > (long)server.zset_max_ziplist_entries)
+            handler->dstobj = createZsetObject();
+        else
+            handler->dstobj = createZsetListpackObject();
+    } else if (length >= 0) {
+        addReplyMultiBulkLen(handler->client,
+            handler->withscores ? length*2 : length);
+    } else {
+        handler->replylen = addDeferredMultiBulkLength(handler->client);
+    }
+}
+
+/* Add one result to the destination sorted set. Results arrive in sorted
+ * set order (or its reverse), so listpack results are simply appended (or
+ * prepended) and no lookup is needed to place them. */
+static void zrangeResultStore(zrangeResultHandler *handler, sds ele, double score) {
+    robj *zobj = handler->dstobj;
+
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->ptr;
+
+        // 元素过大或者数量过多时，转换为跳跃表编码
+        if (sdslen(ele) > server.zset_max_ziplist_value ||
+            zzlLength(zl)+1 > server.zset_max_ziplist_entries)
+        {
+            /* zsetConvert() does not handle an empty listpack. */
+            if (zzlLength(zl) == 0) {
+                decrRefCount(zobj);
+                handler->dstobj = zobj = createZsetObject();
+            } else {
+                zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
+            }
+        } else {
+            zobj->ptr = zzlInsertAt(zl,handler->reverse ? lpSeek(zl,0) : NULL,
+                                    ele,score);
+            return;
+        }
+    }
+
+    if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        zskiplistNode *znode = zslInsert(zs->zsl,score,ele);
+
+        dictAdd(zs->dict,znode->ele,&znode->score);
+    } else {
+        redisPanic("Unknown sorted set encoding");
+    }
+}
+
+static void zrangeResultEmitCBuffer(zrangeResultHandler *handler,
+                                    const void *p, size_t len, double score)
+{
+    handler->length++;
+    if (handler->dstkey) {
+        sds ele = sdsnewlen(p,len);
+        zrangeResultStore(handler,ele,score);
+        sdsfree(ele);
         return;
     }
+    addReplyBulkCBuffer(handler->client,(void*)p,len);
+    if (handler->withscores) addReplyDouble(handler->client,score);
+}
 
-    // 取出有序集合对象
-    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL
-         || checkType(c,zobj,REDIS_ZSET)) return;
+static void zrangeResultEmitLongLong(zrangeResultHandler *handler,
+                                     long long value, double score)
+{
+    handler->length++;
+    if (handler->dstkey) {
+        sds ele = sdsfromlonglong(value);
+        zrangeResultStore(handler,ele,score);
+        sdsfree(ele);
+        return;
+    }
+    addReplyBulkLongLong(handler->client,value);
+    if (handler->withscores) addReplyDouble(handler->client,score);
+}
+
+/* Finish the emission: fix the deferred reply length, or store the
+ * destination key and reply with its cardinality. */
+static void zrangeResultEnd(zrangeResultHandler *handler) {
+    redisClient *c = handler->client;
+
+    if (handler->dstkey == NULL) {
+        if (handler->replylen)
+            setDeferredMultiBulkLength(c,handler->replylen,
+                handler->withscores ? handler->length*2 : handler->length);
+        return;
+    }
+
+    // 与 ZUNIONSTORE 相同：先删除已存在的 dstkey，非空时再关联新对象
+    if (handler->length) {
+        dbDelete(c->db,handler->dstkey);
+        dbAdd(c->db,handler->dstkey,handler->dstobj);
+        signalModifiedKey(c->db,handler->dstkey);
+        notifyKeyspaceEvent(REDIS_NOTIFY_ZSET,"zrangestore",
+            handler->dstkey,c->db->id);
+        server.dirty++;
+    } else {
+        decrRefCount(handler->dstobj);
+        if (dbDelete(c->db,handler->dstkey)) {
+            signalModifiedKey(c->db,handler->dstkey);
+            notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",
+                handler->dstkey,c->db->id);
+            server.dirty++;
+        }
+    }
+    handler->dstobj = NULL;
+    addReplyLongLong(c,handler->length);
+}
+
+/* Emit an empty result. */
+static void zrangeResultEmpty(zrangeResultHandler *handler) {
+    zrangeResultBegin(handler,0);
+    zrangeResultEnd(handler);
+}
+
+/* Emit the elements with rank in [start,end] of 'zobj'. */
+static void zrangeResultByRank(zrangeResultHandler *handler, robj *zobj,
+                               long start, long end)
+{
+    redisClient *c = handler->client;
+    int reverse = handler->reverse;
+    int llen;
+    int rangelen;
 
     /* Sanitize indexes. */
     // 将负数索引转换为正数索引
@@ -3185,42 +3577,39 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
      * The range is empty when start > end or start >= length. */
     // 过滤/调整索引
     if (start > end || start >= llen) {
-        addReply(c,shared.emptymultibulk);
+        zrangeResultEmpty(handler);
         return;
     }
     if (end >= llen) end = llen-1;
     rangelen = (end-start)+1;
 
     /* Return the result in form of a multi-bulk reply */
-    addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
+    zrangeResultBegin(handler,rangelen);
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        // 决定迭代的方向(ZIPLIST encoding 下，score、member 是成对保存的)
+        // 决定迭代的方向(LISTPACK encoding 下，score、member 是成对保存的)
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         // 取出元素
         while (rangelen--) {
             redisAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
-                addReplyBulkLongLong(c,vlong);
+                zrangeResultEmitLongLong(handler,vlong,zzlGetScore(sptr));
             else
-                addReplyBulkCBuffer(c,vstr,vlen);
-
-            if (withscores)
-                addReplyDouble(c,zzlGetScore(sptr));
+                zrangeResultEmitCBuffer(handler,vstr,vlen,zzlGetScore(sptr));
 
             if (reverse)
                 zzlPrev(zl,&eptr,&sptr);
@@ -3232,7 +3621,6 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
         zset *zs = zobj->ptr;
         zskiplist *zsl = zs->zsl;
         zskiplistNode *ln;
-        robj *ele;
 
         /* Check if starting point is trivial, before doing log(N) lookup. */
         // 迭代的方向
@@ -3249,15 +3637,41 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
         // 取出元素
         while(rangelen--) {
             redisAssertWithInfo(c,zobj,ln != NULL);
-            ele = ln->obj;
-            addReplyBulk(c,ele);
-            if (withscores)
-                addReplyDouble(c,ln->score);
+            zrangeResultEmitCBuffer(handler,ln->ele,sdslen(ln->ele),ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
+    zrangeResultEnd(handler);
+}
+
+void zrangeGenericCommand(redisClient *c, int reverse) {
+    robj *key = c->argv[1];
+    robj *zobj;
+    int withscores = 0;
+    long start;
+    long end;
+    zrangeResultHandler handler;
+
+    // 取出 start 和 end 参数
+    if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
+        (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK)) return;
+
+    // 确定是否显示分值
+    if (c->argc == 5 && !strcasecmp(c->argv[4]->ptr,"withscores")) {
+        withscores = 1;
+    } else if (c->argc >= 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    // 取出有序集合对象
+    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL
+         || checkType(c,zobj,REDIS_ZSET)) return;
+
+    zrangeResultInit(&handler,c,NULL,withscores,reverse);
+    zrangeResultByRank(&handler,zobj,start,end);
 }
 
 // ZRANGE key start stop [WITHSCORES]
@@ -3273,60 +3687,15 @@ void zrevrangeCommand(redisClient *c) {
     zrangeGenericCommand(c,1);
 }
 
-/* This command implements ZRANGEBYSCORE, ZREVRANGEBYSCORE. */
-void genericZrangebyscoreCommand(redisClient *c, int reverse) {
-    zrangespec range;
-    robj *key = c->argv[1];
-    robj *zobj;
-    long offset = 0, limit = -1;
-    int withscores = 0;
-    unsigned long rangelen = 0;
-    void *replylen = NULL;
-    int minidx, maxidx;
+/* Emit the elements of 'zobj' in the score range 'range', skipping the
+ * first 'offset' ones and emitting at most 'limit' (no limit if negative). */
+static void zrangeResultByScore(zrangeResultHandler *handler, robj *zobj,
+                                zrangespec *range, long offset, long limit)
+{
+    redisClient *c = handler->client;
+    int reverse = handler->reverse;
 
-    /* Parse the range arguments. */
-    if (reverse) {
-        /* Range is given as [max,min] */
-        maxidx = 2; minidx = 3;
-    } else {
-        /* Range is given as [min,max] */
-        minidx = 2; maxidx = 3;
-    }
-
-    // 分析并读入范围
-    if (zslParseRange(c->argv[minidx],c->argv[maxidx],&range) != REDIS_OK) {
-        addReplyError(c,"min or max is not a float");
-        return;
-    }
-
-    /* Parse optional extra arguments. Note that ZCOUNT will exactly have
-     * 4 arguments, so we'll never enter the following code path. */
-    // 分析并读入可选参数
-    if (c->argc > 4) {
-        int remaining = c->argc - 4;
-        int pos = 4;
-
-        while (remaining) {
-            if (remaining >= 1 && !strcasecmp(c->argv[pos]->ptr,"withscores")) {
-                pos++; remaining--;
-                withscores = 1;
-            } else if (remaining >= 3 && !strcasecmp(c->argv[pos]->ptr,"limit")) {
-                if ((getLongFromObjectOrReply(c, c->argv[pos+1], &offset, NULL) != REDIS_OK) ||
-                    (getLongFromObjectOrReply(c, c->argv[pos+2], &limit, NULL) != REDIS_OK)) return;
-                pos += 3; remaining -= 3;
-            } else {
-                addReply(c,shared.syntaxerr);
-                return;
-            }
-        }
-    }
-
-    /* Ok, lookup the key and get the range */
-    // 取出有序集合对象
-    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
-        checkType(c,zobj,REDIS_ZSET)) return;
-
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -3337,26 +3706,26 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
         /* If reversed, get the last node in range as starting point. */
         // 迭代的方向(取得 range 范围内的最后一个\第一个元素)
         if (reverse) {
-            eptr = zzlLastInRange(zl,&range);
+            eptr = zzlLastInRange(zl,range);
         } else {
-            eptr = zzlFirstInRange(zl,&range);
+            eptr = zzlFirstInRange(zl,range);
         }
 
         /* No "first" element in the specified interval. */
         // 没有元素在指定范围之内
         if (eptr == NULL) {
-            addReply(c, shared.emptymultibulk);
+            zrangeResultEmpty(handler);
             return;
         }
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
          * length in the output buffer, and will "fix" it later */
-        replylen = addDeferredMultiBulkLength(c);
+        zrangeResultBegin(handler,-1);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -3378,23 +3747,18 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
             /* Abort when the node is no longer in range. */
             // 检查分值是否符合范围
             if (reverse) {
-                if (!zslValueGteMin(score,&range)) break;
+                if (!zslValueGteMin(score,range)) break;
             } else {
-                if (!zslValueLteMax(score,&range)) break;
+                if (!zslValueLteMax(score,range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            /* We know the element exists, so listpackGet should always succeed */
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
-            rangelen++;
             if (vstr == NULL) {
-                addReplyBulkLongLong(c,vlong);
+                zrangeResultEmitLongLong(handler,vlong,score);
             } else {
-                addReplyBulkCBuffer(c,vstr,vlen);
-            }
-
-            if (withscores) {
-                addReplyDouble(c,score);
+                zrangeResultEmitCBuffer(handler,vstr,vlen,score);
             }
 
             /* Move to next node */
@@ -3413,22 +3777,22 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
         /* If reversed, get the last node in range as starting point. */
         // 方向
         if (reverse) {
-            ln = zslLastInRange(zsl,&range);
+            ln = zslLastInRange(zsl,range);
         } else {
-            ln = zslFirstInRange(zsl,&range);
+            ln = zslFirstInRange(zsl,range);
         }
 
         /* No "first" element in the specified interval. */
         // 没有值在指定范围之内
         if (ln == NULL) {
-            addReply(c, shared.emptymultibulk);
+            zrangeResultEmpty(handler);
             return;
         }
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
          * length in the output buffer, and will "fix" it later */
-        replylen = addDeferredMultiBulkLength(c);
+        zrangeResultBegin(handler,-1);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -3445,17 +3809,12 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
         while (ln && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zslValueGteMin(ln->score,&range)) break;
+                if (!zslValueGteMin(ln->score,range)) break;
             } else {
-                if (!zslValueLteMax(ln->score,&range)) break;
+                if (!zslValueLteMax(ln->score,range)) break;
             }
 
-            rangelen++;
-            addReplyBulk(c,ln->obj);
-
-            if (withscores) {
-                addReplyDouble(c,ln->score);
-            }
+            zrangeResultEmitCBuffer(handler,ln->ele,sdslen(ln->ele),ln->score);
 
             /* Move to next node */
             if (reverse) {
@@ -3468,11 +3827,63 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
         redisPanic("Unknown sorted set encoding");
     }
 
-    if (withscores) {
-        rangelen *= 2;
+    zrangeResultEnd(handler);
+}
+
+/* This command implements ZRANGEBYSCORE, ZREVRANGEBYSCORE. */
+void genericZrangebyscoreCommand(redisClient *c, int reverse) {
+    zrangespec range;
+    robj *key = c->argv[1];
+    robj *zobj;
+    long offset = 0, limit = -1;
+    int withscores = 0;
+    int minidx, maxidx;
+    zrangeResultHandler handler;
+
+    /* Parse the range arguments. */
+    if (reverse) {
+        /* Range is given as [max,min] */
+        maxidx = 2; minidx = 3;
+    } else {
+        /* Range is given as [min,max] */
+        minidx = 2; maxidx = 3;
     }
 
-    setDeferredMultiBulkLength(c, replylen, rangelen);
+    // 分析并读入范围
+    if (zslParseRange(c->argv[minidx],c->argv[maxidx],&range) != REDIS_OK) {
+        addReplyError(c,"min or max is not a float");
+        return;
+    }
+
+    /* Parse optional extra arguments. Note that ZCOUNT will exactly have
+     * 4 arguments, so we'll never enter the following code path. */
+    // 分析并读入可选参数
+    if (c->argc > 4) {
+        int remaining = c->argc - 4;
+        int pos = 4;
+
+        while (remaining) {
+            if (remaining >= 1 && !strcasecmp(c->argv[pos]->ptr,"withscores")) {
+                pos++; remaining--;
+                withscores = 1;
+            } else if (remaining >= 3 && !strcasecmp(c->argv[pos]->ptr,"limit")) {
+                if ((getLongFromObjectOrReply(c, c->argv[pos+1], &offset, NULL) != REDIS_OK) ||
+                    (getLongFromObjectOrReply(c, c->argv[pos+2], &limit, NULL) != REDIS_OK)) return;
+                pos += 3; remaining -= 3;
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+    }
+
+    /* Ok, lookup the key and get the range */
+    // 取出有序集合对象
+    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
+        checkType(c,zobj,REDIS_ZSET)) return;
+
+    zrangeResultInit(&handler,c,NULL,withscores,reverse);
+    zrangeResultByScore(&handler,zobj,&range,offset,limit);
 }
 
 // ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
@@ -3507,7 +3918,7 @@ void zcountCommand(redisClient *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -3525,7 +3936,7 @@ void zcountCommand(redisClient *c) {
 
         /* First element is in range */
         // 取出分值
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         redisAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -3562,7 +3973,7 @@ void zcountCommand(redisClient *c) {
         // 如果有至少一个元素在范围内，那么执行以下代码
         if (zn != NULL) {
             // 确定范围内第一个元素的排位（利用跳表的特性快速搜索）
-            rank = zslGetRank(zsl, zn->score, zn->obj);
+            rank = zslGetRank(zsl, zn->score, zn->ele);
 
             count = (zsl->length - (rank - 1));
 
@@ -3574,7 +3985,7 @@ void zcountCommand(redisClient *c) {
             // 如果范围内的最后一个元素不为空，那么执行以下代码
             if (zn != NULL) {
                 // 确定范围内最后一个元素的排位（利用跳表的特性快速搜索）
-                rank = zslGetRank(zsl, zn->score, zn->obj);
+                rank = zslGetRank(zsl, zn->score, zn->ele);
 
                 // 这里计算的就是第一个和最后一个两个元素之间的元素数量
                 // （包括这两个元素）
@@ -3609,7 +4020,7 @@ void zlexcountCommand(redisClient *c) {
         return;
     }
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -3624,7 +4035,7 @@ void zlexcountCommand(redisClient *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -3648,7 +4059,7 @@ void zlexcountCommand(redisClient *c) {
 
         /* Use rank of first element, if any, to determine preliminary count */
         if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->obj);
+            rank = zslGetRank(zsl, zn->score, zn->ele);
             count = (zsl->length - (rank - 1));
 
             /* Find last element in range */
@@ -3656,7 +4067,7 @@ void zlexcountCommand(redisClient *c) {
 
             /* Use rank of last element, if any, to determine the actual count */
             if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->obj);
+                rank = zslGetRank(zsl, zn->score, zn->ele);
                 count -= (zsl->length - rank);
             }
         }
@@ -3668,58 +4079,15 @@ void zlexcountCommand(redisClient *c) {
     addReplyLongLong(c, count);
 }
 
-/* This command implements ZRANGEBYLEX, ZREVRANGEBYLEX. */
-void genericZrangebylexCommand(redisClient *c, int reverse) {
-    zlexrangespec range;
-    robj *key = c->argv[1];
-    robj *zobj;
-    long offset = 0, limit = -1;
-    unsigned long rangelen = 0;
-    void *replylen = NULL;
-    int minidx, maxidx;
-
-    /* Parse the range arguments. */
-    if (reverse) {
-        /* Range is given as [max,min] */
-        maxidx = 2; minidx = 3;
-    } else {
-        /* Range is given as [min,max] */
-        minidx = 2; maxidx = 3;
-    }
-
-    if (zslParseLexRange(c->argv[minidx],c->argv[maxidx],&range) != REDIS_OK) {
-        addReplyError(c,"min or max not valid string range item");
-        return;
-    }
-
-    /* Parse optional extra arguments. Note that ZCOUNT will exactly have
-     * 4 arguments, so we'll never enter the following code path. */
-    if (c->argc > 4) {
-        int remaining = c->argc - 4;
-        int pos = 4;
+/* Emit the elements of 'zobj' in the lex range 'range', skipping the
+ * first 'offset' ones and emitting at most 'limit' (no limit if negative). */
+static void zrangeResultByLex(zrangeResultHandler *handler, robj *zobj,
+                              zlexrangespec *range, long offset, long limit)
+{
+    redisClient *c = handler->client;
+    int reverse = handler->reverse;
 
-        while (remaining) {
-            if (remaining >= 3 && !strcasecmp(c->argv[pos]->ptr,"limit")) {
-                if ((getLongFromObjectOrReply(c, c->argv[pos+1], &offset, NULL) != REDIS_OK) ||
-                    (getLongFromObjectOrReply(c, c->argv[pos+2], &limit, NULL) != REDIS_OK)) return;
-                pos += 3; remaining -= 3;
-            } else {
-                zslFreeLexRange(&range);
-                addReply(c,shared.syntaxerr);
-                return;
-            }
-        }
-    }
-
-    /* Ok, lookup the key and get the range */
-    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
-        checkType(c,zobj,REDIS_ZSET))
-    {
-        zslFreeLexRange(&range);
-        return;
-    }
-
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -3728,26 +4096,25 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            eptr = zzlLastInLexRange(zl,&range);
+            eptr = zzlLastInLexRange(zl,range);
         } else {
-            eptr = zzlFirstInLexRange(zl,&range);
+            eptr = zzlFirstInLexRange(zl,range);
         }
 
         /* No "first" element in the specified interval. */
         if (eptr == NULL) {
-            addReply(c, shared.emptymultibulk);
-            zslFreeLexRange(&range);
+            zrangeResultEmpty(handler);
             return;
         }
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
          * length in the output buffer, and will "fix" it later */
-        replylen = addDeferredMultiBulkLength(c);
+        zrangeResultBegin(handler,-1);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -3762,20 +4129,19 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
         while (eptr && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zzlLexValueGteMin(eptr,&range)) break;
+                if (!zzlLexValueGteMin(eptr,range)) break;
             } else {
-                if (!zzlLexValueLteMax(eptr,&range)) break;
+                if (!zzlLexValueLteMax(eptr,range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so listpackGet should always
              * succeed. */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
-            rangelen++;
             if (vstr == NULL) {
-                addReplyBulkLongLong(c,vlong);
+                zrangeResultEmitLongLong(handler,vlong,zzlGetScore(sptr));
             } else {
-                addReplyBulkCBuffer(c,vstr,vlen);
+                zrangeResultEmitCBuffer(handler,vstr,vlen,zzlGetScore(sptr));
             }
 
             /* Move to next node */
@@ -3792,22 +4158,21 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            ln = zslLastInLexRange(zsl,&range);
+            ln = zslLastInLexRange(zsl,range);
         } else {
-            ln = zslFirstInLexRange(zsl,&range);
+            ln = zslFirstInLexRange(zsl,range);
         }
 
         /* No "first" element in the specified interval. */
         if (ln == NULL) {
-            addReply(c, shared.emptymultibulk);
-            zslFreeLexRange(&range);
+            zrangeResultEmpty(handler);
             return;
         }
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
          * length in the output buffer, and will "fix" it later */
-        replylen = addDeferredMultiBulkLength(c);
+        zrangeResultBegin(handler,-1);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -3822,13 +4187,12 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
         while (ln && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zslLexValueGteMin(ln->obj,&range)) break;
+                if (!zslLexValueGteMin(ln->ele,range)) break;
             } else {
-                if (!zslLexValueLteMax(ln->obj,&range)) break;
+                if (!zslLexValueLteMax(ln->ele,range)) break;
             }
 
-            rangelen++;
-            addReplyBulk(c,ln->obj);
+            zrangeResultEmitCBuffer(handler,ln->ele,sdslen(ln->ele),ln->score);
 
             /* Move to next node */
             if (reverse) {
@@ -3841,8 +4205,62 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
         redisPanic("Unknown sorted set encoding");
     }
 
+    zrangeResultEnd(handler);
+}
+
+/* This command implements ZRANGEBYLEX, ZREVRANGEBYLEX. */
+void genericZrangebylexCommand(redisClient *c, int reverse) {
+    zlexrangespec range;
+    robj *key = c->argv[1];
+    robj *zobj;
+    long offset = 0, limit = -1;
+    int minidx, maxidx;
+    zrangeResultHandler handler;
+
+    /* Parse the range arguments. */
+    if (reverse) {
+        /* Range is given as [max,min] */
+        maxidx = 2; minidx = 3;
+    } else {
+        /* Range is given as [min,max] */
+        minidx = 2; maxidx = 3;
+    }
+
+    if (zslParseLexRange(c->argv[minidx],c->argv[maxidx],&range) != REDIS_OK) {
+        addReplyError(c,"min or max not valid string range item");
+        return;
+    }
+
+    /* Parse optional extra arguments. Note that ZCOUNT will exactly have
+     * 4 arguments, so we'll never enter the following code path. */
+    if (c->argc > 4) {
+        int remaining = c->argc - 4;
+        int pos = 4;
+
+        while (remaining) {
+            if (remaining >= 3 && !strcasecmp(c->argv[pos]->ptr,"limit")) {
+                if ((getLongFromObjectOrReply(c, c->argv[pos+1], &offset, NULL) != REDIS_OK) ||
+                    (getLongFromObjectOrReply(c, c->argv[pos+2], &limit, NULL) != REDIS_OK)) return;
+                pos += 3; remaining -= 3;
+            } else {
+                zslFreeLexRange(&range);
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+    }
+
+    /* Ok, lookup the key and get the range */
+    if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
+        checkType(c,zobj,REDIS_ZSET))
+    {
+        zslFreeLexRange(&range);
+        return;
+    }
+
+    zrangeResultInit(&handler,c,NULL,0,reverse);
+    zrangeResultByLex(&handler,zobj,&range,offset,limit);
     zslFreeLexRange(&range);
-    setDeferredMultiBulkLength(c, replylen, rangelen);
 }
 
 void zrangebylexCommand(redisClient *c) {
@@ -3853,6 +4271,92 @@ void zrevrangebylexCommand(redisClient *c) {
     genericZrangebylexCommand(c,1);
 }
 
+// ZRANGESTORE dst src min max [BYSCORE|BYLEX] [REV] [LIMIT offset count]
+// 把 ZRANGE / ZRANGEBYSCORE / ZRANGEBYLEX 的结果直接保存到 dst，返回 dst 的元素数量
+// 和 ZREVRANGEBYSCORE 一样，给定 REV 时 BYSCORE / BYLEX 的范围以 max min 的顺序给出
+void zrangestoreCommand(redisClient *c) {
+    robj *dstkey = c->argv[1];
+    robj *key = c->argv[2];
+    robj *zobj;
+    int byscore = 0, bylex = 0, reverse = 0, j;
+    long offset = 0, limit = -1, start, end;
+    int minidx, maxidx;
+    zrangespec range;
+    zlexrangespec lexrange;
+    zrangeResultHandler handler;
+
+    /* Parse the options. */
+    for (j = 5; j < c->argc; j++) {
+        int leftargs = c->argc-j-1;
+
+        if (!strcasecmp(c->argv[j]->ptr,"byscore")) {
+            byscore = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"bylex")) {
+            bylex = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"rev")) {
+            reverse = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"limit") && leftargs >= 2) {
+            if ((getLongFromObjectOrReply(c, c->argv[j+1], &offset, NULL) != REDIS_OK) ||
+                (getLongFromObjectOrReply(c, c->argv[j+2], &limit, NULL) != REDIS_OK)) return;
+            j += 2;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (byscore && bylex) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if ((offset != 0 || limit != -1) && !byscore && !bylex) {
+        addReplyError(c,"syntax error, LIMIT is only supported in "
+                        "combination with either BYSCORE or BYLEX");
+        return;
+    }
+
+    /* Parse the range arguments, given as [max,min] when reversed. */
+    if (reverse && (byscore || bylex)) {
+        maxidx = 3; minidx = 4;
+    } else {
+        minidx = 3; maxidx = 4;
+    }
+
+    if (byscore) {
+        if (zslParseRange(c->argv[minidx],c->argv[maxidx],&range) != REDIS_OK) {
+            addReplyError(c,"min or max is not a float");
+            return;
+        }
+    } else if (bylex) {
+        if (zslParseLexRange(c->argv[minidx],c->argv[maxidx],&lexrange) != REDIS_OK) {
+            addReplyError(c,"min or max not valid string range item");
+            return;
+        }
+    } else {
+        if ((getLongFromObjectOrReply(c, c->argv[3], &start, NULL) != REDIS_OK) ||
+            (getLongFromObjectOrReply(c, c->argv[4], &end, NULL) != REDIS_OK)) return;
+    }
+
+    // 取出源有序集合，不存在时结果为空集合（dst 会被删除）
+    zrangeResultInit(&handler,c,dstkey,0,reverse);
+    zobj = lookupKeyWrite(c->db,key);
+    if (zobj != NULL && checkType(c,zobj,REDIS_ZSET)) {
+        if (bylex) zslFreeLexRange(&lexrange);
+        return;
+    }
+
+    if (zobj == NULL)
+        zrangeResultEmpty(&handler);
+    else if (byscore)
+        zrangeResultByScore(&handler,zobj,&range,offset,limit);
+    else if (bylex)
+        zrangeResultByLex(&handler,zobj,&lexrange,offset,limit);
+    else
+        zrangeResultByRank(&handler,zobj,start,end);
+
+    if (bylex) zslFreeLexRange(&lexrange);
+}
+
 // ZCARD key
 void zcardCommand(redisClient *c) {
     robj *key = c->argv[1];
@@ -3867,41 +4371,40 @@ void zcardCommand(redisClient *c) {
 }
 
 // ZSCORE key member
-void zscoreCommand(redisClient *c) {
-    robj *key = c->argv[1];
-    robj *zobj;
-    double score;
-
-    if ((zobj = lookupKeyReadOrReply(c,key,shared.nullbulk)) == NULL ||
-        checkType(c,zobj,REDIS_ZSET)) return;
-
-    // ziplist
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
-        // 取出元素
-        if (zzlFind(zobj->ptr,c->argv[2],&score) != NULL)
-            // 回复分值
-            addReplyDouble(c,score);
-        else
-            addReply(c,shared.nullbulk);
-
-    // SKIPLIST
+/* Lookup the score of 'member' in the sorted set 'zobj', storing it into
+ * *score. Returns REDIS_OK if the member exists, REDIS_ERR otherwise.
+ *
+ * 取出成员的分值，成员不存在时返回 REDIS_ERR 。 */
+int zsetScore(robj *zobj, robj *member, double *score) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
+        if (zzlFind(zobj->ptr,member,score) == NULL) return REDIS_ERR;
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
         zset *zs = zobj->ptr;
         dictEntry *de;
 
-        c->argv[2] = tryObjectEncoding(c->argv[2]);
-        // 直接从字典中取出并返回分值
-        de = dictFind(zs->dict,c->argv[2]);
-        if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            addReplyDouble(c,score);
-        } else {
-            addReply(c,shared.nullbulk);
-        }
-
+        // 直接从字典中取出分值
+        de = dictFind(zs->dict,member->ptr);
+        if (de == NULL) return REDIS_ERR;
+        *score = *(double*)dictGetVal(de);
     } else {
         redisPanic("Unknown sorted set encoding");
     }
+    return REDIS_OK;
+}
+
+void zscoreCommand(redisClient *c) {
+    robj *key = c->argv[1];
+    robj *zobj;
+    double score;
+
+    if ((zobj = lookupKeyReadOrReply(c,key,shared.null[c->resp])) == NULL ||
+        checkType(c,zobj,REDIS_ZSET)) return;
+
+    if (zsetScore(zobj,c->argv[2],&score) == REDIS_OK)
+        // 回复分值
+        addReplyDouble(c,score);
+    else
+        addReplyNull(c);
 }
 
 //  获得某一个 member 的 rank
@@ -3913,7 +4416,7 @@ void zrankGenericCommand(redisClient *c, int reverse) {
     unsigned long rank;
 
     // 有序集合
-    if ((zobj = lookupKeyReadOrReply(c,key,shared.nullbulk)) == NULL ||
+    if ((zobj = lookupKeyReadOrReply(c,key,shared.null[c->resp])) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
     // 元素数量
@@ -3921,19 +4424,19 @@ void zrankGenericCommand(redisClient *c, int reverse) {
 
     redisAssertWithInfo(c,ele,sdsEncodedObject(ele));
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,sptr != NULL);
 
         // 计算某一个 member 排名
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr)))
+            if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -3946,7 +4449,7 @@ void zrankGenericCommand(redisClient *c, int reverse) {
             else
                 addReplyLongLong(c,rank-1);
         } else {
-            addReply(c,shared.nullbulk);
+            addReplyNull(c);
         }
 
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -3956,15 +4459,14 @@ void zrankGenericCommand(redisClient *c, int reverse) {
         double score;
 
         // 从字典中取出元素
-        ele = c->argv[2] = tryObjectEncoding(c->argv[2]);
-        de = dictFind(zs->dict,ele);
+        de = dictFind(zs->dict,ele->ptr);
         if (de != NULL) {
 
             // 取出元素的分值
             score = *(double*)dictGetVal(de);
 
             // 在跳跃表中计算该元素的排位
-            rank = zslGetRank(zsl,score,ele);
+            rank = zslGetRank(zsl,score,ele->ptr);
             redisAssertWithInfo(c,ele,rank); /* Existing elements always have a rank. */
 
             // ZRANK 还是 ZREVRANK ？
@@ -3973,7 +4475,7 @@ void zrankGenericCommand(redisClient *c, int reverse) {
             else
                 addReplyLongLong(c,rank-1);
         } else {
-            addReply(c,shared.nullbulk);
+            addReplyNull(c);
         }
 
     } else {
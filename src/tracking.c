@@ -0,0 +1,543 @@
+/* tracking.c - Client side caching: keys tracking and invalidation
+ *
+ * 客户端缓存：记录客户端读取过的键，并在键被修改时发送失效消息
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A client enabling tracking with CLIENT TRACKING on asks the server to
+ * remember the keys it reads, so that it can keep them in a local cache:
+ * when one of these keys is modified, expired or evicted the server sends
+ * an invalidation message, and the client drops the key from its cache.
+ *
+ * In the default mode the server remembers, for every key, the IDs of the
+ * clients that read it since the last invalidation, in the TrackingTable
+ * radix tree. The table is not per DB and the IDs are not removed when a
+ * client disconnects: an invalidation for a client that is gone or no
+ * longer tracking is just discarded. Once sent, the entry of the key is
+ * removed, so a client receives a single message until it reads the key
+ * again. The table size is bounded by tracking-table-max-keys: above it,
+ * random keys are invalidated ahead of time.
+ *
+ * In BCAST mode the server remembers nothing about what the client reads.
+ * Instead the client subscribes to key prefixes, and receives the names of
+ * all the modified keys starting with them. The keys modified in an event
+ * loop iteration are sent in a single message per prefix in beforeSleep().
+ *
+ * RESP3 clients receive the messages in band, as "invalidate" push data.
+ * With the REDIRECT option the messages are delivered to another connection
+ * instead: as push data if it speaks RESP3, otherwise as Pub/Sub messages
+ * on the __redis__:invalidate channel, which it must be subscribed to.
+ * The payload is an array of key names, or null when the whole dataset
+ * was flushed. */
+
+#include "redis.h"
+
+/* The tracking table is made of two levels radix tree: key name -> radix
+ * tree of the IDs (native endian) of the clients that may have the key in
+ * their local cache. */
+static rax *TrackingTable = NULL;
+static rax *PrefixTable = NULL;
+static uint64_t TrackingTableTotalItems = 0; /* Total number of IDs stored
+                                                across the whole tracking
+                                                table. This gives an hint
+                                                about the total memory we
+                                                are using server side for
+                                                CSC. */
+static robj *TrackingChannelName;
+
+/* This is the structure that we have as value of the PrefixTable, and
+ * represents the list of keys modified, and the list of clients that need
+ * to be notified, for a given prefix. */
+typedef struct bcastState {
+    rax *keys;      /* Keys modified in the current event loop cycle, with
+                       the client which modified them as value. */
+    rax *clients;   /* Clients subscribed to the notification events for this
+                       prefix, by pointer. */
+} bcastState;
+
+/* Remove the tracking state from the client 'c'. Note that there is not much
+ * to do for us here, if not to decrement the counter of the clients in
+ * tracking mode, because we just store the ID of the client in the tracking
+ * table, so we'll remove the ID reference in a lazy way. Otherwise when a
+ * client with many entries in the table is removed, it would cost a lot of
+ * time to do the cleanup. */
+void disableTracking(redisClient *c) {
+    if (!(c->flags & REDIS_TRACKING)) return;
+
+    /* If this client is in broadcasting mode, we need to unsubscribe it
+     * from all the prefixes it is registered to. */
+    if (c->flags & REDIS_TRACKING_BCAST) {
+        raxIterator ri;
+
+        raxStart(&ri,c->client_tracking_prefixes);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            bcastState *bs = raxFind(PrefixTable,ri.key,ri.key_len);
+            redisAssert(bs != raxNotFound);
+            raxRemove(bs->clients,(unsigned char*)&c,sizeof(c),NULL);
+            /* Was it the last client? Remove the prefix from the
+             * table. */
+            if (raxSize(bs->clients) == 0) {
+                raxFree(bs->clients);
+                raxFree(bs->keys);
+                zfree(bs);
+                raxRemove(PrefixTable,ri.key,ri.key_len,NULL);
+            }
+        }
+        raxStop(&ri);
+        raxFree(c->client_tracking_prefixes);
+        c->client_tracking_prefixes = NULL;
+    }
+
+    /* Clear flags and adjust the count. */
+    c->flags &= ~(REDIS_TRACKING|REDIS_TRACKING_BROKEN_REDIR|
+                  REDIS_TRACKING_BCAST|REDIS_TRACKING_NOLOOP);
+    server.tracking_clients--;
+}
+
+/* Set the client 'c' to track the prefix 'prefix'. If the client 'c' is
+ * already registered for the specified prefix, no operation is performed. */
+static void enableBcastTrackingForPrefix(redisClient *c, char *prefix,
+                                         size_t plen)
+{
+    bcastState *bs = raxFind(PrefixTable,(unsigned char*)prefix,plen);
+
+    /* If this is the first client subscribing to such prefix, create
+     * the prefix in the table. */
+    if (bs == raxNotFound) {
+        bs = zmalloc(sizeof(*bs));
+        bs->keys = raxNew();
+        bs->clients = raxNew();
+        raxInsert(PrefixTable,(unsigned char*)prefix,plen,bs,NULL);
+    }
+    if (raxTryInsert(bs->clients,(unsigned char*)&c,sizeof(c),NULL,NULL)) {
+        if (!c->client_tracking_prefixes)
+            c->client_tracking_prefixes = raxNew();
+        raxInsert(c->client_tracking_prefixes,
+                  (unsigned char*)prefix,plen,NULL,NULL);
+    }
+}
+
+/* Enable the tracking state for the client 'c', and as a side effect allocates
+ * the tracking table if needed. If the 'redirect_to' argument is non zero, the
+ * invalidation messages for this client will be sent to the client ID
+ * specified by the 'redirect_to' argument. Note that if such client will
+ * eventually get freed, we'll flag the client 'c' with
+ * REDIS_TRACKING_BROKEN_REDIR and stop sending it messages.
+ *
+ * With the REDIS_TRACKING_BCAST option the client is subscribed to the
+ * 'numprefix' prefixes in 'prefix', or to every key if there are none. */
+void enableTracking(redisClient *c, uint64_t redirect_to, int options,
+                    robj **prefix, size_t numprefix)
+{
+    if (!(c->flags & REDIS_TRACKING)) server.tracking_clients++;
+    c->flags |= REDIS_TRACKING;
+    c->flags &= ~(REDIS_TRACKING_BROKEN_REDIR|REDIS_TRACKING_BCAST|
+                  REDIS_TRACKING_NOLOOP);
+    c->flags |= options & (REDIS_TRACKING_BCAST|REDIS_TRACKING_NOLOOP);
+    c->client_tracking_redirection = redirect_to;
+    if (TrackingTable == NULL) {
+        TrackingTable = raxNew();
+        PrefixTable = raxNew();
+        TrackingChannelName = createStringObject("__redis__:invalidate",20);
+    }
+
+    if (options & REDIS_TRACKING_BCAST) {
+        size_t j;
+
+        if (numprefix == 0) enableBcastTrackingForPrefix(c,"",0);
+        for (j = 0; j < numprefix; j++) {
+            sds sdsprefix = prefix[j]->ptr;
+            enableBcastTrackingForPrefix(c,sdsprefix,sdslen(sdsprefix));
+        }
+    }
+}
+
+/* This function is called after the execution of a readonly command by
+ * the client 'c', or by a script run by the client 'tracking': all the keys
+ * of the command are remembered as keys 'tracking' may have in its local
+ * cache, so that we'll send invalidation messages when they change. */
+void trackingRememberKeys(redisClient *tracking, redisClient *c) {
+    int numkeys, j;
+    int *keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+
+    if (keys == NULL) return;
+
+    for (j = 0; j < numkeys; j++) {
+        int idx = keys[j];
+        sds sdskey = c->argv[idx]->ptr;
+        rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
+
+        if (ids == raxNotFound) {
+            ids = raxNew();
+            raxTryInsert(TrackingTable,(unsigned char*)sdskey,
+                         sdslen(sdskey),ids,NULL);
+        }
+        if (raxTryInsert(ids,(unsigned char*)&tracking->id,
+                         sizeof(tracking->id),NULL,NULL))
+            TrackingTableTotalItems++;
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Send an invalidation message to the client 'c' about the key 'keyname'
+ * of 'keylen' bytes, or about the whole dataset if 'keyname' is NULL.
+ * If 'proto' is true the key name is already a RESP array of key names,
+ * as built by the broadcasting code.
+ *
+ * If 'c' redirects to another client and that client no longer exists,
+ * 'c' is flagged with REDIS_TRACKING_BROKEN_REDIR. */
+static void sendTrackingMessage(redisClient *c, char *keyname, size_t keylen,
+                                int proto)
+{
+    redisClient *redir = c;
+
+    if (c->client_tracking_redirection) {
+        redir = lookupClientByID(c->client_tracking_redirection);
+        if (redir == NULL) {
+            c->flags |= REDIS_TRACKING_BROKEN_REDIR;
+            return;
+        }
+        c->flags &= ~REDIS_TRACKING_BROKEN_REDIR;
+    }
+
+    if (redir->resp > 2) {
+        addReplyPushLen(redir,2);
+        addReplyBulkCBuffer(redir,"invalidate",10);
+    } else if (redir != c &&
+               dictFind(redir->pubsub_channels,TrackingChannelName) != NULL)
+    {
+        /* Only clients subscribed to the invalidation channel can receive
+         * the message, otherwise it would be mixed with command replies. */
+        addReply(redir,shared.mbulkhdr[3]);
+        addReply(redir,shared.messagebulk);
+        addReplyBulk(redir,TrackingChannelName);
+    } else {
+        /* A RESP2 client can't receive the message in band: this happens
+         * if a RESP3 client switched back to RESP2 with HELLO. */
+        return;
+    }
+
+    if (keyname == NULL) {
+        addReplyNullArray(redir);
+    } else if (proto) {
+        addReplyString(redir,keyname,keylen);
+    } else {
+        addReplyMultiBulkLen(redir,1);
+        addReplyBulkCBuffer(redir,keyname,keylen);
+    }
+}
+
+/* This function is called when a key is modified in Redis and in the case
+ * we have at least one client with the BCAST mode enabled.
+ * Its goal is to set the key in the right broadcast state if the key
+ * matches one or more prefixes in the prefix table. Later when we
+ * return to the event loop, we'll send invalidation messages to the
+ * clients subscribed to each prefix. */
+static void trackingRememberKeyToBroadcast(redisClient *c, char *keyname,
+                                           size_t keylen)
+{
+    raxIterator ri;
+
+    raxStart(&ri,PrefixTable);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        if (ri.key_len > keylen) continue;
+        if (ri.key_len != 0 && memcmp(ri.key,keyname,ri.key_len) != 0)
+            continue;
+        bcastState *bs = ri.data;
+        /* We insert the client pointer as associated value in the radix
+         * tree. This way we know who was the client that did the last
+         * change to the key, and can avoid sending the notification in the
+         * case the client is in NOLOOP mode. */
+        raxInsert(bs->keys,(unsigned char*)keyname,keylen,c,NULL);
+    }
+    raxStop(&ri);
+}
+
+/* Invalidate the key 'keyname' of 'keylen' bytes, sending a message to
+ * every client that may have it in its local cache.
+ *
+ * If 'bcast' is true the key is also collected for the clients in BCAST
+ * mode subscribed to a matching prefix, which is the case for the keys
+ * actually modified, but not for the keys evicted from the tracking table
+ * by trackingLimitUsedSlots(). */
+static void trackingInvalidateKeyRaw(redisClient *c, char *keyname,
+                                     size_t keylen, int bcast)
+{
+    raxIterator ri;
+    rax *ids;
+
+    if (TrackingTable == NULL) return;
+
+    if (bcast && raxSize(PrefixTable) > 0)
+        trackingRememberKeyToBroadcast(c,keyname,keylen);
+
+    ids = raxFind(TrackingTable,(unsigned char*)keyname,keylen);
+    if (ids == raxNotFound) return;
+
+    raxStart(&ri,ids);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t id;
+        redisClient *target;
+
+        memcpy(&id,ri.key,sizeof(id));
+        target = lookupClientByID(id);
+        /* Note that if the client is in BCAST mode, we don't want to
+         * send invalidation messages that were pending in the case
+         * previously the client was not in BCAST mode. This can happen if
+         * TRACKING is enabled normally, and then the client switches to
+         * BCAST mode. */
+        if (target == NULL ||
+            !(target->flags & REDIS_TRACKING) ||
+            target->flags & REDIS_TRACKING_BCAST)
+        {
+            continue;
+        }
+
+        /* If the client enabled the NOLOOP mode, don't send notifications
+         * about keys changed by the client itself. */
+        if (target->flags & REDIS_TRACKING_NOLOOP && target == c) continue;
+
+        sendTrackingMessage(target,keyname,keylen,0);
+    }
+    raxStop(&ri);
+
+    /* Free the tracking table: we'll create the radix tree and populate it
+     * again if more keys will be modified in this caching slot. */
+    TrackingTableTotalItems -= raxSize(ids);
+    raxFree(ids);
+    raxRemove(TrackingTable,(unsigned char*)keyname,keylen,NULL);
+}
+
+/* Wrapper (the one actually called across the core) to pass the key
+ * as object. Invoked when a key is modified, expired or evicted.
+ *
+ * 键被修改、过期或者淘汰时调用，向缓存了这个键的客户端发送失效消息 */
+void trackingInvalidateKey(robj *keyobj) {
+    robj *decoded;
+
+    if (TrackingTable == NULL) return;
+    decoded = getDecodedObject(keyobj);
+    trackingInvalidateKeyRaw(server.current_client,decoded->ptr,
+                             sdslen(decoded->ptr),1);
+    decrRefCount(decoded);
+}
+
+/* This function is called when one or all the Redis databases are flushed
+ * (dbid == -1 in case of FLUSHALL). Caching keys are not specific for
+ * each DB but are global: currently what we do is send a special
+ * notification to clients with tracking enabled, invalidating the caching
+ * key "", which means, "all the keys", in order to avoid flooding clients
+ * with many invalidation messages for all the keys they may hold.
+ */
+void trackingInvalidateKeysOnFlush(int dbid) {
+    REDIS_NOTUSED(dbid);
+
+    if (server.tracking_clients) {
+        listNode *ln;
+        listIter li;
+
+        listRewind(server.clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            redisClient *c = listNodeValue(ln);
+            if (c->flags & REDIS_TRACKING) sendTrackingMessage(c,NULL,0,0);
+        }
+    }
+
+    /* In case of FLUSHALL, reclaim all the memory used by tracking. */
+    if (TrackingTable) {
+        raxFreeWithCallback(TrackingTable,(void(*)(void*))raxFree);
+        TrackingTable = raxNew();
+        TrackingTableTotalItems = 0;
+    }
+}
+
+/* Tracking forces Redis to remember information about which client may have
+ * certain keys. In workloads where there are a lot of reads, but keys are
+ * hardly modified, the amount of information we have to remember server side
+ * could be a lot, with the number of keys being totally not bound.
+ *
+ * So Redis allows the user to configure a maximum number of keys for the
+ * invalidation table. This function makes sure that we don't go over the
+ * specified fill rate: if we are over, we can just evict informations about
+ * a random key, and send invalidation messages to clients like if the key was
+ * modified.
+ *
+ * The rax has no random walk: a random key is found seeking to random
+ * bytes, which is not uniform but good enough for the purpose.
+ *
+ * 跟踪表中的键超过 tracking-table-max-keys 时，随机失效一些键 */
+void trackingLimitUsedSlots(void) {
+    static unsigned int timeout_counter = 0;
+    raxIterator ri;
+    int effort;
+
+    if (TrackingTable == NULL) return;
+    if (server.tracking_table_max_keys == 0) return; /* No limits set. */
+    if (raxSize(TrackingTable) <= server.tracking_table_max_keys) {
+        timeout_counter = 0;
+        return; /* Limit not reached. */
+    }
+
+    /* We have to invalidate a few keys to reach the limit again. The effort
+     * we do here is proportional to the number of times we entered this
+     * function and found that we are still over the limit. */
+    effort = 100 * (timeout_counter+1);
+
+    /* We just remove one key after another by using a random walk. */
+    raxStart(&ri,TrackingTable);
+    while(effort > 0) {
+        unsigned char seek[8];
+        int j;
+
+        effort--;
+        for (j = 0; j < (int)sizeof(seek); j++) seek[j] = random() & 0xff;
+        raxSeek(&ri,">=",seek,sizeof(seek));
+        if (!raxNext(&ri)) {
+            raxSeek(&ri,"^",NULL,0);
+            if (!raxNext(&ri)) break;
+        }
+        trackingInvalidateKeyRaw(NULL,(char*)ri.key,ri.key_len,0);
+        if (raxSize(TrackingTable) <= server.tracking_table_max_keys) {
+            timeout_counter = 0;
+            raxStop(&ri);
+            return; /* Return ASAP: we are again under the limit. */
+        }
+    }
+
+    /* If we reach this point, we were not able to go under the configured
+     * limit using the maximum effort we had for this run. */
+    raxStop(&ri);
+    timeout_counter++;
+}
+
+/* Generate the RESP array of key names in the radix tree 'keys', skipping
+ * the keys modified by the client 'c' if not NULL. Return NULL if no key
+ * is left. */
+static sds trackingBuildBroadcastReply(redisClient *c, rax *keys) {
+    raxIterator ri;
+    uint64_t count = 0;
+    sds proto;
+
+    if (c == NULL) {
+        count = raxSize(keys);
+    } else {
+        raxStart(&ri,keys);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            if (ri.data != c) count++;
+        }
+        raxStop(&ri);
+        if (count == 0) return NULL;
+    }
+
+    proto = sdscatprintf(sdsempty(),"*%llu\r\n",(unsigned long long)count);
+    raxStart(&ri,keys);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        if (c && ri.data == c) continue;
+        proto = sdscatprintf(proto,"$%llu\r\n",(unsigned long long)ri.key_len);
+        proto = sdscatlen(proto,ri.key,ri.key_len);
+        proto = sdscatlen(proto,"\r\n",2);
+    }
+    raxStop(&ri);
+    return proto;
+}
+
+/* This function will run the prefixes of clients in BCAST mode and
+ * keys that were modified about each prefix, and will send the
+ * notifications to each client in each prefix. Called in beforeSleep().
+ *
+ * 在事件循环进入睡眠之前，把每个前缀在这次循环中被修改的键发送给订阅了前缀的客户端 */
+void trackingBroadcastInvalidationMessages(void) {
+    raxIterator ri, ri2;
+
+    /* Return ASAP if there is nothing to do here. */
+    if (TrackingTable == NULL || !server.tracking_clients) return;
+
+    raxStart(&ri,PrefixTable);
+    raxSeek(&ri,"^",NULL,0);
+
+    /* For each prefix... */
+    while(raxNext(&ri)) {
+        bcastState *bs = ri.data;
+
+        if (raxSize(bs->keys)) {
+            /* Generate the common protocol for all the clients that are
+             * not using the NOLOOP option. */
+            sds proto = trackingBuildBroadcastReply(NULL,bs->keys);
+
+            /* Send this array of keys to every client in the list. */
+            raxStart(&ri2,bs->clients);
+            raxSeek(&ri2,"^",NULL,0);
+            while(raxNext(&ri2)) {
+                redisClient *c;
+
+                memcpy(&c,ri2.key,sizeof(c));
+                if (c->flags & REDIS_TRACKING_NOLOOP) {
+                    /* This client may have certain keys excluded. */
+                    sds adhoc = trackingBuildBroadcastReply(c,bs->keys);
+                    if (adhoc) {
+                        sendTrackingMessage(c,adhoc,sdslen(adhoc),1);
+                        sdsfree(adhoc);
+                    }
+                } else {
+                    sendTrackingMessage(c,proto,sdslen(proto),1);
+                }
+            }
+            raxStop(&ri2);
+
+            /* Clean up: we can remove everything from this state, because we
+             * want to only track the new keys that will be accumulated starting
+             * from now. */
+            sdsfree(proto);
+        }
+        raxFree(bs->keys);
+        bs->keys = raxNew();
+    }
+    raxStop(&ri);
+}
+
+/* This is just used in order to access the amount of used slots in the
+ * tracking table. */
+uint64_t trackingGetTotalItems(void) {
+    return TrackingTableTotalItems;
+}
+
+uint64_t trackingGetTotalKeys(void) {
+    if (TrackingTable == NULL) return 0;
+    return raxSize(TrackingTable);
+}
+
+uint64_t trackingGetTotalPrefixes(void) {
+    if (PrefixTable == NULL) return 0;
+    return raxSize(PrefixTable);
+}
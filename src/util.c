@@ -36,6 +36,9 @@
 #include <math.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <float.h>
 
 #include "util.h"
@@ -470,6 +473,37 @@ int pathIsBaseName(char *path) {
     return strchr(path,'/') == NULL && strchr(path,'\\') == NULL;
 }
 
+/* Create the directory 'dname' if it does not exist. Returns 0 on success
+ * (or if the directory was already there), -1 on error with errno set. */
+int dirCreateIfMissing(char *dname) {
+    if (mkdir(dname,0755) != 0) {
+        if (errno != EEXIST) return -1;
+    }
+    return 0;
+}
+
+/* Return a new sds string with 'filename' joined to the directory 'path'. */
+sds makePath(char *path, char *filename) {
+    return sdscatfmt(sdsempty(),"%s/%s",path,filename);
+}
+
+/* Call fsync() on the directory holding 'filename', so that a previous
+ * rename(2) of the file is durable as well. Returns 0 on success, -1 on
+ * error with errno set. */
+int fsyncFileDir(const char *filename) {
+    char *slash = strrchr(filename,'/');
+    sds dname = slash ? sdsnewlen(filename,slash-filename) : sdsnew(".");
+    int dir_fd, retval = 0;
+
+    dir_fd = open(dname,O_RDONLY);
+    sdsfree(dname);
+    if (dir_fd == -1) return -1;
+    /* Some filesystems refuse fsync() on directories, that's fine. */
+    if (fsync(dir_fd) == -1 && errno != EBADF && errno != EINVAL) retval = -1;
+    close(dir_fd);
+    return retval;
+}
+
 #ifdef UTIL_TEST_MAIN
 #include <assert.h>
 
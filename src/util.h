@@ -41,5 +41,8 @@ int string2l(const char *s, size_t slen, long *value);
 int d2string(char *buf, size_t len, double value);
 sds getAbsolutePath(char *filename);
 int pathIsBaseName(char *path);
+int dirCreateIfMissing(char *dname);
+sds makePath(char *path, char *filename);
+int fsyncFileDir(const char *filename);
 
 #endif
@@ -28,6 +28,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -40,7 +41,10 @@ void zlibc_free(void *ptr) {
 }
 
 #include <string.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "config.h"
 #include "zmalloc.h"
 
@@ -65,6 +69,8 @@ void zlibc_free(void *ptr) {
 #define calloc(count,size) je_calloc(count,size)
 #define realloc(ptr,size) je_realloc(ptr,size)
 #define free(ptr) je_free(ptr)
+#define mallocx(size,flags) je_mallocx(size,flags)
+#define dallocx(ptr,flags) je_dallocx(ptr,flags)
 #endif
 
 #ifdef HAVE_ATOMIC
@@ -87,11 +93,12 @@ void zlibc_free(void *ptr) {
 
 #define update_zmalloc_stat_alloc(__n) do { \
     size_t _n = (__n); \
+    zmalloc_thread_alloc_count++; \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
     if (zmalloc_thread_safe) { \
-        update_zmalloc_stat_add(_n); \
+        zmalloc_thread_stat_add(_n); \
     } else { \
-        used_memory += _n; \
+        used_memory_slots[0].used += _n; \
     } \
 } while(0)
 
@@ -99,16 +106,111 @@ void zlibc_free(void *ptr) {
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
     if (zmalloc_thread_safe) { \
-        update_zmalloc_stat_sub(_n); \
+        zmalloc_thread_stat_sub(_n); \
     } else { \
-        used_memory -= _n; \
+        used_memory_slots[0].used -= _n; \
     } \
 } while(0)
 
-static size_t used_memory = 0;
+/* Per thread memory accounting.
+ *
+ * Every thread owns a counter in used_memory_slots[], padded to a cache line,
+ * and is the only writer of it, so allocating never needs an atomic operation
+ * or a lock and threads don't bounce the same cache line between cores.
+ * zmalloc_used_memory() sums all the counters on read. A single counter may
+ * wrap "below zero" when a thread frees memory allocated by another one: the
+ * counters are unsigned and only their sum is meaningful.
+ *
+ * The main thread always uses slot 0, other threads get a slot the first time
+ * they allocate and give it back when they exit, folding their balance into
+ * the shared used_memory counter. Threads that can't find a free slot update
+ * used_memory directly, with the old atomic / mutex protected path.
+ *
+ * 每个线程只写自己那一格计数器，读的时候再求和，分配路径上没有原子操作。 */
+#define ZMALLOC_MAX_THREADS 64
+#define ZMALLOC_CACHE_LINE 64
+#define ZMALLOC_SLOT_NONE (-1)              /* Not registered yet. */
+#define ZMALLOC_SLOT_SHARED ZMALLOC_MAX_THREADS /* Use used_memory. */
+
+typedef struct zmallocThreadCounter {
+    volatile size_t used;
+    char pad[ZMALLOC_CACHE_LINE-sizeof(size_t)];
+} zmallocThreadCounter;
+
+static zmallocThreadCounter used_memory_slots[ZMALLOC_MAX_THREADS];
+static int used_memory_slot_taken[ZMALLOC_MAX_THREADS];
+static __thread int zmalloc_thread_slot = ZMALLOC_SLOT_NONE;
+/* Allocations done by this thread, see zmalloc_thread_allocs(). */
+static __thread size_t zmalloc_thread_alloc_count = 0;
+static pthread_key_t zmalloc_thread_key;
+
+static size_t used_memory = 0;  /* Shared counter, see above. */
 static int zmalloc_thread_safe = 0;
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Called by pthread when a thread that owns a slot exits. */
+static void zmalloc_thread_release_slot(void *arg) {
+    int slot = zmalloc_thread_slot;
+    size_t balance;
+
+    ((void) arg);
+    if (slot == ZMALLOC_SLOT_NONE || slot == ZMALLOC_SLOT_SHARED) return;
+
+    /* From now on this thread (other destructors may still free memory)
+     * uses the shared counter. */
+    zmalloc_thread_slot = ZMALLOC_SLOT_SHARED;
+    pthread_mutex_lock(&used_memory_mutex);
+    balance = used_memory_slots[slot].used;
+    used_memory_slots[slot].used = 0;
+    used_memory_slot_taken[slot] = 0;
+    pthread_mutex_unlock(&used_memory_mutex);
+    update_zmalloc_stat_add(balance);
+}
+
+/* Assign a counter slot to the calling thread. Only called the first time a
+ * thread allocates or frees, so taking the mutex here is fine. */
+static int zmalloc_thread_register(void) {
+    int j, slot = ZMALLOC_SLOT_SHARED;
+
+    pthread_mutex_lock(&used_memory_mutex);
+    for (j = 1; j < ZMALLOC_MAX_THREADS; j++) {
+        if (!used_memory_slot_taken[j]) {
+            used_memory_slot_taken[j] = 1;
+            slot = j;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&used_memory_mutex);
+
+    zmalloc_thread_slot = slot;
+    /* Any non NULL value makes pthread call the destructor on exit. */
+    if (slot != ZMALLOC_SLOT_SHARED)
+        pthread_setspecific(zmalloc_thread_key,(void*)1);
+    return slot;
+}
+
+static inline void zmalloc_thread_stat_add(size_t n) {
+    int slot = zmalloc_thread_slot;
+
+    if (slot == ZMALLOC_SLOT_NONE) slot = zmalloc_thread_register();
+    if (slot != ZMALLOC_SLOT_SHARED) {
+        used_memory_slots[slot].used += n;
+    } else {
+        update_zmalloc_stat_add(n);
+    }
+}
+
+static inline void zmalloc_thread_stat_sub(size_t n) {
+    int slot = zmalloc_thread_slot;
+
+    if (slot == ZMALLOC_SLOT_NONE) slot = zmalloc_thread_register();
+    if (slot != ZMALLOC_SLOT_SHARED) {
+        used_memory_slots[slot].used -= n;
+    } else {
+        update_zmalloc_stat_sub(n);
+    }
+}
+
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
         size);
@@ -207,6 +309,24 @@ void zfree(void *ptr) {
 #endif
 }
 
+/* Allocation and free functions that bypass the thread cache
+ * and go straight to the allocator arena bins.
+ * Currently implemented only for jemalloc. Used for online defragmentation. */
+#ifdef HAVE_DEFRAG
+void *zmalloc_no_tcache(size_t size) {
+    void *ptr = mallocx(size+PREFIX_SIZE, MALLOCX_TCACHE_NONE);
+    if (!ptr) zmalloc_oom_handler(size);
+    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    return ptr;
+}
+
+void zfree_no_tcache(void *ptr) {
+    if (ptr == NULL) return;
+    update_zmalloc_stat_free(zmalloc_size(ptr));
+    dallocx(ptr, MALLOCX_TCACHE_NONE);
+}
+#endif
+
 char *zstrdup(const char *s) {
     size_t l = strlen(s)+1;
     char *p = zmalloc(l);
@@ -215,8 +335,15 @@ char *zstrdup(const char *s) {
     return p;
 }
 
+/* Number of zmalloc / zcalloc / zrealloc calls done so far by the calling
+ * thread. Used by the microbenchmarks to report allocations per operation. */
+size_t zmalloc_thread_allocs(void) {
+    return zmalloc_thread_alloc_count;
+}
+
 size_t zmalloc_used_memory(void) {
-    size_t um;
+    size_t um = 0;
+    int j;
 
     if (zmalloc_thread_safe) {
 #ifdef HAVE_ATOMIC
@@ -226,15 +353,25 @@ size_t zmalloc_used_memory(void) {
         um = used_memory;
         pthread_mutex_unlock(&used_memory_mutex);
 #endif
+        /* The sum is not a snapshot: other threads keep allocating while we
+         * read, exactly like with a single shared counter. */
+        for (j = 0; j < ZMALLOC_MAX_THREADS; j++)
+            um += used_memory_slots[j].used;
     }
     else {
-        um = used_memory;
+        um = used_memory + used_memory_slots[0].used;
     }
 
     return um;
 }
 
+/* Must be called by the main thread before creating other threads: the
+ * calling thread keeps slot 0, that is what it used so far. */
 void zmalloc_enable_thread_safeness(void) {
+    if (zmalloc_thread_safe) return;
+    pthread_key_create(&zmalloc_thread_key,zmalloc_thread_release_slot);
+    used_memory_slot_taken[0] = 1;
+    zmalloc_thread_slot = 0;
     zmalloc_thread_safe = 1;
 }
 
@@ -325,27 +462,108 @@ float zmalloc_get_fragmentation_ratio(size_t rss) {
     return (float)rss/zmalloc_used_memory();
 }
 
+/* Get the sum of the specified field (converted form kb to bytes) in
+ * /proc/self/smaps. The field must be specified with trailing ":" as it
+ * apperas in the smaps output.
+ *
+ * Example: zmalloc_get_smap_bytes_by_field("Rss:");
+ */
 #if defined(HAVE_PROC_SMAPS)
-size_t zmalloc_get_private_dirty(void) {
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
     char line[1024];
-    size_t pd = 0;
+    size_t bytes = 0;
     FILE *fp = fopen("/proc/self/smaps","r");
+    int flen = strlen(field);
 
     if (!fp) return 0;
     while(fgets(line,sizeof(line),fp) != NULL) {
-        if (strncmp(line,"Private_Dirty:",14) == 0) {
+        if (strncmp(line,field,flen) == 0) {
             char *p = strchr(line,'k');
             if (p) {
                 *p = '\0';
-                pd += strtol(line+14,NULL,10) * 1024;
+                bytes += strtol(line+flen,NULL,10) * 1024;
             }
         }
     }
     fclose(fp);
-    return pd;
+    return bytes;
 }
 #else
-size_t zmalloc_get_private_dirty(void) {
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
+    ((void) field);
     return 0;
 }
 #endif
+
+/* Fill the allocator statistics: 'allocated' is the number of bytes
+ * handed to the application, 'active' the bytes in the pages holding them
+ * (so active - allocated is the internal fragmentation) and 'resident' the
+ * bytes physically mapped by the allocator. Returns 0 when the allocator
+ * can't report them, in which case all the values are set to zero. */
+#if defined(USE_JEMALLOC)
+int zmalloc_get_allocator_info(size_t *allocated,
+                               size_t *active,
+                               size_t *resident) {
+    uint64_t epoch = 1;
+    size_t sz;
+
+    *allocated = *resident = *active = 0;
+    /* Update the statistics cached by mallctl. */
+    sz = sizeof(epoch);
+    je_mallctl("epoch", &epoch, &sz, &epoch, sz);
+    sz = sizeof(size_t);
+    /* Unlike RSS, this does not include RSS from shared libraries and other
+     * non heap mappings. */
+    je_mallctl("stats.resident", resident, &sz, NULL, 0);
+    /* Unlike resident, this doesn't not include the pages jemalloc reserves
+     * for re-use (purge will clean that). */
+    je_mallctl("stats.active", active, &sz, NULL, 0);
+    /* Unlike zmalloc_used_memory, this matches the stats.resident by taking
+     * into account all allocations done by this process (not only zmalloc). */
+    je_mallctl("stats.allocated", allocated, &sz, NULL, 0);
+    return 1;
+}
+#else
+int zmalloc_get_allocator_info(size_t *allocated,
+                               size_t *active,
+                               size_t *resident) {
+    *allocated = *resident = *active = 0;
+    return 0;
+}
+#endif
+
+size_t zmalloc_get_private_dirty(void) {
+    return zmalloc_get_smap_bytes_by_field("Private_Dirty:");
+}
+
+/* Give back to the kernel the pages fully covered by the allocation 'ptr'.
+ * Used by a fork child for the values it already saved: once the child
+ * dropped its mapping the page is no longer shared, so a write of the
+ * parent doesn't trigger a copy-on-write. The content of the pages is lost
+ * for this process, so it must never be accessed again.
+ *
+ * Only done with jemalloc, whose metadata never lives inside the pages of
+ * a large allocation; returns the number of bytes given back. */
+size_t zmadvise_dontneed(void *ptr) {
+#ifdef HAVE_ZMADVISE_DONTNEED
+    static size_t page_size = 0;
+    size_t mask, real_size;
+    char *aligned;
+
+    if (page_size == 0) page_size = sysconf(_SC_PAGESIZE);
+    mask = page_size-1;
+    real_size = zmalloc_size(ptr);
+    if (real_size < page_size) return 0;
+
+    /* Only the pages completely inside the allocation. */
+    aligned = (char*)(((uintptr_t)ptr+mask) & ~mask);
+    real_size -= aligned-(char*)ptr;
+    real_size &= ~mask;
+    if (real_size == 0) return 0;
+    if (madvise(aligned,real_size,MADV_DONTNEED) == -1) return 0;
+    return real_size;
+#else
+    ((void) ptr);
+    return 0;
+#endif
+}
@@ -65,19 +65,40 @@
 #define ZMALLOC_LIB "libc"
 #endif
 
+/* zmadvise_dontneed() can give pages back only with jemalloc on Linux. */
+#if defined(USE_JEMALLOC) && defined(__linux__)
+#define HAVE_ZMADVISE_DONTNEED 1
+#endif
+
+/* We can enable the Redis defrag capabilities only if we are using Jemalloc
+ * and the version used is our special version modified for Redis having
+ * the ability to return per-allocation fragmentation hints. */
+#if defined(USE_JEMALLOC) && defined(JEMALLOC_FRAG_HINT)
+#define HAVE_DEFRAG
+#endif
+
 void *zmalloc(size_t size);
 void *zcalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
+size_t zmalloc_thread_allocs(void);
 void zmalloc_enable_thread_safeness(void);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
 float zmalloc_get_fragmentation_ratio(size_t rss);
 size_t zmalloc_get_rss(void);
 size_t zmalloc_get_private_dirty(void);
+size_t zmadvise_dontneed(void *ptr);
+size_t zmalloc_get_smap_bytes_by_field(char *field);
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident);
 void zlibc_free(void *ptr);
 
+#ifdef HAVE_DEFRAG
+void zfree_no_tcache(void *ptr);
+void *zmalloc_no_tcache(size_t size);
+#endif
+
 #ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
 #endif